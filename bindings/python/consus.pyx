@@ -30,6 +30,11 @@ import calendar
 import json
 import time
 
+try:
+    import asyncio
+except ImportError:
+    asyncio = None
+
 
 cdef extern from "stdint.h":
 
@@ -56,6 +61,8 @@ cdef extern from "consus.h":
         CONSUS_NOT_FOUND     = 6658
         CONSUS_ABORTED       = 6659
         CONSUS_COMMITTED     = 6660
+        CONSUS_SCAN_DONE     = 6661
+        CONSUS_COMPARE_FAILED = 6662
         CONSUS_UNKNOWN_TABLE = 6720
         CONSUS_NONE_PENDING  = 6721
         CONSUS_INVALID       = 6722
@@ -65,6 +72,7 @@ cdef extern from "consus.h":
         CONSUS_COORD_FAIL    = 6787
         CONSUS_UNAVAILABLE   = 6788
         CONSUS_SERVER_ERROR  = 6789
+        CONSUS_BUSY          = 6790
         CONSUS_INTERNAL      = 6910
         CONSUS_GARBAGE       = 6911
 
@@ -73,12 +81,16 @@ cdef extern from "consus.h":
     consus_client* consus_create(const char* coordinator, uint16_t port)
     consus_client* consus_create_conn_str(const char* conn_str)
     void consus_destroy(consus_client* client)
+    void consus_threadsafe(consus_client* client)
     int64_t consus_loop(consus_client* client, int timeout,
-                        consus_returncode* status)
+                        consus_returncode* status) nogil
     int64_t consus_wait(consus_client* client, int64_t x, int timeout,
-                        consus_returncode* status)
+                        consus_returncode* status) nogil
+    int64_t consus_loop_many(consus_client* client, int timeout,
+                             int64_t* ids, consus_returncode* statuses,
+                             size_t ids_sz, consus_returncode* status) nogil
     int consus_poll_fd(consus_client* client)
-    int consus_block(consus_client* client, int timeout)
+    int consus_block(consus_client* client, int timeout) nogil
     const char* consus_error_message(consus_client* client)
     const char* consus_error_location(consus_client* client)
     const char* consus_returncode_to_string(consus_returncode)
@@ -87,6 +99,29 @@ cdef extern from "consus.h":
     int64_t consus_abort_transaction(consus_transaction* xact, consus_returncode* status)
     int64_t consus_restart_transaction(consus_transaction* xact, consus_returncode* status)
     void consus_destroy_transaction(consus_transaction* xact)
+    void consus_buffer_writes(consus_transaction* xact)
+    int64_t consus_stale_get(consus_client* client,
+                             const char* table,
+                             const char* key, size_t key_sz,
+                             uint64_t timestamp,
+                             consus_returncode* status,
+                             char** value, size_t* value_sz)
+    int64_t consus_single_get(consus_client* client,
+                              const char* table,
+                              const char* key, size_t key_sz,
+                              consus_returncode* status,
+                              char** value, size_t* value_sz)
+    int64_t consus_single_put(consus_client* client,
+                              const char* table,
+                              const char* key, size_t key_sz,
+                              const char* value, size_t value_sz,
+                              consus_returncode* status)
+    int64_t consus_single_cas(consus_client* client,
+                              const char* table,
+                              const char* key, size_t key_sz,
+                              const char* expected, size_t expected_sz,
+                              const char* value, size_t value_sz,
+                              consus_returncode* status)
 
     int64_t consus_get(consus_transaction* xact,
                        const char* table,
@@ -98,6 +133,39 @@ cdef extern from "consus.h":
                        const char* key, size_t key_sz,
                        const char* value, size_t value_sz,
                        consus_returncode* status)
+    int64_t consus_get_bin(consus_transaction* xact,
+                           const char* table,
+                           const char* key, size_t key_sz,
+                           consus_returncode* status,
+                           char** value, size_t* value_sz)
+    int64_t consus_put_bin(consus_transaction* xact,
+                           const char* table,
+                           const char* key, size_t key_sz,
+                           const char* value, size_t value_sz,
+                           consus_returncode* status)
+    int64_t consus_cond_put(consus_transaction* xact,
+                            const char* table,
+                            const char* key, size_t key_sz,
+                            const char* expected, size_t expected_sz,
+                            const char* value, size_t value_sz,
+                            consus_returncode* status)
+    int64_t consus_multi_get(consus_transaction* xact,
+                             const char* table,
+                             const char* const* keys, const size_t* keys_sz, size_t n,
+                             consus_returncode* status,
+                             char** values, size_t* values_sz)
+    int64_t consus_multi_put(consus_transaction* xact,
+                             const char* table,
+                             const char* const* keys, const size_t* keys_sz,
+                             const char* const* values, const size_t* values_sz,
+                             size_t n, consus_returncode* status)
+    int64_t consus_scan(consus_transaction* xact,
+                        const char* table,
+                        const char* key, size_t key_sz,
+                        uint64_t n,
+                        consus_returncode* status,
+                        char** key_out, size_t* key_out_sz,
+                        char** value, size_t* value_sz)
 
 
 class ConsusException(Exception):
@@ -137,6 +205,7 @@ class ConsusSeeErrnoException(ConsusException): pass
 class ConsusCoordFailException(ConsusException): pass
 class ConsusUnavailableException(ConsusException): pass
 class ConsusServerErrorException(ConsusException): pass
+class ConsusBusyException(ConsusException): pass
 class ConsusInternalException(ConsusException): pass
 class ConsusGarbageException(ConsusException): pass
 
@@ -159,6 +228,9 @@ cdef class Client:
         if not isinstance(conn_str, bytes):
             conn_str = conn_str.encode('ascii')
         self.client = consus_create_conn_str(conn_str)
+        # lets finish release the GIL while other threads use the client
+        if self.client:
+            consus_threadsafe(self.client)
 
     def __dealloc__(self):
         if self.client:
@@ -167,18 +239,96 @@ cdef class Client:
     def begin_transaction(self):
         return Transaction(self)
 
+    def stale_get(self, str table, key, timestamp=None):
+        cdef bytes tmp = table.encode('ascii')
+        cdef bytes jkey = json.dumps(key).encode('utf8')
+        cdef consus_returncode status
+        cdef const char* t = tmp
+        cdef const char* k = jkey
+        cdef size_t k_sz = len(jkey)
+        cdef uint64_t ts = 0xffffffffffffffff
+        cdef char* value = NULL
+        cdef size_t value_sz = 0
+        if timestamp is not None:
+            ts = timestamp
+        req = consus_stale_get(self.client, t, k, k_sz, ts, &status, &value, &value_sz)
+        self.finish(req, &status)
+        if status == CONSUS_SUCCESS:
+            x = json.loads(value[:value_sz].decode('utf8'))
+            free(value)
+            return x
+        else:
+            return None
+
+    def single_get(self, str table, key):
+        cdef bytes tmp = table.encode('ascii')
+        cdef bytes jkey = json.dumps(key).encode('utf8')
+        cdef consus_returncode status
+        cdef const char* t = tmp
+        cdef const char* k = jkey
+        cdef size_t k_sz = len(jkey)
+        cdef char* value = NULL
+        cdef size_t value_sz = 0
+        req = consus_single_get(self.client, t, k, k_sz, &status, &value, &value_sz)
+        self.finish(req, &status)
+        if status == CONSUS_SUCCESS:
+            x = json.loads(value[:value_sz].decode('utf8'))
+            free(value)
+            return x
+        else:
+            return None
+
+    def single_put(self, str table, key, value):
+        cdef bytes tmp = table.encode('ascii')
+        cdef bytes jkey = json.dumps(key).encode('utf8')
+        cdef bytes jvalue = json.dumps(value).encode('utf8')
+        cdef consus_returncode status
+        cdef const char* t = tmp
+        cdef const char* k = jkey
+        cdef size_t k_sz = len(jkey)
+        cdef const char* v = jvalue
+        cdef size_t v_sz = len(jvalue)
+        req = consus_single_put(self.client, t, k, k_sz, v, v_sz, &status)
+        self.finish(req, &status)
+        return status == CONSUS_SUCCESS
+
+    def single_cas(self, str table, key, expected, value):
+        cdef bytes tmp = table.encode('ascii')
+        cdef bytes jkey = json.dumps(key).encode('utf8')
+        cdef bytes jexpected = json.dumps(expected).encode('utf8')
+        cdef bytes jvalue = json.dumps(value).encode('utf8')
+        cdef consus_returncode status
+        cdef const char* t = tmp
+        cdef const char* k = jkey
+        cdef size_t k_sz = len(jkey)
+        cdef const char* e = NULL
+        cdef size_t e_sz = 0
+        cdef const char* v = jvalue
+        cdef size_t v_sz = len(jvalue)
+        if expected is not None:
+            e = jexpected
+            e_sz = len(jexpected)
+        req = consus_single_cas(self.client, t, k, k_sz, e, e_sz, v, v_sz, &status)
+        self.finish(req, &status)
+        return status == CONSUS_SUCCESS
+
     cdef finish(self, int64_t req, consus_returncode* rstatus):
         cdef consus_returncode lstatus
+        cdef int64_t lid
         if req < 0:
             self.throw_exception(rstatus[0])
-        lid = consus_wait(self.client, req, -1, &lstatus)
+        with nogil:
+            lid = consus_wait(self.client, req, -1, &lstatus)
         if lid < 0:
             self.throw_exception(lstatus)
         assert req == lid
-        if rstatus[0] != CONSUS_SUCCESS and rstatus[0] != CONSUS_NOT_FOUND and rstatus[0] != CONSUS_LESS_DURABLE:
+        if rstatus[0] != CONSUS_SUCCESS and rstatus[0] != CONSUS_NOT_FOUND and rstatus[0] != CONSUS_LESS_DURABLE and rstatus[0] != CONSUS_COMPARE_FAILED:
             self.throw_exception(rstatus[0])
 
     cdef throw_exception(self, consus_returncode status):
+        raise self.exception(status)
+
+    cdef exception(self, consus_returncode status):
         exception = {CONSUS_LESS_DURABLE: ConsusLessDurableException,
                      CONSUS_NOT_FOUND: ConsusNotFoundException,
                      CONSUS_ABORTED: ConsusAbortedException,
@@ -192,9 +342,10 @@ cdef class Client:
                      CONSUS_COORD_FAIL: ConsusCoordFailException,
                      CONSUS_UNAVAILABLE: ConsusUnavailableException,
                      CONSUS_SERVER_ERROR: ConsusServerErrorException,
+                     CONSUS_BUSY: ConsusBusyException,
                      CONSUS_INTERNAL: ConsusInternalException,
                      CONSUS_GARBAGE: ConsusGarbageException}.get(status, ConsusInternalException)
-        raise exception(status, consus_error_message(self.client).decode('ascii', 'ignore'))
+        return exception(status, consus_error_message(self.client).decode('ascii', 'ignore'))
 
 
 cdef class Transaction:
@@ -244,6 +395,133 @@ cdef class Transaction:
         self.finish(req, &status)
         return True
 
+    def cond_put(self, str table, key, expected, value):
+        cdef bytes tmp = table.encode('ascii')
+        cdef bytes jkey = json.dumps(key).encode('utf8')
+        cdef bytes jexpected = json.dumps(expected).encode('utf8')
+        cdef bytes jvalue = json.dumps(value).encode('utf8')
+        cdef consus_returncode status
+        cdef const char* t = tmp
+        cdef const char* k = jkey
+        cdef size_t k_sz = len(jkey)
+        cdef const char* e = NULL
+        cdef size_t e_sz = 0
+        cdef const char* v = jvalue
+        cdef size_t v_sz = len(jvalue)
+        if expected is not None:
+            e = jexpected
+            e_sz = len(jexpected)
+        req = consus_cond_put(self.xact, t, k, k_sz, e, e_sz, v, v_sz, &status)
+        self.finish(req, &status)
+        return status == CONSUS_SUCCESS
+
+    def multi_get(self, str table, keys):
+        cdef bytes tmp = table.encode('ascii')
+        cdef list jkeys = [json.dumps(k).encode('utf8') for k in keys]
+        cdef bytes jkey
+        cdef consus_returncode status
+        cdef const char* t = tmp
+        cdef size_t n = len(jkeys)
+        cdef size_t i
+        cdef const char** ks = <const char**>malloc(n * sizeof(const char*))
+        cdef size_t* ks_sz = <size_t*>malloc(n * sizeof(size_t))
+        cdef char** vs = <char**>malloc(n * sizeof(char*))
+        cdef size_t* vs_sz = <size_t*>malloc(n * sizeof(size_t))
+        try:
+            for i in range(n):
+                jkey = jkeys[i]
+                ks[i] = jkey
+                ks_sz[i] = len(jkey)
+                vs[i] = NULL
+                vs_sz[i] = 0
+            req = consus_multi_get(self.xact, t, ks, ks_sz, n, &status, vs, vs_sz)
+            self.finish(req, &status)
+            values = []
+            for i in range(n):
+                if vs[i] == NULL:
+                    values.append(None)
+                else:
+                    values.append(json.loads(vs[i][:vs_sz[i]].decode('utf8')))
+            return values
+        finally:
+            for i in range(n):
+                if vs[i] != NULL:
+                    free(vs[i])
+            free(ks)
+            free(ks_sz)
+            free(vs)
+            free(vs_sz)
+
+    def multi_put(self, str table, items):
+        cdef list pairs = list(items.items() if isinstance(items, dict) else items)
+        cdef bytes tmp = table.encode('ascii')
+        cdef list jkeys = [json.dumps(k).encode('utf8') for k, v in pairs]
+        cdef list jvalues = [json.dumps(v).encode('utf8') for k, v in pairs]
+        cdef bytes jkey
+        cdef bytes jvalue
+        cdef consus_returncode status
+        cdef const char* t = tmp
+        cdef size_t n = len(jkeys)
+        cdef size_t i
+        cdef const char** ks = <const char**>malloc(n * sizeof(const char*))
+        cdef size_t* ks_sz = <size_t*>malloc(n * sizeof(size_t))
+        cdef const char** vs = <const char**>malloc(n * sizeof(const char*))
+        cdef size_t* vs_sz = <size_t*>malloc(n * sizeof(size_t))
+        try:
+            for i in range(n):
+                jkey = jkeys[i]
+                jvalue = jvalues[i]
+                ks[i] = jkey
+                ks_sz[i] = len(jkey)
+                vs[i] = jvalue
+                vs_sz[i] = len(jvalue)
+            req = consus_multi_put(self.xact, t, ks, ks_sz, vs, vs_sz, n, &status)
+            self.finish(req, &status)
+            return True
+        finally:
+            free(ks)
+            free(ks_sz)
+            free(vs)
+            free(vs_sz)
+
+    def scan(self, str table, key, uint64_t n):
+        cdef bytes tmp = table.encode('ascii')
+        cdef bytes jkey = json.dumps(key).encode('utf8')
+        cdef consus_returncode status
+        cdef consus_returncode lstatus
+        cdef const char* t = tmp
+        cdef const char* k = jkey
+        cdef size_t k_sz = len(jkey)
+        cdef char* key_out = NULL
+        cdef size_t key_out_sz = 0
+        cdef char* value = NULL
+        cdef size_t value_sz = 0
+        cdef int64_t lid
+        req = consus_scan(self.xact, t, k, k_sz, n, &status,
+                          &key_out, &key_out_sz, &value, &value_sz)
+        if req < 0:
+            self.client.throw_exception(status)
+        # the scan returns once per key and then once more with SCAN_DONE
+        items = []
+        while True:
+            with nogil:
+                lid = consus_wait(self.client.client, req, -1, &lstatus)
+            if lid < 0:
+                self.client.throw_exception(lstatus)
+            assert req == lid
+            if status != CONSUS_SUCCESS:
+                break
+            items.append((json.loads(key_out[:key_out_sz].decode('utf8')),
+                          json.loads(value[:value_sz].decode('utf8'))))
+            free(key_out)
+            free(value)
+        if status != CONSUS_SCAN_DONE:
+            self.client.throw_exception(status)
+        return items
+
+    def buffer_writes(self):
+        consus_buffer_writes(self.xact)
+
     def commit(self):
         cdef consus_returncode status
         req = consus_commit_transaction(self.xact, &status)
@@ -256,3 +534,171 @@ cdef class Transaction:
 
     cdef finish(self, int64_t req, consus_returncode* rstatus):
         return self.client.finish(req, rstatus)
+
+
+# The asyncio interface.  Keys and values are bytes-like objects passed to the
+# client through the buffer protocol without copying or JSON encoding; they
+# are held until their operation completes.  Every call returns a future, and
+# completions are collected in batches whenever the client's descriptor is
+# readable, so one interpreter may have any number of transactions and
+# operations in flight.
+
+cdef enum:
+    ASYNC_BATCH = 64
+
+cdef enum async_op_kind:
+    ASYNC_OP_BEGIN
+    ASYNC_OP_GET
+    ASYNC_OP_OTHER
+
+
+cdef const char* buffer_ptr(const unsigned char[:] buf):
+    if buf.shape[0] == 0:
+        return b''
+    return <const char*>&buf[0]
+
+
+cdef class AsyncOp:
+    cdef async_op_kind kind
+    cdef consus_returncode status
+    cdef char* value
+    cdef size_t value_sz
+    cdef object future
+    cdef object keep
+
+    def __dealloc__(self):
+        if self.value:
+            free(self.value)
+
+
+cdef class AsyncClient:
+    cdef Client client
+    cdef object loop
+    cdef dict ops
+    cdef bint drain_scheduled
+    cdef int fd
+
+    def __init__(self, *args, loop=None):
+        self.client = Client(*args)
+        self.loop = loop if loop is not None else asyncio.get_event_loop()
+        self.ops = {}
+        self.drain_scheduled = False
+        self.fd = consus_poll_fd(self.client.client)
+        self.loop.add_reader(self.fd, self.drain)
+
+    def close(self):
+        if self.fd >= 0:
+            self.loop.remove_reader(self.fd)
+            self.fd = -1
+
+    def begin_transaction(self):
+        cdef AsyncTransaction xact = AsyncTransaction.__new__(AsyncTransaction)
+        cdef AsyncOp op = self.op(ASYNC_OP_BEGIN, xact)
+        xact.client = self
+        req = consus_begin_transaction(self.client.client, &op.status, &xact.xact)
+        return self.submit(req, op)
+
+    def drain(self):
+        cdef int64_t ids[ASYNC_BATCH]
+        cdef consus_returncode statuses[ASYNC_BATCH]
+        cdef consus_returncode status
+        cdef int64_t n = ASYNC_BATCH
+        cdef int64_t i
+        self.drain_scheduled = False
+        while n == ASYNC_BATCH:
+            with nogil:
+                n = consus_loop_many(self.client.client, 0, ids, statuses, ASYNC_BATCH, &status)
+            if n < 0:
+                if status != CONSUS_TIMEOUT and status != CONSUS_NONE_PENDING:
+                    self.fail_all(status)
+                return
+            for i in range(n):
+                op = self.ops.pop(ids[i], None)
+                if op is not None:
+                    self.complete(op)
+
+    cdef AsyncOp op(self, async_op_kind kind, keep):
+        cdef AsyncOp op = AsyncOp()
+        op.kind = kind
+        op.status = CONSUS_GARBAGE
+        op.value = NULL
+        op.value_sz = 0
+        op.future = self.loop.create_future()
+        op.keep = keep
+        return op
+
+    cdef submit(self, int64_t req, AsyncOp op):
+        if req < 0:
+            op.future.set_exception(self.client.exception(op.status))
+            return op.future
+        self.ops[req] = op
+        # some operations complete without a message, so look right away
+        if not self.drain_scheduled:
+            self.drain_scheduled = True
+            self.loop.call_soon(self.drain)
+        return op.future
+
+    cdef complete(self, AsyncOp op):
+        if op.future.cancelled():
+            return
+        if op.status == CONSUS_SUCCESS or op.status == CONSUS_LESS_DURABLE:
+            if op.kind == ASYNC_OP_BEGIN:
+                op.future.set_result(op.keep)
+            elif op.kind == ASYNC_OP_GET:
+                op.future.set_result(op.value[:op.value_sz])
+            else:
+                op.future.set_result(None)
+        elif op.status == CONSUS_NOT_FOUND and op.kind == ASYNC_OP_GET:
+            op.future.set_result(None)
+        else:
+            op.future.set_exception(self.client.exception(op.status))
+
+    cdef fail_all(self, consus_returncode status):
+        cdef AsyncOp op
+        ops = self.ops
+        self.ops = {}
+        for op in ops.values():
+            if not op.future.cancelled():
+                op.future.set_exception(self.client.exception(status))
+
+
+cdef class AsyncTransaction:
+    cdef AsyncClient client
+    cdef consus_transaction* xact
+
+    def __dealloc__(self):
+        if self.xact:
+            consus_destroy_transaction(self.xact)
+
+    def get(self, str table, const unsigned char[:] key):
+        cdef bytes t = table.encode('ascii')
+        cdef AsyncOp op = self.client.op(ASYNC_OP_GET, (t, key))
+        req = consus_get_bin(self.xact, t, buffer_ptr(key), key.shape[0],
+                             &op.status, &op.value, &op.value_sz)
+        return self.client.submit(req, op)
+
+    def put(self, str table, const unsigned char[:] key, const unsigned char[:] value):
+        cdef bytes t = table.encode('ascii')
+        cdef AsyncOp op = self.client.op(ASYNC_OP_OTHER, (t, key, value))
+        req = consus_put_bin(self.xact, t, buffer_ptr(key), key.shape[0],
+                             buffer_ptr(value), value.shape[0], &op.status)
+        return self.client.submit(req, op)
+
+    def multi_get(self, str table, keys):
+        # every read is in flight at once; the values come back in order
+        return asyncio.gather(*[self.get(table, k) for k in keys])
+
+    def multi_put(self, str table, items):
+        if isinstance(items, dict):
+            items = items.items()
+        return asyncio.gather(*[self.put(table, k, v) for k, v in items])
+
+    def commit(self):
+        cdef AsyncOp op = self.client.op(ASYNC_OP_OTHER, None)
+        req = consus_commit_transaction(self.xact, &op.status)
+        return self.client.submit(req, op)
+
+    def abort(self):
+        cdef AsyncOp op = self.client.op(ASYNC_OP_OTHER, None)
+        req = consus_abort_transaction(self.xact, &op.status)
+        return self.client.submit(req, op)
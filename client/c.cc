@@ -37,6 +37,9 @@
 // e
 #include <e/guard.h>
 
+// po6
+#include <po6/time.h>
+
 // consus
 #include <consus.h>
 #include "visibility.h"
@@ -44,6 +47,10 @@
 #include "client/client.h"
 #include "client/transaction.h"
 
+// bounds on the pause consus_run_transaction takes between attempts
+#define RUN_BACKOFF_MIN (PO6_MILLIS * 1)
+#define RUN_BACKOFF_MAX (PO6_MILLIS * 256)
+
 #define FAKE_STATUS consus_returncode _status; consus_returncode* status = &_status
 
 #define SIGNAL_PROTECT_ERR(X) \
@@ -64,6 +71,7 @@ inline void return_void() {}
 #define C_WRAP_EXCEPT(X) \
     consus::client* cl = reinterpret_cast<consus::client*>(client); \
     SIGNAL_PROTECT; \
+    po6::threads::mutex::hold hold(cl->mutex()); \
     try \
     { \
         X \
@@ -86,6 +94,7 @@ inline void return_void() {}
     consus::transaction* tx = reinterpret_cast<consus::transaction*>(xact); \
     consus::client* cl = tx->parent(); \
     SIGNAL_PROTECT; \
+    po6::threads::mutex::hold hold(cl->mutex()); \
     try \
     { \
         X \
@@ -151,12 +160,50 @@ consus_create_conn_str(const char* conn_str)
     }
 }
 
+CONSUS_API consus_client*
+consus_create_via_proxy(const char* conn_str, const char* proxy_host, uint16_t proxy_port)
+{
+    FAKE_STATUS;
+    SIGNAL_PROTECT_ERR(NULL);
+
+    try
+    {
+        return reinterpret_cast<struct consus_client*>(new consus::client(conn_str, proxy_host, proxy_port));
+    }
+    catch (std::bad_alloc& ba)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    catch (...)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+}
+
 CONSUS_API void
 consus_destroy(consus_client* client)
 {
     delete reinterpret_cast<consus::client*>(client);
 }
 
+CONSUS_API void
+consus_threadsafe(consus_client* client)
+{
+    consus::client* cl = reinterpret_cast<consus::client*>(client);
+    po6::threads::mutex::hold hold(cl->mutex());
+    cl->threadsafe();
+}
+
+CONSUS_API void
+consus_hedge_reads(consus_client* client, unsigned percentile)
+{
+    consus::client* cl = reinterpret_cast<consus::client*>(client);
+    po6::threads::mutex::hold hold(cl->mutex());
+    cl->hedge_reads(percentile);
+}
+
 CONSUS_API int64_t
 consus_loop(consus_client* client, int timeout, consus_returncode* status)
 {
@@ -173,12 +220,41 @@ consus_wait(consus_client* client, int64_t id, int timeout, consus_returncode* s
     );
 }
 
+CONSUS_API int64_t
+consus_loop_many(consus_client* client, int timeout,
+                 int64_t* ids, consus_returncode* statuses,
+                 size_t ids_sz, consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->loop_many(timeout, ids, statuses, ids_sz, status);
+    );
+}
+
+CONSUS_API int
+consus_poll_fd(consus_client* client)
+{
+    FAKE_STATUS;
+    C_WRAP_EXCEPT(
+    return cl->poll_fd();
+    );
+}
+
+CONSUS_API int
+consus_block(consus_client* client, int timeout)
+{
+    FAKE_STATUS;
+    C_WRAP_EXCEPT(
+    return cl->block(timeout);
+    );
+}
+
 CONSUS_API const char*
 consus_error_message(consus_client* _cl)
 {
     FAKE_STATUS;
     SIGNAL_PROTECT_ERR(NULL);
     consus::client* cl = reinterpret_cast<consus::client*>(_cl);
+    po6::threads::mutex::hold hold(cl->mutex());
     return cl->error_message();
 }
 
@@ -188,6 +264,7 @@ consus_error_location(consus_client* _cl)
     FAKE_STATUS;
     SIGNAL_PROTECT_ERR(NULL);
     consus::client* cl = reinterpret_cast<consus::client*>(_cl);
+    po6::threads::mutex::hold hold(cl->mutex());
     return cl->error_location();
 }
 
@@ -201,6 +278,8 @@ consus_returncode_to_string(consus_returncode stat)
         CSTRINGIFY(CONSUS_NOT_FOUND);
         CSTRINGIFY(CONSUS_ABORTED);
         CSTRINGIFY(CONSUS_COMMITTED);
+        CSTRINGIFY(CONSUS_SCAN_DONE);
+        CSTRINGIFY(CONSUS_COMPARE_FAILED);
         CSTRINGIFY(CONSUS_UNKNOWN_TABLE);
         CSTRINGIFY(CONSUS_NONE_PENDING);
         CSTRINGIFY(CONSUS_INVALID);
@@ -210,6 +289,7 @@ consus_returncode_to_string(consus_returncode stat)
         CSTRINGIFY(CONSUS_COORD_FAIL);
         CSTRINGIFY(CONSUS_UNAVAILABLE);
         CSTRINGIFY(CONSUS_SERVER_ERROR);
+        CSTRINGIFY(CONSUS_BUSY);
         CSTRINGIFY(CONSUS_INTERNAL);
         CSTRINGIFY(CONSUS_GARBAGE);
         default:
@@ -227,10 +307,82 @@ consus_begin_transaction(consus_client* client,
     );
 }
 
+CONSUS_API int64_t
+consus_begin_transaction_declared(consus_client* client,
+                                  const consus_key_hint* hints,
+                                  size_t hints_sz,
+                                  consus_returncode* status,
+                                  consus_transaction** xact)
+{
+    C_WRAP_EXCEPT(
+    return cl->begin_transaction_declared(hints, hints_sz, status, xact);
+    );
+}
+
+CONSUS_API int64_t
+consus_stale_get(consus_client* client,
+                 const char* table,
+                 const char* key, size_t key_sz,
+                 uint64_t timestamp,
+                 consus_returncode* status,
+                 char** value, size_t* value_sz)
+{
+    C_WRAP_EXCEPT(
+    return cl->stale_get(table, key, key_sz, timestamp, status, value, value_sz);
+    );
+}
+
+CONSUS_API int64_t
+consus_single_get(consus_client* client,
+                  const char* table,
+                  const char* key, size_t key_sz,
+                  consus_returncode* status,
+                  char** value, size_t* value_sz)
+{
+    C_WRAP_EXCEPT(
+    return cl->single_get(table, key, key_sz, status, value, value_sz);
+    );
+}
+
+CONSUS_API int64_t
+consus_single_put(consus_client* client,
+                  const char* table,
+                  const char* key, size_t key_sz,
+                  const char* value, size_t value_sz,
+                  consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->single_put(table, key, key_sz, value, value_sz, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_single_cas(consus_client* client,
+                  const char* table,
+                  const char* key, size_t key_sz,
+                  const char* expected, size_t expected_sz,
+                  const char* value, size_t value_sz,
+                  consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->single_cas(table, key, key_sz, expected, expected_sz, value, value_sz, status);
+    );
+}
+
 CONSUS_API void
 consus_destroy_transaction(consus_transaction* xact)
 {
-    delete reinterpret_cast<consus::transaction*>(xact);
+    consus::transaction* tx = reinterpret_cast<consus::transaction*>(xact);
+    po6::threads::mutex::hold hold(tx->parent()->mutex());
+    delete tx;
+}
+
+CONSUS_API void
+consus_buffer_writes(consus_transaction* xact)
+{
+    consus::transaction* tx = reinterpret_cast<consus::transaction*>(xact);
+    po6::threads::mutex::hold hold(tx->parent()->mutex());
+    tx->buffer_writes();
 }
 
 CONSUS_API int64_t
@@ -257,6 +409,142 @@ consus_put(consus_transaction* xact,
     );
 }
 
+CONSUS_API int64_t
+consus_get_bin(consus_transaction* xact,
+               const char* table,
+               const char* key, size_t key_sz,
+               consus_returncode* status,
+               char** value, size_t* value_sz)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->get_bin(table, key, key_sz, status, value, value_sz);
+    );
+}
+
+CONSUS_API int64_t
+consus_get_into(consus_transaction* xact,
+                const char* table,
+                const char* key, size_t key_sz,
+                consus_returncode* status,
+                char* buf, size_t buf_sz, size_t* value_sz)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->get_into(table, key, key_sz, status, buf, buf_sz, value_sz);
+    );
+}
+
+CONSUS_API int64_t
+consus_put_bin(consus_transaction* xact,
+               const char* table,
+               const char* key, size_t key_sz,
+               const char* value, size_t value_sz,
+               consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->put_bin(table, key, key_sz, value, value_sz, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_cond_put(consus_transaction* xact,
+                const char* table,
+                const char* key, size_t key_sz,
+                const char* expected, size_t expected_sz,
+                const char* value, size_t value_sz,
+                consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->cond_put(table, key, key_sz, expected, expected_sz, value, value_sz, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_cond_put_bin(consus_transaction* xact,
+                    const char* table,
+                    const char* key, size_t key_sz,
+                    const char* expected, size_t expected_sz,
+                    const char* value, size_t value_sz,
+                    consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->cond_put_bin(table, key, key_sz, expected, expected_sz, value, value_sz, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_add(consus_transaction* xact,
+           const char* table,
+           const char* key, size_t key_sz,
+           int64_t delta,
+           consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->add(table, key, key_sz, delta, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_max(consus_transaction* xact,
+           const char* table,
+           const char* key, size_t key_sz,
+           int64_t value,
+           consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->max(table, key, key_sz, value, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_set_add(consus_transaction* xact,
+               const char* table,
+               const char* key, size_t key_sz,
+               const char* member, size_t member_sz,
+               consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->set_add(table, key, key_sz, member, member_sz, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_multi_get(consus_transaction* xact,
+                 const char* table,
+                 const char* const* keys, const size_t* keys_sz, size_t n,
+                 consus_returncode* status,
+                 char** values, size_t* values_sz)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->multi_get(table, keys, keys_sz, n, status, values, values_sz);
+    );
+}
+
+CONSUS_API int64_t
+consus_multi_put(consus_transaction* xact,
+                 const char* table,
+                 const char* const* keys, const size_t* keys_sz,
+                 const char* const* values, const size_t* values_sz,
+                 size_t n, consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->multi_put(table, keys, keys_sz, values, values_sz, n, status);
+    );
+}
+
+CONSUS_API int64_t
+consus_scan(consus_transaction* xact,
+            const char* table,
+            const char* key, size_t key_sz,
+            uint64_t n,
+            consus_returncode* status,
+            char** key_out, size_t* key_out_sz,
+            char** value, size_t* value_sz)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->scan(table, key, key_sz, n, status, key_out, key_out_sz, value, value_sz);
+    );
+}
+
 CONSUS_API int64_t
 consus_commit_transaction(consus_transaction* xact,
                           consus_returncode* status)
@@ -275,6 +563,127 @@ consus_abort_transaction(consus_transaction* xact,
     );
 }
 
+CONSUS_API int64_t
+consus_restart_transaction(consus_transaction* xact,
+                           consus_returncode* status)
+{
+    C_WRAP_EXCEPT_XACT(
+    return tx->restart_transaction(status);
+    );
+}
+
+static consus_returncode
+run_wait(consus_client* client, int64_t id, consus_returncode* op_status)
+{
+    if (id < 0)
+    {
+        return *op_status;
+    }
+
+    consus_returncode lstatus;
+
+    if (consus_wait(client, id, -1, &lstatus) < 0)
+    {
+        return lstatus;
+    }
+
+    return *op_status;
+}
+
+// sleep for a random time in [cap/2, cap], where cap doubles per attempt
+static void
+run_backoff(uint64_t* seed, unsigned attempt)
+{
+    uint64_t cap = RUN_BACKOFF_MAX;
+
+    if (attempt < 16 && (RUN_BACKOFF_MIN << attempt) < RUN_BACKOFF_MAX)
+    {
+        cap = RUN_BACKOFF_MIN << attempt;
+    }
+
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    const uint64_t r = *seed * 2685821657736338717ULL;
+    po6::sleep(cap / 2 + r % (cap / 2 + 1));
+}
+
+CONSUS_API consus_returncode
+consus_run_transaction(consus_client* client,
+                       consus_transaction_body body, void* arg,
+                       unsigned max_attempts)
+{
+    consus_returncode status;
+    consus_transaction* xact = NULL;
+    int64_t id = consus_begin_transaction(client, &status, &xact);
+    status = run_wait(client, id, &status);
+    uint64_t seed = po6::monotonic_time() | 1;
+    unsigned attempt = 1;
+
+    // the txman sheds load with BUSY; wait it out like an abort
+    while (status == CONSUS_BUSY &&
+           (max_attempts == 0 || attempt < max_attempts))
+    {
+        run_backoff(&seed, attempt);
+        ++attempt;
+        id = consus_begin_transaction(client, &status, &xact);
+        status = run_wait(client, id, &status);
+    }
+
+    if (status != CONSUS_SUCCESS)
+    {
+        return status;
+    }
+
+    while (true)
+    {
+        status = body(xact, arg);
+
+        if (status == CONSUS_SUCCESS)
+        {
+            id = consus_commit_transaction(xact, &status);
+            status = run_wait(client, id, &status);
+
+            if (status != CONSUS_ABORTED)
+            {
+                consus_destroy_transaction(xact);
+                return status;
+            }
+        }
+        else
+        {
+            consus_returncode astatus;
+            id = consus_abort_transaction(xact, &astatus);
+            run_wait(client, id, &astatus);
+
+            if (status != CONSUS_ABORTED)
+            {
+                consus_destroy_transaction(xact);
+                return status;
+            }
+        }
+
+        if (max_attempts != 0 && attempt >= max_attempts)
+        {
+            consus_destroy_transaction(xact);
+            return CONSUS_ABORTED;
+        }
+
+        run_backoff(&seed, attempt);
+        ++attempt;
+        // restarting keeps the first attempt's timestamp, so that a
+        // transaction that keeps losing conflicts grows old enough to win
+        id = consus_restart_transaction(xact, &status);
+        status = run_wait(client, id, &status);
+
+        if (status != CONSUS_SUCCESS)
+        {
+            consus_destroy_transaction(xact);
+            return status;
+        }
+    }
+}
+
 CONSUS_API int
 consus_debug_client_configuration(consus_client* client,
                                   consus_returncode* status,
@@ -285,6 +694,34 @@ consus_debug_client_configuration(consus_client* client,
     );
 }
 
+CONSUS_API int
+consus_debug_transaction_managers(consus_client* client,
+                                  consus_returncode* status,
+                                  uint64_t* ids, uint64_t* dcs, size_t* sz)
+{
+    C_WRAP_EXCEPT(
+    return cl->debug_transaction_managers(status, ids, dcs, sz);
+    );
+}
+
+CONSUS_API int64_t
+consus_begin_transaction_via(consus_client* client, uint64_t txman,
+                             consus_returncode* status,
+                             consus_transaction** xact)
+{
+    C_WRAP_EXCEPT(
+    return cl->begin_transaction_via(txman, status, xact);
+    );
+}
+
+CONSUS_API uint64_t
+consus_transaction_origin(consus_transaction* xact)
+{
+    consus::transaction* tx = reinterpret_cast<consus::transaction*>(xact);
+    po6::threads::mutex::hold hold(tx->parent()->mutex());
+    return tx->txid().group.get();
+}
+
 CONSUS_API int
 consus_debug_txman_configuration(consus_client* client,
                                  consus_returncode* status,
@@ -310,7 +747,16 @@ consus_admin_create_data_center(consus_client* client, const char* name,
                                 consus_returncode* status)
 {
     C_WRAP_EXCEPT(
-    return cl->create_data_center(name, status);
+    return cl->create_data_center(name, false, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_create_read_replica(consus_client* client, const char* name,
+                                 consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->create_data_center(name, true, status);
     );
 }
 
@@ -323,6 +769,73 @@ consus_admin_set_default_data_center(consus_client* client, const char* name,
     );
 }
 
+CONSUS_API int
+consus_admin_split_partitions(consus_client* client, const char* data_center,
+                              consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->split_partitions(data_center, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_set_table_replication(consus_client* client, const char* table,
+                                   unsigned replication,
+                                   consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->set_table_replication(table, replication, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_set_table_home(consus_client* client, const char* table,
+                            const char* data_center,
+                            consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->set_table_home(table, data_center, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_set_group_quorum(consus_client* client, uint64_t group,
+                              unsigned phase2,
+                              consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->set_group_quorum(group, phase2, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_set_group_witness(consus_client* client, uint64_t group,
+                               uint64_t txman, int witness,
+                               consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->set_group_witness(group, txman, witness != 0, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_export(consus_client* client, uint64_t* timestamp,
+                    consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->kvs_export(timestamp, status);
+    );
+}
+
+CONSUS_API int
+consus_admin_compact(consus_client* client, uint16_t first, uint16_t last,
+                     consus_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->kvs_compact(first, last, status);
+    );
+}
+
 CONSUS_API int
 consus_admin_availability_check(consus_client* client,
                                 consus_availability_requirements* reqs,
@@ -25,7 +25,19 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <limits.h>
+
+// POSIX
+#include <poll.h>
+
+// STL
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
 // po6
+#include <po6/net/hostname.h>
 #include <po6/time.h>
 
 // treadstone
@@ -42,14 +54,31 @@
 #include "client/client.h"
 #include "client/pending.h"
 #include "client/pending_begin_transaction.h"
+#include "client/pending_single.h"
+#include "client/pending_stale_read.h"
 #include "client/pending_string.h"
 
 using consus::client;
 
+// low bits of a thread safe client's IDs name the thread that owns the op
+#define THREAD_ID_BITS 20
+// upper bound on how long a receiving thread leaves the others waiting
+#define RECEIVE_SLICE_MS 10
+// the read latencies a hedging client keeps; it uses the transport's
+// retransmission timeout until it has HEDGE_MIN_SAMPLES of them
+#define HEDGE_WINDOW 256
+#define HEDGE_MIN_SAMPLES 16
+// never hedge sooner than this
+#define HEDGE_MIN_DELAY PO6_MILLIS
+// the busybee ID a proxied client reaches its proxy by
+#define PROXY_ID UINT64_MAX
+// how long to wait for the proxy to answer a hello
+#define PROXY_HELLO_TIMEOUT_MS 1000
+
 #define ERROR(CODE) \
     *status = CONSUS_ ## CODE; \
-    m_last_error.set_loc(__FILE__, __LINE__); \
-    m_last_error.set_msg()
+    this_thread()->last_error.set_loc(__FILE__, __LINE__); \
+    this_thread()->last_error.set_msg()
 
 #define _BUSYBEE_ERROR(BBRC) \
     case BUSYBEE_ ## BBRC: \
@@ -63,6 +92,23 @@ using consus::client;
     _BUSYBEE_ERROR(BBRC); \
     return false;
 
+struct client::thread_state
+{
+    thread_state() : outstanding(), returnable(), returned(), returned_many(), last_error() {}
+
+    // ops this thread issued that have yet to return for the last time
+    std::set<int64_t> outstanding;
+    std::list<e::intrusive_ptr<pending> > returnable;
+    e::intrusive_ptr<pending> returned;
+    // what the last loop_many returned, kept alive like returned
+    std::vector<e::intrusive_ptr<pending> > returned_many;
+    e::error last_error;
+
+    private:
+        thread_state(const thread_state&);
+        thread_state& operator = (const thread_state&);
+};
+
 client :: client(const char* host, uint16_t port)
     : m_coord(replicant_client_create(host, port))
     , m_config()
@@ -73,19 +119,34 @@ client :: client(const char* host, uint16_t port)
     , m_config_data_sz(0)
     , m_busybee_controller(&m_config)
     , m_busybee(busybee_client::create(&m_busybee_controller))
+    , m_proxied(false)
+    , m_proxy_ready(false)
+    , m_nonce_prefix(0)
     , m_next_client_id(1)
     , m_next_server_nonce(1)
     , m_pending()
-    , m_returnable()
-    , m_returned()
+    , m_timers()
+    , m_threadsafe(false)
+    , m_mtx()
+    , m_progress(&m_mtx)
+    , m_receiving(false)
+    , m_thread_ids()
+    , m_threads()
+    , m_rtt()
+    , m_health()
+    , m_selections(0)
+    , m_hedge_percentile(0)
+    , m_read_latencies()
+    , m_read_latencies_idx(0)
     , m_flagfd()
-    , m_last_error()
 {
     if (!m_coord)
     {
         throw std::bad_alloc();
     }
 
+    m_threads.push_back(new thread_state());
+
     busybee_returncode rc = m_busybee->set_external_fd(replicant_client_poll_fd(m_coord));
     assert(rc == BUSYBEE_SUCCESS);
 }
@@ -100,42 +161,127 @@ client :: client(const char* conn_str)
     , m_config_data_sz(0)
     , m_busybee_controller(&m_config)
     , m_busybee(busybee_client::create(&m_busybee_controller))
+    , m_proxied(false)
+    , m_proxy_ready(false)
+    , m_nonce_prefix(0)
     , m_next_client_id(1)
     , m_next_server_nonce(1)
     , m_pending()
-    , m_returnable()
-    , m_returned()
+    , m_timers()
+    , m_threadsafe(false)
+    , m_mtx()
+    , m_progress(&m_mtx)
+    , m_receiving(false)
+    , m_thread_ids()
+    , m_threads()
+    , m_rtt()
+    , m_health()
+    , m_selections(0)
+    , m_hedge_percentile(0)
+    , m_read_latencies()
+    , m_read_latencies_idx(0)
     , m_flagfd()
-    , m_last_error()
 {
     if (!m_coord)
     {
         throw std::bad_alloc();
     }
 
+    m_threads.push_back(new thread_state());
+
+    busybee_returncode rc = m_busybee->set_external_fd(replicant_client_poll_fd(m_coord));
+    assert(rc == BUSYBEE_SUCCESS);
+}
+
+client :: client(const char* conn_str, const char* proxy_host, uint16_t proxy_port)
+    : m_coord(replicant_client_create_conn_str(conn_str))
+    , m_config()
+    , m_config_id(-1)
+    , m_config_status(REPLICANT_SUCCESS)
+    , m_config_state(0)
+    , m_config_data(NULL)
+    , m_config_data_sz(0)
+    , m_busybee_controller(&m_config)
+    , m_busybee(busybee_client::create(&m_busybee_controller))
+    , m_proxied(true)
+    , m_proxy_ready(false)
+    , m_nonce_prefix(0)
+    , m_next_client_id(1)
+    , m_next_server_nonce(1)
+    , m_pending()
+    , m_timers()
+    , m_threadsafe(false)
+    , m_mtx()
+    , m_progress(&m_mtx)
+    , m_receiving(false)
+    , m_thread_ids()
+    , m_threads()
+    , m_rtt()
+    , m_health()
+    , m_selections(0)
+    , m_hedge_percentile(0)
+    , m_read_latencies()
+    , m_read_latencies_idx(0)
+    , m_flagfd()
+{
+    if (!m_coord)
+    {
+        throw std::bad_alloc();
+    }
+
+    po6::net::location proxy = po6::net::hostname(proxy_host, proxy_port).lookup(AF_UNSPEC, IPPROTO_TCP);
+
+    if (proxy == po6::net::location())
+    {
+        replicant_client_destroy(m_coord);
+        throw std::invalid_argument("cannot resolve the proxy's address");
+    }
+
+    m_busybee_controller.set_proxy(PROXY_ID, proxy);
+    m_threads.push_back(new thread_state());
+
     busybee_returncode rc = m_busybee->set_external_fd(replicant_client_poll_fd(m_coord));
     assert(rc == BUSYBEE_SUCCESS);
 }
 
 client :: ~client() throw ()
 {
+    for (size_t i = 0; i < m_threads.size(); ++i)
+    {
+        delete m_threads[i];
+    }
+
     replicant_client_destroy(m_coord);
 }
 
+void
+client :: threadsafe()
+{
+    m_threadsafe = true;
+}
+
+void
+client :: hedge_reads(unsigned percentile)
+{
+    m_hedge_percentile = std::min(percentile, 99U);
+}
+
 int64_t
 client :: loop(int timeout, consus_returncode* status)
 {
     *status = CONSUS_SUCCESS;
-    m_last_error = e::error();
+    thread_state* ts = this_thread();
+    ts->last_error = e::error();
 
-    while (!m_returnable.empty() || !m_pending.empty())
+    while (!ts->returnable.empty() || !ts->outstanding.empty())
     {
-        if (!m_returnable.empty())
+        if (!ts->returnable.empty())
         {
-            m_returned = m_returnable.front();
-            m_returnable.pop_front();
-            m_last_error = m_returned->error();
-            return m_returned->client_id();
+            ts->returned = ts->returnable.front();
+            ts->returnable.pop_front();
+            returning(ts, ts->returned.get());
+            ts->last_error = ts->returned->error();
+            return ts->returned->client_id();
         }
 
         if (inner_loop(timeout, status) < 0)
@@ -151,21 +297,23 @@ int64_t
 client :: wait(int64_t id, int timeout, consus_returncode* status)
 {
     *status = CONSUS_SUCCESS;
-    m_last_error = e::error();
+    thread_state* ts = this_thread();
+    ts->last_error = e::error();
 
     while (true)
     {
-        for (std::list<e::intrusive_ptr<pending> >::iterator it = m_returnable.begin();
-                it != m_returnable.end(); ++it)
+        for (std::list<e::intrusive_ptr<pending> >::iterator it = ts->returnable.begin();
+                it != ts->returnable.end(); ++it)
         {
             pending* p = it->get();
 
             if (p->client_id() == id)
             {
-                m_returned = *it;
-                m_returnable.erase(it);
-                m_last_error = m_returned->error();
-                return m_returned->client_id();
+                ts->returned = *it;
+                ts->returnable.erase(it);
+                returning(ts, ts->returned.get());
+                ts->last_error = ts->returned->error();
+                return ts->returned->client_id();
             }
         }
 
@@ -178,6 +326,113 @@ client :: wait(int64_t id, int timeout, consus_returncode* status)
     return post_loop(status);
 }
 
+int64_t
+client :: loop_many(int timeout, int64_t* ids, consus_returncode* statuses,
+                    size_t ids_sz, consus_returncode* status)
+{
+    *status = CONSUS_SUCCESS;
+    thread_state* ts = this_thread();
+    ts->last_error = e::error();
+    ts->returned_many.clear();
+    const uint64_t start = po6::monotonic_time();
+    size_t n = 0;
+
+    while (n < ids_sz)
+    {
+        if (!ts->returnable.empty())
+        {
+            e::intrusive_ptr<pending> p = ts->returnable.front();
+            ts->returnable.pop_front();
+            returning(ts, p.get());
+            ts->last_error = p->error();
+            ids[n] = p->client_id();
+            statuses[n] = p->status();
+            ts->returned_many.push_back(p);
+            ++n;
+            continue;
+        }
+
+        if (ts->outstanding.empty())
+        {
+            if (n == 0)
+            {
+                return post_loop(status);
+            }
+
+            break;
+        }
+
+        // block only until the first completion; after that, take just what
+        // BusyBee has already received
+        int to = 0;
+
+        if (n == 0 && timeout != 0)
+        {
+            const uint64_t elapsed = (po6::monotonic_time() - start) / PO6_MILLIS;
+
+            if (timeout > 0 && elapsed >= uint64_t(timeout))
+            {
+                ERROR(TIMEOUT) << "operation timed out";
+                return -1;
+            }
+
+            to = timeout < 0 ? -1 : timeout - int(elapsed);
+        }
+
+        const int64_t progress = inner_loop(to, status);
+
+        if (progress < 0)
+        {
+            if (n == 0)
+            {
+                return -1;
+            }
+
+            // keep these completions; a lasting error recurs on the next call
+            *status = CONSUS_SUCCESS;
+            break;
+        }
+
+        if (progress == 0 && to == 0)
+        {
+            if (n == 0)
+            {
+                ERROR(TIMEOUT) << "operation timed out";
+                return -1;
+            }
+
+            break;
+        }
+    }
+
+    return n;
+}
+
+int
+client :: poll_fd()
+{
+    return m_busybee->poll_fd();
+}
+
+int
+client :: block(int timeout)
+{
+    if (!this_thread()->returnable.empty())
+    {
+        return 0;
+    }
+
+    pollfd pfd;
+    pfd.fd = m_busybee->poll_fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    const int to = timer_timeout(timeout);
+    m_mtx.unlock();
+    const int ret = poll(&pfd, 1, to);
+    m_mtx.lock();
+    return ret < 0 ? -1 : 0;
+}
+
 int64_t
 client :: begin_transaction(consus_returncode* status,
                             consus_transaction** xact)
@@ -189,15 +444,152 @@ client :: begin_transaction(consus_returncode* status,
 
     int64_t client_id = generate_new_client_id();
     pending* p = new pending_begin_transaction(client_id, status, xact);
-    p->kickstart_state_machine(this);
+    start(p);
+    return client_id;
+}
+
+int64_t
+client :: begin_transaction_declared(const consus_key_hint* hints,
+                                     size_t hints_sz,
+                                     consus_returncode* status,
+                                     consus_transaction** xact)
+{
+    if (hints_sz > CONSUS_MAX_DECLARED_KEYS)
+    {
+        ERROR(INVALID) << "a transaction may declare at most "
+                       << CONSUS_MAX_DECLARED_KEYS << " keys";
+        return -1;
+    }
+
+    for (size_t i = 0; i < hints_sz; ++i)
+    {
+        if (!hints[i].table || (!hints[i].key && hints[i].key_sz > 0))
+        {
+            ERROR(INVALID) << "declared key " << i << " has no table or key";
+            return -1;
+        }
+    }
+
+    if (!maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    int64_t client_id = generate_new_client_id();
+    pending* p = new pending_begin_transaction(client_id, status, xact, hints, hints_sz);
+    start(p);
+    return client_id;
+}
+
+int64_t
+client :: begin_transaction_via(uint64_t txman,
+                                consus_returncode* status,
+                                consus_transaction** xact)
+{
+    if (!maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    int64_t client_id = generate_new_client_id();
+    pending* p = new pending_begin_transaction(client_id, status, xact, comm_id(txman));
+    start(p);
+    return client_id;
+}
+
+int64_t
+client :: stale_get(const char* table,
+                    const char* key, size_t key_sz,
+                    uint64_t timestamp,
+                    consus_returncode* status,
+                    char** value, size_t* value_sz)
+{
+    if (!maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    unsigned char* binkey = NULL;
+    size_t binkey_sz = 0;
+
+    if (treadstone_json_sz_to_binary(key, key_sz, &binkey, &binkey_sz) < 0)
+    {
+        ERROR(INVALID) << "key contains invalid JSON";
+        return -1;
+    }
+
+    int64_t client_id = generate_new_client_id();
+    pending* p = new pending_stale_read(client_id, status, table,
+            binkey, binkey_sz, binkey, timestamp, value, value_sz);
+    start(p);
+    return client_id;
+}
+
+int64_t
+client :: single_get(const char* table,
+                     const char* key, size_t key_sz,
+                     consus_returncode* status,
+                     char** value, size_t* value_sz)
+{
+    if (!maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    int64_t client_id = generate_new_client_id();
+    pending* p = new pending_single(client_id, status, SINGLE_GET, UPDATE_IF_EQUAL,
+                                    table, key, key_sz, NULL, 0, NULL, 0,
+                                    value, value_sz);
+    start(p);
+    return client_id;
+}
+
+int64_t
+client :: single_put(const char* table,
+                     const char* key, size_t key_sz,
+                     const char* value, size_t value_sz,
+                     consus_returncode* status)
+{
+    if (!maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    int64_t client_id = generate_new_client_id();
+    pending* p = new pending_single(client_id, status, SINGLE_PUT, UPDATE_IF_EQUAL,
+                                    table, key, key_sz, NULL, 0, value, value_sz,
+                                    NULL, NULL);
+    start(p);
+    return client_id;
+}
+
+int64_t
+client :: single_cas(const char* table,
+                     const char* key, size_t key_sz,
+                     const char* expected, size_t expected_sz,
+                     const char* value, size_t value_sz,
+                     consus_returncode* status)
+{
+    if (!maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    const update_t update = expected ? UPDATE_IF_EQUAL : UPDATE_IF_ABSENT;
+    int64_t client_id = generate_new_client_id();
+    pending* p = new pending_single(client_id, status, SINGLE_UPDATE, update,
+                                    table, key, key_sz, expected, expected_sz,
+                                    value, value_sz, NULL, NULL);
+    start(p);
     return client_id;
 }
 
 int
-client :: create_data_center(const char* name, consus_returncode* status)
+client :: create_data_center(const char* name, bool read_replica,
+                              consus_returncode* status)
 {
     std::string tmp;
-    e::packer(&tmp) << e::slice(name);
+    e::packer(&tmp) << e::slice(name) << e::pack_uint8<bool>(read_replica);
     replicant_returncode rc;
     char* data = NULL;
     size_t data_sz = 0;
@@ -277,6 +669,184 @@ client :: set_default_data_center(const char* name, consus_returncode* status)
     return 0;
 }
 
+int
+client :: split_partitions(const char* data_center, consus_returncode* status)
+{
+    std::string tmp;
+    e::packer(&tmp) << e::slice(data_center);
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "data_center_split_partitions",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // XXX
+    if (data) free(data);
+    return 0;
+}
+
+int
+client :: set_table_replication(const char* table, unsigned replication,
+                                 consus_returncode* status)
+{
+    if (replication < 1 || replication > CONSUS_MAX_REPLICATION_FACTOR)
+    {
+        ERROR(INVALID) << "replication factor must be between 1 and "
+                       << CONSUS_MAX_REPLICATION_FACTOR;
+        return -1;
+    }
+
+    std::string tmp;
+    e::packer(&tmp) << e::slice(table) << uint64_t(replication);
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "table_set_replication",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // XXX
+    if (data) free(data);
+    return 0;
+}
+
+int
+client :: set_table_home(const char* table, const char* data_center,
+                         consus_returncode* status)
+{
+    std::string tmp;
+    e::packer(&tmp) << e::slice(table) << e::slice(data_center);
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "table_set_home",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // XXX
+    if (data) free(data);
+    return 0;
+}
+
+int
+client :: set_group_quorum(uint64_t group, unsigned phase2,
+                            consus_returncode* status)
+{
+    if (phase2 > CONSUS_MAX_REPLICATION_FACTOR)
+    {
+        ERROR(INVALID) << "phase 2 quorums must have at most "
+                       << CONSUS_MAX_REPLICATION_FACTOR << " members";
+        return -1;
+    }
+
+    std::string tmp;
+    e::packer(&tmp) << paxos_group_id(group) << uint64_t(phase2);
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "txman_group_set_quorum",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // XXX
+    if (data) free(data);
+    return 0;
+}
+
+int
+client :: set_group_witness(uint64_t group, uint64_t txman, bool witness,
+                            consus_returncode* status)
+{
+    std::string tmp;
+    e::packer(&tmp) << paxos_group_id(group) << comm_id(txman)
+                    << e::pack_uint8<bool>(witness);
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "txman_group_set_witness",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // XXX
+    if (data) free(data);
+    return 0;
+}
+
+int
+client :: kvs_export(uint64_t* timestamp, consus_returncode* status)
+{
+    if (*timestamp == 0)
+    {
+        *timestamp = po6::wallclock_time();
+    }
+
+    std::string tmp;
+    e::packer(&tmp) << *timestamp;
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "kvs_export",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // XXX
+    if (data) free(data);
+    return 0;
+}
+
+int
+client :: kvs_compact(uint16_t first, uint16_t last, consus_returncode* status)
+{
+    std::string tmp;
+    e::packer(&tmp) << first << last;
+    replicant_returncode rc;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_call(m_coord, "consus", "kvs_compact",
+                                       tmp.data(), tmp.size(), REPLICANT_CALL_ROBUST,
+                                       &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status))
+    {
+        return -1;
+    }
+
+    // XXX
+    if (data) free(data);
+    return 0;
+}
+
 int
 client :: availability_check(consus_availability_requirements* reqs,
                              int timeout,
@@ -328,7 +898,9 @@ client :: availability_check(consus_availability_requirements* reqs,
         std::vector<txman_state> txmans;
         std::vector<paxos_group> txman_groups;
         std::vector<kvs> kvss;
-        up = txman_configuration(up, &cid, &vid, &flags, &dcs, &txmans, &txman_groups, &kvss);
+        std::vector<ring> rings;
+        std::vector<table_config> tables;
+        up = txman_configuration(up, &cid, &vid, &flags, &dcs, &txmans, &txman_groups, &kvss, &rings, &tables);
 
         if (data)
         {
@@ -419,24 +991,98 @@ client :: replicant_finish(int64_t id, int timeout, replicant_returncode* rc, co
 
     if (lid < 0)
     {
-        *rc = lrc;
-        ERROR(COORD_FAIL) << "coordinator failure: " << replicant_client_error_message(m_coord);
-        return false;
+        *rc = lrc;
+        ERROR(COORD_FAIL) << "coordinator failure: " << replicant_client_error_message(m_coord);
+        return false;
+    }
+
+    assert(id == lid);
+
+    if (*rc != REPLICANT_SUCCESS)
+    {
+        ERROR(COORD_FAIL) << "coordinator failure: " << replicant_client_error_message(m_coord);
+        return false;
+    }
+
+    return true;
+}
+
+int
+client :: debug_client_configuration(consus_returncode* status, const char** str)
+{
+    if (!maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    replicant_returncode rc = REPLICANT_GARBAGE;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t id = replicant_client_cond_wait(m_coord, "consus", "clientconf", 0, &rc, &data, &data_sz);
+
+    if (!replicant_finish(id, &rc, status) || (!data && data_sz != 0))
+    {
+        return -1;
+    }
+
+    e::unpacker up(data, data_sz);
+    cluster_id cid;
+    version_id vid;
+    uint64_t flags;
+    std::vector<txman> txmans;
+    std::vector<txman> readers;
+    up = client_configuration(up, &cid, &vid, &flags, &txmans, &readers);
+    free(data);
+
+    if (up.error())
+    {
+        ERROR(COORD_FAIL) << "coordinator failure: bad client configuration";
+        return -1;
+    }
+
+    std::ostringstream ostr;
+    ostr << cid << "\n"
+         << vid << "\n";
+
+    if (txmans.empty())
+    {
+        ostr << "no transaction managers";
+    }
+    else if (txmans.size() == 1)
+    {
+        ostr << "1 transaction manager:\n";
+    }
+    else
+    {
+        ostr << txmans.size() << " transaction managers:\n";
+    }
+
+    for (unsigned i = 0; i < txmans.size(); ++i)
+    {
+        ostr << txmans[i] << "\n";
     }
 
-    assert(id == lid);
+    if (!readers.empty())
+    {
+        ostr << readers.size() << " read replica transaction managers:\n";
+    }
 
-    if (*rc != REPLICANT_SUCCESS)
+    for (unsigned i = 0; i < readers.size(); ++i)
     {
-        ERROR(COORD_FAIL) << "coordinator failure: " << replicant_client_error_message(m_coord);
-        return false;
+        ostr << readers[i] << "\n";
     }
 
-    return true;
+    e::intrusive_ptr<pending_string> p = new pending_string(ostr.str());
+    *str = p->string();
+    this_thread()->returned = p.get();
+    *status = CONSUS_SUCCESS;
+    this_thread()->last_error = e::error();
+    return 0;
 }
 
 int
-client :: debug_client_configuration(consus_returncode* status, const char** str)
+client :: debug_transaction_managers(consus_returncode* status,
+                                     uint64_t* ids, uint64_t* dcs, size_t* sz)
 {
     if (!maintain_coord_connection(status))
     {
@@ -458,7 +1104,8 @@ client :: debug_client_configuration(consus_returncode* status, const char** str
     version_id vid;
     uint64_t flags;
     std::vector<txman> txmans;
-    up = client_configuration(up, &cid, &vid, &flags, &txmans);
+    std::vector<txman> readers;
+    up = client_configuration(up, &cid, &vid, &flags, &txmans, &readers);
     free(data);
 
     if (up.error())
@@ -467,33 +1114,15 @@ client :: debug_client_configuration(consus_returncode* status, const char** str
         return -1;
     }
 
-    std::ostringstream ostr;
-    ostr << cid << "\n"
-         << vid << "\n";
-
-    if (txmans.empty())
-    {
-        ostr << "no transaction managers";
-    }
-    else if (txmans.size() == 1)
-    {
-        ostr << "1 transaction manager:\n";
-    }
-    else
-    {
-        ostr << txmans.size() << " transaction managers:\n";
-    }
-
-    for (unsigned i = 0; i < txmans.size(); ++i)
+    for (size_t i = 0; i < txmans.size() && i < *sz; ++i)
     {
-        ostr << txmans[i] << "\n";
+        ids[i] = txmans[i].id.get();
+        dcs[i] = txmans[i].dc.get();
     }
 
-    e::intrusive_ptr<pending_string> p = new pending_string(ostr.str());
-    *str = p->string();
-    m_returned = p.get();
+    *sz = txmans.size();
     *status = CONSUS_SUCCESS;
-    m_last_error = e::error();
+    this_thread()->last_error = e::error();
     return 0;
 }
 
@@ -523,7 +1152,9 @@ client :: debug_txman_configuration(consus_returncode* status, const char** str)
     std::vector<txman_state> txmans;
     std::vector<paxos_group> txman_groups;
     std::vector<kvs> kvss;
-    up = txman_configuration(up, &cid, &vid, &flags, &dcs, &txmans, &txman_groups, &kvss);
+    std::vector<ring> rings;
+    std::vector<table_config> tables;
+    up = txman_configuration(up, &cid, &vid, &flags, &dcs, &txmans, &txman_groups, &kvss, &rings, &tables);
     free(data);
 
     if (up.error())
@@ -532,12 +1163,12 @@ client :: debug_txman_configuration(consus_returncode* status, const char** str)
         return -1;
     }
 
-    std::string s = txman_configuration(cid, vid, flags, dcs, txmans, txman_groups, kvss);
+    std::string s = txman_configuration(cid, vid, flags, dcs, txmans, txman_groups, kvss, rings, tables);
     e::intrusive_ptr<pending_string> p = new pending_string(s);
     *str = p->string();
-    m_returned = p.get();
+    this_thread()->returned = p.get();
     *status = CONSUS_SUCCESS;
-    m_last_error = e::error();
+    this_thread()->last_error = e::error();
     return 0;
 }
 
@@ -565,7 +1196,8 @@ client :: debug_kvs_configuration(consus_returncode* status, const char** str)
     uint64_t flags;
     std::vector<kvs_state> kvss;
     std::vector<ring> rings;
-    up = kvs_configuration(up, &cid, &vid, &flags, &kvss, &rings);
+    std::vector<table_config> tables;
+    up = kvs_configuration(up, &cid, &vid, &flags, &kvss, &rings, &tables);
     free(data);
 
     if (up.error())
@@ -574,80 +1206,173 @@ client :: debug_kvs_configuration(consus_returncode* status, const char** str)
         return -1;
     }
 
-    std::string s = kvs_configuration(cid, vid, flags, kvss, rings);
+    std::string s = kvs_configuration(cid, vid, flags, kvss, rings, tables);
     e::intrusive_ptr<pending_string> p = new pending_string(s);
     *str = p->string();
-    m_returned = p.get();
+    this_thread()->returned = p.get();
     *status = CONSUS_SUCCESS;
-    m_last_error = e::error();
+    this_thread()->last_error = e::error();
     return 0;
 }
 
 const char*
 client :: error_message()
 {
-    return m_last_error.msg();
+    return this_thread()->last_error.msg();
 }
 
 const char*
 client :: error_location()
 {
-    return m_last_error.loc();
+    return this_thread()->last_error.loc();
 }
 
 void
 client :: set_error_message(const char* msg)
 {
-    m_last_error = e::error();
-    m_last_error.set_loc(__FILE__, __LINE__);
-    m_last_error.set_msg() << msg;
+    e::error* err = &this_thread()->last_error;
+    *err = e::error();
+    err->set_loc(__FILE__, __LINE__);
+    err->set_msg() << msg;
 }
 
 uint64_t
 client :: generate_new_nonce()
 {
-    return m_next_server_nonce++;
+    return m_nonce_prefix | m_next_server_nonce++;
 }
 
 int64_t
 client :: generate_new_client_id()
 {
-    return m_next_client_id++;
+    if (!m_threadsafe)
+    {
+        return m_next_client_id++;
+    }
+
+    return (m_next_client_id++ << THREAD_ID_BITS) | thread_index();
 }
 
 void
 client :: initialize(server_selector* ss)
 {
-    m_config.initialize(ss);
+    m_config.initialize(ss, &m_rtt, &m_health, m_selections, false);
+    ++m_selections;
+}
+
+void
+client :: initialize_stale(server_selector* ss)
+{
+    m_config.initialize(ss, &m_rtt, &m_health, m_selections, true);
+    ++m_selections;
+}
+
+void
+client :: observe_rtt(comm_id id, uint64_t rtt)
+{
+    m_rtt.sample(id, rtt);
+}
+
+uint64_t
+client :: hedge_delay(comm_id id)
+{
+    if (m_hedge_percentile == 0)
+    {
+        return 0;
+    }
+
+    if (m_read_latencies.size() < HEDGE_MIN_SAMPLES)
+    {
+        return m_rtt.timeout(id);
+    }
+
+    std::vector<uint64_t> latencies(m_read_latencies);
+    const size_t idx = latencies.size() * m_hedge_percentile / 100;
+    std::nth_element(latencies.begin(), latencies.begin() + idx, latencies.end());
+    return std::max(latencies[idx], uint64_t(HEDGE_MIN_DELAY));
+}
+
+void
+client :: observe_read(uint64_t latency)
+{
+    if (m_read_latencies.size() < HEDGE_WINDOW)
+    {
+        m_read_latencies.push_back(latency);
+    }
+    else
+    {
+        m_read_latencies[m_read_latencies_idx] = latency;
+        m_read_latencies_idx = (m_read_latencies_idx + 1) % HEDGE_WINDOW;
+    }
+}
+
+void
+client :: schedule(uint64_t when, pending* p)
+{
+    m_timers.insert(std::make_pair(when, e::intrusive_ptr<pending>(p)));
+}
+
+void
+client :: cancel(comm_id id, uint64_t nonce)
+{
+    m_pending.erase(std::make_pair(id, nonce));
+}
+
+void
+client :: start(pending* p)
+{
+    // before the kickstart, which may make p returnable at once
+    owner(p->client_id())->outstanding.insert(p->client_id());
+    p->kickstart_state_machine(this);
 }
 
 void
 client :: add_to_returnable(pending* p)
 {
-    m_returnable.push_back(p);
+    owner(p->client_id())->returnable.push_back(p);
 }
 
 bool
 client :: send(uint64_t nonce, comm_id id, std::auto_ptr<e::buffer> msg, pending* p)
 {
-    busybee_returncode rc = m_busybee->send(id.get(), msg);
+    if (!transmit(id, msg))
+    {
+        return false;
+    }
 
-    if (rc == BUSYBEE_DISRUPTED)
+    m_pending[std::make_pair(id, nonce)] = p;
+    return true;
+}
+
+bool
+client :: send(const uint64_t* nonces, size_t nonces_sz, comm_id id,
+               std::auto_ptr<e::buffer> msg, pending* p)
+{
+    if (!transmit(id, msg))
     {
-        handle_disruption(id);
+        return false;
     }
 
-    if (rc == BUSYBEE_SUCCESS)
+    for (size_t i = 0; i < nonces_sz; ++i)
     {
-        m_pending[std::make_pair(id, nonce)] = p;
+        m_pending[std::make_pair(id, nonces[i])] = p;
     }
 
-    return rc == BUSYBEE_SUCCESS;
+    return true;
 }
 
 void
 client :: handle_disruption(const comm_id& id)
 {
+    if (m_proxied && id == comm_id(PROXY_ID))
+    {
+        handle_proxy_disruption();
+        return;
+    }
+
+    // mark it first so that every op redirected below skips it
+    m_health.disrupted(id);
+
     for (std::map<std::pair<comm_id, uint64_t>, e::intrusive_ptr<pending> >::iterator it = m_pending.begin();
             it != m_pending.end(); )
     {
@@ -670,12 +1395,55 @@ client :: inner_loop(int timeout, consus_returncode* status)
 {
     uint64_t cid_num;
     std::auto_ptr<e::buffer> msg;
-    busybee_returncode rc = m_busybee->recv(timeout, &cid_num, &msg);
+    busybee_returncode rc;
+
+    if (m_threadsafe)
+    {
+        // one thread drains BusyBee on behalf of all of them; the others wait
+        // for it to finish a round and then look for their own completions
+        if (m_receiving)
+        {
+            m_progress.wait();
+            return 0;
+        }
+
+        m_receiving = true;
+        fire_timers();
+        timeout = timer_timeout(timeout);
+        rc = m_busybee->recv(0, &cid_num, &msg);
+
+        if (rc == BUSYBEE_TIMEOUT && timeout != 0)
+        {
+            // wait for the socket without the lock so other threads may send
+            pollfd pfd;
+            pfd.fd = m_busybee->poll_fd();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            const int to = timeout < 0 ? RECEIVE_SLICE_MS : std::min(timeout, RECEIVE_SLICE_MS);
+            m_mtx.unlock();
+            poll(&pfd, 1, to);
+            m_mtx.lock();
+            rc = m_busybee->recv(0, &cid_num, &msg);
+        }
+
+        m_receiving = false;
+        m_progress.broadcast();
+    }
+    else
+    {
+        fire_timers();
+        rc = m_busybee->recv(timer_timeout(timeout), &cid_num, &msg);
+    }
+
     comm_id id(cid_num);
 
     switch (rc)
     {
         case BUSYBEE_SUCCESS:
+            if (!m_proxied)
+            {
+                m_health.alive(id);
+            }
             break;
         case BUSYBEE_INTERRUPTED:
             ERROR(INTERRUPTED) << "signal received";
@@ -686,7 +1454,7 @@ client :: inner_loop(int timeout, consus_returncode* status)
             handle_disruption(id);
             return 0;
         case BUSYBEE_EXTERNAL:
-            if (!maintain_coord_connection(status))
+            if (!refresh_coord_connection(status))
             {
                 return -1;
             }
@@ -715,6 +1483,39 @@ client :: inner_loop(int timeout, consus_returncode* status)
         return -1;
     }
 
+    if (m_proxied && msg_type == PROXY_CONFIG)
+    {
+        return handle_proxy_config(up, status) ? 0 : -1;
+    }
+    else if (m_proxied && msg_type == PROXY_DISRUPTED)
+    {
+        comm_id txman;
+        up = up >> txman;
+
+        if (!up.error())
+        {
+            handle_disruption(txman);
+        }
+
+        return 0;
+    }
+    else if (m_proxied && msg_type == PROXY_DELIVER)
+    {
+        // the rest is the transaction manager's message, verbatim
+        up = up >> id >> msg_type;
+
+        if (up.error())
+        {
+            ERROR(SERVER_ERROR) << "communication error: proxy sent message="
+                                << msg->as_slice().hex()
+                                << " with invalid delivery header";
+            return -1;
+        }
+
+        m_health.alive(id);
+        cid_num = id.get();
+    }
+
     if (msg_type == TXMAN_FINISHED)
     {
         transaction_group tg;
@@ -783,6 +1584,34 @@ client :: inner_loop(int timeout, consus_returncode* status)
     return 0;
 }
 
+void
+client :: fire_timers()
+{
+    const uint64_t now = po6::monotonic_time();
+
+    while (!m_timers.empty() && m_timers.begin()->first <= now)
+    {
+        e::intrusive_ptr<pending> p = m_timers.begin()->second;
+        m_timers.erase(m_timers.begin());
+        p->handle_timer(this);
+    }
+}
+
+int
+client :: timer_timeout(int timeout)
+{
+    if (m_timers.empty())
+    {
+        return timeout;
+    }
+
+    const uint64_t now = po6::monotonic_time();
+    const uint64_t when = m_timers.begin()->first;
+    const uint64_t ms = when > now ? (when - now + PO6_MILLIS - 1) / PO6_MILLIS : 0;
+    const int to = ms < uint64_t(INT_MAX) ? int(ms) : INT_MAX;
+    return timeout < 0 ? to : std::min(timeout, to);
+}
+
 int64_t
 client :: post_loop(consus_returncode* status)
 {
@@ -800,7 +1629,7 @@ client :: post_loop(consus_returncode* status)
             handle_disruption(comm_id(cid_num));
             break;
         case BUSYBEE_EXTERNAL:
-            if (!maintain_coord_connection(status))
+            if (!refresh_coord_connection(status))
             {
                 return -1;
             }
@@ -820,9 +1649,87 @@ client :: post_loop(consus_returncode* status)
     return -1;
 }
 
+unsigned
+client :: thread_index()
+{
+    if (!m_threadsafe)
+    {
+        return 0;
+    }
+
+    std::map<pthread_t, unsigned>::iterator it = m_thread_ids.find(pthread_self());
+
+    if (it != m_thread_ids.end())
+    {
+        return it->second;
+    }
+
+    const unsigned tid = m_threads.size();
+    m_threads.push_back(new thread_state());
+    m_thread_ids[pthread_self()] = tid;
+    return tid;
+}
+
+client::thread_state*
+client :: this_thread()
+{
+    return m_threads[thread_index()];
+}
+
+void
+client :: returning(thread_state* ts, pending* p)
+{
+    p->returning();
+
+    if (!p->returns_again())
+    {
+        ts->outstanding.erase(p->client_id());
+    }
+}
+
+client::thread_state*
+client :: owner(int64_t client_id)
+{
+    if (!m_threadsafe)
+    {
+        return m_threads[0];
+    }
+
+    const size_t tid = client_id & ((int64_t(1) << THREAD_ID_BITS) - 1);
+    assert(tid < m_threads.size());
+    return m_threads[tid];
+}
+
 bool
 client :: maintain_coord_connection(consus_returncode* status)
 {
+    if (m_proxied)
+    {
+        return maintain_proxy_connection(status);
+    }
+
+    // the coordinator pushes new configurations through the follow, and
+    // busybee wakes us with BUSYBEE_EXTERNAL when it does
+    if (m_config_id >= 0 && m_config_status == REPLICANT_SUCCESS)
+    {
+        return true;
+    }
+
+    return refresh_coord_connection(status);
+}
+
+bool
+client :: refresh_coord_connection(consus_returncode* status)
+{
+    // a proxied client only talks to the coordinator for the admin API, and
+    // the proxy brings it new configurations
+    if (m_proxied)
+    {
+        replicant_returncode rc;
+        replicant_client_loop(m_coord, 0, &rc);
+        return true;
+    }
+
     if (m_config_status != REPLICANT_SUCCESS)
     {
         replicant_client_kill(m_coord, m_config_id);
@@ -873,3 +1780,122 @@ client :: maintain_coord_connection(consus_returncode* status)
 
     return true;
 }
+
+bool
+client :: transmit(comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    if (!m_proxied)
+    {
+        busybee_returncode rc = m_busybee->send(id.get(), msg);
+
+        if (rc == BUSYBEE_DISRUPTED)
+        {
+            handle_disruption(id);
+        }
+
+        return rc == BUSYBEE_SUCCESS;
+    }
+
+    if (!m_proxy_ready)
+    {
+        return false;
+    }
+
+    const size_t inner = msg->size() - BUSYBEE_HEADER_SIZE;
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(PROXY_FORWARD)
+                    + pack_size(id)
+                    + inner;
+    std::auto_ptr<e::buffer> fwd(e::buffer::create(sz));
+    fwd->pack_at(BUSYBEE_HEADER_SIZE) << PROXY_FORWARD << id;
+    memmove(fwd->data() + fwd->size(), msg->data() + BUSYBEE_HEADER_SIZE, inner);
+    fwd->resize(fwd->size() + inner);
+    busybee_returncode rc = m_busybee->send(PROXY_ID, fwd);
+
+    if (rc == BUSYBEE_DISRUPTED)
+    {
+        handle_proxy_disruption();
+    }
+
+    return rc == BUSYBEE_SUCCESS;
+}
+
+bool
+client :: maintain_proxy_connection(consus_returncode* status)
+{
+    if (m_proxy_ready)
+    {
+        return true;
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE + pack_size(PROXY_HELLO);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << PROXY_HELLO;
+
+    if (m_busybee->send(PROXY_ID, msg) != BUSYBEE_SUCCESS)
+    {
+        ERROR(COORD_FAIL) << "cannot reach the proxy";
+        return false;
+    }
+
+    const uint64_t deadline = po6::monotonic_time() + PROXY_HELLO_TIMEOUT_MS * PO6_MILLIS;
+
+    while (!m_proxy_ready)
+    {
+        const uint64_t now = po6::monotonic_time();
+
+        if (now >= deadline)
+        {
+            ERROR(COORD_FAIL) << "the proxy did not send a configuration";
+            return false;
+        }
+
+        // anything else that arrives meanwhile is handled as usual
+        if (inner_loop(int((deadline - now + PO6_MILLIS - 1) / PO6_MILLIS), status) < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+client :: handle_proxy_config(e::unpacker up, consus_returncode* status)
+{
+    uint64_t prefix;
+    e::slice data;
+    up = up >> prefix >> data;
+    configuration new_config;
+    e::unpacker cup(data);
+    cup = cup >> new_config;
+
+    if (up.error() || cup.error())
+    {
+        ERROR(SERVER_ERROR) << "communication error: proxy sent an invalid configuration";
+        return false;
+    }
+
+    if (m_config.version() < new_config.version())
+    {
+        m_config = new_config;
+    }
+
+    m_nonce_prefix = prefix;
+    m_proxy_ready = true;
+    return true;
+}
+
+void
+client :: handle_proxy_disruption()
+{
+    m_proxy_ready = false;
+    std::map<std::pair<comm_id, uint64_t>, e::intrusive_ptr<pending> > disrupted;
+    disrupted.swap(m_pending);
+
+    for (std::map<std::pair<comm_id, uint64_t>, e::intrusive_ptr<pending> >::iterator it = disrupted.begin();
+            it != disrupted.end(); ++it)
+    {
+        it->second->handle_server_disruption(this, it->first.first);
+    }
+}
@@ -31,9 +31,17 @@
 // C
 #include <stdint.h>
 
+// POSIX
+#include <pthread.h>
+
 // STL
 #include <map>
 #include <list>
+#include <vector>
+
+// po6
+#include <po6/threads/cond.h>
+#include <po6/threads/mutex.h>
 
 // e
 #include <e/error.h>
@@ -49,8 +57,10 @@
 #include <consus.h>
 #include <consus-admin.h>
 #include "namespace.h"
+#include "common/rtt_estimator.h"
 #include "client/configuration.h"
 #include "client/controller.h"
+#include "client/peer_health.h"
 #include "client/pending.h"
 #include "client/server_selector.h"
 
@@ -61,46 +71,139 @@ class client
     public:
         client(const char* host, uint16_t port);
         client(const char* conn_str);
+        client(const char* conn_str, const char* proxy_host, uint16_t proxy_port);
         ~client() throw ();
 
+    public:
+        // thread safety; every public entry point must hold mutex()
+        void threadsafe();
+        po6::threads::mutex* mutex() { return &m_mtx; }
+        // re-send slow transactional reads to a second transaction manager;
+        // 0 turns hedging off
+        void hedge_reads(unsigned percentile);
+
     public:
         // public API
         int64_t loop(int timeout, consus_returncode* status);
         int64_t wait(int64_t id, int timeout, consus_returncode* status);
+        int64_t loop_many(int timeout, int64_t* ids, consus_returncode* statuses,
+                          size_t ids_sz, consus_returncode* status);
+        int poll_fd();
+        int block(int timeout);
         int64_t begin_transaction(consus_returncode* status,
                                   consus_transaction** xact);
+        int64_t begin_transaction_declared(const consus_key_hint* hints,
+                                           size_t hints_sz,
+                                           consus_returncode* status,
+                                           consus_transaction** xact);
+        int64_t stale_get(const char* table,
+                          const char* key, size_t key_sz,
+                          uint64_t timestamp,
+                          consus_returncode* status,
+                          char** value, size_t* value_sz);
+        int64_t single_get(const char* table,
+                           const char* key, size_t key_sz,
+                           consus_returncode* status,
+                           char** value, size_t* value_sz);
+        int64_t single_put(const char* table,
+                           const char* key, size_t key_sz,
+                           const char* value, size_t value_sz,
+                           consus_returncode* status);
+        int64_t single_cas(const char* table,
+                           const char* key, size_t key_sz,
+                           const char* expected, size_t expected_sz,
+                           const char* value, size_t value_sz,
+                           consus_returncode* status);
         // admin API
-        int create_data_center(const char* name, consus_returncode* status);
+        int create_data_center(const char* name, bool read_replica,
+                               consus_returncode* status);
         int set_default_data_center(const char* name, consus_returncode* status);
+        int split_partitions(const char* data_center, consus_returncode* status);
+        int set_table_replication(const char* table, unsigned replication,
+                                  consus_returncode* status);
+        int set_table_home(const char* table, const char* data_center,
+                           consus_returncode* status);
+        int set_group_quorum(uint64_t group, unsigned phase2,
+                             consus_returncode* status);
+        int set_group_witness(uint64_t group, uint64_t txman, bool witness,
+                              consus_returncode* status);
+        int kvs_export(uint64_t* timestamp, consus_returncode* status);
+        int kvs_compact(uint16_t first, uint16_t last, consus_returncode* status);
         int availability_check(consus_availability_requirements* reqs,
                                int timeout, consus_returncode* status);
         // internal semi-public API
         int debug_client_configuration(consus_returncode* status, const char** str);
         int debug_txman_configuration(consus_returncode* status, const char** str);
         int debug_kvs_configuration(consus_returncode* status, const char** str);
+        int debug_transaction_managers(consus_returncode* status,
+                                       uint64_t* ids, uint64_t* dcs, size_t* sz);
+        int64_t begin_transaction_via(uint64_t txman,
+                                      consus_returncode* status,
+                                      consus_transaction** xact);
         // error handling
         const char* error_message();
         const char* error_location();
         void set_error_message(const char* msg);
-        e::error* set_error_message() { return &m_last_error; }
+        e::error* set_error_message() { return &this_thread()->last_error; }
 
     public:
         uint64_t generate_new_nonce();
         int64_t generate_new_client_id();
         void initialize(server_selector* ss);
+        void initialize_stale(server_selector* ss);
+        const peer_health* health() const { return &m_health; }
+        // report the round trip of a request sent exactly once
+        void observe_rtt(comm_id id, uint64_t rtt);
+        // how long a read to id may go unanswered before it is hedged; 0 if
+        // reads are not hedged
+        uint64_t hedge_delay(comm_id id);
+        // report the latency of a read answered by its first request
+        void observe_read(uint64_t latency);
+        // call p->handle_timer once po6::monotonic_time() passes when
+        void schedule(uint64_t when, pending* p);
+        // forget a request whose answer is no longer wanted
+        void cancel(comm_id id, uint64_t nonce);
+        // kickstart p, an op the calling thread is issuing
+        void start(pending* p);
         void add_to_returnable(pending* p);
         bool send(uint64_t nonce, comm_id id, std::auto_ptr<e::buffer> msg, pending* p);
+        // like send, but the one message answers to each of the nonces
+        bool send(const uint64_t* nonces, size_t nonces_sz, comm_id id,
+                  std::auto_ptr<e::buffer> msg, pending* p);
         void handle_disruption(const comm_id& id);
         bool replicant_finish(int64_t id, replicant_returncode* rc, consus_returncode* status);
         bool replicant_finish(int64_t id, int timeout, replicant_returncode* rc, consus_returncode* status);
 
     private:
+        struct thread_state;
         friend class transaction;
+        // the calling thread's completions and errors; there is just one
+        // unless the client is thread safe
+        unsigned thread_index();
+        thread_state* this_thread();
+        thread_state* owner(int64_t client_id);
+        // hand p back to ts, forgetting it once it will not return again
+        void returning(thread_state* ts, pending* p);
         // returns the ID of something that made progress; does not guarantee
         // that it can return, so verify that at the callsite
         int64_t inner_loop(int timeout, consus_returncode* status);
         int64_t post_loop(consus_returncode* status);
+        // run every elapsed timer, and shorten timeout to the next one
+        void fire_timers();
+        int timer_timeout(int timeout);
+        // cheap enough for every operation: it only re-establishes the
+        // follow of the configuration when it has failed or never started
         bool maintain_coord_connection(consus_returncode* status);
+        // drain the coordinator and adopt any newer configuration; runs when
+        // busybee reports the coordinator's descriptor readable
+        bool refresh_coord_connection(consus_returncode* status);
+        // send msg to id, through the proxy if there is one
+        bool transmit(comm_id id, std::auto_ptr<e::buffer> msg);
+        // say hello to the proxy and wait for its configuration
+        bool maintain_proxy_connection(consus_returncode* status);
+        bool handle_proxy_config(e::unpacker up, consus_returncode* status);
+        // every op in flight through the proxy is as good as disrupted
+        void handle_proxy_disruption();
 
     private:
         // configuration
@@ -114,16 +217,33 @@ class client
         // communication
         controller m_busybee_controller;
         const std::auto_ptr<busybee_client> m_busybee;
+        // proxy; the nonce prefix names this client's block of nonces
+        bool m_proxied;
+        bool m_proxy_ready;
+        uint64_t m_nonce_prefix;
         // nonces
         int64_t m_next_client_id;
         uint64_t m_next_server_nonce;
         // operations
         std::map<std::pair<comm_id, uint64_t>, e::intrusive_ptr<pending> > m_pending;
-        std::list<e::intrusive_ptr<pending> > m_returnable;
-        e::intrusive_ptr<pending> m_returned;
+        std::multimap<uint64_t, e::intrusive_ptr<pending> > m_timers;
+        // threads
+        bool m_threadsafe;
+        po6::threads::mutex m_mtx;
+        po6::threads::cond m_progress;
+        bool m_receiving;
+        std::map<pthread_t, unsigned> m_thread_ids;
+        std::vector<thread_state*> m_threads;
+        // locality
+        rtt_estimator m_rtt;
+        peer_health m_health;
+        uint64_t m_selections;
+        // hedging
+        unsigned m_hedge_percentile;
+        std::vector<uint64_t> m_read_latencies;
+        size_t m_read_latencies_idx;
         // misc
         e::flagfd m_flagfd;
-        e::error m_last_error;
 
     private:
         client(const client&);
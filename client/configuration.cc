@@ -25,17 +25,26 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <algorithm>
+
 // consus
 #include "common/client_configuration.h"
 #include "client/configuration.h"
 
 using consus::configuration;
 
+// how often to try an unmeasured transaction manager first
+#define CONFIG_EXPLORE_INTERVAL 8
+
 configuration :: configuration()
     : m_cluster()
     , m_version()
     , m_flags(0)
     , m_txmans()
+    , m_readers()
 {
 }
 
@@ -44,6 +53,7 @@ configuration :: configuration(const configuration& other)
     , m_version(other.m_version)
     , m_flags(other.m_flags)
     , m_txmans(other.m_txmans)
+    , m_readers(other.m_readers)
 {
 }
 
@@ -62,20 +72,87 @@ configuration :: get_address(const comm_id& id) const
         }
     }
 
+    for (size_t i = 0; i < m_readers.size(); ++i)
+    {
+        if (m_readers[i].id == id)
+        {
+            return m_readers[i].bind_to;
+        }
+    }
+
     return po6::net::location();
 }
 
 void
-configuration :: initialize(server_selector* ss)
+configuration :: initialize(server_selector* ss, rtt_estimator* rtt,
+                            const peer_health* health, uint64_t rotate,
+                            bool stale)
 {
+    std::vector<txman> candidates(m_txmans);
+
+    if (stale)
+    {
+        candidates.insert(candidates.end(), m_readers.begin(), m_readers.end());
+    }
+
+    const size_t n = candidates.size();
+    std::vector<uint64_t> srtts(n, UINT64_MAX);
+    size_t nearest = n;
+    size_t unmeasured = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!rtt->smoothed(candidates[i].id, &srtts[i]))
+        {
+            ++unmeasured;
+        }
+        else if (nearest == n || srtts[i] < srtts[nearest])
+        {
+            nearest = i;
+        }
+    }
+
+    // (class, rank, index):  class 0 is the home data center, rotated; class
+    // 1 is everything else that has been measured, nearest first; class 2 is
+    // unmeasured, rotated.  Every CONFIG_EXPLORE_INTERVAL selections an
+    // unmeasured txman goes first so that a wrong guess of home corrects
+    // itself.
+    const bool explore = unmeasured > 0 && rotate % CONFIG_EXPLORE_INTERVAL == 0;
+    std::vector<std::pair<std::pair<unsigned, uint64_t>, size_t> > order;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        const uint64_t rotated = (i + rotate) % n;
+        unsigned cls = 2;
+        uint64_t rank = rotated;
+
+        if (nearest < n && candidates[i].dc == candidates[nearest].dc)
+        {
+            cls = 0;
+        }
+        else if (srtts[i] != UINT64_MAX)
+        {
+            cls = 1;
+            rank = srtts[i];
+        }
+
+        if (explore)
+        {
+            cls = srtts[i] == UINT64_MAX ? 0 : cls + 1;
+        }
+
+        order.push_back(std::make_pair(std::make_pair(cls, rank), i));
+    }
+
+    std::sort(order.begin(), order.end());
     std::vector<comm_id> ids;
 
-    for (size_t i = 0; i < m_txmans.size(); ++i)
+    for (size_t i = 0; i < order.size(); ++i)
     {
-        ids.push_back(m_txmans[i].id);
+        ids.push_back(candidates[order[i].second].id);
     }
 
-    ss->set(&ids[0], ids.size());
+    ss->set(&ids[0], ids.size(), health);
 }
 
 configuration&
@@ -87,6 +164,7 @@ configuration :: operator = (const configuration& rhs)
         m_version = rhs.m_version;
         m_flags = rhs.m_flags;
         m_txmans = rhs.m_txmans;
+        m_readers = rhs.m_readers;
     }
 
     return *this;
@@ -95,5 +173,6 @@ configuration :: operator = (const configuration& rhs)
 e::unpacker
 consus :: operator >> (e::unpacker up, configuration& rhs)
 {
-    return client_configuration(up, &rhs.m_cluster, &rhs.m_version, &rhs.m_flags, &rhs.m_txmans);
+    return client_configuration(up, &rhs.m_cluster, &rhs.m_version, &rhs.m_flags,
+                                &rhs.m_txmans, &rhs.m_readers);
 }
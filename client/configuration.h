@@ -40,6 +40,7 @@
 // consus
 #include "namespace.h"
 #include "common/ids.h"
+#include "common/rtt_estimator.h"
 #include "common/txman.h"
 #include "client/server_selector.h"
 
@@ -61,7 +62,14 @@ class configuration
     public:
         bool exists(const comm_id& id) const;
         po6::net::location get_address(const comm_id& id) const;
-        void initialize(server_selector* ss);
+        // orders the transaction managers so that those in the client's own
+        // data center (that of the nearest measured txman) come first,
+        // rotated by "rotate" to spread load, followed by the rest nearest
+        // first; the selector passes over members health suspects; stale
+        // reads may go to the transaction managers of read replicas too
+        void initialize(server_selector* ss, rtt_estimator* rtt,
+                        const peer_health* health, uint64_t rotate,
+                        bool stale);
 
     public:
         configuration& operator = (const configuration& rhs);
@@ -74,6 +82,8 @@ class configuration
         version_id m_version;
         uint64_t m_flags;
         std::vector<txman> m_txmans;
+        // in read replicas, for stale reads only
+        std::vector<txman> m_readers;
 };
 
 std::ostream&
@@ -47,6 +47,18 @@ int consus_debug_txman_configuration(struct consus_client* client,
 int consus_debug_kvs_configuration(struct consus_client* client,
                                    enum consus_returncode* status,
                                    const char** str);
+/* the (id, data center) of up to *sz transaction managers that clients may
+ * begin transactions at; *sz becomes how many there are */
+int consus_debug_transaction_managers(struct consus_client* client,
+                                      enum consus_returncode* status,
+                                      uint64_t* ids, uint64_t* dcs, size_t* sz);
+/* begin a transaction at the transaction manager with id txman, and fail
+ * rather than go elsewhere; for probing one route at a time */
+int64_t consus_begin_transaction_via(struct consus_client* client, uint64_t txman,
+                                     enum consus_returncode* status,
+                                     struct consus_transaction** xact);
+/* the paxos group that coordinates xact */
+uint64_t consus_transaction_origin(struct consus_transaction* xact);
 
 #ifdef __cplusplus
 } /* extern "C" */
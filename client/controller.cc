@@ -32,6 +32,8 @@ using consus::controller;
 
 controller :: controller(const configuration* config)
     : m_config(config)
+    , m_proxy_id(0)
+    , m_proxy()
 {
 }
 
@@ -42,5 +44,17 @@ controller :: ~controller() throw ()
 po6::net::location
 controller :: lookup(uint64_t id)
 {
+    if (m_proxy_id != 0 && id == m_proxy_id)
+    {
+        return m_proxy;
+    }
+
     return m_config->get_address(comm_id(id));
 }
+
+void
+controller :: set_proxy(uint64_t id, const po6::net::location& proxy)
+{
+    m_proxy_id = id;
+    m_proxy = proxy;
+}
@@ -45,6 +45,8 @@ class controller : public ::busybee_controller
 
     public:
         virtual po6::net::location lookup(uint64_t id);
+        // answer lookups of id with the proxy's address
+        void set_proxy(uint64_t id, const po6::net::location& proxy);
 
     private:
         controller(const controller&);
@@ -52,6 +54,8 @@ class controller : public ::busybee_controller
 
     private:
         const configuration* m_config;
+        uint64_t m_proxy_id;
+        po6::net::location m_proxy;
 };
 
 END_CONSUS_NAMESPACE
@@ -0,0 +1,70 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "client/peer_health.h"
+
+using consus::peer_health;
+
+// long enough to ride out a txman restart without piling requests on it
+#define HEALTH_QUARANTINE (PO6_SECONDS * 10)
+
+peer_health :: peer_health()
+    : m_suspects()
+{
+}
+
+peer_health :: ~peer_health() throw ()
+{
+}
+
+void
+peer_health :: disrupted(comm_id id)
+{
+    m_suspects[id] = po6::monotonic_time();
+}
+
+void
+peer_health :: alive(comm_id id)
+{
+    if (!m_suspects.empty())
+    {
+        m_suspects.erase(id);
+    }
+}
+
+bool
+peer_health :: suspect(comm_id id) const
+{
+    std::map<comm_id, uint64_t>::const_iterator it = m_suspects.find(id);
+    return it != m_suspects.end() &&
+           po6::monotonic_time() < it->second + HEALTH_QUARANTINE;
+}
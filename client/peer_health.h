@@ -0,0 +1,70 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_client_peer_health_h_
+#define consus_client_peer_health_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Remembers which transaction managers BusyBee recently reported as
+// disrupted so that requests go to live members first.  A peer is suspect
+// until it is heard from again or the quarantine passes; suspects are still
+// tried once every live member has been.
+class peer_health
+{
+    public:
+        peer_health();
+        ~peer_health() throw ();
+
+    public:
+        void disrupted(comm_id id);
+        void alive(comm_id id);
+        bool suspect(comm_id id) const;
+
+    private:
+        // when each suspect was last disrupted, per po6::monotonic_time
+        std::map<comm_id, uint64_t> m_suspects;
+
+    private:
+        peer_health(const peer_health&);
+        peer_health& operator = (const peer_health&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_client_peer_health_h_
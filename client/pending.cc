@@ -47,6 +47,12 @@ pending :: returning()
 {
 }
 
+bool
+pending :: returns_again()
+{
+    return false;
+}
+
 void
 pending :: handle_server_failure(client*, comm_id)
 {
@@ -71,6 +77,11 @@ pending :: transaction_finished(client*, const transaction_group&, uint64_t)
     return false;
 }
 
+void
+pending :: handle_timer(client*)
+{
+}
+
 std::ostream&
 pending :: error(const char* file, size_t line)
 {
@@ -65,6 +65,8 @@ class pending
     // will be called once per time the pending returns from these calls
     public:
         virtual void returning();
+        // true if, having just returned, this operation will return again
+        virtual bool returns_again();
 
     // state machine
     public:
@@ -79,6 +81,8 @@ class pending
                                        std::auto_ptr<e::buffer> msg,
                                        e::unpacker up);
         virtual bool transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome);
+        // a time passed to client::schedule has come
+        virtual void handle_timer(client* cl);
 
     // refcount
     protected:
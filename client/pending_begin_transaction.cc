@@ -25,6 +25,12 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <string.h>
+
+// po6
+#include <po6/time.h>
+
 // BusyBee
 #include <busybee.h>
 
@@ -40,12 +46,82 @@ using consus::pending_begin_transaction;
 
 pending_begin_transaction :: pending_begin_transaction(int64_t client_id,
                                                        consus_returncode* status,
-                                                       consus_transaction** xact)
+                                                       consus_transaction** xact,
+                                                       transaction* restart)
+    : pending(client_id, status)
+    , m_xact(xact)
+    , m_restart(restart)
+    , m_priority(restart ? restart->txid().start : 0)
+    , m_ss()
+    , m_pinned()
+    , m_target()
+    , m_sent(0)
+    , m_sends(0)
+    , m_busy(false)
+    , m_hints()
+    , m_hints_sz(0)
+{
+    if (m_xact)
+    {
+        *m_xact = NULL;
+    }
+}
+
+pending_begin_transaction :: pending_begin_transaction(int64_t client_id,
+                                                       consus_returncode* status,
+                                                       consus_transaction** xact,
+                                                       comm_id txman)
     : pending(client_id, status)
     , m_xact(xact)
+    , m_restart(NULL)
+    , m_priority(0)
     , m_ss()
+    , m_pinned(txman)
+    , m_target()
+    , m_sent(0)
+    , m_sends(0)
+    , m_busy(false)
+    , m_hints()
+    , m_hints_sz(0)
 {
-    *m_xact = NULL;
+    if (m_xact)
+    {
+        *m_xact = NULL;
+    }
+}
+
+pending_begin_transaction :: pending_begin_transaction(int64_t client_id,
+                                                       consus_returncode* status,
+                                                       consus_transaction** xact,
+                                                       const consus_key_hint* hints,
+                                                       size_t hints_sz)
+    : pending(client_id, status)
+    , m_xact(xact)
+    , m_restart(NULL)
+    , m_priority(0)
+    , m_ss()
+    , m_pinned()
+    , m_target()
+    , m_sent(0)
+    , m_sends(0)
+    , m_busy(false)
+    , m_hints()
+    , m_hints_sz(hints_sz)
+{
+    if (m_xact)
+    {
+        *m_xact = NULL;
+    }
+
+    e::packer pa(&m_hints);
+
+    for (size_t i = 0; i < hints_sz; ++i)
+    {
+        const uint8_t flags = hints[i].flags & (CONSUS_HINT_READ | CONSUS_HINT_WRITE);
+        pa = pa << e::slice(hints[i].table)
+                << e::slice(hints[i].key, hints[i].key_sz)
+                << flags;
+    }
 }
 
 pending_begin_transaction :: ~pending_begin_transaction() throw ()
@@ -55,13 +131,21 @@ pending_begin_transaction :: ~pending_begin_transaction() throw ()
 std::string
 pending_begin_transaction :: describe()
 {
-    return "pending_begin_transaction()";
+    return m_restart ? "pending_begin_transaction(restart)" : "pending_begin_transaction()";
 }
 
 void
 pending_begin_transaction :: kickstart_state_machine(client* cl)
 {
-    cl->initialize(&m_ss);
+    if (m_pinned != comm_id())
+    {
+        m_ss.set(&m_pinned, 1);
+    }
+    else
+    {
+        cl->initialize(&m_ss);
+    }
+
     send_request(cl);
 }
 
@@ -86,7 +170,18 @@ pending_begin_transaction :: handle_busybee_op(client* cl,
     consus_returncode rc;
     transaction_id txid;
     std::vector<comm_id> ids;
-    up = up >> rc >> txid >> ids;
+    up = up >> rc;
+
+    // an overloaded transaction manager turns the begin away before doing
+    // any work for it, so another one may take it instead
+    if (!up.error() && rc == CONSUS_BUSY)
+    {
+        m_busy = true;
+        send_request(cl);
+        return;
+    }
+
+    up = up >> txid >> ids;
 
     if (up.error())
     {
@@ -95,8 +190,22 @@ pending_begin_transaction :: handle_busybee_op(client* cl,
         return;
     }
 
-    transaction* t = new transaction(cl, txid, &ids[0], ids.size());
-    *m_xact = reinterpret_cast<consus_transaction*>(t);
+    // Karn's rule:  a begin that was retried says nothing about either server
+    if (m_sends == 1)
+    {
+        cl->observe_rtt(m_target, po6::monotonic_time() - m_sent);
+    }
+
+    if (m_restart)
+    {
+        m_restart->restart(txid, &ids[0], ids.size());
+    }
+    else
+    {
+        transaction* t = new transaction(cl, txid, &ids[0], ids.size());
+        *m_xact = reinterpret_cast<consus_transaction*>(t);
+    }
+
     this->success();
     cl->add_to_returnable(this);
 }
@@ -104,6 +213,13 @@ pending_begin_transaction :: handle_busybee_op(client* cl,
 bool
 pending_begin_transaction :: transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome)
 {
+    // the restarted transaction's previous attempt is over; this one has
+    // not yet begun
+    if (m_restart)
+    {
+        return false;
+    }
+
     if (m_xact && reinterpret_cast<transaction*>(m_xact)->txid() != tg.txid)
     {
         return false;
@@ -134,10 +250,17 @@ pending_begin_transaction :: send_request(client* cl)
         const uint64_t nonce = cl->generate_new_nonce();
         const size_t sz = BUSYBEE_HEADER_SIZE
                         + pack_size(TXMAN_BEGIN)
-                        + VARINT_64_MAX_SIZE;
+                        + 3 * VARINT_64_MAX_SIZE
+                        + m_hints.size();
         comm_id id = m_ss.next();
 
-        if (id == comm_id())
+        if (id == comm_id() && m_busy)
+        {
+            PENDING_ERROR(BUSY) << "every transaction manager is overloaded; retry later";
+            cl->add_to_returnable(this);
+            return;
+        }
+        else if (id == comm_id())
         {
             PENDING_ERROR(UNAVAILABLE) << "insufficient number of servers to ensure durability";
             cl->add_to_returnable(this);
@@ -145,10 +268,26 @@ pending_begin_transaction :: send_request(client* cl)
         }
 
         std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_BEGIN << e::pack_varint(nonce);
+        e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_BEGIN << e::pack_varint(nonce);
+
+        if (m_priority != 0 || m_hints_sz > 0)
+        {
+            pa = pa << e::pack_varint(m_priority);
+        }
+
+        // declared keys follow the priority, which is then always sent
+        if (m_hints_sz > 0)
+        {
+            pa = pa << e::pack_varint(m_hints_sz);
+            memmove(msg->data() + msg->size(), m_hints.data(), m_hints.size());
+            msg->resize(msg->size() + m_hints.size());
+        }
 
         if (cl->send(nonce, id, msg, this))
         {
+            ++m_sends;
+            m_target = id;
+            m_sent = po6::monotonic_time();
             return;
         }
     }
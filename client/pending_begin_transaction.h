@@ -33,13 +33,28 @@
 #include "client/server_selector.h"
 
 BEGIN_CONSUS_NAMESPACE
+class transaction;
 
 class pending_begin_transaction : public pending
 {
     public:
+        // with restart, begins anew in place of that aborted transaction and
+        // keeps its priority; xact may then be NULL
         pending_begin_transaction(int64_t client_id,
                                   consus_returncode* status,
-                                  consus_transaction** xact);
+                                  consus_transaction** xact,
+                                  transaction* restart = NULL);
+        // begins only at txman, never failing over to another
+        pending_begin_transaction(int64_t client_id,
+                                  consus_returncode* status,
+                                  consus_transaction** xact,
+                                  comm_id txman);
+        // declares keys for the transaction manager to lock and prefetch
+        pending_begin_transaction(int64_t client_id,
+                                  consus_returncode* status,
+                                  consus_transaction** xact,
+                                  const consus_key_hint* hints,
+                                  size_t hints_sz);
         virtual ~pending_begin_transaction() throw ();
 
     public:
@@ -58,7 +73,18 @@ class pending_begin_transaction : public pending
 
     private:
         consus_transaction** m_xact;
+        transaction* m_restart;
+        uint64_t m_priority;
         server_selector m_ss;
+        comm_id m_pinned;
+        comm_id m_target;
+        uint64_t m_sent;
+        unsigned m_sends;
+        // some server turned the begin away as overloaded
+        bool m_busy;
+        // the declared keys, packed as they go on the wire
+        std::string m_hints;
+        uint64_t m_hints_sz;
 
     private:
         pending_begin_transaction(const pending_begin_transaction&);
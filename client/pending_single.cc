@@ -0,0 +1,246 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// e
+#include <e/strescape.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/constants.h"
+#include "common/consus.h"
+#include "client/client.h"
+#include "client/pending_single.h"
+
+using consus::pending_single;
+
+pending_single :: pending_single(int64_t client_id,
+                                 consus_returncode* status,
+                                 single_t kind,
+                                 update_t update,
+                                 const char* table,
+                                 const char* key, size_t key_sz,
+                                 const char* expected, size_t expected_sz,
+                                 const char* value, size_t value_sz,
+                                 char** value_out, size_t* value_out_sz)
+    : pending(client_id, status)
+    , m_kind(kind)
+    , m_update(update)
+    , m_table(table)
+    , m_key(key, key_sz)
+    , m_expected(expected ? std::string(expected, expected_sz) : std::string())
+    , m_value(value ? std::string(value, value_sz) : std::string())
+    , m_value_out(value_out)
+    , m_value_out_sz(value_out_sz)
+    , m_ss()
+    , m_busy(false)
+{
+}
+
+pending_single :: ~pending_single() throw ()
+{
+}
+
+std::string
+pending_single :: describe()
+{
+    std::ostringstream ostr;
+    ostr << "pending_single(kind=" << unsigned(m_kind)
+         << ", table=\"" << e::strescape(m_table)
+         << "\", key=\"" << e::strescape(m_key) << "\")";
+    return ostr.str();
+}
+
+void
+pending_single :: kickstart_state_machine(client* cl)
+{
+    cl->initialize(&m_ss);
+    send_request(cl);
+}
+
+void
+pending_single :: handle_server_failure(client* cl, comm_id)
+{
+    retry_or_fail(cl);
+}
+
+void
+pending_single :: handle_server_disruption(client* cl, comm_id)
+{
+    retry_or_fail(cl);
+}
+
+void
+pending_single :: handle_busybee_op(client* cl,
+                                    uint64_t,
+                                    std::auto_ptr<e::buffer>,
+                                    e::unpacker up)
+{
+    consus_returncode rc;
+    up = up >> rc;
+
+    // turned away before it took the lock, so another server may take it
+    if (!up.error() && rc == CONSUS_BUSY)
+    {
+        m_busy = true;
+        send_request(cl);
+        return;
+    }
+
+    // refused because another data center holds the table too; every server
+    // would refuse it
+    if (!up.error() && rc == CONSUS_INVALID)
+    {
+        PENDING_ERROR(INVALID) << "table \"" << e::strescape(m_table)
+                               << "\" is held by more than one data center; use a transaction";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    uint64_t timestamp;
+    e::slice value;
+    up = up >> timestamp >> value;
+
+    if (up.error())
+    {
+        PENDING_ERROR(SERVER_ERROR) << "server sent a corrupt response to \"single\"";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    if (rc == CONSUS_SUCCESS && m_kind == SINGLE_GET)
+    {
+        char* tmp = static_cast<char*>(malloc(value.size() + 1));
+
+        if (!tmp)
+        {
+            PENDING_ERROR(SEE_ERRNO) << po6::strerror(errno);
+            cl->add_to_returnable(this);
+            return;
+        }
+
+        memmove(tmp, value.data(), value.size());
+        tmp[value.size()] = '\0';
+        *m_value_out = tmp;
+        *m_value_out_sz = value.size();
+        this->success();
+    }
+    else if (rc == CONSUS_SUCCESS)
+    {
+        this->success();
+    }
+    else if (rc == CONSUS_NOT_FOUND)
+    {
+        *m_value_out = NULL;
+        *m_value_out_sz = 0;
+        set_status(CONSUS_NOT_FOUND);
+        error(__FILE__, __LINE__) << "value not found";
+    }
+    else if (rc == CONSUS_COMPARE_FAILED)
+    {
+        set_status(CONSUS_COMPARE_FAILED);
+        error(__FILE__, __LINE__) << "the key did not hold the expected value";
+    }
+    else
+    {
+        set_status(rc);
+        error(__FILE__, __LINE__) << "server sent failure code";
+    }
+
+    cl->add_to_returnable(this);
+}
+
+bool
+pending_single :: transaction_finished(client*, const transaction_group&, uint64_t)
+{
+    return false;
+}
+
+// A get may simply be asked again.  A put or update that was sent may have
+// been applied, and sending it again could overwrite a write that followed
+// it or apply the update twice, so the caller must decide.
+void
+pending_single :: retry_or_fail(client* cl)
+{
+    if (m_kind == SINGLE_GET)
+    {
+        send_request(cl);
+        return;
+    }
+
+    PENDING_ERROR(UNAVAILABLE) << "server failed with the write outstanding; it may or may not have been applied";
+    cl->add_to_returnable(this);
+}
+
+void
+pending_single :: send_request(client* cl)
+{
+    while (true)
+    {
+        const uint64_t nonce = cl->generate_new_nonce();
+        const uint8_t kind = m_kind;
+        const uint8_t update = m_update;
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(TXMAN_SINGLE)
+                        + VARINT_64_MAX_SIZE
+                        + 2 * sizeof(uint8_t)
+                        + pack_size(e::slice(m_table))
+                        + pack_size(e::slice(m_key))
+                        + pack_size(e::slice(m_expected))
+                        + pack_size(e::slice(m_value));
+        comm_id id = m_ss.next();
+
+        if (id == comm_id() && m_busy)
+        {
+            PENDING_ERROR(BUSY) << "every transaction manager is overloaded; retry later";
+            cl->add_to_returnable(this);
+            return;
+        }
+        else if (id == comm_id())
+        {
+            PENDING_ERROR(UNAVAILABLE) << "no transaction managers available for the operation";
+            cl->add_to_returnable(this);
+            return;
+        }
+
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << TXMAN_SINGLE << e::pack_varint(nonce) << kind << update
+            << e::slice(m_table) << e::slice(m_key)
+            << e::slice(m_expected) << e::slice(m_value);
+
+        if (cl->send(nonce, id, msg, this))
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,187 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// e
+#include <e/strescape.h>
+
+// treadstone
+#include <treadstone.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/constants.h"
+#include "common/consus.h"
+#include "client/client.h"
+#include "client/pending_stale_read.h"
+
+using consus::pending_stale_read;
+
+pending_stale_read :: pending_stale_read(int64_t client_id,
+                                         consus_returncode* status,
+                                         const char* table,
+                                         const unsigned char* key, size_t key_sz,
+                                         unsigned char* key_backing,
+                                         uint64_t timestamp,
+                                         char** value, size_t* value_sz)
+    : pending(client_id, status)
+    , m_ss()
+    , m_table(table)
+    , m_key(key, key_sz)
+    , m_key_backing(key_backing)
+    , m_timestamp(timestamp)
+    , m_value(value)
+    , m_value_sz(value_sz)
+{
+}
+
+pending_stale_read :: ~pending_stale_read() throw ()
+{
+    free(m_key_backing);
+}
+
+std::string
+pending_stale_read :: describe()
+{
+    std::ostringstream ostr;
+    ostr << "pending_stale_read(table=\"" << e::strescape(m_table)
+         << "\", key=\"" << e::strescape(m_key.str())
+         << "\", timestamp=" << m_timestamp << ")";
+    return ostr.str();
+}
+
+void
+pending_stale_read :: kickstart_state_machine(client* cl)
+{
+    cl->initialize_stale(&m_ss);
+    send_request(cl);
+}
+
+void
+pending_stale_read :: handle_server_failure(client* cl, comm_id)
+{
+    send_request(cl);
+}
+
+void
+pending_stale_read :: handle_server_disruption(client* cl, comm_id)
+{
+    send_request(cl);
+}
+
+void
+pending_stale_read :: handle_busybee_op(client* cl,
+                                        uint64_t,
+                                        std::auto_ptr<e::buffer>,
+                                        e::unpacker up)
+{
+    consus_returncode rc;
+    uint64_t timestamp;
+    e::slice value;
+    up = up >> rc >> timestamp >> value;
+
+    if (up.error())
+    {
+        PENDING_ERROR(SERVER_ERROR) << "server sent a corrupt response to \"stale-read\"";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        char* tmp = NULL;
+
+        if (treadstone_binary_to_json(value.data(), value.size(), &tmp))
+        {
+            PENDING_ERROR(SEE_ERRNO) << po6::strerror(errno);
+            cl->add_to_returnable(this);
+            return;
+        }
+
+        *m_value = tmp;
+        *m_value_sz = strlen(tmp);
+        this->success();
+    }
+    else if (rc == CONSUS_NOT_FOUND)
+    {
+        *m_value = NULL;
+        *m_value_sz = 0;
+        set_status(CONSUS_NOT_FOUND);
+        error(__FILE__, __LINE__) << "value not found";
+    }
+    else
+    {
+        set_status(rc);
+        error(__FILE__, __LINE__) << "server sent failure code";
+    }
+
+    cl->add_to_returnable(this);
+}
+
+bool
+pending_stale_read :: transaction_finished(client*, const transaction_group&, uint64_t)
+{
+    return false;
+}
+
+void
+pending_stale_read :: send_request(client* cl)
+{
+    while (true)
+    {
+        const uint64_t nonce = cl->generate_new_nonce();
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(TXMAN_READ_STALE)
+                        + VARINT_64_MAX_SIZE
+                        + pack_size(e::slice(m_table))
+                        + pack_size(m_key)
+                        + sizeof(uint64_t);
+        comm_id id = m_ss.next();
+
+        if (id == comm_id())
+        {
+            PENDING_ERROR(UNAVAILABLE) << "no transaction managers available for the read";
+            cl->add_to_returnable(this);
+            return;
+        }
+
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << TXMAN_READ_STALE << e::pack_varint(nonce)
+            << e::slice(m_table) << m_key << m_timestamp;
+
+        if (cl->send(nonce, id, msg, this))
+        {
+            return;
+        }
+    }
+}
@@ -45,6 +45,7 @@ pending_transaction_commit :: pending_transaction_commit(int64_t client_id,
     , m_xact(xact)
     , m_ss()
     , m_slot(slot)
+    , m_writes()
 {
 }
 
@@ -52,6 +53,17 @@ pending_transaction_commit :: ~pending_transaction_commit() throw ()
 {
 }
 
+void
+pending_transaction_commit :: add_write(uint64_t slot, const std::string& table,
+                                        const std::string& key, const std::string& value)
+{
+    m_writes.push_back(write());
+    m_writes.back().slot = slot;
+    m_writes.back().table = table;
+    m_writes.back().key = key;
+    m_writes.back().value = value;
+}
+
 std::string
 pending_transaction_commit :: describe()
 {
@@ -128,10 +140,19 @@ pending_transaction_commit :: send_request(client* cl)
     while (true)
     {
         const uint64_t nonce = m_xact->parent()->generate_new_nonce();
-        const size_t sz = BUSYBEE_HEADER_SIZE
-                        + pack_size(TXMAN_COMMIT)
-                        + pack_size(m_xact->txid())
-                        + 2 * VARINT_64_MAX_SIZE;
+        size_t sz = BUSYBEE_HEADER_SIZE
+                  + pack_size(TXMAN_COMMIT)
+                  + pack_size(m_xact->txid())
+                  + 3 * VARINT_64_MAX_SIZE;
+
+        for (size_t i = 0; i < m_writes.size(); ++i)
+        {
+            sz += VARINT_64_MAX_SIZE
+                + pack_size(e::slice(m_writes[i].table))
+                + pack_size(e::slice(m_writes[i].key))
+                + pack_size(e::slice(m_writes[i].value));
+        }
+
         comm_id id = m_ss.next();
 
         if (id == comm_id())
@@ -143,11 +164,24 @@ pending_transaction_commit :: send_request(client* cl)
         }
 
         std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE)
+        e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
             << TXMAN_COMMIT << m_xact->txid()
             << e::pack_varint(nonce)
             << e::pack_varint(m_slot);
 
+        if (!m_writes.empty())
+        {
+            pa = pa << e::pack_varint(m_writes.size());
+
+            for (size_t i = 0; i < m_writes.size(); ++i)
+            {
+                pa = pa << e::pack_varint(m_writes[i].slot)
+                        << e::slice(m_writes[i].table)
+                        << e::slice(m_writes[i].key)
+                        << e::slice(m_writes[i].value);
+            }
+        }
+
         if (cl->send(nonce, id, msg, this))
         {
             return;
@@ -28,6 +28,10 @@
 #ifndef consus_client_pending_transaction_commit_h_
 #define consus_client_pending_transaction_commit_h_
 
+// STL
+#include <string>
+#include <vector>
+
 // consus
 #include "client/pending.h"
 #include "client/server_selector.h"
@@ -44,6 +48,11 @@ class pending_transaction_commit : public pending
                                    uint64_t slot);
         virtual ~pending_transaction_commit() throw ();
 
+    public:
+        // a buffered write to send along with the commit
+        void add_write(uint64_t slot, const std::string& table,
+                       const std::string& key, const std::string& value);
+
     public:
         virtual std::string describe();
         virtual void kickstart_state_machine(client* cl);
@@ -56,12 +65,21 @@ class pending_transaction_commit : public pending
         virtual bool transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome);
 
     private:
+        struct write
+        {
+            write() : slot(0), table(), key(), value() {}
+            uint64_t slot;
+            std::string table;
+            std::string key;
+            std::string value;
+        };
         void send_request(client* cl);
 
     private:
         transaction* m_xact;
         server_selector m_ss;
         const uint64_t m_slot;
+        std::vector<write> m_writes;
 
     private:
         pending_transaction_commit(const pending_transaction_commit&);
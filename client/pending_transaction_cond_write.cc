@@ -0,0 +1,261 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// e
+#include <e/strescape.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/constants.h"
+#include "common/consus.h"
+#include "client/client.h"
+#include "client/pending_transaction_cond_write.h"
+#include "client/transaction.h"
+
+using consus::pending_transaction_cond_write;
+
+pending_transaction_cond_write :: pending_transaction_cond_write(int64_t client_id,
+                                                                 consus_returncode* status,
+                                                                 transaction* xact,
+                                                                 uint64_t slot,
+                                                                 const char* table,
+                                                                 update_t update,
+                                                                 const unsigned char* key, size_t key_sz,
+                                                                 const unsigned char* expected, size_t expected_sz,
+                                                                 const unsigned char* value, size_t value_sz,
+                                                                 unsigned char* key_backing,
+                                                                 unsigned char* expected_backing,
+                                                                 unsigned char* value_backing)
+    : pending(client_id, status)
+    , m_xact(xact)
+    , m_ss()
+    , m_slot(slot)
+    , m_table(table)
+    , m_key(key, key_sz)
+    , m_update(update)
+    , m_expected(expected, expected_sz)
+    , m_value(value, value_sz)
+    , m_key_backing(key_backing)
+    , m_expected_backing(expected_backing)
+    , m_value_backing(value_backing)
+    , m_local(false)
+    , m_local_rc(CONSUS_GARBAGE)
+{
+}
+
+pending_transaction_cond_write :: ~pending_transaction_cond_write() throw ()
+{
+    free(m_key_backing);
+    free(m_expected_backing);
+    free(m_value_backing);
+}
+
+std::string
+pending_transaction_cond_write :: describe()
+{
+    std::ostringstream ostr;
+    ostr << "pending_transaction_cond_write(id=" << m_xact->txid()
+         << ", table=\"" << e::strescape(m_table)
+         << "\", update=" << unsigned(m_update)
+         << ", key=\"" << e::strescape(m_key.str())
+         << "\", expected=\"" << e::strescape(m_expected.str())
+         << "\", value=\"" << e::strescape(m_value.str()) << "\")";
+    return ostr.str();
+}
+
+void
+pending_transaction_cond_write :: returning()
+{
+    m_xact->retire_slot(m_slot);
+}
+
+void
+pending_transaction_cond_write :: set_local(consus_returncode rc)
+{
+    m_local = true;
+    m_local_rc = rc;
+}
+
+void
+pending_transaction_cond_write :: kickstart_state_machine(client* cl)
+{
+    if (m_local && m_local_rc == CONSUS_COMPARE_FAILED)
+    {
+        set_status(CONSUS_COMPARE_FAILED);
+        error(__FILE__, __LINE__) << "condition does not hold";
+        cl->add_to_returnable(this);
+        return;
+    }
+    else if (m_local)
+    {
+        PENDING_ERROR(INVALID) << "the stored value is not of the form the update expects";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    m_xact->initialize(&m_ss);
+    send_request(cl);
+}
+
+void
+pending_transaction_cond_write :: handle_server_failure(client* cl, comm_id)
+{
+    send_request(cl);
+}
+
+void
+pending_transaction_cond_write :: handle_server_disruption(client* cl, comm_id)
+{
+    send_request(cl);
+}
+
+void
+pending_transaction_cond_write :: handle_busybee_op(client* cl,
+                                                    uint64_t,
+                                                    std::auto_ptr<e::buffer>,
+                                                    e::unpacker up)
+{
+    consus_returncode rc;
+    e::slice value(m_value);
+    up = up >> rc;
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> value;
+    }
+
+    if (up.error())
+    {
+        m_xact->mark_aborted();
+        PENDING_ERROR(SERVER_ERROR) << "server sent a corrupt response to \"transaction-cond-write\"";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    if (rc == CONSUS_COMPARE_FAILED)
+    {
+        set_status(CONSUS_COMPARE_FAILED);
+        error(__FILE__, __LINE__) << "condition does not hold";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    if (rc == CONSUS_INVALID)
+    {
+        PENDING_ERROR(INVALID) << "the stored value is not of the form the update expects";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        m_xact->mark_aborted();
+        set_status(rc);
+        error(__FILE__, __LINE__) << "server sent failure code";
+        cl->add_to_returnable(this);
+        return;
+    }
+
+    // counters and sets come back as the value written
+    m_xact->record_written(m_table.c_str(), m_key, value);
+    this->success();
+    cl->add_to_returnable(this);
+}
+
+bool
+pending_transaction_cond_write :: transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome)
+{
+    if (reinterpret_cast<transaction*>(m_xact)->txid() != tg.txid)
+    {
+        return false;
+    }
+
+    if (outcome == CONSUS_VOTE_COMMIT)
+    {
+        PENDING_ERROR(COMMITTED) << "transaction has been committed";
+    }
+    else if (outcome == CONSUS_VOTE_ABORT)
+    {
+        PENDING_ERROR(ABORTED) << "transaction has been aborted";
+    }
+    else
+    {
+        PENDING_ERROR(SERVER_ERROR) << "transaction terminated in state unknown to the client";
+    }
+
+    cl->add_to_returnable(this);
+    return true;
+}
+
+void
+pending_transaction_cond_write :: send_request(client* cl)
+{
+    while (true)
+    {
+        const uint64_t nonce = m_xact->parent()->generate_new_nonce();
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(TXMAN_COND_WRITE)
+                        + pack_size(m_xact->txid())
+                        + 2 * VARINT_64_MAX_SIZE
+                        + pack_size(e::slice(m_table))
+                        + pack_size(m_key)
+                        + sizeof(uint8_t)
+                        + pack_size(m_expected)
+                        + pack_size(m_value);
+        comm_id id = m_ss.next();
+
+        if (id == comm_id())
+        {
+            m_xact->mark_aborted();
+            PENDING_ERROR(UNAVAILABLE) << "insufficient number of servers to ensure durability";
+            cl->add_to_returnable(this);
+            return;
+        }
+
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << TXMAN_COND_WRITE << m_xact->txid()
+            << e::pack_varint(nonce)
+            << e::pack_varint(m_slot)
+            << e::slice(m_table)
+            << m_key
+            << uint8_t(m_update)
+            << m_expected
+            << m_value;
+
+        if (cl->send(nonce, id, msg, this))
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,361 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// e
+#include <e/strescape.h>
+
+// treadstone
+#include <treadstone.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/constants.h"
+#include "common/consus.h"
+#include "client/client.h"
+#include "client/pending_transaction_multi.h"
+#include "client/transaction.h"
+
+using consus::pending_transaction_multi;
+
+pending_transaction_multi :: op :: op()
+    : write(false)
+    , slot(0)
+    , nonce(0)
+    , key()
+    , value()
+    , out_value(NULL)
+    , out_value_sz(NULL)
+    , done(false)
+{
+}
+
+pending_transaction_multi :: pending_transaction_multi(int64_t client_id,
+                                                       consus_returncode* status,
+                                                       transaction* xact,
+                                                       const char* table)
+    : pending(client_id, status)
+    , m_xact(xact)
+    , m_ss()
+    , m_table(table)
+    , m_ops()
+    , m_backings()
+    , m_target()
+    , m_outstanding(0)
+    , m_finished(false)
+{
+}
+
+pending_transaction_multi :: ~pending_transaction_multi() throw ()
+{
+    for (size_t i = 0; i < m_backings.size(); ++i)
+    {
+        free(m_backings[i]);
+    }
+}
+
+void
+pending_transaction_multi :: add_read(uint64_t slot, const e::slice& key,
+                                      char** value, size_t* value_sz)
+{
+    op o;
+    o.slot = slot;
+    o.key = key;
+    o.out_value = value;
+    o.out_value_sz = value_sz;
+    *value = NULL;
+    *value_sz = 0;
+    m_ops.push_back(o);
+    ++m_outstanding;
+}
+
+void
+pending_transaction_multi :: add_write(uint64_t slot, const e::slice& key, const e::slice& value)
+{
+    op o;
+    o.write = true;
+    o.slot = slot;
+    o.key = key;
+    o.value = value;
+    m_ops.push_back(o);
+    ++m_outstanding;
+}
+
+void
+pending_transaction_multi :: add_backing(unsigned char* backing)
+{
+    m_backings.push_back(backing);
+}
+
+std::string
+pending_transaction_multi :: describe()
+{
+    std::ostringstream ostr;
+    ostr << "pending_transaction_multi(id=" << m_xact->txid()
+         << ", table=\"" << e::strescape(m_table)
+         << "\", ops=" << m_ops.size()
+         << ", outstanding=" << m_outstanding << ")";
+    return ostr.str();
+}
+
+void
+pending_transaction_multi :: returning()
+{
+    if (!m_ops.empty())
+    {
+        m_xact->retire_slot(m_ops[0].slot);
+    }
+}
+
+void
+pending_transaction_multi :: kickstart_state_machine(client* cl)
+{
+    // every write was buffered; nothing to send until the commit
+    if (m_ops.empty())
+    {
+        this->success();
+        finish(cl);
+        return;
+    }
+
+    m_xact->initialize(&m_ss);
+    send_request(cl);
+}
+
+void
+pending_transaction_multi :: handle_server_failure(client* cl, comm_id si)
+{
+    // one call per registered nonce; only the first should resend
+    if (!m_finished && si == m_target)
+    {
+        send_request(cl);
+    }
+}
+
+void
+pending_transaction_multi :: handle_server_disruption(client* cl, comm_id si)
+{
+    if (!m_finished && si == m_target)
+    {
+        send_request(cl);
+    }
+}
+
+void
+pending_transaction_multi :: handle_busybee_op(client* cl,
+                                               uint64_t nonce,
+                                               std::auto_ptr<e::buffer>,
+                                               e::unpacker up)
+{
+    if (m_finished)
+    {
+        return;
+    }
+
+    op* o = NULL;
+
+    for (size_t i = 0; i < m_ops.size(); ++i)
+    {
+        if (m_ops[i].nonce == nonce && !m_ops[i].done)
+        {
+            o = &m_ops[i];
+            break;
+        }
+    }
+
+    if (!o)
+    {
+        return;
+    }
+
+    consus_returncode rc;
+    uint64_t timestamp;
+    e::slice value;
+    up = up >> rc;
+
+    if (!o->write && (rc == CONSUS_SUCCESS || rc == CONSUS_NOT_FOUND))
+    {
+        up = up >> timestamp >> value;
+    }
+
+    if (up.error())
+    {
+        m_xact->mark_aborted();
+        PENDING_ERROR(SERVER_ERROR) << "server sent a corrupt response to \"transaction-multi\"";
+        finish(cl);
+        return;
+    }
+
+    if (rc != CONSUS_SUCCESS && (o->write || rc != CONSUS_NOT_FOUND))
+    {
+        m_xact->mark_aborted();
+        set_status(rc);
+        error(__FILE__, __LINE__) << "server sent failure code";
+        finish(cl);
+        return;
+    }
+
+    if (!o->write && rc == CONSUS_SUCCESS)
+    {
+        char* tmp = NULL;
+
+        if (treadstone_binary_to_json(value.data(), value.size(), &tmp))
+        {
+            PENDING_ERROR(SEE_ERRNO) << po6::strerror(errno);
+            finish(cl);
+            return;
+        }
+
+        *o->out_value = tmp;
+        *o->out_value_sz = strlen(tmp);
+    }
+
+    o->done = true;
+    assert(m_outstanding > 0);
+    --m_outstanding;
+
+    if (m_outstanding == 0)
+    {
+        this->success();
+        finish(cl);
+    }
+}
+
+bool
+pending_transaction_multi :: transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome)
+{
+    if (reinterpret_cast<transaction*>(m_xact)->txid() != tg.txid)
+    {
+        return false;
+    }
+
+    // called once per outstanding nonce
+    if (m_finished)
+    {
+        return true;
+    }
+
+    if (outcome == CONSUS_VOTE_COMMIT)
+    {
+        PENDING_ERROR(COMMITTED) << "transaction has been committed";
+    }
+    else if (outcome == CONSUS_VOTE_ABORT)
+    {
+        PENDING_ERROR(ABORTED) << "transaction has been aborted";
+    }
+    else
+    {
+        PENDING_ERROR(SERVER_ERROR) << "transaction terminated in state unknown to the client";
+    }
+
+    finish(cl);
+    return true;
+}
+
+void
+pending_transaction_multi :: send_request(client* cl)
+{
+    while (true)
+    {
+        size_t sz = BUSYBEE_HEADER_SIZE
+                  + pack_size(TXMAN_MULTI)
+                  + pack_size(m_xact->txid())
+                  + VARINT_64_MAX_SIZE;
+        std::vector<uint64_t> nonces;
+
+        for (size_t i = 0; i < m_ops.size(); ++i)
+        {
+            if (m_ops[i].done)
+            {
+                continue;
+            }
+
+            m_ops[i].nonce = m_xact->parent()->generate_new_nonce();
+            nonces.push_back(m_ops[i].nonce);
+            sz += sizeof(uint8_t)
+                + 2 * VARINT_64_MAX_SIZE
+                + pack_size(e::slice(m_table))
+                + pack_size(m_ops[i].key)
+                + (m_ops[i].write ? pack_size(m_ops[i].value) : 0);
+        }
+
+        comm_id id = m_ss.next();
+
+        if (id == comm_id())
+        {
+            m_xact->mark_aborted();
+            PENDING_ERROR(UNAVAILABLE) << "insufficient number of servers to ensure durability";
+            finish(cl);
+            return;
+        }
+
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << TXMAN_MULTI << m_xact->txid()
+            << e::pack_varint(nonces.size());
+
+        for (size_t i = 0; i < m_ops.size(); ++i)
+        {
+            if (m_ops[i].done)
+            {
+                continue;
+            }
+
+            uint8_t write = m_ops[i].write ? 1 : 0;
+            pa = pa << write
+                    << e::pack_varint(m_ops[i].nonce)
+                    << e::pack_varint(m_ops[i].slot)
+                    << e::slice(m_table)
+                    << m_ops[i].key;
+
+            if (m_ops[i].write)
+            {
+                pa = pa << m_ops[i].value;
+            }
+        }
+
+        m_target = id;
+
+        if (cl->send(&nonces[0], nonces.size(), id, msg, this))
+        {
+            return;
+        }
+    }
+}
+
+void
+pending_transaction_multi :: finish(client* cl)
+{
+    m_finished = true;
+    cl->add_to_returnable(this);
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_client_pending_transaction_multi_h_
+#define consus_client_pending_transaction_multi_h_
+
+// STL
+#include <vector>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "client/pending.h"
+#include "client/server_selector.h"
+
+BEGIN_CONSUS_NAMESPACE
+class transaction;
+
+// Several reads or writes of one transaction carried in a single TXMAN_MULTI
+// message.  Each operation has its own slot and nonce, so the transaction
+// manager treats it exactly as if it had been issued separately.
+class pending_transaction_multi : public pending
+{
+    public:
+        pending_transaction_multi(int64_t client_id,
+                                  consus_returncode* status,
+                                  transaction* xact,
+                                  const char* table);
+        virtual ~pending_transaction_multi() throw ();
+
+    public:
+        // key and value must point into memory owned by this object (see
+        // add_backing) or by the caller for the lifetime of the operation
+        void add_read(uint64_t slot, const e::slice& key,
+                      char** value, size_t* value_sz);
+        void add_write(uint64_t slot, const e::slice& key, const e::slice& value);
+        void add_backing(unsigned char* backing);
+
+    public:
+        virtual std::string describe();
+        virtual void returning();
+        virtual void kickstart_state_machine(client* cl);
+        virtual void handle_server_failure(client* cl, comm_id si);
+        virtual void handle_server_disruption(client* cl, comm_id si);
+        virtual void handle_busybee_op(client* cl,
+                                       uint64_t nonce,
+                                       std::auto_ptr<e::buffer> msg,
+                                       e::unpacker up);
+        virtual bool transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome);
+
+    private:
+        struct op
+        {
+            op();
+            bool write;
+            uint64_t slot;
+            uint64_t nonce;
+            e::slice key;
+            e::slice value;
+            char** out_value;
+            size_t* out_value_sz;
+            bool done;
+        };
+        void send_request(client* cl);
+        void finish(client* cl);
+
+    private:
+        transaction* m_xact;
+        server_selector m_ss;
+        std::string m_table;
+        std::vector<op> m_ops;
+        std::vector<unsigned char*> m_backings;
+        comm_id m_target;
+        size_t m_outstanding;
+        bool m_finished;
+
+    private:
+        pending_transaction_multi(const pending_transaction_multi&);
+        pending_transaction_multi& operator = (const pending_transaction_multi&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_client_pending_transaction_multi_h_
@@ -25,6 +25,13 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// po6
+#include <po6/time.h>
+
 // e
 #include <e/strescape.h>
 
@@ -49,20 +56,48 @@ pending_transaction_read :: pending_transaction_read(int64_t client_id,
                                                      uint64_t slot,
                                                      const char* table,
                                                      const unsigned char* key, size_t key_sz,
+                                                     unsigned char* key_backing, bool binary,
                                                      char** value, size_t* value_sz)
     : pending(client_id, status)
     , m_xact(xact)
     , m_ss()
     , m_slot(slot)
     , m_table(table)
-    , m_key(key, key + key_sz)
+    , m_key(key, key_sz)
+    , m_key_backing(key_backing)
+    , m_binary(binary)
     , m_value(value)
     , m_value_sz(value_sz)
+    , m_buf(NULL)
+    , m_buf_sz(0)
+    , m_local(false)
+    , m_local_value()
+    , m_outstanding()
+    , m_first_nonce(0)
+    , m_sent(0)
+    , m_hedge_at(0)
+    , m_hedged(false)
+    , m_done(false)
 {
 }
 
 pending_transaction_read :: ~pending_transaction_read() throw ()
 {
+    free(m_key_backing);
+}
+
+void
+pending_transaction_read :: set_local(const std::string& value)
+{
+    m_local = true;
+    m_local_value = value;
+}
+
+void
+pending_transaction_read :: set_buffer(char* buf, size_t buf_sz)
+{
+    m_buf = buf;
+    m_buf_sz = buf_sz;
 }
 
 std::string
@@ -71,35 +106,69 @@ pending_transaction_read :: describe()
     std::ostringstream ostr;
     ostr << "pending_transaction_read(id=" << m_xact->txid()
          << ", table=\"" << e::strescape(m_table)
-         << "\", key=\"" << e::strescape(m_key) << "\")";
+         << "\", key=\"" << e::strescape(m_key.str()) << "\")";
     return ostr.str();
 }
 
+void
+pending_transaction_read :: returning()
+{
+    m_xact->retire_slot(m_slot);
+}
+
 void
 pending_transaction_read :: kickstart_state_machine(client* cl)
 {
+    if (m_local)
+    {
+        complete(cl, CONSUS_SUCCESS, e::slice(m_local_value));
+        return;
+    }
+
     m_xact->initialize(&m_ss);
     send_request(cl);
 }
 
 void
-pending_transaction_read :: handle_server_failure(client* cl, comm_id)
+pending_transaction_read :: handle_server_failure(client* cl, comm_id id)
 {
-    send_request(cl);
+    lost(cl, id);
 }
 
 void
-pending_transaction_read :: handle_server_disruption(client* cl, comm_id)
+pending_transaction_read :: handle_server_disruption(client* cl, comm_id id)
 {
-    send_request(cl);
+    lost(cl, id);
 }
 
 void
 pending_transaction_read :: handle_busybee_op(client* cl,
-                                              uint64_t,
+                                              uint64_t nonce,
                                               std::auto_ptr<e::buffer>,
                                               e::unpacker up)
 {
+    if (m_done)
+    {
+        return;
+    }
+
+    m_done = true;
+
+    for (size_t i = 0; i < m_outstanding.size(); ++i)
+    {
+        if (m_outstanding[i].second != nonce)
+        {
+            cl->cancel(m_outstanding[i].first, m_outstanding[i].second);
+        }
+    }
+
+    m_outstanding.clear();
+
+    if (nonce == m_first_nonce)
+    {
+        cl->observe_read(po6::monotonic_time() - m_sent);
+    }
+
     consus_returncode rc;
     uint64_t timestamp;
     e::slice value;
@@ -113,6 +182,12 @@ pending_transaction_read :: handle_busybee_op(client* cl,
         return;
     }
 
+    complete(cl, rc, value);
+}
+
+void
+pending_transaction_read :: complete(client* cl, consus_returncode rc, const e::slice& value)
+{
     if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
     {
         m_xact->mark_aborted();
@@ -122,7 +197,42 @@ pending_transaction_read :: handle_busybee_op(client* cl,
         return;
     }
 
-    if (rc == CONSUS_SUCCESS)
+    if (rc == CONSUS_SUCCESS && m_buf)
+    {
+        *m_value_sz = value.size();
+
+        if (value.size() > m_buf_sz)
+        {
+            PENDING_ERROR(INVALID) << "value of " << value.size()
+                                   << " bytes does not fit the "
+                                   << m_buf_sz << " byte buffer";
+            cl->add_to_returnable(this);
+            return;
+        }
+
+        memmove(m_buf, value.data(), value.size());
+        this->success();
+        cl->add_to_returnable(this);
+    }
+    else if (rc == CONSUS_SUCCESS && m_binary)
+    {
+        char* tmp = static_cast<char*>(malloc(value.size() + 1));
+
+        if (!tmp)
+        {
+            PENDING_ERROR(SEE_ERRNO) << po6::strerror(errno);
+            cl->add_to_returnable(this);
+            return;
+        }
+
+        memmove(tmp, value.data(), value.size());
+        tmp[value.size()] = '\0';
+        *m_value = tmp;
+        *m_value_sz = value.size();
+        this->success();
+        cl->add_to_returnable(this);
+    }
+    else if (rc == CONSUS_SUCCESS)
     {
         char* tmp = NULL;
 
@@ -140,7 +250,11 @@ pending_transaction_read :: handle_busybee_op(client* cl,
     }
     else if (rc == CONSUS_NOT_FOUND)
     {
-        *m_value = NULL;
+        if (m_value)
+        {
+            *m_value = NULL;
+        }
+
         *m_value_sz = 0;
         set_status(CONSUS_NOT_FOUND);
         error(__FILE__, __LINE__) << "value not found";
@@ -160,6 +274,15 @@ pending_transaction_read :: transaction_finished(client* cl, const transaction_g
         return false;
     }
 
+    // a hedged read is in m_pending more than once, but finishes once
+    if (m_done)
+    {
+        return true;
+    }
+
+    m_done = true;
+    m_outstanding.clear();
+
     if (outcome == CONSUS_VOTE_COMMIT)
     {
         PENDING_ERROR(COMMITTED) << "transaction has been committed";
@@ -177,18 +300,36 @@ pending_transaction_read :: transaction_finished(client* cl, const transaction_g
     return true;
 }
 
+void
+pending_transaction_read :: handle_timer(client* cl)
+{
+    // hedge at most once, and only a request that is still alone
+    if (m_done || m_hedged || m_outstanding.size() != 1 ||
+        po6::monotonic_time() < m_hedge_at)
+    {
+        return;
+    }
+
+    m_hedged = true;
+
+    while (true)
+    {
+        comm_id id = m_ss.next();
+        uint64_t nonce;
+
+        // no other member to ask; keep waiting on the first
+        if (id == comm_id() || send_to(cl, id, &nonce))
+        {
+            return;
+        }
+    }
+}
+
 void
 pending_transaction_read :: send_request(client* cl)
 {
     while (true)
     {
-        const uint64_t nonce = m_xact->parent()->generate_new_nonce();
-        const size_t sz = BUSYBEE_HEADER_SIZE
-                        + pack_size(TXMAN_READ)
-                        + pack_size(m_xact->txid())
-                        + 2 * VARINT_64_MAX_SIZE
-                        + pack_size(e::slice(m_table))
-                        + pack_size(e::slice(m_key));
         comm_id id = m_ss.next();
 
         if (id == comm_id())
@@ -199,17 +340,69 @@ pending_transaction_read :: send_request(client* cl)
             return;
         }
 
-        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE)
-            << TXMAN_READ << m_xact->txid()
-            << e::pack_varint(nonce)
-            << e::pack_varint(m_slot)
-            << e::slice(m_table)
-            << e::slice(m_key);
+        if (send_to(cl, id, &m_first_nonce))
+        {
+            break;
+        }
+    }
+
+    m_sent = po6::monotonic_time();
+    const uint64_t delay = m_hedged ? 0 : cl->hedge_delay(m_outstanding.back().first);
+
+    if (delay > 0)
+    {
+        m_hedge_at = m_sent + delay;
+        cl->schedule(m_hedge_at, this);
+    }
+}
+
+bool
+pending_transaction_read :: send_to(client* cl, comm_id id, uint64_t* nonce)
+{
+    *nonce = m_xact->parent()->generate_new_nonce();
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(TXMAN_READ)
+                    + pack_size(m_xact->txid())
+                    + 2 * VARINT_64_MAX_SIZE
+                    + pack_size(e::slice(m_table))
+                    + pack_size(m_key);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << TXMAN_READ << m_xact->txid()
+        << e::pack_varint(*nonce)
+        << e::pack_varint(m_slot)
+        << e::slice(m_table)
+        << m_key;
 
-        if (cl->send(nonce, id, msg, this))
+    if (!cl->send(*nonce, id, msg, this))
+    {
+        return false;
+    }
+
+    m_outstanding.push_back(std::make_pair(id, *nonce));
+    return true;
+}
+
+void
+pending_transaction_read :: lost(client* cl, comm_id id)
+{
+    for (size_t i = 0; i < m_outstanding.size(); )
+    {
+        if (m_outstanding[i].first == id)
         {
-            return;
+            cl->cancel(m_outstanding[i].first, m_outstanding[i].second);
+            m_outstanding[i] = m_outstanding.back();
+            m_outstanding.pop_back();
+        }
+        else
+        {
+            ++i;
         }
     }
+
+    // a hedged copy may still answer
+    if (!m_done && m_outstanding.empty())
+    {
+        send_request(cl);
+    }
 }
@@ -28,6 +28,13 @@
 #ifndef consus_client_pending_transaction_read_h_
 #define consus_client_pending_transaction_read_h_
 
+// STL
+#include <utility>
+#include <vector>
+
+// e
+#include <e/slice.h>
+
 // consus
 #include "client/pending.h"
 #include "client/server_selector.h"
@@ -44,11 +51,19 @@ class pending_transaction_read : public pending
                                  uint64_t slot,
                                  const char* table,
                                  const unsigned char* key, size_t key_sz,
+                                 unsigned char* key_backing, bool binary,
                                  char** value, size_t* value_sz);
         virtual ~pending_transaction_read() throw ();
 
+    public:
+        // answer with value instead of asking the transaction manager
+        void set_local(const std::string& value);
+        // copy the value into buf rather than allocating it
+        void set_buffer(char* buf, size_t buf_sz);
+
     public:
         virtual std::string describe();
+        virtual void returning();
         virtual void kickstart_state_machine(client* cl);
         virtual void handle_server_failure(client* cl, comm_id si);
         virtual void handle_server_disruption(client* cl, comm_id si);
@@ -57,18 +72,36 @@ class pending_transaction_read : public pending
                                        std::auto_ptr<e::buffer> msg,
                                        e::unpacker up);
         virtual bool transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome);
+        virtual void handle_timer(client* cl);
 
     private:
         void send_request(client* cl);
+        bool send_to(client* cl, comm_id id, uint64_t* nonce);
+        void lost(client* cl, comm_id id);
+        void complete(client* cl, consus_returncode rc, const e::slice& value);
 
     private:
         transaction* m_xact;
         server_selector m_ss;
         const uint64_t m_slot;
         std::string m_table;
-        std::string m_key;
+        e::slice m_key;
+        unsigned char* m_key_backing;
+        bool m_binary;
         char** m_value;
         size_t* m_value_sz;
+        char* m_buf;
+        size_t m_buf_sz;
+        bool m_local;
+        std::string m_local_value;
+        // every copy of the request still awaiting an answer; the first
+        // answer wins and the rest are cancelled
+        std::vector<std::pair<comm_id, uint64_t> > m_outstanding;
+        uint64_t m_first_nonce;
+        uint64_t m_sent;
+        uint64_t m_hedge_at;
+        bool m_hedged;
+        bool m_done;
 
     private:
         pending_transaction_read(const pending_transaction_read&);
@@ -0,0 +1,388 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <algorithm>
+
+// e
+#include <e/strescape.h>
+
+// treadstone
+#include <treadstone.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/constants.h"
+#include "common/consus.h"
+#include "client/client.h"
+#include "client/pending_transaction_scan.h"
+#include "client/transaction.h"
+
+// Keys requested from the transaction manager at a time.
+#define SCAN_CHUNK 64
+// Request the next chunk once fewer than this many keys remain buffered.
+#define SCAN_PREFETCH 16
+
+using consus::pending_transaction_scan;
+
+pending_transaction_scan :: pending_transaction_scan(int64_t client_id,
+                                                     consus_returncode* status,
+                                                     transaction* xact,
+                                                     const char* table,
+                                                     const unsigned char* key, size_t key_sz,
+                                                     uint64_t n,
+                                                     char** key_out, size_t* key_out_sz,
+                                                     char** value, size_t* value_sz)
+    : pending(client_id, status)
+    , m_xact(xact)
+    , m_ss()
+    , m_table(table)
+    , m_next(reinterpret_cast<const char*>(key), key_sz)
+    , m_remaining(n)
+    , m_items()
+    , m_exhausted(false)
+    , m_requesting(false)
+    , m_returnable(false)
+    , m_finished(false)
+    , m_nonce(0)
+    , m_target()
+    , m_fail_status(CONSUS_SUCCESS)
+    , m_fail_msg()
+    , m_key_out(key_out)
+    , m_key_out_sz(key_out_sz)
+    , m_value(value)
+    , m_value_sz(value_sz)
+{
+}
+
+pending_transaction_scan :: ~pending_transaction_scan() throw ()
+{
+}
+
+std::string
+pending_transaction_scan :: describe()
+{
+    std::ostringstream ostr;
+    ostr << "pending_transaction_scan(id=" << m_xact->txid()
+         << ", table=\"" << e::strescape(m_table)
+         << "\", next=\"" << e::strescape(m_next)
+         << "\", remaining=" << m_remaining << ")";
+    return ostr.str();
+}
+
+void
+pending_transaction_scan :: returning()
+{
+    client* cl = m_xact->parent();
+    m_returnable = false;
+    *m_key_out = NULL;
+    *m_key_out_sz = 0;
+    *m_value = NULL;
+    *m_value_sz = 0;
+
+    if (m_finished)
+    {
+        return;
+    }
+
+    if (m_items.empty() || m_remaining == 0)
+    {
+        m_finished = true;
+
+        if (m_fail_status != CONSUS_SUCCESS)
+        {
+            set_status(m_fail_status);
+            error(__FILE__, __LINE__) << m_fail_msg;
+        }
+        else
+        {
+            this->success();
+            set_status(CONSUS_SCAN_DONE);
+        }
+
+        return;
+    }
+
+    const std::pair<std::string, std::string>& item(m_items.front());
+    char* k = NULL;
+    char* v = NULL;
+
+    if (treadstone_binary_to_json(reinterpret_cast<const unsigned char*>(item.first.data()),
+                                  item.first.size(), &k) ||
+        treadstone_binary_to_json(reinterpret_cast<const unsigned char*>(item.second.data()),
+                                  item.second.size(), &v))
+    {
+        free(k);
+        m_finished = true;
+        PENDING_ERROR(SEE_ERRNO) << po6::strerror(errno);
+        return;
+    }
+
+    *m_key_out = k;
+    *m_key_out_sz = strlen(k);
+    *m_value = v;
+    *m_value_sz = strlen(v);
+    m_items.pop_front();
+    --m_remaining;
+    this->success();
+
+    if (!m_exhausted && !m_requesting &&
+        m_items.size() < SCAN_PREFETCH &&
+        m_items.size() < m_remaining)
+    {
+        send_request(cl);
+    }
+
+    // with nothing buffered, the response to the request above makes this
+    // returnable again
+    if (!m_items.empty() || m_exhausted || m_remaining == 0)
+    {
+        make_returnable(cl);
+    }
+}
+
+void
+pending_transaction_scan :: kickstart_state_machine(client* cl)
+{
+    m_xact->initialize(&m_ss);
+
+    if (m_remaining == 0)
+    {
+        m_exhausted = true;
+        make_returnable(cl);
+        return;
+    }
+
+    send_request(cl);
+}
+
+void
+pending_transaction_scan :: handle_server_failure(client* cl, comm_id si)
+{
+    if (m_requesting && si == m_target)
+    {
+        m_requesting = false;
+        m_target = m_ss.next();
+        send_request(cl);
+    }
+}
+
+void
+pending_transaction_scan :: handle_server_disruption(client* cl, comm_id si)
+{
+    if (m_requesting && si == m_target)
+    {
+        m_requesting = false;
+        m_target = m_ss.next();
+        send_request(cl);
+    }
+}
+
+void
+pending_transaction_scan :: handle_busybee_op(client* cl,
+                                              uint64_t nonce,
+                                              std::auto_ptr<e::buffer>,
+                                              e::unpacker up)
+{
+    if (m_finished || !m_requesting || nonce != m_nonce)
+    {
+        return;
+    }
+
+    m_requesting = false;
+    consus_returncode rc;
+    up = up >> rc;
+
+    if (up.error())
+    {
+        fail(cl, CONSUS_SERVER_ERROR, "server sent a corrupt response to \"transaction-scan\"");
+        return;
+    }
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        fail(cl, rc, "server sent failure code");
+        return;
+    }
+
+    uint8_t done;
+    e::slice last;
+    uint64_t items_sz;
+    up = up >> done >> last >> items_sz;
+
+    for (uint64_t i = 0; i < items_sz && !up.error(); ++i)
+    {
+        e::slice k;
+        uint64_t timestamp;
+        e::slice v;
+        up = up >> k >> timestamp >> v;
+        m_items.push_back(std::make_pair(k.str(), v.str()));
+    }
+
+    if (up.error())
+    {
+        fail(cl, CONSUS_SERVER_ERROR, "server sent a corrupt response to \"transaction-scan\"");
+        return;
+    }
+
+    while (m_items.size() > m_remaining)
+    {
+        m_items.pop_back();
+    }
+
+    if (done)
+    {
+        m_exhausted = true;
+    }
+    else
+    {
+        // appending a zero byte yields the smallest key after "last"
+        m_next = last.str();
+        m_next.push_back('\0');
+    }
+
+    if (!m_items.empty() || m_exhausted)
+    {
+        make_returnable(cl);
+    }
+    else
+    {
+        // no live keys before the stores' horizon; continue past it
+        send_request(cl);
+    }
+}
+
+bool
+pending_transaction_scan :: transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome)
+{
+    if (reinterpret_cast<transaction*>(m_xact)->txid() != tg.txid)
+    {
+        return false;
+    }
+
+    m_requesting = false;
+
+    if (outcome == CONSUS_VOTE_COMMIT)
+    {
+        fail(cl, CONSUS_COMMITTED, "transaction has been committed");
+    }
+    else if (outcome == CONSUS_VOTE_ABORT)
+    {
+        fail(cl, CONSUS_ABORTED, "transaction has been aborted");
+    }
+    else
+    {
+        fail(cl, CONSUS_SERVER_ERROR, "transaction terminated in state unknown to the client");
+    }
+
+    return true;
+}
+
+void
+pending_transaction_scan :: send_request(client* cl)
+{
+    assert(!m_requesting);
+    assert(m_remaining > m_items.size());
+    const uint64_t limit = std::min(uint64_t(SCAN_CHUNK), m_remaining - m_items.size());
+
+    if (m_target == comm_id())
+    {
+        m_target = m_ss.next();
+    }
+
+    while (true)
+    {
+        const uint64_t nonce = m_xact->parent()->generate_new_nonce();
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(TXMAN_SCAN)
+                        + pack_size(m_xact->txid())
+                        + 2 * VARINT_64_MAX_SIZE
+                        + pack_size(e::slice(m_table))
+                        + pack_size(e::slice(m_next));
+
+        if (m_target == comm_id())
+        {
+            fail(cl, CONSUS_UNAVAILABLE, "insufficient number of servers to ensure durability");
+            return;
+        }
+
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << TXMAN_SCAN << m_xact->txid()
+            << e::pack_varint(nonce)
+            << e::slice(m_table)
+            << e::slice(m_next)
+            << e::pack_varint(limit);
+
+        if (cl->send(nonce, m_target, msg, this))
+        {
+            m_nonce = nonce;
+            m_requesting = true;
+            return;
+        }
+
+        m_target = m_ss.next();
+    }
+}
+
+void
+pending_transaction_scan :: fail(client* cl, consus_returncode rc, const std::string& msg)
+{
+    m_items.clear();
+    m_exhausted = true;
+
+    if (m_fail_status == CONSUS_SUCCESS)
+    {
+        m_fail_status = rc;
+        m_fail_msg = msg;
+    }
+
+    make_returnable(cl);
+}
+
+bool
+pending_transaction_scan :: returns_again()
+{
+    return !m_finished;
+}
+
+void
+pending_transaction_scan :: make_returnable(client* cl)
+{
+    if (!m_returnable && !m_finished)
+    {
+        m_returnable = true;
+        cl->add_to_returnable(this);
+    }
+}
@@ -0,0 +1,105 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_client_pending_transaction_scan_h_
+#define consus_client_pending_transaction_scan_h_
+
+// STL
+#include <list>
+#include <string>
+
+// consus
+#include "client/pending.h"
+#include "client/server_selector.h"
+
+BEGIN_CONSUS_NAMESPACE
+class transaction;
+
+// Streams the first n keys >= a start key.  The operation returns once per key
+// with CONSUS_SUCCESS, and a final time with CONSUS_SCAN_DONE (or an error).
+// Keys are fetched from the transaction manager in bounded chunks, and the
+// next chunk is requested while the current one is being consumed.
+class pending_transaction_scan : public pending
+{
+    public:
+        pending_transaction_scan(int64_t client_id,
+                                 consus_returncode* status,
+                                 transaction* xact,
+                                 const char* table,
+                                 const unsigned char* key, size_t key_sz,
+                                 uint64_t n,
+                                 char** key_out, size_t* key_out_sz,
+                                 char** value, size_t* value_sz);
+        virtual ~pending_transaction_scan() throw ();
+
+    public:
+        virtual std::string describe();
+        virtual void returning();
+        virtual bool returns_again();
+        virtual void kickstart_state_machine(client* cl);
+        virtual void handle_server_failure(client* cl, comm_id si);
+        virtual void handle_server_disruption(client* cl, comm_id si);
+        virtual void handle_busybee_op(client* cl,
+                                       uint64_t nonce,
+                                       std::auto_ptr<e::buffer> msg,
+                                       e::unpacker up);
+        virtual bool transaction_finished(client* cl, const transaction_group& tg, uint64_t outcome);
+
+    private:
+        void send_request(client* cl);
+        void fail(client* cl, consus_returncode rc, const std::string& msg);
+        void make_returnable(client* cl);
+
+    private:
+        transaction* m_xact;
+        server_selector m_ss;
+        std::string m_table;
+        // where the next chunk starts
+        std::string m_next;
+        uint64_t m_remaining;
+        std::list<std::pair<std::string, std::string> > m_items;
+        bool m_exhausted;
+        bool m_requesting;
+        bool m_returnable;
+        bool m_finished;
+        uint64_t m_nonce;
+        comm_id m_target;
+        consus_returncode m_fail_status;
+        std::string m_fail_msg;
+        char** m_key_out;
+        size_t* m_key_out_sz;
+        char** m_value;
+        size_t* m_value_sz;
+
+    private:
+        pending_transaction_scan(const pending_transaction_scan&);
+        pending_transaction_scan& operator = (const pending_transaction_scan&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_client_pending_transaction_scan_h_
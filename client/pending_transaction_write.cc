@@ -25,6 +25,10 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <stdlib.h>
+#include <string.h>
+
 // e
 #include <e/strescape.h>
 
@@ -46,19 +50,26 @@ pending_transaction_write :: pending_transaction_write(int64_t client_id,
                                                        uint64_t slot,
                                                        const char* table,
                                                        const unsigned char* key, size_t key_sz,
-                                                       const unsigned char* value, size_t value_sz)
+                                                       const unsigned char* value, size_t value_sz,
+                                                       unsigned char* key_backing,
+                                                       unsigned char* value_backing)
     : pending(client_id, status)
     , m_xact(xact)
     , m_ss()
     , m_slot(slot)
     , m_table(table)
-    , m_key(key, key + key_sz)
-    , m_value(value, value + value_sz)
+    , m_key(key, key_sz)
+    , m_value(value, value_sz)
+    , m_key_backing(key_backing)
+    , m_value_backing(value_backing)
+    , m_local(false)
 {
 }
 
 pending_transaction_write :: ~pending_transaction_write() throw ()
 {
+    free(m_key_backing);
+    free(m_value_backing);
 }
 
 std::string
@@ -67,14 +78,33 @@ pending_transaction_write :: describe()
     std::ostringstream ostr;
     ostr << "pending_transaction_write(id=" << m_xact->txid()
          << ", table=\"" << e::strescape(m_table)
-         << "\", key=\"" << e::strescape(m_key)
-         << "\", value=\"" << e::strescape(m_value) << "\")";
+         << "\", key=\"" << e::strescape(m_key.str())
+         << "\", value=\"" << e::strescape(m_value.str()) << "\")";
     return ostr.str();
 }
 
+void
+pending_transaction_write :: returning()
+{
+    m_xact->retire_slot(m_slot);
+}
+
+void
+pending_transaction_write :: set_local()
+{
+    m_local = true;
+}
+
 void
 pending_transaction_write :: kickstart_state_machine(client* cl)
 {
+    if (m_local)
+    {
+        this->success();
+        cl->add_to_returnable(this);
+        return;
+    }
+
     m_xact->initialize(&m_ss);
     send_request(cl);
 }
@@ -157,8 +187,8 @@ pending_transaction_write :: send_request(client* cl)
                         + pack_size(m_xact->txid())
                         + 2 * VARINT_64_MAX_SIZE
                         + pack_size(e::slice(m_table))
-                        + pack_size(e::slice(m_key))
-                        + pack_size(e::slice(m_value));
+                        + pack_size(m_key)
+                        + pack_size(m_value);
         comm_id id = m_ss.next();
 
         if (id == comm_id())
@@ -175,8 +205,8 @@ pending_transaction_write :: send_request(client* cl)
             << e::pack_varint(nonce)
             << e::pack_varint(m_slot)
             << e::slice(m_table)
-            << e::slice(m_key)
-            << e::slice(m_value);
+            << m_key
+            << m_value;
 
         if (cl->send(nonce, id, msg, this))
         {
@@ -28,6 +28,9 @@
 #ifndef consus_client_pending_transaction_write_h_
 #define consus_client_pending_transaction_write_h_
 
+// e
+#include <e/slice.h>
+
 // consus
 #include "client/pending.h"
 #include "client/server_selector.h"
@@ -44,11 +47,18 @@ class pending_transaction_write : public pending
                                   uint64_t slot,
                                   const char* table,
                                   const unsigned char* key, size_t key_sz,
-                                  const unsigned char* value, size_t value_sz);
+                                  const unsigned char* value, size_t value_sz,
+                                  unsigned char* key_backing,
+                                  unsigned char* value_backing);
         virtual ~pending_transaction_write() throw ();
 
+    public:
+        // complete at once; the write travels with the commit instead
+        void set_local();
+
     public:
         virtual std::string describe();
+        virtual void returning();
         virtual void kickstart_state_machine(client* cl);
         virtual void handle_server_failure(client* cl, comm_id si);
         virtual void handle_server_disruption(client* cl, comm_id si);
@@ -66,8 +76,11 @@ class pending_transaction_write : public pending
         server_selector m_ss;
         const uint64_t m_slot;
         std::string m_table;
-        std::string m_key;
-        std::string m_value;
+        e::slice m_key;
+        e::slice m_value;
+        unsigned char* m_key_backing;
+        unsigned char* m_value_backing;
+        bool m_local;
 
     private:
         pending_transaction_write(const pending_transaction_write&);
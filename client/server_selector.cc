@@ -25,7 +25,11 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
-// C
+// STL
+#include <algorithm>
+
+// consus
+#include "client/peer_health.h"
 #include "client/server_selector.h"
 
 using consus::server_selector;
@@ -33,6 +37,7 @@ using consus::server_selector;
 server_selector :: server_selector()
     : m_ids()
     , m_consumed_idx()
+    , m_health(NULL)
 {
 }
 
@@ -41,10 +46,11 @@ server_selector :: ~server_selector() throw ()
 }
 
 void
-server_selector :: set(const comm_id* ids, size_t ids_sz)
+server_selector :: set(const comm_id* ids, size_t ids_sz, const peer_health* health)
 {
     m_ids = std::vector<comm_id>(ids, ids + ids_sz);
     m_consumed_idx = 0;
+    m_health = health;
 }
 
 consus::comm_id
@@ -55,6 +61,19 @@ server_selector :: next()
         return comm_id();
     }
 
+    // health is checked as each peer is handed out, so a request redirected
+    // after a disruption passes over every member known to be down
+    for (size_t i = m_consumed_idx; m_health && i < m_ids.size(); ++i)
+    {
+        if (!m_health->suspect(m_ids[i]))
+        {
+            std::rotate(m_ids.begin() + m_consumed_idx,
+                        m_ids.begin() + i,
+                        m_ids.begin() + i + 1);
+            break;
+        }
+    }
+
     return m_ids[m_consumed_idx++];
 }
 
@@ -63,4 +82,5 @@ server_selector :: clear()
 {
     m_ids.clear();
     m_consumed_idx = 0;
+    m_health = NULL;
 }
@@ -36,6 +36,7 @@
 #include "common/ids.h"
 
 BEGIN_CONSUS_NAMESPACE
+class peer_health;
 
 class server_selector
 {
@@ -44,13 +45,15 @@ class server_selector
         ~server_selector() throw ();
 
     public:
-        void set(const comm_id* ids, size_t ids_sz);
+        // with health, next skips suspect peers until only they remain
+        void set(const comm_id* ids, size_t ids_sz, const peer_health* health = NULL);
         comm_id next();
         void clear();
 
     private:
         std::vector<comm_id> m_ids;
         size_t m_consumed_idx;
+        const peer_health* m_health;
 };
 
 END_CONSUS_NAMESPACE
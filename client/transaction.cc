@@ -25,14 +25,27 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// po6
+#include <po6/errno.h>
+
 // treadstone
 #include <treadstone.h>
 
 // consus
+#include "common/constants.h"
 #include "client/client.h"
 #include "client/transaction.h"
+#include "client/pending_begin_transaction.h"
 #include "client/pending_transaction_read.h"
 #include "client/pending_transaction_write.h"
+#include "client/pending_transaction_cond_write.h"
+#include "client/pending_transaction_multi.h"
+#include "client/pending_transaction_scan.h"
 #include "client/pending_transaction_commit.h"
 #include "client/pending_transaction_abort.h"
 
@@ -49,6 +62,10 @@ transaction :: transaction(client* cl, const transaction_id& txid,
     , m_txid(txid)
     , m_ids(ids, ids + ids_sz)
     , m_next_slot(1)
+    , m_outstanding()
+    , m_writes()
+    , m_buffer_writes(false)
+    , m_buffered()
 {
 }
 
@@ -67,6 +84,11 @@ transaction :: get(const char* table,
         return -1;
     }
 
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
     unsigned char* binkey = NULL;
     size_t binkey_sz = 0;
 
@@ -76,13 +98,106 @@ transaction :: get(const char* table,
         return -1;
     }
 
-    uint64_t slot = m_next_slot;
-    ++m_next_slot;
+    // the transaction's own writes are the only value it can read back, so
+    // there is nothing for the transaction manager to order or record
+    std::string buffered;
+    const bool local = find_write(table, e::slice(binkey, binkey_sz), &buffered);
+    uint64_t slot = 0;
+
+    if (!local)
+    {
+        slot = take_slots(1);
+    }
+
     int64_t client_id = m_cl->generate_new_client_id();
-    pending* p = new pending_transaction_read(client_id, status, this, slot,
-            table, binkey, binkey_sz, value, value_sz);
-    free(binkey);
-    p->kickstart_state_machine(m_cl);
+    pending_transaction_read* p = new pending_transaction_read(client_id, status, this, slot,
+            table, binkey, binkey_sz, binkey, false, value, value_sz);
+
+    if (local)
+    {
+        p->set_local(buffered);
+    }
+
+    m_cl->start(p);
+    return client_id;
+}
+
+int64_t
+transaction :: get_bin(const char* table,
+                       const char* key, size_t key_sz,
+                       consus_returncode* status,
+                       char** value, size_t* value_sz)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
+    std::string buffered;
+    const bool local = find_write(table, e::slice(key, key_sz), &buffered);
+    uint64_t slot = 0;
+
+    if (!local)
+    {
+        slot = take_slots(1);
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    pending_transaction_read* p = new pending_transaction_read(client_id, status, this, slot,
+            table, reinterpret_cast<const unsigned char*>(key), key_sz,
+            NULL, true, value, value_sz);
+
+    if (local)
+    {
+        p->set_local(buffered);
+    }
+
+    m_cl->start(p);
+    return client_id;
+}
+
+int64_t
+transaction :: get_into(const char* table,
+                        const char* key, size_t key_sz,
+                        consus_returncode* status,
+                        char* buf, size_t buf_sz, size_t* value_sz)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
+    std::string buffered;
+    const bool local = find_write(table, e::slice(key, key_sz), &buffered);
+    uint64_t slot = 0;
+
+    if (!local)
+    {
+        slot = take_slots(1);
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    pending_transaction_read* p = new pending_transaction_read(client_id, status, this, slot,
+            table, reinterpret_cast<const unsigned char*>(key), key_sz,
+            NULL, true, NULL, value_sz);
+    p->set_buffer(buf, buf_sz);
+
+    if (local)
+    {
+        p->set_local(buffered);
+    }
+
+    m_cl->start(p);
     return client_id;
 }
 
@@ -97,6 +212,11 @@ transaction :: put(const char* table,
         return -1;
     }
 
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
     unsigned char* binkey = NULL;
     size_t binkey_sz = 0;
     unsigned char* binval = NULL;
@@ -115,14 +235,314 @@ transaction :: put(const char* table,
         return -1;
     }
 
-    uint64_t slot = m_next_slot;
-    ++m_next_slot;
+    record_write(table, e::slice(binkey, binkey_sz), e::slice(binval, binval_sz));
+    uint64_t slot = 0;
+
+    if (!m_buffer_writes)
+    {
+        slot = take_slots(1);
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    pending_transaction_write* p = new pending_transaction_write(client_id, status, this, slot,
+            table, binkey, binkey_sz, binval, binval_sz, binkey, binval);
+
+    if (m_buffer_writes)
+    {
+        p->set_local();
+    }
+
+    m_cl->start(p);
+    return client_id;
+}
+
+int64_t
+transaction :: put_bin(const char* table,
+                       const char* key, size_t key_sz,
+                       const char* value, size_t value_sz,
+                       consus_returncode* status)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
+    record_write(table, e::slice(key, key_sz), e::slice(value, value_sz));
+    uint64_t slot = 0;
+
+    if (!m_buffer_writes)
+    {
+        slot = take_slots(1);
+    }
+
     int64_t client_id = m_cl->generate_new_client_id();
-    pending* p = new pending_transaction_write(client_id, status, this, slot,
-            table, binkey, binkey_sz, binval, binval_sz);
+    pending_transaction_write* p = new pending_transaction_write(client_id, status, this, slot,
+            table, reinterpret_cast<const unsigned char*>(key), key_sz,
+            reinterpret_cast<const unsigned char*>(value), value_sz,
+            NULL, NULL);
+
+    if (m_buffer_writes)
+    {
+        p->set_local();
+    }
+
+    m_cl->start(p);
+    return client_id;
+}
+
+int64_t
+transaction :: cond_put(const char* table,
+                        const char* key, size_t key_sz,
+                        const char* expected, size_t expected_sz,
+                        const char* value, size_t value_sz,
+                        consus_returncode* status)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    unsigned char* binkey = NULL;
+    size_t binkey_sz = 0;
+    unsigned char* binexp = NULL;
+    size_t binexp_sz = 0;
+    unsigned char* binval = NULL;
+    size_t binval_sz = 0;
+
+    if (treadstone_json_sz_to_binary(key, key_sz, &binkey, &binkey_sz) < 0)
+    {
+        ERROR(INVALID) << "key contains invalid JSON";
+        return -1;
+    }
+
+    if (expected &&
+        treadstone_json_sz_to_binary(expected, expected_sz, &binexp, &binexp_sz) < 0)
+    {
+        ERROR(INVALID) << "expected value contains invalid JSON";
+        free(binkey);
+        return -1;
+    }
+
+    if (treadstone_json_sz_to_binary(value, value_sz, &binval, &binval_sz) < 0)
+    {
+        ERROR(INVALID) << "value contains invalid JSON";
+        free(binkey);
+        free(binexp);
+        return -1;
+    }
+
+    return issue_update(table, expected ? UPDATE_IF_EQUAL : UPDATE_IF_ABSENT,
+                        binkey, binkey_sz, binexp, binexp_sz,
+                        binval, binval_sz, binkey, binexp, binval, status);
+}
+
+int64_t
+transaction :: cond_put_bin(const char* table,
+                            const char* key, size_t key_sz,
+                            const char* expected, size_t expected_sz,
+                            const char* value, size_t value_sz,
+                            consus_returncode* status)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    return issue_update(table, expected ? UPDATE_IF_EQUAL : UPDATE_IF_ABSENT,
+                        reinterpret_cast<const unsigned char*>(key), key_sz,
+                        reinterpret_cast<const unsigned char*>(expected), expected_sz,
+                        reinterpret_cast<const unsigned char*>(value), value_sz,
+                        NULL, NULL, NULL, status);
+}
+
+int64_t
+transaction :: add(const char* table,
+                   const char* key, size_t key_sz,
+                   int64_t delta,
+                   consus_returncode* status)
+{
+    return counter_update(table, UPDATE_ADD, key, key_sz, delta, status);
+}
+
+int64_t
+transaction :: max(const char* table,
+                   const char* key, size_t key_sz,
+                   int64_t value,
+                   consus_returncode* status)
+{
+    return counter_update(table, UPDATE_MAX, key, key_sz, value, status);
+}
+
+int64_t
+transaction :: set_add(const char* table,
+                       const char* key, size_t key_sz,
+                       const char* member, size_t member_sz,
+                       consus_returncode* status)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    return issue_update(table, UPDATE_SET_ADD,
+                        reinterpret_cast<const unsigned char*>(key), key_sz,
+                        NULL, 0,
+                        reinterpret_cast<const unsigned char*>(member), member_sz,
+                        NULL, NULL, NULL, status);
+}
+
+int64_t
+transaction :: multi_get(const char* table,
+                         const char* const* keys, const size_t* keys_sz, size_t n,
+                         consus_returncode* status,
+                         char** values, size_t* values_sz)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
+    if (n == 0)
+    {
+        ERROR(INVALID) << "multi_get requires at least one key";
+        return -1;
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    e::intrusive_ptr<pending_transaction_multi> p;
+    p = new pending_transaction_multi(client_id, status, this, table);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char* binkey = NULL;
+        size_t binkey_sz = 0;
+
+        if (treadstone_json_sz_to_binary(keys[i], keys_sz[i], &binkey, &binkey_sz) < 0)
+        {
+            ERROR(INVALID) << "key " << i << " contains invalid JSON";
+            return -1;
+        }
+
+        p->add_backing(binkey);
+        p->add_read(m_next_slot + i, e::slice(binkey, binkey_sz), &values[i], &values_sz[i]);
+    }
+
+    take_slots(n);
+    m_cl->start(p.get());
+    return client_id;
+}
+
+int64_t
+transaction :: multi_put(const char* table,
+                         const char* const* keys, const size_t* keys_sz,
+                         const char* const* values, const size_t* values_sz,
+                         size_t n, consus_returncode* status)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
+    if (n == 0)
+    {
+        ERROR(INVALID) << "multi_put requires at least one key";
+        return -1;
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    e::intrusive_ptr<pending_transaction_multi> p;
+    p = new pending_transaction_multi(client_id, status, this, table);
+
+    std::vector<std::pair<e::slice, e::slice> > writes;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char* binkey = NULL;
+        size_t binkey_sz = 0;
+        unsigned char* binval = NULL;
+        size_t binval_sz = 0;
+
+        if (treadstone_json_sz_to_binary(keys[i], keys_sz[i], &binkey, &binkey_sz) < 0)
+        {
+            ERROR(INVALID) << "key " << i << " contains invalid JSON";
+            return -1;
+        }
+
+        p->add_backing(binkey);
+
+        if (treadstone_json_sz_to_binary(values[i], values_sz[i], &binval, &binval_sz) < 0)
+        {
+            ERROR(INVALID) << "value " << i << " contains invalid JSON";
+            return -1;
+        }
+
+        p->add_backing(binval);
+        writes.push_back(std::make_pair(e::slice(binkey, binkey_sz), e::slice(binval, binval_sz)));
+
+        if (!m_buffer_writes)
+        {
+            p->add_write(m_next_slot + i,
+                         e::slice(binkey, binkey_sz),
+                         e::slice(binval, binval_sz));
+        }
+    }
+
+    for (size_t i = 0; i < writes.size(); ++i)
+    {
+        record_write(table, writes[i].first, writes[i].second);
+    }
+
+    if (!m_buffer_writes)
+    {
+        take_slots(n);
+    }
+
+    m_cl->start(p.get());
+    return client_id;
+}
+
+int64_t
+transaction :: scan(const char* table,
+                    const char* key, size_t key_sz,
+                    uint64_t n,
+                    consus_returncode* status,
+                    char** key_out, size_t* key_out_sz,
+                    char** value, size_t* value_sz)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    unsigned char* binkey = NULL;
+    size_t binkey_sz = 0;
+
+    if (treadstone_json_sz_to_binary(key, key_sz, &binkey, &binkey_sz) < 0)
+    {
+        ERROR(INVALID) << "key contains invalid JSON";
+        return -1;
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    pending* p = new pending_transaction_scan(client_id, status, this,
+            table, binkey, binkey_sz, n, key_out, key_out_sz, value, value_sz);
     free(binkey);
-    free(binval);
-    p->kickstart_state_machine(m_cl);
+    m_cl->start(p);
     return client_id;
 }
 
@@ -134,11 +554,26 @@ transaction :: commit(consus_returncode* status)
         return -1;
     }
 
-    uint64_t slot = m_next_slot;
-    ++m_next_slot;
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
+    // buffered writes take the slots just before the commit, in one message
+    // with it; a key put twice is sent once, with its final value
+    uint64_t slot = m_next_slot + m_buffered.size();
     int64_t client_id = m_cl->generate_new_client_id();
-    pending* p = new pending_transaction_commit(client_id, status, this, slot);
-    p->kickstart_state_machine(m_cl);
+    pending_transaction_commit* p = new pending_transaction_commit(client_id, status, this, slot);
+
+    for (write_set_t::iterator it = m_buffered.begin(); it != m_buffered.end(); ++it)
+    {
+        p->add_write(m_next_slot, it->first.first, it->first.second, it->second);
+        ++m_next_slot;
+    }
+
+    m_buffered.clear();
+    ++m_next_slot;
+    m_cl->start(p);
     return client_id;
 }
 
@@ -150,18 +585,48 @@ transaction :: abort(consus_returncode* status)
         return -1;
     }
 
+    if (!window_open(status))
+    {
+        return -1;
+    }
+
     uint64_t slot = m_next_slot;
     ++m_next_slot;
     int64_t client_id = m_cl->generate_new_client_id();
     pending* p = new pending_transaction_abort(client_id, status, this, slot);
-    p->kickstart_state_machine(m_cl);
+    m_cl->start(p);
     return client_id;
 }
 
+int64_t
+transaction :: restart_transaction(consus_returncode* status)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    pending* p = new pending_begin_transaction(client_id, status, NULL, this);
+    m_cl->start(p);
+    return client_id;
+}
+
+void
+transaction :: restart(const transaction_id& txid, const comm_id* ids, size_t ids_sz)
+{
+    m_txid = txid;
+    m_ids.assign(ids, ids + ids_sz);
+    m_next_slot = 1;
+    m_outstanding.clear();
+    m_writes.clear();
+    m_buffered.clear();
+}
+
 void
 transaction :: initialize(server_selector* ss)
 {
-    ss->set(&m_ids[0], m_ids.size());
+    ss->set(&m_ids[0], m_ids.size(), m_cl->health());
 }
 
 void
@@ -169,3 +634,172 @@ transaction :: mark_aborted()
 {
     ::abort(); // XXX
 }
+
+void
+transaction :: record_write(const char* table, const e::slice& key, const e::slice& value)
+{
+    const std::pair<std::string, std::string> tk(std::string(table), key.str());
+    m_writes[tk] = value.str();
+
+    if (m_buffer_writes)
+    {
+        m_buffered[tk] = value.str();
+    }
+}
+
+void
+transaction :: record_written(const char* table, const e::slice& key, const e::slice& value)
+{
+    m_writes[std::make_pair(std::string(table), key.str())] = value.str();
+}
+
+void
+transaction :: retire_slot(uint64_t slot)
+{
+    m_outstanding.erase(slot);
+}
+
+bool
+transaction :: find_write(const char* table, const e::slice& key, std::string* value)
+{
+    write_set_t::iterator it = m_writes.find(std::make_pair(std::string(table), key.str()));
+
+    if (it == m_writes.end())
+    {
+        return false;
+    }
+
+    *value = it->second;
+    return true;
+}
+
+bool
+transaction :: window_open(consus_returncode* status)
+{
+    if (!m_outstanding.empty() &&
+        m_next_slot >= *m_outstanding.begin() + CONSUS_TRANSACTION_WINDOW)
+    {
+        ERROR(BUSY) << "too many operations outstanding; wait for earlier ones to complete";
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t
+transaction :: take_slots(uint64_t n)
+{
+    const uint64_t slot = m_next_slot;
+    m_next_slot += n;
+    m_outstanding.insert(slot);
+    return slot;
+}
+
+int64_t
+transaction :: counter_update(const char* table, update_t update,
+                              const char* key, size_t key_sz,
+                              int64_t operand,
+                              consus_returncode* status)
+{
+    if (!m_cl->maintain_coord_connection(status))
+    {
+        return -1;
+    }
+
+    const std::string counter(update_counter(operand));
+    unsigned char* binval = static_cast<unsigned char*>(malloc(counter.size()));
+
+    if (!binval)
+    {
+        ERROR(SEE_ERRNO) << po6::strerror(errno);
+        return -1;
+    }
+
+    memmove(binval, counter.data(), counter.size());
+    return issue_update(table, update,
+                        reinterpret_cast<const unsigned char*>(key), key_sz,
+                        NULL, 0, binval, counter.size(),
+                        NULL, NULL, binval, status);
+}
+
+int64_t
+transaction :: issue_update(const char* table, update_t update,
+                            const unsigned char* key, size_t key_sz,
+                            const unsigned char* expected, size_t expected_sz,
+                            const unsigned char* value, size_t value_sz,
+                            unsigned char* key_backing,
+                            unsigned char* expected_backing,
+                            unsigned char* value_backing,
+                            consus_returncode* status)
+{
+    if (!window_open(status))
+    {
+        free(key_backing);
+        free(expected_backing);
+        free(value_backing);
+        return -1;
+    }
+
+    int64_t client_id = m_cl->generate_new_client_id();
+    std::string buffered;
+
+    // the transaction manager cannot see this transaction's own writes, so
+    // they decide the update here
+    if (find_write(table, e::slice(key, key_sz), &buffered))
+    {
+        std::string result;
+        consus_returncode rc;
+
+        if (!update_apply(update, true, e::slice(buffered),
+                          e::slice(expected, expected_sz),
+                          e::slice(value, value_sz), &result, &rc))
+        {
+            pending_transaction_cond_write* p = new pending_transaction_cond_write(client_id, status, this, 0,
+                    table, update, key, key_sz, expected, expected_sz, value, value_sz,
+                    key_backing, expected_backing, value_backing);
+            p->set_local(rc);
+            m_cl->start(p);
+            return client_id;
+        }
+
+        unsigned char* binval = static_cast<unsigned char*>(malloc(result.size() + 1));
+
+        if (!binval)
+        {
+            ERROR(SEE_ERRNO) << po6::strerror(errno);
+            free(key_backing);
+            free(expected_backing);
+            free(value_backing);
+            return -1;
+        }
+
+        memmove(binval, result.data(), result.size());
+        free(expected_backing);
+        free(value_backing);
+        record_write(table, e::slice(key, key_sz), e::slice(binval, result.size()));
+        uint64_t slot = 0;
+
+        if (!m_buffer_writes)
+        {
+            slot = take_slots(1);
+        }
+
+        pending_transaction_write* p = new pending_transaction_write(client_id, status, this, slot,
+                table, key, key_sz, binval, result.size(), key_backing, binval);
+
+        if (m_buffer_writes)
+        {
+            p->set_local();
+        }
+
+        m_cl->start(p);
+        return client_id;
+    }
+
+    const uint64_t slot = take_slots(2);
+    pending_transaction_cond_write* p = new pending_transaction_cond_write(client_id, status, this, slot,
+            table, update, key, key_sz, expected, expected_sz, value, value_sz,
+            key_backing, expected_backing, value_backing);
+    m_cl->start(p);
+    return client_id;
+}
@@ -31,13 +31,22 @@
 // C
 #include <stdint.h>
 
+// STL
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
 // e
 #include <e/error.h>
+#include <e/slice.h>
 
 // consus
 #include <consus.h>
 #include "namespace.h"
 #include "common/transaction_id.h"
+#include "common/update.h"
 
 BEGIN_CONSUS_NAMESPACE
 class client;
@@ -60,16 +69,115 @@ class transaction
                     const char* key, size_t key_sz,
                     const char* value, size_t value_sz,
                     consus_returncode* status);
+        // like get/put, but key and value are raw bytes that must remain
+        // valid until the operation completes
+        int64_t get_bin(const char* table,
+                        const char* key, size_t key_sz,
+                        consus_returncode* status,
+                        char** value, size_t* value_sz);
+        int64_t put_bin(const char* table,
+                        const char* key, size_t key_sz,
+                        const char* value, size_t value_sz,
+                        consus_returncode* status);
+        // like get_bin, but copies the value into the caller's buf
+        int64_t get_into(const char* table,
+                         const char* key, size_t key_sz,
+                         consus_returncode* status,
+                         char* buf, size_t buf_sz, size_t* value_sz);
+        // write value only if key holds expected, or is absent if expected is
+        // NULL; the transaction manager decides without a client round trip
+        int64_t cond_put(const char* table,
+                         const char* key, size_t key_sz,
+                         const char* expected, size_t expected_sz,
+                         const char* value, size_t value_sz,
+                         consus_returncode* status);
+        int64_t cond_put_bin(const char* table,
+                             const char* key, size_t key_sz,
+                             const char* expected, size_t expected_sz,
+                             const char* value, size_t value_sz,
+                             consus_returncode* status);
+        // updates that read and write key in one request to the transaction
+        // manager; keys and members are raw bytes
+        int64_t add(const char* table,
+                    const char* key, size_t key_sz,
+                    int64_t delta,
+                    consus_returncode* status);
+        int64_t max(const char* table,
+                    const char* key, size_t key_sz,
+                    int64_t value,
+                    consus_returncode* status);
+        int64_t set_add(const char* table,
+                        const char* key, size_t key_sz,
+                        const char* member, size_t member_sz,
+                        consus_returncode* status);
+        // n reads or writes of one table sent to the transaction manager
+        // in a single message; values[i] is NULL if keys[i] is not found
+        int64_t multi_get(const char* table,
+                          const char* const* keys, const size_t* keys_sz, size_t n,
+                          consus_returncode* status,
+                          char** values, size_t* values_sz);
+        int64_t multi_put(const char* table,
+                          const char* const* keys, const size_t* keys_sz,
+                          const char* const* values, const size_t* values_sz,
+                          size_t n, consus_returncode* status);
+        // returns once per key, then once more with CONSUS_SCAN_DONE
+        int64_t scan(const char* table,
+                     const char* key, size_t key_sz,
+                     uint64_t n,
+                     consus_returncode* status,
+                     char** key_out, size_t* key_out_sz,
+                     char** value, size_t* value_sz);
+        // hold every later put in the client and send them with the commit
+        void buffer_writes() { m_buffer_writes = true; }
         int64_t commit(consus_returncode* status);
         int64_t abort(consus_returncode* status);
+        // begin again after an abort, keeping this attempt's priority
+        int64_t restart_transaction(consus_returncode* status);
+        // called once the restart has begun on the transaction managers
+        void restart(const transaction_id& txid, const comm_id* ids, size_t ids_sz);
         void initialize(server_selector* ss);
         void mark_aborted();
+        // a write the transaction manager already holds, for reading back
+        void record_written(const char* table, const e::slice& key, const e::slice& value);
+        // the operation that took slot has been returned to the application
+        void retire_slot(uint64_t slot);
+
+    private:
+        typedef std::map<std::pair<std::string, std::string>, std::string> write_set_t;
+        // values this transaction has written, so that reading them back
+        // needs no round trip
+        void record_write(const char* table, const e::slice& key, const e::slice& value);
+        bool find_write(const char* table, const e::slice& key, std::string* value);
+        // false, with CONSUS_BUSY, if the next slot falls outside the window
+        // the transaction manager accepts
+        bool window_open(consus_returncode* status);
+        // n consecutive slots, outstanding until the first is retired
+        uint64_t take_slots(uint64_t n);
+        int64_t counter_update(const char* table, update_t update,
+                               const char* key, size_t key_sz,
+                               int64_t operand,
+                               consus_returncode* status);
+        // takes ownership of the backing pointers, any of which may be NULL
+        int64_t issue_update(const char* table, update_t update,
+                             const unsigned char* key, size_t key_sz,
+                             const unsigned char* expected, size_t expected_sz,
+                             const unsigned char* value, size_t value_sz,
+                             unsigned char* key_backing,
+                             unsigned char* expected_backing,
+                             unsigned char* value_backing,
+                             consus_returncode* status);
 
     private:
         client* const m_cl;
-        const transaction_id m_txid;
-        const std::vector<comm_id> m_ids;
+        transaction_id m_txid;
+        std::vector<comm_id> m_ids;
         uint64_t m_next_slot;
+        // the first slot of each operation not yet returned
+        std::set<uint64_t> m_outstanding;
+        write_set_t m_writes;
+        bool m_buffer_writes;
+        // the subset of m_writes not yet sent to the transaction manager
+        write_set_t m_buffered;
 
     private:
         transaction(const transaction&);
@@ -0,0 +1,228 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// C
+#include <stdio.h>
+
+// STL
+#include <new>
+
+#ifdef CONSUS_JEMALLOC
+// jemalloc
+#include <jemalloc/jemalloc.h>
+#endif
+
+#ifdef CONSUS_TCMALLOC
+// tcmalloc
+#include <gperftools/malloc_extension.h>
+#endif
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "common/alloc_stats.h"
+
+using consus::alloc_stats;
+
+namespace
+{
+
+const char* const s_tag_names[consus::ALLOC_TAGS] = {
+    "other",
+    "transactions",
+    "voters",
+    "replicators",
+    "lock_states",
+    "message_buffers"
+};
+
+uint64_t s_held[consus::ALLOC_TAGS];
+uint64_t s_released[consus::ALLOC_TAGS];
+#ifdef CONSUS_JEMALLOC
+// the mallocx flags for each tag; 0 until initialize selects an arena
+int s_arena_flags[consus::ALLOC_TAGS];
+#endif
+
+// the AnonHugePages total of /proc/self/smaps_rollup, which every allocator
+// shares; false on kernels without it
+bool
+huge_page_bytes(uint64_t* bytes)
+{
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+
+    if (!f)
+    {
+        return false;
+    }
+
+    char line[256];
+    bool found = false;
+
+    while (!found && fgets(line, sizeof(line), f))
+    {
+        unsigned long long kb = 0;
+
+        if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1)
+        {
+            *bytes = uint64_t(kb) * 1024ULL;
+            found = true;
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+#ifdef CONSUS_JEMALLOC
+size_t
+jemalloc_stat(const char* name)
+{
+    size_t value = 0;
+    size_t sz = sizeof(value);
+
+    if (mallctl(name, &value, &sz, NULL, 0) != 0)
+    {
+        return 0;
+    }
+
+    return value;
+}
+#endif
+
+} // namespace
+
+void
+alloc_stats :: initialize()
+{
+#ifdef CONSUS_JEMALLOC
+    for (unsigned i = 0; i < ALLOC_TAGS; ++i)
+    {
+        unsigned arena = 0;
+        size_t sz = sizeof(arena);
+
+        if (s_arena_flags[i] == 0 &&
+            mallctl("arenas.create", &arena, &sz, NULL, 0) == 0)
+        {
+            s_arena_flags[i] = MALLOCX_ARENA(arena);
+        }
+    }
+#endif
+}
+
+void*
+alloc_stats :: allocate(alloc_tag tag, size_t sz)
+{
+#ifdef CONSUS_JEMALLOC
+    void* p = s_arena_flags[tag] != 0 ? mallocx(sz, s_arena_flags[tag]) : malloc(sz);
+#else
+    void* p = malloc(sz);
+#endif
+
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+
+    held(tag, sz);
+    return p;
+}
+
+void
+alloc_stats :: deallocate(alloc_tag tag, void* p, size_t sz)
+{
+    if (!p)
+    {
+        return;
+    }
+
+    released(tag, sz);
+    free(p);
+}
+
+void
+alloc_stats :: held(alloc_tag tag, size_t sz)
+{
+    e::atomic::increment_64_nobarrier(&s_held[tag], sz);
+}
+
+void
+alloc_stats :: released(alloc_tag tag, size_t sz)
+{
+    e::atomic::increment_64_nobarrier(&s_released[tag], sz);
+}
+
+void
+alloc_stats :: render(std::ostream& out)
+{
+    out << "# TYPE consus_subsystem_bytes gauge\n";
+
+    for (unsigned i = 0; i < ALLOC_TAGS; ++i)
+    {
+        // read released first so that a racing free cannot push it past held
+        const uint64_t released = e::atomic::load_64_acquire(&s_released[i]);
+        const uint64_t held = e::atomic::load_64_acquire(&s_held[i]);
+        out << "consus_subsystem_bytes{subsystem=\"" << s_tag_names[i] << "\"} "
+            << (held > released ? held - released : 0) << "\n";
+    }
+
+#if defined(CONSUS_JEMALLOC)
+    uint64_t epoch = 1;
+    size_t epoch_sz = sizeof(epoch);
+    mallctl("epoch", &epoch, &epoch_sz, &epoch, epoch_sz);
+    out << "# TYPE consus_allocator_bytes gauge\n"
+        << "consus_allocator_bytes{allocator=\"jemalloc\",kind=\"allocated\"} " << jemalloc_stat("stats.allocated") << "\n"
+        << "consus_allocator_bytes{allocator=\"jemalloc\",kind=\"active\"} " << jemalloc_stat("stats.active") << "\n"
+        << "consus_allocator_bytes{allocator=\"jemalloc\",kind=\"resident\"} " << jemalloc_stat("stats.resident") << "\n"
+        << "consus_allocator_bytes{allocator=\"jemalloc\",kind=\"mapped\"} " << jemalloc_stat("stats.mapped") << "\n";
+#elif defined(CONSUS_TCMALLOC)
+    size_t allocated = 0;
+    size_t heap = 0;
+    size_t free_bytes = 0;
+    MallocExtension* ext = MallocExtension::instance();
+    ext->GetNumericProperty("generic.current_allocated_bytes", &allocated);
+    ext->GetNumericProperty("generic.heap_size", &heap);
+    ext->GetNumericProperty("tcmalloc.pageheap_free_bytes", &free_bytes);
+    out << "# TYPE consus_allocator_bytes gauge\n"
+        << "consus_allocator_bytes{allocator=\"tcmalloc\",kind=\"allocated\"} " << allocated << "\n"
+        << "consus_allocator_bytes{allocator=\"tcmalloc\",kind=\"heap\"} " << heap << "\n"
+        << "consus_allocator_bytes{allocator=\"tcmalloc\",kind=\"free\"} " << free_bytes << "\n";
+#endif
+
+    uint64_t huge = 0;
+
+    if (huge_page_bytes(&huge))
+    {
+        out << "# TYPE consus_huge_page_bytes gauge\n"
+            << "consus_huge_page_bytes " << huge << "\n";
+    }
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_common_alloc_stats_h_
+#define consus_common_alloc_stats_h_
+
+// Bytes held by each of the daemons' long-lived subsystems.  Classes opt in
+// by deriving from tagged<TAG>, or by naming a tag for pooled<T>, which
+// routes their operator new/delete through here.  When built with jemalloc
+// (./configure --with-allocator=jemalloc) each tag allocates from an arena
+// of its own, so one subsystem's churn cannot fragment another's pages.
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// STL
+#include <iostream>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+enum alloc_tag
+{
+    ALLOC_OTHER,
+    ALLOC_TRANSACTIONS,
+    ALLOC_VOTERS,
+    ALLOC_REPLICATORS,
+    ALLOC_LOCK_STATES,
+    // idle message buffers held by buffer_pool
+    ALLOC_BUFFERS,
+    ALLOC_TAGS
+};
+
+class alloc_stats
+{
+    public:
+        // create the per-tag arenas; allocations made earlier come from the
+        // default arena and may be freed as usual
+        static void initialize();
+        static void* allocate(alloc_tag tag, size_t sz);
+        static void deallocate(alloc_tag tag, void* p, size_t sz);
+        // account for memory a subsystem holds that it did not allocate here
+        static void held(alloc_tag tag, size_t sz);
+        static void released(alloc_tag tag, size_t sz);
+        // append as Prometheus gauges, with the allocator's own view and the
+        // process's transparent huge pages
+        static void render(std::ostream& out);
+
+    private:
+        alloc_stats();
+        alloc_stats(const alloc_stats&);
+        alloc_stats& operator = (const alloc_stats&);
+};
+
+template <alloc_tag TAG>
+class tagged
+{
+    public:
+        static void* operator new(size_t sz)
+        { return alloc_stats::allocate(TAG, sz); }
+        static void operator delete(void* p, size_t sz)
+        { alloc_stats::deallocate(TAG, p, sz); }
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_alloc_stats_h_
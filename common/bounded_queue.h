@@ -0,0 +1,337 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_bounded_queue_h_
+#define consus_common_bounded_queue_h_
+
+// A bounded_queue hands work from one stage of a daemon to the next.  Pushing
+// onto a full queue blocks, so a stage that falls behind slows the stages
+// that feed it rather than letting its backlog grow without limit.  Once shut
+// down, pushes fail and pops drain what remains before failing.
+//
+// The queue itself is a lock-free ring of sequenced cells (Vyukov's bounded
+// MPMC queue), so producers and consumers never contend on a mutex while
+// there is work to do.  The mutex and condition variables are only touched
+// by threads about to sleep on an empty or full queue, and by whoever must
+// wake them.
+
+// STL
+#include <vector>
+
+// po6
+#include <po6/threads/cond.h>
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "namespace.h"
+
+// tries before a thread blocked on the queue goes to sleep
+#define BOUNDED_QUEUE_SPINS 64
+
+BEGIN_CONSUS_NAMESPACE
+
+template <typename T>
+class bounded_queue
+{
+    public:
+        // capacity is rounded up to a power of two
+        bounded_queue(size_t capacity);
+        ~bounded_queue() throw ();
+
+    public:
+        bool push(const T& t);
+        // false instead of blocking when the queue is full
+        bool try_push(const T& t);
+        bool pop(T* t);
+        void shutdown();
+        size_t size();
+
+    private:
+        struct cell
+        {
+            cell() : seq(0), item() {}
+            uint64_t seq;
+            T item;
+        };
+
+    private:
+        static size_t round_up(size_t capacity);
+        bool try_pop(T* t);
+        bool is_shutdown() { return e::atomic::load_64_acquire(&m_shutdown) != 0; }
+        void wake(po6::threads::cond* c, uint64_t* sleepers);
+
+    private:
+        std::vector<cell> m_cells;
+        const uint64_t m_mask;
+        uint64_t m_head;
+        uint64_t m_tail;
+        uint64_t m_shutdown;
+        po6::threads::mutex m_mtx;
+        po6::threads::cond m_not_empty;
+        po6::threads::cond m_not_full;
+        uint64_t m_sleeping_consumers;
+        uint64_t m_sleeping_producers;
+
+    private:
+        bounded_queue(const bounded_queue&);
+        bounded_queue& operator = (const bounded_queue&);
+};
+
+template <typename T>
+bounded_queue<T> :: bounded_queue(size_t capacity)
+    : m_cells(round_up(capacity))
+    , m_mask(m_cells.size() - 1)
+    , m_head(0)
+    , m_tail(0)
+    , m_shutdown(0)
+    , m_mtx()
+    , m_not_empty(&m_mtx)
+    , m_not_full(&m_mtx)
+    , m_sleeping_consumers(0)
+    , m_sleeping_producers(0)
+{
+    for (size_t i = 0; i < m_cells.size(); ++i)
+    {
+        m_cells[i].seq = i;
+    }
+}
+
+template <typename T>
+bounded_queue<T> :: ~bounded_queue() throw ()
+{
+}
+
+template <typename T>
+bool
+bounded_queue<T> :: push(const T& t)
+{
+    for (unsigned spins = 0; true; ++spins)
+    {
+        if (is_shutdown())
+        {
+            return false;
+        }
+
+        if (try_push(t))
+        {
+            return true;
+        }
+
+        if (spins < BOUNDED_QUEUE_SPINS)
+        {
+            continue;
+        }
+
+        po6::threads::mutex::hold hold(&m_mtx);
+        e::atomic::increment_64_nobarrier(&m_sleeping_producers, 1);
+        e::atomic::memory_barrier();
+
+        // a consumer that made room before the increment was visible did
+        // not know to wake us; look once more before sleeping
+        if (size() > m_mask && !is_shutdown())
+        {
+            m_not_full.wait();
+        }
+
+        e::atomic::increment_64_nobarrier(&m_sleeping_producers, -1);
+        spins = 0;
+    }
+}
+
+template <typename T>
+bool
+bounded_queue<T> :: try_push(const T& t)
+{
+    uint64_t pos = e::atomic::load_64_acquire(&m_tail);
+    cell* c = NULL;
+
+    while (true)
+    {
+        c = &m_cells[pos & m_mask];
+        const uint64_t seq = e::atomic::load_64_acquire(&c->seq);
+        const int64_t diff = int64_t(seq) - int64_t(pos);
+
+        if (diff == 0)
+        {
+            const uint64_t prev = e::atomic::compare_and_swap_64_nobarrier(&m_tail, pos, pos + 1);
+
+            if (prev == pos)
+            {
+                break;
+            }
+
+            pos = prev;
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = e::atomic::load_64_acquire(&m_tail);
+        }
+    }
+
+    c->item = t;
+    e::atomic::store_64_release(&c->seq, pos + 1);
+    wake(&m_not_empty, &m_sleeping_consumers);
+    return true;
+}
+
+template <typename T>
+bool
+bounded_queue<T> :: pop(T* t)
+{
+    for (unsigned spins = 0; true; ++spins)
+    {
+        if (try_pop(t))
+        {
+            return true;
+        }
+
+        // one more look after seeing shutdown drains what was pushed before
+        // it; a push racing with shutdown may strand its item, which only
+        // matters to a daemon that is exiting anyway
+        if (is_shutdown())
+        {
+            return try_pop(t);
+        }
+
+        if (spins < BOUNDED_QUEUE_SPINS)
+        {
+            continue;
+        }
+
+        po6::threads::mutex::hold hold(&m_mtx);
+        e::atomic::increment_64_nobarrier(&m_sleeping_consumers, 1);
+        e::atomic::memory_barrier();
+
+        if (size() == 0 && !is_shutdown())
+        {
+            m_not_empty.wait();
+        }
+
+        e::atomic::increment_64_nobarrier(&m_sleeping_consumers, -1);
+        spins = 0;
+    }
+}
+
+template <typename T>
+bool
+bounded_queue<T> :: try_pop(T* t)
+{
+    uint64_t pos = e::atomic::load_64_acquire(&m_head);
+    cell* c = NULL;
+
+    while (true)
+    {
+        c = &m_cells[pos & m_mask];
+        const uint64_t seq = e::atomic::load_64_acquire(&c->seq);
+        const int64_t diff = int64_t(seq) - int64_t(pos + 1);
+
+        if (diff == 0)
+        {
+            const uint64_t prev = e::atomic::compare_and_swap_64_nobarrier(&m_head, pos, pos + 1);
+
+            if (prev == pos)
+            {
+                break;
+            }
+
+            pos = prev;
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = e::atomic::load_64_acquire(&m_head);
+        }
+    }
+
+    *t = c->item;
+    c->item = T();
+    e::atomic::store_64_release(&c->seq, pos + m_mask + 1);
+    wake(&m_not_full, &m_sleeping_producers);
+    return true;
+}
+
+template <typename T>
+void
+bounded_queue<T> :: shutdown()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    e::atomic::store_64_release(&m_shutdown, 1);
+    m_not_empty.broadcast();
+    m_not_full.broadcast();
+}
+
+template <typename T>
+size_t
+bounded_queue<T> :: size()
+{
+    const uint64_t head = e::atomic::load_64_acquire(&m_head);
+    const uint64_t tail = e::atomic::load_64_acquire(&m_tail);
+    return tail > head ? tail - head : 0;
+}
+
+template <typename T>
+size_t
+bounded_queue<T> :: round_up(size_t capacity)
+{
+    size_t c = 2;
+
+    while (c < capacity)
+    {
+        c <<= 1;
+    }
+
+    return c;
+}
+
+template <typename T>
+void
+bounded_queue<T> :: wake(po6::threads::cond* c, uint64_t* sleepers)
+{
+    // pairs with the barrier a sleeper issues between announcing itself
+    // and its final look at the queue
+    e::atomic::memory_barrier();
+
+    if (e::atomic::load_64_acquire(sleepers) > 0)
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        c->signal();
+    }
+}
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_bounded_queue_h_
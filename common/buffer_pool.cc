@@ -0,0 +1,153 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// consus
+#include "common/alloc_stats.h"
+#include "common/buffer_pool.h"
+
+using consus::buffer_pool;
+
+// the smallest size class is 1 << BUFFER_POOL_MIN_SHIFT bytes
+#define BUFFER_POOL_MIN_SHIFT 6
+// the largest size class is 1 << BUFFER_POOL_MAX_SHIFT bytes
+#define BUFFER_POOL_MAX_SHIFT 16
+#define BUFFER_POOL_CLASSES (BUFFER_POOL_MAX_SHIFT - BUFFER_POOL_MIN_SHIFT + 1)
+// buffers each thread keeps per size class before returning them to malloc
+#define BUFFER_POOL_MAX_FREE 256
+
+namespace
+{
+
+// free buffers are chained through the first bytes of their data
+__thread e::buffer* s_free[BUFFER_POOL_CLASSES];
+__thread unsigned s_free_sz[BUFFER_POOL_CLASSES];
+
+unsigned
+shift_for(size_t sz)
+{
+    unsigned shift = BUFFER_POOL_MIN_SHIFT;
+
+    while ((size_t(1) << shift) < sz)
+    {
+        ++shift;
+    }
+
+    return shift;
+}
+
+e::buffer*
+next_of(e::buffer* buf)
+{
+    e::buffer* next;
+    memmove(&next, buf->data(), sizeof(next));
+    return next;
+}
+
+void
+set_next(e::buffer* buf, e::buffer* next)
+{
+    memmove(buf->data(), &next, sizeof(next));
+}
+
+} // namespace
+
+std::auto_ptr<e::buffer>
+buffer_pool :: create(size_t sz)
+{
+    const unsigned shift = shift_for(sz);
+
+    if (shift > BUFFER_POOL_MAX_SHIFT)
+    {
+        return std::auto_ptr<e::buffer>(e::buffer::create(sz));
+    }
+
+    const unsigned cls = shift - BUFFER_POOL_MIN_SHIFT;
+    e::buffer* buf = s_free[cls];
+
+    if (!buf)
+    {
+        return std::auto_ptr<e::buffer>(e::buffer::create(size_t(1) << shift));
+    }
+
+    s_free[cls] = next_of(buf);
+    --s_free_sz[cls];
+    alloc_stats::released(ALLOC_BUFFERS, buf->capacity());
+    buf->clear();
+    return std::auto_ptr<e::buffer>(buf);
+}
+
+std::auto_ptr<e::buffer>
+buffer_pool :: reuse(std::auto_ptr<e::buffer> msg, size_t sz)
+{
+    if (msg.get() && msg->capacity() >= sz)
+    {
+        msg->clear();
+        return msg;
+    }
+
+    recycle(msg);
+    return create(sz);
+}
+
+void
+buffer_pool :: recycle(std::auto_ptr<e::buffer> buf)
+{
+    if (!buf.get() || buf->capacity() < (size_t(1) << BUFFER_POOL_MIN_SHIFT))
+    {
+        return;
+    }
+
+    // file the buffer under the largest class it can serve in full
+    unsigned shift = BUFFER_POOL_MIN_SHIFT;
+
+    while ((size_t(1) << (shift + 1)) <= buf->capacity())
+    {
+        ++shift;
+    }
+
+    // oversized buffers would pin memory behind a small size class
+    if (shift > BUFFER_POOL_MAX_SHIFT)
+    {
+        return;
+    }
+
+    const unsigned cls = shift - BUFFER_POOL_MIN_SHIFT;
+
+    if (s_free_sz[cls] >= BUFFER_POOL_MAX_FREE)
+    {
+        return;
+    }
+
+    alloc_stats::held(ALLOC_BUFFERS, buf->capacity());
+    e::buffer* b = buf.release();
+    set_next(b, s_free[cls]);
+    s_free[cls] = b;
+    ++s_free_sz[cls];
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_buffer_pool_h_
+#define consus_common_buffer_pool_h_
+
+// Per-thread free lists of message buffers in power-of-two size classes.
+// BusyBee takes ownership of every buffer it sends, so the pool is refilled
+// from the other direction:  handlers that have finished with a received
+// message hand it back, and the next message the thread builds reuses it.
+// Buffers may be returned on a different thread than the one that created
+// them, just as with pooled<T>.
+
+// STL
+#include <memory>
+
+// e
+#include <e/buffer.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+class buffer_pool
+{
+    public:
+        // an empty buffer with a capacity of at least sz bytes
+        static std::auto_ptr<e::buffer> create(size_t sz);
+        // turn a received message, whose contents will not be touched again,
+        // into an empty buffer of at least sz bytes for the reply
+        static std::auto_ptr<e::buffer> reuse(std::auto_ptr<e::buffer> msg, size_t sz);
+        // return a buffer whose contents will not be touched again
+        static void recycle(std::auto_ptr<e::buffer> buf);
+
+    private:
+        buffer_pool();
+        buffer_pool(const buffer_pool&);
+        buffer_pool& operator = (const buffer_pool&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_buffer_pool_h_
@@ -0,0 +1,194 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// e
+#include <e/endian.h>
+#include <e/serialization.h>
+
+// consus
+#include "common/bulk_load.h"
+
+#define BULK_LOAD_MAGIC "consus-bulk-load"
+#define BULK_LOAD_MAGIC_SIZE 16
+#define HEADER_SIZE (BULK_LOAD_MAGIC_SIZE + sizeof(uint64_t) + sizeof(uint32_t))
+#define BLOCK_HEADER_SIZE (sizeof(uint16_t) + 2 * sizeof(uint64_t))
+
+using consus::bulk_load_writer;
+using consus::bulk_load_reader;
+
+bulk_load_writer :: bulk_load_writer()
+    : m_fd()
+{
+}
+
+bulk_load_writer :: ~bulk_load_writer() throw ()
+{
+}
+
+bool
+bulk_load_writer :: open(const std::string& path, const e::slice& table, uint64_t timestamp)
+{
+    m_fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+
+    if (m_fd.get() < 0)
+    {
+        return false;
+    }
+
+    unsigned char header[HEADER_SIZE];
+    memmove(header, BULK_LOAD_MAGIC, BULK_LOAD_MAGIC_SIZE);
+    e::pack64be(timestamp, header + BULK_LOAD_MAGIC_SIZE);
+    e::pack32be(table.size(), header + BULK_LOAD_MAGIC_SIZE + sizeof(uint64_t));
+    return m_fd.xwrite(header, HEADER_SIZE) == ssize_t(HEADER_SIZE) &&
+           m_fd.xwrite(table.data(), table.size()) == ssize_t(table.size());
+}
+
+bool
+bulk_load_writer :: block(uint16_t index, const records_t& records)
+{
+    std::string body;
+    e::packer pa(&body);
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        pa = pa << e::slice(records[i].first) << e::slice(records[i].second);
+    }
+
+    unsigned char header[BLOCK_HEADER_SIZE];
+    e::pack16be(index, header);
+    e::pack64be(records.size(), header + sizeof(uint16_t));
+    e::pack64be(body.size(), header + sizeof(uint16_t) + sizeof(uint64_t));
+    return m_fd.xwrite(header, BLOCK_HEADER_SIZE) == ssize_t(BLOCK_HEADER_SIZE) &&
+           m_fd.xwrite(body.data(), body.size()) == ssize_t(body.size());
+}
+
+bool
+bulk_load_writer :: close()
+{
+    bool ok = fsync(m_fd.get()) == 0;
+    m_fd.close();
+    return ok;
+}
+
+bulk_load_reader :: bulk_load_reader()
+    : m_fd()
+    , m_table()
+    , m_timestamp(0)
+    , m_remain(0)
+    , m_error(false)
+{
+}
+
+bulk_load_reader :: ~bulk_load_reader() throw ()
+{
+}
+
+bool
+bulk_load_reader :: open(const std::string& path)
+{
+    m_fd = ::open(path.c_str(), O_RDONLY);
+
+    if (m_fd.get() < 0)
+    {
+        return false;
+    }
+
+    char header[HEADER_SIZE];
+
+    if (!read_exactly(header, HEADER_SIZE) ||
+        memcmp(header, BULK_LOAD_MAGIC, BULK_LOAD_MAGIC_SIZE) != 0)
+    {
+        return false;
+    }
+
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(header);
+    uint32_t table_sz = 0;
+    e::unpack64be(ptr + BULK_LOAD_MAGIC_SIZE, &m_timestamp);
+    e::unpack32be(ptr + BULK_LOAD_MAGIC_SIZE + sizeof(uint64_t), &table_sz);
+    m_table.resize(table_sz);
+    return table_sz == 0 || read_exactly(&m_table[0], table_sz);
+}
+
+bool
+bulk_load_reader :: next(uint16_t* index, uint64_t* records)
+{
+    if (m_remain > 0 && lseek(m_fd.get(), m_remain, SEEK_CUR) < 0)
+    {
+        m_error = true;
+        return false;
+    }
+
+    m_remain = 0;
+    char header[BLOCK_HEADER_SIZE];
+    ssize_t amt = m_fd.xread(header, BLOCK_HEADER_SIZE);
+
+    if (amt == 0)
+    {
+        return false;
+    }
+    else if (amt != ssize_t(BLOCK_HEADER_SIZE))
+    {
+        m_error = true;
+        return false;
+    }
+
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(header);
+    e::unpack16be(ptr, index);
+    e::unpack64be(ptr + sizeof(uint16_t), records);
+    e::unpack64be(ptr + sizeof(uint16_t) + sizeof(uint64_t), &m_remain);
+    return true;
+}
+
+bool
+bulk_load_reader :: read(std::string* block)
+{
+    block->resize(m_remain);
+
+    if (m_remain > 0 && !read_exactly(&(*block)[0], m_remain))
+    {
+        m_error = true;
+        return false;
+    }
+
+    m_remain = 0;
+    return true;
+}
+
+bool
+bulk_load_reader :: read_exactly(char* buf, size_t buf_sz)
+{
+    return m_fd.xread(buf, buf_sz) == ssize_t(buf_sz);
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_bulk_load_h_
+#define consus_common_bulk_load_h_
+
+// Bulk-load files carry one table's initial data to every key-value store
+// without going through transactions.  Every version in a file has the same
+// timestamp.  The file is a header followed by blocks of records that share a
+// ring index.  consus-bulk-load writes one block per index, in increasing order
+// of index; exports made by the stores may repeat an index in later blocks:
+//
+//  header: "consus-bulk-load" | timestamp (u64) | table size (u32) | table
+//  block:  index (u16) | records (u64) | bytes (u64) | (key, value)* by key
+//
+// Integers are big-endian and the records are packed as e::slices, so a store
+// can read the blocks for the indices it replicates and seek past the rest.
+
+// C
+#include <stdint.h>
+
+// STL
+#include <string>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/io/fd.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+class bulk_load_writer
+{
+    public:
+        typedef std::vector<std::pair<std::string, std::string> > records_t;
+
+    public:
+        bulk_load_writer();
+        ~bulk_load_writer() throw ();
+
+    public:
+        bool open(const std::string& path, const e::slice& table, uint64_t timestamp);
+        // records must be sorted by key
+        bool block(uint16_t index, const records_t& records);
+        // flushes the file to disk
+        bool close();
+
+    private:
+        po6::io::fd m_fd;
+
+    private:
+        bulk_load_writer(const bulk_load_writer&);
+        bulk_load_writer& operator = (const bulk_load_writer&);
+};
+
+class bulk_load_reader
+{
+    public:
+        bulk_load_reader();
+        ~bulk_load_reader() throw ();
+
+    public:
+        bool open(const std::string& path);
+        const std::string& table() const { return m_table; }
+        uint64_t timestamp() const { return m_timestamp; }
+        // advance to the next block, skipping the rest of the current one;
+        // false at the end of the file or if it is corrupt (see error())
+        bool next(uint16_t* index, uint64_t* records);
+        // the records of the block next() found, for e::unpacker
+        bool read(std::string* block);
+        bool error() const { return m_error; }
+
+    private:
+        bool read_exactly(char* buf, size_t buf_sz);
+
+    private:
+        po6::io::fd m_fd;
+        std::string m_table;
+        uint64_t m_timestamp;
+        // bytes of the current block not yet read
+        uint64_t m_remain;
+        bool m_error;
+
+    private:
+        bulk_load_reader(const bulk_load_reader&);
+        bulk_load_reader& operator = (const bulk_load_reader&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_bulk_load_h_
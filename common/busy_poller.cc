@@ -0,0 +1,96 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "common/busy_poller.h"
+
+using consus::busy_poller;
+
+// a spin shorter than this is not worth the CPU; block instead
+#define BUSY_POLL_MIN_SPIN 1000ULL
+
+busy_poller :: busy_poller(uint64_t limit)
+    : m_limit(limit)
+    , m_spin(limit)
+{
+}
+
+busy_poller :: ~busy_poller() throw ()
+{
+}
+
+busybee_returncode
+busy_poller :: recv(busybee_server* bb,
+                    e::garbage_collector::thread_state* ts,
+                    uint64_t* id, std::auto_ptr<e::buffer>* msg)
+{
+    if (m_limit == 0)
+    {
+        return bb->recv(ts, -1, id, msg);
+    }
+
+    const uint64_t start = po6::monotonic_time();
+    busybee_returncode rc;
+
+    if (m_spin > 0)
+    {
+        do
+        {
+            rc = bb->recv(ts, 0, id, msg);
+
+            if (rc != BUSYBEE_TIMEOUT)
+            {
+                m_spin = m_limit;
+                return rc;
+            }
+        }
+        while (po6::monotonic_time() - start < m_spin);
+
+        m_spin /= 2;
+
+        if (m_spin < BUSY_POLL_MIN_SPIN)
+        {
+            m_spin = 0;
+        }
+    }
+
+    rc = bb->recv(ts, -1, id, msg);
+
+    // a spin up to the limit would have caught this one
+    if (rc == BUSYBEE_SUCCESS && po6::monotonic_time() - start < m_limit)
+    {
+        m_spin = std::min(m_limit, std::max(m_spin * 2, uint64_t(BUSY_POLL_MIN_SPIN)));
+    }
+
+    return rc;
+}
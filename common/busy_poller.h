@@ -0,0 +1,74 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_busy_poller_h_
+#define consus_common_busy_poller_h_
+
+// STL
+#include <memory>
+
+// e
+#include <e/buffer.h>
+#include <e/garbage_collector.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Receives for one network thread, spinning on non-blocking receives for a
+// while before it blocks, so that a message arriving on a busy server does
+// not pay for a wakeup.  The spin adapts:  it halves each time it ends
+// empty-handed, so an idle thread soon blocks straight away, and doubles
+// back up to the limit whenever a message turns up within the limit.  A
+// limit of 0 always blocks.
+class busy_poller
+{
+    public:
+        busy_poller(uint64_t limit);
+        ~busy_poller() throw ();
+
+    public:
+        busybee_returncode recv(busybee_server* bb,
+                                e::garbage_collector::thread_state* ts,
+                                uint64_t* id, std::auto_ptr<e::buffer>* msg);
+
+    private:
+        const uint64_t m_limit;
+        uint64_t m_spin;
+
+    private:
+        busy_poller(const busy_poller&);
+        busy_poller& operator = (const busy_poller&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_busy_poller_h_
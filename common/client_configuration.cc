@@ -36,7 +36,17 @@ consus :: client_configuration(e::unpacker up,
                                cluster_id* cid,
                                version_id* vid,
                                uint64_t* flags,
-                               std::vector<txman>* txmans)
+                               std::vector<txman>* txmans,
+                               std::vector<txman>* readers)
 {
-    return up >> *cid >> *vid >> *flags >> *txmans;
+    up = up >> *cid >> *vid >> *flags >> *txmans;
+    readers->clear();
+
+    // coordinators predating read replicas send none
+    if (!up.error() && up.remain())
+    {
+        up = up >> *readers;
+    }
+
+    return up;
 }
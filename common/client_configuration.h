@@ -39,7 +39,8 @@ e::unpacker client_configuration(e::unpacker up,
                                  cluster_id* cid,
                                  version_id* vid,
                                  uint64_t* flags,
-                                 std::vector<txman>* txmans);
+                                 std::vector<txman>* txmans,
+                                 std::vector<txman>* readers);
 
 END_CONSUS_NAMESPACE
 
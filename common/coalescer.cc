@@ -0,0 +1,180 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/varint.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/coalescer.h"
+#include "common/network_msgtype.h"
+
+using consus::coalescer;
+
+// unless set_limits says otherwise, messages larger than this are sent on
+// their own
+#define COALESCE_MAX_MESSAGE 1024
+// unless set_limits says otherwise, a batch is sent as soon as it holds this
+// many bytes
+#define COALESCE_BATCH_BYTES 8192
+
+coalescer :: coalescer()
+    : m_window(0)
+    , m_max_message(COALESCE_MAX_MESSAGE)
+    , m_batch_bytes(COALESCE_BATCH_BYTES)
+    , m_mtx()
+    , m_batches()
+{
+}
+
+coalescer :: ~coalescer() throw ()
+{
+    for (std::map<comm_id, batch>::iterator it = m_batches.begin();
+            it != m_batches.end(); ++it)
+    {
+        for (size_t i = 0; i < it->second.msgs.size(); ++i)
+        {
+            delete it->second.msgs[i];
+        }
+    }
+}
+
+void
+coalescer :: set_limits(size_t max_message, size_t batch_bytes)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_max_message = max_message;
+    m_batch_bytes = batch_bytes;
+}
+
+void
+coalescer :: add(comm_id id, std::auto_ptr<e::buffer> msg, outbox_t* ready)
+{
+    const size_t sz = msg->size() - BUSYBEE_HEADER_SIZE;
+    po6::threads::mutex::hold hold(&m_mtx);
+    batch* b = &m_batches[id];
+
+    if (sz > m_max_message)
+    {
+        flush(id, b, ready);
+        ready->push_back(std::make_pair(id, msg.release()));
+        return;
+    }
+
+    if (b->msgs.empty())
+    {
+        b->started = po6::monotonic_time();
+    }
+
+    b->msgs.push_back(msg.release());
+    b->bytes += e::varint_length(sz) + sz;
+
+    if (b->bytes >= m_batch_bytes)
+    {
+        flush(id, b, ready);
+    }
+}
+
+void
+coalescer :: expired(uint64_t now, outbox_t* ready)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (std::map<comm_id, batch>::iterator it = m_batches.begin();
+            it != m_batches.end(); ++it)
+    {
+        if (!it->second.msgs.empty() && it->second.started + m_window <= now)
+        {
+            flush(it->first, &it->second, ready);
+        }
+    }
+}
+
+bool
+coalescer :: split(e::unpacker up, std::vector<e::buffer*>* msgs)
+{
+    while (!up.error() && up.remain() > 0)
+    {
+        e::slice m;
+        up = up >> m;
+
+        if (up.error())
+        {
+            break;
+        }
+
+        e::buffer* buf = e::buffer::create(BUSYBEE_HEADER_SIZE + m.size());
+        memmove(buf->data() + BUSYBEE_HEADER_SIZE, m.data(), m.size());
+        buf->resize(BUSYBEE_HEADER_SIZE + m.size());
+        msgs->push_back(buf);
+    }
+
+    return !up.error();
+}
+
+void
+coalescer :: flush(comm_id id, batch* b, outbox_t* ready)
+{
+    if (b->msgs.empty())
+    {
+        return;
+    }
+
+    // a lone message gains nothing from the extra framing
+    if (b->msgs.size() == 1)
+    {
+        ready->push_back(std::make_pair(id, b->msgs[0]));
+        b->msgs.clear();
+        b->bytes = 0;
+        return;
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(CONSUS_BATCH)
+                    + b->bytes;
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE) << CONSUS_BATCH;
+
+    for (size_t i = 0; i < b->msgs.size(); ++i)
+    {
+        e::buffer* m = b->msgs[i];
+        pa = pa << e::slice(m->data() + BUSYBEE_HEADER_SIZE, m->size() - BUSYBEE_HEADER_SIZE);
+        delete m;
+    }
+
+    b->msgs.clear();
+    b->bytes = 0;
+    ready->push_back(std::make_pair(id, msg.release()));
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_coalescer_h_
+#define consus_common_coalescer_h_
+
+// STL
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/buffer.h>
+#include <e/serialization.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Holds small messages bound for the same peer for up to a window so that
+// they travel together as one CONSUS_BATCH frame.  A batch leaves as soon as
+// it is full, or when expired() finds it has waited out the window; larger
+// messages never wait, but first push out whatever is queued ahead of them.
+class coalescer
+{
+    public:
+        typedef std::vector<std::pair<comm_id, e::buffer*> > outbox_t;
+
+    public:
+        coalescer();
+        ~coalescer() throw ();
+
+    public:
+        void set_window(uint64_t window) { m_window = window; }
+        bool enabled() const { return m_window > 0; }
+        uint64_t window() const { return m_window; }
+        // messages larger than max_message are sent on their own, and a
+        // batch leaves once it holds batch_bytes
+        void set_limits(size_t max_message, size_t batch_bytes);
+        // queue msg for id; anything that must be sent now, in order, is
+        // appended to ready and owned by the caller
+        void add(comm_id id, std::auto_ptr<e::buffer> msg, outbox_t* ready);
+        // every batch that was started at or before now - window
+        void expired(uint64_t now, outbox_t* ready);
+        // the messages carried by the CONSUS_BATCH that up points into
+        static bool split(e::unpacker up, std::vector<e::buffer*>* msgs);
+
+    private:
+        struct batch
+        {
+            batch() : msgs(), bytes(0), started(0) {}
+            std::vector<e::buffer*> msgs;
+            size_t bytes;
+            uint64_t started;
+        };
+        void flush(comm_id id, batch* b, outbox_t* ready);
+
+    private:
+        uint64_t m_window;
+        size_t m_max_message;
+        size_t m_batch_bytes;
+        po6::threads::mutex m_mtx;
+        std::map<comm_id, batch> m_batches;
+
+    private:
+        coalescer(const coalescer&);
+        coalescer& operator = (const coalescer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_coalescer_h_
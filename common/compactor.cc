@@ -0,0 +1,267 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <string.h>
+
+// STL
+#include <string>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/compactor.h"
+#include "common/network_msgtype.h"
+
+using consus::compactor;
+
+// the encoding written by this build; bump it whenever the format changes
+#define COMPACT_VERSION 1
+// larger messages carry values rather than control fields and are sent as
+// they are; this also bounds what a frame may claim to expand to
+#define COMPACT_MAX_BYTES UINT16_MAX
+
+namespace
+{
+
+unsigned
+zeros_in_word(const uint8_t* word)
+{
+    unsigned zeros = 0;
+
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        zeros += word[i] == 0 ? 1 : 0;
+    }
+
+    return zeros;
+}
+
+// Each word becomes a tag whose bit i is set when byte i is nonzero,
+// followed by the nonzero bytes.  An all-zero tag is followed by a count of
+// further all-zero words that were skipped; an all-ones tag is followed by
+// a count of further words, each with at most one zero byte, copied as is.
+// A trailing partial word is treated as if padded with zeros.
+void
+pack_words(const uint8_t* data, size_t sz, std::string* out)
+{
+    size_t i = 0;
+
+    while (i < sz)
+    {
+        uint8_t word[8];
+        const size_t w = sz - i < 8 ? sz - i : 8;
+        memset(word, 0, sizeof(word));
+        memmove(word, data + i, w);
+        i += w;
+        uint8_t tag = 0;
+
+        for (unsigned b = 0; b < 8; ++b)
+        {
+            tag |= word[b] != 0 ? (1U << b) : 0;
+        }
+
+        out->push_back(char(tag));
+
+        for (unsigned b = 0; b < 8; ++b)
+        {
+            if (word[b] != 0)
+            {
+                out->push_back(char(word[b]));
+            }
+        }
+
+        if (tag == 0)
+        {
+            unsigned count = 0;
+
+            while (count < 255 && i + 8 <= sz && zeros_in_word(data + i) == 8)
+            {
+                ++count;
+                i += 8;
+            }
+
+            out->push_back(char(count));
+        }
+        else if (tag == 0xff)
+        {
+            const size_t start = i;
+            unsigned count = 0;
+
+            while (count < 255 && i + 8 <= sz && zeros_in_word(data + i) <= 1)
+            {
+                ++count;
+                i += 8;
+            }
+
+            out->push_back(char(count));
+            out->append(reinterpret_cast<const char*>(data + start), i - start);
+        }
+    }
+}
+
+bool
+unpack_words(const uint8_t* in, size_t in_sz, uint8_t* out, size_t out_sz)
+{
+    size_t pos = 0;
+    size_t off = 0;
+
+    while (off < out_sz)
+    {
+        if (pos >= in_sz)
+        {
+            return false;
+        }
+
+        const uint8_t tag = in[pos++];
+        uint8_t word[8];
+
+        for (unsigned b = 0; b < 8; ++b)
+        {
+            word[b] = 0;
+
+            if ((tag & (1U << b)))
+            {
+                if (pos >= in_sz)
+                {
+                    return false;
+                }
+
+                word[b] = in[pos++];
+            }
+        }
+
+        const size_t w = out_sz - off < 8 ? out_sz - off : 8;
+        memmove(out + off, word, w);
+        off += w;
+
+        if (tag != 0 && tag != 0xff)
+        {
+            continue;
+        }
+
+        if (pos >= in_sz)
+        {
+            return false;
+        }
+
+        const size_t run = size_t(in[pos++]) * 8;
+
+        if (run > out_sz - off)
+        {
+            return false;
+        }
+
+        if (tag == 0)
+        {
+            memset(out + off, 0, run);
+        }
+        else
+        {
+            if (run > in_sz - pos)
+            {
+                return false;
+            }
+
+            memmove(out + off, in + pos, run);
+            pos += run;
+        }
+
+        off += run;
+    }
+
+    return pos == in_sz;
+}
+
+} // namespace
+
+compactor :: compactor()
+    : m_enabled(false)
+{
+}
+
+compactor :: ~compactor() throw ()
+{
+}
+
+void
+compactor :: compact(std::auto_ptr<e::buffer>* msg) const
+{
+    const size_t sz = (*msg)->size() - BUSYBEE_HEADER_SIZE;
+
+    if (!m_enabled || sz > COMPACT_MAX_BYTES)
+    {
+        return;
+    }
+
+    std::string packed;
+    packed.reserve(sz + sz / 8 + 2);
+    pack_words((*msg)->data() + BUSYBEE_HEADER_SIZE, sz, &packed);
+    const size_t header_sz = pack_size(CONSUS_COMPACT)
+                           + sizeof(uint8_t)
+                           + sizeof(uint16_t);
+    const size_t frame_sz = BUSYBEE_HEADER_SIZE + header_sz + packed.size();
+
+    if (frame_sz >= (*msg)->size())
+    {
+        return;
+    }
+
+    std::auto_ptr<e::buffer> frame(e::buffer::create(frame_sz));
+    frame->pack_at(BUSYBEE_HEADER_SIZE)
+        << CONSUS_COMPACT << uint8_t(COMPACT_VERSION) << uint16_t(sz);
+    memmove(frame->data() + BUSYBEE_HEADER_SIZE + header_sz, packed.data(), packed.size());
+    frame->resize(frame_sz);
+    *msg = frame;
+}
+
+e::buffer*
+compactor :: expand(const e::buffer* msg, e::unpacker up) const
+{
+    uint8_t version;
+    uint16_t sz;
+    up = up >> version >> sz;
+
+    if (up.error() || version != COMPACT_VERSION)
+    {
+        return NULL;
+    }
+
+    const uint8_t* packed = msg->data() + msg->size() - up.remain();
+    std::auto_ptr<e::buffer> ret(e::buffer::create(BUSYBEE_HEADER_SIZE + sz));
+
+    if (!unpack_words(packed, up.remain(), ret->data() + BUSYBEE_HEADER_SIZE, sz))
+    {
+        return NULL;
+    }
+
+    ret->resize(BUSYBEE_HEADER_SIZE + sz);
+    return ret.release();
+}
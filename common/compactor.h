@@ -0,0 +1,78 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_compactor_h_
+#define consus_common_compactor_h_
+
+// STL
+#include <memory>
+
+// e
+#include <e/buffer.h>
+#include <e/serialization.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Compact framing for the small control messages that make up most of a
+// commit.  Their fields are fixed-width 64-bit integers that are mostly zero
+// bytes, so a CONSUS_COMPACT frame stores each 8-byte word of the message as
+// a bitmap of its nonzero bytes followed by those bytes, with runs of zero or
+// incompressible words collapsed.  The encoding knows nothing about message
+// layouts and works for every message type.  Each frame names its encoding
+// version, so receivers can drop frames they don't understand, and as with
+// CONSUS_COMPRESSED every build expands frames whether or not it sends them.
+class compactor
+{
+    public:
+        compactor();
+        ~compactor() throw ();
+
+    public:
+        bool enabled() const { return m_enabled; }
+        void enable() { m_enabled = true; }
+        // replace *msg with a CONSUS_COMPACT frame when that makes it
+        // smaller
+        void compact(std::auto_ptr<e::buffer>* msg) const;
+        // the message carried by the CONSUS_COMPACT frame msg, whose
+        // remaining contents up points into, or NULL if it is corrupt or
+        // uses an unknown version
+        e::buffer* expand(const e::buffer* msg, e::unpacker up) const;
+
+    private:
+        bool m_enabled;
+
+    private:
+        compactor(const compactor&);
+        compactor& operator = (const compactor&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_compactor_h_
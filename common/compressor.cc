@@ -0,0 +1,202 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// C
+#include <string.h>
+
+// STL
+#include <fstream>
+#include <sstream>
+
+#ifdef CONSUS_LZ4
+// LZ4
+#include <lz4.h>
+#endif
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/compressor.h"
+#include "common/crc32c.h"
+#include "common/network_msgtype.h"
+
+using consus::compressor;
+
+// messages with fewer payload bytes than this are sent as they are
+#define COMPRESS_MIN_BYTES 256
+// LZ4 only looks back this far, so a longer dictionary is wasted
+#define COMPRESS_MAX_DICT (64 * 1024)
+// refuse frames that claim to expand to more than this
+#define COMPRESS_MAX_MESSAGE (64 * 1024 * 1024)
+
+compressor :: compressor()
+    : m_enabled(false)
+    , m_dict()
+    , m_dict_crc(0)
+{
+}
+
+compressor :: ~compressor() throw ()
+{
+}
+
+bool
+compressor :: available()
+{
+#ifdef CONSUS_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+compressor :: load_dictionary(const std::string& path)
+{
+    std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+
+    if (!fin)
+    {
+        return false;
+    }
+
+    std::ostringstream contents;
+    contents << fin.rdbuf();
+    m_dict = contents.str();
+
+    if (m_dict.size() > COMPRESS_MAX_DICT)
+    {
+        m_dict = m_dict.substr(m_dict.size() - COMPRESS_MAX_DICT);
+    }
+
+    m_dict_crc = m_dict.empty() ? 0 : crc32c(0, reinterpret_cast<const unsigned char*>(m_dict.data()), m_dict.size());
+    return true;
+}
+
+void
+compressor :: compress(std::auto_ptr<e::buffer>* msg) const
+{
+#ifdef CONSUS_LZ4
+    const size_t sz = (*msg)->size() - BUSYBEE_HEADER_SIZE;
+
+    if (!m_enabled || sz < COMPRESS_MIN_BYTES || sz > COMPRESS_MAX_MESSAGE)
+    {
+        return;
+    }
+
+    const char* src = reinterpret_cast<const char*>((*msg)->data() + BUSYBEE_HEADER_SIZE);
+    const int bound = LZ4_compressBound(sz);
+    std::string dst(bound, '\0');
+    int dst_sz = 0;
+
+    if (m_dict.empty())
+    {
+        dst_sz = LZ4_compress_default(src, &dst[0], sz, bound);
+    }
+    else
+    {
+        // the stream is per call so that threads may compress concurrently
+        LZ4_stream_t* stream = LZ4_createStream();
+
+        if (!stream)
+        {
+            return;
+        }
+
+        LZ4_loadDict(stream, m_dict.data(), m_dict.size());
+        dst_sz = LZ4_compress_fast_continue(stream, src, &dst[0], sz, bound, 1);
+        LZ4_freeStream(stream);
+    }
+
+    const e::slice compressed(dst.data(), dst_sz > 0 ? dst_sz : 0);
+    const size_t frame_sz = BUSYBEE_HEADER_SIZE
+                          + pack_size(CONSUS_COMPRESSED)
+                          + sizeof(uint32_t)
+                          + sizeof(uint64_t)
+                          + pack_size(compressed);
+
+    if (dst_sz <= 0 || frame_sz >= (*msg)->size())
+    {
+        return;
+    }
+
+    std::auto_ptr<e::buffer> frame(e::buffer::create(frame_sz));
+    frame->pack_at(BUSYBEE_HEADER_SIZE)
+        << CONSUS_COMPRESSED << m_dict_crc << uint64_t(sz) << compressed;
+    *msg = frame;
+#else
+    (void) msg;
+#endif
+}
+
+e::buffer*
+compressor :: decompress(e::unpacker up) const
+{
+#ifdef CONSUS_LZ4
+    uint32_t dict_crc;
+    uint64_t sz;
+    e::slice compressed;
+    up = up >> dict_crc >> sz >> compressed;
+
+    if (up.error() || (dict_crc != 0 && dict_crc != m_dict_crc) ||
+        sz > COMPRESS_MAX_MESSAGE)
+    {
+        return NULL;
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(BUSYBEE_HEADER_SIZE + sz));
+    char* dst = reinterpret_cast<char*>(msg->data() + BUSYBEE_HEADER_SIZE);
+    const char* src = reinterpret_cast<const char*>(compressed.data());
+    int ret = 0;
+
+    if (dict_crc == 0)
+    {
+        ret = LZ4_decompress_safe(src, dst, compressed.size(), sz);
+    }
+    else
+    {
+        ret = LZ4_decompress_safe_usingDict(src, dst, compressed.size(), sz,
+                                            m_dict.data(), m_dict.size());
+    }
+
+    if (ret < 0 || uint64_t(ret) != sz)
+    {
+        return NULL;
+    }
+
+    msg->resize(BUSYBEE_HEADER_SIZE + sz);
+    return msg.release();
+#else
+    (void) up;
+    return NULL;
+#endif
+}
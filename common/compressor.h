@@ -0,0 +1,84 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_compressor_h_
+#define consus_common_compressor_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <memory>
+#include <string>
+
+// e
+#include <e/buffer.h>
+#include <e/serialization.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// LZ4 framing for messages that cross the WAN.  A CONSUS_COMPRESSED frame
+// names the dictionary it was compressed with by its CRC (0 for none), so a
+// receiver that was given a different dictionary drops the message instead
+// of misreading it; the sender's retransmission timers take it from there.
+// Without LZ4 support every call is a no-op.
+class compressor
+{
+    public:
+        compressor();
+        ~compressor() throw ();
+
+    public:
+        static bool available();
+        bool enabled() const { return m_enabled; }
+        void enable() { m_enabled = available(); }
+        // prime the compressor with the contents of path; at most the last
+        // 64kB are used
+        bool load_dictionary(const std::string& path);
+        // replace *msg with a CONSUS_COMPRESSED frame when that makes it
+        // smaller; small messages are left alone
+        void compress(std::auto_ptr<e::buffer>* msg) const;
+        // the message carried by the CONSUS_COMPRESSED frame that up points
+        // into, or NULL if it is corrupt or needs another dictionary
+        e::buffer* decompress(e::unpacker up) const;
+
+    private:
+        bool m_enabled;
+        std::string m_dict;
+        uint32_t m_dict_crc;
+
+    private:
+        compressor(const compressor&);
+        compressor& operator = (const compressor&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_compressor_h_
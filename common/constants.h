@@ -30,8 +30,18 @@
 
 #define CONSUS_MAX_REPLICATION_FACTOR 9
 
+// Replication factor for tables that have not been assigned one through the
+// coordinator.
+#define CONSUS_DEFAULT_REPLICATION_FACTOR 5
+
 #define CONSUS_PORT_TXMAN 22751
 #define CONSUS_PORT_KVS 22761
+#define CONSUS_PORT_PROXY 22771
+
+// Clients of a proxy draw their nonces from blocks of their own, so that the
+// proxy routes each response by its nonce alone:  the bits above this shift
+// name the client, and those below count its requests.
+#define CONSUS_PROXY_NONCE_SHIFT 40
 
 // This defines the maximum number of key-value stores that can be within a
 // single data center.  This can support a 10PB data set with just 160GB per
@@ -50,11 +60,36 @@
 //  - common/partition.h
 //  - assumed to fit in an unsigned int
 //  - assumed to be this exact value in daemon::choose_index
+//
+// Keys hash to one of this many slots, and each of a ring's partitions covers
+// an equal run of them, so this is also the most partitions a ring can be
+// split into.
 #define CONSUS_KVS_PARTITIONS 65536
 
+// A data center's ring starts with this many partitions, so that a small
+// cluster's configuration stays cheap to ship and rebuild.  Splitting a ring
+// doubles its partitions, up to CONSUS_KVS_PARTITIONS, as data grows.  Always
+// a power of two.
+#define CONSUS_KVS_INITIAL_PARTITIONS 1024
+
 #define CONSUS_VOTE_ABORT 0x61626f7274000000ULL
 #define CONSUS_VOTE_COMMIT 0x636f6d6d69740000ULL
 
 #define CONSUS_WRITE_TOMBSTONE 1
 
+// Upper bound on the keys a key-value store returns for one scan request.
+// Longer scans are issued as several requests that each resume where the
+// previous one left off.
+#define CONSUS_MAX_SCAN_LIMIT 1024
+
+// Upper bound on the keys a transaction may declare when it begins; the
+// transaction manager locks them all with one batch per key-value store.
+#define CONSUS_MAX_DECLARED_KEYS 256
+
+// A client may issue a transaction's operations without waiting for earlier
+// ones, but never more than this many slots past the lowest one still
+// unanswered.  The transaction manager refuses operations further out, so
+// the gaps it holds open for operations yet to arrive stay bounded.
+#define CONSUS_TRANSACTION_WINDOW 256
+
 #endif // consus_common_constants_h_
@@ -39,6 +39,8 @@ consus :: operator << (std::ostream& lhs, const consus_returncode& rc)
         STRINGIFY(CONSUS_NOT_FOUND);
         STRINGIFY(CONSUS_ABORTED);
         STRINGIFY(CONSUS_COMMITTED);
+        STRINGIFY(CONSUS_SCAN_DONE);
+        STRINGIFY(CONSUS_COMPARE_FAILED);
         STRINGIFY(CONSUS_UNKNOWN_TABLE);
         STRINGIFY(CONSUS_NONE_PENDING);
         STRINGIFY(CONSUS_INVALID);
@@ -48,6 +50,7 @@ consus :: operator << (std::ostream& lhs, const consus_returncode& rc)
         STRINGIFY(CONSUS_COORD_FAIL);
         STRINGIFY(CONSUS_UNAVAILABLE);
         STRINGIFY(CONSUS_SERVER_ERROR);
+        STRINGIFY(CONSUS_BUSY);
         STRINGIFY(CONSUS_INTERNAL);
         STRINGIFY(CONSUS_GARBAGE);
         default:
@@ -29,7 +29,13 @@
 #include <stdio.h>
 
 // POSIX
+#include <fcntl.h>
 #include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <vector>
 
 // Google Log
 #include <glog/logging.h>
@@ -58,6 +64,7 @@ coordinator_link :: coordinator_link(const std::string& rendezvous,
     , m_bind_to(bind_to)
     , m_data_center(data_center)
     , m_cb(c)
+    , m_deltas(c && c->follows_deltas())
     , m_config_id(-1)
     , m_config_status(REPLICANT_SUCCESS)
     , m_config_state(0)
@@ -72,6 +79,7 @@ coordinator_link :: coordinator_link(const std::string& rendezvous,
     , m_orphaned(false)
     , m_online_once(false)
     , m_backoff(250 * PO6_MILLIS)
+    , m_cache_path()
 {
     if (!m_repl)
     {
@@ -128,6 +136,45 @@ coordinator_link :: establish()
     return m_last_config_valid;
 }
 
+bool
+coordinator_link :: establish_cached()
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        invariant_check();
+
+        if (m_error)
+        {
+            LOG(ERROR) << "coordinator link failed";
+            return false;
+        }
+
+        po6::io::fd fd(open(m_cache_path.c_str(), O_RDONLY));
+        struct stat st;
+
+        if (!m_cache_path.empty() && fd.get() >= 0 &&
+            fstat(fd.get(), &st) == 0 && st.st_size > 0)
+        {
+            std::vector<char> data(st.st_size);
+
+            // m_last_config_state stays 0, so the coordinator's first answer
+            // replaces whatever was cached
+            if (fd.xread(&data[0], data.size()) == ssize_t(data.size()) &&
+                m_cb->new_config(&data[0], data.size()) &&
+                m_cb->has_id(m_id))
+            {
+                LOG(INFO) << "starting from the configuration cached in " << m_cache_path;
+                m_last_config_valid = true;
+                return true;
+            }
+
+            LOG(WARNING) << "ignoring the configuration cached in " << m_cache_path;
+        }
+    }
+
+    return establish();
+}
+
 void
 coordinator_link :: allow_reregistration()
 {
@@ -135,6 +182,13 @@ coordinator_link :: allow_reregistration()
     m_allow_rereg = true;
 }
 
+void
+coordinator_link :: cache_config(const std::string& path)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_cache_path = path;
+}
+
 void
 coordinator_link :: maintain_connection()
 {
@@ -147,7 +201,7 @@ coordinator_link :: maintain_connection()
         return;
     }
 
-    std::string cond = m_cb->prefix() + "conf";
+    std::string cond = m_cb->prefix() + (m_deltas ? "delta" : "conf");
 
     if (m_config_status != REPLICANT_SUCCESS)
     {
@@ -168,6 +222,14 @@ coordinator_link :: maintain_connection()
             m_config_status != REPLICANT_SUCCESS)
         {
             LOG(ERROR) << "coordinator failure: " << replicant_client_error_message(m_repl);
+
+            // a coordinator that predates deltas has no such condition
+            if (m_deltas && m_config_status == REPLICANT_COND_NOT_FOUND)
+            {
+                LOG(WARNING) << "coordinator does not publish " << cond << "; following full configurations";
+                m_deltas = false;
+            }
+
             return;
         }
 
@@ -212,7 +274,21 @@ coordinator_link :: maintain_connection()
 
     if (m_last_config_state < m_config_state)
     {
-        m_last_config_valid = m_cb->new_config(m_config_data, m_config_data_sz);
+        if (m_deltas)
+        {
+            m_last_config_valid = m_cb->new_config_delta(m_config_data, m_config_data_sz) ||
+                                  fetch_full_config();
+        }
+        else
+        {
+            m_last_config_valid = m_cb->new_config(m_config_data, m_config_data_sz);
+
+            if (m_last_config_valid)
+            {
+                save_config(m_config_data, m_config_data_sz);
+            }
+        }
+
         m_last_config_state = m_config_state;
 
         if (!m_cb->has_id(m_id) && m_allow_rereg)
@@ -344,6 +420,7 @@ coordinator_link :: registration()
     std::string func = m_cb->prefix() + "_register";
     std::string input;
     e::packer(&input) << m_id << m_bind_to << e::slice(m_data_center);
+    input += m_cb->registration_extra();
     coordinator_returncode rc;
 
     if (!call_no_lock(func.c_str(), input.data(), input.size(), &rc))
@@ -370,6 +447,58 @@ coordinator_link :: registration()
     }
 }
 
+bool
+coordinator_link :: fetch_full_config()
+{
+    std::string cond = m_cb->prefix() + "conf";
+    replicant_returncode status = REPLICANT_GARBAGE;
+    replicant_returncode lstatus = REPLICANT_GARBAGE;
+    char* data = NULL;
+    size_t data_sz = 0;
+    int64_t req = replicant_client_cond_wait(m_repl, "consus", cond.c_str(), 0,
+                                             &status, &data, &data_sz);
+
+    if (req < 0 ||
+        replicant_client_wait(m_repl, req, 10000, &lstatus) != req ||
+        status != REPLICANT_SUCCESS)
+    {
+        LOG(ERROR) << "coordinator failure: " << replicant_client_error_message(m_repl);
+        return false;
+    }
+
+    bool ret = m_cb->new_config(data, data_sz);
+
+    if (ret)
+    {
+        save_config(data, data_sz);
+    }
+
+    free(data);
+    return ret;
+}
+
+void
+coordinator_link :: save_config(const char* data, size_t data_sz)
+{
+    if (m_cache_path.empty())
+    {
+        return;
+    }
+
+    const std::string tmp(m_cache_path + ".tmp");
+    po6::io::fd fd(open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    // a torn cache would be rejected at startup anyway, but renaming keeps
+    // the previous one usable
+    if (fd.get() < 0 ||
+        fd.xwrite(data, data_sz) != ssize_t(data_sz) ||
+        fsync(fd.get()) < 0 ||
+        rename(tmp.c_str(), m_cache_path.c_str()) < 0)
+    {
+        PLOG(WARNING) << "could not cache configuration in " << m_cache_path;
+    }
+}
+
 bool
 coordinator_link :: online()
 {
@@ -408,3 +537,21 @@ coordinator_link :: callback :: callback()
 coordinator_link :: callback :: ~callback() throw ()
 {
 }
+
+std::string
+coordinator_link :: callback :: registration_extra()
+{
+    return std::string();
+}
+
+bool
+coordinator_link :: callback :: follows_deltas()
+{
+    return false;
+}
+
+bool
+coordinator_link :: callback :: new_config_delta(const char*, size_t)
+{
+    return false;
+}
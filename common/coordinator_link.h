@@ -65,11 +65,17 @@ class coordinator_link
         bool initial_registration();
         // establish a connection
         bool establish();
+        // like establish, but start from the configuration saved by
+        // cache_config when it still names this server, without waiting for
+        // the coordinator; maintain_connection reconciles it later
+        bool establish_cached();
 
         // claim the token again in steady state if removed; default is to set
         // "orphaned" and cease further activity (expecting the process to
         // self-terminate).
         void allow_reregistration();
+        // save every full configuration received to path
+        void cache_config(const std::string& path);
 
     // maintenance:  steady-state operation
     public:
@@ -92,6 +98,8 @@ class coordinator_link
         bool call_no_lock(const char* func, const char* input, size_t input_sz, coordinator_returncode* coord);
         bool registration();
         bool online();
+        bool fetch_full_config();
+        void save_config(const char* data, size_t data_sz);
 
     private:
         po6::threads::mutex m_mtx;
@@ -100,6 +108,7 @@ class coordinator_link
         const po6::net::location m_bind_to;
         const std::string m_data_center;
         callback* const m_cb;
+        bool m_deltas;
         int64_t m_config_id;
         replicant_returncode m_config_status;
         uint64_t m_config_state;
@@ -114,6 +123,7 @@ class coordinator_link
         bool m_orphaned;
         bool m_online_once;
         uint64_t m_backoff;
+        std::string m_cache_path;
 
     private:
         coordinator_link(const coordinator_link&);
@@ -128,7 +138,13 @@ class coordinator_link::callback
 
     public:
         virtual std::string prefix() = 0;
+        // appended to the registration request after the data center
+        virtual std::string registration_extra();
         virtual bool new_config(const char* data, size_t data_sz) = 0;
+        // follow the prefix + "delta" condition instead of prefix + "conf";
+        // the full configuration is fetched whenever new_config_delta fails
+        virtual bool follows_deltas();
+        virtual bool new_config_delta(const char* data, size_t data_sz);
         virtual bool has_id(comm_id id) = 0;
         virtual po6::net::location address(comm_id id) = 0;
         virtual bool is_steady_state(comm_id id) = 0;
@@ -25,16 +25,31 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+// C
+#include <arm_acle.h>
+#endif
+
 // consus
 #include "common/crc32c.h"
 
 #define CRC_FFs 0xFFFFFFFFU
 
+// Large buffers are checksummed as three independent lanes of CRC32C_LANE
+// bytes each so the CRC unit's latency is hidden, then folded together
+// with crc32c_shift_lane, which advances a CRC over CRC32C_LANE zero bytes.
+#define CRC32C_LANE 1024
+#define CRC32C_LANE_MIN (3 * CRC32C_LANE)
+
 static uint32_t
 crc32c_sb8_64_bit(uint32_t p_running_crc,
                   const uint8_t* p_buf,
                   const uint32_t length,
                   const uint32_t init_bytes);
+static void
+crc32c_init_lane_shift();
+static uint32_t
+crc32c_shift_lane(uint32_t crc);
 
 
 static uint32_t
@@ -80,6 +95,102 @@ crc32_sse42_quads(uint32_t init_crc, const uint8_t* data, size_t n)
     return crc;
 }
 
+#if defined(__x86_64__)
+static uint32_t
+crc32_sse42_lanes(uint32_t init_crc, const uint8_t* data, size_t n)
+{
+    if (n < CRC32C_LANE_MIN)
+    {
+        return crc32_sse42_quads(init_crc, data, n);
+    }
+
+    const uintptr_t x = reinterpret_cast<uintptr_t>(data);
+    const size_t align = ((x + 7) & ~7ULL) - x;
+    uint32_t crc = crc32_sse42_quads(init_crc, data, align) ^ CRC_FFs;
+    data += align;
+    n -= align;
+
+    while (n >= CRC32C_LANE_MIN)
+    {
+        const uint64_t* a_ptr = reinterpret_cast<const uint64_t*>(data);
+        const uint64_t* b_ptr = a_ptr + CRC32C_LANE / 8;
+        const uint64_t* c_ptr = b_ptr + CRC32C_LANE / 8;
+        uint64_t a = crc;
+        uint64_t b = 0;
+        uint64_t c = 0;
+
+        for (size_t i = 0; i < CRC32C_LANE / 8; ++i)
+        {
+            __asm__ __volatile__("crc32q %2, %0" : "=r"(a) : "0"(a), "r"(a_ptr[i]) : );
+            __asm__ __volatile__("crc32q %2, %0" : "=r"(b) : "0"(b), "r"(b_ptr[i]) : );
+            __asm__ __volatile__("crc32q %2, %0" : "=r"(c) : "0"(c), "r"(c_ptr[i]) : );
+        }
+
+        crc = crc32c_shift_lane(crc32c_shift_lane(a) ^ b) ^ c;
+        data += CRC32C_LANE_MIN;
+        n -= CRC32C_LANE_MIN;
+    }
+
+    return crc32_sse42_quads(crc ^ CRC_FFs, data, n);
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t
+crc32_armv8_bytes(uint32_t crc, const uint8_t* data, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        crc = __crc32cb(crc, data[i]);
+    }
+
+    return crc;
+}
+
+static uint32_t
+crc32_armv8_lanes(uint32_t init_crc, const uint8_t* data, size_t n)
+{
+    const uintptr_t x = reinterpret_cast<uintptr_t>(data);
+    const size_t align = ((x + 7) & ~7ULL) - x;
+    const size_t init = align > n ? n : align;
+    uint32_t crc = crc32_armv8_bytes(init_crc ^ CRC_FFs, data, init);
+    data += init;
+    n -= init;
+
+    while (n >= CRC32C_LANE_MIN)
+    {
+        const uint64_t* a_ptr = reinterpret_cast<const uint64_t*>(data);
+        const uint64_t* b_ptr = a_ptr + CRC32C_LANE / 8;
+        const uint64_t* c_ptr = b_ptr + CRC32C_LANE / 8;
+        uint32_t a = crc;
+        uint32_t b = 0;
+        uint32_t c = 0;
+
+        for (size_t i = 0; i < CRC32C_LANE / 8; ++i)
+        {
+            a = __crc32cd(a, a_ptr[i]);
+            b = __crc32cd(b, b_ptr[i]);
+            c = __crc32cd(c, c_ptr[i]);
+        }
+
+        crc = crc32c_shift_lane(crc32c_shift_lane(a) ^ b) ^ c;
+        data += CRC32C_LANE_MIN;
+        n -= CRC32C_LANE_MIN;
+    }
+
+    const uint64_t* body_ptr = reinterpret_cast<const uint64_t*>(data);
+    const size_t body = n >> 3;
+
+    for (size_t i = 0; i < body; ++i)
+    {
+        crc = __crc32cd(crc, body_ptr[i]);
+    }
+
+    crc = crc32_armv8_bytes(crc, data + (body << 3), n - (body << 3));
+    return crc ^ CRC_FFs;
+}
+#endif
+
 typedef uint32_t (*crc32c_func_t)(uint32_t init_crc, const uint8_t* data, size_t n);
 
 #if defined(__i386__)
@@ -101,6 +212,12 @@ typedef uint32_t (*crc32c_func_t)(uint32_t init_crc, const uint8_t* data, size_t
 static crc32c_func_t
 choose_crc32c()
 {
+    crc32c_init_lane_shift();
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return crc32_armv8_lanes;
+#endif
+
 #ifdef cpuid
     cpuid_t xa;
     cpuid_t xb;
@@ -110,7 +227,11 @@ choose_crc32c()
 
     if (xc & (1<<20))
     {
+#if defined(__x86_64__)
+        return crc32_sse42_lanes;
+#else
         return crc32_sse42_quads;
+#endif
     }
 #endif
 
@@ -632,3 +753,53 @@ crc32c_sb8_64_bit(
         crc = crc_tableil8_o32[(crc ^ *p_buf++) & 0x000000FF] ^ (crc >> 8);
     return crc;
 }
+
+// crc32c_lane_shift[k][b] is the CRC state reached by running a state
+// holding byte b at position k over CRC32C_LANE zero bytes.  Shifting is
+// linear, so any state is shifted by XOR-ing one entry per byte.
+static uint32_t crc32c_lane_shift[4][256];
+
+static void
+crc32c_init_lane_shift()
+{
+    uint32_t basis[32];
+
+    for (unsigned i = 0; i < 32; ++i)
+    {
+        uint32_t v = 1U << i;
+
+        for (unsigned j = 0; j < CRC32C_LANE; ++j)
+        {
+            v = crc_tableil8_o32[v & 0xff] ^ (v >> 8);
+        }
+
+        basis[i] = v;
+    }
+
+    for (unsigned k = 0; k < 4; ++k)
+    {
+        for (unsigned b = 0; b < 256; ++b)
+        {
+            uint32_t v = 0;
+
+            for (unsigned j = 0; j < 8; ++j)
+            {
+                if (b & (1U << j))
+                {
+                    v ^= basis[8 * k + j];
+                }
+            }
+
+            crc32c_lane_shift[k][b] = v;
+        }
+    }
+}
+
+static uint32_t
+crc32c_shift_lane(uint32_t crc)
+{
+    return crc32c_lane_shift[0][crc & 0xff] ^
+           crc32c_lane_shift[1][(crc >> 8) & 0xff] ^
+           crc32c_lane_shift[2][(crc >> 16) & 0xff] ^
+           crc32c_lane_shift[3][crc >> 24];
+}
@@ -36,18 +36,21 @@ using consus::data_center;
 data_center :: data_center()
     : id()
     , name()
+    , read_replica(false)
 {
 }
 
 data_center :: data_center(data_center_id i, const std::string& n)
     : id(i)
     , name(n)
+    , read_replica(false)
 {
 }
 
 data_center :: data_center(const data_center& other)
     : id(other.id)
     , name(other.name)
+    , read_replica(other.read_replica)
 {
 }
 
@@ -58,21 +61,28 @@ data_center :: ~data_center() throw ()
 std::ostream&
 consus :: operator << (std::ostream& lhs, const data_center& rhs)
 {
-    return lhs << "data_center(id=" << rhs.id.get()
-               << ", name=\"" << e::strescape(rhs.name) << "\")";
+    lhs << "data_center(id=" << rhs.id.get()
+        << ", name=\"" << e::strescape(rhs.name) << "\"";
+
+    if (rhs.read_replica)
+    {
+        lhs << ", read_replica";
+    }
+
+    return lhs << ")";
 }
 
 e::packer
 consus :: operator << (e::packer lhs, const data_center& rhs)
 {
-    return lhs << rhs.id << e::slice(rhs.name);
+    return lhs << rhs.id << e::slice(rhs.name) << e::pack_uint8<bool>(rhs.read_replica);
 }
 
 e::unpacker
 consus :: operator >> (e::unpacker lhs, data_center& rhs)
 {
     e::slice name;
-    lhs = lhs >> rhs.id >> name;
+    lhs = lhs >> rhs.id >> name >> e::unpack_uint8<bool>(rhs.read_replica);
     rhs.name = name.str();
     return lhs;
 }
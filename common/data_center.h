@@ -45,6 +45,9 @@ class data_center
     public:
         data_center_id id;
         std::string name;
+        // holds a copy of every table, fed asynchronously, for stale reads;
+        // it forms no transaction manager groups and never votes
+        bool read_replica;
 };
 
 std::ostream&
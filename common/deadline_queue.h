@@ -0,0 +1,142 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_deadline_queue_h_
+#define consus_common_deadline_queue_h_
+
+// The deadline_queue tracks when each state machine next needs to be worked
+// so that the pumping threads only touch the objects that are due, instead of
+// sweeping every live object on every tick.  Each key is armed at most once;
+// re-arming a key with an earlier deadline supersedes the later one.
+
+// STL
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+template <typename K>
+class deadline_queue
+{
+    public:
+        deadline_queue();
+        ~deadline_queue() throw ();
+
+    public:
+        void schedule(const K& key, uint64_t when);
+        // remove every key due at or before now, appending it to keys
+        void due(uint64_t now, std::vector<K>* keys);
+        size_t size();
+
+    private:
+        typedef std::pair<uint64_t, K> entry;
+        // std::*_heap build a max-heap; invert it
+        static bool later(const entry& lhs, const entry& rhs) { return lhs.first > rhs.first; }
+
+    private:
+        po6::threads::mutex m_mtx;
+        std::vector<entry> m_heap;
+        std::map<K, uint64_t> m_armed;
+
+    private:
+        deadline_queue(const deadline_queue&);
+        deadline_queue& operator = (const deadline_queue&);
+};
+
+template <typename K>
+deadline_queue<K> :: deadline_queue()
+    : m_mtx()
+    , m_heap()
+    , m_armed()
+{
+}
+
+template <typename K>
+deadline_queue<K> :: ~deadline_queue() throw ()
+{
+}
+
+template <typename K>
+void
+deadline_queue<K> :: schedule(const K& key, uint64_t when)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    typename std::map<K, uint64_t>::iterator it = m_armed.find(key);
+
+    if (it != m_armed.end() && it->second <= when)
+    {
+        return;
+    }
+
+    m_armed[key] = when;
+    m_heap.push_back(std::make_pair(when, key));
+    std::push_heap(m_heap.begin(), m_heap.end(), &deadline_queue::later);
+}
+
+template <typename K>
+void
+deadline_queue<K> :: due(uint64_t now, std::vector<K>* keys)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    while (!m_heap.empty() && m_heap[0].first <= now)
+    {
+        entry e = m_heap[0];
+        std::pop_heap(m_heap.begin(), m_heap.end(), &deadline_queue::later);
+        m_heap.pop_back();
+        typename std::map<K, uint64_t>::iterator it = m_armed.find(e.second);
+
+        // skip deadlines superseded by an earlier re-arm
+        if (it == m_armed.end() || it->second != e.first)
+        {
+            continue;
+        }
+
+        m_armed.erase(it);
+        keys->push_back(e.second);
+    }
+}
+
+template <typename K>
+size_t
+deadline_queue<K> :: size()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_armed.size();
+}
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_deadline_queue_h_
@@ -57,5 +57,6 @@ CREATE_ID(comm)
 CREATE_ID(paxos_group)
 CREATE_ID(data_center)
 CREATE_ID(partition)
+CREATE_ID(table)
 
 END_CONSUS_NAMESPACE
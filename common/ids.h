@@ -99,6 +99,7 @@ CREATE_ID(comm)
 CREATE_ID(paxos_group)
 CREATE_ID(data_center)
 CREATE_ID(partition)
+CREATE_ID(table)
 
 #undef OPERATOR
 #undef CREATE_ID
@@ -25,6 +25,9 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// e
+#include <e/strescape.h>
+
 // consus
 #include "common/kvs.h"
 
@@ -34,6 +37,9 @@ kvs :: kvs()
     : id()
     , bind_to()
     , dc()
+    , capacity(1)
+    , zone()
+    , rack()
 {
 }
 
@@ -41,6 +47,9 @@ kvs :: kvs(comm_id i, const po6::net::location& b)
     : id(i)
     , bind_to(b)
     , dc()
+    , capacity(1)
+    , zone()
+    , rack()
 {
 }
 
@@ -48,6 +57,9 @@ kvs :: kvs(const kvs& other)
     : id(other.id)
     , bind_to(other.bind_to)
     , dc(other.dc)
+    , capacity(other.capacity)
+    , zone(other.zone)
+    , rack(other.rack)
 {
 }
 
@@ -58,17 +70,25 @@ kvs :: ~kvs() throw ()
 std::ostream&
 consus :: operator << (std::ostream& lhs, const kvs& rhs)
 {
-    return lhs << "kvs(id=" << rhs.id.get() << ", bind_to=" << rhs.bind_to << ", dc=" << rhs.dc.get() << ")";
+    return lhs << "kvs(id=" << rhs.id.get() << ", bind_to=" << rhs.bind_to << ", dc=" << rhs.dc.get() << ", capacity=" << rhs.capacity
+               << ", zone=\"" << e::strescape(rhs.zone) << "\""
+               << ", rack=\"" << e::strescape(rhs.rack) << "\")";
 }
 
 e::packer
 consus :: operator << (e::packer lhs, const kvs& rhs)
 {
-    return lhs << rhs.id << rhs.bind_to << rhs.dc;
+    return lhs << rhs.id << rhs.bind_to << rhs.dc << rhs.capacity
+               << e::slice(rhs.zone) << e::slice(rhs.rack);
 }
 
 e::unpacker
 consus :: operator >> (e::unpacker lhs, kvs& rhs)
 {
-    return lhs >> rhs.id >> rhs.bind_to >> rhs.dc;
+    e::slice zone;
+    e::slice rack;
+    lhs = lhs >> rhs.id >> rhs.bind_to >> rhs.dc >> rhs.capacity >> zone >> rack;
+    rhs.zone = zone.str();
+    rhs.rack = rack.str();
+    return lhs;
 }
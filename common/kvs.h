@@ -28,6 +28,9 @@
 #ifndef consus_common_kvs_h_
 #define consus_common_kvs_h_
 
+// STL
+#include <string>
+
 // po6
 #include <po6/net/location.h>
 
@@ -49,6 +52,11 @@ class kvs
         comm_id id;
         po6::net::location bind_to;
         data_center_id dc;
+        // relative share of its data center's partitions this server owns
+        uint64_t capacity;
+        // topology labels within the data center; empty when unknown
+        std::string zone;
+        std::string rack;
 };
 
 std::ostream&
@@ -37,9 +37,27 @@ consus :: kvs_configuration(e::unpacker up,
                             version_id* vid,
                             uint64_t* flags,
                             std::vector<kvs_state>* kvss,
-                            std::vector<ring>* rings)
+                            std::vector<ring>* rings,
+                            std::vector<table_config>* tables)
 {
-    return up >> *cid >> *vid >> *flags >> *kvss >> *rings;
+    return up >> *cid >> *vid >> *flags >> *kvss >> *rings >> *tables;
+}
+
+e::unpacker
+consus :: kvs_configuration_delta(e::unpacker up,
+                                  cluster_id* cid,
+                                  version_id* base,
+                                  version_id* vid,
+                                  uint64_t* flags,
+                                  bool* full,
+                                  std::vector<kvs_state>* kvss,
+                                  std::vector<table_config>* tables,
+                                  uint64_t* rings_sz,
+                                  std::vector<uint32_t>* rings,
+                                  std::vector<partition>* partitions)
+{
+    return up >> *cid >> *base >> *vid >> *flags >> e::unpack_uint8<bool>(*full)
+              >> *kvss >> *tables >> *rings_sz >> *rings >> *partitions;
 }
 
 std::string
@@ -47,7 +65,8 @@ consus :: kvs_configuration(const cluster_id& cid,
                               const version_id& vid,
                               uint64_t,
                               const std::vector<kvs_state>& kvss,
-                              const std::vector<ring>& rings)
+                              const std::vector<ring>& rings,
+                              const std::vector<table_config>& tables)
 {
     std::ostringstream ostr;
     ostr << cid << "\n"
@@ -71,11 +90,17 @@ consus :: kvs_configuration(const cluster_id& cid,
         ostr << kvss[i] << "\n";
     }
 
+    for (size_t i = 0; i < tables.size(); ++i)
+    {
+        ostr << tables[i] << "\n";
+    }
+
     for (size_t i = 0; i < rings.size(); ++i)
     {
-        ostr << "ring for " << rings[i].dc << "\n";
-        const partition* ptr = rings[i].partitions;
-        const partition* const end = ptr + CONSUS_KVS_PARTITIONS;
+        ostr << "ring for " << rings[i].dc << " in "
+             << rings[i].partitions.size() << " partitions\n";
+        const partition* ptr = &rings[i].partitions[0];
+        const partition* const end = ptr + rings[i].partitions.size();
 
         while (ptr < end)
         {
@@ -88,7 +113,7 @@ consus :: kvs_configuration(const cluster_id& cid,
                 ++eor;
             }
 
-            unsigned ub = eor < end ? eor->index : CONSUS_KVS_PARTITIONS;
+            unsigned ub = eor < end ? eor->index : rings[i].partitions.size();
 
             if (ptr + 1 == eor && ptr->next_owner == comm_id())
             {
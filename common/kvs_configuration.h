@@ -33,6 +33,7 @@
 #include "common/ids.h"
 #include "common/kvs_state.h"
 #include "common/ring.h"
+#include "common/table_config.h"
 
 BEGIN_CONSUS_NAMESPACE
 
@@ -41,12 +42,28 @@ e::unpacker kvs_configuration(e::unpacker up,
                               version_id* vid,
                               uint64_t* flags,
                               std::vector<kvs_state>* kvss,
-                              std::vector<ring>* rings);
+                              std::vector<ring>* rings,
+                              std::vector<table_config>* tables);
+// the change from version base to vid published alongside each full
+// configuration; full says the receiver must fetch the whole configuration
+// because the rings themselves were added or changed wholesale
+e::unpacker kvs_configuration_delta(e::unpacker up,
+                                    cluster_id* cid,
+                                    version_id* base,
+                                    version_id* vid,
+                                    uint64_t* flags,
+                                    bool* full,
+                                    std::vector<kvs_state>* kvss,
+                                    std::vector<table_config>* tables,
+                                    uint64_t* rings_sz,
+                                    std::vector<uint32_t>* rings,
+                                    std::vector<partition>* partitions);
 std::string kvs_configuration(const cluster_id& cid,
                               const version_id& vid,
                               uint64_t flags,
                               const std::vector<kvs_state>& kvss,
-                              const std::vector<ring>& rings);
+                              const std::vector<ring>& rings,
+                              const std::vector<table_config>& tables);
 
 END_CONSUS_NAMESPACE
 
@@ -0,0 +1,86 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// consus
+#include "common/kvs_load.h"
+
+using consus::partition_load;
+using consus::kvs_load;
+
+partition_load :: partition_load()
+    : index(0)
+    , requests(0)
+    , bytes(0)
+{
+}
+
+partition_load :: partition_load(uint16_t i, uint64_t r, uint64_t b)
+    : index(i)
+    , requests(r)
+    , bytes(b)
+{
+}
+
+partition_load :: ~partition_load() throw ()
+{
+}
+
+kvs_load :: kvs_load()
+    : id()
+    , requests(0)
+    , bytes(0)
+    , hottest()
+{
+}
+
+kvs_load :: ~kvs_load() throw ()
+{
+}
+
+e::packer
+consus :: operator << (e::packer lhs, const partition_load& rhs)
+{
+    return lhs << rhs.index << rhs.requests << rhs.bytes;
+}
+
+e::unpacker
+consus :: operator >> (e::unpacker lhs, partition_load& rhs)
+{
+    return lhs >> rhs.index >> rhs.requests >> rhs.bytes;
+}
+
+e::packer
+consus :: operator << (e::packer lhs, const kvs_load& rhs)
+{
+    return lhs << rhs.id << rhs.requests << rhs.bytes << rhs.hottest;
+}
+
+e::unpacker
+consus :: operator >> (e::unpacker lhs, kvs_load& rhs)
+{
+    return lhs >> rhs.id >> rhs.requests >> rhs.bytes >> rhs.hottest;
+}
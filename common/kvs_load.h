@@ -0,0 +1,77 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_kvs_load_h_
+#define consus_common_kvs_load_h_
+
+// STL
+#include <vector>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// traffic a key value store served for one hash slot
+struct partition_load
+{
+    partition_load();
+    partition_load(uint16_t index, uint64_t requests, uint64_t bytes);
+    ~partition_load() throw ();
+
+    uint16_t index;
+    uint64_t requests;
+    uint64_t bytes;
+};
+
+// traffic a key value store served during one reporting interval, with its
+// hottest ring indices, hottest first
+struct kvs_load
+{
+    kvs_load();
+    ~kvs_load() throw ();
+
+    comm_id id;
+    uint64_t requests;
+    uint64_t bytes;
+    std::vector<partition_load> hottest;
+};
+
+e::packer
+operator << (e::packer lhs, const partition_load& rhs);
+e::unpacker
+operator >> (e::unpacker lhs, partition_load& rhs);
+
+e::packer
+operator << (e::packer lhs, const kvs_load& rhs);
+e::unpacker
+operator >> (e::unpacker lhs, kvs_load& rhs);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_kvs_load_h_
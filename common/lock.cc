@@ -36,6 +36,7 @@ consus :: operator << (std::ostream& lhs, lock_op rhs)
     {
         STRINGIFY(LOCK_LOCK);
         STRINGIFY(LOCK_UNLOCK);
+        STRINGIFY(LOCK_LOCK_SHARED);
         default:
             lhs << "unknown lock_op";
     }
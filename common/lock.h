@@ -45,7 +45,8 @@ BEGIN_CONSUS_NAMESPACE
 enum lock_op
 {
     LOCK_LOCK   = 1,
-    LOCK_UNLOCK = 2
+    LOCK_UNLOCK = 2,
+    LOCK_LOCK_SHARED = 3
 };
 
 std::ostream&
@@ -0,0 +1,302 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// STL
+#include <sstream>
+
+// Google Log
+#include <glog/logging.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "common/metrics.h"
+
+// message types are tracked in [HANDLER_BASE, HANDLER_BASE + HANDLER_SLOTS)
+#define HANDLER_BASE 7400
+#define HANDLER_SLOTS 448
+// how often the server checks for shutdown, in milliseconds
+#define METRICS_POLL_MS 100
+
+using po6::threads::make_obj_func;
+using consus::histogram;
+using consus::metrics;
+
+std::string
+consus :: metrics_label_escape(const std::string& s)
+{
+    std::string out;
+
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = s[i];
+
+        if (c == '\\' || c == '"')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c == '\n')
+        {
+            out += "\\n";
+        }
+        else if (c < 0x20 || c >= 0x7f)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\\\x%02x", c);
+            out += buf;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+
+    return out;
+}
+
+histogram :: histogram()
+    : m_count(0)
+    , m_sum(0)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        m_buckets[i] = 0;
+    }
+}
+
+histogram :: ~histogram() throw ()
+{
+}
+
+void
+histogram :: record(uint64_t nanos)
+{
+    size_t idx = 0;
+
+    while (idx + 1 < HISTOGRAM_BUCKETS && (nanos >> (idx + 1)) > 0)
+    {
+        ++idx;
+    }
+
+    e::atomic::increment_64_nobarrier(&m_buckets[idx], 1);
+    e::atomic::increment_64_nobarrier(&m_sum, nanos);
+    e::atomic::increment_64_nobarrier(&m_count, 1);
+}
+
+uint64_t
+histogram :: count()
+{
+    return e::atomic::increment_64_nobarrier(&m_count, 0);
+}
+
+void
+histogram :: render(std::ostream& out, const std::string& name,
+                    const std::string& labels, double scale)
+{
+    const std::string sep(labels.empty() ? "" : ",");
+    uint64_t cumulative = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        cumulative += e::atomic::increment_64_nobarrier(&m_buckets[i], 0);
+        double le = static_cast<double>(2ULL << i) / scale;
+        out << name << "_bucket{" << labels << sep << "le=\"" << le << "\"} "
+            << cumulative << "\n";
+    }
+
+    out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << cumulative << "\n";
+    out << name << "_sum{" << labels << "} "
+        << static_cast<double>(e::atomic::increment_64_nobarrier(&m_sum, 0)) / scale << "\n";
+    out << name << "_count{" << labels << "} " << cumulative << "\n";
+}
+
+metrics :: metrics(e::garbage_collector* gc)
+    : m_gc(gc)
+    , m_handlers(new histogram[HANDLER_SLOTS])
+    , m_listen()
+    , m_report(NULL)
+    , m_report_ptr(NULL)
+    , m_thread(make_obj_func(&metrics::serve, this))
+    , m_started(false)
+    , m_shutdown(0)
+{
+}
+
+metrics :: ~metrics() throw ()
+{
+    shutdown();
+    delete[] m_handlers;
+}
+
+void
+metrics :: handled(network_msgtype mt, uint64_t nanos)
+{
+    unsigned idx = static_cast<unsigned>(mt) - HANDLER_BASE;
+
+    if (idx < HANDLER_SLOTS)
+    {
+        m_handlers[idx].record(nanos);
+    }
+}
+
+bool
+metrics :: listen(const po6::net::location& bind_to,
+                  void (*report)(void*, std::ostream*), void* p)
+{
+    sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    bind_to.pack(reinterpret_cast<sockaddr*>(&addr), &addrlen);
+    m_listen = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    int yes = 1;
+
+    if (m_listen.get() < 0 ||
+        setsockopt(m_listen.get(), SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0 ||
+        bind(m_listen.get(), reinterpret_cast<sockaddr*>(&addr), addrlen) < 0 ||
+        ::listen(m_listen.get(), SOMAXCONN) < 0)
+    {
+        PLOG(ERROR) << "could not serve metrics on " << bind_to;
+        return false;
+    }
+
+    m_report = report;
+    m_report_ptr = p;
+    m_thread.start();
+    m_started = true;
+    LOG(INFO) << "serving metrics on " << bind_to;
+    return true;
+}
+
+void
+metrics :: shutdown()
+{
+    if (m_started)
+    {
+        e::atomic::increment_32_nobarrier(&m_shutdown, 1);
+        m_thread.join();
+        m_started = false;
+    }
+}
+
+void
+metrics :: serve()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_SETMASK, &ss, NULL) < 0)
+    {
+        PLOG(ERROR) << "could not block signals";
+        return;
+    }
+
+    e::garbage_collector::thread_state ts;
+    m_gc->register_thread(&ts);
+
+    while (e::atomic::increment_32_nobarrier(&m_shutdown, 0) == 0)
+    {
+        m_gc->quiescent_state(&ts);
+        pollfd pfd;
+        pfd.fd = m_listen.get();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        m_gc->offline(&ts);
+        int ret = poll(&pfd, 1, METRICS_POLL_MS);
+        m_gc->online(&ts);
+
+        if (ret <= 0)
+        {
+            continue;
+        }
+
+        po6::io::fd conn(accept(m_listen.get(), NULL, NULL));
+
+        if (conn.get() < 0)
+        {
+            continue;
+        }
+
+        // the request itself does not matter; every path gets the same page
+        char req[1024];
+        pfd.fd = conn.get();
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, METRICS_POLL_MS) > 0)
+        {
+            ssize_t amt = read(conn.get(), req, sizeof(req));
+            (void) amt;
+        }
+
+        std::ostringstream body;
+        render(body);
+        std::ostringstream resp;
+        resp << "HTTP/1.0 200 OK\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body.str().size() << "\r\n"
+             << "\r\n" << body.str();
+        const std::string out(resp.str());
+        conn.xwrite(out.data(), out.size());
+    }
+
+    m_gc->deregister_thread(&ts);
+}
+
+void
+metrics :: render(std::ostream& out)
+{
+    out << "# TYPE consus_handler_seconds histogram\n";
+
+    for (unsigned i = 0; i < HANDLER_SLOTS; ++i)
+    {
+        if (m_handlers[i].count() == 0)
+        {
+            continue;
+        }
+
+        std::ostringstream labels;
+        labels << "type=\"" << static_cast<network_msgtype>(HANDLER_BASE + i) << "\"";
+        m_handlers[i].render(out, "consus_handler_seconds", labels.str());
+    }
+
+    if (m_report)
+    {
+        m_report(m_report_ptr, &out);
+    }
+}
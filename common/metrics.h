@@ -0,0 +1,141 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_metrics_h_
+#define consus_common_metrics_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+#include <string>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/net/location.h>
+#include <po6/threads/thread.h>
+
+// e
+#include <e/garbage_collector.h>
+
+// consus
+#include "namespace.h"
+#include "common/network_msgtype.h"
+
+// histograms cover [2^i, 2^(i+1)) nanoseconds (or other units) for i < HISTOGRAM_BUCKETS
+#define HISTOGRAM_BUCKETS 40
+
+BEGIN_CONSUS_NAMESPACE
+
+// A latency histogram with power-of-two buckets.  Recording is a pair of
+// relaxed atomic increments, so every thread may record into the same one.
+class histogram
+{
+    public:
+        histogram();
+        ~histogram() throw ();
+
+    public:
+        void record(uint64_t nanos);
+        uint64_t count();
+        // append name as a Prometheus histogram in seconds, or in recorded
+        // units over scale when what was recorded is not nanoseconds
+        void render(std::ostream& out, const std::string& name,
+                    const std::string& labels, double scale = 1e9);
+
+    private:
+        uint64_t m_buckets[HISTOGRAM_BUCKETS];
+        uint64_t m_count;
+        uint64_t m_sum;
+
+    private:
+        histogram(const histogram&);
+        histogram& operator = (const histogram&);
+};
+
+// Per-message-type handler time, served over plain HTTP in the Prometheus
+// text format from a socket of its own so that it keeps answering when the
+// coordinator does not.  The daemon appends its own gauges to every scrape
+// through the report callback, which runs on a thread registered with the
+// garbage collector.
+class metrics
+{
+    public:
+        metrics(e::garbage_collector* gc);
+        ~metrics() throw ();
+
+    public:
+        void handled(network_msgtype mt, uint64_t nanos);
+        bool listen(const po6::net::location& bind_to,
+                    void (*report)(void*, std::ostream*), void* p);
+        void shutdown();
+
+    private:
+        void serve();
+        void render(std::ostream& out);
+
+    private:
+        e::garbage_collector* m_gc;
+        histogram* m_handlers;
+        po6::io::fd m_listen;
+        void (*m_report)(void*, std::ostream*);
+        void* m_report_ptr;
+        po6::threads::thread m_thread;
+        bool m_started;
+        uint32_t m_shutdown;
+
+    private:
+        metrics(const metrics&);
+        metrics& operator = (const metrics&);
+};
+
+// s as a Prometheus label value; keys are arbitrary bytes, and label values
+// allow only \\, \" and \n as escapes, so anything else unprintable becomes a
+// literal \xNN
+std::string
+metrics_label_escape(const std::string& s);
+
+// the number of entries in an e::state_hash_table; as with any iteration of
+// one, the calling thread must be registered with the garbage collector
+template <typename T>
+size_t
+live_states(T* table)
+{
+    size_t count = 0;
+
+    for (typename T::iterator it(table); it.valid(); ++it)
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_metrics_h_
@@ -49,14 +49,33 @@ consus :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(TXMAN_WOUND);
         STRINGIFY(TXMAN_HOLD_LOCK);
         STRINGIFY(TXMAN_FINISHED);
+        STRINGIFY(TXMAN_MULTI);
+        STRINGIFY(TXMAN_SCAN);
+        STRINGIFY(TXMAN_READ_STALE);
+        STRINGIFY(TXMAN_COND_WRITE);
+        STRINGIFY(TXMAN_SINGLE);
         STRINGIFY(TXMAN_PAXOS_2A);
         STRINGIFY(TXMAN_PAXOS_2B);
+        STRINGIFY(TXMAN_PAXOS_2A_BATCH);
+        STRINGIFY(TXMAN_PAXOS_2B_BATCH);
+        STRINGIFY(TXMAN_LEASE_REQUEST);
+        STRINGIFY(TXMAN_LEASE_GRANT);
+        STRINGIFY(TXMAN_GROUP_LOAD);
+        STRINGIFY(TXMAN_LOG_SHIP);
+        STRINGIFY(TXMAN_LOG_SHIP_ACK);
+        STRINGIFY(TXMAN_WITNESS);
+        STRINGIFY(TXMAN_WITNESS_FORGET);
         STRINGIFY(LV_VOTE_1A);
         STRINGIFY(LV_VOTE_1B);
         STRINGIFY(LV_VOTE_2A);
         STRINGIFY(LV_VOTE_2B);
         STRINGIFY(LV_VOTE_LEARN);
+        STRINGIFY(LV_VOTE_2A_BATCH);
+        STRINGIFY(LV_VOTE_2B_BATCH);
         STRINGIFY(COMMIT_RECORD);
+        STRINGIFY(COMMIT_VALUES);
+        STRINGIFY(COMMIT_VALUES_ACK);
+        STRINGIFY(COMMIT_RECORD_CHUNK);
         STRINGIFY(GV_OUTCOME);
         STRINGIFY(GV_PROPOSE);
         STRINGIFY(GV_VOTE_1A);
@@ -67,6 +86,9 @@ consus :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(KVS_REP_RD_RESP);
         STRINGIFY(KVS_REP_WR);
         STRINGIFY(KVS_REP_WR_RESP);
+        STRINGIFY(KVS_REP_SCAN);
+        STRINGIFY(KVS_REP_SCAN_RESP);
+        STRINGIFY(KVS_REP_RD_STALE);
         STRINGIFY(KVS_RAW_RD);
         STRINGIFY(KVS_RAW_RD_RESP);
         STRINGIFY(KVS_RAW_WR);
@@ -76,9 +98,25 @@ consus :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(KVS_RAW_LK);
         STRINGIFY(KVS_RAW_LK_RESP);
         STRINGIFY(KVS_WOUND_XACT);
+        STRINGIFY(KVS_RAW_SCAN);
+        STRINGIFY(KVS_RAW_SCAN_RESP);
+        STRINGIFY(KVS_LOCK_OP_BATCH);
+        STRINGIFY(KVS_LOCK_OP_BATCH_RESP);
+        STRINGIFY(KVS_AE_DIGEST);
+        STRINGIFY(KVS_AE_DIGEST_RESP);
         STRINGIFY(KVS_MIGRATE_SYN);
         STRINGIFY(KVS_MIGRATE_ACK);
+        STRINGIFY(KVS_MIGRATE_PULL);
+        STRINGIFY(KVS_MIGRATE_DATA);
+        STRINGIFY(CONSUS_COMPRESSED);
+        STRINGIFY(CONSUS_BATCH);
         STRINGIFY(CONSUS_NOP);
+        STRINGIFY(CONSUS_COMPACT);
+        STRINGIFY(PROXY_HELLO);
+        STRINGIFY(PROXY_CONFIG);
+        STRINGIFY(PROXY_FORWARD);
+        STRINGIFY(PROXY_DELIVER);
+        STRINGIFY(PROXY_DISRUPTED);
         default:
             lhs << "unknown msgtype";
     }
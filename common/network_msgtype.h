@@ -52,17 +52,37 @@ enum network_msgtype
     TXMAN_WOUND     = 7429,
     TXMAN_HOLD_LOCK = 7430,
     TXMAN_FINISHED  = 7431,
+    TXMAN_MULTI     = 7432,
+    TXMAN_SCAN      = 7434,
+    TXMAN_READ_STALE = 7435,
+    TXMAN_COND_WRITE = 7438,
+    TXMAN_SINGLE    = 7447,
 
     TXMAN_PAXOS_2A  = 7439,
     TXMAN_PAXOS_2B  = 7433,
+    TXMAN_PAXOS_2A_BATCH = 7436,
+    TXMAN_PAXOS_2B_BATCH = 7437,
+
+    TXMAN_LEASE_REQUEST = 7440,
+    TXMAN_LEASE_GRANT   = 7441,
+    TXMAN_GROUP_LOAD    = 7442,
+    TXMAN_LOG_SHIP      = 7443,
+    TXMAN_LOG_SHIP_ACK  = 7444,
+    TXMAN_WITNESS       = 7445,
+    TXMAN_WITNESS_FORGET = 7446,
 
     LV_VOTE_1A      = 7500,
     LV_VOTE_1B      = 7501,
     LV_VOTE_2A      = 7502,
     LV_VOTE_2B      = 7503,
     LV_VOTE_LEARN   = 7504,
+    LV_VOTE_2A_BATCH = 7508,
+    LV_VOTE_2B_BATCH = 7509,
 
     COMMIT_RECORD   = 7505,
+    COMMIT_VALUES   = 7506,
+    COMMIT_VALUES_ACK = 7507,
+    COMMIT_RECORD_CHUNK = 7510,
 
     GV_OUTCOME      = 7611,
     GV_PROPOSE      = 7606,
@@ -75,6 +95,9 @@ enum network_msgtype
     KVS_REP_RD_RESP = 7741,
     KVS_REP_WR      = 7742,
     KVS_REP_WR_RESP = 7743,
+    KVS_REP_SCAN      = 7744,
+    KVS_REP_SCAN_RESP = 7745,
+    KVS_REP_RD_STALE  = 7746,
 
     KVS_RAW_RD      = 7750,
     KVS_RAW_RD_RESP = 7751,
@@ -89,10 +112,30 @@ enum network_msgtype
 
     KVS_WOUND_XACT  = 7758,
 
+    KVS_RAW_SCAN      = 7759,
+    KVS_RAW_SCAN_RESP = 7760,
+
+    KVS_LOCK_OP_BATCH      = 7761,
+    KVS_LOCK_OP_BATCH_RESP = 7762,
+
+    KVS_AE_DIGEST      = 7763,
+    KVS_AE_DIGEST_RESP = 7764,
+
     KVS_MIGRATE_SYN = 7800,
     KVS_MIGRATE_ACK = 7801,
-
-    CONSUS_NOP      = 7835
+    KVS_MIGRATE_PULL = 7802,
+    KVS_MIGRATE_DATA = 7803,
+
+    CONSUS_COMPRESSED = 7833,
+    CONSUS_BATCH    = 7834,
+    CONSUS_NOP      = 7835,
+    CONSUS_COMPACT  = 7836,
+
+    PROXY_HELLO     = 7900,
+    PROXY_CONFIG    = 7901,
+    PROXY_FORWARD   = 7902,
+    PROXY_DELIVER   = 7903,
+    PROXY_DISRUPTED = 7904
 };
 
 std::ostream&
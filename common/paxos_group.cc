@@ -25,6 +25,9 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// STL
+#include <algorithm>
+
 // consus
 #include "common/macros.h"
 #include "common/paxos_group.h"
@@ -35,10 +38,15 @@ paxos_group :: paxos_group()
     : id()
     , dc()
     , members_sz(0)
+    , phase2_sz(0)
+    , joint(false)
+    , joint_phase2_sz(0)
+    , witnesses_sz(0)
 {
     for (unsigned i = 0; i < CONSUS_MAX_REPLICATION_FACTOR; ++i)
     {
         members[i] = comm_id();
+        witnesses[i] = comm_id();
     }
 }
 
@@ -46,6 +54,10 @@ paxos_group :: paxos_group(const paxos_group& other)
     : id(other.id)
     , dc(other.dc)
     , members_sz(other.members_sz)
+    , phase2_sz(other.phase2_sz)
+    , joint(other.joint)
+    , joint_phase2_sz(other.joint_phase2_sz)
+    , witnesses_sz(other.witnesses_sz)
 {
     for (unsigned i = 0; i < members_sz; ++i)
     {
@@ -56,6 +68,16 @@ paxos_group :: paxos_group(const paxos_group& other)
     {
         members[i] = comm_id();
     }
+
+    for (unsigned i = 0; i < witnesses_sz; ++i)
+    {
+        witnesses[i] = other.witnesses[i];
+    }
+
+    for (unsigned i = witnesses_sz; i < CONSUS_MAX_REPLICATION_FACTOR; ++i)
+    {
+        witnesses[i] = comm_id();
+    }
 }
 
 paxos_group :: ~paxos_group() throw ()
@@ -68,6 +90,33 @@ paxos_group :: quorum() const
     return members_sz / 2 + 1;
 }
 
+unsigned
+paxos_group :: phase1_quorum() const
+{
+    unsigned smallest = phase2_quorum(phase2_sz);
+
+    if (joint)
+    {
+        smallest = std::min(smallest, phase2_quorum(joint_phase2_sz));
+    }
+
+    const unsigned intersecting = members_sz - smallest + 1;
+    return std::max(quorum(), intersecting);
+}
+
+unsigned
+paxos_group :: phase2_quorum() const
+{
+    unsigned largest = phase2_quorum(phase2_sz);
+
+    if (joint)
+    {
+        largest = std::max(largest, phase2_quorum(joint_phase2_sz));
+    }
+
+    return largest;
+}
+
 unsigned
 paxos_group :: index(comm_id c) const
 {
@@ -84,6 +133,33 @@ paxos_group :: index(comm_id c) const
     return i;
 }
 
+unsigned
+paxos_group :: witness_index(comm_id c) const
+{
+    unsigned i = 0;
+
+    for (; i < witnesses_sz; ++i)
+    {
+        if (witnesses[i] == c)
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+unsigned
+paxos_group :: phase2_quorum(unsigned sz) const
+{
+    if (sz == 0 || sz > members_sz)
+    {
+        return quorum();
+    }
+
+    return sz;
+}
+
 paxos_group&
 paxos_group :: operator = (const paxos_group& rhs)
 {
@@ -92,6 +168,10 @@ paxos_group :: operator = (const paxos_group& rhs)
         id = rhs.id;
         dc = rhs.dc;
         members_sz = rhs.members_sz;
+        phase2_sz = rhs.phase2_sz;
+        joint = rhs.joint;
+        joint_phase2_sz = rhs.joint_phase2_sz;
+        witnesses_sz = rhs.witnesses_sz;
 
         for (unsigned i = 0; i < members_sz; ++i)
         {
@@ -102,6 +182,16 @@ paxos_group :: operator = (const paxos_group& rhs)
         {
             members[i] = comm_id();
         }
+
+        for (unsigned i = 0; i < witnesses_sz; ++i)
+        {
+            witnesses[i] = rhs.witnesses[i];
+        }
+
+        for (unsigned i = witnesses_sz; i < CONSUS_MAX_REPLICATION_FACTOR; ++i)
+        {
+            witnesses[i] = comm_id();
+        }
     }
 
     return *this;
@@ -122,7 +212,37 @@ consus :: operator << (std::ostream& lhs, const paxos_group& rhs)
         lhs << rhs.members[i].get();
     }
 
-    lhs << "])";
+    lhs << "]";
+
+    if (rhs.phase2_sz > 0 || rhs.joint)
+    {
+        lhs << ", phase1=" << rhs.phase1_quorum()
+            << ", phase2=" << rhs.phase2_quorum();
+    }
+
+    if (rhs.joint)
+    {
+        lhs << ", switching";
+    }
+
+    if (rhs.witnesses_sz > 0)
+    {
+        lhs << ", witnesses=[";
+
+        for (unsigned i = 0; i < rhs.witnesses_sz; ++i)
+        {
+            if (i > 0)
+            {
+                lhs << ", ";
+            }
+
+            lhs << rhs.witnesses[i].get();
+        }
+
+        lhs << "]";
+    }
+
+    lhs << ")";
     return lhs;
 }
 
@@ -136,7 +256,14 @@ consus :: operator << (e::packer pa, const paxos_group& rhs)
         pa = pa << rhs.members[i];
     }
 
-    return pa;
+    pa = pa << e::pack_varint(rhs.phase2_sz) << e::pack_varint(rhs.witnesses_sz);
+
+    for (unsigned i = 0; i < rhs.witnesses_sz; ++i)
+    {
+        pa = pa << rhs.witnesses[i];
+    }
+
+    return pa << e::pack_uint8<bool>(rhs.joint) << e::pack_varint(rhs.joint_phase2_sz);
 }
 
 e::unpacker
@@ -162,5 +289,48 @@ consus :: operator >> (e::unpacker up, paxos_group& rhs)
         rhs.members[i] = comm_id();
     }
 
+    // groups encoded before flexible quorums end here, and take majorities
+    rhs.phase2_sz = 0;
+    rhs.joint = false;
+    rhs.joint_phase2_sz = 0;
+    rhs.witnesses_sz = 0;
+
+    for (unsigned i = 0; i < CONSUS_MAX_REPLICATION_FACTOR; ++i)
+    {
+        rhs.witnesses[i] = comm_id();
+    }
+
+    if (!up.error() && up.remain())
+    {
+        sz = 0;
+        up = up >> e::unpack_varint(sz);
+        rhs.phase2_sz = sz;
+    }
+
+    if (!up.error() && up.remain())
+    {
+        sz = 0;
+        up = up >> e::unpack_varint(sz);
+
+        if (sz > CONSUS_MAX_REPLICATION_FACTOR)
+        {
+            return e::unpacker::error_out();
+        }
+
+        rhs.witnesses_sz = sz;
+
+        for (unsigned i = 0; i < rhs.witnesses_sz; ++i)
+        {
+            up = up >> rhs.witnesses[i];
+        }
+    }
+
+    if (!up.error() && up.remain())
+    {
+        sz = 0;
+        up = up >> e::unpack_uint8<bool>(rhs.joint) >> e::unpack_varint(sz);
+        rhs.joint_phase2_sz = sz;
+    }
+
     return up;
 }
@@ -43,8 +43,18 @@ class paxos_group
         ~paxos_group() throw ();
 
     public:
+        // a simple majority, for decisions that every pair of quorums must
+        // agree upon
         unsigned quorum() const;
+        // flexible Paxos:  phase 2 runs on every operation and may use small
+        // quorums, so long as every phase 1 quorum intersects them
+        unsigned phase1_quorum() const;
+        unsigned phase2_quorum() const;
         unsigned index(comm_id id) const;
+        unsigned witness_index(comm_id id) const;
+
+    private:
+        unsigned phase2_quorum(unsigned sz) const;
 
     public:
         paxos_group& operator = (const paxos_group& rhs);
@@ -54,6 +64,17 @@ class paxos_group
         data_center_id dc;
         unsigned members_sz;
         comm_id members[CONSUS_MAX_REPLICATION_FACTOR];
+        // size of phase 2 quorums; 0 for a majority
+        unsigned phase2_sz;
+        // while the coordinator switches phase 2 sizes, the size being left;
+        // quorums then intersect those of both sizes, so members that have
+        // yet to see the switch still agree with those that have
+        bool joint;
+        unsigned joint_phase2_sz;
+        // witnesses keep a durable copy of the group's phase 2 messages and
+        // commit records, but are never counted toward any quorum
+        unsigned witnesses_sz;
+        comm_id witnesses[CONSUS_MAX_REPLICATION_FACTOR];
 };
 
 std::ostream&
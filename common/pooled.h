@@ -0,0 +1,111 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_pooled_h_
+#define consus_common_pooled_h_
+
+// Deriving from pooled<T> gives T its own operator new/delete backed by a
+// per-thread free list, so the short-lived objects created for every key
+// operation are recycled without touching the shared heap.  Objects may be
+// freed by a different thread than the one that allocated them; the memory
+// simply joins that thread's list.  Each thread keeps at most POOLED_MAX_FREE
+// objects of each type and returns the rest to malloc, accounted under TAG.
+
+// STL
+#include <new>
+
+// consus
+#include "namespace.h"
+#include "common/alloc_stats.h"
+
+#define POOLED_MAX_FREE 1024
+
+BEGIN_CONSUS_NAMESPACE
+
+template <typename T, alloc_tag TAG = ALLOC_OTHER>
+class pooled
+{
+    public:
+        static void* operator new(size_t sz);
+        static void operator delete(void* p, size_t sz);
+
+    private:
+        struct node
+        {
+            node* next;
+        };
+
+    private:
+        static __thread node* s_free;
+        static __thread unsigned s_free_sz;
+};
+
+template <typename T, alloc_tag TAG>
+__thread typename pooled<T, TAG>::node* pooled<T, TAG>::s_free = NULL;
+template <typename T, alloc_tag TAG>
+__thread unsigned pooled<T, TAG>::s_free_sz = 0;
+
+template <typename T, alloc_tag TAG>
+void*
+pooled<T, TAG> :: operator new(size_t sz)
+{
+    // subclasses of T are a different size and bypass the pool
+    if (sz == sizeof(T) && s_free)
+    {
+        node* n = s_free;
+        s_free = n->next;
+        --s_free_sz;
+        return n;
+    }
+
+    return alloc_stats::allocate(TAG, sz < sizeof(node) ? sizeof(node) : sz);
+}
+
+template <typename T, alloc_tag TAG>
+void
+pooled<T, TAG> :: operator delete(void* p, size_t sz)
+{
+    if (!p)
+    {
+        return;
+    }
+
+    if (sz != sizeof(T) || s_free_sz >= POOLED_MAX_FREE)
+    {
+        alloc_stats::deallocate(TAG, p, sz < sizeof(node) ? sizeof(node) : sz);
+        return;
+    }
+
+    node* n = static_cast<node*>(p);
+    n->next = s_free;
+    s_free = n;
+    ++s_free_sz;
+}
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_pooled_h_
@@ -0,0 +1,65 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_probes_h_
+#define consus_common_probes_h_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// Static tracepoints for bpftrace, SystemTap, and perf.
+//
+// Configured with --enable-usdt, each probe is a nop instruction and a note
+// in the binary that a tracer patches while attached; arguments are only
+// evaluated while one is.  Otherwise the probes compile away entirely.  All
+// probes belong to the "consus" provider, e.g.
+//
+//     bpftrace -e 'usdt:./consus-transaction-manager:consus:log_append { @[arg1] = count(); }'
+//
+// Arguments must be integers or pointers.  Transactions are identified by
+// their id's (group, start, number), and paxos groups and communication ids
+// by their integer value.
+
+#ifdef CONSUS_USDT
+#include <sys/sdt.h>
+#define CONSUS_PROBE1(name, a) DTRACE_PROBE1(consus, name, a)
+#define CONSUS_PROBE2(name, a, b) DTRACE_PROBE2(consus, name, a, b)
+#define CONSUS_PROBE3(name, a, b, c) DTRACE_PROBE3(consus, name, a, b, c)
+#define CONSUS_PROBE4(name, a, b, c, d) DTRACE_PROBE4(consus, name, a, b, c, d)
+#define CONSUS_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(consus, name, a, b, c, d, e)
+#define CONSUS_PROBE6(name, a, b, c, d, e, f) DTRACE_PROBE6(consus, name, a, b, c, d, e, f)
+#else
+#define CONSUS_PROBE1(name, a) do { } while (false)
+#define CONSUS_PROBE2(name, a, b) do { } while (false)
+#define CONSUS_PROBE3(name, a, b, c) do { } while (false)
+#define CONSUS_PROBE4(name, a, b, c, d) do { } while (false)
+#define CONSUS_PROBE5(name, a, b, c, d, e) do { } while (false)
+#define CONSUS_PROBE6(name, a, b, c, d, e, f) do { } while (false)
+#endif
+
+#endif // consus_common_probes_h_
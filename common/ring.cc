@@ -25,26 +25,25 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <assert.h>
+
 // consus
 #include "common/ring.h"
 
-#pragma GCC diagnostic ignored "-Wlarger-than="
-
 using consus::ring;
 
 ring :: ring()
     : dc()
+    , partitions()
 {
-    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
-    {
-        partitions[i].index = i;
-    }
 }
 
 ring :: ring(data_center_id _dc)
     : dc(_dc)
+    , partitions(CONSUS_KVS_INITIAL_PARTITIONS)
 {
-    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    for (size_t i = 0; i < partitions.size(); ++i)
     {
         partitions[i].index = i;
     }
@@ -54,21 +53,67 @@ ring :: ~ring() throw ()
 {
 }
 
+bool
+ring :: can_split() const
+{
+    if (partitions.size() >= CONSUS_KVS_PARTITIONS)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < partitions.size(); ++i)
+    {
+        if (partitions[i].next_owner != comm_id())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+ring :: split(uint64_t* counter)
+{
+    std::vector<partition> halves(partitions.size() * 2);
+
+    for (size_t i = 0; i < halves.size(); ++i)
+    {
+        const partition& whole(partitions[i / 2]);
+        halves[i].index = i;
+        halves[i].owner = whole.owner;
+
+        if (whole.owner != comm_id())
+        {
+            halves[i].id = partition_id(*counter);
+            ++*counter;
+        }
+    }
+
+    partitions.swap(halves);
+}
+
 void
-ring :: get_owners(comm_id owners[CONSUS_KVS_PARTITIONS])
+ring :: get_owners(std::vector<comm_id>* owners) const
 {
-    for (unsigned i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    owners->resize(partitions.size());
+
+    for (unsigned i = 0; i < partitions.size(); ++i)
     {
-        owners[i] = partitions[i].owner;
+        (*owners)[i] = partitions[i].owner;
     }
 }
 
 void
-ring :: set_owners(comm_id owners[CONSUS_KVS_PARTITIONS], uint64_t* counter)
+ring :: set_owners(const std::vector<comm_id>& owners, uint64_t* counter,
+                   std::vector<unsigned>* changed)
 {
-    for (unsigned i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    assert(owners.size() == partitions.size());
+
+    for (unsigned i = 0; i < partitions.size(); ++i)
     {
         partition* part = &partitions[i];
+        const partition before(*part);
 
         if (part->owner == comm_id())
         {
@@ -89,17 +134,166 @@ ring :: set_owners(comm_id owners[CONSUS_KVS_PARTITIONS], uint64_t* counter)
             ++*counter;
             part->next_owner = owners[i];
         }
+
+        if (changed &&
+            (before.id != part->id ||
+             before.owner != part->owner ||
+             before.next_id != part->next_id ||
+             before.next_owner != part->next_owner))
+        {
+            changed->push_back(i);
+        }
     }
 }
 
 e::packer
 consus :: operator << (e::packer lhs, const ring& rhs)
 {
-    return lhs << rhs.dc << e::pack_array<partition>(rhs.partitions, CONSUS_KVS_PARTITIONS);
+    return lhs << rhs.dc << rhs.partitions;
 }
 
 e::unpacker
 consus :: operator >> (e::unpacker lhs, ring& rhs)
 {
-    return lhs >> rhs.dc >> e::unpack_array<partition>(rhs.partitions, CONSUS_KVS_PARTITIONS);
+    lhs = lhs >> rhs.dc >> rhs.partitions;
+    const size_t sz = rhs.partitions.size();
+
+    // a power of two no larger than the slots it divides
+    if (!lhs.error() && (sz == 0 || sz > CONSUS_KVS_PARTITIONS || (sz & (sz - 1)) != 0))
+    {
+        return e::unpacker::error_out();
+    }
+
+    for (size_t i = 0; !lhs.error() && i < sz; ++i)
+    {
+        if (rhs.partitions[i].index != i)
+        {
+            return e::unpacker::error_out();
+        }
+    }
+
+    return lhs;
+}
+
+e::packer
+consus :: pack_compact(e::packer lhs, const ring& rhs)
+{
+    std::vector<uint32_t> owner_runs;
+    std::vector<comm_id> owners;
+    std::vector<uint32_t> id_runs;
+    std::vector<partition_id> ids;
+    std::vector<partition> migrating;
+
+    for (size_t i = 0; i < rhs.partitions.size(); ++i)
+    {
+        const partition& p(rhs.partitions[i]);
+
+        if (owners.empty() || owners.back() != p.owner)
+        {
+            owner_runs.push_back(0);
+            owners.push_back(p.owner);
+        }
+
+        ++owner_runs.back();
+
+        // an unowned partition has no id; a run of them stays at zero
+        const uint64_t expect = ids.empty() || ids.back() == partition_id()
+                              ? 0 : ids.back().get() + id_runs.back();
+
+        if (ids.empty() || p.id.get() != expect)
+        {
+            id_runs.push_back(0);
+            ids.push_back(p.id);
+        }
+
+        ++id_runs.back();
+
+        if (p.next_id != partition_id() || p.next_owner != comm_id())
+        {
+            migrating.push_back(p);
+        }
+    }
+
+    return lhs << rhs.dc << uint32_t(rhs.partitions.size())
+               << owner_runs << owners << id_runs << ids << migrating;
+}
+
+e::unpacker
+consus :: unpack_compact(e::unpacker lhs, ring* rhs)
+{
+    uint32_t sz = 0;
+    std::vector<uint32_t> owner_runs;
+    std::vector<comm_id> owners;
+    std::vector<uint32_t> id_runs;
+    std::vector<partition_id> ids;
+    std::vector<partition> migrating;
+    lhs = lhs >> rhs->dc >> sz >> owner_runs >> owners >> id_runs >> ids >> migrating;
+
+    if (lhs.error())
+    {
+        return lhs;
+    }
+
+    if (sz == 0 || sz > CONSUS_KVS_PARTITIONS || (sz & (sz - 1)) != 0 ||
+        owner_runs.size() != owners.size() || id_runs.size() != ids.size())
+    {
+        return e::unpacker::error_out();
+    }
+
+    rhs->partitions.clear();
+    rhs->partitions.resize(sz);
+
+    size_t covered = 0;
+
+    for (size_t i = 0; i < owner_runs.size(); ++i)
+    {
+        for (uint32_t j = 0; j < owner_runs[i]; ++j, ++covered)
+        {
+            if (covered >= sz)
+            {
+                return e::unpacker::error_out();
+            }
+
+            rhs->partitions[covered].index = covered;
+            rhs->partitions[covered].owner = owners[i];
+        }
+    }
+
+    if (covered != sz)
+    {
+        return e::unpacker::error_out();
+    }
+
+    covered = 0;
+
+    for (size_t i = 0; i < id_runs.size(); ++i)
+    {
+        for (uint32_t j = 0; j < id_runs[i]; ++j, ++covered)
+        {
+            if (covered >= sz)
+            {
+                return e::unpacker::error_out();
+            }
+
+            rhs->partitions[covered].id = ids[i] == partition_id()
+                                        ? partition_id() : partition_id(ids[i].get() + j);
+        }
+    }
+
+    if (covered != sz)
+    {
+        return e::unpacker::error_out();
+    }
+
+    for (size_t i = 0; i < migrating.size(); ++i)
+    {
+        if (migrating[i].index >= sz)
+        {
+            return e::unpacker::error_out();
+        }
+
+        rhs->partitions[migrating[i].index] = migrating[i];
+    }
+
+    return lhs;
 }
@@ -28,6 +28,12 @@
 #ifndef consus_common_ring_h_
 #define consus_common_ring_h_
 
+// C
+#include <stdint.h>
+
+// STL
+#include <vector>
+
 // consus
 #include "namespace.h"
 #include "common/constants.h"
@@ -36,6 +42,11 @@
 
 BEGIN_CONSUS_NAMESPACE
 
+// A data center's partitions, in ring order.  Keys hash to one of
+// CONSUS_KVS_PARTITIONS slots and each partition covers an equal, contiguous
+// run of them, so the number of partitions is a power of two that splitting
+// doubles.  Splitting never moves data: both halves of a partition keep its
+// owner.
 class ring
 {
     public:
@@ -44,12 +55,24 @@ class ring
         ~ring() throw ();
 
     public:
-        void get_owners(comm_id owners[CONSUS_KVS_PARTITIONS]);
-        void set_owners(comm_id owners[CONSUS_KVS_PARTITIONS], uint64_t* post_inc_counter);
+        // the partition covering slot, the high 16 bits of a key's hash
+        unsigned partition_for(uint16_t slot) const
+        { return slot / (CONSUS_KVS_PARTITIONS / partitions.size()); }
+        // partition p covers the slots [first_slot(p), first_slot(p + 1))
+        unsigned first_slot(unsigned p) const
+        { return p * (CONSUS_KVS_PARTITIONS / partitions.size()); }
+        // no partition may be migrating, so that each migration names a
+        // single range
+        bool can_split() const;
+        void split(uint64_t* post_inc_counter);
+        void get_owners(std::vector<comm_id>* owners) const;
+        // changed, if non-NULL, gets the index of every partition altered
+        void set_owners(const std::vector<comm_id>& owners, uint64_t* post_inc_counter,
+                        std::vector<unsigned>* changed);
 
     public:
         data_center_id dc;
-        partition partitions[CONSUS_KVS_PARTITIONS];
+        std::vector<partition> partitions;
 };
 
 e::packer
@@ -59,6 +82,15 @@ operator >> (e::unpacker lhs, ring& rhs);
 size_t
 pack_size(const ring& r);
 
+// The coordinator's snapshot encoding of a ring.  Owners are run-length
+// encoded, as are partition ids that count up by one; partitions that are
+// migrating follow in full.  A settled ring of any size thus costs a few
+// bytes per run of partitions sharing an owner.
+e::packer
+pack_compact(e::packer lhs, const ring& rhs);
+e::unpacker
+unpack_compact(e::unpacker lhs, ring* rhs);
+
 END_CONSUS_NAMESPACE
 
 #endif // consus_common_ring_h_
@@ -0,0 +1,167 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "common/rtt_estimator.h"
+
+using consus::rtt_estimator;
+
+// bounds on any computed timeout
+#define RTT_MIN_TIMEOUT (PO6_MILLIS * 5)
+#define RTT_MAX_TIMEOUT (PO6_SECONDS * 10)
+// timer granularity; the variance term never contributes less than this
+#define RTT_GRANULARITY PO6_MILLIS
+
+struct rtt_estimator :: estimate
+{
+    estimate() : srtt(0), rttvar(0) {}
+    estimate(const estimate& other) : srtt(other.srtt), rttvar(other.rttvar) {}
+    ~estimate() throw () {}
+    estimate& operator = (const estimate& rhs)
+    { srtt = rhs.srtt; rttvar = rhs.rttvar; return *this; }
+    uint64_t srtt;
+    uint64_t rttvar;
+};
+
+rtt_estimator :: rtt_estimator()
+    : m_mtx()
+    , m_default(PO6_SECONDS)
+    , m_peers()
+{
+}
+
+rtt_estimator :: ~rtt_estimator() throw ()
+{
+}
+
+void
+rtt_estimator :: set_default(uint64_t timeout)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_default = timeout;
+}
+
+void
+rtt_estimator :: sample(comm_id peer, uint64_t rtt)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::map<comm_id, estimate>::iterator it = m_peers.find(peer);
+
+    if (it == m_peers.end())
+    {
+        estimate e;
+        e.srtt = rtt;
+        e.rttvar = rtt / 2;
+        m_peers.insert(std::make_pair(peer, e));
+        return;
+    }
+
+    estimate* e = &it->second;
+    const uint64_t delta = e->srtt > rtt ? e->srtt - rtt : rtt - e->srtt;
+    // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|; SRTT = 7/8 SRTT + 1/8 R
+    e->rttvar = (3 * e->rttvar + delta) / 4;
+    e->srtt = (7 * e->srtt + rtt) / 8;
+}
+
+uint64_t
+rtt_estimator :: timeout(comm_id peer)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::map<comm_id, estimate>::iterator it = m_peers.find(peer);
+
+    if (it == m_peers.end())
+    {
+        return m_default;
+    }
+
+    return compute(it->second);
+}
+
+uint64_t
+rtt_estimator :: timeout()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_peers.empty())
+    {
+        return m_default;
+    }
+
+    uint64_t t = 0;
+
+    for (std::map<comm_id, estimate>::iterator it = m_peers.begin();
+            it != m_peers.end(); ++it)
+    {
+        t = std::max(t, compute(it->second));
+    }
+
+    return t;
+}
+
+uint64_t
+rtt_estimator :: shortest()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    uint64_t t = m_default;
+
+    for (std::map<comm_id, estimate>::iterator it = m_peers.begin();
+            it != m_peers.end(); ++it)
+    {
+        t = std::min(t, compute(it->second));
+    }
+
+    return t;
+}
+
+bool
+rtt_estimator :: smoothed(comm_id peer, uint64_t* srtt)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::map<comm_id, estimate>::iterator it = m_peers.find(peer);
+
+    if (it == m_peers.end())
+    {
+        return false;
+    }
+
+    *srtt = it->second.srtt;
+    return true;
+}
+
+uint64_t
+rtt_estimator :: compute(const estimate& e)
+{
+    // RTO = SRTT + max(G, 4 * RTTVAR)
+    uint64_t t = e.srtt + std::max(uint64_t(RTT_GRANULARITY), 4 * e.rttvar);
+    return std::min(std::max(t, uint64_t(RTT_MIN_TIMEOUT)), uint64_t(RTT_MAX_TIMEOUT));
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_rtt_estimator_h_
+#define consus_common_rtt_estimator_h_
+
+// The rtt_estimator keeps a smoothed round-trip time and variance for every
+// peer and derives a retransmission timeout from them the way TCP does (RFC
+// 6298).  Peers that have not yet been measured use the configured default.
+// Callers should only report samples for requests that were sent exactly once
+// so that a late response to a retransmission cannot shrink the estimate.
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+class rtt_estimator
+{
+    public:
+        rtt_estimator();
+        ~rtt_estimator() throw ();
+
+    public:
+        // all in nanoseconds, like po6::monotonic_time
+        void set_default(uint64_t timeout);
+        void sample(comm_id peer, uint64_t rtt);
+        // timeout for a message to a single peer
+        uint64_t timeout(comm_id peer);
+        // timeout for a message to several peers: the most conservative
+        uint64_t timeout();
+        // the soonest any peer's timeout may elapse
+        uint64_t shortest();
+        // the smoothed round-trip time; false if peer was never sampled
+        bool smoothed(comm_id peer, uint64_t* srtt);
+
+    private:
+        struct estimate;
+        uint64_t compute(const estimate& e);
+
+    private:
+        po6::threads::mutex m_mtx;
+        uint64_t m_default;
+        std::map<comm_id, estimate> m_peers;
+
+    private:
+        rtt_estimator(const rtt_estimator&);
+        rtt_estimator& operator = (const rtt_estimator&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_rtt_estimator_h_
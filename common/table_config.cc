@@ -0,0 +1,112 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// e
+#include <e/strescape.h>
+#include <e/varint.h>
+
+// consus
+#include "common/constants.h"
+#include "common/table_config.h"
+
+using consus::table_config;
+
+table_config :: table_config()
+    : id()
+    , name()
+    , replication(CONSUS_DEFAULT_REPLICATION_FACTOR)
+    , home()
+{
+}
+
+table_config :: table_config(table_id i, const std::string& n, unsigned r)
+    : id(i)
+    , name(n)
+    , replication(r)
+    , home()
+{
+}
+
+table_config :: table_config(const table_config& other)
+    : id(other.id)
+    , name(other.name)
+    , replication(other.replication)
+    , home(other.home)
+{
+}
+
+table_config :: ~table_config() throw ()
+{
+}
+
+table_config&
+table_config :: operator = (const table_config& rhs)
+{
+    id = rhs.id;
+    name = rhs.name;
+    replication = rhs.replication;
+    home = rhs.home;
+    return *this;
+}
+
+std::ostream&
+consus :: operator << (std::ostream& lhs, const table_config& rhs)
+{
+    lhs << "table(id=" << rhs.id.get()
+        << ", name=\"" << e::strescape(rhs.name)
+        << "\", replication=" << rhs.replication;
+
+    if (rhs.home != data_center_id())
+    {
+        lhs << ", home=" << rhs.home.get();
+    }
+
+    return lhs << ")";
+}
+
+e::packer
+consus :: operator << (e::packer lhs, const table_config& rhs)
+{
+    return lhs << rhs.id << e::slice(rhs.name) << e::pack_varint(rhs.replication) << rhs.home;
+}
+
+e::unpacker
+consus :: operator >> (e::unpacker lhs, table_config& rhs)
+{
+    e::slice name;
+    uint64_t replication;
+    lhs = lhs >> rhs.id >> name >> e::unpack_varint(replication) >> rhs.home;
+    rhs.name = name.str();
+    rhs.replication = replication;
+    return lhs;
+}
+
+size_t
+consus :: pack_size(const table_config& rhs)
+{
+    return pack_size(rhs.id) + pack_size(e::slice(rhs.name)) + e::varint_length(rhs.replication) + pack_size(rhs.home);
+}
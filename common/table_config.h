@@ -0,0 +1,73 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_table_config_h_
+#define consus_common_table_config_h_
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Per-table settings maintained by the coordinator.  Tables without an entry
+// use the defaults from common/constants.h.
+class table_config
+{
+    public:
+        table_config();
+        table_config(table_id id, const std::string& name, unsigned replication);
+        table_config(const table_config& other);
+        ~table_config() throw ();
+
+    public:
+        table_config& operator = (const table_config& rhs);
+
+    public:
+        // assigned by the coordinator when the table is first configured and
+        // never reused; daemons send it in place of the name
+        table_id id;
+        std::string name;
+        unsigned replication;
+        // the only data center whose key-value stores hold this table, or
+        // data_center_id() to hold it in every data center
+        data_center_id home;
+};
+
+std::ostream&
+operator << (std::ostream& lhs, const table_config& rhs);
+
+e::packer
+operator << (e::packer lhs, const table_config& rhs);
+e::unpacker
+operator >> (e::unpacker lhs, table_config& rhs);
+size_t
+pack_size(const table_config& tc);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_table_config_h_
@@ -0,0 +1,172 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// e
+#include <e/varint.h>
+
+// consus
+#include "common/table_dictionary.h"
+
+using consus::table_dictionary;
+using consus::table_ref;
+
+table_ref :: table_ref()
+    : id()
+    , name()
+{
+}
+
+table_ref :: table_ref(table_id i, const e::slice& n)
+    : id(i)
+    , name(n)
+{
+}
+
+table_ref :: ~table_ref() throw ()
+{
+}
+
+e::packer
+consus :: operator << (e::packer lhs, const table_ref& rhs)
+{
+    lhs = lhs << e::pack_varint(rhs.id.get());
+
+    if (rhs.id == table_id())
+    {
+        lhs = lhs << rhs.name;
+    }
+
+    return lhs;
+}
+
+e::unpacker
+consus :: operator >> (e::unpacker lhs, table_ref& rhs)
+{
+    uint64_t id;
+    lhs = lhs >> e::unpack_varint(id);
+    rhs.id = table_id(id);
+    rhs.name = e::slice();
+
+    if (!lhs.error() && rhs.id == table_id())
+    {
+        lhs = lhs >> rhs.name;
+    }
+
+    return lhs;
+}
+
+size_t
+consus :: pack_size(const table_ref& tr)
+{
+    size_t sz = e::varint_length(tr.id.get());
+
+    if (tr.id == table_id())
+    {
+        sz += pack_size(tr.name);
+    }
+
+    return sz;
+}
+
+table_dictionary :: table_dictionary()
+    : m_mtx()
+    , m_tables()
+{
+}
+
+table_dictionary :: ~table_dictionary() throw ()
+{
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        delete m_tables[i].second;
+    }
+}
+
+void
+table_dictionary :: learn(const std::vector<table_config>& tables)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < tables.size(); ++i)
+    {
+        if (tables[i].id == table_id())
+        {
+            continue;
+        }
+
+        bool found = false;
+
+        for (size_t j = 0; !found && j < m_tables.size(); ++j)
+        {
+            found = m_tables[j].first == tables[i].id;
+        }
+
+        if (!found)
+        {
+            m_tables.push_back(std::make_pair(tables[i].id, new std::string(tables[i].name)));
+        }
+    }
+}
+
+table_ref
+table_dictionary :: intern(const e::slice& table)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (e::slice(*m_tables[i].second) == table)
+        {
+            return table_ref(m_tables[i].first, table);
+        }
+    }
+
+    return table_ref(table_id(), table);
+}
+
+bool
+table_dictionary :: resolve(const table_ref& tr, e::slice* table)
+{
+    if (tr.id == table_id())
+    {
+        *table = tr.name;
+        return true;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (m_tables[i].first == tr.id)
+        {
+            *table = e::slice(*m_tables[i].second);
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_table_dictionary_h_
+#define consus_common_table_dictionary_h_
+
+// STL
+#include <string>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/buffer.h>
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "common/table_config.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// A table as it travels between daemons: the id the coordinator assigned it,
+// or, for a table the coordinator has not yet configured, id zero followed by
+// the name.
+class table_ref
+{
+    public:
+        table_ref();
+        table_ref(table_id id, const e::slice& name);
+        ~table_ref() throw ();
+
+    public:
+        table_id id;
+        e::slice name;
+};
+
+e::packer
+operator << (e::packer lhs, const table_ref& rhs);
+e::unpacker
+operator >> (e::unpacker lhs, table_ref& rhs);
+size_t
+pack_size(const table_ref& tr);
+
+// Every table id this daemon has seen in a configuration, with its name.
+// Ids are never reused and tables are never removed, so names handed out
+// remain valid until the dictionary is destroyed, long after the
+// configuration that introduced them has been collected.
+class table_dictionary
+{
+    public:
+        table_dictionary();
+        ~table_dictionary() throw ();
+
+    public:
+        void learn(const std::vector<table_config>& tables);
+        // the reference to send for table
+        table_ref intern(const e::slice& table);
+        // the name a received reference stands for; false for an id not yet
+        // learned, i.e., from a daemon on a newer configuration
+        bool resolve(const table_ref& tr, e::slice* table);
+
+    private:
+        typedef std::vector<std::pair<table_id, const std::string*> > table_list_t;
+
+    private:
+        po6::threads::mutex m_mtx;
+        table_list_t m_tables;
+
+    private:
+        table_dictionary(const table_dictionary&);
+        table_dictionary& operator = (const table_dictionary&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_table_dictionary_h_
@@ -0,0 +1,191 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// STL
+#include <vector>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "common/hash.h"
+#include "common/metrics.h"
+#include "common/table_stats.h"
+
+using consus::metrics_label_escape;
+using consus::table_stats;
+
+struct table_stats::counters
+{
+    counters() { for (size_t i = 0; i < NUM_STATS; ++i) v[i] = 0; }
+    uint64_t v[NUM_STATS];
+};
+
+namespace
+{
+
+struct series
+{
+    const char* name;
+    const char* labels;
+    table_stats::stat s;
+    bool seconds;
+};
+
+// grouped by name, so each TYPE line precedes all of its samples
+const series s_series[] = {
+    {"consus_table_ops_total", "op=\"read\"", table_stats::READS, false},
+    {"consus_table_ops_total", "op=\"write\"", table_stats::WRITES, false},
+    {"consus_table_bytes_total", "op=\"read\"", table_stats::READ_BYTES, false},
+    {"consus_table_bytes_total", "op=\"write\"", table_stats::WRITE_BYTES, false},
+    {"consus_table_versions_total", "", table_stats::VERSIONS, false},
+    {"consus_table_lock_waits_total", "", table_stats::LOCK_WAITS, false},
+    {"consus_table_lock_wait_seconds_total", "", table_stats::LOCK_WAIT_NANOS, true},
+    {"consus_table_replicated_total", "op=\"read\"", table_stats::REPLICATED_READS, false},
+    {"consus_table_replicated_total", "op=\"write\"", table_stats::REPLICATED_WRITES, false},
+    {"consus_table_replicated_seconds_total", "op=\"read\"", table_stats::REPLICATED_READ_NANOS, true},
+    {"consus_table_replicated_seconds_total", "op=\"write\"", table_stats::REPLICATED_WRITE_NANOS, true},
+    {"consus_table_transaction_ops_total", "outcome=\"committed\"", table_stats::COMMITS, false},
+    {"consus_table_transaction_ops_total", "outcome=\"aborted\"", table_stats::ABORTS, false},
+    {"consus_table_transaction_seconds_total", "", table_stats::TRANSACTION_NANOS, true},
+};
+
+} // namespace
+
+table_stats :: table_stats()
+    : m_shards()
+    , m_untracked(new counters())
+{
+}
+
+table_stats :: ~table_stats() throw ()
+{
+    for (size_t i = 0; i < TABLE_STATS_SHARDS; ++i)
+    {
+        for (std::map<std::string, counters*>::iterator it = m_shards[i].tables.begin();
+                it != m_shards[i].tables.end(); ++it)
+        {
+            delete it->second;
+        }
+    }
+
+    delete m_untracked;
+}
+
+void
+table_stats :: record(const e::slice& table, stat s, uint64_t amount)
+{
+    // counters are never freed before the daemon exits, so they may be
+    // bumped outside the shard's lock
+    e::atomic::increment_64_nobarrier(&get(table)->v[s], amount);
+}
+
+void
+table_stats :: render(std::ostream& out)
+{
+    std::vector<std::pair<std::string, counters*> > tables;
+
+    for (size_t i = 0; i < TABLE_STATS_SHARDS; ++i)
+    {
+        po6::threads::mutex::hold hold(&m_shards[i].mtx);
+
+        for (std::map<std::string, counters*>::iterator it = m_shards[i].tables.begin();
+                it != m_shards[i].tables.end(); ++it)
+        {
+            tables.push_back(std::make_pair(it->first, it->second));
+        }
+    }
+
+    tables.push_back(std::make_pair(std::string(), m_untracked));
+    const char* last = NULL;
+
+    for (size_t i = 0; i < sizeof(s_series) / sizeof(s_series[0]); ++i)
+    {
+        const series& s(s_series[i]);
+
+        if (!last || strcmp(last, s.name) != 0)
+        {
+            out << "# TYPE " << s.name << " counter\n";
+            last = s.name;
+        }
+
+        for (size_t j = 0; j < tables.size(); ++j)
+        {
+            const uint64_t v = e::atomic::load_64_nobarrier(&tables[j].second->v[s.s]);
+
+            if (v == 0 && !tables[j].first.empty())
+            {
+                continue;
+            }
+
+            out << s.name << "{table=\"" << metrics_label_escape(tables[j].first) << "\"";
+
+            if (*s.labels)
+            {
+                out << "," << s.labels;
+            }
+
+            out << "} ";
+
+            if (s.seconds)
+            {
+                out << v * 1e-9 << "\n";
+            }
+            else
+            {
+                out << v << "\n";
+            }
+        }
+    }
+}
+
+table_stats::counters*
+table_stats :: get(const e::slice& table)
+{
+    const uint64_t h = hash64(0, table.data(), table.size());
+    shard* s = &m_shards[h % TABLE_STATS_SHARDS];
+    po6::threads::mutex::hold hold(&s->mtx);
+    const std::string name(table.str());
+    std::map<std::string, counters*>::iterator it = s->tables.find(name);
+
+    if (it != s->tables.end())
+    {
+        return it->second;
+    }
+
+    if (s->tables.size() >= TABLE_STATS_MAX_TABLES / TABLE_STATS_SHARDS)
+    {
+        return m_untracked;
+    }
+
+    counters* c = new counters();
+    s->tables.insert(std::make_pair(name, c));
+    return c;
+}
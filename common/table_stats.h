@@ -0,0 +1,116 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_table_stats_h_
+#define consus_common_table_stats_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+#include <map>
+#include <string>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+
+// independently locked maps the tables are spread over
+#define TABLE_STATS_SHARDS 16
+// tables tracked by name; the rest share the table="" series
+#define TABLE_STATS_MAX_TABLES 1024
+
+BEGIN_CONSUS_NAMESPACE
+
+// Counters kept per table, so operators can see which tables drive a
+// daemon's load.  Each daemon counts what it does itself: a key-value store
+// counts the reads, writes, and lock waits it serves, and a transaction
+// manager counts the operations it commits or aborts on a client's behalf.
+// Summing a series over the instance label gives the cluster-wide figure.
+class table_stats
+{
+    public:
+        enum stat
+        {
+            READS,
+            READ_BYTES,
+            WRITES,
+            WRITE_BYTES,
+            // writes that stored a new version
+            VERSIONS,
+            LOCK_WAITS,
+            LOCK_WAIT_NANOS,
+            // operations a replicator saw through to the end, and how long
+            REPLICATED_READS,
+            REPLICATED_READ_NANOS,
+            REPLICATED_WRITES,
+            REPLICATED_WRITE_NANOS,
+            // transactional operations by outcome, and how long their
+            // transactions ran
+            COMMITS,
+            ABORTS,
+            TRANSACTION_NANOS,
+            NUM_STATS
+        };
+
+    public:
+        table_stats();
+        ~table_stats() throw ();
+
+    public:
+        void record(const e::slice& table, stat s, uint64_t amount);
+        // append as Prometheus counters
+        void render(std::ostream& out);
+
+    private:
+        struct counters;
+        struct shard
+        {
+            shard() : mtx(), tables() {}
+            po6::threads::mutex mtx;
+            std::map<std::string, counters*> tables;
+        };
+        counters* get(const e::slice& table);
+
+    private:
+        shard m_shards[TABLE_STATS_SHARDS];
+        counters* m_untracked;
+
+    private:
+        table_stats(const table_stats&);
+        table_stats& operator = (const table_stats&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_table_stats_h_
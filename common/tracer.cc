@@ -0,0 +1,173 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <sstream>
+
+// Google Log
+#include <glog/logging.h>
+
+// consus
+#include "common/tracer.h"
+
+// the nonce bit that marks a key-value operation as traced
+#define TRACE_NONCE_BIT (1ULL << 63)
+// Chrome trace pids and tids are 32-bit
+#define TRACE_ID_MASK 0x7fffffffULL
+
+using consus::tracer;
+
+uint64_t
+tracer :: tag(uint64_t nonce, bool traced)
+{
+    return traced ? (nonce | TRACE_NONCE_BIT) : (nonce & ~TRACE_NONCE_BIT);
+}
+
+bool
+tracer :: tagged(uint64_t nonce)
+{
+    return (nonce & TRACE_NONCE_BIT) != 0;
+}
+
+tracer :: tracer()
+    : m_mtx()
+    , m_fd()
+    , m_sample_one_in(0)
+    , m_us()
+{
+}
+
+tracer :: ~tracer() throw ()
+{
+}
+
+bool
+tracer :: open(const std::string& path, uint64_t sample_one_in, comm_id us)
+{
+    m_fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+
+    if (m_fd.get() < 0)
+    {
+        PLOG(ERROR) << "could not open trace file " << path;
+        return false;
+    }
+
+    // the closing bracket is optional in this format, so a file that was cut
+    // short by a crash still loads
+    if (lseek(m_fd.get(), 0, SEEK_END) == 0 &&
+        m_fd.xwrite("[\n", 2) != 2)
+    {
+        PLOG(ERROR) << "could not write trace file " << path;
+        return false;
+    }
+
+    m_sample_one_in = sample_one_in;
+    m_us = us;
+    return true;
+}
+
+bool
+tracer :: enabled()
+{
+    return m_fd.get() >= 0;
+}
+
+bool
+tracer :: sampled(const transaction_group& tg)
+{
+    if (!enabled() || m_sample_one_in == 0)
+    {
+        return false;
+    }
+
+    // mix the hash so that the decision does not follow the low bits of the
+    // transaction number
+    uint64_t h = tg.hash();
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h % m_sample_one_in == 0;
+}
+
+void
+tracer :: span(const char* name, const transaction_group& tg, uint64_t nonce,
+               uint64_t start, uint64_t end)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    std::ostringstream args;
+    args << "\"tg\":\"" << transaction_group::log(tg) << "\"";
+
+    if (nonce != 0)
+    {
+        args << ",\"nonce\":\"" << std::hex << nonce << "\"";
+    }
+    emit(name, tg.hash(), args.str(), start, end);
+}
+
+void
+tracer :: span(const char* name, uint64_t nonce,
+               uint64_t start, uint64_t end)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    std::ostringstream args;
+    args << "\"nonce\":\"" << std::hex << nonce << "\"";
+    emit(name, nonce, args.str(), start, end);
+}
+
+void
+tracer :: emit(const char* name, uint64_t track, const std::string& args,
+               uint64_t start, uint64_t end)
+{
+    std::ostringstream ostr;
+    ostr << "{\"name\":\"" << name << "\""
+         << ",\"cat\":\"consus\",\"ph\":\"X\""
+         << ",\"ts\":" << start / 1000
+         << ",\"dur\":" << (end > start ? end - start : 0) / 1000
+         << ",\"pid\":" << (m_us.get() & TRACE_ID_MASK)
+         << ",\"tid\":" << (track & TRACE_ID_MASK)
+         << ",\"args\":{" << args << ",\"server\":\"" << m_us.get() << "\"}},\n";
+    const std::string s(ostr.str());
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_fd.xwrite(s.data(), s.size()) != ssize_t(s.size()))
+    {
+        PLOG(WARNING) << "could not write trace span";
+    }
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_tracer_h_
+#define consus_common_tracer_h_
+
+// Sampled transaction tracing.  Whether a transaction is traced is a pure
+// function of its transaction_group, so every transaction manager configured
+// with the same sampling rate traces the same transactions without
+// coordinating.  Key-value operations issued on behalf of a traced
+// transaction carry the decision to the key-value stores in the high bit of
+// their nonce.  Spans are appended to a file in the Chrome trace event
+// format, so the files from every server may be concatenated and loaded into
+// chrome://tracing or Perfetto; timestamps are wall-clock to line them up.
+
+// C
+#include <stdint.h>
+
+// STL
+#include <string>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "common/transaction_group.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+class tracer
+{
+    public:
+        // set or clear the trace bit of a nonce
+        static uint64_t tag(uint64_t nonce, bool traced);
+        static bool tagged(uint64_t nonce);
+
+    public:
+        tracer();
+        ~tracer() throw ();
+
+    public:
+        // trace one in sample_one_in transactions; 0 traces only tagged nonces
+        bool open(const std::string& path, uint64_t sample_one_in, comm_id us);
+        bool enabled();
+        bool sampled(const transaction_group& tg);
+        // record [start, end), both from po6::wallclock_time(); a nonzero
+        // nonce links the span to the key-value store's span for that nonce
+        void span(const char* name, const transaction_group& tg, uint64_t nonce,
+                  uint64_t start, uint64_t end);
+        void span(const char* name, uint64_t nonce,
+                  uint64_t start, uint64_t end);
+
+    private:
+        void emit(const char* name, uint64_t track, const std::string& args,
+                  uint64_t start, uint64_t end);
+
+    private:
+        po6::threads::mutex m_mtx;
+        po6::io::fd m_fd;
+        uint64_t m_sample_one_in;
+        comm_id m_us;
+
+    private:
+        tracer(const tracer&);
+        tracer& operator = (const tracer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_tracer_h_
@@ -39,7 +39,20 @@
 // log to ensure that a message delayed waiting for a log entry to become
 // durable will not be retransmitted.  Absent this mechanism, it is possible
 // for duplicate retransmitted messages to end up enqueued waiting for a single
-// log entry to become durable.
+// log entry to become durable.  Until that first copy clears the durability
+// barrier the value is not retransmitted at all, and the resend interval is
+// measured from the moment it does rather than from when it was queued, so a
+// slow log never turns into back-to-back retransmissions.
+//
+// Ordinarily a changed value is transmitted right away.  For ballots, where
+// competing leaders each keep raising their ballot, that turns contention into
+// a storm of 1a messages.  With backoff enabled, each successive new value
+// must wait a randomized, exponentially growing fraction of the resend
+// interval after the previous transmission.
+
+// C
+#include <stddef.h>
+#include <stdint.h>
 
 // consus
 #include "namespace.h"
@@ -56,25 +69,44 @@ class transmit_limiter
     public:
         const T& value() const { return m_value; }
         void skip_transmissions(unsigned skip) { m_skip_transmissions = skip; }
+        void backoff_new_values() { m_backoff = true; }
         bool may_transmit(const T& value, uint64_t now, daemon* d);
         void transmit_now(const T& value, uint64_t now);
         void transmit_now(const T& value, uint64_t now, uint64_t log, uint64_t* durable,
                           void (daemon::**func)(int64_t, paxos_group_id, std::auto_ptr<e::buffer>));
 
+    private:
+        void changed_value(uint64_t now);
+
     private:
         uint64_t m_last_transmitted;
         uint64_t m_log_durable_seqno;
+        bool m_awaiting_durable;
+        bool (daemon::*m_is_durable)(int64_t);
         unsigned m_skip_transmissions;
         unsigned m_skip_countdown;
+        bool m_backoff;
+        unsigned m_backoff_steps;
+        uint64_t m_backoff_jitter;
         T m_value;
 };
 
+// first step waits 1/TRANSMIT_BACKOFF_BASE of the resend interval; the wait
+// doubles with every new value up to TRANSMIT_BACKOFF_MAX_STEPS doublings
+#define TRANSMIT_BACKOFF_BASE 16
+#define TRANSMIT_BACKOFF_MAX_STEPS 6
+
 template <typename T, class daemon>
 transmit_limiter<T, daemon> :: transmit_limiter()
     : m_last_transmitted(0)
     , m_log_durable_seqno(0)
+    , m_awaiting_durable(false)
+    , m_is_durable(NULL)
     , m_skip_transmissions(0)
     , m_skip_countdown(0)
+    , m_backoff(false)
+    , m_backoff_steps(0)
+    , m_backoff_jitter(reinterpret_cast<uintptr_t>(this))
     , m_value()
 {
 }
@@ -93,9 +125,30 @@ transmit_limiter<T, daemon> :: may_transmit(const T& value, uint64_t now, daemon
         m_skip_countdown = m_skip_transmissions;
     }
 
+    if (m_value == value && m_awaiting_durable)
+    {
+        if (!(d->*m_is_durable)(m_log_durable_seqno))
+        {
+            return false;
+        }
+
+        // the first copy just went out; count the interval from here
+        m_awaiting_durable = false;
+        m_last_transmitted = now;
+        return false;
+    }
+
     bool may = m_value != value ||
                m_last_transmitted + d->resend_interval() < now;
 
+    if (may && m_value != value && m_backoff && m_backoff_steps > 0)
+    {
+        // wait between half and all of the current step
+        const uint64_t step = (d->resend_interval() << m_backoff_steps) / TRANSMIT_BACKOFF_BASE;
+        const uint64_t wait = step / 2 + m_backoff_jitter % (step / 2 + 1);
+        may = m_last_transmitted + wait < now;
+    }
+
     if (may && m_skip_countdown > 0)
     {
         --m_skip_countdown;
@@ -110,7 +163,13 @@ template <typename T, class daemon>
 void
 transmit_limiter<T, daemon> :: transmit_now(const T& value, uint64_t now)
 {
+    if (m_value != value)
+    {
+        changed_value(now);
+    }
+
     m_value = value;
+    m_awaiting_durable = false;
     m_last_transmitted = now;
 }
 
@@ -121,8 +180,11 @@ transmit_limiter<T, daemon> :: transmit_now(const T& value, uint64_t now, uint64
 {
     if (m_value != value)
     {
+        changed_value(now);
         m_value = value;
         m_log_durable_seqno = log;
+        m_awaiting_durable = true;
+        m_is_durable = &daemon::is_durable;
         *durable = log;
         *func = &daemon::send_when_durable;
     }
@@ -135,6 +197,28 @@ transmit_limiter<T, daemon> :: transmit_now(const T& value, uint64_t now, uint64
     m_last_transmitted = now;
 }
 
+template <typename T, class daemon>
+void
+transmit_limiter<T, daemon> :: changed_value(uint64_t now)
+{
+    if (!m_backoff)
+    {
+        return;
+    }
+
+    if (m_backoff_steps < TRANSMIT_BACKOFF_MAX_STEPS)
+    {
+        ++m_backoff_steps;
+    }
+
+    // xorshift; seeded per limiter so that competing leaders draw different
+    // waits
+    m_backoff_jitter ^= now;
+    m_backoff_jitter ^= m_backoff_jitter << 13;
+    m_backoff_jitter ^= m_backoff_jitter >> 7;
+    m_backoff_jitter ^= m_backoff_jitter << 17;
+}
+
 END_CONSUS_NAMESPACE
 
 #endif // consus_common_transmit_limiter_h_
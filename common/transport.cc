@@ -0,0 +1,87 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// consus
+#include "common/transport.h"
+
+using consus::transport;
+
+namespace
+{
+
+class busybee_transport : public transport
+{
+    public:
+        busybee_transport(busybee_server* bb) : m_bb(bb) {}
+        virtual ~busybee_transport() throw () {}
+
+    public:
+        virtual const char* name() const { return "busybee"; }
+        virtual busybee_returncode send(consus::comm_id id, std::auto_ptr<e::buffer> msg);
+
+    private:
+        busybee_server* m_bb;
+
+    private:
+        busybee_transport(const busybee_transport&);
+        busybee_transport& operator = (const busybee_transport&);
+};
+
+busybee_returncode
+busybee_transport :: send(consus::comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    return m_bb->send(id.get(), msg);
+}
+
+} // namespace
+
+transport*
+transport :: create(const std::string& name, busybee_server* bb)
+{
+    // kernel-bypass transports register here as they are added
+    if (name == "busybee")
+    {
+        return new busybee_transport(bb);
+    }
+
+    return NULL;
+}
+
+const char*
+transport :: names()
+{
+    return "busybee";
+}
+
+transport :: transport()
+{
+}
+
+transport :: ~transport() throw ()
+{
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_common_transport_h_
+#define consus_common_transport_h_
+
+// STL
+#include <memory>
+#include <string>
+
+// e
+#include <e/buffer.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// How messages leave for a peer.  BusyBee over TCP carries everything by
+// default; a daemon may put a different transport in front of it for the
+// peers in its own data center, where messages are small and round trips
+// set the commit latency.  A transport that receives on its own hands what
+// arrives to busybee_server::deliver, so the daemon's threads still take
+// every message from the one BusyBee queue.
+class transport
+{
+    public:
+        // the transport registered as name, sending through bb where it
+        // falls back to BusyBee; NULL if no transport has that name
+        static transport* create(const std::string& name, busybee_server* bb);
+        // the registered names, comma separated, for error messages
+        static const char* names();
+
+    public:
+        transport();
+        virtual ~transport() throw ();
+
+    public:
+        virtual const char* name() const = 0;
+        // msg is consumed whatever the outcome; the codes mean what they mean
+        // for busybee_server::send so that callers treat transports alike
+        virtual busybee_returncode send(comm_id id, std::auto_ptr<e::buffer> msg) = 0;
+
+    private:
+        transport(const transport&);
+        transport& operator = (const transport&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_transport_h_
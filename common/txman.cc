@@ -25,6 +25,9 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// e
+#include <e/strescape.h>
+
 // consus
 #include "common/txman.h"
 
@@ -34,6 +37,8 @@ txman :: txman()
     : id()
     , bind_to()
     , dc()
+    , zone()
+    , rack()
 {
 }
 
@@ -41,6 +46,8 @@ txman :: txman(comm_id i, const po6::net::location& b)
     : id(i)
     , bind_to(b)
     , dc()
+    , zone()
+    , rack()
 {
 }
 
@@ -48,6 +55,8 @@ txman :: txman(const txman& other)
     : id(other.id)
     , bind_to(other.bind_to)
     , dc(other.dc)
+    , zone(other.zone)
+    , rack(other.rack)
 {
 }
 
@@ -58,17 +67,25 @@ txman :: ~txman() throw ()
 std::ostream&
 consus :: operator << (std::ostream& lhs, const txman& rhs)
 {
-    return lhs << "txman(id=" << rhs.id.get() << ", bind_to=" << rhs.bind_to << ", dc=" << rhs.dc.get() << ")";
+    return lhs << "txman(id=" << rhs.id.get() << ", bind_to=" << rhs.bind_to << ", dc=" << rhs.dc.get()
+               << ", zone=\"" << e::strescape(rhs.zone) << "\""
+               << ", rack=\"" << e::strescape(rhs.rack) << "\")";
 }
 
 e::packer
 consus :: operator << (e::packer lhs, const txman& rhs)
 {
-    return lhs << rhs.id << rhs.bind_to << rhs.dc;
+    return lhs << rhs.id << rhs.bind_to << rhs.dc
+               << e::slice(rhs.zone) << e::slice(rhs.rack);
 }
 
 e::unpacker
 consus :: operator >> (e::unpacker lhs, txman& rhs)
 {
-    return lhs >> rhs.id >> rhs.bind_to >> rhs.dc;
+    e::slice zone;
+    e::slice rack;
+    lhs = lhs >> rhs.id >> rhs.bind_to >> rhs.dc >> zone >> rack;
+    rhs.zone = zone.str();
+    rhs.rack = rack.str();
+    return lhs;
 }
@@ -28,6 +28,9 @@
 #ifndef consus_common_txman_h_
 #define consus_common_txman_h_
 
+// STL
+#include <string>
+
 // po6
 #include <po6/net/location.h>
 
@@ -49,6 +52,9 @@ class txman
         comm_id id;
         po6::net::location bind_to;
         data_center_id dc;
+        // topology labels within the data center; empty when unknown
+        std::string zone;
+        std::string rack;
 };
 
 std::ostream&
@@ -39,9 +39,12 @@ consus :: txman_configuration(e::unpacker up,
                               std::vector<data_center>* dcs,
                               std::vector<txman_state>* txmans,
                               std::vector<paxos_group>* txman_groups,
-                              std::vector<kvs>* kvss)
+                              std::vector<kvs>* kvss,
+                              std::vector<ring>* rings,
+                              std::vector<table_config>* tables)
 {
-    return up >> *cid >> *vid >> *flags >> *dcs >> *txmans >> *txman_groups >> *kvss;
+    return up >> *cid >> *vid >> *flags >> *dcs >> *txmans >> *txman_groups
+              >> *kvss >> *rings >> *tables;
 }
 
 std::string
@@ -51,7 +54,9 @@ consus :: txman_configuration(const cluster_id& cid,
                               const std::vector<data_center>& dcs,
                               const std::vector<txman_state>& txmans,
                               const std::vector<paxos_group>& txman_groups,
-                              const std::vector<kvs>& kvss)
+                              const std::vector<kvs>& kvss,
+                              const std::vector<ring>& rings,
+                              const std::vector<table_config>& tables)
 {
     std::ostringstream ostr;
     ostr << cid << "\n"
@@ -129,5 +134,16 @@ consus :: txman_configuration(const cluster_id& cid,
         ostr << kvss[i] << "\n";
     }
 
+    for (size_t i = 0; i < tables.size(); ++i)
+    {
+        ostr << tables[i] << "\n";
+    }
+
+    // the partitions themselves are in the kvs configuration
+    for (size_t i = 0; i < rings.size(); ++i)
+    {
+        ostr << "routing by ring for " << rings[i].dc << "\n";
+    }
+
     return ostr.str();
 }
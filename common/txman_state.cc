@@ -48,6 +48,8 @@ txman_state :: txman_state()
     : tx()
     , state()
     , nonce()
+    , standby_for()
+    , standby_synced(false)
 {
 }
 
@@ -55,6 +57,8 @@ txman_state :: txman_state(const txman& t)
     : tx(t)
     , state(REGISTERED)
     , nonce()
+    , standby_for()
+    , standby_synced(false)
 {
 }
 
@@ -62,6 +66,8 @@ txman_state :: txman_state(const txman_state& other)
     : tx(other.tx)
     , state(other.state)
     , nonce(other.nonce)
+    , standby_for(other.standby_for)
+    , standby_synced(other.standby_synced)
 {
 }
 
@@ -77,6 +83,8 @@ txman_state :: operator = (const txman_state& rhs)
         tx = rhs.tx;
         state = rhs.state;
         nonce = rhs.nonce;
+        standby_for = rhs.standby_for;
+        standby_synced = rhs.standby_synced;
     }
 
     return *this;
@@ -90,6 +98,8 @@ consus :: operator << (std::ostream& lhs, const txman_state& rhs)
                << ", dc=" << rhs.tx.dc.get()
                << ", state=" << rhs.state
                << ", nonce=" << rhs.nonce
+               << ", standby_for=" << rhs.standby_for.get()
+               << ", standby_synced=" << (rhs.standby_synced ? "yes" : "no")
                << ")";
 }
 
@@ -111,13 +121,15 @@ consus :: operator << (std::ostream& lhs, const txman_state::state_t& rhs)
 e::packer
 consus :: operator << (e::packer lhs, const txman_state& rhs)
 {
-    return lhs << rhs.tx << rhs.state << rhs.nonce;
+    return lhs << rhs.tx << rhs.state << rhs.nonce
+               << rhs.standby_for << e::pack_uint8<bool>(rhs.standby_synced);
 }
 
 e::unpacker
 consus :: operator >> (e::unpacker lhs, txman_state& rhs)
 {
-    return lhs >> rhs.tx >> rhs.state >> rhs.nonce;
+    return lhs >> rhs.tx >> rhs.state >> rhs.nonce
+               >> rhs.standby_for >> e::unpack_uint8<bool>(rhs.standby_synced);
 }
 
 e::packer
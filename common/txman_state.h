@@ -65,6 +65,10 @@ class txman_state
         txman tx;
         state_t state;
         uint64_t nonce;
+        // a warm standby tails this primary's log and joins no group of its
+        // own; synced once everything the primary still needs has reached it
+        comm_id standby_for;
+        bool standby_synced;
 };
 
 std::ostream&
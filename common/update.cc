@@ -0,0 +1,163 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// e
+#include <e/endian.h>
+#include <e/serialization.h>
+
+// consus
+#include "common/update.h"
+
+using consus::update_t;
+
+namespace
+{
+
+bool
+read_counter(bool found, const e::slice& current, int64_t* x)
+{
+    if (!found)
+    {
+        *x = 0;
+        return true;
+    }
+
+    if (current.size() != sizeof(uint64_t))
+    {
+        return false;
+    }
+
+    uint64_t tmp;
+    e::unpack64be(current.data(), &tmp);
+    *x = static_cast<int64_t>(tmp);
+    return true;
+}
+
+} // namespace
+
+bool
+consus :: update_is_valid(unsigned u)
+{
+    return u <= UPDATE_SET_ADD;
+}
+
+bool
+consus :: update_is_conditional(update_t u)
+{
+    return u == UPDATE_IF_EQUAL || u == UPDATE_IF_ABSENT;
+}
+
+bool
+consus :: update_apply(update_t u, bool found, const e::slice& current,
+                       const e::slice& expected, const e::slice& value,
+                       std::string* result, consus_returncode* rc)
+{
+    *rc = CONSUS_SUCCESS;
+
+    switch (u)
+    {
+        case UPDATE_IF_EQUAL:
+        case UPDATE_IF_ABSENT:
+            if (u == UPDATE_IF_ABSENT ? found : (!found || current != expected))
+            {
+                *rc = CONSUS_COMPARE_FAILED;
+                return false;
+            }
+
+            result->assign(value.cdata(), value.size());
+            return true;
+        case UPDATE_ADD:
+        case UPDATE_MAX:
+        {
+            int64_t x;
+            int64_t y;
+
+            if (!read_counter(found, current, &x) ||
+                !read_counter(true, value, &y))
+            {
+                *rc = CONSUS_INVALID;
+                return false;
+            }
+
+            // two's complement wrap on overflow, as every replica agrees
+            const uint64_t sum = static_cast<uint64_t>(x) + static_cast<uint64_t>(y);
+            *result = update_counter(u == UPDATE_ADD ? static_cast<int64_t>(sum) : std::max(x, y));
+            return true;
+        }
+        case UPDATE_SET_ADD:
+        {
+            std::vector<e::slice> members;
+            e::unpacker up(current.data(), found ? current.size() : 0);
+
+            while (!up.error() && up.remain())
+            {
+                e::slice m;
+                up = up >> m;
+                members.push_back(m);
+            }
+
+            if (up.error())
+            {
+                *rc = CONSUS_INVALID;
+                return false;
+            }
+
+            std::vector<e::slice>::iterator it;
+            it = std::lower_bound(members.begin(), members.end(), value);
+
+            if (it == members.end() || *it != value)
+            {
+                members.insert(it, value);
+            }
+
+            result->clear();
+            e::packer pa(result);
+
+            for (size_t i = 0; i < members.size(); ++i)
+            {
+                pa = pa << members[i];
+            }
+
+            return true;
+        }
+        default:
+            *rc = CONSUS_INVALID;
+            return false;
+    }
+}
+
+std::string
+consus :: update_counter(int64_t x)
+{
+    unsigned char buf[sizeof(uint64_t)];
+    e::pack64be(static_cast<uint64_t>(x), buf);
+    return std::string(reinterpret_cast<const char*>(buf), sizeof(buf));
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_common_update_h_
+#define consus_common_update_h_
+
+// STL
+#include <string>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include <consus.h>
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// How a TXMAN_COND_WRITE combines the value the transaction manager reads
+// with the operands the client sent.  Counters are 8-byte big-endian signed
+// integers and a missing counter is zero; sets are their distinct members in
+// sorted order, each packed as an e::slice, and a missing set is empty.
+enum update_t
+{
+    UPDATE_IF_EQUAL     = 0, // write value if the key holds expected
+    UPDATE_IF_ABSENT    = 1, // write value if the key does not exist
+    UPDATE_ADD          = 2, // add value to the counter
+    UPDATE_MAX          = 3, // raise the counter to value
+    UPDATE_SET_ADD      = 4  // insert value into the set
+};
+
+// What a TXMAN_SINGLE does with its one key, outside any transaction:  read
+// it, write value, or write what its update_t makes of the current value.
+enum single_t
+{
+    SINGLE_GET      = 0,
+    SINGLE_PUT      = 1,
+    SINGLE_UPDATE   = 2
+};
+
+bool
+update_is_valid(unsigned u);
+// conditional updates may leave the key alone; the others always write
+bool
+update_is_conditional(update_t u);
+
+// true and the value to write, or false with CONSUS_COMPARE_FAILED if the
+// condition fails or CONSUS_INVALID if current is not of the update's form
+bool
+update_apply(update_t u, bool found, const e::slice& current,
+             const e::slice& expected, const e::slice& value,
+             std::string* result, consus_returncode* rc);
+
+std::string
+update_counter(int64_t x);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_common_update_h_
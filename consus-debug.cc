@@ -42,6 +42,8 @@ main(int argc, const char* argv[])
     cmds.push_back(e::subcommand("client-configuration",    "Show the client configuration"));
     cmds.push_back(e::subcommand("txman-configuration",     "Show the transaction manager configuration"));
     cmds.push_back(e::subcommand("kvs-configuration",       "Show the key value store configuration"));
+    cmds.push_back(e::subcommand("lock-contention",         "Show the most contended locks on a key value store"));
+    cmds.push_back(e::subcommand("hot-spots",               "Show the hottest keys, lock queues, replicators, and transactions of a daemon"));
     return dispatch_to_subcommands(argc, argv,
                                    "consus debug", "Consus",
                                    PACKAGE_VERSION,
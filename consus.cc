@@ -42,9 +42,20 @@ main(int argc, const char* argv[])
 	cmds.push_back(e::subcommand("transaction-manager",	"Start a new transaction manager"));
 	cmds.push_back(e::subcommand("key-value-store",		"Start a new key value store"));
 	cmds.push_back(e::subcommand("coordinator",			"Start a new coordinator"));
+    cmds.push_back(e::subcommand("proxy",               "Start a per-host proxy that multiplexes local clients"));
     cmds.push_back(e::subcommand("create-data-center",  "Create a new data center"));
     cmds.push_back(e::subcommand("set-default-data-center", "Set the default data center for new servers"));
+    cmds.push_back(e::subcommand("split-partitions",    "Double the partitions of a data center's ring"));
+    cmds.push_back(e::subcommand("set-table-replication", "Set the replication factor for a table"));
+    cmds.push_back(e::subcommand("set-table-home", "Keep a table in one data center"));
+    cmds.push_back(e::subcommand("set-group-quorum", "Commit on fewer members of a transaction manager group"));
+    cmds.push_back(e::subcommand("set-group-witness", "Add or remove a non-voting witness of a transaction manager group"));
     cmds.push_back(e::subcommand("availability-check",  "Check that the cluster has sufficient availability"));
+    cmds.push_back(e::subcommand("bulk-load",           "Prepare a table's initial data for loading without transactions"));
+    cmds.push_back(e::subcommand("export",              "Export every table as of a timestamp"));
+    cmds.push_back(e::subcommand("compact",             "Compact the stored data of a range of partitions"));
+    cmds.push_back(e::subcommand("bench",               "Drive a synthetic workload and report throughput and latency"));
+    cmds.push_back(e::subcommand("probe",               "Report commit latency through each transaction manager"));
     cmds.push_back(e::subcommand("debug",             	"Debug tools for Consus developers"));
     return dispatch_to_subcommands(argc, argv,
                                    "consus", "Consus",
@@ -32,6 +32,7 @@
 
 // STL
 #include <algorithm>
+#include <iterator>
 #include <map>
 #include <sstream>
 #include <string>
@@ -105,11 +106,24 @@ coordinator :: coordinator()
     , m_txman_groups()
     , m_txman_quiescence_counter(0)
     , m_txmans_changed(false)
+    , m_txman_quorum_counter(0)
     , m_kvss()
     , m_kvs_quiescence_counter(0)
     , m_kvss_changed(false)
+    , m_kvss_changed_dcs()
     , m_rings()
     , m_migrated()
+    , m_kvs_loads()
+    , m_kvs_load_counter(0)
+    , m_kvs_dirty()
+    , m_kvs_dirty_base_rings(0)
+    , m_kvs_delta_base()
+    , m_kvs_delta_since()
+    , m_tables()
+    , m_export_timestamp(0)
+    , m_compaction(0)
+    , m_compaction_first(0)
+    , m_compaction_last(0)
 {
 }
 
@@ -163,6 +177,8 @@ coordinator :: invariant_check(rsm_context* ctx)
     {
         INVARIANT(m_txman_groups[i].id.get() < m_counter);
         //XXX INVARIANT(get_data_center(m_txman_groups[i].dc));
+        INVARIANT(!get_data_center(m_txman_groups[i].dc) ||
+                  !get_data_center(m_txman_groups[i].dc)->read_replica);
 
         for (unsigned m = 0; m < m_txman_groups[i].members_sz; ++m)
         {
@@ -171,12 +187,26 @@ coordinator :: invariant_check(rsm_context* ctx)
             INVARIANT(ts->tx.id == m_txman_groups[i].members[m]);
             INVARIANT(ts->tx.dc == m_txman_groups[i].dc);
         }
+
+        for (unsigned w = 0; w < m_txman_groups[i].witnesses_sz; ++w)
+        {
+            txman_state* ts = get_txman(m_txman_groups[i].witnesses[w]);
+            INVARIANT(ts);
+            INVARIANT(ts->tx.dc == m_txman_groups[i].dc);
+            INVARIANT(m_txman_groups[i].index(ts->tx.id) == m_txman_groups[i].members_sz);
+        }
     }
 
     for (size_t i = 0; i < m_kvss.size(); ++i)
     {
         //XXX INVARIANT(get_data_center(m_kvss[i].kv.dc));
     }
+
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        INVARIANT(m_tables[i].id != table_id());
+        INVARIANT(m_tables[i].id.get() < m_counter);
+    }
 }
 
 consus::data_center*
@@ -218,7 +248,7 @@ coordinator :: new_data_center(const std::string& name)
 }
 
 void
-coordinator :: data_center_create(rsm_context* ctx, const std::string& name)
+coordinator :: data_center_create(rsm_context* ctx, const std::string& name, bool read_replica)
 {
     data_center* dc = get_data_center(name);
 
@@ -228,8 +258,11 @@ coordinator :: data_center_create(rsm_context* ctx, const std::string& name)
         return generate_response(ctx, consus::COORD_DUPLICATE);
     }
 
+    // fixed at creation, so no group ever forms in a read replica
     dc = new_data_center(name);
-    rsm_log(ctx, "created data center %s", e::strescape(dc->name).c_str());
+    dc->read_replica = read_replica;
+    rsm_log(ctx, "created %sdata center %s", read_replica ? "read replica " : "",
+                 e::strescape(dc->name).c_str());
     generate_next_configuration(ctx);
     return generate_response(ctx, COORD_SUCCESS);
 }
@@ -249,6 +282,36 @@ coordinator :: data_center_default(rsm_context* ctx, const std::string& name)
     return generate_response(ctx, COORD_SUCCESS);
 }
 
+void
+coordinator :: data_center_split_partitions(rsm_context* ctx, const std::string& name)
+{
+    data_center* dc = get_data_center(name);
+
+    if (!dc)
+    {
+        rsm_log(ctx, "cannot split the partitions of data center \"%s\" because it doesn't exist", e::strescape(name).c_str());
+        return generate_response(ctx, COORD_NOT_FOUND);
+    }
+
+    ring* r = get_or_create_ring(dc->id);
+
+    if (!r->can_split())
+    {
+        rsm_log(ctx, "cannot split the %" PRIu64 " partitions of data center \"%s\" "
+                     "while any of them is migrating or once there are %u\n",
+                     uint64_t(r->partitions.size()), e::strescape(name).c_str(),
+                     unsigned(CONSUS_KVS_PARTITIONS));
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    r->split(&m_counter);
+    m_kvs_dirty_base_rings = 0;
+    rsm_log(ctx, "split the ring of data center \"%s\" into %" PRIu64 " partitions\n",
+                 e::strescape(name).c_str(), uint64_t(r->partitions.size()));
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
 consus::txman_state*
 coordinator :: get_txman(comm_id tx)
 {
@@ -264,7 +327,8 @@ coordinator :: new_txman(const txman& t)
 }
 
 void
-coordinator :: txman_register(rsm_context* ctx, const txman& t, const std::string& dc_name)
+coordinator :: txman_register(rsm_context* ctx, const txman& t, const std::string& dc_name,
+                              comm_id standby_for)
 {
     txman_state* ts = get_txman(t.id);
 
@@ -289,8 +353,49 @@ coordinator :: txman_register(rsm_context* ctx, const txman& t, const std::strin
         dcid = dc->id;
     }
 
+    if (standby_for != comm_id())
+    {
+        txman_state* primary = get_txman(standby_for);
+
+        if (!primary)
+        {
+            rsm_log(ctx, "register %s failed: primary %" PRIu64 " doesn't exist",
+                         to_string(t).c_str(), standby_for.get());
+            return generate_response(ctx, consus::COORD_NOT_FOUND);
+        }
+
+        // the standby takes the primary's place in groups that must stay
+        // within one data center
+        if (primary->tx.dc != dcid || primary->standby_for != comm_id())
+        {
+            rsm_log(ctx, "register %s failed: %" PRIu64 " cannot have a standby in this data center",
+                         to_string(t).c_str(), standby_for.get());
+            return generate_response(ctx, consus::COORD_NO_CAN_DO);
+        }
+
+        for (size_t i = 0; i < m_txmans.size(); ++i)
+        {
+            if (m_txmans[i].standby_for == standby_for)
+            {
+                rsm_log(ctx, "register %s failed: %" PRIu64 " already has a standby",
+                             to_string(t).c_str(), standby_for.get());
+                return generate_response(ctx, consus::COORD_NO_CAN_DO);
+            }
+        }
+    }
+
     ts = new_txman(t);
     ts->tx.dc = dcid;
+    ts->standby_for = standby_for;
+
+    if (standby_for != comm_id())
+    {
+        rsm_log(ctx, "registered %s as a warm standby for %" PRIu64,
+                     to_string(ts->tx).c_str(), standby_for.get());
+        generate_next_configuration(ctx);
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
     rsm_log(ctx, "registered %s", to_string(ts->tx).c_str());
     generate_next_configuration(ctx);
     return generate_response(ctx, COORD_SUCCESS);
@@ -386,6 +491,17 @@ coordinator :: txman_offline(rsm_context* ctx, comm_id id, const po6::net::locat
                      id.get(), txman_state::to_string(ts->state),
                      txman_state::to_string(txman_state::OFFLINE));
         ts->state = txman_state::OFFLINE;
+
+        if (ts->standby_for != comm_id())
+        {
+            // it must catch up again before it may be swapped in
+            ts->standby_synced = false;
+        }
+        else if (!swap_in_standby(ctx, id))
+        {
+            promote_witnesses(ctx, id);
+        }
+
         txman_availability_changed();
         generate_next_configuration(ctx);
     }
@@ -393,6 +509,173 @@ coordinator :: txman_offline(rsm_context* ctx, comm_id id, const po6::net::locat
     return generate_response(ctx, COORD_SUCCESS);
 }
 
+void
+coordinator :: txman_standby_synced(rsm_context* ctx, comm_id primary, comm_id standby, bool synced)
+{
+    txman_state* ts = get_txman(standby);
+
+    if (!ts)
+    {
+        rsm_log(ctx, "cannot change the sync state of transaction manager %" PRIu64
+                     " because it is not registered", standby.get());
+        return generate_response(ctx, COORD_NOT_FOUND);
+    }
+
+    if (ts->standby_for != primary ||
+        (synced && ts->state != txman_state::ONLINE))
+    {
+        rsm_log(ctx, "cannot mark transaction manager %" PRIu64 " %s because it is "
+                     "not an online standby for %" PRIu64, standby.get(),
+                     synced ? "synced" : "unsynced", primary.get());
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    if (ts->standby_synced != synced)
+    {
+        rsm_log(ctx, "warm standby %" PRIu64 " for %" PRIu64 " is now %s",
+                     standby.get(), primary.get(), synced ? "synced" : "unsynced");
+        ts->standby_synced = synced;
+    }
+
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+void
+coordinator :: txman_group_set_quorum(rsm_context* ctx, paxos_group_id id, uint64_t phase2)
+{
+    paxos_group* g = NULL;
+
+    for (size_t i = 0; i < m_txman_groups.size(); ++i)
+    {
+        if (m_txman_groups[i].id == id)
+        {
+            g = &m_txman_groups[i];
+        }
+    }
+
+    if (!g)
+    {
+        rsm_log(ctx, "cannot set quorums for transaction manager group %" PRIu64
+                     " because it does not exist", id.get());
+        return generate_response(ctx, COORD_NOT_FOUND);
+    }
+
+    if (phase2 > g->members_sz)
+    {
+        rsm_log(ctx, "cannot set phase 2 quorums of transaction manager group %" PRIu64
+                     " to %" PRIu64 " of %u members", id.get(), phase2, g->members_sz);
+        return generate_response(ctx, COORD_MALFORMED);
+    }
+
+    if (g->joint)
+    {
+        rsm_log(ctx, "cannot set phase 2 quorums of transaction manager group %" PRIu64
+                     " while it is still switching from an earlier change", id.get());
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    if (g->phase2_sz == phase2)
+    {
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
+    // members apply the change as the configuration reaches them, and an
+    // old phase 1 quorum need not intersect a new phase 2 quorum; until tick
+    // finishes the switch, the group's quorums intersect those of both sizes
+    g->joint = true;
+    g->joint_phase2_sz = g->phase2_sz;
+    g->phase2_sz = phase2;
+    m_txman_quorum_counter = 0;
+    rsm_log(ctx, "transaction manager group %" PRIu64 " is switching phase 2 quorums "
+                 "and uses phase 1 quorums of %u and phase 2 quorums of %u of %u members "
+                 "until every member has the change", id.get(),
+                 g->phase1_quorum(), g->phase2_quorum(), g->members_sz);
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+void
+coordinator :: txman_group_set_witness(rsm_context* ctx, paxos_group_id id, comm_id tx, bool witness)
+{
+    paxos_group* g = NULL;
+
+    for (size_t i = 0; i < m_txman_groups.size(); ++i)
+    {
+        if (m_txman_groups[i].id == id)
+        {
+            g = &m_txman_groups[i];
+        }
+    }
+
+    if (!g)
+    {
+        rsm_log(ctx, "cannot change the witnesses of transaction manager group %" PRIu64
+                     " because it does not exist", id.get());
+        return generate_response(ctx, COORD_NOT_FOUND);
+    }
+
+    txman_state* ts = get_txman(tx);
+
+    if (!ts)
+    {
+        rsm_log(ctx, "cannot make transaction manager %" PRIu64 " a witness"
+                     " because it is not registered", tx.get());
+        return generate_response(ctx, COORD_NOT_FOUND);
+    }
+
+    const unsigned idx = g->witness_index(tx);
+
+    if (!witness)
+    {
+        if (idx < g->witnesses_sz)
+        {
+            for (unsigned w = idx + 1; w < g->witnesses_sz; ++w)
+            {
+                g->witnesses[w - 1] = g->witnesses[w];
+            }
+
+            --g->witnesses_sz;
+            g->witnesses[g->witnesses_sz] = comm_id();
+            rsm_log(ctx, "transaction manager %" PRIu64 " no longer witnesses group %" PRIu64,
+                         tx.get(), id.get());
+            generate_next_configuration(ctx);
+        }
+
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
+    if (idx < g->witnesses_sz)
+    {
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
+    if (ts->tx.dc != g->dc ||
+        ts->standby_for != comm_id() ||
+        g->index(tx) < g->members_sz)
+    {
+        rsm_log(ctx, "cannot make transaction manager %" PRIu64 " a witness of group %" PRIu64
+                     " because it is a standby, a member, or in another data center",
+                     tx.get(), id.get());
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    if (g->witnesses_sz >= CONSUS_MAX_REPLICATION_FACTOR)
+    {
+        rsm_log(ctx, "cannot make transaction manager %" PRIu64 " a witness of group %" PRIu64
+                     " because it already has %u witnesses", tx.get(), id.get(), g->witnesses_sz);
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    // witnesses hold only what reaches them from now on, so one added to a
+    // busy group is only as complete as the transactions begun after it
+    g->witnesses[g->witnesses_sz] = tx;
+    ++g->witnesses_sz;
+    rsm_log(ctx, "transaction manager %" PRIu64 " now witnesses group %" PRIu64,
+                 tx.get(), id.get());
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
 consus::kvs_state*
 coordinator :: get_kvs(comm_id lk)
 {
@@ -473,7 +756,7 @@ coordinator :: kvs_online(rsm_context* ctx, comm_id id, const po6::net::location
         kv->state = kvs_state::ONLINE;
         kv->nonce = nonce;
         changed = true;
-        kvs_availability_changed();
+        kvs_availability_changed(kv->kv.dc);
     }
     else if (kv->nonce != nonce)
     {
@@ -530,7 +813,7 @@ coordinator :: kvs_offline(rsm_context* ctx, comm_id id, const po6::net::locatio
                      id.get(), kvs_state::to_string(kv->state),
                      kvs_state::to_string(kvs_state::OFFLINE));
         kv->state = kvs_state::OFFLINE;
-        kvs_availability_changed();
+        kvs_availability_changed(kv->kv.dc);
         generate_next_configuration(ctx);
     }
 
@@ -543,6 +826,156 @@ coordinator :: kvs_migrated(rsm_context*, partition_id id)
     m_migrated.push_back(id);
 }
 
+void
+coordinator :: kvs_migrated_batch(rsm_context*, const std::vector<partition_id>& ids)
+{
+    // the next tick folds them all into one configuration
+    m_migrated.insert(m_migrated.end(), ids.begin(), ids.end());
+}
+
+void
+coordinator :: kvs_load_report(rsm_context*, const kvs_load& load)
+{
+    const size_t KVS_LOAD_MAX_HOTTEST = 256;
+
+    if (!get_kvs(load.id))
+    {
+        return;
+    }
+
+    size_t idx = 0;
+
+    while (idx < m_kvs_loads.size() && m_kvs_loads[idx].id != load.id)
+    {
+        ++idx;
+    }
+
+    if (idx == m_kvs_loads.size())
+    {
+        m_kvs_loads.push_back(load);
+    }
+    else
+    {
+        m_kvs_loads[idx] = load;
+    }
+
+    if (m_kvs_loads[idx].hottest.size() > KVS_LOAD_MAX_HOTTEST)
+    {
+        m_kvs_loads[idx].hottest.resize(KVS_LOAD_MAX_HOTTEST);
+    }
+}
+
+consus::table_config*
+coordinator :: get_table(const std::string& name)
+{
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (m_tables[i].name == name)
+        {
+            return &m_tables[i];
+        }
+    }
+
+    return NULL;
+}
+
+void
+coordinator :: table_set_replication(rsm_context* ctx, const std::string& name, uint64_t replication)
+{
+    if (replication < 1 || replication > CONSUS_MAX_REPLICATION_FACTOR)
+    {
+        rsm_log(ctx, "cannot set replication for table \"%s\" to %" PRIu64, e::strescape(name).c_str(), replication);
+        return generate_response(ctx, consus::COORD_MALFORMED);
+    }
+
+    table_config* tc = get_table(name);
+
+    if (!tc)
+    {
+        m_tables.push_back(table_config(table_id(m_counter), name, replication));
+        ++m_counter;
+        tc = &m_tables.back();
+    }
+
+    tc->replication = replication;
+    rsm_log(ctx, "set replication for table \"%s\" to %" PRIu64, e::strescape(name).c_str(), replication);
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+void
+coordinator :: table_set_home(rsm_context* ctx, const std::string& name, const std::string& dc_name)
+{
+    data_center* dc = get_data_center(dc_name);
+
+    if (!dc)
+    {
+        rsm_log(ctx, "cannot home table \"%s\" in data center \"%s\" because it does not exist",
+                     e::strescape(name).c_str(), e::strescape(dc_name).c_str());
+        return generate_response(ctx, COORD_NOT_FOUND);
+    }
+
+    table_config* tc = get_table(name);
+
+    if (!tc)
+    {
+        m_tables.push_back(table_config(table_id(m_counter), name, CONSUS_DEFAULT_REPLICATION_FACTOR));
+        ++m_counter;
+        tc = &m_tables.back();
+    }
+
+    if (tc->home == dc->id)
+    {
+        return generate_response(ctx, COORD_SUCCESS);
+    }
+
+    if (tc->home != data_center_id())
+    {
+        rsm_log(ctx, "cannot move table \"%s\" to data center \"%s\" because it is already homed elsewhere",
+                     e::strescape(name).c_str(), e::strescape(dc_name).c_str());
+        return generate_response(ctx, COORD_NO_CAN_DO);
+    }
+
+    tc->home = dc->id;
+    rsm_log(ctx, "homed table \"%s\" in data center \"%s\"",
+                 e::strescape(name).c_str(), e::strescape(dc_name).c_str());
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+void
+coordinator :: kvs_export(rsm_context* ctx, uint64_t timestamp)
+{
+    if (timestamp == 0)
+    {
+        rsm_log(ctx, "cannot export at timestamp 0");
+        return generate_response(ctx, consus::COORD_MALFORMED);
+    }
+
+    m_export_timestamp = timestamp;
+    rsm_log(ctx, "requesting an export as of timestamp %" PRIu64, timestamp);
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
+void
+coordinator :: kvs_compact(rsm_context* ctx, uint16_t first, uint16_t last)
+{
+    if (first > last)
+    {
+        rsm_log(ctx, "cannot compact partitions %u through %u", unsigned(first), unsigned(last));
+        return generate_response(ctx, consus::COORD_MALFORMED);
+    }
+
+    ++m_compaction;
+    m_compaction_first = first;
+    m_compaction_last = last;
+    rsm_log(ctx, "requesting compaction %" PRIu64 " of partitions %u through %u",
+            m_compaction, unsigned(first), unsigned(last));
+    generate_next_configuration(ctx);
+    return generate_response(ctx, COORD_SUCCESS);
+}
+
 void
 coordinator :: is_stable(rsm_context* ctx)
 {
@@ -561,15 +994,46 @@ coordinator :: tick(rsm_context* ctx)
 {
     const unsigned TXMAN_TICK_LIMIT = 5;
     const unsigned KVS_TICK_LIMIT = 5;
+    const unsigned KVS_LOAD_TICK_LIMIT = 30;
+    const unsigned TXMAN_QUORUM_TICK_LIMIT = 30;
     ++m_txman_quiescence_counter;
     bool changed = false;
 
+    if (m_txman_quorum_counter < TXMAN_QUORUM_TICK_LIMIT)
+    {
+        ++m_txman_quorum_counter;
+    }
+
+    for (size_t i = 0; m_txman_quorum_counter >= TXMAN_QUORUM_TICK_LIMIT &&
+                       i < m_txman_groups.size(); ++i)
+    {
+        paxos_group* g = &m_txman_groups[i];
+
+        if (!g->joint)
+        {
+            continue;
+        }
+
+        // every member has long since had the joint quorums, which
+        // intersect the new ones, so the old ones are no longer in use
+        g->joint = false;
+        g->joint_phase2_sz = 0;
+        rsm_log(ctx, "transaction manager group %" PRIu64 " now uses phase 1 quorums of %u "
+                     "and phase 2 quorums of %u of %u members", g->id.get(),
+                     g->phase1_quorum(), g->phase2_quorum(), g->members_sz);
+        changed = true;
+    }
+
     if (m_txman_quiescence_counter >= TXMAN_TICK_LIMIT && m_txmans_changed)
     {
         rsm_log(ctx, "regenerating paxos groups because of recent changes to transaction manager availability");
-        regenerate_paxos_groups(ctx);
+
+        if (regenerate_paxos_groups(ctx))
+        {
+            changed = true;
+        }
+
         m_txmans_changed = false;
-        changed = true;
     }
     else if (m_txmans_changed)
     {
@@ -598,11 +1062,25 @@ coordinator :: tick(rsm_context* ctx)
         rsm_log(ctx, "delaying ring restructuring because key-value stores' availability has not quiesced (regenerating in %d ticks)", KVS_TICK_LIMIT - m_kvs_quiescence_counter);
     }
 
-    if (changed)
-    {
-        generate_next_configuration(ctx);
-    }
-}
+    ++m_kvs_load_counter;
+
+    if (m_kvs_load_counter >= KVS_LOAD_TICK_LIMIT)
+    {
+        // membership changes take precedence over load
+        if (!m_kvss_changed && rebalance_hot_partitions(ctx))
+        {
+            changed = true;
+        }
+
+        m_kvs_loads.clear();
+        m_kvs_load_counter = 0;
+    }
+
+    if (changed)
+    {
+        generate_next_configuration(ctx);
+    }
+}
 
 coordinator*
 coordinator :: recreate(rsm_context* /*ctx*/,
@@ -626,8 +1104,47 @@ coordinator :: recreate(rsm_context* /*ctx*/,
             >> c->m_kvss
             >> c->m_kvs_quiescence_counter
             >> e::unpack_uint8<bool>(c->m_kvss_changed)
+            >> c->m_kvss_changed_dcs
             >> c->m_rings
-            >> c->m_migrated;
+            >> c->m_migrated
+            >> c->m_kvs_loads
+            >> c->m_kvs_load_counter
+            >> c->m_tables
+            >> c->m_kvs_dirty
+            >> c->m_kvs_dirty_base_rings;
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> c->m_export_timestamp;
+    }
+
+    // snapshots that encode rings compactly leave the slot above empty
+    if (!up.error() && up.remain())
+    {
+        uint32_t rings = 0;
+        up = up >> rings;
+        c->m_rings.resize(rings);
+
+        for (size_t i = 0; !up.error() && i < c->m_rings.size(); ++i)
+        {
+            up = unpack_compact(up, &c->m_rings[i]);
+        }
+    }
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> c->m_kvs_delta_base >> c->m_kvs_delta_since;
+    }
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> c->m_compaction >> c->m_compaction_first >> c->m_compaction_last;
+    }
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> c->m_txman_quorum_counter;
+    }
 
     if (up.error())
     {
@@ -642,7 +1159,8 @@ coordinator :: snapshot(rsm_context* /*ctx*/,
                         char** data, size_t* data_sz)
 {
     std::string buf;
-    e::packer(&buf)
+    e::packer pa(&buf);
+    pa = pa
         << m_cluster << m_version
         << m_flags << m_counter
         << m_dc_default << m_dcs
@@ -653,8 +1171,28 @@ coordinator :: snapshot(rsm_context* /*ctx*/,
         << m_kvss
         << m_kvs_quiescence_counter
         << e::pack_uint8<bool>(m_kvss_changed)
-        << m_rings
-        << m_migrated;
+        << m_kvss_changed_dcs
+        << std::vector<ring>()
+        << m_migrated
+        << m_kvs_loads
+        << m_kvs_load_counter
+        << m_tables
+        << m_kvs_dirty
+        << m_kvs_dirty_base_rings
+        << m_export_timestamp
+        << uint32_t(m_rings.size());
+
+    // every replica replays from the snapshot, so failover time tracks its
+    // size; a settled ring is a handful of runs instead of a partition each
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        pa = pack_compact(pa, m_rings[i]);
+    }
+
+    pa = pa << m_kvs_delta_base << m_kvs_delta_since
+            << m_compaction << m_compaction_first << m_compaction_last
+            << m_txman_quorum_counter;
+
     char* ptr = static_cast<char*>(malloc(buf.size()));
     *data = ptr;
     *data_sz = buf.size();
@@ -673,10 +1211,24 @@ coordinator :: generate_next_configuration(rsm_context* ctx)
     m_version = version_id(m_version.get() + 1);
     rsm_log(ctx, "issuing new configuration version %" PRIu64 "\n", m_version.get());
     std::vector<txman> txmans;
+    std::vector<txman> readers;
 
     for (size_t i = 0; i < m_txmans.size(); ++i)
     {
-        if (m_txmans[i].state == txman_state::ONLINE)
+        const data_center* dc = get_data_center(m_txmans[i].tx.dc);
+
+        // clients begin transactions only on group members, and send only
+        // stale reads to the transaction managers of read replicas
+        if (m_txmans[i].state != txman_state::ONLINE ||
+            m_txmans[i].standby_for != comm_id())
+        {
+            continue;
+        }
+        else if (dc && dc->read_replica)
+        {
+            readers.push_back(m_txmans[i].tx);
+        }
+        else
         {
             txmans.push_back(m_txmans[i].tx);
         }
@@ -694,21 +1246,94 @@ coordinator :: generate_next_configuration(rsm_context* ctx)
 
     // client configuration
     std::string clientconf;
-    e::packer(&clientconf) << m_cluster << m_version << m_flags << txmans;
+    e::packer(&clientconf) << m_cluster << m_version << m_flags << txmans << readers;
     rsm_cond_broadcast_data(ctx, "clientconf", clientconf.data(), clientconf.size());
 
+    // the rings dominate both of the configurations below, so they are
+    // packed once and spliced into each
+    std::string rings;
+    e::packer(&rings) << m_rings;
+
     // txman configuration
     std::string txmanconf;
+    std::string txmantail;
     e::packer(&txmanconf)
         << m_cluster << m_version << m_flags
         << m_dcs << m_txmans << m_txman_groups << kvss;
+    e::packer(&txmantail) << m_tables;
+    txmanconf += rings;
+    txmanconf += txmantail;
     rsm_cond_broadcast_data(ctx, "txmanconf", txmanconf.data(), txmanconf.size());
 
     // kvs configuration
     std::string kvsconf;
-    e::packer(&kvsconf)
-        << m_cluster << m_version << m_flags << m_kvss << m_rings;
+    std::string kvstail;
+    e::packer(&kvsconf) << m_cluster << m_version << m_flags << m_kvss;
+    e::packer(&kvstail) << m_tables << m_export_timestamp
+                        << m_compaction << m_compaction_first << m_compaction_last;
+    kvsconf += rings;
+    kvsconf += kvstail;
     rsm_cond_broadcast_data(ctx, "kvsconf", kvsconf.data(), kvsconf.size());
+
+    // kvs configuration delta, cumulative from m_kvs_delta_base so that a
+    // daemon that missed a few versions need not fetch the full kvsconf;
+    // daemons behind the base, or that get a delta marked full, fall back
+    // to kvsconf
+    const size_t KVS_DELTA_MAX_PARTITIONS = CONSUS_KVS_PARTITIONS / 4;
+    const uint64_t KVS_DELTA_MAX_VERSIONS = 64;
+    std::sort(m_kvs_dirty.begin(), m_kvs_dirty.end());
+    m_kvs_dirty.resize(std::unique(m_kvs_dirty.begin(), m_kvs_dirty.end()) - m_kvs_dirty.begin());
+    const bool full = m_rings.size() != m_kvs_dirty_base_rings ||
+                      m_kvs_dirty.size() > KVS_DELTA_MAX_PARTITIONS;
+
+    if (!full)
+    {
+        std::vector<uint64_t> since;
+        std::set_union(m_kvs_delta_since.begin(), m_kvs_delta_since.end(),
+                       m_kvs_dirty.begin(), m_kvs_dirty.end(),
+                       std::back_inserter(since));
+        m_kvs_delta_since.swap(since);
+
+        // start over from the previous version once the delta grows too
+        // large or reaches back too far to be worth keeping
+        if (m_kvs_delta_base == version_id() ||
+            m_kvs_delta_since.size() > KVS_DELTA_MAX_PARTITIONS ||
+            m_version.get() - m_kvs_delta_base.get() > KVS_DELTA_MAX_VERSIONS)
+        {
+            m_kvs_delta_base = version_id(m_version.get() - 1);
+            m_kvs_delta_since = m_kvs_dirty;
+        }
+    }
+
+    std::vector<uint32_t> delta_rings;
+    std::vector<partition> delta_partitions;
+
+    for (size_t i = 0; !full && i < m_kvs_delta_since.size(); ++i)
+    {
+        const uint32_t r = m_kvs_delta_since[i] >> 32;
+        const uint32_t p = m_kvs_delta_since[i] & 0xffffffffULL;
+        delta_rings.push_back(r);
+        delta_partitions.push_back(m_rings[r].partitions[p]);
+    }
+
+    const version_id delta_base = full ? version_id(m_version.get() - 1) : m_kvs_delta_base;
+    std::string kvsdelta;
+    e::packer(&kvsdelta)
+        << m_cluster << delta_base << m_version << m_flags
+        << e::pack_uint8<bool>(full) << m_kvss << m_tables
+        << uint64_t(m_rings.size()) << delta_rings << delta_partitions
+        << m_export_timestamp
+        << m_compaction << m_compaction_first << m_compaction_last;
+    rsm_cond_broadcast_data(ctx, "kvsdelta", kvsdelta.data(), kvsdelta.size());
+    m_kvs_dirty.clear();
+    m_kvs_dirty_base_rings = m_rings.size();
+
+    // every daemon must hold this version in full before the next delta
+    if (full)
+    {
+        m_kvs_delta_base = m_version;
+        m_kvs_delta_since.clear();
+    }
 }
 
 void
@@ -719,10 +1344,15 @@ coordinator :: txman_availability_changed()
 }
 
 void
-coordinator :: kvs_availability_changed()
+coordinator :: kvs_availability_changed(data_center_id dc)
 {
     m_kvs_quiescence_counter = 0;
     m_kvss_changed = true;
+
+    if (std::find(m_kvss_changed_dcs.begin(), m_kvss_changed_dcs.end(), dc) == m_kvss_changed_dcs.end())
+    {
+        m_kvss_changed_dcs.push_back(dc);
+    }
 }
 
 namespace
@@ -746,36 +1376,113 @@ update_scatters_and_pairs(const paxos_group& g,
     }
 }
 
-void
-sort_nodes_by_width(const std::vector<txman_state>& txmans,
-                    std::map<comm_id, unsigned>* scatters,
-                    std::vector<comm_id>* sorted)
-{
-    std::vector<std::pair<unsigned, comm_id> > widths;
+} // namespace
 
-    for (size_t i = 0; i < txmans.size(); ++i)
+// A synced standby holds every log record its primary's groups still depend
+// upon, so it can stand in for the primary member-for-member without the
+// groups being torn down and formed anew.
+bool
+coordinator :: swap_in_standby(rsm_context* ctx, comm_id primary)
+{
+    for (size_t i = 0; i < m_txmans.size(); ++i)
     {
-        if (txmans[i].state != txman_state::ONLINE)
+        txman_state* ts = &m_txmans[i];
+
+        if (ts->standby_for != primary)
         {
             continue;
         }
 
-        comm_id id(txmans[i].tx.id);
-        widths.push_back(std::make_pair((*scatters)[id], id));
+        if (ts->state != txman_state::ONLINE || !ts->standby_synced)
+        {
+            rsm_log(ctx, "warm standby %" PRIu64 " for %" PRIu64 " is not ready to take its place",
+                         ts->tx.id.get(), primary.get());
+            return false;
+        }
+
+        unsigned swapped = 0;
+
+        for (size_t g = 0; g < m_txman_groups.size(); ++g)
+        {
+            for (unsigned m = 0; m < m_txman_groups[g].members_sz; ++m)
+            {
+                if (m_txman_groups[g].members[m] == primary)
+                {
+                    m_txman_groups[g].members[m] = ts->tx.id;
+                    ++swapped;
+                }
+            }
+        }
+
+        for (size_t g = 0; g < m_txman_groups.size(); ++g)
+        {
+            for (unsigned w = 0; w < m_txman_groups[g].witnesses_sz; ++w)
+            {
+                if (m_txman_groups[g].witnesses[w] == primary)
+                {
+                    m_txman_groups[g].witnesses[w] = ts->tx.id;
+                }
+            }
+        }
+
+        ts->standby_for = comm_id();
+        ts->standby_synced = false;
+        rsm_log(ctx, "swapped warm standby %" PRIu64 " into %u groups in place of %" PRIu64,
+                     ts->tx.id.get(), swapped, primary.get());
+        return true;
     }
 
-    std::stable_sort(widths.begin(), widths.end());
-    sorted->clear();
+    return false;
+}
 
-    for (size_t i = 0; i < widths.size(); ++i)
+// A witness has logged the group's phase 2 messages and commit records all
+// along, so it takes the member's place straight away instead of leaving the
+// group one short until it is regenerated.
+void
+coordinator :: promote_witnesses(rsm_context* ctx, comm_id member)
+{
+    for (size_t i = 0; i < m_txman_groups.size(); ++i)
     {
-        sorted->push_back(widths[i].second);
+        paxos_group* g = &m_txman_groups[i];
+        const unsigned idx = g->index(member);
+
+        if (idx >= g->members_sz)
+        {
+            continue;
+        }
+
+        unsigned w = 0;
+
+        for (; w < g->witnesses_sz; ++w)
+        {
+            txman_state* ts = get_txman(g->witnesses[w]);
+
+            if (ts && ts->state == txman_state::ONLINE)
+            {
+                break;
+            }
+        }
+
+        if (w >= g->witnesses_sz)
+        {
+            continue;
+        }
+
+        g->members[idx] = g->witnesses[w];
+
+        for (++w; w < g->witnesses_sz; ++w)
+        {
+            g->witnesses[w - 1] = g->witnesses[w];
+        }
+
+        --g->witnesses_sz;
+        g->witnesses[g->witnesses_sz] = comm_id();
+        rsm_log(ctx, "promoted witness %" PRIu64 " into group %" PRIu64 " in place of %" PRIu64,
+                     g->members[idx].get(), g->id.get(), member.get());
     }
 }
 
-} // namespace
-
-void
+bool
 coordinator :: regenerate_paxos_groups(rsm_context*)
 {
     const unsigned SCATTER = 3;
@@ -809,6 +1516,30 @@ coordinator :: regenerate_paxos_groups(rsm_context*)
         }
     }
 
+    // the online transaction managers of each data center ordered by width
+    // (groups already shared) and then by position in m_txmans; kept up to
+    // date as groups form rather than re-sorted for every new group
+    typedef std::set<std::pair<unsigned, size_t> > width_set;
+    std::map<data_center_id, width_set> widths;
+    std::map<comm_id, size_t> positions;
+
+    for (size_t node = 0; node < m_txmans.size(); ++node)
+    {
+        const data_center* dc = get_data_center(m_txmans[node].tx.dc);
+
+        // standbys join groups only by being swapped in, and read replicas
+        // never vote
+        if (m_txmans[node].state == txman_state::ONLINE &&
+            m_txmans[node].standby_for == comm_id() &&
+            !(dc && dc->read_replica))
+        {
+            const txman_state& ts(m_txmans[node]);
+            widths[ts.tx.dc].insert(std::make_pair(scatters[ts.tx.id], node));
+            positions[ts.tx.id] = node;
+        }
+    }
+
+    const size_t groups_sz = m_txman_groups.size();
     size_t txmans_sz = m_txman_groups.size() + 1;
 
     while (m_txman_groups.size() != txmans_sz)
@@ -819,7 +1550,10 @@ coordinator :: regenerate_paxos_groups(rsm_context*)
         {
             const txman_state& ts(m_txmans[node]);
 
-            if (ts.state != txman_state::ONLINE || scatters[ts.tx.id] >= SCATTER)
+            if (ts.state != txman_state::ONLINE ||
+                ts.standby_for != comm_id() ||
+                positions.find(ts.tx.id) == positions.end() ||
+                scatters[ts.tx.id] >= SCATTER)
             {
                 continue;
             }
@@ -828,39 +1562,29 @@ coordinator :: regenerate_paxos_groups(rsm_context*)
             g.dc = ts.tx.dc;
             g.members_sz = 1;
             g.members[0] = ts.tx.id;
-            std::vector<comm_id> candidates;
-            sort_nodes_by_width(m_txmans, &scatters, &candidates);
+            width_set* candidates = &widths[ts.tx.dc];
 
-            for (size_t i = 0; i < candidates.size(); ++i)
+            // candidates are all in ts's data center; additional
+            // constraints should set valid=false if not met
+            for (width_set::iterator it = candidates->begin();
+                    it != candidates->end() && g.members_sz < REPLICATION; ++it)
             {
-                if (ts.tx.id == candidates[i])
+                comm_id a = m_txmans[it->second].tx.id;
+
+                if (ts.tx.id == a)
                 {
                     continue;
                 }
 
                 bool valid = true;
-                comm_id a = candidates[i];
-                txman_state* ats = get_txman(a);
 
                 for (unsigned p = 0; valid && p < g.members_sz; ++p)
                 {
-                    comm_id b = g.members[p];
-                    assert(a != b);
-                    txman_state* bts = get_txman(b);
-
                     // nodes must not already be in a replica set together
-                    if (pairs.find(std::make_pair(a, b)) != pairs.end())
-                    {
-                        valid = false;
-                    }
-
-                    // nodes must be in the same data center
-                    if (ats->tx.dc != bts->tx.dc)
+                    if (pairs.find(std::make_pair(a, g.members[p])) != pairs.end())
                     {
                         valid = false;
                     }
-
-                    // additional constraints should set valid=false if not met
                 }
 
                 if (valid)
@@ -868,11 +1592,6 @@ coordinator :: regenerate_paxos_groups(rsm_context*)
                     g.members[g.members_sz] = a;
                     ++g.members_sz;
                 }
-
-                if (g.members_sz == REPLICATION)
-                {
-                    break;
-                }
             }
 
             if (g.members_sz == 1 &&
@@ -883,10 +1602,24 @@ coordinator :: regenerate_paxos_groups(rsm_context*)
 
             g.id = paxos_group_id(m_counter);
             ++m_counter;
+
+            for (unsigned p = 0; p < g.members_sz; ++p)
+            {
+                candidates->erase(std::make_pair(scatters[g.members[p]], positions[g.members[p]]));
+            }
+
             update_scatters_and_pairs(g, &scatters, &pairs);
+
+            for (unsigned p = 0; p < g.members_sz; ++p)
+            {
+                candidates->insert(std::make_pair(scatters[g.members[p]], positions[g.members[p]]));
+            }
+
             m_txman_groups.push_back(g);
         }
     }
+
+    return m_txman_groups.size() != groups_sz;
 }
 
 namespace
@@ -909,304 +1642,189 @@ select_active_by_data_center(const std::vector<kvs_state>& kvss,
     }
 }
 
-template <typename T>
-unsigned
-compute_partition_count(T parts[CONSUS_KVS_PARTITIONS])
+// split partitions among servers in proportion to their capacities by
+// largest remainder; every server gets at least one partition
+void
+weighted_targets(const std::vector<uint64_t>& capacities,
+                 unsigned partitions,
+                 std::vector<unsigned>* targets)
 {
-    unsigned idx = 0;
-    unsigned partitions = 0;
+    const size_t n = capacities.size();
+    std::vector<uint64_t> clamped(n);
+    uint64_t total = 0;
 
-    while (idx < CONSUS_KVS_PARTITIONS)
+    for (size_t i = 0; i < n; ++i)
     {
-        unsigned end = idx + 1;
+        // bounded so that capacity * partitions cannot overflow
+        clamped[i] = std::min(std::max(capacities[i], uint64_t(1)), uint64_t(1) << 32);
+        total += clamped[i];
+    }
 
-        while (end < CONSUS_KVS_PARTITIONS &&
-               parts[idx] == parts[end])
-        {
-            ++end;
-        }
+    targets->resize(n);
+    std::vector<std::pair<uint64_t, size_t> > remainders;
+    unsigned assigned = 0;
 
-        ++partitions;
-        idx = end;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const uint64_t share = clamped[i] * partitions;
+        (*targets)[i] = share / total;
+        assigned += (*targets)[i];
+        // negated so that sorting puts the largest remainder first, with
+        // earlier servers breaking ties
+        remainders.push_back(std::make_pair(total - share % total, i));
     }
 
-    return partitions;
-}
+    std::sort(remainders.begin(), remainders.end());
 
-void
-map_owners_to_indices(comm_id owners[CONSUS_KVS_PARTITIONS],
-                      unsigned partitions[CONSUS_KVS_PARTITIONS])
-{
-    unsigned idx = 0;
-    unsigned count = 0;
+    for (size_t i = 0; assigned < partitions; ++i)
+    {
+        ++(*targets)[remainders[i % n].second];
+        ++assigned;
+    }
 
-    while (idx < CONSUS_KVS_PARTITIONS)
+    for (size_t i = 0; i < n; ++i)
     {
-        unsigned end = idx;
+        if ((*targets)[i] > 0)
+        {
+            continue;
+        }
 
-        while (end < CONSUS_KVS_PARTITIONS &&
-               owners[idx] == owners[end])
+        size_t largest = 0;
+
+        for (size_t j = 1; j < n; ++j)
         {
-            partitions[end] = count;
-            ++end;
+            if ((*targets)[j] > (*targets)[largest])
+            {
+                largest = j;
+            }
         }
 
-        ++count;
-        idx = end;
+        if ((*targets)[largest] > 1)
+        {
+            --(*targets)[largest];
+            ++(*targets)[i];
+        }
     }
 }
 
+// lay kvss out as one contiguous range each, sized by capacity, keeping the
+// servers in the order they already appear on the ring and choosing the
+// rotation of that order that moves the fewest partitions
 void
-evenly_distribute_indices(unsigned count,
-                          unsigned partitions[CONSUS_KVS_PARTITIONS])
+weighted_assignment(const std::vector<comm_id>& current_owners,
+                    const std::vector<comm_id>& kvss,
+                    const std::vector<uint64_t>& capacities,
+                    std::vector<comm_id>* new_owners)
 {
-    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    assert(!kvss.empty());
+    assert(kvss.size() == capacities.size());
+    const unsigned partitions = current_owners.size();
+    std::vector<unsigned> targets;
+    weighted_targets(capacities, partitions, &targets);
+    new_owners->resize(partitions);
+    std::map<comm_id, size_t> positions;
+
+    for (size_t i = 0; i < kvss.size(); ++i)
     {
-        partitions[i] = 0;
+        positions[kvss[i]] = i;
     }
 
-    const unsigned size = CONSUS_KVS_PARTITIONS / count;
-    const unsigned excess = CONSUS_KVS_PARTITIONS % count;
-    unsigned idx = 0;
+    // servers that own partitions now, in ring order, and how many they own
+    std::vector<size_t> order;
+    std::vector<unsigned> owned(kvss.size(), 0);
 
-    for (size_t i = 0; i < count; ++i)
+    for (size_t p = 0; p < partitions; ++p)
     {
-        const unsigned this_size = size + (i < excess ? 1 : 0);
+        std::map<comm_id, size_t>::iterator it = positions.find(current_owners[p]);
 
-        for (size_t j = 0; j < this_size; ++j)
+        if (it == positions.end())
         {
-            partitions[idx + j] = i;
+            continue;
         }
 
-        idx += this_size;
-    }
-
-    assert(partitions[CONSUS_KVS_PARTITIONS - 1] == count - 1);
-}
-
-void
-stable_marriage(comm_id current_owners[CONSUS_KVS_PARTITIONS],
-                comm_id new_owners[CONSUS_KVS_PARTITIONS],
-                unsigned new_partitions)
-{
-    // map CONSUS_KVS_PARTITIONS buckets onto a smaller number of buckets (the
-    // value of each element in the arrays)
-    unsigned part1[CONSUS_KVS_PARTITIONS];
-    unsigned part2[CONSUS_KVS_PARTITIONS];
-    // label each contiguous block of owners with a unique id
-    map_owners_to_indices(current_owners, part1);
-    // create an ideal distribution of N partitions
-    evenly_distribute_indices(new_partitions, part2);
-    const unsigned n1 = compute_partition_count(part1);
-    const unsigned n2 = new_partitions;
-    assert(n2 == compute_partition_count(part2));
-    // preference weights for the stable marriage algorithm
-    // prefs1: part1/current for part2/new
-    // prefs2: part2/new for part1/current
-    std::map<std::pair<unsigned, unsigned>, unsigned> prefs1;
-    std::map<std::pair<unsigned, unsigned>, unsigned> prefs2;
+        if (owned[it->second] == 0)
+        {
+            order.push_back(it->second);
+        }
 
-    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
-    {
-        ++prefs1[std::make_pair(part1[i], part2[i])];
-        ++prefs2[std::make_pair(part2[i], part1[i])];
+        ++owned[it->second];
     }
 
-    // who is assigned to whom; matches part1/part2
-    // assign1: values [0:n1] value CONSUS_KVS_PARTITIONS means unassigned
-    // assign2: values [0:n2] value CONSUS_KVS_PARTITIONS means unassigned
-    // it's sized CONSUS_KVS_PARTITIONS for static allocation
-    unsigned assign1[CONSUS_KVS_PARTITIONS];
-    unsigned assign2[CONSUS_KVS_PARTITIONS];
+    // a new server goes right after the server with the most partitions
+    // beyond its target, which is where most of its partitions come from
+    std::vector<int64_t> surplus(kvss.size());
 
-    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    for (size_t i = 0; i < kvss.size(); ++i)
     {
-        assign1[i] = CONSUS_KVS_PARTITIONS;
-        assign2[i] = CONSUS_KVS_PARTITIONS;
+        surplus[i] = int64_t(owned[i]) - int64_t(targets[i]);
     }
 
-    std::set<std::pair<unsigned, unsigned> > proposals;
-
-    while (true)
+    for (size_t i = 0; i < kvss.size(); ++i)
     {
-        // if either assign1 or assign2 is completely mapped
-        if (std::find(assign1, assign1 + n1, CONSUS_KVS_PARTITIONS) == assign1 + n1 ||
-            std::find(assign2, assign2 + n2, CONSUS_KVS_PARTITIONS) == assign2 + n2)
+        if (owned[i] > 0)
         {
-            break;
+            continue;
         }
 
-        // consider everyone in the first group
-        for (unsigned idx1 = 0; idx1 < n1; ++idx1)
-        {
-            // if already matched
-            if (assign1[idx1] < CONSUS_KVS_PARTITIONS)
-            {
-                continue;
-            }
-
-            unsigned best_candidate = CONSUS_KVS_PARTITIONS;
-            unsigned best_preference = 0;
+        size_t best = 0;
 
-            // consider everyone in the second group
-            for (unsigned idx2 = 0; idx2 < n2; ++idx2)
-            {
-                // if there's already a proposal from 1->2
-                if (proposals.find(std::make_pair(idx1, idx2)) != proposals.end())
-                {
-                    continue;
-                }
-
-                std::map<std::pair<unsigned, unsigned>, unsigned>::iterator it;
-                it = prefs1.find(std::make_pair(idx1, idx2));
-                // what's idx1's preference for idx2?
-                const unsigned preference = it != prefs1.end() ? it->second : 0;
-
-                // pick
-                if (best_candidate == CONSUS_KVS_PARTITIONS ||
-                    best_preference < preference)
-                {
-                    best_candidate = idx2;
-                    best_preference = preference;
-                }
-            }
-
-            // if no one to propose to
-            if (best_candidate == CONSUS_KVS_PARTITIONS)
-            {
-                continue;
-            }
-
-            proposals.insert(std::make_pair(idx1, best_candidate));
-
-            // if idx1's preference is unmatched, match them
-            if (assign2[best_candidate] == CONSUS_KVS_PARTITIONS)
-            {
-                assign1[idx1] = best_candidate;
-                assign2[best_candidate] = idx1;
-            }
-            else
+        for (size_t j = 1; j < order.size(); ++j)
+        {
+            if (surplus[order[j]] > surplus[order[best]])
             {
-                std::map<std::pair<unsigned, unsigned>, unsigned>::iterator it;
-                it = prefs2.find(std::make_pair(best_candidate, assign2[best_candidate]));
-                // candidate's preference for its current match
-                const unsigned cur_preference = it != prefs2.end() ? it->second : 0;
-                it = prefs2.find(std::make_pair(best_candidate, idx1));
-                // candidate's preference for idx1
-                const unsigned new_preference = it != prefs2.end() ? it->second : 0;
-
-                // trade up
-                if (cur_preference < new_preference)
-                {
-                    assign1[assign2[best_candidate]] = CONSUS_KVS_PARTITIONS;
-                    assign1[idx1] = best_candidate;
-                    assign2[best_candidate] = idx1;
-                }
+                best = j;
             }
         }
-    }
 
-    // fill in new owners
-    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
-    {
-        assert(part2[i] < n2);
-
-        // if this bucket is unassigned
-        if (assign2[part2[i]] == CONSUS_KVS_PARTITIONS)
+        if (!order.empty())
         {
-            new_owners[i] = comm_id();
-            continue;
+            surplus[order[best]] -= targets[i];
         }
 
-        // find an element in part1 with the value this partition matches
-        assert(assign2[part2[i]] < n1);
-        unsigned* const ptr = std::find(part1, part1 + CONSUS_KVS_PARTITIONS, assign2[part2[i]]);
-        const unsigned idx = ptr - part1;
-        assert(idx < CONSUS_KVS_PARTITIONS);
-        new_owners[i] = current_owners[idx];
+        order.insert(order.begin() + std::min(best + 1, order.size()), i);
     }
-}
 
-void
-unassign_discontinuous(comm_id old_owners[CONSUS_KVS_PARTITIONS],
-                       comm_id new_owners[CONSUS_KVS_PARTITIONS])
-{
-    std::map<comm_id, unsigned> counts;
-    comm_id* ptr = new_owners;
-    comm_id* const end = ptr + CONSUS_KVS_PARTITIONS;
+    size_t best_rotation = 0;
+    unsigned best_moved = partitions + 1;
 
-    while (ptr < end)
+    for (size_t r = 0; r < order.size(); ++r)
     {
-        // find the contiguous size of this assignment
-        comm_id* tmp = ptr;
-        // how many partitions are the same in old and new
-        unsigned maintained = 0;
+        unsigned moved = 0;
+        unsigned p = 0;
 
-        while (tmp < end && *tmp == *ptr)
+        for (size_t k = 0; k < order.size(); ++k)
         {
-            if (old_owners[tmp - new_owners] == *ptr)
-            {
-                ++maintained;
-            }
-
-            ++tmp;
-        }
+            const size_t node = order[(r + k) % order.size()];
 
-        // look for any previous range assigned to *ptr
-        std::map<comm_id, unsigned>::iterator it = counts.find(*ptr);
-
-        // if *ptr was previously assigned and previous assignment maintained
-        // fewer partitions
-        if (it != counts.end() && it->second < maintained)
-        {
-            for (comm_id* c = new_owners; c < ptr; ++c)
+            for (unsigned j = 0; j < targets[node]; ++j, ++p)
             {
-                if (*c == *ptr)
+                if (current_owners[p] != kvss[node])
                 {
-                    *c = comm_id();
+                    ++moved;
                 }
             }
-
-            it->second = maintained;
         }
-        else if (it == counts.end())
+
+        if (moved < best_moved)
         {
-            counts.insert(std::make_pair(*ptr, maintained));
+            best_rotation = r;
+            best_moved = moved;
         }
-
-        ptr = tmp;
     }
-}
 
-void
-assign_unassigned(comm_id owners[CONSUS_KVS_PARTITIONS], comm_id* kvs, size_t kvs_sz)
-{
-    comm_id* const owners_end = owners + CONSUS_KVS_PARTITIONS;
-    unsigned part[CONSUS_KVS_PARTITIONS];
-    evenly_distribute_indices(kvs_sz, part);
+    unsigned p = 0;
 
-    for (size_t i = 0; i < kvs_sz; ++i)
+    for (size_t k = 0; k < order.size(); ++k)
     {
-        if (std::find(owners, owners_end, kvs[i]) != owners_end)
-        {
-            continue;
-        }
+        const size_t node = order[(best_rotation + k) % order.size()];
 
-        unsigned fill = CONSUS_KVS_PARTITIONS;
-
-        for (size_t j = 0; j < CONSUS_KVS_PARTITIONS; ++j)
+        for (unsigned j = 0; j < targets[node]; ++j, ++p)
         {
-            if (owners[j] == comm_id() && fill == CONSUS_KVS_PARTITIONS)
-            {
-                fill = part[j];
-            }
-
-            if (part[j] == fill && owners[j] == comm_id())
-            {
-                owners[j] = kvs[i];
-            }
+            (*new_owners)[p] = kvss[node];
         }
     }
+
+    assert(p == partitions);
 }
 
 struct assignment
@@ -1318,6 +1936,15 @@ coordinator :: get_or_create_ring(data_center_id id)
     return &m_rings.back();
 }
 
+void
+coordinator :: partitions_changed(size_t ring_idx, const std::vector<unsigned>& changed)
+{
+    for (size_t i = 0; i < changed.size(); ++i)
+    {
+        m_kvs_dirty.push_back((uint64_t(ring_idx) << 32) | changed[i]);
+    }
+}
+
 void
 coordinator :: maintain_kvs_rings(rsm_context* ctx)
 {
@@ -1326,6 +1953,13 @@ coordinator :: maintain_kvs_rings(rsm_context* ctx)
 
     for (size_t i = 0; i < m_dcs.size(); ++i)
     {
+        // rings of data centers whose servers did not change are left as is
+        if (std::find(m_kvss_changed_dcs.begin(), m_kvss_changed_dcs.end(), m_dcs[i].id) ==
+                m_kvss_changed_dcs.end())
+        {
+            continue;
+        }
+
         ring* r = get_or_create_ring(m_dcs[i].id);
         std::vector<comm_id> kvss;
         select_active_by_data_center(m_kvss, m_dcs[i].id, &kvss);
@@ -1335,17 +1969,26 @@ coordinator :: maintain_kvs_rings(rsm_context* ctx)
             continue;
         }
 
-        comm_id current_owners[CONSUS_KVS_PARTITIONS];
-        r->get_owners(current_owners);
-        comm_id new_owners[CONSUS_KVS_PARTITIONS];
-        stable_marriage(current_owners, new_owners, kvss.size());
-        unassign_discontinuous(current_owners, new_owners);
-        assign_unassigned(new_owners, &kvss[0], kvss.size());
-        r->set_owners(new_owners, &m_counter);
+        std::vector<uint64_t> capacities;
+
+        for (size_t k = 0; k < kvss.size(); ++k)
+        {
+            kvs_state* kv = get_kvs(kvss[k]);
+            assert(kv);
+            capacities.push_back(kv->kv.capacity);
+        }
+
+        std::vector<comm_id> current_owners;
+        r->get_owners(&current_owners);
+        std::vector<comm_id> new_owners;
+        weighted_assignment(current_owners, kvss, capacities, &new_owners);
+        std::vector<unsigned> changed;
+        r->set_owners(new_owners, &m_counter, &changed);
+        partitions_changed(r - &m_rings[0], changed);
         std::vector<assignment> assignments;
         std::vector<reassignment> reassignments;
 
-        for (unsigned p = 0; p < CONSUS_KVS_PARTITIONS; ++p)
+        for (unsigned p = 0; p < new_owners.size(); ++p)
         {
             if (new_owners[p] == comm_id())
             {
@@ -1365,6 +2008,182 @@ coordinator :: maintain_kvs_rings(rsm_context* ctx)
         log_assignments(ctx, m_dcs[i].name, &assignments);
         log_reassignments(ctx, "reassigning", m_dcs[i].name, &reassignments);
     }
+
+    m_kvss_changed_dcs.clear();
+}
+
+bool
+coordinator :: rebalance_hot_partitions(rsm_context* ctx)
+{
+    // a server is overloaded once it serves this much more than the mean of
+    // its data center, and at most this many partitions move off it at once
+    const uint64_t LOAD_IMBALANCE_PERCENT = 150;
+    const unsigned LOAD_MAX_MOVE_FRACTION = 16;
+    bool ret = false;
+
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        ring* r = &m_rings[i];
+        const unsigned parts = r->partitions.size();
+        const unsigned max_move = std::max(parts / LOAD_MAX_MOVE_FRACTION, 1U);
+        bool migrating = false;
+
+        for (unsigned p = 0; p < parts; ++p)
+        {
+            if (r->partitions[p].next_owner != comm_id())
+            {
+                migrating = true;
+                break;
+            }
+        }
+
+        // let earlier moves land before judging the load again
+        if (migrating)
+        {
+            continue;
+        }
+
+        std::vector<const kvs_load*> loads;
+        uint64_t total = 0;
+
+        for (size_t j = 0; j < m_kvs_loads.size(); ++j)
+        {
+            kvs_state* kv = get_kvs(m_kvs_loads[j].id);
+
+            if (kv && kv->kv.dc == r->dc)
+            {
+                loads.push_back(&m_kvs_loads[j]);
+                total += m_kvs_loads[j].requests;
+            }
+        }
+
+        if (loads.size() < 2 || total == 0)
+        {
+            continue;
+        }
+
+        const kvs_load* hot = loads[0];
+
+        for (size_t j = 1; j < loads.size(); ++j)
+        {
+            if (loads[j]->requests > hot->requests)
+            {
+                hot = loads[j];
+            }
+        }
+
+        if (hot->requests * loads.size() * 100 <= total * LOAD_IMBALANCE_PERCENT)
+        {
+            continue;
+        }
+
+        std::vector<comm_id> owners;
+        r->get_owners(&owners);
+        const partition_load* pl = NULL;
+
+        // the hottest slot in a partition the server owns, rather than
+        // replicates
+        for (size_t j = 0; !pl && j < hot->hottest.size(); ++j)
+        {
+            if (owners[r->partition_for(hot->hottest[j].index)] == hot->id)
+            {
+                pl = &hot->hottest[j];
+            }
+        }
+
+        if (!pl)
+        {
+            continue;
+        }
+
+        const unsigned hottest = r->partition_for(pl->index);
+        unsigned lo = hottest;
+        unsigned hi = hottest;
+
+        while (lo > 0 && owners[lo - 1] == hot->id)
+        {
+            --lo;
+        }
+
+        while (hi + 1 < parts && owners[hi + 1] == hot->id)
+        {
+            ++hi;
+        }
+
+        // hand the hot partition, and everything between it and the edge of
+        // the range, to the neighbor on the shorter side
+        unsigned begin = 0;
+        unsigned end = 0;
+        comm_id to;
+
+        if (lo > 0 && (hottest - lo <= hi - hottest || hi + 1 == parts))
+        {
+            begin = lo;
+            end = hottest + 1;
+            to = owners[lo - 1];
+        }
+        else if (hi + 1 < parts)
+        {
+            begin = hottest;
+            end = hi + 1;
+            to = owners[hi + 1];
+        }
+
+        // the server keeps at least one partition
+        if (to == comm_id() || end - begin > max_move || end - begin > hi - lo)
+        {
+            continue;
+        }
+
+        kvs_state* kv = get_kvs(to);
+
+        if (!kv || kv->state != kvs_state::ONLINE)
+        {
+            continue;
+        }
+
+        uint64_t moved = 0;
+        uint64_t to_requests = 0;
+
+        for (size_t j = 0; j < hot->hottest.size(); ++j)
+        {
+            const unsigned p = r->partition_for(hot->hottest[j].index);
+
+            if (p >= begin && p < end)
+            {
+                moved += hot->hottest[j].requests;
+            }
+        }
+
+        for (size_t j = 0; j < loads.size(); ++j)
+        {
+            if (loads[j]->id == to)
+            {
+                to_requests = loads[j]->requests;
+            }
+        }
+
+        // only move if the neighbor stays cooler than the server would be
+        if (moved > hot->requests || to_requests + moved >= hot->requests - moved)
+        {
+            continue;
+        }
+
+        for (unsigned p = begin; p < end; ++p)
+        {
+            owners[p] = to;
+        }
+
+        std::vector<unsigned> changed;
+        r->set_owners(owners, &m_counter, &changed);
+        partitions_changed(i, changed);
+        rsm_log(ctx, "moving partitions %u-%u from kvs(%" PRIu64 ") to kvs(%" PRIu64 ") "
+                     "because it served %" PRIu64 " of %" PRIu64 " requests in its data center\n",
+                     begin, end - 1, hot->id.get(), to.get(), hot->requests, total);
+        ret = true;
+    }
+
+    return ret;
 }
 
 bool
@@ -1379,8 +2198,9 @@ coordinator :: finish_migrations(rsm_context* ctx)
     for (size_t i = 0; i < m_rings.size(); ++i)
     {
         std::vector<reassignment> reassignments;
+        std::vector<unsigned> changed;
 
-        for (unsigned p = 0; p < CONSUS_KVS_PARTITIONS; ++p)
+        for (unsigned p = 0; p < m_rings[i].partitions.size(); ++p)
         {
             partition* part = &m_rings[i].partitions[p];
 
@@ -1394,9 +2214,11 @@ coordinator :: finish_migrations(rsm_context* ctx)
                 part->owner = part->next_owner;
                 part->next_id = partition_id();
                 part->next_owner = comm_id();
+                changed.push_back(p);
             }
         }
 
+        partitions_changed(i, changed);
         data_center* dc = get_data_center(m_rings[i].dc);
         assert(dc);
         log_reassignments(ctx, "migrated", dc->name, &reassignments);
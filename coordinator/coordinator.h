@@ -39,9 +39,11 @@
 #include "common/data_center.h"
 #include "common/ids.h"
 #include "common/kvs.h"
+#include "common/kvs_load.h"
 #include "common/kvs_state.h"
 #include "common/paxos_group.h"
 #include "common/ring.h"
+#include "common/table_config.h"
 #include "common/txman.h"
 #include "common/txman_state.h"
 
@@ -63,16 +65,25 @@ class coordinator
         data_center* get_data_center(data_center_id id);
         data_center* get_data_center(const std::string& name);
         data_center* new_data_center(const std::string& name);
-        void data_center_create(rsm_context* ctx, const std::string& name);
+        void data_center_create(rsm_context* ctx, const std::string& name, bool read_replica);
         void data_center_default(rsm_context* ctx, const std::string& name);
+        // double the partitions of the data center's ring
+        void data_center_split_partitions(rsm_context* ctx, const std::string& name);
 
     // transaction managers
     public:
         txman_state* get_txman(comm_id tx);
         txman_state* new_txman(const txman& t);
-        void txman_register(rsm_context* ctx, const txman& t, const std::string& data_center);
+        // standby_for is comm_id() unless t is to be a warm standby
+        void txman_register(rsm_context* ctx, const txman& t, const std::string& data_center,
+                            comm_id standby_for);
         void txman_online(rsm_context* ctx, comm_id id, const po6::net::location& bind_to, uint64_t nonce);
         void txman_offline(rsm_context* ctx, comm_id id, const po6::net::location& bind_to, uint64_t nonce);
+        // primary reports whether standby holds every record it still needs
+        void txman_standby_synced(rsm_context* ctx, comm_id primary, comm_id standby, bool synced);
+        // 0 returns the group to majority quorums
+        void txman_group_set_quorum(rsm_context* ctx, paxos_group_id id, uint64_t phase2);
+        void txman_group_set_witness(rsm_context* ctx, paxos_group_id id, comm_id tx, bool witness);
 
     // key value stores
     public:
@@ -82,11 +93,28 @@ class coordinator
         void kvs_online(rsm_context* ctx, comm_id id, const po6::net::location& bind_to, uint64_t nonce);
         void kvs_offline(rsm_context* ctx, comm_id id, const po6::net::location& bind_to, uint64_t nonce);
         void kvs_migrated(rsm_context* ctx, partition_id part);
+        void kvs_migrated_batch(rsm_context* ctx, const std::vector<partition_id>& parts);
+        void kvs_load_report(rsm_context* ctx, const kvs_load& load);
+
+    // tables
+    public:
+        table_config* get_table(const std::string& name);
+        void table_set_replication(rsm_context* ctx, const std::string& name, uint64_t replication);
+        // a table's data stays where it was written, so its home is
+        // permanent once set
+        void table_set_home(rsm_context* ctx, const std::string& name, const std::string& dc_name);
+
+    // backups
+    public:
+        void kvs_export(rsm_context* ctx, uint64_t timestamp);
 
     // maintenance
     public:
         void is_stable(rsm_context* ctx);
         void tick(rsm_context* ctx);
+        // every key value store compacts the data of partitions first
+        // through last, as in the top sixteen bits of a key's hash
+        void kvs_compact(rsm_context* ctx, uint16_t first, uint16_t last);
 
     // backup/restore
     public:
@@ -99,11 +127,19 @@ class coordinator
     private:
         void generate_next_configuration(rsm_context* ctx);
         void txman_availability_changed();
-        void kvs_availability_changed();
-        void regenerate_paxos_groups(rsm_context* ctx);
+        void kvs_availability_changed(data_center_id dc);
+        // put primary's synced standby in its place in every group; false if
+        // it has none ready
+        bool swap_in_standby(rsm_context* ctx, comm_id primary);
+        // put an online witness in member's place in each group that has one
+        void promote_witnesses(rsm_context* ctx, comm_id member);
+        // true if any group was added
+        bool regenerate_paxos_groups(rsm_context* ctx);
         ring* get_or_create_ring(data_center_id id);
+        void partitions_changed(size_t ring_idx, const std::vector<unsigned>& changed);
         void maintain_kvs_rings(rsm_context* ctx);
         bool finish_migrations(rsm_context* ctx);
+        bool rebalance_hot_partitions(rsm_context* ctx);
 
     private:
         // meta state
@@ -120,13 +156,42 @@ class coordinator
         std::vector<paxos_group> m_txman_groups;
         unsigned m_txman_quiescence_counter;
         bool m_txmans_changed;
+        // ticks since the last change to a group's phase 2 quorums; groups
+        // keep joint quorums until it reaches the limit in tick
+        unsigned m_txman_quorum_counter;
         // key value stores
         std::vector<kvs_state> m_kvss;
         unsigned m_kvs_quiescence_counter;
         bool m_kvss_changed;
+        // data centers whose rings maintain_kvs_rings must revisit
+        std::vector<data_center_id> m_kvss_changed_dcs;
         // rings
         std::vector<ring> m_rings;
         std::vector<partition_id> m_migrated;
+        // the latest traffic report from each key value store, discarded
+        // every time rebalance_hot_partitions runs
+        std::vector<kvs_load> m_kvs_loads;
+        unsigned m_kvs_load_counter;
+        // partitions changed since the last kvs configuration, as
+        // (ring index << 32 | partition index), and how many rings it had;
+        // zero after a split, so that the next delta is marked full
+        std::vector<uint64_t> m_kvs_dirty;
+        uint64_t m_kvs_dirty_base_rings;
+        // the published delta is against this version, and carries every
+        // partition changed since; any daemon at or past it may apply it
+        version_id m_kvs_delta_base;
+        std::vector<uint64_t> m_kvs_delta_since;
+        // tables
+        std::vector<table_config> m_tables;
+        // every key value store exports the newest version at or before
+        // this timestamp of each key it leads; 0 if never requested
+        uint64_t m_export_timestamp;
+        // every key value store compacts the partitions in
+        // [m_compaction_first, m_compaction_last] once for each new value
+        // of m_compaction; 0 if never requested
+        uint64_t m_compaction;
+        uint16_t m_compaction_first;
+        uint16_t m_compaction_last;
 
     private:
         coordinator(const coordinator&);
@@ -43,13 +43,23 @@ struct state_machine CONSUS_API rsm = {
     {{"init", consus_coordinator_init},
      {"data_center_create", consus_coordinator_data_center_create},
      {"data_center_default", consus_coordinator_data_center_default},
+     {"data_center_split_partitions", consus_coordinator_data_center_split_partitions},
      {"txman_register", consus_coordinator_txman_register},
      {"txman_online", consus_coordinator_txman_online},
      {"txman_offline", consus_coordinator_txman_offline},
+     {"txman_standby_synced", consus_coordinator_txman_standby_synced},
+     {"txman_group_set_quorum", consus_coordinator_txman_group_set_quorum},
+     {"txman_group_set_witness", consus_coordinator_txman_group_set_witness},
      {"kvs_register", consus_coordinator_kvs_register},
      {"kvs_online", consus_coordinator_kvs_online},
      {"kvs_offline", consus_coordinator_kvs_offline},
      {"kvs_migrated", consus_coordinator_kvs_migrated},
+     {"kvs_migrated_batch", consus_coordinator_kvs_migrated_batch},
+     {"kvs_load_report", consus_coordinator_kvs_load_report},
+     {"table_set_replication", consus_coordinator_table_set_replication},
+     {"table_set_home", consus_coordinator_table_set_home},
+     {"kvs_export", consus_coordinator_kvs_export},
+     {"kvs_compact", consus_coordinator_kvs_compact},
      {"is_stable", consus_coordinator_is_stable},
      {"tick", consus_coordinator_tick},
      {NULL, NULL}}
@@ -73,6 +73,7 @@ consus_coordinator_create(rsm_context* ctx)
     rsm_cond_create(ctx, "clientconf");
     rsm_cond_create(ctx, "txmanconf");
     rsm_cond_create(ctx, "kvsconf");
+    rsm_cond_create(ctx, "kvsdelta");
     return new (std::nothrow) coordinator();
 }
 
@@ -106,10 +107,18 @@ consus_coordinator_data_center_create(rsm_context* ctx, void* obj, const char* d
 {
     PROTECT_UNINITIALIZED;
     e::slice name;
+    uint8_t read_replica = 0;
     e::unpacker up(data, data_sz);
     up = up >> name;
+
+    // clients predating read replicas send none
+    if (!up.error() && up.remain())
+    {
+        up = up >> read_replica;
+    }
+
     CHECK_UNPACK(data_center_create);
-    c->data_center_create(ctx, name.str());
+    c->data_center_create(ctx, name.str(), read_replica != 0);
 }
 
 CONSUS_API void
@@ -123,6 +132,17 @@ consus_coordinator_data_center_default(rsm_context* ctx, void* obj, const char*
     c->data_center_default(ctx, name.str());
 }
 
+CONSUS_API void
+consus_coordinator_data_center_split_partitions(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    e::slice name;
+    e::unpacker up(data, data_sz);
+    up = up >> name;
+    CHECK_UNPACK(data_center_split_partitions);
+    c->data_center_split_partitions(ctx, name.str());
+}
+
 CONSUS_API void
 consus_coordinator_txman_register(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
 {
@@ -130,11 +150,29 @@ consus_coordinator_txman_register(rsm_context* ctx, void* obj, const char* data,
     comm_id id;
     po6::net::location bind_to;
     e::slice data_center;
+    comm_id standby_for;
+    e::slice zone;
+    e::slice rack;
     e::unpacker up(data, data_sz);
     up = up >> id >> bind_to >> data_center;
+
+    // only warm standbys name a primary; a null one precedes labels
+    if (!up.error() && up.remain())
+    {
+        up = up >> standby_for;
+    }
+
+    // daemons predating topology labels send none
+    if (!up.error() && up.remain())
+    {
+        up = up >> zone >> rack;
+    }
+
     CHECK_UNPACK(txman_register);
     txman t(id, bind_to);
-    c->txman_register(ctx, t, data_center.str());
+    t.zone = zone.str();
+    t.rack = rack.str();
+    c->txman_register(ctx, t, data_center.str(), standby_for);
 }
 
 CONSUS_API void
@@ -163,6 +201,44 @@ consus_coordinator_txman_offline(rsm_context* ctx, void* obj, const char* data,
     c->txman_offline(ctx, id, bind_to, nonce);
 }
 
+CONSUS_API void
+consus_coordinator_txman_standby_synced(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    comm_id primary;
+    comm_id standby;
+    uint8_t synced;
+    e::unpacker up(data, data_sz);
+    up = up >> primary >> standby >> synced;
+    CHECK_UNPACK(txman_standby_synced);
+    c->txman_standby_synced(ctx, primary, standby, synced != 0);
+}
+
+CONSUS_API void
+consus_coordinator_txman_group_set_quorum(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    paxos_group_id id;
+    uint64_t phase2;
+    e::unpacker up(data, data_sz);
+    up = up >> id >> phase2;
+    CHECK_UNPACK(txman_group_set_quorum);
+    c->txman_group_set_quorum(ctx, id, phase2);
+}
+
+CONSUS_API void
+consus_coordinator_txman_group_set_witness(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    paxos_group_id id;
+    comm_id tx;
+    uint8_t witness;
+    e::unpacker up(data, data_sz);
+    up = up >> id >> tx >> witness;
+    CHECK_UNPACK(txman_group_set_witness);
+    c->txman_group_set_witness(ctx, id, tx, witness != 0);
+}
+
 CONSUS_API void
 consus_coordinator_kvs_register(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
 {
@@ -170,10 +246,29 @@ consus_coordinator_kvs_register(rsm_context* ctx, void* obj, const char* data, s
     comm_id id;
     po6::net::location bind_to;
     e::slice data_center;
+    uint64_t capacity = 1;
+    e::slice zone;
+    e::slice rack;
     e::unpacker up(data, data_sz);
     up = up >> id >> bind_to >> data_center;
+
+    // daemons predating capacities send none
+    if (!up.error() && up.remain())
+    {
+        up = up >> capacity;
+    }
+
+    // nor do those predating topology labels
+    if (!up.error() && up.remain())
+    {
+        up = up >> zone >> rack;
+    }
+
     CHECK_UNPACK(kvs_register);
     kvs k(id, bind_to);
+    k.capacity = capacity > 0 ? capacity : 1;
+    k.zone = zone.str();
+    k.rack = rack.str();
     c->kvs_register(ctx, k, data_center.str());
 }
 
@@ -214,6 +309,75 @@ consus_coordinator_kvs_migrated(rsm_context* ctx, void* obj, const char* data, s
     c->kvs_migrated(ctx, id);
 }
 
+CONSUS_API void
+consus_coordinator_kvs_migrated_batch(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    std::vector<partition_id> ids;
+    e::unpacker up(data, data_sz);
+    up = up >> ids;
+    CHECK_UNPACK(kvs_migrated_batch);
+    c->kvs_migrated_batch(ctx, ids);
+}
+
+CONSUS_API void
+consus_coordinator_kvs_load_report(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    kvs_load load;
+    e::unpacker up(data, data_sz);
+    up = up >> load;
+    CHECK_UNPACK(kvs_load_report);
+    c->kvs_load_report(ctx, load);
+}
+
+CONSUS_API void
+consus_coordinator_table_set_replication(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    e::slice name;
+    uint64_t replication;
+    e::unpacker up(data, data_sz);
+    up = up >> name >> replication;
+    CHECK_UNPACK(table_set_replication);
+    c->table_set_replication(ctx, name.str(), replication);
+}
+
+CONSUS_API void
+consus_coordinator_table_set_home(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    e::slice name;
+    e::slice dc_name;
+    e::unpacker up(data, data_sz);
+    up = up >> name >> dc_name;
+    CHECK_UNPACK(table_set_home);
+    c->table_set_home(ctx, name.str(), dc_name.str());
+}
+
+CONSUS_API void
+consus_coordinator_kvs_export(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    uint64_t timestamp;
+    e::unpacker up(data, data_sz);
+    up = up >> timestamp;
+    CHECK_UNPACK(kvs_export);
+    c->kvs_export(ctx, timestamp);
+}
+
+CONSUS_API void
+consus_coordinator_kvs_compact(rsm_context* ctx, void* obj, const char* data, size_t data_sz)
+{
+    PROTECT_UNINITIALIZED;
+    uint16_t first;
+    uint16_t last;
+    e::unpacker up(data, data_sz);
+    up = up >> first >> last;
+    CHECK_UNPACK(kvs_compact);
+    c->kvs_compact(ctx, first, last);
+}
+
 CONSUS_API void
 consus_coordinator_is_stable(rsm_context* ctx, void* obj, const char*, size_t)
 {
@@ -56,15 +56,26 @@ TRANSITION(init);
 
 TRANSITION(data_center_create);
 TRANSITION(data_center_default);
+TRANSITION(data_center_split_partitions);
 
 TRANSITION(txman_register);
 TRANSITION(txman_online);
 TRANSITION(txman_offline);
+TRANSITION(txman_standby_synced);
+TRANSITION(txman_group_set_quorum);
+TRANSITION(txman_group_set_witness);
 
 TRANSITION(kvs_register);
 TRANSITION(kvs_online);
 TRANSITION(kvs_offline);
 TRANSITION(kvs_migrated);
+TRANSITION(kvs_migrated_batch);
+TRANSITION(kvs_load_report);
+
+TRANSITION(table_set_replication);
+TRANSITION(table_set_home);
+TRANSITION(kvs_export);
+TRANSITION(kvs_compact);
 
 TRANSITION(is_stable);
 TRANSITION(tick);
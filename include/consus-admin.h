@@ -39,8 +39,50 @@ extern "C"
 
 int consus_admin_create_data_center(struct consus_client* client, const char* name,
                                     enum consus_returncode* status);
+/* a read replica holds a full copy of every table for stale reads, but is
+ * never part of a transaction's quorum */
+int consus_admin_create_read_replica(struct consus_client* client, const char* name,
+                                     enum consus_returncode* status);
 int consus_admin_set_default_data_center(struct consus_client* client, const char* name,
                                          enum consus_returncode* status);
+/* double the partitions of data_center's ring without moving any data;
+ * refused while partitions are migrating */
+int consus_admin_split_partitions(struct consus_client* client, const char* data_center,
+                                  enum consus_returncode* status);
+int consus_admin_set_table_replication(struct consus_client* client, const char* table,
+                                       unsigned replication,
+                                       enum consus_returncode* status);
+/* keep table only in data_center, where transactions that touch nothing
+ * homed elsewhere commit without other data centers; permanent, so set it
+ * before the table holds data */
+int consus_admin_set_table_home(struct consus_client* client, const char* table,
+                                const char* data_center,
+                                enum consus_returncode* status);
+/* commit on phase2 of group's transaction managers, enlarging the quorums
+ * that take over the group to intersect; 0 restores majorities.  The group
+ * uses quorums that satisfy both sizes for a while after each change, and
+ * refuses another change until then */
+int consus_admin_set_group_quorum(struct consus_client* client, uint64_t group,
+                                  unsigned phase2,
+                                  enum consus_returncode* status);
+/* add (witness != 0) or remove the transaction manager txman as a witness of
+ * group; witnesses log the group's work but never count toward its quorums,
+ * and one takes the place of a member that fails */
+int consus_admin_set_group_witness(struct consus_client* client, uint64_t group,
+                                   uint64_t txman, int witness,
+                                   enum consus_returncode* status);
+/* every key value store writes the newest version at or before timestamp of
+ * each key it leads to its data directory; 0 picks the current time, and
+ * *timestamp holds the one used */
+int consus_admin_export(struct consus_client* client, uint64_t* timestamp,
+                        enum consus_returncode* status);
+/* every key value store compacts the data of partitions first through last,
+ * numbered by the top sixteen bits of a key's hash, a step at a time while
+ * its foreground traffic allows; a store that is not split by partition
+ * compacts all of its data */
+int consus_admin_compact(struct consus_client* client,
+                         uint16_t first, uint16_t last,
+                         enum consus_returncode* status);
 
 struct consus_availability_requirements
 {
@@ -46,6 +46,8 @@ enum consus_returncode
     CONSUS_NOT_FOUND    = 6658,
     CONSUS_ABORTED      = 6659,
     CONSUS_COMMITTED    = 6660,
+    CONSUS_SCAN_DONE    = 6661,
+    CONSUS_COMPARE_FAILED = 6662,
 
     /* persistent/programmatic errors */
     CONSUS_UNKNOWN_TABLE    = 6720,
@@ -59,6 +61,7 @@ enum consus_returncode
     CONSUS_COORD_FAIL   = 6787,
     CONSUS_UNAVAILABLE  = 6788,
     CONSUS_SERVER_ERROR = 6789,
+    CONSUS_BUSY         = 6790,
 
     /* this should never happen */
     CONSUS_INTERNAL     = 6910,
@@ -70,13 +73,43 @@ struct consus_transaction;
 
 struct consus_client* consus_create(const char* coordinator, uint16_t port);
 struct consus_client* consus_create_conn_str(const char* conn_str);
+/* Like consus_create_conn_str, but reach the transaction managers through
+ * the consus-proxy listening on proxy_host:proxy_port, which also supplies
+ * the configuration.  The coordinator is contacted only for the admin and
+ * debug calls. */
+struct consus_client* consus_create_via_proxy(const char* conn_str,
+                                              const char* proxy_host,
+                                              uint16_t proxy_port);
 void consus_destroy(struct consus_client* client);
+/* Let many threads share client, its connections, and its configuration.
+ * Call it before anything else; afterwards consus_loop and consus_wait
+ * return only the calling thread's operations, and error messages are kept
+ * per thread.  A transaction must stay with the thread that began it. */
+void consus_threadsafe(struct consus_client* client);
+/* Re-send a transactional read to a second transaction manager of the group
+ * once it has gone unanswered for the given percentile (1-99) of recent read
+ * latencies, and keep whichever answer comes first.  0, the default, turns
+ * hedging off. */
+void consus_hedge_reads(struct consus_client* client, unsigned percentile);
 
 int64_t consus_loop(struct consus_client* client, int timeout,
                     enum consus_returncode* status);
 int64_t consus_wait(struct consus_client* client, int64_t id, int timeout,
                     enum consus_returncode* status);
+/* Like consus_loop, but returns up to ids_sz completed operations at once,
+ * writing their IDs to ids and their statuses to statuses.  It waits up to
+ * timeout for the first completion and then takes only what has already
+ * arrived.  Returns how many completed, or -1 with status set;
+ * consus_error_message describes the last operation returned. */
+int64_t consus_loop_many(struct consus_client* client, int timeout,
+                         int64_t* ids, enum consus_returncode* statuses,
+                         size_t ids_sz, enum consus_returncode* status);
 
+/* The descriptor becomes readable when the client has work to do; then call
+ * consus_loop_many with a timeout of 0.  Completions it had no room for stay
+ * queued without making the descriptor readable, so call it again until it
+ * returns fewer than ids_sz before waiting.  consus_block waits on the
+ * descriptor itself, waking early when a hedged read is due. */
 int consus_poll_fd(struct consus_client* client);
 int consus_block(struct consus_client* client, int timeout);
 
@@ -84,16 +117,115 @@ const char* consus_error_message(struct consus_client* client);
 const char* consus_error_location(struct consus_client* client);
 const char* consus_returncode_to_string(enum consus_returncode);
 
+/* Completes with CONSUS_BUSY when every transaction manager tried is shedding
+ * load; back off before trying again. */
 int64_t consus_begin_transaction(struct consus_client* client,
                                  enum consus_returncode* status,
                                  struct consus_transaction** xact);
+
+/* Keys a transaction expects to touch, declared when it begins.  Keys are
+ * binary, as for consus_get_bin.  The transaction manager locks every
+ * declared key at once, exclusively where CONSUS_HINT_WRITE is set, and
+ * fetches those marked CONSUS_HINT_READ before the client asks, so that a
+ * transaction of known shape executes in about one round trip.  Hints are
+ * advisory:  operations on undeclared keys proceed as usual, and a key
+ * declared but never touched is merely locked until the transaction ends.
+ * At most 256 keys may be declared. */
+enum consus_key_hint_flags
+{
+    CONSUS_HINT_READ    = 1,
+    CONSUS_HINT_WRITE   = 2
+};
+
+struct consus_key_hint
+{
+    const char* table;
+    const char* key;
+    size_t key_sz;
+    unsigned flags;
+};
+
+int64_t consus_begin_transaction_declared(struct consus_client* client,
+                                          const struct consus_key_hint* hints,
+                                          size_t hints_sz,
+                                          enum consus_returncode* status,
+                                          struct consus_transaction** xact);
+/* A transaction's operations may be issued without waiting for earlier ones,
+ * up to 256 past the oldest not yet returned by consus_loop or consus_wait.
+ * Beyond that they fail at once with CONSUS_BUSY; return some and retry. */
 int64_t consus_commit_transaction(struct consus_transaction* xact,
                                   enum consus_returncode* status);
 int64_t consus_abort_transaction(struct consus_transaction* xact,
                                  enum consus_returncode* status);
+/* Begin a fresh attempt of an aborted xact in place.  The new attempt keeps
+ * the priority of the first, so a transaction retried this way eventually
+ * outranks those that keep wounding it.  Earlier reads and writes are
+ * discarded. */
 int64_t consus_restart_transaction(struct consus_transaction* xact,
                                    enum consus_returncode* status);
 void consus_destroy_transaction(struct consus_transaction* xact);
+/* Hold every later put of xact in the client and send them all with the
+ * commit, so that the transaction manager replicates and locks the whole write
+ * set at once.  Buffered puts complete immediately; errors they would have
+ * reported surface from the commit. */
+void consus_buffer_writes(struct consus_transaction* xact);
+
+/* Run body in a transaction and commit it, retrying with jittered exponential
+ * backoff (1 ms doubling up to 256 ms) whenever body or the commit reports
+ * CONSUS_ABORTED.  body waits for its own operations and returns
+ * CONSUS_SUCCESS to commit or CONSUS_ABORTED to retry; any other code aborts
+ * the transaction and is returned as is.  Gives up with CONSUS_ABORTED after
+ * max_attempts attempts, or never when it is 0.  Blocks the calling thread;
+ * do not use it alongside consus_loop on the same client. */
+typedef enum consus_returncode (*consus_transaction_body)(struct consus_transaction* xact,
+                                                          void* arg);
+enum consus_returncode consus_run_transaction(struct consus_client* client,
+                                              consus_transaction_body body, void* arg,
+                                              unsigned max_attempts);
+
+/* Read key outside of any transaction from the nearest replica.  The value is
+ * the newest version at or before timestamp (UINT64_MAX for the newest the
+ * replica holds) that the replica has, and may miss writes that have not yet
+ * reached it.  Nothing bounds how far behind that replica may be, so a read
+ * at timestamp is not a snapshot as of timestamp; use it only where any
+ * previously committed value will do. */
+int64_t consus_stale_get(struct consus_client* client,
+                         const char* table,
+                         const char* key, size_t key_sz,
+                         uint64_t timestamp,
+                         enum consus_returncode* status,
+                         char** value, size_t* value_sz);
+
+/* Read, write, or compare-and-swap one key outside of any transaction.  Each
+ * takes the key's lock for just long enough to do its work, so it is
+ * linearizable with respect to transactions and other single-key operations,
+ * but costs one round trip to a transaction manager and none of the logging
+ * or voting of a transaction.  Keys and values are binary, as for
+ * consus_get_bin, and are copied; values returned by consus_single_get are
+ * NUL-terminated and must be released with free().  consus_single_cas writes
+ * value only if key holds expected or, when expected is NULL, only if key does
+ * not exist, and otherwise completes with CONSUS_COMPARE_FAILED.  A put or
+ * compare-and-swap interrupted by a server failure completes with
+ * CONSUS_UNAVAILABLE and may or may not have been applied.  All three skip
+ * the vote that keeps data centers in agreement, so they complete with
+ * CONSUS_INVALID unless one data center alone holds the table (see
+ * consus_admin_set_table_home) or there is only one data center. */
+int64_t consus_single_get(struct consus_client* client,
+                          const char* table,
+                          const char* key, size_t key_sz,
+                          enum consus_returncode* status,
+                          char** value, size_t* value_sz);
+int64_t consus_single_put(struct consus_client* client,
+                          const char* table,
+                          const char* key, size_t key_sz,
+                          const char* value, size_t value_sz,
+                          enum consus_returncode* status);
+int64_t consus_single_cas(struct consus_client* client,
+                          const char* table,
+                          const char* key, size_t key_sz,
+                          const char* expected, size_t expected_sz,
+                          const char* value, size_t value_sz,
+                          enum consus_returncode* status);
 
 int64_t consus_get(struct consus_transaction* xact,
                    const char* table,
@@ -106,6 +238,102 @@ int64_t consus_put(struct consus_transaction* xact,
                    const char* value, size_t value_sz,
                    enum consus_returncode* status);
 
+/* Binary variants of consus_get/consus_put:  keys and values are raw bytes
+ * rather than JSON, and are not copied, so they must remain valid until the
+ * operation completes.  Values returned by consus_get_bin are NUL-terminated
+ * for convenience and must be released with free(). */
+int64_t consus_get_bin(struct consus_transaction* xact,
+                       const char* table,
+                       const char* key, size_t key_sz,
+                       enum consus_returncode* status,
+                       char** value, size_t* value_sz);
+int64_t consus_put_bin(struct consus_transaction* xact,
+                       const char* table,
+                       const char* key, size_t key_sz,
+                       const char* value, size_t value_sz,
+                       enum consus_returncode* status);
+/* Like consus_get_bin, but the value is copied straight out of the response
+ * into buf, which must remain valid until the operation completes; nothing is
+ * allocated and no NUL is appended.  value_sz is set to the size of the value
+ * even when it exceeds buf_sz, in which case buf is left untouched and the
+ * operation completes with CONSUS_INVALID so the caller may retry with a
+ * larger buffer. */
+int64_t consus_get_into(struct consus_transaction* xact,
+                        const char* table,
+                        const char* key, size_t key_sz,
+                        enum consus_returncode* status,
+                        char* buf, size_t buf_sz, size_t* value_sz);
+
+/* Write value to key only if key currently holds expected, or, when expected
+ * is NULL, only if key does not exist.  The transaction manager reads and
+ * decides in one round trip; the key stays locked either way.  Completes with
+ * CONSUS_SUCCESS once written or CONSUS_COMPARE_FAILED if the condition does
+ * not hold.  Comparisons are of the binary forms of expected and the stored
+ * value. */
+int64_t consus_cond_put(struct consus_transaction* xact,
+                        const char* table,
+                        const char* key, size_t key_sz,
+                        const char* expected, size_t expected_sz,
+                        const char* value, size_t value_sz,
+                        enum consus_returncode* status);
+int64_t consus_cond_put_bin(struct consus_transaction* xact,
+                            const char* table,
+                            const char* key, size_t key_sz,
+                            const char* expected, size_t expected_sz,
+                            const char* value, size_t value_sz,
+                            enum consus_returncode* status);
+
+/* Update key in place at the transaction manager, without a read by the
+ * client.  Counters are 8-byte big-endian two's complement integers and a
+ * missing key counts as 0; consus_add adds delta and consus_max keeps the
+ * larger value.  Sets are sorted, distinct members, each length-prefixed the
+ * way Consus packs any slice; consus_set_add inserts member.  Keys are binary.
+ * Completes with CONSUS_SUCCESS, or CONSUS_INVALID if the stored value is not
+ * of the right form.  The key stays locked until the transaction ends. */
+int64_t consus_add(struct consus_transaction* xact,
+                   const char* table,
+                   const char* key, size_t key_sz,
+                   int64_t delta,
+                   enum consus_returncode* status);
+int64_t consus_max(struct consus_transaction* xact,
+                   const char* table,
+                   const char* key, size_t key_sz,
+                   int64_t value,
+                   enum consus_returncode* status);
+int64_t consus_set_add(struct consus_transaction* xact,
+                       const char* table,
+                       const char* key, size_t key_sz,
+                       const char* member, size_t member_sz,
+                       enum consus_returncode* status);
+
+/* Issue n reads (or writes) against one table in a single round trip to the
+ * transaction manager.  The arrays must hold n entries; values[i] is set to
+ * NULL if keys[i] does not exist. */
+int64_t consus_multi_get(struct consus_transaction* xact,
+                         const char* table,
+                         const char* const* keys, const size_t* keys_sz, size_t n,
+                         enum consus_returncode* status,
+                         char** values, size_t* values_sz);
+int64_t consus_multi_put(struct consus_transaction* xact,
+                         const char* table,
+                         const char* const* keys, const size_t* keys_sz,
+                         const char* const* values, const size_t* values_sz,
+                         size_t n, enum consus_returncode* status);
+
+/* Read the first n keys >= key in table.  The returned id comes back from
+ * consus_loop/consus_wait once per key with status CONSUS_SUCCESS and key_out
+ * and value set (release both with free()), and a final time with
+ * CONSUS_SCAN_DONE or an error.  Scans see the latest committed values but
+ * take no locks, so keys inserted into the range concurrently are not
+ * detected when the transaction commits. */
+int64_t consus_scan(struct consus_transaction* xact,
+                    const char* table,
+                    const char* key, size_t key_sz,
+                    uint64_t n,
+                    enum consus_returncode* status,
+                    char** key_out, size_t* key_out_sz,
+                    char** value, size_t* value_sz);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
@@ -0,0 +1,569 @@
+/* Copyright (c) 2015-2016, Robert Escriva, Cornell University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Consus nor the names of its contributors may be
+ *       used to endorse or promote products derived from this software without
+ *       specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef consus_hpp_
+#define consus_hpp_
+
+/* A C++17 interface to the client in consus.h.  Every operation returns a
+ * consus::future that completes when client::poll collects its result, so
+ * many operations may be in flight at once:
+ *
+ *     consus::client cl("127.0.0.1:1982");
+ *     consus::transaction tx = cl.begin_transaction().get();
+ *     std::vector<consus::future<std::optional<std::string>>> reads;
+ *     for (auto& k : keys) reads.push_back(tx.get("table", k));
+ *     auto values = consus::get_all(reads);
+ *     tx.put("table", "sum", total(values)).get();
+ *     tx.commit().get();
+ *
+ * future::get drives the client until the result is in.  Event-driven
+ * programs instead watch client::poll_fd, call client::poll(0) when it is
+ * readable, and chain work with future::then or, under C++20, co_await;
+ * continuations run through the client's executor, inline by default.
+ * A client, and everything begun from it, belongs to one thread at a time.
+ * Keys and values are binary, and are copied until their operation
+ * completes. */
+
+#if __cplusplus < 201703L
+#error "consus.hpp requires C++17"
+#endif
+
+/* STL */
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define CONSUS_COROUTINES 1
+#endif
+
+/* consus */
+#include <consus.h>
+
+namespace consus
+{
+
+class error : public std::runtime_error
+{
+    public:
+        error(consus_returncode status, const std::string& message)
+            : std::runtime_error(message), m_status(status) {}
+
+    public:
+        consus_returncode status() const { return m_status; }
+
+    private:
+        consus_returncode m_status;
+};
+
+/* Runs a completion's continuation; how a program hands completions to its
+ * own thread pool or event loop. */
+typedef std::function<void (std::function<void ()>)> executor;
+
+class client;
+class transaction;
+template <typename T> class future;
+
+namespace detail
+{
+
+struct begin_state;
+
+struct state_base
+{
+    state_base() : status(CONSUS_GARBAGE), done(false), cl(nullptr) {}
+    virtual ~state_base() {}
+
+    // turn what the C client wrote into the result
+    virtual void finish() {}
+    virtual bool succeeded() const
+    { return status == CONSUS_SUCCESS || status == CONSUS_LESS_DURABLE; }
+
+    consus_returncode status;
+    bool done;
+    std::string message;
+    client* cl;
+    std::function<void ()> continuation;
+    // copies of the arguments, valid until the operation completes
+    std::string table;
+    std::string key;
+    std::string value;
+    std::string expected;
+};
+
+template <typename T>
+struct state : state_base
+{
+    T take() { return std::move(*result); }
+    std::optional<T> result;
+};
+
+template <>
+struct state<void> : state_base
+{
+    void take() {}
+};
+
+} // namespace detail
+
+template <typename T>
+class future
+{
+    public:
+        future() : m_state() {}
+
+    public:
+        bool valid() const { return bool(m_state); }
+        bool ready() const { return m_state && m_state->done; }
+        // drive the client until the operation completes; throws
+        // consus::error if it failed
+        T get();
+        // run f(future) through the client's executor once complete
+        template <typename F> void then(F f);
+#ifdef CONSUS_COROUTINES
+        bool await_ready() const noexcept { return ready(); }
+        void await_suspend(std::coroutine_handle<> h)
+        { m_state->continuation = [h]() { h.resume(); }; }
+        T await_resume() { return get(); }
+#endif
+
+    private:
+        friend class client;
+        friend class transaction;
+        explicit future(std::shared_ptr<detail::state<T> > s) : m_state(std::move(s)) {}
+        std::shared_ptr<detail::state<T> > m_state;
+};
+
+class transaction
+{
+    public:
+        transaction(transaction&& other) noexcept;
+        transaction& operator = (transaction&& rhs) noexcept;
+        ~transaction();
+
+    public:
+        future<std::optional<std::string> > get(std::string_view table,
+                                                std::string_view key);
+        future<void> put(std::string_view table,
+                         std::string_view key,
+                         std::string_view value);
+        // write value if key holds expected or, without expected, does not
+        // exist; false if the condition did not hold
+        future<bool> cond_put(std::string_view table,
+                              std::string_view key,
+                              std::optional<std::string_view> expected,
+                              std::string_view value);
+        future<void> commit();
+        future<void> abort();
+        consus_transaction* handle() { return m_xact; }
+
+    private:
+        friend struct detail::begin_state;
+        friend class client;
+        transaction(client* cl, consus_transaction* xact) : m_cl(cl), m_xact(xact) {}
+        transaction(const transaction&) = delete;
+        transaction& operator = (const transaction&) = delete;
+
+    private:
+        client* m_cl;
+        consus_transaction* m_xact;
+};
+
+class client
+{
+    public:
+        explicit client(const char* conn_str);
+        client(const char* host, uint16_t port);
+        ~client();
+
+    public:
+        future<transaction> begin_transaction();
+        // readable whenever poll has something to do
+        int poll_fd() { return consus_poll_fd(m_cl); }
+        // complete every operation whose result has arrived, waiting up to
+        // timeout milliseconds (-1 forever) for the first; returns how many
+        size_t poll(int timeout);
+        void set_executor(executor ex) { m_executor = std::move(ex); }
+        consus_client* handle() { return m_cl; }
+
+    private:
+        friend class transaction;
+        template <typename T> friend class future;
+        template <typename T, typename S>
+        future<T> submit(int64_t id, std::shared_ptr<S> s);
+        void run(std::function<void ()> f);
+        client(const client&) = delete;
+        client& operator = (const client&) = delete;
+
+    private:
+        consus_client* m_cl;
+        executor m_executor;
+        std::unordered_map<int64_t, std::shared_ptr<detail::state_base> > m_ops;
+};
+
+namespace detail
+{
+
+struct begin_state : state<transaction>
+{
+    begin_state() : xact(nullptr) {}
+    virtual ~begin_state() { if (xact) consus_destroy_transaction(xact); }
+    virtual void finish()
+    {
+        if (succeeded())
+        {
+            result.emplace(transaction(cl, xact));
+            xact = nullptr;
+        }
+    }
+    consus_transaction* xact;
+};
+
+struct read_state : state<std::optional<std::string> >
+{
+    read_state() : out(nullptr), out_sz(0) {}
+    virtual ~read_state() { free(out); }
+    virtual bool succeeded() const
+    { return status == CONSUS_SUCCESS || status == CONSUS_NOT_FOUND; }
+    virtual void finish()
+    {
+        if (status == CONSUS_SUCCESS)
+        {
+            result.emplace(std::string(out, out_sz));
+        }
+        else if (status == CONSUS_NOT_FOUND)
+        {
+            result.emplace(std::nullopt);
+        }
+    }
+    char* out;
+    size_t out_sz;
+};
+
+struct cond_state : state<bool>
+{
+    virtual bool succeeded() const
+    { return status == CONSUS_SUCCESS || status == CONSUS_COMPARE_FAILED; }
+    virtual void finish() { result.emplace(status == CONSUS_SUCCESS); }
+};
+
+} // namespace detail
+
+template <typename T>
+T
+future<T> :: get()
+{
+    while (!m_state->done)
+    {
+        m_state->cl->poll(-1);
+    }
+
+    if (!m_state->succeeded())
+    {
+        throw error(m_state->status, m_state->message);
+    }
+
+    return m_state->take();
+}
+
+template <typename T>
+template <typename F>
+void
+future<T> :: then(F f)
+{
+    future<T> self(*this);
+
+    if (m_state->done)
+    {
+        m_state->cl->run([self, f]() mutable { f(self); });
+    }
+    else
+    {
+        m_state->continuation = [self, f]() mutable { f(self); };
+    }
+}
+
+template <typename T>
+std::vector<T>
+get_all(std::vector<future<T> >& fs)
+{
+    std::vector<T> results;
+    results.reserve(fs.size());
+
+    for (size_t i = 0; i < fs.size(); ++i)
+    {
+        results.push_back(fs[i].get());
+    }
+
+    return results;
+}
+
+inline
+client :: client(const char* conn_str)
+    : m_cl(consus_create_conn_str(conn_str))
+    , m_executor()
+    , m_ops()
+{
+    if (!m_cl)
+    {
+        throw std::bad_alloc();
+    }
+}
+
+inline
+client :: client(const char* host, uint16_t port)
+    : m_cl(consus_create(host, port))
+    , m_executor()
+    , m_ops()
+{
+    if (!m_cl)
+    {
+        throw std::bad_alloc();
+    }
+}
+
+inline
+client :: ~client()
+{
+    m_ops.clear();
+    consus_destroy(m_cl);
+}
+
+inline future<transaction>
+client :: begin_transaction()
+{
+    std::shared_ptr<detail::begin_state> s(new detail::begin_state());
+    int64_t id = consus_begin_transaction(m_cl, &s->status, &s->xact);
+    return submit<transaction>(id, s);
+}
+
+inline size_t
+client :: poll(int timeout)
+{
+    const size_t batch = 64;
+    int64_t ids[batch];
+    consus_returncode statuses[batch];
+    consus_returncode status;
+    size_t total = 0;
+
+    while (true)
+    {
+        int64_t n = consus_loop_many(m_cl, timeout, ids, statuses, batch, &status);
+
+        if (n < 0)
+        {
+            if (status == CONSUS_TIMEOUT || status == CONSUS_NONE_PENDING)
+            {
+                return total;
+            }
+
+            throw error(status, consus_error_message(m_cl));
+        }
+
+        for (int64_t i = 0; i < n; ++i)
+        {
+            auto it = m_ops.find(ids[i]);
+
+            if (it == m_ops.end())
+            {
+                continue;
+            }
+
+            std::shared_ptr<detail::state_base> s(std::move(it->second));
+            m_ops.erase(it);
+            s->finish();
+            s->done = true;
+
+            if (!s->succeeded())
+            {
+                s->message = consus_error_message(m_cl);
+            }
+
+            if (s->continuation)
+            {
+                std::function<void ()> c(std::move(s->continuation));
+                s->continuation = nullptr;
+                run(std::move(c));
+            }
+        }
+
+        total += n;
+
+        if (size_t(n) < batch)
+        {
+            return total;
+        }
+
+        timeout = 0;
+    }
+}
+
+template <typename T, typename S>
+future<T>
+client :: submit(int64_t id, std::shared_ptr<S> s)
+{
+    s->cl = this;
+
+    if (id < 0)
+    {
+        s->done = true;
+        s->message = consus_error_message(m_cl);
+    }
+    else
+    {
+        m_ops[id] = s;
+    }
+
+    return future<T>(s);
+}
+
+inline void
+client :: run(std::function<void ()> f)
+{
+    if (m_executor)
+    {
+        m_executor(std::move(f));
+    }
+    else
+    {
+        f();
+    }
+}
+
+inline
+transaction :: transaction(transaction&& other) noexcept
+    : m_cl(other.m_cl)
+    , m_xact(std::exchange(other.m_xact, nullptr))
+{
+}
+
+inline transaction&
+transaction :: operator = (transaction&& rhs) noexcept
+{
+    if (this != &rhs)
+    {
+        if (m_xact)
+        {
+            consus_destroy_transaction(m_xact);
+        }
+
+        m_cl = rhs.m_cl;
+        m_xact = std::exchange(rhs.m_xact, nullptr);
+    }
+
+    return *this;
+}
+
+inline
+transaction :: ~transaction()
+{
+    if (m_xact)
+    {
+        consus_destroy_transaction(m_xact);
+    }
+}
+
+inline future<std::optional<std::string> >
+transaction :: get(std::string_view table, std::string_view key)
+{
+    std::shared_ptr<detail::read_state> s(new detail::read_state());
+    s->table.assign(table);
+    s->key.assign(key);
+    int64_t id = consus_get_bin(m_xact, s->table.c_str(),
+                                s->key.data(), s->key.size(),
+                                &s->status, &s->out, &s->out_sz);
+    return m_cl->submit<std::optional<std::string> >(id, s);
+}
+
+inline future<void>
+transaction :: put(std::string_view table,
+                   std::string_view key,
+                   std::string_view value)
+{
+    std::shared_ptr<detail::state<void> > s(new detail::state<void>());
+    s->table.assign(table);
+    s->key.assign(key);
+    s->value.assign(value);
+    int64_t id = consus_put_bin(m_xact, s->table.c_str(),
+                                s->key.data(), s->key.size(),
+                                s->value.data(), s->value.size(),
+                                &s->status);
+    return m_cl->submit<void>(id, s);
+}
+
+inline future<bool>
+transaction :: cond_put(std::string_view table,
+                        std::string_view key,
+                        std::optional<std::string_view> expected,
+                        std::string_view value)
+{
+    std::shared_ptr<detail::cond_state> s(new detail::cond_state());
+    s->table.assign(table);
+    s->key.assign(key);
+    s->value.assign(value);
+
+    if (expected)
+    {
+        s->expected.assign(*expected);
+    }
+
+    int64_t id = consus_cond_put_bin(m_xact, s->table.c_str(),
+                                     s->key.data(), s->key.size(),
+                                     expected ? s->expected.data() : nullptr,
+                                     s->expected.size(),
+                                     s->value.data(), s->value.size(),
+                                     &s->status);
+    return m_cl->submit<bool>(id, s);
+}
+
+inline future<void>
+transaction :: commit()
+{
+    std::shared_ptr<detail::state<void> > s(new detail::state<void>());
+    int64_t id = consus_commit_transaction(m_xact, &s->status);
+    return m_cl->submit<void>(id, s);
+}
+
+inline future<void>
+transaction :: abort()
+{
+    std::shared_ptr<detail::state<void> > s(new detail::state<void>());
+    int64_t id = consus_abort_transaction(m_xact, &s->status);
+    return m_cl->submit<void>(id, s);
+}
+
+} // namespace consus
+
+#endif /* consus_hpp_ */
@@ -0,0 +1,905 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/endian.h>
+
+// Google Log
+#include <glog/logging.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/buffer_pool.h"
+#include "common/hash.h"
+#include "common/network_msgtype.h"
+#include "kvs/anti_entropy.h"
+#include "kvs/daemon.h"
+#include "kvs/key_encoding.h"
+
+// writes to keys that share a stripe are serialized so that reading the
+// previous newest version and storing the next one appear atomic to the tree
+#define AE_STRIPES 1024
+// stored versions examined per pump tick while building or repairing
+#define AE_SCAN_STEP 256
+// ring indices compared per round, and the ranges each differing range is
+// split into on the way down
+#define AE_ROUND_WIDTH 4096
+#define AE_FANOUT 16
+// a comparison whose peer stops answering is abandoned after this many resends
+#define AE_MAX_RESENDS 3
+
+using consus::anti_entropy;
+
+extern bool s_debug_mode;
+
+anti_entropy :: anti_entropy()
+    : m_interval(0)
+    , m_tree()
+    , m_stripes(new po6::threads::mutex[AE_STRIPES])
+    , m_mtx()
+    , m_built(false)
+    , m_build_cursor()
+    , m_built_through()
+    , m_written()
+    , m_peer()
+    , m_nonce(0)
+    , m_ranges()
+    , m_sent_at(0)
+    , m_resends(0)
+    , m_last_round(0)
+    , m_round_started(0)
+    , m_next_index(0)
+    , m_rounds(0)
+    , m_suspect(CONSUS_KVS_PARTITIONS, false)
+    , m_divergent(CONSUS_KVS_PARTITIONS, false)
+    , m_divergent_count(0)
+    , m_agreed()
+    , m_repairing()
+    , m_repair_cursor()
+    , m_repair_last()
+    , m_repaired(0)
+{
+}
+
+anti_entropy :: ~anti_entropy() throw ()
+{
+    delete[] m_stripes;
+}
+
+void
+anti_entropy :: set_interval(uint64_t interval)
+{
+    m_interval = interval;
+}
+
+consus_returncode
+anti_entropy :: store(datalayer* data,
+                      const e::slice& table, const e::slice& key,
+                      uint64_t timestamp, const e::slice& value,
+                      bool tombstone)
+{
+    if (m_interval == 0)
+    {
+        return tombstone ? data->del(table, key, timestamp)
+                         : data->put(table, key, timestamp, value);
+    }
+
+    po6::threads::mutex::hold hold(stripe(table, key));
+    bool track = true;
+
+    {
+        po6::threads::mutex::hold hold_state(&m_mtx);
+
+        if (!m_built)
+        {
+            const std::string dk(data_key(table, key, 0));
+
+            if (!passed(dk))
+            {
+                // the build will read this key's newest version itself
+                m_written.insert(dk);
+                track = false;
+            }
+        }
+    }
+
+    uint64_t newest = 0;
+    bool live = false;
+
+    if (track)
+    {
+        datalayer::reference* ref = NULL;
+        consus_returncode rc = data->get(table, key, UINT64_MAX, &newest, NULL, &ref);
+        delete ref;
+        live = rc == CONSUS_SUCCESS;
+
+        if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+        {
+            LOG(ERROR) << "anti-entropy could not read the newest version of a key; its replicas will appear to differ";
+            track = false;
+        }
+    }
+
+    consus_returncode rc = tombstone ? data->del(table, key, timestamp)
+                                     : data->put(table, key, timestamp, value);
+
+    if (track && rc == CONSUS_SUCCESS && timestamp > newest)
+    {
+        const uint16_t index = hash64(table, key) >> 48;
+
+        if (live)
+        {
+            m_tree.toggle(index, version_hash(table, key, newest));
+        }
+
+        if (!tombstone)
+        {
+            m_tree.toggle(index, version_hash(table, key, timestamp));
+        }
+    }
+
+    return rc;
+}
+
+consus_returncode
+anti_entropy :: store_batch(datalayer* data,
+                            const std::vector<datalayer::raw_item>& items)
+{
+    if (m_interval == 0)
+    {
+        return data->put_batch(items);
+    }
+
+    // hold every stripe the batch touches, in address order so that
+    // concurrent batches cannot deadlock
+    std::vector<po6::threads::mutex*> stripes;
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        stripes.push_back(stripe(e::slice(items[i].table), e::slice(items[i].key)));
+    }
+
+    std::sort(stripes.begin(), stripes.end());
+    stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+
+    for (size_t i = 0; i < stripes.size(); ++i)
+    {
+        stripes[i]->lock();
+    }
+
+    // the newest version of each key and whether it is live, counting the
+    // items before it in the batch; UINT64_MAX for keys left untracked
+    std::map<std::string, std::pair<uint64_t, bool> > newest;
+    std::vector<std::pair<uint16_t, uint64_t> > toggles;
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const e::slice table(items[i].table);
+        const e::slice key(items[i].key);
+        const std::string dk(data_key(table, key, 0));
+        std::map<std::string, std::pair<uint64_t, bool> >::iterator it = newest.find(dk);
+
+        if (it == newest.end())
+        {
+            bool track = true;
+
+            {
+                po6::threads::mutex::hold hold_state(&m_mtx);
+
+                if (!m_built && !passed(dk))
+                {
+                    m_written.insert(dk);
+                    track = false;
+                }
+            }
+
+            uint64_t ts = UINT64_MAX;
+            bool live = false;
+
+            if (track)
+            {
+                datalayer::reference* ref = NULL;
+                consus_returncode rc = data->get(table, key, UINT64_MAX, &ts, NULL, &ref);
+                delete ref;
+                live = rc == CONSUS_SUCCESS;
+
+                if (rc == CONSUS_NOT_FOUND)
+                {
+                    ts = 0;
+                }
+                else if (rc != CONSUS_SUCCESS)
+                {
+                    LOG(ERROR) << "anti-entropy could not read the newest version of a key; its replicas will appear to differ";
+                    ts = UINT64_MAX;
+                }
+            }
+
+            it = newest.insert(std::make_pair(dk, std::make_pair(ts, live))).first;
+        }
+
+        const uint64_t timestamp = items[i].timestamp;
+        const bool tombstone = items[i].value.empty();
+
+        if (it->second.first != UINT64_MAX && timestamp > it->second.first)
+        {
+            const uint16_t index = hash64(table, key) >> 48;
+
+            if (it->second.second)
+            {
+                toggles.push_back(std::make_pair(index, version_hash(table, key, it->second.first)));
+            }
+
+            if (!tombstone)
+            {
+                toggles.push_back(std::make_pair(index, version_hash(table, key, timestamp)));
+            }
+
+            it->second = std::make_pair(timestamp, !tombstone);
+        }
+    }
+
+    consus_returncode rc = data->put_batch(items);
+
+    for (size_t i = 0; rc == CONSUS_SUCCESS && i < toggles.size(); ++i)
+    {
+        m_tree.toggle(toggles[i].first, toggles[i].second);
+    }
+
+    for (size_t i = stripes.size(); i > 0; --i)
+    {
+        stripes[i - 1]->unlock();
+    }
+
+    return rc;
+}
+
+bool
+anti_entropy :: digests(const std::vector<range_t>& ranges,
+                        std::vector<uint64_t>* ds)
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (!m_built)
+        {
+            return false;
+        }
+    }
+
+    ds->clear();
+
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (ranges[i].first <= ranges[i].second)
+        {
+            ds->push_back(m_tree.digest(ranges[i].first, ranges[i].second));
+        }
+        else
+        {
+            ds->push_back(0);
+        }
+    }
+
+    return true;
+}
+
+void
+anti_entropy :: digests_response(comm_id id, uint64_t nonce, bool ready,
+                                 const std::vector<uint64_t>& ds, daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (id != m_peer || nonce != m_nonce)
+    {
+        return;
+    }
+
+    if (!ready || ds.size() != m_ranges.size())
+    {
+        LOG_IF(INFO, s_debug_mode) << "anti-entropy peer " << id << " cannot compare yet";
+        m_peer = comm_id();
+        m_ranges.clear();
+        return;
+    }
+
+    std::vector<range_t> next;
+
+    for (size_t i = 0; i < m_ranges.size(); ++i)
+    {
+        const uint16_t lower = m_ranges[i].first;
+        const uint16_t upper = m_ranges[i].second;
+
+        if (m_tree.digest(lower, upper) == ds[i])
+        {
+            std::fill(m_suspect.begin() + lower, m_suspect.begin() + upper + 1, false);
+            std::vector<uint64_t>& agreed(m_agreed[m_peer]);
+
+            if (agreed.empty())
+            {
+                agreed.resize(CONSUS_KVS_PARTITIONS, 0);
+            }
+
+            // both sides held the same data no earlier than the round began
+            std::fill(agreed.begin() + lower, agreed.begin() + upper + 1, m_round_started);
+            continue;
+        }
+
+        if (lower == upper)
+        {
+            // writes in flight make replicas differ for a moment; only an
+            // index that differs on two comparisons is repaired
+            if (!m_suspect[lower])
+            {
+                m_suspect[lower] = true;
+            }
+            else if (!m_divergent[lower])
+            {
+                m_suspect[lower] = false;
+                m_divergent[lower] = true;
+                ++m_divergent_count;
+            }
+
+            continue;
+        }
+
+        const uint32_t width = uint32_t(upper) - lower + 1;
+        const uint32_t step = (width + AE_FANOUT - 1) / AE_FANOUT;
+
+        for (uint32_t lo = lower; lo <= upper; lo += step)
+        {
+            next.push_back(range_t(lo, std::min<uint32_t>(lo + step - 1, upper)));
+        }
+    }
+
+    m_ranges.swap(next);
+
+    if (m_ranges.empty())
+    {
+        m_peer = comm_id();
+        return;
+    }
+
+    m_nonce = d->generate_id();
+    m_resends = 0;
+    send_digests(d, po6::monotonic_time());
+}
+
+void
+anti_entropy :: tick(daemon* d, uint64_t now)
+{
+    if (m_interval == 0)
+    {
+        return;
+    }
+
+    build_step(d);
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        compare_step(d, now);
+    }
+
+    repair_step(d);
+}
+
+uint64_t
+anti_entropy :: agreed_through(daemon* d)
+{
+    configuration* c = d->get_config();
+    const unsigned min_replication = c->min_replication();
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_interval == 0)
+    {
+        return 0;
+    }
+
+    // only the replicas compare considers ever push repairs, so only they
+    // can bring back what a dropped tombstone hid
+    uint64_t through = UINT64_MAX;
+    std::set<comm_id> peers;
+
+    for (uint32_t index = 0; index < CONSUS_KVS_PARTITIONS; ++index)
+    {
+        replica_set rs;
+
+        if (!c->replicas(d->m_us.dc, index, &rs))
+        {
+            return 0;
+        }
+
+        const unsigned n = std::min(rs.num_replicas, min_replication);
+        bool has_us = false;
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            has_us = has_us || rs.replicas[i] == d->m_us.id;
+        }
+
+        if (!has_us)
+        {
+            continue;
+        }
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            const comm_id peer = rs.replicas[i];
+
+            if (peer == d->m_us.id || peer == comm_id())
+            {
+                continue;
+            }
+
+            std::map<comm_id, std::vector<uint64_t> >::iterator it = m_agreed.find(peer);
+
+            if (it == m_agreed.end())
+            {
+                return 0;
+            }
+
+            through = std::min(through, it->second[index]);
+            peers.insert(peer);
+        }
+    }
+
+    // forget peers that no longer share an index with this daemon
+    std::map<comm_id, std::vector<uint64_t> >::iterator it = m_agreed.begin();
+
+    while (it != m_agreed.end())
+    {
+        if (peers.find(it->first) == peers.end())
+        {
+            m_agreed.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    return through;
+}
+
+std::string
+anti_entropy :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "interval=" << m_interval << " built=" << (m_built ? "yes" : "no")
+         << " awaiting_build=" << m_written.size() << "\n";
+    ostr << "rounds=" << m_rounds << " next_index=" << m_next_index;
+
+    if (m_peer != comm_id())
+    {
+        ostr << " comparing with " << m_peer << " over " << m_ranges.size() << " ranges";
+    }
+
+    ostr << "\n";
+    ostr << "divergent=" << m_divergent_count
+         << " repairing=" << (m_repairing.empty() ? "no" : "yes")
+         << " repaired=" << m_repaired << "\n";
+    return ostr.str();
+}
+
+uint64_t
+anti_entropy :: version_hash(const e::slice& table,
+                             const e::slice& key,
+                             uint64_t timestamp)
+{
+    unsigned char buf[sizeof(uint64_t)];
+    e::pack64be(timestamp, buf);
+    return hash64(hash64(table, key), buf, sizeof(buf));
+}
+
+po6::threads::mutex*
+anti_entropy :: stripe(const e::slice& table, const e::slice& key)
+{
+    return &m_stripes[hash64(table, key) % AE_STRIPES];
+}
+
+bool
+anti_entropy :: passed(const std::string& dk)
+{
+    if (m_built)
+    {
+        return true;
+    }
+
+    return !m_built_through.empty() && dk <= m_built_through &&
+           m_written.find(dk) == m_written.end();
+}
+
+void
+anti_entropy :: contribute(datalayer* data, const e::slice& table, const e::slice& key)
+{
+    // the caller holds the stripe
+    uint64_t newest = 0;
+    datalayer::reference* ref = NULL;
+    consus_returncode rc = data->get(table, key, UINT64_MAX, &newest, NULL, &ref);
+    delete ref;
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        m_tree.toggle(hash64(table, key) >> 48, version_hash(table, key, newest));
+    }
+    else if (rc != CONSUS_NOT_FOUND)
+    {
+        LOG(ERROR) << "anti-entropy could not read the newest version of a key; its replicas will appear to differ";
+    }
+}
+
+void
+anti_entropy :: build_step(daemon* d)
+{
+    std::string cursor;
+    std::string last;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (m_built)
+        {
+            return;
+        }
+
+        cursor = m_build_cursor;
+        last = m_built_through;
+    }
+
+    std::vector<datalayer::raw_item> items;
+    std::string next;
+    bool done = false;
+
+    if (d->m_data->raw_scan(cursor, AE_SCAN_STEP, &items, &next, &done) != CONSUS_SUCCESS)
+    {
+        LOG(ERROR) << "anti-entropy could not scan local data; will retry";
+        return;
+    }
+
+    // a key's versions are adjacent and may straddle two scans; only the
+    // first sighting counts
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const e::slice table(items[i].table);
+        const e::slice key(items[i].key);
+        const std::string dk(data_key(table, key, 0));
+
+        if (dk == last)
+        {
+            continue;
+        }
+
+        po6::threads::mutex::hold hold(stripe(table, key));
+        contribute(d->m_data.get(), table, key);
+        po6::threads::mutex::hold hold_state(&m_mtx);
+        m_written.erase(dk);
+        m_built_through = last = dk;
+    }
+
+    // keys first written after the scan went past their place in the store
+    std::vector<std::string> missed;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_build_cursor = next;
+
+        if (done && !m_written.empty())
+        {
+            m_built_through = std::max(m_built_through, *m_written.rbegin());
+        }
+
+        for (std::set<std::string>::iterator it = m_written.begin();
+                it != m_written.end() && *it <= m_built_through; ++it)
+        {
+            missed.push_back(*it);
+        }
+    }
+
+    for (size_t i = 0; i < missed.size(); ++i)
+    {
+        e::slice table;
+        std::string key;
+        uint64_t timestamp;
+
+        if (!decode_data_key(missed[i].data(), missed[i].size(), &table, &key, &timestamp))
+        {
+            continue;
+        }
+
+        po6::threads::mutex::hold hold(stripe(table, e::slice(key)));
+        contribute(d->m_data.get(), table, e::slice(key));
+        po6::threads::mutex::hold hold_state(&m_mtx);
+        m_written.erase(missed[i]);
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (done && m_written.empty())
+    {
+        m_built = true;
+        LOG(INFO) << "anti-entropy hash tree covers all local data";
+    }
+}
+
+void
+anti_entropy :: compare_step(daemon* d, uint64_t now)
+{
+    if (m_peer != comm_id())
+    {
+        if (m_sent_at + d->resend_interval(m_peer) < now)
+        {
+            if (m_resends >= AE_MAX_RESENDS)
+            {
+                LOG_IF(INFO, s_debug_mode) << "abandoning anti-entropy comparison with " << m_peer;
+                m_peer = comm_id();
+                m_ranges.clear();
+            }
+            else
+            {
+                ++m_resends;
+                send_digests(d, now);
+            }
+        }
+
+        return;
+    }
+
+    if (!m_built || m_last_round + m_interval > now)
+    {
+        return;
+    }
+
+    m_last_round = now;
+    m_round_started = po6::wallclock_time();
+    configuration* c = d->get_config();
+    const unsigned min_replication = c->min_replication();
+
+    // find the next index this daemon replicates along with a peer
+    for (unsigned examined = 0; examined < AE_ROUND_WIDTH; ++examined, ++m_next_index)
+    {
+        replica_set rs;
+
+        if (!c->replicas(d->m_us.dc, m_next_index, &rs))
+        {
+            return;
+        }
+
+        const unsigned n = std::min(rs.num_replicas, min_replication);
+        unsigned us = n;
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            if (rs.replicas[i] == d->m_us.id)
+            {
+                us = i;
+            }
+        }
+
+        if (n < 2 || us == n)
+        {
+            continue;
+        }
+
+        // cycle through the other replicas from one round to the next
+        const comm_id peer = rs.replicas[(us + 1 + m_rounds % (n - 1)) % n];
+
+        if (comparable(d, m_next_index, peer))
+        {
+            m_peer = peer;
+            break;
+        }
+    }
+
+    if (m_peer == comm_id())
+    {
+        return;
+    }
+
+    const uint16_t lower = m_next_index;
+    uint16_t upper = lower;
+
+    while (upper - lower + 1 < AE_ROUND_WIDTH && upper < CONSUS_KVS_PARTITIONS - 1 &&
+           comparable(d, upper + 1, m_peer))
+    {
+        ++upper;
+    }
+
+    m_next_index = upper + 1;
+    ++m_rounds;
+    m_nonce = d->generate_id();
+    m_ranges.clear();
+    m_ranges.push_back(range_t(lower, upper));
+    m_resends = 0;
+    LOG_IF(INFO, s_debug_mode) << "comparing ring indices " << lower << "-" << upper << " with " << m_peer;
+    send_digests(d, now);
+}
+
+void
+anti_entropy :: repair_step(daemon* d)
+{
+    std::string cursor;
+    std::string last;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (m_repairing.empty())
+        {
+            if (m_divergent_count == 0)
+            {
+                return;
+            }
+
+            LOG(INFO) << "repairing " << m_divergent_count << " ring indices that differ from their replicas";
+            m_repairing.swap(m_divergent);
+            m_divergent.assign(CONSUS_KVS_PARTITIONS, false);
+            m_divergent_count = 0;
+            m_repair_cursor.clear();
+            m_repair_last.clear();
+        }
+
+        cursor = m_repair_cursor;
+        last = m_repair_last;
+    }
+
+    std::vector<datalayer::raw_item> items;
+    std::string next;
+    bool done = false;
+
+    if (d->m_data->raw_scan(cursor, AE_SCAN_STEP, &items, &next, &done) != CONSUS_SUCCESS)
+    {
+        LOG(ERROR) << "anti-entropy could not scan local data; will retry";
+        return;
+    }
+
+    configuration* c = d->get_config();
+    uint64_t repaired = 0;
+
+    // m_repairing changes only on this thread
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const e::slice table(items[i].table);
+        const e::slice key(items[i].key);
+        const e::slice value(items[i].value);
+        const std::string dk(data_key(table, key, 0));
+
+        // the first version of each key is its newest
+        if (dk == last)
+        {
+            continue;
+        }
+
+        last = dk;
+        replica_set rs;
+
+        if (!m_repairing[hash64(table, key) >> 48] ||
+            !c->hash(d->m_us.dc, table, key, &rs))
+        {
+            continue;
+        }
+
+        const uint8_t flags = value.empty() ? CONSUS_WRITE_TOMBSTONE : 0;
+        const table_ref tr(d->m_table_ids.intern(table));
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(KVS_RAW_WR)
+                        + sizeof(uint64_t)
+                        + sizeof(uint8_t)
+                        + pack_size(tr)
+                        + pack_size(key)
+                        + sizeof(uint64_t)
+                        + pack_size(value);
+
+        for (unsigned r = 0; r < rs.num_replicas; ++r)
+        {
+            if (rs.replicas[r] == d->m_us.id || rs.replicas[r] == comm_id())
+            {
+                continue;
+            }
+
+            // nobody waits on the answer
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE)
+                << KVS_RAW_WR << uint64_t(0) << flags << tr << key << items[i].timestamp << value;
+            d->send(rs.replicas[r], msg);
+        }
+
+        ++repaired;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_repair_cursor = next;
+    m_repair_last = last;
+    m_repaired += repaired;
+
+    if (done)
+    {
+        LOG(INFO) << "anti-entropy repair finished; " << m_repaired << " keys pushed to replicas so far";
+        m_repairing.clear();
+    }
+}
+
+bool
+anti_entropy :: comparable(daemon* d, uint16_t index, comm_id peer)
+{
+    configuration* c = d->get_config();
+    replica_set rs;
+
+    if (!c->replicas(d->m_us.dc, index, &rs))
+    {
+        return false;
+    }
+
+    // replicas past the smallest replication factor hold only some tables,
+    // and a migrating index holds data in motion; neither compares cleanly
+    const unsigned n = std::min(rs.num_replicas, c->min_replication());
+    bool has_us = false;
+    bool has_peer = false;
+
+    for (unsigned i = 0; i < n; ++i)
+    {
+        if (rs.transitioning[i] != comm_id())
+        {
+            return false;
+        }
+
+        has_us = has_us || rs.replicas[i] == d->m_us.id;
+        has_peer = has_peer || rs.replicas[i] == peer;
+    }
+
+    return has_us && has_peer;
+}
+
+void
+anti_entropy :: send_digests(daemon* d, uint64_t now)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_AE_DIGEST)
+                    + sizeof(uint64_t)
+                    + sizeof(uint64_t)
+                    + m_ranges.size() * 2 * sizeof(uint16_t);
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_AE_DIGEST << m_nonce << uint64_t(m_ranges.size());
+
+    for (size_t i = 0; i < m_ranges.size(); ++i)
+    {
+        pa = pa << m_ranges[i].first << m_ranges[i].second;
+    }
+
+    d->send(m_peer, msg);
+    m_sent_at = now;
+}
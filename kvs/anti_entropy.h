@@ -0,0 +1,154 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_anti_entropy_h_
+#define consus_kvs_anti_entropy_h_
+
+// STL
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include <consus.h>
+#include "namespace.h"
+#include "common/ids.h"
+#include "kvs/datalayer.h"
+#include "kvs/hash_tree.h"
+
+BEGIN_CONSUS_NAMESPACE
+class daemon;
+
+// Keeps a hash tree over the newest version of every key this daemon stores,
+// leaving out keys whose newest version is a tombstone so that pruning never
+// changes it.  A range of ring indices at a time is compared with another
+// replica, descending only into the ranges that differ.  An index found to
+// differ twice in a row is repaired by pushing this daemon's newest version of
+// each of its keys to the index's replicas; the peer does the same from its
+// side, so both converge on the newest.  The last time each index agreed with
+// each peer bounds which tombstones pruning may drop: a tombstone dropped
+// before every replica has it could be undone by a repair that pushes back the
+// value it hid.
+class anti_entropy
+{
+    public:
+        typedef std::pair<uint16_t, uint16_t> range_t;
+
+    public:
+        anti_entropy();
+        ~anti_entropy() throw ();
+
+    public:
+        // nanoseconds between comparisons; 0 disables the service and its tree
+        void set_interval(uint64_t interval);
+        // write one version, keeping the tree current
+        consus_returncode store(datalayer* data,
+                                const e::slice& table, const e::slice& key,
+                                uint64_t timestamp, const e::slice& value,
+                                bool tombstone);
+        // write every item as datalayer::put_batch does, keeping the tree
+        // current; an empty value is a tombstone
+        consus_returncode store_batch(datalayer* data,
+                                      const std::vector<datalayer::raw_item>& items);
+        // false until the tree covers everything stored before startup
+        bool digests(const std::vector<range_t>& ranges,
+                     std::vector<uint64_t>* ds);
+        void digests_response(comm_id id, uint64_t nonce, bool ready,
+                              const std::vector<uint64_t>& ds, daemon* d);
+        // builds the tree, runs comparisons and repairs; called by the pump
+        void tick(daemon* d, uint64_t now);
+        // the wall-clock time at which every index this daemon replicates
+        // last agreed with each of its other replicas; 0 until all have
+        // agreed once, or when the service is disabled
+        uint64_t agreed_through(daemon* d);
+        std::string debug_dump();
+
+    private:
+        static uint64_t version_hash(const e::slice& table,
+                                     const e::slice& key,
+                                     uint64_t timestamp);
+        po6::threads::mutex* stripe(const e::slice& table, const e::slice& key);
+        bool passed(const std::string& dk);
+        void contribute(datalayer* data, const e::slice& table, const e::slice& key);
+        void build_step(daemon* d);
+        void compare_step(daemon* d, uint64_t now);
+        void repair_step(daemon* d);
+        bool comparable(daemon* d, uint16_t index, comm_id peer);
+        void send_digests(daemon* d, uint64_t now);
+
+    private:
+        uint64_t m_interval;
+        hash_tree m_tree;
+        po6::threads::mutex* m_stripes;
+        // guards everything below
+        po6::threads::mutex m_mtx;
+        // building the tree from what was stored before startup; every key
+        // through m_built_through is in the tree, and so is every key in
+        // m_written once the build passes it
+        bool m_built;
+        std::string m_build_cursor;
+        std::string m_built_through;
+        std::set<std::string> m_written;
+        // the comparison in progress, if m_peer is set
+        comm_id m_peer;
+        uint64_t m_nonce;
+        std::vector<range_t> m_ranges;
+        uint64_t m_sent_at;
+        unsigned m_resends;
+        uint64_t m_last_round;
+        uint64_t m_round_started;
+        uint16_t m_next_index;
+        uint64_t m_rounds;
+        // indices that differed once, and those that differed twice
+        std::vector<bool> m_suspect;
+        std::vector<bool> m_divergent;
+        size_t m_divergent_count;
+        // per peer, the wall-clock start of the last round in which each
+        // index compared equal
+        std::map<comm_id, std::vector<uint64_t> > m_agreed;
+        // the repair in progress, if m_repairing is non-empty
+        std::vector<bool> m_repairing;
+        std::string m_repair_cursor;
+        std::string m_repair_last;
+        uint64_t m_repaired;
+
+    private:
+        anti_entropy(const anti_entropy&);
+        anti_entropy& operator = (const anti_entropy&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_anti_entropy_h_
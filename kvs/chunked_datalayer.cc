@@ -0,0 +1,615 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// Google Log
+#include <glog/logging.h>
+
+// po6
+#include <po6/path.h>
+
+// e
+#include <e/serialization.h>
+#include <e/strescape.h>
+
+// consus
+#include "common/hash.h"
+#include "kvs/chunked_datalayer.h"
+
+using consus::chunked_datalayer;
+
+// The first byte of every stored value but a tombstone says how the rest is
+// stored: the value itself, or a manifest of its size, chunk count, and hash.
+#define STORED_WHOLE 0
+#define STORED_CHUNKED 1
+
+// Refuse manifests that claim more than this.
+#define CHUNKED_MAX_VALUE (1024ULL * 1024ULL * 1024ULL)
+
+// Chunks live in this table; the leading NUL keeps it apart from any table a
+// client creates.
+static e::slice
+chunk_table()
+{
+    return e::slice("\0chunks", 7);
+}
+
+static std::string
+chunk_key(const e::slice& table, const e::slice& key, uint32_t idx)
+{
+    std::string tmp;
+    e::packer(&tmp) << table << key << idx;
+    return tmp;
+}
+
+// the number of chunks stored refers to, or 0 if it holds its value whole
+static bool
+decode_manifest(const e::slice& stored, uint64_t* size, uint32_t* chunks, uint64_t* hash)
+{
+    *size = 0;
+    *chunks = 0;
+    *hash = 0;
+
+    if (stored.empty() || stored.data()[0] == STORED_WHOLE)
+    {
+        return true;
+    }
+    else if (stored.data()[0] != STORED_CHUNKED)
+    {
+        return false;
+    }
+
+    e::unpacker up(e::slice(stored.data() + 1, stored.size() - 1));
+    up = up >> *size >> *chunks >> *hash;
+    return !up.error() && !up.remain() && *size <= CHUNKED_MAX_VALUE && *chunks > 0;
+}
+
+struct chunked_datalayer::reference : public datalayer::reference
+{
+    reference(datalayer::reference* inner);
+    virtual ~reference() throw ();
+
+    datalayer::reference* inner;
+    std::string value;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+chunked_datalayer :: reference :: reference(datalayer::reference* _inner)
+    : datalayer::reference()
+    , inner(_inner)
+    , value()
+{
+}
+
+chunked_datalayer :: reference :: ~reference() throw ()
+{
+    delete inner;
+}
+
+chunked_datalayer :: chunked_datalayer(datalayer* backing, uint64_t chunk_size)
+    : m_backing(backing)
+    , m_chunk_size(chunk_size)
+    , m_mtx()
+    , m_chunked_puts(0)
+    , m_chunks_written(0)
+    , m_assembled(0)
+{
+}
+
+chunked_datalayer :: ~chunked_datalayer() throw ()
+{
+}
+
+std::string
+chunked_datalayer :: marker(const std::string& data)
+{
+    return po6::path::join(data, "CHUNKED");
+}
+
+bool
+chunked_datalayer :: init(std::string data)
+{
+    if (!m_backing->init(data))
+    {
+        return false;
+    }
+
+    const std::string path(marker(data));
+    struct stat st;
+
+    if (stat(path.c_str(), &st) == 0)
+    {
+        return true;
+    }
+
+    // values already stored have no header and would be misread
+    std::vector<raw_item> items;
+    std::string next;
+    bool done = false;
+
+    if (m_backing->raw_scan(std::string(), 1, &items, &next, &done) != CONSUS_SUCCESS)
+    {
+        return false;
+    }
+
+    if (!items.empty())
+    {
+        LOG(ERROR) << "value chunking can only be turned on for a new store; "
+                   << data << " already holds data";
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR);
+
+    if (fd < 0)
+    {
+        PLOG(ERROR) << "could not create " << path;
+        return false;
+    }
+
+    close(fd);
+    return true;
+}
+
+consus_returncode
+chunked_datalayer :: get(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp_le,
+                         uint64_t* timestamp,
+                         e::slice* value,
+                         datalayer::reference** ref)
+{
+    e::slice stored;
+    datalayer::reference* inner = NULL;
+    consus_returncode rc = m_backing->get(table, key, timestamp_le, timestamp, &stored, &inner);
+    std::auto_ptr<reference> r(new reference(inner));
+
+    if (value)
+    {
+        *value = e::slice();
+    }
+
+    // a caller after only the timestamp never reads the chunks
+    if (rc == CONSUS_SUCCESS && value)
+    {
+        if (stored.size() > 0 && stored.data()[0] == STORED_WHOLE)
+        {
+            *value = e::slice(stored.data() + 1, stored.size() - 1);
+        }
+        else if ((rc = assemble(table, key, *timestamp, stored, &r->value)) == CONSUS_SUCCESS)
+        {
+            *value = e::slice(r->value);
+        }
+        else if (rc == CONSUS_NOT_FOUND)
+        {
+            LOG(ERROR) << "missing chunks of \"" << e::strescape(table.str())
+                       << "\", \"" << e::strescape(key.str()) << "\"@" << *timestamp;
+            rc = CONSUS_SERVER_ERROR;
+        }
+    }
+
+    *ref = r.release();
+    return rc;
+}
+
+consus_returncode
+chunked_datalayer :: scan(const e::slice& table,
+                          const e::slice& key,
+                          uint64_t timestamp_le,
+                          uint64_t limit,
+                          std::vector<scan_item>* items)
+{
+    consus_returncode rc = m_backing->scan(table, key, timestamp_le, limit, items);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    std::string tmp;
+
+    for (size_t i = 0; i < items->size(); ++i)
+    {
+        scan_item* si = &(*items)[i];
+        rc = decode(table, e::slice(si->key), si->timestamp, e::slice(si->value), &tmp);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            LOG(ERROR) << "could not read the chunks of \"" << e::strescape(table.str())
+                       << "\", \"" << e::strescape(si->key) << "\"@" << si->timestamp;
+            return CONSUS_SERVER_ERROR;
+        }
+
+        si->value.swap(tmp);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+chunked_datalayer :: put(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp,
+                         const e::slice& value)
+{
+    std::string stored;
+    uint32_t chunks = 0;
+
+    if (m_chunk_size > 0 && value.size() > m_chunk_size)
+    {
+        // chunks first, so that no reader finds a manifest without them
+        for (uint64_t off = 0; off < value.size(); off += m_chunk_size)
+        {
+            const size_t sz = std::min(value.size() - off, m_chunk_size);
+            consus_returncode rc = m_backing->put(chunk_table(),
+                                                  chunk_key(table, key, chunks),
+                                                  timestamp,
+                                                  e::slice(value.data() + off, sz));
+
+            if (rc != CONSUS_SUCCESS)
+            {
+                return rc;
+            }
+
+            ++chunks;
+        }
+
+        stored.push_back(STORED_CHUNKED);
+        e::packer(&stored) << uint64_t(value.size()) << chunks
+                           << hash64(0, value.data(), value.size());
+        po6::threads::mutex::hold hold(&m_mtx);
+        ++m_chunked_puts;
+        m_chunks_written += chunks;
+    }
+    else
+    {
+        stored.reserve(1 + value.size());
+        stored.push_back(STORED_WHOLE);
+        stored.append(value.cdata(), value.size());
+    }
+
+    consus_returncode rc = retire_chunks(table, key, timestamp, chunks);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    return m_backing->put(table, key, timestamp, stored);
+}
+
+consus_returncode
+chunked_datalayer :: del(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp)
+{
+    consus_returncode rc = retire_chunks(table, key, timestamp, 0);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    return m_backing->del(table, key, timestamp);
+}
+
+consus_returncode
+chunked_datalayer :: raw_scan(const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    consus_returncode rc = m_backing->raw_scan(cursor, limit, items, next, done);
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        rc = decode_items(items);
+    }
+
+    return rc;
+}
+
+consus::datalayer::snapshot*
+chunked_datalayer :: create_snapshot()
+{
+    return m_backing->create_snapshot();
+}
+
+consus_returncode
+chunked_datalayer :: raw_scan(const datalayer::snapshot* snap,
+                              const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    consus_returncode rc = m_backing->raw_scan(snap, cursor, limit, items, next, done);
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        rc = decode_items(items);
+    }
+
+    return rc;
+}
+
+consus_returncode
+chunked_datalayer :: prune(uint64_t watermark,
+                           uint64_t tombstones,
+                           const std::string& cursor,
+                           uint64_t limit,
+                           std::string* next,
+                           bool* done,
+                           uint64_t* pruned)
+{
+    // chunks are versioned alongside their manifests, so the backing store
+    // prunes both without looking inside either
+    return m_backing->prune(watermark, tombstones, cursor, limit, next, done, pruned);
+}
+
+consus_returncode
+chunked_datalayer :: read_lock(const e::slice& table,
+                               const e::slice& key,
+                               std::vector<transaction_group>* holders,
+                               bool* shared)
+{
+    return m_backing->read_lock(table, key, holders, shared);
+}
+
+consus_returncode
+chunked_datalayer :: write_lock(const e::slice& table,
+                                const e::slice& key,
+                                const std::vector<transaction_group>& holders,
+                                bool shared)
+{
+    return m_backing->write_lock(table, key, holders, shared);
+}
+
+consus_returncode
+chunked_datalayer :: checkpoint_locks()
+{
+    return m_backing->checkpoint_locks();
+}
+
+consus_returncode
+chunked_datalayer :: scan_locks(const std::string& cursor,
+                                uint64_t limit,
+                                std::vector<lock_item>* locks,
+                                std::string* next,
+                                bool* done)
+{
+    return m_backing->scan_locks(cursor, limit, locks, next, done);
+}
+
+unsigned
+chunked_datalayer :: write_pressure()
+{
+    return m_backing->write_pressure();
+}
+
+void
+chunked_datalayer :: stats(storage_stats* st)
+{
+    m_backing->stats(st);
+}
+
+std::string
+chunked_datalayer :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "value chunking chunk_size=" << m_chunk_size
+         << " chunked_puts=" << m_chunked_puts
+         << " chunks_written=" << m_chunks_written
+         << " assembled=" << m_assembled;
+    return ostr.str();
+}
+
+consus_returncode
+chunked_datalayer :: decode(const e::slice& table,
+                            const e::slice& key,
+                            uint64_t timestamp,
+                            const e::slice& stored,
+                            std::string* out)
+{
+    // tombstones stay empty
+    if (stored.empty())
+    {
+        out->clear();
+        return CONSUS_SUCCESS;
+    }
+    else if (stored.data()[0] == STORED_WHOLE)
+    {
+        out->assign(stored.cdata() + 1, stored.size() - 1);
+        return CONSUS_SUCCESS;
+    }
+
+    return assemble(table, key, timestamp, stored, out);
+}
+
+consus_returncode
+chunked_datalayer :: assemble(const e::slice& table,
+                              const e::slice& key,
+                              uint64_t timestamp,
+                              const e::slice& stored,
+                              std::string* out)
+{
+    uint64_t size;
+    uint32_t chunks;
+    uint64_t hash;
+
+    if (!decode_manifest(stored, &size, &chunks, &hash) || chunks == 0)
+    {
+        LOG(ERROR) << "corrupt chunk manifest for \"" << e::strescape(table.str())
+                   << "\", \"" << e::strescape(key.str()) << "\"@" << timestamp;
+        return CONSUS_SERVER_ERROR;
+    }
+
+    out->clear();
+    out->reserve(size);
+
+    for (uint32_t i = 0; i < chunks; ++i)
+    {
+        uint64_t ts = 0;
+        e::slice chunk;
+        datalayer::reference* ref = NULL;
+        const std::string ck(chunk_key(table, key, i));
+        consus_returncode rc = m_backing->get(chunk_table(), e::slice(ck), timestamp, &ts, &chunk, &ref);
+        const bool found = rc == CONSUS_SUCCESS && ts == timestamp;
+
+        if (found)
+        {
+            out->append(chunk.cdata(), chunk.size());
+        }
+
+        delete ref;
+
+        if (!found)
+        {
+            return CONSUS_NOT_FOUND;
+        }
+    }
+
+    if (out->size() != size ||
+        hash64(0, reinterpret_cast<const unsigned char*>(out->data()), out->size()) != hash)
+    {
+        LOG(ERROR) << "chunks of \"" << e::strescape(table.str()) << "\", \""
+                   << e::strescape(key.str()) << "\"@" << timestamp
+                   << " do not match their manifest";
+        return CONSUS_SERVER_ERROR;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    ++m_assembled;
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+chunked_datalayer :: retire_chunks(const e::slice& table,
+                                   const e::slice& key,
+                                   uint64_t timestamp,
+                                   uint32_t keep)
+{
+    uint64_t ts = 0;
+    e::slice prev;
+    datalayer::reference* ref = NULL;
+    consus_returncode rc = m_backing->get(table, key, timestamp, &ts, &prev, &ref);
+    uint64_t size;
+    uint32_t chunks = 0;
+    uint64_t hash;
+
+    if (rc == CONSUS_SUCCESS && !decode_manifest(prev, &size, &chunks, &hash))
+    {
+        chunks = 0;
+    }
+
+    delete ref;
+
+    if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+    {
+        return rc;
+    }
+
+    // a tombstone at timestamp makes each chunk's newest version match the
+    // key's, so both are pruned together
+    for (uint32_t i = keep; i < chunks; ++i)
+    {
+        rc = m_backing->del(chunk_table(), e::slice(chunk_key(table, key, i)), timestamp);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            return rc;
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+chunked_datalayer :: decode_items(std::vector<raw_item>* items)
+{
+    const e::slice hidden(chunk_table());
+    std::string tmp;
+    size_t out = 0;
+
+    for (size_t i = 0; i < items->size(); ++i)
+    {
+        raw_item* ri = &(*items)[i];
+
+        if (e::slice(ri->table) == hidden)
+        {
+            continue;
+        }
+
+        consus_returncode rc = decode(e::slice(ri->table), e::slice(ri->key),
+                                      ri->timestamp, e::slice(ri->value), &tmp);
+
+        // pruning reached this version's chunks before the version itself,
+        // so no reader can observe it any longer
+        if (rc == CONSUS_NOT_FOUND)
+        {
+            continue;
+        }
+        else if (rc != CONSUS_SUCCESS)
+        {
+            return rc;
+        }
+
+        ri->value.swap(tmp);
+
+        if (out != i)
+        {
+            raw_item* dst = &(*items)[out];
+            dst->table.swap(ri->table);
+            dst->key.swap(ri->key);
+            dst->timestamp = ri->timestamp;
+            dst->value.swap(ri->value);
+        }
+
+        ++out;
+    }
+
+    items->resize(out);
+    return CONSUS_SUCCESS;
+}
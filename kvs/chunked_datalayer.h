@@ -0,0 +1,167 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_chunked_datalayer_h_
+#define consus_kvs_chunked_datalayer_h_
+
+// STL
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Splits values larger than the chunk size into chunks in front of another
+// datalayer, so that a large value never becomes one huge record that the
+// storage engine must copy through every compaction.  The value's own record
+// holds a manifest giving its size, chunk count, and hash; chunk i is a
+// version of its own key in a hidden table, stored at the manifest's
+// timestamp.  Since each chunk has the same versions as the key it belongs to,
+// pruning the key's old versions prunes their chunks along with them.
+//
+// Every value the backing store holds carries a one-byte header saying which
+// of the two forms it takes, so a store that has been chunked must always be
+// opened through this class.  A marker file in the data directory marks such
+// a store.  Scans return whole values and skip the hidden table, so a replica
+// that receives a value re-chunks it as it sees fit.
+class chunked_datalayer : public datalayer
+{
+    public:
+        // takes ownership of backing; a chunk_size of 0 stores every value
+        // whole, which still reads values chunked before
+        chunked_datalayer(datalayer* backing, uint64_t chunk_size);
+        virtual ~chunked_datalayer() throw ();
+
+    public:
+        // the file whose presence marks a chunked store in data
+        static std::string marker(const std::string& data);
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual datalayer::snapshot* create_snapshot();
+        virtual consus_returncode raw_scan(const datalayer::snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared);
+        virtual consus_returncode checkpoint_locks();
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done);
+        virtual unsigned write_pressure();
+        virtual void stats(storage_stats* st);
+
+    public:
+        std::string debug_dump();
+
+    private:
+        struct reference;
+
+    private:
+        // the whole value of a stored record, reading its chunks if need be
+        consus_returncode decode(const e::slice& table,
+                                 const e::slice& key,
+                                 uint64_t timestamp,
+                                 const e::slice& stored,
+                                 std::string* out);
+        consus_returncode assemble(const e::slice& table,
+                                   const e::slice& key,
+                                   uint64_t timestamp,
+                                   const e::slice& stored,
+                                   std::string* out);
+        // tombstone the chunks beyond the first keep of the version that a
+        // write at timestamp supersedes, so that pruning reclaims them
+        consus_returncode retire_chunks(const e::slice& table,
+                                        const e::slice& key,
+                                        uint64_t timestamp,
+                                        uint32_t keep);
+        consus_returncode decode_items(std::vector<raw_item>* items);
+
+    private:
+        const std::auto_ptr<datalayer> m_backing;
+        const uint64_t m_chunk_size;
+        po6::threads::mutex m_mtx;
+        uint64_t m_chunked_puts;
+        uint64_t m_chunks_written;
+        uint64_t m_assembled;
+
+    private:
+        chunked_datalayer(const chunked_datalayer&);
+        chunked_datalayer& operator = (const chunked_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_chunked_datalayer_h_
@@ -0,0 +1,108 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "kvs/compaction_governor.h"
+
+using consus::compaction_governor;
+
+// How much of the peak rate is kept from one sample to the next, so that the
+// peak follows the daily cycle down rather than holding the busiest second.
+#define PEAK_DECAY 0.999
+
+// The share of the peak rate under which the store is quiet.
+#define QUIET_SHARE 0.25
+
+compaction_governor :: compaction_governor()
+    : m_target(0)
+    , m_ops(0)
+    , m_latency(0)
+    , m_sampled(0)
+    , m_sampled_ops(0)
+    , m_sampled_latency(0)
+    , m_rate(0)
+    , m_peak(0)
+    , m_mean(0)
+{
+}
+
+compaction_governor :: ~compaction_governor() throw ()
+{
+}
+
+void
+compaction_governor :: set_target(uint64_t latency)
+{
+    m_target = latency;
+}
+
+void
+compaction_governor :: record(uint64_t latency)
+{
+    e::atomic::increment_64_nobarrier(&m_ops, 1);
+    e::atomic::increment_64_nobarrier(&m_latency, latency);
+}
+
+void
+compaction_governor :: sample(uint64_t now)
+{
+    const uint64_t ops = e::atomic::load_64_nobarrier(&m_ops);
+    const uint64_t latency = e::atomic::load_64_nobarrier(&m_latency);
+
+    if (m_sampled > 0 && now > m_sampled)
+    {
+        const uint64_t window_ops = ops - m_sampled_ops;
+        m_rate = double(window_ops) * PO6_SECONDS / (now - m_sampled);
+        m_mean = window_ops > 0 ? (latency - m_sampled_latency) / window_ops : 0;
+        m_peak = std::max(m_rate, m_peak * PEAK_DECAY);
+    }
+
+    m_sampled = now;
+    m_sampled_ops = ops;
+    m_sampled_latency = latency;
+}
+
+bool
+compaction_governor :: may_compact() const
+{
+    return m_target == 0 || m_mean <= m_target;
+}
+
+bool
+compaction_governor :: quiet() const
+{
+    return m_sampled > 0 && m_rate <= m_peak * QUIET_SHARE;
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_compaction_governor_h_
+#define consus_kvs_compaction_governor_h_
+
+// C
+#include <stdint.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Decides when the key-value store may spend its disk on compaction, from
+// the reads and writes it serves in the foreground.  Network threads record
+// how long each storage operation took; the compaction thread samples the
+// totals once a tick.  Compaction yields whenever the mean latency of the
+// last tick is over the target, and compaction nobody asked for waits for
+// the store to be quiet, serving well under its recent peak rate.
+class compaction_governor
+{
+    public:
+        compaction_governor();
+        ~compaction_governor() throw ();
+
+    public:
+        // nanoseconds of foreground latency above which compaction yields;
+        // 0 never yields
+        void set_target(uint64_t latency);
+        // from any thread, for each foreground operation
+        void record(uint64_t latency);
+        // from the compaction thread alone
+        void sample(uint64_t now);
+        bool may_compact() const;
+        bool quiet() const;
+        uint64_t mean_latency() const { return m_mean; }
+
+    private:
+        uint64_t m_target;
+        uint64_t m_ops;
+        uint64_t m_latency;
+        // as of the last sample
+        uint64_t m_sampled;
+        uint64_t m_sampled_ops;
+        uint64_t m_sampled_latency;
+        double m_rate;
+        double m_peak;
+        uint64_t m_mean;
+
+    private:
+        compaction_governor(const compaction_governor&);
+        compaction_governor& operator = (const compaction_governor&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_compaction_governor_h_
@@ -0,0 +1,888 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+
+// POSIX
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+// Google Log
+#include <glog/logging.h>
+
+// zstd
+#define ZDICT_STATIC_LINKING_ONLY
+#include <zdict.h>
+#include <zstd.h>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/path.h>
+
+// e
+#include <e/endian.h>
+#include <e/strescape.h>
+
+// consus
+#include "kvs/compressed_datalayer.h"
+
+using consus::compressed_datalayer;
+
+// The first byte of every stored value but a tombstone says how the rest is
+// stored.
+#define STORED_PLAIN 0
+#define STORED_ZSTD 1
+
+// zstd's default; higher levels cost far more time than they save space on
+// small records.
+#define COMPRESS_LEVEL 3
+
+// Values shorter than this are stored as they are; the frame header alone
+// would eat most of what compression saves.
+#define COMPRESS_MIN_BYTES 32
+
+// Refuse frames that claim to expand to more than this.
+#define COMPRESS_MAX_VALUE (64ULL * 1024ULL * 1024ULL)
+
+// Bytes of values gathered from a table before training its dictionary, and
+// the most any one value contributes.
+#define TRAIN_SAMPLE_BYTES (1024ULL * 1024ULL)
+#define TRAIN_SAMPLE_MAX_VALUE 4096
+
+// Size of a trained dictionary.
+#define DICTIONARY_BYTES (16 * 1024)
+
+// Upper bound on idle compression and decompression contexts kept around.
+#define CONTEXT_POOL_SIZE 16
+
+struct compressed_datalayer::dictionary
+{
+    dictionary(unsigned id, const std::string& table, const std::string& bytes);
+    ~dictionary() throw ();
+    bool valid() const { return cdict && ddict; }
+
+    const unsigned id;
+    const std::string table;
+    ZSTD_CDict* cdict;
+    ZSTD_DDict* ddict;
+
+    private:
+        dictionary(const dictionary&);
+        dictionary& operator = (const dictionary&);
+};
+
+compressed_datalayer :: dictionary :: dictionary(unsigned _id,
+                                                 const std::string& _table,
+                                                 const std::string& bytes)
+    : id(_id)
+    , table(_table)
+    , cdict(ZSTD_createCDict(bytes.data(), bytes.size(), COMPRESS_LEVEL))
+    , ddict(ZSTD_createDDict(bytes.data(), bytes.size()))
+{
+}
+
+compressed_datalayer :: dictionary :: ~dictionary() throw ()
+{
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+}
+
+struct compressed_datalayer::table_state
+{
+    table_state(const std::string& table);
+    ~table_state() throw ();
+
+    const std::string table;
+    // NULL until trained; compression goes on without one until then
+    dictionary* dict;
+    // set once training has started, whether or not it succeeded
+    bool trained;
+    std::string samples;
+    std::vector<size_t> sample_sizes;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+
+    private:
+        table_state(const table_state&);
+        table_state& operator = (const table_state&);
+};
+
+compressed_datalayer :: table_state :: table_state(const std::string& _table)
+    : table(_table)
+    , dict(NULL)
+    , trained(false)
+    , samples()
+    , sample_sizes()
+    , bytes_in(0)
+    , bytes_out(0)
+{
+}
+
+compressed_datalayer :: table_state :: ~table_state() throw ()
+{
+}
+
+struct compressed_datalayer::reference : public datalayer::reference
+{
+    reference(datalayer::reference* inner);
+    virtual ~reference() throw ();
+
+    datalayer::reference* inner;
+    std::string value;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+compressed_datalayer :: reference :: reference(datalayer::reference* _inner)
+    : datalayer::reference()
+    , inner(_inner)
+    , value()
+{
+}
+
+compressed_datalayer :: reference :: ~reference() throw ()
+{
+    delete inner;
+}
+
+compressed_datalayer :: compressed_datalayer(datalayer* backing, const std::vector<std::string>& tables)
+    : m_backing(backing)
+    , m_dict_dir()
+    , m_mtx()
+    , m_states()
+    , m_dicts()
+    , m_cctxs()
+    , m_dctxs()
+    , m_bytes_in(0)
+    , m_bytes_out(0)
+    , m_decompressions(0)
+{
+    for (size_t i = 0; i < tables.size(); ++i)
+    {
+        if (m_states.find(tables[i]) == m_states.end())
+        {
+            m_states[tables[i]] = new table_state(tables[i]);
+        }
+    }
+}
+
+compressed_datalayer :: ~compressed_datalayer() throw ()
+{
+    for (std::map<std::string, table_state*>::iterator it = m_states.begin();
+            it != m_states.end(); ++it)
+    {
+        delete it->second;
+    }
+
+    for (std::map<unsigned, dictionary*>::iterator it = m_dicts.begin();
+            it != m_dicts.end(); ++it)
+    {
+        delete it->second;
+    }
+
+    for (size_t i = 0; i < m_cctxs.size(); ++i)
+    {
+        ZSTD_freeCCtx(m_cctxs[i]);
+    }
+
+    for (size_t i = 0; i < m_dctxs.size(); ++i)
+    {
+        ZSTD_freeDCtx(m_dctxs[i]);
+    }
+}
+
+std::string
+compressed_datalayer :: dictionary_dir(const std::string& data)
+{
+    return po6::path::join(data, "dictionaries");
+}
+
+bool
+compressed_datalayer :: init(std::string data)
+{
+    if (!m_backing->init(data))
+    {
+        return false;
+    }
+
+    m_dict_dir = dictionary_dir(data);
+    struct stat st;
+
+    if (stat(m_dict_dir.c_str(), &st) < 0)
+    {
+        // values already stored have no header and would be misread
+        std::vector<raw_item> items;
+        std::string next;
+        bool done = false;
+
+        if (m_backing->raw_scan(std::string(), 1, &items, &next, &done) != CONSUS_SUCCESS)
+        {
+            return false;
+        }
+
+        if (!items.empty())
+        {
+            LOG(ERROR) << "value compression can only be turned on for a new store; "
+                       << data << " already holds data";
+            return false;
+        }
+
+        if (mkdir(m_dict_dir.c_str(), S_IRWXU) < 0 && errno != EEXIST)
+        {
+            PLOG(ERROR) << "could not create " << m_dict_dir;
+            return false;
+        }
+    }
+
+    return load_dictionaries();
+}
+
+consus_returncode
+compressed_datalayer :: get(const e::slice& table,
+                            const e::slice& key,
+                            uint64_t timestamp_le,
+                            uint64_t* timestamp,
+                            e::slice* value,
+                            datalayer::reference** ref)
+{
+    e::slice stored;
+    datalayer::reference* inner = NULL;
+    consus_returncode rc = m_backing->get(table, key, timestamp_le, timestamp, &stored, &inner);
+    std::auto_ptr<reference> r(new reference(inner));
+
+    if (value)
+    {
+        *value = e::slice();
+    }
+
+    // a caller after only the timestamp never pays for decompression
+    if (rc == CONSUS_SUCCESS && value)
+    {
+        if (stored.size() > 0 && stored.data()[0] == STORED_PLAIN)
+        {
+            *value = e::slice(stored.data() + 1, stored.size() - 1);
+        }
+        else if (decode(stored, &r->value))
+        {
+            *value = e::slice(r->value);
+        }
+        else
+        {
+            LOG(ERROR) << "could not decompress a stored value of table \""
+                       << e::strescape(table.str()) << "\"";
+            rc = CONSUS_SERVER_ERROR;
+        }
+    }
+
+    *ref = r.release();
+    return rc;
+}
+
+consus_returncode
+compressed_datalayer :: scan(const e::slice& table,
+                             const e::slice& key,
+                             uint64_t timestamp_le,
+                             uint64_t limit,
+                             std::vector<scan_item>* items)
+{
+    consus_returncode rc = m_backing->scan(table, key, timestamp_le, limit, items);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    std::string tmp;
+
+    for (size_t i = 0; i < items->size(); ++i)
+    {
+        if (!decode((*items)[i].value, &tmp))
+        {
+            LOG(ERROR) << "could not decompress a stored value of table \""
+                       << e::strescape(table.str()) << "\"";
+            return CONSUS_SERVER_ERROR;
+        }
+
+        (*items)[i].value.swap(tmp);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+compressed_datalayer :: put(const e::slice& table,
+                            const e::slice& key,
+                            uint64_t timestamp,
+                            const e::slice& value)
+{
+    table_state* ts = get_table(table);
+    std::string stored;
+
+    if (ts)
+    {
+        sample(ts, value);
+    }
+
+    encode(ts, value, &stored);
+    return m_backing->put(table, key, timestamp, stored);
+}
+
+consus_returncode
+compressed_datalayer :: del(const e::slice& table,
+                            const e::slice& key,
+                            uint64_t timestamp)
+{
+    return m_backing->del(table, key, timestamp);
+}
+
+consus_returncode
+compressed_datalayer :: raw_scan(const std::string& cursor,
+                                 uint64_t limit,
+                                 std::vector<raw_item>* items,
+                                 std::string* next,
+                                 bool* done)
+{
+    consus_returncode rc = m_backing->raw_scan(cursor, limit, items, next, done);
+
+    if (rc == CONSUS_SUCCESS && !decode_items(items))
+    {
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return rc;
+}
+
+consus::datalayer::snapshot*
+compressed_datalayer :: create_snapshot()
+{
+    return m_backing->create_snapshot();
+}
+
+consus_returncode
+compressed_datalayer :: raw_scan(const datalayer::snapshot* snap,
+                                 const std::string& cursor,
+                                 uint64_t limit,
+                                 std::vector<raw_item>* items,
+                                 std::string* next,
+                                 bool* done)
+{
+    consus_returncode rc = m_backing->raw_scan(snap, cursor, limit, items, next, done);
+
+    if (rc == CONSUS_SUCCESS && !decode_items(items))
+    {
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return rc;
+}
+
+consus_returncode
+compressed_datalayer :: prune(uint64_t watermark,
+                              uint64_t tombstones,
+                              const std::string& cursor,
+                              uint64_t limit,
+                              std::string* next,
+                              bool* done,
+                              uint64_t* pruned)
+{
+    // tombstones stay empty, so pruning never needs to look inside a value
+    return m_backing->prune(watermark, tombstones, cursor, limit, next, done, pruned);
+}
+
+consus_returncode
+compressed_datalayer :: read_lock(const e::slice& table,
+                                  const e::slice& key,
+                                  std::vector<transaction_group>* holders,
+                                  bool* shared)
+{
+    return m_backing->read_lock(table, key, holders, shared);
+}
+
+consus_returncode
+compressed_datalayer :: write_lock(const e::slice& table,
+                                   const e::slice& key,
+                                   const std::vector<transaction_group>& holders,
+                                   bool shared)
+{
+    return m_backing->write_lock(table, key, holders, shared);
+}
+
+consus_returncode
+compressed_datalayer :: checkpoint_locks()
+{
+    return m_backing->checkpoint_locks();
+}
+
+consus_returncode
+compressed_datalayer :: scan_locks(const std::string& cursor,
+                                  uint64_t limit,
+                                  std::vector<lock_item>* locks,
+                                  std::string* next,
+                                  bool* done)
+{
+    return m_backing->scan_locks(cursor, limit, locks, next, done);
+}
+
+unsigned
+compressed_datalayer :: write_pressure()
+{
+    return m_backing->write_pressure();
+}
+
+void
+compressed_datalayer :: stats(storage_stats* st)
+{
+    m_backing->stats(st);
+}
+
+std::string
+compressed_datalayer :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "value compression bytes_in=" << m_bytes_in
+         << " bytes_out=" << m_bytes_out
+         << " ratio=" << (m_bytes_out ? double(m_bytes_in) / m_bytes_out : 0.)
+         << " decompressions=" << m_decompressions
+         << " dictionaries=" << m_dicts.size();
+
+    for (std::map<std::string, table_state*>::iterator it = m_states.begin();
+            it != m_states.end(); ++it)
+    {
+        table_state* ts = it->second;
+        ostr << "\ntable \"" << e::strescape(it->first) << "\"";
+
+        if (ts->dict)
+        {
+            ostr << " dictionary=" << ts->dict->id;
+        }
+        else if (ts->trained)
+        {
+            ostr << " dictionary=none";
+        }
+        else
+        {
+            ostr << " dictionary=sampling(" << ts->samples.size() << "/" << TRAIN_SAMPLE_BYTES << ")";
+        }
+
+        ostr << " bytes_in=" << ts->bytes_in
+             << " bytes_out=" << ts->bytes_out;
+    }
+
+    return ostr.str();
+}
+
+bool
+compressed_datalayer :: load_dictionaries()
+{
+    DIR* dir = opendir(m_dict_dir.c_str());
+
+    if (!dir)
+    {
+        PLOG(ERROR) << "could not open " << m_dict_dir;
+        return false;
+    }
+
+    std::vector<std::string> names;
+
+    while (struct dirent* ent = readdir(dir))
+    {
+        const std::string name(ent->d_name);
+
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".dict") == 0)
+        {
+            names.push_back(name);
+        }
+    }
+
+    closedir(dir);
+
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        const std::string path(po6::path::join(m_dict_dir, names[i]));
+        std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+        std::ostringstream contents;
+        contents << fin.rdbuf();
+        const std::string c(contents.str());
+        uint32_t table_sz = 0;
+
+        if (c.size() >= sizeof(uint32_t))
+        {
+            e::unpack32be(c.data(), &table_sz);
+        }
+
+        if (!fin || c.size() < sizeof(uint32_t) + table_sz)
+        {
+            LOG(ERROR) << "dictionary " << path << " is corrupt";
+            return false;
+        }
+
+        const std::string table(c.data() + sizeof(uint32_t), table_sz);
+        const std::string bytes(c.substr(sizeof(uint32_t) + table_sz));
+        const unsigned id = ZDICT_getDictID(bytes.data(), bytes.size());
+        std::auto_ptr<dictionary> d(new dictionary(id, table, bytes));
+
+        if (id == 0 || !d->valid() || m_dicts.find(id) != m_dicts.end())
+        {
+            LOG(ERROR) << "dictionary " << path << " is corrupt";
+            return false;
+        }
+
+        std::map<std::string, table_state*>::iterator it = m_states.find(table);
+
+        if (it != m_states.end())
+        {
+            it->second->dict = d.get();
+            it->second->trained = true;
+        }
+
+        m_dicts[id] = d.release();
+    }
+
+    return true;
+}
+
+bool
+compressed_datalayer :: save_dictionary(const std::string& table, const std::string& dict, unsigned id)
+{
+    std::ostringstream ostr;
+    ostr << id << ".dict";
+    const std::string path(po6::path::join(m_dict_dir, ostr.str()));
+    const std::string tmp(path + ".tmp");
+    char header[sizeof(uint32_t)];
+    e::pack32be(table.size(), header);
+    po6::io::fd fd(open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    // a value compressed with the dictionary must never reach the disk
+    // before the dictionary does
+    if (fd.get() < 0 ||
+        fd.xwrite(header, sizeof(header)) != ssize_t(sizeof(header)) ||
+        fd.xwrite(table.data(), table.size()) != ssize_t(table.size()) ||
+        fd.xwrite(dict.data(), dict.size()) != ssize_t(dict.size()) ||
+        fsync(fd.get()) < 0 ||
+        rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        PLOG(ERROR) << "could not write dictionary " << path;
+        return false;
+    }
+
+    po6::io::fd dir(open(m_dict_dir.c_str(), O_RDONLY));
+
+    if (dir.get() < 0 || fsync(dir.get()) < 0)
+    {
+        PLOG(ERROR) << "could not sync " << m_dict_dir;
+        return false;
+    }
+
+    return true;
+}
+
+compressed_datalayer::table_state*
+compressed_datalayer :: get_table(const e::slice& table)
+{
+    // m_states is fixed at construction
+    if (m_states.empty())
+    {
+        return NULL;
+    }
+
+    std::map<std::string, table_state*>::iterator it = m_states.find(table.str());
+    return it != m_states.end() ? it->second : NULL;
+}
+
+compressed_datalayer::dictionary*
+compressed_datalayer :: get_dictionary(unsigned id)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::map<unsigned, dictionary*>::iterator it = m_dicts.find(id);
+    return it != m_dicts.end() ? it->second : NULL;
+}
+
+void
+compressed_datalayer :: sample(table_state* ts, const e::slice& value)
+{
+    std::string samples;
+    std::vector<size_t> sizes;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (ts->trained || value.empty())
+        {
+            return;
+        }
+
+        const size_t sz = std::min(value.size(), size_t(TRAIN_SAMPLE_MAX_VALUE));
+        ts->samples.append(reinterpret_cast<const char*>(value.data()), sz);
+        ts->sample_sizes.push_back(sz);
+
+        if (ts->samples.size() < TRAIN_SAMPLE_BYTES)
+        {
+            return;
+        }
+
+        // one writer trains while the others carry on without a dictionary
+        ts->trained = true;
+        samples.swap(ts->samples);
+        sizes.swap(ts->sample_sizes);
+    }
+
+    const std::string& table(ts->table);
+    std::string dict(DICTIONARY_BYTES, '\0');
+    size_t sz = ZDICT_trainFromBuffer(&dict[0], dict.size(), samples.data(), &sizes[0], sizes.size());
+
+    if (ZDICT_isError(sz))
+    {
+        LOG(WARNING) << "could not train a compression dictionary for table \""
+                     << e::strescape(table) << "\": " << ZDICT_getErrorName(sz)
+                     << "; compressing its values without one";
+        return;
+    }
+
+    dict.resize(sz);
+    const unsigned id = ZDICT_getDictID(dict.data(), dict.size());
+    std::auto_ptr<dictionary> d(new dictionary(id, table, dict));
+
+    if (id == 0 || !d->valid() || get_dictionary(id) ||
+        !save_dictionary(table, dict, id))
+    {
+        LOG(WARNING) << "could not install a compression dictionary for table \""
+                     << e::strescape(table) << "\"; compressing its values without one";
+        return;
+    }
+
+    LOG(INFO) << "trained compression dictionary " << id << " for table \""
+              << e::strescape(table) << "\" from " << sizes.size() << " values";
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_dicts[id] = d.get();
+    ts->dict = d.release();
+}
+
+void
+compressed_datalayer :: encode(table_state* ts, const e::slice& value, std::string* out)
+{
+    out->clear();
+
+    if (ts && value.size() >= COMPRESS_MIN_BYTES)
+    {
+        dictionary* dict = NULL;
+
+        {
+            po6::threads::mutex::hold hold(&m_mtx);
+            dict = ts->dict;
+        }
+
+        ZSTD_CCtx* cctx = acquire_cctx();
+        out->resize(1 + ZSTD_compressBound(value.size()));
+        (*out)[0] = STORED_ZSTD;
+        const size_t sz = dict
+                        ? ZSTD_compress_usingCDict(cctx, &(*out)[1], out->size() - 1,
+                                                   value.data(), value.size(), dict->cdict)
+                        : ZSTD_compressCCtx(cctx, &(*out)[1], out->size() - 1,
+                                            value.data(), value.size(), COMPRESS_LEVEL);
+        release_cctx(cctx);
+        const bool smaller = !ZSTD_isError(sz) && sz < value.size();
+        const size_t stored = 1 + (smaller ? sz : value.size());
+
+        {
+            po6::threads::mutex::hold hold(&m_mtx);
+            ts->bytes_in += value.size();
+            ts->bytes_out += stored;
+            m_bytes_in += value.size();
+            m_bytes_out += stored;
+        }
+
+        if (smaller)
+        {
+            out->resize(1 + sz);
+            return;
+        }
+
+        out->clear();
+    }
+
+    // a delete is stored as an empty value; anything else gets its header
+    if (!value.empty())
+    {
+        out->reserve(1 + value.size());
+        out->push_back(char(STORED_PLAIN));
+        out->append(reinterpret_cast<const char*>(value.data()), value.size());
+    }
+}
+
+bool
+compressed_datalayer :: decode(const e::slice& stored, std::string* out)
+{
+    out->clear();
+
+    if (stored.empty())
+    {
+        return true;
+    }
+
+    const char* src = reinterpret_cast<const char*>(stored.data()) + 1;
+    const size_t src_sz = stored.size() - 1;
+
+    if (stored.data()[0] == STORED_PLAIN)
+    {
+        out->assign(src, src_sz);
+        return true;
+    }
+    else if (stored.data()[0] != STORED_ZSTD)
+    {
+        return false;
+    }
+
+    const unsigned long long sz = ZSTD_getFrameContentSize(src, src_sz);
+
+    if (sz == ZSTD_CONTENTSIZE_UNKNOWN || sz == ZSTD_CONTENTSIZE_ERROR ||
+        sz > COMPRESS_MAX_VALUE)
+    {
+        return false;
+    }
+
+    const unsigned id = ZSTD_getDictID_fromFrame(src, src_sz);
+    dictionary* dict = id != 0 ? get_dictionary(id) : NULL;
+
+    if (id != 0 && !dict)
+    {
+        return false;
+    }
+
+    out->resize(sz);
+    ZSTD_DCtx* dctx = acquire_dctx();
+    const size_t ret = dict
+                     ? ZSTD_decompress_usingDDict(dctx, &(*out)[0], sz, src, src_sz, dict->ddict)
+                     : ZSTD_decompressDCtx(dctx, &(*out)[0], sz, src, src_sz);
+    release_dctx(dctx);
+    return !ZSTD_isError(ret) && ret == sz;
+}
+
+bool
+compressed_datalayer :: decode_items(std::vector<raw_item>* items)
+{
+    std::string tmp;
+
+    for (size_t i = 0; i < items->size(); ++i)
+    {
+        if (!decode((*items)[i].value, &tmp))
+        {
+            LOG(ERROR) << "could not decompress a stored value of table \""
+                       << e::strescape((*items)[i].table) << "\"";
+            return false;
+        }
+
+        (*items)[i].value.swap(tmp);
+    }
+
+    return true;
+}
+
+ZSTD_CCtx*
+compressed_datalayer :: acquire_cctx()
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (!m_cctxs.empty())
+        {
+            ZSTD_CCtx* cctx = m_cctxs.back();
+            m_cctxs.pop_back();
+            return cctx;
+        }
+    }
+
+    return ZSTD_createCCtx();
+}
+
+void
+compressed_datalayer :: release_cctx(ZSTD_CCtx* cctx)
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (m_cctxs.size() < CONTEXT_POOL_SIZE)
+        {
+            m_cctxs.push_back(cctx);
+            return;
+        }
+    }
+
+    ZSTD_freeCCtx(cctx);
+}
+
+ZSTD_DCtx*
+compressed_datalayer :: acquire_dctx()
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        ++m_decompressions;
+
+        if (!m_dctxs.empty())
+        {
+            ZSTD_DCtx* dctx = m_dctxs.back();
+            m_dctxs.pop_back();
+            return dctx;
+        }
+    }
+
+    return ZSTD_createDCtx();
+}
+
+void
+compressed_datalayer :: release_dctx(ZSTD_DCtx* dctx)
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (m_dctxs.size() < CONTEXT_POOL_SIZE)
+        {
+            m_dctxs.push_back(dctx);
+            return;
+        }
+    }
+
+    ZSTD_freeDCtx(dctx);
+}
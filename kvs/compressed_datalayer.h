@@ -0,0 +1,174 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_kvs_compressed_datalayer_h_
+#define consus_kvs_compressed_datalayer_h_
+
+// STL
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+// zstd
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+BEGIN_CONSUS_NAMESPACE
+
+// Compresses the values of chosen tables with zstd in front of another
+// datalayer.  Each table trains a dictionary of its own from the first values
+// written to it, so that the redundancy between small records, which block
+// compression cannot see, is squeezed out too.  Values are decompressed only
+// when a reader asks for them; a get that passes no value never pays for it.
+//
+// Every value the backing store holds carries a one-byte header saying how
+// it was stored, so a store that has been compressed must always be opened
+// through this class, even once no table is chosen.  The dictionaries
+// directory beneath the data directory marks such a store.  Scans return
+// plain values, so replicas never need each other's dictionaries.
+class compressed_datalayer : public datalayer
+{
+    public:
+        // takes ownership of backing
+        compressed_datalayer(datalayer* backing, const std::vector<std::string>& tables);
+        virtual ~compressed_datalayer() throw ();
+
+    public:
+        // the directory whose presence marks a compressed store in data
+        static std::string dictionary_dir(const std::string& data);
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual datalayer::snapshot* create_snapshot();
+        virtual consus_returncode raw_scan(const datalayer::snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared);
+        virtual consus_returncode checkpoint_locks();
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done);
+        virtual unsigned write_pressure();
+        virtual void stats(storage_stats* st);
+
+    public:
+        std::string debug_dump();
+
+    private:
+        struct dictionary;
+        struct table_state;
+        struct reference;
+
+    private:
+        bool load_dictionaries();
+        bool save_dictionary(const std::string& table, const std::string& dict, unsigned id);
+        // the state of a compressed table, or NULL for tables stored as is
+        table_state* get_table(const e::slice& table);
+        dictionary* get_dictionary(unsigned id);
+        // adds value to the table's training samples, and trains its
+        // dictionary once there are enough
+        void sample(table_state* ts, const e::slice& value);
+        void encode(table_state* ts, const e::slice& value, std::string* out);
+        bool decode(const e::slice& stored, std::string* out);
+        bool decode_items(std::vector<raw_item>* items);
+        // contexts are costly to create, so idle ones are kept for reuse
+        ZSTD_CCtx_s* acquire_cctx();
+        void release_cctx(ZSTD_CCtx_s* cctx);
+        ZSTD_DCtx_s* acquire_dctx();
+        void release_dctx(ZSTD_DCtx_s* dctx);
+
+    private:
+        const std::auto_ptr<datalayer> m_backing;
+        std::string m_dict_dir;
+        po6::threads::mutex m_mtx;
+        std::map<std::string, table_state*> m_states;
+        std::map<unsigned, dictionary*> m_dicts;
+        std::vector<ZSTD_CCtx_s*> m_cctxs;
+        std::vector<ZSTD_DCtx_s*> m_dctxs;
+        uint64_t m_bytes_in;
+        uint64_t m_bytes_out;
+        uint64_t m_decompressions;
+
+    private:
+        compressed_datalayer(const compressed_datalayer&);
+        compressed_datalayer& operator = (const compressed_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_compressed_datalayer_h_
@@ -25,22 +25,50 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
-// e
-#include <e/endian.h>
+// STL
+#include <algorithm>
+#include <set>
 
 // consus
+#include "common/hash.h"
 #include "common/kvs_configuration.h"
+#include "common/topology.h"
 #include "kvs/configuration.h"
 
 using consus::configuration;
 
+// a delta touching more partitions than this is applied by rebuilding the
+// whole cache instead of refreshing just the affected entries
+#define DELTA_REFRESH_MAX_PARTITIONS 1024
+
+static unsigned
+distinct_owners(const consus::ring& r)
+{
+    std::set<consus::comm_id> owners;
+
+    for (size_t p = 0; p < r.partitions.size(); ++p)
+    {
+        if (r.partitions[p].owner != consus::comm_id() &&
+            (p == 0 || r.partitions[p - 1].owner != r.partitions[p].owner))
+        {
+            owners.insert(r.partitions[p].owner);
+        }
+    }
+
+    return owners.size();
+}
+
 struct configuration::cached_ring
 {
-    cached_ring() : dc() {}
+    cached_ring() : dc(), distinct(0), replica_sets() {}
     ~cached_ring() throw () {}
 
     data_center_id dc;
-    size_t replica_sets[CONSUS_KVS_PARTITIONS];
+    // number of distinct owners in the ring; a replica set can never have
+    // more members than this
+    unsigned distinct;
+    // by partition
+    std::vector<size_t> replica_sets;
 };
 
 configuration :: configuration()
@@ -49,8 +77,14 @@ configuration :: configuration()
     , m_flags(0)
     , m_kvss()
     , m_rings()
+    , m_tables()
+    , m_export_timestamp(0)
+    , m_compaction(0)
+    , m_compaction_first(0)
+    , m_compaction_last(0)
     , m_cached_replica_sets()
     , m_cached_rings()
+    , m_cached_replica_sets_built(0)
 {
 }
 
@@ -86,6 +120,33 @@ configuration :: get_data_center(comm_id id) const
     return data_center_id();
 }
 
+unsigned
+configuration :: distance(comm_id a, comm_id b) const
+{
+    const kvs* ka = NULL;
+    const kvs* kb = NULL;
+
+    for (size_t i = 0; i < m_kvss.size(); ++i)
+    {
+        if (m_kvss[i].kv.id == a)
+        {
+            ka = &m_kvss[i].kv;
+        }
+
+        if (m_kvss[i].kv.id == b)
+        {
+            kb = &m_kvss[i].kv;
+        }
+    }
+
+    if (!ka || !kb)
+    {
+        return 2;
+    }
+
+    return topology_distance(ka->zone, ka->rack, kb->zone, kb->rack);
+}
+
 po6::net::location
 configuration :: get_address(comm_id id) const
 {
@@ -122,25 +183,21 @@ configuration :: daemons() const
 
 bool
 configuration :: hash(data_center_id dc,
-                      const e::slice& /* table XXX */,
+                      const e::slice& table,
                       const e::slice& key,
                       replica_set* rs)
 {
-    // XXX use a better mapping scheme
-    char buf[sizeof(uint16_t)];
-    memset(buf, 0, sizeof(buf));
-    memmove(buf, key.data(), key.size() < 2 ? key.size() : 2);
-    uint16_t index;
-    e::unpack16be(buf, &index);
+    // the high bits of the hash select one of CONSUS_KVS_PARTITIONS slots
+    const uint16_t index = hash64(table, key) >> 48;
 
     for (size_t i = 0; i < m_rings.size(); ++i)
     {
         if (m_cached_rings[i].dc == dc)
         {
-            size_t r = m_cached_rings[i].replica_sets[index];
+            size_t r = m_cached_rings[i].replica_sets[m_rings[i].partition_for(index)];
             assert(r < m_cached_replica_sets.size());
             *rs = m_cached_replica_sets[r];
-            rs->desired_replication = 5;//XXX
+            rs->desired_replication = replication(table);
 
             if (rs->num_replicas > rs->desired_replication)
             {
@@ -154,6 +211,50 @@ configuration :: hash(data_center_id dc,
     return false;
 }
 
+unsigned
+configuration :: replication(const e::slice& table) const
+{
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (e::slice(m_tables[i].name) == table)
+        {
+            return m_tables[i].replication;
+        }
+    }
+
+    return CONSUS_DEFAULT_REPLICATION_FACTOR;
+}
+
+bool
+configuration :: replicas(data_center_id dc, uint16_t index, replica_set* rs)
+{
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        if (m_cached_rings[i].dc == dc)
+        {
+            size_t r = m_cached_rings[i].replica_sets[m_rings[i].partition_for(index)];
+            assert(r < m_cached_replica_sets.size());
+            *rs = m_cached_replica_sets[r];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned
+configuration :: min_replication() const
+{
+    unsigned m = CONSUS_DEFAULT_REPLICATION_FACTOR;
+
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        m = std::min(m, m_tables[i].replication);
+    }
+
+    return m;
+}
+
 std::vector<consus::comm_id>
 configuration :: ids()
 {
@@ -185,7 +286,7 @@ configuration :: owner_from_next_id(partition_id id)
 {
     for (size_t i = 0; i < m_rings.size(); ++i)
     {
-        for (unsigned p = 0; p < CONSUS_KVS_PARTITIONS; ++p)
+        for (unsigned p = 0; p < m_rings[i].partitions.size(); ++p)
         {
             if (m_rings[i].partitions[p].next_id == id)
             {
@@ -197,10 +298,134 @@ configuration :: owner_from_next_id(partition_id id)
     return comm_id();
 }
 
+bool
+configuration :: slots_from_next_id(partition_id id, unsigned* lower, unsigned* upper)
+{
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        for (unsigned p = 0; p < m_rings[i].partitions.size(); ++p)
+        {
+            if (m_rings[i].partitions[p].next_id == id)
+            {
+                *lower = m_rings[i].first_slot(p);
+                *upper = m_rings[i].first_slot(p + 1);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
 std::string
 configuration :: dump() const
 {
-    return kvs_configuration(m_cluster, m_version, m_flags, m_kvss, m_rings);
+    return kvs_configuration(m_cluster, m_version, m_flags, m_kvss, m_rings, m_tables);
+}
+
+bool
+configuration :: apply_delta(const configuration& base, const char* data, size_t data_sz)
+{
+    cluster_id cid;
+    version_id base_vid;
+    version_id vid;
+    uint64_t flags = 0;
+    bool full = false;
+    std::vector<kvs_state> kvss;
+    std::vector<table_config> tables;
+    uint64_t rings_sz = 0;
+    std::vector<uint32_t> rings;
+    std::vector<partition> partitions;
+    e::unpacker up(data, data_sz);
+    uint64_t export_timestamp = 0;
+    uint64_t compaction = 0;
+    uint16_t compaction_first = 0;
+    uint16_t compaction_last = 0;
+    up = kvs_configuration_delta(up, &cid, &base_vid, &vid, &flags, &full,
+                                 &kvss, &tables, &rings_sz, &rings, &partitions);
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> export_timestamp;
+    }
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> compaction >> compaction_first >> compaction_last;
+    }
+
+    if (up.error() || up.remain() || full ||
+        cid != base.m_cluster ||
+        base.m_version < base_vid ||
+        base.m_version >= vid ||
+        rings_sz != base.m_rings.size() ||
+        rings.size() != partitions.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < rings.size(); ++i)
+    {
+        // a split resizes the ring, which only a full fetch carries
+        if (rings[i] >= rings_sz ||
+            partitions[i].index >= base.m_rings[rings[i]].partitions.size())
+        {
+            return false;
+        }
+    }
+
+    m_cluster = cid;
+    m_version = vid;
+    m_flags = flags;
+    m_kvss.swap(kvss);
+    m_tables.swap(tables);
+    m_export_timestamp = export_timestamp;
+    m_compaction = compaction;
+    m_compaction_first = compaction_first;
+    m_compaction_last = compaction_last;
+    m_rings = base.m_rings;
+    m_cached_replica_sets = base.m_cached_replica_sets;
+    m_cached_rings = base.m_cached_rings;
+    m_cached_replica_sets_built = base.m_cached_replica_sets_built;
+    std::vector<std::vector<uint16_t> > changed(m_rings.size());
+
+    for (size_t i = 0; i < rings.size(); ++i)
+    {
+        m_rings[rings[i]].partitions[partitions[i].index] = partitions[i];
+        changed[rings[i]].push_back(partitions[i].index);
+    }
+
+    // refreshing appends replica sets without reclaiming the ones it
+    // replaces, so rebuild once enough garbage accumulates
+    bool rebuild = partitions.size() > DELTA_REFRESH_MAX_PARTITIONS ||
+                   m_cached_replica_sets.size() > 2 * m_cached_replica_sets_built +
+                                                  DELTA_REFRESH_MAX_PARTITIONS;
+
+    for (size_t i = 0; !rebuild && i < m_rings.size(); ++i)
+    {
+        // gaining or losing an owner changes how far every lookup scans
+        if (!changed[i].empty() &&
+            distinct_owners(m_rings[i]) != m_cached_rings[i].distinct)
+        {
+            rebuild = true;
+        }
+    }
+
+    if (rebuild)
+    {
+        reconstruct_cache();
+        return true;
+    }
+
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        if (!changed[i].empty())
+        {
+            refresh_cache(i, changed[i]);
+        }
+    }
+
+    return true;
 }
 
 void
@@ -213,8 +438,10 @@ configuration :: reconstruct_cache()
     for (size_t i = 0; i < m_rings.size(); ++i)
     {
         m_cached_rings[i].dc = m_rings[i].dc;
+        m_cached_rings[i].distinct = distinct_owners(m_rings[i]);
+        m_cached_rings[i].replica_sets.resize(m_rings[i].partitions.size());
 
-        for (size_t idx = 0; idx < CONSUS_KVS_PARTITIONS; ++idx)
+        for (size_t idx = 0; idx < m_rings[i].partitions.size(); ++idx)
         {
             replica_set rs;
             rs.desired_replication = CONSUS_MAX_REPLICATION_FACTOR;
@@ -223,7 +450,7 @@ configuration :: reconstruct_cache()
                 m_cached_replica_sets.back().replicas[0] != m_rings[i].partitions[idx].owner ||
                 m_cached_replica_sets.back().transitioning[0] != m_rings[i].partitions[idx].next_owner)
             {
-                lookup(&m_rings[i], idx, &rs);
+                lookup(&m_rings[i], idx, m_cached_rings[i].distinct, &rs);
 
                 if (m_cached_replica_sets.empty() || m_cached_replica_sets.back() != rs)
                 {
@@ -234,38 +461,99 @@ configuration :: reconstruct_cache()
             m_cached_rings[i].replica_sets[idx] = m_cached_replica_sets.size() - 1;
         }
     }
+
+    m_cached_replica_sets_built = m_cached_replica_sets.size();
+}
+
+void
+configuration :: refresh_cache(size_t ring_idx, const std::vector<uint16_t>& changed)
+{
+    ring* r = &m_rings[ring_idx];
+    cached_ring* cr = &m_cached_rings[ring_idx];
+    const unsigned want = std::min(cr->distinct, unsigned(CONSUS_MAX_REPLICATION_FACTOR));
+    const size_t sz = r->partitions.size();
+
+    if (want == 0)
+    {
+        return;
+    }
+
+    for (size_t c = 0; c < changed.size(); ++c)
+    {
+        // a lookup starting at idx reads partitions from idx onward until it
+        // has seen want distinct owners; walk backward from the changed
+        // partition until [idx, changed) alone holds that many, at which
+        // point no lookup starting further back can reach the change
+        std::vector<comm_id> seen;
+
+        for (size_t step = 0; step < sz; ++step)
+        {
+            const size_t idx = (changed[c] + sz - step) % sz;
+
+            if (step > 0 && r->partitions[idx].owner != comm_id() &&
+                std::find(seen.begin(), seen.end(), r->partitions[idx].owner) == seen.end())
+            {
+                seen.push_back(r->partitions[idx].owner);
+            }
+
+            if (seen.size() >= want)
+            {
+                break;
+            }
+
+            replica_set rs;
+            rs.desired_replication = CONSUS_MAX_REPLICATION_FACTOR;
+            lookup(r, idx, cr->distinct, &rs);
+            size_t* slot = &cr->replica_sets[idx];
+
+            if (m_cached_replica_sets[*slot] != rs)
+            {
+                if (m_cached_replica_sets.back() != rs)
+                {
+                    m_cached_replica_sets.push_back(rs);
+                }
+
+                *slot = m_cached_replica_sets.size() - 1;
+            }
+        }
+    }
 }
 
 void
-configuration :: lookup(ring* r, uint16_t idx, replica_set* rs)
+configuration :: lookup(ring* r, uint16_t idx, unsigned distinct, replica_set* rs)
 {
     assert(rs->desired_replication <= CONSUS_MAX_REPLICATION_FACTOR);
+    const unsigned want = std::min(rs->desired_replication, distinct);
     rs->num_replicas = 0;
     rs->replicas[0] = comm_id();
 
-    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS && rs->num_replicas < rs->desired_replication; ++i)
+    for (size_t i = 0; i < r->partitions.size() && rs->num_replicas < want; ++i)
     {
-        partition* p = &r->partitions[(idx + i) % CONSUS_KVS_PARTITIONS];
+        partition* p = &r->partitions[(idx + i) % r->partitions.size()];
 
-        // if the partition is assigned, we haven't wrapped around, and it's not
-        // the same as the previous partition
-        if (p->owner != comm_id() && p->owner != rs->replicas[0] &&
-            (rs->num_replicas == 0 || rs->replicas[rs->num_replicas - 1] != p->owner))
+        // if the partition is assigned and its owner is not already a replica
+        if (p->owner == comm_id() ||
+            (rs->num_replicas > 0 && rs->replicas[rs->num_replicas - 1] == p->owner) ||
+            std::find(rs->replicas, rs->replicas + rs->num_replicas, p->owner) !=
+                rs->replicas + rs->num_replicas)
         {
-            rs->replicas[rs->num_replicas] = p->owner;
-            rs->transitioning[rs->num_replicas] = p->next_owner;
-            ++rs->num_replicas;
+            continue;
         }
+
+        rs->replicas[rs->num_replicas] = p->owner;
+        rs->transitioning[rs->num_replicas] = p->next_owner;
+        ++rs->num_replicas;
     }
 }
 
 void
 configuration :: migratable_partitions(comm_id id, ring* r, std::vector<partition_id>* parts)
 {
-    const partition* end_of_ring = r->partitions + CONSUS_KVS_PARTITIONS;
+    partition* const start_of_ring = &r->partitions[0];
+    const partition* end_of_ring = start_of_ring + r->partitions.size();
     partition* ptr = NULL;
 
-    for (unsigned p = 0; p < CONSUS_KVS_PARTITIONS; ++p)
+    for (unsigned p = 0; p < r->partitions.size(); ++p)
     {
         if (r->partitions[p].owner == id)
         {
@@ -277,7 +565,7 @@ configuration :: migratable_partitions(comm_id id, ring* r, std::vector<partitio
     if (ptr)
     {
         // add partition directly in front of ptr if we're commandeering it
-        if (ptr - r->partitions > 0 &&
+        if (ptr - start_of_ring > 0 &&
             (ptr - 1)->next_owner == id)
         {
             parts->push_back((ptr - 1)->next_id);
@@ -297,7 +585,7 @@ configuration :: migratable_partitions(comm_id id, ring* r, std::vector<partitio
         return;
     }
 
-    for (unsigned p = 0; p < CONSUS_KVS_PARTITIONS; ++p)
+    for (unsigned p = 0; p < r->partitions.size(); ++p)
     {
         if (r->partitions[p].next_owner == id)
         {
@@ -315,7 +603,7 @@ configuration :: migratable_partitions(comm_id id, ring* r, std::vector<partitio
 
     while (ptr < end_of_ring && ptr->next_owner == id)
     {
-        if (ptr == r->partitions ||
+        if (ptr == start_of_ring ||
             ptr + 1 == end_of_ring ||
             (ptr - 1)->owner != ptr->owner ||
             ptr->owner != (ptr + 1)->owner)
@@ -336,7 +624,17 @@ configuration :: migratable_partitions(comm_id id, ring* r, std::vector<partitio
 e::unpacker
 consus :: operator >> (e::unpacker up, configuration& c)
 {
-    up = kvs_configuration(up, &c.m_cluster, &c.m_version, &c.m_flags, &c.m_kvss, &c.m_rings);
+    up = kvs_configuration(up, &c.m_cluster, &c.m_version, &c.m_flags, &c.m_kvss, &c.m_rings, &c.m_tables);
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> c.m_export_timestamp;
+    }
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> c.m_compaction >> c.m_compaction_first >> c.m_compaction_last;
+    }
 
     if (up.error())
     {
@@ -33,6 +33,7 @@
 #include "common/ids.h"
 #include "common/kvs_state.h"
 #include "common/ring.h"
+#include "common/table_config.h"
 #include "kvs/replica_set.h"
 
 BEGIN_CONSUS_NAMESPACE
@@ -47,6 +48,13 @@ class configuration
     public:
         cluster_id cluster() const { return m_cluster; }
         version_id version() const { return m_version; }
+        // the most recent export requested through the coordinator, or 0
+        uint64_t export_timestamp() const { return m_export_timestamp; }
+        // the most recent compaction requested through the coordinator,
+        // numbered from 1 with 0 for none, and the partitions it covers
+        uint64_t compaction() const { return m_compaction; }
+        uint16_t compaction_first() const { return m_compaction_first; }
+        uint16_t compaction_last() const { return m_compaction_last; }
 
     // kvs daemons
     public:
@@ -54,6 +62,8 @@ class configuration
         data_center_id get_data_center(comm_id id) const;
         po6::net::location get_address(comm_id id) const;
         kvs_state::state_t get_state(comm_id id) const;
+        // per topology_distance; 2 if either is unknown
+        unsigned distance(comm_id a, comm_id b) const;
         size_t daemons() const;
 
     // hashing
@@ -62,6 +72,13 @@ class configuration
                   const e::slice& table,
                   const e::slice& key,
                   replica_set* rs);
+        unsigned replication(const e::slice& table) const;
+        const std::vector<table_config>& tables() const { return m_tables; }
+        // every replica of the partition covering slot index, regardless of
+        // any table's replication
+        bool replicas(data_center_id dc, uint16_t index, replica_set* rs);
+        // the fewest replicas any table keeps
+        unsigned min_replication() const;
 
     // XXX these APIs could be better designed or use better datastructures;
     // reevaluate them and their consistency with respect to other calls in this
@@ -70,17 +87,25 @@ class configuration
         std::vector<comm_id> ids();
         std::vector<partition_id> migratable_partitions(comm_id id);
         comm_id owner_from_next_id(partition_id id);
+        // the slots [lower, upper) of the partition migrating under id
+        bool slots_from_next_id(partition_id id, unsigned* lower, unsigned* upper);
 
     // debug/internal
     public:
         std::string dump() const;
+        // become base with a delta from kvs_configuration_delta applied,
+        // refreshing only the cached replica sets the delta can affect;
+        // false if base predates the delta's base version, is not older than
+        // the delta, or the delta asks for a full fetch
+        bool apply_delta(const configuration& base, const char* data, size_t data_sz);
 
     private:
         struct cached_ring;
 
     private:
         void reconstruct_cache();
-        void lookup(ring* r, uint16_t idx, replica_set* rs);
+        void refresh_cache(size_t ring_idx, const std::vector<uint16_t>& changed);
+        void lookup(ring* r, uint16_t idx, unsigned distinct, replica_set* rs);
 
     // XXX same as above xxx about APIs
     private:
@@ -95,10 +120,17 @@ class configuration
         uint64_t m_flags;
         std::vector<kvs_state> m_kvss;
         std::vector<ring> m_rings;
+        std::vector<table_config> m_tables;
+        uint64_t m_export_timestamp;
+        uint64_t m_compaction;
+        uint16_t m_compaction_first;
+        uint16_t m_compaction_last;
 
         // cached data
         std::vector<replica_set> m_cached_replica_sets;
         std::vector<cached_ring> m_cached_rings;
+        // m_cached_replica_sets.size() after the last full reconstruction
+        size_t m_cached_replica_sets_built;
 
     private:
         configuration(const configuration& other);
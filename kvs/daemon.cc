@@ -35,11 +35,17 @@
 #include <stdlib.h>
 
 // POSIX
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 // STL
 #include <algorithm>
+#include <deque>
+#include <map>
+#include <sstream>
 
 // Google Log
 #include <glog/logging.h>
@@ -63,19 +69,77 @@
 
 // consus
 #include <consus.h>
+#include "common/alloc_stats.h"
 #include "common/background_thread.h"
+#include "common/buffer_pool.h"
+#include "common/bulk_load.h"
+#include "common/busy_poller.h"
 #include "common/constants.h"
 #include "common/consus.h"
+#include "common/cpu_affinity.h"
 #include "common/generate_token.h"
+#include "common/hash.h"
 #include "common/lock.h"
 #include "common/macros.h"
 #include "common/network_msgtype.h"
+#include "common/probes.h"
+#include "common/random_id.h"
 #include "common/transaction_group.h"
 #include "kvs/daemon.h"
 #include "kvs/leveldb_datalayer.h"
+#ifdef CONSUS_ROCKSDB
+#include "kvs/rocksdb_datalayer.h"
+#endif
 
 using consus::daemon;
 
+// how often the pumping thread checks for due state machines
+#define PUMP_TICK (PO6_MILLIS * 10)
+// how often lazily-persisted locks are forced to disk
+#define LOCK_CHECKPOINT_INTERVAL (PO6_SECONDS * 1)
+// the pruner examines this many versions per step, one step per tick, and
+// starts a new pass over the store this long after finishing the last
+#define PRUNE_STEP 4096
+#define PRUNE_TICK (PO6_MILLIS * 50)
+#define PRUNE_PASS_INTERVAL (PO6_SECONDS * 60)
+// sweep expired versions in steps this big, and start a pass this often
+#define SWEEP_STEP 4096
+#define SWEEP_PASS_INTERVAL (PO6_SECONDS * 10)
+// move cold keys in steps this big, and start a pass this often
+#define TIER_STEP 4096
+#define TIER_PASS_INTERVAL (PO6_SECONDS * 3600)
+// lock recovery reads this many durable locks at a time
+#define LOCK_RECOVERY_STEP 1024
+// how often traffic is reported to the coordinator, naming at most this many
+// of the hottest partitions
+#define LOAD_REPORT_INTERVAL (PO6_SECONDS * 10)
+#define LOAD_REPORT_HOTTEST 64
+// how stale the load piggybacked on responses may be
+#define LOAD_SAMPLE_INTERVAL (PO6_MILLIS * 10)
+// a migration batch stops growing once it carries this many bytes...
+#define MIGRATE_BATCH_BYTES (4ULL * 1024ULL * 1024ULL)
+// ...or once this many stored versions have been examined for it
+#define MIGRATE_SCAN_LIMIT 65536
+// versions fetched from the datalayer per step while filling a batch
+#define MIGRATE_SCAN_STEP 256
+// finished migrations wait this long to be reported together
+#define MIGRATED_BATCH_WINDOW (100ULL * PO6_MILLIS)
+// how often hinted writes are offered to the next owners of partitions
+#define HANDOFF_REPLAY_INTERVAL (PO6_MILLIS * 250)
+// an export starts once transactions that began by its timestamp have had this
+// long to commit, checking the configuration for new requests every tick...
+#define EXPORT_SETTLE (PO6_SECONDS * 30)
+#define EXPORT_TICK (PO6_SECONDS * 1)
+// ...and examines this many versions per step, writing out what it has
+// gathered whenever it reaches this many bytes
+#define EXPORT_SCAN_STEP 1024
+#define EXPORT_BUFFER_BYTES (16ULL * 1024ULL * 1024ULL)
+// compaction takes at most one step per tick, so foreground latency is
+// sampled between steps
+#define COMPACTION_TICK (PO6_SECONDS * 1)
+// partitions remembered across a restart for warming the store
+#define WARM_UP_HOTTEST 256
+
 #define CHECK_UNPACK(MSGTYPE, UNPACKER) \
     do \
     { \
@@ -116,11 +180,17 @@ struct daemon::coordinator_callback : public coordinator_link::callback
     coordinator_callback(daemon* d);
     virtual ~coordinator_callback() throw ();
     virtual std::string prefix() { return "kvs"; }
+    virtual std::string registration_extra();
     virtual bool new_config(const char* data, size_t data_sz);
+    virtual bool follows_deltas() { return true; }
+    virtual bool new_config_delta(const char* data, size_t data_sz);
     virtual bool has_id(comm_id id);
     virtual po6::net::location address(comm_id id);
     virtual bool is_steady_state(comm_id id);
 
+    private:
+        void install(std::auto_ptr<configuration> c);
+
     private:
         daemon* d;
         coordinator_callback(const coordinator_callback&);
@@ -135,12 +205,16 @@ class daemon::migration_bgthread : public consus::background_thread
 
     public:
         void new_config();
+        void migrated(partition_id part);
 
     protected:
         virtual const char* thread_name();
         virtual bool have_work();
         virtual void do_work();
 
+    private:
+        void report_migrated();
+
     private:
         migration_bgthread(const migration_bgthread&);
         migration_bgthread& operator = (const migration_bgthread&);
@@ -148,6 +222,45 @@ class daemon::migration_bgthread : public consus::background_thread
     private:
         daemon* m_d;
         bool m_have_new_config;
+        std::vector<partition_id> m_migrated;
+};
+
+// Serves migration pulls one at a time, off the network threads.  Each pull
+// carries the cursor its batch resumes from, so a pull superseded by a newer
+// one from the same destination is simply dropped.
+class daemon::migrate_pull_bgthread : public consus::background_thread
+{
+    public:
+        migrate_pull_bgthread(daemon* d);
+        virtual ~migrate_pull_bgthread() throw ();
+
+    public:
+        void enqueue(comm_id id, partition_id key, version_id version,
+                     uint64_t seqno, const std::string& cursor);
+
+    protected:
+        virtual const char* thread_name();
+        virtual bool have_work();
+        virtual void do_work();
+
+    private:
+        struct pull
+        {
+            pull() : id(), key(), version(), seqno(0), cursor() {}
+            comm_id id;
+            partition_id key;
+            version_id version;
+            uint64_t seqno;
+            std::string cursor;
+        };
+
+    private:
+        migrate_pull_bgthread(const migrate_pull_bgthread&);
+        migrate_pull_bgthread& operator = (const migrate_pull_bgthread&);
+
+    private:
+        daemon* m_d;
+        std::deque<pull> m_pulls;
 };
 
 daemon :: coordinator_callback :: coordinator_callback(daemon* _d)
@@ -183,6 +296,16 @@ split_by_newlines(std::string s)
     return v;
 }
 
+std::string
+daemon :: coordinator_callback :: registration_extra()
+{
+    std::string extra;
+    e::packer(&extra) << d->m_us.capacity
+                      << e::slice(d->m_us.zone)
+                      << e::slice(d->m_us.rack);
+    return extra;
+}
+
 bool
 daemon :: coordinator_callback :: new_config(const char* data, size_t data_sz)
 {
@@ -196,8 +319,37 @@ daemon :: coordinator_callback :: new_config(const char* data, size_t data_sz)
         return false;
     }
 
+    install(c);
+    return true;
+}
+
+bool
+daemon :: coordinator_callback :: new_config_delta(const char* data, size_t data_sz)
+{
+    configuration* base = d->get_config();
+
+    if (!base)
+    {
+        return false;
+    }
+
+    std::auto_ptr<configuration> c(new configuration());
+
+    if (!c->apply_delta(*base, data, data_sz))
+    {
+        return false;
+    }
+
+    install(c);
+    return true;
+}
+
+void
+daemon :: coordinator_callback :: install(std::auto_ptr<configuration> c)
+{
     configuration* old_config = d->get_config();
     d->m_us.dc = c->get_data_center(d->m_us.id);
+    d->m_table_ids.learn(c->tables());
     e::atomic::store_ptr_release(&d->m_config, c.release());
     d->m_gc.collect(old_config, e::garbage_collector::free_ptr<configuration>);
     d->m_migrate_thread->new_config();
@@ -218,8 +370,6 @@ daemon :: coordinator_callback :: new_config(const char* data, size_t data_sz)
         LOG(INFO) << "===  end debug dump of configuration  ===";
     }
 #endif
-
-    return true;
 }
 
 bool
@@ -265,6 +415,7 @@ daemon :: migration_bgthread :: migration_bgthread(daemon* d)
     : background_thread(&d->m_gc)
     , m_d(d)
     , m_have_new_config(false)
+    , m_migrated()
 {
 }
 
@@ -280,6 +431,14 @@ daemon :: migration_bgthread :: new_config()
     wakeup();
 }
 
+void
+daemon :: migration_bgthread :: migrated(partition_id part)
+{
+    po6::threads::mutex::hold hold(mtx());
+    m_migrated.push_back(part);
+    wakeup();
+}
+
 const char*
 daemon :: migration_bgthread :: thread_name()
 {
@@ -289,17 +448,27 @@ daemon :: migration_bgthread :: thread_name()
 bool
 daemon :: migration_bgthread :: have_work()
 {
-    return m_have_new_config;
+    return m_have_new_config || !m_migrated.empty();
 }
 
 void
 daemon :: migration_bgthread :: do_work()
 {
+    bool have_new_config;
+
     {
         po6::threads::mutex::hold hold(mtx());
+        have_new_config = m_have_new_config;
         m_have_new_config = false;
     }
 
+    if (!have_new_config)
+    {
+        // give partitions finishing alongside this one a chance to join it
+        po6::sleep(MIGRATED_BATCH_WINDOW);
+        return report_migrated();
+    }
+
     configuration* c = m_d->get_config();
     std::vector<partition_id> parts = c->migratable_partitions(m_d->m_us.id);
 
@@ -310,6 +479,12 @@ daemon :: migration_bgthread :: do_work()
         m->externally_work_state_machine(m_d);
     }
 
+    // partitions that moved away take their files with them
+    if (m_d->m_shards)
+    {
+        m_d->m_shards->drop_unowned(c, m_d->m_us.dc, m_d->m_us.id);
+    }
+
     // XXX add a true ticker to drive state machine (call ext_work_sm every X
     // seconds)
     po6::sleep(PO6_SECONDS);
@@ -325,8 +500,108 @@ daemon :: migration_bgthread :: do_work()
         else
         {
             m->terminate();
+            m_d->m_migration_sched.release(m->state_key());
+        }
+    }
+
+    report_migrated();
+}
+
+daemon :: migrate_pull_bgthread :: migrate_pull_bgthread(daemon* d)
+    : background_thread(&d->m_gc)
+    , m_d(d)
+    , m_pulls()
+{
+}
+
+daemon :: migrate_pull_bgthread :: ~migrate_pull_bgthread() throw ()
+{
+}
+
+void
+daemon :: migrate_pull_bgthread :: enqueue(comm_id id, partition_id key, version_id version,
+                                            uint64_t seqno, const std::string& cursor)
+{
+    po6::threads::mutex::hold hold(mtx());
+
+    for (std::deque<pull>::iterator it = m_pulls.begin(); it != m_pulls.end(); ++it)
+    {
+        // the destination applies only the answer to its newest pull
+        if (it->id == id && it->key == key)
+        {
+            if (it->seqno <= seqno)
+            {
+                it->version = version;
+                it->seqno = seqno;
+                it->cursor = cursor;
+            }
+
+            return;
+        }
+    }
+
+    m_pulls.push_back(pull());
+    m_pulls.back().id = id;
+    m_pulls.back().key = key;
+    m_pulls.back().version = version;
+    m_pulls.back().seqno = seqno;
+    m_pulls.back().cursor = cursor;
+    wakeup();
+}
+
+const char*
+daemon :: migrate_pull_bgthread :: thread_name()
+{
+    return "migrate-pull";
+}
+
+bool
+daemon :: migrate_pull_bgthread :: have_work()
+{
+    return !m_pulls.empty();
+}
+
+void
+daemon :: migrate_pull_bgthread :: do_work()
+{
+    pull p;
+
+    {
+        po6::threads::mutex::hold hold(mtx());
+
+        if (m_pulls.empty())
+        {
+            return;
         }
+
+        p = m_pulls.front();
+        m_pulls.pop_front();
+    }
+
+    m_d->serve_migrate_pull(p.id, p.key, p.version, p.seqno, p.cursor);
+}
+
+void
+daemon :: migration_bgthread :: report_migrated()
+{
+    std::vector<partition_id> parts;
+
+    {
+        po6::threads::mutex::hold hold(mtx());
+        parts.swap(m_migrated);
     }
+
+    if (parts.empty())
+    {
+        return;
+    }
+
+    std::sort(parts.begin(), parts.end());
+    parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+    std::string msg;
+    e::packer(&msg) << parts;
+    m_d->m_coord->fire_and_forget("kvs_migrated_batch", msg.data(), msg.size());
+    LOG_IF(INFO, s_debug_mode) << "reported " << parts.size() << " migrated partitions to the coordinator";
 }
 
 daemon :: daemon()
@@ -334,18 +609,69 @@ daemon :: daemon()
     , m_gc()
     , m_busybee_controller(this)
     , m_busybee()
+    , m_rtt()
     , m_coord_cb()
     , m_coord()
     , m_config(NULL)
     , m_threads()
+    , m_cpus()
+    , m_busy_poll(0)
     , m_data()
+    , m_row_cache(NULL)
+    , m_expiring(NULL)
+    , m_shards(NULL)
+    , m_compressed(NULL)
+    , m_chunked(NULL)
+    , m_tiered(NULL)
+    , m_storage(NULL)
+    , m_responses()
+    , m_pressure_mtx()
+    , m_pressure_sampled(0)
+    , m_pressure(0)
+    , m_write_throttle()
     , m_locks(&m_gc)
     , m_repl_lk(&m_gc)
     , m_repl_rd(&m_gc)
     , m_repl_wr(&m_gc)
+    , m_repl_sc(&m_gc)
     , m_migrations(&m_gc)
     , m_migrate_thread(new migration_bgthread(this))
+    , m_migrate_pull_thread(new migrate_pull_bgthread(this))
+    , m_migration_sched()
+    , m_handoff()
+    , m_migration_snapshots()
+    , m_anti_entropy()
+    , m_load()
+    , m_last_load_report(0)
+    , m_hot()
+    , m_tables()
+    , m_table_ids()
+    , m_pump_queue()
     , m_pumping_thread(po6::threads::make_obj_func(&daemon::pump, this))
+    , m_version_retention(0)
+    , m_write_catchup(0)
+    , m_write_catchup_bytes(0)
+    , m_pruning_thread(po6::threads::make_obj_func(&daemon::prune, this))
+    , m_lock_recovery_thread(po6::threads::make_obj_func(&daemon::recover_locks, this))
+    , m_coalescer()
+    , m_coalescing_thread(po6::threads::make_obj_func(&daemon::coalesce, this))
+    , m_compactor()
+    , m_transport()
+    , m_local_transport()
+    , m_metrics(&m_gc)
+    , m_tracer()
+    , m_bulk_load()
+    , m_bulk_load_thread(po6::threads::make_obj_func(&daemon::bulk_load, this))
+    , m_data_dir()
+    , m_export_bytes_per_second(0)
+    , m_exporting_thread(po6::threads::make_obj_func(&daemon::export_tables, this))
+    , m_compaction()
+    , m_compact_when_idle(false)
+    , m_compaction_step(CONSUS_KVS_PARTITIONS)
+    , m_compactions_requested(0)
+    , m_compactions_idle(0)
+    , m_compactions_deferred(0)
+    , m_compacting_thread(po6::threads::make_obj_func(&daemon::compact_storage, this))
 {
 }
 
@@ -365,7 +691,41 @@ daemon :: run(bool background,
               bool set_coordinator,
               const char* coordinator,
               const char* data_center,
-              unsigned threads)
+              uint64_t capacity,
+              const char* zone,
+              const char* rack,
+              unsigned threads,
+              uint64_t resend_default,
+              bool use_rocksdb,
+              bool lazy_locks,
+              unsigned migration_concurrency,
+              uint64_t migration_bytes_per_second,
+              uint64_t migration_batches_per_second,
+              uint64_t version_retention,
+              uint64_t write_catchup,
+              uint64_t anti_entropy_interval,
+              uint64_t row_cache_bytes,
+              uint64_t response_cache_bytes,
+              bool pin_threads,
+              uint64_t busy_poll,
+              uint64_t coalesce_window,
+              bool compact_messages,
+              const char* intra_dc_transport,
+              uint16_t metrics_port,
+              const char* trace_file,
+              const char* bulk_load,
+              uint64_t export_bytes_per_second,
+              uint64_t compaction_latency,
+              bool compact_when_idle,
+              unsigned lock_escalation,
+              uint64_t wound_delay,
+              unsigned data_shards,
+              uint64_t warm_up_bytes,
+              uint64_t value_chunk_bytes,
+              const char* cold_dir,
+              uint64_t cold_age,
+              const std::vector<std::string>& compress_tables,
+              const std::map<std::string, uint64_t>& expire_tables)
 {
     if (!e::block_all_signals())
     {
@@ -373,6 +733,22 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
+    alloc_stats::initialize();
+    m_rtt.set_default(resend_default);
+    m_migration_sched.set_limits(migration_concurrency,
+                                 migration_bytes_per_second,
+                                 migration_batches_per_second);
+    m_version_retention = version_retention;
+    m_write_catchup = write_catchup;
+    m_anti_entropy.set_interval(anti_entropy_interval);
+    m_responses.set_budget(response_cache_bytes);
+    m_data_dir = data;
+    m_export_bytes_per_second = export_bytes_per_second;
+    m_compaction.set_target(compaction_latency);
+    m_compact_when_idle = compact_when_idle;
+    m_locks.set_escalation_threshold(lock_escalation);
+    m_locks.set_wound_delay(wound_delay);
+
     if (!e::daemonize(background, log, "consus-txman-", pidfile, has_pidfile))
     {
         return EXIT_FAILURE;
@@ -389,13 +765,110 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
-    m_data.reset(new leveldb_datalayer());
+    if (data_shards > 1)
+    {
+#ifndef CONSUS_ROCKSDB
+        if (use_rocksdb)
+        {
+            LOG(ERROR) << "this build does not include the rocksdb datalayer";
+            return EXIT_FAILURE;
+        }
+#endif
+        m_shards = new sharded_datalayer(data_shards, use_rocksdb, lazy_locks);
+        m_data.reset(m_shards);
+        m_compaction_step = CONSUS_KVS_PARTITIONS / data_shards;
+    }
+    else if (use_rocksdb)
+    {
+#ifdef CONSUS_ROCKSDB
+        m_data.reset(new rocksdb_datalayer(lazy_locks));
+#else
+        LOG(ERROR) << "this build does not include the rocksdb datalayer";
+        return EXIT_FAILURE;
+#endif
+    }
+    else
+    {
+        m_data.reset(new leveldb_datalayer(lazy_locks));
+    }
+
+    m_storage = m_data.get();
+    std::string cold(cold_dir ? cold_dir : "");
+
+    // a store tiered once must always be read through both tiers, and the
+    // tiers sit beneath everything that changes what is stored
+    if (!cold.empty() || tiered_datalayer::recorded_cold_dir(data, &cold))
+    {
+        m_tiered = new tiered_datalayer(m_data.release(), new leveldb_datalayer(false), cold, cold_age);
+        m_data.reset(m_tiered);
+        LOG(INFO) << "moving keys untouched for " << cold_age / (PO6_SECONDS * 86400)
+                  << " days to the cold store in " << cold;
+    }
+
+    struct stat st;
+
+    // a store chunked once must always be read through the chunker, which
+    // sits beneath compression so that it splits what compression leaves
+    if (value_chunk_bytes > 0 ||
+        stat(chunked_datalayer::marker(data).c_str(), &st) == 0)
+    {
+        m_chunked = new chunked_datalayer(m_data.release(), value_chunk_bytes);
+        m_data.reset(m_chunked);
+
+        if (value_chunk_bytes > 0)
+        {
+            LOG(INFO) << "storing values larger than " << value_chunk_bytes << " bytes in chunks";
+        }
+    }
+
+    // a store compressed once must always be read through the compressor
+    if (!compress_tables.empty() ||
+        stat(compressed_datalayer::dictionary_dir(data).c_str(), &st) == 0)
+    {
+#ifdef CONSUS_ZSTD
+        m_compressed = new compressed_datalayer(m_data.release(), compress_tables);
+        m_data.reset(m_compressed);
+
+        for (size_t i = 0; i < compress_tables.size(); ++i)
+        {
+            LOG(INFO) << "compressing values of table "" << e::strescape(compress_tables[i]) << """;
+        }
+#else
+        LOG(ERROR) << "this build does not include value compression";
+        return EXIT_FAILURE;
+#endif
+    }
+
+    if (row_cache_bytes > 0)
+    {
+        m_row_cache = new row_cache(m_data.release(), row_cache_bytes);
+        m_data.reset(m_row_cache);
+    }
+
+    // outermost, so that nothing beneath hands out an expired version
+    if (!expire_tables.empty())
+    {
+        m_expiring = new expiring_datalayer(m_data.release(), expire_tables);
+        m_data.reset(m_expiring);
+
+        for (std::map<std::string, uint64_t>::const_iterator it = expire_tables.begin();
+                it != expire_tables.end(); ++it)
+        {
+            LOG(INFO) << "expiring versions of table \"" << e::strescape(it->first)
+                      << "\" after " << it->second / PO6_SECONDS << "s";
+        }
+    }
 
     if (!m_data->init(data))
     {
         return EXIT_FAILURE;
     }
 
+    if (warm_up_bytes > 0)
+    {
+        warm_up(warm_up_bytes, threads);
+    }
+
     bool saved;
     uint64_t id;
     std::string rendezvous(coordinator);
@@ -409,11 +882,14 @@ daemon :: run(bool background,
 
     m_us.id = comm_id(id);
     m_us.bind_to = bind_to;
+    m_us.capacity = capacity;
+    m_us.zone = zone;
+    m_us.rack = rack;
     bool (coordinator_link::*coordfunc)();
 
     if (saved)
     {
-        coordfunc = &coordinator_link::establish;
+        coordfunc = &coordinator_link::establish_cached;
     }
     else
     {
@@ -430,6 +906,7 @@ daemon :: run(bool background,
     m_coord_cb.reset(new coordinator_callback(this));
     m_coord.reset(new coordinator_link(rendezvous, m_us.id, m_us.bind_to, data_center, m_coord_cb.get()));
     m_coord->allow_reregistration();
+    m_coord->cache_config(po6::path::join(data, "KVS.config"));
     LOG(INFO) << "starting consus kvs-daemon " << m_us.id
               << " on address " << m_us.bind_to;
     LOG(INFO) << "connecting to " << rendezvous;
@@ -447,7 +924,49 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
+    // the transaction managers choose what to sample; trace whatever they tag
+    if (trace_file && !m_tracer.open(trace_file, 0, m_us.id))
+    {
+        return EXIT_FAILURE;
+    }
+
     m_busybee.reset(busybee_server::create(&m_busybee_controller, id, bind_to, &m_gc));
+    m_transport.reset(transport::create("busybee", m_busybee.get()));
+
+    if (intra_dc_transport)
+    {
+        m_local_transport.reset(transport::create(intra_dc_transport, m_busybee.get()));
+
+        if (!m_local_transport.get())
+        {
+            LOG(ERROR) << "there is no transport named " << intra_dc_transport
+                       << "; choose one of " << transport::names();
+            return EXIT_FAILURE;
+        }
+
+        LOG(INFO) << "reaching key-value stores in this data center over " << m_local_transport->name();
+    }
+
+    m_busy_poll = busy_poll;
+
+    if (m_busy_poll > 0)
+    {
+        LOG(INFO) << "network threads spin for up to " << m_busy_poll / 1000 << "us before blocking";
+    }
+
+    if (pin_threads)
+    {
+        m_cpus = cpus_by_socket();
+        LOG(INFO) << "pinning network threads to " << std::min(size_t(threads), m_cpus.size())
+                  << " of " << m_cpus.size() << " CPUs, one socket at a time";
+    }
+
+    if (metrics_port > 0 &&
+        !m_metrics.listen(po6::net::location(bind_to.address, metrics_port),
+                          &daemon::metrics_callback, this))
+    {
+        return EXIT_FAILURE;
+    }
 
     for (size_t i = 0; i < threads; ++i)
     {
@@ -458,8 +977,37 @@ daemon :: run(bool background,
     }
 
     m_migrate_thread->start();
+    m_migrate_pull_thread->start();
     m_pumping_thread.start();
 
+    if (m_version_retention > 0)
+    {
+        m_pruning_thread.start();
+    }
+
+    m_lock_recovery_thread.start();
+
+    if (bulk_load)
+    {
+        m_bulk_load = bulk_load;
+        m_bulk_load_thread.start();
+    }
+
+    m_exporting_thread.start();
+    m_compacting_thread.start();
+
+    if (coalesce_window > 0)
+    {
+        m_coalescer.set_window(coalesce_window);
+        m_coalescing_thread.start();
+        LOG(INFO) << "coalescing small messages for up to " << coalesce_window / 1000 << "us";
+    }
+
+    if (compact_messages)
+    {
+        m_compactor.enable();
+    }
+
     while (e::atomic::increment_32_nobarrier(&s_interrupts, 0) == 0)
     {
         bool debug_mode = s_debug_mode;
@@ -476,6 +1024,18 @@ daemon :: run(bool background,
             break;
         }
 
+        const uint64_t now = po6::monotonic_time();
+
+        if (m_last_load_report + LOAD_REPORT_INTERVAL <= now)
+        {
+            kvs_load load;
+            m_load.report(m_us.id, LOAD_REPORT_HOTTEST, &load);
+            std::string msg;
+            e::packer(&msg) << load;
+            m_coord->fire_and_forget("kvs_load_report", msg.data(), msg.size());
+            m_last_load_report = now;
+        }
+
         if (s_debug_mode != debug_mode)
         {
             if (s_debug_mode)
@@ -499,7 +1059,28 @@ daemon :: run(bool background,
 
     e::atomic::increment_32_nobarrier(&s_interrupts, 1);
     m_pumping_thread.join();
+
+    if (m_version_retention > 0)
+    {
+        m_pruning_thread.join();
+    }
+
+    m_lock_recovery_thread.join();
+
+    if (!m_bulk_load.empty())
+    {
+        m_bulk_load_thread.join();
+    }
+
+    m_exporting_thread.join();
+    m_compacting_thread.join();
+
+    if (m_coalescer.enabled())
+    {
+        m_coalescing_thread.join();
+    }
     m_migrate_thread->shutdown();
+    m_migrate_pull_thread->shutdown();
     m_busybee->shutdown();
 
     for (size_t i = 0; i < m_threads.size(); ++i)
@@ -507,6 +1088,15 @@ daemon :: run(bool background,
         m_threads[i]->join();
     }
 
+    m_metrics.shutdown();
+
+    if (m_data->checkpoint_locks() != CONSUS_SUCCESS)
+    {
+        LOG(ERROR) << "could not checkpoint locks on shutdown";
+    }
+
+    save_hot_partitions();
+
     LOG(INFO) << "consus is gracefully shutting down";
     return EXIT_SUCCESS;
 }
@@ -525,15 +1115,26 @@ daemon :: loop(size_t thread)
         return;
     }
 
+    if (!m_cpus.empty())
+    {
+        const unsigned cpu = m_cpus[thread % m_cpus.size()];
+
+        if (!pin_to_cpu(cpu))
+        {
+            LOG(WARNING) << "could not pin network thread " << thread << " to CPU " << cpu;
+        }
+    }
+
     e::garbage_collector::thread_state ts;
     m_gc.register_thread(&ts);
+    busy_poller poller(m_busy_poll);
     bool done = false;
 
     while (!done)
     {
         uint64_t _id;
         std::auto_ptr<e::buffer> msg;
-        busybee_returncode rc = m_busybee->recv(&ts, -1, &_id, &msg);
+        busybee_returncode rc = poller.recv(m_busybee.get(), &ts, &_id, &msg);
 
         switch (rc)
         {
@@ -579,12 +1180,18 @@ daemon :: loop(size_t thread)
             LOG(INFO) << "recv<-" << id << " " << mt << " " << msg->b64();
         }
 #endif
+        CONSUS_PROBE3(message_receive, id.get(), uint64_t(mt), msg->size());
+        const uint64_t start = po6::monotonic_time();
+        CONSUS_PROBE2(message_dispatch, id.get(), uint64_t(mt));
 
         switch (mt)
         {
             case KVS_REP_RD:
                 process_rep_rd(id, msg, up);
                 break;
+            case KVS_REP_RD_STALE:
+                process_rep_rd_stale(id, msg, up);
+                break;
             case KVS_REP_WR:
                 process_rep_wr(id, msg, up);
                 break;
@@ -600,9 +1207,21 @@ daemon :: loop(size_t thread)
             case KVS_RAW_WR_RESP:
                 process_raw_wr_resp(id, msg, up);
                 break;
+            case KVS_REP_SCAN:
+                process_rep_scan(id, msg, up);
+                break;
+            case KVS_RAW_SCAN:
+                process_raw_scan(id, msg, up);
+                break;
+            case KVS_RAW_SCAN_RESP:
+                process_raw_scan_resp(id, msg, up);
+                break;
             case KVS_LOCK_OP:
                 process_lock_op(id, msg, up);
                 break;
+            case KVS_LOCK_OP_BATCH:
+                process_lock_op_batch(id, msg, up);
+                break;
             case KVS_RAW_LK:
                 process_raw_lk(id, msg, up);
                 break;
@@ -612,18 +1231,42 @@ daemon :: loop(size_t thread)
             case KVS_WOUND_XACT:
                 process_wound_xact(id, msg, up);
                 break;
+            case KVS_AE_DIGEST:
+                process_ae_digest(id, msg, up);
+                break;
+            case KVS_AE_DIGEST_RESP:
+                process_ae_digest_resp(id, msg, up);
+                break;
             case KVS_MIGRATE_SYN:
                 process_migrate_syn(id, msg, up);
                 break;
             case KVS_MIGRATE_ACK:
                 process_migrate_ack(id, msg, up);
                 break;
+            case KVS_MIGRATE_PULL:
+                process_migrate_pull(id, msg, up);
+                break;
+            case KVS_MIGRATE_DATA:
+                process_migrate_data(id, msg, up);
+                break;
+            case CONSUS_BATCH:
+                process_batch(id, msg, up);
+                break;
             case CONSUS_NOP:
                 break;
+            case CONSUS_COMPACT:
+                process_compact(id, msg, up);
+                break;
+            case CONSUS_COMPRESSED:
             case CLIENT_RESPONSE:
             case TXMAN_BEGIN:
             case TXMAN_READ:
             case TXMAN_WRITE:
+            case TXMAN_MULTI:
+            case TXMAN_SCAN:
+            case TXMAN_READ_STALE:
+            case TXMAN_COND_WRITE:
+            case TXMAN_SINGLE:
             case TXMAN_COMMIT:
             case TXMAN_ABORT:
             case TXMAN_WOUND:
@@ -631,12 +1274,26 @@ daemon :: loop(size_t thread)
             case TXMAN_FINISHED:
             case TXMAN_PAXOS_2A:
             case TXMAN_PAXOS_2B:
+            case TXMAN_PAXOS_2A_BATCH:
+            case TXMAN_PAXOS_2B_BATCH:
+            case TXMAN_LEASE_REQUEST:
+            case TXMAN_LEASE_GRANT:
+            case TXMAN_GROUP_LOAD:
+            case TXMAN_LOG_SHIP:
+            case TXMAN_LOG_SHIP_ACK:
+            case TXMAN_WITNESS:
+            case TXMAN_WITNESS_FORGET:
             case LV_VOTE_1A:
             case LV_VOTE_1B:
             case LV_VOTE_2A:
             case LV_VOTE_2B:
             case LV_VOTE_LEARN:
+            case LV_VOTE_2A_BATCH:
+            case LV_VOTE_2B_BATCH:
             case COMMIT_RECORD:
+            case COMMIT_VALUES:
+            case COMMIT_VALUES_ACK:
+            case COMMIT_RECORD_CHUNK:
             case GV_OUTCOME:
             case GV_PROPOSE:
             case GV_VOTE_1A:
@@ -645,12 +1302,29 @@ daemon :: loop(size_t thread)
             case GV_VOTE_2B:
             case KVS_REP_RD_RESP:
             case KVS_REP_WR_RESP:
+            case KVS_REP_SCAN_RESP:
             case KVS_LOCK_OP_RESP:
+            case KVS_LOCK_OP_BATCH_RESP:
+            case PROXY_HELLO:
+            case PROXY_CONFIG:
+            case PROXY_FORWARD:
+            case PROXY_DELIVER:
+            case PROXY_DISRUPTED:
             default:
                 LOG(INFO) << "received " << mt << " message which key-value-stores do not process";
                 break;
         }
 
+        const uint64_t elapsed = po6::monotonic_time() - start;
+        m_metrics.handled(mt, elapsed);
+
+        // the operations that wait on the storage engine, and so on
+        // compaction
+        if (mt == KVS_RAW_RD || mt == KVS_RAW_WR || mt == KVS_RAW_SCAN ||
+            mt == KVS_LOCK_OP || mt == KVS_LOCK_OP_BATCH)
+        {
+            m_compaction.record(elapsed);
+        }
         m_gc.quiescent_state(&ts);
     }
 
@@ -680,29 +1354,59 @@ daemon :: process_rep_rd(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker u
             continue;
         }
 
-        r->init(id, nonce, table, key, msg);
+        r->init(id, nonce, table, key, timestamp, false, msg);
         r->externally_work_state_machine(this);
+        schedule_pump(x, po6::monotonic_time());
         break;
     }
 }
 
 void
-daemon :: process_rep_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+daemon :: process_rep_rd_stale(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
-    uint8_t flags;
     e::slice table;
     e::slice key;
     uint64_t timestamp;
-    e::slice value;
-    up = up >> nonce >> flags >> table >> key >> timestamp >> value;
-    CHECK_UNPACK(KVS_REP_WR, up);
-    // XXX check key/value meet spec
+    up = up >> nonce >> table >> key >> timestamp;
+    CHECK_UNPACK(KVS_REP_RD_STALE, up);
+    // XXX check key meet spec
 
     while (true)
     {
         uint64_t x = generate_id();
-        write_replicator_map_t::state_reference wsr;
+        read_replicator_map_t::state_reference rsr;
+        read_replicator* r = m_repl_rd.create_state(x, &rsr);
+
+        if (!r)
+        {
+            continue;
+        }
+
+        r->init(id, nonce, table, key, timestamp, true, msg);
+        r->externally_work_state_machine(this);
+        schedule_pump(x, po6::monotonic_time());
+        break;
+    }
+}
+
+void
+daemon :: process_rep_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    uint8_t flags;
+    e::slice table;
+    e::slice key;
+    uint64_t timestamp;
+    e::slice value;
+    up = up >> nonce >> flags >> table >> key >> timestamp >> value;
+    CHECK_UNPACK(KVS_REP_WR, up);
+    // XXX check key/value meet spec
+
+    while (true)
+    {
+        uint64_t x = generate_id();
+        write_replicator_map_t::state_reference wsr;
         write_replicator* w = m_repl_wr.create_state(x, &wsr);
 
         if (!w)
@@ -712,19 +1416,34 @@ daemon :: process_rep_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker u
 
         w->init(id, nonce, flags, table, key, timestamp, value, msg);
         w->externally_work_state_machine(this);
+        schedule_pump(x, po6::monotonic_time());
         break;
     }
 }
 
 void
-daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
+    table_ref tr;
     e::slice table;
     e::slice key;
     uint64_t timestamp;
-    up = up >> nonce >> table >> key >> timestamp;
+    up = up >> nonce >> tr >> key >> timestamp;
     CHECK_UNPACK(KVS_RAW_RD, up);
+
+    if (!resolve_table(tr, &table))
+    {
+        return;
+    }
+
+    if (m_responses.lookup(id, nonce, &msg))
+    {
+        LOG_IF(INFO, s_debug_mode) << "replaying raw read response; nonce=" << nonce << " to=" << id;
+        send(id, msg);
+        return;
+    }
+
     configuration* c = get_config();
     // XXX check table exists
     // XXX check key meet spec
@@ -740,11 +1459,27 @@ daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
         return;
     }
 
+    const uint16_t index = hash64(table, key) >> 48;
+    m_migration_sched.record_traffic(index);
     e::slice value;
     datalayer::reference* ref = NULL;
     consus_returncode rc = CONSUS_GARBAGE;
     rc = m_data->get(table, key, timestamp, &timestamp, &value, &ref);
+    m_load.record(index, key.size() + value.size());
+    m_hot.read(table, key);
+    m_tables.record(table, table_stats::READS, 1);
+    m_tables.record(table, table_stats::READ_BYTES, key.size() + value.size());
+
+    // table and key point into the request, which becomes the response
+    if (s_debug_mode)
+    {
+        LOG(INFO) << logid(table, key) << "-R-RAW read; value=\""
+                  << e::strescape(value.str()) << "\"@" << timestamp
+                  << "\", nonce=" << nonce << " replicas=" << rs;
+    }
 
+    // value still references the datalayer's copy and is packed straight
+    // from it
     const size_t sz = BUSYBEE_HEADER_SIZE
                     + pack_size(KVS_RAW_RD_RESP)
                     + sizeof(uint64_t)
@@ -752,17 +1487,12 @@ daemon :: process_raw_rd(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
                     + sizeof(uint64_t)
                     + pack_size(value)
                     + pack_size(rs);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg = buffer_pool::reuse(msg, sz);
     msg->pack_at(BUSYBEE_HEADER_SIZE)
         << KVS_RAW_RD_RESP << nonce << rc << timestamp << value << rs;
+    m_responses.insert(id, nonce, msg.get());
     send(id, msg);
-
-    if (s_debug_mode)
-    {
-        LOG(INFO) << logid(table, key) << "-R-RAW read; value=\""
-                  << e::strescape(value.str()) << "\"@" << timestamp
-                  << "\", nonce=" << nonce << " replicas=" << rs;
-    }
+    delete ref;
 }
 
 void
@@ -789,16 +1519,30 @@ daemon :: process_raw_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpac
 }
 
 void
-daemon :: process_raw_wr(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_raw_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
     uint8_t flags;
+    table_ref tr;
     e::slice table;
     e::slice key;
     uint64_t timestamp;
     e::slice value;
-    up = up >> nonce >> flags >> table >> key >> timestamp >> value;
+    up = up >> nonce >> flags >> tr >> key >> timestamp >> value;
     CHECK_UNPACK(KVS_RAW_WR, up);
+
+    if (!resolve_table(tr, &table))
+    {
+        return;
+    }
+
+    if (m_responses.lookup(id, nonce, &msg))
+    {
+        LOG_IF(INFO, s_debug_mode) << "replaying raw write response; nonce=" << nonce << " to=" << id;
+        send(id, msg);
+        return;
+    }
+
     configuration* c = get_config();
     // XXX check table exists
     // XXX check key/value meet spec
@@ -814,26 +1558,47 @@ daemon :: process_raw_wr(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
         return;
     }
 
-    consus_returncode rc = CONSUS_GARBAGE;
-
-    if ((CONSUS_WRITE_TOMBSTONE & flags))
+    const uint16_t index = hash64(table, key) >> 48;
+    m_migration_sched.record_traffic(index);
+    m_load.record(index, key.size() + value.size());
+    m_hot.written(table, key);
+    m_tables.record(table, table_stats::WRITES, 1);
+    m_tables.record(table, table_stats::WRITE_BYTES, key.size() + value.size());
+    consus_returncode rc = CONSUS_BUSY;
+
+    // a shed write is answered now and retried by its replicator, instead of
+    // holding this thread inside a storage engine about to stall
+    if (m_write_throttle.admit(load()))
     {
-        rc = m_data->del(table, key, timestamp);
+        rc = m_anti_entropy.store(m_data.get(), table, key, timestamp, value,
+                                  (CONSUS_WRITE_TOMBSTONE & flags));
     }
-    else
+    else if (s_debug_mode)
     {
-        rc = m_data->put(table, key, timestamp, value);
+        LOG(INFO) << logid(table, key) << "-W-RAW shed under write pressure " << unsigned(load());
     }
 
-    const size_t sz = BUSYBEE_HEADER_SIZE
-                    + pack_size(KVS_RAW_WR_RESP)
-                    + sizeof(uint64_t)
-                    + pack_size(rc)
-                    + pack_size(rs);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_RAW_WR_RESP << nonce << rc << rs;
-    send(id, msg);
+    if (rc == CONSUS_SUCCESS)
+    {
+        m_tables.record(table, table_stats::VERSIONS, 1);
+    }
+
+    // as the current owner of a migrating partition, take the write to the
+    // next owner so the replicator need not wait for it
+    bool handed_off = false;
 
+    for (unsigned i = 0; rc == CONSUS_SUCCESS && i < rs.num_replicas; ++i)
+    {
+        if (rs.replicas[i] == m_us.id &&
+            rs.transitioning[i] != comm_id() &&
+            rs.transitioning[i] != m_us.id)
+        {
+            handed_off = m_handoff.journal(generate_id(), rs.transitioning[i],
+                                           flags, table, key, timestamp, value);
+        }
+    }
+
+    // table and key point into the request, which becomes the response
     if (s_debug_mode)
     {
         if ((CONSUS_WRITE_TOMBSTONE & flags))
@@ -845,27 +1610,161 @@ daemon :: process_raw_wr(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
             LOG(INFO) << logid(table, key) << "-W-RAW written; nonce=" << nonce << " replicas=" << rs;
         }
     }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_RAW_WR_RESP)
+                    + sizeof(uint64_t)
+                    + pack_size(rc)
+                    + pack_size(rs)
+                    + sizeof(uint8_t);
+    msg = buffer_pool::reuse(msg, sz);
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_RAW_WR_RESP << nonce << rc << rs
+                                      << uint8_t(handed_off ? 1 : 0);
+
+    // a failed write may succeed if tried again, so only a success is final
+    if (rc == CONSUS_SUCCESS)
+    {
+        m_responses.insert(id, nonce, msg.get());
+    }
+
+    send(id, msg);
 }
 
 void
-daemon :: process_raw_wr_resp(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_raw_wr_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
     consus_returncode rc;
     replica_set rs;
+    uint8_t handed_off = 0;
     up = up >> nonce >> rc >> rs;
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> handed_off;
+    }
+
     CHECK_UNPACK(KVS_RAW_WR_RESP, up);
     write_replicator_map_t::state_reference wsr;
     write_replicator* w = m_repl_wr.get_state(nonce, &wsr);
 
     if (w)
     {
-        w->response(id, rc, rs, this);
+        w->response(id, rc, rs, handed_off != 0, this);
+    }
+    else if (m_handoff.ack(nonce, rc))
+    {
+        LOG_IF(INFO, s_debug_mode) << "hinted write delivered; nonce=" << nonce << " rc=" << rc << " to=" << id;
     }
     else
     {
         LOG_IF(INFO, s_debug_mode) << "dropped raw write; nonce=" << nonce << " rc=" << rc << " from=" << id;
     }
+
+    buffer_pool::recycle(msg);
+}
+
+void
+daemon :: process_rep_scan(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    e::slice table;
+    e::slice key;
+    uint64_t timestamp;
+    uint64_t limit;
+    up = up >> nonce >> table >> key >> timestamp >> limit;
+    CHECK_UNPACK(KVS_REP_SCAN, up);
+
+    while (true)
+    {
+        uint64_t x = generate_id();
+        scan_replicator_map_t::state_reference ssr;
+        scan_replicator* s = m_repl_sc.create_state(x, &ssr);
+
+        if (!s)
+        {
+            continue;
+        }
+
+        s->init(id, nonce, table, key, limit, msg);
+        s->externally_work_state_machine(this);
+        schedule_pump(x, po6::monotonic_time());
+        break;
+    }
+}
+
+void
+daemon :: process_raw_scan(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t nonce;
+    table_ref tr;
+    e::slice table;
+    e::slice key;
+    uint64_t timestamp;
+    uint64_t limit;
+    up = up >> nonce >> tr >> key >> timestamp >> limit;
+    CHECK_UNPACK(KVS_RAW_SCAN, up);
+
+    if (!resolve_table(tr, &table))
+    {
+        return;
+    }
+
+    limit = std::min(limit, uint64_t(CONSUS_MAX_SCAN_LIMIT));
+    std::vector<datalayer::scan_item> items;
+    consus_returncode rc = m_data->scan(table, key, timestamp, limit, &items);
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(KVS_RAW_SCAN_RESP)
+              + sizeof(uint64_t)
+              + pack_size(rc)
+              + sizeof(uint64_t);
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        sz += pack_size(e::slice(items[i].key))
+            + sizeof(uint64_t)
+            + pack_size(e::slice(items[i].value));
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_RAW_SCAN_RESP << nonce << rc << uint64_t(items.size());
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        pa = pa << e::slice(items[i].key)
+                << items[i].timestamp
+                << e::slice(items[i].value);
+    }
+
+    send(id, msg);
+
+    if (s_debug_mode)
+    {
+        LOG(INFO) << logid(table, key) << "-S-RAW scanned " << items.size()
+                  << " keys; nonce=" << nonce;
+    }
+}
+
+void
+daemon :: process_raw_scan_resp(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t nonce;
+    consus_returncode rc;
+    uint64_t items_sz;
+    up = up >> nonce >> rc >> items_sz;
+    CHECK_UNPACK(KVS_RAW_SCAN_RESP, up);
+    scan_replicator_map_t::state_reference ssr;
+    scan_replicator* s = m_repl_sc.get_state(nonce, &ssr);
+
+    if (s)
+    {
+        s->response(id, rc, items_sz, up, this);
+    }
+    else
+    {
+        LOG_IF(INFO, s_debug_mode) << "dropped raw scan; nonce=" << nonce << " rc=" << rc << " from=" << id;
+    }
 }
 
 void
@@ -894,27 +1793,130 @@ daemon :: process_lock_op(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker
 
         lr->init(id, nonce, table, key, tg, op, msg);
         lr->externally_work_state_machine(this);
+        schedule_pump(x, po6::monotonic_time());
         break;
     }
 }
 
+namespace
+{
+
+struct batched_lock
+{
+    batched_lock() : nonce(), table(), key(), op() {}
+    bool operator < (const batched_lock& rhs) const;
+
+    uint64_t nonce;
+    e::slice table;
+    e::slice key;
+    lock_op op;
+};
+
+bool
+batched_lock :: operator < (const batched_lock& rhs) const
+{
+    int cmp = table.compare(rhs.table);
+
+    if (cmp != 0)
+    {
+        return cmp < 0;
+    }
+
+    return key.compare(rhs.key) < 0;
+}
+
+} // namespace
+
+void
+daemon :: process_lock_op_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    transaction_group tg;
+    uint64_t count;
+    up = up >> tg >> count;
+    CHECK_UNPACK(KVS_LOCK_OP_BATCH, up);
+    std::vector<batched_lock> locks;
+
+    for (uint64_t i = 0; i < count && !up.error(); ++i)
+    {
+        batched_lock bl;
+        up = up >> bl.nonce >> bl.table >> bl.key >> bl.op;
+        locks.push_back(bl);
+    }
+
+    CHECK_UNPACK(KVS_LOCK_OP_BATCH, up);
+
+    if (locks.empty())
+    {
+        return;
+    }
+
+    // every lock of the batch belongs to the same transaction, so issuing
+    // them in key order means two batches contending for the same keys meet
+    // in the same order on every replica
+    std::sort(locks.begin(), locks.end());
+    e::compat::shared_ptr<lock_batch> batch(new lock_batch(id, locks.size()));
+    const uint64_t now = po6::monotonic_time();
+
+    for (size_t i = 0; i < locks.size(); ++i)
+    {
+        // each replicator outlives the message, so it gets its own copy of
+        // the table and key
+        const batched_lock& bl(locks[i]);
+        std::auto_ptr<e::buffer> backing(e::buffer::create(pack_size(bl.table) + pack_size(bl.key)));
+        backing->pack_at(0) << bl.table << bl.key;
+        e::slice table;
+        e::slice key;
+        backing->unpack_from(0) >> table >> key;
+
+        while (true)
+        {
+            uint64_t x = generate_id();
+            lock_replicator_map_t::state_reference lsr;
+            lock_replicator* lr = m_repl_lk.create_state(x, &lsr);
+
+            if (!lr)
+            {
+                continue;
+            }
+
+            lr->init(id, bl.nonce, table, key, tg, bl.op, backing);
+            lr->join(batch);
+            lr->externally_work_state_machine(this);
+            schedule_pump(x, now);
+            break;
+        }
+    }
+
+    buffer_pool::recycle(msg);
+}
+
 void
 daemon :: process_raw_lk(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
     uint64_t nonce;
+    table_ref tr;
     e::slice table;
     e::slice key;
     transaction_group tg;
     lock_op op;
-    up = up >> nonce >> table >> key >> tg >> op;
+    up = up >> nonce >> tr >> key >> tg >> op;
     CHECK_UNPACK(KVS_RAW_LK, up);
+
+    if (!resolve_table(tr, &table))
+    {
+        return;
+    }
+
     // XXX check table exists
     // XXX check key/value meet spec
+    m_load.record(hash64(table, key) >> 48, key.size());
 
     switch (op)
     {
         case LOCK_LOCK:
-            return m_locks.lock(id, nonce, table, key, tg, this);
+            return m_locks.lock(id, nonce, table, key, tg, false, this);
+        case LOCK_LOCK_SHARED:
+            return m_locks.lock(id, nonce, table, key, tg, true, this);
         case LOCK_UNLOCK:
             return m_locks.unlock(id, nonce, table, key, tg, this);
         default:
@@ -924,7 +1926,7 @@ daemon :: process_raw_lk(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 }
 
 void
-daemon :: process_raw_lk_resp(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_raw_lk_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
     transaction_group tg;
@@ -938,6 +1940,8 @@ daemon :: process_raw_lk_resp(comm_id id, std::auto_ptr<e::buffer>, e::unpacker
     {
         lk->response(id, tg, rs, this);
     }
+
+    buffer_pool::recycle(msg);
 }
 
 void
@@ -946,7 +1950,8 @@ daemon :: process_wound_xact(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
     uint64_t nonce;
     uint8_t flags;
     transaction_group tg;
-    up = up >> nonce >> flags >> tg;
+    uint64_t delay;
+    up = up >> nonce >> flags >> tg >> delay;
     CHECK_UNPACK(KVS_WOUND_XACT, up);
     lock_replicator_map_t::state_reference sr;
     lock_replicator* lk = m_repl_lk.get_state(nonce, &sr);
@@ -957,17 +1962,74 @@ daemon :: process_wound_xact(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
 
         if ((flags & WOUND_XACT_ABORT))
         {
-            lk->abort(tg, this);
+            lk->abort(tg, delay, this);
         }
         else if ((flags & WOUND_XACT_DROP_REQ))
         {
-            lk->drop(tg);
+            lk->drop(tg, this);
         }
     }
 }
 
 void
-daemon :: process_migrate_syn(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+daemon :: process_ae_digest(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    uint64_t count;
+    up = up >> nonce >> count;
+    std::vector<anti_entropy::range_t> ranges;
+
+    for (uint64_t i = 0; !up.error() && i < count; ++i)
+    {
+        anti_entropy::range_t r;
+        up = up >> r.first >> r.second;
+        ranges.push_back(r);
+    }
+
+    CHECK_UNPACK(KVS_AE_DIGEST, up);
+    std::vector<uint64_t> ds;
+    const bool ready = m_anti_entropy.digests(ranges, &ds);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_AE_DIGEST_RESP)
+                    + sizeof(uint64_t)
+                    + sizeof(uint8_t)
+                    + sizeof(uint64_t)
+                    + ds.size() * sizeof(uint64_t);
+    msg = buffer_pool::reuse(msg, sz);
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_AE_DIGEST_RESP << nonce << uint8_t(ready ? 1 : 0) << uint64_t(ds.size());
+
+    for (size_t i = 0; i < ds.size(); ++i)
+    {
+        pa = pa << ds[i];
+    }
+
+    send(id, msg);
+}
+
+void
+daemon :: process_ae_digest_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    uint8_t ready;
+    uint64_t count;
+    up = up >> nonce >> ready >> count;
+    std::vector<uint64_t> ds;
+
+    for (uint64_t i = 0; !up.error() && i < count; ++i)
+    {
+        uint64_t x;
+        up = up >> x;
+        ds.push_back(x);
+    }
+
+    CHECK_UNPACK(KVS_AE_DIGEST_RESP, up);
+    m_anti_entropy.digests_response(id, nonce, ready != 0, ds, this);
+    buffer_pool::recycle(msg);
+}
+
+void
+daemon :: process_migrate_syn(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
     partition_id key;
     version_id version;
@@ -978,8 +2040,27 @@ daemon :: process_migrate_syn(comm_id id, std::auto_ptr<e::buffer> msg, e::unpac
     if (c->version() >= version)
     {
         LOG_IF(INFO, s_debug_mode) << "received migration SYN for " << key << "/" << version;
-        assert(pack_size(KVS_MIGRATE_SYN) == pack_size(KVS_MIGRATE_ACK));
-        msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_MIGRATE_ACK << key << c->version();
+        // the partition's traffic lets the destination move hot partitions
+        // first; older destinations ignore the trailing field
+        unsigned lower = 0;
+        unsigned upper = 0;
+        uint64_t heat = 0;
+
+        if (c->slots_from_next_id(key, &lower, &upper))
+        {
+            for (unsigned s = lower; s < upper; ++s)
+            {
+                heat += m_migration_sched.traffic(s);
+            }
+        }
+
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(KVS_MIGRATE_ACK)
+                        + pack_size(key)
+                        + sizeof(uint64_t)
+                        + sizeof(uint64_t);
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_MIGRATE_ACK << key << c->version() << heat;
         send(id, msg);
     }
 }
@@ -989,7 +2070,14 @@ daemon :: process_migrate_ack(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
     partition_id key;
     version_id version;
+    uint64_t heat = 0;
     up = up >> key >> version;
+
+    if (up.remain())
+    {
+        up = up >> heat;
+    }
+
     CHECK_UNPACK(KVS_MIGRATE_ACK, up);
 
     // XXX check source?
@@ -999,24 +2087,225 @@ daemon :: process_migrate_ack(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
 
     if (m)
     {
-        m->ack(version, this);
+        m->ack(version, heat, this);
     }
 }
 
-std::string
-daemon :: logid(const e::slice& table, const e::slice& key)
+// The source side of a migration.  The destination pulls one batch at a time
+// and only asks for the next once it has applied this one, so the destination
+// sets the pace and a lost batch is simply pulled again from the same cursor.
+void
+daemon :: process_migrate_pull(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
-    e::compat::hash<std::string> h;
-    unsigned char buf[2 * sizeof(uint64_t)];
-    unsigned char* ptr = buf;
-    ptr = e::pack64be(h(table.str()), ptr);
-    ptr = e::pack64be(h(key.str()), ptr);
+    partition_id key;
+    version_id version;
+    uint64_t seqno;
+    e::slice cursor;
+    up = up >> key >> version >> seqno >> cursor;
+    CHECK_UNPACK(KVS_MIGRATE_PULL, up);
+    m_migrate_pull_thread->enqueue(id, key, version, seqno, cursor.str());
+}
+
+void
+daemon :: serve_migrate_pull(comm_id id, partition_id key, version_id version,
+                             uint64_t seqno, const std::string& cursor)
+{
+    configuration* c = get_config();
+
+    if (c->version() < version)
+    {
+        // the destination will retry once this daemon catches up
+        return;
+    }
+
+    const data_center_id dc = c->get_data_center(m_us.id);
+    unsigned lower = 0;
+    unsigned upper = 0;
+    const bool has_slots = c->slots_from_next_id(key, &lower, &upper);
+    std::vector<datalayer::raw_item> items;
+    std::vector<datalayer::raw_item> batch;
+    std::string next(cursor);
+
+    if (m_handoff.first_pull(id, key) && !next.empty())
+    {
+        // writes handed off before this daemon restarted were lost with its
+        // hints; only a transfer from the start is sure to include them
+        LOG(INFO) << "restarting migration of " << key << " from the beginning";
+        next.clear();
+    }
+
+    const migration_snapshots::snapshot_ptr snap =
+        m_migration_snapshots.get(id, key, next.empty(), m_data.get(), po6::monotonic_time());
+    bool done = false;
+    size_t batch_sz = 0;
+
+    for (uint64_t examined = 0;
+            !done && batch_sz < MIGRATE_BATCH_BYTES && examined < MIGRATE_SCAN_LIMIT;
+            examined += MIGRATE_SCAN_STEP)
+    {
+        const std::string resume(next);
+        consus_returncode rc = m_data->raw_scan(snap.get(), resume, MIGRATE_SCAN_STEP, &items, &next, &done);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            LOG(ERROR) << "migration of " << key << " failed to scan local data";
+            return;
+        }
+
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            const e::slice table(items[i].table);
+            const e::slice k(items[i].key);
+            replica_set rs;
+
+            // other partitions moving to the destination have transfers of
+            // their own
+            const unsigned slot = hash64(table, k) >> 48;
+
+            if ((has_slots && (slot < lower || slot >= upper)) ||
+                !c->hash(dc, table, k, &rs))
+            {
+                continue;
+            }
+
+            // ship only the keys the destination is taking over
+            bool wanted = false;
+
+            for (unsigned r = 0; r < rs.num_replicas; ++r)
+            {
+                wanted = wanted || (rs.transitioning[r] == id && rs.replicas[r] != id);
+            }
+
+            if (wanted)
+            {
+                batch_sz += pack_size(e::slice(items[i].table))
+                          + pack_size(e::slice(items[i].key))
+                          + sizeof(uint64_t)
+                          + pack_size(e::slice(items[i].value));
+                batch.push_back(items[i]);
+            }
+        }
+    }
+
+    if (done && m_handoff.pending(id))
+    {
+        // the destination will retry once its hinted writes are delivered
+        LOG_IF(INFO, s_debug_mode) << "holding the end of migration " << key << " for hinted writes";
+        return;
+    }
+
+    if (done)
+    {
+        m_migration_snapshots.finish(id, key);
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_MIGRATE_DATA)
+                    + pack_size(key)
+                    + sizeof(uint64_t)
+                    + pack_size(e::slice(next))
+                    + sizeof(uint8_t)
+                    + sizeof(uint64_t)
+                    + batch_sz;
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_MIGRATE_DATA << key << seqno << e::slice(next)
+        << uint8_t(done ? 1 : 0) << uint64_t(batch.size());
+
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        pa = pa << e::slice(batch[i].table)
+                << e::slice(batch[i].key)
+                << batch[i].timestamp
+                << e::slice(batch[i].value);
+    }
+
+    send(id, msg);
+    LOG_IF(INFO, s_debug_mode) << "sent migration batch " << seqno << " for " << key
+                               << " with " << batch.size() << " versions"
+                               << (done ? "; transfer complete" : "");
+}
+
+void
+daemon :: process_migrate_data(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    partition_id key;
+    uint64_t seqno;
+    e::slice next;
+    uint8_t done;
+    up = up >> key >> seqno >> next >> done;
+    CHECK_UNPACK(KVS_MIGRATE_DATA, up);
+    migrator_map_t::state_reference msr;
+    migrator* m = m_migrations.get_state(key, &msr);
+
+    if (m)
+    {
+        m->data(seqno, next, done != 0, up, this);
+    }
+}
+
+void
+daemon :: process_batch(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    std::vector<e::buffer*> msgs;
+
+    if (!coalescer::split(up, &msgs))
+    {
+        LOG(WARNING) << "dropping the tail of a malformed batch from " << id;
+    }
+
+    // each message re-enters the receive queue so that the batch is handled
+    // by every network thread rather than the one that unpacked it
+    for (size_t i = 0; i < msgs.size(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg(msgs[i]);
+        m_busybee->deliver(id.get(), msg);
+    }
+}
+
+void
+daemon :: process_compact(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    std::auto_ptr<e::buffer> expanded(m_compactor.expand(msg.get(), up));
+
+    if (!expanded.get())
+    {
+        LOG(WARNING) << "dropping compact message from " << id
+                     << " that is corrupt or uses an unknown version";
+        return;
+    }
+
+    buffer_pool::recycle(msg);
+    m_busybee->deliver(id.get(), expanded);
+}
+
+std::string
+daemon :: logid(const e::slice& table, const e::slice& key)
+{
+    e::compat::hash<std::string> h;
+    unsigned char buf[2 * sizeof(uint64_t)];
+    unsigned char* ptr = buf;
+    ptr = e::pack64be(h(table.str()), ptr);
+    ptr = e::pack64be(h(key.str()), ptr);
     char b64[2 * sizeof(buf)];
     size_t sz = e::b64_ntop(buf, ptr - buf, b64, sizeof(b64));
     assert(sz <= sizeof(b64));
     return std::string(b64, sz);
 }
 
+bool
+daemon :: resolve_table(const table_ref& tr, e::slice* table)
+{
+    if (m_table_ids.resolve(tr, table))
+    {
+        return true;
+    }
+
+    // the sender is on a newer configuration; it will resend
+    LOG_IF(INFO, s_debug_mode) << "dropping message for unknown " << tr.id;
+    return false;
+}
+
 consus::configuration*
 daemon :: get_config()
 {
@@ -1089,7 +2378,143 @@ daemon :: debug_dump()
         }
     }
 
+    LOG(INFO) << "---------------------------------- Row Cache -----------------------------------";
+
+    if (m_row_cache)
+    {
+        LOG(INFO) << m_row_cache->debug_dump();
+    }
+    else
+    {
+        LOG(INFO) << "row cache disabled";
+    }
+
+    LOG(INFO) << m_responses.debug_dump();
+
+    LOG(INFO) << "---------------------------------- Data Shards ---------------------------------";
+
+    if (m_shards)
+    {
+        std::string debug = m_shards->debug_dump();
+        std::vector<std::string> lines = split_by_newlines(debug);
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+    else
+    {
+        LOG(INFO) << "single store";
+    }
+
+    LOG(INFO) << "-------------------------------- Storage Engine --------------------------------";
+    datalayer::storage_stats st;
+    m_data->stats(&st);
+
+    for (size_t i = 0; i < st.level_files.size(); ++i)
+    {
+        LOG(INFO) << "level " << i << " files=" << st.level_files[i]
+                  << " bytes=" << (i < st.level_bytes.size() ? st.level_bytes[i] : 0);
+    }
+
+    LOG(INFO) << "pending_compaction_bytes=" << st.pending_compaction_bytes
+              << " stalls=" << st.stalls
+              << " stall_ms=" << st.stall_time / PO6_MILLIS
+              << " write_pressure=" << unsigned(load())
+              << " writes_admitted=" << m_write_throttle.admitted()
+              << " writes_throttled=" << m_write_throttle.throttled();
+
+    LOG(INFO) << "------------------------------- Value Compression ------------------------------";
+
+    if (m_compressed)
+    {
+        std::string debug = m_compressed->debug_dump();
+        std::vector<std::string> lines = split_by_newlines(debug);
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+    else
+    {
+        LOG(INFO) << "value compression disabled";
+    }
+
+    LOG(INFO) << "-------------------------------- Value Chunking --------------------------------";
+
+    if (m_chunked)
+    {
+        LOG(INFO) << m_chunked->debug_dump();
+    }
+    else
+    {
+        LOG(INFO) << "value chunking disabled";
+    }
+
+    LOG(INFO) << "------------------------------------ Tiering -----------------------------------";
+
+    if (m_tiered)
+    {
+        LOG(INFO) << m_tiered->debug_dump();
+    }
+    else
+    {
+        LOG(INFO) << "tiering disabled";
+    }
+
+    LOG(INFO) << "------------------------------------ Expiry ------------------------------------";
+
+    if (m_expiring)
+    {
+        std::string debug = m_expiring->debug_dump();
+        std::vector<std::string> lines = split_by_newlines(debug);
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+    else
+    {
+        LOG(INFO) << "expiry disabled";
+    }
+
     LOG(INFO) << "---------------------------------- Migrations ----------------------------------";
+    LOG(INFO) << m_migration_sched.debug_dump();
+
+    {
+        std::string debug = m_handoff.debug_dump();
+        std::vector<std::string> lines = split_by_newlines(debug);
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << "handoff " << lines[i];
+        }
+    }
+
+    {
+        std::string debug = m_migration_snapshots.debug_dump();
+        std::vector<std::string> lines = split_by_newlines(debug);
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+
+    LOG(INFO) << "--------------------------------- Anti-Entropy ---------------------------------";
+
+    {
+        std::string debug = m_anti_entropy.debug_dump();
+        std::vector<std::string> lines = split_by_newlines(debug);
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
 
     for (migrator_map_t::iterator it(&m_migrations); it.valid(); ++it)
     {
@@ -1106,16 +2531,149 @@ daemon :: debug_dump()
     LOG(INFO) << "================================ End Debug Dump ================================";
 }
 
+void
+daemon :: warm_up(uint64_t budget, unsigned threads)
+{
+    const std::string path(po6::path::join(m_data_dir, "KVS.hot"));
+    po6::io::fd fd(open(path.c_str(), O_RDONLY));
+    struct stat st;
+
+    if (fd.get() < 0 || fstat(fd.get(), &st) < 0 || st.st_size <= 0)
+    {
+        return;
+    }
+
+    if (!m_shards)
+    {
+        LOG(INFO) << "not warming the store: partitions can be found only with --data-shards";
+        return;
+    }
+
+    std::vector<char> buf(st.st_size);
+    std::vector<uint16_t> indices;
+
+    if (fd.xread(&buf[0], buf.size()) != ssize_t(buf.size()) ||
+        (e::unpacker(&buf[0], buf.size()) >> indices).error())
+    {
+        LOG(WARNING) << "ignoring unreadable hot partitions in " << path;
+        return;
+    }
+
+    LOG(INFO) << "warming the store with the " << indices.size()
+              << " partitions hottest at the last shutdown";
+    const uint64_t start = po6::monotonic_time();
+    const uint64_t bytes = m_shards->warm(indices, budget, threads);
+    LOG(INFO) << "read " << bytes / (1024 * 1024) << "MB to warm the store in "
+              << (po6::monotonic_time() - start) / PO6_MILLIS << "ms";
+}
+
+void
+daemon :: save_hot_partitions()
+{
+    std::vector<uint16_t> indices;
+    m_load.hottest(WARM_UP_HOTTEST, &indices);
+
+    if (indices.empty())
+    {
+        return;
+    }
+
+    std::string buf;
+    e::packer(&buf) << indices;
+    const std::string path(po6::path::join(m_data_dir, "KVS.hot"));
+    const std::string tmp(path + ".tmp");
+    po6::io::fd fd(open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    if (fd.get() < 0 ||
+        fd.xwrite(buf.data(), buf.size()) != ssize_t(buf.size()) ||
+        rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        PLOG(WARNING) << "could not save hot partitions to " << path;
+    }
+}
+
+void
+daemon :: metrics_callback(void* d, std::ostream* out)
+{
+    static_cast<daemon*>(d)->metrics_report(out);
+}
+
+void
+daemon :: metrics_report(std::ostream* out)
+{
+    *out << "# TYPE consus_live_states gauge\n"
+         << "consus_live_states{table=\"lock_replicators\"} " << live_states(&m_repl_lk) << "\n"
+         << "consus_live_states{table=\"read_replicators\"} " << live_states(&m_repl_rd) << "\n"
+         << "consus_live_states{table=\"write_replicators\"} " << live_states(&m_repl_wr) << "\n"
+         << "consus_live_states{table=\"scan_replicators\"} " << live_states(&m_repl_sc) << "\n"
+         << "consus_live_states{table=\"migrations\"} " << live_states(&m_migrations) << "\n";
+    m_locks.contention()->render(*out);
+    m_hot.render(*out);
+    m_tables.render(*out);
+    *out << "# TYPE consus_load gauge\n"
+         << "consus_load " << unsigned(load()) << "\n";
+    datalayer::storage_stats st;
+    m_data->stats(&st);
+    *out << "# TYPE consus_storage_level_files gauge\n";
+
+    for (size_t i = 0; i < st.level_files.size(); ++i)
+    {
+        *out << "consus_storage_level_files{level=\"" << i << "\"} " << st.level_files[i] << "\n";
+    }
+
+    *out << "# TYPE consus_storage_level_bytes gauge\n";
+
+    for (size_t i = 0; i < st.level_bytes.size(); ++i)
+    {
+        *out << "consus_storage_level_bytes{level=\"" << i << "\"} " << st.level_bytes[i] << "\n";
+    }
+
+    *out << "# TYPE consus_storage_pending_compaction_bytes gauge\n"
+         << "consus_storage_pending_compaction_bytes " << st.pending_compaction_bytes << "\n"
+         << "# TYPE consus_storage_stalls_total counter\n"
+         << "consus_storage_stalls_total " << st.stalls << "\n"
+         << "# TYPE consus_storage_stall_seconds_total counter\n"
+         << "consus_storage_stall_seconds_total " << double(st.stall_time) / PO6_SECONDS << "\n"
+         << "# TYPE consus_raw_writes_total counter\n"
+         << "consus_raw_writes_total{result=\"admitted\"} " << m_write_throttle.admitted() << "\n"
+         << "consus_raw_writes_total{result=\"throttled\"} " << m_write_throttle.throttled() << "\n"
+         << "# TYPE consus_compaction_steps_total counter\n"
+         << "consus_compaction_steps_total{reason=\"requested\"} " << e::atomic::load_64_nobarrier(&m_compactions_requested) << "\n"
+         << "consus_compaction_steps_total{reason=\"idle\"} " << e::atomic::load_64_nobarrier(&m_compactions_idle) << "\n"
+         << "# TYPE consus_compaction_deferred_total counter\n"
+         << "consus_compaction_deferred_total " << e::atomic::load_64_nobarrier(&m_compactions_deferred) << "\n";
+    alloc_stats::render(*out);
+}
+
 uint64_t
 daemon :: generate_id()
 {
-    // XXX copy of txman impl
-    // XXX don't go out of process
-    po6::io::fd fd(open("/dev/urandom", O_RDONLY));
-    uint64_t x;
-    int ret = fd.xread(&x, sizeof(x));
-    assert(ret == 8);
-    return x;
+    return random_id();
+}
+
+uint8_t
+daemon :: load()
+{
+    const uint64_t now = po6::monotonic_time();
+
+    if (e::atomic::load_64_acquire(&m_pressure_sampled) + LOAD_SAMPLE_INTERVAL <= now)
+    {
+        po6::threads::mutex::hold hold(&m_pressure_mtx);
+
+        if (m_pressure_sampled + LOAD_SAMPLE_INTERVAL <= now)
+        {
+            e::atomic::store_64_release(&m_pressure, m_data->write_pressure());
+            e::atomic::store_64_release(&m_pressure_sampled, now);
+        }
+    }
+
+    return e::atomic::load_64_acquire(&m_pressure);
+}
+
+void
+daemon :: report_migrated(partition_id part)
+{
+    m_migrate_thread->migrated(part);
 }
 
 bool
@@ -1145,14 +2703,37 @@ daemon :: send(comm_id id, std::auto_ptr<e::buffer> msg)
         return false;
     }
 
-    busybee_returncode rc = m_busybee->send(id.get(), msg);
+    if (!m_coalescer.enabled())
+    {
+        return transmit_now(id, msg);
+    }
+
+    coalescer::outbox_t ready;
+    m_coalescer.add(id, msg, &ready);
+    return transmit_now(&ready);
+}
+
+bool
+daemon :: transmit_now(comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    // every peer of a key-value store is a server
+    m_compactor.compact(&msg);
+    // only other key-value stores have a data center in our configuration
+    transport* t = m_transport.get();
+
+    if (m_local_transport.get() && get_config()->get_data_center(id) == m_us.dc)
+    {
+        t = m_local_transport.get();
+    }
+
+    busybee_returncode rc = t->send(id, msg);
 
     switch (rc)
     {
         case BUSYBEE_SUCCESS:
             return true;
         case BUSYBEE_DISRUPTED:
-            LOG_IF(INFO, s_debug_mode) << "message not sent: disrupted";
+            LOG_IF(INFO, s_debug_mode) << "message not sent to " << id << ": disrupted";
             return false;
         case BUSYBEE_SEE_ERRNO:
             PLOG(ERROR) << "send error";
@@ -1167,6 +2748,20 @@ daemon :: send(comm_id id, std::auto_ptr<e::buffer> msg)
     }
 }
 
+bool
+daemon :: transmit_now(coalescer::outbox_t* ready)
+{
+    bool sent = true;
+
+    for (size_t i = 0; i < ready->size(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg((*ready)[i].second);
+        sent = transmit_now((*ready)[i].first, msg) && sent;
+    }
+
+    return sent;
+}
+
 void
 daemon :: pump()
 {
@@ -1182,11 +2777,13 @@ daemon :: pump()
     LOG(INFO) << "pumping thread started";
     e::garbage_collector::thread_state ts;
     m_gc.register_thread(&ts);
+    uint64_t last_checkpoint = po6::monotonic_time();
+    uint64_t last_handoff = last_checkpoint;
 
     while (true)
     {
         m_gc.offline(&ts);
-        po6::sleep(PO6_MILLIS * 250);
+        po6::sleep(PUMP_TICK);
         m_gc.online(&ts);
 
         if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
@@ -1194,28 +2791,47 @@ daemon :: pump()
             break;
         }
 
-        for (lock_replicator_map_t::iterator it(&m_repl_lk); it.valid(); ++it)
+        const uint64_t now = po6::monotonic_time();
+
+        // every replicator is armed when it's created and re-armed each time
+        // it's worked, so the queue alone says which are due
+        std::vector<uint64_t> due;
+        m_pump_queue.due(now, &due);
+
+        for (size_t i = 0; i < due.size(); ++i)
         {
-            lock_replicator* lr = *it;
-            lr->externally_work_state_machine(this);
+            if (pump_one(due[i]))
+            {
+                schedule_pump(due[i], now);
+            }
         }
 
-        for (read_replicator_map_t::iterator it(&m_repl_rd); it.valid(); ++it)
+        // there is at most one migrator per partition; they are worked every
+        // tick so throttled pulls go out as soon as the scheduler allows,
+        // and keep their own retransmission timers
+        for (migrator_map_t::iterator it(&m_migrations); it.valid(); ++it)
         {
-            read_replicator* rr = *it;
-            rr->externally_work_state_machine(this);
+            migrator* m = *it;
+            m->externally_work_state_machine(this);
         }
 
-        for (write_replicator_map_t::iterator it(&m_repl_wr); it.valid(); ++it)
+        if (last_handoff + HANDOFF_REPLAY_INTERVAL <= now)
         {
-            write_replicator* wr = *it;
-            wr->externally_work_state_machine(this);
+            last_handoff = now;
+            m_handoff.replay(this, now);
+            m_migration_snapshots.expire(now);
         }
 
-        for (migrator_map_t::iterator it(&m_migrations); it.valid(); ++it)
+        m_anti_entropy.tick(this, now);
+
+        if (last_checkpoint + LOCK_CHECKPOINT_INTERVAL <= now)
         {
-            migrator* m = *it;
-            m->externally_work_state_machine(this);
+            last_checkpoint = now;
+
+            if (m_data->checkpoint_locks() != CONSUS_SUCCESS)
+            {
+                LOG(ERROR) << "could not checkpoint locks; will retry";
+            }
         }
 
         m_gc.quiescent_state(&ts);
@@ -1224,3 +2840,741 @@ daemon :: pump()
     m_gc.deregister_thread(&ts);
     LOG(INFO) << "pumping thread shutting down";
 }
+
+void
+daemon :: coalesce()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "coalescing thread started";
+
+    while (true)
+    {
+        po6::sleep(m_coalescer.window());
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        coalescer::outbox_t ready;
+        m_coalescer.expired(po6::monotonic_time(), &ready);
+        transmit_now(&ready);
+    }
+
+    LOG(INFO) << "coalescing thread shutting down";
+}
+
+// Old versions are garbage once no transaction can read at their timestamp.
+// Transaction timestamps are wall-clock times assigned at begin, so every
+// version older than the retention window, save the newest, is unreachable by
+// any transaction that began within the window.  Expired versions are
+// unreachable by anyone, so the same thread sweeps them too, and it moves
+// keys nobody has written in a long time to the cold store.  A tombstone hides
+// older versions on every replica only once every replica has it, so
+// tombstones go only once anti-entropy has seen this daemon's indices agree
+// with their other replicas, a retention window after the tombstone was
+// written; with anti-entropy disabled they stay, though what they hide goes.
+void
+daemon :: prune()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "pruning thread started";
+    std::string cursor;
+    uint64_t pruned = 0;
+    uint64_t next_pass = 0;
+    uint64_t tombstones = 0;
+    std::string sweep_cursor;
+    uint64_t swept = 0;
+    uint64_t next_sweep = 0;
+    std::string tier_cursor;
+    uint64_t moved = 0;
+    uint64_t next_tier = 0;
+
+    while (true)
+    {
+        po6::sleep(PRUNE_TICK);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        const uint64_t now = po6::wallclock_time();
+
+        if (m_expiring && now >= next_sweep)
+        {
+            std::string next;
+            bool done = false;
+            uint64_t n = 0;
+
+            if (m_expiring->sweep(now, sweep_cursor, SWEEP_STEP, &next, &done, &n) != CONSUS_SUCCESS)
+            {
+                LOG(ERROR) << "could not sweep expired versions; will retry";
+            }
+            else if (done)
+            {
+                LOG_IF(INFO, swept + n > 0 || s_debug_mode) << "swept " << swept + n << " expired versions";
+                sweep_cursor.clear();
+                swept = 0;
+                next_sweep = now + SWEEP_PASS_INTERVAL;
+            }
+            else
+            {
+                sweep_cursor = next;
+                swept += n;
+            }
+        }
+
+        if (m_tiered && now >= next_tier)
+        {
+            std::string next;
+            bool done = false;
+            uint64_t n = 0;
+
+            if (m_tiered->tier(now, tier_cursor, TIER_STEP, &next, &done, &n) != CONSUS_SUCCESS)
+            {
+                LOG(ERROR) << "could not move cold keys; will retry";
+            }
+            else if (done)
+            {
+                LOG_IF(INFO, moved + n > 0 || s_debug_mode) << "moved " << moved + n << " versions to the cold store";
+                tier_cursor.clear();
+                moved = 0;
+                next_tier = now + TIER_PASS_INTERVAL;
+            }
+            else
+            {
+                tier_cursor = next;
+                moved += n;
+            }
+        }
+
+        if (now < next_pass || now < m_version_retention)
+        {
+            continue;
+        }
+
+        if (cursor.empty())
+        {
+            // pruning already assumes transactions finish within the
+            // retention window, so agreement reached that long after a
+            // tombstone's timestamp includes the tombstone
+            const uint64_t agreed = m_anti_entropy.agreed_through(this);
+            tombstones = agreed > m_version_retention ? agreed - m_version_retention : 0;
+        }
+
+        std::string next;
+        bool done = false;
+        uint64_t n = 0;
+        consus_returncode rc = m_data->prune(now - m_version_retention, tombstones,
+                                             cursor, PRUNE_STEP,
+                                             &next, &done, &n);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            LOG(ERROR) << "could not prune old versions; will retry";
+            continue;
+        }
+
+        pruned += n;
+        cursor = next;
+
+        if (done)
+        {
+            LOG_IF(INFO, pruned > 0 || s_debug_mode) << "pruned " << pruned << " old versions";
+            cursor.clear();
+            pruned = 0;
+            next_pass = now + PRUNE_PASS_INTERVAL;
+        }
+    }
+
+    LOG(INFO) << "pruning thread shutting down";
+}
+
+// A restarted daemon keeps its locks only on disk, and would otherwise read
+// each back when a request first touched it, leaving locks of transactions
+// that died with no request behind them unnoticed.  Reading them all back in
+// batches puts every holder in memory at once, so the first waiter on an
+// orphaned lock learns its holder and asks its transaction manager whether
+// that transaction finished.
+void
+daemon :: recover_locks()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    std::string cursor;
+    std::vector<datalayer::lock_item> locks;
+    uint64_t recovered = 0;
+    bool done = false;
+
+    while (!done)
+    {
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        m_gc.quiescent_state(&ts);
+        std::string next;
+        consus_returncode rc = m_data->scan_locks(cursor, LOCK_RECOVERY_STEP,
+                                                  &locks, &next, &done);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            LOG(ERROR) << "could not read durable locks; the rest recover as they are used";
+            break;
+        }
+
+        for (size_t i = 0; i < locks.size(); ++i)
+        {
+            if (locks[i].holders.empty())
+            {
+                continue;
+            }
+
+            m_locks.recover(e::slice(locks[i].table), e::slice(locks[i].key),
+                            locks[i].holders, locks[i].shared);
+            ++recovered;
+        }
+
+        cursor = next;
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "recovered " << recovered << " held locks";
+}
+
+// Installs the keys of a consus-bulk-load file that this daemon replicates.
+// The whole file shares one timestamp, so every replica holds the same version
+// of each key no matter when it loads; loading a file twice is harmless.
+void
+daemon :: bulk_load()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    bulk_load_reader reader;
+
+    if (!reader.open(m_bulk_load))
+    {
+        LOG(ERROR) << "could not open bulk-load file " << m_bulk_load;
+        return;
+    }
+
+    const e::slice table(reader.table());
+    LOG(INFO) << "bulk loading table " << reader.table() << " from " << m_bulk_load;
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    uint16_t index = 0;
+    uint64_t records = 0;
+    uint64_t loaded = 0;
+    std::string block;
+    bool failed = false;
+
+    while (!failed && reader.next(&index, &records))
+    {
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        m_gc.quiescent_state(&ts);
+        configuration* c = get_config();
+        replica_set rs;
+        bool ours = false;
+
+        if (c->replicas(m_us.dc, index, &rs))
+        {
+            for (unsigned i = 0; i < rs.num_replicas; ++i)
+            {
+                ours = ours || rs.replicas[i] == m_us.id || rs.transitioning[i] == m_us.id;
+            }
+        }
+
+        // next() seeks past what is left unread
+        if (!ours)
+        {
+            continue;
+        }
+
+        if (!reader.read(&block))
+        {
+            break;
+        }
+
+        e::unpacker up(block.data(), block.size());
+
+        for (uint64_t r = 0; r < records; ++r)
+        {
+            e::slice key;
+            e::slice value;
+            up = up >> key >> value;
+
+            if (up.error())
+            {
+                LOG(ERROR) << "bulk-load file " << m_bulk_load << " has a corrupt block for ring index " << index;
+                failed = true;
+                break;
+            }
+
+            bool replicated = false;
+
+            if (!value.empty() && c->hash(m_us.dc, table, key, &rs))
+            {
+                for (unsigned i = 0; i < rs.num_replicas; ++i)
+                {
+                    replicated = replicated || rs.replicas[i] == m_us.id || rs.transitioning[i] == m_us.id;
+                }
+            }
+
+            if (!replicated)
+            {
+                continue;
+            }
+
+            if (m_anti_entropy.store(m_data.get(), table, key, reader.timestamp(), value, false) != CONSUS_SUCCESS)
+            {
+                LOG(ERROR) << "bulk load could not store data; stopping";
+                failed = true;
+                break;
+            }
+
+            ++loaded;
+        }
+    }
+
+    m_gc.deregister_thread(&ts);
+
+    if (failed || reader.error())
+    {
+        LOG(ERROR) << "bulk load of " << m_bulk_load << " stopped after " << loaded << " keys";
+    }
+    else
+    {
+        LOG(INFO) << "bulk load of " << m_bulk_load << " installed " << loaded << " keys";
+    }
+}
+
+void
+daemon :: export_tables()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "export thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    uint64_t handled = 0;
+
+    while (true)
+    {
+        po6::sleep(EXPORT_TICK);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        m_gc.quiescent_state(&ts);
+        const uint64_t timestamp = get_config()->export_timestamp();
+
+        if (timestamp == 0 || timestamp == handled ||
+            po6::wallclock_time() < timestamp + EXPORT_SETTLE)
+        {
+            continue;
+        }
+
+        handled = timestamp;
+        export_as_of(timestamp, &ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "export thread shutting down";
+}
+
+// Works through the compaction last requested with consus-compact a step of
+// m_compaction_step partitions per tick and, with m_compact_when_idle, through
+// the whole store while it is quiet and behind on compaction.  Either way a
+// step waits while foreground operations are slower than the target.  The
+// storage engines offer no way to slow their own compactions, so this is the
+// part of compaction that can be moved out of the way of traffic.
+void
+daemon :: compact_storage()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "compaction thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    // a request made before this daemon saw its first configuration was
+    // meant for the stores running at the time
+    bool primed = false;
+    uint64_t handled = 0;
+    bool requested = false;
+    uint32_t next = 0;
+    uint32_t last = 0;
+    uint32_t idle_next = 0;
+
+    while (true)
+    {
+        po6::sleep(COMPACTION_TICK);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        m_gc.quiescent_state(&ts);
+        m_compaction.sample(po6::monotonic_time());
+        configuration* c = get_config();
+
+        if (c->version().get() == 0)
+        {
+            continue;
+        }
+
+        if (!primed)
+        {
+            handled = c->compaction();
+            primed = true;
+        }
+        else if (c->compaction() != handled)
+        {
+            handled = c->compaction();
+            requested = true;
+            next = c->compaction_first();
+            last = c->compaction_last();
+            LOG(INFO) << "compaction " << handled << " of partitions "
+                      << next << " through " << last << " requested";
+        }
+
+        if (!requested && !(m_compact_when_idle && m_compaction.quiet()))
+        {
+            continue;
+        }
+
+        if (!m_compaction.may_compact())
+        {
+            e::atomic::increment_64_nobarrier(&m_compactions_deferred, 1);
+            continue;
+        }
+
+        if (requested)
+        {
+            const uint32_t hi = std::min(last, next - next % m_compaction_step + m_compaction_step - 1);
+            m_storage->compact(next, hi);
+            e::atomic::increment_64_nobarrier(&m_compactions_requested, 1);
+            next = hi + 1;
+
+            if (next > last)
+            {
+                requested = false;
+                LOG(INFO) << "compaction " << handled << " finished";
+            }
+
+            continue;
+        }
+
+        datalayer::storage_stats st;
+        m_storage->stats(&st);
+
+        if (st.pending_compaction_bytes == 0)
+        {
+            continue;
+        }
+
+        m_storage->compact(idle_next, idle_next + m_compaction_step - 1);
+        e::atomic::increment_64_nobarrier(&m_compactions_idle, 1);
+        idle_next = (idle_next + m_compaction_step) % CONSUS_KVS_PARTITIONS;
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "compaction thread shutting down";
+}
+
+static bool
+flush_export(consus::bulk_load_writer* writer,
+             std::map<uint16_t, consus::bulk_load_writer::records_t>* pending)
+{
+    typedef std::map<uint16_t, consus::bulk_load_writer::records_t> pending_t;
+
+    for (pending_t::iterator it = pending->begin(); it != pending->end(); ++it)
+    {
+        if (!writer->block(it->first, it->second))
+        {
+            return false;
+        }
+    }
+
+    pending->clear();
+    return true;
+}
+
+// Writes the newest version at or before timestamp of every key this daemon
+// is the first replica of within its data center, one consus-bulk-load file
+// per table, so that each data center's stores together hold a complete copy.
+// The scan reads a snapshot, so writes during the export cannot leak into it.
+// A DONE file marks a finished export, which is never redone.
+bool
+daemon :: export_as_of(uint64_t timestamp, e::garbage_collector::thread_state* ts)
+{
+    std::ostringstream ostr;
+    ostr << "export-" << timestamp;
+    const std::string dir(po6::path::join(m_data_dir, ostr.str()));
+    const std::string done_path(po6::path::join(dir, "DONE"));
+    struct stat st;
+
+    if (stat(done_path.c_str(), &st) == 0)
+    {
+        return true;
+    }
+
+    if (mkdir(dir.c_str(), S_IRWXU) < 0 && errno != EEXIST)
+    {
+        PLOG(ERROR) << "could not create " << dir;
+        return false;
+    }
+
+    if (m_version_retention > 0 &&
+        timestamp + m_version_retention < po6::wallclock_time())
+    {
+        LOG(WARNING) << "export as of " << timestamp << " reaches back further than "
+                     << "--version-retention; versions it needs may have been pruned";
+    }
+
+    LOG(INFO) << "exporting data as of " << timestamp << " to " << dir;
+    std::auto_ptr<datalayer::snapshot> snap(m_data->create_snapshot());
+    const uint64_t start = po6::monotonic_time();
+    bulk_load_writer writer;
+    bool writing = false;
+    std::string table;
+    unsigned files = 0;
+    std::map<uint16_t, bulk_load_writer::records_t> pending;
+    uint64_t pending_bytes = 0;
+    uint64_t written = 0;
+    uint64_t exported = 0;
+    std::string last_table;
+    std::string last_key;
+    bool first = true;
+    std::string cursor;
+    bool done = false;
+
+    while (!done)
+    {
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            return false;
+        }
+
+        m_gc.quiescent_state(ts);
+        configuration* c = get_config();
+        std::vector<datalayer::raw_item> items;
+        std::string next;
+
+        if (m_data->raw_scan(snap.get(), cursor, EXPORT_SCAN_STEP, &items, &next, &done) != CONSUS_SUCCESS)
+        {
+            LOG(ERROR) << "export as of " << timestamp << " could not scan local data; abandoning it";
+            return false;
+        }
+
+        cursor = next;
+
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            datalayer::raw_item* ri = &items[i];
+
+            // each key's versions are adjacent and newest first, so the
+            // first at or before the timestamp decides the key
+            if (ri->timestamp > timestamp ||
+                (!first && ri->table == last_table && ri->key == last_key))
+            {
+                continue;
+            }
+
+            first = false;
+            last_table = ri->table;
+            last_key = ri->key;
+            const e::slice tbl(ri->table);
+            const e::slice key(ri->key);
+            replica_set rs;
+
+            if (ri->value.empty() ||
+                !c->hash(m_us.dc, tbl, key, &rs) ||
+                rs.num_replicas == 0 || rs.replicas[0] != m_us.id)
+            {
+                continue;
+            }
+
+            if (!writing || ri->table != table)
+            {
+                std::ostringstream name;
+                name << files << ".bulk";
+
+                if ((writing && !(flush_export(&writer, &pending) && writer.close())) ||
+                    !writer.open(po6::path::join(dir, name.str()), tbl, timestamp))
+                {
+                    PLOG(ERROR) << "export as of " << timestamp << " could not write to " << dir;
+                    return false;
+                }
+
+                written += pending_bytes;
+                pending_bytes = 0;
+                writing = true;
+                table = ri->table;
+                ++files;
+            }
+
+            const uint16_t index = hash64(tbl, key) >> 48;
+            pending[index].push_back(std::make_pair(ri->key, ri->value));
+            pending_bytes += ri->key.size() + ri->value.size();
+            ++exported;
+
+            if (pending_bytes < EXPORT_BUFFER_BYTES)
+            {
+                continue;
+            }
+
+            if (!flush_export(&writer, &pending))
+            {
+                PLOG(ERROR) << "export as of " << timestamp << " could not write to " << dir;
+                return false;
+            }
+
+            written += pending_bytes;
+            pending_bytes = 0;
+
+            if (m_export_bytes_per_second > 0)
+            {
+                const uint64_t due = start + uint64_t(double(written) * PO6_SECONDS / m_export_bytes_per_second);
+                const uint64_t now = po6::monotonic_time();
+
+                if (now < due)
+                {
+                    po6::sleep(due - now);
+                }
+            }
+        }
+    }
+
+    if (writing && !(flush_export(&writer, &pending) && writer.close()))
+    {
+        PLOG(ERROR) << "export as of " << timestamp << " could not write to " << dir;
+        return false;
+    }
+
+    po6::io::fd fd(open(done_path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    if (fd.get() < 0 || fsync(fd.get()) < 0)
+    {
+        PLOG(ERROR) << "could not mark the export in " << dir << " finished";
+        return false;
+    }
+
+    LOG(INFO) << "export as of " << timestamp << " wrote " << exported
+              << " keys in " << files << " tables to " << dir;
+    return true;
+}
+
+void
+daemon :: schedule_pump(uint64_t id, uint64_t now)
+{
+    // the replicators retransmit only once strictly more than
+    // resend_interval has passed; give them a tick of slack
+    m_pump_queue.schedule(id, now + m_rtt.shortest() + PUMP_TICK);
+}
+
+// Replicator ids come from generate_id and are unique across all of the
+// maps.  Returns false once the replicator is gone.
+bool
+daemon :: pump_one(uint64_t id)
+{
+    {
+        lock_replicator_map_t::state_reference lsr;
+        lock_replicator* lr = m_repl_lk.get_state(id, &lsr);
+
+        if (lr)
+        {
+            lr->externally_work_state_machine(this);
+            return true;
+        }
+    }
+
+    {
+        read_replicator_map_t::state_reference rsr;
+        read_replicator* rr = m_repl_rd.get_state(id, &rsr);
+
+        if (rr)
+        {
+            rr->externally_work_state_machine(this);
+            return true;
+        }
+    }
+
+    {
+        write_replicator_map_t::state_reference wsr;
+        write_replicator* wr = m_repl_wr.get_state(id, &wsr);
+
+        if (wr)
+        {
+            wr->externally_work_state_machine(this);
+            return true;
+        }
+    }
+
+    {
+        scan_replicator_map_t::state_reference ssr;
+        scan_replicator* sr = m_repl_sc.get_state(id, &ssr);
+
+        if (sr)
+        {
+            sr->externally_work_state_machine(this);
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -29,6 +29,7 @@
 #define consus_kvs_daemon_h_
 
 // STL
+#include <map>
 #include <string>
 
 // LevelDB
@@ -37,6 +38,7 @@
 
 // po6
 #include <po6/net/location.h>
+#include <po6/threads/mutex.h>
 #include <po6/threads/thread.h>
 
 // e
@@ -49,16 +51,42 @@
 
 // consus
 #include "namespace.h"
+#include "common/coalescer.h"
+#include "common/compactor.h"
 #include "common/constants.h"
 #include "common/coordinator_link.h"
+#include "common/deadline_queue.h"
+#include "common/metrics.h"
+#include "common/rtt_estimator.h"
+#include "common/table_dictionary.h"
+#include "common/table_stats.h"
+#include "common/tracer.h"
+#include "common/transport.h"
 #include "common/kvs.h"
+#include "kvs/anti_entropy.h"
+#include "kvs/chunked_datalayer.h"
+#include "kvs/compaction_governor.h"
+#include "kvs/compressed_datalayer.h"
 #include "kvs/configuration.h"
 #include "kvs/controller.h"
 #include "kvs/datalayer.h"
+#include "kvs/expiring_datalayer.h"
+#include "kvs/hinted_handoff.h"
+#include "kvs/hot_spots.h"
+#include "kvs/load_tracker.h"
+#include "kvs/lock_batch.h"
 #include "kvs/lock_manager.h"
 #include "kvs/lock_replicator.h"
+#include "kvs/migration_scheduler.h"
+#include "kvs/migration_snapshots.h"
 #include "kvs/migrator.h"
 #include "kvs/read_replicator.h"
+#include "kvs/response_cache.h"
+#include "kvs/row_cache.h"
+#include "kvs/scan_replicator.h"
+#include "kvs/sharded_datalayer.h"
+#include "kvs/tiered_datalayer.h"
+#include "kvs/write_throttle.h"
 #include "kvs/write_replicator.h"
 
 BEGIN_CONSUS_NAMESPACE
@@ -80,20 +108,59 @@ class daemon
                 bool set_coordinator,
                 const char* coordinator,
                 const char* data_center,
-                unsigned threads);
+                uint64_t capacity,
+                const char* zone,
+                const char* rack,
+                unsigned threads,
+                uint64_t resend_default,
+                bool use_rocksdb,
+                bool lazy_locks,
+                unsigned migration_concurrency,
+                uint64_t migration_bytes_per_second,
+                uint64_t migration_batches_per_second,
+                uint64_t version_retention,
+                uint64_t write_catchup,
+                uint64_t anti_entropy_interval,
+                uint64_t row_cache_bytes,
+                uint64_t response_cache_bytes,
+                bool pin_threads,
+                uint64_t busy_poll,
+                uint64_t coalesce_window,
+                bool compact_messages,
+                const char* intra_dc_transport,
+                uint16_t metrics_port,
+                const char* trace_file,
+                const char* bulk_load,
+                uint64_t export_bytes_per_second,
+                uint64_t compaction_latency,
+                bool compact_when_idle,
+                unsigned lock_escalation,
+                uint64_t wound_delay,
+                unsigned data_shards,
+                uint64_t warm_up_bytes,
+                uint64_t value_chunk_bytes,
+                const char* cold_dir,
+                uint64_t cold_age,
+                const std::vector<std::string>& compress_tables,
+                const std::map<std::string, uint64_t>& expire_tables);
 
     private:
         struct coordinator_callback;
         class migration_bgthread;
+        class migrate_pull_bgthread;
         typedef e::state_hash_table<uint64_t, lock_replicator> lock_replicator_map_t;
         typedef e::state_hash_table<uint64_t, read_replicator> read_replicator_map_t;
         typedef e::state_hash_table<uint64_t, write_replicator> write_replicator_map_t;
+        typedef e::state_hash_table<uint64_t, scan_replicator> scan_replicator_map_t;
         typedef e::state_hash_table<partition_id, migrator> migrator_map_t;
+        friend class anti_entropy;
         friend class controller;
+        friend class hinted_handoff;
         friend class lock_manager;
         friend class lock_replicator;
         friend class lock_state;
         friend class read_replicator;
+        friend class scan_replicator;
         friend class write_replicator;
         friend class migrator;
 
@@ -106,51 +173,194 @@ class daemon
         void process_write_cancel(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
 
         void process_rep_rd(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_rep_rd_stale(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_rep_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_rd(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_wr(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_wr_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_rep_scan(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_raw_scan(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_raw_scan_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
 
         void process_lock_op(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_lock_op_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_lk(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_raw_lk_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_wound_xact(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_ae_digest(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_ae_digest_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
 
         void process_migrate_syn(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_migrate_ack(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_migrate_pull(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_migrate_data(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        // scan for and send one batch of a migration pulled by id; runs on
+        // m_migrate_pull_thread rather than holding up a network thread
+        void serve_migrate_pull(comm_id id, partition_id key, version_id version,
+                                uint64_t seqno, const std::string& cursor);
+        void process_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_compact(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
 
     private:
         static std::string logid(const e::slice& table, const e::slice& key);
+        // the table a message names; false if it is dropped instead
+        bool resolve_table(const table_ref& tr, e::slice* table);
 
     public:
         configuration* get_config();
         void debug_dump();
         uint64_t generate_id();
-        uint64_t resend_interval() { return PO6_SECONDS; }
+        // for messages to several peers at once
+        uint64_t resend_interval() { return m_rtt.timeout(); }
+        uint64_t resend_interval(comm_id id) { return m_rtt.timeout(id); }
+        void observe_rtt(comm_id id, uint64_t rtt) { m_rtt.sample(id, rtt); }
+        // how loaded this server is, 0-100, as reported to transaction
+        // managers at the end of every response to them
+        uint8_t load();
         bool send(comm_id id, std::auto_ptr<e::buffer> msg);
+        // tell the coordinator that part has moved here, together with every
+        // other partition that finishes about the same time
+        void report_migrated(partition_id part);
+        // hand messages to BusyBee, by way of the coalescer if it is enabled
+        bool transmit_now(comm_id id, std::auto_ptr<e::buffer> msg);
+        bool transmit_now(coalescer::outbox_t* ready);
+        void coalesce();
         void pump();
+        void schedule_pump(uint64_t id, uint64_t now);
+        bool pump_one(uint64_t id);
+        void prune();
+        void bulk_load();
+        // rebuild every durable lock's holders in memory after a restart
+        void recover_locks();
+        void export_tables();
+        // the partitions hottest at the last shutdown are read into the
+        // store's caches at startup, before the coordinator hears from us
+        void warm_up(uint64_t budget, unsigned threads);
+        void save_hot_partitions();
+        bool export_as_of(uint64_t timestamp, e::garbage_collector::thread_state* ts);
+        void compact_storage();
+        static void metrics_callback(void* d, std::ostream* out);
+        void metrics_report(std::ostream* out);
 
     private:
         kvs m_us;
         e::garbage_collector m_gc;
         controller m_busybee_controller;
         std::auto_ptr<busybee_server> m_busybee;
+        rtt_estimator m_rtt;
         std::auto_ptr<coordinator_callback> m_coord_cb;
         std::auto_ptr<coordinator_link> m_coord;
         configuration* m_config;
         std::vector<e::compat::shared_ptr<po6::threads::thread> > m_threads;
+        // CPUs the network threads are pinned to, in order; empty if unpinned
+        std::vector<unsigned> m_cpus;
+        // how long a network thread may spin before it blocks; 0 never spins
+        uint64_t m_busy_poll;
         std::auto_ptr<datalayer> m_data;
+        // the caching layer within m_data when reads are cached, for its
+        // stats; else NULL
+        row_cache* m_row_cache;
+        // m_data itself when tables expire, for sweeping; else NULL
+        expiring_datalayer* m_expiring;
+        // the store beneath m_data when it is split by partition; else NULL
+        sharded_datalayer* m_shards;
+        // the compressing layer within m_data, if any; else NULL
+        compressed_datalayer* m_compressed;
+        // the chunking layer within m_data, if any; else NULL
+        chunked_datalayer* m_chunked;
+        // the tiering layer within m_data, for moving cold keys; else NULL
+        tiered_datalayer* m_tiered;
+        // the storage engine beneath every layer of m_data, for compaction
+        datalayer* m_storage;
+        // answers to raw reads and writes, replayed to retransmissions
+        response_cache m_responses;
+        // the datalayer's write pressure, resampled every LOAD_SAMPLE_INTERVAL
+        po6::threads::mutex m_pressure_mtx;
+        uint64_t m_pressure_sampled;
+        uint64_t m_pressure;
+        // sheds raw writes as that pressure nears a stall
+        write_throttle m_write_throttle;
         lock_manager m_locks;
         lock_replicator_map_t m_repl_lk;
         read_replicator_map_t m_repl_rd;
         write_replicator_map_t m_repl_wr;
+        scan_replicator_map_t m_repl_sc;
         migrator_map_t m_migrations;
         std::auto_ptr<migration_bgthread> m_migrate_thread;
+        std::auto_ptr<migrate_pull_bgthread> m_migrate_pull_thread;
+        migration_scheduler m_migration_sched;
+        // writes owed to the next owners of partitions migrating away
+        hinted_handoff m_handoff;
+        // what this daemon's outgoing migrations copy from
+        migration_snapshots m_migration_snapshots;
+        // compares and repairs replicas in the background
+        anti_entropy m_anti_entropy;
+
+        // per-partition traffic reported to the coordinator
+        load_tracker m_load;
+        uint64_t m_last_load_report;
+        // sampled hot keys and slow replicators, for consus-debug hot-spots
+        hot_spots m_hot;
+        // per-table traffic, for sizing and placing tables
+        table_stats m_tables;
+        // table ids from the configuration, which replicas exchange in place
+        // of table names
+        table_dictionary m_table_ids;
 
         // state machine pumping
+        deadline_queue<uint64_t> m_pump_queue;
         po6::threads::thread m_pumping_thread;
 
+        // versions older than this (in nanoseconds) are pruned; 0 keeps all
+        uint64_t m_version_retention;
+        po6::threads::thread m_pruning_thread;
+
+        // reads the durable locks back in at startup
+        po6::threads::thread m_lock_recovery_thread;
+
+        // how long (in nanoseconds) a write keeps retrying replicas that
+        // missed the quorum after it was acknowledged
+        uint64_t m_write_catchup;
+        // bytes of writes held in memory for that catch-up, across all
+        // write replicators
+        uint64_t m_write_catchup_bytes;
+
+        // message coalescing
+        coalescer m_coalescer;
+        po6::threads::thread m_coalescing_thread;
+        compactor m_compactor;
+        // BusyBee for every peer, unless m_local_transport is set for the
+        // key-value stores in our data center
+        std::auto_ptr<transport> m_transport;
+        std::auto_ptr<transport> m_local_transport;
+
+        // handler latency and table sizes, for --metrics-port
+        metrics m_metrics;
+
+        // spans of operations the transaction managers tagged, for --trace-file
+        tracer m_tracer;
+
+        // a file from consus-bulk-load to install in the background
+        std::string m_bulk_load;
+        po6::threads::thread m_bulk_load_thread;
+
+        // exports requested with consus-export, written beneath m_data_dir
+        std::string m_data_dir;
+        uint64_t m_export_bytes_per_second;
+        po6::threads::thread m_exporting_thread;
+
+        // compactions requested with consus-compact, and those run ahead of
+        // need while the store is quiet if m_compact_when_idle
+        compaction_governor m_compaction;
+        bool m_compact_when_idle;
+        // the partitions compacted at once: one shard's worth, or all of them
+        unsigned m_compaction_step;
+        uint64_t m_compactions_requested;
+        uint64_t m_compactions_idle;
+        uint64_t m_compactions_deferred;
+        po6::threads::thread m_compacting_thread;
+
     private:
         daemon(const daemon&);
         daemon& operator = (const daemon&);
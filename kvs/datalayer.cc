@@ -38,6 +38,37 @@ datalayer :: ~datalayer() throw ()
 {
 }
 
+consus_returncode
+datalayer :: erase_version(const e::slice&, const e::slice&, uint64_t)
+{
+    return CONSUS_SERVER_ERROR;
+}
+
+consus_returncode
+datalayer :: put_batch(const std::vector<raw_item>& items)
+{
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const e::slice table(items[i].table);
+        const e::slice key(items[i].key);
+        consus_returncode rc = items[i].value.empty()
+                             ? del(table, key, items[i].timestamp)
+                             : put(table, key, items[i].timestamp, e::slice(items[i].value));
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            return rc;
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+void
+datalayer :: compact(uint16_t, uint16_t)
+{
+}
+
 datalayer :: reference :: reference()
 {
 }
@@ -45,3 +76,87 @@ datalayer :: reference :: reference()
 datalayer :: reference :: ~reference() throw ()
 {
 }
+
+datalayer :: snapshot :: snapshot()
+{
+}
+
+datalayer :: snapshot :: ~snapshot() throw ()
+{
+}
+
+datalayer :: scan_item :: scan_item()
+    : key()
+    , timestamp(0)
+    , value()
+{
+}
+
+datalayer :: scan_item :: ~scan_item() throw ()
+{
+}
+
+datalayer :: raw_item :: raw_item()
+    : table()
+    , key()
+    , timestamp(0)
+    , value()
+{
+}
+
+datalayer :: raw_item :: ~raw_item() throw ()
+{
+}
+
+datalayer :: lock_item :: lock_item()
+    : table()
+    , key()
+    , holders()
+    , shared(false)
+{
+}
+
+datalayer :: lock_item :: ~lock_item() throw ()
+{
+}
+
+datalayer :: storage_stats :: storage_stats()
+    : level_files()
+    , level_bytes()
+    , pending_compaction_bytes(0)
+    , stalls(0)
+    , stall_time(0)
+{
+}
+
+datalayer :: storage_stats :: ~storage_stats() throw ()
+{
+}
+
+void
+datalayer :: storage_stats :: merge(const storage_stats& other)
+{
+    if (level_files.size() < other.level_files.size())
+    {
+        level_files.resize(other.level_files.size(), 0);
+    }
+
+    if (level_bytes.size() < other.level_bytes.size())
+    {
+        level_bytes.resize(other.level_bytes.size(), 0);
+    }
+
+    for (size_t i = 0; i < other.level_files.size(); ++i)
+    {
+        level_files[i] += other.level_files[i];
+    }
+
+    for (size_t i = 0; i < other.level_bytes.size(); ++i)
+    {
+        level_bytes[i] += other.level_bytes[i];
+    }
+
+    pending_compaction_bytes += other.pending_compaction_bytes;
+    stalls += other.stalls;
+    stall_time += other.stall_time;
+}
@@ -28,6 +28,13 @@
 #ifndef consus_kvs_datalayer_h_
 #define consus_kvs_datalayer_h_
 
+// STL
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/time.h>
+
 // e
 #include <e/slice.h>
 
@@ -43,6 +50,11 @@ class datalayer
 {
     public:
         class reference;
+        class snapshot;
+        struct scan_item;
+        struct raw_item;
+        struct lock_item;
+        struct storage_stats;
 
     public:
         datalayer();
@@ -50,12 +62,22 @@ class datalayer
 
     public:
         virtual bool init(std::string data) = 0;
+        // value may be NULL when only the timestamp is wanted, which spares
+        // a compressing store from decompressing it
         virtual consus_returncode get(const e::slice& table,
                                       const e::slice& key,
                                       uint64_t timestamp_le,
                                       uint64_t* timestamp,
                                       e::slice* value,
                                       reference** ref) = 0;
+        // the newest version <= timestamp_le of each of the first limit keys
+        // >= key, in key order; deleted keys are included with an empty value
+        // so that callers merging replicas can tell a delete from a miss
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items) = 0;
         virtual consus_returncode put(const e::slice& table,
                                       const e::slice& key,
                                       uint64_t timestamp,
@@ -63,12 +85,77 @@ class datalayer
         virtual consus_returncode del(const e::slice& table,
                                       const e::slice& key,
                                       uint64_t timestamp) = 0;
+        // put (or, for an empty value, del) every item, as durably as one
+        // put; stores that sync each write override it to sync once
+        virtual consus_returncode put_batch(const std::vector<raw_item>& items);
+        // every stored version of every key, in storage order, starting just
+        // after the opaque cursor (empty for the beginning); examines at most
+        // limit versions, sets *next to resume from, and sets *done once the
+        // store is exhausted
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done) = 0;
+        // a point-in-time view of every stored version, for copies that must
+        // not mix in writes made while they run; delete it to release it
+        virtual snapshot* create_snapshot() = 0;
+        // raw_scan as of snap
+        virtual consus_returncode raw_scan(const snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done) = 0;
+        // drop versions no reader at or after watermark can observe: all but
+        // the newest version <= watermark, and that one too if it's a
+        // tombstone <= tombstones, which every replica is known to hold;
+        // covers keys after cursor (as in raw_scan) until about limit
+        // versions have been examined
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned) = 0;
+        // remove one stored version outright, as prune does, instead of
+        // hiding it beneath a tombstone; only the storage engines themselves
+        // support it, for moving versions between stores
+        virtual consus_returncode erase_version(const e::slice& table,
+                                                const e::slice& key,
+                                                uint64_t timestamp);
+        // a lock is held exclusively by at most one transaction, or shared
+        // by any number of them
         virtual consus_returncode read_lock(const e::slice& table,
                                             const e::slice& key,
-                                            transaction_group* tg) = 0;
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared) = 0;
         virtual consus_returncode write_lock(const e::slice& table,
                                              const e::slice& key,
-                                             const transaction_group& tg) = 0;
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared) = 0;
+        // make every lock written so far durable; a no-op unless locks are
+        // persisted lazily
+        virtual consus_returncode checkpoint_locks() = 0;
+        // every durable lock, in storage order, starting just after the
+        // opaque cursor as in raw_scan; examines at most limit locks
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done) = 0;
+        // how close writes are to stalling, from 0 (idle) to 100 (stopped);
+        // callers sample it every few milliseconds, so it may ask the store
+        virtual unsigned write_pressure() = 0;
+        // what the storage engine is doing beneath the writes; cheap enough
+        // to call on every metrics scrape
+        virtual void stats(storage_stats* st) = 0;
+        // compact every key whose partition, as in the top sixteen bits of
+        // its hash, lies within [first, last], and return once that is done;
+        // engines that cannot tell partitions apart compact all they hold,
+        // and only the storage engines themselves do anything
+        virtual void compact(uint16_t first, uint16_t last);
 };
 
 class datalayer::reference
@@ -78,6 +165,66 @@ class datalayer::reference
         virtual ~reference() throw ();
 };
 
+class datalayer::snapshot
+{
+    public:
+        snapshot();
+        virtual ~snapshot() throw ();
+};
+
+struct datalayer::scan_item
+{
+    scan_item();
+    ~scan_item() throw ();
+
+    std::string key;
+    uint64_t timestamp;
+    std::string value;
+};
+
+struct datalayer::raw_item
+{
+    raw_item();
+    ~raw_item() throw ();
+
+    std::string table;
+    std::string key;
+    uint64_t timestamp;
+    std::string value;
+};
+
+struct datalayer::lock_item
+{
+    lock_item();
+    ~lock_item() throw ();
+
+    std::string table;
+    std::string key;
+    std::vector<transaction_group> holders;
+    bool shared;
+};
+
+struct datalayer::storage_stats
+{
+    storage_stats();
+    ~storage_stats() throw ();
+    // adds other's counts to this, level by level
+    void merge(const storage_stats& other);
+
+    // indexed by level
+    std::vector<uint64_t> level_files;
+    std::vector<uint64_t> level_bytes;
+    // bytes compaction must rewrite before every level is within its target
+    uint64_t pending_compaction_bytes;
+    // writes the engine held up for at least WRITE_STALL_THRESHOLD, and the
+    // nanoseconds they spent held up
+    uint64_t stalls;
+    uint64_t stall_time;
+};
+
+// How long a write to the storage engine may take before it counts as stalled.
+#define WRITE_STALL_THRESHOLD (PO6_MILLIS * 50)
+
 END_CONSUS_NAMESPACE
 
 #endif // consus_kvs_datalayer_h_
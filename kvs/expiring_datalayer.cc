@@ -0,0 +1,333 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// STL
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/strescape.h>
+
+// consus
+#include "kvs/expiring_datalayer.h"
+
+using consus::expiring_datalayer;
+
+expiring_datalayer :: expiring_datalayer(datalayer* backing,
+                                         const std::map<std::string, uint64_t>& ttls)
+    : m_backing(backing)
+    , m_ttls(ttls)
+    , m_mtx()
+    , m_hidden(0)
+    , m_swept(0)
+{
+}
+
+expiring_datalayer :: ~expiring_datalayer() throw ()
+{
+}
+
+bool
+expiring_datalayer :: init(std::string data)
+{
+    return m_backing->init(data);
+}
+
+consus_returncode
+expiring_datalayer :: get(const e::slice& table,
+                          const e::slice& key,
+                          uint64_t timestamp_le,
+                          uint64_t* timestamp,
+                          e::slice* value,
+                          datalayer::reference** ref)
+{
+    consus_returncode rc = m_backing->get(table, key, timestamp_le, timestamp, value, ref);
+
+    // read as a tombstone at the version's timestamp would be, so replicas
+    // that differ only in whether they have swept it yet still agree
+    if (rc == CONSUS_SUCCESS && expired(table, *timestamp, po6::wallclock_time()))
+    {
+        if (value)
+        {
+            *value = e::slice();
+        }
+
+        po6::threads::mutex::hold hold(&m_mtx);
+        ++m_hidden;
+        return CONSUS_NOT_FOUND;
+    }
+
+    return rc;
+}
+
+consus_returncode
+expiring_datalayer :: scan(const e::slice& table,
+                           const e::slice& key,
+                           uint64_t timestamp_le,
+                           uint64_t limit,
+                           std::vector<scan_item>* items)
+{
+    consus_returncode rc = m_backing->scan(table, key, timestamp_le, limit, items);
+
+    if (rc != CONSUS_SUCCESS || m_ttls.find(table.str()) == m_ttls.end())
+    {
+        return rc;
+    }
+
+    const uint64_t now = po6::wallclock_time();
+
+    for (size_t i = 0; i < items->size(); ++i)
+    {
+        if (expired(table, (*items)[i].timestamp, now))
+        {
+            (*items)[i].value.clear();
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+expiring_datalayer :: put(const e::slice& table,
+                          const e::slice& key,
+                          uint64_t timestamp,
+                          const e::slice& value)
+{
+    return m_backing->put(table, key, timestamp, value);
+}
+
+consus_returncode
+expiring_datalayer :: del(const e::slice& table,
+                          const e::slice& key,
+                          uint64_t timestamp)
+{
+    return m_backing->del(table, key, timestamp);
+}
+
+consus_returncode
+expiring_datalayer :: raw_scan(const std::string& cursor,
+                               uint64_t limit,
+                               std::vector<raw_item>* items,
+                               std::string* next,
+                               bool* done)
+{
+    consus_returncode rc = m_backing->raw_scan(cursor, limit, items, next, done);
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        filter_items(items);
+    }
+
+    return rc;
+}
+
+consus::datalayer::snapshot*
+expiring_datalayer :: create_snapshot()
+{
+    return m_backing->create_snapshot();
+}
+
+consus_returncode
+expiring_datalayer :: raw_scan(const datalayer::snapshot* snap,
+                               const std::string& cursor,
+                               uint64_t limit,
+                               std::vector<raw_item>* items,
+                               std::string* next,
+                               bool* done)
+{
+    consus_returncode rc = m_backing->raw_scan(snap, cursor, limit, items, next, done);
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        filter_items(items);
+    }
+
+    return rc;
+}
+
+consus_returncode
+expiring_datalayer :: prune(uint64_t watermark,
+                            uint64_t tombstones,
+                            const std::string& cursor,
+                            uint64_t limit,
+                            std::string* next,
+                            bool* done,
+                            uint64_t* pruned)
+{
+    return m_backing->prune(watermark, tombstones, cursor, limit, next, done, pruned);
+}
+
+consus_returncode
+expiring_datalayer :: read_lock(const e::slice& table,
+                                const e::slice& key,
+                                std::vector<transaction_group>* holders,
+                                bool* shared)
+{
+    return m_backing->read_lock(table, key, holders, shared);
+}
+
+consus_returncode
+expiring_datalayer :: write_lock(const e::slice& table,
+                                 const e::slice& key,
+                                 const std::vector<transaction_group>& holders,
+                                 bool shared)
+{
+    return m_backing->write_lock(table, key, holders, shared);
+}
+
+consus_returncode
+expiring_datalayer :: checkpoint_locks()
+{
+    return m_backing->checkpoint_locks();
+}
+
+consus_returncode
+expiring_datalayer :: scan_locks(const std::string& cursor,
+                                 uint64_t limit,
+                                 std::vector<lock_item>* locks,
+                                 std::string* next,
+                                 bool* done)
+{
+    return m_backing->scan_locks(cursor, limit, locks, next, done);
+}
+
+unsigned
+expiring_datalayer :: write_pressure()
+{
+    return m_backing->write_pressure();
+}
+
+void
+expiring_datalayer :: stats(storage_stats* st)
+{
+    m_backing->stats(st);
+}
+
+consus_returncode
+expiring_datalayer :: sweep(uint64_t now,
+                            const std::string& cursor,
+                            uint64_t limit,
+                            std::string* next,
+                            bool* done,
+                            uint64_t* swept)
+{
+    std::vector<raw_item> items;
+    consus_returncode rc = m_backing->raw_scan(cursor, limit, &items, next, done);
+    *swept = 0;
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const raw_item& ri(items[i]);
+
+        // already a tombstone, whether swept or deleted
+        if (ri.value.empty() || !expired(e::slice(ri.table), ri.timestamp, now))
+        {
+            continue;
+        }
+
+        rc = m_backing->del(e::slice(ri.table), e::slice(ri.key), ri.timestamp);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            *next = cursor;
+            *done = false;
+            return rc;
+        }
+
+        ++*swept;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_swept += *swept;
+    return CONSUS_SUCCESS;
+}
+
+std::string
+expiring_datalayer :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "expiry hidden=" << m_hidden << " swept=" << m_swept;
+
+    for (std::map<std::string, uint64_t>::const_iterator it = m_ttls.begin();
+            it != m_ttls.end(); ++it)
+    {
+        ostr << "\ntable \"" << e::strescape(it->first) << "\" ttl="
+             << it->second / PO6_SECONDS << "s";
+    }
+
+    return ostr.str();
+}
+
+bool
+expiring_datalayer :: expired(const e::slice& table, uint64_t timestamp, uint64_t now) const
+{
+    std::map<std::string, uint64_t>::const_iterator it = m_ttls.find(table.str());
+    return it != m_ttls.end() && timestamp < now && now - timestamp > it->second;
+}
+
+void
+expiring_datalayer :: filter_items(std::vector<raw_item>* items)
+{
+    const uint64_t now = po6::wallclock_time();
+    size_t out = 0;
+
+    for (size_t i = 0; i < items->size(); ++i)
+    {
+        raw_item* ri = &(*items)[i];
+
+        // swept or not, an expired version never leaves this replica
+        if (expired(e::slice(ri->table), ri->timestamp, now))
+        {
+            continue;
+        }
+
+        if (out != i)
+        {
+            raw_item* dst = &(*items)[out];
+            dst->table.swap(ri->table);
+            dst->key.swap(ri->key);
+            dst->timestamp = ri->timestamp;
+            dst->value.swap(ri->value);
+        }
+
+        ++out;
+    }
+
+    items->resize(out);
+}
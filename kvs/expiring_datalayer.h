@@ -0,0 +1,150 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_expiring_datalayer_h_
+#define consus_kvs_expiring_datalayer_h_
+
+// STL
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Expires the versions of chosen tables a fixed time after their timestamp,
+// in front of every other datalayer.  Timestamps are wall-clock times, so a
+// version written at t is readable until t + ttl and then reads as deleted:
+// get finds nothing, scan reports a delete, and raw scans leave it out so
+// that migration and anti-entropy never carry it between replicas.
+//
+// Expired versions take no transaction to remove.  sweep overwrites each one
+// in place with a tombstone at its own timestamp, which frees its value at
+// once, and the version pruner later drops the tombstone like any other.
+// Every replica sweeps on its own, so every key-value store must be given
+// the same tables and times.
+class expiring_datalayer : public datalayer
+{
+    public:
+        // takes ownership of backing; ttls maps each table to how long its
+        // versions live, in nanoseconds
+        expiring_datalayer(datalayer* backing, const std::map<std::string, uint64_t>& ttls);
+        virtual ~expiring_datalayer() throw ();
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual datalayer::snapshot* create_snapshot();
+        virtual consus_returncode raw_scan(const datalayer::snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared);
+        virtual consus_returncode checkpoint_locks();
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done);
+        virtual unsigned write_pressure();
+        virtual void stats(storage_stats* st);
+
+    public:
+        // tombstone the versions that expired by now among about limit
+        // versions after cursor, resuming as raw_scan does
+        consus_returncode sweep(uint64_t now,
+                                const std::string& cursor,
+                                uint64_t limit,
+                                std::string* next,
+                                bool* done,
+                                uint64_t* swept);
+        std::string debug_dump();
+
+    private:
+        bool expired(const e::slice& table, uint64_t timestamp, uint64_t now) const;
+        void filter_items(std::vector<raw_item>* items);
+
+    private:
+        const std::auto_ptr<datalayer> m_backing;
+        const std::map<std::string, uint64_t> m_ttls;
+        po6::threads::mutex m_mtx;
+        uint64_t m_hidden;
+        uint64_t m_swept;
+
+    private:
+        expiring_datalayer(const expiring_datalayer&);
+        expiring_datalayer& operator = (const expiring_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_expiring_datalayer_h_
@@ -0,0 +1,92 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// consus
+#include "kvs/hash_tree.h"
+
+using consus::hash_tree;
+
+hash_tree :: hash_tree()
+    : m_mtx()
+    , m_nodes(new uint64_t[2 * CONSUS_KVS_PARTITIONS])
+{
+    memset(m_nodes, 0, sizeof(uint64_t) * 2 * CONSUS_KVS_PARTITIONS);
+}
+
+hash_tree :: ~hash_tree() throw ()
+{
+    delete[] m_nodes;
+}
+
+void
+hash_tree :: toggle(uint16_t index, uint64_t h)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t n = CONSUS_KVS_PARTITIONS + index; n > 0; n /= 2)
+    {
+        m_nodes[n] ^= h;
+    }
+}
+
+uint64_t
+hash_tree :: digest(uint16_t lower, uint16_t upper)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    uint64_t d = 0;
+    size_t lo = CONSUS_KVS_PARTITIONS + lower;
+    size_t hi = CONSUS_KVS_PARTITIONS + upper + 1;
+
+    // the standard bottom-up walk over the half-open range [lo, hi)
+    while (lo < hi)
+    {
+        if (lo & 1)
+        {
+            d ^= m_nodes[lo++];
+        }
+
+        if (hi & 1)
+        {
+            d ^= m_nodes[--hi];
+        }
+
+        lo /= 2;
+        hi /= 2;
+    }
+
+    return d;
+}
+
+void
+hash_tree :: clear()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    memset(m_nodes, 0, sizeof(uint64_t) * 2 * CONSUS_KVS_PARTITIONS);
+}
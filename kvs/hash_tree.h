@@ -0,0 +1,69 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_hash_tree_h_
+#define consus_kvs_hash_tree_h_
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/constants.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// A hash tree over the ring indices.  Each leaf is the exclusive-or of the
+// hashes in its index, and each interior node the exclusive-or of its
+// children, so adding or removing a hash touches one path and replicas holding
+// the same hashes agree on every range regardless of the order they saw them.
+class hash_tree
+{
+    public:
+        hash_tree();
+        ~hash_tree() throw ();
+
+    public:
+        // adds h to index, or removes it if it was added before
+        void toggle(uint16_t index, uint64_t h);
+        // the digest of indices [lower, upper]
+        uint64_t digest(uint16_t lower, uint16_t upper);
+        void clear();
+
+    private:
+        po6::threads::mutex m_mtx;
+        // m_nodes[1] is the root; the leaf for index i is m_nodes[N + i]
+        uint64_t* m_nodes;
+
+    private:
+        hash_tree(const hash_tree&);
+        hash_tree& operator = (const hash_tree&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_hash_tree_h_
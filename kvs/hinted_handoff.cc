@@ -0,0 +1,239 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <sstream>
+
+// Google Log
+#include <glog/logging.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/buffer_pool.h"
+#include "common/consus.h"
+#include "common/network_msgtype.h"
+#include "kvs/daemon.h"
+#include "kvs/hinted_handoff.h"
+
+// hints beyond this many bytes of table, key and value are refused, and the
+// writes wait on the next owner as they would without handoff
+#define HANDOFF_MAX_BYTES (64ULL * 1024ULL * 1024ULL)
+
+using consus::hinted_handoff;
+
+extern bool s_debug_mode;
+
+struct hinted_handoff :: hint
+{
+    hint();
+    ~hint() throw () {}
+    size_t bytes() const { return table.size() + key.size() + value.size(); }
+
+    comm_id target;
+    uint8_t flags;
+    std::string table;
+    std::string key;
+    uint64_t timestamp;
+    std::string value;
+    uint64_t last_sent;
+};
+
+hinted_handoff :: hint :: hint()
+    : target()
+    , flags()
+    , table()
+    , key()
+    , timestamp()
+    , value()
+    , last_sent(0)
+{
+}
+
+hinted_handoff :: hinted_handoff()
+    : m_mtx()
+    , m_hints()
+    , m_pending()
+    , m_bytes(0)
+    , m_pulled()
+{
+}
+
+hinted_handoff :: ~hinted_handoff() throw ()
+{
+}
+
+bool
+hinted_handoff :: journal(uint64_t nonce, comm_id target, uint8_t flags,
+                          const e::slice& table, const e::slice& key,
+                          uint64_t timestamp, const e::slice& value)
+{
+    const uint64_t bytes = table.size() + key.size() + value.size();
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_bytes + bytes > HANDOFF_MAX_BYTES)
+    {
+        LOG_EVERY_N(WARNING, 1000) << "hinted handoff journal is full; migrating writes will wait on their next owner";
+        return false;
+    }
+
+    hint& h(m_hints[nonce]);
+    h.target = target;
+    h.flags = flags;
+    h.table.assign(table.cdata(), table.size());
+    h.key.assign(key.cdata(), key.size());
+    h.timestamp = timestamp;
+    h.value.assign(value.cdata(), value.size());
+    m_bytes += bytes;
+    ++m_pending[target];
+    return true;
+}
+
+bool
+hinted_handoff :: ack(uint64_t nonce, consus_returncode rc)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    hint_map_t::iterator it = m_hints.find(nonce);
+
+    if (it == m_hints.end())
+    {
+        return false;
+    }
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        erase(it);
+    }
+    else if (rc == CONSUS_UNKNOWN_TABLE || rc == CONSUS_INVALID)
+    {
+        LOG(WARNING) << "dropping hinted write for " << it->second.target << ": " << rc;
+        erase(it);
+    }
+
+    return true;
+}
+
+bool
+hinted_handoff :: pending(comm_id target)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_pending.find(target) != m_pending.end();
+}
+
+bool
+hinted_handoff :: first_pull(comm_id target, partition_id partition)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_pulled.insert(std::make_pair(target, partition)).second;
+}
+
+void
+hinted_handoff :: replay(daemon* d, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    configuration* c = d->get_config();
+    hint_map_t::iterator it = m_hints.begin();
+
+    while (it != m_hints.end())
+    {
+        hint& h(it->second);
+        const e::slice table(h.table);
+        const e::slice key(h.key);
+        replica_set rs;
+        bool wanted = false;
+
+        if (c->hash(d->m_us.dc, table, key, &rs))
+        {
+            for (unsigned i = 0; i < rs.num_replicas; ++i)
+            {
+                wanted = wanted || rs.replicas[i] == h.target || rs.transitioning[i] == h.target;
+            }
+        }
+
+        if (!wanted)
+        {
+            // the migration was abandoned or the target left the cluster
+            LOG_IF(INFO, s_debug_mode) << "dropping hinted write for " << h.target << "; no longer a replica";
+            erase(it++);
+            continue;
+        }
+
+        if (h.last_sent + d->resend_interval(h.target) < now)
+        {
+            const e::slice value(h.value);
+            const table_ref tr(d->m_table_ids.intern(table));
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(KVS_RAW_WR)
+                            + sizeof(uint64_t)
+                            + sizeof(uint8_t)
+                            + pack_size(tr)
+                            + pack_size(key)
+                            + sizeof(uint64_t)
+                            + pack_size(value);
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE)
+                << KVS_RAW_WR << it->first << h.flags << tr << key << h.timestamp << value;
+            d->send(h.target, msg);
+            h.last_sent = now;
+        }
+
+        ++it;
+    }
+}
+
+std::string
+hinted_handoff :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "hints=" << m_hints.size() << " bytes=" << m_bytes << "\n";
+
+    for (std::map<comm_id, uint64_t>::iterator it = m_pending.begin();
+            it != m_pending.end(); ++it)
+    {
+        ostr << "target=" << it->first << " hints=" << it->second << "\n";
+    }
+
+    return ostr.str();
+}
+
+void
+hinted_handoff :: erase(hint_map_t::iterator it)
+{
+    const comm_id target = it->second.target;
+    m_bytes -= it->second.bytes();
+    std::map<comm_id, uint64_t>::iterator p = m_pending.find(target);
+    assert(p != m_pending.end());
+
+    if (--p->second == 0)
+    {
+        m_pending.erase(p);
+    }
+
+    m_hints.erase(it);
+}
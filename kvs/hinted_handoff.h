@@ -0,0 +1,99 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_hinted_handoff_h_
+#define consus_kvs_hinted_handoff_h_
+
+// STL
+#include <map>
+#include <set>
+#include <string>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include <consus.h>
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+class daemon;
+
+// Writes this daemon accepted as the current owner of a partition that is
+// migrating, on behalf of the partition's next owner.  The write replicator
+// counts the pair as written once the current owner holds the write, and the
+// hint carries it to the next owner in the background.  The current owner
+// withholds the end of the migration from a next owner with hints outstanding,
+// so the next owner never takes over without them.
+class hinted_handoff
+{
+    public:
+        hinted_handoff();
+        ~hinted_handoff() throw ();
+
+    public:
+        // false if the journal is full; the write must then reach target
+        // before the replicator counts it
+        bool journal(uint64_t nonce, comm_id target, uint8_t flags,
+                     const e::slice& table, const e::slice& key,
+                     uint64_t timestamp, const e::slice& value);
+        // false if nonce names no hint
+        bool ack(uint64_t nonce, consus_returncode rc);
+        bool pending(comm_id target);
+        // true the first time target pulls partition since this daemon
+        // started; hints journaled before a restart are lost, so that pull
+        // must start over from the beginning of the data
+        bool first_pull(comm_id target, partition_id partition);
+        void replay(daemon* d, uint64_t now);
+        std::string debug_dump();
+
+    private:
+        struct hint;
+        typedef std::map<uint64_t, hint> hint_map_t;
+
+    private:
+        void erase(hint_map_t::iterator it);
+
+    private:
+        po6::threads::mutex m_mtx;
+        hint_map_t m_hints;
+        std::map<comm_id, uint64_t> m_pending;
+        uint64_t m_bytes;
+        std::set<std::pair<comm_id, partition_id> > m_pulled;
+
+    private:
+        hinted_handoff(const hinted_handoff&);
+        hinted_handoff& operator = (const hinted_handoff&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_hinted_handoff_h_
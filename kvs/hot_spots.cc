@@ -0,0 +1,189 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "common/metrics.h"
+#include "kvs/hot_spots.h"
+
+using consus::heavy_hitters;
+using consus::hot_spots;
+using consus::metrics_label_escape;
+
+struct hot_spots::slow
+{
+    slow() : kind(""), tk(), nanos(0) {}
+    const char* kind;
+    table_key_pair tk;
+    uint64_t nanos;
+};
+
+namespace
+{
+
+void
+render_keys(std::ostream& out, const char* op, heavy_hitters* hh)
+{
+    std::vector<heavy_hitters::entry> entries;
+    hh->top(&entries);
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        out << "consus_hot_key{op=\"" << op << "\",rank=\"" << i << "\""
+            << ",table=\"" << metrics_label_escape(entries[i].tk.table) << "\""
+            << ",key=\"" << metrics_label_escape(entries[i].tk.key) << "\"} "
+            << entries[i].count * HOT_SPOTS_SAMPLE << "\n";
+    }
+}
+
+} // namespace
+
+hot_spots :: hot_spots()
+    : m_ops(0)
+    , m_reads()
+    , m_writes()
+    , m_slow_mtx()
+    , m_slow_floor(0)
+    , m_slow()
+{
+}
+
+hot_spots :: ~hot_spots() throw ()
+{
+}
+
+void
+hot_spots :: read(const e::slice& table, const e::slice& key)
+{
+    if (sampled())
+    {
+        m_reads.add(table_key_pair(table, key), 1);
+    }
+}
+
+void
+hot_spots :: written(const e::slice& table, const e::slice& key)
+{
+    if (sampled())
+    {
+        m_writes.add(table_key_pair(table, key), 1);
+    }
+}
+
+void
+hot_spots :: replicated(const char* kind, const e::slice& table,
+                        const e::slice& key, uint64_t nanos)
+{
+    if (nanos <= e::atomic::load_64_nobarrier(&m_slow_floor))
+    {
+        return;
+    }
+
+    po6::threads::mutex::hold hold(&m_slow_mtx);
+
+    if (m_slow.size() < HOT_SPOTS_SLOWEST)
+    {
+        m_slow.push_back(slow());
+    }
+    else
+    {
+        size_t fastest = 0;
+
+        for (size_t i = 1; i < m_slow.size(); ++i)
+        {
+            if (m_slow[i].nanos < m_slow[fastest].nanos)
+            {
+                fastest = i;
+            }
+        }
+
+        if (m_slow[fastest].nanos >= nanos)
+        {
+            return;
+        }
+
+        std::swap(m_slow[fastest], m_slow.back());
+    }
+
+    m_slow.back().kind = kind;
+    m_slow.back().tk = table_key_pair(table, key);
+    m_slow.back().nanos = nanos;
+
+    if (m_slow.size() == HOT_SPOTS_SLOWEST)
+    {
+        uint64_t floor = m_slow[0].nanos;
+
+        for (size_t i = 1; i < m_slow.size(); ++i)
+        {
+            floor = std::min(floor, m_slow[i].nanos);
+        }
+
+        e::atomic::store_64_nobarrier(&m_slow_floor, floor);
+    }
+}
+
+void
+hot_spots :: render(std::ostream& out)
+{
+    out << "# TYPE consus_hot_key gauge\n";
+    render_keys(out, "read", &m_reads);
+    render_keys(out, "write", &m_writes);
+    std::vector<slow> s;
+
+    {
+        po6::threads::mutex::hold hold(&m_slow_mtx);
+        s = m_slow;
+    }
+
+    std::sort(s.begin(), s.end(), slower);
+    out << "# TYPE consus_slow_replicator_seconds gauge\n";
+
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        out << "consus_slow_replicator_seconds{kind=\"" << s[i].kind << "\",rank=\"" << i << "\""
+            << ",table=\"" << metrics_label_escape(s[i].tk.table) << "\""
+            << ",key=\"" << metrics_label_escape(s[i].tk.key) << "\"} "
+            << s[i].nanos * 1e-9 << "\n";
+    }
+}
+
+bool
+hot_spots :: slower(const slow& lhs, const slow& rhs)
+{
+    return lhs.nanos > rhs.nanos;
+}
+
+bool
+hot_spots :: sampled()
+{
+    return e::atomic::increment_64_nobarrier(&m_ops, 1) % HOT_SPOTS_SAMPLE == 0;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_hot_spots_h_
+#define consus_kvs_hot_spots_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+#include "kvs/lock_contention.h"
+
+// one read or write in this many feeds the hot key top-Ks
+#define HOT_SPOTS_SAMPLE 16
+// how many of the slowest replicators are remembered
+#define HOT_SPOTS_SLOWEST 32
+
+BEGIN_CONSUS_NAMESPACE
+
+// What consus-debug hot-spots asks a running daemon: the keys read and
+// written most, and the replicators that took longest to answer a
+// transaction manager.  Reads and writes are sampled, so the hot path pays for
+// an atomic increment; replicators are compared against the slowest kept so
+// far before taking the lock.
+class hot_spots
+{
+    public:
+        hot_spots();
+        ~hot_spots() throw ();
+
+    public:
+        void read(const e::slice& table, const e::slice& key);
+        void written(const e::slice& table, const e::slice& key);
+        // kind must be a string literal
+        void replicated(const char* kind, const e::slice& table,
+                        const e::slice& key, uint64_t nanos);
+        // append as Prometheus gauges
+        void render(std::ostream& out);
+
+    private:
+        struct slow;
+        static bool slower(const slow& lhs, const slow& rhs);
+        bool sampled();
+
+    private:
+        uint64_t m_ops;
+        heavy_hitters m_reads;
+        heavy_hitters m_writes;
+        po6::threads::mutex m_slow_mtx;
+        // the fastest of m_slow once it is full; read without the lock
+        uint64_t m_slow_floor;
+        std::vector<slow> m_slow;
+
+    private:
+        hot_spots(const hot_spots&);
+        hot_spots& operator = (const hot_spots&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_hot_spots_h_
@@ -0,0 +1,245 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <assert.h>
+#include <stdint.h>
+
+// e
+#include <e/endian.h>
+#include <e/serialization.h>
+
+// consus
+#include "kvs/key_encoding.h"
+
+#define DATA_TAG 'D'
+#define FORMAT_TAG 'F'
+#define LOCK_TAG 'L'
+
+std::string
+consus :: data_key(const e::slice& table, const e::slice& key, uint64_t timestamp)
+{
+    std::string tmp;
+    tmp.reserve(data_key_prefix_size(table) + key.size() + 2 + sizeof(uint64_t));
+    tmp.push_back(DATA_TAG);
+    std::string t;
+    e::packer(&t) << table;
+    tmp.append(t);
+
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        tmp.push_back(key.cdata()[i]);
+
+        if (key.cdata()[i] == '\0')
+        {
+            tmp.push_back('\xff');
+        }
+    }
+
+    tmp.push_back('\0');
+    tmp.push_back('\x01');
+    unsigned char ts[sizeof(uint64_t)];
+    e::pack64be(UINT64_MAX - timestamp, ts);
+    tmp.append(reinterpret_cast<const char*>(ts), sizeof(ts));
+    return tmp;
+}
+
+size_t
+consus :: data_key_prefix_size(const e::slice& table)
+{
+    return 1 + pack_size(table);
+}
+
+bool
+consus :: decode_data_key(const char* data, size_t data_sz,
+                          e::slice* table, std::string* key, uint64_t* timestamp)
+{
+    if (data_sz < 1 + 2 + sizeof(uint64_t) || data[0] != DATA_TAG)
+    {
+        return false;
+    }
+
+    const char* const end = data + data_sz - sizeof(uint64_t);
+    e::unpacker up(data + 1, end - data - 1);
+    up = up >> *table;
+
+    if (up.error())
+    {
+        return false;
+    }
+
+    const char* ptr = end - up.remain();
+    key->clear();
+
+    while (ptr + 1 < end)
+    {
+        if (ptr[0] != '\0')
+        {
+            key->push_back(ptr[0]);
+            ++ptr;
+        }
+        else if (ptr[1] == '\xff')
+        {
+            key->push_back('\0');
+            ptr += 2;
+        }
+        else if (ptr[1] == '\x01' && ptr + 2 == end)
+        {
+            e::unpack64be(end, timestamp);
+            *timestamp = UINT64_MAX - *timestamp;
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+bool
+consus :: is_data_key(const char* data, size_t data_sz)
+{
+    return data_sz > 0 && data[0] == DATA_TAG;
+}
+
+std::string
+consus :: data_keys_begin()
+{
+    return std::string(1, DATA_TAG);
+}
+
+std::string
+consus :: presence_key(const std::string& dk)
+{
+    assert(dk.size() > sizeof(uint64_t));
+    std::string tmp(dk, 0, dk.size() - sizeof(uint64_t));
+    tmp.append(sizeof(uint64_t), '\0');
+    return tmp;
+}
+
+std::string
+consus :: format_key()
+{
+    return std::string(1, FORMAT_TAG);
+}
+
+std::string
+consus :: lock_key(const e::slice& table, const e::slice& key)
+{
+    std::string tmp(1, LOCK_TAG);
+    std::string tk;
+    e::packer(&tk) << table << key;
+    tmp.append(tk);
+    return tmp;
+}
+
+bool
+consus :: decode_lock_key(const char* data, size_t data_sz,
+                          e::slice* table, e::slice* key)
+{
+    if (!is_lock_key(data, data_sz))
+    {
+        return false;
+    }
+
+    e::unpacker up(data + 1, data_sz - 1);
+    up = up >> *table >> *key;
+    return !up.error() && !up.remain();
+}
+
+bool
+consus :: is_lock_key(const char* data, size_t data_sz)
+{
+    return data_sz > 0 && data[0] == LOCK_TAG;
+}
+
+std::string
+consus :: lock_keys_begin()
+{
+    return std::string(1, LOCK_TAG);
+}
+
+std::string
+consus :: lock_value(const std::vector<transaction_group>& holders, bool shared)
+{
+    std::string val;
+    e::packer pa(&val);
+
+    if (holders.empty())
+    {
+        pa = pa << transaction_group();
+    }
+    else if (!shared)
+    {
+        assert(holders.size() == 1);
+        pa = pa << holders[0];
+    }
+    else
+    {
+        std::vector<transaction_group> others(holders.begin() + 1, holders.end());
+        pa = pa << holders[0] << uint8_t(1) << others;
+    }
+
+    return val;
+}
+
+bool
+consus :: decode_lock_value(const char* data, size_t data_sz,
+                            std::vector<transaction_group>* holders, bool* shared)
+{
+    transaction_group tg;
+    uint8_t flag = 0;
+    std::vector<transaction_group> others;
+    e::unpacker up(data, data_sz);
+    up = up >> tg;
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> flag >> others;
+    }
+
+    if (up.error())
+    {
+        return false;
+    }
+
+    holders->clear();
+    *shared = false;
+
+    if (tg != transaction_group())
+    {
+        holders->push_back(tg);
+        holders->insert(holders->end(), others.begin(), others.end());
+        *shared = flag != 0;
+    }
+
+    return true;
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_key_encoding_h_
+#define consus_kvs_key_encoding_h_
+
+// STL
+#include <string>
+#include <vector>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+#include "common/transaction_group.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// The on-disk layout shared by the datalayers.  Keys compare bytewise.  A data
+// key is a tag, the length-prefixed table, the key with each 0x00 escaped as
+// 0x00 0xff and terminated by 0x00 0x01, and the timestamp inverted and
+// big-endian, so that keys sort in byte order and each key's versions sort
+// newest first.  Lock keys carry a different tag and sort after all data.
+std::string
+data_key(const e::slice& table, const e::slice& key, uint64_t timestamp);
+// every data key of table starts with this many bytes of any other
+size_t
+data_key_prefix_size(const e::slice& table);
+bool
+decode_data_key(const char* data, size_t data_sz,
+                e::slice* table, std::string* key, uint64_t* timestamp);
+bool
+is_data_key(const char* data, size_t data_sz);
+// sorts at or before every data key
+std::string
+data_keys_begin();
+// every key with a stored version also has a presence marker: a data key at
+// the otherwise unused timestamp UINT64_MAX, which sorts just before the
+// key's newest version; this is the marker for the key of data_key
+std::string
+presence_key(const std::string& data_key);
+// records which optional parts of the format a store has; sorts after all
+// data and before all locks
+std::string
+format_key();
+
+std::string
+lock_key(const e::slice& table, const e::slice& key);
+bool
+decode_lock_key(const char* data, size_t data_sz,
+                e::slice* table, e::slice* key);
+bool
+is_lock_key(const char* data, size_t data_sz);
+// sorts at or before every lock key, and after every other key
+std::string
+lock_keys_begin();
+// an exclusive lock is stored as its holder alone; shared locks append a
+// flag and the remaining holders
+std::string
+lock_value(const std::vector<transaction_group>& holders, bool shared);
+bool
+decode_lock_value(const char* data, size_t data_sz,
+                  std::vector<transaction_group>* holders, bool* shared);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_key_encoding_h_
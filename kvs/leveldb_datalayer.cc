@@ -25,19 +25,69 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <sstream>
+
 // Google Log
 #include <glog/logging.h>
 
+// po6
+#include <po6/path.h>
+#include <po6/threads/cond.h>
+
 // e
+#include <e/atomic.h>
 #include <e/endian.h>
 #include <e/serialization.h>
 #include <e/strescape.h>
 
 // consus
+#include "kvs/key_encoding.h"
 #include "kvs/leveldb_datalayer.h"
 
 using consus::leveldb_datalayer;
 
+// Upper bound on the bytes a single group commit will fold into one batch.
+// Writers queued beyond this wait for the next sync.
+#define GROUP_COMMIT_MAX_BYTES (4ULL * 1024ULL * 1024ULL)
+
+// Bytes of uncompressed blocks leveldb keeps in memory.
+#define BLOCK_CACHE_BYTES (128ULL * 1024ULL * 1024ULL)
+
+// Upper bound on idle iterators kept around for reuse by get.
+#define ITERATOR_POOL_SIZE 64
+
+// Upper bound on lazily-persisted locks held in memory before write_lock
+// forces them to disk itself.
+#define LAZY_LOCKS_MAX_DIRTY 65536
+
+// Records moved per batch when upgrading a store from the old key format.
+#define UPGRADE_BATCH 4096
+
+// LevelDB stops writes outright once level 0 holds this many files.
+#define L0_STOP_WRITES 12
+
+// LevelDB compacts level 0 once it holds this many files, and each deeper
+// level once it outgrows ten times the one above, starting from 10MB.
+#define L0_COMPACTION_TRIGGER 4
+#define L1_MAX_BYTES (10ULL * 1024ULL * 1024ULL)
+#define LEVELS 7
+
+// Writers waiting on group commit at which the queue alone counts as stalled.
+#define WRITERS_STALLED 256
+
+// The ordering of the old key format; used only to read stores that predate
+// the bytewise format while upgrading them.
 struct leveldb_datalayer::comparator : public leveldb::Comparator
 {
     comparator();
@@ -123,35 +173,190 @@ leveldb_datalayer :: comparator :: Compare(const leveldb::Slice& a, const leveld
     return 0;
 }
 
+// Bloom filters over data keys with the timestamp stripped off, so that one
+// probe answers for every version of a key.  Locks are filtered whole.
+struct leveldb_datalayer::filter : public leveldb::FilterPolicy
+{
+    filter();
+    virtual ~filter() throw ();
+    virtual const char* Name() const { return "ConsusPrefixBloomFilter"; }
+    virtual void CreateFilter(const leveldb::Slice* keys, int n, std::string* dst) const;
+    virtual bool KeyMayMatch(const leveldb::Slice& key, const leveldb::Slice& f) const;
+    static leveldb::Slice prefix(const leveldb::Slice& key);
+
+    const leveldb::FilterPolicy* bloom;
+
+    private:
+        filter(const filter&);
+        filter& operator = (const filter&);
+};
+
+leveldb_datalayer :: filter :: filter()
+    : bloom(leveldb::NewBloomFilterPolicy(10))
+{
+}
+
+leveldb_datalayer :: filter :: ~filter() throw ()
+{
+    delete bloom;
+}
+
+void
+leveldb_datalayer :: filter :: CreateFilter(const leveldb::Slice* keys, int n, std::string* dst) const
+{
+    // versions of a key are adjacent, so dropping repeats is enough
+    std::vector<leveldb::Slice> prefixes;
+    prefixes.reserve(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        leveldb::Slice p = prefix(keys[i]);
+
+        if (prefixes.empty() || prefixes.back() != p)
+        {
+            prefixes.push_back(p);
+        }
+    }
+
+    bloom->CreateFilter(prefixes.empty() ? NULL : &prefixes[0], prefixes.size(), dst);
+}
+
+bool
+leveldb_datalayer :: filter :: KeyMayMatch(const leveldb::Slice& key, const leveldb::Slice& f) const
+{
+    return bloom->KeyMayMatch(prefix(key), f);
+}
+
+leveldb::Slice
+leveldb_datalayer :: filter :: prefix(const leveldb::Slice& key)
+{
+    if (is_data_key(key.data(), key.size()) && key.size() > sizeof(uint64_t))
+    {
+        return leveldb::Slice(key.data(), key.size() - sizeof(uint64_t));
+    }
+
+    return key;
+}
+
 struct leveldb_datalayer::reference : public datalayer::reference
 {
-    reference(std::auto_ptr<leveldb::Iterator> it);
+    reference(leveldb_datalayer* dl, leveldb::Iterator* it, uint64_t generation);
     virtual ~reference() throw ();
 
-    std::auto_ptr<leveldb::Iterator> it;
+    leveldb_datalayer* dl;
+    leveldb::Iterator* it;
+    uint64_t generation;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
 };
 
-leveldb_datalayer :: reference :: reference(std::auto_ptr<leveldb::Iterator> _it)
+leveldb_datalayer :: reference :: reference(leveldb_datalayer* _dl,
+                                            leveldb::Iterator* _it,
+                                            uint64_t _generation)
     : datalayer::reference()
+    , dl(_dl)
     , it(_it)
+    , generation(_generation)
 {
 }
 
 leveldb_datalayer :: reference :: ~reference() throw ()
+{
+    dl->release_iterator(it, generation);
+}
+
+struct leveldb_datalayer::snapshot : public datalayer::snapshot
+{
+    snapshot(leveldb::DB* db);
+    virtual ~snapshot() throw ();
+
+    leveldb::DB* db;
+    const leveldb::Snapshot* snap;
+
+    private:
+        snapshot(const snapshot&);
+        snapshot& operator = (const snapshot&);
+};
+
+leveldb_datalayer :: snapshot :: snapshot(leveldb::DB* _db)
+    : datalayer::snapshot()
+    , db(_db)
+    , snap(db->GetSnapshot())
+{
+}
+
+leveldb_datalayer :: snapshot :: ~snapshot() throw ()
+{
+    db->ReleaseSnapshot(snap);
+}
+
+struct leveldb_datalayer::writer
+{
+    writer(po6::threads::mutex* mtx, const std::string& k, const leveldb::Slice& v);
+    ~writer() throw ();
+
+    const std::string& key;
+    const leveldb::Slice value;
+    const std::vector<std::string>* deletes;
+    // more data keys and values to write alongside key
+    const std::vector<std::pair<std::string, std::string> >* puts;
+    bool done;
+    consus_returncode rc;
+    po6::threads::cond cond;
+
+    private:
+        writer(const writer&);
+        writer& operator = (const writer&);
+};
+
+leveldb_datalayer :: writer :: writer(po6::threads::mutex* mtx,
+                                      const std::string& k,
+                                      const leveldb::Slice& v)
+    : key(k)
+    , value(v)
+    , deletes(NULL)
+    , puts(NULL)
+    , done(false)
+    , rc(CONSUS_GARBAGE)
+    , cond(mtx)
+{
+}
+
+leveldb_datalayer :: writer :: ~writer() throw ()
 {
 }
 
-leveldb_datalayer :: leveldb_datalayer()
+leveldb_datalayer :: leveldb_datalayer(bool lazy_locks, unsigned shares)
     : m_cmp(new comparator())
     , m_bf(NULL)
+    , m_cache(NULL)
     , m_db(NULL)
+    , m_writers_mtx()
+    , m_writers()
+    , m_iterators_mtx()
+    , m_write_generation(0)
+    , m_iterators()
+    , m_lazy_locks(lazy_locks)
+    , m_shares(std::max(shares, 1U))
+    , m_locks_mtx()
+    , m_dirty_locks()
+    , m_stalls(0)
+    , m_stall_time(0)
 {
 }
 
 leveldb_datalayer :: ~leveldb_datalayer() throw ()
 {
-    delete m_bf;
+    for (size_t i = 0; i < m_iterators.size(); ++i)
+    {
+        delete m_iterators[i];
+    }
+
     delete m_db;
+    delete m_bf;
+    delete m_cache;
 }
 
 bool
@@ -159,10 +364,10 @@ leveldb_datalayer :: init(std::string data)
 {
     leveldb::Options opts;
     opts.create_if_missing = true;
-    opts.filter_policy = m_bf = leveldb::NewBloomFilterPolicy(10);
-    opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L);
-    opts.comparator = m_cmp.get();
-    leveldb::Status st = leveldb::DB::Open(opts, data, &m_db);
+    opts.filter_policy = m_bf = new filter();
+    opts.block_cache = m_cache = leveldb::NewLRUCache(BLOCK_CACHE_BYTES / m_shares);
+    opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L) / m_shares;
+    leveldb::Status st = leveldb::DB::Open(opts, po6::path::join(data, "leveldb"), &m_db);
 
     if (!st.ok())
     {
@@ -170,6 +375,194 @@ leveldb_datalayer :: init(std::string data)
         return false;
     }
 
+    return upgrade(data) && add_presence_markers();
+}
+
+// Stores that predate the bytewise key format live directly in the data
+// directory under the old comparator.  Their records move into the new store
+// in batches before the daemon serves anything; every batch is durable in the
+// new store before it is deleted from the old one, so an interrupted upgrade
+// picks up where it left off on the next start.
+bool
+leveldb_datalayer :: upgrade(const std::string& data)
+{
+    if (access(po6::path::join(data, "CURRENT").c_str(), F_OK) < 0)
+    {
+        return true;
+    }
+
+    leveldb::Options opts;
+    opts.create_if_missing = false;
+    opts.comparator = m_cmp.get();
+    leveldb::DB* old = NULL;
+    leveldb::Status st = leveldb::DB::Open(opts, data, &old);
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "could not open leveldb to upgrade it: " << st.ToString();
+        return false;
+    }
+
+    LOG(INFO) << "upgrading leveldb in " << data << " to the bytewise key format";
+    leveldb::WriteOptions wopts;
+    wopts.sync = true;
+    leveldb::Iterator* it = old->NewIterator(leveldb::ReadOptions());
+    it->SeekToFirst();
+    uint64_t moved = 0;
+
+    while (st.ok() && it->Valid())
+    {
+        leveldb::WriteBatch add;
+        leveldb::WriteBatch remove;
+
+        for (size_t n = 0; n < UPGRADE_BATCH && it->Valid(); ++n, it->Next())
+        {
+            std::string k;
+
+            if (!upgrade_key(it->key(), &k))
+            {
+                LOG(ERROR) << "cannot upgrade corrupt key \""
+                           << e::strescape(it->key().ToString()) << "\"";
+                delete it;
+                delete old;
+                return false;
+            }
+
+            add.Put(k, it->value());
+            remove.Delete(it->key());
+            ++moved;
+        }
+
+        st = m_db->Write(wopts, &add);
+
+        if (st.ok())
+        {
+            st = old->Write(wopts, &remove);
+        }
+    }
+
+    if (st.ok())
+    {
+        st = it->status();
+    }
+
+    delete it;
+    delete old;
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "could not upgrade leveldb: " << st.ToString();
+        return false;
+    }
+
+    // only leveldb's own files go; the rest of the data directory stays
+    st = leveldb::DestroyDB(data, opts);
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "upgraded leveldb, but could not remove the old files: " << st.ToString();
+        return false;
+    }
+
+    LOG(INFO) << "upgraded " << moved << " records to the bytewise key format";
+    return true;
+}
+
+bool
+leveldb_datalayer :: upgrade_key(const leveldb::Slice& k, std::string* out)
+{
+    static const leveldb::Slice lock_table_prefix("\x0bconsus.lock", 12);
+    const bool is_lock = k.starts_with(lock_table_prefix);
+    const size_t skip = is_lock ? lock_table_prefix.size() : 0;
+    const size_t trail = is_lock ? 0 : sizeof(uint64_t);
+    e::slice table;
+    e::unpacker up(k.data() + skip, k.size() - skip);
+    up = up >> table;
+
+    if (up.error() || up.remain() < trail)
+    {
+        return false;
+    }
+
+    const e::slice key(k.data() + k.size() - up.remain(), up.remain() - trail);
+
+    if (is_lock)
+    {
+        *out = lock_key(table, key);
+        return true;
+    }
+
+    uint64_t timestamp;
+    e::unpack64be(k.data() + k.size() - sizeof(uint64_t), &timestamp);
+    *out = data_key(table, key, timestamp);
+    return true;
+}
+
+// Stores written before presence markers existed get them once; until then
+// get would report every key as missing.
+bool
+leveldb_datalayer :: add_presence_markers()
+{
+    std::string val;
+    leveldb::Status st = m_db->Get(leveldb::ReadOptions(), format_key(), &val);
+
+    if (st.ok())
+    {
+        return true;
+    }
+    else if (!st.IsNotFound())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        return false;
+    }
+
+    leveldb::WriteOptions wopts;
+    wopts.sync = true;
+    leveldb::Iterator* it = m_db->NewIterator(leveldb::ReadOptions());
+    it->Seek(data_keys_begin());
+    uint64_t added = 0;
+
+    while (st.ok() && it->Valid() &&
+           is_data_key(it->key().data(), it->key().size()))
+    {
+        leveldb::WriteBatch batch;
+
+        for (size_t n = 0; n < UPGRADE_BATCH && it->Valid() &&
+                is_data_key(it->key().data(), it->key().size()); ++n, it->Next())
+        {
+            if (it->key().size() > sizeof(uint64_t))
+            {
+                batch.Put(presence_key(it->key().ToString()), leveldb::Slice());
+                ++added;
+            }
+        }
+
+        st = m_db->Write(wopts, &batch);
+    }
+
+    if (st.ok())
+    {
+        st = it->status();
+    }
+
+    delete it;
+
+    if (st.ok())
+    {
+        st = m_db->Put(wopts, format_key(), "presence");
+    }
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "could not add presence markers: " << st.ToString();
+        return false;
+    }
+
+    if (added > 0)
+    {
+        LOG(INFO) << "added presence markers for " << added << " stored versions";
+    }
+
     return true;
 }
 
@@ -181,27 +574,52 @@ leveldb_datalayer :: get(const e::slice& table,
                          e::slice* value,
                          datalayer::reference** ref)
 {
+    e::slice discard;
+    value = value ? value : &discard;
+
+    // UINT64_MAX is where the presence marker lives
+    timestamp_le = std::min(timestamp_le, UINT64_MAX - 1);
     std::string tmp = data_key(table, key, timestamp_le);
-    std::auto_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
-    it->Seek(tmp);
     *timestamp = 0;
     *value = e::slice();
     *ref = NULL;
 
+    // seeks never consult the bloom filters, but a point read of the marker
+    // does, so keys that were never written cost no block reads
+    std::string ignored;
+    leveldb::Status st = m_db->Get(leveldb::ReadOptions(), presence_key(tmp), &ignored);
+
+    if (st.IsNotFound())
+    {
+        return CONSUS_NOT_FOUND;
+    }
+    else if (!st.ok())
+    {
+        LOG(ERROR) << "leveldb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    uint64_t generation;
+    leveldb::Iterator* it = acquire_iterator(&generation);
+    it->Seek(tmp);
+
     if (!it->status().ok())
     {
         LOG(ERROR) << "leveldb error: " << it->status().ToString();
+        release_iterator(it, generation);
         return CONSUS_SERVER_ERROR;
     }
     else if (!it->Valid() || tmp.size() != it->key().size() ||
              memcmp(tmp.data(), it->key().data(), tmp.size() - 8) != 0)
     {
+        release_iterator(it, generation);
         return CONSUS_NOT_FOUND;
     }
 
     e::unpack64be(it->key().data() + it->key().size() - 8, timestamp);
+    *timestamp = UINT64_MAX - *timestamp;
     *value = e::slice(it->value().data(), it->value().size());
-    *ref = new reference(it);
+    *ref = new reference(this, it, generation);
 
     if (value->empty())
     {
@@ -213,6 +631,66 @@ leveldb_datalayer :: get(const e::slice& table,
     }
 }
 
+consus_returncode
+leveldb_datalayer :: scan(const e::slice& table,
+                          const e::slice& key,
+                          uint64_t timestamp_le,
+                          uint64_t limit,
+                          std::vector<scan_item>* items)
+{
+    // every data key of the table starts with the same prefix; the rest
+    // orders by key bytes, then newest timestamp first
+    const std::string prefix(data_key(table, e::slice(), 0), 0, data_key_prefix_size(table));
+    // so that presence markers always sort as too new
+    timestamp_le = std::min(timestamp_le, UINT64_MAX - 1);
+    uint64_t generation;
+    leveldb::Iterator* it = acquire_iterator(&generation);
+    it->Seek(data_key(table, key, timestamp_le));
+    items->clear();
+
+    while (it->Valid() && items->size() < limit)
+    {
+        const leveldb::Slice k(it->key());
+        e::slice ktable;
+        std::string ukey;
+        uint64_t timestamp;
+
+        if (!k.starts_with(prefix) ||
+            !decode_data_key(k.data(), k.size(), &ktable, &ukey, &timestamp))
+        {
+            break;
+        }
+
+        if (timestamp > timestamp_le)
+        {
+            it->Seek(data_key(table, e::slice(ukey), timestamp_le));
+            continue;
+        }
+
+        items->push_back(scan_item());
+        scan_item* si = &items->back();
+        si->key = ukey;
+        si->timestamp = timestamp;
+        si->value.assign(it->value().data(), it->value().size());
+
+        // appending a zero byte yields the smallest key after this one
+        std::string next(si->key);
+        next.push_back('\0');
+        it->Seek(data_key(table, e::slice(next), UINT64_MAX));
+    }
+
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "leveldb error: " << it->status().ToString();
+        rc = CONSUS_SERVER_ERROR;
+    }
+
+    release_iterator(it, generation);
+    return rc;
+}
+
 consus_returncode
 leveldb_datalayer :: put(const e::slice& table,
                          const e::slice& key,
@@ -221,60 +699,309 @@ leveldb_datalayer :: put(const e::slice& table,
 {
     assert(!value.empty()); /* XXX */
     std::string tmp = data_key(table, key, timestamp);
-    leveldb::WriteOptions opts;
-    opts.sync = true;
-    leveldb::Status st = m_db->Put(opts, tmp, leveldb::Slice(value.cdata(), value.size()));
-    consus_returncode rc;
+    return write(tmp, leveldb::Slice(value.cdata(), value.size()));
+}
 
-    if (st.ok())
+consus_returncode
+leveldb_datalayer :: del(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp)
+{
+    std::string tmp = data_key(table, key, timestamp);
+    return write(tmp, leveldb::Slice());
+}
+
+consus_returncode
+leveldb_datalayer :: put_batch(const std::vector<raw_item>& items)
+{
+    std::vector<std::pair<std::string, std::string> > puts;
+    puts.reserve(items.size());
+
+    for (size_t i = 0; i < items.size(); ++i)
     {
-        rc = CONSUS_SUCCESS;
+        puts.push_back(std::make_pair(data_key(e::slice(items[i].table),
+                                               e::slice(items[i].key),
+                                               items[i].timestamp),
+                                      items[i].value));
+    }
+
+    const std::string none;
+    writer w(&m_writers_mtx, none, leveldb::Slice());
+    w.puts = &puts;
+    return commit(&w);
+}
+
+consus_returncode
+leveldb_datalayer :: raw_scan(const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    uint64_t generation;
+    leveldb::Iterator* it = acquire_iterator(&generation);
+    consus_returncode rc = raw_scan(it, cursor, limit, items, next, done);
+    release_iterator(it, generation);
+    return rc;
+}
+
+consus::datalayer::snapshot*
+leveldb_datalayer :: create_snapshot()
+{
+    return new snapshot(m_db);
+}
+
+consus_returncode
+leveldb_datalayer :: raw_scan(const datalayer::snapshot* snap,
+                              const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    leveldb::ReadOptions opts;
+    opts.snapshot = static_cast<const snapshot*>(snap)->snap;
+    // a bulk copy reads each block once; keep it from evicting hot data
+    opts.fill_cache = false;
+    leveldb::Iterator* it = m_db->NewIterator(opts);
+    consus_returncode rc = raw_scan(it, cursor, limit, items, next, done);
+    delete it;
+    return rc;
+}
+
+consus_returncode
+leveldb_datalayer :: raw_scan(leveldb::Iterator* it,
+                              const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    items->clear();
+    *next = cursor;
+    *done = false;
+
+    if (cursor.empty())
+    {
+        it->Seek(data_keys_begin());
     }
     else
     {
-        LOG(ERROR) << "leveldb error: " << st.ToString();
+        it->Seek(cursor);
+
+        if (it->Valid() && it->key() == leveldb::Slice(cursor))
+        {
+            it->Next();
+        }
+    }
+
+    // locks sort after all data and are not part of the scan
+    for (uint64_t examined = 0; it->Valid() && examined < limit; ++examined, it->Next())
+    {
+        const leveldb::Slice k(it->key());
+
+        if (!is_data_key(k.data(), k.size()))
+        {
+            break;
+        }
+
+        next->assign(k.data(), k.size());
+        e::slice table;
+        std::string key;
+        uint64_t timestamp;
+
+        if (!decode_data_key(k.data(), k.size(), &table, &key, &timestamp))
+        {
+            LOG(ERROR) << "skipping corrupt data key \"" << e::strescape(*next) << "\"";
+            continue;
+        }
+
+        // the receiver's own writes recreate the marker
+        if (timestamp == UINT64_MAX)
+        {
+            continue;
+        }
+
+        items->push_back(raw_item());
+        raw_item* ri = &items->back();
+        ri->table = table.str();
+        ri->key = key;
+        ri->timestamp = timestamp;
+        ri->value.assign(it->value().data(), it->value().size());
+    }
+
+    *done = !it->Valid() || !is_data_key(it->key().data(), it->key().size());
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "leveldb error: " << it->status().ToString();
         rc = CONSUS_SERVER_ERROR;
+        *done = false;
     }
 
     return rc;
 }
 
 consus_returncode
-leveldb_datalayer :: del(const e::slice& table,
-                         const e::slice& key,
-                         uint64_t timestamp)
+leveldb_datalayer :: prune(uint64_t watermark,
+                           uint64_t tombstones,
+                           const std::string& cursor,
+                           uint64_t limit,
+                           std::string* next,
+                           bool* done,
+                           uint64_t* pruned)
 {
-    std::string tmp = data_key(table, key, timestamp);
-    leveldb::WriteOptions opts;
-    opts.sync = true;
-    leveldb::Status st = m_db->Put(opts, tmp, leveldb::Slice());
-    consus_returncode rc;
+    uint64_t generation;
+    leveldb::Iterator* it = acquire_iterator(&generation);
+    std::vector<std::string> doomed;
+    *next = cursor;
+    *done = false;
+    *pruned = 0;
 
-    if (st.ok())
+    if (cursor.empty())
     {
-        rc = CONSUS_SUCCESS;
+        it->Seek(data_keys_begin());
     }
     else
     {
-        LOG(ERROR) << "leveldb error: " << st.ToString();
+        it->Seek(cursor);
+
+        if (it->Valid() && it->key() == leveldb::Slice(cursor))
+        {
+            it->Next();
+        }
+    }
+
+    // Each key's versions sort newest first, so the first version at or
+    // below the watermark is the one that must stay.  The
+    // cursor only ever lands on the last version of a key, so resuming never
+    // splits a key's versions.
+    // Presence markers sit above any watermark and always stay; one that
+    // outlives its versions costs get a seek, never a wrong answer.
+    std::string user_key;
+    bool kept_below = false;
+    uint64_t examined = 0;
+
+    for (; it->Valid(); it->Next())
+    {
+        const leveldb::Slice k(it->key());
+
+        if (!is_data_key(k.data(), k.size()))
+        {
+            break;
+        }
+
+        if (k.size() < 1 + sizeof(uint64_t))
+        {
+            next->assign(k.data(), k.size());
+            continue;
+        }
+
+        const leveldb::Slice prefix(k.data(), k.size() - sizeof(uint64_t));
+
+        if (prefix != leveldb::Slice(user_key))
+        {
+            if (examined >= limit)
+            {
+                break;
+            }
+
+            user_key.assign(prefix.data(), prefix.size());
+            kept_below = false;
+        }
+
+        ++examined;
+        next->assign(k.data(), k.size());
+        uint64_t timestamp;
+        e::unpack64be(k.data() + k.size() - sizeof(uint64_t), &timestamp);
+        timestamp = UINT64_MAX - timestamp;
+
+        if (timestamp > watermark)
+        {
+            continue;
+        }
+
+        if (!kept_below)
+        {
+            kept_below = true;
+
+            // a tombstone with nothing older to hide is dead once no replica
+            // could push back what it hid
+            if (!it->value().empty() || timestamp > tombstones)
+            {
+                continue;
+            }
+        }
+
+        doomed.push_back(std::string(k.data(), k.size()));
+    }
+
+    *done = !it->Valid() || !is_data_key(it->key().data(), it->key().size());
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "leveldb error: " << it->status().ToString();
         rc = CONSUS_SERVER_ERROR;
+        *done = false;
+    }
+
+    release_iterator(it, generation);
+
+    if (rc == CONSUS_SUCCESS && !doomed.empty())
+    {
+        rc = erase(doomed);
+    }
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        *pruned = doomed.size();
+    }
+    else
+    {
+        *next = cursor;
     }
 
     return rc;
 }
 
+consus_returncode
+leveldb_datalayer :: erase_version(const e::slice& table,
+                                   const e::slice& key,
+                                   uint64_t timestamp)
+{
+    std::vector<std::string> doomed;
+    doomed.push_back(data_key(table, key, timestamp));
+    return erase(doomed);
+}
+
 consus_returncode
 leveldb_datalayer :: read_lock(const e::slice& table,
                                const e::slice& key,
-                               transaction_group* tg)
+                               std::vector<transaction_group>* holders,
+                               bool* shared)
 {
     std::string tmp = lock_key(table, key);
     std::string val;
+    holders->clear();
+    *shared = false;
+
+    if (m_lazy_locks)
+    {
+        po6::threads::mutex::hold hold(&m_locks_mtx);
+        std::map<std::string, std::string>::iterator it = m_dirty_locks.find(tmp);
+
+        if (it != m_dirty_locks.end())
+        {
+            return decode_lock(table, key, it->second, holders, shared);
+        }
+    }
+
     leveldb::Status st = m_db->Get(leveldb::ReadOptions(), tmp, &val);
 
     if (st.IsNotFound())
     {
-        *tg = transaction_group();
         return CONSUS_NOT_FOUND;
     }
     else if (!st.ok())
@@ -283,64 +1010,440 @@ leveldb_datalayer :: read_lock(const e::slice& table,
         return CONSUS_SERVER_ERROR;
     }
 
-    e::unpacker up(val);
-    up = up >> *tg;
+    return decode_lock(table, key, val, holders, shared);
+}
 
-    if (up.error())
+consus_returncode
+leveldb_datalayer :: write_lock(const e::slice& table,
+                                const e::slice& key,
+                                const std::vector<transaction_group>& holders,
+                                bool shared)
+{
+    std::string tmp = lock_key(table, key);
+    std::string val = lock_value(holders, shared);
+
+    if (!m_lazy_locks)
     {
-        LOG(ERROR) << "corrupt lock (\""
-                   << e::strescape(table.str()) << "\", \""
-                   << e::strescape(key.str()) << "\")";
-        return CONSUS_INVALID;
+        return write(tmp, val);
     }
 
-    return CONSUS_SUCCESS;
+    bool full = false;
+
+    {
+        po6::threads::mutex::hold hold(&m_locks_mtx);
+        m_dirty_locks[tmp] = val;
+        full = m_dirty_locks.size() >= LAZY_LOCKS_MAX_DIRTY;
+    }
+
+    return full ? checkpoint_locks() : CONSUS_SUCCESS;
 }
 
 consus_returncode
-leveldb_datalayer :: write_lock(const e::slice& table,
-                                const e::slice& key,
-                                const transaction_group& tg)
+leveldb_datalayer :: checkpoint_locks()
 {
-    std::string tmp = lock_key(table, key);
-    std::string val;
-    e::packer(&val) << tg;
+    if (!m_lazy_locks)
+    {
+        return CONSUS_SUCCESS;
+    }
+
+    {
+        po6::threads::mutex::hold hold(&m_locks_mtx);
+
+        if (m_dirty_locks.empty())
+        {
+            return CONSUS_SUCCESS;
+        }
+    }
+
+    return write(std::string(), leveldb::Slice());
+}
+
+consus_returncode
+leveldb_datalayer :: scan_locks(const std::string& cursor,
+                               uint64_t limit,
+                               std::vector<lock_item>* locks,
+                               std::string* next,
+                               bool* done)
+{
+    leveldb::ReadOptions opts;
+    // recovery reads every lock once; keep it from evicting hot data
+    opts.fill_cache = false;
+    leveldb::Iterator* it = m_db->NewIterator(opts);
+    locks->clear();
+    *next = cursor;
+    *done = false;
+
+    if (cursor.empty())
+    {
+        it->Seek(lock_keys_begin());
+    }
+    else
+    {
+        it->Seek(cursor);
+
+        if (it->Valid() && it->key() == leveldb::Slice(cursor))
+        {
+            it->Next();
+        }
+    }
+
+    for (uint64_t examined = 0; it->Valid() && examined < limit; ++examined, it->Next())
+    {
+        const leveldb::Slice k(it->key());
+        const leveldb::Slice v(it->value());
+        next->assign(k.data(), k.size());
+        e::slice table;
+        e::slice key;
+        locks->push_back(lock_item());
+        lock_item* li = &locks->back();
+
+        if (!decode_lock_key(k.data(), k.size(), &table, &key) ||
+            !decode_lock_value(v.data(), v.size(), &li->holders, &li->shared))
+        {
+            LOG(ERROR) << "skipping corrupt lock \"" << e::strescape(*next) << "\"";
+            locks->pop_back();
+            continue;
+        }
+
+        li->table = table.str();
+        li->key = key.str();
+    }
+
+    *done = !it->Valid();
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "leveldb error: " << it->status().ToString();
+        rc = CONSUS_SERVER_ERROR;
+        *done = false;
+    }
+
+    delete it;
+    return rc;
+}
+
+unsigned
+leveldb_datalayer :: write_pressure()
+{
+    std::string prop;
+    unsigned l0 = 0;
+
+    if (m_db->GetProperty("leveldb.num-files-at-level0", &prop))
+    {
+        l0 = strtoul(prop.c_str(), NULL, 10);
+    }
+
+    size_t queued = 0;
+
+    {
+        po6::threads::mutex::hold hold(&m_writers_mtx);
+        queued = m_writers.size();
+    }
+
+    const size_t pressure = std::max(size_t(l0) * 100 / L0_STOP_WRITES,
+                                     queued * 100 / WRITERS_STALLED);
+    return std::min(pressure, size_t(100));
+}
+
+void
+leveldb_datalayer :: stats(storage_stats* st)
+{
+    st->level_files.assign(LEVELS, 0);
+    st->level_bytes.assign(LEVELS, 0);
+    std::string prop;
+
+    // leveldb reports sizes only in its stats table, rounded to megabytes:
+    //   Level  Files Size(MB) Time(sec) Read(MB) Write(MB)
+    if (m_db->GetProperty("leveldb.stats", &prop))
+    {
+        std::istringstream istr(prop);
+        std::string line;
+
+        while (std::getline(istr, line))
+        {
+            unsigned level;
+            unsigned long long files;
+            double mb;
+
+            if (sscanf(line.c_str(), " %u %llu %lf", &level, &files, &mb) == 3 &&
+                level < LEVELS)
+            {
+                st->level_files[level] = files;
+                st->level_bytes[level] = uint64_t(mb * 1024. * 1024.);
+            }
+        }
+    }
+
+    // leveldb does not track this itself; estimate it as every byte of each
+    // level beyond the size that triggers its compaction
+    st->pending_compaction_bytes = 0;
+
+    if (st->level_files[0] >= L0_COMPACTION_TRIGGER)
+    {
+        st->pending_compaction_bytes += st->level_bytes[0];
+    }
+
+    uint64_t target = L1_MAX_BYTES;
+
+    for (unsigned level = 1; level < LEVELS; ++level, target *= 10)
+    {
+        if (st->level_bytes[level] > target)
+        {
+            st->pending_compaction_bytes += st->level_bytes[level] - target;
+        }
+    }
+
+    st->stalls = e::atomic::load_64_nobarrier(&m_stalls);
+    st->stall_time = e::atomic::load_64_nobarrier(&m_stall_time);
+}
+
+void
+leveldb_datalayer :: compact(uint16_t, uint16_t)
+{
+    // keys are ordered by table and key rather than by hash, so the
+    // partitions are spread over the whole key space
+    m_db->CompactRange(NULL, NULL);
+}
+
+consus_returncode
+leveldb_datalayer :: write(const std::string& k, const leveldb::Slice& v)
+{
+    writer w(&m_writers_mtx, k, v);
+    return commit(&w);
+}
+
+consus_returncode
+leveldb_datalayer :: erase(const std::vector<std::string>& keys)
+{
+    const std::string none;
+    writer w(&m_writers_mtx, none, leveldb::Slice());
+    w.deletes = &keys;
+    return commit(&w);
+}
+
+consus_returncode
+leveldb_datalayer :: commit(writer* w)
+{
+    m_writers_mtx.lock();
+    m_writers.push_back(w);
+
+    while (!w->done && m_writers.front() != w)
+    {
+        w->cond.wait();
+    }
+
+    if (w->done)
+    {
+        m_writers_mtx.unlock();
+        return w->rc;
+    }
+
+    // This thread is at the head of the queue and becomes the leader for one
+    // group commit.  Everything queued behind it (up to the size cap) goes
+    // out in the same batch; those writers sleep until the sync completes.
+    leveldb::WriteBatch batch;
+    size_t batch_sz = 0;
+    writer* last = NULL;
+
+    for (std::deque<writer*>::iterator it = m_writers.begin();
+            it != m_writers.end(); ++it)
+    {
+        writer* x = *it;
+        const bool data = is_data_key(x->key.data(), x->key.size());
+        size_t x_sz = x->key.size() * (data ? 2 : 1) + x->value.size();
+
+        for (size_t i = 0; x->deletes && i < x->deletes->size(); ++i)
+        {
+            x_sz += (*x->deletes)[i].size();
+        }
+
+        for (size_t i = 0; x->puts && i < x->puts->size(); ++i)
+        {
+            x_sz += (*x->puts)[i].first.size() * 2 + (*x->puts)[i].second.size();
+        }
+
+        if (last && batch_sz + x_sz > GROUP_COMMIT_MAX_BYTES)
+        {
+            break;
+        }
+
+        if (!x->key.empty())
+        {
+            batch.Put(x->key, x->value);
+        }
+
+        if (data)
+        {
+            batch.Put(presence_key(x->key), leveldb::Slice());
+        }
+
+        for (size_t i = 0; x->puts && i < x->puts->size(); ++i)
+        {
+            batch.Put((*x->puts)[i].first, (*x->puts)[i].second);
+            batch.Put(presence_key((*x->puts)[i].first), leveldb::Slice());
+        }
+
+        for (size_t i = 0; x->deletes && i < x->deletes->size(); ++i)
+        {
+            batch.Delete((*x->deletes)[i]);
+        }
+
+        batch_sz += x_sz;
+        last = x;
+    }
+
+    assert(last);
+    m_writers_mtx.unlock();
+    // Dirty locks ride along with whatever batch goes out next.  Only one
+    // leader writes at a time, so no older copy can land after this one.
+    std::vector<std::pair<std::string, std::string> > locks;
+
+    if (m_lazy_locks)
+    {
+        po6::threads::mutex::hold hold(&m_locks_mtx);
+        locks.assign(m_dirty_locks.begin(), m_dirty_locks.end());
+    }
+
+    for (size_t i = 0; i < locks.size(); ++i)
+    {
+        batch.Put(locks[i].first, locks[i].second);
+    }
+
     leveldb::WriteOptions opts;
     opts.sync = true;
-    leveldb::Status st = m_db->Put(opts, tmp, val);
+    const uint64_t start = po6::monotonic_time();
+    leveldb::Status st = m_db->Write(opts, &batch);
+    const uint64_t elapsed = po6::monotonic_time() - start;
+    consus_returncode rc;
+
+    if (elapsed >= WRITE_STALL_THRESHOLD)
+    {
+        e::atomic::increment_64_nobarrier(&m_stalls, 1);
+        e::atomic::increment_64_nobarrier(&m_stall_time, elapsed);
+    }
 
     if (st.ok())
     {
-        return CONSUS_SUCCESS;
+        rc = CONSUS_SUCCESS;
     }
     else
     {
         LOG(ERROR) << "leveldb error: " << st.ToString();
-        return CONSUS_SERVER_ERROR;
+        rc = CONSUS_SERVER_ERROR;
+    }
+
+    if (st.ok() && !locks.empty())
+    {
+        // a lock that changed again while syncing stays dirty
+        po6::threads::mutex::hold hold(&m_locks_mtx);
+
+        for (size_t i = 0; i < locks.size(); ++i)
+        {
+            std::map<std::string, std::string>::iterator it = m_dirty_locks.find(locks[i].first);
+
+            if (it != m_dirty_locks.end() && it->second == locks[i].second)
+            {
+                m_dirty_locks.erase(it);
+            }
+        }
     }
+
+    std::vector<leveldb::Iterator*> stale;
+
+    {
+        // every pooled iterator predates this batch and would miss it
+        po6::threads::mutex::hold hold(&m_iterators_mtx);
+        ++m_write_generation;
+        stale.swap(m_iterators);
+    }
+
+    for (size_t i = 0; i < stale.size(); ++i)
+    {
+        delete stale[i];
+    }
+
+    m_writers_mtx.lock();
+
+    while (true)
+    {
+        writer* x = m_writers.front();
+        m_writers.pop_front();
+        x->rc = rc;
+        x->done = true;
+
+        if (x != w)
+        {
+            x->cond.signal();
+        }
+
+        if (x == last)
+        {
+            break;
+        }
+    }
+
+    if (!m_writers.empty())
+    {
+        m_writers.front()->cond.signal();
+    }
+
+    m_writers_mtx.unlock();
+    return rc;
 }
 
-std::string
-leveldb_datalayer :: data_key(const e::slice& table,
-                              const e::slice& key,
-                              uint64_t timestamp)
+consus_returncode
+leveldb_datalayer :: decode_lock(const e::slice& table,
+                                 const e::slice& key,
+                                 const std::string& val,
+                                 std::vector<transaction_group>* holders,
+                                 bool* shared)
 {
-    std::string tmp;
-    e::packer(&tmp)
-        << table
-        << e::pack_array<uint8_t>(key.data(), key.size())
-        << timestamp;
-    return tmp;
+    if (!decode_lock_value(val.data(), val.size(), holders, shared))
+    {
+        LOG(ERROR) << "corrupt lock (\""
+                   << e::strescape(table.str()) << "\", \""
+                   << e::strescape(key.str()) << "\")";
+        return CONSUS_INVALID;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+leveldb::Iterator*
+leveldb_datalayer :: acquire_iterator(uint64_t* generation)
+{
+    {
+        po6::threads::mutex::hold hold(&m_iterators_mtx);
+        *generation = m_write_generation;
+
+        if (!m_iterators.empty())
+        {
+            leveldb::Iterator* it = m_iterators.back();
+            m_iterators.pop_back();
+            return it;
+        }
+    }
+
+    // creating the iterator after reading the generation guarantees it
+    // reflects every write that generation accounts for
+    return m_db->NewIterator(leveldb::ReadOptions());
 }
 
-std::string
-leveldb_datalayer :: lock_key(const e::slice& table,
-                              const e::slice& key)
+void
+leveldb_datalayer :: release_iterator(leveldb::Iterator* it, uint64_t generation)
 {
-    std::string tmp;
-    e::packer(&tmp)
-        << e::slice("consus.lock")
-        << table
-        << e::pack_array<uint8_t>(key.data(), key.size());
-    return tmp;
+    {
+        po6::threads::mutex::hold hold(&m_iterators_mtx);
+
+        if (generation == m_write_generation &&
+            m_iterators.size() < ITERATOR_POOL_SIZE &&
+            it->status().ok())
+        {
+            m_iterators.push_back(it);
+            return;
+        }
+    }
+
+    delete it;
 }
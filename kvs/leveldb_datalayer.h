@@ -29,12 +29,20 @@
 #define consus_kvs_leveldb_datalayer_h_
 
 // STL
+#include <deque>
+#include <map>
 #include <memory>
+#include <vector>
 
 // LevelDB
+#include <leveldb/cache.h>
 #include <leveldb/comparator.h>
 #include <leveldb/db.h>
 #include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
+
+// po6
+#include <po6/threads/mutex.h>
 
 // e
 #include <e/slice.h>
@@ -49,7 +57,10 @@ BEGIN_CONSUS_NAMESPACE
 class leveldb_datalayer : public datalayer
 {
     public:
-        leveldb_datalayer();
+        // with lazy_locks, lock state lives in memory and reaches the disk
+        // with the next group commit or checkpoint instead of on every change;
+        // shares is how many stores split the daemon's cache and open files
+        leveldb_datalayer(bool lazy_locks, unsigned shares = 1);
         virtual ~leveldb_datalayer() throw ();
 
     public:
@@ -60,6 +71,11 @@ class leveldb_datalayer : public datalayer
                                       uint64_t* timestamp,
                                       e::slice* value,
                                       datalayer::reference** ref);
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items);
         virtual consus_returncode put(const e::slice& table,
                                       const e::slice& key,
                                       uint64_t timestamp,
@@ -67,28 +83,98 @@ class leveldb_datalayer : public datalayer
         virtual consus_returncode del(const e::slice& table,
                                       const e::slice& key,
                                       uint64_t timestamp);
+        virtual consus_returncode put_batch(const std::vector<raw_item>& items);
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual datalayer::snapshot* create_snapshot();
+        virtual consus_returncode raw_scan(const datalayer::snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned);
+        virtual consus_returncode erase_version(const e::slice& table,
+                                                const e::slice& key,
+                                                uint64_t timestamp);
         virtual consus_returncode read_lock(const e::slice& table,
                                             const e::slice& key,
-                                            transaction_group* tg);
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared);
         virtual consus_returncode write_lock(const e::slice& table,
                                              const e::slice& key,
-                                             const transaction_group& tg);
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared);
+        virtual consus_returncode checkpoint_locks();
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done);
+        virtual unsigned write_pressure();
+        virtual void stats(storage_stats* st);
+        virtual void compact(uint16_t first, uint16_t last);
 
     private:
         struct comparator;
+        struct filter;
         struct reference;
+        struct snapshot;
+        struct writer;
 
     private:
-        std::string data_key(const e::slice& table,
-                             const e::slice& key,
-                             uint64_t timestamp);
-        std::string lock_key(const e::slice& table,
-                             const e::slice& key);
+        // group commit:  all writes funnel through here; concurrent writers
+        // are coalesced into a single WriteBatch that is synced once
+        // an empty key writes nothing of its own, but still carries every
+        // dirty lock to disk
+        consus_returncode write(const std::string& k, const leveldb::Slice& v);
+        consus_returncode erase(const std::vector<std::string>& keys);
+        consus_returncode commit(writer* w);
+        consus_returncode raw_scan(leveldb::Iterator* it,
+                                   const std::string& cursor,
+                                   uint64_t limit,
+                                   std::vector<raw_item>* items,
+                                   std::string* next,
+                                   bool* done);
+        consus_returncode decode_lock(const e::slice& table,
+                                      const e::slice& key,
+                                      const std::string& val,
+                                      std::vector<transaction_group>* holders,
+                                      bool* shared);
+        // iterator pool:  iterators are reused across reads for as long as
+        // no write has committed since they were created
+        leveldb::Iterator* acquire_iterator(uint64_t* generation);
+        void release_iterator(leveldb::Iterator* it, uint64_t generation);
+        bool upgrade(const std::string& data);
+        bool upgrade_key(const leveldb::Slice& k, std::string* out);
+        bool add_presence_markers();
 
     private:
         std::auto_ptr<comparator> m_cmp;
         const leveldb::FilterPolicy* m_bf;
+        leveldb::Cache* m_cache;
         leveldb::DB* m_db;
+        po6::threads::mutex m_writers_mtx;
+        std::deque<writer*> m_writers;
+        po6::threads::mutex m_iterators_mtx;
+        uint64_t m_write_generation;
+        std::vector<leveldb::Iterator*> m_iterators;
+        const bool m_lazy_locks;
+        const unsigned m_shares;
+        po6::threads::mutex m_locks_mtx;
+        std::map<std::string, std::string> m_dirty_locks;
+        // group commits held up for WRITE_STALL_THRESHOLD or longer
+        uint64_t m_stalls;
+        uint64_t m_stall_time;
 
     private:
         leveldb_datalayer(const leveldb_datalayer&);
@@ -0,0 +1,136 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "kvs/load_tracker.h"
+
+using consus::load_tracker;
+using consus::partition_load;
+
+static bool
+hotter(const partition_load& lhs, const partition_load& rhs)
+{
+    if (lhs.requests != rhs.requests)
+    {
+        return lhs.requests > rhs.requests;
+    }
+
+    return lhs.index < rhs.index;
+}
+
+load_tracker :: load_tracker()
+    : m_requests(new uint64_t[CONSUS_KVS_PARTITIONS])
+    , m_bytes(new uint64_t[CONSUS_KVS_PARTITIONS])
+    , m_reported_requests(new uint64_t[CONSUS_KVS_PARTITIONS])
+    , m_reported_bytes(new uint64_t[CONSUS_KVS_PARTITIONS])
+{
+    memset(m_requests, 0, sizeof(uint64_t) * CONSUS_KVS_PARTITIONS);
+    memset(m_bytes, 0, sizeof(uint64_t) * CONSUS_KVS_PARTITIONS);
+    memset(m_reported_requests, 0, sizeof(uint64_t) * CONSUS_KVS_PARTITIONS);
+    memset(m_reported_bytes, 0, sizeof(uint64_t) * CONSUS_KVS_PARTITIONS);
+}
+
+load_tracker :: ~load_tracker() throw ()
+{
+    delete[] m_requests;
+    delete[] m_bytes;
+    delete[] m_reported_requests;
+    delete[] m_reported_bytes;
+}
+
+void
+load_tracker :: record(uint16_t index, uint64_t bytes)
+{
+    e::atomic::increment_64_nobarrier(&m_requests[index], 1);
+    e::atomic::increment_64_nobarrier(&m_bytes[index], bytes);
+}
+
+void
+load_tracker :: report(comm_id id, size_t max_hottest, kvs_load* load)
+{
+    load->id = id;
+    load->requests = 0;
+    load->bytes = 0;
+    load->hottest.clear();
+    std::vector<partition_load> busy;
+
+    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    {
+        const uint64_t requests = e::atomic::increment_64_nobarrier(&m_requests[i], 0);
+        const uint64_t bytes = e::atomic::increment_64_nobarrier(&m_bytes[i], 0);
+        const uint64_t dr = requests - m_reported_requests[i];
+        const uint64_t db = bytes - m_reported_bytes[i];
+        m_reported_requests[i] = requests;
+        m_reported_bytes[i] = bytes;
+        load->requests += dr;
+        load->bytes += db;
+
+        if (dr > 0)
+        {
+            busy.push_back(partition_load(i, dr, db));
+        }
+    }
+
+    const size_t n = std::min(max_hottest, busy.size());
+    std::partial_sort(busy.begin(), busy.begin() + n, busy.end(), hotter);
+    load->hottest.assign(busy.begin(), busy.begin() + n);
+}
+
+void
+load_tracker :: hottest(size_t max_hottest, std::vector<uint16_t>* indices)
+{
+    std::vector<partition_load> busy;
+
+    for (size_t i = 0; i < CONSUS_KVS_PARTITIONS; ++i)
+    {
+        const uint64_t requests = e::atomic::increment_64_nobarrier(&m_requests[i], 0);
+
+        if (requests > 0)
+        {
+            busy.push_back(partition_load(i, requests, 0));
+        }
+    }
+
+    const size_t n = std::min(max_hottest, busy.size());
+    std::partial_sort(busy.begin(), busy.begin() + n, busy.end(), hotter);
+    indices->clear();
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        indices->push_back(busy[i].index);
+    }
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_load_tracker_h_
+#define consus_kvs_load_tracker_h_
+
+// STL
+#include <vector>
+
+// consus
+#include "namespace.h"
+#include "common/constants.h"
+#include "common/kvs_load.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Counts the requests and bytes this daemon serves for each ring index, and
+// summarizes the traffic since the last summary for the coordinator, which
+// moves hot partitions off overloaded servers.
+class load_tracker
+{
+    public:
+        load_tracker();
+        ~load_tracker() throw ();
+
+    public:
+        void record(uint16_t index, uint64_t bytes);
+        // traffic since the previous call, naming at most max_hottest
+        // indices; not safe to call concurrently with itself
+        void report(comm_id id, size_t max_hottest, kvs_load* load);
+        // the indices with the most requests since startup, hottest first,
+        // naming at most max_hottest
+        void hottest(size_t max_hottest, std::vector<uint16_t>* indices);
+
+    private:
+        uint64_t* m_requests;
+        uint64_t* m_bytes;
+        // counter values as of the previous report
+        uint64_t* m_reported_requests;
+        uint64_t* m_reported_bytes;
+
+    private:
+        load_tracker(const load_tracker&);
+        load_tracker& operator = (const load_tracker&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_load_tracker_h_
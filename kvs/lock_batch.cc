@@ -0,0 +1,97 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/buffer_pool.h"
+#include "common/consus.h"
+#include "common/network_msgtype.h"
+#include "kvs/daemon.h"
+#include "kvs/lock_batch.h"
+
+using consus::lock_batch;
+
+lock_batch :: lock_batch(comm_id id, size_t expected)
+    : m_mtx()
+    , m_id(id)
+    , m_outstanding(expected)
+    , m_responses()
+{
+    m_responses.reserve(expected);
+}
+
+lock_batch :: ~lock_batch() throw ()
+{
+}
+
+void
+lock_batch :: respond(uint64_t nonce, consus_returncode rc, daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    assert(m_outstanding > 0);
+    m_responses.push_back(std::make_pair(nonce, rc));
+    --m_outstanding;
+    maybe_send(d);
+}
+
+void
+lock_batch :: dropped(daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    assert(m_outstanding > 0);
+    --m_outstanding;
+    maybe_send(d);
+}
+
+void
+lock_batch :: maybe_send(daemon* d)
+{
+    if (m_outstanding > 0 || m_responses.empty())
+    {
+        return;
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_LOCK_OP_BATCH_RESP)
+                    + sizeof(uint64_t)
+                    + m_responses.size() * (sizeof(uint64_t) + pack_size(CONSUS_SUCCESS))
+                    + sizeof(uint8_t);
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_LOCK_OP_BATCH_RESP << uint64_t(m_responses.size());
+
+    for (size_t i = 0; i < m_responses.size(); ++i)
+    {
+        pa = pa << m_responses[i].first << m_responses[i].second;
+    }
+
+    pa = pa << d->load();
+    d->send(m_id, msg);
+    m_responses.clear();
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_lock_batch_h_
+#define consus_kvs_lock_batch_h_
+
+// STL
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include <consus.h>
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+class daemon;
+
+// Shared by the lock replicators created for one KVS_LOCK_OP_BATCH.  Each
+// replicator reports its outcome here instead of answering the transaction
+// manager directly, and the last one to report sends a single
+// KVS_LOCK_OP_BATCH_RESP.
+class lock_batch
+{
+    public:
+        lock_batch(comm_id id, size_t expected);
+        ~lock_batch() throw ();
+
+    public:
+        void respond(uint64_t nonce, consus_returncode rc, daemon* d);
+        // the replicator was dropped and will never respond
+        void dropped(daemon* d);
+
+    private:
+        void maybe_send(daemon* d);
+
+    private:
+        po6::threads::mutex m_mtx;
+        const comm_id m_id;
+        size_t m_outstanding;
+        std::vector<std::pair<uint64_t, consus_returncode> > m_responses;
+
+    private:
+        lock_batch(const lock_batch&);
+        lock_batch& operator = (const lock_batch&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_lock_batch_h_
@@ -0,0 +1,249 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// e
+#include <e/atomic.h>
+#include <e/strescape.h>
+
+// consus
+#include "common/metrics.h"
+#include "kvs/lock_contention.h"
+
+using consus::heavy_hitters;
+using consus::lock_contention;
+using consus::metrics_label_escape;
+
+namespace
+{
+
+bool
+heavier(const heavy_hitters::entry& lhs, const heavy_hitters::entry& rhs)
+{
+    return lhs.count > rhs.count;
+}
+
+std::string
+labels(const char* dimension, size_t rank, const heavy_hitters::entry& e)
+{
+    std::ostringstream ostr;
+    ostr << "dimension=\"" << dimension << "\",rank=\"" << rank << "\""
+         << ",table=\"" << metrics_label_escape(e.tk.table) << "\""
+         << ",key=\"" << metrics_label_escape(e.tk.key) << "\"";
+    return ostr.str();
+}
+
+void
+dump_one(std::ostream& out, const char* dimension, heavy_hitters* hh)
+{
+    std::vector<heavy_hitters::entry> entries;
+    hh->top(&entries);
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        out << "contention " << dimension << "[" << i << "]"
+            << " table=\"" << e::strescape(entries[i].tk.table) << "\""
+            << " key=\"" << e::strescape(entries[i].tk.key) << "\""
+            << " total=" << entries[i].count
+            << " error=" << entries[i].error
+            << " events=" << entries[i].events << "\n";
+    }
+}
+
+} // namespace
+
+heavy_hitters :: heavy_hitters()
+    : m_mtx()
+    , m_entries()
+{
+    m_entries.reserve(LOCK_CONTENTION_TOP_K);
+}
+
+heavy_hitters :: ~heavy_hitters() throw ()
+{
+}
+
+void
+heavy_hitters :: add(const table_key_pair& tk, uint64_t weight)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    size_t smallest = 0;
+
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (m_entries[i].tk == tk)
+        {
+            m_entries[i].count += weight;
+            ++m_entries[i].events;
+            return;
+        }
+
+        if (m_entries[i].count < m_entries[smallest].count)
+        {
+            smallest = i;
+        }
+    }
+
+    if (m_entries.size() < LOCK_CONTENTION_TOP_K)
+    {
+        m_entries.push_back(entry());
+        m_entries.back().tk = tk;
+        m_entries.back().count = weight;
+        m_entries.back().events = 1;
+        return;
+    }
+
+    entry* e = &m_entries[smallest];
+    e->tk = tk;
+    e->error = e->count;
+    e->count += weight;
+    e->events = 1;
+}
+
+void
+heavy_hitters :: top(std::vector<entry>* entries)
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        *entries = m_entries;
+    }
+
+    std::sort(entries->begin(), entries->end(), heavier);
+}
+
+lock_contention :: lock_contention()
+    : m_wait()
+    , m_queue()
+    , m_wound()
+    , m_hold()
+    , m_typical_hold(0)
+{
+}
+
+lock_contention :: ~lock_contention() throw ()
+{
+}
+
+void
+lock_contention :: waited(const table_key_pair& tk, uint64_t nanos)
+{
+    m_wait.add(tk, nanos);
+}
+
+void
+lock_contention :: queued(const table_key_pair& tk, uint64_t ahead)
+{
+    m_queue.add(tk, ahead);
+}
+
+void
+lock_contention :: wounded(const table_key_pair& tk)
+{
+    m_wound.add(tk, 1);
+}
+
+void
+lock_contention :: held(const table_key_pair& tk, uint64_t nanos)
+{
+    m_hold.add(tk, nanos);
+    // an EWMA with weight 1/8; racing updates lose a sample, which is fine
+    // for an estimate
+    const uint64_t avg = e::atomic::load_64_nobarrier(&m_typical_hold);
+    const uint64_t upd = avg == 0 ? nanos : avg - avg / 8 + nanos / 8;
+    e::atomic::store_64_nobarrier(&m_typical_hold, upd);
+}
+
+uint64_t
+lock_contention :: typical_hold()
+{
+    return e::atomic::load_64_nobarrier(&m_typical_hold);
+}
+
+void
+lock_contention :: render(std::ostream& out)
+{
+    const char* const dimensions[] = {"wait_seconds", "queued_ahead", "wounds", "hold_seconds"};
+    const double scales[] = {1e-9, 1, 1, 1e-9};
+    heavy_hitters* hhs[] = {&m_wait, &m_queue, &m_wound, &m_hold};
+    std::vector<heavy_hitters::entry> entries[4];
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        hhs[i]->top(&entries[i]);
+    }
+
+    // each metric family's samples must be contiguous
+    out << "# TYPE consus_lock_contention gauge\n";
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        for (size_t j = 0; j < entries[i].size(); ++j)
+        {
+            out << "consus_lock_contention{" << labels(dimensions[i], j, entries[i][j])
+                << "} " << entries[i][j].count * scales[i] << "\n";
+        }
+    }
+
+    out << "# TYPE consus_lock_contention_error gauge\n";
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        for (size_t j = 0; j < entries[i].size(); ++j)
+        {
+            out << "consus_lock_contention_error{" << labels(dimensions[i], j, entries[i][j])
+                << "} " << entries[i][j].error * scales[i] << "\n";
+        }
+    }
+
+    out << "# TYPE consus_lock_contention_events gauge\n";
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        for (size_t j = 0; j < entries[i].size(); ++j)
+        {
+            out << "consus_lock_contention_events{" << labels(dimensions[i], j, entries[i][j])
+                << "} " << entries[i][j].events << "\n";
+        }
+    }
+}
+
+std::string
+lock_contention :: debug_dump()
+{
+    std::ostringstream ostr;
+    dump_one(ostr, "wait_nanos", &m_wait);
+    dump_one(ostr, "queued_ahead", &m_queue);
+    dump_one(ostr, "wounds", &m_wound);
+    dump_one(ostr, "hold_nanos", &m_hold);
+    return ostr.str();
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_lock_contention_h_
+#define consus_kvs_lock_contention_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "kvs/table_key_pair.h"
+
+// how many keys each top-K remembers
+#define LOCK_CONTENTION_TOP_K 32
+
+BEGIN_CONSUS_NAMESPACE
+
+// The keys with the largest total weight, found with the Space-Saving
+// algorithm of Metwally et al.: a key not among the K tracked ones replaces
+// the smallest and inherits its count as error.  Any key whose true total
+// exceeds 1/K of all weight is guaranteed to be present.
+class heavy_hitters
+{
+    public:
+        struct entry
+        {
+            entry() : tk(), count(0), error(0), events(0) {}
+            table_key_pair tk;
+            // an overestimate of the key's total by at most error
+            uint64_t count;
+            uint64_t error;
+            uint64_t events;
+        };
+
+    public:
+        heavy_hitters();
+        ~heavy_hitters() throw ();
+
+    public:
+        void add(const table_key_pair& tk, uint64_t weight);
+        // the tracked keys, heaviest first
+        void top(std::vector<entry>* entries);
+
+    private:
+        po6::threads::mutex m_mtx;
+        std::vector<entry> m_entries;
+
+    private:
+        heavy_hitters(const heavy_hitters&);
+        heavy_hitters& operator = (const heavy_hitters&);
+};
+
+// The history lock_state's debug_dump lacks: which keys waited longest for
+// their locks, had the longest queues, wounded the most transactions, and
+// were held the longest, accumulated since the daemon started.
+class lock_contention
+{
+    public:
+        lock_contention();
+        ~lock_contention() throw ();
+
+    public:
+        void waited(const table_key_pair& tk, uint64_t nanos);
+        void queued(const table_key_pair& tk, uint64_t ahead);
+        void wounded(const table_key_pair& tk);
+        void held(const table_key_pair& tk, uint64_t nanos);
+        // a moving average of how long locks are held, across all keys
+        uint64_t typical_hold();
+        // append as Prometheus gauges
+        void render(std::ostream& out);
+        std::string debug_dump();
+
+    private:
+        heavy_hitters m_wait;
+        heavy_hitters m_queue;
+        heavy_hitters m_wound;
+        heavy_hitters m_hold;
+        uint64_t m_typical_hold;
+
+    private:
+        lock_contention(const lock_contention&);
+        lock_contention& operator = (const lock_contention&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_lock_contention_h_
@@ -0,0 +1,283 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <assert.h>
+
+// STL
+#include <sstream>
+
+// e
+#include <e/compat.h>
+#include <e/strescape.h>
+
+// consus
+#include "common/hash.h"
+#include "kvs/lock_escalation.h"
+
+using consus::lock_escalation;
+
+struct lock_escalation::tracked
+{
+    tracked() : keys(), exclusive(false) {}
+    ~tracked() throw () {}
+    // every key the transaction has locked within the partition and not yet
+    // unlocked, whether by key or under the partition lock
+    std::set<std::string> keys;
+    bool exclusive;
+};
+
+struct lock_escalation::holder
+{
+    holder() : tg(), shared(false) {}
+    holder(const transaction_group& t, bool s) : tg(t), shared(s) {}
+    ~holder() throw () {}
+    transaction_group tg;
+    bool shared;
+};
+
+struct lock_escalation::partition
+{
+    partition() : keyed(), escalated() {}
+    ~partition() throw () {}
+    bool empty() const { return keyed.empty() && escalated.empty(); }
+    // transactions holding keys within the partition
+    std::map<transaction_group, tracked> keyed;
+    // transactions holding the whole partition; one exclusive holder or any
+    // number of shared holders
+    std::vector<holder> escalated;
+};
+
+struct lock_escalation::stripe
+{
+    stripe() : mtx(), partitions(), escalations(0) {}
+    ~stripe() throw () {}
+    po6::threads::mutex mtx;
+    std::map<partition_key, partition> partitions;
+    uint64_t escalations;
+
+    private:
+        stripe(const stripe&);
+        stripe& operator = (const stripe&);
+};
+
+lock_escalation :: lock_escalation()
+    : m_threshold(0)
+    , m_stripes(new stripe[LOCK_ESCALATION_STRIPES])
+{
+}
+
+lock_escalation :: ~lock_escalation() throw ()
+{
+    delete[] m_stripes;
+}
+
+lock_escalation::verdict
+lock_escalation :: admit(const e::slice& table, const e::slice& key,
+                         const transaction_group& tg, bool shared,
+                         transaction_group* blocker)
+{
+    const partition_key pk(table.str(), partition_index(table, key));
+    stripe* s = get_stripe(pk);
+    po6::threads::mutex::hold hold(&s->mtx);
+    partition* p = &s->partitions[pk];
+    bool covered = false;
+
+    for (size_t i = 0; i < p->escalated.size(); ++i)
+    {
+        const holder& h(p->escalated[i]);
+
+        if (h.tg == tg)
+        {
+            covered = shared || !h.shared;
+        }
+        else if (!shared || !h.shared)
+        {
+            *blocker = h.tg;
+            return BLOCKED;
+        }
+    }
+
+    tracked* t = &p->keyed[tg];
+    t->keys.insert(key.str());
+
+    if (covered)
+    {
+        return COVERED;
+    }
+
+    t->exclusive = t->exclusive || !shared;
+
+    if (t->keys.size() > m_threshold && maybe_escalate(p, tg))
+    {
+        ++s->escalations;
+    }
+
+    return PROCEED;
+}
+
+void
+lock_escalation :: release(const e::slice& table, const e::slice& key,
+                           const transaction_group& tg)
+{
+    const partition_key pk(table.str(), partition_index(table, key));
+    stripe* s = get_stripe(pk);
+    po6::threads::mutex::hold hold(&s->mtx);
+    std::map<partition_key, partition>::iterator it = s->partitions.find(pk);
+
+    if (it == s->partitions.end())
+    {
+        return;
+    }
+
+    partition* p = &it->second;
+    std::map<transaction_group, tracked>::iterator t = p->keyed.find(tg);
+
+    if (t != p->keyed.end())
+    {
+        // unlocks are idempotent, so a key may be released more than once
+        t->second.keys.erase(key.str());
+
+        if (!t->second.keys.empty())
+        {
+            return;
+        }
+
+        p->keyed.erase(t);
+    }
+
+    for (size_t i = 0; i < p->escalated.size(); ++i)
+    {
+        if (p->escalated[i].tg == tg)
+        {
+            p->escalated[i] = p->escalated.back();
+            p->escalated.pop_back();
+            break;
+        }
+    }
+
+    if (p->empty())
+    {
+        s->partitions.erase(it);
+    }
+}
+
+std::string
+lock_escalation :: debug_dump()
+{
+    std::ostringstream ostr;
+    uint64_t escalations = 0;
+
+    for (size_t i = 0; i < LOCK_ESCALATION_STRIPES; ++i)
+    {
+        stripe* s = &m_stripes[i];
+        po6::threads::mutex::hold hold(&s->mtx);
+        escalations += s->escalations;
+
+        for (std::map<partition_key, partition>::iterator it = s->partitions.begin();
+                it != s->partitions.end(); ++it)
+        {
+            const partition& p(it->second);
+
+            for (size_t j = 0; j < p.escalated.size(); ++j)
+            {
+                ostr << "partition table=\"" << e::strescape(it->first.first)
+                     << "\" index=" << it->first.second
+                     << " holder=" << transaction_group::log(p.escalated[j].tg)
+                     << " mode=" << (p.escalated[j].shared ? "shared" : "exclusive")
+                     << "\n";
+            }
+        }
+    }
+
+    ostr << "escalation threshold=" << m_threshold
+         << " escalations=" << escalations << "\n";
+    return ostr.str();
+}
+
+uint16_t
+lock_escalation :: partition_index(const e::slice& table, const e::slice& key)
+{
+    // the same partition configuration::hash places the key in
+    return hash64(table, key) >> 48;
+}
+
+lock_escalation::stripe*
+lock_escalation :: get_stripe(const partition_key& pk)
+{
+    e::compat::hash<std::string> h;
+    return &m_stripes[(h(pk.first) ^ pk.second) % LOCK_ESCALATION_STRIPES];
+}
+
+bool
+lock_escalation :: maybe_escalate(partition* p, const transaction_group& tg)
+{
+    std::map<transaction_group, tracked>::iterator self = p->keyed.find(tg);
+    assert(self != p->keyed.end());
+    const bool shared = !self->second.exclusive;
+    holder* mine = NULL;
+
+    for (size_t i = 0; i < p->escalated.size(); ++i)
+    {
+        holder* h = &p->escalated[i];
+
+        if (h->tg == tg)
+        {
+            mine = h;
+        }
+        else if (!shared || !h->shared)
+        {
+            return false;
+        }
+    }
+
+    // any key another transaction asked for counts as held, which errs
+    // toward staying with per-key locks
+    for (std::map<transaction_group, tracked>::iterator it = p->keyed.begin();
+            it != p->keyed.end(); ++it)
+    {
+        if (it->first != tg && !it->second.keys.empty() &&
+            (!shared || it->second.exclusive))
+        {
+            return false;
+        }
+    }
+
+    if (mine)
+    {
+        mine->shared = false;
+    }
+    else
+    {
+        p->escalated.push_back(holder(tg, shared));
+    }
+
+    // the per-key locks already granted stay with lock_state until unlocked,
+    // and the keys stay tracked so the partition lock outlives them
+    return true;
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_kvs_lock_escalation_h_
+#define consus_kvs_lock_escalation_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+#include "common/transaction_group.h"
+
+// independently locked shards of the partition table
+#define LOCK_ESCALATION_STRIPES 64
+
+BEGIN_CONSUS_NAMESPACE
+
+// Coarse locks over one partition of a table.  Keys are placed by hash, so
+// the partition is the only range of keys that a single replica set holds in
+// its entirety.  A transaction that asks for more than the threshold of keys
+// within one partition trades its further per-key locks there for a lock
+// over the whole partition, so a large batch of reads or updates costs one
+// lock per partition rather than one per key.  Every replica of the
+// partition sees the same requests and escalates alike.  Scans take no locks
+// at all---the transaction manager reads them again before prepare---so
+// they never reach this path.
+//
+// Escalation never waits:  while any other transaction has a conflicting
+// lock within the partition, the transaction keeps locking key by key.
+// Partition locks live in memory only, and so rely upon the quorum of
+// replicas that granted them to survive the failure of any one.
+class lock_escalation
+{
+    public:
+        enum verdict
+        {
+            // take the per-key lock as usual
+            PROCEED,
+            // the transaction's partition lock already covers the key
+            COVERED,
+            // another transaction's partition lock conflicts
+            BLOCKED
+        };
+
+    public:
+        lock_escalation();
+        ~lock_escalation() throw ();
+
+    public:
+        // keys per transaction and partition before escalating; 0 disables
+        void set_threshold(unsigned threshold) { m_threshold = threshold; }
+        bool enabled() const { return m_threshold > 0; }
+        // decide how tg's lock on (table, key) proceeds, and remember the key
+        // when it goes on to the per-key lock
+        verdict admit(const e::slice& table, const e::slice& key,
+                      const transaction_group& tg, bool shared,
+                      transaction_group* blocker);
+        // forget tg's lock on (table, key); the partition lock goes with the
+        // last of tg's keys within the partition
+        void release(const e::slice& table, const e::slice& key,
+                     const transaction_group& tg);
+        std::string debug_dump();
+
+    private:
+        struct tracked;
+        struct holder;
+        struct partition;
+        struct stripe;
+        typedef std::pair<std::string, uint16_t> partition_key;
+
+    private:
+        static uint16_t partition_index(const e::slice& table, const e::slice& key);
+        stripe* get_stripe(const partition_key& pk);
+        bool maybe_escalate(partition* p, const transaction_group& tg);
+
+    private:
+        unsigned m_threshold;
+        stripe* m_stripes;
+
+    private:
+        lock_escalation(const lock_escalation&);
+        lock_escalation& operator = (const lock_escalation&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_lock_escalation_h_
@@ -25,9 +25,15 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <stdlib.h>
+
 // STL
 #include <sstream>
 
+// Google Log
+#include <glog/logging.h>
+
 // BusyBee
 #include <busybee.h>
 
@@ -40,10 +46,14 @@
 
 using consus::lock_manager;
 
+extern bool s_debug_mode;
 extern std::vector<std::string> split_by_newlines(std::string s);
 
 lock_manager :: lock_manager(e::garbage_collector* gc)
     : m_locks(gc)
+    , m_contention()
+    , m_escalation()
+    , m_wound_delay(0)
 {
 }
 
@@ -54,11 +64,34 @@ lock_manager :: ~lock_manager() throw ()
 void
 lock_manager :: lock(comm_id id, uint64_t nonce,
                      const e::slice& table, const e::slice& key,
-                     const transaction_group& tg, daemon* d)
+                     const transaction_group& tg, bool shared, daemon* d)
 {
+    if (m_escalation.enabled())
+    {
+        transaction_group blocker;
+
+        switch (m_escalation.admit(table, key, tg, shared, &blocker))
+        {
+            case lock_escalation::PROCEED:
+                break;
+            case lock_escalation::COVERED:
+                return send_response(id, nonce, table, key, tg, d);
+            case lock_escalation::BLOCKED:
+                // wound-wait, as lock_state does for per-key holders
+                if (tg.txid.preempts(blocker.txid))
+                {
+                    send_wound_abort(id, nonce, table, key, blocker, d);
+                }
+
+                return send_response(id, nonce, table, key, blocker, d);
+            default:
+                abort();
+        }
+    }
+
     lock_map_t::state_reference sr;
     lock_state* s = m_locks.get_or_create_state(table_key_pair(table, key), &sr);
-    s->enqueue_lock(id, nonce, tg, d);
+    s->enqueue_lock(id, nonce, tg, shared, d);
 }
 
 void
@@ -66,11 +99,31 @@ lock_manager :: unlock(comm_id id, uint64_t nonce,
                        const e::slice& table, const e::slice& key,
                        const transaction_group& tg, daemon* d)
 {
+    if (m_escalation.enabled())
+    {
+        m_escalation.release(table, key, tg);
+    }
+
     lock_map_t::state_reference sr;
     lock_state* s = m_locks.get_or_create_state(table_key_pair(table, key), &sr);
     s->unlock(id, nonce, tg, d);
 }
 
+void
+lock_manager :: recover(const e::slice& table, const e::slice& key,
+                        const std::vector<transaction_group>& holders, bool shared)
+{
+    // an unheld lock would be collected as soon as it was created
+    if (holders.empty())
+    {
+        return;
+    }
+
+    lock_map_t::state_reference sr;
+    lock_state* s = m_locks.get_or_create_state(table_key_pair(table, key), &sr);
+    s->recover(holders, shared);
+}
+
 std::string
 lock_manager :: debug_dump()
 {
@@ -88,5 +141,53 @@ lock_manager :: debug_dump()
         }
     }
 
+    ostr << m_escalation.debug_dump();
+    ostr << m_contention.debug_dump();
     return ostr.str();
 }
+
+void
+lock_manager :: send_response(comm_id id, uint64_t nonce,
+                              const e::slice& table, const e::slice& key,
+                              const transaction_group& tg, daemon* d)
+{
+    configuration* c = d->get_config();
+    replica_set rs;
+
+    if (!c->hash(d->m_us.dc, table, key, &rs))
+    {
+        LOG_IF(INFO, s_debug_mode) << daemon::logid(table, key) << " dropping response to=" << id << " because hashing failed";
+        return;
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_RAW_LK_RESP)
+                    + sizeof(uint64_t)
+                    + pack_size(tg)
+                    + pack_size(rs);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_RAW_LK_RESP << nonce << tg << rs;
+    d->send(id, msg);
+}
+
+void
+lock_manager :: send_wound_abort(comm_id id, uint64_t nonce,
+                                 const e::slice& table, const e::slice& key,
+                                 const transaction_group& tg, daemon* d)
+{
+    m_contention.wounded(table_key_pair(table, key));
+    LOG_IF(INFO, s_debug_mode) << daemon::logid(table, key)
+                               << " abort-wounds partition holder "
+                               << transaction_group::log(tg);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_WOUND_XACT)
+                    + sizeof(uint64_t)
+                    + sizeof(uint8_t)
+                    + pack_size(tg)
+                    + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_WOUND_XACT << nonce << uint8_t(WOUND_XACT_ABORT) << tg << m_wound_delay;
+    d->send(id, msg);
+}
@@ -36,6 +36,8 @@
 #include "common/ids.h"
 #include "common/lock.h"
 #include "common/transaction_group.h"
+#include "kvs/lock_contention.h"
+#include "kvs/lock_escalation.h"
 #include "kvs/lock_state.h"
 #include "kvs/table_key_pair.h"
 
@@ -51,17 +53,38 @@ class lock_manager
     public:
         void lock(comm_id id, uint64_t nonce,
                   const e::slice& table, const e::slice& key,
-                  const transaction_group& tg, daemon* d);
+                  const transaction_group& tg, bool shared, daemon* d);
         void unlock(comm_id id, uint64_t nonce,
                     const e::slice& table, const e::slice& key,
                     const transaction_group& tg, daemon* d);
+        // rebuild table/key's holders from its durable lock before any
+        // request needs them
+        void recover(const e::slice& table, const e::slice& key,
+                     const std::vector<transaction_group>& holders, bool shared);
+        lock_contention* contention() { return &m_contention; }
+        void set_escalation_threshold(unsigned threshold)
+        { m_escalation.set_threshold(threshold); }
+        // the most a wound may wait for the holder to finish on its own
+        void set_wound_delay(uint64_t nanos) { m_wound_delay = nanos; }
+        uint64_t wound_delay() const { return m_wound_delay; }
         std::string debug_dump();
 
     private:
         typedef e::state_hash_table<table_key_pair, lock_state> lock_map_t;
 
+    private:
+        void send_response(comm_id id, uint64_t nonce,
+                           const e::slice& table, const e::slice& key,
+                           const transaction_group& tg, daemon* d);
+        void send_wound_abort(comm_id id, uint64_t nonce,
+                              const e::slice& table, const e::slice& key,
+                              const transaction_group& tg, daemon* d);
+
     private:
         lock_map_t m_locks;
+        lock_contention m_contention;
+        lock_escalation m_escalation;
+        uint64_t m_wound_delay;
 
     private:
         lock_manager(const lock_manager&);
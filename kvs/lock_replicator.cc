@@ -28,6 +28,9 @@
 // Google Log
 #include <glog/logging.h>
 
+// po6
+#include <po6/time.h>
+
 // e
 #include <e/strescape.h>
 
@@ -35,10 +38,13 @@
 #include <busybee.h>
 
 // consus
+#include "common/buffer_pool.h"
 #include "common/constants.h"
 #include "common/consus.h"
 #include "common/network_msgtype.h"
+#include "common/tracer.h"
 #include "kvs/daemon.h"
+#include "kvs/lock_batch.h"
 #include "kvs/lock_replicator.h"
 
 using consus::lock_replicator;
@@ -104,6 +110,7 @@ struct lock_replicator :: lock_stub
 
     comm_id target;
     uint64_t last_request_time;
+    unsigned requests;
     transaction_group tg;
     replica_set rs;
 };
@@ -111,6 +118,7 @@ struct lock_replicator :: lock_stub
 lock_replicator :: lock_stub :: lock_stub(comm_id t)
     : target(t)
     , last_request_time(0)
+    , requests(0)
     , tg()
     , rs()
 {
@@ -121,6 +129,7 @@ lock_replicator :: lock_replicator(uint64_t key)
     , m_mtx()
     , m_init(false)
     , m_finished(false)
+    , m_traced_since(0)
     , m_id()
     , m_nonce()
     , m_table()
@@ -128,9 +137,13 @@ lock_replicator :: lock_replicator(uint64_t key)
     , m_tg()
     , m_op()
     , m_backing()
+    , m_batch()
     , m_requests()
     , m_info_limiter()
+    , m_wound_tg()
+    , m_wound_at(0)
 {
+    m_requests.reserve(CONSUS_MAX_REPLICATION_FACTOR);
 }
 
 lock_replicator :: ~lock_replicator() throw ()
@@ -166,6 +179,7 @@ lock_replicator :: init(comm_id id, uint64_t nonce,
     m_op = op;
     m_backing = backing;
     m_init = true;
+    m_traced_since = tracer::tagged(nonce) ? po6::wallclock_time() : 0;
 
     if (s_debug_mode)
     {
@@ -177,6 +191,13 @@ lock_replicator :: init(comm_id id, uint64_t nonce,
     }
 }
 
+void
+lock_replicator :: join(const e::compat::shared_ptr<lock_batch>& batch)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_batch = batch;
+}
+
 void
 lock_replicator :: response(comm_id id, const transaction_group& tg,
                             const replica_set& rs, daemon* d)
@@ -198,27 +219,47 @@ lock_replicator :: response(comm_id id, const transaction_group& tg,
     }
 
     LOG_IF(INFO, s_debug_mode) << logid() << " response from=" << id << " tg=" << tg << " rs=" << rs;
+
+    // Karn's rule:  only a request sent exactly once gives a clean sample
+    if (stub->requests == 1)
+    {
+        d->observe_rtt(id, po6::monotonic_time() - stub->last_request_time);
+    }
+
+    stub->requests = 0;
     stub->tg = tg;
     stub->rs = rs;
     work_state_machine(d);
 }
 
 void
-lock_replicator :: abort(const transaction_group& tg, daemon* d)
+lock_replicator :: abort(const transaction_group& tg, uint64_t delay, daemon* d)
 {
-    drop(tg);
-    const size_t sz = BUSYBEE_HEADER_SIZE
-                    + pack_size(TXMAN_WOUND)
-                    + pack_size(tg);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_WOUND << tg;
+    drop(tg, d);
     po6::threads::mutex::hold hold(&m_mtx);
-    LOG_IF(INFO, s_debug_mode) << logid() << " sending wound message for " << transaction_group::log(tg);
-    d->send(m_id, msg);
+    const uint64_t now = po6::monotonic_time();
+
+    // every wound the lock's replicas send is for the current holder, so
+    // keep whichever deadline comes first
+    if (m_wound_at == 0 || m_wound_tg != tg || now + delay < m_wound_at)
+    {
+        m_wound_tg = tg;
+        m_wound_at = now + delay;
+    }
+
+    if (m_wound_at > now)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " deferring wound message for "
+                                   << transaction_group::log(tg) << " by " << delay << "ns";
+        d->m_pump_queue.schedule(m_state_key, m_wound_at);
+        return;
+    }
+
+    send_wound(d);
 }
 
 void
-lock_replicator :: drop(const transaction_group& tg)
+lock_replicator :: drop(const transaction_group& tg, daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
 
@@ -227,6 +268,12 @@ lock_replicator :: drop(const transaction_group& tg)
         m_finished = true;
         m_requests.clear();
         LOG_IF(INFO, s_debug_mode) << logid() << " dropping transaction";
+
+        if (m_batch.get())
+        {
+            m_batch->dropped(d);
+            m_batch.reset();
+        }
     }
 }
 
@@ -241,6 +288,11 @@ lock_replicator :: externally_work_state_machine(daemon* d)
         return;
     }
 
+    if (!m_finished && m_wound_at > 0 && m_wound_at <= po6::monotonic_time())
+    {
+        send_wound(d);
+    }
+
     work_state_machine(d);
 }
 
@@ -263,6 +315,9 @@ lock_replicator :: debug_dump()
         case LOCK_LOCK:
             ostr << "op=" << "lock\n";
             break;
+        case LOCK_LOCK_SHARED:
+            ostr << "op=" << "lock shared\n";
+            break;
         case LOCK_UNLOCK:
             ostr << "op=" << "unlock\n";
             break;
@@ -294,6 +349,8 @@ lock_replicator :: logid()
     {
         case LOCK_LOCK:
             return s + "-LL-REP";
+        case LOCK_LOCK_SHARED:
+            return s + "-LS-REP";
         case LOCK_UNLOCK:
             return s + "-LU-REP";
         default:
@@ -366,13 +423,13 @@ lock_replicator :: work_state_machine(daemon* d)
             groups.push_back(owner1->tg);
         }
 
-        if (owner1->last_request_time + d->resend_interval() < now &&
+        if (owner1->last_request_time + d->resend_interval(owner1->target) < now &&
             (owner1->tg != m_tg || !agree))
         {
             send_lock_request(owner1, now, d);
         }
 
-        if (owner2 && owner2->last_request_time + d->resend_interval() < now &&
+        if (owner2 && owner2->last_request_time + d->resend_interval(owner2->target) < now &&
             (owner2->tg != m_tg || !agree))
         {
             send_lock_request(owner2, now, d);
@@ -395,14 +452,31 @@ lock_replicator :: work_state_machine(daemon* d)
     if (complete >= quorum)
     {
         consus_returncode rc = short_lock ? CONSUS_LESS_DURABLE : CONSUS_SUCCESS;
+
+        if (m_traced_since != 0)
+        {
+            d->m_tracer.span("lock_replicator", m_tg, m_nonce, m_traced_since, po6::wallclock_time());
+            m_traced_since = 0;
+        }
+
         m_finished = true;
-        const size_t sz = BUSYBEE_HEADER_SIZE
-                        + pack_size(KVS_LOCK_OP_RESP)
-                        + sizeof(uint64_t)
-                        + pack_size(rc);
-        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_LOCK_OP_RESP << m_nonce << rc;
-        d->send(m_id, msg);
+
+        if (m_batch.get())
+        {
+            m_batch->respond(m_nonce, rc, d);
+            m_batch.reset();
+        }
+        else
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(KVS_LOCK_OP_RESP)
+                            + sizeof(uint64_t)
+                            + pack_size(rc)
+                            + sizeof(uint8_t);
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_LOCK_OP_RESP << m_nonce << rc << d->load();
+            d->send(m_id, msg);
+        }
 
         if (s_debug_mode)
         {
@@ -444,7 +518,7 @@ lock_replicator :: work_state_machine(daemon* d)
                             + pack_size(mode)
                             + pack_size(m_table)
                             + pack_size(m_key);
-            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
             msg->pack_at(BUSYBEE_HEADER_SIZE)
                 << TXMAN_HOLD_LOCK << m_nonce << mode << m_table << m_key;
             m_info_limiter.transmit_now(mode, now);
@@ -461,16 +535,32 @@ lock_replicator :: send_lock_request(lock_stub* stub, uint64_t now, daemon* d)
         LOG(INFO) << logid() << " sending target=" << stub->target;
     }
 
+    const table_ref tr(d->m_table_ids.intern(m_table));
     const size_t sz = BUSYBEE_HEADER_SIZE
                     + pack_size(KVS_RAW_LK)
                     + sizeof(uint64_t)
-                    + pack_size(m_table)
+                    + pack_size(tr)
                     + pack_size(m_key)
                     + pack_size(m_tg)
                     + pack_size(m_op);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_RAW_LK << m_state_key << m_table << m_key << m_tg << m_op;
+        << KVS_RAW_LK << m_state_key << tr << m_key << m_tg << m_op;
     d->send(stub->target, msg);
     stub->last_request_time = now;
+    ++stub->requests;
+}
+
+void
+lock_replicator :: send_wound(daemon* d)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(TXMAN_WOUND)
+                    + pack_size(m_wound_tg);
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_WOUND << m_wound_tg;
+    LOG_IF(INFO, s_debug_mode) << logid() << " sending wound message for " << transaction_group::log(m_wound_tg);
+    d->send(m_id, msg);
+    m_wound_tg = transaction_group();
+    m_wound_at = 0;
 }
@@ -32,20 +32,23 @@
 #include <po6/threads/mutex.h>
 
 // e
+#include <e/compat.h>
 #include <e/slice.h>
 
 // consus
 #include <consus.h>
 #include "namespace.h"
 #include "common/ids.h"
+#include "common/pooled.h"
 #include "common/lock.h"
 #include "common/transaction_group.h"
 #include "common/transmit_limiter.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
+class lock_batch;
 
-class lock_replicator
+class lock_replicator : public pooled<lock_replicator, ALLOC_REPLICATORS>
 {
     public:
         lock_replicator(uint64_t key);
@@ -60,10 +63,14 @@ class lock_replicator
                   const e::slice& table, const e::slice& key,
                   const transaction_group& tg, lock_op op,
                   std::auto_ptr<e::buffer> backing);
+        // answer through batch rather than with a KVS_LOCK_OP_RESP
+        void join(const e::compat::shared_ptr<lock_batch>& batch);
         void response(comm_id id, const transaction_group& tg,
                       const replica_set& rs, daemon* d);
-        void abort(const transaction_group& tg, daemon* d);
-        void drop(const transaction_group& tg);
+        // wound tg, the holder in our way, once we have waited delay more
+        // nanoseconds without getting the lock
+        void abort(const transaction_group& tg, uint64_t delay, daemon* d);
+        void drop(const transaction_group& tg, daemon* d);
         void externally_work_state_machine(daemon* d);
         std::string debug_dump();
 
@@ -77,12 +84,15 @@ class lock_replicator
         void ensure_stub_exists(comm_id id) { get_or_create_stub(id); }
         void work_state_machine(daemon* d);
         void send_lock_request(lock_stub* stub, uint64_t now, daemon* d);
+        void send_wound(daemon* d);
 
     private:
         const uint64_t m_state_key;
         po6::threads::mutex m_mtx;
         bool m_init;
         bool m_finished;
+        // when init saw a nonce tagged for tracing; else 0
+        uint64_t m_traced_since;
         comm_id m_id;
         uint64_t m_nonce;
         e::slice m_table;
@@ -90,8 +100,12 @@ class lock_replicator
         transaction_group m_tg;
         lock_op m_op;
         std::auto_ptr<e::buffer> m_backing;
+        e::compat::shared_ptr<lock_batch> m_batch;
         std::vector<lock_stub> m_requests;
         transmit_limiter<transaction_group, daemon> m_info_limiter;
+        // a deferred wound, sent at m_wound_at unless the lock comes first
+        transaction_group m_wound_tg;
+        uint64_t m_wound_at;
 };
 
 END_CONSUS_NAMESPACE
@@ -25,6 +25,12 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// STL
+#include <algorithm>
+
+// po6
+#include <po6/time.h>
+
 // e
 #include <e/strescape.h>
 
@@ -36,6 +42,7 @@
 
 // consus
 #include "common/network_msgtype.h"
+#include "common/probes.h"
 #include "kvs/configuration.h"
 #include "kvs/daemon.h"
 #include "kvs/lock_state.h"
@@ -44,22 +51,156 @@ using consus::lock_state;
 
 extern bool s_debug_mode;
 
-struct lock_state::request
+lock_state :: request :: request()
+    : id()
+    , nonce()
+    , tg()
+    , shared(false)
+    , granted(false)
+    , upgrade(false)
+    , enqueued(0)
+    , granted_at(0)
+{
+}
+
+lock_state :: request :: request(comm_id i, uint64_t n, const transaction_group& x, bool s)
+    : id(i)
+    , nonce(n)
+    , tg(x)
+    , shared(s)
+    , granted(false)
+    , upgrade(false)
+    , enqueued(po6::monotonic_time())
+    , granted_at(0)
+{
+}
+
+lock_state :: request :: ~request() throw ()
+{
+}
+
+lock_state :: queue :: queue()
+    : m_inline()
+    , m_overflow()
+    , m_sz(0)
+{
+}
+
+lock_state :: queue :: queue(const queue& other)
+    : m_inline()
+    , m_overflow(other.m_overflow)
+    , m_sz(other.m_sz)
+{
+    for (size_t i = 0; i < LOCK_STATE_INLINE_REQUESTS; ++i)
+    {
+        m_inline[i] = other.m_inline[i];
+    }
+}
+
+lock_state :: queue :: ~queue() throw ()
+{
+}
+
+lock_state::request&
+lock_state :: queue :: operator [] (size_t idx)
 {
-    request() : id(), nonce(), tg() {}
-    request(comm_id i, uint64_t n, const transaction_group& x)
-        : id(i), nonce(n), tg(x) {}
-    ~request() throw () {}
-    comm_id id;
-    uint64_t nonce;
-    transaction_group tg;
-};
+    assert(idx < m_sz);
+    return idx < LOCK_STATE_INLINE_REQUESTS
+         ? m_inline[idx]
+         : m_overflow[idx - LOCK_STATE_INLINE_REQUESTS];
+}
+
+const lock_state::request&
+lock_state :: queue :: operator [] (size_t idx) const
+{
+    assert(idx < m_sz);
+    return idx < LOCK_STATE_INLINE_REQUESTS
+         ? m_inline[idx]
+         : m_overflow[idx - LOCK_STATE_INLINE_REQUESTS];
+}
+
+void
+lock_state :: queue :: push_back(const request& r)
+{
+    if (m_sz < LOCK_STATE_INLINE_REQUESTS)
+    {
+        m_inline[m_sz] = r;
+    }
+    else
+    {
+        m_overflow.push_back(r);
+    }
+
+    ++m_sz;
+}
+
+void
+lock_state :: queue :: insert(size_t idx, const request& r)
+{
+    assert(idx <= m_sz);
+    push_back(r);
+
+    for (size_t i = m_sz - 1; i > idx; --i)
+    {
+        std::swap((*this)[i], (*this)[i - 1]);
+    }
+}
+
+void
+lock_state :: queue :: erase(size_t idx)
+{
+    assert(idx < m_sz);
+
+    for (size_t i = idx; i + 1 < m_sz; ++i)
+    {
+        (*this)[i] = (*this)[i + 1];
+    }
+
+    if (m_sz > LOCK_STATE_INLINE_REQUESTS)
+    {
+        m_overflow.pop_back();
+    }
+    else
+    {
+        m_inline[m_sz - 1] = request();
+    }
+
+    --m_sz;
+}
+
+void
+lock_state :: queue :: swap(queue* other)
+{
+    for (size_t i = 0; i < LOCK_STATE_INLINE_REQUESTS; ++i)
+    {
+        std::swap(m_inline[i], other->m_inline[i]);
+    }
+
+    m_overflow.swap(other->m_overflow);
+    std::swap(m_sz, other->m_sz);
+}
+
+lock_state::queue&
+lock_state :: queue :: operator = (const queue& rhs)
+{
+    if (this != &rhs)
+    {
+        for (size_t i = 0; i < LOCK_STATE_INLINE_REQUESTS; ++i)
+        {
+            m_inline[i] = rhs.m_inline[i];
+        }
+
+        m_overflow = rhs.m_overflow;
+        m_sz = rhs.m_sz;
+    }
+
+    return *this;
+}
 
 lock_state :: lock_state(const table_key_pair& tk)
     : m_state_key(tk)
     , m_mtx()
     , m_init(false)
-    , m_holder()
     , m_reqs()
 {
 }
@@ -78,13 +219,13 @@ bool
 lock_state :: finished()
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    return !m_init || (m_reqs.empty() && m_holder == transaction_group());
+    return !m_init || m_reqs.empty();
 }
 
 void
 lock_state :: enqueue_lock(comm_id id, uint64_t nonce,
                            const transaction_group& tg,
-                           daemon* d)
+                           bool shared, daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     invariant_check();
@@ -94,15 +235,21 @@ lock_state :: enqueue_lock(comm_id id, uint64_t nonce,
         return;
     }
 
+    CONSUS_PROBE4(lock_enqueue, tg.txid.group.get(), tg.txid.start,
+                  tg.txid.number, uint64_t(shared));
+
     if (s_debug_mode)
     {
         LOG(INFO) << logid() << " lock(\""
                   << e::strescape(m_state_key.table) << "\", \""
                   << e::strescape(m_state_key.key) << "\") nonce=" << nonce
-                  << " id=" << id;
+                  << " id=" << id << (shared ? " shared" : " exclusive");
     }
 
-    if (m_holder == tg)
+    queue next(m_reqs);
+    size_t idx = find_request(next, tg);
+
+    if (idx < next.size() && next[idx].granted && (shared || !next[idx].shared))
     {
         LOG_IF(INFO, s_debug_mode) << logid() << " lock already held; nonce=" << nonce << " id=" << id;
         send_response(id, nonce, tg, d);
@@ -110,76 +257,122 @@ lock_state :: enqueue_lock(comm_id id, uint64_t nonce,
         return;
     }
 
-    bool found = false;
-
-    // scan the enqueued transactions to see if this is already enqueued
-    for (std::list<request>::iterator it = m_reqs.begin();
-            it != m_reqs.end(); ++it)
+    if (idx < next.size() && next[idx].granted && !next[idx].upgrade)
+    {
+        // a shared holder wants exclusive access; it keeps its shared hold
+        // and becomes the exclusive holder once every other reader leaves
+        LOG_IF(INFO, s_debug_mode) << logid() << " upgrading "
+            << transaction_group::log(tg) << "; nonce=" << nonce << " id=" << id;
+        next[idx].upgrade = true;
+        next[idx].id = id;
+        next[idx].nonce = nonce;
+    }
+    else if (idx < next.size())
     {
-        // we found this transaction group vying for the lock
-        if (it->tg == tg)
+        request* r = &next[idx];
+
+        // if the previous requester has a higher nonce than the current
+        // requester, tell prev to silently stop replicating
+        if (r->nonce > nonce)
         {
-            found = true;
+            LOG_IF(INFO, s_debug_mode) << logid() << " drop-wounding "
+                << transaction_group::log(tg) << "; nonce=" << r->nonce << " id=" << r->id;
+            send_wound_drop(r->id, r->nonce, r->tg, d);
+            r->id = id;
+            r->nonce = nonce;
+        }
+        // else, tell current to silently stop replicating
+        else
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " drop-wounding "
+                                       << transaction_group::log(tg)
+                                       << "; nonce=" << nonce << " id=" << id;
+            send_wound_drop(id, nonce, tg, d);
+        }
 
-            // if the previous requester has a higher nonce than the current
-            // requester, tell prev to silently stop replicating
-            if (it->nonce > nonce)
-            {
-                LOG_IF(INFO, s_debug_mode) << logid() << " drop-wounding "
-                    << transaction_group::log(tg) << "; nonce=" << it->nonce << " id=" << it->id;
-                send_wound_drop(it->id, it->nonce, it->tg, d);
-                it->id = id;
-                it->nonce = nonce;
-            }
-            // else, tell current to silently stop replicating
-            else
-            {
-                LOG_IF(INFO, s_debug_mode) << logid() << " drop-wounding "
-                                           << transaction_group::log(tg)
-                                           << "; nonce=" << nonce << " id=" << id;
-                send_wound_drop(id, nonce, tg, d);
-            }
+        if (!r->granted)
+        {
+            r->shared = r->shared && shared;
         }
     }
+    else
+    {
+        if (!next.empty())
+        {
+            d->m_locks.contention()->queued(m_state_key, next.size());
+        }
 
-    if (!found)
+        ordered_enqueue(&next, request(id, nonce, tg, shared));
+    }
+
+    grant(&next);
+
+    if (!commit(&next, tg, d))
     {
-        ordered_enqueue(request(id, nonce, tg));
+        LOG(ERROR) << "failed lock(\""
+                   << e::strescape(m_state_key.table)
+                   << "\", \""
+                   << e::strescape(m_state_key.key)
+                   << "\") nonce=" << nonce;
+        invariant_check();
+        return;
     }
 
-    // if no one holds the lock, we take the lock
-    if (m_holder == transaction_group())
+    idx = find_request(m_reqs, tg);
+    assert(idx < m_reqs.size());
+    const request& r(m_reqs[idx]);
+
+    if (r.granted && !r.upgrade)
     {
-        assert(m_reqs.size() == 1);
-        consus_returncode rc = d->m_data->write_lock(m_state_key.table,
-                                                     m_state_key.key, tg);
+        send_response(id, nonce, tg, d);
+        invariant_check();
+        return;
+    }
 
-        if (rc != CONSUS_SUCCESS)
+    // wound-wait:  abort every younger holder this request is waiting upon;
+    // an upgrade still holds its shared lock, but waits like an exclusive
+    // request on every other reader, so younger readers are wounded too
+    const bool wants_shared = r.shared && !r.upgrade;
+    transaction_group blocker;
+
+    for (size_t i = 0; i < m_reqs.size() && m_reqs[i].granted; ++i)
+    {
+        const request& h(m_reqs[i]);
+
+        if (h.tg == tg || (wants_shared && h.shared && !h.upgrade))
         {
-            LOG(ERROR) << "failed lock(\""
-                       << e::strescape(m_state_key.table)
-                       << "\", \""
-                       << e::strescape(m_state_key.key)
-                       << "\") nonce=" << nonce;
-            assert(m_reqs.front().tg == tg);
-            m_reqs.pop_front();
-            invariant_check();
-            return;
+            continue;
         }
 
-        m_holder = tg;
+        if (blocker == transaction_group())
+        {
+            blocker = h.tg;
+        }
+
+        if (tg.txid.preempts(h.tg.txid))
+        {
+            send_wound_abort(id, nonce, h, d);
+            LOG_IF(INFO, s_debug_mode) << logid()
+                                       << transaction_group::log(tg)
+                                       << " abort-wounds "
+                                       << transaction_group::log(h.tg);
+        }
     }
 
-    if (tg.txid.preempts(m_holder.txid))
+    // a reader queued behind an older writer waits on holders it could
+    // share with; name one of them, never the requester itself, which the
+    // response would report as a grant
+    for (size_t i = 0; blocker == transaction_group() &&
+                       i < m_reqs.size() && m_reqs[i].granted; ++i)
     {
-        send_wound_abort(id, nonce, m_holder, d);
-        LOG_IF(INFO, s_debug_mode) << logid()
-                                   << transaction_group::log(tg)
-                                   << " abort-wounds "
-                                   << transaction_group::log(m_holder);
+        if (m_reqs[i].tg != tg)
+        {
+            blocker = m_reqs[i].tg;
+        }
     }
 
-    send_response(id, nonce, m_holder, d);
+    assert(blocker != transaction_group());
+    send_response(id, nonce, blocker, d);
     invariant_check();
 }
 
@@ -204,25 +397,25 @@ lock_state :: unlock(comm_id id, uint64_t nonce,
                   << " id=" << id;
     }
 
-    if (m_holder == tg)
+    queue next(m_reqs);
+    const size_t idx = find_request(next, tg);
+
+    if (idx < next.size())
     {
-        assert(!m_reqs.empty());
-        assert(m_reqs.front().tg == tg);
-        request next;
+        const request& r(next[idx]);
+        const uint64_t granted_at = r.granted ? r.granted_at : 0;
 
-        if (m_reqs.size() > 1)
+        if (!r.granted)
         {
-            std::list<request>::iterator it = m_reqs.begin();
-            ++it;
-            assert(it != m_reqs.end());
-            next = *it;
+            LOG_IF(INFO, s_debug_mode) << logid() << " drop-wounding "
+                << transaction_group::log(tg) << "; nonce=" << r.nonce << " id=" << r.id;
+            send_wound_drop(r.id, r.nonce, r.tg, d);
         }
 
-        consus_returncode rc = d->m_data->write_lock(m_state_key.table,
-                                                     m_state_key.key,
-                                                     next.tg);
+        next.erase(idx);
+        grant(&next);
 
-        if (rc != CONSUS_SUCCESS)
+        if (!commit(&next, transaction_group(), d))
         {
             LOG(ERROR) << logid() << " failed unlock(\""
                        << e::strescape(m_state_key.table)
@@ -233,29 +426,9 @@ lock_state :: unlock(comm_id id, uint64_t nonce,
             return;
         }
 
-        m_reqs.pop_front();
-        m_holder = next.tg;
-
-        if (next.tg != transaction_group())
-        {
-            send_response(next.id, next.nonce, next.tg, d);
-        }
-    }
-    else
-    {
-        for (std::list<request>::iterator it = m_reqs.begin(); it != m_reqs.end(); )
+        if (granted_at > 0)
         {
-            if (it->tg == tg)
-            {
-                it = m_reqs.erase(it);
-                LOG_IF(INFO, s_debug_mode) << logid() << " drop-wounding "
-                    << transaction_group::log(tg) << "; nonce=" << it->nonce << " id=" << it->id;
-                send_wound_drop(it->id, it->nonce, it->tg, d);
-            }
-            else
-            {
-                ++it;
-            }
+            d->m_locks.contention()->held(m_state_key, po6::monotonic_time() - granted_at);
         }
     }
 
@@ -265,20 +438,34 @@ lock_state :: unlock(comm_id id, uint64_t nonce,
     invariant_check();
 }
 
+void
+lock_state :: recover(const std::vector<transaction_group>& holders, bool shared)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    invariant_check();
+
+    if (!m_init)
+    {
+        restore(holders, shared);
+    }
+
+    invariant_check();
+}
+
 std::string
 lock_state :: debug_dump()
 {
     po6::threads::mutex::hold hold(&m_mtx);
     std::ostringstream ostr;
-    ostr << "lock holder=" << transaction_group::log(m_holder) << "\n";
-    size_t i = 0;
 
-    for (std::list<request>::iterator it = m_reqs.begin();
-            it != m_reqs.end(); ++it, ++i)
+    for (size_t i = 0; i < m_reqs.size(); ++i)
     {
-        ostr << "lock queue[" << i << "]"
-             << " tx=" << transaction_group::log(it->tg)
-             << " id=" << it->id << " nonce=" << it->nonce << "\n";
+        const request& r(m_reqs[i]);
+        ostr << "lock " << (r.granted ? "holder" : "queue") << "[" << i << "]"
+             << " tx=" << transaction_group::log(r.tg)
+             << " mode=" << (r.shared ? "shared" : "exclusive")
+             << (r.upgrade ? " upgrading" : "")
+             << " id=" << r.id << " nonce=" << r.nonce << "\n";
     }
 
     return ostr.str();
@@ -293,25 +480,44 @@ lock_state :: logid()
 void
 lock_state :: invariant_check()
 {
-    if (!m_init || m_reqs.empty())
+    if (!m_init)
     {
-        assert(m_holder == transaction_group());
         assert(m_reqs.empty());
+        return;
     }
-    else
+
+    // holders form a prefix of the queue and are either one exclusive
+    // holder or any number of shared holders
+    assert(m_reqs.empty() || m_reqs[0].granted);
+    size_t granted = 0;
+    bool exclusive = false;
+    bool waiting = false;
+
+    for (size_t i = 0; i < m_reqs.size(); ++i)
     {
-        assert(m_holder == m_reqs.front().tg);
+        if (m_reqs[i].granted)
+        {
+            assert(!waiting);
+            ++granted;
+            exclusive = exclusive || !m_reqs[i].shared;
+        }
+        else
+        {
+            waiting = true;
+            // waiters stay in wound-wait priority order
+            assert(!m_reqs[i - 1].granted ||
+                   !m_reqs[i].tg.txid.preempts(m_reqs[i - 1].tg.txid));
+        }
 
-        for (std::list<request>::iterator it1 = m_reqs.begin();
-                it1 != m_reqs.end(); ++it1)
+        assert(!m_reqs[i].upgrade || (m_reqs[i].granted && m_reqs[i].shared));
+
+        for (size_t j = 0; j < m_reqs.size(); ++j)
         {
-            for (std::list<request>::iterator it2 = m_reqs.begin();
-                    it2 != m_reqs.end(); ++it2)
-            {
-                assert(it1 == it2 || it1->tg != it2->tg);
-            }
+            assert(i == j || m_reqs[i].tg != m_reqs[j].tg);
         }
     }
+
+    assert(!exclusive || granted == 1);
 }
 
 bool
@@ -324,9 +530,11 @@ lock_state :: ensure_initialized(daemon* d)
         return true;
     }
 
-    transaction_group tg;
+    std::vector<transaction_group> holders;
+    bool shared = false;
     consus_returncode rc = d->m_data->read_lock(m_state_key.table,
-                                                m_state_key.key, &tg);
+                                                m_state_key.key,
+                                                &holders, &shared);
 
     if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
     {
@@ -338,41 +546,226 @@ lock_state :: ensure_initialized(daemon* d)
         return false;
     }
 
-    if (tg != transaction_group())
+    restore(holders, shared);
+    invariant_check();
+    return true;
+}
+
+void
+lock_state :: restore(const std::vector<transaction_group>& holders, bool shared)
+{
+    for (size_t i = 0; i < holders.size(); ++i)
     {
-        LOG_IF(INFO, s_debug_mode) << logid() << " restoring " << transaction_group::log(tg) << " as durable lock holder";
-        m_reqs.push_back(request(comm_id(), 0, tg));
-        m_holder = tg;
+        LOG_IF(INFO, s_debug_mode) << logid() << " restoring " << transaction_group::log(holders[i]) << " as durable lock holder";
+        request r(comm_id(), 0, holders[i], shared);
+        r.granted = true;
+        r.granted_at = r.enqueued;
+        m_reqs.push_back(r);
     }
 
     m_init = true;
-    invariant_check();
-    return true;
+}
+
+size_t
+lock_state :: find_request(const queue& reqs, const transaction_group& tg)
+{
+    size_t idx = 0;
+
+    while (idx < reqs.size() && reqs[idx].tg != tg)
+    {
+        ++idx;
+    }
+
+    return idx;
 }
 
 void
-lock_state :: ordered_enqueue(const request& r)
+lock_state :: ordered_enqueue(queue* reqs, const request& r)
+{
+    size_t lower = 0;
+
+    while (lower < reqs->size() && (*reqs)[lower].granted)
+    {
+        ++lower;
+    }
+
+    // the waiters are sorted, so binary search for the first one r does not
+    // yield to
+    size_t upper = reqs->size();
+
+    while (lower < upper)
+    {
+        const size_t mid = lower + (upper - lower) / 2;
+
+        if ((*reqs)[mid].tg.txid.preempts(r.tg.txid))
+        {
+            lower = mid + 1;
+        }
+        else
+        {
+            upper = mid;
+        }
+    }
+
+    reqs->insert(lower, r);
+}
+
+void
+lock_state :: grant(queue* reqs)
+{
+    size_t idx = 0;
+
+    if (reqs->empty())
+    {
+        return;
+    }
+
+    if (!(*reqs)[0].granted)
+    {
+        (*reqs)[0].granted = true;
+
+        if (!(*reqs)[0].shared)
+        {
+            return;
+        }
+
+        ++idx;
+    }
+    else
+    {
+        size_t holders = 0;
+        request* upgrading = NULL;
+
+        for (; idx < reqs->size() && (*reqs)[idx].granted; ++idx)
+        {
+            ++holders;
+
+            if ((*reqs)[idx].upgrade)
+            {
+                upgrading = &(*reqs)[idx];
+            }
+        }
+
+        // a pending upgrade admits no new readers, lest it starve
+        if (upgrading)
+        {
+            if (holders == 1)
+            {
+                upgrading->shared = false;
+                upgrading->upgrade = false;
+            }
+
+            return;
+        }
+
+        if (!(*reqs)[0].shared)
+        {
+            return;
+        }
+    }
+
+    // readers at the head of the queue join the shared holders
+    for (; idx < reqs->size() && (*reqs)[idx].shared; ++idx)
+    {
+        (*reqs)[idx].granted = true;
+    }
+}
+
+bool
+lock_state :: commit(queue* next,
+                     const transaction_group& requester,
+                     daemon* d)
 {
-    std::list<request>::iterator it = m_reqs.begin();
+    std::vector<transaction_group> old_holders;
+    std::vector<transaction_group> new_holders;
+    bool old_shared = false;
+    bool new_shared = false;
+    holders(m_reqs, &old_holders, &old_shared);
+    holders(*next, &new_holders, &new_shared);
+
+    // only a change in who holds the lock needs to reach the disk
+    if (old_holders != new_holders || old_shared != new_shared)
+    {
+        consus_returncode rc = d->m_data->write_lock(m_state_key.table,
+                                                     m_state_key.key,
+                                                     new_holders, new_shared);
 
-    if (it != m_reqs.end())
+        if (rc != CONSUS_SUCCESS)
+        {
+            return false;
+        }
+    }
+
+    // tell every waiter that just became a holder
+    for (size_t i = 0; i < next->size() && (*next)[i].granted; ++i)
     {
-        ++it;
+        const request& r((*next)[i]);
+
+        if (r.upgrade || r.tg == requester)
+        {
+            continue;
+        }
+
+        const size_t prev = find_request(m_reqs, r.tg);
+
+        if (prev >= m_reqs.size() || !m_reqs[prev].granted ||
+            m_reqs[prev].shared != r.shared)
+        {
+            send_response(r.id, r.nonce, r.tg, d);
+        }
     }
 
-    while (it != m_reqs.end() && it->tg.txid.preempts(r.tg.txid))
+    m_reqs.swap(next);
+    const uint64_t now = po6::monotonic_time();
+
+    for (size_t i = 0; i < m_reqs.size() && m_reqs[i].granted; ++i)
     {
-        ++it;
+        request* r = &m_reqs[i];
+
+        if (r->granted_at > 0)
+        {
+            continue;
+        }
+
+        r->granted_at = now;
+        CONSUS_PROBE5(lock_grant, r->tg.txid.group.get(), r->tg.txid.start,
+                      r->tg.txid.number, uint64_t(r->shared), now - r->enqueued);
+
+        if (r->tg != requester)
+        {
+            d->m_locks.contention()->waited(m_state_key, now - r->enqueued);
+            d->m_tables.record(m_state_key.table, table_stats::LOCK_WAITS, 1);
+            d->m_tables.record(m_state_key.table, table_stats::LOCK_WAIT_NANOS, now - r->enqueued);
+        }
     }
 
-    m_reqs.insert(it, r);
+    return true;
+}
+
+void
+lock_state :: holders(const queue& reqs,
+                      std::vector<transaction_group>* tgs,
+                      bool* shared)
+{
+    tgs->clear();
+    *shared = false;
+
+    for (size_t i = 0; i < reqs.size() && reqs[i].granted; ++i)
+    {
+        tgs->push_back(reqs[i].tg);
+        *shared = reqs[i].shared;
+    }
 }
 
 void
 lock_state :: send_wound(comm_id id, uint64_t nonce, uint8_t action,
-                         const transaction_group& tg,
+                         const transaction_group& tg, uint64_t delay,
                          daemon* d)
 {
+    d->m_locks.contention()->wounded(m_state_key);
+    CONSUS_PROBE5(lock_wound, tg.txid.group.get(), tg.txid.start,
+                  tg.txid.number, uint64_t(action), delay);
+
     if (id == comm_id())
     {
         LOG_IF(INFO, s_debug_mode) << logid() << " dropping wound to null id";
@@ -383,10 +776,11 @@ lock_state :: send_wound(comm_id id, uint64_t nonce, uint8_t action,
                     + pack_size(KVS_WOUND_XACT)
                     + sizeof(uint64_t)
                     + sizeof(uint8_t)
-                    + pack_size(tg);
+                    + pack_size(tg)
+                    + sizeof(uint64_t);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_WOUND_XACT << nonce << action << tg;
+        << KVS_WOUND_XACT << nonce << action << tg << delay;
     d->send(id, msg);
 }
 
@@ -395,15 +789,30 @@ lock_state :: send_wound_drop(comm_id id, uint64_t nonce,
                               const transaction_group& tg,
                               daemon* d)
 {
-    send_wound(id, nonce, WOUND_XACT_DROP_REQ, tg, d);
+    send_wound(id, nonce, WOUND_XACT_DROP_REQ, tg, 0, d);
 }
 
 void
 lock_state :: send_wound_abort(comm_id id, uint64_t nonce,
-                               const transaction_group& tg,
+                               const request& h,
                                daemon* d)
 {
-    send_wound(id, nonce, WOUND_XACT_ABORT, tg, d);
+    // A holder that is about to release would rather finish than be
+    // aborted and retried, so let the waiter hold the wound for as long as
+    // the holder is typically expected to still need, capped by the
+    // configured delay.
+    const uint64_t max_delay = d->m_locks.wound_delay();
+    uint64_t delay = 0;
+
+    if (max_delay > 0)
+    {
+        const uint64_t typical = d->m_locks.contention()->typical_hold();
+        const uint64_t now = po6::monotonic_time();
+        const uint64_t held = h.granted_at > 0 && h.granted_at < now ? now - h.granted_at : 0;
+        delay = typical > held ? std::min(max_delay, typical - held) : 0;
+    }
+
+    send_wound(id, nonce, WOUND_XACT_ABORT, h.tg, delay, d);
 }
 
 void
@@ -29,7 +29,7 @@
 #define consus_kvs_lock_state_h_
 
 // STL
-#include <list>
+#include <vector>
 
 // po6
 #include <po6/threads/mutex.h>
@@ -39,15 +39,21 @@
 
 // consus
 #include "namespace.h"
+#include "common/alloc_stats.h"
 #include "common/ids.h"
 #include "common/lock.h"
+#include "common/pooled.h"
 #include "common/transaction_group.h"
 #include "kvs/table_key_pair.h"
 
+// requests a lock_state holds without allocating; a key rarely has more
+// holders and waiters than this at once
+#define LOCK_STATE_INLINE_REQUESTS 4
+
 BEGIN_CONSUS_NAMESPACE
 class daemon;
 
-class lock_state
+class lock_state : public pooled<lock_state, ALLOC_LOCK_STATES>
 {
     public:
         lock_state(const table_key_pair& tk);
@@ -58,30 +64,91 @@ class lock_state
         bool finished();
 
     public:
+        // shared locks may be held by many transactions at once; a shared
+        // holder that asks for an exclusive lock is upgraded in place
         void enqueue_lock(comm_id id, uint64_t nonce,
                           const transaction_group& tg,
-                          daemon* d);
+                          bool shared, daemon* d);
         void unlock(comm_id id, uint64_t nonce,
                     const transaction_group& tg,
                     daemon* d);
+        // take the holders of the durable lock, read ahead of any request;
+        // a no-op once the lock has been initialized
+        void recover(const std::vector<transaction_group>& holders, bool shared);
         std::string debug_dump();
         std::string logid();
 
     private:
-        struct request;
+        struct request
+        {
+            request();
+            request(comm_id id, uint64_t nonce, const transaction_group& tg, bool shared);
+            ~request() throw ();
+
+            comm_id id;
+            uint64_t nonce;
+            transaction_group tg;
+            // the mode held (if granted) or wanted (if waiting)
+            bool shared;
+            bool granted;
+            // a shared holder waiting to become the exclusive holder
+            bool upgrade;
+            // monotonic times for contention accounting; granted_at is set
+            // once the grant is durable
+            uint64_t enqueued;
+            uint64_t granted_at;
+        };
+        // the first LOCK_STATE_INLINE_REQUESTS requests live inline, the
+        // rest in an overflow vector
+        class queue
+        {
+            public:
+                queue();
+                queue(const queue& other);
+                ~queue() throw ();
+
+            public:
+                size_t size() const { return m_sz; }
+                bool empty() const { return m_sz == 0; }
+                request& operator [] (size_t idx);
+                const request& operator [] (size_t idx) const;
+                void push_back(const request& r);
+                void insert(size_t idx, const request& r);
+                void erase(size_t idx);
+                void swap(queue* other);
+
+            public:
+                queue& operator = (const queue& rhs);
+
+            private:
+                request m_inline[LOCK_STATE_INLINE_REQUESTS];
+                std::vector<request> m_overflow;
+                size_t m_sz;
+        };
 
     private:
         void invariant_check();
         bool ensure_initialized(daemon* d);
-        void ordered_enqueue(const request& r);
+        void restore(const std::vector<transaction_group>& holders, bool shared);
+        // the index of tg's request, or reqs.size() if it has none
+        size_t find_request(const queue& reqs, const transaction_group& tg);
+        void ordered_enqueue(queue* reqs, const request& r);
+        void grant(queue* reqs);
+        bool commit(queue* next,
+                    const transaction_group& requester,
+                    daemon* d);
+        void holders(const queue& reqs,
+                     std::vector<transaction_group>* tgs,
+                     bool* shared);
         void send_wound(comm_id id, uint64_t nonce, uint8_t flags,
-                        const transaction_group& tg,
+                        const transaction_group& tg, uint64_t delay,
                         daemon* d);
         void send_wound_drop(comm_id id, uint64_t nonce,
                              const transaction_group& tg,
                              daemon* d);
+        // wound holder h, giving it until its expected release to finish
         void send_wound_abort(comm_id id, uint64_t nonce,
-                              const transaction_group& tg,
+                              const request& h,
                               daemon* d);
         void send_lock_held(const transaction_group& tg, daemon* d);
         void send_response(comm_id id, uint64_t nonce,
@@ -92,8 +159,8 @@ class lock_state
         const table_key_pair m_state_key;
         po6::threads::mutex m_mtx;
         bool m_init;
-        transaction_group m_holder;
-        std::list<request> m_reqs;
+        // holders first, then waiters in wound-wait priority order
+        queue m_reqs;
 
     private:
         lock_state(const lock_state&);
@@ -25,11 +25,17 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <stdlib.h>
+#include <string.h>
+
 // POSIX
 #include <signal.h>
 
 // C++
+#include <map>
 #include <string>
+#include <vector>
 
 // Google Log
 #include <glog/logging.h>
@@ -37,6 +43,7 @@
 // po6
 #include <po6/net/hostname.h>
 #include <po6/net/location.h>
+#include <po6/time.h>
 
 // e
 #include <e/popt.h>
@@ -55,6 +62,27 @@
 
 extern bool s_debug_mode;
 
+static std::vector<std::string>
+split_list(const char* list)
+{
+    std::vector<std::string> items;
+
+    for (const char* item = list; *item; )
+    {
+        const char* end = strchr(item, ',');
+        end = end ? end : item + strlen(item);
+
+        if (end > item)
+        {
+            items.push_back(std::string(item, end));
+        }
+
+        item = *end ? end + 1 : end;
+    }
+
+    return items;
+}
+
 int
 main(int argc, const char* argv[])
 {
@@ -65,10 +93,48 @@ main(int argc, const char* argv[])
     const char* listen_host = "auto";
     long listen_port = CONSUS_PORT_KVS;
     const char* data_center = "";
+    long capacity = 1;
+    const char* zone = "";
+    const char* rack = "";
     const char* pidfile = "";
     bool has_pidfile = false;
     long threads = 0;
+    long resend_ms = 1000;
     bool log_immediate = false;
+    bool rocksdb = false;
+    bool lazy_locks = false;
+    long migration_concurrency = 4;
+    long migration_mbps = 64;
+    long migration_batches = 64;
+    long version_retention = 3600;
+    long write_catchup = 30;
+    long anti_entropy = 10;
+    long row_cache_mb = 64;
+    long response_cache_mb = 16;
+    bool pin_threads = false;
+    long busy_poll_us = 0;
+    long coalesce_us = 0;
+    bool compact_messages = false;
+    const char* intra_dc_transport = "";
+    bool has_intra_dc_transport = false;
+    long metrics_port = 0;
+    const char* trace_file = "";
+    bool has_trace_file = false;
+    const char* bulk_load = "";
+    bool has_bulk_load = false;
+    long export_mbps = 32;
+    long compaction_latency_ms = 10;
+    bool compact_when_idle = false;
+    long lock_escalation = 0;
+    long wound_delay_ms = 0;
+    long data_shards = 0;
+    long warm_up_mb = 256;
+    const char* compress_tables = "";
+    long chunk_values_kb = 0;
+    const char* cold_dir = "";
+    bool has_cold_dir = false;
+    long cold_after = 30;
+    const char* expire_tables = "";
     sigset_t ss;
 
     if (sigfillset(&ss) < 0 ||
@@ -102,12 +168,114 @@ main(int argc, const char* argv[])
     ap.arg().name('c', "data-center")
             .description("data center containing this key value store")
             .metavar("name").as_string(&data_center);
+    ap.arg().long_name("capacity")
+            .description("relative share of the data center's partitions to own when first registering (default: 1)")
+            .metavar("N").as_long(&capacity);
+    ap.arg().long_name("zone")
+            .description("availability zone within the data center, for read locality")
+            .metavar("name").as_string(&zone);
+    ap.arg().long_name("rack")
+            .description("rack within the zone, for read locality")
+            .metavar("name").as_string(&rack);
     ap.arg().long_name("pidfile")
             .description("write the PID to a file (default: don't)")
             .metavar("file").as_string(&pidfile).set_true(&has_pidfile);
     ap.arg().name('t', "threads")
             .description("the number of threads which will handle network traffic")
             .metavar("N").as_long(&threads);
+    ap.arg().long_name("resend-interval")
+            .description("retransmission timeout for peers whose round-trip time is not yet known (default: 1000)")
+            .metavar("ms").as_long(&resend_ms);
+    ap.arg().long_name("rocksdb")
+            .description("store data in rocksdb instead of leveldb (requires a build configured with --enable-rocksdb)")
+            .set_true(&rocksdb);
+    ap.arg().long_name("lazy-locks")
+            .description("keep lock state in memory and persist it in batches, relying upon replication for durability between checkpoints")
+            .set_true(&lazy_locks);
+    ap.arg().long_name("migration-concurrency")
+            .description("partitions migrated concurrently, or 0 for no limit (default: 4)")
+            .metavar("N").as_long(&migration_concurrency);
+    ap.arg().long_name("migration-bandwidth")
+            .description("megabytes per second all migrations may pull, or 0 for no limit (default: 64)")
+            .metavar("MB").as_long(&migration_mbps);
+    ap.arg().long_name("migration-batches")
+            .description("batches per second all migrations may pull, or 0 for no limit (default: 64)")
+            .metavar("N").as_long(&migration_batches);
+    ap.arg().long_name("version-retention")
+            .description("seconds of history kept for reads in the past, or 0 to keep every version (default: 3600)")
+            .metavar("S").as_long(&version_retention);
+    ap.arg().long_name("write-catch-up")
+            .description("seconds an acknowledged write keeps retrying replicas that missed its quorum, or 0 to stop at the quorum (default: 30)")
+            .metavar("S").as_long(&write_catchup);
+    ap.arg().long_name("anti-entropy")
+            .description("seconds between comparing a range of data with another replica, or 0 to disable (default: 10)")
+            .metavar("S").as_long(&anti_entropy);
+    ap.arg().long_name("row-cache")
+            .description("megabytes of memory for caching the newest version of hot keys, or 0 to disable (default: 64)")
+            .metavar("MB").as_long(&row_cache_mb);
+    ap.arg().long_name("response-cache")
+            .description("megabytes of memory for replaying responses to retransmitted raw reads and writes, or 0 to disable (default: 16)")
+            .metavar("MB").as_long(&response_cache_mb);
+    ap.arg().long_name("pin-threads")
+            .description("pin each network thread to its own CPU, filling one socket before the next")
+            .set_true(&pin_threads);
+    ap.arg().long_name("busy-poll")
+            .description("spin on the network for up to this many microseconds before blocking, spinning less while idle, or 0 to always block (default: 0)")
+            .metavar("us").as_long(&busy_poll_us);
+    ap.arg().long_name("coalesce")
+            .description("hold small messages to a peer for up to this many microseconds to send them together, or 0 to disable (default: 0)")
+            .metavar("us").as_long(&coalesce_us);
+    ap.arg().long_name("compact-messages")
+            .description("send messages to other servers with their zero bytes suppressed; every server must run a version that understands them")
+            .set_true(&compact_messages);
+    ap.arg().long_name("intra-dc-transport")
+            .description("reach key-value stores in this data center over this transport instead of BusyBee (default: busybee)")
+            .metavar("name").as_string(&intra_dc_transport).set_true(&has_intra_dc_transport);
+    ap.arg().long_name("metrics-port")
+            .description("serve Prometheus metrics over HTTP on this port, or 0 to disable (default: 0)")
+            .metavar("port").as_long(&metrics_port);
+    ap.arg().long_name("trace-file")
+            .description("append spans of operations on behalf of traced transactions to this file in Chrome trace format")
+            .metavar("file").as_string(&trace_file).set_true(&has_trace_file);
+    ap.arg().long_name("bulk-load")
+            .description("install this daemon's share of a file made by consus-bulk-load, in the background")
+            .metavar("file").as_string(&bulk_load).set_true(&has_bulk_load);
+    ap.arg().long_name("export-bandwidth")
+            .description("megabytes per second an export requested with consus-export may write, or 0 for no limit (default: 32)")
+            .metavar("MB").as_long(&export_mbps);
+    ap.arg().long_name("compaction-latency")
+            .description("hold off compaction while reads and writes average more than this many milliseconds, or 0 to never hold off (default: 10)")
+            .metavar("ms").as_long(&compaction_latency_ms);
+    ap.arg().long_name("compact-when-idle")
+            .description("compact ahead of need while traffic is well below its recent peak")
+            .set_true(&compact_when_idle);
+    ap.arg().long_name("lock-escalation")
+            .description("lock a whole partition for a transaction that locks more than N of its keys, or 0 to disable (default: 0)")
+            .metavar("N").as_long(&lock_escalation);
+    ap.arg().long_name("wound-delay")
+            .description("wait up to this long for a lock holder to finish before wounding it, scaled by how long locks are typically held, or 0 to wound immediately (default: 0)")
+            .metavar("ms").as_long(&wound_delay_ms);
+    ap.arg().long_name("data-shards")
+            .description("split the store into this many, each holding a contiguous group of partitions, or 0 for a single store (default: 0)")
+            .metavar("N").as_long(&data_shards);
+    ap.arg().long_name("warm-up")
+            .description("megabytes of the partitions hottest at the last shutdown to read into the store's caches at startup, or 0 to disable; requires --data-shards (default: 256)")
+            .metavar("MB").as_long(&warm_up_mb);
+    ap.arg().long_name("compress-tables")
+            .description("compress the values of these tables with a dictionary trained on their first writes; only for a new data directory")
+            .metavar("table,table,...").as_string(&compress_tables);
+    ap.arg().long_name("chunk-values")
+            .description("store each value larger than this many kilobytes as chunks of that size beneath a manifest, or 0 to store every value whole; only for a new data directory (default: 0)")
+            .metavar("KB").as_long(&chunk_values_kb);
+    ap.arg().long_name("cold-dir")
+            .description("move keys untouched for --cold-after days into a store in this directory, meant for a cheaper disk; once given, a data directory always uses it")
+            .metavar("DIR").as_string(&cold_dir).set_true(&has_cold_dir);
+    ap.arg().long_name("cold-after")
+            .description("days a key must go unwritten before it moves to the cold store (default: 30)")
+            .metavar("D").as_long(&cold_after);
+    ap.arg().long_name("expire-tables")
+            .description("make each version of these tables unreadable this many seconds after it was written, and sweep it away in the background; every key-value store must be given the same list")
+            .metavar("table=S,table=S,...").as_string(&expire_tables);
     ap.arg().long_name("log-immediate")
             .description("immediately flush all log output")
             .set_true(&log_immediate).hidden();
@@ -188,6 +356,12 @@ main(int argc, const char* argv[])
         FLAGS_logbufsecs = 0;
     }
 
+    if (capacity <= 0)
+    {
+        std::cerr << "capacity must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     if (threads <= 0)
     {
         threads += sysconf(_SC_NPROCESSORS_ONLN);
@@ -204,6 +378,133 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (resend_ms <= 0)
+    {
+        std::cerr << "resend-interval must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (migration_concurrency < 0 || migration_mbps < 0 || migration_batches < 0)
+    {
+        std::cerr << "migration limits must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (version_retention < 0)
+    {
+        std::cerr << "version-retention must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (write_catchup < 0)
+    {
+        std::cerr << "write-catch-up must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (anti_entropy < 0)
+    {
+        std::cerr << "anti-entropy must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::map<std::string, uint64_t> expire_list;
+    std::vector<std::string> expire_items = split_list(expire_tables);
+
+    for (size_t i = 0; i < expire_items.size(); ++i)
+    {
+        const size_t eq = expire_items[i].rfind('=');
+        char* end = NULL;
+        const long seconds = eq == std::string::npos ? 0
+                           : strtol(expire_items[i].c_str() + eq + 1, &end, 10);
+
+        if (eq == std::string::npos || eq == 0 || !end || *end != '\0' || seconds <= 0)
+        {
+            std::cerr << "expire-tables takes table=seconds pairs with positive seconds" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        expire_list[expire_items[i].substr(0, eq)] = uint64_t(seconds) * PO6_SECONDS;
+    }
+
+    if (chunk_values_kb < 0)
+    {
+        std::cerr << "chunk-values must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (cold_after <= 0)
+    {
+        std::cerr << "cold-after must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (row_cache_mb < 0)
+    {
+        std::cerr << "row-cache must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (response_cache_mb < 0)
+    {
+        std::cerr << "response-cache must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (busy_poll_us < 0)
+    {
+        std::cerr << "busy-poll must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (coalesce_us < 0)
+    {
+        std::cerr << "coalesce must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (metrics_port < 0 || metrics_port >= (1 << 16))
+    {
+        std::cerr << "metrics-port is out of range" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (export_mbps < 0)
+    {
+        std::cerr << "export-bandwidth must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (compaction_latency_ms < 0)
+    {
+        std::cerr << "compaction-latency must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (lock_escalation < 0)
+    {
+        std::cerr << "lock-escalation must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (wound_delay_ms < 0)
+    {
+        std::cerr << "wound-delay must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (data_shards < 0 || data_shards > 256 || (data_shards & (data_shards - 1)) != 0)
+    {
+        std::cerr << "data-shards must be a power of two no greater than 256" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (warm_up_mb < 0)
+    {
+        std::cerr << "warm-up must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     try
     {
         consus::daemon d;
@@ -213,7 +514,38 @@ main(int argc, const char* argv[])
                      std::string(pidfile), has_pidfile,
                      listen, bind_to,
                      conn.isset(), conn.conn_str(),
-                     data_center, threads);
+                     data_center, capacity, zone, rack, threads,
+                     resend_ms * PO6_MILLIS,
+                     rocksdb,
+                     lazy_locks,
+                     migration_concurrency,
+                     uint64_t(migration_mbps) * 1024ULL * 1024ULL,
+                     migration_batches,
+                     uint64_t(version_retention) * PO6_SECONDS,
+                     uint64_t(write_catchup) * PO6_SECONDS,
+                     uint64_t(anti_entropy) * PO6_SECONDS,
+                     uint64_t(row_cache_mb) * 1024ULL * 1024ULL,
+                     uint64_t(response_cache_mb) * 1024ULL * 1024ULL,
+                     pin_threads,
+                     uint64_t(busy_poll_us) * 1000ULL,
+                     uint64_t(coalesce_us) * 1000ULL,
+                     compact_messages,
+                     has_intra_dc_transport ? intra_dc_transport : NULL,
+                     metrics_port,
+                     has_trace_file ? trace_file : NULL,
+                     has_bulk_load ? bulk_load : NULL,
+                     uint64_t(export_mbps) * 1024ULL * 1024ULL,
+                     uint64_t(compaction_latency_ms) * PO6_MILLIS,
+                     compact_when_idle,
+                     lock_escalation,
+                     uint64_t(wound_delay_ms) * 1000ULL * 1000ULL,
+                     data_shards,
+                     uint64_t(warm_up_mb) * 1024ULL * 1024ULL,
+                     uint64_t(chunk_values_kb) * 1024ULL,
+                     has_cold_dir ? cold_dir : NULL,
+                     uint64_t(cold_after) * 86400ULL * PO6_SECONDS,
+                     split_list(compress_tables),
+                     expire_list);
     }
     catch (std::exception& e)
     {
@@ -0,0 +1,177 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "kvs/migration_scheduler.h"
+
+using consus::migration_scheduler;
+
+migration_scheduler :: migration_scheduler()
+    : m_mtx()
+    , m_concurrency(0)
+    , m_bytes_per_second(0)
+    , m_batches_per_second(0)
+    , m_byte_tokens(0)
+    , m_batch_tokens(0)
+    , m_last_refill(0)
+    , m_active()
+    , m_waiting()
+    , m_traffic(new uint64_t[CONSUS_KVS_PARTITIONS])
+{
+    memset(m_traffic, 0, sizeof(uint64_t) * CONSUS_KVS_PARTITIONS);
+}
+
+migration_scheduler :: ~migration_scheduler() throw ()
+{
+    delete[] m_traffic;
+}
+
+void
+migration_scheduler :: set_limits(unsigned concurrency,
+                                  uint64_t bytes_per_second,
+                                  uint64_t batches_per_second)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_concurrency = concurrency;
+    m_bytes_per_second = bytes_per_second;
+    m_batches_per_second = batches_per_second;
+    m_byte_tokens = std::min(m_byte_tokens, double(bytes_per_second));
+    m_batch_tokens = std::min(m_batch_tokens, double(batches_per_second));
+}
+
+void
+migration_scheduler :: record_traffic(uint16_t index)
+{
+    e::atomic::increment_64_nobarrier(&m_traffic[index], 1);
+}
+
+uint64_t
+migration_scheduler :: traffic(uint16_t index)
+{
+    return e::atomic::increment_64_nobarrier(&m_traffic[index], 0);
+}
+
+bool
+migration_scheduler :: admit(partition_id p, uint64_t heat, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (std::find(m_active.begin(), m_active.end(), p) == m_active.end())
+    {
+        m_waiting[p] = heat;
+
+        // free slots go to the hottest waiting partitions, whoever asks
+        while ((m_concurrency == 0 || m_active.size() < m_concurrency) &&
+               !m_waiting.empty())
+        {
+            std::map<partition_id, uint64_t>::iterator hottest = m_waiting.begin();
+
+            for (std::map<partition_id, uint64_t>::iterator it = m_waiting.begin();
+                    it != m_waiting.end(); ++it)
+            {
+                if (it->second > hottest->second)
+                {
+                    hottest = it;
+                }
+            }
+
+            m_active.push_back(hottest->first);
+            m_waiting.erase(hottest);
+        }
+
+        if (std::find(m_active.begin(), m_active.end(), p) == m_active.end())
+        {
+            return false;
+        }
+    }
+
+    refill(now);
+
+    if ((m_bytes_per_second > 0 && m_byte_tokens <= 0) ||
+        (m_batches_per_second > 0 && m_batch_tokens < 1))
+    {
+        return false;
+    }
+
+    m_batch_tokens -= 1;
+    return true;
+}
+
+void
+migration_scheduler :: charge(uint64_t bytes)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    // the budget may go negative; the next pulls wait until it recovers
+    m_byte_tokens -= bytes;
+}
+
+void
+migration_scheduler :: release(partition_id p)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_active.erase(std::remove(m_active.begin(), m_active.end(), p), m_active.end());
+    m_waiting.erase(p);
+}
+
+std::string
+migration_scheduler :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "migration scheduler concurrency=" << m_concurrency
+         << " bytes/s=" << m_bytes_per_second
+         << " batches/s=" << m_batches_per_second
+         << " active=" << m_active.size()
+         << " waiting=" << m_waiting.size();
+    return ostr.str();
+}
+
+void
+migration_scheduler :: refill(uint64_t now)
+{
+    const double elapsed = double(now - std::min(now, m_last_refill)) / PO6_SECONDS;
+    m_last_refill = now;
+    // buckets hold at most one second of budget, so idle time cannot be
+    // saved up into a burst
+    m_byte_tokens = std::min(m_byte_tokens + elapsed * m_bytes_per_second,
+                             double(m_bytes_per_second));
+    m_batch_tokens = std::min(m_batch_tokens + elapsed * m_batches_per_second,
+                              double(m_batches_per_second));
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_migration_scheduler_h_
+#define consus_kvs_migration_scheduler_h_
+
+// STL
+#include <map>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/constants.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Decides which migrators may pull their next batch.  At most "concurrency"
+// partitions transfer at once, the hottest waiting partition takes the next
+// free slot, and all pulls share one budget of bytes and batches per second.
+class migration_scheduler
+{
+    public:
+        migration_scheduler();
+        ~migration_scheduler() throw ();
+
+    public:
+        void set_limits(unsigned concurrency,
+                        uint64_t bytes_per_second,
+                        uint64_t batches_per_second);
+        // traffic this daemon served, by hash slot; sources report it to
+        // destinations so the hottest partitions move first
+        void record_traffic(uint16_t index);
+        uint64_t traffic(uint16_t index);
+        // true if partition p may send a pull right now; heat is the
+        // traffic its source reported
+        bool admit(partition_id p, uint64_t heat, uint64_t now);
+        // account for a batch that arrived
+        void charge(uint64_t bytes);
+        // p no longer needs a slot
+        void release(partition_id p);
+        std::string debug_dump();
+
+    private:
+        void refill(uint64_t now);
+
+    private:
+        po6::threads::mutex m_mtx;
+        unsigned m_concurrency;
+        uint64_t m_bytes_per_second;
+        uint64_t m_batches_per_second;
+        double m_byte_tokens;
+        double m_batch_tokens;
+        uint64_t m_last_refill;
+        std::vector<partition_id> m_active;
+        std::map<partition_id, uint64_t> m_waiting;
+        uint64_t* m_traffic;
+
+    private:
+        migration_scheduler(const migration_scheduler&);
+        migration_scheduler& operator = (const migration_scheduler&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_migration_scheduler_h_
@@ -0,0 +1,126 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// Google Log
+#include <glog/logging.h>
+
+// consus
+#include "kvs/migration_snapshots.h"
+
+// a transfer nobody has pulled from for this long has been abandoned, or
+// will start over; its snapshot pins old data on disk, so let it go
+#define SNAPSHOT_IDLE_TIMEOUT (PO6_SECONDS * 60)
+
+using consus::migration_snapshots;
+
+struct migration_snapshots :: transfer
+{
+    transfer() : snap(), taken(0), last_pull(0) {}
+    ~transfer() throw () {}
+
+    snapshot_ptr snap;
+    uint64_t taken;
+    uint64_t last_pull;
+};
+
+migration_snapshots :: migration_snapshots()
+    : m_mtx()
+    , m_transfers()
+{
+}
+
+migration_snapshots :: ~migration_snapshots() throw ()
+{
+}
+
+migration_snapshots::snapshot_ptr
+migration_snapshots :: get(comm_id target, partition_id partition,
+                           bool restart, datalayer* data, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    transfer& t(m_transfers[std::make_pair(target, partition)]);
+
+    if (restart || !t.snap.get())
+    {
+        t.snap = snapshot_ptr(data->create_snapshot());
+        t.taken = now;
+    }
+
+    t.last_pull = now;
+    return t.snap;
+}
+
+void
+migration_snapshots :: finish(comm_id target, partition_id partition)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_transfers.erase(std::make_pair(target, partition));
+}
+
+void
+migration_snapshots :: expire(uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    transfer_map_t::iterator it = m_transfers.begin();
+
+    while (it != m_transfers.end())
+    {
+        if (it->second.last_pull + SNAPSHOT_IDLE_TIMEOUT < now)
+        {
+            LOG(INFO) << "releasing the snapshot for idle migration of "
+                      << it->first.second << " to " << it->first.first;
+            m_transfers.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+std::string
+migration_snapshots :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+
+    for (transfer_map_t::iterator it = m_transfers.begin();
+            it != m_transfers.end(); ++it)
+    {
+        ostr << "snapshot for " << it->first.second << " to " << it->first.first
+             << " taken=" << it->second.taken
+             << " last_pull=" << it->second.last_pull << "\n";
+    }
+
+    return ostr.str();
+}
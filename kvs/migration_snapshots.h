@@ -0,0 +1,88 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_migration_snapshots_h_
+#define consus_kvs_migration_snapshots_h_
+
+// STL
+#include <map>
+#include <string>
+#include <utility>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/compat.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// The source side of migrations:  each transfer of a partition to its next
+// owner reads from one snapshot taken when the transfer starts, so the copy is
+// of a single point in time and never chases writes made while it runs.  The
+// writes since the snapshot reach the next owner through hinted handoff.
+class migration_snapshots
+{
+    public:
+        typedef e::compat::shared_ptr<datalayer::snapshot> snapshot_ptr;
+
+    public:
+        migration_snapshots();
+        ~migration_snapshots() throw ();
+
+    public:
+        // the snapshot for target's transfer of partition; a transfer that
+        // starts over from the beginning gets a fresh one
+        snapshot_ptr get(comm_id target, partition_id partition,
+                         bool restart, datalayer* data, uint64_t now);
+        void finish(comm_id target, partition_id partition);
+        // release the snapshots of transfers nobody has pulled from lately
+        void expire(uint64_t now);
+        std::string debug_dump();
+
+    private:
+        struct transfer;
+        typedef std::pair<comm_id, partition_id> transfer_key_t;
+        typedef std::map<transfer_key_t, transfer> transfer_map_t;
+
+    private:
+        po6::threads::mutex m_mtx;
+        transfer_map_t m_transfers;
+
+    private:
+        migration_snapshots(const migration_snapshots&);
+        migration_snapshots& operator = (const migration_snapshots&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_migration_snapshots_h_
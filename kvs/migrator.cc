@@ -25,6 +25,10 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// STL
+#include <sstream>
+#include <vector>
+
 // BusyBee
 #include <busybee.h>
 
@@ -47,6 +51,13 @@ migrator :: migrator(partition_id key)
     , m_state(UNINITIALIZED)
     , m_last_handshake(0)
     , m_last_coord_call(0)
+    , m_cursor()
+    , m_pull_seqno(0)
+    , m_last_pull(0)
+    , m_applying(false)
+    , m_transferred_versions(0)
+    , m_heat(0)
+    , m_transferred(false)
 {
 }
 
@@ -69,7 +80,7 @@ migrator :: finished()
 }
 
 void
-migrator :: ack(version_id version, daemon* d)
+migrator :: ack(version_id version, uint64_t heat, daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     ensure_initialized(d);
@@ -78,10 +89,94 @@ migrator :: ack(version_id version, daemon* d)
     {
         LOG_IF(INFO, s_debug_mode) << "received migration ACK for " << m_state_key << "/" << m_version;
         m_state = TRANSFER_DATA;
+        m_heat = heat;
         work_state_machine(d);
     }
 }
 
+void
+migrator :: data(uint64_t seqno, const e::slice& next, bool done,
+                  e::unpacker up, daemon* d)
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        ensure_initialized(d);
+
+        if (m_state != TRANSFER_DATA || m_transferred || seqno != m_pull_seqno || m_applying)
+        {
+            LOG_IF(INFO, s_debug_mode) << "dropping stale migration batch " << seqno << " for " << m_state_key;
+            return;
+        }
+
+        m_applying = true;
+    }
+
+    std::vector<datalayer::raw_item> items;
+    uint64_t count;
+    uint64_t bytes = 0;
+    up = up >> count;
+
+    for (uint64_t i = 0; !up.error() && i < count; ++i)
+    {
+        e::slice table;
+        e::slice key;
+        uint64_t timestamp;
+        e::slice value;
+        up = up >> table >> key >> timestamp >> value;
+
+        if (up.error())
+        {
+            break;
+        }
+
+        items.push_back(datalayer::raw_item());
+        items.back().table = table.str();
+        items.back().key = key.str();
+        items.back().timestamp = timestamp;
+        items.back().value = value.str();
+        bytes += table.size() + key.size() + sizeof(uint64_t) + value.size();
+    }
+
+    // versions are immutable, so applying a batch twice is harmless; the
+    // whole batch is synced once, without holding up the state machine
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!up.error())
+    {
+        rc = d->m_anti_entropy.store_batch(d->m_data.get(), items);
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_applying = false;
+
+    if (up.error())
+    {
+        LOG(ERROR) << "migration of " << m_state_key << " received a corrupt batch; will pull it again";
+        return;
+    }
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        LOG(ERROR) << "migration of " << m_state_key << " could not store data; will pull the batch again";
+        return;
+    }
+
+    if (m_state != TRANSFER_DATA || seqno != m_pull_seqno)
+    {
+        return;
+    }
+
+    d->m_migration_sched.charge(bytes);
+    m_cursor = next.str();
+    ++m_pull_seqno;
+    m_last_pull = 0;
+    m_transferred_versions += count;
+    m_transferred = done;
+    LOG_IF(INFO, s_debug_mode) << "applied migration batch " << seqno << " for " << m_state_key
+                               << " (" << m_transferred_versions << " versions so far)";
+    work_state_machine(d);
+}
+
 void
 migrator :: externally_work_state_machine(daemon* d)
 {
@@ -100,7 +195,14 @@ migrator :: terminate()
 std::string
 migrator :: debug_dump()
 {
-    return "XXX"; // XXX
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "migration " << m_state_key << "/" << m_version
+         << " batches=" << m_pull_seqno
+         << " versions=" << m_transferred_versions
+         << " heat=" << m_heat
+         << (m_transferred ? " transferred" : "");
+    return ostr.str();
 }
 
 void
@@ -154,17 +256,45 @@ migrator :: work_state_machine_check_config(daemon* d)
 void
 migrator :: work_state_machine_transfer_data(daemon* d)
 {
-    bool done = true;
-    // XXX
-
     const uint64_t now = po6::monotonic_time();
 
-    if (done &&
-        m_last_coord_call + d->resend_interval() < now)
+    if (!m_transferred)
+    {
+        // a pull that goes unanswered is sent again from the same cursor, which
+        // also resumes the transfer if the source restarts or changes
+        if (m_last_pull + d->resend_interval() < now &&
+            d->m_migration_sched.admit(m_state_key, m_heat, now))
+        {
+            send_pull(d, now);
+        }
+
+        return;
+    }
+
+    d->m_migration_sched.release(m_state_key);
+
+    if (m_last_coord_call + d->resend_interval() < now)
     {
-        std::string msg;
-        e::packer(&msg) << m_state_key;
-        d->m_coord->fire_and_forget("kvs_migrated", msg.data(), msg.size());
+        d->report_migrated(m_state_key);
         m_last_coord_call = now;
     }
 }
+
+void
+migrator :: send_pull(daemon* d, uint64_t now)
+{
+    configuration* c = d->get_config();
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_MIGRATE_PULL)
+                    + pack_size(m_state_key)
+                    + sizeof(uint64_t)
+                    + sizeof(uint64_t)
+                    + pack_size(e::slice(m_cursor));
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_MIGRATE_PULL << m_state_key << m_version
+        << m_pull_seqno << e::slice(m_cursor);
+    d->send(c->owner_from_next_id(m_state_key), msg);
+    m_last_pull = now;
+    LOG_IF(INFO, s_debug_mode) << "sending migration pull " << m_pull_seqno << " for " << m_state_key << "/" << m_version;
+}
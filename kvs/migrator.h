@@ -28,10 +28,14 @@
 #ifndef consus_kvs_migrator_h_
 #define consus_kvs_migrator_h_
 
+// STL
+#include <string>
+
 // po6
 #include <po6/threads/mutex.h>
 
 // e
+#include <e/serialization.h>
 #include <e/slice.h>
 
 // consus
@@ -53,7 +57,10 @@ class migrator
         bool finished();
 
     public:
-        void ack(version_id version, daemon* d);
+        void ack(version_id version, uint64_t heat, daemon* d);
+        // one batch of the partition's data, answering pull number seqno
+        void data(uint64_t seqno, const e::slice& next, bool done,
+                  e::unpacker items, daemon* d);
         void externally_work_state_machine(daemon* d);
         void terminate();
         std::string debug_dump();
@@ -72,6 +79,7 @@ class migrator
         void work_state_machine(daemon* d);
         void work_state_machine_check_config(daemon* d);
         void work_state_machine_transfer_data(daemon* d);
+        void send_pull(daemon* d, uint64_t now);
 
     private:
         const partition_id m_state_key;
@@ -80,6 +88,16 @@ class migrator
         state_t m_state;
         uint64_t m_last_handshake;
         uint64_t m_last_coord_call;
+        // the transfer resumes from m_cursor; only the answer to
+        // m_pull_seqno is applied, so duplicates and stragglers are ignored
+        std::string m_cursor;
+        uint64_t m_pull_seqno;
+        uint64_t m_last_pull;
+        // the answer to m_pull_seqno is being stored outside m_mtx
+        bool m_applying;
+        uint64_t m_transferred_versions;
+        uint64_t m_heat;
+        bool m_transferred;
 };
 
 END_CONSUS_NAMESPACE
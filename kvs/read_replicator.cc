@@ -27,9 +27,15 @@
 
 #define __STDC_LIMIT_MACROS
 
+// STL
+#include <algorithm>
+
 // Google Log
 #include <glog/logging.h>
 
+// po6
+#include <po6/time.h>
+
 // e
 #include <e/strescape.h>
 
@@ -37,14 +43,18 @@
 #include <busybee.h>
 
 // consus
+#include "common/buffer_pool.h"
 #include "common/constants.h"
 #include "common/consus.h"
 #include "common/network_msgtype.h"
+#include "common/tracer.h"
 #include "kvs/daemon.h"
 #include "kvs/read_replicator.h"
 
 using consus::read_replicator;
 
+#define STALE_READ_ATTEMPTS 2
+
 extern bool s_debug_mode;
 
 struct read_replicator :: read_stub
@@ -55,12 +65,14 @@ struct read_replicator :: read_stub
     comm_id target;
     replica_set rs;
     uint64_t last_request_time;
+    unsigned requests;
 };
 
 read_replicator :: read_stub :: read_stub(comm_id t)
     : target(t)
     , rs()
     , last_request_time(0)
+    , requests(0)
 {
 }
 
@@ -69,10 +81,15 @@ read_replicator :: read_replicator(uint64_t key)
     , m_mtx()
     , m_init(false)
     , m_finished(false)
+    , m_traced_since(0)
+    , m_started(0)
     , m_id()
     , m_nonce()
     , m_table()
     , m_key()
+    , m_read_timestamp(UINT64_MAX)
+    , m_stale(false)
+    , m_stale_done(false)
     , m_kbacking()
     , m_status(CONSUS_NOT_FOUND)
     , m_value()
@@ -80,6 +97,8 @@ read_replicator :: read_replicator(uint64_t key)
     , m_timestamp(0)
     , m_requests()
 {
+    // one stub per replica; sized up front so the common case never grows it
+    m_requests.reserve(CONSUS_MAX_REPLICATION_FACTOR);
 }
 
 read_replicator :: ~read_replicator() throw ()
@@ -101,6 +120,7 @@ read_replicator :: finished()
 void
 read_replicator :: init(comm_id id, uint64_t nonce,
                         const e::slice& table, const e::slice& key,
+                        uint64_t timestamp, bool stale,
                         std::auto_ptr<e::buffer> backing)
 {
     po6::threads::mutex::hold hold(&m_mtx);
@@ -109,14 +129,18 @@ read_replicator :: init(comm_id id, uint64_t nonce,
     m_nonce = nonce;
     m_table = table;
     m_key = key;
+    m_read_timestamp = timestamp;
+    m_stale = stale;
     m_kbacking = backing;
     m_init = true;
+    m_traced_since = tracer::tagged(nonce) ? po6::wallclock_time() : 0;
+    m_started = po6::monotonic_time();
 
     if (s_debug_mode)
     {
-        LOG(INFO) << logid() << " read(\""
+        LOG(INFO) << logid() << (stale ? " stale-read(\"" : " read(\"")
                   << e::strescape(table.str()) << "\", \""
-                  << e::strescape(key.str()) << "\")";
+                  << e::strescape(key.str()) << "\")@" << timestamp;
     }
 }
 
@@ -146,9 +170,18 @@ read_replicator :: response(comm_id id, consus_returncode rc,
         return;
     }
 
+    // Karn's rule:  only a request sent exactly once gives a clean sample
+    if (stub->requests == 1)
+    {
+        d->observe_rtt(id, po6::monotonic_time() - stub->last_request_time);
+    }
+
+    stub->requests = 0;
+
     if (returncode_is_final(rc))
     {
         stub->rs = rs;
+        m_stale_done = true;
 
         if (m_timestamp == 0 || timestamp > m_timestamp)
         {
@@ -241,6 +274,18 @@ read_replicator :: work_state_machine(daemon* d)
     }
 
     const uint64_t now = po6::monotonic_time();
+
+    if (m_stale)
+    {
+        if (work_state_machine_stale(rs, now, d))
+        {
+            return;
+        }
+
+        LOG_IF(INFO, s_debug_mode) << logid() << " no replica answered the stale read; falling back to a quorum read";
+        m_stale = false;
+    }
+
     unsigned complete = 0;
 
     for (unsigned i = 0; i < rs.num_replicas; ++i)
@@ -257,7 +302,7 @@ read_replicator :: work_state_machine(daemon* d)
         {
             ++complete;
         }
-        else if (stub->last_request_time + d->resend_interval() < now)
+        else if (stub->last_request_time + d->resend_interval(stub->target) < now)
         {
             send_read_request(stub, now, d);
         }
@@ -275,22 +320,96 @@ read_replicator :: work_state_machine(daemon* d)
 
     if (complete >= quorum)
     {
-        m_finished = true;
-        const size_t sz = BUSYBEE_HEADER_SIZE
-                        + pack_size(KVS_REP_RD_RESP)
-                        + sizeof(uint64_t)
-                        + pack_size(m_status)
-                        + sizeof(uint64_t)
-                        + pack_size(m_value);
-        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE)
-            << KVS_REP_RD_RESP << m_nonce << m_status << m_timestamp << m_value;
-        d->send(m_id, msg);
-        LOG_IF(INFO, s_debug_mode) << "sending read response " << m_status
-                                   << " nonce=" << m_nonce << " to " << m_id;
+        send_response(d);
     }
 }
 
+// Returns false once every replica has been tried STALE_READ_ATTEMPTS times
+// without an answer.
+bool
+read_replicator :: work_state_machine_stale(const replica_set& rs, uint64_t now, daemon* d)
+{
+    if (m_stale_done)
+    {
+        send_response(d);
+        return true;
+    }
+
+    // try the replicas nearest first:  ourselves, then those in our rack,
+    // then those in our zone, each by estimated RTT
+    configuration* c = d->get_config();
+    std::vector<std::pair<std::pair<unsigned, uint64_t>, comm_id> > order;
+
+    for (unsigned i = 0; i < rs.num_replicas; ++i)
+    {
+        const comm_id r = rs.replicas[i];
+        const bool us = r == d->m_us.id;
+        order.push_back(std::make_pair(std::make_pair(us ? 0 : c->distance(d->m_us.id, r),
+                                                      us ? 0 : d->resend_interval(r)), r));
+    }
+
+    std::sort(order.begin(), order.end());
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        read_stub* stub = get_stub(order[i].second);
+
+        if (!stub)
+        {
+            m_requests.push_back(read_stub(order[i].second));
+            stub = &m_requests.back();
+        }
+
+        if (stub->last_request_time == 0)
+        {
+            send_read_request(stub, now, d);
+            return true;
+        }
+
+        if (stub->last_request_time + d->resend_interval(stub->target) >= now)
+        {
+            return true;
+        }
+
+        if (stub->requests < STALE_READ_ATTEMPTS)
+        {
+            send_read_request(stub, now, d);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+read_replicator :: send_response(daemon* d)
+{
+    if (m_traced_since != 0)
+    {
+        d->m_tracer.span("read_replicator", m_nonce, m_traced_since, po6::wallclock_time());
+        m_traced_since = 0;
+    }
+
+    m_finished = true;
+    const uint64_t elapsed = po6::monotonic_time() - m_started;
+    d->m_hot.replicated(m_stale ? "stale_read" : "read", m_table, m_key, elapsed);
+    d->m_tables.record(m_table, table_stats::REPLICATED_READS, 1);
+    d->m_tables.record(m_table, table_stats::REPLICATED_READ_NANOS, elapsed);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_REP_RD_RESP)
+                    + sizeof(uint64_t)
+                    + pack_size(m_status)
+                    + sizeof(uint64_t)
+                    + pack_size(m_value)
+                    + sizeof(uint8_t);
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_REP_RD_RESP << m_nonce << m_status << m_timestamp << m_value << d->load();
+    d->send(m_id, msg);
+    LOG_IF(INFO, s_debug_mode) << "sending read response " << m_status
+                               << " nonce=" << m_nonce << " to " << m_id;
+}
+
 // It's tempting to dedupe this with {write,lock}-replicator.  Reads and writes
 // may have different sets of "terminal" returncodes in the future that
 // represent non-transient errors; keeping them as different functions reminds
@@ -307,6 +426,8 @@ read_replicator :: returncode_is_final(consus_returncode rc)
         case CONSUS_LESS_DURABLE:
         case CONSUS_ABORTED:
         case CONSUS_COMMITTED:
+        case CONSUS_SCAN_DONE:
+        case CONSUS_COMPARE_FAILED:
         case CONSUS_NONE_PENDING:
         case CONSUS_INVALID:
         case CONSUS_TIMEOUT:
@@ -330,17 +451,19 @@ read_replicator :: send_read_request(read_stub* stub, uint64_t now, daemon* d)
         LOG(INFO) << logid() << " sending target=" << stub->target;
     }
 
+    const table_ref tr(d->m_table_ids.intern(m_table));
     const size_t sz = BUSYBEE_HEADER_SIZE
                     + pack_size(KVS_RAW_RD)
                     + sizeof(uint64_t)
                     + sizeof(uint8_t)
-                    + pack_size(m_table)
+                    + pack_size(tr)
                     + pack_size(m_key)
                     + sizeof(uint64_t)
                     + pack_size(m_value);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_RAW_RD << m_state_key << m_table << m_key << uint64_t(UINT64_MAX);
+        << KVS_RAW_RD << m_state_key << tr << m_key << m_read_timestamp;
     d->send(stub->target, msg);
     stub->last_request_time = now;
+    ++stub->requests;
 }
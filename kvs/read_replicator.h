@@ -38,11 +38,12 @@
 #include <consus.h>
 #include "namespace.h"
 #include "common/ids.h"
+#include "common/pooled.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
 
-class read_replicator
+class read_replicator : public pooled<read_replicator, ALLOC_REPLICATORS>
 {
     public:
         read_replicator(uint64_t key);
@@ -53,8 +54,12 @@ class read_replicator
         bool finished();
 
     public:
+        // a stale read asks only the nearest replica for the newest version
+        // at or before timestamp, falling back to a quorum read if no
+        // replica answers
         void init(comm_id id, uint64_t nonce,
                   const e::slice& table, const e::slice& key,
+                  uint64_t timestamp, bool stale,
                   std::auto_ptr<e::buffer> backing);
         void response(comm_id id, consus_returncode rc,
                       uint64_t timestamp, const e::slice& value,
@@ -70,6 +75,8 @@ class read_replicator
         std::string logid();
         read_stub* get_stub(comm_id id);
         void work_state_machine(daemon* d);
+        bool work_state_machine_stale(const replica_set& rs, uint64_t now, daemon* d);
+        void send_response(daemon* d);
         bool returncode_is_final(consus_returncode rc);
         void send_read_request(read_stub* stub, uint64_t now, daemon* d);
 
@@ -78,10 +85,16 @@ class read_replicator
         po6::threads::mutex m_mtx;
         bool m_init;
         bool m_finished;
+        // when init saw a nonce tagged for tracing; else 0
+        uint64_t m_traced_since;
+        uint64_t m_started;
         comm_id m_id;
         uint64_t m_nonce;
         e::slice m_table;
         e::slice m_key;
+        uint64_t m_read_timestamp;
+        bool m_stale;
+        bool m_stale_done;
         std::auto_ptr<e::buffer> m_kbacking;
         consus_returncode m_status;
         e::slice m_value;
@@ -0,0 +1,220 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// STL
+#include <sstream>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/buffer_pool.h"
+#include "kvs/response_cache.h"
+
+using consus::response_cache;
+
+// Independently locked partitions of the cache; an entry's shard comes from
+// its nonce.
+#define RESPONSE_CACHE_SHARDS 16
+
+// Bookkeeping charged against the budget for every cached response, on top
+// of its bytes.
+#define RESPONSE_CACHE_ENTRY_OVERHEAD 96
+
+struct response_cache::shard
+{
+    typedef std::list<key_t> fifo_t;
+    typedef std::map<key_t, std::string> index_t;
+
+    shard();
+    ~shard() throw ();
+    void evict(uint64_t budget);
+
+    po6::threads::mutex mtx;
+    // oldest first
+    fifo_t fifo;
+    index_t index;
+    uint64_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    private:
+        shard(const shard&);
+        shard& operator = (const shard&);
+};
+
+response_cache :: shard :: shard()
+    : mtx()
+    , fifo()
+    , index()
+    , bytes(0)
+    , hits(0)
+    , misses(0)
+    , evictions(0)
+{
+}
+
+response_cache :: shard :: ~shard() throw ()
+{
+}
+
+void
+response_cache :: shard :: evict(uint64_t budget)
+{
+    while (bytes > budget && !fifo.empty())
+    {
+        index_t::iterator it = index.find(fifo.front());
+
+        if (it != index.end())
+        {
+            bytes -= it->second.size() + RESPONSE_CACHE_ENTRY_OVERHEAD;
+            index.erase(it);
+        }
+
+        fifo.pop_front();
+        ++evictions;
+    }
+}
+
+response_cache :: response_cache()
+    : m_shard_budget(0)
+    , m_shards(new shard[RESPONSE_CACHE_SHARDS])
+{
+}
+
+response_cache :: ~response_cache() throw ()
+{
+    delete[] m_shards;
+}
+
+void
+response_cache :: set_budget(uint64_t budget)
+{
+    m_shard_budget = budget / RESPONSE_CACHE_SHARDS;
+}
+
+bool
+response_cache :: lookup(comm_id id, uint64_t nonce, std::auto_ptr<e::buffer>* msg)
+{
+    if (m_shard_budget == 0)
+    {
+        return false;
+    }
+
+    shard* s = get_shard(id, nonce);
+    po6::threads::mutex::hold hold(&s->mtx);
+    shard::index_t::iterator it = s->index.find(key_t(id, nonce));
+
+    if (it == s->index.end())
+    {
+        ++s->misses;
+        return false;
+    }
+
+    const std::string& resp(it->second);
+    const size_t sz = BUSYBEE_HEADER_SIZE + resp.size();
+    *msg = buffer_pool::reuse(*msg, sz);
+    memmove((*msg)->data() + BUSYBEE_HEADER_SIZE, resp.data(), resp.size());
+    (*msg)->resize(sz);
+    ++s->hits;
+    return true;
+}
+
+void
+response_cache :: insert(comm_id id, uint64_t nonce, const e::buffer* msg)
+{
+    if (m_shard_budget == 0 || msg->size() < BUSYBEE_HEADER_SIZE)
+    {
+        return;
+    }
+
+    const size_t sz = msg->size() - BUSYBEE_HEADER_SIZE;
+
+    // a response bigger than the shard would only flush everything else
+    if (sz + RESPONSE_CACHE_ENTRY_OVERHEAD > m_shard_budget)
+    {
+        return;
+    }
+
+    shard* s = get_shard(id, nonce);
+    po6::threads::mutex::hold hold(&s->mtx);
+    const key_t k(id, nonce);
+    std::string& resp(s->index[k]);
+
+    if (resp.empty())
+    {
+        s->fifo.push_back(k);
+    }
+    else
+    {
+        s->bytes -= resp.size() + RESPONSE_CACHE_ENTRY_OVERHEAD;
+    }
+
+    resp.assign(reinterpret_cast<const char*>(msg->data() + BUSYBEE_HEADER_SIZE), sz);
+    s->bytes += sz + RESPONSE_CACHE_ENTRY_OVERHEAD;
+    s->evict(m_shard_budget);
+}
+
+std::string
+response_cache :: debug_dump()
+{
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    for (size_t i = 0; i < RESPONSE_CACHE_SHARDS; ++i)
+    {
+        po6::threads::mutex::hold hold(&m_shards[i].mtx);
+        entries += m_shards[i].index.size();
+        bytes += m_shards[i].bytes;
+        hits += m_shards[i].hits;
+        misses += m_shards[i].misses;
+        evictions += m_shards[i].evictions;
+    }
+
+    std::ostringstream ostr;
+    ostr << "response cache entries=" << entries
+         << " bytes=" << bytes
+         << " budget=" << m_shard_budget * RESPONSE_CACHE_SHARDS
+         << " duplicates=" << hits
+         << " misses=" << misses
+         << " evictions=" << evictions;
+    return ostr.str();
+}
+
+response_cache::shard*
+response_cache :: get_shard(comm_id, uint64_t nonce)
+{
+    // nonces are random, so they spread evenly on their own
+    return &m_shards[nonce % RESPONSE_CACHE_SHARDS];
+}
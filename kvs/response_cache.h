@@ -0,0 +1,90 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_response_cache_h_
+#define consus_kvs_response_cache_h_
+
+// STL
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/buffer.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Remembers the responses recently sent to raw reads and writes, keyed by the
+// replicator that asked and the nonce it used.  A replicator that times out
+// resends the identical request under the same nonce; answering it from here
+// spares the datalayer from redoing (and re-syncing) the work.  Entries age
+// out first-in-first-out once the byte budget is spent.
+class response_cache
+{
+    public:
+        response_cache();
+        ~response_cache() throw ();
+
+    public:
+        // budget is in bytes, split evenly across shards; 0 disables the
+        // cache.  Call before any other method.
+        void set_budget(uint64_t budget);
+        // a copy of the response previously sent to (id, nonce), ready to be
+        // sent again
+        bool lookup(comm_id id, uint64_t nonce, std::auto_ptr<e::buffer>* msg);
+        // remember msg, a fully packed response about to be sent to id
+        void insert(comm_id id, uint64_t nonce, const e::buffer* msg);
+        std::string debug_dump();
+
+    private:
+        struct shard;
+        typedef std::pair<comm_id, uint64_t> key_t;
+
+    private:
+        shard* get_shard(comm_id id, uint64_t nonce);
+
+    private:
+        uint64_t m_shard_budget;
+        shard* m_shards;
+
+    private:
+        response_cache(const response_cache&);
+        response_cache& operator = (const response_cache&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_response_cache_h_
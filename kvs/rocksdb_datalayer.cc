@@ -0,0 +1,832 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdlib.h>
+
+// POSIX
+#include <unistd.h>
+
+// Google Log
+#include <glog/logging.h>
+
+// RocksDB
+#include <rocksdb/compaction_filter.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
+
+// po6
+#include <po6/path.h>
+
+// e
+#include <e/atomic.h>
+#include <e/endian.h>
+#include <e/strescape.h>
+
+// consus
+#include "kvs/key_encoding.h"
+#include "kvs/rocksdb_datalayer.h"
+
+using consus::rocksdb_datalayer;
+
+// Bits per entry in the bloom filters kept over key prefixes.
+#define BLOOM_BITS_PER_KEY 10
+
+// Block cache dedicated to the lock column family, in megabytes.
+#define LOCK_CACHE_MB 64
+
+// Most threads any one compaction is split across.
+#define COMPACTION_SUBTASKS 4
+
+// Data keys with the timestamp stripped off, so that the bloom filters can
+// answer for every version of a key at once.
+struct rocksdb_datalayer::prefix : public rocksdb::SliceTransform
+{
+    prefix();
+    virtual ~prefix() throw ();
+    virtual const char* Name() const { return "ConsusKeyPrefix"; }
+    virtual rocksdb::Slice Transform(const rocksdb::Slice& k) const;
+    virtual bool InDomain(const rocksdb::Slice& k) const;
+};
+
+rocksdb_datalayer :: prefix :: prefix()
+{
+}
+
+rocksdb_datalayer :: prefix :: ~prefix() throw ()
+{
+}
+
+rocksdb::Slice
+rocksdb_datalayer :: prefix :: Transform(const rocksdb::Slice& k) const
+{
+    return rocksdb::Slice(k.data(), k.size() - sizeof(uint64_t));
+}
+
+bool
+rocksdb_datalayer :: prefix :: InDomain(const rocksdb::Slice& k) const
+{
+    return k.size() > sizeof(uint64_t) && is_data_key(k.data(), k.size());
+}
+
+// Drops the versions prune would have dropped as compaction rewrites them.
+// Compaction visits keys in order, so every version of a key that's part of
+// this compaction arrives together, newest first.
+struct rocksdb_datalayer::pruner : public rocksdb::CompactionFilter
+{
+    pruner(uint64_t watermark, uint64_t tombstones, bool full);
+    virtual ~pruner() throw ();
+    virtual bool Filter(int level,
+                        const rocksdb::Slice& key,
+                        const rocksdb::Slice& value,
+                        std::string* new_value,
+                        bool* value_changed) const;
+    virtual const char* Name() const { return "ConsusPruner"; }
+
+    const uint64_t watermark;
+    const uint64_t tombstones;
+    const bool full;
+    mutable std::string group;
+    mutable bool covered;
+
+    private:
+        pruner(const pruner&);
+        pruner& operator = (const pruner&);
+};
+
+rocksdb_datalayer :: pruner :: pruner(uint64_t _watermark, uint64_t _tombstones, bool _full)
+    : watermark(_watermark)
+    , tombstones(_tombstones)
+    , full(_full)
+    , group()
+    , covered(false)
+{
+}
+
+rocksdb_datalayer :: pruner :: ~pruner() throw ()
+{
+}
+
+bool
+rocksdb_datalayer :: pruner :: Filter(int,
+                                      const rocksdb::Slice& key,
+                                      const rocksdb::Slice& value,
+                                      std::string*,
+                                      bool*) const
+{
+    if (watermark == 0 || key.size() <= sizeof(uint64_t) ||
+        !is_data_key(key.data(), key.size()))
+    {
+        return false;
+    }
+
+    const rocksdb::Slice g(key.data(), key.size() - sizeof(uint64_t));
+
+    if (g != rocksdb::Slice(group))
+    {
+        group.assign(g.data(), g.size());
+        covered = false;
+    }
+
+    uint64_t timestamp;
+    e::unpack64be(key.data() + key.size() - sizeof(uint64_t), &timestamp);
+    timestamp = UINT64_MAX - timestamp;
+
+    if (timestamp > watermark)
+    {
+        return false;
+    }
+
+    if (covered)
+    {
+        return true;
+    }
+
+    // the newest version at or below the watermark stays, unless it's a
+    // tombstone every replica holds and this compaction holds every version
+    // it could be hiding
+    covered = true;
+    return value.empty() && full && timestamp <= tombstones;
+}
+
+struct rocksdb_datalayer::pruner_factory : public rocksdb::CompactionFilterFactory
+{
+    pruner_factory(const uint64_t* watermark, const uint64_t* tombstones);
+    virtual ~pruner_factory() throw ();
+    virtual std::unique_ptr<rocksdb::CompactionFilter>
+        CreateCompactionFilter(const rocksdb::CompactionFilter::Context& context);
+    virtual const char* Name() const { return "ConsusPrunerFactory"; }
+
+    const uint64_t* watermark;
+    const uint64_t* tombstones;
+
+    private:
+        pruner_factory(const pruner_factory&);
+        pruner_factory& operator = (const pruner_factory&);
+};
+
+rocksdb_datalayer :: pruner_factory :: pruner_factory(const uint64_t* _watermark,
+                                                       const uint64_t* _tombstones)
+    : watermark(_watermark)
+    , tombstones(_tombstones)
+{
+}
+
+rocksdb_datalayer :: pruner_factory :: ~pruner_factory() throw ()
+{
+}
+
+std::unique_ptr<rocksdb::CompactionFilter>
+rocksdb_datalayer :: pruner_factory :: CreateCompactionFilter(const rocksdb::CompactionFilter::Context& context)
+{
+    const uint64_t w = e::atomic::load_64_acquire(watermark);
+    const uint64_t t = e::atomic::load_64_acquire(tombstones);
+    return std::unique_ptr<rocksdb::CompactionFilter>(new pruner(w, t, context.is_full_compaction));
+}
+
+struct rocksdb_datalayer::reference : public datalayer::reference
+{
+    reference(rocksdb::Iterator* it);
+    virtual ~reference() throw ();
+
+    rocksdb::Iterator* it;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+rocksdb_datalayer :: reference :: reference(rocksdb::Iterator* _it)
+    : datalayer::reference()
+    , it(_it)
+{
+}
+
+rocksdb_datalayer :: reference :: ~reference() throw ()
+{
+    delete it;
+}
+
+struct rocksdb_datalayer::snapshot : public datalayer::snapshot
+{
+    snapshot(rocksdb::DB* db);
+    virtual ~snapshot() throw ();
+
+    rocksdb::DB* db;
+    const rocksdb::Snapshot* snap;
+
+    private:
+        snapshot(const snapshot&);
+        snapshot& operator = (const snapshot&);
+};
+
+rocksdb_datalayer :: snapshot :: snapshot(rocksdb::DB* _db)
+    : datalayer::snapshot()
+    , db(_db)
+    , snap(db->GetSnapshot())
+{
+}
+
+rocksdb_datalayer :: snapshot :: ~snapshot() throw ()
+{
+    db->ReleaseSnapshot(snap);
+}
+
+rocksdb_datalayer :: rocksdb_datalayer(bool lazy_locks, unsigned shares)
+    : m_lazy_locks(lazy_locks)
+    , m_shares(std::max(shares, 1U))
+    , m_watermark(0)
+    , m_tombstones(0)
+    , m_db(NULL)
+    , m_data(NULL)
+    , m_locks(NULL)
+    , m_stalls(0)
+    , m_stall_time(0)
+{
+}
+
+rocksdb_datalayer :: ~rocksdb_datalayer() throw ()
+{
+    delete m_data;
+    delete m_locks;
+    delete m_db;
+}
+
+bool
+rocksdb_datalayer :: init(std::string data)
+{
+    rocksdb::DBOptions opts;
+    opts.create_if_missing = true;
+    opts.create_missing_column_families = true;
+    opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L) / m_shares;
+    opts.IncreaseParallelism(std::max(sysconf(_SC_NPROCESSORS_ONLN), 2L));
+    opts.max_subcompactions = COMPACTION_SUBTASKS;
+
+    rocksdb::BlockBasedTableOptions table;
+    table.filter_policy.reset(rocksdb::NewBloomFilterPolicy(BLOOM_BITS_PER_KEY, false));
+    table.whole_key_filtering = false;
+    rocksdb::ColumnFamilyOptions data_opts;
+    data_opts.OptimizeLevelStyleCompaction();
+    data_opts.prefix_extractor.reset(new prefix());
+    data_opts.memtable_prefix_bloom_size_ratio = 0.1;
+    data_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table));
+    data_opts.compaction_filter_factory.reset(new pruner_factory(&m_watermark, &m_tombstones));
+
+    rocksdb::ColumnFamilyOptions lock_opts;
+    lock_opts.OptimizeForPointLookup(std::max(LOCK_CACHE_MB / m_shares, 1U));
+
+    std::vector<rocksdb::ColumnFamilyDescriptor> families;
+    families.push_back(rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName, data_opts));
+    families.push_back(rocksdb::ColumnFamilyDescriptor("locks", lock_opts));
+    std::vector<rocksdb::ColumnFamilyHandle*> handles;
+    rocksdb::Status st = rocksdb::DB::Open(opts, po6::path::join(data, "rocksdb"),
+                                           families, &handles, &m_db);
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "could not open rocksdb: " << st.ToString();
+        return false;
+    }
+
+    assert(handles.size() == 2);
+    m_data = handles[0];
+    m_locks = handles[1];
+    return true;
+}
+
+consus_returncode
+rocksdb_datalayer :: get(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp_le,
+                         uint64_t* timestamp,
+                         e::slice* value,
+                         datalayer::reference** ref)
+{
+    e::slice ignored;
+    value = value ? value : &ignored;
+
+    std::string tmp = data_key(table, key, timestamp_le);
+    rocksdb::Iterator* it = data_iterator(false);
+    it->Seek(tmp);
+    *timestamp = 0;
+    *value = e::slice();
+    *ref = NULL;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << it->status().ToString();
+        delete it;
+        return CONSUS_SERVER_ERROR;
+    }
+    else if (!it->Valid() || tmp.size() != it->key().size() ||
+             memcmp(tmp.data(), it->key().data(), tmp.size() - 8) != 0)
+    {
+        delete it;
+        return CONSUS_NOT_FOUND;
+    }
+
+    e::unpack64be(it->key().data() + it->key().size() - 8, timestamp);
+    *timestamp = UINT64_MAX - *timestamp;
+    *value = e::slice(it->value().data(), it->value().size());
+    *ref = new reference(it);
+
+    if (value->empty())
+    {
+        return CONSUS_NOT_FOUND;
+    }
+    else
+    {
+        return CONSUS_SUCCESS;
+    }
+}
+
+consus_returncode
+rocksdb_datalayer :: scan(const e::slice& table,
+                          const e::slice& key,
+                          uint64_t timestamp_le,
+                          uint64_t limit,
+                          std::vector<scan_item>* items)
+{
+    const std::string prefix(data_key(table, e::slice(), 0), 0, data_key_prefix_size(table));
+    rocksdb::Iterator* it = data_iterator(true);
+    it->Seek(data_key(table, key, timestamp_le));
+    items->clear();
+
+    while (it->Valid() && items->size() < limit)
+    {
+        const rocksdb::Slice k(it->key());
+        e::slice ktable;
+        std::string ukey;
+        uint64_t timestamp;
+
+        if (!k.starts_with(prefix) ||
+            !decode_data_key(k.data(), k.size(), &ktable, &ukey, &timestamp))
+        {
+            break;
+        }
+
+        if (timestamp > timestamp_le)
+        {
+            it->Seek(data_key(table, e::slice(ukey), timestamp_le));
+            continue;
+        }
+
+        items->push_back(scan_item());
+        scan_item* si = &items->back();
+        si->key = ukey;
+        si->timestamp = timestamp;
+        si->value.assign(it->value().data(), it->value().size());
+
+        std::string next(si->key);
+        next.push_back('\0');
+        it->Seek(data_key(table, e::slice(next), UINT64_MAX));
+    }
+
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << it->status().ToString();
+        rc = CONSUS_SERVER_ERROR;
+    }
+
+    delete it;
+    return rc;
+}
+
+consus_returncode
+rocksdb_datalayer :: put(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp,
+                         const e::slice& value)
+{
+    assert(!value.empty()); /* XXX */
+    return write(m_data, data_key(table, key, timestamp), value, true);
+}
+
+consus_returncode
+rocksdb_datalayer :: del(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp)
+{
+    return write(m_data, data_key(table, key, timestamp), e::slice(), true);
+}
+
+consus_returncode
+rocksdb_datalayer :: put_batch(const std::vector<raw_item>& items)
+{
+    rocksdb::WriteBatch batch;
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const std::string k = data_key(e::slice(items[i].table),
+                                       e::slice(items[i].key),
+                                       items[i].timestamp);
+        batch.Put(m_data, k, items[i].value);
+    }
+
+    rocksdb::WriteOptions opts;
+    opts.sync = true;
+    const uint64_t start = po6::monotonic_time();
+    rocksdb::Status st = m_db->Write(opts, &batch);
+    const uint64_t elapsed = po6::monotonic_time() - start;
+
+    if (elapsed >= WRITE_STALL_THRESHOLD)
+    {
+        e::atomic::increment_64_nobarrier(&m_stalls, 1);
+        e::atomic::increment_64_nobarrier(&m_stall_time, elapsed);
+    }
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+rocksdb_datalayer :: raw_scan(const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    rocksdb::Iterator* it = data_iterator(true);
+    consus_returncode rc = raw_scan(it, cursor, limit, items, next, done);
+    delete it;
+    return rc;
+}
+
+consus::datalayer::snapshot*
+rocksdb_datalayer :: create_snapshot()
+{
+    return new snapshot(m_db);
+}
+
+consus_returncode
+rocksdb_datalayer :: raw_scan(const datalayer::snapshot* snap,
+                              const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    rocksdb::Iterator* it = data_iterator(true, static_cast<const snapshot*>(snap)->snap);
+    consus_returncode rc = raw_scan(it, cursor, limit, items, next, done);
+    delete it;
+    return rc;
+}
+
+consus_returncode
+rocksdb_datalayer :: raw_scan(rocksdb::Iterator* it,
+                              const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    items->clear();
+    *next = cursor;
+    *done = false;
+
+    if (cursor.empty())
+    {
+        it->Seek(data_keys_begin());
+    }
+    else
+    {
+        it->Seek(cursor);
+
+        if (it->Valid() && it->key() == rocksdb::Slice(cursor))
+        {
+            it->Next();
+        }
+    }
+
+    for (uint64_t examined = 0; it->Valid() && examined < limit; ++examined, it->Next())
+    {
+        const rocksdb::Slice k(it->key());
+        next->assign(k.data(), k.size());
+        e::slice table;
+        std::string key;
+        uint64_t timestamp;
+
+        if (!decode_data_key(k.data(), k.size(), &table, &key, &timestamp))
+        {
+            LOG(ERROR) << "skipping corrupt data key \"" << e::strescape(*next) << "\"";
+            continue;
+        }
+
+        items->push_back(raw_item());
+        raw_item* ri = &items->back();
+        ri->table = table.str();
+        ri->key = key;
+        ri->timestamp = timestamp;
+        ri->value.assign(it->value().data(), it->value().size());
+    }
+
+    *done = !it->Valid();
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << it->status().ToString();
+        rc = CONSUS_SERVER_ERROR;
+        *done = false;
+    }
+
+    return rc;
+}
+
+consus_returncode
+rocksdb_datalayer :: prune(uint64_t watermark,
+                           uint64_t tombstones,
+                           const std::string& cursor,
+                           uint64_t,
+                           std::string* next,
+                           bool* done,
+                           uint64_t* pruned)
+{
+    e::atomic::store_64_release(&m_tombstones, tombstones);
+    e::atomic::store_64_release(&m_watermark, watermark);
+    *next = cursor;
+    *done = true;
+    *pruned = 0;
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+rocksdb_datalayer :: erase_version(const e::slice& table,
+                                   const e::slice& key,
+                                   uint64_t timestamp)
+{
+    rocksdb::WriteOptions opts;
+    opts.sync = true;
+    rocksdb::Status st = m_db->Delete(opts, m_data, data_key(table, key, timestamp));
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+rocksdb_datalayer :: read_lock(const e::slice& table,
+                               const e::slice& key,
+                               std::vector<transaction_group>* holders,
+                               bool* shared)
+{
+    std::string val;
+    holders->clear();
+    *shared = false;
+    rocksdb::Status st = m_db->Get(rocksdb::ReadOptions(), m_locks, lock_key(table, key), &val);
+
+    if (st.IsNotFound())
+    {
+        return CONSUS_NOT_FOUND;
+    }
+    else if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    if (!decode_lock_value(val.data(), val.size(), holders, shared))
+    {
+        LOG(ERROR) << "corrupt lock (\""
+                   << e::strescape(table.str()) << "\", \""
+                   << e::strescape(key.str()) << "\")";
+        return CONSUS_INVALID;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+rocksdb_datalayer :: write_lock(const e::slice& table,
+                                const e::slice& key,
+                                const std::vector<transaction_group>& holders,
+                                bool shared)
+{
+    const std::string val = lock_value(holders, shared);
+    return write(m_locks, lock_key(table, key), e::slice(val), !m_lazy_locks);
+}
+
+consus_returncode
+rocksdb_datalayer :: checkpoint_locks()
+{
+    if (!m_lazy_locks)
+    {
+        return CONSUS_SUCCESS;
+    }
+
+    rocksdb::Status st = m_db->SyncWAL();
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+rocksdb_datalayer :: scan_locks(const std::string& cursor,
+                               uint64_t limit,
+                               std::vector<lock_item>* locks,
+                               std::string* next,
+                               bool* done)
+{
+    rocksdb::ReadOptions opts;
+    // the lock family is hashed for point lookups; walk it in key order
+    opts.total_order_seek = true;
+    opts.fill_cache = false;
+    rocksdb::Iterator* it = m_db->NewIterator(opts, m_locks);
+    locks->clear();
+    *next = cursor;
+    *done = false;
+
+    if (cursor.empty())
+    {
+        it->Seek(lock_keys_begin());
+    }
+    else
+    {
+        it->Seek(cursor);
+
+        if (it->Valid() && it->key() == rocksdb::Slice(cursor))
+        {
+            it->Next();
+        }
+    }
+
+    for (uint64_t examined = 0; it->Valid() && examined < limit; ++examined, it->Next())
+    {
+        const rocksdb::Slice k(it->key());
+        const rocksdb::Slice v(it->value());
+        next->assign(k.data(), k.size());
+        e::slice table;
+        e::slice key;
+        locks->push_back(lock_item());
+        lock_item* li = &locks->back();
+
+        if (!decode_lock_key(k.data(), k.size(), &table, &key) ||
+            !decode_lock_value(v.data(), v.size(), &li->holders, &li->shared))
+        {
+            LOG(ERROR) << "skipping corrupt lock \"" << e::strescape(*next) << "\"";
+            locks->pop_back();
+            continue;
+        }
+
+        li->table = table.str();
+        li->key = key.str();
+    }
+
+    *done = !it->Valid();
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    if (!it->status().ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << it->status().ToString();
+        rc = CONSUS_SERVER_ERROR;
+        *done = false;
+    }
+
+    delete it;
+    return rc;
+}
+
+unsigned
+rocksdb_datalayer :: write_pressure()
+{
+    uint64_t stopped = 0;
+    uint64_t delayed = 0;
+
+    if (m_db->GetIntProperty(m_data, rocksdb::DB::Properties::kIsWriteStopped, &stopped) && stopped)
+    {
+        return 100;
+    }
+
+    // rocksdb is already throttling writes to let compaction catch up
+    if (m_db->GetIntProperty(m_data, rocksdb::DB::Properties::kActualDelayedWriteRate, &delayed) && delayed)
+    {
+        return 90;
+    }
+
+    std::string prop;
+    const int stop = m_db->GetOptions(m_data).level0_stop_writes_trigger;
+
+    if (stop <= 0 ||
+        !m_db->GetProperty(m_data, rocksdb::DB::Properties::kNumFilesAtLevelPrefix + "0", &prop))
+    {
+        return 0;
+    }
+
+    const unsigned long l0 = strtoul(prop.c_str(), NULL, 10);
+    return std::min(l0 * 100 / stop, 100UL);
+}
+
+void
+rocksdb_datalayer :: stats(storage_stats* st)
+{
+    rocksdb::ColumnFamilyMetaData meta;
+    m_db->GetColumnFamilyMetaData(m_data, &meta);
+    st->level_files.assign(meta.levels.size(), 0);
+    st->level_bytes.assign(meta.levels.size(), 0);
+
+    for (size_t i = 0; i < meta.levels.size(); ++i)
+    {
+        st->level_files[i] = meta.levels[i].files.size();
+        st->level_bytes[i] = meta.levels[i].size;
+    }
+
+    uint64_t pending = 0;
+    m_db->GetIntProperty(m_data, rocksdb::DB::Properties::kEstimatePendingCompactionBytes, &pending);
+    st->pending_compaction_bytes = pending;
+    st->stalls = e::atomic::load_64_nobarrier(&m_stalls);
+    st->stall_time = e::atomic::load_64_nobarrier(&m_stall_time);
+}
+
+void
+rocksdb_datalayer :: compact(uint16_t, uint16_t)
+{
+    // keys are ordered by table and key rather than by hash, so the
+    // partitions are spread over the whole key space
+    m_db->CompactRange(rocksdb::CompactRangeOptions(), m_data, NULL, NULL);
+}
+
+// gets use prefix seeks, which consult the bloom filters but cannot see past
+// the key they started on; scans need total order
+rocksdb::Iterator*
+rocksdb_datalayer :: data_iterator(bool total_order, const rocksdb::Snapshot* snap)
+{
+    rocksdb::ReadOptions opts;
+    opts.total_order_seek = total_order;
+    opts.prefix_same_as_start = !total_order;
+    opts.snapshot = snap;
+    return m_db->NewIterator(opts, m_data);
+}
+
+// concurrent writers are grouped into one log write (and sync) by rocksdb
+// itself
+consus_returncode
+rocksdb_datalayer :: write(rocksdb::ColumnFamilyHandle* cf,
+                           const std::string& k,
+                           const e::slice& v,
+                           bool sync)
+{
+    rocksdb::WriteOptions opts;
+    opts.sync = sync;
+    const uint64_t start = po6::monotonic_time();
+    rocksdb::Status st = m_db->Put(opts, cf, k, rocksdb::Slice(v.cdata(), v.size()));
+    const uint64_t elapsed = po6::monotonic_time() - start;
+
+    if (elapsed >= WRITE_STALL_THRESHOLD)
+    {
+        e::atomic::increment_64_nobarrier(&m_stalls, 1);
+        e::atomic::increment_64_nobarrier(&m_stall_time, elapsed);
+    }
+
+    if (!st.ok())
+    {
+        LOG(ERROR) << "rocksdb error: " << st.ToString();
+        return CONSUS_SERVER_ERROR;
+    }
+
+    return CONSUS_SUCCESS;
+}
@@ -0,0 +1,161 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_rocksdb_datalayer_h_
+#define consus_kvs_rocksdb_datalayer_h_
+
+// STL
+#include <vector>
+
+// RocksDB
+#include <rocksdb/db.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include <consus.h>
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Data and locks live in separate column families so that each can be tuned
+// (and compacted) on its own.  Old versions are garbage collected during
+// compaction rather than by explicit deletes.
+class rocksdb_datalayer : public datalayer
+{
+    public:
+        // with lazy_locks, lock changes are written without syncing the
+        // log, and reach the disk with the next synced write or checkpoint;
+        // shares is how many stores split the daemon's caches and open files
+        rocksdb_datalayer(bool lazy_locks, unsigned shares = 1);
+        virtual ~rocksdb_datalayer() throw ();
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode put_batch(const std::vector<raw_item>& items);
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual datalayer::snapshot* create_snapshot();
+        virtual consus_returncode raw_scan(const datalayer::snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        // records the watermark for the compaction filter and returns done
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned);
+        virtual consus_returncode erase_version(const e::slice& table,
+                                                const e::slice& key,
+                                                uint64_t timestamp);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared);
+        virtual consus_returncode checkpoint_locks();
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done);
+        virtual unsigned write_pressure();
+        virtual void stats(storage_stats* st);
+        virtual void compact(uint16_t first, uint16_t last);
+
+    private:
+        struct prefix;
+        struct pruner;
+        struct pruner_factory;
+        struct reference;
+        struct snapshot;
+
+    private:
+        rocksdb::Iterator* data_iterator(bool total_order,
+                                         const rocksdb::Snapshot* snap = NULL);
+        consus_returncode raw_scan(rocksdb::Iterator* it,
+                                   const std::string& cursor,
+                                   uint64_t limit,
+                                   std::vector<raw_item>* items,
+                                   std::string* next,
+                                   bool* done);
+        consus_returncode write(rocksdb::ColumnFamilyHandle* cf,
+                                const std::string& k,
+                                const e::slice& v,
+                                bool sync);
+
+    private:
+        const bool m_lazy_locks;
+        const unsigned m_shares;
+        uint64_t m_watermark;
+        uint64_t m_tombstones;
+        rocksdb::DB* m_db;
+        rocksdb::ColumnFamilyHandle* m_data;
+        rocksdb::ColumnFamilyHandle* m_locks;
+        // writes held up for WRITE_STALL_THRESHOLD or longer
+        uint64_t m_stalls;
+        uint64_t m_stall_time;
+
+    private:
+        rocksdb_datalayer(const rocksdb_datalayer&);
+        rocksdb_datalayer& operator = (const rocksdb_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_rocksdb_datalayer_h_
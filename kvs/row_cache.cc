@@ -0,0 +1,483 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <sstream>
+
+// e
+#include <e/serialization.h>
+
+// consus
+#include "common/hash.h"
+#include "kvs/row_cache.h"
+
+using consus::row_cache;
+
+// Independently locked partitions of the cache; a key's shard comes from its
+// hash.
+#define ROW_CACHE_SHARDS 64
+
+// Bookkeeping charged against the budget for every cached row, on top of the
+// bytes of its key and value.
+#define ROW_CACHE_ENTRY_OVERHEAD 96
+
+struct row_cache::entry
+{
+    entry();
+    ~entry() throw ();
+    uint64_t charge() const
+    { return key.size() + value.size() + ROW_CACHE_ENTRY_OVERHEAD; }
+
+    std::string key;
+    // zero with an empty value if the key has never been written
+    uint64_t timestamp;
+    // empty for a delete
+    std::string value;
+};
+
+row_cache :: entry :: entry()
+    : key()
+    , timestamp(0)
+    , value()
+{
+}
+
+row_cache :: entry :: ~entry() throw ()
+{
+}
+
+struct row_cache::shard
+{
+    typedef std::list<entry> lru_t;
+    typedef std::map<std::string, lru_t::iterator> index_t;
+
+    shard();
+    ~shard() throw ();
+    // on a miss, *newer says whether the key is cached at a version after
+    // timestamp_le
+    bool lookup(const std::string& key, uint64_t timestamp_le,
+                uint64_t* timestamp, std::string* value,
+                uint64_t* generation, bool* newer);
+    // caches the newest version as read from the backing store, unless some
+    // write to this shard happened after generation was taken and the read
+    // may have missed it
+    void fill(const std::string& key, uint64_t timestamp,
+              const e::slice& value, uint64_t generation, uint64_t budget);
+    // replaces the cached version if timestamp is newer; keys not already
+    // cached are left out
+    void update(const std::string& key, uint64_t timestamp,
+                const e::slice& value);
+    void evict(uint64_t budget);
+
+    po6::threads::mutex mtx;
+    // most recently used first
+    lru_t lru;
+    index_t index;
+    uint64_t bytes;
+    uint64_t generation;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    private:
+        shard(const shard&);
+        shard& operator = (const shard&);
+};
+
+row_cache :: shard :: shard()
+    : mtx()
+    , lru()
+    , index()
+    , bytes(0)
+    , generation(0)
+    , hits(0)
+    , misses(0)
+    , evictions(0)
+{
+}
+
+row_cache :: shard :: ~shard() throw ()
+{
+}
+
+bool
+row_cache :: shard :: lookup(const std::string& key, uint64_t timestamp_le,
+                             uint64_t* timestamp, std::string* value,
+                             uint64_t* gen, bool* newer)
+{
+    po6::threads::mutex::hold hold(&mtx);
+    index_t::iterator it = index.find(key);
+
+    if (it == index.end() || it->second->timestamp > timestamp_le)
+    {
+        ++misses;
+        *gen = generation;
+        *newer = it != index.end();
+        return false;
+    }
+
+    lru.splice(lru.begin(), lru, it->second);
+    *timestamp = it->second->timestamp;
+    *value = it->second->value;
+    ++hits;
+    return true;
+}
+
+void
+row_cache :: shard :: fill(const std::string& key, uint64_t timestamp,
+                           const e::slice& value, uint64_t gen, uint64_t budget)
+{
+    po6::threads::mutex::hold hold(&mtx);
+
+    if (gen != generation)
+    {
+        return;
+    }
+
+    index_t::iterator it = index.find(key);
+
+    if (it != index.end())
+    {
+        if (it->second->timestamp < timestamp)
+        {
+            bytes -= it->second->charge();
+            it->second->timestamp = timestamp;
+            it->second->value.assign(value.cdata(), value.size());
+            bytes += it->second->charge();
+        }
+
+        lru.splice(lru.begin(), lru, it->second);
+    }
+    else
+    {
+        lru.push_front(entry());
+        lru.front().key = key;
+        lru.front().timestamp = timestamp;
+        lru.front().value.assign(value.cdata(), value.size());
+        index[key] = lru.begin();
+        bytes += lru.front().charge();
+    }
+
+    evict(budget);
+}
+
+void
+row_cache :: shard :: update(const std::string& key, uint64_t timestamp,
+                             const e::slice& value)
+{
+    po6::threads::mutex::hold hold(&mtx);
+    ++generation;
+    index_t::iterator it = index.find(key);
+
+    if (it == index.end() || it->second->timestamp > timestamp)
+    {
+        return;
+    }
+
+    bytes -= it->second->charge();
+    it->second->timestamp = timestamp;
+    it->second->value.assign(value.cdata(), value.size());
+    bytes += it->second->charge();
+}
+
+void
+row_cache :: shard :: evict(uint64_t budget)
+{
+    while (bytes > budget && !lru.empty())
+    {
+        bytes -= lru.back().charge();
+        index.erase(lru.back().key);
+        lru.pop_back();
+        ++evictions;
+    }
+}
+
+struct row_cache::reference : public datalayer::reference
+{
+    reference();
+    virtual ~reference() throw ();
+
+    std::string value;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+row_cache :: reference :: reference()
+    : datalayer::reference()
+    , value()
+{
+}
+
+row_cache :: reference :: ~reference() throw ()
+{
+}
+
+static std::string
+cache_key(const e::slice& table, const e::slice& key)
+{
+    std::string k;
+    e::packer(&k) << table << key;
+    return k;
+}
+
+row_cache :: row_cache(datalayer* backing, uint64_t budget)
+    : m_backing(backing)
+    , m_shard_budget(budget / ROW_CACHE_SHARDS)
+    , m_shards(new shard[ROW_CACHE_SHARDS])
+{
+}
+
+row_cache :: ~row_cache() throw ()
+{
+    delete[] m_shards;
+}
+
+bool
+row_cache :: init(std::string data)
+{
+    return m_backing->init(data);
+}
+
+consus_returncode
+row_cache :: get(const e::slice& table,
+                 const e::slice& key,
+                 uint64_t timestamp_le,
+                 uint64_t* timestamp,
+                 e::slice* value,
+                 datalayer::reference** ref)
+{
+    shard* s = get_shard(table, key);
+    const std::string k(cache_key(table, key));
+    std::auto_ptr<reference> r(new reference());
+    uint64_t generation = 0;
+    bool newer = false;
+
+    if (s->lookup(k, timestamp_le, timestamp, &r->value, &generation, &newer))
+    {
+        const bool found = !r->value.empty();
+
+        if (value)
+        {
+            *value = e::slice(r->value);
+        }
+
+        *ref = r.release();
+        return found ? CONSUS_SUCCESS : CONSUS_NOT_FOUND;
+    }
+
+    // without the value there is nothing to fill the cache with, and with
+    // the newest version already cached there is nothing to fill it for
+    if (!value || newer)
+    {
+        return m_backing->get(table, key, timestamp_le, timestamp, value, ref);
+    }
+
+    // only the newest version may be cached, so that is what a miss reads
+    consus_returncode rc = m_backing->get(table, key, UINT64_MAX, timestamp, value, ref);
+
+    if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+    {
+        return rc;
+    }
+
+    s->fill(k, *timestamp, *value, generation, m_shard_budget);
+
+    if (*timestamp <= timestamp_le)
+    {
+        return rc;
+    }
+
+    delete *ref;
+    *ref = NULL;
+    return m_backing->get(table, key, timestamp_le, timestamp, value, ref);
+}
+
+consus_returncode
+row_cache :: scan(const e::slice& table,
+                  const e::slice& key,
+                  uint64_t timestamp_le,
+                  uint64_t limit,
+                  std::vector<scan_item>* items)
+{
+    return m_backing->scan(table, key, timestamp_le, limit, items);
+}
+
+consus_returncode
+row_cache :: put(const e::slice& table,
+                 const e::slice& key,
+                 uint64_t timestamp,
+                 const e::slice& value)
+{
+    consus_returncode rc = m_backing->put(table, key, timestamp, value);
+    return rc == CONSUS_SUCCESS ? update(table, key, timestamp, value) : rc;
+}
+
+consus_returncode
+row_cache :: del(const e::slice& table,
+                 const e::slice& key,
+                 uint64_t timestamp)
+{
+    consus_returncode rc = m_backing->del(table, key, timestamp);
+    return rc == CONSUS_SUCCESS ? update(table, key, timestamp, e::slice()) : rc;
+}
+
+consus_returncode
+row_cache :: raw_scan(const std::string& cursor,
+                      uint64_t limit,
+                      std::vector<raw_item>* items,
+                      std::string* next,
+                      bool* done)
+{
+    return m_backing->raw_scan(cursor, limit, items, next, done);
+}
+
+consus::datalayer::snapshot*
+row_cache :: create_snapshot()
+{
+    return m_backing->create_snapshot();
+}
+
+consus_returncode
+row_cache :: raw_scan(const datalayer::snapshot* snap,
+                      const std::string& cursor,
+                      uint64_t limit,
+                      std::vector<raw_item>* items,
+                      std::string* next,
+                      bool* done)
+{
+    return m_backing->raw_scan(snap, cursor, limit, items, next, done);
+}
+
+// pruning never removes the newest version of a key, unless it is a delete
+// that a cached copy answers identically
+consus_returncode
+row_cache :: prune(uint64_t watermark,
+                   uint64_t tombstones,
+                   const std::string& cursor,
+                   uint64_t limit,
+                   std::string* next,
+                   bool* done,
+                   uint64_t* pruned)
+{
+    return m_backing->prune(watermark, tombstones, cursor, limit, next, done, pruned);
+}
+
+consus_returncode
+row_cache :: read_lock(const e::slice& table,
+                       const e::slice& key,
+                       std::vector<transaction_group>* holders,
+                       bool* shared)
+{
+    return m_backing->read_lock(table, key, holders, shared);
+}
+
+consus_returncode
+row_cache :: write_lock(const e::slice& table,
+                        const e::slice& key,
+                        const std::vector<transaction_group>& holders,
+                        bool shared)
+{
+    return m_backing->write_lock(table, key, holders, shared);
+}
+
+consus_returncode
+row_cache :: checkpoint_locks()
+{
+    return m_backing->checkpoint_locks();
+}
+
+consus_returncode
+row_cache :: scan_locks(const std::string& cursor,
+                       uint64_t limit,
+                       std::vector<lock_item>* locks,
+                       std::string* next,
+                       bool* done)
+{
+    return m_backing->scan_locks(cursor, limit, locks, next, done);
+}
+
+unsigned
+row_cache :: write_pressure()
+{
+    return m_backing->write_pressure();
+}
+
+void
+row_cache :: stats(storage_stats* st)
+{
+    m_backing->stats(st);
+}
+
+std::string
+row_cache :: debug_dump()
+{
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    for (size_t i = 0; i < ROW_CACHE_SHARDS; ++i)
+    {
+        po6::threads::mutex::hold hold(&m_shards[i].mtx);
+        entries += m_shards[i].index.size();
+        bytes += m_shards[i].bytes;
+        hits += m_shards[i].hits;
+        misses += m_shards[i].misses;
+        evictions += m_shards[i].evictions;
+    }
+
+    std::ostringstream ostr;
+    ostr << "row cache entries=" << entries
+         << " bytes=" << bytes
+         << " budget=" << m_shard_budget * ROW_CACHE_SHARDS
+         << " hits=" << hits
+         << " misses=" << misses
+         << " evictions=" << evictions
+         << " hit_rate=" << (hits + misses ? 100. * hits / (hits + misses) : 0.) << "%";
+    return ostr.str();
+}
+
+row_cache::shard*
+row_cache :: get_shard(const e::slice& table, const e::slice& key)
+{
+    return &m_shards[hash64(table, key) % ROW_CACHE_SHARDS];
+}
+
+consus_returncode
+row_cache :: update(const e::slice& table,
+                    const e::slice& key,
+                    uint64_t timestamp,
+                    const e::slice& value)
+{
+    get_shard(table, key)->update(cache_key(table, key), timestamp, value);
+    return CONSUS_SUCCESS;
+}
@@ -0,0 +1,381 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <algorithm>
+
+// Google Log
+#include <glog/logging.h>
+
+// e
+#include <e/strescape.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/constants.h"
+#include "common/consus.h"
+#include "common/network_msgtype.h"
+#include "kvs/daemon.h"
+#include "kvs/scan_replicator.h"
+
+using consus::scan_replicator;
+
+extern bool s_debug_mode;
+
+struct scan_replicator :: scan_stub
+{
+    scan_stub(comm_id t);
+    ~scan_stub() throw () {}
+
+    comm_id target;
+    bool done;
+    uint64_t last_request_time;
+    unsigned requests;
+};
+
+scan_replicator :: scan_stub :: scan_stub(comm_id t)
+    : target(t)
+    , done(false)
+    , last_request_time(0)
+    , requests(0)
+{
+}
+
+scan_replicator :: scan_replicator(uint64_t key)
+    : m_state_key(key)
+    , m_mtx()
+    , m_init(false)
+    , m_finished(false)
+    , m_id()
+    , m_nonce()
+    , m_table()
+    , m_key()
+    , m_limit(0)
+    , m_backing()
+    , m_requests()
+    , m_versions()
+    , m_truncated(false)
+    , m_horizon()
+{
+}
+
+scan_replicator :: ~scan_replicator() throw ()
+{
+}
+
+uint64_t
+scan_replicator :: state_key()
+{
+    return m_state_key;
+}
+
+bool
+scan_replicator :: finished()
+{
+    return !m_init || m_finished;
+}
+
+void
+scan_replicator :: init(comm_id id, uint64_t nonce,
+                        const e::slice& table, const e::slice& key,
+                        uint64_t limit,
+                        std::auto_ptr<e::buffer> backing)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    assert(!m_init);
+    m_id = id;
+    m_nonce = nonce;
+    m_table = table;
+    m_key = key;
+    m_limit = std::max(uint64_t(1), std::min(limit, uint64_t(CONSUS_MAX_SCAN_LIMIT)));
+    m_backing = backing;
+    m_init = true;
+
+    if (s_debug_mode)
+    {
+        LOG(INFO) << logid() << " scan(\""
+                  << e::strescape(table.str()) << "\", \""
+                  << e::strescape(key.str()) << "\", " << m_limit << ")";
+    }
+}
+
+void
+scan_replicator :: response(comm_id id, consus_returncode rc,
+                            uint64_t items_sz, e::unpacker up,
+                            daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_init || m_finished)
+    {
+        return;
+    }
+
+    scan_stub* stub = get_stub(id);
+
+    if (!stub || stub->done)
+    {
+        if (s_debug_mode)
+        {
+            LOG(INFO) << logid() << " dropped response; no outstanding request to " << id;
+        }
+
+        return;
+    }
+
+    if (stub->requests == 1)
+    {
+        d->observe_rtt(id, po6::monotonic_time() - stub->last_request_time);
+    }
+
+    stub->requests = 0;
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " response rc=" << rc << " from=" << id;
+        return;
+    }
+
+    std::vector<std::pair<std::string, version> > items;
+
+    for (uint64_t i = 0; i < items_sz && !up.error(); ++i)
+    {
+        e::slice key;
+        e::slice value;
+        items.push_back(std::make_pair(std::string(), version()));
+        up = up >> key >> items.back().second.timestamp >> value;
+        items.back().first = key.str();
+        items.back().second.value = value.str();
+    }
+
+    if (up.error() || items.size() > m_limit)
+    {
+        LOG(WARNING) << logid() << " dropped corrupt response from " << id;
+        return;
+    }
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        version* v = &m_versions[items[i].first];
+
+        if (v->timestamp == 0 || items[i].second.timestamp > v->timestamp)
+        {
+            *v = items[i].second;
+        }
+    }
+
+    if (items.size() == m_limit &&
+        (!m_truncated || items.back().first < m_horizon))
+    {
+        m_truncated = true;
+        m_horizon = items.back().first;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << " response items=" << items.size() << " from=" << id;
+    stub->done = true;
+    work_state_machine(d);
+}
+
+void
+scan_replicator :: externally_work_state_machine(daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_init || m_finished)
+    {
+        return;
+    }
+
+    work_state_machine(d);
+}
+
+std::string
+scan_replicator :: debug_dump()
+{
+    return "XXX"; // XXX
+}
+
+std::string
+scan_replicator :: logid()
+{
+    return daemon::logid(m_table, m_key) + "-S-REP";
+}
+
+scan_replicator::scan_stub*
+scan_replicator :: get_stub(comm_id id)
+{
+    for (size_t j = 0; j < m_requests.size(); ++j)
+    {
+        if (m_requests[j].target == id)
+        {
+            return &m_requests[j];
+        }
+    }
+
+    return NULL;
+}
+
+void
+scan_replicator :: work_state_machine(daemon* d)
+{
+    assert(m_init);
+    configuration* c = d->get_config();
+    std::vector<comm_id> ids = c->ids();
+    const uint64_t now = po6::monotonic_time();
+    bool complete = true;
+
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (c->get_data_center(ids[i]) != d->m_us.dc)
+        {
+            continue;
+        }
+
+        scan_stub* stub = get_stub(ids[i]);
+
+        if (!stub)
+        {
+            m_requests.push_back(scan_stub(ids[i]));
+            stub = &m_requests.back();
+        }
+
+        if (stub->done)
+        {
+            continue;
+        }
+
+        complete = false;
+
+        if (stub->last_request_time + d->resend_interval(stub->target) < now)
+        {
+            send_scan_request(stub, now, d);
+        }
+    }
+
+    if (complete)
+    {
+        m_finished = true;
+        send_response(d);
+    }
+}
+
+void
+scan_replicator :: send_scan_request(scan_stub* stub, uint64_t now, daemon* d)
+{
+    if (s_debug_mode)
+    {
+        LOG(INFO) << logid() << " sending target=" << stub->target;
+    }
+
+    const table_ref tr(d->m_table_ids.intern(m_table));
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_RAW_SCAN)
+                    + sizeof(uint64_t)
+                    + pack_size(tr)
+                    + pack_size(m_key)
+                    + 2 * sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_RAW_SCAN << m_state_key << tr << m_key
+        << uint64_t(UINT64_MAX) << m_limit;
+    d->send(stub->target, msg);
+    stub->last_request_time = now;
+    ++stub->requests;
+}
+
+void
+scan_replicator :: send_response(daemon* d)
+{
+    // Everything up to the horizon was seen by every store that holds it.
+    // The caller resumes after "last", which is the horizon unless the live
+    // keys filled the limit first.
+    std::vector<version_map_t::iterator> live;
+    version_map_t::iterator it;
+
+    for (it = m_versions.begin(); it != m_versions.end() && live.size() < m_limit; ++it)
+    {
+        if (m_truncated && it->first > m_horizon)
+        {
+            break;
+        }
+
+        if (!it->second.value.empty())
+        {
+            live.push_back(it);
+        }
+    }
+
+    uint8_t done = 1;
+    e::slice last;
+
+    if (live.size() == m_limit)
+    {
+        done = 0;
+        last = e::slice(live.back()->first);
+    }
+    else if (m_truncated)
+    {
+        done = 0;
+        last = e::slice(m_horizon);
+    }
+
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(KVS_REP_SCAN_RESP)
+              + sizeof(uint64_t)
+              + pack_size(CONSUS_SUCCESS)
+              + sizeof(uint8_t)
+              + pack_size(last)
+              + sizeof(uint64_t);
+
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        sz += pack_size(e::slice(live[i]->first))
+            + sizeof(uint64_t)
+            + pack_size(e::slice(live[i]->second.value));
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_REP_SCAN_RESP << m_nonce << CONSUS_SUCCESS
+        << done << last << uint64_t(live.size());
+
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        pa = pa << e::slice(live[i]->first)
+                << live[i]->second.timestamp
+                << e::slice(live[i]->second.value);
+    }
+
+    d->send(m_id, msg);
+    LOG_IF(INFO, s_debug_mode) << "sending scan response items=" << live.size()
+                               << " done=" << unsigned(done)
+                               << " nonce=" << m_nonce << " to " << m_id;
+}
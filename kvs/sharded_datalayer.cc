@@ -0,0 +1,1031 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <dirent.h>
+#include <errno.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// Google Log
+#include <glog/logging.h>
+
+// po6
+#include <po6/path.h>
+#include <po6/threads/thread.h>
+
+// consus
+#include "common/constants.h"
+#include "common/hash.h"
+#include "kvs/configuration.h"
+#include "kvs/leveldb_datalayer.h"
+#include "kvs/replica_set.h"
+#include "kvs/sharded_datalayer.h"
+#ifdef CONSUS_ROCKSDB
+#include "kvs/rocksdb_datalayer.h"
+#endif
+
+using consus::sharded_datalayer;
+
+// Bytes of a cursor that name its shard, most significant first.
+#define SHARD_CURSOR_PREFIX 2
+// Versions read per step while warming a shard.
+#define WARM_STEP 1024
+
+namespace
+{
+
+int
+remove_entry(const char* path, const struct stat*, int, struct FTW*)
+{
+    if (remove(path) < 0)
+    {
+        PLOG(ERROR) << "could not remove " << path;
+    }
+
+    return 0;
+}
+
+void
+remove_tree(const std::string& path)
+{
+    nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+bool
+compare_scan_items(const consus::datalayer::scan_item& lhs,
+                   const consus::datalayer::scan_item& rhs)
+{
+    return lhs.key < rhs.key;
+}
+
+} // namespace
+
+struct sharded_datalayer::store
+{
+    store(datalayer* data, const std::string& dir);
+    ~store() throw ();
+
+    datalayer* const data;
+    const std::string dir;
+    // set once the store has been replaced; the last user removes its files
+    bool dropped;
+
+    private:
+        store(const store&);
+        store& operator = (const store&);
+};
+
+sharded_datalayer :: store :: store(datalayer* _data, const std::string& _dir)
+    : data(_data)
+    , dir(_dir)
+    , dropped(false)
+{
+}
+
+sharded_datalayer :: store :: ~store() throw ()
+{
+    delete data;
+
+    if (dropped)
+    {
+        remove_tree(dir);
+    }
+}
+
+struct sharded_datalayer::shard
+{
+    shard();
+    ~shard() throw ();
+
+    po6::threads::mutex mtx;
+    store_ptr current;
+    uint64_t generation;
+    // nothing has been written since the store was created empty
+    bool clean;
+    uint64_t drops;
+
+    private:
+        shard(const shard&);
+        shard& operator = (const shard&);
+};
+
+sharded_datalayer :: shard :: shard()
+    : mtx()
+    , current()
+    , generation(0)
+    , clean(false)
+    , drops(0)
+{
+}
+
+sharded_datalayer :: shard :: ~shard() throw ()
+{
+}
+
+struct sharded_datalayer::reference : public datalayer::reference
+{
+    reference(const store_ptr& s, datalayer::reference* ref);
+    virtual ~reference() throw ();
+
+    store_ptr s;
+    datalayer::reference* ref;
+
+    private:
+        reference(const reference&);
+        reference& operator = (const reference&);
+};
+
+sharded_datalayer :: reference :: reference(const store_ptr& _s, datalayer::reference* _ref)
+    : datalayer::reference()
+    , s(_s)
+    , ref(_ref)
+{
+}
+
+sharded_datalayer :: reference :: ~reference() throw ()
+{
+    // the child reference must go before the store that made it
+    delete ref;
+    ref = NULL;
+}
+
+struct sharded_datalayer::snapshot : public datalayer::snapshot
+{
+    snapshot();
+    virtual ~snapshot() throw ();
+
+    std::vector<store_ptr> stores;
+    std::vector<datalayer::snapshot*> snaps;
+
+    private:
+        snapshot(const snapshot&);
+        snapshot& operator = (const snapshot&);
+};
+
+sharded_datalayer :: snapshot :: snapshot()
+    : datalayer::snapshot()
+    , stores()
+    , snaps()
+{
+}
+
+sharded_datalayer :: snapshot :: ~snapshot() throw ()
+{
+    for (size_t i = 0; i < snaps.size(); ++i)
+    {
+        delete snaps[i];
+    }
+
+    snaps.clear();
+}
+
+// Shards left to warm, hottest first, handed out to the warming threads.
+struct sharded_datalayer::warmer
+{
+    warmer(uint64_t budget);
+    ~warmer() throw ();
+
+    po6::threads::mutex mtx;
+    std::vector<unsigned> shards;
+    size_t next;
+    uint64_t read;
+    const uint64_t budget;
+
+    private:
+        warmer(const warmer&);
+        warmer& operator = (const warmer&);
+};
+
+sharded_datalayer :: warmer :: warmer(uint64_t _budget)
+    : mtx()
+    , shards()
+    , next(0)
+    , read(0)
+    , budget(_budget)
+{
+}
+
+sharded_datalayer :: warmer :: ~warmer() throw ()
+{
+}
+
+sharded_datalayer :: sharded_datalayer(unsigned shards, bool use_rocksdb, bool lazy_locks)
+    : m_shards_sz(shards)
+    , m_use_rocksdb(use_rocksdb)
+    , m_lazy_locks(lazy_locks)
+    , m_data()
+    , m_shards(new shard[shards])
+{
+    assert(shards > 0 && shards <= CONSUS_KVS_PARTITIONS);
+    assert((shards & (shards - 1)) == 0);
+}
+
+sharded_datalayer :: ~sharded_datalayer() throw ()
+{
+    delete[] m_shards;
+}
+
+bool
+sharded_datalayer :: init(std::string data)
+{
+    std::ostringstream ostr;
+    ostr << "shards-" << m_shards_sz;
+    const std::string layout(ostr.str());
+    m_data = po6::path::join(data, layout);
+    std::vector<uint64_t> newest(m_shards_sz, 0);
+    std::vector<bool> found(m_shards_sz, false);
+    std::vector<std::string> stale;
+    DIR* dir = opendir(data.c_str());
+
+    if (!dir)
+    {
+        PLOG(ERROR) << "could not open " << data;
+        return false;
+    }
+
+    // data written under any other layout would be silently stranded
+    while (struct dirent* ent = readdir(dir))
+    {
+        const std::string name(ent->d_name);
+
+        if (name == "leveldb" || name == "rocksdb" ||
+            (name.compare(0, 7, "shards-") == 0 && name != layout))
+        {
+            LOG(ERROR) << data << " holds a store made with a different --data-shards ("
+                       << name << "); move it aside or restart with the same setting";
+            closedir(dir);
+            return false;
+        }
+    }
+
+    closedir(dir);
+
+    if (mkdir(m_data.c_str(), S_IRWXU) < 0 && errno != EEXIST)
+    {
+        PLOG(ERROR) << "could not create " << m_data;
+        return false;
+    }
+
+    dir = opendir(m_data.c_str());
+
+    if (!dir)
+    {
+        PLOG(ERROR) << "could not open " << m_data;
+        return false;
+    }
+
+    std::vector<std::pair<unsigned, uint64_t> > entries;
+
+    while (struct dirent* ent = readdir(dir))
+    {
+        unsigned idx;
+        unsigned long long generation;
+        char trailing;
+
+        if (sscanf(ent->d_name, "%u.%llu%c", &idx, &generation, &trailing) != 2 ||
+            idx >= m_shards_sz)
+        {
+            continue;
+        }
+
+        entries.push_back(std::make_pair(idx, uint64_t(generation)));
+
+        if (!found[idx] || newest[idx] < generation)
+        {
+            found[idx] = true;
+            newest[idx] = generation;
+        }
+    }
+
+    closedir(dir);
+
+    // a crash may leave behind stores that were dropped but not yet removed
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].second < newest[entries[i].first])
+        {
+            char name[64];
+            sprintf(name, "%04u.%llu", entries[i].first, (unsigned long long)entries[i].second);
+            remove_tree(po6::path::join(m_data, name));
+        }
+    }
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        store_ptr s = open_store(i, newest[i]);
+
+        if (!s)
+        {
+            return false;
+        }
+
+        po6::threads::mutex::hold hold(&m_shards[i].mtx);
+        m_shards[i].current = s;
+        m_shards[i].generation = newest[i];
+        m_shards[i].clean = !found[i];
+    }
+
+    return true;
+}
+
+consus_returncode
+sharded_datalayer :: get(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp_le,
+                         uint64_t* timestamp,
+                         e::slice* value,
+                         datalayer::reference** ref)
+{
+    store_ptr s = get_store(shard_of(table, key));
+    datalayer::reference* inner = NULL;
+    consus_returncode rc = s->data->get(table, key, timestamp_le, timestamp, value, &inner);
+    *ref = new reference(s, inner);
+    return rc;
+}
+
+consus_returncode
+sharded_datalayer :: scan(const e::slice& table,
+                          const e::slice& key,
+                          uint64_t timestamp_le,
+                          uint64_t limit,
+                          std::vector<scan_item>* items)
+{
+    // a table's keys are spread over every shard by their hash, so the first
+    // limit keys overall are among the first limit keys of each shard
+    items->clear();
+    std::vector<scan_item> part;
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        store_ptr s = get_store(i);
+        consus_returncode rc = s->data->scan(table, key, timestamp_le, limit, &part);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            return rc;
+        }
+
+        items->insert(items->end(), part.begin(), part.end());
+    }
+
+    std::sort(items->begin(), items->end(), compare_scan_items);
+
+    if (items->size() > limit)
+    {
+        items->resize(limit);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+sharded_datalayer :: put(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp,
+                         const e::slice& value)
+{
+    store_ptr s = get_store_for_write(shard_of(table, key));
+    return s->data->put(table, key, timestamp, value);
+}
+
+consus_returncode
+sharded_datalayer :: del(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp)
+{
+    store_ptr s = get_store_for_write(shard_of(table, key));
+    return s->data->del(table, key, timestamp);
+}
+
+consus_returncode
+sharded_datalayer :: put_batch(const std::vector<raw_item>& items)
+{
+    // one batch per shard, each synced once
+    std::vector<std::vector<raw_item> > per_shard(m_shards_sz);
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        per_shard[shard_of(e::slice(items[i].table), e::slice(items[i].key))].push_back(items[i]);
+    }
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        if (per_shard[i].empty())
+        {
+            continue;
+        }
+
+        store_ptr s = get_store_for_write(i);
+        consus_returncode rc = s->data->put_batch(per_shard[i]);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            return rc;
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+sharded_datalayer :: raw_scan(const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    unsigned idx;
+    std::string inner;
+
+    if (!parse_cursor(cursor, &idx, &inner))
+    {
+        return CONSUS_INVALID;
+    }
+
+    if (idx >= m_shards_sz)
+    {
+        items->clear();
+        *next = cursor;
+        *done = true;
+        return CONSUS_SUCCESS;
+    }
+
+    store_ptr s = get_store(idx);
+    std::string inner_next;
+    consus_returncode rc = s->data->raw_scan(inner, limit, items, &inner_next, done);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    if (*done && idx + 1 < m_shards_sz)
+    {
+        *next = shard_cursor(idx + 1, std::string());
+        *done = false;
+    }
+    else
+    {
+        *next = shard_cursor(idx, inner_next);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+uint64_t
+sharded_datalayer :: warm(const std::vector<uint16_t>& indices, uint64_t budget, unsigned threads)
+{
+    warmer w(budget);
+    std::vector<bool> seen(m_shards_sz, false);
+    const unsigned width = CONSUS_KVS_PARTITIONS / m_shards_sz;
+
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        const unsigned idx = indices[i] / width;
+
+        if (idx < m_shards_sz && !seen[idx])
+        {
+            seen[idx] = true;
+            w.shards.push_back(idx);
+        }
+    }
+
+    threads = std::max(1U, std::min(threads, unsigned(w.shards.size())));
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        using namespace po6::threads;
+        e::compat::shared_ptr<thread> t(new thread(make_obj_func(&sharded_datalayer::warm_shards, this, &w)));
+        ts.push_back(t);
+        t->start();
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+
+    return w.read;
+}
+
+void
+sharded_datalayer :: warm_shards(warmer* w)
+{
+    while (true)
+    {
+        unsigned idx;
+
+        {
+            po6::threads::mutex::hold hold(&w->mtx);
+
+            if (w->next >= w->shards.size() || w->read >= w->budget)
+            {
+                return;
+            }
+
+            idx = w->shards[w->next];
+            ++w->next;
+        }
+
+        // a plain scan fills the engine's block cache as it goes
+        store_ptr s = get_store(idx);
+        std::string cursor;
+        std::string next;
+        std::vector<raw_item> items;
+        bool done = false;
+
+        while (!done)
+        {
+            if (s->data->raw_scan(cursor, WARM_STEP, &items, &next, &done) != CONSUS_SUCCESS)
+            {
+                LOG(WARNING) << "could not warm data shard " << idx;
+                break;
+            }
+
+            uint64_t bytes = 0;
+
+            for (size_t i = 0; i < items.size(); ++i)
+            {
+                bytes += items[i].table.size() + items[i].key.size() + items[i].value.size();
+            }
+
+            cursor.swap(next);
+            po6::threads::mutex::hold hold(&w->mtx);
+            w->read += bytes;
+
+            if (w->read >= w->budget)
+            {
+                return;
+            }
+        }
+    }
+}
+
+consus::datalayer::snapshot*
+sharded_datalayer :: create_snapshot()
+{
+    std::auto_ptr<snapshot> snap(new snapshot());
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        store_ptr s = get_store(i);
+        snap->stores.push_back(s);
+        snap->snaps.push_back(s->data->create_snapshot());
+    }
+
+    return snap.release();
+}
+
+consus_returncode
+sharded_datalayer :: raw_scan(const datalayer::snapshot* _snap,
+                              const std::string& cursor,
+                              uint64_t limit,
+                              std::vector<raw_item>* items,
+                              std::string* next,
+                              bool* done)
+{
+    const snapshot* snap = static_cast<const snapshot*>(_snap);
+    unsigned idx;
+    std::string inner;
+
+    if (!parse_cursor(cursor, &idx, &inner))
+    {
+        return CONSUS_INVALID;
+    }
+
+    if (idx >= m_shards_sz)
+    {
+        items->clear();
+        *next = cursor;
+        *done = true;
+        return CONSUS_SUCCESS;
+    }
+
+    std::string inner_next;
+    consus_returncode rc = snap->stores[idx]->data->raw_scan(snap->snaps[idx], inner, limit, items, &inner_next, done);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    if (*done && idx + 1 < m_shards_sz)
+    {
+        *next = shard_cursor(idx + 1, std::string());
+        *done = false;
+    }
+    else
+    {
+        *next = shard_cursor(idx, inner_next);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+sharded_datalayer :: prune(uint64_t watermark,
+                           uint64_t tombstones,
+                           const std::string& cursor,
+                           uint64_t limit,
+                           std::string* next,
+                           bool* done,
+                           uint64_t* pruned)
+{
+    unsigned idx;
+    std::string inner;
+
+    if (!parse_cursor(cursor, &idx, &inner))
+    {
+        return CONSUS_INVALID;
+    }
+
+    if (idx >= m_shards_sz)
+    {
+        *next = cursor;
+        *done = true;
+        *pruned = 0;
+        return CONSUS_SUCCESS;
+    }
+
+    store_ptr s = get_store(idx);
+    std::string inner_next;
+    consus_returncode rc = s->data->prune(watermark, tombstones, inner, limit, &inner_next, done, pruned);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    if (*done && idx + 1 < m_shards_sz)
+    {
+        *next = shard_cursor(idx + 1, std::string());
+        *done = false;
+    }
+    else
+    {
+        *next = shard_cursor(idx, inner_next);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+sharded_datalayer :: erase_version(const e::slice& table,
+                                   const e::slice& key,
+                                   uint64_t timestamp)
+{
+    store_ptr s = get_store_for_write(shard_of(table, key));
+    return s->data->erase_version(table, key, timestamp);
+}
+
+consus_returncode
+sharded_datalayer :: read_lock(const e::slice& table,
+                               const e::slice& key,
+                               std::vector<transaction_group>* holders,
+                               bool* shared)
+{
+    store_ptr s = get_store(shard_of(table, key));
+    return s->data->read_lock(table, key, holders, shared);
+}
+
+consus_returncode
+sharded_datalayer :: write_lock(const e::slice& table,
+                                const e::slice& key,
+                                const std::vector<transaction_group>& holders,
+                                bool shared)
+{
+    store_ptr s = get_store_for_write(shard_of(table, key));
+    return s->data->write_lock(table, key, holders, shared);
+}
+
+consus_returncode
+sharded_datalayer :: checkpoint_locks()
+{
+    consus_returncode ret = CONSUS_SUCCESS;
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        store_ptr s = get_store(i);
+        consus_returncode rc = s->data->checkpoint_locks();
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            ret = rc;
+        }
+    }
+
+    return ret;
+}
+
+consus_returncode
+sharded_datalayer :: scan_locks(const std::string& cursor,
+                                uint64_t limit,
+                                std::vector<lock_item>* locks,
+                                std::string* next,
+                                bool* done)
+{
+    unsigned idx;
+    std::string inner;
+
+    if (!parse_cursor(cursor, &idx, &inner))
+    {
+        return CONSUS_INVALID;
+    }
+
+    if (idx >= m_shards_sz)
+    {
+        locks->clear();
+        *next = cursor;
+        *done = true;
+        return CONSUS_SUCCESS;
+    }
+
+    store_ptr s = get_store(idx);
+    std::string inner_next;
+    consus_returncode rc = s->data->scan_locks(inner, limit, locks, &inner_next, done);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    if (*done && idx + 1 < m_shards_sz)
+    {
+        *next = shard_cursor(idx + 1, std::string());
+        *done = false;
+    }
+    else
+    {
+        *next = shard_cursor(idx, inner_next);
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+unsigned
+sharded_datalayer :: write_pressure()
+{
+    // writes spread evenly over the shards, so the most backed up one is
+    // the one that stalls them
+    unsigned pressure = 0;
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        store_ptr s = get_store(i);
+        pressure = std::max(pressure, s->data->write_pressure());
+    }
+
+    return pressure;
+}
+
+void
+sharded_datalayer :: stats(storage_stats* st)
+{
+    *st = storage_stats();
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        store_ptr s = get_store(i);
+        storage_stats shard_st;
+        s->data->stats(&shard_st);
+        st->merge(shard_st);
+    }
+}
+
+void
+sharded_datalayer :: compact(uint16_t first, uint16_t last)
+{
+    const unsigned per_shard = CONSUS_KVS_PARTITIONS / m_shards_sz;
+
+    for (unsigned i = first / per_shard; i <= last / per_shard && i < m_shards_sz; ++i)
+    {
+        store_ptr s = get_store(i);
+        s->data->compact(0, UINT16_MAX);
+    }
+}
+
+void
+sharded_datalayer :: drop_unowned(configuration* c, data_center_id dc, comm_id us)
+{
+    const unsigned width = CONSUS_KVS_PARTITIONS / m_shards_sz;
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        {
+            po6::threads::mutex::hold hold(&m_shards[i].mtx);
+
+            if (m_shards[i].clean)
+            {
+                continue;
+            }
+        }
+
+        bool owned = false;
+
+        for (unsigned p = i * width; !owned && p < (i + 1) * width; ++p)
+        {
+            replica_set rs;
+
+            // without a replica set, assume the worst and keep the data
+            if (!c->replicas(dc, p, &rs))
+            {
+                owned = true;
+                break;
+            }
+
+            for (unsigned r = 0; r < rs.num_replicas; ++r)
+            {
+                if (rs.replicas[r] == us || rs.transitioning[r] == us)
+                {
+                    owned = true;
+                }
+            }
+        }
+
+        if (owned)
+        {
+            continue;
+        }
+
+        uint64_t generation;
+
+        {
+            po6::threads::mutex::hold hold(&m_shards[i].mtx);
+            generation = m_shards[i].generation + 1;
+        }
+
+        store_ptr s = open_store(i, generation);
+
+        if (!s)
+        {
+            LOG(ERROR) << "could not create a fresh store for data shard " << i
+                       << "; keeping the old one";
+            continue;
+        }
+
+        store_ptr old;
+
+        {
+            po6::threads::mutex::hold hold(&m_shards[i].mtx);
+            old = m_shards[i].current;
+            old->dropped = true;
+            m_shards[i].current = s;
+            m_shards[i].generation = generation;
+            m_shards[i].clean = true;
+            ++m_shards[i].drops;
+        }
+
+        LOG(INFO) << "dropping data shard " << i << " (partitions " << i * width
+                  << " through " << (i + 1) * width - 1 << "); this daemon no longer holds any of them";
+    }
+}
+
+std::string
+sharded_datalayer :: debug_dump()
+{
+    std::ostringstream ostr;
+    ostr << "data shards=" << m_shards_sz
+         << " partitions_per_shard=" << CONSUS_KVS_PARTITIONS / m_shards_sz;
+
+    for (unsigned i = 0; i < m_shards_sz; ++i)
+    {
+        po6::threads::mutex::hold hold(&m_shards[i].mtx);
+        ostr << "\nshard " << i
+             << " generation=" << m_shards[i].generation
+             << " clean=" << (m_shards[i].clean ? "yes" : "no")
+             << " drops=" << m_shards[i].drops
+             << " in_use=" << m_shards[i].current.use_count() - 1;
+    }
+
+    return ostr.str();
+}
+
+unsigned
+sharded_datalayer :: shard_of(const e::slice& table, const e::slice& key) const
+{
+    const uint16_t index = hash64(table, key) >> 48;
+    return index / (CONSUS_KVS_PARTITIONS / m_shards_sz);
+}
+
+sharded_datalayer::store_ptr
+sharded_datalayer :: get_store(unsigned idx)
+{
+    po6::threads::mutex::hold hold(&m_shards[idx].mtx);
+    return m_shards[idx].current;
+}
+
+sharded_datalayer::store_ptr
+sharded_datalayer :: get_store_for_write(unsigned idx)
+{
+    po6::threads::mutex::hold hold(&m_shards[idx].mtx);
+    m_shards[idx].clean = false;
+    return m_shards[idx].current;
+}
+
+sharded_datalayer::store_ptr
+sharded_datalayer :: open_store(unsigned idx, uint64_t generation)
+{
+    char name[64];
+    sprintf(name, "%04u.%llu", idx, (unsigned long long)generation);
+    const std::string dir(po6::path::join(m_data, name));
+
+    if (mkdir(dir.c_str(), S_IRWXU) < 0 && errno != EEXIST)
+    {
+        PLOG(ERROR) << "could not create " << dir;
+        return store_ptr();
+    }
+
+    std::auto_ptr<datalayer> data;
+
+    if (m_use_rocksdb)
+    {
+#ifdef CONSUS_ROCKSDB
+        data.reset(new rocksdb_datalayer(m_lazy_locks, m_shards_sz));
+#else
+        LOG(ERROR) << "this build does not include the rocksdb datalayer";
+        return store_ptr();
+#endif
+    }
+    else
+    {
+        data.reset(new leveldb_datalayer(m_lazy_locks, m_shards_sz));
+    }
+
+    if (!data->init(dir))
+    {
+        return store_ptr();
+    }
+
+    return store_ptr(new store(data.release(), dir));
+}
+
+std::string
+sharded_datalayer :: shard_cursor(unsigned idx, const std::string& cursor)
+{
+    std::string c(SHARD_CURSOR_PREFIX, '\0');
+    c[0] = char((idx >> 8) & 0xff);
+    c[1] = char(idx & 0xff);
+    return c + cursor;
+}
+
+bool
+sharded_datalayer :: parse_cursor(const std::string& cursor, unsigned* idx, std::string* inner) const
+{
+    if (cursor.empty())
+    {
+        *idx = 0;
+        inner->clear();
+        return true;
+    }
+
+    if (cursor.size() < SHARD_CURSOR_PREFIX)
+    {
+        return false;
+    }
+
+    *idx = (unsigned(uint8_t(cursor[0])) << 8) | unsigned(uint8_t(cursor[1]));
+    inner->assign(cursor, SHARD_CURSOR_PREFIX, std::string::npos);
+    return true;
+}
@@ -0,0 +1,172 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_kvs_sharded_datalayer_h_
+#define consus_kvs_sharded_datalayer_h_
+
+// STL
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/compat.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+class configuration;
+
+// Splits the store into one leveldb or rocksdb instance per group of
+// contiguous partitions, each in a directory of its own beneath the data
+// directory.  Every key lives in the store of its partition's group, so
+// compaction and write stalls stay within a group, and a group this daemon
+// no longer replicates is dropped by removing its files rather than by
+// deleting its keys one at a time.
+//
+// A dropped store is replaced by an empty one of the next generation.  Calls
+// and snapshots already in flight keep the old store alive; its directory is
+// removed once the last of them lets go.
+class sharded_datalayer : public datalayer
+{
+    public:
+        // shards must be a power of two no larger than CONSUS_KVS_PARTITIONS
+        sharded_datalayer(unsigned shards, bool use_rocksdb, bool lazy_locks);
+        virtual ~sharded_datalayer() throw ();
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode put_batch(const std::vector<raw_item>& items);
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual datalayer::snapshot* create_snapshot();
+        virtual consus_returncode raw_scan(const datalayer::snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned);
+        virtual consus_returncode erase_version(const e::slice& table,
+                                                const e::slice& key,
+                                                uint64_t timestamp);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared);
+        virtual consus_returncode checkpoint_locks();
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done);
+        virtual unsigned write_pressure();
+        virtual void stats(storage_stats* st);
+        virtual void compact(uint16_t first, uint16_t last);
+
+    public:
+        // drop every group of which us holds no partition in c
+        void drop_unowned(configuration* c, data_center_id dc, comm_id us);
+        // read through the groups holding the given ring indices, hottest
+        // first and with up to threads at once, so that their blocks are
+        // cached before any traffic arrives; stops after about budget bytes
+        // and returns how many were read
+        uint64_t warm(const std::vector<uint16_t>& indices, uint64_t budget, unsigned threads);
+        std::string debug_dump();
+
+    private:
+        struct store;
+        struct shard;
+        struct reference;
+        struct snapshot;
+        struct warmer;
+        typedef e::compat::shared_ptr<store> store_ptr;
+
+    private:
+        unsigned shard_of(const e::slice& table, const e::slice& key) const;
+        store_ptr get_store(unsigned idx);
+        // as get_store, for a call that may add data to the group
+        store_ptr get_store_for_write(unsigned idx);
+        store_ptr open_store(unsigned idx, uint64_t generation);
+        // cursors name the shard in their first two bytes, followed by the
+        // cursor of that shard's store
+        static std::string shard_cursor(unsigned idx, const std::string& cursor);
+        bool parse_cursor(const std::string& cursor, unsigned* idx, std::string* inner) const;
+        void warm_shards(warmer* w);
+
+    private:
+        const unsigned m_shards_sz;
+        const bool m_use_rocksdb;
+        const bool m_lazy_locks;
+        std::string m_data;
+        shard* m_shards;
+
+    private:
+        sharded_datalayer(const sharded_datalayer&);
+        sharded_datalayer& operator = (const sharded_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_sharded_datalayer_h_
@@ -0,0 +1,641 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// Google Log
+#include <glog/logging.h>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/path.h>
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "common/hash.h"
+#include "kvs/tiered_datalayer.h"
+
+using consus::tiered_datalayer;
+
+// writes and moves of keys that share a stripe are serialized
+#define TIER_STRIPES 1024
+
+struct tiered_datalayer::snapshot : public datalayer::snapshot
+{
+    snapshot(datalayer::snapshot* hot, datalayer::snapshot* cold);
+    virtual ~snapshot() throw ();
+
+    const std::auto_ptr<datalayer::snapshot> hot;
+    const std::auto_ptr<datalayer::snapshot> cold;
+
+    private:
+        snapshot(const snapshot&);
+        snapshot& operator = (const snapshot&);
+};
+
+tiered_datalayer :: snapshot :: snapshot(datalayer::snapshot* h, datalayer::snapshot* c)
+    : hot(h)
+    , cold(c)
+{
+}
+
+tiered_datalayer :: snapshot :: ~snapshot() throw ()
+{
+}
+
+static std::string
+marker(const std::string& data)
+{
+    return po6::path::join(data, "TIERED");
+}
+
+tiered_datalayer :: tiered_datalayer(datalayer* hot, datalayer* cold,
+                                     const std::string& cold_dir, uint64_t cold_age)
+    : m_hot(hot)
+    , m_cold(cold)
+    , m_cold_dir(cold_dir)
+    , m_cold_age(cold_age)
+    , m_stripes(new po6::threads::mutex[TIER_STRIPES])
+    , m_cold_reads(0)
+    , m_demoted(0)
+    , m_promoted(0)
+{
+}
+
+tiered_datalayer :: ~tiered_datalayer() throw ()
+{
+    delete[] m_stripes;
+}
+
+bool
+tiered_datalayer :: recorded_cold_dir(const std::string& data, std::string* cold_dir)
+{
+    const std::string path(marker(data));
+    po6::io::fd fd(open(path.c_str(), O_RDONLY));
+    struct stat st;
+
+    if (fd.get() < 0 || fstat(fd.get(), &st) < 0 || st.st_size <= 0)
+    {
+        return false;
+    }
+
+    std::vector<char> buf(st.st_size);
+
+    if (fd.xread(&buf[0], buf.size()) != ssize_t(buf.size()))
+    {
+        return false;
+    }
+
+    cold_dir->assign(&buf[0], buf.size());
+    return true;
+}
+
+bool
+tiered_datalayer :: init(std::string data)
+{
+    if (!m_hot->init(data))
+    {
+        return false;
+    }
+
+    std::string recorded;
+
+    if (recorded_cold_dir(data, &recorded) && recorded != m_cold_dir)
+    {
+        LOG(ERROR) << "cold versions of " << data << " live in " << recorded
+                   << ", not " << m_cold_dir;
+        return false;
+    }
+
+    if (mkdir(m_cold_dir.c_str(), S_IRWXU) < 0 && errno != EEXIST)
+    {
+        PLOG(ERROR) << "could not create " << m_cold_dir;
+        return false;
+    }
+
+    if (!m_cold->init(m_cold_dir))
+    {
+        return false;
+    }
+
+    if (!recorded.empty())
+    {
+        return true;
+    }
+
+    // once a key has moved, the store can never again be read without the
+    // cold directory
+    const std::string path(marker(data));
+    const std::string tmp(path + ".tmp");
+    po6::io::fd fd(open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    if (fd.get() < 0 ||
+        fd.xwrite(m_cold_dir.data(), m_cold_dir.size()) != ssize_t(m_cold_dir.size()) ||
+        fsync(fd.get()) < 0 ||
+        rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        PLOG(ERROR) << "could not record the cold directory in " << path;
+        return false;
+    }
+
+    return true;
+}
+
+consus_returncode
+tiered_datalayer :: get(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp_le,
+                        uint64_t* timestamp,
+                        e::slice* value,
+                        datalayer::reference** ref)
+{
+    consus_returncode rc = m_hot->get(table, key, timestamp_le, timestamp, value, ref);
+
+    // a hot key has every one of its versions in the hot store, so anything
+    // but a clean miss is the answer
+    if (rc != CONSUS_NOT_FOUND || *timestamp != 0)
+    {
+        return rc;
+    }
+
+    if (*ref)
+    {
+        delete *ref;
+        *ref = NULL;
+    }
+
+    rc = m_cold->get(table, key, timestamp_le, timestamp, value, ref);
+
+    if (*timestamp != 0)
+    {
+        e::atomic::increment_64_nobarrier(&m_cold_reads, 1);
+    }
+
+    return rc;
+}
+
+consus_returncode
+tiered_datalayer :: scan(const e::slice& table,
+                         const e::slice& key,
+                         uint64_t timestamp_le,
+                         uint64_t limit,
+                         std::vector<scan_item>* items)
+{
+    std::vector<scan_item> hot;
+    std::vector<scan_item> cold;
+    consus_returncode rc = m_hot->scan(table, key, timestamp_le, limit, &hot);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    rc = m_cold->scan(table, key, timestamp_le, limit, &cold);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    // each list holds the first keys of its own store, so the first limit
+    // keys of both are the first limit keys overall; a key in both is one
+    // caught moving, and its newer version wins
+    items->clear();
+    size_t h = 0;
+    size_t c = 0;
+
+    while (items->size() < limit && (h < hot.size() || c < cold.size()))
+    {
+        if (c == cold.size() ||
+            (h < hot.size() && hot[h].key < cold[c].key))
+        {
+            items->push_back(scan_item());
+            std::swap(items->back(), hot[h]);
+            ++h;
+        }
+        else if (h == hot.size() || cold[c].key < hot[h].key)
+        {
+            items->push_back(scan_item());
+            std::swap(items->back(), cold[c]);
+            ++c;
+        }
+        else
+        {
+            items->push_back(scan_item());
+            std::swap(items->back(), hot[h].timestamp >= cold[c].timestamp ? hot[h] : cold[c]);
+            ++h;
+            ++c;
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+tiered_datalayer :: put(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp,
+                        const e::slice& value)
+{
+    po6::threads::mutex::hold hold(stripe(table, key));
+    consus_returncode rc = promote(table, key);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    return m_hot->put(table, key, timestamp, value);
+}
+
+consus_returncode
+tiered_datalayer :: del(const e::slice& table,
+                        const e::slice& key,
+                        uint64_t timestamp)
+{
+    po6::threads::mutex::hold hold(stripe(table, key));
+    consus_returncode rc = promote(table, key);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    return m_hot->del(table, key, timestamp);
+}
+
+consus_returncode
+tiered_datalayer :: raw_scan(const std::string& cursor,
+                             uint64_t limit,
+                             std::vector<raw_item>* items,
+                             std::string* next,
+                             bool* done)
+{
+    return raw_scan(NULL, NULL, cursor, limit, items, next, done);
+}
+
+consus::datalayer::snapshot*
+tiered_datalayer :: create_snapshot()
+{
+    std::auto_ptr<datalayer::snapshot> hot(m_hot->create_snapshot());
+    std::auto_ptr<datalayer::snapshot> cold(m_cold->create_snapshot());
+    return new snapshot(hot.release(), cold.release());
+}
+
+consus_returncode
+tiered_datalayer :: raw_scan(const datalayer::snapshot* _snap,
+                             const std::string& cursor,
+                             uint64_t limit,
+                             std::vector<raw_item>* items,
+                             std::string* next,
+                             bool* done)
+{
+    const snapshot* snap = static_cast<const snapshot*>(_snap);
+    return raw_scan(snap->hot.get(), snap->cold.get(), cursor, limit, items, next, done);
+}
+
+// Both prune and raw_scan cover the hot store and then the cold one; the
+// first byte of the cursor says which, and the rest belongs to that store.
+consus_returncode
+tiered_datalayer :: prune(uint64_t watermark,
+                          uint64_t tombstones,
+                          const std::string& cursor,
+                          uint64_t limit,
+                          std::string* next,
+                          bool* done,
+                          uint64_t* pruned)
+{
+    const bool cold = !cursor.empty() && cursor[0] == 'c';
+    const std::string inner(cursor.empty() ? cursor : cursor.substr(1));
+    datalayer* dl = cold ? m_cold.get() : m_hot.get();
+    std::string inner_next;
+    consus_returncode rc = dl->prune(watermark, tombstones, inner, limit, &inner_next, done, pruned);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    if (*done && !cold)
+    {
+        *next = "c";
+        *done = false;
+    }
+    else
+    {
+        *next = (cold ? "c" : "h") + inner_next;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+tiered_datalayer :: read_lock(const e::slice& table,
+                              const e::slice& key,
+                              std::vector<transaction_group>* holders,
+                              bool* shared)
+{
+    return m_hot->read_lock(table, key, holders, shared);
+}
+
+consus_returncode
+tiered_datalayer :: write_lock(const e::slice& table,
+                               const e::slice& key,
+                               const std::vector<transaction_group>& holders,
+                               bool shared)
+{
+    return m_hot->write_lock(table, key, holders, shared);
+}
+
+consus_returncode
+tiered_datalayer :: checkpoint_locks()
+{
+    return m_hot->checkpoint_locks();
+}
+
+consus_returncode
+tiered_datalayer :: scan_locks(const std::string& cursor,
+                               uint64_t limit,
+                               std::vector<lock_item>* locks,
+                               std::string* next,
+                               bool* done)
+{
+    return m_hot->scan_locks(cursor, limit, locks, next, done);
+}
+
+unsigned
+tiered_datalayer :: write_pressure()
+{
+    return m_hot->write_pressure();
+}
+
+void
+tiered_datalayer :: stats(storage_stats* st)
+{
+    m_hot->stats(st);
+}
+
+consus_returncode
+tiered_datalayer :: tier(uint64_t now,
+                         const std::string& cursor,
+                         uint64_t limit,
+                         std::string* next,
+                         bool* done,
+                         uint64_t* moved)
+{
+    std::vector<raw_item> items;
+    consus_returncode rc = m_hot->raw_scan(cursor, limit, &items, next, done);
+    *moved = 0;
+
+    if (rc != CONSUS_SUCCESS || now < m_cold_age)
+    {
+        return rc;
+    }
+
+    const uint64_t cold_before = now - m_cold_age;
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const raw_item& ri(items[i]);
+
+        // a key's versions are adjacent, and the first sighting moves them all
+        if (i > 0 && ri.table == items[i - 1].table && ri.key == items[i - 1].key)
+        {
+            continue;
+        }
+
+        const e::slice table(ri.table);
+        const e::slice key(ri.key);
+        po6::threads::mutex::hold hold(stripe(table, key));
+        uint64_t newest = 0;
+        datalayer::reference* ref = NULL;
+        rc = m_hot->get(table, key, UINT64_MAX, &newest, NULL, &ref);
+
+        if (ref)
+        {
+            delete ref;
+        }
+
+        if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+        {
+            break;
+        }
+
+        rc = CONSUS_SUCCESS;
+
+        // already moved, or written since the scan
+        if (newest == 0 || newest >= cold_before)
+        {
+            continue;
+        }
+
+        uint64_t copied = 0;
+        rc = copy_versions(m_hot.get(), m_cold.get(), table, key, &copied);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            break;
+        }
+
+        *moved += copied;
+    }
+
+    e::atomic::increment_64_nobarrier(&m_demoted, *moved);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        *next = cursor;
+        *done = false;
+    }
+
+    return rc;
+}
+
+std::string
+tiered_datalayer :: debug_dump()
+{
+    std::ostringstream ostr;
+    ostr << "cold_dir=" << m_cold_dir
+         << " cold_age=" << m_cold_age / PO6_SECONDS << "s"
+         << " cold_reads=" << e::atomic::load_64_nobarrier(&m_cold_reads)
+         << " demoted=" << e::atomic::load_64_nobarrier(&m_demoted)
+         << " promoted=" << e::atomic::load_64_nobarrier(&m_promoted);
+    return ostr.str();
+}
+
+consus_returncode
+tiered_datalayer :: copy_versions(datalayer* from, datalayer* to,
+                                  const e::slice& table,
+                                  const e::slice& key,
+                                  uint64_t* copied)
+{
+    std::vector<uint64_t> timestamps;
+    uint64_t timestamp_le = UINT64_MAX;
+    *copied = 0;
+
+    // newest first, so that the versions already copied always hold the
+    // newest version at or below any timestamp they can answer for
+    while (true)
+    {
+        uint64_t timestamp = 0;
+        e::slice value;
+        datalayer::reference* ref = NULL;
+        consus_returncode rc = from->get(table, key, timestamp_le, &timestamp, &value, &ref);
+
+        if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+        {
+            if (ref)
+            {
+                delete ref;
+            }
+
+            return rc;
+        }
+
+        if (timestamp == 0)
+        {
+            break;
+        }
+
+        const std::string v(value.cdata(), value.size());
+
+        if (ref)
+        {
+            delete ref;
+        }
+
+        rc = v.empty() ? to->del(table, key, timestamp)
+                       : to->put(table, key, timestamp, e::slice(v));
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            return rc;
+        }
+
+        timestamps.push_back(timestamp);
+        timestamp_le = timestamp - 1;
+    }
+
+    // oldest first, so that what's left behind is still a newest-first run
+    // that gives the same answers as the copy
+    for (size_t i = timestamps.size(); i > 0; --i)
+    {
+        consus_returncode rc = from->erase_version(table, key, timestamps[i - 1]);
+
+        if (rc != CONSUS_SUCCESS)
+        {
+            return rc;
+        }
+    }
+
+    *copied = timestamps.size();
+    return CONSUS_SUCCESS;
+}
+
+consus_returncode
+tiered_datalayer :: promote(const e::slice& table, const e::slice& key)
+{
+    uint64_t newest = 0;
+    datalayer::reference* ref = NULL;
+    consus_returncode rc = m_cold->get(table, key, UINT64_MAX, &newest, NULL, &ref);
+
+    if (ref)
+    {
+        delete ref;
+    }
+
+    if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+    {
+        return rc;
+    }
+
+    if (newest == 0)
+    {
+        return CONSUS_SUCCESS;
+    }
+
+    uint64_t copied = 0;
+    rc = copy_versions(m_cold.get(), m_hot.get(), table, key, &copied);
+    e::atomic::increment_64_nobarrier(&m_promoted, copied);
+    return rc;
+}
+
+consus_returncode
+tiered_datalayer :: raw_scan(const datalayer::snapshot* hot_snap,
+                             const datalayer::snapshot* cold_snap,
+                             const std::string& cursor,
+                             uint64_t limit,
+                             std::vector<raw_item>* items,
+                             std::string* next,
+                             bool* done)
+{
+    const bool cold = !cursor.empty() && cursor[0] == 'c';
+    const std::string inner(cursor.empty() ? cursor : cursor.substr(1));
+    datalayer* dl = cold ? m_cold.get() : m_hot.get();
+    const datalayer::snapshot* snap = cold ? cold_snap : hot_snap;
+    std::string inner_next;
+    consus_returncode rc = snap ? dl->raw_scan(snap, inner, limit, items, &inner_next, done)
+                                : dl->raw_scan(inner, limit, items, &inner_next, done);
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        return rc;
+    }
+
+    if (*done && !cold)
+    {
+        *next = "c";
+        *done = false;
+    }
+    else
+    {
+        *next = (cold ? "c" : "h") + inner_next;
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+po6::threads::mutex*
+tiered_datalayer :: stripe(const e::slice& table, const e::slice& key)
+{
+    return &m_stripes[hash64(table, key) % TIER_STRIPES];
+}
@@ -0,0 +1,175 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_kvs_tiered_datalayer_h_
+#define consus_kvs_tiered_datalayer_h_
+
+// STL
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "kvs/datalayer.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Keeps keys nobody has written for a long time in a second store, on a
+// cheaper disk than the one holding the rest.  Each key lives wholly in one
+// store or the other: tier moves a key into the cold store once every
+// version of it is older than the cold age, and the first write to a cold
+// key moves it back before the write lands.  Reads consult the cold store
+// only when the hot one has nothing at all for the key, which the hot
+// store's presence markers and bloom filters answer without touching the
+// disk, so reads of hot keys cost what they did before.
+//
+// Because no key spans both stores, each prunes its own keys exactly as if
+// it were the only store.  Versions are copied before they are erased from
+// where they came from, newest first, so a reader always finds the newest
+// version at or below its timestamp in one store or the other.
+class tiered_datalayer : public datalayer
+{
+    public:
+        // takes ownership of hot and cold; cold is opened in cold_dir, and
+        // keys move to it once untouched for cold_age nanoseconds
+        tiered_datalayer(datalayer* hot, datalayer* cold,
+                         const std::string& cold_dir, uint64_t cold_age);
+        virtual ~tiered_datalayer() throw ();
+
+    public:
+        // the cold directory a tiered store in data was last opened with,
+        // which must be used from then on
+        static bool recorded_cold_dir(const std::string& data, std::string* cold_dir);
+
+    public:
+        virtual bool init(std::string data);
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      datalayer::reference** ref);
+        virtual consus_returncode scan(const e::slice& table,
+                                       const e::slice& key,
+                                       uint64_t timestamp_le,
+                                       uint64_t limit,
+                                       std::vector<scan_item>* items);
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value);
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp);
+        virtual consus_returncode raw_scan(const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual datalayer::snapshot* create_snapshot();
+        virtual consus_returncode raw_scan(const datalayer::snapshot* snap,
+                                           const std::string& cursor,
+                                           uint64_t limit,
+                                           std::vector<raw_item>* items,
+                                           std::string* next,
+                                           bool* done);
+        virtual consus_returncode prune(uint64_t watermark,
+                                        uint64_t tombstones,
+                                        const std::string& cursor,
+                                        uint64_t limit,
+                                        std::string* next,
+                                        bool* done,
+                                        uint64_t* pruned);
+        virtual consus_returncode read_lock(const e::slice& table,
+                                            const e::slice& key,
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared);
+        virtual consus_returncode write_lock(const e::slice& table,
+                                             const e::slice& key,
+                                             const std::vector<transaction_group>& holders,
+                                             bool shared);
+        virtual consus_returncode checkpoint_locks();
+        virtual consus_returncode scan_locks(const std::string& cursor,
+                                             uint64_t limit,
+                                             std::vector<lock_item>* locks,
+                                             std::string* next,
+                                             bool* done);
+        virtual unsigned write_pressure();
+        virtual void stats(storage_stats* st);
+
+    public:
+        // move the keys untouched since before now - cold age among about
+        // limit hot versions after cursor, resuming as raw_scan does
+        consus_returncode tier(uint64_t now,
+                               const std::string& cursor,
+                               uint64_t limit,
+                               std::string* next,
+                               bool* done,
+                               uint64_t* moved);
+        std::string debug_dump();
+
+    private:
+        struct snapshot;
+
+    private:
+        // the caller holds the key's stripe
+        consus_returncode copy_versions(datalayer* from, datalayer* to,
+                                        const e::slice& table,
+                                        const e::slice& key,
+                                        uint64_t* copied);
+        consus_returncode promote(const e::slice& table, const e::slice& key);
+        consus_returncode raw_scan(const datalayer::snapshot* hot_snap,
+                                   const datalayer::snapshot* cold_snap,
+                                   const std::string& cursor,
+                                   uint64_t limit,
+                                   std::vector<raw_item>* items,
+                                   std::string* next,
+                                   bool* done);
+        po6::threads::mutex* stripe(const e::slice& table, const e::slice& key);
+
+    private:
+        const std::auto_ptr<datalayer> m_hot;
+        const std::auto_ptr<datalayer> m_cold;
+        const std::string m_cold_dir;
+        const uint64_t m_cold_age;
+        po6::threads::mutex* m_stripes;
+        uint64_t m_cold_reads;
+        uint64_t m_demoted;
+        uint64_t m_promoted;
+
+    private:
+        tiered_datalayer(const tiered_datalayer&);
+        tiered_datalayer& operator = (const tiered_datalayer&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_tiered_datalayer_h_
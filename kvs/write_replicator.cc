@@ -28,15 +28,22 @@
 // Google Log
 #include <glog/logging.h>
 
+// po6
+#include <po6/time.h>
+
 // e
+#include <e/atomic.h>
 #include <e/strescape.h>
 
 // BusyBee
 #include <busybee.h>
 
 // consus
+#include "common/buffer_pool.h"
+#include "common/constants.h"
 #include "common/consus.h"
 #include "common/network_msgtype.h"
+#include "common/tracer.h"
 #include "kvs/daemon.h"
 #include "kvs/write_replicator.h"
 
@@ -44,6 +51,11 @@ using consus::write_replicator;
 
 extern bool s_debug_mode;
 
+// memory all writes may hold while catching up replicas that missed their
+// quorum; a write past it stops at the quorum, and anti-entropy repairs the
+// replicas it left behind
+#define WRITE_CATCHUP_MAX_BYTES (256ULL * 1024ULL * 1024ULL)
+
 struct write_replicator :: write_stub
 {
     write_stub(comm_id t);
@@ -51,15 +63,19 @@ struct write_replicator :: write_stub
 
     comm_id target;
     uint64_t last_request_time;
+    unsigned requests;
     consus_returncode status;
     replica_set rs;
+    bool handed_off;
 };
 
 write_replicator :: write_stub :: write_stub(comm_id t)
     : target(t)
     , last_request_time(0)
+    , requests(0)
     , status(CONSUS_GARBAGE)
     , rs()
+    , handed_off(false)
 {
 }
 
@@ -67,7 +83,12 @@ write_replicator :: write_replicator(uint64_t key)
     : m_state_key(key)
     , m_mtx()
     , m_init(false)
+    , m_acked(false)
+    , m_acked_at(0)
+    , m_catchup_bytes(0)
     , m_finished(false)
+    , m_traced_since(0)
+    , m_started(0)
     , m_id()
     , m_nonce()
     , m_flags()
@@ -78,6 +99,7 @@ write_replicator :: write_replicator(uint64_t key)
     , m_backing()
     , m_requests()
 {
+    m_requests.reserve(CONSUS_MAX_REPLICATION_FACTOR);
 }
 
 write_replicator :: ~write_replicator() throw ()
@@ -114,6 +136,8 @@ write_replicator :: init(comm_id id, uint64_t nonce, unsigned flags,
     m_value = value;
     m_backing = msg;
     m_init = true;
+    m_traced_since = tracer::tagged(nonce) ? po6::wallclock_time() : 0;
+    m_started = po6::monotonic_time();
 
     if (s_debug_mode)
     {
@@ -143,6 +167,7 @@ void
 write_replicator :: response(comm_id id,
                              consus_returncode rc,
                              const replica_set& rs,
+                             bool handed_off,
                              daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
@@ -165,10 +190,20 @@ write_replicator :: response(comm_id id,
         return;
     }
 
-    if (stub->status == CONSUS_GARBAGE)
+    // Karn's rule:  only a request sent exactly once gives a clean sample
+    if (stub->requests == 1)
+    {
+        d->observe_rtt(id, po6::monotonic_time() - stub->last_request_time);
+    }
+
+    stub->requests = 0;
+
+    // a replica that shed the write or failed it may take the retry
+    if (stub->status == CONSUS_GARBAGE || !returncode_is_final(stub->status))
     {
         stub->status = rc;
         stub->rs = rs;
+        stub->handed_off = handed_off;
 
         if (s_debug_mode)
         {
@@ -205,6 +240,7 @@ write_replicator :: debug_dump()
     std::ostringstream ostr;
     po6::threads::mutex::hold hold(&m_mtx);
     ostr << "init=" << (m_init ? "yes" : "no") << "\n";
+    ostr << "acked=" << (m_acked ? "yes" : "no") << "\n";
     ostr << "finished=" << (m_finished ? "yes" : "no") << "\n";
     ostr << "request id=" << m_id << " nonce=" << m_nonce << "\n";
     ostr << "flags=" << m_flags << "\n";
@@ -221,6 +257,7 @@ write_replicator :: debug_dump()
              << " last_request_time=" << m_requests[i].last_request_time
              << " status=" << m_requests[i].status
              << " replica_set=" << m_requests[i].rs
+             << (m_requests[i].handed_off ? " handed_off" : "")
              << "\n";
     }
 
@@ -291,7 +328,15 @@ write_replicator :: work_state_machine(daemon* d)
 
         if (owner2)
         {
-            if (owner2->status == CONSUS_GARBAGE)
+            if (owner2->status == CONSUS_GARBAGE &&
+                owner1->status == CONSUS_SUCCESS && owner1->handed_off &&
+                replica_sets_agree(rs.replicas[i], owner1->rs, rs))
+            {
+                // the current owner journaled a hint for the next owner and
+                // will not finish the migration until the hint is delivered
+                rc = CONSUS_SUCCESS;
+            }
+            else if (owner2->status == CONSUS_GARBAGE)
             {
                 rc = CONSUS_GARBAGE;
             }
@@ -320,7 +365,7 @@ write_replicator :: work_state_machine(daemon* d)
         {
             ++complete_invalid;
         }
-        else if (owner1->last_request_time + d->resend_interval() < now)
+        else if (owner1->last_request_time + d->resend_interval(owner1->target) < now)
         {
             if (owner1 && !returncode_is_final(owner1->status))
             {
@@ -334,6 +379,27 @@ write_replicator :: work_state_machine(daemon* d)
         }
     }
 
+    if (m_acked)
+    {
+        // catching up the replicas that missed the quorum; stop once they
+        // all have it, if they disagree, or once the window closes
+        const unsigned sum = complete_success + complete_unknown + complete_invalid;
+
+        if (complete_success >= rs.num_replicas ||
+            sum != complete_success ||
+            m_acked_at + d->m_write_catchup < now)
+        {
+            LOG_IF(INFO, s_debug_mode && complete_success < rs.num_replicas)
+                << logid() << " abandoning catch-up with "
+                << rs.num_replicas - complete_success << " replicas behind";
+            e::atomic::increment_64_nobarrier(&d->m_write_catchup_bytes, -m_catchup_bytes);
+            m_catchup_bytes = 0;
+            m_finished = true;
+        }
+
+        return;
+    }
+
     bool short_write = false;
 
     if (rs.desired_replication > rs.num_replicas)
@@ -353,8 +419,8 @@ write_replicator :: work_state_machine(daemon* d)
     // quroum
     // if this proves problematic, we should revisit
     //
-    // also, this only writes a quorum, and {c,sh}ould be modified to write the
-    // remaining nodes after returning to the client.
+    // this answers once a quorum has the write; the remaining replicas are
+    // written afterward, for up to --write-catch-up
     if (sum > 0 && sum == complete_success && complete_success >= quorum)
     {
         status = !short_write ? CONSUS_SUCCESS : CONSUS_LESS_DURABLE;
@@ -379,13 +445,45 @@ write_replicator :: work_state_machine(daemon* d)
 
     if (status != CONSUS_GARBAGE)
     {
-        m_finished = true;
+        if (m_traced_since != 0)
+        {
+            d->m_tracer.span("write_replicator", m_nonce, m_traced_since, po6::wallclock_time());
+            m_traced_since = 0;
+        }
+
+        m_acked = true;
+        m_acked_at = now;
+        d->m_hot.replicated("write", m_table, m_key, now - m_started);
+        d->m_tables.record(m_table, table_stats::REPLICATED_WRITES, 1);
+        d->m_tables.record(m_table, table_stats::REPLICATED_WRITE_NANOS, now - m_started);
+        m_finished = (status != CONSUS_SUCCESS && status != CONSUS_LESS_DURABLE) ||
+                     complete_success >= rs.num_replicas ||
+                     d->m_write_catchup == 0;
+
+        if (!m_finished)
+        {
+            const uint64_t sz = m_backing.get() ? m_backing->size() : 0;
+
+            if (e::atomic::increment_64_nobarrier(&d->m_write_catchup_bytes, sz) > WRITE_CATCHUP_MAX_BYTES)
+            {
+                e::atomic::increment_64_nobarrier(&d->m_write_catchup_bytes, -sz);
+                LOG_EVERY_N(WARNING, 1000) << "write catch-up is holding more than "
+                                           << WRITE_CATCHUP_MAX_BYTES << " bytes; "
+                                           << "leaving replicas that missed the quorum to anti-entropy";
+                m_finished = true;
+            }
+            else
+            {
+                m_catchup_bytes = sz;
+            }
+        }
         const size_t sz = BUSYBEE_HEADER_SIZE
                         + pack_size(KVS_REP_WR_RESP)
                         + sizeof(uint64_t)
-                        + pack_size(status);
-        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_REP_WR_RESP << m_nonce << status;
+                        + pack_size(status)
+                        + sizeof(uint8_t);
+        std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE) << KVS_REP_WR_RESP << m_nonce << status << d->load();
         d->send(m_id, msg);
 
         if (s_debug_mode)
@@ -408,6 +506,8 @@ write_replicator :: returncode_is_final(consus_returncode rc)
         case CONSUS_NOT_FOUND:
         case CONSUS_ABORTED:
         case CONSUS_COMMITTED:
+        case CONSUS_SCAN_DONE:
+        case CONSUS_COMPARE_FAILED:
         case CONSUS_NONE_PENDING:
         case CONSUS_TIMEOUT:
         case CONSUS_INTERRUPTED:
@@ -431,17 +531,19 @@ write_replicator :: send_write_request(write_stub* stub, uint64_t now, daemon* d
     }
 
     assert(!returncode_is_final(stub->status));
+    const table_ref tr(d->m_table_ids.intern(m_table));
     const size_t sz = BUSYBEE_HEADER_SIZE
                     + pack_size(KVS_RAW_WR)
                     + sizeof(uint64_t)
                     + sizeof(uint8_t)
-                    + pack_size(m_table)
+                    + pack_size(tr)
                     + pack_size(m_key)
                     + sizeof(uint64_t)
                     + pack_size(m_value);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_RAW_WR << m_state_key << uint8_t(m_flags) << m_table << m_key << m_timestamp << m_value;
+        << KVS_RAW_WR << m_state_key << uint8_t(m_flags) << tr << m_key << m_timestamp << m_value;
     d->send(stub->target, msg);
     stub->last_request_time = now;
+    ++stub->requests;
 }
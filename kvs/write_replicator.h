@@ -38,11 +38,12 @@
 #include <consus.h>
 #include "namespace.h"
 #include "common/ids.h"
+#include "common/pooled.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
 
-class write_replicator
+class write_replicator : public pooled<write_replicator, ALLOC_REPLICATORS>
 {
     public:
         write_replicator(uint64_t key);
@@ -57,8 +58,10 @@ class write_replicator
                   const e::slice& table, const e::slice& key,
                   uint64_t timestamp, const e::slice& value,
                   std::auto_ptr<e::buffer> msg);
+        // handed_off: id is the current owner of a migrating partition and
+        // will carry the write to the next owner itself
         void response(comm_id id, consus_returncode rc,
-                      const replica_set& rs, daemon* d);
+                      const replica_set& rs, bool handed_off, daemon* d);
         void externally_work_state_machine(daemon* d);
         std::string debug_dump();
 
@@ -83,7 +86,16 @@ class write_replicator
         const uint64_t m_state_key;
         po6::threads::mutex m_mtx;
         bool m_init;
+        // answered the transaction manager once a quorum agreed; the
+        // remaining replicas are written until m_finished
+        bool m_acked;
+        uint64_t m_acked_at;
+        // what this write adds to the daemon's m_write_catchup_bytes
+        uint64_t m_catchup_bytes;
         bool m_finished;
+        // when init saw a nonce tagged for tracing; else 0
+        uint64_t m_traced_since;
+        uint64_t m_started;
         comm_id m_id;
         uint64_t m_nonce;
         unsigned m_flags;
@@ -0,0 +1,90 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "kvs/write_throttle.h"
+
+using consus::write_throttle;
+
+// Pressure at which writes start being shed.
+#define THROTTLE_SOFT_PRESSURE 50
+
+// Resolution of the admitted share of writes.
+#define THROTTLE_SCALE 1024
+
+write_throttle :: write_throttle()
+    : m_writes(0)
+    , m_admitted(0)
+    , m_throttled(0)
+{
+}
+
+write_throttle :: ~write_throttle() throw ()
+{
+}
+
+bool
+write_throttle :: admit(unsigned pressure)
+{
+    if (pressure <= THROTTLE_SOFT_PRESSURE)
+    {
+        e::atomic::increment_64_nobarrier(&m_admitted, 1);
+        return true;
+    }
+
+    const uint64_t share = pressure >= 100 ? 0
+                         : uint64_t(100 - pressure) * THROTTLE_SCALE / (100 - THROTTLE_SOFT_PRESSURE);
+    // admit the nth write whenever n * share crosses a multiple of the scale,
+    // which spreads the admitted writes evenly without any shared state but
+    // the count
+    const uint64_t n = e::atomic::increment_64_nobarrier(&m_writes, 1);
+
+    if ((n * share) / THROTTLE_SCALE != ((n - 1) * share) / THROTTLE_SCALE)
+    {
+        e::atomic::increment_64_nobarrier(&m_admitted, 1);
+        return true;
+    }
+
+    e::atomic::increment_64_nobarrier(&m_throttled, 1);
+    return false;
+}
+
+uint64_t
+write_throttle :: admitted()
+{
+    return e::atomic::load_64_nobarrier(&m_admitted);
+}
+
+uint64_t
+write_throttle :: throttled()
+{
+    return e::atomic::load_64_nobarrier(&m_throttled);
+}
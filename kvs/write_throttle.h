@@ -0,0 +1,71 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_kvs_write_throttle_h_
+#define consus_kvs_write_throttle_h_
+
+// C
+#include <stdint.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Sheds raw writes ahead of the storage engine stalling them.  Below the
+// soft pressure every write is admitted; above it, a share of writes that
+// shrinks linearly to nothing at full pressure is admitted, spread evenly
+// over the writes as they arrive.  A shed write is answered right away, and
+// the replicator that sent it retries after its resend interval, so network
+// threads never sit inside a stalled engine and the load backs off smoothly
+// rather than all at once.
+class write_throttle
+{
+    public:
+        write_throttle();
+        ~write_throttle() throw ();
+
+    public:
+        // pressure is datalayer::write_pressure, from 0 to 100
+        bool admit(unsigned pressure);
+        uint64_t admitted();
+        uint64_t throttled();
+
+    private:
+        uint64_t m_writes;
+        uint64_t m_admitted;
+        uint64_t m_throttled;
+
+    private:
+        write_throttle(const write_throttle&);
+        write_throttle& operator = (const write_throttle&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_kvs_write_throttle_h_
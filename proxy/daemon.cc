@@ -0,0 +1,602 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <signal.h>
+
+// STL
+#include <algorithm>
+
+// Google Log
+#include <glog/logging.h>
+#include <glog/raw_logging.h>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+#include <e/daemon.h>
+#include <e/daemonize.h>
+#include <e/guard.h>
+
+// consus
+#include "common/client_configuration.h"
+#include "common/constants.h"
+#include "common/generate_token.h"
+#include "common/txman.h"
+#include "proxy/daemon.h"
+
+// a client's nonce block is named by the bits above CONSUS_PROXY_NONCE_SHIFT;
+// block 0 is never handed out
+#define PROXY_MAX_SLOTS (1ULL << (64 - CONSUS_PROXY_NONCE_SHIFT))
+// how long the coordinator loop waits before checking for interrupts
+#define PROXY_COORD_TIMEOUT_MS 250
+
+using consus::daemon;
+
+uint32_t s_interrupts = 0;
+bool s_debug_mode = false;
+
+static void
+exit_on_signal(int /*signum*/)
+{
+    RAW_LOG(ERROR, "interrupted: exiting");
+    e::atomic::increment_32_nobarrier(&s_interrupts, 1);
+}
+
+static void
+handle_debug_mode(int /*signum*/)
+{
+    s_debug_mode = !s_debug_mode;
+}
+
+daemon :: daemon()
+    : m_mtx()
+    , m_config()
+    , m_addresses()
+    , m_clients()
+    , m_slots()
+    , m_next_slot(1)
+    , m_busybee_controller(this)
+    , m_gc()
+    , m_busybee()
+    , m_threads()
+{
+}
+
+daemon :: ~daemon() throw ()
+{
+}
+
+int
+daemon :: run(bool background,
+              std::string log,
+              std::string pidfile,
+              bool has_pidfile,
+              po6::net::location bind_to,
+              const char* coordinator,
+              unsigned threads)
+{
+    if (!e::block_all_signals())
+    {
+        std::cerr << "could not block signals; exiting" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!e::daemonize(background, log, "consus-proxy-", pidfile, has_pidfile))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!e::install_signal_handler(SIGHUP, exit_on_signal) ||
+        !e::install_signal_handler(SIGINT, exit_on_signal) ||
+        !e::install_signal_handler(SIGTERM, exit_on_signal) ||
+        !e::install_signal_handler(SIGQUIT, exit_on_signal) ||
+        !e::install_signal_handler(SIGUSR2, handle_debug_mode))
+    {
+        PLOG(ERROR) << "could not install signal handlers";
+        return EXIT_FAILURE;
+    }
+
+    uint64_t id;
+
+    if (!generate_token(&id))
+    {
+        PLOG(ERROR) << "could not read random token from /dev/urandom";
+        return EXIT_FAILURE;
+    }
+
+    // transaction managers see the proxy as one more client, under this id
+    m_busybee.reset(busybee_server::create(&m_busybee_controller, id, bind_to, &m_gc));
+    LOG(INFO) << "starting consus proxy " << comm_id(id) << " on address " << bind_to;
+    LOG(INFO) << "connecting to " << coordinator;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        using namespace po6::threads;
+        e::compat::shared_ptr<thread> t(new thread(make_obj_func(&daemon::loop, this, i)));
+        m_threads.push_back(t);
+        t->start();
+    }
+
+    const bool followed = follow_config(coordinator);
+    e::atomic::increment_32_nobarrier(&s_interrupts, 1);
+    m_busybee->shutdown();
+
+    for (size_t i = 0; i < m_threads.size(); ++i)
+    {
+        m_threads[i]->join();
+    }
+
+    LOG(ERROR) << "consus is gracefully shutting down";
+    return followed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void
+daemon :: loop(size_t thread)
+{
+    LOG(INFO) << "network thread " << thread << " started";
+
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_SETMASK, &ss, NULL) < 0)
+    {
+        std::cerr << "could not block signals" << std::endl;
+        return;
+    }
+
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    bool done = false;
+
+    while (!done)
+    {
+        uint64_t _id;
+        std::auto_ptr<e::buffer> msg;
+        busybee_returncode rc = m_busybee->recv(&ts, -1, &_id, &msg);
+
+        switch (rc)
+        {
+            case BUSYBEE_SUCCESS:
+                break;
+            case BUSYBEE_SHUTDOWN:
+                done = true;
+                continue;
+            case BUSYBEE_DISRUPTED:
+                handle_disruption(comm_id(_id));
+                continue;
+            case BUSYBEE_INTERRUPTED:
+            case BUSYBEE_TIMEOUT:
+                continue;
+            case BUSYBEE_SEE_ERRNO:
+                PLOG(ERROR) << "receive error";
+                continue;
+            case BUSYBEE_EXTERNAL:
+            default:
+                LOG(ERROR) << "internal invariants broken; crashing";
+                abort();
+        }
+
+        comm_id id(_id);
+        network_msgtype mt;
+        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+        up = up >> mt;
+
+        if (up.error())
+        {
+            LOG(WARNING) << "dropping message that has a malformed header";
+            continue;
+        }
+
+        switch (mt)
+        {
+            case PROXY_HELLO:
+                process_hello(id, msg, up);
+                break;
+            case PROXY_FORWARD:
+                process_forward(id, msg, up);
+                break;
+            case CLIENT_RESPONSE:
+                process_client_response(id, msg, up);
+                break;
+            case TXMAN_FINISHED:
+                process_txman_finished(id, msg, up);
+                break;
+            default:
+                LOG(INFO) << "received " << mt << " message which proxies do not process";
+                break;
+        }
+
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "network thread " << thread << " shutting down";
+}
+
+void
+daemon :: process_hello(comm_id id, std::auto_ptr<e::buffer>, e::unpacker)
+{
+    std::auto_ptr<e::buffer> resp;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        // the client learns its block from the configuration message, so
+        // there is nothing to say until the first one arrives
+        if (m_config.empty())
+        {
+            LOG_IF(INFO, s_debug_mode) << "holding off client " << id << " until there is a configuration";
+            return;
+        }
+
+        std::map<comm_id, uint64_t>::iterator it = m_clients.find(id);
+        uint64_t slot;
+
+        if (it != m_clients.end())
+        {
+            slot = it->second;
+        }
+        else if (m_slots.size() + 1 >= PROXY_MAX_SLOTS)
+        {
+            LOG(WARNING) << "turning away client " << id << ": every nonce block is in use";
+            return;
+        }
+        else
+        {
+            while (m_next_slot == 0 || m_slots.find(m_next_slot) != m_slots.end())
+            {
+                m_next_slot = (m_next_slot + 1) % PROXY_MAX_SLOTS;
+            }
+
+            slot = m_next_slot;
+            m_next_slot = (m_next_slot + 1) % PROXY_MAX_SLOTS;
+            m_clients[id] = slot;
+            m_slots[slot] = id;
+            LOG_IF(INFO, s_debug_mode) << "client " << id << " takes nonce block " << slot;
+        }
+
+        resp = config_message(slot, m_config);
+    }
+
+    m_busybee->send(id.get(), resp);
+}
+
+void
+daemon :: process_forward(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    comm_id txman;
+    up = up >> txman;
+
+    if (up.error())
+    {
+        LOG(WARNING) << "dropping malformed forward from client " << id;
+        return;
+    }
+
+    bool hello = false;
+    bool known = false;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        hello = m_clients.find(id) != m_clients.end();
+        known = m_addresses.find(txman) != m_addresses.end();
+    }
+
+    // without a nonce block, the responses could not find their way back
+    if (!hello)
+    {
+        LOG_IF(INFO, s_debug_mode) << "dropping forward from client " << id << " that has not said hello";
+        return;
+    }
+
+    if (!known)
+    {
+        send_disrupted(id, txman);
+        return;
+    }
+
+    // strip the forwarding header in place; the request follows it verbatim
+    const size_t offset = BUSYBEE_HEADER_SIZE + pack_size(PROXY_FORWARD) + pack_size(txman);
+    memmove(msg->data() + BUSYBEE_HEADER_SIZE, msg->data() + offset, msg->size() - offset);
+    msg->resize(msg->size() - (offset - BUSYBEE_HEADER_SIZE));
+
+    if (m_busybee->send(txman.get(), msg) != BUSYBEE_SUCCESS)
+    {
+        send_disrupted(id, txman);
+    }
+}
+
+void
+daemon :: process_client_response(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    up = up >> nonce;
+
+    if (up.error())
+    {
+        LOG(WARNING) << "dropping response without a nonce from " << id;
+        return;
+    }
+
+    comm_id client;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        std::map<uint64_t, comm_id>::iterator it = m_slots.find(nonce >> CONSUS_PROXY_NONCE_SHIFT);
+
+        if (it == m_slots.end())
+        {
+            LOG_IF(INFO, s_debug_mode) << "dropping response from " << id << " for a departed client";
+            return;
+        }
+
+        client = it->second;
+    }
+
+    std::auto_ptr<e::buffer> out(wrap_delivery(id, msg.get()));
+    m_busybee->send(client.get(), out);
+}
+
+// The outcome carries no nonce, so every local client hears it and each
+// ignores the transactions that are not its own.
+void
+daemon :: process_txman_finished(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker)
+{
+    std::vector<std::pair<comm_id, uint64_t> > clients;
+    local_clients(&clients);
+
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        std::auto_ptr<e::buffer> out(wrap_delivery(id, msg.get()));
+        m_busybee->send(clients[i].first.get(), out);
+    }
+}
+
+void
+daemon :: handle_disruption(comm_id id)
+{
+    bool txman = false;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        std::map<comm_id, uint64_t>::iterator it = m_clients.find(id);
+
+        if (it != m_clients.end())
+        {
+            LOG_IF(INFO, s_debug_mode) << "client " << id << " left nonce block " << it->second;
+            m_slots.erase(it->second);
+            m_clients.erase(it);
+            return;
+        }
+
+        txman = m_addresses.find(id) != m_addresses.end();
+    }
+
+    if (!txman)
+    {
+        return;
+    }
+
+    // each client fails over its own outstanding requests
+    std::vector<std::pair<comm_id, uint64_t> > clients;
+    local_clients(&clients);
+
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        send_disrupted(clients[i].first, id);
+    }
+}
+
+bool
+daemon :: follow_config(const char* coordinator)
+{
+    replicant_client* repl = replicant_client_create_conn_str(coordinator);
+
+    if (!repl)
+    {
+        LOG(ERROR) << "could not create a coordinator client for " << coordinator;
+        return false;
+    }
+
+    e::guard g_repl = e::makeguard(replicant_client_destroy, repl);
+    int64_t follow = -1;
+    replicant_returncode status = REPLICANT_SUCCESS;
+    uint64_t state = 0;
+    char* data = NULL;
+    size_t data_sz = 0;
+    uint64_t installed = 0;
+    uint64_t backoff = 250 * PO6_MILLIS;
+
+    while (e::atomic::increment_32_nobarrier(&s_interrupts, 0) == 0)
+    {
+        if (follow >= 0 && status != REPLICANT_SUCCESS)
+        {
+            LOG(ERROR) << "lost the client configuration: " << replicant_client_error_message(repl);
+            replicant_client_kill(repl, follow);
+            follow = -1;
+        }
+
+        if (follow < 0)
+        {
+            status = REPLICANT_SUCCESS;
+            follow = replicant_client_cond_follow(repl, "consus", "clientconf",
+                                                  &status, &state, &data, &data_sz);
+        }
+
+        replicant_returncode rc;
+
+        if (follow < 0 ||
+            (replicant_client_loop(repl, PROXY_COORD_TIMEOUT_MS, &rc) < 0 &&
+             rc != REPLICANT_TIMEOUT && rc != REPLICANT_INTERRUPTED &&
+             rc != REPLICANT_NONE_PENDING))
+        {
+            LOG(ERROR) << "coordinator failure: " << replicant_client_error_message(repl);
+            LOG(ERROR) << "backing off for " << (backoff / PO6_MILLIS) << " milliseconds";
+            po6::sleep(backoff);
+            backoff = std::min(backoff * 2, uint64_t(PO6_SECONDS) * 8);
+
+            if (follow >= 0)
+            {
+                replicant_client_kill(repl, follow);
+                follow = -1;
+            }
+
+            continue;
+        }
+
+        backoff = 250 * PO6_MILLIS;
+
+        if (status == REPLICANT_SUCCESS && state > installed && data &&
+            install_config(data, data_sz))
+        {
+            installed = state;
+        }
+    }
+
+    if (follow >= 0)
+    {
+        replicant_client_kill(repl, follow);
+    }
+
+    return true;
+}
+
+bool
+daemon :: install_config(const char* data, size_t data_sz)
+{
+    cluster_id cid;
+    version_id vid;
+    uint64_t flags;
+    std::vector<txman> txmans;
+    std::vector<txman> readers;
+    e::unpacker up(data, data_sz);
+    up = client_configuration(up, &cid, &vid, &flags, &txmans, &readers);
+
+    if (up.error())
+    {
+        LOG(ERROR) << "received a corrupt client configuration";
+        return false;
+    }
+
+    std::vector<std::pair<comm_id, uint64_t> > clients;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_config.assign(data, data_sz);
+        m_addresses.clear();
+
+        for (size_t i = 0; i < txmans.size(); ++i)
+        {
+            m_addresses[txmans[i].id] = txmans[i].bind_to;
+        }
+
+        for (size_t i = 0; i < readers.size(); ++i)
+        {
+            m_addresses[readers[i].id] = readers[i].bind_to;
+        }
+
+        clients.assign(m_clients.begin(), m_clients.end());
+    }
+
+    LOG(INFO) << "adopted client configuration " << vid << " naming "
+              << txmans.size() << " transaction managers and "
+              << readers.size() << " read replicas; pushing it to "
+              << clients.size() << " clients";
+    const std::string config(data, data_sz);
+
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg(config_message(clients[i].second, config));
+        m_busybee->send(clients[i].first.get(), msg);
+    }
+
+    return true;
+}
+
+po6::net::location
+daemon :: address(comm_id id)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::map<comm_id, po6::net::location>::iterator it = m_addresses.find(id);
+    return it != m_addresses.end() ? it->second : po6::net::location();
+}
+
+std::auto_ptr<e::buffer>
+daemon :: wrap_delivery(comm_id txman, const e::buffer* msg)
+{
+    const size_t inner = msg->size() - BUSYBEE_HEADER_SIZE;
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(PROXY_DELIVER)
+                    + pack_size(txman)
+                    + inner;
+    std::auto_ptr<e::buffer> out(e::buffer::create(sz));
+    out->pack_at(BUSYBEE_HEADER_SIZE) << PROXY_DELIVER << txman;
+    memmove(out->data() + out->size(), msg->data() + BUSYBEE_HEADER_SIZE, inner);
+    out->resize(out->size() + inner);
+    return out;
+}
+
+std::auto_ptr<e::buffer>
+daemon :: config_message(uint64_t slot, const std::string& packed)
+{
+    const uint64_t prefix = slot << CONSUS_PROXY_NONCE_SHIFT;
+    const e::slice config(packed);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(PROXY_CONFIG)
+                    + sizeof(uint64_t)
+                    + pack_size(config);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << PROXY_CONFIG << prefix << config;
+    return msg;
+}
+
+void
+daemon :: send_disrupted(comm_id client, comm_id txman)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(PROXY_DISRUPTED)
+                    + pack_size(txman);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << PROXY_DISRUPTED << txman;
+    m_busybee->send(client.get(), msg);
+}
+
+void
+daemon :: local_clients(std::vector<std::pair<comm_id, uint64_t> >* clients)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    clients->assign(m_clients.begin(), m_clients.end());
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_proxy_daemon_h_
+#define consus_proxy_daemon_h_
+
+// STL
+#include <map>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/net/location.h>
+#include <po6/threads/mutex.h>
+#include <po6/threads/thread.h>
+
+// e
+#include <e/buffer.h>
+#include <e/compat.h>
+#include <e/garbage_collector.h>
+#include <e/serialization.h>
+
+// BusyBee
+#include <busybee.h>
+
+// Replicant
+#include <replicant.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "common/network_msgtype.h"
+#include "proxy/controller.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// A per-host proxy.  Local clients connect to it rather than to every
+// transaction manager and the coordinator:  it follows the client
+// configuration once on behalf of all of them, and relays their requests to
+// the transaction managers over one shared connection apiece.  Each client
+// numbers its requests within a block of nonces the proxy assigned it, which
+// is all the proxy needs to route the responses back.
+class daemon
+{
+    public:
+        daemon();
+        ~daemon() throw ();
+
+    public:
+        int run(bool daemonize,
+                std::string log,
+                std::string pidfile,
+                bool has_pidfile,
+                po6::net::location bind_to,
+                const char* coordinator,
+                unsigned threads);
+
+    private:
+        friend class controller;
+        void loop(size_t thread);
+        void process_hello(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_forward(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_client_response(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_txman_finished(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void handle_disruption(comm_id id);
+        // follow the client configuration until interrupted
+        bool follow_config(const char* coordinator);
+        bool install_config(const char* data, size_t data_sz);
+        po6::net::location address(comm_id id);
+        // a transaction manager's message to a local client, as from txman
+        std::auto_ptr<e::buffer> wrap_delivery(comm_id txman, const e::buffer* msg);
+        std::auto_ptr<e::buffer> config_message(uint64_t slot, const std::string& packed);
+        void send_disrupted(comm_id client, comm_id txman);
+        // every client that has said hello
+        void local_clients(std::vector<std::pair<comm_id, uint64_t> >* clients);
+
+    private:
+        po6::threads::mutex m_mtx;
+        // the packed client configuration, and the addresses it names
+        std::string m_config;
+        std::map<comm_id, po6::net::location> m_addresses;
+        // local clients by busybee id and by nonce block
+        std::map<comm_id, uint64_t> m_clients;
+        std::map<uint64_t, comm_id> m_slots;
+        uint64_t m_next_slot;
+        controller m_busybee_controller;
+        e::garbage_collector m_gc;
+        std::auto_ptr<busybee_server> m_busybee;
+        std::vector<e::compat::shared_ptr<po6::threads::thread> > m_threads;
+
+    private:
+        daemon(const daemon&);
+        daemon& operator = (const daemon&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_proxy_daemon_h_
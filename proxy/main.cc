@@ -0,0 +1,176 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <signal.h>
+#include <unistd.h>
+
+// Google Log
+#include <glog/logging.h>
+
+// po6
+#include <po6/net/hostname.h>
+#include <po6/net/location.h>
+
+// e
+#include <e/popt.h>
+
+// consus
+#include "common/constants.h"
+#include "common/macros.h"
+#include "proxy/daemon.h"
+#include "tools/connect_opts.h"
+
+int
+main(int argc, const char* argv[])
+{
+    bool daemonize = true;
+    const char* log = ".";
+    const char* listen_host = "127.0.0.1";
+    long listen_port = CONSUS_PORT_PROXY;
+    const char* pidfile = "";
+    bool has_pidfile = false;
+    long threads = 0;
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        sigprocmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        std::cerr << "could not block signals";
+        return EXIT_FAILURE;
+    }
+
+    consus::connect_opts conn('c', "connect", 'P', "connect-port", 'C', "connect-string");
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('d', "daemon")
+            .description("run in the background")
+            .set_true(&daemonize);
+    ap.arg().name('f', "foreground")
+            .description("run in the foreground")
+            .set_false(&daemonize);
+    ap.arg().name('L', "log")
+            .description("store logs in this directory (default: .)")
+            .metavar("dir").as_string(&log);
+    ap.arg().name('l', "listen")
+            .description("listen for local clients on this IP address (default: 127.0.0.1)")
+            .metavar("IP").as_string(&listen_host);
+    ap.arg().name('p', "listen-port")
+            .description("listen on an alternative port (default: " STR(CONSUS_PORT_PROXY) ")")
+            .metavar("port").as_long(&listen_port);
+    ap.arg().long_name("pidfile")
+            .description("write the PID to a file (default: don't)")
+            .metavar("file").as_string(&pidfile).set_true(&has_pidfile);
+    ap.arg().name('t', "threads")
+            .description("the number of threads which will relay network traffic")
+            .metavar("N").as_long(&threads);
+    ap.add("Connect to the cluster:", conn.parser());
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!conn.validate())
+    {
+        std::cerr << "invalid host:port specification\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << "command takes no positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (listen_port >= (1 << 16) || listen_port <= 0)
+    {
+        std::cerr << "listen-port is out of range" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    po6::net::ipaddr listen_ip;
+    po6::net::location bind_to;
+
+    if (listen_ip.set(listen_host))
+    {
+        bind_to = po6::net::location(listen_ip, listen_port);
+    }
+
+    if (bind_to == po6::net::location())
+    {
+        bind_to = po6::net::hostname(listen_host, 0).lookup(AF_UNSPEC, IPPROTO_TCP);
+        bind_to.port = listen_port;
+    }
+
+    if (bind_to == po6::net::location())
+    {
+        std::cerr << "cannot interpret listen address as hostname or IP address" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    google::InitGoogleLogging(argv[0]);
+    google::InstallFailureSignalHandler();
+
+    if (threads <= 0)
+    {
+        threads += sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (threads <= 0)
+        {
+            std::cerr << "cannot create a non-positive number of threads" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else if (threads > 512)
+    {
+        std::cerr << "refusing to create more than 512 threads" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        consus::daemon d;
+        return d.run(daemonize,
+                     std::string(log),
+                     std::string(pidfile), has_pidfile,
+                     bind_to,
+                     conn.conn_str(),
+                     threads);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "error:  " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
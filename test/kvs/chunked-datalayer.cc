@@ -0,0 +1,209 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <memory>
+#include <string>
+#include <vector>
+
+// consus
+#include "test/kvs/scratch.h"
+#include "test/th.h"
+#include "kvs/chunked_datalayer.h"
+#include "kvs/leveldb_datalayer.h"
+
+using namespace consus;
+
+#define TABLE "t"
+#define CHUNK_SIZE 64
+
+namespace
+{
+
+// chunks TABLE in front of a leveldb store, keeping a hand on the store so
+// tests can see and damage what it holds
+struct store
+{
+    store(const std::string& dir);
+    ~store() throw () {}
+
+    datalayer* backing;
+    std::auto_ptr<chunked_datalayer> dl;
+
+    private:
+        store(const store&);
+        store& operator = (const store&);
+};
+
+store :: store(const std::string& dir)
+    : backing(new leveldb_datalayer(false))
+    , dl()
+{
+    dl.reset(new chunked_datalayer(backing, CHUNK_SIZE));
+    ASSERT_TRUE(dl->init(dir));
+}
+
+} // namespace
+
+static consus_returncode
+get(datalayer* dl, const std::string& table, const std::string& key,
+    uint64_t timestamp_le, std::string* value)
+{
+    uint64_t timestamp = 0;
+    datalayer::reference* ref = NULL;
+    e::slice v;
+    consus_returncode rc = dl->get(e::slice(table), e::slice(key), timestamp_le, &timestamp, &v, &ref);
+    value->assign(v.cdata(), v.size());
+    delete ref;
+    return rc;
+}
+
+static void
+raw_scan_all(datalayer* dl, std::vector<datalayer::raw_item>* all)
+{
+    std::string cursor;
+    bool done = false;
+    all->clear();
+
+    while (!done)
+    {
+        std::vector<datalayer::raw_item> items;
+        std::string next;
+        ASSERT_EQ(dl->raw_scan(cursor, 4, &items, &next, &done), CONSUS_SUCCESS);
+        all->insert(all->end(), items.begin(), items.end());
+        cursor = next;
+    }
+}
+
+// the chunks the backing store holds for the version at timestamp
+static std::vector<datalayer::raw_item>
+chunks(datalayer* backing, uint64_t timestamp)
+{
+    std::vector<datalayer::raw_item> all;
+    std::vector<datalayer::raw_item> out;
+    raw_scan_all(backing, &all);
+
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        if (all[i].table != TABLE && all[i].timestamp == timestamp && !all[i].value.empty())
+        {
+            out.push_back(all[i]);
+        }
+    }
+
+    return out;
+}
+
+static std::string
+value_of(size_t sz)
+{
+    std::string v;
+
+    for (size_t i = 0; i < sz; ++i)
+    {
+        v.push_back(char('a' + i * 7 % 26));
+    }
+
+    return v;
+}
+
+TEST(ChunkedDatalayer, SmallValuesStayWhole)
+{
+    scratch_dir dir;
+    store s(dir.path());
+    const std::string value(value_of(CHUNK_SIZE));
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("k"), 10, e::slice(value)), CONSUS_SUCCESS);
+
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), TABLE, "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == value);
+    ASSERT_EQ(get(s.backing, TABLE, "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(v.size(), value.size() + 1);
+    ASSERT_TRUE(chunks(s.backing, 10).empty());
+}
+
+TEST(ChunkedDatalayer, LargeValuesReassemble)
+{
+    scratch_dir dir;
+    store s(dir.path());
+    const std::string value(value_of(10 * CHUNK_SIZE + 1));
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("k"), 10, e::slice(value)), CONSUS_SUCCESS);
+    ASSERT_EQ(chunks(s.backing, 10).size(), 11U);
+
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), TABLE, "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == value);
+    ASSERT_EQ(get(s.backing, TABLE, "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_LT(v.size(), size_t(CHUNK_SIZE));
+
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(s.dl->scan(e::slice(TABLE), e::slice(), 10, 10, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 1U);
+    ASSERT_TRUE(items[0].value == value);
+
+    // replicas get the whole value, never the chunks
+    std::vector<datalayer::raw_item> raw;
+    raw_scan_all(s.dl.get(), &raw);
+    ASSERT_EQ(raw.size(), 1U);
+    ASSERT_TRUE(raw[0].table == TABLE);
+    ASSERT_TRUE(raw[0].value == value);
+
+    // a smaller value written over it keeps the older version readable
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("k"), 20, e::slice("small")), CONSUS_SUCCESS);
+    ASSERT_EQ(get(s.dl.get(), TABLE, "k", 20, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == "small");
+    ASSERT_EQ(get(s.dl.get(), TABLE, "k", 15, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == value);
+}
+
+TEST(ChunkedDatalayer, MissingChunkIsAnError)
+{
+    scratch_dir dir;
+    store s(dir.path());
+    const std::string value(value_of(4 * CHUNK_SIZE));
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("k"), 10, e::slice(value)), CONSUS_SUCCESS);
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("l"), 10, e::slice("whole")), CONSUS_SUCCESS);
+    std::vector<datalayer::raw_item> c(chunks(s.backing, 10));
+    ASSERT_EQ(c.size(), 4U);
+
+    // as if the chunk were pruned before the manifest that refers to it
+    ASSERT_EQ(s.backing->del(e::slice(c[2].table), e::slice(c[2].key), 10), CONSUS_SUCCESS);
+
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), TABLE, "k", 10, &v), CONSUS_SERVER_ERROR);
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(s.dl->scan(e::slice(TABLE), e::slice(), 10, 10, &items), CONSUS_SERVER_ERROR);
+
+    // raw scans drop the version no reader can observe, and carry on
+    std::vector<datalayer::raw_item> raw;
+    raw_scan_all(s.dl.get(), &raw);
+    ASSERT_EQ(raw.size(), 1U);
+    ASSERT_TRUE(raw[0].key == "l");
+    ASSERT_TRUE(raw[0].value == "whole");
+}
@@ -0,0 +1,253 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <sys/stat.h>
+
+// STL
+#include <memory>
+#include <string>
+#include <vector>
+
+// consus
+#include "test/kvs/scratch.h"
+#include "test/th.h"
+#include "kvs/compressed_datalayer.h"
+#include "kvs/leveldb_datalayer.h"
+
+using namespace consus;
+
+#define TABLE "z"
+
+// the first byte of each stored value, as compressed_datalayer writes it
+#define STORED_PLAIN 0
+#define STORED_ZSTD 1
+
+namespace
+{
+
+// compresses TABLE in front of a leveldb store, keeping a hand on the store
+// so tests can see what it holds
+struct store
+{
+    store(const std::string& dir);
+    ~store() throw () {}
+
+    datalayer* backing;
+    std::auto_ptr<compressed_datalayer> dl;
+
+    private:
+        store(const store&);
+        store& operator = (const store&);
+};
+
+store :: store(const std::string& dir)
+    : backing(new leveldb_datalayer(false))
+    , dl()
+{
+    dl.reset(new compressed_datalayer(backing, std::vector<std::string>(1, TABLE)));
+    ASSERT_TRUE(dl->init(dir));
+}
+
+} // namespace
+
+static consus_returncode
+get(datalayer* dl, const std::string& table, const std::string& key,
+    uint64_t timestamp_le, std::string* value)
+{
+    uint64_t timestamp = 0;
+    datalayer::reference* ref = NULL;
+    e::slice v;
+    consus_returncode rc = dl->get(e::slice(table), e::slice(key), timestamp_le, &timestamp, &v, &ref);
+    value->assign(v.cdata(), v.size());
+    delete ref;
+    return rc;
+}
+
+// a value like a page of JSON records; similar to its neighbours, but not to
+// itself, so that a dictionary has something to learn
+static std::string
+record(unsigned i)
+{
+    std::string r("[");
+
+    for (unsigned j = i * 6; j < i * 6 + 6; ++j)
+    {
+        char buf[256];
+        int sz = snprintf(buf, sizeof(buf),
+                          "{\"id\": %u, \"name\": \"user%u\", \"email\": \"user%u@example.com\", "
+                          "\"created\": \"2016-%02u-%02uT%02u:00:00Z\", \"score\": %u}, ",
+                          j, j * 7919, j * 104729, 1 + j % 12, 1 + j % 28, j % 24, j * 31 % 1000);
+        r.append(buf, sz);
+    }
+
+    r.append("]");
+    return r;
+}
+
+static std::string
+key_for(unsigned i)
+{
+    char buf[32];
+    int sz = snprintf(buf, sizeof(buf), "key%08u", i);
+    return std::string(buf, sz);
+}
+
+static std::string
+incompressible(size_t sz)
+{
+    std::string s;
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+    while (s.size() < sz)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        s.push_back(char(x & 0xff));
+    }
+
+    return s;
+}
+
+TEST(CompressedDatalayer, CompressibleValuesRoundTrip)
+{
+    scratch_dir dir;
+    store s(dir.path());
+    const std::string value(record(1) + record(1) + record(1));
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("k"), 10, e::slice(value)), CONSUS_SUCCESS);
+
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), TABLE, "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == value);
+    ASSERT_EQ(get(s.backing, TABLE, "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(v[0], STORED_ZSTD);
+    ASSERT_LT(v.size(), value.size() / 2);
+
+    // scans, and the raw scans replicas use, see the plain value
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(s.dl->scan(e::slice(TABLE), e::slice(), 10, 10, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 1U);
+    ASSERT_TRUE(items[0].value == value);
+    std::vector<datalayer::raw_item> raw;
+    std::string next;
+    bool done = false;
+    ASSERT_EQ(s.dl->raw_scan(std::string(), 10, &raw, &next, &done), CONSUS_SUCCESS);
+    ASSERT_TRUE(done);
+    ASSERT_EQ(raw.size(), 1U);
+    ASSERT_TRUE(raw[0].value == value);
+}
+
+TEST(CompressedDatalayer, FallsBackToPlainValues)
+{
+    scratch_dir dir;
+    store s(dir.path());
+    // too short to be worth a frame, too random to shrink, and in a table
+    // that is not compressed
+    const std::string shortv("short");
+    const std::string randomv(incompressible(4096));
+    const std::string otherv(std::string(1000, 'x'));
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("short"), 10, e::slice(shortv)), CONSUS_SUCCESS);
+    ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice("random"), 10, e::slice(randomv)), CONSUS_SUCCESS);
+    ASSERT_EQ(s.dl->put(e::slice("other"), e::slice("k"), 10, e::slice(otherv)), CONSUS_SUCCESS);
+
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), TABLE, "short", 10, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == shortv);
+    ASSERT_EQ(get(s.backing, TABLE, "short", 10, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(v[0], STORED_PLAIN);
+    ASSERT_TRUE(v.substr(1) == shortv);
+
+    ASSERT_EQ(get(s.dl.get(), TABLE, "random", 10, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == randomv);
+    ASSERT_EQ(get(s.backing, TABLE, "random", 10, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(v[0], STORED_PLAIN);
+    ASSERT_TRUE(v.substr(1) == randomv);
+
+    ASSERT_EQ(get(s.dl.get(), "other", "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == otherv);
+    ASSERT_EQ(get(s.backing, "other", "k", 10, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(v[0], STORED_PLAIN);
+    ASSERT_TRUE(v.substr(1) == otherv);
+
+    // deletes stay empty tombstones
+    ASSERT_EQ(s.dl->del(e::slice(TABLE), e::slice("short"), 20), CONSUS_SUCCESS);
+    ASSERT_EQ(get(s.dl.get(), TABLE, "short", 20, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(get(s.dl.get(), TABLE, "short", 10, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == shortv);
+}
+
+TEST(CompressedDatalayer, DictionaryOutlivesReopen)
+{
+    scratch_dir dir;
+    // enough sampled bytes to train a dictionary, and some written after
+    const unsigned n = 1536;
+
+    {
+        store s(dir.path());
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            const std::string r(record(i));
+            ASSERT_EQ(s.dl->put(e::slice(TABLE), e::slice(key_for(i)), 10 + i, e::slice(r)),
+                      CONSUS_SUCCESS);
+        }
+    }
+
+    store s(dir.path());
+
+    for (unsigned i = 0; i < n; i += 7)
+    {
+        const std::string r(record(i));
+        std::string v;
+        ASSERT_EQ(get(s.dl.get(), TABLE, key_for(i), UINT64_MAX - 1, &v), CONSUS_SUCCESS);
+        ASSERT_TRUE(v == r);
+    }
+}
+
+TEST(CompressedDatalayer, RefusesStoresWrittenWithoutIt)
+{
+    scratch_dir dir;
+
+    {
+        leveldb_datalayer plain(false);
+        ASSERT_TRUE(plain.init(dir.path()));
+        ASSERT_EQ(plain.put(e::slice(TABLE), e::slice("k"), 10, e::slice("v")), CONSUS_SUCCESS);
+    }
+
+    // its values have no header and would be misread
+    compressed_datalayer dl(new leveldb_datalayer(false), std::vector<std::string>(1, TABLE));
+    ASSERT_FALSE(dl.init(dir.path()));
+    struct stat st;
+    ASSERT_LT(stat(compressed_datalayer::dictionary_dir(dir.path()).c_str(), &st), 0);
+}
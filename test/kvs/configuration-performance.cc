@@ -0,0 +1,351 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// STL
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/buffer.h>
+#include <e/popt.h>
+#include <e/serialization.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/kvs_configuration.h"
+#include "common/network_msgtype.h"
+#include "common/table_dictionary.h"
+#include "kvs/configuration.h"
+#include "kvs/replica_set.h"
+
+using namespace consus;
+
+// Times the work a key-value store does on every message and every
+// configuration change: parsing the configuration and rebuilding its replica
+// sets, hashing keys to replica sets, and packing and unpacking rings, replica
+// sets and the raw read and write messages.  Everything is built up front,
+// so each loop measures only the call under test.
+
+// keeps the optimizer from discarding the results
+static volatile uint64_t s_sink;
+
+static void
+report(const char* name, uint64_t ops, uint64_t start)
+{
+    const uint64_t elapsed = po6::monotonic_time() - start;
+    printf("%s: %llu in %.3fs (%.1f ns each)\n", name, (unsigned long long)ops,
+           elapsed / 1e9, ops ? double(elapsed) / ops : 0.0);
+}
+
+static std::string
+make_configuration(long dcs, long servers, long partitions, long tables)
+{
+    std::vector<kvs_state> kvss;
+    std::vector<ring> rings;
+    std::vector<table_config> tcs;
+    uint64_t counter = 1;
+
+    for (long d = 0; d < dcs; ++d)
+    {
+        const data_center_id dc(d + 1);
+        std::vector<comm_id> ids;
+
+        for (long s = 0; s < servers; ++s)
+        {
+            kvs kv(comm_id(d * servers + s + 1), po6::net::location());
+            kv.dc = dc;
+            kv.capacity = 1;
+            kvs_state ks(kv);
+            ks.state = kvs_state::ONLINE;
+            kvss.push_back(ks);
+            ids.push_back(kv.id);
+        }
+
+        ring r(dc);
+
+        while (r.partitions.size() < size_t(partitions))
+        {
+            r.split(&counter);
+        }
+
+        std::vector<comm_id> owners(r.partitions.size());
+
+        for (size_t p = 0; p < owners.size(); ++p)
+        {
+            owners[p] = ids[p % ids.size()];
+        }
+
+        r.set_owners(owners, &counter, NULL);
+        rings.push_back(r);
+    }
+
+    for (long t = 0; t < tables; ++t)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "table%ld", t);
+        tcs.push_back(table_config(table_id(t + 1), name, 3));
+    }
+
+    return kvs_configuration(cluster_id(1), version_id(1), 0, kvss, rings, tcs);
+}
+
+int
+main(int argc, const char* argv[])
+{
+    long dcs = 3;
+    long servers = 5;
+    long partitions = CONSUS_KVS_INITIAL_PARTITIONS;
+    long tables = 4;
+    long configs = 100;
+    long iterations = 1000000;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('d', "data-centers")
+            .description("data centers in the configuration, each with a ring (default: 3)")
+            .as_long(&dcs);
+    ap.arg().name('s', "servers")
+            .description("key-value stores in each data center (default: 5)")
+            .as_long(&servers);
+    ap.arg().name('p', "partitions")
+            .description("partitions in each ring, a power of two (default: 1024)")
+            .as_long(&partitions);
+    ap.arg().name('t', "tables")
+            .description("tables in the configuration (default: 4)")
+            .as_long(&tables);
+    ap.arg().name('c', "configurations")
+            .description("how many times to parse the configuration (default: 100)")
+            .as_long(&configs);
+    ap.arg().name('n', "iterations")
+            .description("how many times to run each of the other operations (default: 1,000,000)")
+            .as_long(&iterations);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (dcs <= 0 || servers <= 0 || tables <= 0 || configs <= 0 || iterations <= 0)
+    {
+        std::cerr << "data-centers, servers, tables, configurations and iterations must be positive\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (partitions < CONSUS_KVS_INITIAL_PARTITIONS || partitions > CONSUS_KVS_PARTITIONS ||
+        (partitions & (partitions - 1)) != 0)
+    {
+        std::cerr << "partitions must be a power of two from "
+                  << CONSUS_KVS_INITIAL_PARTITIONS << " to " << CONSUS_KVS_PARTITIONS << "\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    const std::string conf = make_configuration(dcs, servers, partitions, tables);
+    printf("configuration: %llu bytes\n", (unsigned long long)conf.size());
+    uint64_t start;
+
+    // unpacking alone, and unpacking followed by reconstruct_cache; the
+    // difference is the cost of rebuilding the replica sets
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < configs; ++i)
+    {
+        cluster_id cid;
+        version_id vid;
+        uint64_t flags;
+        std::vector<kvs_state> kvss;
+        std::vector<ring> rings;
+        std::vector<table_config> tcs;
+        e::unpacker up(conf.data(), conf.size());
+        up = kvs_configuration(up, &cid, &vid, &flags, &kvss, &rings, &tcs);
+        s_sink = s_sink + up.error() + rings.size();
+    }
+
+    report("unpack configuration", configs, start);
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < configs; ++i)
+    {
+        configuration c;
+        e::unpacker up(conf.data(), conf.size());
+        up = up >> c;
+        s_sink = s_sink + up.error() + c.daemons();
+    }
+
+    report("unpack configuration and reconstruct cache", configs, start);
+
+    configuration c;
+
+    if ((e::unpacker(conf.data(), conf.size()) >> c).error())
+    {
+        std::cerr << "could not parse the configuration" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const size_t keys_sz = 4096;
+    std::vector<std::string> keys(keys_sz);
+
+    for (size_t i = 0; i < keys_sz; ++i)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key%llu", (unsigned long long)i);
+        keys[i] = buf;
+    }
+
+    const e::slice table("table0");
+    replica_set rs;
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        c.hash(data_center_id(i % dcs + 1), table, keys[i % keys_sz], &rs);
+        s_sink = s_sink + rs.num_replicas;
+    }
+
+    report("configuration::hash", iterations, start);
+
+    ring r;
+    std::vector<kvs_state> kvss;
+    std::vector<ring> rings;
+    std::vector<table_config> tcs;
+    cluster_id cid;
+    version_id vid;
+    uint64_t flags;
+    kvs_configuration(e::unpacker(conf.data(), conf.size()), &cid, &vid, &flags, &kvss, &rings, &tcs);
+    r = rings[0];
+    std::string buf;
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < configs; ++i)
+    {
+        buf.clear();
+        e::packer(&buf) << r;
+        ring out;
+        e::unpacker(buf.data(), buf.size()) >> out;
+        s_sink = s_sink + out.partitions.size();
+    }
+
+    report("pack and unpack ring", configs, start);
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < configs; ++i)
+    {
+        buf.clear();
+        pack_compact(e::packer(&buf), r);
+        ring out;
+        unpack_compact(e::unpacker(buf.data(), buf.size()), &out);
+        s_sink = s_sink + out.partitions.size();
+    }
+
+    report("pack and unpack compact ring", configs, start);
+    c.hash(data_center_id(1), table, keys[0], &rs);
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        buf.clear();
+        e::packer(&buf) << rs;
+        replica_set out;
+        e::unpacker(buf.data(), buf.size()) >> out;
+        s_sink = s_sink + out.num_replicas;
+    }
+
+    report("pack and unpack replica_set", iterations, start);
+
+    // the raw reads and writes that replicators send, packed as they pack
+    // them and unpacked as the daemon does
+    const table_ref tr(table_id(1), table);
+    const std::string value(128, 'v');
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        const e::slice key(keys[i % keys_sz]);
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(KVS_RAW_WR)
+                        + sizeof(uint64_t)
+                        + sizeof(uint8_t)
+                        + pack_size(tr)
+                        + pack_size(key)
+                        + sizeof(uint64_t)
+                        + pack_size(e::slice(value));
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << KVS_RAW_WR << uint64_t(i) << uint8_t(0) << tr << key << uint64_t(i) << e::slice(value);
+        network_msgtype mt;
+        uint64_t nonce;
+        uint8_t fl;
+        table_ref tr_out;
+        e::slice k;
+        uint64_t timestamp;
+        e::slice v;
+        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+        up = up >> mt >> nonce >> fl >> tr_out >> k >> timestamp >> v;
+        s_sink = s_sink + up.error() + v.size();
+    }
+
+    report("pack and unpack KVS_RAW_WR", iterations, start);
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        const e::slice key(keys[i % keys_sz]);
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(KVS_RAW_RD)
+                        + sizeof(uint64_t)
+                        + pack_size(tr)
+                        + pack_size(key)
+                        + sizeof(uint64_t);
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << KVS_RAW_RD << uint64_t(i) << tr << key << uint64_t(i);
+        network_msgtype mt;
+        uint64_t nonce;
+        table_ref tr_out;
+        e::slice k;
+        uint64_t timestamp;
+        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+        up = up >> mt >> nonce >> tr_out >> k >> timestamp;
+        s_sink = s_sink + up.error() + k.size();
+    }
+
+    report("pack and unpack KVS_RAW_RD", iterations, start);
+    return EXIT_SUCCESS;
+}
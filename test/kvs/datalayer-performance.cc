@@ -0,0 +1,444 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <sys/stat.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
+// e
+#include <e/compat.h>
+#include <e/popt.h>
+
+// consus
+#include "common/transaction_group.h"
+#include "kvs/datalayer.h"
+#include "kvs/leveldb_datalayer.h"
+#include "kvs/row_cache.h"
+#ifdef CONSUS_ROCKSDB
+#include "kvs/rocksdb_datalayer.h"
+#endif
+
+using namespace consus;
+
+// Drives a datalayer directly, without a cluster around it.  The store is
+// first loaded with --versions versions of each of --keys keys; then every
+// thread issues --ops operations drawn from the --gets/--puts/--locks mix.
+// A get reads the version --depth below the newest, so that the cost of
+// skipping over newer versions shows up.  A lock acquires and then
+// releases one exclusive lock the way the lock manager would.
+
+#define TABLE "bench"
+
+enum optype
+{
+    OP_GET,
+    OP_PUT,
+    OP_LOCK,
+    OP_COUNT
+};
+
+static const char* const optype_names[OP_COUNT] = {"get", "put", "lock"};
+
+struct workload
+{
+    long keys;
+    long versions;
+    long depth;
+    long ops;
+    long gets;
+    long puts;
+    std::string value;
+};
+
+class worker
+{
+    public:
+        worker(datalayer* data, const workload* w, unsigned idx);
+        ~worker() throw ();
+
+    public:
+        void run();
+        std::vector<uint64_t>* latencies(unsigned op) { return &m_latencies[op]; }
+        uint64_t errors() const { return m_errors; }
+
+    private:
+        bool get(const std::string& key);
+        bool put(const std::string& key);
+        bool lock(const std::string& key);
+
+    private:
+        datalayer* m_data;
+        const workload* m_w;
+        unsigned m_idx;
+        uint16_t m_randbuf[3];
+        uint64_t m_next_timestamp;
+        std::vector<uint64_t> m_latencies[OP_COUNT];
+        uint64_t m_errors;
+
+    private:
+        worker(const worker&);
+        worker& operator = (const worker&);
+};
+
+static std::string
+key_for(long k)
+{
+    char buf[32];
+    int sz = snprintf(buf, sizeof(buf), "key%012ld", k);
+    return std::string(buf, sz);
+}
+
+worker :: worker(datalayer* data, const workload* w, unsigned idx)
+    : m_data(data)
+    , m_w(w)
+    , m_idx(idx)
+    , m_next_timestamp(0)
+    , m_errors(0)
+{
+    m_randbuf[0] = idx;
+    m_randbuf[1] = 0xbeefU;
+    m_randbuf[2] = 0xdeadU;
+    // keep each thread's timestamps apart and above the loaded versions
+    m_next_timestamp = (uint64_t(idx) + 1) << 40;
+
+    for (unsigned op = 0; op < OP_COUNT; ++op)
+    {
+        m_latencies[op].reserve(w->ops);
+    }
+}
+
+worker :: ~worker() throw ()
+{
+}
+
+void
+worker :: run()
+{
+    for (long i = 0; i < m_w->ops; ++i)
+    {
+        const std::string key(key_for(nrand48(m_randbuf) % m_w->keys));
+        const long dice = nrand48(m_randbuf) % 100;
+        unsigned op = dice < m_w->gets ? OP_GET
+                    : dice < m_w->gets + m_w->puts ? OP_PUT : OP_LOCK;
+        const uint64_t start = po6::monotonic_time();
+        bool ok = false;
+
+        switch (op)
+        {
+            case OP_GET:
+                ok = get(key);
+                break;
+            case OP_PUT:
+                ok = put(key);
+                break;
+            case OP_LOCK:
+                ok = lock(key);
+                break;
+            default:
+                abort();
+        }
+
+        if (ok)
+        {
+            m_latencies[op].push_back(po6::monotonic_time() - start);
+        }
+        else
+        {
+            ++m_errors;
+        }
+    }
+}
+
+bool
+worker :: get(const std::string& key)
+{
+    uint64_t timestamp;
+    e::slice value;
+    datalayer::reference* ref = NULL;
+    consus_returncode rc = m_data->get(e::slice(TABLE), e::slice(key),
+                                       m_w->versions - m_w->depth,
+                                       &timestamp, &value, &ref);
+    delete ref;
+    return rc == CONSUS_SUCCESS;
+}
+
+bool
+worker :: put(const std::string& key)
+{
+    ++m_next_timestamp;
+    consus_returncode rc = m_data->put(e::slice(TABLE), e::slice(key),
+                                       m_next_timestamp, e::slice(m_w->value));
+    return rc == CONSUS_SUCCESS;
+}
+
+bool
+worker :: lock(const std::string& key)
+{
+    std::vector<transaction_group> holders;
+    bool shared = false;
+
+    if (m_data->read_lock(e::slice(TABLE), e::slice(key), &holders, &shared) != CONSUS_SUCCESS)
+    {
+        return false;
+    }
+
+    holders.clear();
+    holders.push_back(transaction_group(paxos_group_id(m_idx + 1),
+                                        transaction_id(paxos_group_id(m_idx + 1),
+                                                       ++m_next_timestamp, 0)));
+
+    if (m_data->write_lock(e::slice(TABLE), e::slice(key), holders, false) != CONSUS_SUCCESS)
+    {
+        return false;
+    }
+
+    holders.clear();
+    return m_data->write_lock(e::slice(TABLE), e::slice(key), holders, false) == CONSUS_SUCCESS;
+}
+
+static void
+print_latencies(const char* name, double secs, std::vector<uint64_t>* l)
+{
+    std::sort(l->begin(), l->end());
+
+    if (l->empty())
+    {
+        return;
+    }
+
+    const size_t sz = l->size();
+    printf("%s: %.0f ops/s p50 %.1fus p90 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus\n",
+           name, sz / secs,
+           (*l)[sz * 50 / 100] / 1000.0,
+           (*l)[sz * 90 / 100] / 1000.0,
+           (*l)[sz * 99 / 100] / 1000.0,
+           (*l)[sz * 999 / 1000] / 1000.0,
+           l->back() / 1000.0);
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* dir = "datalayer-performance";
+    const char* backend = "leveldb";
+    long row_cache_mb = 0;
+    bool lazy_locks = false;
+    long threads = 1;
+    long value_size = 100;
+    long locks = 0;
+    workload w;
+    w.keys = 100000;
+    w.versions = 1;
+    w.depth = 0;
+    w.ops = 100000;
+    w.gets = 50;
+    w.puts = 50;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('d', "dir")
+            .description("store data in this directory, which must not exist (default: datalayer-performance)")
+            .as_string(&dir);
+    ap.arg().name('b', "backend")
+            .description("\"leveldb\" or \"rocksdb\" (default: leveldb)")
+            .as_string(&backend);
+    ap.arg().long_name("row-cache")
+            .description("put a row cache of this many MB in front of the backend (default: 0)")
+            .as_long(&row_cache_mb);
+    ap.arg().long_name("lazy-locks")
+            .description("keep lock state in memory between group commits")
+            .set_true(&lazy_locks);
+    ap.arg().name('t', "threads")
+            .description("how many threads issue operations (default: 1)")
+            .as_long(&threads);
+    ap.arg().name('n', "ops")
+            .description("operations per thread (default: 100,000)")
+            .as_long(&w.ops);
+    ap.arg().name('k', "keys")
+            .description("how many keys to load (default: 100,000)")
+            .as_long(&w.keys);
+    ap.arg().long_name("versions")
+            .description("versions to load per key (default: 1)")
+            .as_long(&w.versions);
+    ap.arg().long_name("depth")
+            .description("read the version this far below the newest loaded (default: 0)")
+            .as_long(&w.depth);
+    ap.arg().long_name("value-size")
+            .description("bytes per value (default: 100)")
+            .as_long(&value_size);
+    ap.arg().long_name("gets")
+            .description("percentage of operations that are gets (default: 50)")
+            .as_long(&w.gets);
+    ap.arg().long_name("puts")
+            .description("percentage of operations that are puts (default: 50)")
+            .as_long(&w.puts);
+    ap.arg().long_name("locks")
+            .description("percentage of operations that lock and unlock a key (default: 0)")
+            .as_long(&locks);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (threads <= 0 || w.ops <= 0 || w.keys <= 0 || w.versions <= 0 ||
+        w.depth < 0 || w.depth >= w.versions || value_size <= 0 ||
+        row_cache_mb < 0 || w.gets < 0 || w.puts < 0 || locks < 0 ||
+        w.gets + w.puts + locks != 100)
+    {
+        std::cerr << "options out of range; --gets, --puts and --locks must sum to 100\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+
+    if (stat(dir, &st) == 0 || errno != ENOENT)
+    {
+        std::cerr << dir << " already exists; the benchmark needs an empty store" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::auto_ptr<datalayer> data;
+
+    if (strcmp(backend, "leveldb") == 0)
+    {
+        data.reset(new leveldb_datalayer(lazy_locks));
+    }
+#ifdef CONSUS_ROCKSDB
+    else if (strcmp(backend, "rocksdb") == 0)
+    {
+        data.reset(new rocksdb_datalayer(lazy_locks));
+    }
+#endif
+    else
+    {
+        std::cerr << "unknown or unavailable backend \"" << backend << "\"" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (row_cache_mb > 0)
+    {
+        data.reset(new row_cache(data.release(), uint64_t(row_cache_mb) * 1024ULL * 1024ULL));
+    }
+
+    if (!data->init(dir))
+    {
+        std::cerr << "could not initialize the datalayer in " << dir << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    w.value = std::string(value_size, 'v');
+    uint64_t start = po6::monotonic_time();
+
+    for (long k = 0; k < w.keys; ++k)
+    {
+        const std::string key(key_for(k));
+
+        for (long v = 1; v <= w.versions; ++v)
+        {
+            if (data->put(e::slice(TABLE), e::slice(key), v, e::slice(w.value)) != CONSUS_SUCCESS)
+            {
+                std::cerr << "could not load " << key << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    double secs = (po6::monotonic_time() - start) / 1e9;
+    printf("load: %ld versions in %.3fs (%.0f puts/s)\n",
+           w.keys * w.versions, secs, w.keys * w.versions / secs);
+    std::vector<worker*> workers;
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+
+    for (long i = 0; i < threads; ++i)
+    {
+        using namespace po6::threads;
+        workers.push_back(new worker(data.get(), &w, i));
+        e::compat::shared_ptr<thread> t(new thread(make_obj_func(&worker::run, workers.back())));
+        ts.push_back(t);
+    }
+
+    start = po6::monotonic_time();
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->start();
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+
+    secs = (po6::monotonic_time() - start) / 1e9;
+    uint64_t errors = 0;
+
+    for (unsigned op = 0; op < OP_COUNT; ++op)
+    {
+        std::vector<uint64_t> merged;
+
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            std::vector<uint64_t>* l = workers[i]->latencies(op);
+            merged.insert(merged.end(), l->begin(), l->end());
+        }
+
+        print_latencies(optype_names[op], secs, &merged);
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        errors += workers[i]->errors();
+        delete workers[i];
+    }
+
+    printf("total: %.0f ops/s over %.3fs, %llu errors\n",
+           threads * w.ops / secs, secs, (unsigned long long)errors);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "test/kvs/scratch.h"
+#include "test/th.h"
+#include "kvs/expiring_datalayer.h"
+#include "kvs/leveldb_datalayer.h"
+
+using namespace consus;
+
+#define TABLE "t"
+#define TTL (60ULL * PO6_SECONDS)
+
+static expiring_datalayer*
+create(const std::string& dir)
+{
+    std::map<std::string, uint64_t> ttls;
+    ttls[TABLE] = TTL;
+    std::auto_ptr<expiring_datalayer> dl(new expiring_datalayer(new leveldb_datalayer(false), ttls));
+    ASSERT_TRUE(dl->init(dir));
+    return dl.release();
+}
+
+static consus_returncode
+get(datalayer* dl, const std::string& table, const std::string& key,
+    uint64_t* timestamp, std::string* value)
+{
+    datalayer::reference* ref = NULL;
+    e::slice v;
+    consus_returncode rc = dl->get(e::slice(table), e::slice(key), UINT64_MAX - 1, timestamp, &v, &ref);
+    value->assign(v.cdata(), v.size());
+    delete ref;
+    return rc;
+}
+
+static void
+put(datalayer* dl, const std::string& table, const std::string& key, uint64_t timestamp)
+{
+    ASSERT_EQ(dl->put(e::slice(table), e::slice(key), timestamp, e::slice("v")), CONSUS_SUCCESS);
+}
+
+static uint64_t
+sweep_all(expiring_datalayer* dl, uint64_t now)
+{
+    std::string cursor;
+    bool done = false;
+    uint64_t total = 0;
+
+    while (!done)
+    {
+        std::string next;
+        uint64_t swept = 0;
+        ASSERT_EQ(dl->sweep(now, cursor, 2, &next, &done, &swept), CONSUS_SUCCESS);
+        total += swept;
+        cursor = next;
+    }
+
+    return total;
+}
+
+TEST(ExpiringDatalayer, ExpiresStrictlyAfterTheTTL)
+{
+    scratch_dir dir;
+    std::auto_ptr<expiring_datalayer> dl(create(dir.path()));
+    const uint64_t t = 1000 * PO6_SECONDS;
+    put(dl.get(), TABLE, "k", t);
+
+    // a version written at t is readable through t + TTL, and gone just after
+    ASSERT_EQ(sweep_all(dl.get(), t), 0U);
+    ASSERT_EQ(sweep_all(dl.get(), t + TTL), 0U);
+    ASSERT_EQ(sweep_all(dl.get(), t + TTL + 1), 1U);
+    // once swept it is a tombstone, which is never swept again
+    ASSERT_EQ(sweep_all(dl.get(), t + TTL + 1), 0U);
+
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(dl.get(), TABLE, "k", &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, t);
+}
+
+TEST(ExpiringDatalayer, ReadsHideExpiredVersions)
+{
+    scratch_dir dir;
+    std::auto_ptr<expiring_datalayer> dl(create(dir.path()));
+    const uint64_t now = po6::wallclock_time();
+    put(dl.get(), TABLE, "fresh", now - TTL / 2);
+    put(dl.get(), TABLE, "stale", now - 2 * TTL);
+    put(dl.get(), "other", "stale", now - 2 * TTL);
+
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(dl.get(), TABLE, "fresh", &ts, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == "v");
+    // unswept, an expired version reads as the tombstone sweeping leaves
+    ASSERT_EQ(get(dl.get(), TABLE, "stale", &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, now - 2 * TTL);
+    ASSERT_TRUE(v.empty());
+    // tables without a TTL keep everything
+    ASSERT_EQ(get(dl.get(), "other", "stale", &ts, &v), CONSUS_SUCCESS);
+
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(dl->scan(e::slice(TABLE), e::slice(), UINT64_MAX - 1, 10, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 2U);
+    ASSERT_TRUE(items[0].key == "fresh");
+    ASSERT_TRUE(items[0].value == "v");
+    ASSERT_TRUE(items[1].key == "stale");
+    ASSERT_TRUE(items[1].value.empty());
+
+    // and expired versions never travel to other replicas
+    std::vector<datalayer::raw_item> raw;
+    std::string next;
+    bool done = false;
+    ASSERT_EQ(dl->raw_scan(std::string(), 10, &raw, &next, &done), CONSUS_SUCCESS);
+    ASSERT_TRUE(done);
+    ASSERT_EQ(raw.size(), 2U);
+    ASSERT_TRUE(raw[0].table == TABLE);
+    ASSERT_TRUE(raw[0].key == "fresh");
+    ASSERT_TRUE(raw[1].table == "other");
+}
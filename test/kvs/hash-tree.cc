@@ -0,0 +1,178 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdint.h>
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// consus
+#include "test/th.h"
+#include "kvs/hash_tree.h"
+
+using namespace consus;
+
+// Finds the indices of [lower, upper] on which two trees differ the way
+// anti-entropy does, splitting every range that differs sixteen ways until
+// single indices remain.
+static void
+diff(hash_tree* a, hash_tree* b, uint16_t lower, uint16_t upper,
+     std::vector<uint16_t>* out, uint64_t* compared)
+{
+    ++*compared;
+
+    if (a->digest(lower, upper) == b->digest(lower, upper))
+    {
+        return;
+    }
+
+    if (lower == upper)
+    {
+        out->push_back(lower);
+        return;
+    }
+
+    const uint32_t width = uint32_t(upper) - lower + 1;
+    const uint32_t step = (width + 15) / 16;
+
+    for (uint32_t lo = lower; lo <= upper; lo += step)
+    {
+        const uint32_t hi = std::min(lo + step - 1, uint32_t(upper));
+        diff(a, b, lo, hi, out, compared);
+    }
+}
+
+static std::vector<uint16_t>
+diff(hash_tree* a, hash_tree* b, uint64_t* compared)
+{
+    std::vector<uint16_t> out;
+    *compared = 0;
+    diff(a, b, 0, CONSUS_KVS_PARTITIONS - 1, &out, compared);
+    return out;
+}
+
+TEST(HashTree, OrderDoesNotMatter)
+{
+    hash_tree a;
+    hash_tree b;
+
+    for (uint64_t i = 0; i < 1000; ++i)
+    {
+        a.toggle(i * 7919 % CONSUS_KVS_PARTITIONS, i * 0x9e3779b97f4a7c15ULL);
+    }
+
+    for (uint64_t i = 1000; i > 0; --i)
+    {
+        b.toggle((i - 1) * 7919 % CONSUS_KVS_PARTITIONS, (i - 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    uint64_t compared = 0;
+    ASSERT_EQ(a.digest(0, CONSUS_KVS_PARTITIONS - 1), b.digest(0, CONSUS_KVS_PARTITIONS - 1));
+    ASSERT_TRUE(diff(&a, &b, &compared).empty());
+    ASSERT_EQ(compared, 1U);
+}
+
+TEST(HashTree, ToggleTwiceRemoves)
+{
+    hash_tree a;
+    hash_tree empty;
+    a.toggle(42, 0xdeadbeef);
+    ASSERT_NE(a.digest(0, CONSUS_KVS_PARTITIONS - 1), 0U);
+    ASSERT_EQ(a.digest(42, 42), 0xdeadbeefU);
+    ASSERT_EQ(a.digest(0, 41), 0U);
+    ASSERT_EQ(a.digest(43, CONSUS_KVS_PARTITIONS - 1), 0U);
+    a.toggle(42, 0xdeadbeef);
+    ASSERT_EQ(a.digest(0, CONSUS_KVS_PARTITIONS - 1), 0U);
+
+    uint64_t compared = 0;
+    ASSERT_TRUE(diff(&a, &empty, &compared).empty());
+}
+
+TEST(HashTree, DiffFindsExactlyTheDifferingIndices)
+{
+    hash_tree a;
+    hash_tree b;
+
+    for (uint64_t i = 0; i < CONSUS_KVS_PARTITIONS; i += 3)
+    {
+        a.toggle(i, i + 1);
+        b.toggle(i, i + 1);
+    }
+
+    // the edges of the ring, neighbours, and a spot where the other side has
+    // an extra hash, a missing one, and a different one
+    std::vector<uint16_t> expected;
+    expected.push_back(0);
+    expected.push_back(1);
+    expected.push_back(2);
+    expected.push_back(4097);
+    expected.push_back(CONSUS_KVS_PARTITIONS - 1);
+    a.toggle(0, 0xabc);
+    b.toggle(1, 0xabc);
+    a.toggle(2, 0x123);
+    b.toggle(2, 0x456);
+    b.toggle(4097, 4097 + 1);
+    a.toggle(CONSUS_KVS_PARTITIONS - 1, 1);
+
+    uint64_t compared = 0;
+    std::vector<uint16_t> found(diff(&a, &b, &compared));
+    std::sort(found.begin(), found.end());
+    ASSERT_EQ(found.size(), expected.size());
+
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        ASSERT_EQ(found[i], expected[i]);
+    }
+
+    // the descent only opens ranges that differ
+    ASSERT_LT(compared, 16U * 4U * expected.size() + 1U);
+
+    a.clear();
+    ASSERT_EQ(a.digest(0, CONSUS_KVS_PARTITIONS - 1), 0U);
+}
+
+TEST(HashTree, RangeDigestsCombine)
+{
+    hash_tree a;
+
+    for (uint64_t i = 0; i < 4096; ++i)
+    {
+        a.toggle(i * 13 % CONSUS_KVS_PARTITIONS, (i + 1) * 0x100000001b3ULL);
+    }
+
+    // any split of a range combines back to the range's digest
+    const uint16_t splits[] = {0, 1, 1000, 32767, 32768, 65534};
+
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i)
+    {
+        const uint16_t s = splits[i];
+        ASSERT_EQ(a.digest(0, s) ^ a.digest(s + 1, CONSUS_KVS_PARTITIONS - 1),
+                  a.digest(0, CONSUS_KVS_PARTITIONS - 1));
+    }
+}
@@ -0,0 +1,304 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// consus
+#include "test/kvs/scratch.h"
+#include "test/th.h"
+#include "kvs/leveldb_datalayer.h"
+
+using namespace consus;
+
+#define TABLE "t"
+
+static std::string
+bytes(const char* s, size_t sz)
+{
+    return std::string(s, sz);
+}
+
+static consus_returncode
+get(datalayer* dl, const std::string& table, const std::string& key,
+    uint64_t timestamp_le, uint64_t* timestamp, std::string* value)
+{
+    datalayer::reference* ref = NULL;
+    e::slice v;
+    consus_returncode rc = dl->get(e::slice(table), e::slice(key), timestamp_le, timestamp, &v, &ref);
+    value->assign(v.cdata(), v.size());
+    delete ref;
+    return rc;
+}
+
+static void
+put(datalayer* dl, const std::string& table, const std::string& key,
+    uint64_t timestamp, const std::string& value)
+{
+    ASSERT_EQ(dl->put(e::slice(table), e::slice(key), timestamp, e::slice(value)), CONSUS_SUCCESS);
+}
+
+static void
+raw_scan_all(datalayer* dl, std::vector<datalayer::raw_item>* all)
+{
+    std::string cursor;
+    bool done = false;
+    all->clear();
+
+    while (!done)
+    {
+        std::vector<datalayer::raw_item> items;
+        std::string next;
+        ASSERT_EQ(dl->raw_scan(cursor, 2, &items, &next, &done), CONSUS_SUCCESS);
+        all->insert(all->end(), items.begin(), items.end());
+        cursor = next;
+    }
+}
+
+TEST(LevelDBDatalayer, ScanFollowsByteOrder)
+{
+    scratch_dir dir;
+    leveldb_datalayer dl(false);
+    ASSERT_TRUE(dl.init(dir.path()));
+    // in byte order; a length prefix or an unescaped NUL would reorder them
+    std::vector<std::string> keys;
+    keys.push_back(bytes("\x00", 1));
+    keys.push_back(bytes("\x00\x00", 2));
+    keys.push_back(bytes("\x00\x01", 2));
+    keys.push_back(bytes("\x00\xff", 2));
+    keys.push_back(bytes("\x01", 1));
+    keys.push_back(bytes("a", 1));
+    keys.push_back(bytes("a\x00", 2));
+    keys.push_back(bytes("a\x00\x01", 3));
+    keys.push_back(bytes("a\x00\xff", 3));
+    keys.push_back(bytes("a\x01", 2));
+    keys.push_back(bytes("ab", 2));
+    keys.push_back(bytes("b", 1));
+    keys.push_back(bytes("\xff", 1));
+    keys.push_back(bytes("\xff\xff", 2));
+
+    for (size_t i = keys.size(); i > 0; --i)
+    {
+        put(&dl, TABLE, keys[i - 1], 1, "v" + keys[i - 1]);
+        // a table whose name extends this one must not interleave with it
+        put(&dl, TABLE "t", keys[i - 1], 1, "w" + keys[i - 1]);
+    }
+
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(dl.scan(e::slice(TABLE), e::slice(), 10, 100, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), keys.size());
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        ASSERT_TRUE(items[i].key == keys[i]);
+        ASSERT_EQ(items[i].timestamp, 1U);
+        ASSERT_TRUE(items[i].value == "v" + keys[i]);
+    }
+
+    // starting mid-way lands on the first key at or after the start
+    ASSERT_EQ(dl.scan(e::slice(TABLE), e::slice(keys[6]), 10, 3, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 3U);
+    ASSERT_TRUE(items[0].key == keys[6]);
+    ASSERT_TRUE(items[1].key == keys[7]);
+    ASSERT_TRUE(items[2].key == keys[8]);
+
+    std::vector<datalayer::raw_item> raw;
+    raw_scan_all(&dl, &raw);
+    ASSERT_EQ(raw.size(), 2 * keys.size());
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        ASSERT_TRUE(raw[i].table == TABLE);
+        ASSERT_TRUE(raw[i].key == keys[i]);
+        ASSERT_TRUE(raw[keys.size() + i].table == TABLE "t");
+        ASSERT_TRUE(raw[keys.size() + i].key == keys[i]);
+    }
+}
+
+TEST(LevelDBDatalayer, EscapedKeysStayDistinct)
+{
+    scratch_dir dir;
+    leveldb_datalayer dl(false);
+    ASSERT_TRUE(dl.init(dir.path()));
+    // each is the one before with bytes that look like the key terminator
+    // or its escape appended
+    std::vector<std::string> keys;
+    keys.push_back(bytes("a", 1));
+    keys.push_back(bytes("a\x00", 2));
+    keys.push_back(bytes("a\x00\x01", 3));
+    keys.push_back(bytes("a\x00\xff", 3));
+    keys.push_back(bytes("a\x00\xff\x00\x01", 5));
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        put(&dl, TABLE, keys[i], 1 + i, "v" + keys[i]);
+    }
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        uint64_t ts = 0;
+        std::string v;
+        ASSERT_EQ(get(&dl, TABLE, keys[i], UINT64_MAX, &ts, &v), CONSUS_SUCCESS);
+        ASSERT_EQ(ts, 1 + i);
+        ASSERT_TRUE(v == "v" + keys[i]);
+    }
+
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(dl.del(e::slice(TABLE), e::slice(keys[1]), 10), CONSUS_SUCCESS);
+    ASSERT_EQ(get(&dl, TABLE, keys[1], UINT64_MAX, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(get(&dl, TABLE, keys[0], UINT64_MAX, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(get(&dl, TABLE, keys[2], UINT64_MAX, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(get(&dl, TABLE, bytes("a\x00\x00", 3), UINT64_MAX, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(get(&dl, TABLE "t", keys[0], UINT64_MAX, &ts, &v), CONSUS_NOT_FOUND);
+}
+
+TEST(LevelDBDatalayer, VersionsSortNewestFirst)
+{
+    scratch_dir dir;
+    leveldb_datalayer dl(false);
+    ASSERT_TRUE(dl.init(dir.path()));
+    // timestamps whose big-endian bytes differ in different places
+    put(&dl, TABLE, "k", 0xff, "a");
+    put(&dl, TABLE, "k", 0x10000, "c");
+    put(&dl, TABLE, "k", 0x100, "b");
+    uint64_t ts = 0;
+    std::string v;
+
+    ASSERT_EQ(get(&dl, TABLE, "k", UINT64_MAX, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 0x10000U);
+    ASSERT_TRUE(v == "c");
+    ASSERT_EQ(get(&dl, TABLE, "k", 0xffff, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 0x100U);
+    ASSERT_TRUE(v == "b");
+    ASSERT_EQ(get(&dl, TABLE, "k", 0x100, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 0x100U);
+    ASSERT_EQ(get(&dl, TABLE, "k", 0xff, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 0xffU);
+    ASSERT_TRUE(v == "a");
+    ASSERT_EQ(get(&dl, TABLE, "k", 0xfe, &ts, &v), CONSUS_NOT_FOUND);
+
+    std::vector<datalayer::raw_item> raw;
+    raw_scan_all(&dl, &raw);
+    ASSERT_EQ(raw.size(), 3U);
+    ASSERT_EQ(raw[0].timestamp, 0x10000U);
+    ASSERT_EQ(raw[1].timestamp, 0x100U);
+    ASSERT_EQ(raw[2].timestamp, 0xffU);
+}
+
+TEST(LevelDBDatalayer, DeletesHideOlderVersions)
+{
+    scratch_dir dir;
+    leveldb_datalayer dl(false);
+    ASSERT_TRUE(dl.init(dir.path()));
+    put(&dl, TABLE, "k", 10, "v");
+    ASSERT_EQ(dl.del(e::slice(TABLE), e::slice("k"), 20), CONSUS_SUCCESS);
+    uint64_t ts = 0;
+    std::string v;
+
+    ASSERT_EQ(get(&dl, TABLE, "k", 30, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 20U);
+    ASSERT_EQ(get(&dl, TABLE, "k", 15, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "v");
+
+    // scans report the delete so that replicas can be merged
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(dl.scan(e::slice(TABLE), e::slice(), 30, 10, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 1U);
+    ASSERT_TRUE(items[0].key == "k");
+    ASSERT_EQ(items[0].timestamp, 20U);
+    ASSERT_TRUE(items[0].value.empty());
+}
+
+TEST(LevelDBDatalayer, PresenceMarkersStayHidden)
+{
+    scratch_dir dir;
+    leveldb_datalayer dl(false);
+    ASSERT_TRUE(dl.init(dir.path()));
+    uint64_t ts = 0;
+    std::string v;
+
+    ASSERT_EQ(get(&dl, TABLE, "k", UINT64_MAX, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 0U);
+
+    put(&dl, TABLE, "k", 10, "a");
+    put(&dl, TABLE, "k", 20, "b");
+    ASSERT_EQ(dl.del(e::slice(TABLE), e::slice("j"), 5), CONSUS_SUCCESS);
+
+    // the marker sits at UINT64_MAX, where no reader may find it
+    ASSERT_EQ(get(&dl, TABLE, "k", UINT64_MAX, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 20U);
+    ASSERT_TRUE(v == "b");
+    ASSERT_EQ(get(&dl, TABLE, "j", UINT64_MAX, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 5U);
+
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(dl.scan(e::slice(TABLE), e::slice(), UINT64_MAX, 10, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 2U);
+    ASSERT_TRUE(items[0].key == "j");
+    ASSERT_EQ(items[0].timestamp, 5U);
+    ASSERT_TRUE(items[1].key == "k");
+    ASSERT_EQ(items[1].timestamp, 20U);
+    ASSERT_TRUE(items[1].value == "b");
+
+    // and raw scans ship versions only; the receiver writes its own markers
+    std::vector<datalayer::raw_item> raw;
+    raw_scan_all(&dl, &raw);
+    ASSERT_EQ(raw.size(), 3U);
+    ASSERT_TRUE(raw[0].key == "j");
+    ASSERT_EQ(raw[0].timestamp, 5U);
+    ASSERT_TRUE(raw[1].key == "k");
+    ASSERT_EQ(raw[1].timestamp, 20U);
+    ASSERT_TRUE(raw[2].key == "k");
+    ASSERT_EQ(raw[2].timestamp, 10U);
+}
+
+TEST(LevelDBDatalayer, PresenceMarkersSurviveReopen)
+{
+    scratch_dir dir;
+
+    {
+        leveldb_datalayer dl(false);
+        ASSERT_TRUE(dl.init(dir.path()));
+        put(&dl, TABLE, "k", 10, "a");
+    }
+
+    leveldb_datalayer dl(false);
+    ASSERT_TRUE(dl.init(dir.path()));
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(&dl, TABLE, "k", UINT64_MAX, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "a");
+    ASSERT_EQ(get(&dl, TABLE, "l", UINT64_MAX, &ts, &v), CONSUS_NOT_FOUND);
+}
@@ -0,0 +1,386 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// STL
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// consus
+#include "test/th.h"
+#include "kvs/row_cache.h"
+
+using namespace consus;
+
+#define TABLE "t"
+
+namespace
+{
+
+// Every version of every key in memory, newest first per key, counting the
+// reads that reach it.  A delete is a version with an empty value.
+class memory_datalayer : public datalayer
+{
+    public:
+        memory_datalayer() : gets(0), cache(NULL), race_key(), race_ts(0), race_value(), m_versions() {}
+        virtual ~memory_datalayer() throw () {}
+
+    public:
+        virtual bool init(std::string) { return true; }
+        virtual consus_returncode get(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp_le,
+                                      uint64_t* timestamp,
+                                      e::slice* value,
+                                      reference** ref)
+        {
+            ++gets;
+            value_ref* r = new value_ref();
+            *ref = r;
+            *timestamp = 0;
+            consus_returncode rc = CONSUS_NOT_FOUND;
+            versions_t::iterator it = m_versions.find(row(table, key));
+
+            if (it != m_versions.end())
+            {
+                version_map_t::iterator v = it->second.lower_bound(timestamp_le);
+
+                if (v != it->second.end())
+                {
+                    *timestamp = v->first;
+                    r->value = v->second;
+                    rc = v->second.empty() ? CONSUS_NOT_FOUND : CONSUS_SUCCESS;
+                }
+            }
+
+            if (value)
+            {
+                *value = e::slice(r->value);
+            }
+
+            // a write that lands between this read and the cache's fill
+            if (cache && !race_key.empty())
+            {
+                std::string k;
+                k.swap(race_key);
+                ASSERT_EQ(cache->put(e::slice(TABLE), e::slice(k), race_ts, e::slice(race_value)), CONSUS_SUCCESS);
+            }
+
+            return rc;
+        }
+        virtual consus_returncode scan(const e::slice&, const e::slice&, uint64_t, uint64_t,
+                                       std::vector<scan_item>*) { return CONSUS_SUCCESS; }
+        virtual consus_returncode put(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp,
+                                      const e::slice& value)
+        {
+            m_versions[row(table, key)][timestamp] = std::string(value.cdata(), value.size());
+            return CONSUS_SUCCESS;
+        }
+        virtual consus_returncode del(const e::slice& table,
+                                      const e::slice& key,
+                                      uint64_t timestamp)
+        {
+            m_versions[row(table, key)][timestamp] = std::string();
+            return CONSUS_SUCCESS;
+        }
+        virtual consus_returncode raw_scan(const std::string&, uint64_t,
+                                           std::vector<raw_item>*,
+                                           std::string*, bool* done)
+        { *done = true; return CONSUS_SUCCESS; }
+        virtual snapshot* create_snapshot() { return new snapshot(); }
+        virtual consus_returncode raw_scan(const snapshot*, const std::string&, uint64_t,
+                                           std::vector<raw_item>*,
+                                           std::string*, bool* done)
+        { *done = true; return CONSUS_SUCCESS; }
+        virtual consus_returncode prune(uint64_t, uint64_t, const std::string&, uint64_t,
+                                        std::string*, bool* done, uint64_t* pruned)
+        { *done = true; *pruned = 0; return CONSUS_SUCCESS; }
+        virtual consus_returncode read_lock(const e::slice&, const e::slice&,
+                                            std::vector<transaction_group>* holders,
+                                            bool* shared)
+        { holders->clear(); *shared = false; return CONSUS_SUCCESS; }
+        virtual consus_returncode write_lock(const e::slice&, const e::slice&,
+                                             const std::vector<transaction_group>&, bool)
+        { return CONSUS_SUCCESS; }
+        virtual consus_returncode checkpoint_locks() { return CONSUS_SUCCESS; }
+        virtual consus_returncode scan_locks(const std::string&, uint64_t,
+                                             std::vector<lock_item>*,
+                                             std::string*, bool* done)
+        { *done = true; return CONSUS_SUCCESS; }
+        virtual unsigned write_pressure() { return 0; }
+        virtual void stats(storage_stats*) {}
+
+    public:
+        uint64_t gets;
+        // set race_key to have the next get write race_value at race_ts
+        // through cache once it has read
+        datalayer* cache;
+        std::string race_key;
+        uint64_t race_ts;
+        std::string race_value;
+
+    private:
+        struct value_ref : public reference
+        {
+            value_ref() : value() {}
+            virtual ~value_ref() throw () {}
+            std::string value;
+        };
+        struct newest_first
+        {
+            bool operator () (uint64_t lhs, uint64_t rhs) const { return lhs > rhs; }
+        };
+        typedef std::map<uint64_t, std::string, newest_first> version_map_t;
+        typedef std::map<std::pair<std::string, std::string>, version_map_t> versions_t;
+        static std::pair<std::string, std::string> row(const e::slice& table, const e::slice& key)
+        { return std::make_pair(std::string(table.cdata(), table.size()),
+                                std::string(key.cdata(), key.size())); }
+        versions_t m_versions;
+};
+
+struct cached_store
+{
+    cached_store(uint64_t budget)
+        : backing(new memory_datalayer())
+        , cache(backing, budget)
+    {
+        backing->cache = &cache;
+    }
+
+    memory_datalayer* backing;
+    row_cache cache;
+
+    private:
+        cached_store(const cached_store&);
+        cached_store& operator = (const cached_store&);
+};
+
+} // namespace
+
+static consus_returncode
+get(datalayer* dl, const std::string& key, uint64_t timestamp_le,
+    uint64_t* timestamp, std::string* value)
+{
+    datalayer::reference* ref = NULL;
+    e::slice v;
+    consus_returncode rc = dl->get(e::slice(TABLE), e::slice(key), timestamp_le, timestamp, &v, &ref);
+    value->assign(v.cdata(), v.size());
+    delete ref;
+    return rc;
+}
+
+static void
+put(datalayer* dl, const std::string& key, uint64_t timestamp, const std::string& value)
+{
+    ASSERT_EQ(dl->put(e::slice(TABLE), e::slice(key), timestamp, e::slice(value)), CONSUS_SUCCESS);
+}
+
+// one counter out of row_cache::debug_dump
+static uint64_t
+counter(row_cache* rc, const char* name)
+{
+    const std::string dump = rc->debug_dump();
+    const std::string field = std::string(" ") + name + "=";
+    size_t pos = dump.find(field);
+    ASSERT_NE(pos, std::string::npos);
+    return strtoull(dump.c_str() + pos + field.size(), NULL, 10);
+}
+
+TEST(RowCache, RepeatReadsStayInMemory)
+{
+    cached_store s(1024 * 1024);
+    put(&s.cache, "k", 5, "v5");
+    uint64_t ts = 0;
+    std::string v;
+
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+        ASSERT_EQ(ts, 5U);
+        ASSERT_TRUE(v == "v5");
+    }
+
+    ASSERT_EQ(s.backing->gets, 1U);
+    ASSERT_EQ(counter(&s.cache, "hits"), 2U);
+    ASSERT_EQ(counter(&s.cache, "misses"), 1U);
+
+    // a key that was never written is cached as absent
+    ASSERT_EQ(get(&s.cache, "none", UINT64_MAX - 1, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(get(&s.cache, "none", UINT64_MAX - 1, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 0U);
+    ASSERT_EQ(s.backing->gets, 2U);
+}
+
+TEST(RowCache, OlderReadsPassThrough)
+{
+    cached_store s(1024 * 1024);
+    put(&s.cache, "k", 5, "v5");
+    put(&s.cache, "k", 10, "v10");
+    uint64_t ts = 0;
+    std::string v;
+
+    // a miss caches the newest version, then reads the one asked for
+    ASSERT_EQ(get(&s.cache, "k", 7, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 5U);
+    ASSERT_TRUE(v == "v5");
+    ASSERT_EQ(s.backing->gets, 2U);
+
+    ASSERT_EQ(get(&s.cache, "k", 10, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "v10");
+    ASSERT_EQ(s.backing->gets, 2U);
+
+    // older than the cached version, so only the backing store knows
+    ASSERT_EQ(get(&s.cache, "k", 9, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 5U);
+    ASSERT_TRUE(v == "v5");
+    ASSERT_EQ(get(&s.cache, "k", 4, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(s.backing->gets, 4U);
+}
+
+TEST(RowCache, WritesRefreshCachedKeys)
+{
+    cached_store s(1024 * 1024);
+    put(&s.cache, "k", 5, "v5");
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    put(&s.cache, "k", 10, "v10");
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "v10");
+    // a write that arrives late does not displace a newer version
+    put(&s.cache, "k", 7, "v7");
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "v10");
+    ASSERT_EQ(s.backing->gets, 1U);
+}
+
+TEST(RowCache, DeletesBecomeNotFound)
+{
+    cached_store s(1024 * 1024);
+    put(&s.cache, "k", 5, "v5");
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(s.cache.del(e::slice(TABLE), e::slice("k"), 20), CONSUS_SUCCESS);
+
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 20U);
+    ASSERT_TRUE(v.empty());
+    ASSERT_EQ(s.backing->gets, 1U);
+
+    // the version beneath the delete is still there for older readers
+    ASSERT_EQ(get(&s.cache, "k", 15, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 5U);
+    ASSERT_TRUE(v == "v5");
+    ASSERT_EQ(s.backing->gets, 2U);
+
+    // a delete read from the backing store is cached the same way
+    put(&s.cache, "j", 5, "v5");
+    ASSERT_EQ(s.backing->del(e::slice(TABLE), e::slice("j"), 20), CONSUS_SUCCESS);
+    ASSERT_EQ(get(&s.cache, "j", UINT64_MAX - 1, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(get(&s.cache, "j", UINT64_MAX - 1, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 20U);
+    ASSERT_EQ(s.backing->gets, 3U);
+}
+
+TEST(RowCache, RacingWriteSuppressesFill)
+{
+    cached_store s(1024 * 1024);
+    put(&s.cache, "k", 5, "v5");
+    s.backing->race_key = "k";
+    s.backing->race_ts = 10;
+    s.backing->race_value = "v10";
+    uint64_t ts = 0;
+    std::string v;
+
+    // the read saw the version before the write, and must not cache it
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 5U);
+    ASSERT_TRUE(v == "v5");
+    ASSERT_EQ(s.backing->gets, 1U);
+
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "v10");
+    ASSERT_EQ(s.backing->gets, 2U);
+
+    ASSERT_EQ(get(&s.cache, "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "v10");
+    ASSERT_EQ(s.backing->gets, 2U);
+}
+
+TEST(RowCache, EvictsWithinBudget)
+{
+    // each shard has room for one of these rows but not two
+    const uint64_t budget = 64 * 256;
+    cached_store s(budget);
+    const std::string value(100, 'v');
+    const unsigned keys = 1000;
+    char buf[16];
+
+    for (unsigned i = 0; i < keys; ++i)
+    {
+        snprintf(buf, sizeof(buf), "k%u", i);
+        put(&s.cache, buf, 5, value);
+        uint64_t ts = 0;
+        std::string v;
+        ASSERT_EQ(get(&s.cache, buf, UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+        // the row just read is the last to go
+        ASSERT_EQ(get(&s.cache, buf, UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+        ASSERT_TRUE(v == value);
+    }
+
+    ASSERT_EQ(s.backing->gets, uint64_t(keys));
+    const uint64_t entries = counter(&s.cache, "entries");
+    ASSERT_LE(entries, 64U);
+    ASSERT_LE(counter(&s.cache, "bytes"), budget);
+    ASSERT_EQ(counter(&s.cache, "evictions"), keys - entries);
+
+    // all but the survivors have to be read again
+    for (unsigned i = 0; i < keys; ++i)
+    {
+        snprintf(buf, sizeof(buf), "k%u", i);
+        uint64_t ts = 0;
+        std::string v;
+        ASSERT_EQ(get(&s.cache, buf, UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    }
+
+    ASSERT_GE(s.backing->gets, uint64_t(2 * keys - entries));
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_test_kvs_scratch_h_
+#define consus_test_kvs_scratch_h_
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <ftw.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// An empty directory for one test's store, removed with everything beneath
+// it when the test is done.
+class scratch_dir
+{
+    public:
+        scratch_dir()
+            : m_path()
+        {
+            const char* tmp = getenv("TMPDIR");
+            std::string pattern(tmp && *tmp ? tmp : "/tmp");
+            pattern += "/consus-test-XXXXXX";
+            std::vector<char> buf(pattern.begin(), pattern.end());
+            buf.push_back('\0');
+
+            if (!mkdtemp(&buf[0]))
+            {
+                perror("mkdtemp");
+                abort();
+            }
+
+            m_path = &buf[0];
+        }
+        ~scratch_dir() throw ()
+        {
+            nftw(m_path.c_str(), remove_one, 16, FTW_DEPTH | FTW_PHYS);
+        }
+
+    public:
+        const std::string& path() const { return m_path; }
+        std::string path(const char* name) const { return m_path + "/" + name; }
+
+    private:
+        static int remove_one(const char* path, const struct stat*, int, struct FTW*)
+        {
+            return remove(path);
+        }
+
+    private:
+        std::string m_path;
+
+    private:
+        scratch_dir(const scratch_dir&);
+        scratch_dir& operator = (const scratch_dir&);
+};
+
+#endif // consus_test_kvs_scratch_h_
@@ -0,0 +1,242 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// STL
+#include <memory>
+#include <string>
+#include <vector>
+
+// consus
+#include "test/kvs/scratch.h"
+#include "test/th.h"
+#include "kvs/leveldb_datalayer.h"
+#include "kvs/tiered_datalayer.h"
+
+using namespace consus;
+
+#define TABLE "t"
+#define COLD_AGE 100
+
+namespace
+{
+
+// tiers a leveldb store in front of another, keeping a hand on both so tests
+// can see which one holds a key
+struct store
+{
+    store(const scratch_dir& dir);
+    ~store() throw () {}
+
+    datalayer* hot;
+    datalayer* cold;
+    std::auto_ptr<tiered_datalayer> dl;
+
+    private:
+        store(const store&);
+        store& operator = (const store&);
+};
+
+store :: store(const scratch_dir& dir)
+    : hot(new leveldb_datalayer(false))
+    , cold(new leveldb_datalayer(false))
+    , dl()
+{
+    dl.reset(new tiered_datalayer(hot, cold, dir.path("cold"), COLD_AGE));
+    ASSERT_TRUE(dl->init(dir.path()));
+}
+
+} // namespace
+
+static consus_returncode
+get(datalayer* dl, const std::string& key, uint64_t timestamp_le,
+    uint64_t* timestamp, std::string* value)
+{
+    datalayer::reference* ref = NULL;
+    e::slice v;
+    *timestamp = 0;
+    consus_returncode rc = dl->get(e::slice(TABLE), e::slice(key), timestamp_le, timestamp, &v, &ref);
+    value->assign(v.cdata(), v.size());
+    delete ref;
+    return rc;
+}
+
+static void
+put(datalayer* dl, const std::string& key, uint64_t timestamp, const std::string& value)
+{
+    ASSERT_EQ(dl->put(e::slice(TABLE), e::slice(key), timestamp, e::slice(value)), CONSUS_SUCCESS);
+}
+
+static uint64_t
+tier_all(tiered_datalayer* dl, uint64_t now)
+{
+    std::string cursor;
+    bool done = false;
+    uint64_t total = 0;
+
+    while (!done)
+    {
+        std::string next;
+        uint64_t moved = 0;
+        ASSERT_EQ(dl->tier(now, cursor, 2, &next, &done, &moved), CONSUS_SUCCESS);
+        total += moved;
+        cursor = next;
+    }
+
+    return total;
+}
+
+// true if the versions of key are in dl, and only there
+static bool
+held_by(datalayer* dl, datalayer* other, const std::string& key)
+{
+    uint64_t ts;
+    std::string v;
+    get(dl, key, UINT64_MAX - 1, &ts, &v);
+    const bool here = ts != 0;
+    get(other, key, UINT64_MAX - 1, &ts, &v);
+    return here && ts == 0;
+}
+
+TEST(TieredDatalayer, ReadsCrossTiers)
+{
+    scratch_dir dir;
+    store s(dir);
+    put(s.dl.get(), "old", 10, "a");
+    put(s.dl.get(), "old", 20, "b");
+    put(s.dl.get(), "new", 950, "c");
+    ASSERT_EQ(tier_all(s.dl.get(), 1000), 2U);
+    ASSERT_TRUE(held_by(s.cold, s.hot, "old"));
+    ASSERT_TRUE(held_by(s.hot, s.cold, "new"));
+
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), "old", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 20U);
+    ASSERT_TRUE(v == "b");
+    ASSERT_EQ(get(s.dl.get(), "old", 15, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "a");
+    ASSERT_EQ(get(s.dl.get(), "old", 5, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(get(s.dl.get(), "new", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == "c");
+    ASSERT_EQ(get(s.dl.get(), "none", UINT64_MAX - 1, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 0U);
+}
+
+TEST(TieredDatalayer, ColdTombstonesStayDeleted)
+{
+    scratch_dir dir;
+    store s(dir);
+    put(s.dl.get(), "k", 10, "a");
+    ASSERT_EQ(s.dl->del(e::slice(TABLE), e::slice("k"), 20), CONSUS_SUCCESS);
+    ASSERT_EQ(tier_all(s.dl.get(), 1000), 2U);
+    ASSERT_TRUE(held_by(s.cold, s.hot, "k"));
+
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), "k", UINT64_MAX - 1, &ts, &v), CONSUS_NOT_FOUND);
+    ASSERT_EQ(ts, 20U);
+    ASSERT_EQ(get(s.dl.get(), "k", 15, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_TRUE(v == "a");
+}
+
+TEST(TieredDatalayer, ScansMergeTiers)
+{
+    scratch_dir dir;
+    store s(dir);
+    put(s.dl.get(), "a", 10, "A");
+    put(s.dl.get(), "b", 950, "B");
+    put(s.dl.get(), "c", 10, "C");
+    put(s.dl.get(), "d", 950, "D");
+    ASSERT_EQ(tier_all(s.dl.get(), 1000), 2U);
+    ASSERT_TRUE(held_by(s.cold, s.hot, "a"));
+    ASSERT_TRUE(held_by(s.hot, s.cold, "b"));
+
+    std::vector<datalayer::scan_item> items;
+    ASSERT_EQ(s.dl->scan(e::slice(TABLE), e::slice(), UINT64_MAX - 1, 10, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 4U);
+    ASSERT_TRUE(items[0].key == "a" && items[0].value == "A");
+    ASSERT_TRUE(items[1].key == "b" && items[1].value == "B");
+    ASSERT_TRUE(items[2].key == "c" && items[2].value == "C");
+    ASSERT_TRUE(items[3].key == "d" && items[3].value == "D");
+
+    ASSERT_EQ(s.dl->scan(e::slice(TABLE), e::slice("b"), UINT64_MAX - 1, 2, &items), CONSUS_SUCCESS);
+    ASSERT_EQ(items.size(), 2U);
+    ASSERT_TRUE(items[0].key == "b");
+    ASSERT_TRUE(items[1].key == "c");
+
+    // raw scans cover the hot store and then the cold one
+    std::string cursor;
+    bool done = false;
+    std::vector<std::string> keys;
+
+    while (!done)
+    {
+        std::vector<datalayer::raw_item> raw;
+        std::string next;
+        ASSERT_EQ(s.dl->raw_scan(cursor, 1, &raw, &next, &done), CONSUS_SUCCESS);
+
+        for (size_t i = 0; i < raw.size(); ++i)
+        {
+            keys.push_back(raw[i].key);
+        }
+
+        cursor = next;
+    }
+
+    ASSERT_EQ(keys.size(), 4U);
+    ASSERT_TRUE(keys[0] == "b");
+    ASSERT_TRUE(keys[1] == "d");
+    ASSERT_TRUE(keys[2] == "a");
+    ASSERT_TRUE(keys[3] == "c");
+}
+
+TEST(TieredDatalayer, WritesPromoteColdKeys)
+{
+    scratch_dir dir;
+    store s(dir);
+    put(s.dl.get(), "k", 10, "a");
+    ASSERT_EQ(tier_all(s.dl.get(), 1000), 1U);
+    ASSERT_TRUE(held_by(s.cold, s.hot, "k"));
+
+    put(s.dl.get(), "k", 2000, "b");
+    ASSERT_TRUE(held_by(s.hot, s.cold, "k"));
+
+    uint64_t ts = 0;
+    std::string v;
+    ASSERT_EQ(get(s.dl.get(), "k", 15, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 10U);
+    ASSERT_TRUE(v == "a");
+    ASSERT_EQ(get(s.dl.get(), "k", UINT64_MAX - 1, &ts, &v), CONSUS_SUCCESS);
+    ASSERT_EQ(ts, 2000U);
+    ASSERT_TRUE(v == "b");
+
+    // recently written, it stays put
+    ASSERT_EQ(tier_all(s.dl.get(), 2050), 0U);
+}
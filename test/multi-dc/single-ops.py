@@ -0,0 +1,41 @@
+import time
+
+import consus
+
+# "the table" is held by every data center, so single-key operations, which
+# skip the global vote, are refused for it; the gremlin homes "homed" in dc1
+c = consus.Client()
+
+for op in (lambda: c.single_get('the table', 'k'),
+           lambda: c.single_put('the table', 'k', 'v'),
+           lambda: c.single_cas('the table', 'k', None, 'v')):
+    try:
+        op()
+        assert False, 'single-key operation on a replicated table succeeded'
+    except consus.ConsusInvalidException:
+        pass
+
+t = c.begin_transaction()
+assert t.get('the table', 'k') is None
+t.commit()
+
+# the transaction managers learn the home from the next configuration
+deadline = time.time() + 60
+while True:
+    try:
+        assert c.single_put('homed', 'k', 'v1')
+        break
+    except consus.ConsusInvalidException:
+        assert time.time() < deadline
+        time.sleep(0.1)
+
+assert c.single_get('homed', 'k') == 'v1'
+assert not c.single_cas('homed', 'k', 'v2', 'v3')
+assert c.single_cas('homed', 'k', 'v1', 'v2')
+
+t = c.begin_transaction()
+assert t.get('homed', 'k') == 'v2'
+assert t.put('homed', 'k', 'v3')
+t.commit()
+
+assert c.single_get('homed', 'k') == 'v3'
@@ -27,14 +27,25 @@
 
 #define __STDC_LIMIT_MACROS
 
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <sys/resource.h>
+#include <unistd.h>
+
 // STL
 #include <algorithm>
-#include <queue>
+#include <deque>
+#include <iostream>
+#include <vector>
 
 // po6
 #include <po6/threads/cond.h>
 #include <po6/threads/mutex.h>
 #include <po6/threads/thread.h>
+#include <po6/time.h>
 
 // e
 #include <e/atomic.h>
@@ -47,17 +58,54 @@
 #include "txman/generalized_paxos.h"
 
 #define MAX_ACCEPTORS 13
+// reordering picks among this many messages at the head of a queue
+#define REORDER_WINDOW 64
 
 using namespace consus;
 
+// Commands conflict with probability m_rate percent.  The decision is a
+// function of the unordered pair so that every acceptor agrees on it.
 struct comparator : public generalized_paxos::comparator
 {
-    comparator() {}
+    comparator() : m_rate(100) {}
     virtual ~comparator() throw () {}
-    virtual bool conflict(const generalized_paxos::command&,
-                          const generalized_paxos::command&) const { return true; }
+    virtual bool conflict(const generalized_paxos::command& a,
+                          const generalized_paxos::command& b) const;
+    long m_rate;
 };
 
+bool
+comparator :: conflict(const generalized_paxos::command& a,
+                       const generalized_paxos::command& b) const
+{
+    if (m_rate >= 100)
+    {
+        return true;
+    }
+
+    if (a.value.size() < sizeof(uint64_t) ||
+        b.value.size() < sizeof(uint64_t))
+    {
+        return true;
+    }
+
+    uint64_t x;
+    uint64_t y;
+    e::unpack64be(reinterpret_cast<const uint8_t*>(a.value.data()), &x);
+    e::unpack64be(reinterpret_cast<const uint8_t*>(b.value.data()), &y);
+
+    if (x > y)
+    {
+        std::swap(x, y);
+    }
+
+    uint64_t h = x * 0x9e3779b97f4a7c15ULL ^ y;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return long(h % 100) < m_rate;
+}
+
 comparator cmp;
 
 struct message
@@ -68,6 +116,7 @@ struct message
         , has_p1b(false), p1b()
         , has_p2a(false), p2a()
         , has_p2b(false), p2b()
+        , has_tick(false)
     {
     }
     ~message() throw ();
@@ -82,6 +131,8 @@ struct message
     generalized_paxos::message_p2a p2a;
     bool has_p2b;
     generalized_paxos::message_p2b p2b;
+    // retransmit what was last sent; only used when messages may be lost
+    bool has_tick;
 };
 
 message :: ~message() throw ()
@@ -95,6 +146,7 @@ class queue
         ~queue() throw ();
 
     public:
+        void reorder(long rate, unsigned seed);
         const message* pop();
         void push(const message* m);
         void done();
@@ -102,8 +154,10 @@ class queue
     private:
         po6::threads::mutex m_mtx;
         po6::threads::cond m_cnd;
-        std::queue<const message*> m_q;
+        std::deque<const message*> m_q;
         bool m_done;
+        long m_reorder;
+        uint16_t m_randbuf[3];
 };
 
 queue :: queue()
@@ -111,13 +165,26 @@ queue :: queue()
     , m_cnd(&m_mtx)
     , m_q()
     , m_done(false)
+    , m_reorder(0)
 {
+    m_randbuf[0] = 0;
+    m_randbuf[1] = 0;
+    m_randbuf[2] = 0xcafeU;
 }
 
 queue :: ~queue() throw ()
 {
 }
 
+void
+queue :: reorder(long rate, unsigned seed)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_reorder = rate;
+    m_randbuf[0] = seed;
+    m_randbuf[1] = seed >> 16;
+}
+
 const message*
 queue :: pop()
 {
@@ -130,8 +197,15 @@ queue :: pop()
 
     if (!m_q.empty())
     {
+        if (m_reorder > 0 && m_q.size() > 1 &&
+            nrand48(m_randbuf) % 100 < m_reorder)
+        {
+            size_t window = std::min(m_q.size(), size_t(REORDER_WINDOW));
+            std::swap(m_q.front(), m_q[nrand48(m_randbuf) % window]);
+        }
+
         const message* m = m_q.front();
-        m_q.pop();
+        m_q.pop_front();
         return m;
     }
     else
@@ -150,7 +224,7 @@ queue :: push(const message* m)
         m_cnd.signal();
     }
 
-    m_q.push(m);
+    m_q.push_back(m);
 }
 
 void
@@ -164,12 +238,14 @@ queue :: done()
 class server
 {
     public:
-        server(queue* queues, unsigned queues_sz, unsigned idx, long learn);
+        server(queue* queues, unsigned queues_sz, unsigned idx, long learn, long loss);
         ~server() throw ();
 
     public:
         void run();
         bool done(bool wait);
+        uint64_t sent() const { return m_sent; }
+        uint64_t dropped() const { return m_dropped; }
 
     private:
         void handle_command(const message* m);
@@ -177,6 +253,7 @@ class server
         void handle_p1b(const message* m);
         void handle_p2a(const message* m);
         void handle_p2b(const message* m);
+        void handle_tick(const message* m);
         void work_state_machine();
         void send_to_all(const generalized_paxos::message_p1a& m);
         void send_to_all(const generalized_paxos::message_p1b& m);
@@ -191,6 +268,9 @@ class server
         uint16_t m_randbuf[3];
         generalized_paxos m_gp;
         long m_learn;
+        long m_loss;
+        uint64_t m_sent;
+        uint64_t m_dropped;
         po6::threads::mutex m_done_mtx;
         po6::threads::cond m_done_cnd;
         bool m_done;
@@ -204,12 +284,15 @@ class server
         server& operator = (const server&);
 };
 
-server :: server(queue* queues, unsigned queues_sz, unsigned idx, long learn)
+server :: server(queue* queues, unsigned queues_sz, unsigned idx, long learn, long loss)
     : m_queues(queues)
     , m_queues_sz(queues_sz)
     , m_idx(idx)
     , m_gp()
     , m_learn(learn)
+    , m_loss(loss)
+    , m_sent(0)
+    , m_dropped(0)
     , m_done_mtx()
     , m_done_cnd(&m_done_mtx)
     , m_done(false)
@@ -247,6 +330,7 @@ server :: run()
         handle_p1b(msg);
         handle_p2a(msg);
         handle_p2b(msg);
+        handle_tick(msg);
     }
 }
 
@@ -336,6 +420,50 @@ server :: handle_p2b(const message* msg)
     }
 }
 
+void
+server :: handle_tick(const message* msg)
+{
+    if (!msg->has_tick)
+    {
+        return;
+    }
+
+    // the send_to_all overloads suppress duplicates, so go around them
+    if (m_prev_p1a != generalized_paxos::message_p1a())
+    {
+        message* m = new message();
+        m->has_p1a = true;
+        m->p1a = m_prev_p1a;
+        send_to_all(m);
+    }
+
+    if (m_prev_p1b != generalized_paxos::message_p1b())
+    {
+        message* m = new message();
+        m->has_p1b = true;
+        m->p1b = m_prev_p1b;
+        send_to_all(m);
+    }
+
+    if (m_prev_p2a != generalized_paxos::message_p2a())
+    {
+        message* m = new message();
+        m->has_p2a = true;
+        m->p2a = m_prev_p2a;
+        send_to_all(m);
+    }
+
+    if (m_prev_p2b != generalized_paxos::message_p2b())
+    {
+        message* m = new message();
+        m->has_p2b = true;
+        m->p2b = m_prev_p2b;
+        send_to_all(m);
+    }
+
+    work_state_machine();
+}
+
 void
 server :: work_state_machine()
 {
@@ -447,23 +575,124 @@ server :: send_to_all(message* m)
 {
     for (unsigned i = 0; i < m_queues_sz; ++i)
     {
+        // a server always hears itself
+        if (i != m_idx && m_loss > 0 &&
+            nrand48(m_randbuf) % 100 < m_loss)
+        {
+            ++m_dropped;
+            continue;
+        }
+
+        ++m_sent;
         m_queues[i].push(m);
     }
 }
 
+// Periodically asks every server to retransmit, so that lost messages do
+// not stall an instance forever.
+class ticker
+{
+    public:
+        ticker(queue* queues, size_t queues_sz, uint64_t interval);
+        ~ticker() throw ();
+
+    public:
+        void run();
+        void stop();
+
+    private:
+        queue* m_queues;
+        size_t m_queues_sz;
+        uint64_t m_interval;
+        uint32_t m_stop;
+        message m_tick;
+
+    private:
+        ticker(const ticker&);
+        ticker& operator = (const ticker&);
+};
+
+ticker :: ticker(queue* queues, size_t queues_sz, uint64_t interval)
+    : m_queues(queues)
+    , m_queues_sz(queues_sz)
+    , m_interval(interval)
+    , m_stop(0)
+    , m_tick()
+{
+    m_tick.has_tick = true;
+}
+
+ticker :: ~ticker() throw ()
+{
+}
+
+void
+ticker :: run()
+{
+    while (e::atomic::increment_32_nobarrier(&m_stop, 0) == 0)
+    {
+        usleep(m_interval);
+
+        for (size_t i = 0; i < m_queues_sz; ++i)
+        {
+            m_queues[i].push(&m_tick);
+        }
+    }
+}
+
+void
+ticker :: stop()
+{
+    e::atomic::increment_32_nobarrier(&m_stop, 1);
+}
+
+static uint64_t
+cpu_time()
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+    {
+        return 0;
+    }
+
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL
+         + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
 int
 main(int argc, const char* argv[])
 {
     long acceptors = 5;
     long numbers = 1000000;
+    long instances = 1;
+    long conflicts = 100;
+    long loss = 0;
+    long reorder = 0;
+    long retransmit = 1000;
     e::argparser ap;
     ap.autohelp();
     ap.arg().name('a', "acceptors")
             .description("how many acceptors to use (default: 5)")
             .as_long(&acceptors);
     ap.arg().name('n', "numbers")
-            .description("how many numbers to add (default: 1,000,000)")
+            .description("how many numbers to add to each instance (default: 1,000,000)")
             .as_long(&numbers);
+    ap.arg().name('i', "instances")
+            .description("how many independent instances to run concurrently (default: 1)")
+            .as_long(&instances);
+    ap.arg().name('c', "conflicts")
+            .description("percentage of command pairs that conflict (default: 100)")
+            .as_long(&conflicts);
+    ap.arg().name('l', "loss")
+            .description("percentage of messages between acceptors to drop (default: 0)")
+            .as_long(&loss);
+    ap.arg().name('r', "reorder")
+            .description("percentage of deliveries taken out of order (default: 0)")
+            .as_long(&reorder);
+    ap.arg().long_name("retransmit")
+            .description("with loss, retransmit every this many microseconds (default: 1000)")
+            .as_long(&retransmit);
 
     if (!ap.parse(argc, argv))
     {
@@ -491,47 +720,124 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
-    queue queues[MAX_ACCEPTORS];
-    server* servers[MAX_ACCEPTORS];
+    if (instances <= 0)
+    {
+        std::cerr << "must specify a positive number of instances\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (conflicts < 0 || conflicts > 100 ||
+        loss < 0 || loss >= 100 ||
+        reorder < 0 || reorder > 100)
+    {
+        std::cerr << "percentages must be between 0 and 100, and loss below 100\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (retransmit <= 0)
+    {
+        std::cerr << "must specify a positive retransmit interval\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    cmp.m_rate = conflicts;
+    const long servers_sz = instances * acceptors;
+    queue* queues = new queue[instances * MAX_ACCEPTORS];
+    std::vector<server*> servers;
 
-    for (long i = 0; i < acceptors; ++i)
+    for (long i = 0; i < instances; ++i)
     {
-        servers[i] = new server(queues, acceptors, i, numbers);
+        queue* qs = queues + i * MAX_ACCEPTORS;
+
+        for (long j = 0; j < acceptors; ++j)
+        {
+            qs[j].reorder(reorder, i * MAX_ACCEPTORS + j);
+            servers.push_back(new server(qs, acceptors, j, numbers, loss));
+        }
     }
 
     std::vector<e::compat::shared_ptr<po6::threads::thread> > threads;
 
-    for (long i = 0; i < acceptors; ++i)
+    for (long i = 0; i < servers_sz; ++i)
     {
         using namespace po6::threads;
         e::compat::shared_ptr<thread> ptr(new thread(make_obj_func(&server::run, servers[i])));
         threads.push_back(ptr);
     }
 
-    for (long i = 0; i < acceptors; ++i)
+    ticker tick(queues, instances * MAX_ACCEPTORS, retransmit);
+    po6::threads::thread tick_thread(po6::threads::make_obj_func(&ticker::run, &tick));
+    const uint64_t start_wall = po6::monotonic_time();
+    const uint64_t start_cpu = cpu_time();
+
+    for (long i = 0; i < servers_sz; ++i)
     {
         threads[i]->start();
     }
 
-    for (long i = 0; i < numbers; ++i)
+    if (loss > 0)
     {
-        message* m = new message();
-        m->has_c = true;
-        m->c.type = 1;
-        e::packer(&m->c.value) << uint64_t(i);
-        queues[i % acceptors].push(m);
+        tick_thread.start();
+    }
+
+    for (long i = 0; i < instances; ++i)
+    {
+        queue* qs = queues + i * MAX_ACCEPTORS;
+
+        for (long j = 0; j < numbers; ++j)
+        {
+            message* m = new message();
+            m->has_c = true;
+            m->c.type = 1;
+            e::packer(&m->c.value) << uint64_t(j);
+            qs[j % acceptors].push(m);
+        }
     }
 
-    for (long i = 0; i < acceptors; ++i)
+    for (long i = 0; i < servers_sz; ++i)
     {
         servers[i]->done(true);
     }
 
-    for (long i = 0; i < acceptors; ++i)
+    const uint64_t elapsed_wall = po6::monotonic_time() - start_wall;
+    const uint64_t elapsed_cpu = cpu_time() - start_cpu;
+
+    if (loss > 0)
     {
-        queues[i].push(NULL);
-        threads[i]->join();
+        tick.stop();
+        tick_thread.join();
+    }
+
+    uint64_t sent = 0;
+    uint64_t dropped = 0;
+
+    for (long i = 0; i < instances; ++i)
+    {
+        queue* qs = queues + i * MAX_ACCEPTORS;
+
+        for (long j = 0; j < acceptors; ++j)
+        {
+            qs[j].push(NULL);
+        }
     }
 
+    for (long i = 0; i < servers_sz; ++i)
+    {
+        threads[i]->join();
+        sent += servers[i]->sent();
+        dropped += servers[i]->dropped();
+    }
+
+    const double learned = double(numbers) * instances;
+    const double secs = elapsed_wall / 1e9;
+    printf("learned %.0f commands in %.3fs (%.0f commands/s)\n",
+           learned, secs, learned / secs);
+    printf("messages: %llu delivered, %llu dropped, %.2f delivered per learned command\n",
+           (unsigned long long)sent, (unsigned long long)dropped, sent / learned);
+    printf("cpu: %.3fs (%.2fus per learned command)\n",
+           elapsed_cpu / 1e6, elapsed_cpu / learned);
     return EXIT_SUCCESS;
 }
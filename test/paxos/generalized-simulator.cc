@@ -0,0 +1,714 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+// e
+#include <e/popt.h>
+#include <e/serialization.h>
+
+// consus
+#include "common/constants.h"
+#include "common/ids.h"
+#include "txman/generalized_paxos.h"
+
+// Deterministic simulation of the cross-data center vote.
+//
+// Each data center runs the same generalized_paxos instance that
+// global_voter drives, with the same comparator, default leader and fast
+// ballot.  Messages travel over a virtual network whose one-way latency is
+// configured per pair of data centers, and time is a virtual clock that only
+// moves when a message is delivered, so a run is a function of its
+// arguments alone.  For every commit it reports how many wide-area messages
+// and payload bytes the vote cost and how much virtual time passed before
+// each data center learned every vote.
+//
+// The replication inside a data center (the outer Paxos that orders each
+// inner message) is modeled as a fixed --local-latency on every send.
+
+#define MAX_DATA_CENTERS CONSUS_MAX_REPLICATION_FACTOR
+// a single vote never needs more deliveries than this; beyond it the
+// instance is reported as stalled instead of spinning forever
+#define MAX_EVENTS_PER_COMMIT 100000
+
+using namespace consus;
+
+// Mirrors global_voter::global_comparator: votes from different data centers
+// commute, anything tagged past the replication factor does not.
+struct comparator : public generalized_paxos::comparator
+{
+    comparator() {}
+    virtual ~comparator() throw () {}
+    virtual bool conflict(const generalized_paxos::command& a,
+                          const generalized_paxos::command& b) const;
+};
+
+bool
+comparator :: conflict(const generalized_paxos::command& a,
+                       const generalized_paxos::command& b) const
+{
+    return a.type >= CONSUS_MAX_REPLICATION_FACTOR ||
+           b.type >= CONSUS_MAX_REPLICATION_FACTOR;
+}
+
+comparator cmp;
+
+struct event
+{
+    event()
+        : when(0), seq(0), to(0)
+        , has_c(false), c()
+        , has_p1a(false), p1a()
+        , has_p1b(false), p1b()
+        , has_p2a(false), p2a()
+        , has_p2b(false), p2b()
+    {
+    }
+    ~event() throw () {}
+
+    uint64_t when;
+    uint64_t seq;
+    unsigned to;
+    bool has_c;
+    generalized_paxos::command c;
+    bool has_p1a;
+    generalized_paxos::message_p1a p1a;
+    bool has_p1b;
+    generalized_paxos::message_p1b p1b;
+    bool has_p2a;
+    generalized_paxos::message_p2a p2a;
+    bool has_p2b;
+    generalized_paxos::message_p2b p2b;
+};
+
+// orders the priority queue by delivery time, breaking ties in send order
+struct event_later
+{
+    bool operator () (const event* lhs, const event* rhs) const
+    {
+        if (lhs->when != rhs->when)
+        {
+            return lhs->when > rhs->when;
+        }
+
+        return lhs->seq > rhs->seq;
+    }
+};
+
+struct data_center
+{
+    data_center()
+        : gp(), learned_at(0), learned(false)
+        , prev_p1a(), prev_p1b(), prev_p2a(), prev_p2b()
+    {
+    }
+    ~data_center() throw () {}
+
+    generalized_paxos gp;
+    uint64_t learned_at;
+    bool learned;
+    // like the transmitters in global_voter, never resend an identical message
+    generalized_paxos::message_p1a prev_p1a;
+    generalized_paxos::message_p1b prev_p1b;
+    generalized_paxos::message_p2a prev_p2a;
+    generalized_paxos::message_p2b prev_p2b;
+
+    private:
+        data_center(const data_center&);
+        data_center& operator = (const data_center&);
+};
+
+struct outcome
+{
+    outcome()
+        : messages(0), bytes(0), first(0), last(0)
+        , fast(false), stalled(false)
+    {
+    }
+
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t first;
+    uint64_t last;
+    bool fast;
+    bool stalled;
+};
+
+class simulator
+{
+    public:
+        simulator(unsigned dcs_sz, const std::vector<uint64_t>& latency,
+                  uint64_t local, long jitter, unsigned seed);
+        ~simulator() throw ();
+
+    public:
+        void run(bool conflict, outcome* out);
+
+    private:
+        void deliver(const event* ev);
+        void work_state_machine(unsigned idx);
+        void send_to_all(unsigned from, event* proto, size_t payload);
+        void send_to_all(unsigned from, const generalized_paxos::command& c);
+        void send_to_all(unsigned from, const generalized_paxos::message_p1a& m);
+        void send_to_all(unsigned from, const generalized_paxos::message_p1b& m);
+        void send_to_all(unsigned from, const generalized_paxos::message_p2a& m);
+        void send_to_all(unsigned from, const generalized_paxos::message_p2b& m);
+        uint64_t delay(unsigned from, unsigned to);
+
+    private:
+        const unsigned m_dcs_sz;
+        const std::vector<uint64_t> m_latency;
+        const uint64_t m_local;
+        const long m_jitter;
+        uint16_t m_randbuf[3];
+        abstract_id m_ids[MAX_DATA_CENTERS];
+        std::vector<data_center*> m_dcs;
+        std::priority_queue<event*, std::vector<event*>, event_later> m_events;
+        uint64_t m_now;
+        uint64_t m_seq;
+        outcome* m_out;
+
+    private:
+        simulator(const simulator&);
+        simulator& operator = (const simulator&);
+};
+
+simulator :: simulator(unsigned dcs_sz, const std::vector<uint64_t>& latency,
+                       uint64_t local, long jitter, unsigned seed)
+    : m_dcs_sz(dcs_sz)
+    , m_latency(latency)
+    , m_local(local)
+    , m_jitter(jitter)
+    , m_dcs()
+    , m_events()
+    , m_now(0)
+    , m_seq(0)
+    , m_out(NULL)
+{
+    m_randbuf[0] = seed;
+    m_randbuf[1] = seed >> 16;
+    m_randbuf[2] = 0x5eedU;
+
+    for (unsigned i = 0; i < m_dcs_sz; ++i)
+    {
+        m_ids[i] = abstract_id(i + 1);
+    }
+}
+
+simulator :: ~simulator() throw ()
+{
+}
+
+void
+simulator :: run(bool conflict, outcome* out)
+{
+    *out = outcome();
+    m_out = out;
+    m_now = 0;
+    m_dcs.clear();
+
+    for (unsigned i = 0; i < m_dcs_sz; ++i)
+    {
+        m_dcs.push_back(new data_center());
+        m_dcs[i]->gp.init(&cmp, m_ids[i], m_ids, m_dcs_sz);
+        m_dcs[i]->gp.default_leader(m_ids[0], generalized_paxos::ballot::FAST);
+    }
+
+    // every data center finishes its local vote at once and sends it to all;
+    // a conflicting run re-casts the last vote so it cannot commute
+    for (unsigned i = 0; i < m_dcs_sz; ++i)
+    {
+        generalized_paxos::command c;
+        c.type = i;
+
+        if (conflict && i + 1 == m_dcs_sz)
+        {
+            c.type += CONSUS_MAX_REPLICATION_FACTOR;
+        }
+
+        e::packer(&c.value) << uint64_t(1);
+        send_to_all(i, c);
+    }
+
+    uint64_t processed = 0;
+
+    while (!m_events.empty())
+    {
+        event* ev = m_events.top();
+        m_events.pop();
+
+        if (processed < MAX_EVENTS_PER_COMMIT)
+        {
+            m_now = ev->when;
+            deliver(ev);
+            ++processed;
+        }
+
+        delete ev;
+    }
+
+    out->fast = m_dcs[0]->gp.acceptor_ballot().type == generalized_paxos::ballot::FAST;
+    out->first = UINT64_MAX;
+
+    for (unsigned i = 0; i < m_dcs_sz; ++i)
+    {
+        if (!m_dcs[i]->learned)
+        {
+            out->stalled = true;
+        }
+
+        out->first = std::min(out->first, m_dcs[i]->learned_at);
+        out->last = std::max(out->last, m_dcs[i]->learned_at);
+        delete m_dcs[i];
+    }
+
+    m_dcs.clear();
+    m_out = NULL;
+}
+
+void
+simulator :: deliver(const event* ev)
+{
+    data_center* dc = m_dcs[ev->to];
+
+    if (ev->has_c)
+    {
+        dc->gp.propose(ev->c);
+    }
+
+    if (ev->has_p1a)
+    {
+        bool send = false;
+        generalized_paxos::message_p1b r;
+        dc->gp.process_p1a(ev->p1a, &send, &r);
+
+        if (send)
+        {
+            send_to_all(ev->to, r);
+        }
+    }
+
+    if (ev->has_p1b)
+    {
+        dc->gp.process_p1b(ev->p1b);
+    }
+
+    if (ev->has_p2a)
+    {
+        bool send = false;
+        generalized_paxos::message_p2b r;
+        dc->gp.process_p2a(ev->p2a, &send, &r);
+
+        if (send)
+        {
+            send_to_all(ev->to, r);
+        }
+    }
+
+    if (ev->has_p2b)
+    {
+        dc->gp.process_p2b(ev->p2b);
+    }
+
+    work_state_machine(ev->to);
+}
+
+void
+simulator :: work_state_machine(unsigned idx)
+{
+    data_center* dc = m_dcs[idx];
+    bool send_m1 = false;
+    bool send_m2 = false;
+    bool send_m3 = false;
+    generalized_paxos::message_p1a m1;
+    generalized_paxos::message_p2a m2;
+    generalized_paxos::message_p2b m3;
+    // as in global_voter, the data center that started the transaction leads
+    dc->gp.advance(idx == 0,
+                   &send_m1, &m1,
+                   &send_m2, &m2,
+                   &send_m3, &m3);
+
+    if (send_m1)
+    {
+        send_to_all(idx, m1);
+    }
+
+    if (send_m2)
+    {
+        send_to_all(idx, m2);
+    }
+
+    if (send_m3)
+    {
+        send_to_all(idx, m3);
+    }
+
+    if (!dc->learned && dc->gp.learned().commands.size() >= m_dcs_sz)
+    {
+        dc->learned = true;
+        dc->learned_at = m_now;
+    }
+}
+
+void
+simulator :: send_to_all(unsigned from, event* proto, size_t payload)
+{
+    for (unsigned i = 0; i < m_dcs_sz; ++i)
+    {
+        event* ev = new event(*proto);
+        ev->when = m_now + m_local;
+        ev->seq = m_seq++;
+        ev->to = i;
+
+        // a data center hears itself once its own replicas agree
+        if (i != from)
+        {
+            ev->when += delay(from, i);
+            ++m_out->messages;
+            m_out->bytes += payload;
+        }
+
+        m_events.push(ev);
+    }
+
+    delete proto;
+}
+
+void
+simulator :: send_to_all(unsigned from, const generalized_paxos::command& c)
+{
+    event* ev = new event();
+    ev->has_c = true;
+    ev->c = c;
+    send_to_all(from, ev, pack_size(c));
+}
+
+void
+simulator :: send_to_all(unsigned from, const generalized_paxos::message_p1a& m)
+{
+    data_center* dc = m_dcs[from];
+
+    if (m == dc->prev_p1a)
+    {
+        return;
+    }
+
+    dc->prev_p1a = m;
+    event* ev = new event();
+    ev->has_p1a = true;
+    ev->p1a = m;
+    send_to_all(from, ev, pack_size(m));
+}
+
+void
+simulator :: send_to_all(unsigned from, const generalized_paxos::message_p1b& m)
+{
+    data_center* dc = m_dcs[from];
+
+    if (m == dc->prev_p1b)
+    {
+        return;
+    }
+
+    dc->prev_p1b = m;
+    event* ev = new event();
+    ev->has_p1b = true;
+    ev->p1b = m;
+    send_to_all(from, ev, pack_size(m));
+}
+
+void
+simulator :: send_to_all(unsigned from, const generalized_paxos::message_p2a& m)
+{
+    data_center* dc = m_dcs[from];
+
+    if (m == dc->prev_p2a)
+    {
+        return;
+    }
+
+    dc->prev_p2a = m;
+    event* ev = new event();
+    ev->has_p2a = true;
+    ev->p2a = m;
+    send_to_all(from, ev, pack_size(m));
+}
+
+void
+simulator :: send_to_all(unsigned from, const generalized_paxos::message_p2b& m)
+{
+    data_center* dc = m_dcs[from];
+
+    if (m == dc->prev_p2b)
+    {
+        return;
+    }
+
+    dc->prev_p2b = m;
+    event* ev = new event();
+    ev->has_p2b = true;
+    ev->p2b = m;
+    send_to_all(from, ev, pack_size(m));
+}
+
+uint64_t
+simulator :: delay(unsigned from, unsigned to)
+{
+    uint64_t base = m_latency[from * m_dcs_sz + to];
+
+    if (m_jitter <= 0 || base == 0)
+    {
+        return base;
+    }
+
+    // uniformly within +/- m_jitter percent of the configured latency
+    long pct = 100 - m_jitter + long(nrand48(m_randbuf) % (2 * m_jitter + 1));
+    return base * pct / 100;
+}
+
+static bool
+parse_latency(const char* spec, unsigned dcs_sz, std::vector<uint64_t>* latency)
+{
+    std::vector<uint64_t> values;
+    const char* ptr = spec;
+
+    while (*ptr)
+    {
+        char* end = NULL;
+        double ms = strtod(ptr, &end);
+
+        if (end == ptr || ms < 0)
+        {
+            return false;
+        }
+
+        values.push_back(uint64_t(ms * 1000));
+        ptr = end;
+
+        if (*ptr == ',')
+        {
+            ++ptr;
+        }
+        else if (*ptr)
+        {
+            return false;
+        }
+    }
+
+    if (values.size() != dcs_sz * dcs_sz)
+    {
+        return false;
+    }
+
+    for (unsigned i = 0; i < dcs_sz; ++i)
+    {
+        values[i * dcs_sz + i] = 0;
+    }
+
+    *latency = values;
+    return true;
+}
+
+static uint64_t
+percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    size_t idx = size_t(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+int
+main(int argc, const char* argv[])
+{
+    long data_centers = 3;
+    long commits = 1000;
+    long conflicts = 0;
+    long wan = 50;
+    long local = 1;
+    long jitter = 0;
+    long seed = 0;
+    const char* matrix = NULL;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('d', "data-centers")
+            .description("how many data centers vote (default: 3)")
+            .as_long(&data_centers);
+    ap.arg().name('n', "commits")
+            .description("how many independent votes to simulate (default: 1000)")
+            .as_long(&commits);
+    ap.arg().name('c', "conflicts")
+            .description("percentage of votes in which one vote conflicts (default: 0)")
+            .as_long(&conflicts);
+    ap.arg().name('w', "wan-latency")
+            .description("one-way latency between data centers in ms (default: 50)")
+            .as_long(&wan);
+    ap.arg().name('m', "latency-matrix")
+            .description("comma-separated one-way latencies in ms, row-major, one row per data center")
+            .as_string(&matrix);
+    ap.arg().name('l', "local-latency")
+            .description("time in ms to agree on a message within a data center (default: 1)")
+            .as_long(&local);
+    ap.arg().name('j', "jitter")
+            .description("percentage by which each wide-area delay varies (default: 0)")
+            .as_long(&jitter);
+    ap.arg().name('s', "seed")
+            .description("seed for conflicts and jitter (default: 0)")
+            .as_long(&seed);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (data_centers <= 0 || data_centers > MAX_DATA_CENTERS)
+    {
+        std::cerr << "must specify between 1 and " << MAX_DATA_CENTERS << " data centers\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (commits <= 0)
+    {
+        std::cerr << "must specify a positive number of commits\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (conflicts < 0 || conflicts > 100 ||
+        jitter < 0 || jitter > 100)
+    {
+        std::cerr << "percentages must be between 0 and 100\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (wan < 0 || local < 0)
+    {
+        std::cerr << "latencies must not be negative\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    const unsigned dcs_sz = data_centers;
+    std::vector<uint64_t> latency(dcs_sz * dcs_sz, wan * 1000);
+
+    for (unsigned i = 0; i < dcs_sz; ++i)
+    {
+        latency[i * dcs_sz + i] = 0;
+    }
+
+    if (matrix && !parse_latency(matrix, dcs_sz, &latency))
+    {
+        std::cerr << "latency matrix must hold " << dcs_sz * dcs_sz
+                  << " non-negative values\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    simulator sim(dcs_sz, latency, local * 1000, jitter, seed);
+    uint16_t randbuf[3] = {uint16_t(seed), uint16_t(seed >> 16), 0xc0deU};
+    std::vector<uint64_t> firsts;
+    std::vector<uint64_t> lasts;
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t fast = 0;
+    uint64_t stalled = 0;
+
+    for (long i = 0; i < commits; ++i)
+    {
+        outcome out;
+        sim.run(nrand48(randbuf) % 100 < conflicts, &out);
+
+        if (out.stalled)
+        {
+            ++stalled;
+            continue;
+        }
+
+        messages += out.messages;
+        bytes += out.bytes;
+        fast += out.fast ? 1 : 0;
+        firsts.push_back(out.first);
+        lasts.push_back(out.last);
+    }
+
+    std::sort(firsts.begin(), firsts.end());
+    std::sort(lasts.begin(), lasts.end());
+    const double learned = lasts.size();
+
+    if (learned > 0)
+    {
+        uint64_t first_sum = 0;
+        uint64_t last_sum = 0;
+
+        for (size_t i = 0; i < lasts.size(); ++i)
+        {
+            first_sum += firsts[i];
+            last_sum += lasts[i];
+        }
+
+        printf("simulated %.0f votes across %u data centers (%llu fast, %llu classic)\n",
+               learned, dcs_sz, (unsigned long long)fast,
+               (unsigned long long)(lasts.size() - fast));
+        printf("wide-area cost per vote: %.2f messages, %.0f payload bytes\n",
+               messages / learned, bytes / learned);
+        printf("virtual latency until the first data center learns: mean %.3fms\n",
+               first_sum / learned / 1000.);
+        printf("virtual latency until every data center learns: mean %.3fms, p50 %.3fms, p99 %.3fms, max %.3fms\n",
+               last_sum / learned / 1000.,
+               percentile(lasts, 0.50) / 1000.,
+               percentile(lasts, 0.99) / 1000.,
+               lasts.back() / 1000.);
+    }
+
+    if (stalled > 0)
+    {
+        printf("stalled: %llu votes never reached every data center\n",
+               (unsigned long long)stalled);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
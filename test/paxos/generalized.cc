@@ -141,6 +141,72 @@ TEST(GeneralizedPaxos, FiveAcceptors)
     }
 }
 
+static void
+exchange_p2bs(generalized_paxos* gp, unsigned gp_sz)
+{
+    bool send_m1 = false;
+    bool send_m2 = false;
+    bool send_m3 = false;
+    generalized_paxos::message_p1a m1;
+    generalized_paxos::message_p2a m2;
+    generalized_paxos::message_p2b m3;
+
+    for (unsigned i = 0; i < 2 * gp_sz; ++i)
+    {
+        gp[i % gp_sz].advance(false, &send_m1, &m1, &send_m2, &m2, &send_m3, &m3);
+
+        if (!send_m3)
+        {
+            continue;
+        }
+
+        for (unsigned j = 0; j < gp_sz; ++j)
+        {
+            gp[j].process_p2b(m3);
+            gp[j].propose_from_p2b(m3);
+        }
+    }
+}
+
+TEST(GeneralizedPaxos, LearnedSince)
+{
+    generalized_paxos gp[3];
+
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        gp[i].init(&ncc, _ids[i], _ids, 3);
+        gp[i].default_leader(_ids[0], generalized_paxos::ballot::FAST);
+    }
+
+    const generalized_paxos::command a(1, "a");
+    const generalized_paxos::command b(2, "b");
+    gp[0].propose(a);
+    exchange_p2bs(gp, 3);
+    std::vector<generalized_paxos::command> cmds;
+
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(1U, gp[i].learned_since(0, &cmds));
+        ASSERT_EQ(1U, cmds.size());
+        ASSERT_EQ(a, cmds[0]);
+        // a learned command is never proposed again
+        ASSERT_FALSE(gp[i].propose(a));
+    }
+
+    gp[1].propose(b);
+    exchange_p2bs(gp, 3);
+
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(2U, gp[i].learned_since(1, &cmds));
+        ASSERT_EQ(1U, cmds.size());
+        ASSERT_EQ(b, cmds[0]);
+        ASSERT_EQ(2U, gp[i].learned_since(2, &cmds));
+        ASSERT_EQ(0U, cmds.size());
+        ASSERT_EQ(2U, gp[i].learned().commands.size());
+    }
+}
+
 TEST(GeneralizedPaxos, Conflict)
 {
     // ignore gp[0] to make 1-indexed for easy reading
@@ -0,0 +1,102 @@
+# Run a fixed consus-bench workload against the cluster the gremlin started
+# and compare it to test/perf/baseline.json:
+#
+#   python bench.py <topology> <nodes> <data centers>
+#
+# The run fails if commits/s falls, or p50 latency, p99 latency or messages
+# per commit rise, by more than the baseline's tolerance.  A topology with no
+# baseline only reports.  Set CONSUS_PERF_RECORD=1 to write this run's
+# numbers into the baseline instead of comparing against it.
+
+import json
+import os
+import subprocess
+import sys
+
+try:
+    from urllib.request import urlopen
+except ImportError:
+    from urllib2 import urlopen
+
+# must match maint/generate-gremlin-include
+PORT_TXMAN = 22751
+PORT_KVS = 22761
+PORT_METRICS = 500
+
+WORKLOAD = ['--threads', '16', '--duration', '60', '--keys', '100000',
+            '--ops', '4', '--reads', '50', '--value-size', '100']
+
+def metrics_ports(nodes, dcs):
+    ports = []
+    for dc in range(dcs):
+        for r in range(nodes):
+            ports.append(PORT_METRICS + PORT_TXMAN + dc * 1000 + r)
+            ports.append(PORT_METRICS + PORT_KVS + dc * 1000 + r)
+    return ports
+
+def messages_handled(ports):
+    total = 0
+    for port in ports:
+        page = urlopen('http://127.0.0.1:%d/metrics' % port).read().decode('utf-8')
+        for line in page.splitlines():
+            if line.startswith('consus_handler_seconds_count{'):
+                total += int(float(line.rsplit(' ', 1)[1]))
+    return total
+
+def run(nodes, dcs):
+    ports = metrics_ports(nodes, dcs)
+    before = messages_handled(ports)
+    bench = os.path.join(os.environ['CONSUS_BUILDDIR'], 'consus-bench')
+    report = json.loads(subprocess.check_output([bench] + WORKLOAD).decode('utf-8'))
+    after = messages_handled(ports)
+    txn = report['operations']['transaction']
+    committed = max(report['committed'], 1)
+    return {'commits_per_second': txn['per_second'],
+            'p50_ms': txn['latency_us']['p50'] / 1000.,
+            'p99_ms': txn['latency_us']['p99'] / 1000.,
+            'messages_per_commit': float(after - before) / committed}
+
+# (metric, True if higher is better)
+METRICS = [('commits_per_second', True),
+           ('p50_ms', False),
+           ('p99_ms', False),
+           ('messages_per_commit', False)]
+
+def main(topology, nodes, dcs):
+    path = os.path.join(os.environ['CONSUS_SRCDIR'], 'test', 'perf', 'baseline.json')
+    baseline = json.load(open(path))
+    result = run(nodes, dcs)
+    sys.stdout.write('%s: %s\n' % (topology, json.dumps(result, sort_keys=True)))
+
+    if os.environ.get('CONSUS_PERF_RECORD'):
+        baseline['topologies'][topology] = result
+        f = open(path, 'w')
+        json.dump(baseline, f, indent=4, sort_keys=True)
+        f.write('\n')
+        f.close()
+        return 0
+
+    if topology not in baseline['topologies']:
+        sys.stdout.write('%s: no baseline; set CONSUS_PERF_RECORD=1 to record one\n' % topology)
+        return 0
+
+    base = baseline['topologies'][topology]
+    tolerance = baseline['tolerance']
+    failed = False
+
+    for metric, higher_is_better in METRICS:
+        if metric not in base:
+            continue
+        if higher_is_better:
+            regressed = result[metric] < base[metric] * (1 - tolerance)
+        else:
+            regressed = result[metric] > base[metric] * (1 + tolerance)
+        if regressed:
+            sys.stdout.write('%s: %s regressed from %.3f to %.3f\n' %
+                             (topology, metric, base[metric], result[metric]))
+            failed = True
+
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1], int(sys.argv[2]), int(sys.argv[3])))
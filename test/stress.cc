@@ -0,0 +1,600 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Stress the cluster with many concurrent clients contending for the same
+// keys.  Every transaction reads a few counters and writes each back one
+// higher, retrying aborts through consus_run_transaction; afterwards the
+// counters must sum to the increments of committed transactions, so a lost
+// update or a phantom commit fails the run as surely as a crash does.  The
+// scenarios differ only in which counters a transaction touches:
+//
+//  hot-keys:   a few counters drawn from a small set, so most transactions
+//              conflict
+//  deadlocks:  two counters of a tiny set, locked in random order, so that
+//              transactions routinely wait on each other in a cycle
+//  large:      many counters drawn from a large set, so transactions hold
+//              many locks for a long time
+//
+// Throughput, abort rate and latency go to stdout.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
+// e
+#include <e/compat.h>
+#include <e/popt.h>
+
+// consus
+#include <consus.h>
+#include "tools/connect_opts.h"
+
+#define PROG "stress"
+// counters read per transaction when verifying
+#define VERIFY_BATCH 100
+
+namespace
+{
+
+struct scenario
+{
+    const char* name;
+    long keys;
+    long ops;
+};
+
+const scenario scenarios[] = {
+    {"hot-keys", 16, 4},
+    {"deadlocks", 4, 2},
+    {"large", 10000, 64}
+};
+
+struct workload
+{
+    workload()
+        : conn_str(NULL), table("stress"), prefix(), threads(1), duration(10)
+        , keys(0), ops(0), max_attempts(0) {}
+    const char* conn_str;
+    const char* table;
+    // keeps the counters of one run apart from any earlier run's
+    std::string prefix;
+    unsigned threads;
+    uint64_t duration;
+    uint64_t keys;
+    unsigned ops;
+    unsigned max_attempts;
+};
+
+// xorshift64*; each worker has its own, so no locking
+class rng
+{
+    public:
+        rng(uint64_t seed) : m_x(seed ? seed : 88172645463325252ULL) {}
+
+    public:
+        uint64_t next()
+        {
+            m_x ^= m_x >> 12;
+            m_x ^= m_x << 25;
+            m_x ^= m_x >> 27;
+            return m_x * 2685821657736338717ULL;
+        }
+
+    private:
+        uint64_t m_x;
+};
+
+std::string
+key_for(const workload& w, uint64_t k)
+{
+    char buf[32];
+    int sz = snprintf(buf, sizeof(buf), "%012llu", (unsigned long long)k);
+    return w.prefix + std::string(buf, sz);
+}
+
+// counters are 8 bytes big-endian; a missing key is 0
+uint64_t
+decode(const char* value, size_t value_sz)
+{
+    uint64_t x = 0;
+
+    for (size_t i = 0; i < value_sz && i < sizeof(uint64_t); ++i)
+    {
+        x = (x << 8) | static_cast<unsigned char>(value[i]);
+    }
+
+    return x;
+}
+
+std::string
+encode(uint64_t x)
+{
+    std::string value(sizeof(uint64_t), '\0');
+
+    for (size_t i = 0; i < sizeof(uint64_t); ++i)
+    {
+        value[sizeof(uint64_t) - i - 1] = static_cast<char>(x >> (i * 8));
+    }
+
+    return value;
+}
+
+// wait for id and return the operation's status, or the loop's if it failed
+consus_returncode
+wait(consus_client* cl, int64_t id, consus_returncode* status)
+{
+    if (id < 0)
+    {
+        return *status;
+    }
+
+    consus_returncode lrc;
+
+    if (consus_wait(cl, id, -1, &lrc) != id)
+    {
+        return lrc;
+    }
+
+    return *status;
+}
+
+struct increment
+{
+    increment() : cl(NULL), w(NULL), keys(), attempts(0) {}
+    consus_client* cl;
+    const workload* w;
+    std::vector<std::string> keys;
+    uint64_t attempts;
+};
+
+consus_returncode
+increment_body(consus_transaction* xact, void* arg)
+{
+    increment* inc = static_cast<increment*>(arg);
+    ++inc->attempts;
+
+    for (size_t i = 0; i < inc->keys.size(); ++i)
+    {
+        const std::string& key(inc->keys[i]);
+        consus_returncode status;
+        char* value = NULL;
+        size_t value_sz = 0;
+        int64_t id = consus_get_bin(xact, inc->w->table, key.data(), key.size(),
+                                    &status, &value, &value_sz);
+        status = wait(inc->cl, id, &status);
+        const uint64_t x = decode(value, value_sz);
+        free(value);
+
+        if (status != CONSUS_SUCCESS && status != CONSUS_NOT_FOUND)
+        {
+            return status;
+        }
+
+        const std::string next(encode(x + 1));
+        id = consus_put_bin(xact, inc->w->table, key.data(), key.size(),
+                            next.data(), next.size(), &status);
+        status = wait(inc->cl, id, &status);
+
+        if (status != CONSUS_SUCCESS && status != CONSUS_LESS_DURABLE)
+        {
+            return status;
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+struct stats
+{
+    stats() : latencies(), attempts(0), committed(0), increments(0), gave_up(0), errors(0) {}
+    std::vector<uint64_t> latencies;
+    uint64_t attempts;
+    uint64_t committed;
+    uint64_t increments;
+    uint64_t gave_up;
+    uint64_t errors;
+};
+
+class worker
+{
+    public:
+        worker(const workload* w, unsigned idx, uint64_t end);
+        ~worker() throw ();
+
+    public:
+        void run();
+        const stats& results() const { return m_stats; }
+
+    private:
+        void choose_keys(std::vector<std::string>* keys);
+
+    private:
+        const workload* const m_w;
+        const uint64_t m_end;
+        consus_client* m_cl;
+        rng m_rng;
+        stats m_stats;
+
+    private:
+        worker(const worker&);
+        worker& operator = (const worker&);
+};
+
+worker :: worker(const workload* w, unsigned idx, uint64_t end)
+    : m_w(w)
+    , m_end(end)
+    , m_cl(NULL)
+    , m_rng(po6::monotonic_time() * 2654435761ULL + idx)
+    , m_stats()
+{
+}
+
+worker :: ~worker() throw ()
+{
+    if (m_cl)
+    {
+        consus_destroy(m_cl);
+    }
+}
+
+void
+worker :: run()
+{
+    m_cl = consus_create_conn_str(m_w->conn_str);
+
+    if (!m_cl)
+    {
+        ++m_stats.errors;
+        return;
+    }
+
+    while (po6::monotonic_time() < m_end)
+    {
+        increment inc;
+        inc.cl = m_cl;
+        inc.w = m_w;
+        choose_keys(&inc.keys);
+        const uint64_t start = po6::monotonic_time();
+        consus_returncode rc = consus_run_transaction(m_cl, increment_body, &inc, m_w->max_attempts);
+        const uint64_t end = po6::monotonic_time();
+        m_stats.attempts += inc.attempts;
+
+        if (rc == CONSUS_COMMITTED || rc == CONSUS_SUCCESS)
+        {
+            ++m_stats.committed;
+            m_stats.increments += inc.keys.size();
+            m_stats.latencies.push_back(end - start);
+        }
+        else if (rc == CONSUS_ABORTED)
+        {
+            ++m_stats.gave_up;
+        }
+        else
+        {
+            // the transaction may or may not have committed, so the counters
+            // can no longer be checked
+            std::cerr << PROG ": " << consus_returncode_to_string(rc) << ": "
+                      << consus_error_message(m_cl) << std::endl;
+            ++m_stats.errors;
+            return;
+        }
+    }
+}
+
+void
+worker :: choose_keys(std::vector<std::string>* keys)
+{
+    std::vector<uint64_t> ks;
+
+    while (ks.size() < m_w->ops)
+    {
+        uint64_t k = m_rng.next() % m_w->keys;
+
+        if (std::find(ks.begin(), ks.end(), k) == ks.end())
+        {
+            ks.push_back(k);
+        }
+    }
+
+    for (size_t i = 0; i < ks.size(); ++i)
+    {
+        keys->push_back(key_for(*m_w, ks[i]));
+    }
+}
+
+struct sum
+{
+    sum() : cl(NULL), w(NULL), first(0), last(0), total(0) {}
+    consus_client* cl;
+    const workload* w;
+    uint64_t first;
+    uint64_t last;
+    uint64_t total;
+};
+
+consus_returncode
+sum_body(consus_transaction* xact, void* arg)
+{
+    sum* s = static_cast<sum*>(arg);
+    s->total = 0;
+
+    for (uint64_t k = s->first; k < s->last; ++k)
+    {
+        const std::string key(key_for(*s->w, k));
+        consus_returncode status;
+        char* value = NULL;
+        size_t value_sz = 0;
+        int64_t id = consus_get_bin(xact, s->w->table, key.data(), key.size(),
+                                    &status, &value, &value_sz);
+        status = wait(s->cl, id, &status);
+        s->total += decode(value, value_sz);
+        free(value);
+
+        if (status != CONSUS_SUCCESS && status != CONSUS_NOT_FOUND)
+        {
+            return status;
+        }
+    }
+
+    return CONSUS_SUCCESS;
+}
+
+// the sum of every counter, or false if it could not be read
+bool
+verify(const workload& w, uint64_t* total)
+{
+    consus_client* cl = consus_create_conn_str(w.conn_str);
+
+    if (!cl)
+    {
+        return false;
+    }
+
+    sum s;
+    s.cl = cl;
+    s.w = &w;
+    *total = 0;
+
+    for (uint64_t k = 0; k < w.keys; k += VERIFY_BATCH)
+    {
+        s.first = k;
+        s.last = std::min(w.keys, k + VERIFY_BATCH);
+        consus_returncode rc = consus_run_transaction(cl, sum_body, &s, 0);
+
+        if (rc != CONSUS_COMMITTED && rc != CONSUS_SUCCESS)
+        {
+            std::cerr << PROG ": could not read the counters back: "
+                      << consus_returncode_to_string(rc) << ": "
+                      << consus_error_message(cl) << std::endl;
+            consus_destroy(cl);
+            return false;
+        }
+
+        *total += s.total;
+    }
+
+    consus_destroy(cl);
+    return true;
+}
+
+double
+percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    size_t idx = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+    return sorted[idx] / 1e6;
+}
+
+} // namespace
+
+int
+main(int argc, const char* argv[])
+{
+    const char* scenario_name = "hot-keys";
+    const char* table = "stress";
+    long threads = 16;
+    long duration = 30;
+    long keys = 0;
+    long ops = 0;
+    long max_attempts = 100;
+    consus::connect_opts conn;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS]");
+    ap.arg().name('s', "scenario")
+            .description("\"hot-keys\", \"deadlocks\" or \"large\" (default: hot-keys)")
+            .metavar("name").as_string(&scenario_name);
+    ap.arg().name('t', "threads")
+            .description("run N clients concurrently, each on its own thread (default: 16)")
+            .metavar("N").as_long(&threads);
+    ap.arg().name('d', "duration")
+            .description("start transactions for S seconds (default: 30)")
+            .metavar("S").as_long(&duration);
+    ap.arg().name('k', "keys")
+            .description("draw counters from N keys (default: set by the scenario)")
+            .metavar("N").as_long(&keys);
+    ap.arg().name('o', "ops")
+            .description("counters incremented per transaction (default: set by the scenario)")
+            .metavar("N").as_long(&ops);
+    ap.arg().long_name("max-attempts")
+            .description("give a transaction up after N aborts, or 0 to retry it forever (default: 100)")
+            .metavar("N").as_long(&max_attempts);
+    ap.arg().long_name("table")
+            .description("table holding the counters (default: stress)")
+            .metavar("name").as_string(&table);
+    ap.add("Connect to a cluster:", conn.parser());
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!conn.validate())
+    {
+        std::cerr << PROG ": invalid host:port specification\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << PROG " takes zero positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    const scenario* sc = NULL;
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+    {
+        if (strcmp(scenario_name, scenarios[i].name) == 0)
+        {
+            sc = &scenarios[i];
+        }
+    }
+
+    if (!sc)
+    {
+        std::cerr << PROG ": unknown scenario \"" << scenario_name << "\"\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    keys = keys > 0 ? keys : sc->keys;
+    ops = ops > 0 ? ops : sc->ops;
+
+    if (threads <= 0 || duration <= 0 || max_attempts < 0 || ops > keys)
+    {
+        std::cerr << PROG ": option out of range\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    workload w;
+    w.conn_str = conn.conn_str();
+    w.table = table;
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%llu-", (unsigned long long)po6::wallclock_time());
+    w.prefix = prefix;
+    w.threads = threads;
+    w.duration = duration;
+    w.keys = keys;
+    w.ops = ops;
+    w.max_attempts = max_attempts;
+
+    const uint64_t start = po6::monotonic_time();
+    const uint64_t end = start + w.duration * PO6_SECONDS;
+    std::vector<worker*> workers;
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+
+    for (unsigned i = 0; i < w.threads; ++i)
+    {
+        workers.push_back(new worker(&w, i, end));
+        e::compat::shared_ptr<po6::threads::thread> t(new po6::threads::thread(
+                    po6::threads::make_obj_func(&worker::run, workers.back())));
+        ts.push_back(t);
+        t->start();
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+
+    const double elapsed = (po6::monotonic_time() - start) / double(PO6_SECONDS);
+    stats total;
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        const stats& s(workers[i]->results());
+        total.latencies.insert(total.latencies.end(), s.latencies.begin(), s.latencies.end());
+        total.attempts += s.attempts;
+        total.committed += s.committed;
+        total.increments += s.increments;
+        total.gave_up += s.gave_up;
+        total.errors += s.errors;
+        delete workers[i];
+    }
+
+    std::sort(total.latencies.begin(), total.latencies.end());
+    const uint64_t aborted = total.attempts - total.committed;
+    printf("scenario: %s (%ld threads, %ld keys, %ld counters per transaction)\n",
+           sc->name, threads, keys, ops);
+    printf("committed: %llu (%.1f/s)\n", (unsigned long long)total.committed,
+           total.committed / elapsed);
+    printf("aborted attempts: %llu (%.1f%% of attempts)\n", (unsigned long long)aborted,
+           total.attempts ? 100.0 * aborted / total.attempts : 0.0);
+    printf("gave up: %llu\n", (unsigned long long)total.gave_up);
+    printf("errors: %llu\n", (unsigned long long)total.errors);
+    printf("latency: p50 %.1fms p90 %.1fms p99 %.1fms max %.1fms\n",
+           percentile(total.latencies, 0.50),
+           percentile(total.latencies, 0.90),
+           percentile(total.latencies, 0.99),
+           total.latencies.empty() ? 0.0 : total.latencies.back() / 1e6);
+
+    if (total.errors > 0)
+    {
+        std::cerr << PROG ": errors leave the counters unverifiable" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    uint64_t counted = 0;
+
+    if (!verify(w, &counted))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("counters: %llu, committed increments: %llu\n",
+           (unsigned long long)counted, (unsigned long long)total.increments);
+
+    if (counted != total.increments)
+    {
+        std::cerr << PROG ": counters disagree with committed transactions" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,368 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/buffer.h>
+#include <e/popt.h>
+#include <e/serialization.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/network_msgtype.h"
+#include "common/transaction_group.h"
+#include "common/txman_configuration.h"
+#include "txman/configuration.h"
+#include "txman/generalized_paxos.h"
+#include "txman/log_entry_t.h"
+
+using namespace consus;
+
+// Times the work a transaction manager does on every message and every
+// configuration change: parsing the configuration and rebuilding its caches,
+// finding groups and key-value stores, and packing and unpacking transaction
+// groups, generalized Paxos cstructs and the phase 2a message that carries
+// each operation.  Everything is built up front, so each loop measures only
+// the call under test.
+
+// keeps the optimizer from discarding the results
+static volatile uint64_t s_sink;
+
+static void
+report(const char* name, uint64_t ops, uint64_t start)
+{
+    const uint64_t elapsed = po6::monotonic_time() - start;
+    printf("%s: %llu in %.3fs (%.1f ns each)\n", name, (unsigned long long)ops,
+           elapsed / 1e9, ops ? double(elapsed) / ops : 0.0);
+}
+
+static std::string
+make_configuration(long dcs, long servers, long partitions, long tables)
+{
+    std::vector<data_center> dcv;
+    std::vector<txman_state> txmans;
+    std::vector<paxos_group> groups;
+    std::vector<kvs> kvss;
+    std::vector<ring> rings;
+    std::vector<table_config> tcs;
+    uint64_t counter = 1;
+
+    for (long d = 0; d < dcs; ++d)
+    {
+        const data_center_id dc(d + 1);
+        char name[32];
+        snprintf(name, sizeof(name), "dc%ld", d);
+        dcv.push_back(data_center(dc, name));
+        std::vector<comm_id> tx_ids;
+        std::vector<comm_id> kv_ids;
+
+        for (long s = 0; s < servers; ++s)
+        {
+            txman tx(comm_id(2 * (d * servers + s) + 1), po6::net::location());
+            tx.dc = dc;
+            txman_state ts(tx);
+            ts.state = txman_state::ONLINE;
+            txmans.push_back(ts);
+            tx_ids.push_back(tx.id);
+            kvs kv(comm_id(2 * (d * servers + s) + 2), po6::net::location());
+            kv.dc = dc;
+            kv.capacity = 1;
+            kvss.push_back(kv);
+            kv_ids.push_back(kv.id);
+        }
+
+        // every transaction manager leads a group of the next few
+        for (size_t i = 0; i < tx_ids.size(); ++i)
+        {
+            paxos_group g;
+            g.id = paxos_group_id(counter++);
+            g.dc = dc;
+            g.members_sz = std::min(tx_ids.size(), size_t(5));
+
+            for (unsigned j = 0; j < g.members_sz; ++j)
+            {
+                g.members[j] = tx_ids[(i + j) % tx_ids.size()];
+            }
+
+            groups.push_back(g);
+        }
+
+        ring r(dc);
+
+        while (r.partitions.size() < size_t(partitions))
+        {
+            r.split(&counter);
+        }
+
+        std::vector<comm_id> owners(r.partitions.size());
+
+        for (size_t p = 0; p < owners.size(); ++p)
+        {
+            owners[p] = kv_ids[p % kv_ids.size()];
+        }
+
+        r.set_owners(owners, &counter, NULL);
+        rings.push_back(r);
+    }
+
+    for (long t = 0; t < tables; ++t)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "table%ld", t);
+        tcs.push_back(table_config(table_id(t + 1), name, 3));
+    }
+
+    return txman_configuration(cluster_id(1), version_id(1), 0, dcv, txmans, groups, kvss, rings, tcs);
+}
+
+int
+main(int argc, const char* argv[])
+{
+    long dcs = 3;
+    long servers = 5;
+    long partitions = CONSUS_KVS_INITIAL_PARTITIONS;
+    long tables = 4;
+    long commands = 16;
+    long configs = 100;
+    long iterations = 1000000;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('d', "data-centers")
+            .description("data centers in the configuration, each with a ring (default: 3)")
+            .as_long(&dcs);
+    ap.arg().name('s', "servers")
+            .description("transaction managers, and key-value stores, in each data center (default: 5)")
+            .as_long(&servers);
+    ap.arg().name('p', "partitions")
+            .description("partitions in each ring, a power of two (default: 1024)")
+            .as_long(&partitions);
+    ap.arg().name('t', "tables")
+            .description("tables in the configuration (default: 4)")
+            .as_long(&tables);
+    ap.arg().name('k', "commands")
+            .description("commands in each generalized Paxos cstruct (default: 16)")
+            .as_long(&commands);
+    ap.arg().name('c', "configurations")
+            .description("how many times to parse the configuration (default: 100)")
+            .as_long(&configs);
+    ap.arg().name('n', "iterations")
+            .description("how many times to run each of the other operations (default: 1,000,000)")
+            .as_long(&iterations);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (dcs <= 0 || servers <= 0 || tables <= 0 || commands <= 0 || configs <= 0 || iterations <= 0)
+    {
+        std::cerr << "data-centers, servers, tables, commands, configurations and iterations must be positive\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (partitions < CONSUS_KVS_INITIAL_PARTITIONS || partitions > CONSUS_KVS_PARTITIONS ||
+        (partitions & (partitions - 1)) != 0)
+    {
+        std::cerr << "partitions must be a power of two from "
+                  << CONSUS_KVS_INITIAL_PARTITIONS << " to " << CONSUS_KVS_PARTITIONS << "\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    const std::string conf = make_configuration(dcs, servers, partitions, tables);
+    printf("configuration: %llu bytes\n", (unsigned long long)conf.size());
+    uint64_t start;
+
+    // unpacking alone, and unpacking followed by reconstruct_cache; the
+    // difference is the cost of rebuilding the caches
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < configs; ++i)
+    {
+        cluster_id cid;
+        version_id vid;
+        uint64_t flags;
+        std::vector<data_center> dcv;
+        std::vector<txman_state> txmans;
+        std::vector<paxos_group> groups;
+        std::vector<kvs> kvss;
+        std::vector<ring> rings;
+        std::vector<table_config> tcs;
+        e::unpacker up(conf.data(), conf.size());
+        up = txman_configuration(up, &cid, &vid, &flags, &dcv, &txmans, &groups, &kvss, &rings, &tcs);
+        s_sink = s_sink + up.error() + rings.size();
+    }
+
+    report("unpack configuration", configs, start);
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < configs; ++i)
+    {
+        configuration c;
+        e::unpacker up(conf.data(), conf.size());
+        up = up >> c;
+        s_sink = s_sink + up.error() + c.version().get();
+    }
+
+    report("unpack configuration and reconstruct cache", configs, start);
+
+    configuration c;
+
+    if ((e::unpacker(conf.data(), conf.size()) >> c).error())
+    {
+        std::cerr << "could not parse the configuration" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const long txmans_sz = dcs * servers;
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        const comm_id id(2 * (i % txmans_sz) + 1);
+        s_sink = s_sink + c.groups_for(id).size();
+    }
+
+    report("configuration::groups_for", iterations, start);
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        const paxos_group* g = c.get_group(paxos_group_id(i % txmans_sz + 1));
+        s_sink = s_sink + (g ? g->members_sz : 0);
+    }
+
+    report("configuration::get_group", iterations, start);
+
+    const size_t keys_sz = 4096;
+    std::vector<std::string> keys(keys_sz);
+
+    for (size_t i = 0; i < keys_sz; ++i)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key%llu", (unsigned long long)i);
+        keys[i] = buf;
+    }
+
+    const e::slice table("table0");
+    txman near(comm_id(1), po6::net::location());
+    near.dc = data_center_id(1);
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        const comm_id id = c.choose_kvs(data_center_id(1), table, keys[i % keys_sz], i, near, NULL);
+        s_sink = s_sink + id.get();
+    }
+
+    report("configuration::choose_kvs", iterations, start);
+
+    std::string buf;
+    const transaction_group tg(paxos_group_id(1), transaction_id(paxos_group_id(1), 1, 1));
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        buf.clear();
+        e::packer(&buf) << tg;
+        transaction_group out;
+        e::unpacker(buf.data(), buf.size()) >> out;
+        s_sink = s_sink + out.txid.number;
+    }
+
+    report("pack and unpack transaction_group", iterations, start);
+
+    generalized_paxos::cstruct cs;
+
+    for (long i = 0; i < commands; ++i)
+    {
+        cs.commands.push_back(generalized_paxos::command(1, std::string(64, 'c')));
+    }
+
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        buf.clear();
+        e::packer(&buf) << cs;
+        generalized_paxos::cstruct out;
+        e::unpacker(buf.data(), buf.size()) >> out;
+        s_sink = s_sink + out.commands.size();
+    }
+
+    report("pack and unpack generalized_paxos::cstruct", iterations, start);
+
+    // a write as the transaction logs it and sends it to its group, and as
+    // each member unpacks it
+    const std::string value(128, 'v');
+    start = po6::monotonic_time();
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        const e::slice key(keys[i % keys_sz]);
+        std::string entry;
+        e::packer(&entry) << LOG_ENTRY_TX_WRITE << tg << uint64_t(i) << table << key << e::slice(value);
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(TXMAN_PAXOS_2A)
+                        + pack_size(e::slice(entry));
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_PAXOS_2A << e::slice(entry);
+        network_msgtype mt;
+        e::slice log_entry;
+        log_entry_t t;
+        transaction_group tg_out;
+        uint64_t seqno;
+        e::slice tab;
+        e::slice k;
+        e::slice v;
+        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+        up = up >> mt >> log_entry;
+        up = e::unpacker(log_entry) >> t >> tg_out >> seqno >> tab >> k >> v;
+        s_sink = s_sink + up.error() + v.size();
+    }
+
+    report("pack and unpack TXMAN_PAXOS_2A", iterations, start);
+    return EXIT_SUCCESS;
+}
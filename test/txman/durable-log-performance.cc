@@ -0,0 +1,382 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <sys/stat.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+#include <e/compat.h>
+#include <e/popt.h>
+
+// consus
+#include "txman/durable_log.h"
+
+using namespace consus;
+
+// Writers append as fast as they can while a watcher plays the role of the
+// transaction manager's durability thread, noting when each record number
+// became durable.  Matching the two afterwards gives the append-to-durable
+// latency that a client waiting on the log would see.
+
+struct appended
+{
+    appended() : recno(), when() {}
+    appended(int64_t r, uint64_t w) : recno(r), when(w) {}
+    int64_t recno;
+    uint64_t when;
+};
+
+class writer
+{
+    public:
+        writer(durable_log* log, long entries, long entry_sz);
+        ~writer() throw ();
+
+    public:
+        void run();
+        const std::vector<appended>& records() const { return m_records; }
+        const std::vector<uint64_t>& latencies() const { return m_latencies; }
+        bool failed() const { return m_failed; }
+
+    private:
+        durable_log* m_log;
+        long m_entries;
+        std::vector<unsigned char> m_entry;
+        std::vector<appended> m_records;
+        std::vector<uint64_t> m_latencies;
+        bool m_failed;
+
+    private:
+        writer(const writer&);
+        writer& operator = (const writer&);
+};
+
+writer :: writer(durable_log* log, long entries, long entry_sz)
+    : m_log(log)
+    , m_entries(entries)
+    , m_entry(entry_sz, 'x')
+    , m_records()
+    , m_latencies()
+    , m_failed(false)
+{
+    m_records.reserve(entries);
+    m_latencies.reserve(entries);
+}
+
+writer :: ~writer() throw ()
+{
+}
+
+void
+writer :: run()
+{
+    for (long i = 0; i < m_entries; ++i)
+    {
+        const uint64_t start = po6::monotonic_time();
+        int64_t recno = m_log->append(&m_entry[0], m_entry.size());
+        const uint64_t end = po6::monotonic_time();
+
+        if (recno < 0)
+        {
+            m_failed = true;
+            return;
+        }
+
+        m_records.push_back(appended(recno, end));
+        m_latencies.push_back(end - start);
+    }
+}
+
+class watcher
+{
+    public:
+        watcher(durable_log* log);
+        ~watcher() throw ();
+
+    public:
+        void run();
+        void stop();
+        // when recno was first seen durable, or 0 if it never was
+        uint64_t durable_at(int64_t recno) const;
+
+    private:
+        durable_log* m_log;
+        uint32_t m_stop;
+        // (durable upper bound, time it was observed), ascending
+        std::vector<appended> m_bounds;
+
+    private:
+        watcher(const watcher&);
+        watcher& operator = (const watcher&);
+};
+
+watcher :: watcher(durable_log* log)
+    : m_log(log)
+    , m_stop(0)
+    , m_bounds()
+{
+}
+
+watcher :: ~watcher() throw ()
+{
+}
+
+void
+watcher :: run()
+{
+    int64_t x = -1;
+
+    while (e::atomic::increment_32_nobarrier(&m_stop, 0) == 0)
+    {
+        x = m_log->wait(x);
+
+        if (m_log->error() != 0)
+        {
+            break;
+        }
+
+        if (m_bounds.empty() || m_bounds.back().recno < x)
+        {
+            m_bounds.push_back(appended(x, po6::monotonic_time()));
+        }
+    }
+}
+
+void
+watcher :: stop()
+{
+    e::atomic::increment_32_nobarrier(&m_stop, 1);
+    m_log->wake();
+}
+
+static bool
+compare_recno(const appended& lhs, const appended& rhs)
+{
+    return lhs.recno < rhs.recno;
+}
+
+uint64_t
+watcher :: durable_at(int64_t recno) const
+{
+    // recno is durable once the bound passes it
+    std::vector<appended>::const_iterator it;
+    it = std::upper_bound(m_bounds.begin(), m_bounds.end(),
+                          appended(recno, 0), compare_recno);
+    return it == m_bounds.end() ? 0 : it->when;
+}
+
+static void
+replay_nothing(void*, const unsigned char*, size_t)
+{
+}
+
+static void
+print_latencies(const char* name, std::vector<uint64_t>* l)
+{
+    std::sort(l->begin(), l->end());
+
+    if (l->empty())
+    {
+        printf("%s: none\n", name);
+        return;
+    }
+
+    const size_t sz = l->size();
+    printf("%s: p50 %.1fus p90 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus\n", name,
+           (*l)[sz * 50 / 100] / 1000.0,
+           (*l)[sz * 90 / 100] / 1000.0,
+           (*l)[sz * 99 / 100] / 1000.0,
+           (*l)[sz * 999 / 1000] / 1000.0,
+           l->back() / 1000.0);
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* dir = "durable-log-performance";
+    long threads = 1;
+    long entries = 100000;
+    long entry_sz = 128;
+    bool sync_writes = false;
+    bool pmem = false;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('d', "dir")
+            .description("put the log in this directory, which must not exist; choose its file system to compare storage (default: durable-log-performance)")
+            .as_string(&dir);
+    ap.arg().name('t', "threads")
+            .description("how many threads append concurrently (default: 1)")
+            .as_long(&threads);
+    ap.arg().name('n', "entries")
+            .description("how many entries each thread appends (default: 100,000)")
+            .as_long(&entries);
+    ap.arg().name('s', "size")
+            .description("bytes per entry (default: 128)")
+            .as_long(&entry_sz);
+    ap.arg().long_name("sync-writes")
+            .description("open the log with O_DSYNC writes instead of batched fsyncs")
+            .set_true(&sync_writes);
+    ap.arg().long_name("pmem")
+            .description("map the log from persistent memory; the directory must be on a DAX file system")
+            .set_true(&pmem);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (threads <= 0 || entries <= 0 || entry_sz <= 0)
+    {
+        std::cerr << "threads, entries and size must be positive\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+
+    if (stat(dir, &st) == 0 || errno != ENOENT)
+    {
+        std::cerr << dir << " already exists; the benchmark needs an empty log" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<writer*> writers;
+    std::vector<uint64_t> append_latencies;
+    std::vector<uint64_t> durable_latencies;
+    uint64_t elapsed = 0;
+    uint64_t fsyncs = 0;
+
+    {
+        durable_log log;
+
+        if (!log.open(dir, sync_writes, pmem))
+        {
+            std::cerr << "could not open log: " << strerror(log.error()) << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        using namespace po6::threads;
+        watcher w(&log);
+        thread wt(make_obj_func(&watcher::run, &w));
+        wt.start();
+        std::vector<e::compat::shared_ptr<thread> > ts;
+
+        for (long i = 0; i < threads; ++i)
+        {
+            writers.push_back(new writer(&log, entries, entry_sz));
+            e::compat::shared_ptr<thread> t(new thread(make_obj_func(&writer::run, writers.back())));
+            ts.push_back(t);
+        }
+
+        const uint64_t start = po6::monotonic_time();
+
+        for (size_t i = 0; i < ts.size(); ++i)
+        {
+            ts[i]->start();
+        }
+
+        for (size_t i = 0; i < ts.size(); ++i)
+        {
+            ts[i]->join();
+        }
+
+        const int64_t last = log.next_recno() - 1;
+
+        while (log.durable() <= last && log.error() == 0)
+        {
+            log.wait(last);
+        }
+
+        elapsed = po6::monotonic_time() - start;
+        w.stop();
+        wt.join();
+        fsyncs = log.fsync_latency()->count();
+
+        for (size_t i = 0; i < writers.size(); ++i)
+        {
+            if (writers[i]->failed())
+            {
+                std::cerr << "append failed: " << strerror(log.error()) << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            const std::vector<appended>& r(writers[i]->records());
+            const std::vector<uint64_t>& l(writers[i]->latencies());
+            append_latencies.insert(append_latencies.end(), l.begin(), l.end());
+
+            for (size_t j = 0; j < r.size(); ++j)
+            {
+                uint64_t when = w.durable_at(r[j].recno);
+                durable_latencies.push_back(when > r[j].when ? when - r[j].when : 0);
+            }
+
+            delete writers[i];
+        }
+    }
+
+    const double secs = elapsed / 1e9;
+    const double records = double(threads) * entries;
+    printf("records/s: %.0f\n", records / secs);
+    printf("bytes/s: %.0f\n", records * entry_sz / secs);
+    printf("fsyncs: %llu (%.1f records each)\n", (unsigned long long)fsyncs,
+           fsyncs ? records / fsyncs : 0.0);
+    print_latencies("append", &append_latencies);
+    print_latencies("append-to-durable", &durable_latencies);
+
+    durable_log log;
+    const uint64_t start = po6::monotonic_time();
+
+    if (!log.open(dir, sync_writes, pmem))
+    {
+        std::cerr << "could not reopen log: " << strerror(log.error()) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int64_t replayed = log.replay(replay_nothing, NULL);
+    const uint64_t end = po6::monotonic_time();
+    printf("replay: %lld records in %.3fs (%.0f records/s)\n", (long long)replayed,
+           (end - start) / 1e9, replayed / ((end - start) / 1e9));
+    return EXIT_SUCCESS;
+}
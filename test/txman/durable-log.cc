@@ -0,0 +1,488 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// e
+#include <e/endian.h>
+#include <e/serialization.h>
+#include <e/varint.h>
+
+// consus
+#include "test/kvs/scratch.h"
+#include "test/th.h"
+#include "common/crc32c.h"
+#include "txman/durable_log.h"
+
+using namespace consus;
+
+static std::vector<std::string>
+make_entries(unsigned first, unsigned count)
+{
+    std::vector<std::string> entries;
+
+    for (unsigned i = first; i < first + count; ++i)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "entry %u", i);
+        entries.push_back(buf);
+    }
+
+    return entries;
+}
+
+// entries big enough that a few hundred of them fill several segments
+static std::vector<std::string>
+make_large_entries(unsigned count)
+{
+    std::vector<std::string> entries;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        std::string entry(1024 * 1024, 'a' + i % 26);
+        char buf[32];
+        int sz = snprintf(buf, sizeof(buf), "entry %u", i);
+        entry.replace(0, sz, buf, sz);
+        entries.push_back(entry);
+    }
+
+    return entries;
+}
+
+static void
+collect_entry(void* p, const unsigned char* entry, size_t entry_sz)
+{
+    std::vector<std::string>* entries = static_cast<std::vector<std::string>*>(p);
+    entries->push_back(std::string(reinterpret_cast<const char*>(entry), entry_sz));
+}
+
+static std::vector<std::string>
+replay(durable_log* log)
+{
+    std::vector<std::string> entries;
+    int64_t replayed = log->replay(collect_entry, &entries);
+    ASSERT_EQ(replayed, int64_t(entries.size()));
+    return entries;
+}
+
+static void
+assert_replayed(const std::vector<std::string>& replayed,
+                const std::vector<std::string>& expected)
+{
+    ASSERT_EQ(replayed.size(), expected.size());
+
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        ASSERT_TRUE(replayed[i] == expected[i]);
+    }
+}
+
+// append every entry, and return once all of them are durable
+static void
+append_durably(durable_log* log, const std::vector<std::string>& entries)
+{
+    int64_t last = 0;
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        last = log->append(entries[i].data(), entries[i].size());
+        ASSERT_GT(last, 0);
+    }
+
+    while (log->durable() <= last)
+    {
+        ASSERT_EQ(log->error(), 0);
+        log->wait(last);
+    }
+}
+
+static std::vector<std::string>
+list_segments(const std::string& dir)
+{
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+    ASSERT_TRUE(d != NULL);
+    struct dirent* ent;
+
+    while ((ent = readdir(d)))
+    {
+        if (strncmp(ent->d_name, "log.", 4) == 0)
+        {
+            names.push_back(ent->d_name);
+        }
+    }
+
+    closedir(d);
+    return names;
+}
+
+static void
+append_file(const std::string& path, const std::string& data)
+{
+    int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, data.data(), data.size()), ssize_t(data.size()));
+    ASSERT_EQ(close(fd), 0);
+}
+
+// what a crash part way through a write leaves behind the last record
+static void
+tear_every_segment(const std::string& dir)
+{
+    std::vector<std::string> names = list_segments(dir);
+
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        append_file(dir + "/" + names[i], std::string(5, '\xff'));
+    }
+}
+
+// a record as the log lays it out: record number, size, the body, and a
+// CRC32C over all three; a record number of zero makes it a frame
+static std::string
+encode_record(uint64_t recno, const std::string& body)
+{
+    unsigned char header[2 * sizeof(uint64_t)];
+    e::pack64be(recno, header);
+    e::pack64be(uint64_t(body.size()), header + sizeof(uint64_t));
+    uint32_t crc = 0;
+    crc = crc32c(crc, header, sizeof(header));
+    crc = crc32c(crc, reinterpret_cast<const unsigned char*>(body.data()), body.size());
+    unsigned char crcbuf[sizeof(uint32_t)];
+    e::pack32be(crc, crcbuf);
+    return std::string(reinterpret_cast<const char*>(header), sizeof(header))
+         + body
+         + std::string(reinterpret_cast<const char*>(crcbuf), sizeof(crcbuf));
+}
+
+// one record within a frame: a varint record number and a varint-prefixed
+// entry
+static std::string
+encode_framed(uint64_t recno, uint64_t size, const std::string& entry)
+{
+    std::string framed;
+    e::packer pa(&framed);
+    pa = pa << e::pack_varint(recno) << e::pack_varint(size);
+    framed.append(entry);
+    return framed;
+}
+
+static std::string
+encode_frame(uint64_t first, const std::vector<std::string>& entries)
+{
+    std::string payload;
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        payload += encode_framed(first + i, entries[i].size(), entries[i]);
+    }
+
+    return encode_record(0, payload);
+}
+
+static uint64_t
+file_size(const std::string& path)
+{
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    return st.st_size;
+}
+
+TEST(DurableLog, ReplaysFramedRecordsAfterRestart)
+{
+    scratch_dir dir;
+    const std::vector<std::string> entries = make_entries(1, 5);
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        assert_replayed(replay(&log), std::vector<std::string>());
+        append_durably(&log, entries);
+    }
+
+    tear_every_segment(dir.path());
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), entries);
+    ASSERT_EQ(log.next_recno(), 6);
+    // replay hands each record over once
+    assert_replayed(replay(&log), std::vector<std::string>());
+}
+
+TEST(DurableLog, ReplaysSynchronousRecordsAfterRestart)
+{
+    scratch_dir dir;
+    const std::vector<std::string> entries = make_entries(1, 5);
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), true, false));
+        append_durably(&log, entries);
+    }
+
+    tear_every_segment(dir.path());
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), true, false));
+    assert_replayed(replay(&log), entries);
+    ASSERT_EQ(log.next_recno(), 6);
+}
+
+TEST(DurableLog, KeepsEarlierIncarnationsUntilCollected)
+{
+    scratch_dir dir;
+    const std::vector<std::string> first = make_entries(1, 3);
+    const std::vector<std::string> second = make_entries(4, 3);
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        append_durably(&log, first);
+    }
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        assert_replayed(replay(&log), first);
+        // numbering picks up after the records just replayed
+        ASSERT_EQ(log.next_recno(), 4);
+        append_durably(&log, second);
+    }
+
+    tear_every_segment(dir.path());
+    std::vector<std::string> all(first);
+    all.insert(all.end(), second.begin(), second.end());
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), all);
+    ASSERT_EQ(log.next_recno(), 7);
+}
+
+TEST(DurableLog, ReplaysAcrossSegmentsInRecordOrder)
+{
+    scratch_dir dir;
+    // writes alternate between segments, so neither holds a contiguous run
+    append_file(dir.path("log.0000000000000001"),
+                encode_record(1, "one") + encode_record(3, "three") + encode_record(5, "five"));
+    append_file(dir.path("log.0000000000000002"),
+                encode_record(2, "two") + encode_record(4, "four") + std::string(3, '\0'));
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), true, false));
+    std::vector<std::string> expected;
+    expected.push_back("one");
+    expected.push_back("two");
+    expected.push_back("three");
+    expected.push_back("four");
+    expected.push_back("five");
+    assert_replayed(replay(&log), expected);
+    ASSERT_EQ(log.next_recno(), 6);
+}
+
+TEST(DurableLog, CollectDropsSegmentsBelowTheBound)
+{
+    scratch_dir dir;
+    const std::vector<std::string> first = make_entries(1, 3);
+    const std::vector<std::string> second = make_entries(4, 3);
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        append_durably(&log, first);
+    }
+
+    const std::vector<std::string> sealed = list_segments(dir.path());
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        assert_replayed(replay(&log), first);
+        append_durably(&log, second);
+        // every sealed segment holds record 1 or later
+        const size_t before = list_segments(dir.path()).size();
+        log.collect(1);
+        ASSERT_EQ(list_segments(dir.path()).size(), before);
+        log.collect(4);
+
+        for (size_t i = 0; i < sealed.size(); ++i)
+        {
+            ASSERT_NE(access(dir.path(sealed[i].c_str()).c_str(), F_OK), 0);
+        }
+
+        ASSERT_EQ(list_segments(dir.path()).size(), 2U);
+    }
+
+    tear_every_segment(dir.path());
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), second);
+    ASSERT_EQ(log.next_recno(), 7);
+}
+
+TEST(DurableLog, RotatesFullSegments)
+{
+    scratch_dir dir;
+    // writes alternate between the two open segments, so this fills both
+    // past the rotation size
+    const std::vector<std::string> entries = make_large_entries(160);
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            append_durably(&log, std::vector<std::string>(1, entries[i]));
+        }
+
+        ASSERT_GT(list_segments(dir.path()).size(), 2U);
+    }
+
+    tear_every_segment(dir.path());
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        assert_replayed(replay(&log), entries);
+        ASSERT_EQ(log.next_recno(), 161);
+        // everything replayed is durable, so every sealed segment can go
+        log.collect(log.next_recno());
+        ASSERT_EQ(list_segments(dir.path()).size(), 2U);
+    }
+
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), std::vector<std::string>());
+}
+
+TEST(DurableLog, ReplaysFramesAndSingleRecords)
+{
+    scratch_dir dir;
+    // records from before framing sit alongside frames, and file_a predates
+    // numbered segments
+    append_file(dir.path("file_a"), encode_record(1, "entry 1"));
+    append_file(dir.path("log.0000000000000001"),
+                encode_frame(2, make_entries(2, 3)) +
+                encode_record(5, "entry 5") +
+                encode_frame(6, make_entries(6, 1)));
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), make_entries(1, 6));
+    ASSERT_EQ(log.next_recno(), 7);
+}
+
+TEST(DurableLog, StopsAtChecksumMismatch)
+{
+    scratch_dir dir;
+    const std::string good = encode_frame(1, make_entries(1, 2));
+    std::string bad = encode_frame(3, make_entries(3, 2));
+    bad[bad.size() / 2] ^= 0x01;
+    // a record past the bad one was never acknowledged, intact or not
+    append_file(dir.path("log.0000000000000001"),
+                good + bad + encode_frame(5, make_entries(5, 1)));
+    std::string single = encode_record(7, "entry 7");
+    single[single.size() - 1] ^= 0x01;
+    append_file(dir.path("log.0000000000000002"),
+                encode_record(6, "entry 6") + single);
+    std::vector<std::string> expected = make_entries(1, 2);
+    expected.push_back("entry 6");
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        assert_replayed(replay(&log), expected);
+        ASSERT_EQ(log.next_recno(), 7);
+        // recovery cuts each segment back to its last intact record
+        ASSERT_EQ(file_size(dir.path("log.0000000000000001")), good.size());
+        ASSERT_EQ(file_size(dir.path("log.0000000000000002")),
+                  encode_record(6, "entry 6").size());
+    }
+
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), expected);
+}
+
+TEST(DurableLog, DropsTornTail)
+{
+    scratch_dir dir;
+    const std::string kept = encode_frame(1, make_entries(1, 2));
+    const std::string torn = encode_frame(3, make_entries(3, 2));
+    // torn inside the checksum, inside the body, and inside the header
+    append_file(dir.path("log.0000000000000001"), kept + torn.substr(0, torn.size() - 1));
+    append_file(dir.path("log.0000000000000002"), kept.substr(0, kept.size() / 2));
+    append_file(dir.path("log.0000000000000003"), encode_record(5, "entry 5") + torn.substr(0, 7));
+    std::vector<std::string> expected = make_entries(1, 2);
+    expected.push_back("entry 5");
+
+    {
+        durable_log log;
+        ASSERT_TRUE(log.open(dir.path(), false, false));
+        assert_replayed(replay(&log), expected);
+        ASSERT_EQ(log.next_recno(), 6);
+        ASSERT_EQ(file_size(dir.path("log.0000000000000001")), kept.size());
+        // a segment with nothing intact is removed outright
+        ASSERT_NE(access(dir.path("log.0000000000000002").c_str(), F_OK), 0);
+        append_durably(&log, make_entries(6, 2));
+    }
+
+    expected.push_back("entry 6");
+    expected.push_back("entry 7");
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), expected);
+}
+
+TEST(DurableLog, DropsMalformedFrame)
+{
+    scratch_dir dir;
+    const std::string kept = encode_frame(1, make_entries(1, 2));
+    // the checksum holds, but the second record claims more bytes than
+    // the frame has; none of the frame's records are trusted
+    const std::string payload = encode_framed(3, 7, "entry 3")
+                              + encode_framed(4, 64, "entry 4");
+    append_file(dir.path("log.0000000000000001"),
+                kept + encode_record(0, payload) + encode_frame(5, make_entries(5, 1)));
+    durable_log log;
+    ASSERT_TRUE(log.open(dir.path(), false, false));
+    assert_replayed(replay(&log), make_entries(1, 2));
+    ASSERT_EQ(log.next_recno(), 3);
+    ASSERT_EQ(file_size(dir.path("log.0000000000000001")), kept.size());
+}
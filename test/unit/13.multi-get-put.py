@@ -0,0 +1,15 @@
+import consus
+
+c = consus.Client()
+
+t = c.begin_transaction()
+assert t.multi_get('the table', ['k1', 'k2', 'k3']) == [None, None, None]
+t.commit()
+
+t = c.begin_transaction()
+assert t.multi_put('the table', [('k1', 'v1'), ('k2', 'v2'), ('k3', 'v3')])
+t.commit()
+
+t = c.begin_transaction()
+assert t.multi_get('the table', ['k1', 'k2', 'k3', 'k4']) == ['v1', 'v2', 'v3', None]
+t.commit()
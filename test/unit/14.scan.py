@@ -0,0 +1,18 @@
+import consus
+
+c = consus.Client()
+
+t = c.begin_transaction()
+assert t.scan('the table', 'a', 10) == []
+t.commit()
+
+t = c.begin_transaction()
+for k in ('a', 'b', 'c', 'd'):
+    assert t.put('the table', k, k.upper())
+t.commit()
+
+t = c.begin_transaction()
+assert t.scan('the table', 'a', 10) == [('a', 'A'), ('b', 'B'), ('c', 'C'), ('d', 'D')]
+assert t.scan('the table', 'b', 2) == [('b', 'B'), ('c', 'C')]
+assert t.scan('the table', 'e', 10) == []
+t.commit()
@@ -0,0 +1,16 @@
+import time
+
+import consus
+
+c = consus.Client()
+
+assert c.stale_get('the table', 'the key') is None
+
+t = c.begin_transaction()
+assert t.put('the table', 'the key', 'the value')
+t.commit()
+
+# the nearest replica may not have the write yet
+while c.stale_get('the table', 'the key') is None:
+    time.sleep(0.1)
+assert c.stale_get('the table', 'the key') == 'the value'
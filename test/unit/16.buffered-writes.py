@@ -0,0 +1,24 @@
+import consus
+
+c = consus.Client()
+
+t = c.begin_transaction()
+t.buffer_writes()
+assert t.put('the table', 'k1', 'v1')
+assert t.put('the table', 'k2', 'v2')
+t.abort()
+
+t = c.begin_transaction()
+assert t.get('the table', 'k1') is None
+assert t.get('the table', 'k2') is None
+t.commit()
+
+t = c.begin_transaction()
+t.buffer_writes()
+assert t.put('the table', 'k1', 'v1')
+assert t.multi_put('the table', [('k2', 'v2'), ('k3', 'v3')])
+t.commit()
+
+t = c.begin_transaction()
+assert t.multi_get('the table', ['k1', 'k2', 'k3']) == ['v1', 'v2', 'v3']
+t.commit()
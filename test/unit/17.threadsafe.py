@@ -0,0 +1,27 @@
+import threading
+
+import consus
+
+# the threads share one Client and each waits on only its own operations
+c = consus.Client()
+failures = []
+
+def worker(n):
+    try:
+        for i in range(16):
+            key = 'key-%d-%d' % (n, i)
+            t = c.begin_transaction()
+            assert t.put('the table', key, i)
+            t.commit()
+            t = c.begin_transaction()
+            assert t.get('the table', key) == i
+            t.commit()
+    except Exception as e:
+        failures.append(e)
+
+threads = [threading.Thread(target=worker, args=(n,)) for n in range(8)]
+for th in threads:
+    th.start()
+for th in threads:
+    th.join()
+assert not failures, failures
@@ -0,0 +1,17 @@
+import consus
+
+c = consus.Client()
+
+t = c.begin_transaction()
+assert t.cond_put('the table', 'the key', None, 'v1')
+t.commit()
+
+t = c.begin_transaction()
+assert not t.cond_put('the table', 'the key', None, 'v2')
+assert not t.cond_put('the table', 'the key', 'v2', 'v3')
+assert t.cond_put('the table', 'the key', 'v1', 'v2')
+t.commit()
+
+t = c.begin_transaction()
+assert t.get('the table', 'the key') == 'v2'
+t.commit()
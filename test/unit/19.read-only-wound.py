@@ -0,0 +1,31 @@
+import time
+
+import consus
+
+c = consus.Client()
+
+t = c.begin_transaction()
+assert t.put('table', 'key', 'v1')
+t.commit()
+
+t1 = c.begin_transaction()
+time.sleep(1)
+t2 = c.begin_transaction()
+time.sleep(1)
+assert t2.get('table', 'key') == 'v1'
+time.sleep(1)
+assert t1.put('table', 'key', 'v2')
+time.sleep(1)
+
+aborted = None
+try:
+    t2.commit()
+    aborted = False
+except consus.ConsusAbortedException:
+    aborted = True
+t1.commit()
+assert aborted
+
+t = c.begin_transaction()
+assert t.get('table', 'key') == 'v2'
+t.commit()
@@ -0,0 +1,617 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// A YCSB-style load generator.  Every worker thread has its own client and
+// runs one transaction at a time of --ops reads and writes against keys drawn
+// uniformly or from a scrambled zipfian.  Without --rate each worker starts
+// its next transaction as soon as the last one finishes; with --rate the
+// workers together start transactions on a fixed schedule and latency is
+// measured from when a transaction was due, so a stalled cluster shows up in
+// the percentiles rather than hiding behind a lower offered load.  The report
+// goes to stdout as JSON.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
+// e
+#include <e/compat.h>
+#include <e/guard.h>
+#include <e/popt.h>
+
+// consus
+#include <consus.h>
+#include "tools/connect_opts.h"
+
+#define PROG "consus-bench"
+
+namespace
+{
+
+enum optype
+{
+    OP_GET,
+    OP_PUT,
+    OP_COMMIT,
+    OP_TRANSACTION,
+    OP_COUNT
+};
+
+const char* const optype_names[OP_COUNT] = {"get", "put", "commit", "transaction"};
+
+struct workload
+{
+    workload()
+        : conn_str(NULL), threads(1), duration(10), keys(100000), tables(1)
+        , table_prefix("bench"), ops(4), read_fraction(0.5), zipfian(false)
+        , theta(0.99), value_size(100), rate(0), zeta_n(0), zeta_2(0)
+        , alpha(0), eta(0) {}
+    const char* conn_str;
+    unsigned threads;
+    uint64_t duration;
+    uint64_t keys;
+    unsigned tables;
+    const char* table_prefix;
+    unsigned ops;
+    double read_fraction;
+    bool zipfian;
+    double theta;
+    size_t value_size;
+    uint64_t rate;
+    // zipfian constants, after Gray et al., "Quickly Generating
+    // Billion-Record Synthetic Databases"
+    double zeta_n;
+    double zeta_2;
+    double alpha;
+    double eta;
+};
+
+// xorshift64*; each worker has its own, so no locking
+class rng
+{
+    public:
+        rng(uint64_t seed) : m_x(seed ? seed : 88172645463325252ULL) {}
+
+    public:
+        uint64_t next()
+        {
+            m_x ^= m_x >> 12;
+            m_x ^= m_x << 25;
+            m_x ^= m_x >> 27;
+            return m_x * 2685821657736338717ULL;
+        }
+        double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    private:
+        uint64_t m_x;
+};
+
+double
+zeta(uint64_t n, double theta)
+{
+    double sum = 0;
+
+    for (uint64_t i = 1; i <= n; ++i)
+    {
+        sum += 1.0 / pow(double(i), theta);
+    }
+
+    return sum;
+}
+
+uint64_t
+fnv1a(uint64_t x)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (unsigned i = 0; i < sizeof(x); ++i)
+    {
+        h ^= (x >> (i * 8)) & 0xff;
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+uint64_t
+choose_key(const workload& w, rng* r)
+{
+    if (!w.zipfian)
+    {
+        return r->next() % w.keys;
+    }
+
+    const double u = r->uniform();
+    const double uz = u * w.zeta_n;
+    uint64_t rank;
+
+    if (uz < 1.0)
+    {
+        rank = 0;
+    }
+    else if (uz < 1.0 + pow(0.5, w.theta))
+    {
+        rank = 1;
+    }
+    else
+    {
+        rank = uint64_t(w.keys * pow(w.eta * u - w.eta + 1, w.alpha));
+    }
+
+    // scramble so that the hot keys are spread across the key space
+    return fnv1a(std::min(rank, w.keys - 1)) % w.keys;
+}
+
+struct stats
+{
+    stats() : latencies(OP_COUNT), aborted(0), errors(0) {}
+    std::vector<std::vector<uint64_t> > latencies;
+    uint64_t aborted;
+    uint64_t errors;
+};
+
+class worker
+{
+    public:
+        worker(const workload* w, unsigned idx, uint64_t start, uint64_t end);
+        ~worker() throw ();
+
+    public:
+        void run();
+        const stats& results() const { return m_stats; }
+
+    private:
+        bool wait(int64_t id);
+        bool transaction(uint64_t due);
+        std::string key_for(uint64_t k);
+
+    private:
+        const workload* const m_w;
+        const unsigned m_idx;
+        const uint64_t m_start;
+        const uint64_t m_end;
+        consus_client* m_cl;
+        rng m_rng;
+        std::string m_value;
+        stats m_stats;
+
+    private:
+        worker(const worker&);
+        worker& operator = (const worker&);
+};
+
+worker :: worker(const workload* w, unsigned idx, uint64_t start, uint64_t end)
+    : m_w(w)
+    , m_idx(idx)
+    , m_start(start)
+    , m_end(end)
+    , m_cl(NULL)
+    , m_rng(fnv1a(po6::monotonic_time() + idx))
+    , m_value()
+    , m_stats()
+{
+    for (size_t i = 0; i < m_w->value_size; ++i)
+    {
+        m_value.push_back('a' + m_rng.next() % 26);
+    }
+}
+
+worker :: ~worker() throw ()
+{
+    if (m_cl)
+    {
+        consus_destroy(m_cl);
+    }
+}
+
+void
+worker :: run()
+{
+    m_cl = consus_create_conn_str(m_w->conn_str);
+
+    if (!m_cl)
+    {
+        ++m_stats.errors;
+        return;
+    }
+
+    // with --rate, worker i starts transactions i, i + threads, ... of the
+    // global schedule
+    const uint64_t interval = m_w->rate > 0 ? PO6_SECONDS / m_w->rate : 0;
+    uint64_t seq = m_idx;
+
+    while (true)
+    {
+        uint64_t now = po6::monotonic_time();
+        uint64_t due = now;
+
+        if (interval > 0)
+        {
+            due = m_start + seq * interval;
+            seq += m_w->threads;
+
+            if (due > now)
+            {
+                usleep((due - now) / 1000);
+            }
+        }
+
+        if (due >= m_end)
+        {
+            break;
+        }
+
+        if (!transaction(due))
+        {
+            ++m_stats.errors;
+        }
+    }
+}
+
+bool
+worker :: wait(int64_t id)
+{
+    if (id < 0)
+    {
+        return false;
+    }
+
+    consus_returncode lrc;
+    return consus_wait(m_cl, id, -1, &lrc) == id;
+}
+
+bool
+worker :: transaction(uint64_t due)
+{
+    consus_returncode status;
+    consus_transaction* xact = NULL;
+
+    if (!wait(consus_begin_transaction(m_cl, &status, &xact)) ||
+        status != CONSUS_SUCCESS)
+    {
+        return false;
+    }
+
+    e::guard g_xact = e::makeguard(consus_destroy_transaction, xact);
+
+    for (unsigned i = 0; i < m_w->ops; ++i)
+    {
+        std::ostringstream table;
+        table << m_w->table_prefix << (m_rng.next() % m_w->tables);
+        const std::string key(key_for(choose_key(*m_w, &m_rng)));
+        const bool read = m_rng.uniform() < m_w->read_fraction;
+        const uint64_t start = po6::monotonic_time();
+        int64_t id;
+        char* value = NULL;
+        size_t value_sz = 0;
+
+        if (read)
+        {
+            id = consus_get_bin(xact, table.str().c_str(), key.data(), key.size(),
+                                &status, &value, &value_sz);
+        }
+        else
+        {
+            id = consus_put_bin(xact, table.str().c_str(), key.data(), key.size(),
+                                m_value.data(), m_value.size(), &status);
+        }
+
+        const bool ok = wait(id);
+        free(value);
+
+        if (!ok)
+        {
+            return false;
+        }
+
+        if (status == CONSUS_ABORTED)
+        {
+            ++m_stats.aborted;
+            return true;
+        }
+
+        if (status != CONSUS_SUCCESS && status != CONSUS_NOT_FOUND &&
+            status != CONSUS_LESS_DURABLE)
+        {
+            return false;
+        }
+
+        m_stats.latencies[read ? OP_GET : OP_PUT].push_back(po6::monotonic_time() - start);
+    }
+
+    const uint64_t start = po6::monotonic_time();
+
+    if (!wait(consus_commit_transaction(xact, &status)))
+    {
+        return false;
+    }
+
+    const uint64_t end = po6::monotonic_time();
+
+    if (status == CONSUS_ABORTED)
+    {
+        ++m_stats.aborted;
+        return true;
+    }
+
+    if (status != CONSUS_COMMITTED && status != CONSUS_SUCCESS)
+    {
+        return false;
+    }
+
+    m_stats.latencies[OP_COMMIT].push_back(end - start);
+    m_stats.latencies[OP_TRANSACTION].push_back(end - due);
+    return true;
+}
+
+std::string
+worker :: key_for(uint64_t k)
+{
+    char buf[32];
+    int sz = snprintf(buf, sizeof(buf), "user%012llu", (unsigned long long)k);
+    return std::string(buf, sz);
+}
+
+double
+percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    size_t idx = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+    return sorted[idx] / 1000.0;
+}
+
+void
+report(const workload& w, double elapsed, const std::vector<worker*>& workers)
+{
+    std::vector<uint64_t> merged[OP_COUNT];
+    uint64_t aborted = 0;
+    uint64_t errors = 0;
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        const stats& s(workers[i]->results());
+        aborted += s.aborted;
+        errors += s.errors;
+
+        for (unsigned op = 0; op < OP_COUNT; ++op)
+        {
+            merged[op].insert(merged[op].end(), s.latencies[op].begin(), s.latencies[op].end());
+        }
+    }
+
+    std::ostringstream out;
+    out.precision(3);
+    out << std::fixed;
+    out << "{\n"
+        << "  \"threads\": " << w.threads << ",\n"
+        << "  \"seconds\": " << elapsed << ",\n"
+        << "  \"offered_rate\": " << w.rate << ",\n"
+        << "  \"distribution\": \"" << (w.zipfian ? "zipfian" : "uniform") << "\",\n"
+        << "  \"committed\": " << merged[OP_TRANSACTION].size() << ",\n"
+        << "  \"aborted\": " << aborted << ",\n"
+        << "  \"errors\": " << errors << ",\n"
+        << "  \"operations\": {";
+
+    for (unsigned op = 0; op < OP_COUNT; ++op)
+    {
+        std::vector<uint64_t>& l(merged[op]);
+        std::sort(l.begin(), l.end());
+        double sum = 0;
+
+        for (size_t i = 0; i < l.size(); ++i)
+        {
+            sum += l[i];
+        }
+
+        out << (op ? ",\n" : "\n")
+            << "    \"" << optype_names[op] << "\": {"
+            << "\"count\": " << l.size()
+            << ", \"per_second\": " << l.size() / elapsed
+            << ", \"latency_us\": {"
+            << "\"mean\": " << (l.empty() ? 0 : sum / l.size() / 1000.0)
+            << ", \"p50\": " << percentile(l, 0.50)
+            << ", \"p90\": " << percentile(l, 0.90)
+            << ", \"p99\": " << percentile(l, 0.99)
+            << ", \"p999\": " << percentile(l, 0.999)
+            << ", \"max\": " << (l.empty() ? 0 : l.back() / 1000.0)
+            << "}}";
+    }
+
+    out << "\n  }\n}\n";
+    std::cout << out.str() << std::flush;
+}
+
+} // namespace
+
+int
+main(int argc, const char* argv[])
+{
+    long threads = 1;
+    long duration = 10;
+    long keys = 100000;
+    long tables = 1;
+    const char* table_prefix = "bench";
+    long ops = 4;
+    long reads = 50;
+    const char* distribution = "uniform";
+    const char* theta = "0.99";
+    long value_size = 100;
+    long rate = 0;
+    consus::connect_opts conn;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS]");
+    ap.arg().name('t', "threads")
+            .description("run N workers, each with its own client (default: 1)")
+            .metavar("N").as_long(&threads);
+    ap.arg().name('d', "duration")
+            .description("run for S seconds (default: 10)")
+            .metavar("S").as_long(&duration);
+    ap.arg().name('k', "keys")
+            .description("draw keys from N distinct keys per table (default: 100000)")
+            .metavar("N").as_long(&keys);
+    ap.arg().long_name("tables")
+            .description("spread operations across N tables named <prefix>0 to <prefix>N-1 (default: 1)")
+            .metavar("N").as_long(&tables);
+    ap.arg().long_name("table-prefix")
+            .description("prefix of the table names (default: bench)")
+            .metavar("name").as_string(&table_prefix);
+    ap.arg().name('o', "ops")
+            .description("operations per transaction (default: 4)")
+            .metavar("N").as_long(&ops);
+    ap.arg().name('r', "reads")
+            .description("percentage of operations that are reads; the rest are writes (default: 50)")
+            .metavar("P").as_long(&reads);
+    ap.arg().long_name("distribution")
+            .description("key distribution, \"uniform\" or \"zipfian\" (default: uniform)")
+            .metavar("D").as_string(&distribution);
+    ap.arg().long_name("zipf-theta")
+            .description("skew of the zipfian distribution (default: 0.99)")
+            .metavar("T").as_string(&theta);
+    ap.arg().long_name("value-size")
+            .description("bytes per written value (default: 100)")
+            .metavar("B").as_long(&value_size);
+    ap.arg().long_name("rate")
+            .description("start R transactions per second in total (open loop), or 0 to start each as the last finishes (default: 0)")
+            .metavar("R").as_long(&rate);
+    ap.add("Connect to a cluster:", conn.parser());
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!conn.validate())
+    {
+        std::cerr << PROG ": invalid host:port specification\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << PROG " takes zero positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    workload w;
+    w.conn_str = conn.conn_str();
+    w.table_prefix = table_prefix;
+    w.zipfian = strcmp(distribution, "zipfian") == 0;
+    w.theta = strtod(theta, NULL);
+
+    if (threads <= 0 || duration <= 0 || keys <= 0 || tables <= 0 ||
+        ops <= 0 || value_size < 0 || rate < 0 || reads < 0 || reads > 100)
+    {
+        std::cerr << PROG ": option out of range\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!w.zipfian && strcmp(distribution, "uniform") != 0)
+    {
+        std::cerr << PROG ": unknown distribution \"" << distribution << "\"\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (w.zipfian && (w.theta <= 0 || w.theta >= 1 || keys < 3))
+    {
+        std::cerr << PROG ": zipfian needs a zipf-theta between 0 and 1 and at least 3 keys\n" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    w.threads = threads;
+    w.duration = duration;
+    w.keys = keys;
+    w.tables = tables;
+    w.ops = ops;
+    w.read_fraction = reads / 100.0;
+    w.value_size = value_size;
+    w.rate = rate;
+
+    if (w.zipfian)
+    {
+        w.zeta_n = zeta(w.keys, w.theta);
+        w.zeta_2 = zeta(2, w.theta);
+        w.alpha = 1.0 / (1.0 - w.theta);
+        w.eta = (1 - pow(2.0 / w.keys, 1 - w.theta)) / (1 - w.zeta_2 / w.zeta_n);
+    }
+
+    const uint64_t start = po6::monotonic_time();
+    const uint64_t end = start + w.duration * PO6_SECONDS;
+    std::vector<worker*> workers;
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+
+    for (unsigned i = 0; i < w.threads; ++i)
+    {
+        workers.push_back(new worker(&w, i, start, end));
+        e::compat::shared_ptr<po6::threads::thread> t(new po6::threads::thread(
+                    po6::threads::make_obj_func(&worker::run, workers.back())));
+        ts.push_back(t);
+        t->start();
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+
+    const double elapsed = (po6::monotonic_time() - start) / double(PO6_SECONDS);
+    report(w, elapsed, workers);
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        delete workers[i];
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,327 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Prepares a bulk-load file for a table from tab-separated "key<TAB>value"
+// lines.  The lines are spilled to disk by ring index, and each spill file is
+// sorted in memory, so memory use is about 1/256th of the input.  Every key
+// value store started with --bulk-load on the result installs the keys it
+// replicates, at the file's one timestamp; a key that appears more than once
+// keeps its last value.
+
+// C
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/time.h>
+
+// e
+#include <e/popt.h>
+#include <e/serialization.h>
+
+// consus
+#include "common/bulk_load.h"
+#include "common/hash.h"
+
+// the high byte of the ring index picks the spill file
+#define SPILL_FILES 256
+#define SPILL_BUFFER_BYTES (1024ULL * 1024ULL)
+
+namespace
+{
+
+struct record
+{
+    record() : index(0), seqno(0), key(), value() {}
+    record(const record& other)
+        : index(other.index), seqno(other.seqno), key(other.key), value(other.value) {}
+    ~record() throw () {}
+    record& operator = (const record& rhs)
+    { index = rhs.index; seqno = rhs.seqno; key = rhs.key; value = rhs.value; return *this; }
+    bool operator < (const record& rhs) const
+    {
+        if (index != rhs.index) return index < rhs.index;
+        if (key != rhs.key) return key < rhs.key;
+        return seqno < rhs.seqno;
+    }
+
+    uint16_t index;
+    uint64_t seqno;
+    std::string key;
+    std::string value;
+};
+
+std::string
+spill_name(const std::string& output, unsigned i)
+{
+    std::ostringstream ostr;
+    ostr << output << ".spill-" << i;
+    return ostr.str();
+}
+
+bool
+flush(po6::io::fd* fd, std::string* buf)
+{
+    const bool ok = fd->xwrite(buf->data(), buf->size()) == ssize_t(buf->size());
+    buf->clear();
+    return ok;
+}
+
+bool
+slurp(const std::string& path, std::string* data)
+{
+    std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+    std::ostringstream ostr;
+    ostr << fin.rdbuf();
+    *data = ostr.str();
+    return !fin.bad();
+}
+
+} // namespace
+
+int
+main(int argc, const char* argv[])
+{
+    long timestamp = 0;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS] <table> <input> <output>");
+    ap.arg().long_name("timestamp")
+            .description("install every key at this wall-clock time in nanoseconds (default: now)")
+            .metavar("NS").as_long(&timestamp);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 3)
+    {
+        std::cerr << "consus-bulk-load takes three positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (timestamp < 0)
+    {
+        std::cerr << "consus-bulk-load: timestamp must be non-negative\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    const e::slice table(ap.args()[0]);
+    const std::string input(ap.args()[1]);
+    const std::string output(ap.args()[2]);
+    const uint64_t ts = timestamp > 0 ? uint64_t(timestamp) : po6::wallclock_time();
+    std::ifstream fin;
+
+    if (input != "-")
+    {
+        fin.open(input.c_str(), std::ios::in | std::ios::binary);
+
+        if (!fin)
+        {
+            std::cerr << "consus-bulk-load: could not open " << input << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::istream& in(input == "-" ? std::cin : fin);
+    po6::io::fd spills[SPILL_FILES];
+    std::vector<std::string> buffers(SPILL_FILES);
+
+    for (unsigned i = 0; i < SPILL_FILES; ++i)
+    {
+        spills[i] = open(spill_name(output, i).c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+
+        if (spills[i].get() < 0)
+        {
+            std::cerr << "consus-bulk-load: could not create " << spill_name(output, i)
+                      << ": " << strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // spill every line to the file for its index
+    std::string line;
+    uint64_t lines = 0;
+    uint64_t skipped = 0;
+
+    while (std::getline(in, line))
+    {
+        ++lines;
+        const size_t tab = line.find('\t');
+
+        if (tab == std::string::npos || tab == 0 || tab + 1 == line.size())
+        {
+            ++skipped;
+            continue;
+        }
+
+        const e::slice key(line.data(), tab);
+        const e::slice value(line.data() + tab + 1, line.size() - tab - 1);
+        const uint16_t index = consus::hash64(table, key) >> 48;
+        const unsigned s = index >> 8;
+        e::packer(&buffers[s]) << index << key << value;
+
+        if (buffers[s].size() >= SPILL_BUFFER_BYTES && !flush(&spills[s], &buffers[s]))
+        {
+            std::cerr << "consus-bulk-load: could not write " << spill_name(output, s)
+                      << ": " << strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (in.bad())
+    {
+        std::cerr << "consus-bulk-load: could not read " << input << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned i = 0; i < SPILL_FILES; ++i)
+    {
+        if (!flush(&spills[i], &buffers[i]))
+        {
+            std::cerr << "consus-bulk-load: could not write " << spill_name(output, i)
+                      << ": " << strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        spills[i].close();
+    }
+
+    consus::bulk_load_writer writer;
+
+    if (!writer.open(output, table, ts))
+    {
+        std::cerr << "consus-bulk-load: could not create " << output
+                  << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // sort each spill file and write its indices in order
+    uint64_t keys = 0;
+
+    for (unsigned i = 0; i < SPILL_FILES; ++i)
+    {
+        const std::string name(spill_name(output, i));
+        std::string data;
+
+        if (!slurp(name, &data))
+        {
+            std::cerr << "consus-bulk-load: could not read " << name << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::vector<record> records;
+        e::unpacker up(data.data(), data.size());
+
+        while (!up.error() && up.remain())
+        {
+            record r;
+            e::slice key;
+            e::slice value;
+            up = up >> r.index >> key >> value;
+            r.seqno = records.size();
+            r.key = key.str();
+            r.value = value.str();
+            records.push_back(r);
+        }
+
+        if (up.error())
+        {
+            std::cerr << "consus-bulk-load: " << name << " is corrupt" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::sort(records.begin(), records.end());
+        consus::bulk_load_writer::records_t block;
+
+        for (size_t r = 0; r < records.size(); ++r)
+        {
+            // the last of a run of one key wins
+            if (r + 1 < records.size() &&
+                records[r + 1].index == records[r].index &&
+                records[r + 1].key == records[r].key)
+            {
+                continue;
+            }
+
+            block.push_back(std::make_pair(records[r].key, records[r].value));
+
+            if (r + 1 == records.size() || records[r + 1].index != records[r].index)
+            {
+                if (!writer.block(records[r].index, block))
+                {
+                    std::cerr << "consus-bulk-load: could not write " << output
+                              << ": " << strerror(errno) << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                keys += block.size();
+                block.clear();
+            }
+        }
+
+        unlink(name.c_str());
+    }
+
+    if (!writer.close())
+    {
+        std::cerr << "consus-bulk-load: could not sync " << output
+                  << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "wrote " << keys << " keys of table " << table.str()
+              << " at timestamp " << ts << " to " << output;
+
+    if (skipped > 0)
+    {
+        std::cout << "; skipped " << skipped << " of " << lines
+                  << " lines without a key and value";
+    }
+
+    std::cout << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -36,10 +36,14 @@
 int
 main(int argc, const char* argv[])
 {
+    bool read_replica = false;
     consus::connect_opts conn;
     e::argparser ap;
     ap.autohelp();
     ap.option_string("[OPTIONS] <dc-name>");
+    ap.arg().name('r', "read-replica")
+            .description("serve stale reads from a full copy, outside every quorum")
+            .set_true(&read_replica);
     ap.add("Connect to a cluster:", conn.parser());
 
     if (!ap.parse(argc, argv))
@@ -72,7 +76,11 @@ main(int argc, const char* argv[])
     e::guard g_cl = e::makeguard(consus_destroy, cl);
     consus_returncode rc;
 
-    if (consus_admin_create_data_center(cl, ap.args()[0], &rc) < 0)
+    int ret = read_replica
+            ? consus_admin_create_read_replica(cl, ap.args()[0], &rc)
+            : consus_admin_create_data_center(cl, ap.args()[0], &rc);
+
+    if (ret < 0)
     {
         std::cerr << "consus-create-data-center: " << consus_error_message(cl) << std::endl;
         return EXIT_FAILURE;
@@ -0,0 +1,205 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Fetches a daemon's metrics page and prints what it is busiest with: on a
+// key value store, the hottest keys, the longest lock queues, and the slowest
+// replicators; on a transaction manager, the oldest transactions in flight.
+// Each is kept up to date as the daemon runs, so asking never makes it walk
+// its state tables the way a debug dump does.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// e
+#include <e/popt.h>
+
+// consus
+#include "tools/fetch_metrics.h"
+
+// the value of label name in a Prometheus sample line, or "" if absent
+static std::string
+label(const std::string& line, const std::string& name)
+{
+    const std::string needle(name + "=\"");
+    size_t start = line.find(needle);
+
+    if (start == std::string::npos)
+    {
+        return "";
+    }
+
+    start += needle.size();
+    size_t end = start;
+
+    while (end < line.size() && line[end] != '"')
+    {
+        end += line[end] == '\\' ? 2 : 1;
+    }
+
+    return line.substr(start, end - start);
+}
+
+static long
+rank(const std::string& line)
+{
+    return atol(label(line, "rank").c_str());
+}
+
+static std::string
+value(const std::string& line)
+{
+    size_t space = line.rfind(' ');
+    return space == std::string::npos ? "" : line.substr(space + 1);
+}
+
+static bool
+starts_with(const std::string& line, const char* prefix)
+{
+    return line.compare(0, strlen(prefix), prefix) == 0;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* host = "127.0.0.1";
+    long port = 0;
+    long top = 10;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS]");
+    ap.arg().name('h', "host")
+            .description("the daemon to ask (default: 127.0.0.1)")
+            .metavar("addr").as_string(&host);
+    ap.arg().name('p', "port")
+            .description("the daemon's --metrics-port")
+            .metavar("port").as_long(&port);
+    ap.arg().name('n', "top")
+            .description("print at most N entries of each list (default: 10)")
+            .metavar("N").as_long(&top);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (port <= 0 || port >= (1 << 16))
+    {
+        std::cerr << "consus-debug-hot-spots: must specify the metrics port\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << "consus-debug-hot-spots takes zero positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    std::string page;
+    std::string error;
+
+    if (!consus::fetch_metrics(host, port, &page, &error))
+    {
+        std::cerr << "consus-debug-hot-spots: " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // section name -> printed lines, in the order sections first appear
+    std::map<std::string, std::string> sections;
+    std::vector<std::string> order;
+    std::istringstream in(page);
+    std::string line;
+
+    while (std::getline(in, line))
+    {
+        std::string section;
+        std::ostringstream entry;
+
+        if (starts_with(line, "consus_hot_key{"))
+        {
+            section = "hottest keys (" + label(line, "op") + "s, estimated)";
+            entry << "table=\"" << label(line, "table") << "\" key=\"" << label(line, "key")
+                  << "\" " << value(line);
+        }
+        else if (starts_with(line, "consus_lock_contention{") &&
+                 label(line, "dimension") == "queued_ahead")
+        {
+            section = "longest lock queues (transactions queued ahead, summed)";
+            entry << "table=\"" << label(line, "table") << "\" key=\"" << label(line, "key")
+                  << "\" " << value(line);
+        }
+        else if (starts_with(line, "consus_slow_replicator_seconds{"))
+        {
+            section = "slowest replicators (seconds)";
+            entry << label(line, "kind") << " table=\"" << label(line, "table")
+                  << "\" key=\"" << label(line, "key") << "\" " << value(line);
+        }
+        else if (starts_with(line, "consus_oldest_transaction_seconds{"))
+        {
+            section = "oldest transactions in flight (seconds)";
+            entry << label(line, "transaction") << " " << value(line);
+        }
+        else
+        {
+            continue;
+        }
+
+        if (rank(line) >= top)
+        {
+            continue;
+        }
+
+        if (sections.find(section) == sections.end())
+        {
+            order.push_back(section);
+        }
+
+        sections[section] += "  " + entry.str() + "\n";
+    }
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        std::cout << order[i] << ":\n" << sections[order[i]];
+    }
+
+    if (order.empty())
+    {
+        std::cout << "nothing to report yet\n";
+    }
+
+    std::cout << std::flush;
+    return EXIT_SUCCESS;
+}
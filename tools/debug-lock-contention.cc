@@ -0,0 +1,109 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Fetches a key value store's metrics page and prints the lock contention
+// top-K from it.  The statistics are per daemon, so this talks to one
+// daemon's --metrics-port rather than to the coordinator.
+
+// C
+#include <stdlib.h>
+
+// STL
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// e
+#include <e/popt.h>
+
+// consus
+#include "tools/fetch_metrics.h"
+
+int
+main(int argc, const char* argv[])
+{
+    const char* host = "127.0.0.1";
+    long port = 0;
+    bool all = false;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS]");
+    ap.arg().name('h', "host")
+            .description("the key value store to ask (default: 127.0.0.1)")
+            .metavar("addr").as_string(&host);
+    ap.arg().name('p', "port")
+            .description("the key value store's --metrics-port")
+            .metavar("port").as_long(&port);
+    ap.arg().name('a', "all")
+            .description("also print the error bound and event count of each key")
+            .set_true(&all);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (port <= 0 || port >= (1 << 16))
+    {
+        std::cerr << "consus-debug-lock-contention: must specify the metrics port\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << "consus-debug-lock-contention takes zero positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    std::string page;
+    std::string error;
+
+    if (!consus::fetch_metrics(host, port, &page, &error))
+    {
+        std::cerr << "consus-debug-lock-contention: " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::istringstream in(page);
+    std::string line;
+    const std::string prefix("consus_lock_contention{");
+    const std::string prefix_all("consus_lock_contention_");
+
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, prefix.size(), prefix) == 0 ||
+            (all && line.compare(0, prefix_all.size(), prefix_all) == 0))
+        {
+            std::cout << line << "\n";
+        }
+    }
+
+    std::cout << std::flush;
+    return EXIT_SUCCESS;
+}
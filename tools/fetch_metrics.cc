@@ -0,0 +1,114 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <errno.h>
+#include <string.h>
+
+// POSIX
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// STL
+#include <sstream>
+
+// consus
+#include "tools/fetch_metrics.h"
+
+bool
+consus :: fetch_metrics(const char* host, long port, std::string* page, std::string* error)
+{
+    struct addrinfo hints;
+    struct addrinfo* ai = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    std::ostringstream service;
+    service << port;
+    int rc = getaddrinfo(host, service.str().c_str(), &hints, &ai);
+
+    if (rc != 0)
+    {
+        *error = gai_strerror(rc);
+        return false;
+    }
+
+    int fd = -1;
+
+    for (struct addrinfo* a = ai; a; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+        {
+            break;
+        }
+
+        if (fd >= 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(ai);
+
+    if (fd < 0)
+    {
+        *error = strerror(errno);
+        return false;
+    }
+
+    const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+
+    if (write(fd, req, sizeof(req) - 1) != ssize_t(sizeof(req) - 1))
+    {
+        *error = strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    char buf[4096];
+    ssize_t amt;
+
+    while ((amt = read(fd, buf, sizeof(buf))) > 0)
+    {
+        page->append(buf, amt);
+    }
+
+    if (amt < 0)
+    {
+        *error = strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+    return true;
+}
@@ -0,0 +1,439 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// A latency canary.  For every transaction manager that clients may begin
+// transactions at, a worker with its own client begins a transaction there
+// and commits a single write, on a fixed open-loop schedule of --rate probes
+// per second.  Latency is measured from when each probe was due rather than
+// from when it was sent, so that a stall shows up in full instead of as
+// fewer, faster probes.  Every --interval seconds one line per route (origin
+// data center, paxos group, and transaction manager) goes to stdout with
+// how many probes committed, aborted, and failed, and their latency
+// percentiles.  The set of transaction managers is fixed at startup.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+#include <po6/threads/thread.h>
+#include <po6/time.h>
+
+// e
+#include <e/compat.h>
+#include <e/guard.h>
+#include <e/popt.h>
+
+// consus
+#include <consus.h>
+#include "client/consus-internal.h"
+#include "tools/connect_opts.h"
+
+#define PROG "consus-probe"
+// more transaction managers than this are not probed
+#define PROBE_MAX_TARGETS 4096
+
+namespace
+{
+
+struct route_stats
+{
+    route_stats() : latencies(), aborted(0), errors(0) {}
+    std::vector<uint64_t> latencies;
+    uint64_t aborted;
+    uint64_t errors;
+};
+
+// keyed by the group that coordinated each probe; 0 if none began
+typedef std::map<uint64_t, route_stats> route_map_t;
+
+class prober
+{
+    public:
+        prober(const char* conn_str, const char* table, uint64_t txman,
+               uint64_t dc, uint64_t rate, uint64_t start, uint64_t end);
+        ~prober() throw ();
+
+    public:
+        void run();
+        uint64_t txman() const { return m_txman; }
+        uint64_t dc() const { return m_dc; }
+        // the routes probed since the last call
+        void take(route_map_t* routes);
+
+    private:
+        bool wait(int64_t id);
+        void probe(uint64_t due);
+        void record(uint64_t group, uint64_t latency, bool aborted, bool error);
+
+    private:
+        const char* const m_conn_str;
+        const char* const m_table;
+        const uint64_t m_txman;
+        const uint64_t m_dc;
+        const uint64_t m_rate;
+        const uint64_t m_start;
+        const uint64_t m_end;
+        consus_client* m_cl;
+        std::string m_key;
+        po6::threads::mutex m_mtx;
+        route_map_t m_routes;
+
+    private:
+        prober(const prober&);
+        prober& operator = (const prober&);
+};
+
+prober :: prober(const char* conn_str, const char* table, uint64_t txman,
+                 uint64_t dc, uint64_t rate, uint64_t start, uint64_t end)
+    : m_conn_str(conn_str)
+    , m_table(table)
+    , m_txman(txman)
+    , m_dc(dc)
+    , m_rate(rate)
+    , m_start(start)
+    , m_end(end)
+    , m_cl(NULL)
+    , m_key()
+    , m_mtx()
+    , m_routes()
+{
+    std::ostringstream ostr;
+    ostr << "probe-" << txman;
+    m_key = ostr.str();
+}
+
+prober :: ~prober() throw ()
+{
+    if (m_cl)
+    {
+        consus_destroy(m_cl);
+    }
+}
+
+void
+prober :: run()
+{
+    m_cl = consus_create_conn_str(m_conn_str);
+
+    if (!m_cl)
+    {
+        record(0, 0, false, true);
+        return;
+    }
+
+    const uint64_t interval = PO6_SECONDS / m_rate;
+
+    for (uint64_t seq = 0; ; ++seq)
+    {
+        const uint64_t due = m_start + seq * interval;
+        const uint64_t now = po6::monotonic_time();
+
+        if (due >= m_end)
+        {
+            break;
+        }
+
+        if (due > now)
+        {
+            usleep((due - now) / 1000);
+        }
+
+        probe(due);
+    }
+}
+
+void
+prober :: take(route_map_t* routes)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    routes->clear();
+    routes->swap(m_routes);
+}
+
+bool
+prober :: wait(int64_t id)
+{
+    if (id < 0)
+    {
+        return false;
+    }
+
+    consus_returncode lrc;
+    return consus_wait(m_cl, id, -1, &lrc) == id;
+}
+
+void
+prober :: probe(uint64_t due)
+{
+    consus_returncode status;
+    consus_transaction* xact = NULL;
+
+    if (!wait(consus_begin_transaction_via(m_cl, m_txman, &status, &xact)) ||
+        status != CONSUS_SUCCESS)
+    {
+        record(0, 0, false, true);
+        return;
+    }
+
+    e::guard g_xact = e::makeguard(consus_destroy_transaction, xact);
+    const uint64_t group = consus_transaction_origin(xact);
+    char value[32];
+    int value_sz = snprintf(value, sizeof(value), "%llu", (unsigned long long)due);
+
+    if (!wait(consus_put_bin(xact, m_table, m_key.data(), m_key.size(),
+                             value, value_sz, &status)) ||
+        (status != CONSUS_SUCCESS && status != CONSUS_ABORTED))
+    {
+        record(group, 0, false, true);
+        return;
+    }
+
+    if (status == CONSUS_SUCCESS &&
+        !wait(consus_commit_transaction(xact, &status)))
+    {
+        record(group, 0, false, true);
+        return;
+    }
+
+    const uint64_t latency = po6::monotonic_time() - due;
+
+    if (status == CONSUS_ABORTED)
+    {
+        record(group, latency, true, false);
+    }
+    else if (status == CONSUS_COMMITTED || status == CONSUS_SUCCESS)
+    {
+        record(group, latency, false, false);
+    }
+    else
+    {
+        record(group, latency, false, true);
+    }
+}
+
+void
+prober :: record(uint64_t group, uint64_t latency, bool aborted, bool error)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    route_stats* rs = &m_routes[group];
+
+    if (aborted)
+    {
+        ++rs->aborted;
+    }
+    else if (error)
+    {
+        ++rs->errors;
+    }
+    else
+    {
+        rs->latencies.push_back(latency);
+    }
+}
+
+double
+percentile_ms(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    size_t idx = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+    return sorted[idx] / double(PO6_MILLIS);
+}
+
+void
+report(double elapsed, const std::vector<prober*>& probers)
+{
+    std::ostringstream out;
+    out.precision(3);
+    out << std::fixed;
+
+    for (size_t i = 0; i < probers.size(); ++i)
+    {
+        route_map_t routes;
+        probers[i]->take(&routes);
+
+        for (route_map_t::iterator it = routes.begin(); it != routes.end(); ++it)
+        {
+            std::vector<uint64_t>& l(it->second.latencies);
+            std::sort(l.begin(), l.end());
+            out << "seconds=" << elapsed
+                << " data_center=" << probers[i]->dc()
+                << " group=" << it->first
+                << " txman=" << probers[i]->txman()
+                << " committed=" << l.size()
+                << " aborted=" << it->second.aborted
+                << " errors=" << it->second.errors
+                << " p50_ms=" << percentile_ms(l, 0.50)
+                << " p99_ms=" << percentile_ms(l, 0.99)
+                << " p999_ms=" << percentile_ms(l, 0.999)
+                << " max_ms=" << (l.empty() ? 0 : l.back() / double(PO6_MILLIS))
+                << "\n";
+        }
+    }
+
+    std::cout << out.str() << std::flush;
+}
+
+} // namespace
+
+int
+main(int argc, const char* argv[])
+{
+    long rate = 10;
+    long interval = 10;
+    long duration = 0;
+    const char* table = "consus-probe";
+    consus::connect_opts conn;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS]");
+    ap.arg().name('r', "rate")
+            .description("start R probes per second at each transaction manager (default: 10)")
+            .metavar("R").as_long(&rate);
+    ap.arg().name('i', "interval")
+            .description("report every S seconds (default: 10)")
+            .metavar("S").as_long(&interval);
+    ap.arg().name('d', "duration")
+            .description("stop after S seconds, or 0 to run until killed (default: 0)")
+            .metavar("S").as_long(&duration);
+    ap.arg().long_name("table")
+            .description("write probes to this table (default: consus-probe)")
+            .metavar("name").as_string(&table);
+    ap.add("Connect to a cluster:", conn.parser());
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!conn.validate())
+    {
+        std::cerr << PROG ": invalid host:port specification\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << PROG " takes zero positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (rate <= 0 || rate > long(PO6_SECONDS) || interval <= 0 || duration < 0)
+    {
+        std::cerr << PROG ": option out of range\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    consus_client* cl = consus_create_conn_str(conn.conn_str());
+
+    if (!cl)
+    {
+        std::cerr << PROG ": memory allocation failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    e::guard g_cl = e::makeguard(consus_destroy, cl);
+    std::vector<uint64_t> ids(PROBE_MAX_TARGETS);
+    std::vector<uint64_t> dcs(PROBE_MAX_TARGETS);
+    size_t targets = ids.size();
+    consus_returncode rc;
+
+    if (consus_debug_transaction_managers(cl, &rc, &ids[0], &dcs[0], &targets) < 0)
+    {
+        std::cerr << PROG ": " << consus_error_message(cl) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (targets == 0)
+    {
+        std::cerr << PROG ": no transaction managers to probe" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    targets = std::min(targets, ids.size());
+    const uint64_t start = po6::monotonic_time();
+    const uint64_t end = duration > 0 ? start + duration * PO6_SECONDS : UINT64_MAX;
+    std::vector<prober*> probers;
+    std::vector<e::compat::shared_ptr<po6::threads::thread> > ts;
+
+    for (size_t i = 0; i < targets; ++i)
+    {
+        probers.push_back(new prober(conn.conn_str(), table, ids[i], dcs[i],
+                                     rate, start, end));
+        e::compat::shared_ptr<po6::threads::thread> t(new po6::threads::thread(
+                    po6::threads::make_obj_func(&prober::run, probers.back())));
+        ts.push_back(t);
+        t->start();
+    }
+
+    for (uint64_t next = start + interval * PO6_SECONDS; next < end + interval * PO6_SECONDS;
+            next += interval * PO6_SECONDS)
+    {
+        const uint64_t now = po6::monotonic_time();
+
+        if (next > now)
+        {
+            usleep((next - now) / 1000);
+        }
+
+        report((po6::monotonic_time() - start) / double(PO6_SECONDS), probers);
+    }
+
+    for (size_t i = 0; i < ts.size(); ++i)
+    {
+        ts[i]->join();
+    }
+
+    for (size_t i = 0; i < probers.size(); ++i)
+    {
+        delete probers[i];
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "txman/admission_control.h"
+
+using consus::admission_control;
+
+// how often the loads are recomputed
+#define ADMISSION_REFRESH (100 * PO6_MILLIS)
+// pressure, in thousandths of the limit, at which shedding starts
+#define ADMISSION_SOFT 800
+
+admission_control :: admission_control()
+    : m_max_transactions(0)
+    , m_max_durable_queue(0)
+    , m_max_kvs_latency(0)
+    , m_kvs_sum(0)
+    , m_kvs_count(0)
+    , m_mtx()
+    , m_next_refresh(0)
+    , m_kvs_seen_sum(0)
+    , m_kvs_seen_count(0)
+    , m_kvs_latency(0)
+    , m_transactions(0)
+    , m_durable_queue(0)
+    , m_kvs_load(0)
+    , m_pressure(0)
+    , m_begins(0)
+    , m_shed(0)
+{
+}
+
+admission_control :: ~admission_control() throw ()
+{
+}
+
+void
+admission_control :: set_limits(uint64_t transactions, uint64_t durable_queue, uint64_t kvs_latency)
+{
+    m_max_transactions = transactions;
+    m_max_durable_queue = durable_queue;
+    m_max_kvs_latency = kvs_latency;
+}
+
+void
+admission_control :: observe_kvs_latency(uint64_t nanos)
+{
+    if (m_max_kvs_latency > 0)
+    {
+        e::atomic::increment_64_nobarrier(&m_kvs_sum, nanos);
+        e::atomic::increment_64_nobarrier(&m_kvs_count, 1);
+    }
+}
+
+bool
+admission_control :: stale(uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (now < m_next_refresh)
+    {
+        return false;
+    }
+
+    m_next_refresh = now + ADMISSION_REFRESH;
+    return true;
+}
+
+void
+admission_control :: refresh(uint64_t transactions, uint64_t durable_queue, unsigned kvs_load)
+{
+    const uint64_t sum = e::atomic::increment_64_nobarrier(&m_kvs_sum, 0);
+    const uint64_t count = e::atomic::increment_64_nobarrier(&m_kvs_count, 0);
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (count > m_kvs_seen_count)
+    {
+        const uint64_t mean = (sum - m_kvs_seen_sum) / (count - m_kvs_seen_count);
+        m_kvs_latency = (m_kvs_latency * 3 + mean) / 4;
+    }
+    else
+    {
+        // with nothing outstanding there is nothing to measure; let the
+        // estimate fade so that shedding every begin cannot keep it high
+        m_kvs_latency = m_kvs_latency / 2;
+    }
+
+    m_kvs_seen_sum = sum;
+    m_kvs_seen_count = count;
+    m_transactions = transactions;
+    m_durable_queue = durable_queue;
+    m_kvs_load = kvs_load;
+    uint64_t pressure = 0;
+    pressure = std::max(pressure, permille(m_transactions, m_max_transactions));
+    pressure = std::max(pressure, permille(m_durable_queue, m_max_durable_queue));
+    pressure = std::max(pressure, permille(m_kvs_latency, m_max_kvs_latency));
+    pressure = std::max(pressure, permille(m_kvs_load, 100));
+    e::atomic::store_64_release(&m_pressure, pressure);
+}
+
+bool
+admission_control :: admit()
+{
+    const uint64_t pressure = e::atomic::load_64_acquire(&m_pressure);
+    const uint64_t n = e::atomic::increment_64_nobarrier(&m_begins, 1);
+
+    if (pressure < ADMISSION_SOFT)
+    {
+        return true;
+    }
+
+    const uint64_t share = pressure >= 1000 ? 1000
+                         : (pressure - ADMISSION_SOFT) * 1000 / (1000 - ADMISSION_SOFT);
+
+    // 617 is coprime to 1000, so the begins shed are spread evenly
+    if ((n * 617) % 1000 >= share)
+    {
+        return true;
+    }
+
+    e::atomic::increment_64_nobarrier(&m_shed, 1);
+    return false;
+}
+
+std::string
+admission_control :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "pressure=" << e::atomic::load_64_acquire(&m_pressure) << "/1000"
+         << " transactions=" << m_transactions << "/" << m_max_transactions
+         << " durable_queue=" << m_durable_queue << "/" << m_max_durable_queue
+         << " kvs_load=" << m_kvs_load << "/100"
+         << " kvs_latency=" << m_kvs_latency / 1000 << "us/" << m_max_kvs_latency / 1000 << "us"
+         << " begins=" << e::atomic::increment_64_nobarrier(&m_begins, 0)
+         << " shed=" << e::atomic::increment_64_nobarrier(&m_shed, 0);
+    return ostr.str();
+}
+
+uint64_t
+admission_control :: permille(uint64_t value, uint64_t limit)
+{
+    if (limit == 0)
+    {
+        return 0;
+    }
+
+    return value >= limit ? 1000 : value * 1000 / limit;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_admission_control_h_
+#define consus_txman_admission_control_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <string>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Decides whether to begin another transaction or turn the client away as
+// busy.  Each configured signal (live transactions, records awaiting the
+// durable log, mean key-value store response time) is compared to its
+// limit, as is the load the key-value stores report of themselves out of
+// 100, and the worst ratio is the pressure.  Below ADMISSION_SOFT of every
+// limit all begins are admitted; between there and the limit a growing
+// share is shed; at or above it all are.  The daemon refreshes the signals
+// at most once per ADMISSION_REFRESH, so admitting is two loads.
+class admission_control
+{
+    public:
+        admission_control();
+        ~admission_control() throw ();
+
+    public:
+        // zero disables a signal; latency is in nanoseconds
+        void set_limits(uint64_t transactions, uint64_t durable_queue, uint64_t kvs_latency);
+        bool enabled() const { return m_max_transactions > 0 || m_max_durable_queue > 0 || m_max_kvs_latency > 0; }
+        void observe_kvs_latency(uint64_t nanos);
+        // true for exactly one caller per refresh interval, which must then
+        // call refresh with the current loads
+        bool stale(uint64_t now);
+        void refresh(uint64_t transactions, uint64_t durable_queue, unsigned kvs_load);
+        bool admit();
+        std::string debug_dump();
+
+    private:
+        static uint64_t permille(uint64_t value, uint64_t limit);
+
+    private:
+        uint64_t m_max_transactions;
+        uint64_t m_max_durable_queue;
+        uint64_t m_max_kvs_latency;
+        // accumulated by observe_kvs_latency, drained by refresh
+        uint64_t m_kvs_sum;
+        uint64_t m_kvs_count;
+        po6::threads::mutex m_mtx;
+        uint64_t m_next_refresh;
+        uint64_t m_kvs_seen_sum;
+        uint64_t m_kvs_seen_count;
+        uint64_t m_kvs_latency;
+        uint64_t m_transactions;
+        uint64_t m_durable_queue;
+        uint64_t m_kvs_load;
+        // worst load as thousandths of its limit
+        uint64_t m_pressure;
+        uint64_t m_begins;
+        uint64_t m_shed;
+
+    private:
+        admission_control(const admission_control&);
+        admission_control& operator = (const admission_control&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_admission_control_h_
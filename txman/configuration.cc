@@ -25,15 +25,70 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <limits.h>
+
 // STL
+#include <algorithm>
 #include <set>
 
+// po6
+#include <po6/time.h>
+
 // consus
+#include "common/hash.h"
+#include "common/topology.h"
 #include "common/txman_configuration.h"
 #include "txman/configuration.h"
 
+// replicas within this much load of one another are treated as equal
+#define KVS_STEER_MARGIN 20
+
 using consus::configuration;
 
+// the distinct online owners of a partition and its successors, in ring
+// order, so that the first replication(table) are the key's replicas
+struct configuration::owners
+{
+    owners() : ids_sz(0) {}
+    ~owners() throw () {}
+    bool operator != (const owners& rhs) const;
+
+    comm_id ids[CONSUS_MAX_REPLICATION_FACTOR];
+    // offsets into m_kvss, parallel to ids
+    size_t kvs_idx[CONSUS_MAX_REPLICATION_FACTOR];
+    unsigned ids_sz;
+};
+
+bool
+configuration :: owners :: operator != (const owners& rhs) const
+{
+    if (ids_sz != rhs.ids_sz)
+    {
+        return true;
+    }
+
+    for (unsigned i = 0; i < ids_sz; ++i)
+    {
+        if (ids[i] != rhs.ids[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+struct configuration::cached_ring
+{
+    cached_ring() : dc(), owners_idx() {}
+    ~cached_ring() throw () {}
+
+    data_center_id dc;
+    // index into m_cached_owners for each partition
+    std::vector<uint32_t> owners_idx;
+};
+
 configuration :: configuration()
     : m_cluster()
     , m_version()
@@ -42,6 +97,14 @@ configuration :: configuration()
     , m_txmans()
     , m_paxos_groups()
     , m_kvss()
+    , m_rings()
+    , m_tables()
+    , m_cached_owners()
+    , m_cached_rings()
+    , m_group_index()
+    , m_member_groups()
+    , m_dc_first_groups()
+    , m_no_groups()
 {
 }
 
@@ -129,38 +192,49 @@ configuration :: get_state(comm_id id) const
     return txman_state::state_t();
 }
 
-std::vector<consus::paxos_group_id>
-configuration :: groups_for(comm_id id) const
+consus::comm_id
+configuration :: standby_for(comm_id id) const
 {
-    std::vector<paxos_group_id> gs;
-
-    for (size_t i = 0; i < m_paxos_groups.size(); ++i)
+    for (size_t i = 0; i < m_txmans.size(); ++i)
     {
-        for (size_t p = 0; p < m_paxos_groups[i].members_sz; ++p)
+        if (m_txmans[i].tx.id == id)
         {
-            if (m_paxos_groups[i].members[p] == id)
-            {
-                gs.push_back(m_paxos_groups[i].id);
-                break;
-            }
+            return m_txmans[i].standby_for;
         }
     }
 
-    return gs;
+    return comm_id();
 }
 
-const consus::paxos_group*
-configuration :: get_group(paxos_group_id id) const
+consus::comm_id
+configuration :: standby_of(comm_id id) const
 {
-    for (size_t i = 0; i < m_paxos_groups.size(); ++i)
+    for (size_t i = 0; i < m_txmans.size(); ++i)
     {
-        if (m_paxos_groups[i].id == id)
+        if (id != comm_id() &&
+            m_txmans[i].standby_for == id &&
+            m_txmans[i].state == txman_state::ONLINE)
         {
-            return &m_paxos_groups[i];
+            return m_txmans[i].tx.id;
         }
     }
 
-    return NULL;
+    return comm_id();
+}
+
+const std::vector<consus::paxos_group_id>&
+configuration :: groups_for(comm_id id) const
+{
+    std::map<comm_id, std::vector<paxos_group_id> >::const_iterator it;
+    it = m_member_groups.find(id);
+    return it != m_member_groups.end() ? it->second : m_no_groups;
+}
+
+const consus::paxos_group*
+configuration :: get_group(paxos_group_id id) const
+{
+    std::map<paxos_group_id, size_t>::const_iterator it = m_group_index.find(id);
+    return it != m_group_index.end() ? &m_paxos_groups[it->second] : NULL;
 }
 
 bool
@@ -188,21 +262,30 @@ bool
 configuration :: choose_groups(paxos_group_id g, std::vector<paxos_group_id>* groups) const
 {
     groups->push_back(g);
-    std::set<data_center_id> dcs;
     const paxos_group* gptr = get_group(g);
     assert(gptr);
-    dcs.insert(gptr->dc);
 
-    for (size_t i = 0; i < m_paxos_groups.size(); ++i)
+    for (size_t i = 0; i < m_dc_first_groups.size(); ++i)
+    {
+        const paxos_group& pg(m_paxos_groups[m_dc_first_groups[i]]);
+
+        if (pg.dc != gptr->dc)
+        {
+            groups->push_back(pg.id);
+        }
+    }
+
+    size_t voting = 0;
+
+    for (size_t i = 0; i < m_dcs.size(); ++i)
     {
-        if (dcs.find(m_paxos_groups[i].dc) == dcs.end())
+        if (!m_dcs[i].read_replica)
         {
-            groups->push_back(m_paxos_groups[i].id);
-            dcs.insert(m_paxos_groups[i].dc);
+            ++voting;
         }
     }
 
-    return groups->size() >= (m_dcs.size() / 2 + 1);
+    return groups->size() >= (voting / 2 + 1);
 }
 
 consus::comm_id
@@ -219,14 +302,272 @@ configuration :: choose_kvs(data_center_id dc) const
     return comm_id();
 }
 
+consus::comm_id
+configuration :: choose_kvs(data_center_id dc,
+                            const e::slice& table,
+                            const e::slice& key,
+                            uint64_t salt,
+                            const txman& near,
+                            kvs_pressure* pressure) const
+{
+    // the high bits of the hash select one of CONSUS_KVS_PARTITIONS slots
+    const uint16_t index = hash64(table, key) >> 48;
+
+    for (size_t i = 0; i < m_cached_rings.size(); ++i)
+    {
+        if (m_cached_rings[i].dc != dc)
+        {
+            continue;
+        }
+
+        const owners& o(m_cached_owners[m_cached_rings[i].owners_idx[m_rings[i].partition_for(index)]]);
+        const unsigned n = std::min(o.ids_sz, replication(table));
+
+        if (n == 0)
+        {
+            break;
+        }
+
+        // spread across the replicas topologically nearest to us only
+        comm_id nearest[CONSUS_MAX_REPLICATION_FACTOR];
+        unsigned nearest_sz = 0;
+        unsigned best = UINT_MAX;
+
+        for (unsigned r = 0; r < n; ++r)
+        {
+            const kvs& kv(m_kvss[o.kvs_idx[r]]);
+            const unsigned dist = topology_distance(near.zone, near.rack, kv.zone, kv.rack);
+
+            if (dist < best)
+            {
+                best = dist;
+                nearest_sz = 0;
+            }
+
+            if (dist == best)
+            {
+                nearest[nearest_sz] = o.ids[r];
+                ++nearest_sz;
+            }
+        }
+
+        const comm_id first = nearest[salt % nearest_sz];
+
+        if (pressure && nearest_sz > 1)
+        {
+            const comm_id second = nearest[(salt + 1) % nearest_sz];
+            const uint64_t now = po6::monotonic_time();
+
+            if (pressure->load(second, now) + KVS_STEER_MARGIN < pressure->load(first, now))
+            {
+                return second;
+            }
+        }
+
+        return first;
+    }
+
+    return choose_kvs(dc);
+}
+
+unsigned
+configuration :: replication(const e::slice& table) const
+{
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (e::slice(m_tables[i].name) == table)
+        {
+            return m_tables[i].replication;
+        }
+    }
+
+    return CONSUS_DEFAULT_REPLICATION_FACTOR;
+}
+
+consus::data_center_id
+configuration :: home(const e::slice& table) const
+{
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (e::slice(m_tables[i].name) == table)
+        {
+            return m_tables[i].home;
+        }
+    }
+
+    return data_center_id();
+}
+
+consus::data_center_id
+configuration :: data_center_for(const e::slice& table, data_center_id dc) const
+{
+    if (is_read_replica(dc))
+    {
+        return dc;
+    }
+
+    const data_center_id h = home(table);
+    return h != data_center_id() ? h : dc;
+}
+
+bool
+configuration :: single_data_center(const e::slice& table) const
+{
+    if (home(table) != data_center_id())
+    {
+        return true;
+    }
+
+    size_t voting = 0;
+
+    for (size_t i = 0; i < m_dcs.size(); ++i)
+    {
+        if (!m_dcs[i].read_replica)
+        {
+            ++voting;
+        }
+    }
+
+    return voting <= 1;
+}
+
+bool
+configuration :: is_read_replica(data_center_id dc) const
+{
+    for (size_t i = 0; i < m_dcs.size(); ++i)
+    {
+        if (m_dcs[i].id == dc)
+        {
+            return m_dcs[i].read_replica;
+        }
+    }
+
+    return false;
+}
+
+void
+configuration :: read_replicas(std::vector<data_center_id>* dcs) const
+{
+    dcs->clear();
+
+    for (size_t i = 0; i < m_dcs.size(); ++i)
+    {
+        if (m_dcs[i].read_replica)
+        {
+            dcs->push_back(m_dcs[i].id);
+        }
+    }
+}
+
 std::string
 configuration :: dump() const
 {
-    return txman_configuration(m_cluster, m_version, m_flags, m_dcs, m_txmans, m_paxos_groups, m_kvss);
+    return txman_configuration(m_cluster, m_version, m_flags, m_dcs, m_txmans, m_paxos_groups, m_kvss, m_rings, m_tables);
+}
+
+void
+configuration :: reconstruct_cache()
+{
+    std::map<comm_id, size_t> online;
+
+    for (size_t i = 0; i < m_kvss.size(); ++i)
+    {
+        online.insert(std::make_pair(m_kvss[i].id, i));
+    }
+
+    m_group_index.clear();
+    m_member_groups.clear();
+    m_dc_first_groups.clear();
+    std::set<data_center_id> dcs;
+
+    for (size_t i = 0; i < m_paxos_groups.size(); ++i)
+    {
+        const paxos_group& pg(m_paxos_groups[i]);
+        m_group_index.insert(std::make_pair(pg.id, i));
+
+        for (size_t p = 0; p < pg.members_sz; ++p)
+        {
+            std::vector<paxos_group_id>* gs = &m_member_groups[pg.members[p]];
+
+            if (gs->empty() || gs->back() != pg.id)
+            {
+                gs->push_back(pg.id);
+            }
+        }
+
+        if (dcs.insert(pg.dc).second)
+        {
+            m_dc_first_groups.push_back(i);
+        }
+    }
+
+    const unsigned max_owners = std::min(size_t(CONSUS_MAX_REPLICATION_FACTOR), online.size());
+    m_cached_owners.clear();
+    m_cached_rings.clear();
+    m_cached_rings.resize(m_rings.size());
+
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        const partition* parts = &m_rings[i].partitions[0];
+        const size_t parts_sz = m_rings[i].partitions.size();
+        m_cached_rings[i].dc = m_rings[i].dc;
+        m_cached_rings[i].owners_idx.resize(parts_sz);
+
+        for (size_t idx = 0; idx < parts_sz; ++idx)
+        {
+            // a partition owned by the same node as its predecessor has the
+            // same owners, which with large contiguous runs is most of them
+            if (idx > 0 && parts[idx].owner == parts[idx - 1].owner)
+            {
+                m_cached_rings[i].owners_idx[idx] = m_cached_rings[i].owners_idx[idx - 1];
+                continue;
+            }
+
+            owners o;
+            comm_id last;
+
+            for (size_t j = 0; j < parts_sz && o.ids_sz < max_owners; ++j)
+            {
+                const comm_id owner = parts[(idx + j) % parts_sz].owner;
+
+                if (owner == comm_id() || owner == last ||
+                    (o.ids_sz > 0 && owner == o.ids[0]))
+                {
+                    continue;
+                }
+
+                last = owner;
+
+                std::map<comm_id, size_t>::const_iterator it = online.find(owner);
+
+                if (it != online.end())
+                {
+                    o.ids[o.ids_sz] = owner;
+                    o.kvs_idx[o.ids_sz] = it->second;
+                    ++o.ids_sz;
+                }
+            }
+
+            if (m_cached_owners.empty() || m_cached_owners.back() != o)
+            {
+                m_cached_owners.push_back(o);
+            }
+
+            m_cached_rings[i].owners_idx[idx] = m_cached_owners.size() - 1;
+        }
+    }
 }
 
 e::unpacker
 consus :: operator >> (e::unpacker up, configuration& c)
 {
-    return txman_configuration(up, &c.m_cluster, &c.m_version, &c.m_flags, &c.m_dcs, &c.m_txmans, &c.m_paxos_groups, &c.m_kvss);
+    up = txman_configuration(up, &c.m_cluster, &c.m_version, &c.m_flags, &c.m_dcs, &c.m_txmans, &c.m_paxos_groups, &c.m_kvss, &c.m_rings, &c.m_tables);
+
+    if (up.error())
+    {
+        return up;
+    }
+
+    c.reconstruct_cache();
+    return up;
 }
@@ -28,14 +28,21 @@
 #ifndef consus_txman_configuration_h_
 #define consus_txman_configuration_h_
 
+// STL
+#include <map>
+#include <vector>
+
 // consus
 #include "namespace.h"
 #include "common/data_center.h"
 #include "common/ids.h"
 #include "common/kvs.h"
 #include "common/paxos_group.h"
+#include "common/ring.h"
+#include "common/table_config.h"
 #include "common/txman.h"
 #include "common/txman_state.h"
+#include "txman/kvs_pressure.h"
 
 BEGIN_CONSUS_NAMESPACE
 
@@ -57,10 +64,14 @@ class configuration
         data_center_id get_data_center(comm_id id) const;
         po6::net::location get_address(comm_id id) const;
         txman_state::state_t get_state(comm_id id) const;
+        // the primary id is a warm standby for, or comm_id()
+        comm_id standby_for(comm_id id) const;
+        // the online warm standby for id, or comm_id()
+        comm_id standby_of(comm_id id) const;
 
     // transaction manager paxos groups
     public:
-        std::vector<paxos_group_id> groups_for(comm_id id) const;
+        const std::vector<paxos_group_id>& groups_for(comm_id id) const;
         const paxos_group* get_group(paxos_group_id id) const;
         bool is_member(paxos_group_id g, comm_id id) const;
         bool choose_groups(paxos_group_id g, std::vector<paxos_group_id>* groups) const;
@@ -69,11 +80,43 @@ class configuration
     // key-value stores
     public:
         comm_id choose_kvs(data_center_id dc) const;
+        // a replica of the key's partition within dc, picked by salt so that
+        // operations spread across those replicas sharing near's rack, else
+        // its zone, else all of them; given pressure, the next such replica
+        // is taken instead when it is markedly less loaded; falls back to
+        // choose_kvs(dc) when dc has no ring
+        comm_id choose_kvs(data_center_id dc,
+                           const e::slice& table,
+                           const e::slice& key,
+                           uint64_t salt,
+                           const txman& near,
+                           kvs_pressure* pressure) const;
+        unsigned replication(const e::slice& table) const;
+        // the data center that alone holds table, or data_center_id()
+        data_center_id home(const e::slice& table) const;
+        // where a transaction manager in dc finds table; a read replica
+        // holds every table itself
+        data_center_id data_center_for(const e::slice& table, data_center_id dc) const;
+        // whether the key-value stores of just one data center hold table;
+        // read replicas, which every write feeds, do not count
+        bool single_data_center(const e::slice& table) const;
+
+    // data centers
+    public:
+        bool is_read_replica(data_center_id dc) const;
+        void read_replicas(std::vector<data_center_id>* dcs) const;
 
     // debug/internal
     public:
         std::string dump() const;
 
+    private:
+        struct owners;
+        struct cached_ring;
+
+    private:
+        void reconstruct_cache();
+
     private:
         friend e::unpacker operator >> (e::unpacker, configuration& s);
 
@@ -85,6 +128,18 @@ class configuration
         std::vector<txman_state> m_txmans;
         std::vector<paxos_group> m_paxos_groups;
         std::vector<kvs> m_kvss;
+        std::vector<ring> m_rings;
+        std::vector<table_config> m_tables;
+
+        // cached data
+        std::vector<owners> m_cached_owners;
+        std::vector<cached_ring> m_cached_rings;
+        // group lookups; the size_t values are offsets into m_paxos_groups
+        std::map<paxos_group_id, size_t> m_group_index;
+        std::map<comm_id, std::vector<paxos_group_id> > m_member_groups;
+        // the first group of each data center, in m_paxos_groups order
+        std::vector<size_t> m_dc_first_groups;
+        const std::vector<paxos_group_id> m_no_groups;
 
     private:
         configuration(const configuration& other);
@@ -35,6 +35,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // POSIX
 #include <signal.h>
@@ -51,6 +52,7 @@
 #include <po6/errno.h>
 #include <po6/io/fd.h>
 #include <po6/path.h>
+#include <po6/time.h>
 
 // e
 #include <e/atomic.h>
@@ -61,15 +63,47 @@
 #include <e/strescape.h>
 
 // consus
+#include "common/alloc_stats.h"
+#include "common/buffer_pool.h"
+#include "common/busy_poller.h"
+#include "common/constants.h"
 #include "common/coordinator_returncode.h"
+#include "common/cpu_affinity.h"
 #include "common/generate_token.h"
 #include "common/macros.h"
+#include "common/probes.h"
+#include "common/random_id.h"
 #include "common/util.h"
 #include "txman/daemon.h"
 #include "txman/log_entry_t.h"
 
 using consus::daemon;
 
+// how often the pumping thread checks for due state machines
+#define PUMP_TICK (PO6_MILLIS * 10)
+// how often finished transactions' outcomes and stale witnesses are collected
+#define PUMP_SWEEP_INTERVAL (PO6_SECONDS * 10)
+// how long a finished transaction's outcome is remembered
+#define DISPOSITION_RETENTION (PO6_SECONDS * 300)
+// the oldest priority a restarted transaction may carry over; well inside
+// DISPOSITION_RETENTION so that its messages are never taken for a
+// reclaimed transaction's
+#define PRIORITY_MAX_AGE (PO6_SECONDS * 60)
+// log records awaiting durability are spread over this many queues
+#define DURABLE_SHARDS 16
+// recently appended acceptor entries remembered so retransmits reuse them
+#define LOGGED_ENTRIES 4096
+// messages waiting on each state machine thread before the network blocks
+#define STAGE_QUEUE_CAPACITY 1024
+// how many of the oldest transactions in flight each metrics scrape names
+#define INFLIGHT_REPORTED 32
+// low bits of a key-value store nonce that name the stage owning its group
+#define NONCE_OWNER_MASK 0xffffULL
+// commit records larger than this go to other data centers on their own
+#define COMMIT_PIPELINE_MAX_MESSAGE (16ULL * 1024ULL)
+// a batch of commit traffic leaves as soon as it holds this many bytes
+#define COMMIT_PIPELINE_BATCH_BYTES (64ULL * 1024ULL)
+
 // XXX each and every BUSYBEE_DISRUPTED event must trigger associated retries or
 // cleanups.  Most notably in the kvs_* functions
 
@@ -108,11 +142,65 @@ handle_debug_mode(int /*signum*/)
     s_debug_mode = !s_debug_mode;
 }
 
+// the small per-transaction messages of the data center vote
+static bool
+is_local_vote(e::buffer* msg)
+{
+    network_msgtype mt;
+    e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE) >> mt;
+
+    if (up.error())
+    {
+        return false;
+    }
+
+    switch (mt)
+    {
+        case LV_VOTE_1A:
+        case LV_VOTE_1B:
+        case LV_VOTE_2A:
+        case LV_VOTE_2B:
+        case LV_VOTE_LEARN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// what each transaction sends other data centers to have them vote on its
+// commit, and their votes in return
+static bool
+is_commit_traffic(e::buffer* msg)
+{
+    network_msgtype mt;
+    e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE) >> mt;
+
+    if (up.error())
+    {
+        return false;
+    }
+
+    switch (mt)
+    {
+        case COMMIT_RECORD:
+        case GV_PROPOSE:
+        case GV_VOTE_1A:
+        case GV_VOTE_1B:
+        case GV_VOTE_2A:
+        case GV_VOTE_2B:
+        case GV_OUTCOME:
+            return true;
+        default:
+            return false;
+    }
+}
+
 struct daemon::coordinator_callback : public coordinator_link::callback
 {
     coordinator_callback(daemon* d);
     virtual ~coordinator_callback() throw ();
     virtual std::string prefix() { return "txman"; }
+    virtual std::string registration_extra();
     virtual bool new_config(const char* data, size_t data_sz);
     virtual bool has_id(comm_id id);
     virtual po6::net::location address(comm_id id);
@@ -133,6 +221,16 @@ daemon :: coordinator_callback :: ~coordinator_callback() throw ()
 {
 }
 
+std::string
+daemon :: coordinator_callback :: registration_extra()
+{
+    std::string extra;
+    e::packer(&extra) << d->m_standby_for
+                      << e::slice(d->m_us.zone)
+                      << e::slice(d->m_us.rack);
+    return extra;
+}
+
 bool
 daemon :: coordinator_callback :: new_config(const char* data, size_t data_sz)
 {
@@ -146,13 +244,65 @@ daemon :: coordinator_callback :: new_config(const char* data, size_t data_sz)
         return false;
     }
 
+    const comm_id primary = c->standby_for(d->m_us.id);
+    const comm_id standby = c->standby_of(d->m_us.id);
+    // swapped in for our primary; nothing may run under the new
+    // configuration until what we hold has been replayed
+    const bool promote = d->m_log_replayed &&
+                         d->m_shipper.primary() != comm_id() &&
+                         primary == comm_id() &&
+                         !c->groups_for(d->m_us.id).empty();
+
+    if (promote)
+    {
+        d->m_shipper.begin_promotion();
+    }
+
     configuration* old_config = d->get_config();
+    // groups this member now feeds to the read replicas in place of another
+    std::vector<paxos_group_id> took_over;
+
+    for (size_t i = 0; old_config && i < c->groups_for(d->m_us.id).size(); ++i)
+    {
+        const paxos_group_id g = c->groups_for(d->m_us.id)[i];
+
+        if (c->first_alive(g) == d->m_us.id &&
+            old_config->first_alive(g) != d->m_us.id)
+        {
+            took_over.push_back(g);
+        }
+    }
+
     d->m_us.dc = c->get_data_center(d->m_us.id);
     e::atomic::store_ptr_release(&d->m_config, c.release());
     d->m_gc.collect(old_config, e::garbage_collector::free_ptr<configuration>);
     LOG(INFO) << "updating to configuration " << d->get_config()->version();
     std::vector<paxos_group_id> gs = d->get_config()->groups_for(d->m_us.id);
 
+    if (promote)
+    {
+        d->promote();
+        d->m_shipper.end_promotion();
+    }
+
+    d->m_shipper.set_primary(primary);
+    d->m_shipper.set_standby(standby);
+    std::vector<data_center_id> replicas;
+    d->get_config()->read_replicas(&replicas);
+    d->m_replica_feed.set_replicas(replicas);
+
+    for (size_t i = 0; i < took_over.size(); ++i)
+    {
+        d->m_replica_feed.take_over(took_over[i], po6::monotonic_time());
+    }
+
+    // startup replay sorts out what was witnessed before the daemon knew
+    // its configuration
+    if (d->m_log_replayed)
+    {
+        d->witnesses_changed();
+    }
+
 #if 0
     if (s_debug_mode)
     {
@@ -218,35 +368,182 @@ daemon :: coordinator_callback :: is_steady_state(comm_id id)
     return false;
 }
 
+struct daemon::durable_msg
+{
+    durable_msg() : recno(), client(), msg(NULL) {}
+    durable_msg(int64_t r, comm_id c, e::buffer* m) : recno(r), client(c), msg(m) {}
+    durable_msg(const durable_msg& other)
+        : recno(other.recno), client(other.client), msg(other.msg) {}
+    ~durable_msg() throw () {}
+    durable_msg& operator = (const durable_msg& rhs)
+    {
+        // no self-assign check needed
+        recno = rhs.recno;
+        client = rhs.client;
+        msg = rhs.msg;
+        return *this;
+    }
+    bool operator < (const durable_msg& rhs) { return rhs.recno > recno; }
+    int64_t recno;
+    comm_id client;
+    e::buffer* msg;
+};
+
+struct daemon::durable_cb
+{
+    durable_cb() : recno(), tg(), seqno() {}
+    durable_cb(int64_t r, transaction_group t, uint64_t s) : recno(r), tg(t), seqno(s) {}
+    durable_cb(const durable_cb& other)
+        : recno(other.recno), tg(other.tg), seqno(other.seqno) {}
+    ~durable_cb() throw () {}
+    durable_cb& operator = (const durable_cb& rhs)
+    {
+        // no self-assign check needed
+        recno = rhs.recno;
+        tg = rhs.tg;
+        seqno = rhs.seqno;
+        return *this;
+    }
+    bool operator < (const durable_cb& rhs) { return rhs.recno > recno; }
+    int64_t recno;
+    transaction_group tg;
+    uint64_t seqno;
+};
+
+struct daemon::staged_msg
+{
+    staged_msg() : id(), msg(NULL), tg(), enqueued(0) {}
+    staged_msg(comm_id i, e::buffer* b, uint64_t e) : id(i), msg(b), tg(), enqueued(e) {}
+    staged_msg(const transaction_group& t, uint64_t e) : id(), msg(NULL), tg(t), enqueued(e) {}
+    staged_msg(const staged_msg& other)
+        : id(other.id), msg(other.msg), tg(other.tg), enqueued(other.enqueued) {}
+    ~staged_msg() throw () {}
+    staged_msg& operator = (const staged_msg& rhs)
+    {
+        // no self-assign check needed
+        id = rhs.id;
+        msg = rhs.msg;
+        tg = rhs.tg;
+        enqueued = rhs.enqueued;
+        return *this;
+    }
+    comm_id id;
+    // NULL for a request to pump tg
+    e::buffer* msg;
+    transaction_group tg;
+    uint64_t enqueued;
+};
+
+struct daemon::durable_shard
+{
+    durable_shard() : mtx(), up_to(-1), msgs(), cbs() {}
+    ~durable_shard() throw () {}
+    po6::threads::mutex mtx;
+    int64_t up_to;
+    durable_msg_heap_t msgs;
+    durable_cb_heap_t cbs;
+
+    private:
+        durable_shard(const durable_shard&);
+        durable_shard& operator = (const durable_shard&);
+};
+
 daemon :: daemon()
     : m_us()
     , m_gc()
     , m_busybee_controller(this)
     , m_busybee()
+    , m_rtt()
     , m_coord_cb()
     , m_coord()
     , m_config(NULL)
     , m_threads()
+    , m_cpus()
+    , m_busy_poll(0)
+    , m_stage_queues()
+    , m_stage_threads()
+    , m_inflight()
+    , m_tables()
+    , m_costs()
     , m_transactions(&m_gc)
     , m_local_voters(&m_gc)
     , m_global_voters(&m_gc)
     , m_dispositions(&m_gc)
     , m_readers(&m_gc)
+    , m_read_flights()
     , m_writers(&m_gc)
     , m_lock_ops(&m_gc)
+    , m_scanners(&m_gc)
     , m_log()
     , m_durable_thread(po6::threads::make_obj_func(&daemon::durable, this))
-    , m_durable_mtx()
-    , m_durable_up_to(-1)
-    , m_durable_msgs()
-    , m_durable_cbs()
+    , m_durable_shards(new durable_shard[DURABLE_SHARDS])
+    , m_logged_mtx()
+    , m_logged_entries(LOGGED_ENTRIES, std::make_pair(int64_t(-1), std::string()))
+    , m_log_pins_mtx()
+    , m_log_pins_epoch(0)
+    , m_log_pins()
+    , m_dispositions_mtx()
+    , m_dispositions_queue()
+    , m_dispositions_watermarks()
+    , m_pump_queue()
     , m_pumping_thread(po6::threads::make_obj_func(&daemon::pump, this))
+    , m_coalescer()
+    , m_coalescing_thread(po6::threads::make_obj_func(&daemon::coalesce, this))
+    , m_vote_pipeline()
+    , m_vote_aggregator()
+    , m_vote_pipeline_thread(po6::threads::make_obj_func(&daemon::pipeline_votes, this))
+    , m_commit_pipeline()
+    , m_commit_pipeline_thread(po6::threads::make_obj_func(&daemon::pipeline_commits, this))
+    , m_compressor()
+    , m_compactor()
+    , m_transport()
+    , m_local_transport()
+    , m_wan()
+    , m_wan_thread(po6::threads::make_obj_func(&daemon::schedule_wan, this))
+    , m_leases()
+    , m_lease_thread(po6::threads::make_obj_func(&daemon::renew_leases, this))
+    , m_balance_groups(false)
+    , m_group_load()
+    , m_group_load_thread(po6::threads::make_obj_func(&daemon::report_group_load, this))
+    , m_standby_for()
+    , m_shipper(&m_log)
+    , m_shipping_thread(po6::threads::make_obj_func(&daemon::ship_log, this))
+    , m_log_replayed(false)
+    , m_replay_mtx()
+    , m_replaying(1)
+    , m_replay_sends()
+    , m_witnesses()
+    , m_replica_feed()
+    , m_replica_feed_thread(po6::threads::make_obj_func(&daemon::feed_replicas, this))
+    , m_commit_digest_threshold(0)
+    , m_slow_transaction_threshold(0)
+    , m_transaction_timeout(0)
+    , m_early_lock_release(false)
+    , m_admission()
+    , m_kvs_pressure()
+    , m_metrics(&m_gc)
+    , m_global_votes_fast()
+    , m_global_votes_classic()
+    , m_stage_network()
+    , m_stage_queued()
+    , m_stage_execute()
+    , m_stage_log()
+    , m_phases()
+    , m_clock()
+    , m_optimistic_tables()
+    , m_tracer()
 {
 }
 
 daemon :: ~daemon() throw ()
 {
     m_gc.collect(get_config(), e::garbage_collector::free_ptr<configuration>);
+    delete[] m_durable_shards;
+
+    for (size_t i = 0; i < m_replay_sends.size(); ++i)
+    {
+        delete m_replay_sends[i].second;
+    }
 }
 
 int
@@ -260,7 +557,39 @@ daemon :: run(bool background,
               bool set_coordinator,
               const char* coordinator,
               const char* data_center,
-              unsigned threads)
+              const char* zone,
+              const char* rack,
+              unsigned threads,
+              unsigned stage_threads,
+              uint64_t resend_default,
+              bool sync_writes,
+              bool pmem_log,
+              bool pin_threads,
+              uint64_t busy_poll,
+              uint64_t coalesce_window,
+              bool compress_wan,
+              const char* wan_dictionary,
+              bool compact_messages,
+              const char* intra_dc_transport,
+              uint16_t metrics_port,
+              const char* trace_file,
+              uint64_t trace_sample,
+              uint64_t commit_digest_threshold,
+              uint64_t wan_bulk_bytes_per_second,
+              uint64_t admit_transactions,
+              uint64_t admit_durable_queue,
+              uint64_t admit_kvs_latency,
+              uint64_t vote_pipeline_window,
+              uint64_t commit_pipeline_window,
+              uint64_t slow_transaction_threshold,
+              uint64_t transaction_timeout,
+              uint64_t read_lease,
+              uint64_t max_clock_drift_ppm,
+              bool early_lock_release,
+              bool balance_groups,
+              comm_id standby_for,
+              const std::vector<std::string>& log_dirs,
+              const std::vector<std::string>& optimistic_tables)
 {
     if (!e::block_all_signals())
     {
@@ -268,6 +597,9 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
+    alloc_stats::initialize();
+    m_rtt.set_default(resend_default);
+
     if (!e::daemonize(background, log, "consus-txman-", pidfile, has_pidfile))
     {
         return EXIT_FAILURE;
@@ -284,12 +616,71 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
-    if (!m_log.open(data))
+    if (wan_dictionary && !m_compressor.load_dictionary(wan_dictionary))
+    {
+        LOG(ERROR) << "could not read WAN compression dictionary " << wan_dictionary;
+        return EXIT_FAILURE;
+    }
+
+    if (compress_wan)
+    {
+        if (!compressor::available())
+        {
+            LOG(ERROR) << "cannot compress WAN traffic: consus was built without LZ4";
+            return EXIT_FAILURE;
+        }
+
+        m_compressor.enable();
+        LOG(INFO) << "compressing messages to other data centers";
+    }
+
+    if (compact_messages)
+    {
+        m_compactor.enable();
+    }
+
+    m_commit_digest_threshold = commit_digest_threshold;
+
+    if (commit_digest_threshold > 0)
+    {
+        LOG(INFO) << "shipping values of " << commit_digest_threshold
+                  << " bytes or more to other data centers only after commit";
+    }
+
+    m_slow_transaction_threshold = slow_transaction_threshold;
+    m_transaction_timeout = transaction_timeout;
+    m_early_lock_release = early_lock_release;
+
+    if (early_lock_release)
+    {
+        LOG(INFO) << "releasing read locks once the data center votes to commit";
+    }
+
+    if (!m_log.open(log_dirs.empty() ? std::vector<std::string>(1, data) : log_dirs,
+                    sync_writes, pmem_log))
     {
         LOG(ERROR) << "could not open log: " << po6::strerror(m_log.error());
         return EXIT_FAILURE;
     }
 
+    if (pmem_log)
+    {
+        LOG(INFO) << "keeping the durable log in persistent memory";
+    }
+
+    m_optimistic_tables.insert(optimistic_tables.begin(), optimistic_tables.end());
+
+    for (std::set<std::string>::iterator it = m_optimistic_tables.begin();
+            it != m_optimistic_tables.end(); ++it)
+    {
+        LOG(INFO) << "running transactions on table \"" << e::strescape(*it) << "\" optimistically";
+    }
+
+    if (log_dirs.size() > 1)
+    {
+        LOG(INFO) << "striping the durable log across " << log_dirs.size() << " directories";
+    }
+
     bool saved;
     uint64_t id;
     std::string rendezvous(coordinator);
@@ -303,11 +694,13 @@ daemon :: run(bool background,
 
     m_us.id = comm_id(id);
     m_us.bind_to = bind_to;
+    m_us.zone = zone;
+    m_us.rack = rack;
     bool (coordinator_link::*coordfunc)();
 
     if (saved)
     {
-        coordfunc = &coordinator_link::establish;
+        coordfunc = &coordinator_link::establish_cached;
     }
     else
     {
@@ -321,9 +714,11 @@ daemon :: run(bool background,
         coordfunc = &coordinator_link::initial_registration;
     }
 
+    m_standby_for = standby_for;
     m_coord_cb.reset(new coordinator_callback(this));
     m_coord.reset(new coordinator_link(rendezvous, m_us.id, m_us.bind_to, data_center, m_coord_cb.get()));
     m_coord->allow_reregistration();
+    m_coord->cache_config(po6::path::join(data, "TXMAN.config"));
     LOG(INFO) << "starting consus transaction-manager " << m_us.id
               << " on address " << m_us.bind_to;
     LOG(INFO) << "connecting to " << rendezvous;
@@ -341,10 +736,174 @@ daemon :: run(bool background,
         return EXIT_FAILURE;
     }
 
+    if (trace_file)
+    {
+        if (!m_tracer.open(trace_file, trace_sample, m_us.id))
+        {
+            return EXIT_FAILURE;
+        }
+
+        LOG(INFO) << "tracing one in " << trace_sample << " transactions to " << trace_file;
+    }
+
     m_busybee.reset(busybee_server::create(&m_busybee_controller, id, bind_to, &m_gc));
+    m_transport.reset(transport::create("busybee", m_busybee.get()));
+
+    if (intra_dc_transport)
+    {
+        m_local_transport.reset(transport::create(intra_dc_transport, m_busybee.get()));
+
+        if (!m_local_transport.get())
+        {
+            LOG(ERROR) << "there is no transport named " << intra_dc_transport
+                       << "; choose one of " << transport::names();
+            return EXIT_FAILURE;
+        }
+
+        LOG(INFO) << "reaching peers in this data center over " << m_local_transport->name();
+    }
+
     m_durable_thread.start();
+
+    if (m_shipper.primary() != comm_id())
+    {
+        // a standby's state machines stay idle until it is swapped in
+        int64_t held = m_log.replay(&daemon::hold_callback, this);
+        LOG(INFO) << "standing by for " << m_shipper.primary()
+                  << " with " << held << " entries held from the durable log";
+    }
+    else
+    {
+        e::garbage_collector::thread_state ts;
+        m_gc.register_thread(&ts);
+        int64_t replayed = m_log.replay(&daemon::replay_callback, this);
+        m_gc.deregister_thread(&ts);
+        LOG(INFO) << "replayed " << replayed << " entries from the durable log";
+
+        // replay logged again everything it still needs; once that is
+        // durable, the prior incarnation's segments hold nothing of use
+        const int64_t checkpoint = m_log.next_recno();
+        int64_t x = m_log.durable();
+
+        while (x < checkpoint && m_log.error() == 0)
+        {
+            x = m_log.wait(x);
+        }
+
+        if (m_log.error() != 0)
+        {
+            LOG(ERROR) << "could not checkpoint the replayed log: " << po6::strerror(m_log.error());
+            return EXIT_FAILURE;
+        }
+
+        collect_log();
+    }
+
+    m_log_replayed = true;
+    m_shipping_thread.start();
+    m_replica_feed_thread.start();
+
     m_pumping_thread.start();
 
+    if (coalesce_window > 0)
+    {
+        m_coalescer.set_window(coalesce_window);
+        m_coalescing_thread.start();
+        LOG(INFO) << "coalescing small messages for up to " << coalesce_window / 1000 << "us";
+    }
+
+    if (vote_pipeline_window > 0)
+    {
+        m_vote_pipeline.set_window(vote_pipeline_window);
+        m_vote_aggregator.set_window(vote_pipeline_window);
+        m_vote_pipeline_thread.start();
+        LOG(INFO) << "batching local votes for up to " << vote_pipeline_window / 1000 << "us per group and per peer";
+    }
+
+    if (commit_pipeline_window > 0)
+    {
+        m_commit_pipeline.set_window(commit_pipeline_window);
+        m_commit_pipeline.set_limits(COMMIT_PIPELINE_MAX_MESSAGE, COMMIT_PIPELINE_BATCH_BYTES);
+        m_commit_pipeline_thread.start();
+        LOG(INFO) << "batching commit records and global votes for up to " << commit_pipeline_window / 1000 << "us per peer in another data center";
+    }
+
+    if (wan_bulk_bytes_per_second > 0)
+    {
+        m_wan.set_rate(wan_bulk_bytes_per_second);
+        m_wan_thread.start();
+        LOG(INFO) << "pacing bulk traffic to each other data center at "
+                  << wan_bulk_bytes_per_second / (1024 * 1024) << "MB/s";
+    }
+
+    if (read_lease > 0)
+    {
+        m_leases.configure(read_lease, max_clock_drift_ppm);
+        m_lease_thread.start();
+        LOG(INFO) << "leading groups under " << read_lease / PO6_MILLIS << "ms read leases, "
+                  << "assuming clocks drift apart by at most " << max_clock_drift_ppm << "ppm";
+    }
+
+    m_balance_groups = balance_groups;
+
+    if (balance_groups)
+    {
+        m_group_load_thread.start();
+        LOG(INFO) << "placing new transactions in the least-loaded group";
+    }
+
+    m_admission.set_limits(admit_transactions, admit_durable_queue, admit_kvs_latency);
+
+    if (m_admission.enabled())
+    {
+        LOG(INFO) << "shedding new transactions when overloaded";
+    }
+
+    m_busy_poll = busy_poll;
+
+    if (m_busy_poll > 0)
+    {
+        LOG(INFO) << "network threads spin for up to " << m_busy_poll / 1000 << "us before blocking";
+    }
+
+    if (pin_threads)
+    {
+        m_cpus = cpus_by_socket();
+        LOG(INFO) << "pinning network threads to " << std::min(size_t(threads), m_cpus.size())
+                  << " of " << m_cpus.size() << " CPUs, one socket at a time";
+
+        if (stage_threads > 0)
+        {
+            LOG(INFO) << "pinning state machine threads from the last CPU backwards";
+        }
+    }
+
+    if (metrics_port > 0 &&
+        !m_metrics.listen(po6::net::location(bind_to.address, metrics_port),
+                          &daemon::metrics_callback, this))
+    {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < stage_threads; ++i)
+    {
+        e::compat::shared_ptr<stage_queue_t> q(new stage_queue_t(STAGE_QUEUE_CAPACITY));
+        m_stage_queues.push_back(q);
+    }
+
+    for (size_t i = 0; i < stage_threads; ++i)
+    {
+        using namespace po6::threads;
+        e::compat::shared_ptr<thread> t(new thread(make_obj_func(&daemon::stage, this, i)));
+        m_stage_threads.push_back(t);
+        t->start();
+    }
+
+    if (stage_threads > 0)
+    {
+        LOG(INFO) << "handing messages to " << stage_threads << " state machine threads";
+    }
+
     for (size_t i = 0; i < threads; ++i)
     {
         using namespace po6::threads;
@@ -353,6 +912,8 @@ daemon :: run(bool background,
         t->start();
     }
 
+    release_replay_sends();
+
     while (e::atomic::increment_32_nobarrier(&s_interrupts, 0) == 0)
     {
         bool debug_mode = s_debug_mode;
@@ -391,18 +952,63 @@ daemon :: run(bool background,
     e::atomic::increment_32_nobarrier(&s_interrupts, 1);
     m_busybee->shutdown();
 
+    // unblocks network threads waiting on a full queue
+    for (size_t i = 0; i < m_stage_queues.size(); ++i)
+    {
+        m_stage_queues[i]->shutdown();
+    }
+
     for (size_t i = 0; i < m_threads.size(); ++i)
     {
         m_threads[i]->join();
     }
 
+    for (size_t i = 0; i < m_stage_threads.size(); ++i)
+    {
+        m_stage_threads[i]->join();
+    }
+
     if (s_debug_mode)
     {
         debug_dump();
     }
 
+    m_metrics.shutdown();
     m_log.close();
     m_pumping_thread.join();
+
+    if (m_coalescer.enabled())
+    {
+        m_coalescing_thread.join();
+    }
+
+    if (m_vote_pipeline.enabled())
+    {
+        m_vote_pipeline_thread.join();
+    }
+
+    if (m_commit_pipeline.enabled())
+    {
+        m_commit_pipeline_thread.join();
+    }
+
+    if (m_wan.enabled())
+    {
+        m_wan_thread.join();
+    }
+
+    if (m_leases.enabled())
+    {
+        m_lease_thread.join();
+    }
+
+    if (m_balance_groups)
+    {
+        m_group_load_thread.join();
+    }
+
+    m_shipping_thread.join();
+    m_replica_feed_thread.join();
     m_durable_thread.join();
     LOG(ERROR) << "consus is gracefully shutting down";
     return EXIT_SUCCESS;
@@ -422,15 +1028,26 @@ daemon :: loop(size_t thread)
         return;
     }
 
-    e::garbage_collector::thread_state ts;
-    m_gc.register_thread(&ts);
-    bool done = false;
-
-    while (!done)
+    if (!m_cpus.empty())
+    {
+        const unsigned cpu = m_cpus[thread % m_cpus.size()];
+
+        if (!pin_to_cpu(cpu))
+        {
+            LOG(WARNING) << "could not pin network thread " << thread << " to CPU " << cpu;
+        }
+    }
+
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    busy_poller poller(m_busy_poll);
+    bool done = false;
+
+    while (!done)
     {
         uint64_t _id;
         std::auto_ptr<e::buffer> msg;
-        busybee_returncode rc = m_busybee->recv(&ts, -1, &_id, &msg);
+        busybee_returncode rc = poller.recv(m_busybee.get(), &ts, &_id, &msg);
 
         switch (rc)
         {
@@ -477,107 +1094,30 @@ daemon :: loop(size_t thread)
             LOG(INFO) << "recv<-" << id << " " << mt << " " << msg->b64();
         }
 #endif
-        const uint64_t start = po6::monotonic_time();
+        CONSUS_PROBE3(message_receive, id.get(), uint64_t(mt), msg->size());
 
-        switch (mt)
+        // batches and compressed frames only unwrap and redeliver; they stay
+        // on the network thread so their contents are staged individually
+        if (m_stage_queues.empty() ||
+            mt == CONSUS_BATCH || mt == CONSUS_COMPRESSED || mt == CONSUS_COMPACT)
         {
-            case TXMAN_BEGIN:
-                process_begin(id, msg, up);
-                break;
-            case TXMAN_READ:
-                process_read(id, msg, up);
-                break;
-            case TXMAN_WRITE:
-                process_write(id, msg, up);
-                break;
-            case TXMAN_COMMIT:
-                process_commit(id, msg, up);
-                break;
-            case TXMAN_ABORT:
-                process_abort(id, msg, up);
-                break;
-            case TXMAN_WOUND:
-                process_wound(id, msg, up);
-                break;
-            case TXMAN_HOLD_LOCK:
-                process_hold_lock(id, msg, up);
-                break;
-            case TXMAN_FINISHED:
-                process_finished(id, msg, up);
-                break;
-            case TXMAN_PAXOS_2A:
-                process_paxos_2a(id, msg, up);
-                break;
-            case TXMAN_PAXOS_2B:
-                process_paxos_2b(id, msg, up);
-                break;
-            case LV_VOTE_1A:
-                process_lv_vote_1a(id, msg, up);
-                break;
-            case LV_VOTE_1B:
-                process_lv_vote_1b(id, msg, up);
-                break;
-            case LV_VOTE_2A:
-                process_lv_vote_2a(id, msg, up);
-                break;
-            case LV_VOTE_2B:
-                process_lv_vote_2b(id, msg, up);
-                break;
-            case LV_VOTE_LEARN:
-                process_lv_vote_learn(id, msg, up);
-                break;
-            case COMMIT_RECORD:
-                process_commit_record(id, msg, up);
-                break;
-            case GV_OUTCOME:
-                process_gv_outcome(id, msg, up);
-                break;
-            case GV_PROPOSE:
-                process_gv_propose(id, msg, up);
-                break;
-            case GV_VOTE_1A:
-                process_gv_vote_1a(id, msg, up);
-                break;
-            case GV_VOTE_1B:
-                process_gv_vote_1b(id, msg, up);
-                break;
-            case GV_VOTE_2A:
-                process_gv_vote_2a(id, msg, up);
-                break;
-            case GV_VOTE_2B:
-                process_gv_vote_2b(id, msg, up);
-                break;
-            case KVS_REP_RD_RESP:
-                process_kvs_rep_rd_resp(id, msg, up);
-                break;
-            case KVS_REP_WR_RESP:
-                process_kvs_rep_wr_resp(id, msg, up);
-                break;
-            case KVS_LOCK_OP_RESP:
-                process_kvs_lock_op_resp(id, msg, up);
-                break;
-            case CONSUS_NOP:
-                break;
-            case CLIENT_RESPONSE:
-            case KVS_REP_RD:
-            case KVS_REP_WR:
-            case KVS_RAW_RD:
-            case KVS_RAW_RD_RESP:
-            case KVS_RAW_WR:
-            case KVS_RAW_WR_RESP:
-            case KVS_LOCK_OP:
-            case KVS_RAW_LK:
-            case KVS_RAW_LK_RESP:
-            case KVS_WOUND_XACT:
-            case KVS_MIGRATE_SYN:
-            case KVS_MIGRATE_ACK:
-            default:
-                LOG(INFO) << "received " << mt << " message which transaction-managers do not process";
-                break;
+            dispatch(id, mt, msg, up);
+        }
+        else
+        {
+            const uint64_t start = po6::monotonic_time();
+            stage_queue_t* q = m_stage_queues[stage_for(id, mt, up)].get();
+            m_gc.offline(&ts);
+
+            if (q->push(staged_msg(id, msg.get(), start)))
+            {
+                msg.release();
+            }
+
+            m_gc.online(&ts);
+            m_stage_network.record(po6::monotonic_time() - start);
         }
 
-        const uint64_t end = po6::monotonic_time();
-        LOG_IF(INFO, end - start > 100 * PO6_MILLIS) << mt << " took " << ((end - start) / PO6_MILLIS) << "ms";
         m_gc.quiescent_state(&ts);
     }
 
@@ -585,17 +1125,465 @@ daemon :: loop(size_t thread)
     LOG(INFO) << "network thread shutting down";
 }
 
+void
+daemon :: stage(size_t thread)
+{
+    LOG(INFO) << "state machine thread " << thread << " started";
+
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_SETMASK, &ss, NULL) < 0)
+    {
+        std::cerr << "could not block signals" << std::endl;
+        return;
+    }
+
+    if (!m_cpus.empty())
+    {
+        const unsigned cpu = m_cpus[m_cpus.size() - 1 - thread % m_cpus.size()];
+
+        if (!pin_to_cpu(cpu))
+        {
+            LOG(WARNING) << "could not pin state machine thread " << thread << " to CPU " << cpu;
+        }
+    }
+
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    stage_queue_t* q = m_stage_queues[thread].get();
+
+    while (true)
+    {
+        staged_msg sm;
+        m_gc.offline(&ts);
+        bool popped = q->pop(&sm);
+        m_gc.online(&ts);
+
+        if (!popped)
+        {
+            break;
+        }
+
+        const uint64_t now = po6::monotonic_time();
+        m_stage_queued.record(now - sm.enqueued);
+
+        if (!sm.msg)
+        {
+            if (pump_one(sm.tg))
+            {
+                schedule_pump(sm.tg, now);
+            }
+
+            m_gc.quiescent_state(&ts);
+            continue;
+        }
+
+        std::auto_ptr<e::buffer> msg(sm.msg);
+        network_msgtype mt;
+        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+        up = up >> mt;
+        // the network thread already checked the header
+        assert(!up.error());
+        dispatch(sm.id, mt, msg, up);
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "state machine thread shutting down";
+}
+
+// Messages that name a transaction group go to the thread that owns the
+// group, so that one thread works each group's state machines and their
+// state stays in its cache.  Key-value store responses carry the owner in
+// their nonce.  Everything else keeps per-peer order.
+size_t
+daemon :: stage_for(comm_id id, network_msgtype mt, e::unpacker up)
+{
+    switch (mt)
+    {
+        case KVS_REP_RD_RESP:
+        case KVS_REP_WR_RESP:
+        case KVS_LOCK_OP_RESP:
+        case KVS_LOCK_OP_BATCH_RESP:
+        {
+            uint64_t count = 1;
+            uint64_t nonce = 0;
+
+            if (mt == KVS_LOCK_OP_BATCH_RESP)
+            {
+                up = up >> count;
+            }
+
+            up = up >> nonce;
+
+            if (!up.error() && count > 0)
+            {
+                return (nonce & NONCE_OWNER_MASK) % m_stage_queues.size();
+            }
+
+            break;
+        }
+        case TXMAN_WOUND:
+        case TXMAN_FINISHED:
+        case TXMAN_PAXOS_2B:
+        case TXMAN_PAXOS_2B_BATCH:
+        case LV_VOTE_1A:
+        case LV_VOTE_1B:
+        case LV_VOTE_2A:
+        case LV_VOTE_2B:
+        case LV_VOTE_LEARN:
+        case COMMIT_RECORD:
+        case COMMIT_VALUES:
+        case COMMIT_VALUES_ACK:
+        case COMMIT_RECORD_CHUNK:
+        case GV_OUTCOME:
+        case GV_PROPOSE:
+        case GV_VOTE_1A:
+        case GV_VOTE_1B:
+        case GV_VOTE_2A:
+        case GV_VOTE_2B:
+        case TXMAN_WITNESS:
+        case TXMAN_WITNESS_FORGET:
+        {
+            transaction_group tg;
+            up = up >> tg;
+
+            if (!up.error())
+            {
+                return stage_owner(tg);
+            }
+
+            break;
+        }
+        default:
+            break;
+    }
+
+    return id.get() % m_stage_queues.size();
+}
+
+size_t
+daemon :: stage_owner(const transaction_group& tg)
+{
+    assert(!m_stage_queues.empty());
+    return tg.hash() % m_stage_queues.size();
+}
+
+// Client operations lead with the transaction id, and messages between
+// transaction managers with the transaction group.  Batches that carry many
+// transactions, and key-value store traffic that carries a nonce, name none.
+bool
+daemon :: transaction_of(network_msgtype mt, e::unpacker up, transaction_group* tg)
+{
+    switch (mt)
+    {
+        case TXMAN_READ:
+        case TXMAN_WRITE:
+        case TXMAN_COND_WRITE:
+        case TXMAN_MULTI:
+        case TXMAN_SCAN:
+        case TXMAN_COMMIT:
+        case TXMAN_ABORT:
+        {
+            transaction_id txid;
+            up = up >> txid;
+            *tg = transaction_group(txid);
+            return !up.error();
+        }
+        case TXMAN_PAXOS_2A:
+        {
+            e::slice log_entry;
+            log_entry_t t;
+            up = up >> log_entry;
+            return !up.error() &&
+                   !(e::unpacker(log_entry) >> t >> *tg).error();
+        }
+        case TXMAN_WOUND:
+        case TXMAN_FINISHED:
+        case TXMAN_PAXOS_2B:
+        case TXMAN_PAXOS_2B_BATCH:
+        case LV_VOTE_1A:
+        case LV_VOTE_1B:
+        case LV_VOTE_2A:
+        case LV_VOTE_2B:
+        case LV_VOTE_LEARN:
+        case COMMIT_RECORD:
+        case COMMIT_VALUES:
+        case COMMIT_VALUES_ACK:
+        case COMMIT_RECORD_CHUNK:
+        case GV_OUTCOME:
+        case GV_PROPOSE:
+        case GV_VOTE_1A:
+        case GV_VOTE_1B:
+        case GV_VOTE_2A:
+        case GV_VOTE_2B:
+            up = up >> *tg;
+            return !up.error();
+        default:
+            return false;
+    }
+}
+
+void
+daemon :: dispatch(comm_id id, network_msgtype mt, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    CONSUS_PROBE2(message_dispatch, id.get(), uint64_t(mt));
+    const uint64_t start = po6::monotonic_time();
+    // charged after the handler runs, so that the message that starts a
+    // transaction on this daemon counts towards it; messages to ourselves
+    // never cross the network and count neither way
+    transaction_group cost_tg;
+    const bool costed = id != m_us.id && transaction_of(mt, up, &cost_tg);
+    const uint64_t cost_bytes = msg->size();
+    m_shipper.wait_for_promotion();
+
+    switch (mt)
+    {
+        case TXMAN_BEGIN:
+            process_begin(id, msg, up);
+            break;
+        case TXMAN_READ:
+            process_read(id, msg, up);
+            break;
+        case TXMAN_WRITE:
+            process_write(id, msg, up);
+            break;
+        case TXMAN_COND_WRITE:
+            process_cond_write(id, msg, up);
+            break;
+        case TXMAN_MULTI:
+            process_multi(id, msg, up);
+            break;
+        case TXMAN_SCAN:
+            process_scan(id, msg, up);
+            break;
+        case TXMAN_READ_STALE:
+            process_read_stale(id, msg, up);
+            break;
+        case TXMAN_SINGLE:
+            process_single(id, msg, up);
+            break;
+        case TXMAN_COMMIT:
+            process_commit(id, msg, up);
+            break;
+        case TXMAN_ABORT:
+            process_abort(id, msg, up);
+            break;
+        case TXMAN_WOUND:
+            process_wound(id, msg, up);
+            break;
+        case TXMAN_HOLD_LOCK:
+            process_hold_lock(id, msg, up);
+            break;
+        case TXMAN_FINISHED:
+            process_finished(id, msg, up);
+            break;
+        case TXMAN_LEASE_REQUEST:
+            process_lease_request(id, msg, up);
+            break;
+        case TXMAN_LEASE_GRANT:
+            process_lease_grant(id, msg, up);
+            break;
+        case TXMAN_GROUP_LOAD:
+            process_group_load(id, msg, up);
+            break;
+        case TXMAN_LOG_SHIP:
+            process_log_ship(id, msg, up);
+            break;
+        case TXMAN_LOG_SHIP_ACK:
+            process_log_ship_ack(id, msg, up);
+            break;
+        case TXMAN_WITNESS:
+            process_witness(id, msg, up);
+            break;
+        case TXMAN_WITNESS_FORGET:
+            process_witness_forget(id, msg, up);
+            break;
+        case TXMAN_PAXOS_2A:
+            process_paxos_2a(id, msg, up);
+            break;
+        case TXMAN_PAXOS_2B:
+            process_paxos_2b(id, msg, up);
+            break;
+        case TXMAN_PAXOS_2A_BATCH:
+            process_paxos_2a_batch(id, msg, up);
+            break;
+        case TXMAN_PAXOS_2B_BATCH:
+            process_paxos_2b_batch(id, msg, up);
+            break;
+        case LV_VOTE_1A:
+            process_lv_vote_1a(id, msg, up);
+            break;
+        case LV_VOTE_1B:
+            process_lv_vote_1b(id, msg, up);
+            break;
+        case LV_VOTE_2A:
+            process_lv_vote_2a(id, msg, up);
+            break;
+        case LV_VOTE_2B:
+            process_lv_vote_2b(id, msg, up);
+            break;
+        case LV_VOTE_LEARN:
+            process_lv_vote_learn(id, msg, up);
+            break;
+        case LV_VOTE_2A_BATCH:
+            process_lv_vote_2a_batch(id, msg, up);
+            break;
+        case LV_VOTE_2B_BATCH:
+            process_lv_vote_2b_batch(id, msg, up);
+            break;
+        case COMMIT_RECORD:
+            process_commit_record(id, msg, up);
+            break;
+        case COMMIT_VALUES:
+            process_commit_values(id, msg, up);
+            break;
+        case COMMIT_VALUES_ACK:
+            process_commit_values_ack(id, msg, up);
+            break;
+        case COMMIT_RECORD_CHUNK:
+            process_commit_record_chunk(id, msg, up);
+            break;
+        case GV_OUTCOME:
+            process_gv_outcome(id, msg, up);
+            break;
+        case GV_PROPOSE:
+            process_gv_propose(id, msg, up);
+            break;
+        case GV_VOTE_1A:
+            process_gv_vote_1a(id, msg, up);
+            break;
+        case GV_VOTE_1B:
+            process_gv_vote_1b(id, msg, up);
+            break;
+        case GV_VOTE_2A:
+            process_gv_vote_2a(id, msg, up);
+            break;
+        case GV_VOTE_2B:
+            process_gv_vote_2b(id, msg, up);
+            break;
+        case KVS_REP_RD_RESP:
+            process_kvs_rep_rd_resp(id, msg, up);
+            break;
+        case KVS_REP_WR_RESP:
+            process_kvs_rep_wr_resp(id, msg, up);
+            break;
+        case KVS_LOCK_OP_RESP:
+            process_kvs_lock_op_resp(id, msg, up);
+            break;
+        case KVS_LOCK_OP_BATCH_RESP:
+            process_kvs_lock_op_batch_resp(id, msg, up);
+            break;
+        case KVS_REP_SCAN_RESP:
+            process_kvs_rep_scan_resp(id, msg, up);
+            break;
+        case CONSUS_BATCH:
+            process_batch(id, msg, up);
+            break;
+        case CONSUS_COMPRESSED:
+            process_compressed(id, msg, up);
+            break;
+        case CONSUS_COMPACT:
+            process_compact(id, msg, up);
+            break;
+        case CONSUS_NOP:
+            break;
+        case CLIENT_RESPONSE:
+        case KVS_REP_RD:
+        case KVS_REP_WR:
+        case KVS_REP_SCAN:
+        case KVS_REP_RD_STALE:
+        case KVS_RAW_RD:
+        case KVS_RAW_RD_RESP:
+        case KVS_RAW_WR:
+        case KVS_RAW_WR_RESP:
+        case KVS_LOCK_OP:
+        case KVS_LOCK_OP_BATCH:
+        case KVS_RAW_LK:
+        case KVS_RAW_LK_RESP:
+        case KVS_WOUND_XACT:
+        case KVS_RAW_SCAN:
+        case KVS_RAW_SCAN_RESP:
+        case KVS_AE_DIGEST:
+        case KVS_AE_DIGEST_RESP:
+        case KVS_MIGRATE_SYN:
+        case KVS_MIGRATE_ACK:
+        case KVS_MIGRATE_PULL:
+        case KVS_MIGRATE_DATA:
+        case PROXY_HELLO:
+        case PROXY_CONFIG:
+        case PROXY_FORWARD:
+        case PROXY_DELIVER:
+        case PROXY_DISRUPTED:
+        default:
+            LOG(INFO) << "received " << mt << " message which transaction-managers do not process";
+            break;
+    }
+
+    if (costed)
+    {
+        m_costs.received(cost_tg, mt, cost_bytes);
+    }
+
+    const uint64_t end = po6::monotonic_time();
+    m_metrics.handled(mt, end - start);
+    m_stage_execute.record(end - start);
+    LOG_IF(INFO, end - start > 100 * PO6_MILLIS) << mt << " took " << ((end - start) / PO6_MILLIS) << "ms";
+}
+
 void
 daemon :: process_begin(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
     uint64_t nonce;
+    uint64_t priority = 0;
+    uint64_t hints_sz = 0;
+    std::vector<transaction::key_hint> hints;
     up = up >> e::unpack_varint(nonce);
+
+    // a restarted transaction asks to keep the start of its first attempt
+    if (!up.error() && up.remain())
+    {
+        up = up >> e::unpack_varint(priority);
+    }
+
+    // the keys the client expects to touch
+    if (!up.error() && up.remain())
+    {
+        up = up >> e::unpack_varint(hints_sz);
+    }
+
+    for (uint64_t i = 0; !up.error() && i < hints_sz && i < CONSUS_MAX_DECLARED_KEYS; ++i)
+    {
+        transaction::key_hint h;
+        up = up >> h.table >> h.key >> h.flags;
+        hints.push_back(h);
+    }
+
+    if (hints_sz > CONSUS_MAX_DECLARED_KEYS)
+    {
+        up = up.error_out();
+    }
+
     CHECK_UNPACK(TXMAN_BEGIN, up);
+
+    if (!admit_transaction())
+    {
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(CLIENT_RESPONSE)
+                        + sizeof(uint64_t)
+                        + pack_size(CONSUS_BUSY);
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE) << CLIENT_RESPONSE << nonce << CONSUS_BUSY;
+        send(id, msg);
+        return;
+    }
+
     configuration* c = get_config();
 
     while (true)
     {
-        transaction_id txid = generate_txid();
+        transaction_id txid = generate_txid(priority);
         const paxos_group* group = c->get_group(txid.group);
 
         if (!group)
@@ -623,8 +1611,9 @@ daemon :: process_begin(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
             return;
         }
 
-        uint64_t ts = po6::wallclock_time();
-        xact->begin(id, nonce, ts, *group, dcs, this);
+        uint64_t ts = m_clock.now();
+        xact->begin(id, nonce, ts, *group, dcs, hints, this);
+        schedule_pump(tg, po6::monotonic_time());
         break;
     }
 }
@@ -649,7 +1638,7 @@ daemon :: process_read(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
     }
 
     transaction_map_t::state_reference tsr;
-    transaction* xact = m_transactions.get_or_create_state(transaction_group(txid), &tsr);
+    transaction* xact = get_or_create_pumped(&m_transactions, transaction_group(txid), &tsr);
     assert(xact);
     xact->read(id, nonce, seqno, table, key, msg, this);
 }
@@ -675,21 +1664,33 @@ daemon :: process_write(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up
     }
 
     transaction_map_t::state_reference tsr;
-    transaction* xact = m_transactions.get_or_create_state(transaction_group(txid), &tsr);
+    transaction* xact = get_or_create_pumped(&m_transactions, transaction_group(txid), &tsr);
     assert(xact);
     xact->write(id, nonce, seqno, table, key, value, msg, this);
 }
 
 void
-daemon :: process_commit(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_cond_write(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     transaction_id txid;
     uint64_t nonce;
     uint64_t seqno;
+    e::slice table;
+    e::slice key;
+    uint8_t update;
+    e::slice expected;
+    e::slice value;
     up = up >> txid
             >> e::unpack_varint(nonce)
-            >> e::unpack_varint(seqno);
-    CHECK_UNPACK(TXMAN_COMMIT, up);
+            >> e::unpack_varint(seqno)
+            >> table >> key >> update >> expected >> value;
+    CHECK_UNPACK(TXMAN_COND_WRITE, up);
+
+    if (!update_is_valid(update))
+    {
+        LOG(WARNING) << "received conditional write with unknown update " << unsigned(update);
+        return;
+    }
 
     if (transaction_guard(txid, id))
     {
@@ -697,21 +1698,18 @@ daemon :: process_commit(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     }
 
     transaction_map_t::state_reference tsr;
-    transaction* xact = m_transactions.get_or_create_state(transaction_group(txid), &tsr);
+    transaction* xact = get_or_create_pumped(&m_transactions, transaction_group(txid), &tsr);
     assert(xact);
-    xact->prepare(id, nonce, seqno, this);
+    xact->cond_write(id, nonce, seqno, table, key, update_t(update), expected, value, msg, this);
 }
 
 void
-daemon :: process_abort(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_multi(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     transaction_id txid;
-    uint64_t nonce;
-    uint64_t seqno;
-    up = up >> txid
-            >> e::unpack_varint(nonce)
-            >> e::unpack_varint(seqno);
-    CHECK_UNPACK(TXMAN_ABORT, up);
+    uint64_t ops_sz;
+    up = up >> txid >> e::unpack_varint(ops_sz);
+    CHECK_UNPACK(TXMAN_MULTI, up);
 
     if (transaction_guard(txid, id))
     {
@@ -719,39 +1717,202 @@ daemon :: process_abort(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     }
 
     transaction_map_t::state_reference tsr;
-    transaction* xact = m_transactions.get_or_create_state(transaction_group(txid), &tsr);
+    transaction* xact = get_or_create_pumped(&m_transactions, transaction_group(txid), &tsr);
     assert(xact);
-    xact->abort(id, nonce, seqno, this);
+    xact->multi(id, ops_sz, up, msg, this);
 }
 
 void
-daemon :: process_wound(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+daemon :: process_scan(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
-    transaction_group tg;
-    up = up >> tg;
-    CHECK_UNPACK(TXMAN_WOUND, up);
+    transaction_id txid;
+    uint64_t nonce;
+    e::slice table;
+    e::slice key;
+    uint64_t limit;
+    up = up >> txid >> e::unpack_varint(nonce)
+            >> table >> key >> e::unpack_varint(limit);
+    CHECK_UNPACK(TXMAN_SCAN, up);
 
-    if (transaction_guard(tg, id))
+    if (transaction_guard(txid, id))
     {
         return;
     }
 
-    if (get_config()->is_member(tg.group, m_us.id))
-    {
-        LOG_IF(INFO, s_debug_mode) << transaction_group::log(tg) << " wounding local transaction";
-        // wound the local voter
-        local_voter_map_t::state_reference lvsr;
-        local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
-        assert(lv);
-        lv->wound(this);
-        // wound the global voter
-        global_voter_map_t::state_reference gvsr;
-        global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
-        assert(gv);
-        // XXX gv->wound(this);
-        // work the transaction
-        transaction_map_t::state_reference tsr;
-        transaction* xact = m_transactions.get_state(tg, &tsr);
+    transaction_map_t::state_reference tsr;
+    transaction* xact = get_or_create_pumped(&m_transactions, transaction_group(txid), &tsr);
+    assert(xact);
+    xact->scan(id, nonce, table, key, limit, this);
+}
+
+void
+daemon :: process_read_stale(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t nonce;
+    e::slice table;
+    e::slice key;
+    uint64_t timestamp;
+    up = up >> e::unpack_varint(nonce) >> table >> key >> timestamp;
+    CHECK_UNPACK(TXMAN_READ_STALE, up);
+    // stale reads are outside any transaction, so there is nothing to log or
+    // lock; hand the read straight to the key-value stores
+    read_map_t::state_reference sr;
+    kvs_read* kv = create_read(&sr, transaction_group(), false);
+    kv->callback_client(id, nonce);
+    kv->read_stale(table, key, timestamp, this);
+}
+
+// A single-key operation takes the key's lock in the name of a transaction
+// id of its own, so that it queues and wounds like any transaction, but
+// nothing is logged and nothing is voted on, which is sound only for tables
+// that one data center holds alone.
+void
+daemon :: process_single(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t nonce;
+    uint8_t kind;
+    uint8_t update;
+    e::slice table;
+    e::slice key;
+    e::slice expected;
+    e::slice value;
+    up = up >> e::unpack_varint(nonce) >> kind >> update
+            >> table >> key >> expected >> value;
+    CHECK_UNPACK(TXMAN_SINGLE, up);
+
+    if (kind > SINGLE_UPDATE || (kind == SINGLE_UPDATE && !update_is_valid(update)))
+    {
+        LOG(WARNING) << "received single-key operation of unknown kind "
+                     << unsigned(kind) << "/" << unsigned(update);
+        return;
+    }
+
+    consus_returncode rc = CONSUS_SUCCESS;
+
+    // the operation reaches the key-value stores of one data center and never
+    // the global vote, so another data center holding the table would miss
+    // its writes and could commit writes it does not see
+    if (!get_config()->single_data_center(table))
+    {
+        rc = CONSUS_INVALID;
+    }
+    else if (!admit_transaction())
+    {
+        rc = CONSUS_BUSY;
+    }
+
+    if (rc != CONSUS_SUCCESS)
+    {
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(CLIENT_RESPONSE)
+                        + sizeof(uint64_t)
+                        + pack_size(rc);
+        std::auto_ptr<e::buffer> resp(e::buffer::create(sz));
+        resp->pack_at(BUSYBEE_HEADER_SIZE) << CLIENT_RESPONSE << nonce << rc;
+        send(id, resp);
+        return;
+    }
+
+    while (true)
+    {
+        transaction_group tg(generate_txid(0));
+        transaction_map_t::state_reference tsr;
+        transaction* xact = m_transactions.create_state(tg, &tsr);
+
+        if (!xact)
+        {
+            continue;
+        }
+
+        xact->single(id, nonce, single_t(kind), table, key, update_t(update),
+                     expected, value, msg, this);
+        schedule_pump(tg, po6::monotonic_time());
+        break;
+    }
+}
+
+void
+daemon :: process_commit(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    transaction_id txid;
+    uint64_t nonce;
+    uint64_t seqno;
+    up = up >> txid
+            >> e::unpack_varint(nonce)
+            >> e::unpack_varint(seqno);
+    CHECK_UNPACK(TXMAN_COMMIT, up);
+
+    if (transaction_guard(txid, id))
+    {
+        return;
+    }
+
+    transaction_map_t::state_reference tsr;
+    transaction* xact = get_or_create_pumped(&m_transactions, transaction_group(txid), &tsr);
+    assert(xact);
+
+    // clients that buffer their writes send them along with the commit
+    if (up.remain())
+    {
+        uint64_t writes_sz;
+        up = up >> e::unpack_varint(writes_sz);
+        CHECK_UNPACK(TXMAN_COMMIT, up);
+        xact->prepare(id, nonce, seqno, writes_sz, up, msg, this);
+    }
+    else
+    {
+        xact->prepare(id, nonce, seqno, this);
+    }
+}
+
+void
+daemon :: process_abort(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    transaction_id txid;
+    uint64_t nonce;
+    uint64_t seqno;
+    up = up >> txid
+            >> e::unpack_varint(nonce)
+            >> e::unpack_varint(seqno);
+    CHECK_UNPACK(TXMAN_ABORT, up);
+
+    if (transaction_guard(txid, id))
+    {
+        return;
+    }
+
+    transaction_map_t::state_reference tsr;
+    transaction* xact = get_or_create_pumped(&m_transactions, transaction_group(txid), &tsr);
+    assert(xact);
+    xact->abort(id, nonce, seqno, this);
+}
+
+void
+daemon :: process_wound(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    transaction_group tg;
+    up = up >> tg;
+    CHECK_UNPACK(TXMAN_WOUND, up);
+
+    if (transaction_guard(tg, id))
+    {
+        return;
+    }
+
+    if (get_config()->is_member(tg.group, m_us.id))
+    {
+        LOG_IF(INFO, s_debug_mode) << transaction_group::log(tg) << " wounding local transaction";
+        // wound the local voter
+        local_voter_map_t::state_reference lvsr;
+        local_voter* lv = get_or_create_pumped(&m_local_voters, tg, &lvsr);
+        assert(lv);
+        lv->wound(this);
+        // XXX wound the global voter; until it can be, leave it be rather
+        // than create an empty one for every wounded (often single data
+        // center) transaction
+        // work the transaction
+        transaction_map_t::state_reference tsr;
+        transaction* xact = m_transactions.get_state(tg, &tsr);
 
         if (xact)
         {
@@ -766,15 +1927,24 @@ daemon :: process_wound(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up
 }
 
 void
-daemon :: process_hold_lock(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_hold_lock(comm_id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
     transaction_group tg;
     e::slice table;
     e::slice key;
-    up = up >> nonce >> tg;
+    up = up >> nonce >> tg >> table >> key;
     CHECK_UNPACK(TXMAN_HOLD_LOCK, up);
 
+    // only the holder's group knows whether it finished; the lock may have
+    // been recovered from disk with no transaction manager of its own
+    if (!get_config()->is_member(tg.group, m_us.id))
+    {
+        LOG_IF(INFO, s_debug_mode) << transaction_group::log(tg) << " forwarding lock holder to group";
+        send(tg.group, msg);
+        return;
+    }
+
     transaction_map_t::state_reference tsr;
     transaction* xact = m_transactions.get_state(tg, &tsr);
 
@@ -783,7 +1953,7 @@ daemon :: process_hold_lock(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
         LOG(INFO) << "unlocking lock held by " << transaction_group::log(tg)
                   << " which cleaned up without unlocking";
         daemon::lock_op_map_t::state_reference sr;
-        kvs_lock_op* kv = create_lock_op(&sr);
+        kvs_lock_op* kv = create_lock_op(&sr, tg, false);
         kv->doit(LOCK_UNLOCK, table, key, tg, this);
     }
 }
@@ -807,6 +1977,7 @@ daemon :: process_finished(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     {
         if (m_dispositions.put_ine(tg, outcome))
         {
+            disposition_recorded(tg);
             break;
         }
         else
@@ -827,6 +1998,122 @@ daemon :: process_finished(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     }
 }
 
+void
+daemon :: process_lease_request(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    paxos_group_id g;
+    uint64_t nonce;
+    up = up >> g >> nonce;
+    CHECK_UNPACK(TXMAN_LEASE_REQUEST, up);
+    const paxos_group* group = get_config()->get_group(g);
+
+    if (!group || group->members_sz == 0 || group->members[0] != id)
+    {
+        LOG(ERROR) << "dropping lease request for " << g << " from non-leader " << id;
+        return;
+    }
+
+    if (!m_leases.grant(g, id, po6::monotonic_time()))
+    {
+        return;
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(TXMAN_LEASE_GRANT)
+                    + pack_size(g)
+                    + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_LEASE_GRANT << g << nonce;
+    send(id, msg);
+}
+
+void
+daemon :: process_lease_grant(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    paxos_group_id g;
+    uint64_t nonce;
+    up = up >> g >> nonce;
+    CHECK_UNPACK(TXMAN_LEASE_GRANT, up);
+    const paxos_group* group = get_config()->get_group(g);
+
+    if (!group)
+    {
+        return;
+    }
+
+    m_leases.granted(g, id, nonce, group->quorum(), po6::monotonic_time());
+}
+
+void
+daemon :: process_group_load(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    paxos_group_id g;
+    uint64_t inflight;
+    uint64_t log_latency;
+    up = up >> g >> inflight >> log_latency;
+    CHECK_UNPACK(TXMAN_GROUP_LOAD, up);
+    const paxos_group* group = get_config()->get_group(g);
+
+    if (!group || group->index(id) >= group->members_sz)
+    {
+        return;
+    }
+
+    m_group_load.observe(g, id, inflight, log_latency, po6::monotonic_time());
+}
+
+void
+daemon :: process_log_ship(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t epoch;
+    int64_t start;
+    int64_t collected;
+    int64_t recno;
+    e::slice entry;
+    up = up >> epoch >> start >> collected >> recno >> entry;
+    CHECK_UNPACK(TXMAN_LOG_SHIP, up);
+
+    // the primary resent what we already have; our ack must have been lost
+    if (m_shipper.receive(id, epoch, start, collected, recno, entry))
+    {
+        ack_shipments(m_log.durable(), true);
+    }
+}
+
+void
+daemon :: process_log_ship_ack(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t epoch;
+    int64_t upto;
+    up = up >> epoch >> upto;
+    CHECK_UNPACK(TXMAN_LOG_SHIP_ACK, up);
+
+    // records the standby now has may be released
+    if (m_shipper.acked(id, epoch, upto))
+    {
+        m_log.wake();
+    }
+}
+
+void
+daemon :: process_witness(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    transaction_group tg;
+    e::slice inner;
+    up = up >> tg >> inner;
+    CHECK_UNPACK(TXMAN_WITNESS, up);
+    witness(id, tg, inner);
+}
+
+void
+daemon :: process_witness_forget(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    transaction_group tg;
+    up = up >> tg;
+    CHECK_UNPACK(TXMAN_WITNESS_FORGET, up);
+    m_witnesses.forget(tg);
+}
+
 void
 daemon :: process_paxos_2a(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
@@ -856,7 +2143,7 @@ daemon :: process_paxos_2a(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker
     }
 
     transaction_map_t::state_reference tsr;
-    transaction* xact = m_transactions.get_or_create_state(tg, &tsr);
+    transaction* xact = get_or_create_pumped(&m_transactions, tg, &tsr);
     assert(xact);
     xact->paxos_2a(seqno, t, up, msg, this);
 }
@@ -875,11 +2162,83 @@ daemon :: process_paxos_2b(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
     }
 
     transaction_map_t::state_reference tsr;
-    transaction* xact = m_transactions.get_or_create_state(tg, &tsr);
+    transaction* xact = get_or_create_pumped(&m_transactions, tg, &tsr);
     assert(xact);
     xact->paxos_2b(id, seqno, this);
 }
 
+void
+daemon :: process_paxos_2a_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    std::vector<e::slice> log_entries;
+    up = up >> log_entries;
+    CHECK_UNPACK(TXMAN_PAXOS_2A_BATCH, up);
+    transaction_group tg;
+    transaction_map_t::state_reference tsr;
+    transaction* xact = NULL;
+
+    for (size_t i = 0; i < log_entries.size(); ++i)
+    {
+        // each entry gets its own backing buffer, as if it arrived alone
+        std::auto_ptr<e::buffer> backing(e::buffer::create(log_entries[i].cdata(), log_entries[i].size()));
+        log_entry_t t = LOG_ENTRY_NOP;
+        transaction_group etg;
+        uint64_t seqno = 0;
+        e::unpacker eup = backing->unpack_from(0) >> t >> etg >> seqno;
+
+        if (eup.error() || !is_paxos_2a_log_entry(t) ||
+            (xact && etg != tg))
+        {
+            LOG(ERROR) << "dropping corrupt paxos 2A batch";
+
+            if (s_debug_mode)
+            {
+                LOG(ERROR) << "here's some hex: " << msg->hex();
+            }
+
+            return;
+        }
+
+        if (!xact)
+        {
+            tg = etg;
+
+            if (transaction_guard(tg, id))
+            {
+                return;
+            }
+
+            xact = get_or_create_pumped(&m_transactions, tg, &tsr);
+            assert(xact);
+        }
+
+        xact->paxos_2a(seqno, t, eup, backing, this);
+    }
+}
+
+void
+daemon :: process_paxos_2b_batch(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    transaction_group tg;
+    std::vector<uint64_t> seqnos;
+    up = up >> tg >> seqnos;
+    CHECK_UNPACK(TXMAN_PAXOS_2B_BATCH, up);
+
+    if (transaction_guard(tg, id))
+    {
+        return;
+    }
+
+    transaction_map_t::state_reference tsr;
+    transaction* xact = get_or_create_pumped(&m_transactions, tg, &tsr);
+    assert(xact);
+
+    for (size_t i = 0; i < seqnos.size(); ++i)
+    {
+        xact->paxos_2b(id, seqnos[i], this);
+    }
+}
+
 void
 daemon :: process_lv_vote_1a(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
@@ -895,7 +2254,7 @@ daemon :: process_lv_vote_1a(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     local_voter_map_t::state_reference lvsr;
-    local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+    local_voter* lv = get_or_create_pumped(&m_local_voters, tg, &lvsr);
     assert(lv);
     lv->vote_1a(id, idx, b, this);
 }
@@ -916,7 +2275,7 @@ daemon :: process_lv_vote_1b(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     local_voter_map_t::state_reference lvsr;
-    local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+    local_voter* lv = get_or_create_pumped(&m_local_voters, tg, &lvsr);
     assert(lv);
     lv->vote_1b(id, idx, b, p, this);
 }
@@ -936,7 +2295,7 @@ daemon :: process_lv_vote_2a(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     local_voter_map_t::state_reference lvsr;
-    local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+    local_voter* lv = get_or_create_pumped(&m_local_voters, tg, &lvsr);
     assert(lv);
     lv->vote_2a(id, idx, p, this);
 }
@@ -956,7 +2315,7 @@ daemon :: process_lv_vote_2b(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     local_voter_map_t::state_reference lvsr;
-    local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+    local_voter* lv = get_or_create_pumped(&m_local_voters, tg, &lvsr);
     assert(lv);
     lv->vote_2b(id, idx, p, this);
 }
@@ -976,7 +2335,7 @@ daemon :: process_lv_vote_learn(comm_id id, std::auto_ptr<e::buffer>, e::unpacke
     }
 
     local_voter_map_t::state_reference lvsr;
-    local_voter* lv = m_local_voters.get_or_create_state(tg, &lvsr);
+    local_voter* lv = get_or_create_pumped(&m_local_voters, tg, &lvsr);
     assert(lv);
     lv->vote_learn(idx, v, this);
     transaction_map_t::state_reference tsr;
@@ -989,40 +2348,176 @@ daemon :: process_lv_vote_learn(comm_id id, std::auto_ptr<e::buffer>, e::unpacke
 }
 
 void
-daemon :: process_commit_record(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+daemon :: process_lv_vote_2a_batch(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
-    transaction_group tg;
-    e::slice commit_record;
-    up = up >> tg >> commit_record;
-    CHECK_UNPACK(COMMIT_RECORD, up);
+    std::vector<vote_pipeline::vote> votes;
+    up = up >> votes;
+    CHECK_UNPACK(LV_VOTE_2A_BATCH, up);
+    std::vector<vote_pipeline::vote> accepted;
+    int64_t durable_at = -1;
 
-    if (transaction_guard(tg, id))
+    for (size_t i = 0; i < votes.size(); ++i)
+    {
+        const vote_pipeline::vote& v(votes[i]);
+
+        if (transaction_guard(v.tg, id))
+        {
+            continue;
+        }
+
+        local_voter_map_t::state_reference lvsr;
+        local_voter* lv = get_or_create_pumped(&m_local_voters, v.tg, &lvsr);
+        assert(lv);
+        int64_t recno = -1;
+
+        if (lv->vote_2a(id, v.idx, v.p, this, &recno))
+        {
+            accepted.push_back(v);
+            durable_at = std::max(durable_at, recno);
+        }
+    }
+
+    if (accepted.empty())
     {
         return;
     }
 
-    transaction_map_t::state_reference tsr;
-    transaction* xact = m_transactions.get_or_create_state(tg, &tsr);
-    assert(xact);
-    xact->commit_record(commit_record, msg, this);
+    // the log is durable in order, so one answer covers every vote once the
+    // last of their records is
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(LV_VOTE_2B_BATCH)
+                    + pack_size(accepted);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << LV_VOTE_2B_BATCH << accepted;
+    send_when_durable(durable_at, id, msg);
 }
 
 void
-daemon :: process_gv_outcome(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_lv_vote_2b_batch(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
 {
-    transaction_group tg;
-    uint64_t index;
-    uint64_t outcomes[CONSUS_MAX_REPLICATION_FACTOR];
-    up = up >> tg >> e::unpack_varint(index) >> e::unpack_array<uint64_t>(outcomes, CONSUS_MAX_REPLICATION_FACTOR);
-    CHECK_UNPACK(GV_OUTCOME, up);
+    std::vector<vote_pipeline::vote> votes;
+    up = up >> votes;
+    CHECK_UNPACK(LV_VOTE_2B_BATCH, up);
 
-    if (transaction_guard(tg, id))
+    for (size_t i = 0; i < votes.size(); ++i)
     {
-        return;
+        const vote_pipeline::vote& v(votes[i]);
+
+        if (transaction_guard(v.tg, id))
+        {
+            continue;
+        }
+
+        local_voter_map_t::state_reference lvsr;
+        local_voter* lv = get_or_create_pumped(&m_local_voters, v.tg, &lvsr);
+        assert(lv);
+        lv->vote_2b(id, v.idx, v.p, this);
+    }
+}
+
+void
+daemon :: process_commit_record(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    transaction_group tg;
+    e::slice commit_record;
+    up = up >> tg >> commit_record;
+    CHECK_UNPACK(COMMIT_RECORD, up);
+
+    if (transaction_guard(tg, id))
+    {
+        return;
+    }
+
+    transaction_map_t::state_reference tsr;
+    transaction* xact = get_or_create_pumped(&m_transactions, tg, &tsr);
+    assert(xact);
+    xact->commit_record(commit_record, msg, this);
+}
+
+void
+daemon :: process_commit_record_chunk(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    transaction_group tg;
+    uint64_t ops;
+    uint64_t index;
+    uint64_t count;
+    e::slice chunk;
+    up = up >> tg >> ops >> e::unpack_varint(index) >> e::unpack_varint(count) >> chunk;
+    CHECK_UNPACK(COMMIT_RECORD_CHUNK, up);
+
+    if (transaction_guard(tg, id))
+    {
+        return;
+    }
+
+    transaction_map_t::state_reference tsr;
+    transaction* xact = get_or_create_pumped(&m_transactions, tg, &tsr);
+    assert(xact);
+    xact->commit_record_chunk(ops, index, count, chunk, msg, this);
+}
+
+void
+daemon :: process_commit_values(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    transaction_group tg;
+    std::vector<uint64_t> seqnos;
+    std::vector<e::slice> values;
+    up = up >> tg >> seqnos >> values;
+    CHECK_UNPACK(COMMIT_VALUES, up);
+
+    if (m_dispositions.has(tg))
+    {
+        // applied and finished; the acknowledgement must have been lost
+        transaction_group origin(tg.txid);
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(COMMIT_VALUES_ACK)
+                        + pack_size(origin);
+        std::auto_ptr<e::buffer> ack(e::buffer::create(sz));
+        ack->pack_at(BUSYBEE_HEADER_SIZE) << COMMIT_VALUES_ACK << origin;
+        send(id, ack);
+        return;
+    }
+
+    transaction_map_t::state_reference tsr;
+    transaction* xact = m_transactions.get_state(tg, &tsr);
+
+    if (xact)
+    {
+        xact->commit_values(seqnos, values, msg, this);
+    }
+}
+
+void
+daemon :: process_commit_values_ack(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    transaction_group tg;
+    up = up >> tg;
+    CHECK_UNPACK(COMMIT_VALUES_ACK, up);
+    transaction_map_t::state_reference tsr;
+    transaction* xact = m_transactions.get_state(tg, &tsr);
+
+    if (xact)
+    {
+        xact->commit_values_ack(id, this);
+    }
+}
+
+void
+daemon :: process_gv_outcome(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    transaction_group tg;
+    uint64_t index;
+    uint64_t outcomes[CONSUS_MAX_REPLICATION_FACTOR];
+    up = up >> tg >> e::unpack_varint(index) >> e::unpack_array<uint64_t>(outcomes, CONSUS_MAX_REPLICATION_FACTOR);
+    CHECK_UNPACK(GV_OUTCOME, up);
+
+    if (transaction_guard(tg, id))
+    {
+        return;
     }
 
     global_voter_map_t::state_reference gvsr;
-    global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+    global_voter* gv = get_or_create_pumped(&m_global_voters, tg, &gvsr);
     assert(gv);
 
     if (gv->report(index, outcomes, this))
@@ -1051,7 +2546,7 @@ daemon :: process_gv_propose(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     global_voter_map_t::state_reference gvsr;
-    global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+    global_voter* gv = get_or_create_pumped(&m_global_voters, tg, &gvsr);
     assert(gv);
 
     if (gv->propose(c, this))
@@ -1080,7 +2575,7 @@ daemon :: process_gv_vote_1a(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     global_voter_map_t::state_reference gvsr;
-    global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+    global_voter* gv = get_or_create_pumped(&m_global_voters, tg, &gvsr);
     assert(gv);
 
     if (gv->process_p1a(id, m, this))
@@ -1109,7 +2604,7 @@ daemon :: process_gv_vote_1b(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     global_voter_map_t::state_reference gvsr;
-    global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+    global_voter* gv = get_or_create_pumped(&m_global_voters, tg, &gvsr);
     assert(gv);
 
     if (gv->process_p1b(m, this))
@@ -1138,7 +2633,7 @@ daemon :: process_gv_vote_2a(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     global_voter_map_t::state_reference gvsr;
-    global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+    global_voter* gv = get_or_create_pumped(&m_global_voters, tg, &gvsr);
     assert(gv);
 
     if (gv->process_p2a(id, m, this))
@@ -1167,7 +2662,7 @@ daemon :: process_gv_vote_2b(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
     }
 
     global_voter_map_t::state_reference gvsr;
-    global_voter* gv = m_global_voters.get_or_create_state(tg, &gvsr);
+    global_voter* gv = get_or_create_pumped(&m_global_voters, tg, &gvsr);
     assert(gv);
 
     if (gv->process_p2b(m, this))
@@ -1183,7 +2678,7 @@ daemon :: process_gv_vote_2b(comm_id id, std::auto_ptr<e::buffer>, e::unpacker u
 }
 
 void
-daemon :: process_kvs_rep_rd_resp(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_kvs_rep_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
     consus_returncode rc;
@@ -1191,56 +2686,181 @@ daemon :: process_kvs_rep_rd_resp(comm_id, std::auto_ptr<e::buffer>, e::unpacker
     e::slice value;
     up = up >> nonce >> rc >> timestamp >> value;
     CHECK_UNPACK(KVS_REP_RD_RESP, up);
+    observe_kvs_load(id, up);
+    m_clock.observe(timestamp);
 
     read_map_t::state_reference ksr;
     kvs_read* kv = m_readers.get_state(nonce, &ksr);
 
     if (kv)
     {
+        m_costs.received(kv->tx_group(), KVS_REP_RD_RESP, msg->size());
         kv->response(rc, timestamp, value, this);
     }
+
+    buffer_pool::recycle(msg);
 }
 
 void
-daemon :: process_kvs_rep_wr_resp(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_kvs_rep_wr_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
     consus_returncode rc;
     up = up >> nonce >> rc;
     CHECK_UNPACK(KVS_REP_WR_RESP, up);
+    observe_kvs_load(id, up);
 
     write_map_t::state_reference ksr;
     kvs_write* kv = m_writers.get_state(nonce, &ksr);
 
     if (kv)
     {
+        m_costs.received(kv->tx_group(), KVS_REP_WR_RESP, msg->size());
         kv->response(rc, this);
     }
+    else if (rc == CONSUS_SUCCESS)
+    {
+        m_replica_feed.acked(nonce);
+    }
+
+    buffer_pool::recycle(msg);
+}
+
+void
+daemon :: process_kvs_lock_op_batch_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    uint64_t count;
+    up = up >> count;
+    CHECK_UNPACK(KVS_LOCK_OP_BATCH_RESP, up);
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t nonce;
+        consus_returncode rc;
+        up = up >> nonce >> rc;
+        CHECK_UNPACK(KVS_LOCK_OP_BATCH_RESP, up);
+
+        lock_op_map_t::state_reference ksr;
+        kvs_lock_op* kv = m_lock_ops.get_state(nonce, &ksr);
+
+        if (kv)
+        {
+            // each lock in the batch carries an even share of its size
+            m_costs.received(kv->tx_group(), KVS_LOCK_OP_BATCH_RESP, msg->size() / count);
+            kv->response(rc, this);
+        }
+    }
+
+    observe_kvs_load(id, up);
+    buffer_pool::recycle(msg);
 }
 
 void
-daemon :: process_kvs_lock_op_resp(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
+daemon :: process_kvs_lock_op_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
 {
     uint64_t nonce;
     consus_returncode rc;
     up = up >> nonce >> rc;
     CHECK_UNPACK(KVS_LOCK_OP_RESP, up);
+    observe_kvs_load(id, up);
 
     lock_op_map_t::state_reference ksr;
     kvs_lock_op* kv = m_lock_ops.get_state(nonce, &ksr);
 
     if (kv)
     {
+        m_costs.received(kv->tx_group(), KVS_LOCK_OP_RESP, msg->size());
         kv->response(rc, this);
     }
+
+    buffer_pool::recycle(msg);
+}
+
+void
+daemon :: process_kvs_rep_scan_resp(comm_id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    uint64_t nonce;
+    consus_returncode rc;
+    uint8_t done;
+    e::slice last;
+    uint64_t items_sz;
+    up = up >> nonce >> rc >> done >> last >> items_sz;
+    std::vector<kvs_scan::item> items;
+
+    for (uint64_t i = 0; i < items_sz && !up.error(); ++i)
+    {
+        items.push_back(kvs_scan::item());
+        up = up >> items.back().key >> items.back().timestamp >> items.back().value;
+    }
+
+    CHECK_UNPACK(KVS_REP_SCAN_RESP, up);
+
+    scan_map_t::state_reference ksr;
+    kvs_scan* kv = m_scanners.get_state(nonce, &ksr);
+
+    if (kv)
+    {
+        kv->response(rc, done != 0, last, items, this);
+    }
+}
+
+void
+daemon :: process_batch(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    std::vector<e::buffer*> msgs;
+
+    if (!coalescer::split(up, &msgs))
+    {
+        LOG(WARNING) << "dropping the tail of a malformed batch from " << id;
+    }
+
+    // each message re-enters the receive queue so that the batch is handled
+    // by every network thread rather than the one that unpacked it
+    for (size_t i = 0; i < msgs.size(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg(msgs[i]);
+        m_busybee->deliver(id.get(), msg);
+    }
+}
+
+void
+daemon :: process_compressed(comm_id id, std::auto_ptr<e::buffer>, e::unpacker up)
+{
+    std::auto_ptr<e::buffer> msg(m_compressor.decompress(up));
+
+    if (!msg.get())
+    {
+        LOG(WARNING) << "dropping compressed message from " << id
+                     << " that is corrupt or uses another dictionary";
+        return;
+    }
+
+    m_busybee->deliver(id.get(), msg);
+}
+
+void
+daemon :: process_compact(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up)
+{
+    std::auto_ptr<e::buffer> expanded(m_compactor.expand(msg.get(), up));
+
+    if (!expanded.get())
+    {
+        LOG(WARNING) << "dropping compact message from " << id
+                     << " that is corrupt or uses an unknown version";
+        return;
+    }
+
+    buffer_pool::recycle(msg);
+    m_busybee->deliver(id.get(), expanded);
 }
 
 consus::kvs_read*
-daemon :: create_read(read_map_t::state_reference* sr)
+daemon :: create_read(read_map_t::state_reference* sr,
+                   const transaction_group& tg, bool traced)
 {
     while (true)
     {
-        uint64_t kv_nonce = generate_nonce();
+        uint64_t kv_nonce = tracer::tag(generate_owned_nonce(tg), traced);
 
         if (kv_nonce == 0)
         {
@@ -1256,8 +2876,41 @@ daemon :: create_read(read_map_t::state_reference* sr)
     }
 }
 
-consus::kvs_write*
-daemon :: create_write(write_map_t::state_reference* sr)
+uint64_t
+daemon :: pinned_read(const transaction_group& tg, uint64_t seqno,
+                      void (transaction::*func)(consus_returncode,
+                                                uint64_t,
+                                                const e::slice&,
+                                                uint64_t, daemon*),
+                      const e::slice& table, const e::slice& key,
+                      uint64_t timestamp)
+{
+    const std::string flight(read_flights::flight(table, key, timestamp));
+    const uint64_t nonce = m_read_flights.find(flight);
+
+    if (nonce != 0)
+    {
+        read_map_t::state_reference sr;
+        kvs_read* kv = m_readers.get_state(nonce, &sr);
+
+        if (kv && kv->join(tg, seqno, func))
+        {
+            LOG_IF(INFO, s_debug_mode) << transaction_group::log(tg) << " joined read " << nonce;
+            return nonce;
+        }
+    }
+
+    read_map_t::state_reference sr;
+    kvs_read* kv = create_read(&sr, tg, m_tracer.sampled(tg));
+    kv->callback_transaction(tg, seqno, func);
+    kv->set_flight(flight);
+    m_read_flights.start(flight, kv->state_key());
+    kv->read(table, key, timestamp, this);
+    return kv->state_key();
+}
+
+consus::kvs_scan*
+daemon :: create_scan(scan_map_t::state_reference* sr)
 {
     while (true)
     {
@@ -1268,6 +2921,28 @@ daemon :: create_write(write_map_t::state_reference* sr)
             continue;
         }
 
+        kvs_scan* kv = m_scanners.create_state(kv_nonce, sr);
+
+        if (kv)
+        {
+            return kv;
+        }
+    }
+}
+
+consus::kvs_write*
+daemon :: create_write(write_map_t::state_reference* sr,
+                   const transaction_group& tg, bool traced)
+{
+    while (true)
+    {
+        uint64_t kv_nonce = tracer::tag(generate_owned_nonce(tg), traced);
+
+        if (kv_nonce == 0)
+        {
+            continue;
+        }
+
         kvs_write* kv = m_writers.create_state(kv_nonce, sr);
 
         if (kv)
@@ -1278,11 +2953,12 @@ daemon :: create_write(write_map_t::state_reference* sr)
 }
 
 consus::kvs_lock_op*
-daemon :: create_lock_op(lock_op_map_t::state_reference* sr)
+daemon :: create_lock_op(lock_op_map_t::state_reference* sr,
+                   const transaction_group& tg, bool traced)
 {
     while (true)
     {
-        uint64_t kv_nonce = generate_nonce();
+        uint64_t kv_nonce = tracer::tag(generate_owned_nonce(tg), traced);
 
         if (kv_nonce == 0)
         {
@@ -1317,9 +2993,18 @@ daemon :: debug_dump()
     LOG(INFO) << "note that entries can appear multiple times in the following tables";
     LOG(INFO) << "this is a natural consequence of not holding global locks during the dump";
     {
-        po6::threads::mutex::hold hold(&m_durable_mtx);
-        LOG(INFO) << m_durable_cbs.size() << " unanswered durable callbacks";
-        LOG(INFO) << m_durable_msgs.size() << " unanswered durable messages";
+        size_t cbs = 0;
+        size_t msgs = 0;
+
+        for (size_t i = 0; i < DURABLE_SHARDS; ++i)
+        {
+            po6::threads::mutex::hold hold(&m_durable_shards[i].mtx);
+            cbs += m_durable_shards[i].cbs.size();
+            msgs += m_durable_shards[i].msgs.size();
+        }
+
+        LOG(INFO) << cbs << " unanswered durable callbacks";
+        LOG(INFO) << msgs << " unanswered durable messages";
     }
     LOG(INFO) << "--------------------------------- Transactions ---------------------------------";
 
@@ -1363,178 +3048,326 @@ daemon :: debug_dump()
         }
     }
 
-#if 0
-    LOG(INFO) << "--------------------------------- Dispositions ---------------------------------";
-    LOG(INFO) << "-------------------------------- Read Operations -------------------------------";
-    LOG(INFO) << "------------------------------- Write Operations -------------------------------";
-    LOG(INFO) << "-------------------------------- Lock Operations -------------------------------";
-    LOG(INFO) << "---------------------------------- Durability ----------------------------------";
-#endif
-    LOG(INFO) << "================================ End Debug Dump ================================";
-}
-
-uint64_t
-daemon :: generate_nonce()
-{
-    // XXX don't go out of process
-    po6::io::fd fd(open("/dev/urandom", O_RDONLY));
-    uint64_t x;
-    int ret = fd.xread(&x, sizeof(x));
-    assert(ret == 8);
-    return x;
-}
-
-consus::transaction_id
-daemon :: generate_txid()
-{
-    uint64_t x = generate_nonce();
-    paxos_group_id id;
-    std::vector<paxos_group_id> groups(get_config()->groups_for(m_us.id));
-    // XXX groups.size() == 0?
-    size_t idx = x % groups.size();
-    id = groups[idx];
-    return transaction_id(id, po6::wallclock_time(), x);
-}
-
-bool
-daemon :: transaction_guard(const transaction_id& txid, comm_id id)
-{
-    return transaction_guard(transaction_group(txid), id);
-}
-
-bool
-daemon :: transaction_guard(const transaction_group& tg, comm_id id)
-{
-    uint64_t outcome = 0;
-
-    if (m_dispositions.get(tg, &outcome))
+    if (m_admission.enabled())
     {
-        size_t sz = BUSYBEE_HEADER_SIZE
-                  + pack_size(TXMAN_FINISHED)
-                  + pack_size(tg)
-                  + sizeof(uint64_t);
-        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_FINISHED << tg << outcome;
-        send(id, msg);
-        return true;
+        LOG(INFO) << "------------------------------- Admission Control ------------------------------";
+        LOG(INFO) << m_admission.debug_dump();
     }
 
-    return false;
-}
-
-bool
-daemon :: send(comm_id id, std::auto_ptr<e::buffer> msg)
-{
-#ifdef CONSUS_LOG_ALL_MESSAGES
-    if (s_debug_mode)
+    if (m_vote_pipeline.enabled())
     {
-        network_msgtype mt;
-        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
-        up = up >> mt;
+        LOG(INFO) << "-------------------------------- Vote Pipeline ---------------------------------";
+        std::vector<std::string> lines = split_by_newlines(m_vote_pipeline.debug_dump());
 
-        if (up.error())
-        {
-            LOG(ERROR) << "sending invalid message: " << msg->b64();
-        }
-        else
+        for (size_t i = 0; i < lines.size(); ++i)
         {
-            LOG(INFO) << "send->" << id << " " << mt << " " << msg->b64();
+            LOG(INFO) << lines[i];
         }
     }
-#endif
 
-    if (id == comm_id())
     {
-        LOG_IF(INFO, s_debug_mode) << "message not sent: dropped";
-        return false;
+        LOG(INFO) << "--------------------------------- Hybrid Clock ---------------------------------";
+        LOG(INFO) << m_clock.debug_dump();
     }
 
-    if (id == m_us.id)
     {
-        m_busybee->deliver(id.get(), msg);
-        return true;
-    }
+        LOG(INFO) << "---------------------------------- KVS Pressure --------------------------------";
+        std::vector<std::string> lines = split_by_newlines(m_kvs_pressure.debug_dump());
 
-    busybee_returncode rc = m_busybee->send(id.get(), msg);
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
 
-    switch (rc)
     {
-        case BUSYBEE_SUCCESS:
-            return true;
-        case BUSYBEE_DISRUPTED:
-            LOG_IF(INFO, s_debug_mode) << "message not sent: disrupted";
-            return false;
-        case BUSYBEE_SEE_ERRNO:
-            PLOG(ERROR) << "receive error";
-            return false;
-        case BUSYBEE_SHUTDOWN:
-        case BUSYBEE_INTERRUPTED:
-        case BUSYBEE_TIMEOUT:
-        case BUSYBEE_EXTERNAL:
-        default:
-            LOG(ERROR) << "internal invariants broken; crashing";
-            abort();
+        std::vector<std::string> lines = split_by_newlines(m_shipper.debug_dump());
+
+        if (!lines.empty())
+        {
+            LOG(INFO) << "---------------------------------- Log Shipping --------------------------------";
+        }
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+
+    {
+        std::vector<std::string> lines = split_by_newlines(m_witnesses.debug_dump());
+
+        if (!lines.empty())
+        {
+            LOG(INFO) << "----------------------------------- Witnessing ---------------------------------";
+        }
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+
+    {
+        std::vector<std::string> lines = split_by_newlines(m_replica_feed.debug_dump(po6::monotonic_time()));
+
+        if (!lines.empty())
+        {
+            LOG(INFO) << "---------------------------------- Read Replicas -------------------------------";
+        }
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+
+    if (m_balance_groups)
+    {
+        LOG(INFO) << "----------------------------------- Group Load ---------------------------------";
+        std::vector<std::string> lines = split_by_newlines(m_group_load.debug_dump());
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+
+    if (m_wan.enabled())
+    {
+        LOG(INFO) << "---------------------------------- WAN Pacing ----------------------------------";
+        std::vector<std::string> lines = split_by_newlines(m_wan.debug_dump());
+
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            LOG(INFO) << lines[i];
+        }
+    }
+
+#if 0
+    LOG(INFO) << "--------------------------------- Dispositions ---------------------------------";
+    LOG(INFO) << "-------------------------------- Read Operations -------------------------------";
+    LOG(INFO) << "------------------------------- Write Operations -------------------------------";
+    LOG(INFO) << "-------------------------------- Lock Operations -------------------------------";
+    LOG(INFO) << "---------------------------------- Durability ----------------------------------";
+#endif
+    LOG(INFO) << "================================ End Debug Dump ================================";
+}
+
+uint64_t
+daemon :: generate_nonce()
+{
+    return random_id();
+}
+
+uint64_t
+daemon :: generate_owned_nonce(const transaction_group& tg)
+{
+    uint64_t nonce = generate_nonce();
+
+    if (!m_stage_queues.empty() && tg != transaction_group())
+    {
+        nonce = (nonce & ~NONCE_OWNER_MASK) | stage_owner(tg);
     }
+
+    return nonce;
 }
 
-unsigned
-daemon :: send(paxos_group_id g, std::auto_ptr<e::buffer> msg)
+consus::transaction_id
+daemon :: generate_txid(uint64_t priority)
 {
-    const paxos_group* group = get_config()->get_group(g);
+    uint64_t x = generate_nonce();
+    paxos_group_id id;
+    const std::vector<paxos_group_id>& groups(get_config()->groups_for(m_us.id));
+    // XXX groups.size() == 0?
+    if (m_balance_groups)
+    {
+        id = m_group_load.choose(groups, x, po6::monotonic_time());
+    }
+    else
+    {
+        size_t idx = x % groups.size();
+        id = groups[idx];
+    }
 
-    if (!group)
+    uint64_t start = m_clock.now();
+
+    // wound-wait favors the earlier start, so a retry that keeps it is not
+    // wounded over and over by transactions that began after it first did
+    if (priority != 0 && priority < start && start - priority < PRIORITY_MAX_AGE)
     {
-        return 0;
+        start = priority;
     }
 
-    return send(*group, msg);
+    return transaction_id(id, start, x);
 }
 
-unsigned
-daemon :: send(const paxos_group& g, std::auto_ptr<e::buffer> msg)
+bool
+daemon :: optimistic(const e::slice& table)
 {
-    unsigned count = 0;
+    return !m_optimistic_tables.empty() &&
+           m_optimistic_tables.find(table.str()) != m_optimistic_tables.end();
+}
+
+bool
+daemon :: transaction_guard(const transaction_id& txid, comm_id id)
+{
+    return transaction_guard(transaction_group(txid), id);
+}
+
+bool
+daemon :: transaction_guard(const transaction_group& tg, comm_id id)
+{
+    // nearly every message about a transaction passes through here, so this
+    // is where the clock learns the timestamps of transactions begun elsewhere
+    m_clock.observe(tg.txid.start);
+    uint64_t outcome = 0;
+
+    if (m_dispositions.get(tg, &outcome))
+    {
+        size_t sz = BUSYBEE_HEADER_SIZE
+                  + pack_size(TXMAN_FINISHED)
+                  + pack_size(tg)
+                  + sizeof(uint64_t);
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_FINISHED << tg << outcome;
+        send(id, msg);
+        return true;
+    }
+
+    uint64_t watermark = 0;
 
-    for (unsigned i = 0; i < g.members_sz; ++i)
     {
-        std::auto_ptr<e::buffer> m(msg->copy());
+        po6::threads::mutex::hold hold(&m_dispositions_mtx);
+        disposition_watermark_map_t::iterator it = m_dispositions_watermarks.find(tg.txid.group);
 
-        if (g.members[i] == m_us.id)
+        if (it != m_dispositions_watermarks.end())
         {
-            m_busybee->deliver(g.members[i].get(), m);
-            ++count;
-            continue;
+            watermark = it->second;
         }
+    }
 
-        busybee_returncode rc = m_busybee->send(g.members[i].get(), m);
+    if (tg.txid.start > watermark)
+    {
+        return false;
+    }
 
-        switch (rc)
+    transaction_map_t::state_reference tsr;
+    local_voter_map_t::state_reference lvsr;
+    global_voter_map_t::state_reference gvsr;
+
+    if (m_transactions.get_state(tg, &tsr) ||
+        m_local_voters.get_state(tg, &lvsr) ||
+        m_global_voters.get_state(tg, &gvsr))
+    {
+        return false;
+    }
+
+    // XXX The outcome is gone, so there's nothing to tell the sender; a
+    // transaction that outlived the retention window on its way here is
+    // indistinguishable from a reclaimed one.
+    LOG_IF(INFO, s_debug_mode) << transaction_group::log(tg) << " dropping message from " << id
+                               << " for transaction older than the reclaimed watermark";
+    return true;
+}
+
+void
+daemon :: disposition_recorded(const transaction_group& tg)
+{
+    const paxos_group* g = get_config()->get_group(tg.group);
+
+    // one member speaks for the group; witnesses sweep up after any
+    // transaction whose end they never hear of
+    if (g && g->witnesses_sz > 0 && g->members[0] == m_us.id)
+    {
+        for (unsigned i = 0; i < g->witnesses_sz; ++i)
         {
-            case BUSYBEE_SUCCESS:
-                ++count;
-                break;
-            case BUSYBEE_DISRUPTED:
-                LOG_IF(INFO, s_debug_mode) << "message not sent to " << g.members[i];
-                break;
-            case BUSYBEE_SEE_ERRNO:
-                PLOG(ERROR) << "receive error";
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(TXMAN_WITNESS_FORGET)
+                            + pack_size(tg);
+            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_WITNESS_FORGET << tg;
+            send(g->witnesses[i], msg);
+        }
+    }
+
+    po6::threads::mutex::hold hold(&m_dispositions_mtx);
+    m_dispositions_queue.push_back(std::make_pair(po6::monotonic_time(), tg));
+}
+
+// the start of the oldest transaction of each paxos group with state in table
+template <typename T>
+static void
+oldest_live_states(T* table, std::map<consus::paxos_group_id, uint64_t>* oldest)
+{
+    for (typename T::iterator it(table); it.valid(); ++it)
+    {
+        const consus::transaction_group& tg((*it)->state_key());
+        std::map<consus::paxos_group_id, uint64_t>::iterator o = oldest->find(tg.txid.group);
+
+        if (o == oldest->end())
+        {
+            oldest->insert(std::make_pair(tg.txid.group, tg.txid.start));
+        }
+        else
+        {
+            o->second = std::min(o->second, tg.txid.start);
+        }
+    }
+}
+
+void
+daemon :: collect_dispositions(uint64_t now)
+{
+    std::vector<transaction_group> reclaim;
+    std::map<paxos_group_id, uint64_t> oldest;
+    oldest_live_states(&m_transactions, &oldest);
+    oldest_live_states(&m_local_voters, &oldest);
+    oldest_live_states(&m_global_voters, &oldest);
+
+    {
+        po6::threads::mutex::hold hold(&m_dispositions_mtx);
+
+        while (!m_dispositions_queue.empty() &&
+               m_dispositions_queue.front().first + DISPOSITION_RETENTION <= now)
+        {
+            const transaction_group& tg(m_dispositions_queue.front().second);
+            std::map<paxos_group_id, uint64_t>::iterator o = oldest.find(tg.txid.group);
+
+            // the watermark may pass only finished transactions; one of its
+            // group that started earlier and still runs here, however long,
+            // holds back reclaiming until it finishes too
+            if (o != oldest.end() && o->second <= tg.txid.start)
+            {
                 break;
-            case BUSYBEE_SHUTDOWN:
-            case BUSYBEE_INTERRUPTED:
-            case BUSYBEE_TIMEOUT:
-            case BUSYBEE_EXTERNAL:
-            default:
-                LOG(ERROR) << "internal invariants broken; crashing";
-                abort();
+            }
+
+            uint64_t* watermark = &m_dispositions_watermarks[tg.txid.group];
+            *watermark = std::max(*watermark, tg.txid.start);
+            reclaim.push_back(tg);
+            m_dispositions_queue.pop_front();
         }
     }
 
+    for (size_t i = 0; i < reclaim.size(); ++i)
+    {
+        m_dispositions.del(reclaim[i]);
+    }
+
+    if (!reclaim.empty())
+    {
+        LOG_IF(INFO, s_debug_mode) << "reclaimed " << reclaim.size() << " transaction dispositions";
+    }
+}
+
+bool
+daemon :: send(comm_id id, std::auto_ptr<e::buffer> msg)
+{
 #ifdef CONSUS_LOG_ALL_MESSAGES
     if (s_debug_mode)
     {
         network_msgtype mt;
         e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
-        memset(msg->data(), 0, BUSYBEE_HEADER_SIZE);
         up = up >> mt;
 
         if (up.error())
@@ -1543,217 +3376,1583 @@ daemon :: send(const paxos_group& g, std::auto_ptr<e::buffer> msg)
         }
         else
         {
-            LOG(INFO) << "send->" << count << "/" << g.members_sz << " members of " <<  g.id << " " << mt << " " << msg->b64();
+            LOG(INFO) << "send->" << id << " " << mt << " " << msg->b64();
         }
     }
 #endif
 
-    return count;
+    if (id == comm_id())
+    {
+        LOG_IF(INFO, s_debug_mode) << "message not sent: dropped";
+        return false;
+    }
+
+    if (hold_for_replay(id, &msg))
+    {
+        return true;
+    }
+
+    if (id == m_us.id)
+    {
+        m_busybee->deliver(id.get(), msg);
+        return true;
+    }
+
+    return transmit(id, msg);
 }
 
-struct daemon::durable_msg
+bool
+daemon :: send_bulk(comm_id id, wan_scheduler::traffic_class tc, std::auto_ptr<e::buffer> msg)
 {
-    durable_msg() : recno(), client(), msg(NULL) {}
-    durable_msg(int64_t r, comm_id c, e::buffer* m) : recno(r), client(c), msg(m) {}
-    durable_msg(const durable_msg& other)
-        : recno(other.recno), client(other.client), msg(other.msg) {}
-    ~durable_msg() throw () {}
-    durable_msg& operator = (const durable_msg& rhs)
+    const data_center_id dc = get_config()->get_data_center(id);
+
+    if (!m_wan.enabled() || id == comm_id() || id == m_us.id || dc == m_us.dc)
     {
-        // no self-assign check needed
-        recno = rhs.recno;
-        client = rhs.client;
-        msg = rhs.msg;
-        return *this;
+        return send(id, msg);
     }
-    bool operator < (const durable_msg& rhs) { return rhs.recno > recno; }
-    int64_t recno;
-    comm_id client;
-    e::buffer* msg;
-};
 
-void
-daemon :: send_when_durable(const std::string& entry, comm_id id, std::auto_ptr<e::buffer> msg)
-{
-    e::buffer* m = msg.release();
-    send_when_durable(entry, &id, &m, 1);
-}
+    if (!m_wan.enqueue(dc, id, tc, msg))
+    {
+        LOG_IF(INFO, s_debug_mode) << "bulk message to " << id << " dropped: queue for its data center is full";
+        return false;
+    }
+
+    return true;
+}
+
+unsigned
+daemon :: send(paxos_group_id g, std::auto_ptr<e::buffer> msg)
+{
+    const paxos_group* group = get_config()->get_group(g);
+
+    if (!group)
+    {
+        return 0;
+    }
+
+    return send(*group, msg);
+}
+
+unsigned
+daemon :: send(const paxos_group& g, std::auto_ptr<e::buffer> msg)
+{
+    unsigned count = 0;
+#ifdef CONSUS_LOG_ALL_MESSAGES
+    // the message is logged below, so every member gets a copy
+    const unsigned copies = g.members_sz;
+#else
+    // busybee owns (and frames) whatever it is handed, so the buffer cannot be
+    // shared; the last member gets the original rather than another copy
+    const unsigned copies = g.members_sz - 1;
+#endif
+
+    for (unsigned i = 0; i < g.members_sz; ++i)
+    {
+        std::auto_ptr<e::buffer> m(i < copies ? msg->copy() : msg.release());
+
+        if (hold_for_replay(g.members[i], &m))
+        {
+            ++count;
+            continue;
+        }
+
+        if (g.members[i] == m_us.id)
+        {
+            m_busybee->deliver(g.members[i].get(), m);
+            ++count;
+            continue;
+        }
+
+        if (transmit(g.members[i], m))
+        {
+            ++count;
+        }
+    }
+
+#ifdef CONSUS_LOG_ALL_MESSAGES
+    if (s_debug_mode)
+    {
+        network_msgtype mt;
+        e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+        memset(msg->data(), 0, BUSYBEE_HEADER_SIZE);
+        up = up >> mt;
+
+        if (up.error())
+        {
+            LOG(ERROR) << "sending invalid message: " << msg->b64();
+        }
+        else
+        {
+            LOG(INFO) << "send->" << count << "/" << g.members_sz << " members of " <<  g.id << " " << mt << " " << msg->b64();
+        }
+    }
+#endif
+
+    return count;
+}
+
+bool
+daemon :: hold_for_replay(comm_id id, std::auto_ptr<e::buffer>* msg)
+{
+    if (!e::atomic::load_64_acquire(&m_replaying))
+    {
+        return false;
+    }
+
+    po6::threads::mutex::hold hold(&m_replay_mtx);
+
+    if (!m_replaying)
+    {
+        return false;
+    }
+
+    m_replay_sends.push_back(std::make_pair(id, msg->release()));
+    return true;
+}
+
+void
+daemon :: release_replay_sends()
+{
+    std::vector<std::pair<comm_id, e::buffer*> > held;
+
+    {
+        po6::threads::mutex::hold hold(&m_replay_mtx);
+        e::atomic::store_64_release(&m_replaying, 0);
+        held.swap(m_replay_sends);
+    }
+
+    for (size_t i = 0; i < held.size(); ++i)
+    {
+        send(held[i].first, std::auto_ptr<e::buffer>(held[i].second));
+    }
+
+    LOG_IF(INFO, !held.empty()) << "sent " << held.size() << " messages held back during replay";
+}
+
+bool
+daemon :: transmit(comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    cost_sent(msg.get());
+    coalescer* c = &m_coalescer;
+
+    // with the vote pipeline on, votes of every transaction headed to a peer
+    // travel together whether or not other traffic is coalesced
+    if (m_vote_aggregator.enabled() && is_local_vote(msg.get()))
+    {
+        c = &m_vote_aggregator;
+    }
+    // with the commit pipeline on, commit records and global votes of every
+    // transaction headed to a peer in another data center travel together,
+    // and the peer logs them behind one fsync
+    else if (m_commit_pipeline.enabled() && is_commit_traffic(msg.get()) &&
+             get_config()->get_data_center(id) != m_us.dc)
+    {
+        c = &m_commit_pipeline;
+    }
+
+    if (!c->enabled())
+    {
+        return transmit_now(id, msg);
+    }
+
+    coalescer::outbox_t ready;
+    c->add(id, msg, &ready);
+    return transmit_now(&ready);
+}
+
+void
+daemon :: cost_sent(e::buffer* msg)
+{
+    network_msgtype mt;
+    transaction_group tg;
+    e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> mt;
+
+    if (!up.error() && transaction_of(mt, up, &tg))
+    {
+        m_costs.sent(tg, mt, msg->size());
+    }
+}
+
+bool
+daemon :: transmit_now(comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    // clients may predate compact frames; only servers are sent them
+    if (m_compactor.enabled() && get_config()->exists(id))
+    {
+        m_compactor.compact(&msg);
+    }
+
+    const bool local = get_config()->get_data_center(id) == m_us.dc;
+
+    if (m_compressor.enabled() && !local)
+    {
+        m_compressor.compress(&msg);
+    }
+
+    transport* t = local && m_local_transport.get() ? m_local_transport.get() : m_transport.get();
+    busybee_returncode rc = t->send(id, msg);
+
+    switch (rc)
+    {
+        case BUSYBEE_SUCCESS:
+            return true;
+        case BUSYBEE_DISRUPTED:
+            LOG_IF(INFO, s_debug_mode) << "message not sent to " << id << ": disrupted";
+            return false;
+        case BUSYBEE_SEE_ERRNO:
+            PLOG(ERROR) << "send error";
+            return false;
+        case BUSYBEE_SHUTDOWN:
+        case BUSYBEE_INTERRUPTED:
+        case BUSYBEE_TIMEOUT:
+        case BUSYBEE_EXTERNAL:
+        default:
+            LOG(ERROR) << "internal invariants broken; crashing";
+            abort();
+    }
+}
+
+bool
+daemon :: transmit_now(coalescer::outbox_t* ready)
+{
+    bool sent = true;
+
+    for (size_t i = 0; i < ready->size(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg((*ready)[i].second);
+        sent = transmit_now((*ready)[i].first, msg) && sent;
+    }
+
+    return sent;
+}
+
+void
+daemon :: send_when_durable(const std::string& entry, comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    e::buffer* m = msg.release();
+    send_when_durable(entry, &id, &m, 1);
+}
+
+void
+daemon :: send_when_durable(const std::string& entry, const comm_id* ids, e::buffer** msgs, size_t sz)
+{
+    int64_t x = append_to_log_once(entry);
+    send_when_durable(x, ids, msgs, sz);
+}
+
+void
+daemon :: send_when_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg)
+{
+    const paxos_group* group = get_config()->get_group(g);
+
+    if (!group || group->members_sz <= 0 || idx < 0)
+    {
+        return;
+    }
+
+    e::buffer* msgs[CONSUS_MAX_REPLICATION_FACTOR];
+    msgs[0] = msg.release();
+
+    for (size_t i = 1; i < group->members_sz; ++i)
+    {
+        msgs[i] = msgs[0]->copy();
+    }
+
+    send_when_durable(idx, group->members, msgs, group->members_sz);
+}
+
+void
+daemon :: send_when_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    e::buffer* m = msg.release();
+    send_when_durable(idx, &id, &m, 1);
+}
+
+void
+daemon :: send_when_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz)
+{
+    if (idx < 0)
+    {
+        for (size_t i = 0; i < sz; ++i)
+        {
+            delete msgs[i];
+        }
+
+        return;
+    }
+
+    bool send_now = false;
+    durable_shard* shard = durable_shard_for(idx);
+
+    {
+        po6::threads::mutex::hold hold(&shard->mtx);
+        send_now = idx <= shard->up_to;
+
+        if (!send_now)
+        {
+            for (size_t i = 0; i < sz; ++i)
+            {
+                durable_msg d(idx, ids[i], msgs[i]);
+                shard->msgs.push_back(d);
+                std::push_heap(shard->msgs.begin(), shard->msgs.end());
+            }
+        }
+    }
+
+    if (send_now)
+    {
+        for (size_t i = 0; i < sz; ++i)
+        {
+            send(ids[i], std::auto_ptr<e::buffer>(msgs[i]));
+        }
+    }
+}
+
+void
+daemon :: send_if_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg)
+{
+    const paxos_group* group = get_config()->get_group(g);
+
+    if (!group || group->members_sz <= 0)
+    {
+        return;
+    }
+
+    if (idx < 0 || !is_durable(idx))
+    {
+        return;
+    }
+
+    send(*group, msg);
+}
+
+void
+daemon :: send_if_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg)
+{
+    e::buffer* m = msg.release();
+    send_if_durable(idx, &id, &m, 1);
+}
+
+void
+daemon :: send_if_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz)
+{
+    if (idx < 0 || !is_durable(idx))
+    {
+        for (size_t i = 0; i < sz; ++i)
+        {
+            delete msgs[i];
+        }
+
+        return;
+    }
+
+    for (size_t i = 0; i < sz; ++i)
+    {
+        send(ids[i], std::auto_ptr<e::buffer>(msgs[i]));
+    }
+}
+
+void
+daemon :: callback_when_durable(const std::string& entry, const transaction_group& tg, uint64_t seqno)
+{
+    int64_t x = append_to_log(entry);
+
+    if (x < 0)
+    {
+        return;
+    }
+
+    bool wake = false;
+    durable_shard* shard = durable_shard_for(x);
+
+    {
+        po6::threads::mutex::hold hold(&shard->mtx);
+        durable_cb d(x, tg, seqno);
+        shard->cbs.push_back(d);
+        std::push_heap(shard->cbs.begin(), shard->cbs.end());
+        wake = x <= shard->up_to;
+    }
+
+    if (wake)
+    {
+        m_log.wake();
+    }
+}
+
+daemon::durable_shard*
+daemon :: durable_shard_for(int64_t idx)
+{
+    assert(idx >= 0);
+    return &m_durable_shards[static_cast<uint64_t>(idx) % DURABLE_SHARDS];
+}
+
+bool
+daemon :: is_durable(int64_t idx)
+{
+    durable_shard* shard = durable_shard_for(idx);
+    po6::threads::mutex::hold hold(&shard->mtx);
+    return idx <= shard->up_to;
+}
+
+int64_t
+daemon :: append_to_log_once(const std::string& entry)
+{
+    // Retransmitted paxos messages make acceptors produce byte-identical
+    // entries; the first copy in the log already makes the response safe to
+    // send, so wait on that record instead of appending another.
+    e::compat::hash<std::string> h;
+    const size_t slot = h(entry) % LOGGED_ENTRIES;
+
+    {
+        po6::threads::mutex::hold hold(&m_logged_mtx);
+
+        if (m_logged_entries[slot].first >= 0 &&
+            m_logged_entries[slot].second == entry)
+        {
+            return m_logged_entries[slot].first;
+        }
+    }
+
+    int64_t x = append_to_log(entry);
+
+    if (x >= 0)
+    {
+        po6::threads::mutex::hold hold(&m_logged_mtx);
+        m_logged_entries[slot].first = x;
+        m_logged_entries[slot].second = entry;
+    }
+
+    return x;
+}
+
+struct daemon::log_pin
+{
+    log_pin() : recno(), epoch() {}
+    log_pin(int64_t r, uint64_t e) : recno(r), epoch(e) {}
+    log_pin(const log_pin& other) : recno(other.recno), epoch(other.epoch) {}
+    ~log_pin() throw () {}
+    log_pin& operator = (const log_pin& rhs)
+    {
+        // no self-assign check needed
+        recno = rhs.recno;
+        epoch = rhs.epoch;
+        return *this;
+    }
+    int64_t recno;
+    uint64_t epoch;
+};
+
+int64_t
+daemon :: append_to_log(const std::string& entry)
+{
+    log_entry_t t;
+    transaction_group tg;
+    e::unpacker up = e::unpacker(e::slice(entry.data(), entry.size())) >> t >> tg;
+
+    if (!up.error())
+    {
+        // pin before appending so that the pin never trails the record
+        po6::threads::mutex::hold hold(&m_log_pins_mtx);
+        ++m_log_pins_epoch;
+        log_pin_map_t::iterator it = m_log_pins.find(tg);
+
+        if (it == m_log_pins.end())
+        {
+            m_log_pins.insert(std::make_pair(tg, log_pin(m_log.next_recno(), m_log_pins_epoch)));
+        }
+        else
+        {
+            it->second.epoch = m_log_pins_epoch;
+        }
+    }
+
+    // everything that logs is a state machine that may need retransmits
+    if (!up.error())
+    {
+        schedule_pump(tg, po6::monotonic_time());
+    }
+
+    const uint64_t start = po6::monotonic_time();
+    int64_t recno = m_log.append(entry.data(), entry.size());
+    const uint64_t end = po6::monotonic_time();
+    m_stage_log.record(end - start);
+
+    if (recno >= 0)
+    {
+        std::vector<log_shipper::shipment> out;
+        m_shipper.ship(recno, entry, end, &out);
+        send_shipments(out);
+    }
+
+    return recno;
+}
+
+// Release the pins of transaction groups that no longer have any state and
+// let the log drop every sealed segment older than both the oldest remaining
+// pin and the oldest record not yet durable.  A group's pin is its first
+// record, and its state outlives the application of everything it logged.
+void
+daemon :: collect_log()
+{
+    int64_t lower_bound = m_log.durable();
+    std::vector<std::pair<transaction_group, uint64_t> > candidates;
+
+    {
+        po6::threads::mutex::hold hold(&m_log_pins_mtx);
+
+        for (log_pin_map_t::iterator it = m_log_pins.begin();
+                it != m_log_pins.end(); ++it)
+        {
+            candidates.push_back(std::make_pair(it->first, it->second.epoch));
+        }
+    }
+
+    std::vector<std::pair<transaction_group, uint64_t> > dead;
+
+    // state references must not be taken under m_log_pins_mtx; handlers
+    // append to the log while holding them
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const transaction_group& tg(candidates[i].first);
+        transaction_map_t::state_reference tsr;
+        local_voter_map_t::state_reference lvsr;
+        global_voter_map_t::state_reference gvsr;
+
+        if (!m_transactions.get_state(tg, &tsr) &&
+            !m_local_voters.get_state(tg, &lvsr) &&
+            !m_global_voters.get_state(tg, &gvsr))
+        {
+            dead.push_back(candidates[i]);
+        }
+    }
+
+    {
+        po6::threads::mutex::hold hold(&m_log_pins_mtx);
+
+        for (size_t i = 0; i < dead.size(); ++i)
+        {
+            log_pin_map_t::iterator it = m_log_pins.find(dead[i].first);
+
+            // an append since the snapshot means the group came back
+            if (it != m_log_pins.end() && it->second.epoch == dead[i].second)
+            {
+                m_log_pins.erase(it);
+            }
+        }
+
+        for (log_pin_map_t::iterator it = m_log_pins.begin();
+                it != m_log_pins.end(); ++it)
+        {
+            lower_bound = std::min(lower_bound, it->second.recno);
+        }
+    }
+
+    // a witness keeps the records of what it holds, and a standby keeps the
+    // records it holds for its primary
+    lower_bound = m_witnesses.retain(lower_bound);
+    m_shipper.collected(lower_bound);
+    m_log.collect(m_shipper.retain(lower_bound));
+}
+
+void
+daemon :: replay_callback(void* d, const unsigned char* entry, size_t entry_sz)
+{
+    static_cast<daemon*>(d)->replay(entry, entry_sz);
+}
+
+void
+daemon :: hold_callback(void* d, const unsigned char* entry, size_t entry_sz)
+{
+    static_cast<daemon*>(d)->m_shipper.hold(entry, entry_sz);
+}
+
+void
+daemon :: observe_kvs_load(comm_id id, e::unpacker up)
+{
+    uint8_t load;
+
+    // servers that predate load reporting end their responses early
+    if (up.remain() >= sizeof(uint8_t) && !(up >> load).error())
+    {
+        m_kvs_pressure.observe(id, load, po6::monotonic_time());
+    }
+}
+
+bool
+daemon :: admit_transaction()
+{
+    if (!m_admission.enabled())
+    {
+        return true;
+    }
+
+    const uint64_t now = po6::monotonic_time();
+
+    if (m_admission.stale(now))
+    {
+        m_admission.refresh(live_states(&m_transactions), durable_queue_depth(),
+                            m_kvs_pressure.mean(now));
+    }
+
+    return m_admission.admit();
+}
+
+size_t
+daemon :: durable_queue_depth()
+{
+    size_t depth = 0;
+
+    for (size_t i = 0; i < DURABLE_SHARDS; ++i)
+    {
+        po6::threads::mutex::hold hold(&m_durable_shards[i].mtx);
+        depth += m_durable_shards[i].cbs.size() + m_durable_shards[i].msgs.size();
+    }
+
+    return depth;
+}
+
+void
+daemon :: metrics_callback(void* d, std::ostream* out)
+{
+    static_cast<daemon*>(d)->metrics_report(out);
+}
+
+void
+daemon :: metrics_report(std::ostream* out)
+{
+    size_t cbs = 0;
+    size_t msgs = 0;
+
+    for (size_t i = 0; i < DURABLE_SHARDS; ++i)
+    {
+        po6::threads::mutex::hold hold(&m_durable_shards[i].mtx);
+        cbs += m_durable_shards[i].cbs.size();
+        msgs += m_durable_shards[i].msgs.size();
+    }
+
+    *out << "# TYPE consus_durable_queue gauge\n"
+         << "consus_durable_queue{kind=\"callbacks\"} " << cbs << "\n"
+         << "consus_durable_queue{kind=\"messages\"} " << msgs << "\n";
+    *out << "# TYPE consus_fsync_seconds histogram\n";
+    m_log.fsync_latency()->render(*out, "consus_fsync_seconds", "");
+    *out << "# TYPE consus_global_vote_seconds histogram\n";
+    m_global_votes_fast.render(*out, "consus_global_vote_seconds", "ballot=\"fast\"");
+    m_global_votes_classic.render(*out, "consus_global_vote_seconds", "ballot=\"classic\"");
+    *out << "# TYPE consus_stage_seconds histogram\n";
+    m_stage_network.render(*out, "consus_stage_seconds", "stage=\"network\"");
+    m_stage_queued.render(*out, "consus_stage_seconds", "stage=\"queued\"");
+    m_stage_execute.render(*out, "consus_stage_seconds", "stage=\"execute\"");
+    m_stage_log.render(*out, "consus_stage_seconds", "stage=\"log_append\"");
+    m_phases.render(*out);
+    m_costs.render(*out);
+
+    if (!m_stage_queues.empty())
+    {
+        *out << "# TYPE consus_stage_queue gauge\n";
+
+        for (size_t i = 0; i < m_stage_queues.size(); ++i)
+        {
+            *out << "consus_stage_queue{thread=\"" << i << "\"} " << m_stage_queues[i]->size() << "\n";
+        }
+    }
+
+    *out << "# TYPE consus_live_states gauge\n"
+         << "consus_live_states{table=\"transactions\"} " << live_states(&m_transactions) << "\n"
+         << "consus_live_states{table=\"local_voters\"} " << live_states(&m_local_voters) << "\n"
+         << "consus_live_states{table=\"global_voters\"} " << live_states(&m_global_voters) << "\n"
+         << "consus_live_states{table=\"readers\"} " << live_states(&m_readers) << "\n"
+         << "consus_live_states{table=\"writers\"} " << live_states(&m_writers) << "\n"
+         << "consus_live_states{table=\"lock_ops\"} " << live_states(&m_lock_ops) << "\n"
+         << "consus_live_states{table=\"scanners\"} " << live_states(&m_scanners) << "\n";
+    m_inflight.render(*out, INFLIGHT_REPORTED, po6::monotonic_time());
+    m_tables.render(*out);
+    m_replica_feed.render(*out, po6::monotonic_time());
+    alloc_stats::render(*out);
+}
+
+// Feed a recovered log entry back through the same state machines that
+// produced it.  Each handler re-logs what it accepts, so the new
+// incarnation's log is self-contained once replay completes.
+void
+daemon :: replay(const unsigned char* entry, size_t entry_sz)
+{
+    std::auto_ptr<e::buffer> backing(e::buffer::create(entry_sz));
+    memmove(backing->data(), entry, entry_sz);
+    backing->resize(entry_sz);
+    log_entry_t t = LOG_ENTRY_NOP;
+    transaction_group tg;
+    e::unpacker up = backing->unpack_from(0) >> t >> tg;
+
+    if (up.error())
+    {
+        LOG(ERROR) << "dropping corrupt log entry during replay";
+        return;
+    }
+
+    if (is_paxos_2a_log_entry(t))
+    {
+        uint64_t seqno = 0;
+        up = up >> seqno;
+
+        if (up.error())
+        {
+            LOG(ERROR) << "dropping corrupt paxos 2A log entry during replay";
+            return;
+        }
+
+        transaction_map_t::state_reference tsr;
+        transaction* xact = get_or_create_pumped(&m_transactions, tg, &tsr);
+        assert(xact);
+        xact->paxos_2a(seqno, t, up, backing, this);
+    }
+    else if (t == LOG_ENTRY_LOCAL_VOTE_1A ||
+             t == LOG_ENTRY_LOCAL_VOTE_2A ||
+             t == LOG_ENTRY_LOCAL_LEARN)
+    {
+        uint8_t idx = 0;
+        up = up >> idx;
+        paxos_synod::ballot b;
+        paxos_synod::pvalue p;
+        uint64_t v = 0;
+
+        if (t == LOG_ENTRY_LOCAL_VOTE_1A)
+        {
+            up = up >> b;
+        }
+        else if (t == LOG_ENTRY_LOCAL_VOTE_2A)
+        {
+            up = up >> p;
+        }
+        else
+        {
+            up = up >> v;
+        }
+
+        if (up.error())
+        {
+            LOG(ERROR) << "dropping corrupt local vote log entry during replay";
+            return;
+        }
+
+        local_voter_map_t::state_reference lvsr;
+        local_voter* lv = get_or_create_pumped(&m_local_voters, tg, &lvsr);
+        assert(lv);
+
+        if (t == LOG_ENTRY_LOCAL_VOTE_1A)
+        {
+            lv->vote_1a(b.leader, idx, b, this);
+        }
+        else if (t == LOG_ENTRY_LOCAL_VOTE_2A)
+        {
+            lv->vote_2a(p.b.leader, idx, p, this);
+        }
+        else
+        {
+            lv->vote_learn(idx, v, this);
+        }
+    }
+    else if (t == LOG_ENTRY_GLOBAL_PROPOSE ||
+             t == LOG_ENTRY_GLOBAL_VOTE_1A ||
+             t == LOG_ENTRY_GLOBAL_VOTE_2A)
+    {
+        global_voter_map_t::state_reference gvsr;
+        global_voter* gv = get_or_create_pumped(&m_global_voters, tg, &gvsr);
+        assert(gv);
+
+        if (t == LOG_ENTRY_GLOBAL_PROPOSE)
+        {
+            generalized_paxos::command c;
+            up = up >> c;
+
+            if (!up.error())
+            {
+                gv->propose(c, this);
+            }
+        }
+        else if (t == LOG_ENTRY_GLOBAL_VOTE_1A)
+        {
+            generalized_paxos::message_p1a m;
+            up = up >> m;
+
+            if (!up.error())
+            {
+                gv->process_p1a(comm_id(m.b.leader.get()), m, this);
+            }
+        }
+        else
+        {
+            generalized_paxos::message_p2a m;
+            up = up >> m;
+
+            if (!up.error())
+            {
+                gv->process_p2a(comm_id(m.b.leader.get()), m, this);
+            }
+        }
+
+        if (up.error())
+        {
+            LOG(ERROR) << "dropping corrupt global vote log entry during replay";
+        }
+    }
+    else if (t == LOG_ENTRY_WITNESS)
+    {
+        comm_id sender;
+        e::slice inner;
+        up = up >> sender >> inner;
+
+        if (up.error())
+        {
+            LOG(ERROR) << "dropping corrupt witness log entry during replay";
+            return;
+        }
+
+        witness(sender, tg, inner);
+    }
+}
+
+void
+daemon :: durable()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "durability monitor started";
+    int64_t x = -1;
+    // sample the log's latency by timing one pending record at a time
+    int64_t probe = -1;
+    uint64_t probe_start = 0;
+    std::vector<durable_msg> msgs;
+    std::vector<durable_cb> cbs;
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+
+    while (true)
+    {
+        m_gc.offline(&ts);
+        x = m_log.wait(x);
+        m_gc.online(&ts);
+
+        if (m_log.error() != 0)
+        {
+            if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+            {
+                break;
+            }
+
+            LOG(ERROR) << "durable log: " << po6::strerror(m_log.error());
+            e::atomic::increment_32_nobarrier(&s_interrupts, 2);
+            break;
+        }
+
+        const uint64_t now = po6::monotonic_time();
+
+        if (probe >= 0 && probe < x)
+        {
+            m_group_load.observe_log_latency(now - probe_start);
+            probe = -1;
+        }
+
+        if (probe < 0 && m_log.next_recno() > x)
+        {
+            probe = m_log.next_recno() - 1;
+            probe_start = now;
+        }
+
+        // a record also waits on the standby this daemon ships its log to
+        const int64_t released = m_shipper.gate(x);
+        ack_shipments(x, false);
+
+        // each shard is published and drained on its own, so producers only
+        // ever contend with the queue their record number hashes to
+        for (size_t s = 0; s < DURABLE_SHARDS; ++s)
+        {
+            durable_shard* shard = &m_durable_shards[s];
+            msgs.clear();
+            cbs.clear();
+
+            {
+                po6::threads::mutex::hold hold(&shard->mtx);
+                shard->up_to = released;
+
+                while (!shard->msgs.empty() &&
+                       shard->msgs[0].recno < released)
+                {
+                    msgs.push_back(shard->msgs[0]);
+                    std::pop_heap(shard->msgs.begin(), shard->msgs.end());
+                    shard->msgs.pop_back();
+                }
+
+                while (!shard->cbs.empty() &&
+                       shard->cbs[0].recno < released)
+                {
+                    cbs.push_back(shard->cbs[0]);
+                    std::pop_heap(shard->cbs.begin(), shard->cbs.end());
+                    shard->cbs.pop_back();
+                }
+            }
+
+            for (size_t i = 0; i < msgs.size(); ++i)
+            {
+                std::auto_ptr<e::buffer> msg(msgs[i].msg);
+                send(msgs[i].client, msg);
+            }
+
+            for (size_t i = 0; i < cbs.size(); ++i)
+            {
+                transaction_map_t::state_reference tsr;
+                transaction* xact = m_transactions.get_state(cbs[i].tg, &tsr);
+
+                if (xact)
+                {
+                    xact->callback_durable(cbs[i].seqno, this);
+                }
+            }
+        }
+
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "durability monitor shutting down";
+}
+
+void
+daemon :: pump()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "pumping thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    uint64_t last_sweep = po6::monotonic_time();
+
+    while (true)
+    {
+        m_gc.offline(&ts);
+        po6::sleep(PUMP_TICK);
+        m_gc.online(&ts);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        const uint64_t now = po6::monotonic_time();
+
+        // every state machine is on the queue from the moment it's created
+        // and stays there while it exists, so only the due ones are touched
+        if (last_sweep + PUMP_SWEEP_INTERVAL <= now)
+        {
+            last_sweep = now;
+            collect_dispositions(now);
+            const size_t swept = m_witnesses.sweep(now);
+
+            if (swept > 0)
+            {
+                LOG_IF(INFO, s_debug_mode) << "dropped " << swept << " witnessed messages nobody finished";
+            }
+        }
+
+        std::vector<transaction_group> due;
+        m_pump_queue.due(now, &due);
+
+        for (size_t i = 0; i < due.size(); ++i)
+        {
+            // hand the group to the thread that owns it; a full queue means
+            // that thread is behind, so pump here rather than wait on it
+            if (!m_stage_queues.empty() &&
+                m_stage_queues[stage_owner(due[i])]->try_push(staged_msg(due[i], now)))
+            {
+                continue;
+            }
+
+            if (pump_one(due[i]))
+            {
+                schedule_pump(due[i], now);
+            }
+        }
+
+        collect_log();
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "pumping thread shutting down";
+}
+
+void
+daemon :: coalesce()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "coalescing thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+
+    while (true)
+    {
+        m_gc.offline(&ts);
+        po6::sleep(m_coalescer.window());
+        m_gc.online(&ts);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        coalescer::outbox_t ready;
+        m_coalescer.expired(po6::monotonic_time(), &ready);
+        transmit_now(&ready);
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "coalescing thread shutting down";
+}
+
+void
+daemon :: flush_votes(paxos_group_id g)
+{
+    vote_pipeline::batch_map_t batches;
+    m_vote_pipeline.take(g, &batches);
+    flush_votes(&batches);
+}
+
+void
+daemon :: flush_votes(vote_pipeline::batch_map_t* batches)
+{
+    for (vote_pipeline::batch_map_t::iterator it = batches->begin();
+            it != batches->end(); ++it)
+    {
+        const std::vector<vote_pipeline::vote>& votes(it->second);
+        std::auto_ptr<e::buffer> msg;
+
+        if (votes.empty())
+        {
+            continue;
+        }
+        else if (votes.size() == 1)
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(LV_VOTE_2A)
+                            + pack_size(votes[0]);
+            msg.reset(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << LV_VOTE_2A << votes[0];
+        }
+        else
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(LV_VOTE_2A_BATCH)
+                            + pack_size(votes);
+            msg.reset(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << LV_VOTE_2A_BATCH << votes;
+        }
+
+        send(it->first, msg);
+    }
+}
+
+void
+daemon :: pipeline_votes()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "vote pipeline thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+
+    while (true)
+    {
+        m_gc.offline(&ts);
+        po6::sleep(m_vote_pipeline.window());
+        m_gc.online(&ts);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        vote_pipeline::batch_map_t batches;
+        m_vote_pipeline.take_all(&batches);
+        flush_votes(&batches);
+        coalescer::outbox_t ready;
+        m_vote_aggregator.expired(po6::monotonic_time(), &ready);
+        transmit_now(&ready);
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "vote pipeline thread shutting down";
+}
+
+void
+daemon :: pipeline_commits()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "commit pipeline thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+
+    while (true)
+    {
+        m_gc.offline(&ts);
+        po6::sleep(m_commit_pipeline.window());
+        m_gc.online(&ts);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        coalescer::outbox_t ready;
+        m_commit_pipeline.expired(po6::monotonic_time(), &ready);
+        transmit_now(&ready);
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "commit pipeline thread shutting down";
+}
+
+void
+daemon :: schedule_wan()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "WAN pacing thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+
+    while (true)
+    {
+        m_gc.offline(&ts);
+        po6::sleep(PO6_MILLIS);
+        m_gc.online(&ts);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        coalescer::outbox_t ready;
+        m_wan.dequeue(po6::monotonic_time(), &ready);
+
+        for (size_t i = 0; i < ready.size(); ++i)
+        {
+            std::auto_ptr<e::buffer> msg(ready[i].second);
+            send(ready[i].first, msg);
+        }
+
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "WAN pacing thread shutting down";
+}
+
+void
+daemon :: renew_leases()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    LOG(INFO) << "read lease thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+    // renew four times a lease, so that one lost round does not let it lapse
+    const uint64_t interval = std::max<uint64_t>(m_leases.duration() / 4, PO6_MILLIS);
+
+    while (true)
+    {
+        m_gc.offline(&ts);
+        po6::sleep(interval);
+        m_gc.online(&ts);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
 
-void
-daemon :: send_when_durable(const std::string& entry, const comm_id* ids, e::buffer** msgs, size_t sz)
-{
-    int64_t x = m_log.append(entry.data(), entry.size());
-    send_when_durable(x, ids, msgs, sz);
+        const configuration* c = get_config();
+        const std::vector<paxos_group_id>& gs(c->groups_for(m_us.id));
+
+        for (size_t i = 0; i < gs.size(); ++i)
+        {
+            const paxos_group* group = c->get_group(gs[i]);
+
+            // the first member leads, as the global voter assumes
+            if (!group || group->members_sz == 0 || group->members[0] != m_us.id)
+            {
+                continue;
+            }
+
+            const uint64_t nonce = m_leases.request(gs[i], po6::monotonic_time());
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(TXMAN_LEASE_REQUEST)
+                            + pack_size(gs[i])
+                            + sizeof(uint64_t);
+            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_LEASE_REQUEST << gs[i] << nonce;
+            send(*group, msg);
+        }
+
+        m_gc.quiescent_state(&ts);
+    }
+
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "read lease thread shutting down";
 }
 
 void
-daemon :: send_when_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg)
+daemon :: report_group_load()
 {
-    const paxos_group* group = get_config()->get_group(g);
+    sigset_t ss;
 
-    if (!group || group->members_sz <= 0)
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
     {
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
         return;
     }
 
-    e::buffer* msgs[CONSUS_MAX_REPLICATION_FACTOR];
-    msgs[0] = msg.release();
+    LOG(INFO) << "group load thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
 
-    for (size_t i = 1; i < group->members_sz; ++i)
+    while (true)
     {
-        msgs[i] = msgs[0]->copy();
+        m_gc.offline(&ts);
+        po6::sleep(GROUP_LOAD_INTERVAL);
+        m_gc.online(&ts);
+
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
+        {
+            break;
+        }
+
+        std::map<paxos_group_id, uint64_t> inflight;
+
+        for (transaction_map_t::iterator it(&m_transactions); it.valid(); ++it)
+        {
+            ++inflight[(*it)->state_key().group];
+        }
+
+        const uint64_t log_latency = m_group_load.log_latency();
+        const configuration* c = get_config();
+        const std::vector<paxos_group_id>& gs(c->groups_for(m_us.id));
+
+        for (size_t i = 0; i < gs.size(); ++i)
+        {
+            const paxos_group* group = c->get_group(gs[i]);
+
+            if (!group)
+            {
+                continue;
+            }
+
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(TXMAN_GROUP_LOAD)
+                            + pack_size(gs[i])
+                            + 2 * sizeof(uint64_t);
+            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_GROUP_LOAD << gs[i]
+                                              << inflight[gs[i]] << log_latency;
+            send(*group, msg);
+        }
+
+        m_gc.quiescent_state(&ts);
     }
 
-    send_when_durable(idx, group->members, msgs, group->members_sz);
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "group load thread shutting down";
 }
 
 void
-daemon :: send_when_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg)
+daemon :: ship_log()
 {
-    e::buffer* m = msg.release();
-    send_when_durable(idx, &id, &m, 1);
-}
+    sigset_t ss;
 
-void
-daemon :: send_when_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz)
-{
-    if (idx < 0)
+    if (sigfillset(&ss) < 0 ||
+        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
     {
-        for (size_t i = 0; i < sz; ++i)
-        {
-            delete msgs[i];
-        }
-
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
         return;
     }
 
-    bool send_now = false;
+    LOG(INFO) << "log shipping thread started";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
 
+    while (true)
     {
-        po6::threads::mutex::hold hold(&m_durable_mtx);
-        send_now = idx <= m_durable_up_to;
+        m_gc.offline(&ts);
+        po6::sleep(LOG_SHIP_INTERVAL);
+        m_gc.online(&ts);
 
-        if (!send_now)
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
         {
-            for (size_t i = 0; i < sz; ++i)
+            break;
+        }
+
+        std::vector<log_shipper::shipment> out;
+        comm_id standby;
+        uint64_t epoch = 0;
+        log_shipper::action_t action = m_shipper.tick(po6::monotonic_time(), &out, &standby, &epoch);
+        send_shipments(out);
+
+        if (action == log_shipper::SHIP_REPORT_SYNCED ||
+            action == log_shipper::SHIP_REPORT_UNSYNCED)
+        {
+            const bool synced = action == log_shipper::SHIP_REPORT_SYNCED;
+            std::string input;
+            e::packer(&input) << m_us.id << standby << e::pack_uint8<bool>(synced);
+            coordinator_returncode rc;
+
+            // until the coordinator hears it, a lagging standby stays
+            // attached, and holds back what this daemon releases
+            if (m_coord->call("txman_standby_synced", input.data(), input.size(), &rc))
             {
-                durable_msg d(idx, ids[i], msgs[i]);
-                m_durable_msgs.push_back(d);
-                std::push_heap(m_durable_msgs.begin(), m_durable_msgs.end());
+                if (synced && rc == COORD_SUCCESS)
+                {
+                    LOG(INFO) << "warm standby " << standby << " is synced";
+                    m_shipper.synced(epoch);
+                }
+                else if (!synced)
+                {
+                    LOG(WARNING) << "warm standby " << standby << " fell behind; attaching it afresh";
+                    m_shipper.detach(epoch);
+                }
             }
         }
+
+        m_gc.quiescent_state(&ts);
     }
 
-    if (send_now)
+    m_gc.deregister_thread(&ts);
+    LOG(INFO) << "log shipping thread shutting down";
+}
+
+void
+daemon :: send_shipments(const std::vector<log_shipper::shipment>& out)
+{
+    for (size_t i = 0; i < out.size(); ++i)
     {
-        for (size_t i = 0; i < sz; ++i)
-        {
-            send(ids[i], std::auto_ptr<e::buffer>(msgs[i]));
-        }
+        const log_shipper::shipment& s(out[i]);
+        const e::slice entry(s.entry);
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(TXMAN_LOG_SHIP)
+                        + sizeof(uint64_t)
+                        + 3 * sizeof(int64_t)
+                        + pack_size(entry);
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_LOG_SHIP
+                                          << s.epoch << s.start << s.collected
+                                          << s.recno << entry;
+        send(s.to, msg);
     }
 }
 
 void
-daemon :: send_if_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg)
+daemon :: ack_shipments(int64_t durable, bool force)
 {
-    const paxos_group* group = get_config()->get_group(g);
+    comm_id to;
+    uint64_t epoch;
+    int64_t upto;
 
-    if (!group || group->members_sz <= 0)
+    if (!m_shipper.ack(durable, force, &to, &epoch, &upto))
     {
         return;
     }
 
-    e::buffer* msgs[CONSUS_MAX_REPLICATION_FACTOR];
-    msgs[0] = msg.release();
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(TXMAN_LOG_SHIP_ACK)
+                    + sizeof(uint64_t)
+                    + sizeof(int64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_LOG_SHIP_ACK << epoch << upto;
+    send(to, msg);
+}
 
-    for (size_t i = 1; i < group->members_sz; ++i)
+void
+daemon :: promote()
+{
+    std::vector<std::string> entries;
+    m_shipper.take(&entries);
+    LOG(INFO) << "swapped in for our primary; replaying " << entries.size() << " held entries";
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+
+    for (size_t i = 0; i < entries.size(); ++i)
     {
-        msgs[i] = msgs[0]->copy();
+        replay(reinterpret_cast<const unsigned char*>(entries[i].data()), entries[i].size());
     }
 
-    send_if_durable(idx, group->members, msgs, group->members_sz);
+    m_gc.deregister_thread(&ts);
 }
 
 void
-daemon :: send_if_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg)
+daemon :: witness(comm_id sender, const transaction_group& tg, const e::slice& inner)
 {
-    e::buffer* m = msg.release();
-    send_if_durable(idx, &id, &m, 1);
-}
+    const uint64_t now = po6::monotonic_time();
+    const paxos_group* g = get_config()->get_group(tg.group);
 
-void
-daemon :: send_if_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz)
-{
-    bool should_send = false;
-    m_durable_mtx.lock();
-    should_send = idx <= m_durable_up_to;
-    m_durable_mtx.unlock();
+    if (g && g->index(m_us.id) < g->members_sz)
+    {
+        redispatch_witnessed(witness_store::message(tg, sender, inner, now));
+        return;
+    }
 
-    if (idx < 0 || !should_send)
+    if (!g || g->witness_index(m_us.id) >= g->witnesses_sz)
     {
-        for (size_t i = 0; i < sz; ++i)
-        {
-            delete msgs[i];
-        }
+        LOG_IF(INFO, s_debug_mode) << transaction_group::log(tg) << " dropping message from " << sender
+                                   << " for a group this daemon does not witness";
+        return;
+    }
+
+    std::string entry;
+    e::packer(&entry) << LOG_ENTRY_WITNESS << tg << sender << inner;
 
+    const int64_t recno = append_to_log(entry);
+
+    if (recno < 0)
+    {
+        LOG(ERROR) << "could not log witnessed message: " << po6::strerror(m_log.error());
         return;
     }
 
-    for (size_t i = 0; i < sz; ++i)
+    m_witnesses.hold(tg, sender, inner, recno, now);
+
+    // the configuration that promotes us may have been installed, and the
+    // held messages taken, between the check above and the hold
+    if (get_config()->is_member(tg.group, m_us.id))
     {
-        send(ids[i], std::auto_ptr<e::buffer>(msgs[i]));
+        promote_witnessed(tg.group);
     }
 }
 
-struct daemon::durable_cb
+void
+daemon :: witnesses_changed()
 {
-    durable_cb() : recno(), tg(), seqno() {}
-    durable_cb(int64_t r, transaction_group t, uint64_t s) : recno(r), tg(t), seqno(s) {}
-    durable_cb(const durable_cb& other)
-        : recno(other.recno), tg(other.tg), seqno(other.seqno) {}
-    ~durable_cb() throw () {}
-    durable_cb& operator = (const durable_cb& rhs)
+    const configuration* c = get_config();
+    std::vector<paxos_group_id> gs;
+    m_witnesses.groups(&gs);
+    e::garbage_collector::thread_state ts;
+    m_gc.register_thread(&ts);
+
+    for (size_t i = 0; i < gs.size(); ++i)
     {
-        // no self-assign check needed
-        recno = rhs.recno;
-        tg = rhs.tg;
-        seqno = rhs.seqno;
-        return *this;
+        const paxos_group* g = c->get_group(gs[i]);
+
+        if (g && g->index(m_us.id) < g->members_sz)
+        {
+            promote_witnessed(gs[i]);
+        }
+        else if (!g || g->witness_index(m_us.id) >= g->witnesses_sz)
+        {
+            std::vector<witness_store::message> msgs;
+            m_witnesses.take(gs[i], &msgs);
+            LOG(INFO) << "no longer witnessing " << gs[i] << "; dropping "
+                      << msgs.size() << " held messages";
+        }
     }
-    bool operator < (const durable_cb& rhs) { return rhs.recno > recno; }
-    int64_t recno;
-    transaction_group tg;
-    uint64_t seqno;
-};
+
+    m_gc.deregister_thread(&ts);
+}
 
 void
-daemon :: callback_when_durable(const std::string& entry, const transaction_group& tg, uint64_t seqno)
+daemon :: promote_witnessed(paxos_group_id g)
 {
-    int64_t x = m_log.append(entry.data(), entry.size());
+    std::vector<witness_store::message> msgs;
+    m_witnesses.take(g, &msgs);
 
-    if (x < 0)
+    if (msgs.empty())
     {
         return;
     }
 
-    bool wake = false;
+    LOG(INFO) << "promoted from witness to member of " << g
+              << "; replaying " << msgs.size() << " held messages";
 
+    for (size_t i = 0; i < msgs.size(); ++i)
     {
-        po6::threads::mutex::hold hold(&m_durable_mtx);
-        durable_cb d(x, tg, seqno);
-        m_durable_cbs.push_back(d);
-        std::push_heap(m_durable_cbs.begin(), m_durable_cbs.end());
-        wake = x <= m_durable_up_to;
+        redispatch_witnessed(msgs[i]);
     }
+}
 
-    if (wake)
+// The held message goes through dispatch as though it came from the leader
+// only now; the handlers already tolerate duplicates and late arrivals.
+void
+daemon :: redispatch_witnessed(const witness_store::message& m)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE + m.inner.size();
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    memmove(msg->data() + BUSYBEE_HEADER_SIZE, m.inner.data(), m.inner.size());
+    msg->resize(sz);
+    network_msgtype mt = CONSUS_NOP;
+    e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE) >> mt;
+
+    if (up.error() || (mt != TXMAN_PAXOS_2A_BATCH && mt != COMMIT_RECORD &&
+                       mt != COMMIT_RECORD_CHUNK))
     {
-        m_log.wake();
+        LOG(ERROR) << transaction_group::log(m.tg) << " dropping corrupt witnessed message";
+        return;
     }
+
+    dispatch(m.sender, mt, msg, up);
 }
 
 void
-daemon :: durable()
+daemon :: feed_replicas()
 {
     sigset_t ss;
 
@@ -1764,125 +4963,118 @@ daemon :: durable()
         return;
     }
 
-    LOG(INFO) << "durability monitor started";
-    int64_t x = -1;
+    LOG(INFO) << "read replica feed thread started";
     e::garbage_collector::thread_state ts;
     m_gc.register_thread(&ts);
 
     while (true)
     {
         m_gc.offline(&ts);
-        x = m_log.wait(x);
+        po6::sleep(REPLICA_FEED_INTERVAL);
         m_gc.online(&ts);
 
-        if (m_log.error() != 0)
+        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
         {
-            if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
-            {
-                break;
-            }
-
-            LOG(ERROR) << "durable log: " << po6::strerror(m_log.error());
-            e::atomic::increment_32_nobarrier(&s_interrupts, 2);
             break;
         }
 
-        std::vector<durable_msg> msgs;
-        std::vector<durable_cb> cbs;
+        std::vector<replica_feed::write> out;
+        m_replica_feed.due(po6::monotonic_time(), &out);
+        configuration* c = get_config();
 
+        for (size_t i = 0; i < out.size(); ++i)
         {
-            po6::threads::mutex::hold hold(&m_durable_mtx);
-            m_durable_up_to = x;
-
-            while (!m_durable_msgs.empty() &&
-                   m_durable_msgs[0].recno < x)
+            const replica_feed::write& w(out[i]);
+            const e::slice table(w.table);
+            const e::slice key(w.key);
+            const e::slice value(w.value);
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(KVS_REP_WR)
+                            + sizeof(uint64_t)
+                            + sizeof(uint8_t)
+                            + pack_size(table)
+                            + pack_size(key)
+                            + sizeof(uint64_t)
+                            + pack_size(value);
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE)
+                << KVS_REP_WR << w.nonce << uint8_t(0) << table << key << w.timestamp << value;
+            comm_id kvs = c->choose_kvs(w.dc, table, key, w.nonce, m_us, &m_kvs_pressure);
+
+            if (kvs != comm_id())
             {
-                msgs.push_back(m_durable_msgs[0]);
-                std::pop_heap(m_durable_msgs.begin(), m_durable_msgs.end());
-                m_durable_msgs.pop_back();
-            }
-
-            while (!m_durable_cbs.empty() &&
-                   m_durable_cbs[0].recno < x)
-            {
-                cbs.push_back(m_durable_cbs[0]);
-                std::pop_heap(m_durable_cbs.begin(), m_durable_cbs.end());
-                m_durable_cbs.pop_back();
+                send_bulk(kvs, wan_scheduler::VALUES, msg);
             }
         }
 
-        for (size_t i = 0; i < msgs.size(); ++i)
-        {
-            std::auto_ptr<e::buffer> msg(msgs[i].msg);
-            send(msgs[i].client, msg);
-        }
+        // fill the feed's gaps with each key's newest version, read from
+        // this data center's key-value stores
+        std::vector<replica_feed::resync> resyncs;
+        m_replica_feed.due_resyncs(po6::monotonic_time(), &resyncs);
 
-        for (size_t i = 0; i < cbs.size(); ++i)
+        for (size_t i = 0; i < resyncs.size(); ++i)
         {
-            transaction_map_t::state_reference tsr;
-            transaction* xact = m_transactions.get_state(cbs[i].tg, &tsr);
-
-            if (xact)
-            {
-                xact->callback_durable(cbs[i].seqno, this);
-            }
+            const e::slice table(resyncs[i].table);
+            const e::slice key(resyncs[i].key);
+            read_map_t::state_reference sr;
+            kvs_read* kv = create_read(&sr, transaction_group(), false);
+            kv->callback_feed(resyncs[i].dc, table, key);
+            kv->read(table, key, UINT64_MAX, this);
         }
 
         m_gc.quiescent_state(&ts);
     }
 
     m_gc.deregister_thread(&ts);
-    LOG(INFO) << "durability monitor shutting down";
+    LOG(INFO) << "read replica feed thread shutting down";
 }
 
 void
-daemon :: pump()
+daemon :: schedule_pump(const transaction_group& tg, uint64_t now)
 {
-    sigset_t ss;
-
-    if (sigfillset(&ss) < 0 ||
-        pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
-    {
-        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
-        return;
-    }
+    // the limiters retransmit only once strictly more than resend_interval
+    // has passed; give them a tick of slack
+    m_pump_queue.schedule(tg, now + m_rtt.shortest() + PUMP_TICK);
+}
 
-    LOG(INFO) << "pumping thread started";
-    e::garbage_collector::thread_state ts;
-    m_gc.register_thread(&ts);
+// Work every state machine belonging to tg.  Returns false once none remain.
+bool
+daemon :: pump_one(const transaction_group& tg)
+{
+    bool found = false;
 
-    while (true)
     {
-        m_gc.offline(&ts);
-        po6::sleep(PO6_MILLIS * 250);
-        m_gc.online(&ts);
-
-        if (e::atomic::increment_32_nobarrier(&s_interrupts, 0) > 0)
-        {
-            break;
-        }
+        transaction_map_t::state_reference tsr;
+        transaction* xact = m_transactions.get_state(tg, &tsr);
 
-        for (transaction_map_t::iterator it(&m_transactions); it.valid(); ++it)
+        if (xact)
         {
-            transaction* xact = *it;
             xact->externally_work_state_machine(this);
+            found = true;
         }
+    }
+
+    {
+        local_voter_map_t::state_reference lvsr;
+        local_voter* lv = m_local_voters.get_state(tg, &lvsr);
 
-        for (local_voter_map_t::iterator it(&m_local_voters); it.valid(); ++it)
+        if (lv)
         {
-            local_voter* lv = *it;
             lv->externally_work_state_machine(this);
+            found = true;
         }
+    }
+
+    {
+        global_voter_map_t::state_reference gvsr;
+        global_voter* gv = m_global_voters.get_state(tg, &gvsr);
 
-        for (global_voter_map_t::iterator it(&m_global_voters); it.valid(); ++it)
+        if (gv)
         {
-            global_voter* gv = *it;
             gv->externally_work_state_machine(this);
+            found = true;
         }
-
-        m_gc.quiescent_state(&ts);
     }
 
-    m_gc.deregister_thread(&ts);
-    LOG(INFO) << "pumping thread shutting down";
+    return found;
 }
@@ -30,11 +30,15 @@
 
 // STL
 #include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
 #include <string>
 
 // po6
 #include <po6/net/location.h>
 #include <po6/threads/thread.h>
+#include <po6/time.h>
 
 // e
 #include <e/compat.h>
@@ -50,21 +54,46 @@
 
 // consus
 #include "namespace.h"
+#include "common/bounded_queue.h"
+#include "common/coalescer.h"
+#include "common/compactor.h"
+#include "common/compressor.h"
 #include "common/coordinator_link.h"
+#include "common/deadline_queue.h"
+#include "common/metrics.h"
+#include "common/rtt_estimator.h"
+#include "common/table_stats.h"
+#include "common/tracer.h"
+#include "common/transport.h"
 #include "common/ids.h"
 #include "common/network_msgtype.h"
 #include "common/transaction_id.h"
 #include "common/transaction_group.h"
 #include "common/txman.h"
+#include "txman/admission_control.h"
 #include "txman/configuration.h"
 #include "txman/controller.h"
 #include "txman/durable_log.h"
 #include "txman/global_voter.h"
+#include "txman/group_lease.h"
+#include "txman/group_load.h"
+#include "txman/hybrid_clock.h"
+#include "txman/inflight.h"
 #include "txman/kvs_lock_op.h"
+#include "txman/kvs_pressure.h"
 #include "txman/kvs_read.h"
+#include "txman/kvs_scan.h"
 #include "txman/kvs_write.h"
 #include "txman/local_voter.h"
+#include "txman/log_shipper.h"
+#include "txman/message_cost.h"
+#include "txman/phase_latency.h"
+#include "txman/read_flights.h"
+#include "txman/replica_feed.h"
 #include "txman/transaction.h"
+#include "txman/vote_pipeline.h"
+#include "txman/wan_scheduler.h"
+#include "txman/witness_store.h"
 
 BEGIN_CONSUS_NAMESPACE
 
@@ -85,47 +114,116 @@ class daemon
                 bool set_coordinator,
                 const char* coordinator,
                 const char* data_center,
-                unsigned threads);
+                const char* zone,
+                const char* rack,
+                unsigned threads,
+                unsigned stage_threads,
+                uint64_t resend_default,
+                bool sync_writes,
+                bool pmem_log,
+                bool pin_threads,
+                uint64_t busy_poll,
+                uint64_t coalesce_window,
+                bool compress_wan,
+                const char* wan_dictionary,
+                bool compact_messages,
+                const char* intra_dc_transport,
+                uint16_t metrics_port,
+                const char* trace_file,
+                uint64_t trace_sample,
+                uint64_t commit_digest_threshold,
+                uint64_t wan_bulk_bytes_per_second,
+                uint64_t admit_transactions,
+                uint64_t admit_durable_queue,
+                uint64_t admit_kvs_latency,
+                uint64_t vote_pipeline_window,
+                uint64_t commit_pipeline_window,
+                uint64_t slow_transaction_threshold,
+                uint64_t transaction_timeout,
+                uint64_t read_lease,
+                uint64_t max_clock_drift_ppm,
+                bool early_lock_release,
+                bool balance_groups,
+                comm_id standby_for,
+                const std::vector<std::string>& log_dirs,
+                const std::vector<std::string>& optimistic_tables);
 
     private:
         struct coordinator_callback;
         struct durable_msg;
         struct durable_cb;
+        struct durable_shard;
+        struct staged_msg;
+        typedef bounded_queue<staged_msg> stage_queue_t;
         typedef e::state_hash_table<uint64_t, kvs_read> read_map_t;
         typedef e::state_hash_table<uint64_t, kvs_write> write_map_t;
         typedef e::state_hash_table<uint64_t, kvs_lock_op> lock_op_map_t;
+        typedef e::state_hash_table<uint64_t, kvs_scan> scan_map_t;
         typedef e::state_hash_table<transaction_group, transaction> transaction_map_t;
         typedef e::state_hash_table<transaction_group, local_voter> local_voter_map_t;
         typedef e::state_hash_table<transaction_group, global_voter> global_voter_map_t;
         typedef e::nwf_hash_map<transaction_group, uint64_t, transaction_group::hash> disposition_map_t;
         typedef std::vector<durable_msg> durable_msg_heap_t;
         typedef std::vector<durable_cb> durable_cb_heap_t;
+        struct log_pin;
+        typedef std::map<transaction_group, log_pin> log_pin_map_t;
+        typedef std::deque<std::pair<uint64_t, transaction_group> > disposition_queue_t;
+        typedef std::map<paxos_group_id, uint64_t> disposition_watermark_map_t;
         friend class controller;
         friend class transaction;
         friend class local_voter;
         friend class global_voter;
+        friend class kvs_lock_batch;
         friend class kvs_lock_op;
         friend class kvs_read;
+        friend class kvs_scan;
         friend class kvs_write;
 
     private:
         void loop(size_t thread);
+        // the state machine stage; each thread owns the transaction groups
+        // that stage_for maps to it
+        void stage(size_t thread);
+        size_t stage_for(comm_id id, network_msgtype mt, e::unpacker up);
+        size_t stage_owner(const transaction_group& tg);
+        // the one transaction a message is about, if it names one
+        static bool transaction_of(network_msgtype mt, e::unpacker up, transaction_group* tg);
+        void dispatch(comm_id id, network_msgtype mt, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_begin(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_read(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_write(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_cond_write(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_multi(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_scan(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_read_stale(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_single(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_commit(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_abort(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_wound(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_hold_lock(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_finished(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_lease_request(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_lease_grant(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_group_load(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_log_ship(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_log_ship_ack(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_witness(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_witness_forget(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_paxos_2a(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_paxos_2b(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_paxos_2a_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_paxos_2b_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_lv_vote_1a(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_lv_vote_1b(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_lv_vote_2a(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_lv_vote_2b(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_lv_vote_learn(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_lv_vote_2a_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_lv_vote_2b_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_commit_record(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_commit_record_chunk(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_commit_values(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_commit_values_ack(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_gv_outcome(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_gv_propose(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_gv_vote_1a(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
@@ -135,22 +233,72 @@ class daemon
         void process_kvs_rep_rd_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_kvs_rep_wr_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
         void process_kvs_lock_op_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
-        kvs_read* create_read(read_map_t::state_reference* sr);
-        kvs_write* create_write(write_map_t::state_reference* sr);
-        kvs_lock_op* create_lock_op(lock_op_map_t::state_reference* sr);
+        void process_kvs_lock_op_batch_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_kvs_rep_scan_resp(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_batch(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_compressed(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        void process_compact(comm_id id, std::auto_ptr<e::buffer> msg, e::unpacker up);
+        // traced operations tag their nonce so the key-value store traces too;
+        // the nonce also names the stage that owns tg, to route the response
+        kvs_read* create_read(read_map_t::state_reference* sr,
+                              const transaction_group& tg, bool traced);
+        // read the newest version of table/key at or before timestamp for
+        // tg, riding on a read of the same version already in flight if
+        // there is one; returns the nonce of the read tg waits upon
+        uint64_t pinned_read(const transaction_group& tg, uint64_t seqno,
+                             void (transaction::*func)(consus_returncode,
+                                                       uint64_t,
+                                                       const e::slice&,
+                                                       uint64_t, daemon*),
+                             const e::slice& table, const e::slice& key,
+                             uint64_t timestamp);
+        kvs_write* create_write(write_map_t::state_reference* sr,
+                                const transaction_group& tg, bool traced);
+        kvs_lock_op* create_lock_op(lock_op_map_t::state_reference* sr,
+                                    const transaction_group& tg, bool traced);
+        kvs_scan* create_scan(scan_map_t::state_reference* sr);
 
     public:
         configuration* get_config();
         void debug_dump();
         uint64_t generate_nonce();
-        transaction_id generate_txid();
-        uint64_t resend_interval() { return PO6_SECONDS; }
+        uint64_t generate_owned_nonce(const transaction_group& tg);
+        // priority is a start to keep from an earlier attempt, or 0
+        transaction_id generate_txid(uint64_t priority);
+        // tables whose transactions lock only to validate at prepare
+        bool optimistic(const e::slice& table);
+        // for messages to several peers at once
+        uint64_t resend_interval() { return m_rtt.timeout(); }
+        uint64_t resend_interval(comm_id id) { return m_rtt.timeout(id); }
+        void observe_rtt(comm_id id, uint64_t rtt) { m_rtt.sample(id, rtt); }
+        void observe_kvs_latency(uint64_t nanos) { m_admission.observe_kvs_latency(nanos); }
+        // responses from key-value stores may end with their load
+        void observe_kvs_load(comm_id id, e::unpacker up);
+        // false if the client should be told to back off instead
+        bool admit_transaction();
+        size_t durable_queue_depth();
+        // commit records carry only a digest of values at least this large
+        uint64_t commit_digest_threshold() { return m_commit_digest_threshold; }
+        // transactions that take this long are logged step by step; 0 if not
+        uint64_t slow_transaction_threshold() { return m_slow_transaction_threshold; }
+        // executing transactions whose client is silent this long abort; 0
+        // if they never do
+        uint64_t transaction_timeout() { return m_transaction_timeout; }
         bool transaction_guard(const transaction_id& txid, comm_id id);
         bool transaction_guard(const transaction_group& tg, comm_id id);
+        // dispositions are retained for DISPOSITION_RETENTION after they are
+        // recorded and then reclaimed, but never while an older transaction
+        // of the same group is still running here; afterwards messages for
+        // transactions the watermark has passed are dropped rather than
+        // resurrecting them
+        void disposition_recorded(const transaction_group& tg);
+        void collect_dispositions(uint64_t now);
         bool send(comm_id id, std::auto_ptr<e::buffer> msg);
+        // like send, but paced behind votes when id is in another data center
+        bool send_bulk(comm_id id, wan_scheduler::traffic_class tc, std::auto_ptr<e::buffer> msg);
         unsigned send(paxos_group_id g, std::auto_ptr<e::buffer> msg);
         unsigned send(const paxos_group& g, std::auto_ptr<e::buffer> msg);
-        // XXX next two might cause excessive logging; investigate
+        // the next two reuse the log record of a recent identical entry
         void send_when_durable(const std::string& entry, comm_id id, std::auto_ptr<e::buffer> msg);
         void send_when_durable(const std::string& entry, const comm_id* ids, e::buffer** msgs, size_t sz);
         void send_when_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg);
@@ -159,43 +307,235 @@ class daemon
         void send_if_durable(int64_t idx, paxos_group_id g, std::auto_ptr<e::buffer> msg);
         void send_if_durable(int64_t idx, comm_id id, std::auto_ptr<e::buffer> msg);
         void send_if_durable(int64_t idx, const comm_id* ids, e::buffer** msgs, size_t sz);
+        // hand messages to BusyBee, by way of the coalescer if it is enabled
+        // or the vote aggregator for votes
+        bool transmit(comm_id id, std::auto_ptr<e::buffer> msg);
+        // charge an outgoing message to the transaction it names
+        void cost_sent(e::buffer* msg);
+        bool transmit_now(comm_id id, std::auto_ptr<e::buffer> msg);
+        bool transmit_now(coalescer::outbox_t* ready);
+        // keep what replay sends until the network threads run
+        bool hold_for_replay(comm_id id, std::auto_ptr<e::buffer>* msg);
+        void release_replay_sends();
+        void coalesce();
+        // send what the vote pipeline holds for one group, or for every group
+        void flush_votes(paxos_group_id g);
+        void flush_votes(vote_pipeline::batch_map_t* batches);
+        void pipeline_votes();
+        // send what the commit pipeline has held for its window
+        void pipeline_commits();
+        void schedule_wan();
+        // ask for the lease of every group this daemon leads, well before
+        // the one it holds runs out
+        void renew_leases();
+        // tell the other members of each group how busy this daemon is
+        void report_group_load();
+        // keep the warm standby up to date, and the coordinator up to date
+        // on whether it is synced
+        void ship_log();
+        void send_shipments(const std::vector<log_shipper::shipment>& out);
+        // tell the primary what of its log is durable here
+        void ack_shipments(int64_t durable, bool force);
+        // replay what this daemon held as a standby, now that it is a member
+        void promote();
+        // log and hold what a group sends its witnesses, or act on it if
+        // this daemon has since become a member of the group
+        void witness(comm_id sender, const transaction_group& tg, const e::slice& inner);
+        // act on what was held for each group this daemon is now a member
+        // of, and drop what was held for groups it no longer witnesses
+        void witnesses_changed();
+        void promote_witnessed(paxos_group_id g);
+        void redispatch_witnessed(const witness_store::message& m);
+        // send read replicas the committed writes queued for them
+        void feed_replicas();
         void callback_when_durable(const std::string& entry, const transaction_group& tg, uint64_t seqno);
+        durable_shard* durable_shard_for(int64_t idx);
+        bool is_durable(int64_t idx);
+        int64_t append_to_log(const std::string& entry);
+        int64_t append_to_log_once(const std::string& entry);
+        void collect_log();
         void durable();
         void pump();
+        void schedule_pump(const transaction_group& tg, uint64_t now);
+        // get_or_create_state that also puts tg on the pump queue; every
+        // state machine is found this way, so the queue alone says what to
+        // pump and the maps are never swept
+        template <typename T>
+        T* get_or_create_pumped(e::state_hash_table<transaction_group, T>* map,
+                                const transaction_group& tg,
+                                typename e::state_hash_table<transaction_group, T>::state_reference* sr);
+        bool pump_one(const transaction_group& tg);
+        static void replay_callback(void* d, const unsigned char* entry, size_t entry_sz);
+        static void hold_callback(void* d, const unsigned char* entry, size_t entry_sz);
+        void replay(const unsigned char* entry, size_t entry_sz);
+        static void metrics_callback(void* d, std::ostream* out);
+        void metrics_report(std::ostream* out);
 
     private:
         txman m_us;
         e::garbage_collector m_gc;
         controller m_busybee_controller;
         std::auto_ptr<busybee_server> m_busybee;
+        rtt_estimator m_rtt;
         std::auto_ptr<coordinator_callback> m_coord_cb;
         std::auto_ptr<coordinator_link> m_coord;
         configuration* m_config;
         std::vector<e::compat::shared_ptr<po6::threads::thread> > m_threads;
+        // CPUs the network threads are pinned to, in order; empty if unpinned
+        std::vector<unsigned> m_cpus;
+        // how long a network thread may spin before it blocks; 0 never spins
+        uint64_t m_busy_poll;
+        // state machine stage; empty if the network threads run handlers
+        std::vector<e::compat::shared_ptr<stage_queue_t> > m_stage_queues;
+        std::vector<e::compat::shared_ptr<po6::threads::thread> > m_stage_threads;
+        // outlives m_transactions, whose members leave it as they go
+        inflight m_inflight;
+        // per-table operations by outcome, for sizing and placing tables
+        table_stats m_tables;
+        // also outlives m_transactions, which close their tallies as they go
+        message_cost m_costs;
         transaction_map_t m_transactions;
         local_voter_map_t m_local_voters;
         global_voter_map_t m_global_voters;
         disposition_map_t m_dispositions;
         read_map_t m_readers;
+        read_flights m_read_flights;
         write_map_t m_writers;
         lock_op_map_t m_lock_ops;
+        scan_map_t m_scanners;
         durable_log m_log;
 
         // awaiting durability
         po6::threads::thread m_durable_thread;
-        po6::threads::mutex m_durable_mtx;
-        int64_t m_durable_up_to;
-        durable_msg_heap_t m_durable_msgs;
-        durable_cb_heap_t m_durable_cbs;
+        durable_shard* m_durable_shards;
+
+        // entries recently logged via send_when_durable, by hash slot
+        po6::threads::mutex m_logged_mtx;
+        std::vector<std::pair<int64_t, std::string> > m_logged_entries;
+
+        // oldest log record each live transaction group depends upon
+        po6::threads::mutex m_log_pins_mtx;
+        uint64_t m_log_pins_epoch;
+        log_pin_map_t m_log_pins;
+
+        // reclaiming dispositions:  the queue is ordered by the time each was
+        // recorded; the watermark is, per originating paxos group, the latest
+        // start time of any transaction whose disposition was reclaimed, and
+        // stays below every transaction of the group still running here
+        po6::threads::mutex m_dispositions_mtx;
+        disposition_queue_t m_dispositions_queue;
+        disposition_watermark_map_t m_dispositions_watermarks;
 
         // state machine pumping
+        deadline_queue<transaction_group> m_pump_queue;
         po6::threads::thread m_pumping_thread;
 
+        // message coalescing
+        coalescer m_coalescer;
+        po6::threads::thread m_coalescing_thread;
+
+        // local votes batched across transactions, per paxos group, and
+        // then packed with every other vote bound for the same peer
+        vote_pipeline m_vote_pipeline;
+        coalescer m_vote_aggregator;
+        po6::threads::thread m_vote_pipeline_thread;
+
+        // commit records and global votes of many transactions bound for
+        // the same peer in another data center, sent as one WAN message
+        coalescer m_commit_pipeline;
+        po6::threads::thread m_commit_pipeline_thread;
+
+        // LZ4 for peers in other data centers
+        compressor m_compressor;
+        // zero-suppressed framing for peers that are servers
+        compactor m_compactor;
+        // BusyBee for every peer, unless m_local_transport is set for the
+        // peers in our data center
+        std::auto_ptr<transport> m_transport;
+        std::auto_ptr<transport> m_local_transport;
+
+        // bulk traffic to other data centers
+        wan_scheduler m_wan;
+        po6::threads::thread m_wan_thread;
+
+        // read leases for the groups this daemon leads or grants to
+        group_lease m_leases;
+        po6::threads::thread m_lease_thread;
+
+        // where new transactions go when balancing across groups
+        bool m_balance_groups;
+        group_load m_group_load;
+        po6::threads::thread m_group_load_thread;
+
+        // a warm standby tails its primary's log instead of joining groups;
+        // a primary ships its log to its standby, if it has one
+        comm_id m_standby_for;
+        log_shipper m_shipper;
+        po6::threads::thread m_shipping_thread;
+        // whether startup replayed the log, or held it as a standby
+        bool m_log_replayed;
+        // messages sent while replaying, before anything could handle them;
+        // m_replaying is nonzero until they are released, and is read
+        // without m_replay_mtx on the send path
+        po6::threads::mutex m_replay_mtx;
+        uint64_t m_replaying;
+        std::vector<std::pair<comm_id, e::buffer*> > m_replay_sends;
+
+        // what this daemon holds as a witness of other groups
+        witness_store m_witnesses;
+
+        // committed writes bound for read replicas
+        replica_feed m_replica_feed;
+        po6::threads::thread m_replica_feed_thread;
+
+        uint64_t m_commit_digest_threshold;
+        uint64_t m_slow_transaction_threshold;
+        uint64_t m_transaction_timeout;
+        // drop shared read locks once the data center votes to commit
+        bool m_early_lock_release;
+
+        // turning away begins while overloaded
+        admission_control m_admission;
+        // load reported by each key-value store
+        kvs_pressure m_kvs_pressure;
+
+        // handler latency and queue depths, for --metrics-port
+        metrics m_metrics;
+        // cross-data center votes, by the ballot type that decided them
+        histogram m_global_votes_fast;
+        histogram m_global_votes_classic;
+        // time spent in each stage a message passes through
+        histogram m_stage_network;
+        histogram m_stage_queued;
+        histogram m_stage_execute;
+        histogram m_stage_log;
+        // time spent in each phase of commit
+        phase_latency m_phases;
+
+        // timestamps for transactions begun here
+        hybrid_clock m_clock;
+        // fixed at startup
+        std::set<std::string> m_optimistic_tables;
+
+        // sampled transaction spans, for --trace-file
+        tracer m_tracer;
+
     private:
         daemon(const daemon&);
         daemon& operator = (const daemon&);
 };
 
+template <typename T>
+T*
+daemon :: get_or_create_pumped(e::state_hash_table<transaction_group, T>* map,
+                               const transaction_group& tg,
+                               typename e::state_hash_table<transaction_group, T>::state_reference* sr)
+{
+    T* t = map->get_or_create_state(tg, sr);
+    schedule_pump(tg, po6::monotonic_time());
+    return t;
+}
+
 END_CONSUS_NAMESPACE
 
 #endif // consus_txman_daemon_h_
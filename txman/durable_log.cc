@@ -25,20 +25,36 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#define __STDC_LIMIT_MACROS
+
 // C
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 
 // POSIX
 #include <dirent.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+// x86
+#include <emmintrin.h>
+#endif
 
 // STL
 #include <algorithm>
 #include <vector>
 
+// po6
+#include <po6/time.h>
+
 // e
 #include <e/endian.h>
 #include <e/guard.h>
@@ -47,11 +63,23 @@
 
 // consus
 #include "common/crc32c.h"
+#include "common/probes.h"
 #include "txman/durable_log.h"
 
 using consus::durable_log;
 
+// A record header holds its record number and size.  A frame reuses the
+// layout with a record number of zero and the size of a payload holding
+// many records, each a varint record number and a varint-prefixed entry;
+// either kind is followed by a CRC32C over header and body.
 #define RECORD_HEADER_SIZE (2 * sizeof(uint64_t))
+#define SEGMENT_NAME_DIGITS 16
+#define SEGMENT_ROTATE_SIZE (64ULL * 1024ULL * 1024ULL)
+// a pmem segment is mapped with room to spare, because the flush thread
+// rotates it only after it passes SEGMENT_ROTATE_SIZE; a record that lands
+// past the mapping falls back to an O_DSYNC write
+#define PMEM_MAP_SIZE (2 * SEGMENT_ROTATE_SIZE)
+#define CACHE_LINE_SIZE 64
 
 static void
 encode_header(uint64_t recno, uint64_t size, unsigned char* header)
@@ -60,12 +88,54 @@ encode_header(uint64_t recno, uint64_t size, unsigned char* header)
     e::pack64be(size, header + sizeof(uint64_t));
 }
 
+// Make [addr, addr + sz) of a MAP_SYNC mapping durable.  On x86 that is a
+// flush of each cache line followed by a fence; elsewhere fall back to msync.
+static bool
+persist(const unsigned char* addr, size_t sz)
+{
+#ifdef __SSE2__
+    uintptr_t line = reinterpret_cast<uintptr_t>(addr) & ~uintptr_t(CACHE_LINE_SIZE - 1);
+    const uintptr_t limit = reinterpret_cast<uintptr_t>(addr) + sz;
+
+    for (; line < limit; line += CACHE_LINE_SIZE)
+    {
+        _mm_clflush(reinterpret_cast<const void*>(line));
+    }
+
+    _mm_sfence();
+    return true;
+#else
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+    const uintptr_t limit = reinterpret_cast<uintptr_t>(addr) + sz;
+    return msync(reinterpret_cast<void*>(start), limit - start, MS_SYNC) == 0;
+#endif
+}
+
+struct durable_log :: device
+{
+    device(const std::string& p) : path(p), dir(), lockfile() {}
+    ~device() throw () {}
+    std::string path;
+    po6::io::fd dir;
+    e::lockfile lockfile;
+
+    private:
+        device(const device&);
+        device& operator = (const device&);
+};
+
 struct durable_log :: segment
 {
-    segment(po6::threads::mutex* mtx, int x)
-        : fd(x)
+    segment(po6::threads::mutex* mtx, device* d, const std::string& n, int x)
+        : dev(d)
+        , name(n)
+        , fd(x)
+        , map(NULL)
         , offset_next_write(0)
         , offset_last_fsync(0)
+        , offset_file(0)
+        , pending()
         , recno_last_write(0)
         , recno_last_fsync(0)
         , ongoing_writes(0)
@@ -73,9 +143,16 @@ struct durable_log :: segment
         , syncing(false)
     {
     }
+    device* dev;
+    std::string name;
     po6::io::fd fd;
+    // the first PMEM_MAP_SIZE bytes of fd, if the log is on pmem
+    unsigned char* map;
     uint64_t offset_next_write;
     uint64_t offset_last_fsync;
+    // where the next frame goes, and the records waiting to be framed
+    uint64_t offset_file;
+    std::string pending;
     uint64_t recno_last_write;
     uint64_t recno_last_fsync;
     int32_t ongoing_writes;
@@ -83,91 +160,489 @@ struct durable_log :: segment
     bool syncing;
 };
 
+struct durable_log :: sealed
+{
+    sealed() : dev(NULL), name(), recno_last(0) {}
+    sealed(device* d, const std::string& n, uint64_t r) : dev(d), name(n), recno_last(r) {}
+    sealed(const sealed& other) : dev(other.dev), name(other.name), recno_last(other.recno_last) {}
+    ~sealed() throw () {}
+    sealed& operator = (const sealed& rhs)
+    { dev = rhs.dev; name = rhs.name; recno_last = rhs.recno_last; return *this; }
+    device* dev;
+    std::string name;
+    uint64_t recno_last;
+};
+
+struct durable_log :: record
+{
+    record() : recno(0), entry() {}
+    record(uint64_t r, const unsigned char* e, size_t e_sz)
+        : recno(r), entry(reinterpret_cast<const char*>(e), e_sz) {}
+    record(const record& other) : recno(other.recno), entry(other.entry) {}
+    ~record() throw () {}
+    record& operator = (const record& rhs)
+    { recno = rhs.recno; entry = rhs.entry; return *this; }
+    bool operator < (const record& rhs) const { return recno < rhs.recno; }
+    uint64_t recno;
+    std::string entry;
+};
+
+// Reads every intact record out of a segment.  Scanning stops at the first
+// record that is truncated or fails its checksum; everything from that point
+// on was never acknowledged as durable.
+struct durable_log :: scanner
+{
+    scanner(device* d, const std::string& n, int x)
+        : dev(d)
+        , name(n)
+        , fd(x)
+        , records()
+        , valid(0)
+        , recno_last(0)
+        , error(0)
+    {
+    }
+    ~scanner() throw () {}
+    void run();
+    bool unframe(const unsigned char* payload, size_t payload_sz);
+    device* dev;
+    std::string name;
+    po6::io::fd fd;
+    std::vector<record> records;
+    uint64_t valid;
+    uint64_t recno_last;
+    int error;
+
+    private:
+        scanner(const scanner&);
+        scanner& operator = (const scanner&);
+};
+
+void
+durable_log :: scanner :: run()
+{
+    struct stat st;
+
+    if (fstat(fd.get(), &st) < 0)
+    {
+        error = errno;
+        return;
+    }
+
+    if (st.st_size == 0)
+    {
+        return;
+    }
+
+    // read the segment in place; each record copies out its entry
+    const size_t buf_sz = st.st_size;
+    void* base = mmap(NULL, buf_sz, PROT_READ, MAP_SHARED, fd.get(), 0);
+
+    if (base == MAP_FAILED)
+    {
+        error = errno;
+        return;
+    }
+
+    const unsigned char* buf = static_cast<const unsigned char*>(base);
+    uint64_t off = 0;
+
+    while (off + RECORD_HEADER_SIZE + sizeof(uint32_t) <= buf_sz)
+    {
+        const unsigned char* header = buf + off;
+        uint64_t recno;
+        uint64_t size;
+        e::unpack64be(header, &recno);
+        e::unpack64be(header + sizeof(uint64_t), &size);
+
+        if (size > buf_sz - off - RECORD_HEADER_SIZE - sizeof(uint32_t))
+        {
+            break;
+        }
+
+        const unsigned char* entry = header + RECORD_HEADER_SIZE;
+        uint32_t crc = 0;
+        crc = crc32c(crc, header, RECORD_HEADER_SIZE);
+        crc = crc32c(crc, entry, size);
+        uint32_t stored;
+        e::unpack32be(entry + size, &stored);
+
+        if (crc != stored)
+        {
+            break;
+        }
+
+        if (recno != 0)
+        {
+            records.push_back(record(recno, entry, size));
+            recno_last = std::max(recno_last, recno);
+        }
+        else if (!unframe(entry, size))
+        {
+            break;
+        }
+
+        off += RECORD_HEADER_SIZE + size + sizeof(uint32_t);
+    }
+
+    munmap(base, buf_sz);
+    valid = off;
+}
+
+bool
+durable_log :: scanner :: unframe(const unsigned char* payload, size_t payload_sz)
+{
+    const size_t records_sz = records.size();
+    const uint64_t recno_last_saved = recno_last;
+    size_t off = 0;
+
+    while (off < payload_sz)
+    {
+        const e::slice rest(payload + off, payload_sz - off);
+        uint64_t recno = 0;
+        uint64_t size = 0;
+        e::unpacker up(rest);
+        up = up >> e::unpack_varint(recno) >> e::unpack_varint(size);
+
+        if (up.error() || recno == 0 || size > up.remain())
+        {
+            // the checksum matched, so this was never a frame we wrote
+            records.resize(records_sz);
+            recno_last = recno_last_saved;
+            return false;
+        }
+
+        const size_t entry_off = off + rest.size() - up.remain();
+        records.push_back(record(recno, payload + entry_off, size));
+        recno_last = std::max(recno_last, recno);
+        off = entry_off + size;
+    }
+
+    return true;
+}
+
+static bool
+parse_segment_name(const char* name, uint64_t* number)
+{
+    if (strncmp(name, "log.", 4) != 0 ||
+        strlen(name) != 4 + SEGMENT_NAME_DIGITS)
+    {
+        return false;
+    }
+
+    *number = 0;
+
+    for (const char* c = name + 4; *c; ++c)
+    {
+        *number <<= 4;
+
+        if (*c >= '0' && *c <= '9')
+        {
+            *number |= *c - '0';
+        }
+        else if (*c >= 'a' && *c <= 'f')
+        {
+            *number |= *c - 'a' + 10;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+durable_log :: delete_scanners(std::vector<scanner*>* scans)
+{
+    for (size_t i = 0; i < scans->size(); ++i)
+    {
+        delete (*scans)[i];
+    }
+
+    scans->clear();
+}
+
+// Write the whole record with as few syscalls as possible; in the common
+// case this is a single pwritev.
+static bool
+write_record(int fd, struct iovec* iov, int iovcnt, uint64_t offset)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t amt = pwritev(fd, iov, iovcnt, offset);
+
+        if (amt < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        offset += amt;
+
+        while (iovcnt > 0 && size_t(amt) >= iov->iov_len)
+        {
+            amt -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if (iovcnt > 0)
+        {
+            iov->iov_base = static_cast<unsigned char*>(iov->iov_base) + amt;
+            iov->iov_len -= amt;
+        }
+    }
+
+    return true;
+}
+
 durable_log :: durable_log()
-    : m_path()
-    , m_dir()
-    , m_lockfile()
+    : m_devices()
     , m_mtx()
     , m_cond(&m_mtx)
-    , m_flush(po6::threads::make_obj_func(&durable_log::flush, this))
+    , m_flush()
     , m_error(0)
     , m_wakeup(false)
+    , m_sync_writes(false)
+    , m_pmem(false)
     , m_next_entry(1)
-    , m_segment_a(NULL)
-    , m_segment_b(NULL)
+    , m_segments()
+    , m_next_write(0)
+    , m_next_segment(1)
+    , m_sealed()
+    , m_replay()
+    , m_fsync_latency()
 {
-    m_flush.start();
 }
 
 durable_log :: ~durable_log() throw ()
 {
     close();
-    m_flush.join();
 
-    delete m_segment_a;
-    delete m_segment_b;
+    for (size_t i = 0; i < m_flush.size(); ++i)
+    {
+        m_flush[i]->join();
+        delete m_flush[i];
+    }
+
+    for (size_t i = 0; i < m_segments.size(); ++i)
+    {
+        if (m_segments[i]->map)
+        {
+            munmap(m_segments[i]->map, PMEM_MAP_SIZE);
+        }
+
+        delete m_segments[i];
+    }
+
+    for (size_t i = 0; i < m_devices.size(); ++i)
+    {
+        delete m_devices[i];
+    }
+}
+
+bool
+durable_log :: open(const std::string& dir, bool sync_writes, bool pmem)
+{
+    return open(std::vector<std::string>(1, dir), sync_writes, pmem);
 }
 
 bool
-durable_log :: open(const std::string& dir)
+durable_log :: open(const std::vector<std::string>& dirs, bool sync_writes, bool pmem)
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    m_path = dir;
-    struct stat st;
-    int ret = stat(m_path.c_str(), &st);
+    assert(m_devices.empty());
+    assert(!dirs.empty());
+    // pmem appends are durable once flushed, so they take the synchronous
+    // path and the flush thread never calls fsync
+    m_sync_writes = sync_writes || pmem;
+    m_pmem = pmem;
 
-    if (ret < 0 && errno == ENOENT)
+    for (size_t i = 0; i < dirs.size(); ++i)
     {
-        if (mkdir(m_path.c_str(), S_IRWXU) < 0)
+        m_devices.push_back(new device(dirs[i]));
+
+        if (!open_device(m_devices.back()))
+        {
+            m_error = errno;
+            return false;
+        }
+    }
+
+    std::vector<std::pair<device*, std::string> > names;
+
+    for (size_t i = 0; i < m_devices.size(); ++i)
+    {
+        std::vector<std::string> dev_names;
+
+        if (!list_segments(m_devices[i], &dev_names))
         {
             m_error = errno;
             return false;
         }
 
-        ret = stat(m_path.c_str(), &st);
+        for (size_t j = 0; j < dev_names.size(); ++j)
+        {
+            names.push_back(std::make_pair(m_devices[i], dev_names[j]));
+        }
     }
 
-    if (ret < 0)
+    // recover whatever a prior incarnation left behind; every existing
+    // segment is sealed and stays on disk until collect() drops it
+    std::vector<scanner*> scans;
+
+    for (size_t i = 0; i < names.size(); ++i)
     {
-        m_error = errno;
-        return false;
+        int seg_fd = openat(names[i].first->dir.get(), names[i].second.c_str(), O_RDWR);
+
+        if (seg_fd < 0)
+        {
+            m_error = errno;
+            delete_scanners(&scans);
+            return false;
+        }
+
+        scans.push_back(new scanner(names[i].first, names[i].second, seg_fd));
     }
-    else if (!S_ISDIR(st.st_mode))
+
+    // scan two segments at a time
+    for (size_t i = 0; i < scans.size(); i += 2)
     {
-        m_error = errno = ENOTDIR;
-        return false;
+        if (i + 1 < scans.size())
+        {
+            po6::threads::thread t(po6::threads::make_obj_func(&scanner::run, scans[i + 1]));
+            t.start();
+            scans[i]->run();
+            t.join();
+        }
+        else
+        {
+            scans[i]->run();
+        }
     }
 
-    m_dir = ::open(m_path.c_str(), O_RDONLY);
+    uint64_t recno_last = 0;
 
-    if (m_dir.get() < 0)
+    for (size_t i = 0; i < scans.size(); ++i)
     {
-        m_error = errno;
-        return false;
+        scanner* sc = scans[i];
+
+        if (sc->error || ftruncate(sc->fd.get(), sc->valid) < 0)
+        {
+            m_error = sc->error ? sc->error : errno;
+            delete_scanners(&scans);
+            return false;
+        }
+
+        if (sc->records.empty())
+        {
+            unlinkat(sc->dev->dir.get(), sc->name.c_str(), 0);
+            continue;
+        }
+
+        m_sealed.push_back(sealed(sc->dev, sc->name, sc->recno_last));
+        m_replay.insert(m_replay.end(), sc->records.begin(), sc->records.end());
+        recno_last = std::max(recno_last, sc->recno_last);
+    }
+
+    delete_scanners(&scans);
+    std::sort(m_replay.begin(), m_replay.end());
+    m_next_entry = recno_last + 1;
+
+    for (size_t i = 0; i < m_devices.size(); ++i)
+    {
+        device* dev = m_devices[i];
+        std::string name_a;
+        std::string name_b;
+        int file_a = create_segment(dev, m_next_segment++, &name_a);
+        int file_b = create_segment(dev, m_next_segment++, &name_b);
+        unsigned char* map_a = NULL;
+        unsigned char* map_b = NULL;
+
+        if (file_a < 0 || file_b < 0 ||
+            (m_pmem && (!map_segment(file_a, &map_a) || !map_segment(file_b, &map_b))) ||
+            fsync(dev->dir.get()) < 0)
+        {
+            m_error = errno;
+
+            if (map_a)
+            {
+                munmap(map_a, PMEM_MAP_SIZE);
+            }
+
+            if (map_b)
+            {
+                munmap(map_b, PMEM_MAP_SIZE);
+            }
+
+            ::close(file_a);
+            ::close(file_b);
+            return false;
+        }
+
+        segment* a = new segment(&m_mtx, dev, name_a, file_a);
+        a->map = map_a;
+        a->recno_last_write = recno_last;
+        a->recno_last_fsync = recno_last;
+        m_segments.push_back(a);
+        segment* b = new segment(&m_mtx, dev, name_b, file_b);
+        b->map = map_b;
+        b->recno_last_write = recno_last;
+        b->recno_last_fsync = recno_last;
+        m_segments.push_back(b);
     }
 
-    int fd = openat(m_dir.get(), "LOCK", O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+    for (size_t i = 0; i < m_devices.size(); ++i)
+    {
+        using namespace po6::threads;
+        m_flush.push_back(new thread(make_obj_func(&durable_log::flush, this, i)));
+        m_flush.back()->start();
+    }
+
+    return true;
+}
 
-    if (!m_lockfile.lock(fd))
+bool
+durable_log :: open_device(device* dev)
+{
+    struct stat st;
+    int ret = stat(dev->path.c_str(), &st);
+
+    if (ret < 0 && errno == ENOENT)
+    {
+        if (mkdir(dev->path.c_str(), S_IRWXU) < 0)
+        {
+            return false;
+        }
+
+        ret = stat(dev->path.c_str(), &st);
+    }
+
+    if (ret < 0)
     {
-        m_error = errno;
+        return false;
+    }
+    else if (!S_ISDIR(st.st_mode))
+    {
+        errno = ENOTDIR;
         return false;
     }
 
-    // XXX do rotation on these and don't overwrite the old
-    int file_a = openat(m_dir.get(), "file_a", O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
-    int file_b = openat(m_dir.get(), "file_b", O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    dev->dir = ::open(dev->path.c_str(), O_RDONLY);
 
-    if (file_a < 0 || file_b < 0)
+    if (dev->dir.get() < 0)
     {
-        ::close(file_a);
-        ::close(file_b);
         return false;
     }
 
-    m_segment_a = new segment(&m_mtx, file_a);
-    m_segment_b = new segment(&m_mtx, file_b);
-    return true;
+    int fd = openat(dev->dir.get(), "LOCK", O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+    return dev->lockfile.lock(fd);
 }
 
 void
@@ -187,6 +662,11 @@ durable_log :: append(const char* entry, size_t entry_sz)
 int64_t
 durable_log :: append(const unsigned char* entry, size_t entry_sz)
 {
+    if (!m_sync_writes)
+    {
+        return append_framed(entry, entry_sz);
+    }
+
     unsigned char header[RECORD_HEADER_SIZE];
     segment* seg;
     uint64_t offset;
@@ -219,9 +699,30 @@ durable_log :: append(const unsigned char* entry, size_t entry_sz)
     unsigned char crcbuf[sizeof(uint32_t)];
     e::pack32be(crc, crcbuf);
 
-    if (pwrite(seg->fd.get(), header, RECORD_HEADER_SIZE, offset) < 0 ||
-        pwrite(seg->fd.get(), entry, entry_sz, offset + RECORD_HEADER_SIZE) < 0 ||
-        pwrite(seg->fd.get(), crcbuf, sizeof(uint32_t), offset + RECORD_HEADER_SIZE + entry_sz) < 0)
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = RECORD_HEADER_SIZE;
+    iov[1].iov_base = const_cast<unsigned char*>(entry);
+    iov[1].iov_len = entry_sz;
+    iov[2].iov_base = crcbuf;
+    iov[2].iov_len = sizeof(uint32_t);
+    const uint64_t record_sz = RECORD_HEADER_SIZE + entry_sz + sizeof(uint32_t);
+    bool written = false;
+
+    if (seg->map && offset + record_sz <= PMEM_MAP_SIZE)
+    {
+        unsigned char* dst = seg->map + offset;
+        memcpy(dst, header, RECORD_HEADER_SIZE);
+        memcpy(dst + RECORD_HEADER_SIZE, entry, entry_sz);
+        memcpy(dst + RECORD_HEADER_SIZE + entry_sz, crcbuf, sizeof(uint32_t));
+        written = persist(dst, record_sz);
+    }
+    else
+    {
+        written = write_record(seg->fd.get(), iov, 3, offset);
+    }
+
+    if (!written)
     {
         int e = errno;
         po6::threads::mutex::hold hold(&m_mtx);
@@ -238,9 +739,102 @@ durable_log :: append(const unsigned char* entry, size_t entry_sz)
         m_cond.broadcast();
     }
 
+    CONSUS_PROBE2(log_append, recno, entry_sz);
     return recno;
 }
 
+int64_t
+durable_log :: append_framed(const unsigned char* entry, size_t entry_sz)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_error)
+    {
+        errno = m_error;
+        return -1;
+    }
+
+    const uint64_t recno = m_next_entry;
+    ++m_next_entry;
+    segment* seg = select_segment_write();
+    assert(seg);
+    assert(!seg->syncing);
+    std::string header;
+    e::packer pa(&header);
+    pa = pa << e::pack_varint(recno) << e::pack_varint(uint64_t(entry_sz));
+    seg->pending.append(header);
+    seg->pending.append(reinterpret_cast<const char*>(entry), entry_sz);
+    seg->offset_next_write += header.size() + entry_sz;
+    seg->recno_last_write = recno;
+    m_cond.broadcast();
+    CONSUS_PROBE2(log_append, recno, entry_sz);
+    return recno;
+}
+
+int64_t
+durable_log :: replay(void (*f)(void*, const unsigned char*, size_t), void* p)
+{
+    std::vector<record> records;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        records.swap(m_replay);
+    }
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const record& r(records[i]);
+        f(p, reinterpret_cast<const unsigned char*>(r.entry.data()), r.entry.size());
+    }
+
+    return records.size();
+}
+
+int64_t
+durable_log :: next_recno()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_next_entry;
+}
+
+void
+durable_log :: collect(int64_t lower_bound)
+{
+    std::vector<sealed> dead;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        // a segment sealed ahead of its fsync holds the only copy of
+        // records that may not be on disk yet
+        lower_bound = std::min(lower_bound, durable_lock_held_elsewhere());
+        size_t i = 0;
+
+        while (i < m_sealed.size())
+        {
+            if (m_sealed[i].recno_last < uint64_t(lower_bound))
+            {
+                dead.push_back(m_sealed[i]);
+                m_sealed[i] = m_sealed.back();
+                m_sealed.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < dead.size(); ++i)
+    {
+        if (unlinkat(dead[i].dev->dir.get(), dead[i].name.c_str(), 0) < 0 && errno != ENOENT)
+        {
+            // try again on the next pass
+            po6::threads::mutex::hold hold(&m_mtx);
+            m_sealed.push_back(dead[i]);
+        }
+    }
+}
+
 int64_t
 durable_log :: durable()
 {
@@ -284,8 +878,14 @@ durable_log :: error()
     return m_error;
 }
 
+consus::histogram*
+durable_log :: fsync_latency()
+{
+    return &m_fsync_latency;
+}
+
 void
-durable_log :: flush()
+durable_log :: flush(size_t dev)
 {
     sigset_t ss;
 
@@ -298,17 +898,20 @@ durable_log :: flush()
         return;
     }
 
+    std::string frame;
+
     while (true)
     {
         uint64_t offset_saved;
         uint64_t recno_saved;
+        uint64_t offset_file;
         segment* seg;
 
         {
             po6::threads::mutex::hold hold(&m_mtx);
 
             while (m_error == 0 &&
-                   !(seg = select_segment_fsync()))
+                   !(seg = select_segment_fsync(dev)))
             {
                 m_cond.wait();
             }
@@ -327,114 +930,316 @@ durable_log :: flush()
 
             offset_saved = seg->offset_next_write;
             recno_saved = seg->recno_last_write;
+            offset_file = seg->offset_file;
+            frame.clear();
+            frame.swap(seg->pending);
         }
 
-        if (fsync(seg->fd.get()) < 0)
+        CONSUS_PROBE3(log_flush_start, dev, recno_saved, frame.size());
+
+        // seal everything appended since the last pass behind one header
+        // and checksum
+        if (!frame.empty())
         {
-            int e = errno;
-            po6::threads::mutex::hold hold(&m_mtx);
-            m_error = e;
+            unsigned char header[RECORD_HEADER_SIZE];
+            encode_header(0, frame.size(), header);
+            uint32_t crc = 0;
+            crc = crc32c(crc, header, RECORD_HEADER_SIZE);
+            crc = crc32c(crc, reinterpret_cast<const unsigned char*>(frame.data()), frame.size());
+            unsigned char crcbuf[sizeof(uint32_t)];
+            e::pack32be(crc, crcbuf);
+
+            struct iovec iov[3];
+            iov[0].iov_base = header;
+            iov[0].iov_len = RECORD_HEADER_SIZE;
+            iov[1].iov_base = &frame[0];
+            iov[1].iov_len = frame.size();
+            iov[2].iov_base = crcbuf;
+            iov[2].iov_len = sizeof(uint32_t);
+
+            if (!write_record(seg->fd.get(), iov, 3, offset_file))
+            {
+                int e = errno;
+                po6::threads::mutex::hold hold(&m_mtx);
+                m_error = e;
+            }
+
+            offset_file += RECORD_HEADER_SIZE + frame.size() + sizeof(uint32_t);
         }
 
+        // synchronous writes are already durable once ongoing_writes drains
+        if (!m_sync_writes)
+        {
+            const uint64_t start = po6::monotonic_time();
+
+            if (fsync(seg->fd.get()) < 0)
+            {
+                int e = errno;
+                po6::threads::mutex::hold hold(&m_mtx);
+                m_error = e;
+            }
+
+            m_fsync_latency.record(po6::monotonic_time() - start);
+        }
+
+        CONSUS_PROBE2(log_flush_done, dev, recno_saved);
+
+        bool rotate = false;
+        uint64_t number = 0;
+
         {
             po6::threads::mutex::hold hold(&m_mtx);
-            seg->syncing = false;
             seg->offset_last_fsync = offset_saved;
             seg->recno_last_fsync = recno_saved;
-            m_cond.broadcast();
+            seg->offset_file = offset_file;
+
+            if (m_error == 0 && seg->offset_last_fsync >= SEGMENT_ROTATE_SIZE)
+            {
+                // stay in the syncing state so no writer picks seg up
+                // while its file is swapped out from under it
+                rotate = true;
+                number = m_next_segment++;
+            }
+            else
+            {
+                seg->syncing = false;
+                m_cond.broadcast();
+            }
+        }
+
+        if (rotate)
+        {
+            rotate_segment(seg, number);
         }
     }
 }
 
-durable_log::segment*
-durable_log :: select_segment_write()
+void
+durable_log :: rotate_segment(segment* seg, uint64_t number)
 {
-    segment* a = m_segment_a;
-    segment* b = m_segment_b;
-    assert(a->offset_next_write >= a->offset_last_fsync);
-    assert(b->offset_next_write >= b->offset_last_fsync);
-    const uint64_t a_unflushed = a->offset_next_write - a->offset_last_fsync;
-    const uint64_t b_unflushed = b->offset_next_write - b->offset_last_fsync;
+    std::string name;
+    int fd = create_segment(seg->dev, number, &name);
+    unsigned char* map = NULL;
 
-    if (a_unflushed < b_unflushed && !a->syncing)
+    if (fd < 0 || (m_pmem && !map_segment(fd, &map)) ||
+        fsync(seg->dev->dir.get()) < 0)
     {
-        return a;
+        int e = errno;
+
+        if (map)
+        {
+            munmap(map, PMEM_MAP_SIZE);
+        }
+
+        ::close(fd);
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_error = e;
+        seg->syncing = false;
+        m_cond.broadcast();
+        return;
     }
-    else if (a_unflushed > b_unflushed && !b->syncing)
+
+    // seg is still syncing, so no writer is copying into the old mapping
+    if (seg->map)
     {
-        return b;
+        munmap(seg->map, PMEM_MAP_SIZE);
     }
-    else if (!a->syncing)
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_sealed.push_back(sealed(seg->dev, seg->name, seg->recno_last_fsync));
+    seg->name = name;
+    seg->fd = fd;
+    seg->map = map;
+    seg->offset_next_write = 0;
+    seg->offset_last_fsync = 0;
+    seg->offset_file = 0;
+    seg->syncing = false;
+    m_cond.broadcast();
+}
+
+bool
+durable_log :: list_segments(device* dev, std::vector<std::string>* names)
+{
+    DIR* dir = opendir(dev->path.c_str());
+
+    if (!dir)
     {
-        return a;
+        return false;
     }
-    else if (!b->syncing)
+
+    std::vector<std::pair<uint64_t, std::string> > segments;
+    struct dirent* ent;
+
+    while ((ent = readdir(dir)))
     {
-        return b;
+        uint64_t number = 0;
+
+        // file_a and file_b predate rotation; recover them first
+        if (strcmp(ent->d_name, "file_a") == 0 ||
+            strcmp(ent->d_name, "file_b") == 0)
+        {
+            segments.push_back(std::make_pair(number, std::string(ent->d_name)));
+        }
+        else if (parse_segment_name(ent->d_name, &number))
+        {
+            segments.push_back(std::make_pair(number, std::string(ent->d_name)));
+            m_next_segment = std::max(m_next_segment, number + 1);
+        }
     }
-    else
+
+    closedir(dir);
+    std::sort(segments.begin(), segments.end());
+
+    for (size_t i = 0; i < segments.size(); ++i)
     {
-        return NULL;
+        names->push_back(segments[i].second);
     }
+
+    return true;
 }
 
-durable_log::segment*
-durable_log :: select_segment_fsync()
+int
+durable_log :: create_segment(device* dev, uint64_t number, std::string* name)
 {
-    segment* a = m_segment_a;
-    segment* b = m_segment_b;
+    char buf[4 + SEGMENT_NAME_DIGITS + 1];
+    snprintf(buf, sizeof(buf), "log.%016llx", static_cast<unsigned long long>(number));
+    *name = buf;
+    int flags = O_RDWR|O_CREAT|O_EXCL;
 
-    if (!a || !b)
+    if (m_sync_writes)
     {
-        return NULL;
+        flags |= O_DSYNC;
     }
 
-    assert(!a->syncing);
-    assert(!b->syncing);
-    assert(a->offset_next_write >= a->offset_last_fsync);
-    assert(b->offset_next_write >= b->offset_last_fsync);
-    const uint64_t a_unflushed = a->offset_next_write - a->offset_last_fsync;
-    const uint64_t b_unflushed = b->offset_next_write - b->offset_last_fsync;
+    int fd = openat(dev->dir.get(), buf, flags, S_IRUSR|S_IWUSR);
 
-    if (a_unflushed < b_unflushed)
+    if (fd < 0)
     {
-        return b;
+        return -1;
     }
-    else if (a_unflushed > b_unflushed)
+
+#ifdef FALLOC_FL_KEEP_SIZE
+    // reserve blocks up front so appends don't allocate on the commit path;
+    // keep the size so recovery still sees where the last record ends
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, SEGMENT_ROTATE_SIZE);
+#endif
+    return fd;
+}
+
+bool
+durable_log :: map_segment(int fd, unsigned char** map)
+{
+#if defined(MAP_SYNC) && defined(MAP_SHARED_VALIDATE)
+    // the whole mapping must be backed by the file; recovery stops at the
+    // zeroes past the last record just as it does at a torn one
+    if (ftruncate(fd, PMEM_MAP_SIZE) < 0)
     {
-        return a;
+        return false;
     }
-    else if (a_unflushed > 0)
+
+    // MAP_SYNC fails on anything but a DAX file system, where flushing the
+    // CPU caches would not be enough to make a store durable
+    void* base = mmap(NULL, PMEM_MAP_SIZE, PROT_READ|PROT_WRITE,
+                      MAP_SHARED_VALIDATE|MAP_SYNC, fd, 0);
+
+    if (base == MAP_FAILED)
     {
-        return a;
+        return false;
     }
-    else if (b_unflushed > 0)
+
+    *map = static_cast<unsigned char*>(base);
+    return true;
+#else
+    (void) fd;
+    (void) map;
+    errno = ENOTSUP;
+    return false;
+#endif
+}
+
+durable_log::segment*
+durable_log :: select_segment_write()
+{
+    // the segment with the least unflushed data, starting the search one
+    // past the last pick so that ties rotate across devices
+    segment* best = NULL;
+    uint64_t best_unflushed = 0;
+    const size_t start = m_next_write;
+
+    for (size_t i = 0; i < m_segments.size(); ++i)
     {
-        return b;
+        segment* seg = m_segments[(start + i) % m_segments.size()];
+        assert(seg->offset_next_write >= seg->offset_last_fsync);
+        const uint64_t unflushed = seg->offset_next_write - seg->offset_last_fsync;
+
+        if (seg->syncing || (best && unflushed >= best_unflushed))
+        {
+            continue;
+        }
+
+        best = seg;
+        best_unflushed = unflushed;
+        m_next_write = (start + i + 1) % m_segments.size();
     }
-    else
+
+    return best;
+}
+
+durable_log::segment*
+durable_log :: select_segment_fsync(size_t dev)
+{
+    // the segment on this device with the most unflushed data
+    segment* best = NULL;
+    uint64_t best_unflushed = 0;
+
+    for (size_t i = 0; i < m_segments.size(); ++i)
     {
-        return NULL;
+        segment* seg = m_segments[i];
+
+        if (seg->dev != m_devices[dev])
+        {
+            continue;
+        }
+
+        assert(!seg->syncing);
+        assert(seg->offset_next_write >= seg->offset_last_fsync);
+        const uint64_t unflushed = seg->offset_next_write - seg->offset_last_fsync;
+
+        if (unflushed > best_unflushed)
+        {
+            best = seg;
+            best_unflushed = unflushed;
+        }
     }
+
+    return best;
 }
 
 int64_t
 durable_log :: durable_lock_held_elsewhere()
 {
-    segment* a = m_segment_a;
-    segment* b = m_segment_b;
-    assert(a->offset_next_write >= a->offset_last_fsync);
-    assert(b->offset_next_write >= b->offset_last_fsync);
+    // every record in a segment past its last fsync is newer than that
+    // fsync, so the oldest such fsync bounds what is durable; with nothing
+    // unflushed anywhere, everything written is durable
+    uint64_t unflushed_lb = UINT64_MAX;
+    uint64_t flushed = 0;
 
-    if (a->recno_last_fsync > b->recno_last_fsync)
+    for (size_t i = 0; i < m_segments.size(); ++i)
     {
-        std::swap(a, b);
+        segment* seg = m_segments[i];
+        assert(seg->offset_next_write >= seg->offset_last_fsync);
+        flushed = std::max(flushed, seg->recno_last_fsync);
+
+        if (seg->offset_next_write - seg->offset_last_fsync > 0)
+        {
+            unflushed_lb = std::min(unflushed_lb, seg->recno_last_fsync);
+        }
     }
 
-    if (a->offset_next_write - a->offset_last_fsync > 0)
+    if (unflushed_lb < UINT64_MAX)
     {
-        return a->recno_last_fsync + 1;
+        return unflushed_lb + 1;
     }
 
-    return b->recno_last_fsync + 1;
+    return flushed + 1;
 }
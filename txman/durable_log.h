@@ -47,6 +47,7 @@
 
 // consus
 #include "namespace.h"
+#include "common/metrics.h"
 
 BEGIN_CONSUS_NAMESPACE
 
@@ -57,35 +58,67 @@ class durable_log
         ~durable_log() throw ();
 
     public:
-        bool open(const std::string& dir);
+        // with sync_writes, every append is durable when it returns and
+        // concurrent appends proceed in parallel instead of batching behind
+        // one fsync; pmem implies sync_writes, and requires each directory
+        // to be on a DAX file system so appends can copy straight into a
+        // mapping of the segment and persist with cache-line flushes
+        bool open(const std::string& dir, bool sync_writes, bool pmem);
+        // stripe records across several directories, ideally one per device,
+        // each with its own flush thread; records keep one global order
+        bool open(const std::vector<std::string>& dirs, bool sync_writes, bool pmem);
         void close();
         int64_t append(const char* entry, size_t entry_sz);
         int64_t append(const unsigned char* entry, size_t entry_sz);
         int64_t replay(void (*f)(void*, const unsigned char*, size_t), void* p);
+        // the record number the next append will receive
+        int64_t next_recno();
+        // remove sealed segments whose records all precede lower_bound and
+        // are durable
+        void collect(int64_t lower_bound);
         int64_t durable();
         int64_t wait(int64_t prev_ub);
         void wake();
         int error();
+        // latency of each fsync the flush thread issues
+        histogram* fsync_latency();
 
     private:
+        struct device;
         class segment;
-        void flush();
+        struct sealed;
+        struct record;
+        struct scanner;
+        static void delete_scanners(std::vector<scanner*>* scans);
+        // batch the record for the flush thread's next frame
+        int64_t append_framed(const unsigned char* entry, size_t entry_sz);
+        bool open_device(device* dev);
+        void flush(size_t dev);
+        void rotate_segment(segment* seg, uint64_t number);
+        bool list_segments(device* dev, std::vector<std::string>* names);
+        int create_segment(device* dev, uint64_t number, std::string* name);
+        bool map_segment(int fd, unsigned char** map);
         segment* select_segment_write();
-        segment* select_segment_fsync();
+        segment* select_segment_fsync(size_t dev);
         int64_t durable_lock_held_elsewhere();
 
     private:
-        std::string m_path;
-        po6::io::fd m_dir;
-        e::lockfile m_lockfile;
+        std::vector<device*> m_devices;
         po6::threads::mutex m_mtx;
         po6::threads::cond m_cond;
-        po6::threads::thread m_flush;
+        std::vector<po6::threads::thread*> m_flush;
         int m_error;
         bool m_wakeup;
+        bool m_sync_writes;
+        bool m_pmem;
         uint64_t m_next_entry;
-        segment* m_segment_a;
-        segment* m_segment_b;
+        // two per device, so that one takes writes while the other syncs
+        std::vector<segment*> m_segments;
+        size_t m_next_write;
+        uint64_t m_next_segment;
+        std::vector<sealed> m_sealed;
+        std::vector<record> m_replay;
+        histogram m_fsync_latency;
 
     private:
         durable_log(const durable_log&);
@@ -35,10 +35,12 @@
 #include <stdexcept>
 
 // e
+#include <e/compat.h>
 #include <e/serialization.h>
 #include <e/strescape.h>
 
 // consus
+#include "common/probes.h"
 #include "txman/generalized_paxos.h"
 
 #ifdef GENERALIZED_PAXOS_THROW
@@ -91,8 +93,7 @@ void
 generalized_paxos :: internal_cstruct :: set_N(uint64_t N)
 {
     transitive_closure_N = N;
-    const uint64_t bits = N * N;
-    const uint64_t quads = (bits + 63) / 64;
+    const uint64_t quads = N * words_per_row();
     transitive_closure.resize(quads);
 
     for (size_t i = 0; i < quads; ++i)
@@ -104,27 +105,53 @@ generalized_paxos :: internal_cstruct :: set_N(uint64_t N)
 void
 generalized_paxos :: internal_cstruct :: close_transitively()
 {
-    for (uint64_t i = 0; i < ids.size(); ++i)
+    // Warshall's algorithm with the intermediate vertex outermost; each row
+    // is word-aligned, so reaching through w is an OR of w's row into u's.
+    const uint64_t W = words_per_row();
+
+    for (uint64_t k = 0; k < ids.size(); ++k)
     {
-        const uint64_t u = ids[i];
+        const uint64_t w = ids[k];
+        const uint64_t* const row_w = &transitive_closure[w * W];
 
-        for (uint64_t j = 0; j < ids.size(); ++j)
+        for (uint64_t i = 0; i < ids.size(); ++i)
         {
-            const uint64_t v = ids[j];
+            const uint64_t u = ids[i];
 
-            for (uint64_t k = 0; k < ids.size(); ++k)
+            if (u == w || !are_adjacent(u, w))
             {
-                const uint64_t w = ids[k];
+                continue;
+            }
 
-                if (are_adjacent(u, v) && are_adjacent(v, w))
-                {
-                    set_adjacent(u, w);
-                }
+            uint64_t* const row_u = &transitive_closure[u * W];
+
+            for (uint64_t x = 0; x < W; ++x)
+            {
+                row_u[x] |= row_w[x];
             }
         }
     }
 }
 
+bool
+generalized_paxos :: internal_cstruct :: reaches_any(uint64_t u, const std::vector<uint64_t>& mask) const
+{
+    const uint64_t W = words_per_row();
+    assert(u < transitive_closure_N);
+    assert(mask.size() == W);
+    const uint64_t* const row_u = &transitive_closure[u * W];
+
+    for (uint64_t x = 0; x < W; ++x)
+    {
+        if ((row_u[x] & mask[x]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void
 generalized_paxos :: internal_cstruct :: swap(internal_cstruct* other)
 {
@@ -133,16 +160,22 @@ generalized_paxos :: internal_cstruct :: swap(internal_cstruct* other)
     std::swap(transitive_closure_N, other->transitive_closure_N);
 }
 
+uint64_t
+generalized_paxos :: internal_cstruct :: words_per_row() const
+{
+    return (transitive_closure_N + 63) / 64;
+}
+
 uint64_t
 generalized_paxos :: internal_cstruct :: byte(uint64_t u, uint64_t v) const
 {
-    return (u * transitive_closure_N + v) / 64;
+    return u * words_per_row() + v / 64;
 }
 
 uint64_t
-generalized_paxos :: internal_cstruct :: bit(uint64_t u, uint64_t v) const
+generalized_paxos :: internal_cstruct :: bit(uint64_t, uint64_t v) const
 {
-    return (u * transitive_closure_N + v) % 64;
+    return v % 64;
 }
 
 generalized_paxos :: generalized_paxos()
@@ -153,7 +186,8 @@ generalized_paxos :: generalized_paxos()
     , m_acceptors()
     , m_proposed()
     , m_commands()
-    , m_command_ids()
+    , m_command_hashes()
+    , m_command_table()
     , m_acceptor_ballot()
     , m_acceptor_value()
     , m_acceptor_ivalue()
@@ -166,6 +200,11 @@ generalized_paxos :: generalized_paxos()
     , m_accepted()
     , m_iaccepted()
     , m_learned_cached()
+    , m_learned_value()
+    , m_learned_conflict(false)
+    , m_learned_stale(true)
+    , m_learned_changes(0)
+    , m_learned_log()
 {
 }
 
@@ -200,6 +239,8 @@ generalized_paxos :: default_leader(abstract_id leader, ballot::type_t t)
         m_accepted[i] = message_p2b(m_acceptor_ballot, m_acceptors[i], cstruct());
     }
 
+    m_learned_stale = true;
+
     if (leader == m_us)
     {
         m_state = LEADING_PHASE2;
@@ -222,7 +263,8 @@ generalized_paxos :: propose(const command& c)
 {
     assert(m_init);
 
-    if (std::find(m_proposed.begin(), m_proposed.end(), c) != m_proposed.end())
+    if (std::find(m_proposed.begin(), m_proposed.end(), c) != m_proposed.end() ||
+        is_learned(c))
     {
         return false;
     }
@@ -317,6 +359,8 @@ generalized_paxos :: advance(bool may_attempt_leadership,
         }
     }
 
+    truncate_histories();
+
     if (m_state >= LEADING_PHASE2 && m_leader_ballot.type == ballot::CLASSIC)
     {
         bool changed = false;
@@ -375,6 +419,7 @@ void
 generalized_paxos :: process_p1a(const message_p1a& m, bool* send, message_p1b* r)
 {
     assert(m_init);
+    CONSUS_PROBE3(paxos_p1a, m.b.leader.get(), uint64_t(m.b.type), m.b.number);
     *send = false;
     size_t idx = index_of(m.b.leader);
 
@@ -408,6 +453,7 @@ bool
 generalized_paxos :: process_p1b(const message_p1b& m)
 {
     assert(m_init);
+    CONSUS_PROBE3(paxos_p1b, m.acceptor.get(), uint64_t(m.b.type), m.b.number);
     size_t idx = index_of(m.acceptor);
 
     if (idx >= m_acceptors.size())
@@ -432,6 +478,7 @@ void
 generalized_paxos :: process_p2a(const message_p2a& m, bool* send, message_p2b* r)
 {
     assert(m_init);
+    CONSUS_PROBE4(paxos_p2a, m.b.leader.get(), uint64_t(m.b.type), m.b.number, m.v.commands.size());
     *send = false;
 
     internal_cstruct imv;
@@ -454,6 +501,7 @@ bool
 generalized_paxos :: process_p2b(const message_p2b& m)
 {
     assert(m_init);
+    CONSUS_PROBE4(paxos_p2b, m.acceptor.get(), uint64_t(m.b.type), m.b.number, m.v.commands.size());
 
     size_t idx = index_of(m.acceptor);
 
@@ -471,6 +519,7 @@ generalized_paxos :: process_p2b(const message_p2b& m)
     {
         m_accepted[idx] = m;
         m_iaccepted[idx] = imv;
+        m_learned_stale = true;
         return true;
     }
 
@@ -483,9 +532,32 @@ generalized_paxos :: learned()
     internal_cstruct iret;
     bool conflict;
     learned(&iret, &conflict);
-    cstruct ret;
-    icstruct_to_cstruct(iret, &ret);
-    return ret;
+    return m_learned_value;
+}
+
+uint64_t
+generalized_paxos :: learned_changes()
+{
+    internal_cstruct iret;
+    bool conflict;
+    learned(&iret, &conflict);
+    return m_learned_changes;
+}
+
+size_t
+generalized_paxos :: learned_since(size_t checkpoint, std::vector<command>* commands)
+{
+    internal_cstruct iret;
+    bool conflict;
+    learned(&iret, &conflict);
+    commands->clear();
+
+    for (size_t i = checkpoint; i < m_learned_log.size(); ++i)
+    {
+        commands->push_back(id_command(m_learned_log[i]));
+    }
+
+    return m_learned_log.size();
 }
 
 void
@@ -582,6 +654,15 @@ generalized_paxos :: quorum()
 void
 generalized_paxos :: learned(internal_cstruct* ret, bool* conflict)
 {
+    // learned is a function of m_accepted and of what was learned before,
+    // and the latter already holds every value the former can produce
+    if (!m_learned_stale)
+    {
+        *ret = m_learned_cached;
+        *conflict = m_learned_conflict;
+        return;
+    }
+
     *conflict = false;
     typedef std::map<ballot, uint64_t> ballot_map_t;
     ballot_map_t ballots;
@@ -628,7 +709,27 @@ generalized_paxos :: learned(internal_cstruct* ret, bool* conflict)
     *ret = internal_cstruct();
     icstruct_lub(&lv_ptrs[0], lv_ptrs.size(), ret);
     GP_ASSERT(icstruct_le(m_learned_cached, *ret));
-    m_learned_cached = *ret;
+
+    if (!icstruct_eq(m_learned_cached, *ret))
+    {
+        icstruct_to_cstruct(*ret, &m_learned_value);
+
+        for (size_t i = 0; i < m_learned_value.commands.size(); ++i)
+        {
+            const uint64_t id = command_id(m_learned_value.commands[i]);
+
+            if (!m_learned_cached.has_command(id))
+            {
+                m_learned_log.push_back(id);
+            }
+        }
+
+        m_learned_cached = *ret;
+        ++m_learned_changes;
+    }
+
+    m_learned_conflict = *conflict;
+    m_learned_stale = false;
 }
 
 void
@@ -767,37 +868,156 @@ generalized_paxos :: proven_safe(internal_cstruct* ret)
     icstruct_lub(&gr_ptrs[0], gr_ptrs.size(), ret);
 }
 
-const generalized_paxos::command&
-generalized_paxos :: id_command(uint64_t c)
+void
+generalized_paxos :: truncate_histories()
 {
-    for (command_map_t::iterator it = m_command_ids.begin();
-            it != m_command_ids.end(); ++it)
+    size_t kept = 0;
+
+    for (size_t i = 0; i < m_proposed.size(); ++i)
     {
-        if (it->second == c)
+        if (!is_learned(m_proposed[i]))
         {
-            return it->first;
+            std::swap(m_proposed[kept], m_proposed[i]);
+            ++kept;
         }
     }
 
-    abort();
+    m_proposed.resize(kept);
+
+    // promises matter only to proven_safe as the leader enters phase 2;
+    // keep their ballots, which count toward resending 1a messages
+    if (m_state == LEADING_PHASE1)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_promises.size(); ++i)
+    {
+        if (!m_promises[i].v.is_none())
+        {
+            m_promises[i].v = cstruct();
+            m_ipromises[i] = internal_cstruct();
+        }
+    }
+}
+
+const generalized_paxos::command&
+generalized_paxos :: id_command(uint64_t c)
+{
+    if (c >= m_commands.size())
+    {
+        abort();
+    }
+
+    return m_commands[c];
 }
 
 uint64_t
 generalized_paxos :: command_id(const command& c)
 {
-    command_map_t::iterator it = m_command_ids.find(c);
+    const uint64_t h = command_hash(c);
+    uint64_t id;
 
-    if (it != m_command_ids.end())
+    if (command_lookup(c, h, &id))
     {
-        return it->second;
+        return id;
     }
 
-    uint64_t id = m_commands.size();
+    id = m_commands.size();
     m_commands.push_back(c);
-    m_command_ids.insert(std::make_pair(c, id));
+    m_command_hashes.push_back(h);
+
+    // keep the table at most half full
+    if (m_command_table.size() < 2 * m_commands.size())
+    {
+        command_table_grow();
+    }
+    else
+    {
+        const uint64_t mask = m_command_table.size() - 1;
+        uint64_t i = h & mask;
+
+        while (m_command_table[i] != 0)
+        {
+            i = (i + 1) & mask;
+        }
+
+        m_command_table[i] = id + 1;
+    }
+
     return id;
 }
 
+bool
+generalized_paxos :: command_lookup(const command& c, uint64_t h, uint64_t* id)
+{
+    if (m_command_table.empty())
+    {
+        return false;
+    }
+
+    const uint64_t mask = m_command_table.size() - 1;
+
+    for (uint64_t i = h & mask; m_command_table[i] != 0; i = (i + 1) & mask)
+    {
+        *id = m_command_table[i] - 1;
+
+        if (m_command_hashes[*id] == h && m_commands[*id] == c)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+generalized_paxos :: is_learned(const command& c)
+{
+    uint64_t id;
+    return command_lookup(c, command_hash(c), &id) &&
+           m_learned_cached.has_command(id);
+}
+
+uint64_t
+generalized_paxos :: command_hash(const command& c)
+{
+    e::compat::hash<std::string> h;
+    uint64_t x = h(c.value) ^ (uint64_t(c.type) * 0x9e3779b97f4a7c15ULL);
+    // the table is indexed by low bits, so mix the high bits down
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+void
+generalized_paxos :: command_table_grow()
+{
+    size_t sz = m_command_table.empty() ? 16 : m_command_table.size();
+
+    while (sz < 2 * m_commands.size())
+    {
+        sz *= 2;
+    }
+
+    m_command_table.clear();
+    m_command_table.resize(sz, 0);
+    const uint64_t mask = sz - 1;
+
+    for (uint64_t id = 0; id < m_commands.size(); ++id)
+    {
+        uint64_t i = m_command_hashes[id] & mask;
+
+        while (m_command_table[i] != 0)
+        {
+            i = (i + 1) & mask;
+        }
+
+        m_command_table[i] = id + 1;
+    }
+}
+
 void
 generalized_paxos :: cstruct_to_icstruct(const cstruct& cs, internal_cstruct* ics)
 {
@@ -819,18 +1039,42 @@ generalized_paxos :: cstruct_to_icstruct(const cstruct& cs, internal_cstruct* ic
         ics->set_adjacent(c, c);
     }
 
-    for (uint64_t i = 0; i < ics->ids.size(); ++i)
+    // Edges only run from earlier commands to later ones, so the closure can
+    // be built incrementally:  command j is reachable from i iff i reaches
+    // one of j's direct (conflicting) predecessors.
+    std::vector<uint64_t> preds(ics->words_per_row());
+
+    for (uint64_t j = 1; j < ics->ids.size(); ++j)
     {
-        for (uint64_t j = i + 1; j < ics->ids.size(); ++j)
+        bool any = false;
+
+        for (size_t x = 0; x < preds.size(); ++x)
+        {
+            preds[x] = 0;
+        }
+
+        for (uint64_t i = 0; i < j; ++i)
         {
             if (m_interfere->conflict(cs.commands[i], cs.commands[j]))
+            {
+                preds[ics->ids[i] / 64] |= 1ULL << (ics->ids[i] % 64);
+                any = true;
+            }
+        }
+
+        if (!any)
+        {
+            continue;
+        }
+
+        for (uint64_t i = 0; i < j; ++i)
+        {
+            if (ics->reaches_any(ics->ids[i], preds))
             {
                 ics->set_adjacent(ics->ids[i], ics->ids[j]);
             }
         }
     }
-
-    ics->close_transitively();
 }
 
 void
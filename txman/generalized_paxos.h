@@ -183,6 +183,12 @@ class generalized_paxos
         // what has been cumulatively learned throughout the system, from the
         // limited amount that this instance can observe
         cstruct learned();
+        // grows by one each time learned() does; learned never shrinks, so
+        // an unchanged count means an unchanged learned()
+        uint64_t learned_changes();
+        // the commands learned after the first checkpoint of them, in the
+        // order they were learned; returns the checkpoint to pass next time
+        size_t learned_since(size_t checkpoint, std::vector<command>* commands);
 
         // used to decide retransmits/etc
         void all_accepted_commands(std::vector<command>* commands);
@@ -207,8 +213,10 @@ class generalized_paxos
 
             void set_N(uint64_t N);
             void close_transitively();
+            bool reaches_any(uint64_t u, const std::vector<uint64_t>& mask) const;
             void swap(internal_cstruct* other);
 
+            uint64_t words_per_row() const;
             uint64_t byte(uint64_t u, uint64_t v) const;
             uint64_t bit(uint64_t u, uint64_t v) const;
 
@@ -216,7 +224,6 @@ class generalized_paxos
             std::vector<uint64_t> transitive_closure;
             uint64_t transitive_closure_N;
         };
-        typedef std::map<command, uint64_t> command_map_t;
         friend std::ostream& operator << (std::ostream& lhs, const internal_cstruct& rhs);
 
     private:
@@ -227,10 +234,17 @@ class generalized_paxos
         void learned(const internal_cstruct** vs, size_t vs_sz, size_t max_sz,
                      std::vector<internal_cstruct>* lv, bool* conflict);
         void proven_safe(internal_cstruct* ics);
+        // drop what no longer influences the protocol:  proposals already
+        // learned, and promises once phase 1 of their ballot is over
+        void truncate_histories();
 
         // command manipulation
         const command& id_command(uint64_t c);
         uint64_t command_id(const command& c);
+        bool command_lookup(const command& c, uint64_t h, uint64_t* id);
+        bool is_learned(const command& c);
+        static uint64_t command_hash(const command& c);
+        void command_table_grow();
 
         // cstructs are command histories as described in the paper,
         // not sequences
@@ -255,8 +269,12 @@ class generalized_paxos
         abstract_id m_us;
         std::vector<abstract_id> m_acceptors;
         std::vector<command> m_proposed;
+        // interned commands:  m_commands[id] is the command with that id, and
+        // m_command_table is an open-addressed table of id + 1 (0 is empty)
+        // keyed by the hashes cached in m_command_hashes
         std::vector<command> m_commands;
-        command_map_t m_command_ids;
+        std::vector<uint64_t> m_command_hashes;
+        std::vector<uint64_t> m_command_table;
 
         ballot m_acceptor_ballot;
         cstruct m_acceptor_value;
@@ -272,7 +290,16 @@ class generalized_paxos
         std::vector<message_p2b> m_accepted;
         std::vector<internal_cstruct> m_iaccepted;
 
+        // learned is recomputed only after m_accepted changes
         internal_cstruct m_learned_cached;
+        cstruct m_learned_value;
+        bool m_learned_conflict;
+        bool m_learned_stale;
+        uint64_t m_learned_changes;
+        // ids of learned commands in the order they were learned; a prefix
+        // of it is a checkpoint, and learned commands are never proposed
+        // again, so m_proposed holds only those yet to be learned
+        std::vector<uint64_t> m_learned_log;
 
     private:
         generalized_paxos(const generalized_paxos&);
@@ -148,7 +148,7 @@ global_voter :: global_voter(const transaction_group& tg)
     , m_data_center_cmp(new data_center_comparator(m_global_cmp.get()))
     , m_data_center_gp()
     , m_highest_log_entry(0)
-    , m_dc_prev_learned()
+    , m_dc_checkpoint(0)
     , m_xmit_vote()
     , m_xmit_outer_m1a()
     , m_xmit_outer_m2a()
@@ -161,7 +161,7 @@ global_voter :: global_voter(const transaction_group& tg)
     , m_dcs_sz(0)
     , m_global_cmp(new global_comparator())
     , m_global_gp()
-    , m_global_exec()
+    , m_global_init_time(0)
     , m_has_outcome(false)
     , m_outcome(0)
 {
@@ -170,6 +170,9 @@ global_voter :: global_voter(const transaction_group& tg)
         m_dcs_timestamps[i] = 0;
         m_outcomes[i] = 0;
     }
+
+    m_xmit_outer_m1a.backoff_new_values();
+    m_xmit_inner_m1a.backoff_new_values();
 }
 
 global_voter :: ~global_voter() throw ()
@@ -265,7 +268,11 @@ global_voter :: init(uint64_t vote, const paxos_group_id* dcs, size_t dcs_sz, da
     abstract_id global_acceptors[CONSUS_MAX_REPLICATION_FACTOR];
     copy(m_dcs, m_dcs_sz, global_acceptors);
     m_global_gp.init(m_global_cmp.get(), abstract_id(m_tg.group.get()), global_acceptors, m_dcs_sz);
+    // every data center's vote commutes with every other's, so the fast
+    // ballot decides in one wide-area round trip unless something conflicts,
+    // and only then does the leader fall back to a classic ballot
     m_global_gp.default_leader(global_acceptors[0], generalized_paxos::ballot::FAST);
+    m_global_init_time = po6::monotonic_time();
     // do this at the very end so any failures lead to this being GC'd
     LOG_IF(INFO, s_debug_mode) << logid() << "data centers: " << debug;
     m_global_init = true;
@@ -593,10 +600,7 @@ global_voter :: debug_dump()
                                       e::compat::bind(&global_voter::pretty_print_outer_command, this, e::compat::placeholders::_1));
     ostr << prefix_lines("data center paxos: ", tmp);
 
-    for (size_t i = 0; i < m_global_exec.size(); ++i)
-    {
-        ostr << "command[" << i << "] " << pretty_print_outer(m_global_exec[i]) << "\n";
-    }
+    ostr << "executed " << m_dc_checkpoint << " learned commands\n";
 
     tmp = m_global_gp.debug_dump(e::compat::bind(&global_voter::pretty_print_inner_cstruct, this, e::compat::placeholders::_1),
                                  e::compat::bind(&global_voter::pretty_print_inner_command, this, e::compat::placeholders::_1));
@@ -856,7 +860,7 @@ global_voter :: work_state_machine(daemon* d)
         std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
         msg->pack_at(BUSYBEE_HEADER_SIZE) << GV_VOTE_1A << m_tg << m1;
         m_xmit_outer_m1a.transmit_now(m1, now, m_highest_log_entry, &log_entry, &send_func);
-        (d->*send_func)(m_highest_log_entry, m_tg.group, msg);
+        (d->*send_func)(log_entry, m_tg.group, msg);
     }
 
     if (send_m2 && m_xmit_outer_m2a.may_transmit(m2, now, d))
@@ -874,7 +878,7 @@ global_voter :: work_state_machine(daemon* d)
         std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
         msg->pack_at(BUSYBEE_HEADER_SIZE) << GV_VOTE_2A << m_tg << m2;
         m_xmit_outer_m2a.transmit_now(m2, now, m_highest_log_entry, &log_entry, &send_func);
-        (d->*send_func)(m_highest_log_entry, m_tg.group, msg);
+        (d->*send_func)(log_entry, m_tg.group, msg);
     }
 
     if (send_m3 && m_xmit_outer_m2b.may_transmit(m3, now, d))
@@ -892,7 +896,7 @@ global_voter :: work_state_machine(daemon* d)
         std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
         msg->pack_at(BUSYBEE_HEADER_SIZE) << GV_VOTE_2B << m_tg << m3;
         m_xmit_outer_m2b.transmit_now(m3, now, m_highest_log_entry, &log_entry, &send_func);
-        (d->*send_func)(m_highest_log_entry, m_tg.group, msg);
+        (d->*send_func)(log_entry, m_tg.group, msg);
     }
 
     if (!preconditions_for_global_paxos(d))
@@ -923,22 +927,10 @@ global_voter :: work_state_machine(daemon* d)
         }
     }
 
-    generalized_paxos::cstruct dc_learned = m_data_center_gp.learned();
-
-    if (dc_learned.commands.size() < m_dc_prev_learned.commands.size())
-    {
-        LOG(ERROR) << logid() << "outer generalized paxos unlearned state machine's input: "
-                   << pretty_print_outer(m_dc_prev_learned)
-                   << " truncated to "
-                   << pretty_print_outer(dc_learned);
-    }
-
-    if (s_debug_mode && dc_learned != m_dc_prev_learned)
-    {
-        LOG(INFO) << logid() << "learned state machine input "
-                  << pretty_print_outer(dc_learned);
-        m_dc_prev_learned = dc_learned;
-    }
+    // learned never shrinks and every command in it executes once, so only
+    // those learned since the last checkpoint remain to be executed
+    std::vector<generalized_paxos::command> dc_learned;
+    m_dc_checkpoint = m_data_center_gp.learned_since(m_dc_checkpoint, &dc_learned);
 
     // the value of "lead" *must* be deterministicly derived from something such
     // that each invocation of "advance" below will be the same for each replica
@@ -948,17 +940,10 @@ global_voter :: work_state_machine(daemon* d)
     // of the outer state machine, and not circumstances of execution.
     bool lead = m_tg.group == m_tg.txid.group;//XXX failure sensitive
 
-    for (size_t i = 0; i < dc_learned.commands.size(); ++i)
+    for (size_t i = 0; i < dc_learned.size(); ++i)
     {
-        const generalized_paxos::command& c(dc_learned.commands[i]);
-
-        if (std::find(m_global_exec.begin(), m_global_exec.end(), c) != m_global_exec.end())
-        {
-            continue;
-        }
-
+        const generalized_paxos::command& c(dc_learned[i]);
         LOG_IF(INFO, s_debug_mode) << logid() << "executing " << pretty_print_outer(c);
-        m_global_exec.push_back(c);
         generalized_paxos::command inner_c;
         generalized_paxos::message_p1a inner_m1a;
         generalized_paxos::message_p1b inner_m1b;
@@ -1078,6 +1063,19 @@ global_voter :: work_state_machine(daemon* d)
             {
                 m_has_outcome = true;
                 m_outcome = outcome;
+                const uint64_t elapsed = po6::monotonic_time() - m_global_init_time;
+
+                if (m_global_gp.acceptor_ballot().type == generalized_paxos::ballot::FAST)
+                {
+                    d->m_global_votes_fast.record(elapsed);
+                }
+                else
+                {
+                    d->m_global_votes_classic.record(elapsed);
+                }
+
+                d->m_phases.record(m_tg.group, m_dcs, m_dcs_sz,
+                                   phase_latency::GLOBAL_PAXOS, elapsed);
             }
         }
     }
@@ -1160,6 +1158,11 @@ global_voter :: send_global(const generalized_paxos::message_p2b& m, daemon* d)
     }
 }
 
+// Each inner message crosses the WAN once per data center as a single
+// GV_PROPOSE command.  Its cstruct holds at most one vote (and one re-cast
+// vote) per data center, i.e. fewer than 2 * CONSUS_MAX_REPLICATION_FACTOR
+// small commands, so sending it whole is cheap and keeps every message
+// self-contained for the outer Paxos that orders it at each data center.
 void
 global_voter :: propose_global(const generalized_paxos::command& c, uint64_t log_entry,
                                daemon* d, void (daemon::*send_func)(int64_t, paxos_group_id, std::auto_ptr<e::buffer>))
@@ -36,6 +36,7 @@
 
 // consus
 #include "namespace.h"
+#include "common/alloc_stats.h"
 #include "common/transmit_limiter.h"
 #include "common/transaction_group.h"
 #include "txman/generalized_paxos.h"
@@ -43,7 +44,7 @@
 BEGIN_CONSUS_NAMESPACE
 class daemon;
 
-class global_voter
+class global_voter : public tagged<ALLOC_VOTERS>
 {
     public:
         enum transition_t
@@ -113,7 +114,8 @@ class global_voter
         const std::auto_ptr<data_center_comparator> m_data_center_cmp;
         generalized_paxos m_data_center_gp;
         int64_t m_highest_log_entry;
-        generalized_paxos::cstruct m_dc_prev_learned;
+        // how many learned data center paxos commands have executed
+        size_t m_dc_checkpoint;
         // data center paxos: rate limiting
         transmit_limiter<uint64_t, daemon> m_xmit_vote;
         transmit_limiter<uint64_t, daemon> m_xmit_proposals[CONSUS_MAX_REPLICATION_FACTOR];
@@ -132,7 +134,7 @@ class global_voter
         size_t m_dcs_sz;
         const std::auto_ptr<global_comparator> m_global_cmp;
         generalized_paxos m_global_gp;
-        std::vector<generalized_paxos::command> m_global_exec;
+        uint64_t m_global_init_time;
         // outcome
         bool m_has_outcome;
         uint64_t m_outcome;
@@ -0,0 +1,141 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <algorithm>
+
+// consus
+#include "txman/group_lease.h"
+
+using consus::group_lease;
+
+group_lease :: group_lease()
+    : m_duration(0)
+    , m_drift_ppm(0)
+    , m_mtx()
+    , m_next_nonce(1)
+    , m_holding()
+    , m_granting()
+{
+}
+
+group_lease :: ~group_lease() throw ()
+{
+}
+
+void
+group_lease :: configure(uint64_t duration, uint64_t drift_ppm)
+{
+    m_duration = duration;
+    m_drift_ppm = drift_ppm;
+}
+
+uint64_t
+group_lease :: request(paxos_group_id g, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    holding* h = &m_holding[g];
+    // grants for an older request arrive too late to be counted
+    h->nonce = m_next_nonce++;
+    h->sent = now;
+    h->grants.clear();
+    return h->nonce;
+}
+
+void
+group_lease :: granted(paxos_group_id g, comm_id from, uint64_t nonce,
+                       unsigned quorum, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::map<paxos_group_id, holding>::iterator it = m_holding.find(g);
+
+    if (it == m_holding.end() || it->second.nonce != nonce)
+    {
+        return;
+    }
+
+    holding* h = &it->second;
+
+    if (std::find(h->grants.begin(), h->grants.end(), from) == h->grants.end())
+    {
+        h->grants.push_back(from);
+    }
+
+    if (h->grants.size() < quorum || m_duration <= slack())
+    {
+        return;
+    }
+
+    const uint64_t until = h->sent + m_duration - slack();
+
+    if (until > now)
+    {
+        h->until = std::max(h->until, until);
+    }
+}
+
+bool
+group_lease :: held(paxos_group_id g, uint64_t now)
+{
+    if (!enabled())
+    {
+        return false;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::map<paxos_group_id, holding>::iterator it = m_holding.find(g);
+    return it != m_holding.end() && now < it->second.until;
+}
+
+bool
+group_lease :: grant(paxos_group_id g, comm_id holder, uint64_t now)
+{
+    if (!enabled())
+    {
+        return false;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    granting* gr = &m_granting[g];
+
+    if (gr->holder != holder && now < gr->until)
+    {
+        return false;
+    }
+
+    gr->holder = holder;
+    gr->until = now + m_duration + slack();
+    return true;
+}
+
+uint64_t
+group_lease :: slack() const
+{
+    return m_duration / 1000000 * m_drift_ppm
+         + m_duration % 1000000 * m_drift_ppm / 1000000;
+}
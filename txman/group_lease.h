@@ -0,0 +1,113 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_txman_group_lease_h_
+#define consus_txman_group_lease_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Read leases for paxos groups.  The first member of a group asks every
+// member for a lease; each member that grants it promises not to grant
+// another member one until it runs out.  Once a quorum has granted the same
+// request, the holder may answer reads without waiting for the group.
+//
+// Each side times the lease on its own monotonic clock, so neither trusts
+// the other's.  The holder starts counting when it sent the request, before
+// any grant could have been made, and stops early by the drift bound; a
+// grantor starts counting when it granted and holds its promise late by the
+// same bound.  As long as no clock runs faster than that bound relative to
+// another, the holder stops using its lease before any grantor forgets it.
+class group_lease
+{
+    public:
+        group_lease();
+        ~group_lease() throw ();
+
+    public:
+        // zero duration disables leases
+        void configure(uint64_t duration, uint64_t drift_ppm);
+        bool enabled() const { return m_duration > 0; }
+        uint64_t duration() const { return m_duration; }
+
+    public:
+        // as holder: a fresh request for g, sent at now
+        uint64_t request(paxos_group_id g, uint64_t now);
+        // as holder: from granted request nonce of g
+        void granted(paxos_group_id g, comm_id from, uint64_t nonce,
+                     unsigned quorum, uint64_t now);
+        bool held(paxos_group_id g, uint64_t now);
+        // as grantor: whether holder may have g's lease, starting now
+        bool grant(paxos_group_id g, comm_id holder, uint64_t now);
+
+    private:
+        struct holding
+        {
+            holding() : nonce(0), sent(0), grants(), until(0) {}
+            uint64_t nonce;
+            uint64_t sent;
+            std::vector<comm_id> grants;
+            uint64_t until;
+        };
+        struct granting
+        {
+            granting() : holder(), until(0) {}
+            comm_id holder;
+            uint64_t until;
+        };
+        uint64_t slack() const;
+
+    private:
+        uint64_t m_duration;
+        uint64_t m_drift_ppm;
+        po6::threads::mutex m_mtx;
+        uint64_t m_next_nonce;
+        std::map<paxos_group_id, holding> m_holding;
+        std::map<paxos_group_id, granting> m_granting;
+
+    private:
+        group_lease(const group_lease&);
+        group_lease& operator = (const group_lease&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_group_lease_h_
@@ -0,0 +1,162 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "txman/group_load.h"
+
+using consus::group_load;
+
+#define GROUP_LOAD_STALE (PO6_SECONDS * 1)
+// a log faster than this is not what holds a group back
+#define GROUP_LOAD_MIN_LATENCY 1000ULL
+
+group_load :: group_load()
+    : m_mtx()
+    , m_log_latency(0)
+    , m_loads()
+{
+}
+
+group_load :: ~group_load() throw ()
+{
+}
+
+void
+group_load :: observe_log_latency(uint64_t nanos)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    // weight the newest sample by 1/8, as TCP smooths its RTT
+    m_log_latency = m_log_latency == 0 ? nanos : m_log_latency - m_log_latency / 8 + nanos / 8;
+}
+
+uint64_t
+group_load :: log_latency()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_log_latency;
+}
+
+void
+group_load :: observe(paxos_group_id g, comm_id member,
+                      uint64_t inflight, uint64_t log_latency, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    load* l = &m_loads[g];
+    report* r = &l->members[member];
+    r->inflight = inflight;
+    r->log_latency = log_latency;
+    r->when = now;
+    l->placed = 0;
+}
+
+consus::paxos_group_id
+group_load :: choose(const std::vector<paxos_group_id>& groups,
+                     uint64_t nonce, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    const size_t start = nonce % groups.size();
+    size_t best = start;
+    uint64_t best_cost = UINT64_MAX;
+
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        const size_t idx = (start + i) % groups.size();
+        load_map_t::iterator it = m_loads.find(groups[idx]);
+        const uint64_t c = it != m_loads.end() ? cost(it->second, now) : 0;
+
+        if (c < best_cost)
+        {
+            best = idx;
+            best_cost = c;
+        }
+    }
+
+    ++m_loads[groups[best]].placed;
+    return groups[best];
+}
+
+std::string
+group_load :: debug_dump()
+{
+    const uint64_t now = po6::monotonic_time();
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "log latency=" << m_log_latency / 1000 << "us\n";
+
+    for (load_map_t::iterator it = m_loads.begin(); it != m_loads.end(); ++it)
+    {
+        ostr << it->first << " cost=" << cost(it->second, now)
+             << " placed=" << it->second.placed << "\n";
+
+        for (std::map<comm_id, report>::iterator r = it->second.members.begin();
+                r != it->second.members.end(); ++r)
+        {
+            ostr << "    " << r->first << " inflight=" << r->second.inflight
+                 << " log latency=" << r->second.log_latency / 1000 << "us"
+                 << " age=" << (now - r->second.when) / PO6_MILLIS << "ms\n";
+        }
+    }
+
+    return ostr.str();
+}
+
+uint64_t
+group_load :: cost(const load& l, uint64_t now)
+{
+    uint64_t inflight = 0;
+    uint64_t latency = 0;
+    bool fresh = false;
+
+    for (std::map<comm_id, report>::const_iterator it = l.members.begin();
+            it != l.members.end(); ++it)
+    {
+        if (it->second.when + GROUP_LOAD_STALE < now)
+        {
+            continue;
+        }
+
+        inflight = std::max(inflight, it->second.inflight);
+        latency = std::max(latency, it->second.log_latency);
+        fresh = true;
+    }
+
+    if (!fresh)
+    {
+        return 0;
+    }
+
+    latency = std::max<uint64_t>(latency, GROUP_LOAD_MIN_LATENCY);
+    return (inflight + l.placed + 1) * latency;
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_txman_group_load_h_
+#define consus_txman_group_load_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+// members report this often, well within the time a report stays fresh
+#define GROUP_LOAD_INTERVAL (PO6_MILLIS * 100)
+
+BEGIN_CONSUS_NAMESPACE
+
+// How busy each transaction manager group is, as its members last reported:
+// the transactions each has in flight for the group and how long its durable
+// log takes to make a record durable.  Every member of a group runs every
+// one of the group's transactions, so a group moves only as fast as its
+// slowest member; a group's cost is its busiest member's in-flight count
+// times its slowest member's log latency.
+//
+// Reports go stale after GROUP_LOAD_STALE, and a group without fresh reports
+// costs nothing, so that a group everyone avoided is eventually tried again.
+class group_load
+{
+    public:
+        group_load();
+        ~group_load() throw ();
+
+    public:
+        // this daemon's own log, smoothed
+        void observe_log_latency(uint64_t nanos);
+        uint64_t log_latency();
+        void observe(paxos_group_id g, comm_id member,
+                     uint64_t inflight, uint64_t log_latency, uint64_t now);
+        // the cheapest of groups; ties fall to the one nonce picks
+        paxos_group_id choose(const std::vector<paxos_group_id>& groups,
+                              uint64_t nonce, uint64_t now);
+        std::string debug_dump();
+
+    private:
+        struct report
+        {
+            report() : inflight(0), log_latency(0), when(0) {}
+            uint64_t inflight;
+            uint64_t log_latency;
+            uint64_t when;
+        };
+        struct load
+        {
+            load() : members(), placed(0) {}
+            std::map<comm_id, report> members;
+            // chosen since the last report, so that one stale view does not
+            // send every new transaction to the same group
+            uint64_t placed;
+        };
+        typedef std::map<paxos_group_id, load> load_map_t;
+        uint64_t cost(const load& l, uint64_t now);
+
+    private:
+        po6::threads::mutex m_mtx;
+        uint64_t m_log_latency;
+        load_map_t m_loads;
+
+    private:
+        group_load(const group_load&);
+        group_load& operator = (const group_load&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_group_load_h_
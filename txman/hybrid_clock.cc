@@ -0,0 +1,103 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "txman/hybrid_clock.h"
+
+using consus::hybrid_clock;
+
+// furthest ahead of the local wallclock an observed timestamp may be
+#define HLC_MAX_OFFSET (1000 * PO6_MILLIS)
+
+hybrid_clock :: hybrid_clock()
+    : m_last(0)
+    , m_rejected(0)
+{
+}
+
+hybrid_clock :: ~hybrid_clock() throw ()
+{
+}
+
+uint64_t
+hybrid_clock :: now()
+{
+    while (true)
+    {
+        const uint64_t last = e::atomic::load_64_acquire(&m_last);
+        const uint64_t wall = po6::wallclock_time();
+        const uint64_t next = wall > last ? wall : last + 1;
+
+        if (e::atomic::compare_and_swap_64_nobarrier(&m_last, last, next) == last)
+        {
+            return next;
+        }
+    }
+}
+
+void
+hybrid_clock :: observe(uint64_t timestamp)
+{
+    if (timestamp > po6::wallclock_time() + HLC_MAX_OFFSET)
+    {
+        e::atomic::increment_64_nobarrier(&m_rejected, 1);
+        return;
+    }
+
+    while (true)
+    {
+        const uint64_t last = e::atomic::load_64_acquire(&m_last);
+
+        if (timestamp <= last ||
+            e::atomic::compare_and_swap_64_nobarrier(&m_last, last, timestamp) == last)
+        {
+            return;
+        }
+    }
+}
+
+std::string
+hybrid_clock :: debug_dump()
+{
+    const uint64_t last = e::atomic::load_64_acquire(&m_last);
+    const uint64_t wall = po6::wallclock_time();
+    std::ostringstream ostr;
+    ostr << "ahead of wallclock by " << (last > wall ? last - wall : 0) << "ns"
+         << "; ignored " << e::atomic::load_64_acquire(&m_rejected)
+         << " timestamps too far ahead\n";
+    return ostr.str();
+}
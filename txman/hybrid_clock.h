@@ -0,0 +1,72 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_txman_hybrid_clock_h_
+#define consus_txman_hybrid_clock_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <string>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// A hybrid logical clock for transaction timestamps.  It reads as wallclock
+// nanoseconds, except that every reading is strictly greater than every
+// earlier reading and every timestamp observed from a peer; the logical part
+// is carried in the low-order nanoseconds.  Transactions begun here are thus
+// ordered after those whose timestamps reached us, however far our wallclock
+// trails theirs.  Observations more than HLC_MAX_OFFSET ahead of our
+// wallclock are ignored so that one bad clock cannot drag the others along.
+class hybrid_clock
+{
+    public:
+        hybrid_clock();
+        ~hybrid_clock() throw ();
+
+    public:
+        uint64_t now();
+        void observe(uint64_t timestamp);
+        std::string debug_dump();
+
+    private:
+        uint64_t m_last;
+        uint64_t m_rejected;
+
+    private:
+        hybrid_clock(const hybrid_clock&);
+        hybrid_clock& operator = (const hybrid_clock&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_hybrid_clock_h_
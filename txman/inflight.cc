@@ -0,0 +1,101 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+
+// consus
+#include "txman/inflight.h"
+
+using consus::inflight;
+
+inflight :: inflight()
+    : m_shards()
+{
+}
+
+inflight :: ~inflight() throw ()
+{
+}
+
+void
+inflight :: add(const transaction_group& tg, uint64_t since)
+{
+    shard* s = get_shard(tg);
+    po6::threads::mutex::hold hold(&s->mtx);
+    s->txs.insert(std::make_pair(since, tg));
+}
+
+void
+inflight :: remove(const transaction_group& tg, uint64_t since)
+{
+    shard* s = get_shard(tg);
+    po6::threads::mutex::hold hold(&s->mtx);
+    s->txs.erase(std::make_pair(since, tg));
+}
+
+void
+inflight :: oldest(size_t n, std::vector<entry>* entries)
+{
+    entries->clear();
+
+    for (size_t i = 0; i < INFLIGHT_SHARDS; ++i)
+    {
+        po6::threads::mutex::hold hold(&m_shards[i].mtx);
+        std::set<entry>::iterator it = m_shards[i].txs.begin();
+
+        for (size_t j = 0; j < n && it != m_shards[i].txs.end(); ++j, ++it)
+        {
+            entries->push_back(*it);
+        }
+    }
+
+    std::sort(entries->begin(), entries->end());
+    entries->resize(std::min(n, entries->size()));
+}
+
+void
+inflight :: render(std::ostream& out, size_t n, uint64_t now)
+{
+    std::vector<entry> entries;
+    oldest(n, &entries);
+    out << "# TYPE consus_oldest_transaction_seconds gauge\n";
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const uint64_t age = now > entries[i].first ? now - entries[i].first : 0;
+        out << "consus_oldest_transaction_seconds{rank=\"" << i << "\""
+            << ",transaction=\"" << transaction_group::log(entries[i].second) << "\"} "
+            << age * 1e-9 << "\n";
+    }
+}
+
+inflight::shard*
+inflight :: get_shard(const transaction_group& tg)
+{
+    return &m_shards[tg.hash() % INFLIGHT_SHARDS];
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_inflight_h_
+#define consus_txman_inflight_h_
+
+// STL
+#include <iostream>
+#include <set>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/transaction_group.h"
+
+// independently locked sets the transactions are spread over
+#define INFLIGHT_SHARDS 16
+
+BEGIN_CONSUS_NAMESPACE
+
+// The transactions this daemon is working on, ordered by when it started on
+// them.  Transactions add themselves when they begin executing and remove
+// themselves when they terminate, so finding the oldest never walks the
+// transaction table.
+class inflight
+{
+    public:
+        typedef std::pair<uint64_t, transaction_group> entry;
+
+    public:
+        inflight();
+        ~inflight() throw ();
+
+    public:
+        void add(const transaction_group& tg, uint64_t since);
+        void remove(const transaction_group& tg, uint64_t since);
+        // at most n entries, oldest first
+        void oldest(size_t n, std::vector<entry>* entries);
+        // append as Prometheus gauges, ages relative to now
+        void render(std::ostream& out, size_t n, uint64_t now);
+
+    private:
+        struct shard
+        {
+            shard() : mtx(), txs() {}
+            po6::threads::mutex mtx;
+            std::set<entry> txs;
+        };
+        shard* get_shard(const transaction_group& tg);
+
+    private:
+        shard m_shards[INFLIGHT_SHARDS];
+
+    private:
+        inflight(const inflight&);
+        inflight& operator = (const inflight&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_inflight_h_
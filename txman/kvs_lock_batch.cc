@@ -0,0 +1,188 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <memory>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/buffer_pool.h"
+#include "common/network_msgtype.h"
+#include "txman/daemon.h"
+#include "txman/kvs_lock_batch.h"
+
+using consus::kvs_lock_batch;
+
+struct kvs_lock_batch :: entry
+{
+    entry();
+    entry(comm_id kvs, uint64_t nonce, lock_op op,
+          const e::slice& table, const e::slice& key);
+    ~entry() throw () {}
+    bool operator < (const entry& rhs) const;
+
+    comm_id kvs;
+    uint64_t nonce;
+    lock_op op;
+    e::slice table;
+    e::slice key;
+};
+
+kvs_lock_batch :: entry :: entry()
+    : kvs()
+    , nonce()
+    , op()
+    , table()
+    , key()
+{
+}
+
+kvs_lock_batch :: entry :: entry(comm_id k, uint64_t n, lock_op o,
+                                 const e::slice& t, const e::slice& y)
+    : kvs(k)
+    , nonce(n)
+    , op(o)
+    , table(t)
+    , key(y)
+{
+}
+
+bool
+kvs_lock_batch :: entry :: operator < (const entry& rhs) const
+{
+    if (kvs != rhs.kvs)
+    {
+        return kvs < rhs.kvs;
+    }
+
+    int cmp = table.compare(rhs.table);
+
+    if (cmp != 0)
+    {
+        return cmp < 0;
+    }
+
+    return key.compare(rhs.key) < 0;
+}
+
+kvs_lock_batch :: kvs_lock_batch()
+    : m_entries()
+{
+}
+
+kvs_lock_batch :: ~kvs_lock_batch() throw ()
+{
+}
+
+void
+kvs_lock_batch :: add(comm_id kvs, uint64_t nonce, lock_op op,
+                      const e::slice& table, const e::slice& key)
+{
+    m_entries.push_back(entry(kvs, nonce, op, table, key));
+}
+
+void
+kvs_lock_batch :: flush(const transaction_group& tg, daemon* d)
+{
+    // group by destination; within a group the kvs acquires in this order
+    std::sort(m_entries.begin(), m_entries.end());
+    const entry* ptr = m_entries.empty() ? NULL : &m_entries[0];
+    const entry* const end = ptr + m_entries.size();
+
+    while (ptr < end)
+    {
+        const entry* eptr = ptr;
+
+        while (eptr < end && eptr->kvs == ptr->kvs)
+        {
+            ++eptr;
+        }
+
+        if (eptr - ptr == 1)
+        {
+            send_one(*ptr, tg, d);
+        }
+        else
+        {
+            send_many(ptr, eptr, tg, d);
+        }
+
+        ptr = eptr;
+    }
+
+    m_entries.clear();
+}
+
+void
+kvs_lock_batch :: send_one(const entry& ent, const transaction_group& tg, daemon* d)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_LOCK_OP)
+                    + sizeof(uint64_t)
+                    + pack_size(ent.table)
+                    + pack_size(ent.key)
+                    + pack_size(tg)
+                    + pack_size(ent.op);
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_LOCK_OP << ent.nonce << ent.table << ent.key << tg << ent.op;
+    d->send(ent.kvs, msg);
+    d->m_costs.sent(tg, KVS_LOCK_OP, sz);
+}
+
+void
+kvs_lock_batch :: send_many(const entry* start, const entry* limit,
+                            const transaction_group& tg, daemon* d)
+{
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(KVS_LOCK_OP_BATCH)
+              + pack_size(tg)
+              + sizeof(uint64_t);
+
+    for (const entry* ent = start; ent < limit; ++ent)
+    {
+        sz += sizeof(uint64_t)
+            + pack_size(ent->table)
+            + pack_size(ent->key)
+            + pack_size(ent->op);
+    }
+
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_LOCK_OP_BATCH << tg << uint64_t(limit - start);
+
+    for (const entry* ent = start; ent < limit; ++ent)
+    {
+        pa = pa << ent->nonce << ent->table << ent->key << ent->op;
+    }
+
+    d->send(start->kvs, msg);
+    d->m_costs.sent(tg, KVS_LOCK_OP_BATCH, sz);
+}
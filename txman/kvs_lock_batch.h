@@ -0,0 +1,76 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_kvs_lock_batch_h_
+#define consus_txman_kvs_lock_batch_h_
+
+// STL
+#include <vector>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "common/lock.h"
+#include "common/transaction_group.h"
+
+BEGIN_CONSUS_NAMESPACE
+class daemon;
+
+// Collects the lock operations one pass of a transaction's state machine
+// issues so that each key-value store receives them in a single
+// KVS_LOCK_OP_BATCH.  The slices must outlive the call to flush.
+class kvs_lock_batch
+{
+    public:
+        kvs_lock_batch();
+        ~kvs_lock_batch() throw ();
+
+    public:
+        void add(comm_id kvs, uint64_t nonce, lock_op op,
+                 const e::slice& table, const e::slice& key);
+        void flush(const transaction_group& tg, daemon* d);
+
+    private:
+        struct entry;
+        void send_one(const entry& ent, const transaction_group& tg, daemon* d);
+        void send_many(const entry* start, const entry* limit,
+                       const transaction_group& tg, daemon* d);
+
+    private:
+        std::vector<entry> m_entries;
+
+    private:
+        kvs_lock_batch(const kvs_lock_batch&);
+        kvs_lock_batch& operator = (const kvs_lock_batch&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_kvs_lock_batch_h_
@@ -25,13 +25,18 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// po6
+#include <po6/time.h>
+
 // BusyBee
 #include <busybee.h>
 
 // consus
+#include "common/buffer_pool.h"
 #include "common/network_msgtype.h"
 #include "txman/configuration.h"
 #include "txman/daemon.h"
+#include "txman/kvs_lock_batch.h"
 #include "txman/kvs_lock_op.h"
 
 using consus::kvs_lock_op;
@@ -41,6 +46,7 @@ kvs_lock_op :: kvs_lock_op(const uint64_t& sk)
     , m_mtx()
     , m_init(false)
     , m_finished(false)
+    , m_traced_since(0)
     , m_client()
     , m_client_nonce()
     , m_tx_group()
@@ -67,8 +73,26 @@ kvs_lock_op :: finished()
 }
 
 void
-kvs_lock_op :: doit(lock_op op, const e::slice& table, const e::slice& key, const transaction_group& tg, daemon* d)
+kvs_lock_op :: doit(lock_op op, const e::slice& table, const e::slice& key,
+                    const transaction_group& tg, daemon* d, kvs_lock_batch* batch)
 {
+    configuration* c = d->get_config();
+    const data_center_id dc = c->data_center_for(table, d->m_us.dc);
+    comm_id kvs = c->choose_kvs(dc, table, key, m_state_key, d->m_us, &d->m_kvs_pressure);
+    const uint64_t since = tracer::tagged(m_state_key) ? po6::wallclock_time() : 0;
+
+    if (batch)
+    {
+        {
+            po6::threads::mutex::hold hold(&m_mtx);
+            m_init = true;
+            m_traced_since = since;
+        }
+
+        batch->add(kvs, m_state_key, op, table, key);
+        return;
+    }
+
     const size_t sz = BUSYBEE_HEADER_SIZE
                     + pack_size(KVS_LOCK_OP)
                     + sizeof(uint64_t)
@@ -76,14 +100,14 @@ kvs_lock_op :: doit(lock_op op, const e::slice& table, const e::slice& key, cons
                     + pack_size(key)
                     + pack_size(tg)
                     + pack_size(op);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
         << KVS_LOCK_OP << m_state_key << table << key << tg << op;
-    configuration* c = d->get_config();
-    comm_id kvs = c->choose_kvs(d->m_us.dc);
     d->send(kvs, msg);
+    d->m_costs.sent(tg, KVS_LOCK_OP, sz);
     po6::threads::mutex::hold hold(&m_mtx);
     m_init = true;
+    m_traced_since = since;
 }
 
 void
@@ -95,6 +119,13 @@ kvs_lock_op :: response(consus_returncode rc, daemon* d)
 
     {
         po6::threads::mutex::hold hold(&m_mtx);
+
+        if (m_traced_since != 0 && !m_finished && m_tx_group != transaction_group())
+        {
+            d->m_tracer.span("kvs_lock_op", m_tx_group, m_state_key,
+                             m_traced_since, po6::wallclock_time());
+        }
+
         m_finished = true;
 
         if (m_client != comm_id())
@@ -103,7 +134,7 @@ kvs_lock_op :: response(consus_returncode rc, daemon* d)
                             + pack_size(CLIENT_RESPONSE)
                             + sizeof(uint64_t)
                             + pack_size(rc);
-            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
             msg->pack_at(BUSYBEE_HEADER_SIZE)
                 << CLIENT_RESPONSE << m_client_nonce << rc;
             d->send(m_client, msg);
@@ -126,6 +157,20 @@ kvs_lock_op :: response(consus_returncode rc, daemon* d)
     }
 }
 
+void
+kvs_lock_op :: cancel()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_finished = true;
+}
+
+transaction_group
+kvs_lock_op :: tx_group()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_tx_group;
+}
+
 void
 kvs_lock_op :: callback_client(comm_id client, uint64_t nonce)
 {
@@ -43,13 +43,15 @@
 #include "namespace.h"
 #include "common/ids.h"
 #include "common/lock.h"
+#include "common/pooled.h"
 #include "common/transaction_id.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
+class kvs_lock_batch;
 class transaction;
 
-class kvs_lock_op
+class kvs_lock_op : public pooled<kvs_lock_op, ALLOC_REPLICATORS>
 {
     public:
         kvs_lock_op(const uint64_t& sk);
@@ -58,12 +60,18 @@ class kvs_lock_op
     public:
         const uint64_t& state_key() const;
         bool finished();
+        // the transaction this serves, or transaction_group() for a client
+        transaction_group tx_group();
 
     public:
+        // with a batch, the request goes out when the batch is flushed
         void doit(lock_op op,
                   const e::slice& table, const e::slice& key,
-                  const transaction_group& tg, daemon* d);
+                  const transaction_group& tg, daemon* d,
+                  kvs_lock_batch* batch = NULL);
         void response(consus_returncode rc, daemon* d);
+        // stop waiting on the response; a late one is dropped
+        void cancel();
         void callback_client(comm_id client, uint64_t nonce);
         void callback_transaction(const transaction_group& tg, uint64_t seqno,
                                   void (transaction::*func)(consus_returncode, uint64_t, daemon*));
@@ -73,6 +81,8 @@ class kvs_lock_op
         po6::threads::mutex m_mtx;
         bool m_init;
         bool m_finished;
+        // when the request went out, if its nonce is tagged for tracing
+        uint64_t m_traced_since;
         // client callback
         comm_id m_client;
         uint64_t m_client_nonce;
@@ -0,0 +1,105 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "txman/kvs_pressure.h"
+
+using consus::kvs_pressure;
+
+#define KVS_PRESSURE_STALE (PO6_SECONDS * 1)
+
+kvs_pressure :: kvs_pressure()
+    : m_mtx()
+    , m_loads()
+{
+}
+
+kvs_pressure :: ~kvs_pressure() throw ()
+{
+}
+
+void
+kvs_pressure :: observe(comm_id kvs, unsigned load, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_loads[kvs] = std::make_pair(load, now);
+}
+
+unsigned
+kvs_pressure :: load(comm_id kvs, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    load_map_t::iterator it = m_loads.find(kvs);
+
+    if (it == m_loads.end() || it->second.second + KVS_PRESSURE_STALE < now)
+    {
+        return 0;
+    }
+
+    return it->second.first;
+}
+
+unsigned
+kvs_pressure :: mean(uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    uint64_t sum = 0;
+    uint64_t count = 0;
+
+    for (load_map_t::iterator it = m_loads.begin(); it != m_loads.end(); ++it)
+    {
+        if (it->second.second + KVS_PRESSURE_STALE >= now)
+        {
+            sum += it->second.first;
+            ++count;
+        }
+    }
+
+    return count > 0 ? sum / count : 0;
+}
+
+std::string
+kvs_pressure :: debug_dump()
+{
+    const uint64_t now = po6::monotonic_time();
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+
+    for (load_map_t::iterator it = m_loads.begin(); it != m_loads.end(); ++it)
+    {
+        ostr << it->first << " load=" << it->second.first
+             << " age=" << (now - it->second.second) / PO6_MILLIS << "ms\n";
+    }
+
+    return ostr.str();
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_kvs_pressure_h_
+#define consus_txman_kvs_pressure_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+#include <string>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// The load each key-value store reports at the end of its responses, 0-100.
+// A report older than KVS_PRESSURE_STALE counts as 0 so that a server that
+// stopped being asked because it was loaded is eventually tried again.
+class kvs_pressure
+{
+    public:
+        kvs_pressure();
+        ~kvs_pressure() throw ();
+
+    public:
+        void observe(comm_id kvs, unsigned load, uint64_t now);
+        unsigned load(comm_id kvs, uint64_t now);
+        // the mean over servers with fresh reports
+        unsigned mean(uint64_t now);
+        std::string debug_dump();
+
+    private:
+        typedef std::map<comm_id, std::pair<unsigned, uint64_t> > load_map_t;
+
+    private:
+        po6::threads::mutex m_mtx;
+        load_map_t m_loads;
+
+    private:
+        kvs_pressure(const kvs_pressure&);
+        kvs_pressure& operator = (const kvs_pressure&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_kvs_pressure_h_
@@ -32,6 +32,7 @@
 #include <busybee.h>
 
 // consus
+#include "common/buffer_pool.h"
 #include "common/network_msgtype.h"
 #include "txman/configuration.h"
 #include "txman/daemon.h"
@@ -44,11 +45,18 @@ kvs_read :: kvs_read(const uint64_t& sk)
     , m_mtx()
     , m_init(false)
     , m_finished(false)
+    , m_traced_since(0)
+    , m_sent(0)
     , m_client()
     , m_client_nonce()
+    , m_feed_dc()
+    , m_feed_table()
+    , m_feed_key()
     , m_tx_group()
     , m_tx_seqno()
     , m_tx_func()
+    , m_flight()
+    , m_waiters()
 {
 }
 
@@ -72,20 +80,13 @@ kvs_read :: finished()
 void
 kvs_read :: read(const e::slice& table, const e::slice& key, uint64_t timestamp, daemon* d)
 {
-    const size_t sz = BUSYBEE_HEADER_SIZE
-                    + pack_size(KVS_REP_RD)
-                    + sizeof(uint64_t)
-                    + pack_size(table)
-                    + pack_size(key)
-                    + sizeof(uint64_t);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << KVS_REP_RD << m_state_key << table << key << timestamp;
-    configuration* c = d->get_config();
-    comm_id kvs = c->choose_kvs(d->m_us.dc);
-    d->send(kvs, msg);
-    po6::threads::mutex::hold hold(&m_mtx);
-    m_init = true;
+    send_read(KVS_REP_RD, table, key, timestamp, d);
+}
+
+void
+kvs_read :: read_stale(const e::slice& table, const e::slice& key, uint64_t timestamp, daemon* d)
+{
+    send_read(KVS_REP_RD_STALE, table, key, timestamp, d);
 }
 
 void
@@ -97,9 +98,30 @@ kvs_read :: response(consus_returncode rc,
     transaction_group tx_group;
     uint64_t tx_seqno;
     void (transaction::*tx_func)(consus_returncode, uint64_t, const e::slice&, uint64_t, daemon*);
+    std::vector<waiter> waiters;
+    data_center_id feed_dc;
+    std::string feed_table;
+    std::string feed_key;
 
     {
         po6::threads::mutex::hold hold(&m_mtx);
+
+        if (!m_flight.empty() && !m_finished)
+        {
+            d->m_read_flights.finish(m_flight, m_state_key);
+        }
+
+        if (m_traced_since != 0 && !m_finished && m_tx_group != transaction_group())
+        {
+            d->m_tracer.span("kvs_read", m_tx_group, m_state_key,
+                             m_traced_since, po6::wallclock_time());
+        }
+
+        if (m_sent != 0 && !m_finished)
+        {
+            d->observe_kvs_latency(po6::monotonic_time() - m_sent);
+        }
+
         m_finished = true;
 
         if (m_client != comm_id())
@@ -110,7 +132,7 @@ kvs_read :: response(consus_returncode rc,
                             + pack_size(rc)
                             + sizeof(uint64_t)
                             + pack_size(value);
-            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
             msg->pack_at(BUSYBEE_HEADER_SIZE)
                 << CLIENT_RESPONSE << m_client_nonce << rc << timestamp << value;
             d->send(m_client, msg);
@@ -119,20 +141,43 @@ kvs_read :: response(consus_returncode rc,
         tx_group = m_tx_group;
         tx_seqno = m_tx_seqno;
         tx_func = m_tx_func;
+        waiters.swap(m_waiters);
+        feed_dc = m_feed_dc;
+        feed_table.swap(m_feed_table);
+        feed_key.swap(m_feed_key);
+    }
+
+    if (feed_dc != data_center_id())
+    {
+        d->m_replica_feed.resynced(feed_dc, e::slice(feed_table), e::slice(feed_key),
+                                   rc, timestamp, value, d->generate_nonce(),
+                                   po6::monotonic_time());
     }
 
     if (tx_group != transaction_group())
+    {
+        waiters.insert(waiters.begin(), waiter(tx_group, tx_seqno, tx_func));
+    }
+
+    for (size_t i = 0; i < waiters.size(); ++i)
     {
         daemon::transaction_map_t::state_reference tsr;
-        transaction* xact = d->m_transactions.get_state(tx_group, &tsr);
+        transaction* xact = d->m_transactions.get_state(waiters[i].tg, &tsr);
 
         if (xact)
         {
-            (*xact.*tx_func)(rc, timestamp, value, tx_seqno, d);
+            (*xact.*waiters[i].func)(rc, timestamp, value, waiters[i].seqno, d);
         }
     }
 }
 
+transaction_group
+kvs_read :: tx_group()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_tx_group;
+}
+
 void
 kvs_read :: callback_client(comm_id client, uint64_t nonce)
 {
@@ -141,6 +186,15 @@ kvs_read :: callback_client(comm_id client, uint64_t nonce)
     m_client_nonce = nonce;
 }
 
+void
+kvs_read :: callback_feed(data_center_id dc, const e::slice& table, const e::slice& key)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_feed_dc = dc;
+    m_feed_table = table.str();
+    m_feed_key = key.str();
+}
+
 void
 kvs_read :: callback_transaction(const transaction_group& tg, uint64_t seqno,
                                  void (transaction::*func)(consus_returncode,
@@ -153,3 +207,74 @@ kvs_read :: callback_transaction(const transaction_group& tg, uint64_t seqno,
     m_tx_seqno = seqno;
     m_tx_func = func;
 }
+
+bool
+kvs_read :: join(const transaction_group& tg, uint64_t seqno,
+                 void (transaction::*func)(consus_returncode,
+                                           uint64_t,
+                                           const e::slice&,
+                                           uint64_t, daemon*))
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_init || m_finished)
+    {
+        return false;
+    }
+
+    m_waiters.push_back(waiter(tg, seqno, func));
+    return true;
+}
+
+void
+kvs_read :: set_flight(const std::string& flight)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_flight = flight;
+}
+
+void
+kvs_read :: send_read(network_msgtype mt,
+                      const e::slice& table, const e::slice& key,
+                      uint64_t timestamp, daemon* d)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(mt)
+                    + sizeof(uint64_t)
+                    + pack_size(table)
+                    + pack_size(key)
+                    + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << mt << m_state_key << table << key << timestamp;
+    configuration* c = d->get_config();
+    const data_center_id dc = c->data_center_for(table, d->m_us.dc);
+    comm_id kvs = c->choose_kvs(dc, table, key, m_state_key, d->m_us, &d->m_kvs_pressure);
+    const uint64_t since = tracer::tagged(m_state_key) ? po6::wallclock_time() : 0;
+    const uint64_t sent = po6::monotonic_time();
+    d->send(kvs, msg);
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_init = true;
+    m_traced_since = since;
+    m_sent = sent;
+    d->m_costs.sent(m_tx_group, mt, sz);
+}
+
+kvs_read :: waiter :: waiter()
+    : tg()
+    , seqno()
+    , func()
+{
+}
+
+kvs_read :: waiter :: waiter(const transaction_group& _tg, uint64_t _seqno,
+                             void (transaction::*_func)(consus_returncode, uint64_t, const e::slice&, uint64_t, daemon*))
+    : tg(_tg)
+    , seqno(_seqno)
+    , func(_func)
+{
+}
+
+kvs_read :: waiter :: ~waiter() throw ()
+{
+}
@@ -30,6 +30,8 @@
 
 // STL
 #include <memory>
+#include <string>
+#include <vector>
 
 // po6
 #include <po6/threads/mutex.h>
@@ -42,11 +44,13 @@
 #include <consus.h>
 #include "namespace.h"
 #include "common/ids.h"
+#include "common/network_msgtype.h"
+#include "common/pooled.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
 
-class kvs_read
+class kvs_read : public pooled<kvs_read, ALLOC_REPLICATORS>
 {
     public:
         kvs_read(const uint64_t& sk);
@@ -55,33 +59,77 @@ class kvs_read
     public:
         const uint64_t& state_key() const;
         bool finished();
+        // the transaction this serves, or transaction_group() for a client
+        transaction_group tx_group();
 
     public:
         void read(const e::slice& table, const e::slice& key,
                   uint64_t timestamp, daemon* d);
+        // newest version <= timestamp at the nearest replica; it may miss
+        // writes that have not reached that replica yet
+        void read_stale(const e::slice& table, const e::slice& key,
+                        uint64_t timestamp, daemon* d);
         void response(consus_returncode rc,
                       uint64_t timestamp,
                       const e::slice& value,
                       daemon* d);
         void callback_client(comm_id client, uint64_t nonce);
+        // hand the response to the replica feed, resyncing table/key at dc
+        void callback_feed(data_center_id dc, const e::slice& table, const e::slice& key);
         void callback_transaction(const transaction_group& tg, uint64_t seqno,
                                   void (transaction::*func)(consus_returncode,
                                                             uint64_t,
                                                             const e::slice&,
                                                             uint64_t, daemon*));
+        // have the response also call back tg; false if it already came
+        bool join(const transaction_group& tg, uint64_t seqno,
+                  void (transaction::*func)(consus_returncode,
+                                            uint64_t,
+                                            const e::slice&,
+                                            uint64_t, daemon*));
+        // the read_flights entry to retire once the response comes
+        void set_flight(const std::string& flight);
+
+    private:
+        struct waiter
+        {
+            waiter();
+            waiter(const transaction_group& tg, uint64_t seqno,
+                   void (transaction::*func)(consus_returncode, uint64_t, const e::slice&, uint64_t, daemon*));
+            ~waiter() throw ();
+            transaction_group tg;
+            uint64_t seqno;
+            void (transaction::*func)(consus_returncode, uint64_t, const e::slice&, uint64_t, daemon*);
+        };
+
+    private:
+        void send_read(network_msgtype mt,
+                       const e::slice& table, const e::slice& key,
+                       uint64_t timestamp, daemon* d);
 
     private:
         const uint64_t m_state_key;
         po6::threads::mutex m_mtx;
         bool m_init;
         bool m_finished;
+        // when the request went out, if its nonce is tagged for tracing
+        uint64_t m_traced_since;
+        // when the request went out, for admission control
+        uint64_t m_sent;
         // client callback
         comm_id m_client;
         uint64_t m_client_nonce;
+        // replica feed callback
+        data_center_id m_feed_dc;
+        std::string m_feed_table;
+        std::string m_feed_key;
         // transaction callback
         transaction_group m_tx_group;
         uint64_t m_tx_seqno;
         void (transaction::*m_tx_func)(consus_returncode, uint64_t, const e::slice&, uint64_t, daemon*);
+        // transactions that joined this read rather than sending their own
+        std::string m_flight;
+        std::vector<waiter> m_waiters;
 
     private:
         kvs_read(const kvs_read&);
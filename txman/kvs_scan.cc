@@ -0,0 +1,203 @@
+// Copyright (c) 2015-2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <string>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/serialization.h>
+
+// BusyBee
+#include <busybee.h>
+
+// consus
+#include "common/hash.h"
+#include "common/network_msgtype.h"
+#include "txman/configuration.h"
+#include "txman/daemon.h"
+#include "txman/kvs_scan.h"
+
+using consus::kvs_scan;
+
+// what validating a scan compares:  the outcome, whether the range ran out,
+// and every key returned with its version
+static uint64_t
+scan_digest(consus_returncode rc, bool done, const std::vector<kvs_scan::item>& items)
+{
+    std::string packed;
+    e::packer pa(&packed);
+    pa = pa << rc << uint8_t(done ? 1 : 0);
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        pa = pa << items[i].key << items[i].timestamp;
+    }
+
+    return consus::hash64(0, reinterpret_cast<const unsigned char*>(packed.data()), packed.size());
+}
+
+kvs_scan :: kvs_scan(const uint64_t& sk)
+    : m_state_key(sk)
+    , m_mtx()
+    , m_init(false)
+    , m_finished(false)
+    , m_client()
+    , m_client_nonce()
+    , m_tx_group()
+    , m_tx_index()
+    , m_tx_func()
+{
+}
+
+kvs_scan :: ~kvs_scan() throw ()
+{
+}
+
+const uint64_t&
+kvs_scan :: state_key() const
+{
+    return m_state_key;
+}
+
+bool
+kvs_scan :: finished()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return !m_init || m_finished;
+}
+
+void
+kvs_scan :: scan(const e::slice& table, const e::slice& key,
+                 uint64_t timestamp, uint64_t limit, daemon* d)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(KVS_REP_SCAN)
+                    + sizeof(uint64_t)
+                    + pack_size(table)
+                    + pack_size(key)
+                    + 2 * sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << KVS_REP_SCAN << m_state_key << table << key << timestamp << limit;
+    configuration* c = d->get_config();
+    comm_id kvs = c->choose_kvs(c->data_center_for(table, d->m_us.dc));
+    d->send(kvs, msg);
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_init = true;
+}
+
+void
+kvs_scan :: response(consus_returncode rc, bool done,
+                     const e::slice& last,
+                     const std::vector<item>& items,
+                     daemon* d)
+{
+    transaction_group tx_group;
+    uint64_t tx_index = 0;
+    void (transaction::*tx_func)(uint64_t, uint64_t, daemon*) = NULL;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_finished = true;
+        respond_to_client(rc, done, last, items, d);
+        tx_group = m_tx_group;
+        tx_index = m_tx_index;
+        tx_func = m_tx_func;
+    }
+
+    if (tx_group != transaction_group())
+    {
+        daemon::transaction_map_t::state_reference tsr;
+        transaction* xact = d->m_transactions.get_state(tx_group, &tsr);
+
+        if (xact)
+        {
+            (*xact.*tx_func)(tx_index, scan_digest(rc, done, items), d);
+        }
+    }
+}
+
+void
+kvs_scan :: respond_to_client(consus_returncode rc, bool done,
+                              const e::slice& last,
+                              const std::vector<item>& items,
+                              daemon* d)
+{
+    if (m_client == comm_id())
+    {
+        return;
+    }
+
+    const uint8_t flag = done ? 1 : 0;
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(CLIENT_RESPONSE)
+              + sizeof(uint64_t)
+              + pack_size(rc)
+              + sizeof(uint8_t)
+              + pack_size(last)
+              + sizeof(uint64_t);
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        sz += pack_size(items[i].key)
+            + sizeof(uint64_t)
+            + pack_size(items[i].value);
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << CLIENT_RESPONSE << m_client_nonce << rc
+        << flag << last << uint64_t(items.size());
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        pa = pa << items[i].key << items[i].timestamp << items[i].value;
+    }
+
+    d->send(m_client, msg);
+}
+
+void
+kvs_scan :: callback_client(comm_id client, uint64_t nonce)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_client = client;
+    m_client_nonce = nonce;
+}
+
+void
+kvs_scan :: callback_transaction(const transaction_group& tg, uint64_t index,
+                                 void (transaction::*func)(uint64_t, uint64_t, daemon*))
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_tx_group = tg;
+    m_tx_index = index;
+    m_tx_func = func;
+}
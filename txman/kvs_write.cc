@@ -32,6 +32,7 @@
 #include <busybee.h>
 
 // consus
+#include "common/buffer_pool.h"
 #include "common/network_msgtype.h"
 #include "txman/configuration.h"
 #include "txman/daemon.h"
@@ -44,6 +45,8 @@ kvs_write :: kvs_write(const uint64_t& sk)
     , m_mtx()
     , m_init(false)
     , m_finished(false)
+    , m_traced_since(0)
+    , m_sent(0)
     , m_client()
     , m_client_nonce()
     , m_tx_group()
@@ -85,14 +88,20 @@ kvs_write :: write(unsigned flags,
                     + pack_size(key)
                     + sizeof(uint64_t)
                     + pack_size(value);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
         << KVS_REP_WR << m_state_key << uint8_t(flags) << table << key << timestamp << value;
     configuration* c = d->get_config();
-    comm_id kvs = c->choose_kvs(d->m_us.dc);
+    const data_center_id dc = c->data_center_for(table, d->m_us.dc);
+    comm_id kvs = c->choose_kvs(dc, table, key, m_state_key, d->m_us, &d->m_kvs_pressure);
+    const uint64_t since = tracer::tagged(m_state_key) ? po6::wallclock_time() : 0;
+    const uint64_t sent = po6::monotonic_time();
     d->send(kvs, msg);
     po6::threads::mutex::hold hold(&m_mtx);
     m_init = true;
+    m_traced_since = since;
+    m_sent = sent;
+    d->m_costs.sent(m_tx_group, KVS_REP_WR, sz);
 }
 
 void
@@ -104,6 +113,18 @@ kvs_write :: response(consus_returncode rc, daemon* d)
 
     {
         po6::threads::mutex::hold hold(&m_mtx);
+
+        if (m_traced_since != 0 && !m_finished && m_tx_group != transaction_group())
+        {
+            d->m_tracer.span("kvs_write", m_tx_group, m_state_key,
+                             m_traced_since, po6::wallclock_time());
+        }
+
+        if (m_sent != 0 && !m_finished)
+        {
+            d->observe_kvs_latency(po6::monotonic_time() - m_sent);
+        }
+
         m_finished = true;
 
         if (m_client != comm_id())
@@ -112,7 +133,7 @@ kvs_write :: response(consus_returncode rc, daemon* d)
                             + pack_size(CLIENT_RESPONSE)
                             + sizeof(uint64_t)
                             + pack_size(rc);
-            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            std::auto_ptr<e::buffer> msg(buffer_pool::create(sz));
             msg->pack_at(BUSYBEE_HEADER_SIZE)
                 << CLIENT_RESPONSE << m_client_nonce << rc;
             d->send(m_client, msg);
@@ -135,6 +156,13 @@ kvs_write :: response(consus_returncode rc, daemon* d)
     }
 }
 
+transaction_group
+kvs_write :: tx_group()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_tx_group;
+}
+
 void
 kvs_write :: callback_client(comm_id client, uint64_t nonce)
 {
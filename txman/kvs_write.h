@@ -42,11 +42,12 @@
 #include <consus.h>
 #include "namespace.h"
 #include "common/ids.h"
+#include "common/pooled.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
 
-class kvs_write
+class kvs_write : public pooled<kvs_write, ALLOC_REPLICATORS>
 {
     public:
         kvs_write(const uint64_t& sk);
@@ -55,6 +56,8 @@ class kvs_write
     public:
         const uint64_t& state_key() const;
         bool finished();
+        // the transaction this serves, or transaction_group() for a client
+        transaction_group tx_group();
 
     public:
         void write(unsigned flags,
@@ -73,6 +76,10 @@ class kvs_write
         po6::threads::mutex m_mtx;
         bool m_init;
         bool m_finished;
+        // when the request went out, if its nonce is tagged for tracing
+        uint64_t m_traced_since;
+        // when the request went out, for admission control
+        uint64_t m_sent;
         // client callback
         comm_id m_client;
         uint64_t m_client_nonce;
@@ -28,6 +28,9 @@
 // C
 #include <stdio.h>
 
+// STL
+#include <algorithm>
+
 // Google Log
 #include <glog/logging.h>
 
@@ -41,10 +44,17 @@
 #include "txman/local_voter.h"
 #include "txman/log_entry_t.h"
 
-#pragma GCC diagnostic ignored "-Wlarger-than="
-
 using consus::local_voter;
 
+// Each member leads its own vote instance from phase 2 at the implicit
+// ballot.  If an instance has not been learned this many resend intervals
+// after we cast our own vote, its leader is presumed stuck and the next
+// member takes over with full Paxos.
+#define LV_TAKEOVER_RESENDS 16
+// but never sooner than this; the resend interval follows the observed RTT,
+// which on a LAN would otherwise abort healthy but briefly slow leaders
+#define LV_TAKEOVER_FLOOR PO6_SECONDS
+
 extern bool s_debug_mode;
 
 static const char*
@@ -74,22 +84,23 @@ local_voter :: local_voter(const transaction_group& tg)
     , m_mtx()
     , m_initialized(false)
     , m_group()
-    , m_votes()
-    , m_xmit_p1a()
-    , m_xmit_p2a()
-    , m_xmit_learn()
+    , m_instances(NULL)
     , m_has_preferred_vote(false)
     , m_preferred_vote(0)
+    , m_preferred_vote_time(0)
     , m_has_outcome(false)
     , m_outcome(0)
     , m_outcome_in_dispositions(false)
     , m_wounded(false)
 {
-    po6::threads::mutex::hold hold(&m_mtx);
 }
 
 local_voter :: ~local_voter() throw ()
 {
+    if (m_instances)
+    {
+        delete[] m_instances;
+    }
 }
 
 const consus::transaction_group&
@@ -114,12 +125,13 @@ local_voter :: set_preferred_vote(uint64_t v, daemon* d)
     {
         m_has_preferred_vote = true;
         m_preferred_vote = v;
+        m_preferred_vote_time = po6::monotonic_time();
 
         if (m_initialized)
         {
             unsigned our_idx = m_group.index(d->m_us.id);
             assert(our_idx < m_group.members_sz);
-            m_votes[our_idx].propose(m_preferred_vote);
+            m_instances[our_idx].vote.propose(m_preferred_vote);
         }
     }
 }
@@ -149,7 +161,7 @@ local_voter :: vote_1a(comm_id id, unsigned idx, const paxos_synod::ballot& b, d
     LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] received phase 1 request to follow " << b;
     paxos_synod::ballot a;
     paxos_synod::pvalue p;
-    m_votes[idx].phase1a(b, &a, &p);
+    m_instances[idx].vote.phase1a(b, &a, &p);
 
     std::string entry;
     e::packer(&entry)
@@ -213,42 +225,17 @@ local_voter :: vote_1b(comm_id id, unsigned idx,
         }
     }
 
-    m_votes[idx].phase1b(id, b, p);
+    m_instances[idx].vote.phase1b(id, b, p);
     work_state_machine(d);
 }
 
 void
 local_voter :: vote_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, daemon* d)
 {
-    po6::threads::mutex::hold hold(&m_mtx);
-
-    if (!preconditions_for_paxos(d))
-    {
-        return;
-    }
-
-    if (idx >= m_group.members_sz)
-    {
-        LOG(ERROR) << logid() << " instance[" << idx << "] dropping 2a message with invalid index";
-        return;
-    }
+    int64_t recno = -1;
 
-    if (id != p.b.leader)
+    if (accept_2a(id, idx, p, d, &recno))
     {
-        LOG(ERROR) << logid() << " instance[" << idx << "] dropping 2a message led by " << p.b.leader << " received from " << id;
-        return;
-    }
-
-    LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] received phase 2 request from " << p.b.leader << " to accept " << value_to_string(p.v);
-    bool send = false;
-    m_votes[idx].phase2a(p, &send);
-
-    if (send)
-    {
-        LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] accepted decision to " << value_to_string(p.v);
-        std::string entry;
-        e::packer(&entry)
-            << LOG_ENTRY_LOCAL_VOTE_2A << m_tg << uint8_t(idx) << p;
         const size_t sz = BUSYBEE_HEADER_SIZE
                         + pack_size(LV_VOTE_2B)
                         + pack_size(m_tg)
@@ -257,14 +244,16 @@ local_voter :: vote_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, d
         std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
         msg->pack_at(BUSYBEE_HEADER_SIZE)
             << LV_VOTE_2B << m_tg << uint8_t(idx) << p;
-        d->send_when_durable(entry, p.b.leader, msg);
-    }
-    else
-    {
-        LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] request ignored; following higher ballot";
+        d->send_when_durable(recno, p.b.leader, msg);
     }
 }
 
+bool
+local_voter :: vote_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, daemon* d, int64_t* recno)
+{
+    return accept_2a(id, idx, p, d, recno);
+}
+
 void
 local_voter :: vote_2b(comm_id id, unsigned idx,
                        const paxos_synod::pvalue& p,
@@ -284,7 +273,7 @@ local_voter :: vote_2b(comm_id id, unsigned idx,
     }
 
     LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] received phase 2 response from " << id << " accepting decision to " << value_to_string(p.v) << " lead by " << p.b.leader;
-    m_votes[idx].phase2b(id, p);
+    m_instances[idx].vote.phase2b(id, p);
     work_state_machine(d);
 }
 
@@ -306,15 +295,15 @@ local_voter :: vote_learn(unsigned idx, uint64_t v, daemon* d)
 
     bool log = false;
 
-    if (m_votes[idx].has_learned() &&
-        m_votes[idx].learned() != v)
+    if (m_instances[idx].vote.has_learned() &&
+        m_instances[idx].vote.learned() != v)
     {
         // this should never happen; let's catch if it does so we can make sure
         // it doesn't happen in the future
         LOG(ERROR) << logid() << " instance[" << idx << "] learned inconsistent values: "
-                   << value_to_string(m_votes[idx].learned()) << " vs " << value_to_string(v);
+                   << value_to_string(m_instances[idx].vote.learned()) << " vs " << value_to_string(v);
     }
-    else if (!m_votes[idx].has_learned())
+    else if (!m_instances[idx].vote.has_learned())
     {
         std::string entry;
         e::packer(&entry)
@@ -323,7 +312,7 @@ local_voter :: vote_learn(unsigned idx, uint64_t v, daemon* d)
         log = true;
     }
 
-    m_votes[idx].force_learn(v);
+    m_instances[idx].vote.force_learn(v);
     LOG_IF(INFO, s_debug_mode && log) << logid() << " instance[" << idx << "] decided to " << value_to_string(v) << "; overall votes are " << votes();
     work_state_machine(d);
 }
@@ -333,6 +322,15 @@ local_voter :: wound(daemon* d)
 {
     set_preferred_vote(CONSUS_VOTE_ABORT, d);
     po6::threads::mutex::hold hold(&m_mtx);
+
+    // we already voted to commit, so the transaction is in commit voting
+    // and will release its locks soon; aborting it now only wastes the work
+    if (m_has_preferred_vote && m_preferred_vote == CONSUS_VOTE_COMMIT)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " ignoring wound during commit voting";
+        return;
+    }
+
     m_wounded = true;
 
     if (!preconditions_for_paxos(d))
@@ -383,7 +381,7 @@ local_voter :: debug_dump()
     {
         char buf[16];
         sprintf(buf, "paxos[%lu] ", i);
-        ostr << prefix_lines(buf, m_votes[i].debug_dump());
+        ostr << prefix_lines(buf, m_instances[i].vote.debug_dump());
     }
 
     if (m_has_preferred_vote)
@@ -425,9 +423,9 @@ local_voter :: votes()
 
     for (size_t i = 0; i < m_group.members_sz; ++i)
     {
-        if (m_votes[i].has_learned())
+        if (m_instances[i].vote.has_learned())
         {
-            uint64_t v = m_votes[i].learned();
+            uint64_t v = m_instances[i].vote.learned();
 
             if (v == CONSUS_VOTE_COMMIT)
             {
@@ -470,17 +468,21 @@ local_voter :: preconditions_for_paxos(daemon* d)
         }
 
         m_group = *group;
+        // one instance per member of this group, rather than one per member
+        // of the largest group we could ever see
+        m_instances = new instance[m_group.members_sz];
 
         for (size_t i = 0; i < m_group.members_sz; ++i)
         {
-            m_votes[i].init(d->m_us.id, m_group, m_group.members[i]);
+            m_instances[i].vote.init(d->m_us.id, m_group, m_group.members[i]);
+            m_instances[i].xmit_p1a.backoff_new_values();
         }
 
         if (m_has_preferred_vote)
         {
             unsigned our_idx = m_group.index(d->m_us.id);
             assert(our_idx < m_group.members_sz);
-            m_votes[our_idx].propose(m_preferred_vote);
+            m_instances[our_idx].vote.propose(m_preferred_vote);
         }
 
         m_initialized = true;
@@ -489,6 +491,46 @@ local_voter :: preconditions_for_paxos(daemon* d)
     return true;
 }
 
+bool
+local_voter :: accept_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, daemon* d, int64_t* recno)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!preconditions_for_paxos(d))
+    {
+        return false;
+    }
+
+    if (idx >= m_group.members_sz)
+    {
+        LOG(ERROR) << logid() << " instance[" << idx << "] dropping 2a message with invalid index";
+        return false;
+    }
+
+    if (id != p.b.leader)
+    {
+        LOG(ERROR) << logid() << " instance[" << idx << "] dropping 2a message led by " << p.b.leader << " received from " << id;
+        return false;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] received phase 2 request from " << p.b.leader << " to accept " << value_to_string(p.v);
+    bool send = false;
+    m_instances[idx].vote.phase2a(p, &send);
+
+    if (!send)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] request ignored; following higher ballot";
+        return false;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] accepted decision to " << value_to_string(p.v);
+    std::string entry;
+    e::packer(&entry)
+        << LOG_ENTRY_LOCAL_VOTE_2A << m_tg << uint8_t(idx) << p;
+    *recno = d->append_to_log_once(entry);
+    return *recno >= 0;
+}
+
 void
 local_voter :: work_state_machine(daemon* d)
 {
@@ -498,24 +540,36 @@ local_voter :: work_state_machine(daemon* d)
 
     if (m_has_preferred_vote)
     {
-        m_votes[our_idx].propose(m_preferred_vote);
+        m_instances[our_idx].vote.propose(m_preferred_vote);
         work_paxos_vote(our_idx, d);
     }
 
+    const uint64_t now = po6::monotonic_time();
+
     for (unsigned i = 1; i < m_group.members_sz; ++i)
     {
         unsigned idx = (our_idx + i) % m_group.members_sz;
+        const comm_id member = m_group.members[idx];
+        const uint64_t takeover = std::max<uint64_t>(LV_TAKEOVER_RESENDS * d->resend_interval(member),
+                                                     LV_TAKEOVER_FLOOR);
+        const bool stalled = !m_instances[idx].vote.has_learned() &&
+                             m_preferred_vote_time + takeover < now;
 
         // XXX this is not robust if the coordinator totally goes missing
         // XXX this may have leader thrashing; think about it
         if (!m_wounded &&
-            (d->get_config()->get_state(m_group.members[idx]) == txman_state::ONLINE ||
+            ((d->get_config()->get_state(member) == txman_state::ONLINE && !stalled) ||
              !m_has_preferred_vote))
         {
             break;
         }
 
-        m_votes[idx].propose(CONSUS_VOTE_ABORT);
+        if (stalled)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " instance[" << idx << "] stalled; taking over from " << member;
+        }
+
+        m_instances[idx].vote.propose(CONSUS_VOTE_ABORT);
         work_paxos_vote(idx, d);
     }
 
@@ -524,17 +578,17 @@ local_voter :: work_state_machine(daemon* d)
 
     for (size_t i = 0; i < m_group.members_sz; ++i)
     {
-        if (m_votes[i].has_learned())
+        if (m_instances[i].vote.has_learned())
         {
             ++voted;
 
-            if (m_votes[i].learned() == CONSUS_VOTE_COMMIT)
+            if (m_instances[i].vote.learned() == CONSUS_VOTE_COMMIT)
             {
                 ++committed;
             }
-            else if (m_votes[i].learned() != CONSUS_VOTE_ABORT)
+            else if (m_instances[i].vote.learned() != CONSUS_VOTE_ABORT)
             {
-                LOG(ERROR) << logid() << " instance[" << i << "] learned invalid value: " << m_votes[i].learned();
+                LOG(ERROR) << logid() << " instance[" << i << "] learned invalid value: " << m_instances[i].vote.learned();
             }
         }
     }
@@ -543,6 +597,8 @@ local_voter :: work_state_machine(daemon* d)
     unsigned aborted = voted - committed;
     assert(aborted < m_group.quorum() || committed < m_group.quorum());
 
+    const bool had_outcome = m_has_outcome;
+
     if (committed >= m_group.quorum())
     {
         m_has_outcome = true;
@@ -555,6 +611,12 @@ local_voter :: work_state_machine(daemon* d)
         m_outcome = CONSUS_VOTE_ABORT;
     }
 
+    if (m_has_outcome && !had_outcome && m_has_preferred_vote)
+    {
+        d->m_phases.record(m_group.id, NULL, 0, phase_latency::LOCAL_PAXOS,
+                           po6::monotonic_time() - m_preferred_vote_time);
+    }
+
     if (d->m_dispositions.has(m_tg))
     {
         m_outcome_in_dispositions = true;
@@ -564,7 +626,7 @@ local_voter :: work_state_machine(daemon* d)
 void
 local_voter :: work_paxos_vote(unsigned idx, daemon* d)
 {
-    paxos_synod* ps = &m_votes[idx];
+    paxos_synod* ps = &m_instances[idx].vote;
     paxos_synod::ballot b;
     paxos_synod::pvalue p;
     uint64_t L = 0;
@@ -574,9 +636,9 @@ local_voter :: work_paxos_vote(unsigned idx, daemon* d)
     ps->advance(&send_p1a, &b, &send_p2a, &p, &send_learn, &L);
     const uint64_t now = po6::monotonic_time();
 
-    if (send_p1a && m_xmit_p1a[idx].may_transmit(b, now, d))
+    if (send_p1a && m_instances[idx].xmit_p1a.may_transmit(b, now, d))
     {
-        m_xmit_p1a[idx].transmit_now(b, now);
+        m_instances[idx].xmit_p1a.transmit_now(b, now);
         const size_t sz = BUSYBEE_HEADER_SIZE
                         + pack_size(LV_VOTE_1A)
                         + pack_size(m_tg)
@@ -588,23 +650,37 @@ local_voter :: work_paxos_vote(unsigned idx, daemon* d)
         d->send(m_group, msg);
     }
 
-    if (send_p2a && m_xmit_p2a[idx].may_transmit(p, now, d))
+    if (send_p2a && m_instances[idx].xmit_p2a.may_transmit(p, now, d))
     {
-        m_xmit_p2a[idx].transmit_now(p, now);
-        const size_t sz = BUSYBEE_HEADER_SIZE
-                        + pack_size(LV_VOTE_2A)
-                        + pack_size(m_tg)
-                        + sizeof(uint8_t)
-                        + pack_size(p);
-        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-        msg->pack_at(BUSYBEE_HEADER_SIZE)
-            << LV_VOTE_2A << m_tg << uint8_t(idx) << p;
-        d->send(m_group, msg);
+        m_instances[idx].xmit_p2a.transmit_now(p, now);
+
+        // our own instance, still at its implicit ballot, rides the group's
+        // pipeline with the votes of other transactions
+        if (d->m_vote_pipeline.enabled() &&
+            p.b == paxos_synod::ballot(1, d->m_us.id))
+        {
+            if (d->m_vote_pipeline.append(m_group.id, m_tg, idx, p))
+            {
+                d->flush_votes(m_group.id);
+            }
+        }
+        else
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(LV_VOTE_2A)
+                            + pack_size(m_tg)
+                            + sizeof(uint8_t)
+                            + pack_size(p);
+            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE)
+                << LV_VOTE_2A << m_tg << uint8_t(idx) << p;
+            d->send(m_group, msg);
+        }
     }
 
-    if (send_learn && m_xmit_learn[idx].may_transmit(L, now, d))
+    if (send_learn && m_instances[idx].xmit_learn.may_transmit(L, now, d))
     {
-        m_xmit_learn[idx].transmit_now(L, now);
+        m_instances[idx].xmit_learn.transmit_now(L, now);
         const size_t sz = BUSYBEE_HEADER_SIZE
                         + pack_size(LV_VOTE_LEARN)
                         + pack_size(m_tg)
@@ -616,3 +692,15 @@ local_voter :: work_paxos_vote(unsigned idx, daemon* d)
         d->send(m_group, msg);
     }
 }
+
+local_voter :: instance :: instance()
+    : vote()
+    , xmit_p1a()
+    , xmit_p2a()
+    , xmit_learn()
+{
+}
+
+local_voter :: instance :: ~instance() throw ()
+{
+}
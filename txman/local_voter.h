@@ -33,13 +33,14 @@
 
 // consus
 #include "namespace.h"
+#include "common/alloc_stats.h"
 #include "common/transaction_group.h"
 #include "txman/paxos_synod.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
 
-class local_voter
+class local_voter : public tagged<ALLOC_VOTERS>
 {
     public:
         local_voter(const transaction_group& tg);
@@ -57,6 +58,9 @@ class local_voter
                      const paxos_synod::pvalue& p,
                      daemon* d);
         void vote_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, daemon* d);
+        // for votes that arrive in a batch; true if accepted, in which case
+        // the acceptance may be answered once recno is durable
+        bool vote_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, daemon* d, int64_t* recno);
         void vote_2b(comm_id id, unsigned idx, const paxos_synod::pvalue& p, daemon* d);
         void vote_learn(unsigned idx, uint64_t v, daemon* d);
         void wound(daemon* d);
@@ -69,20 +73,36 @@ class local_voter
     private:
         std::string votes();
         bool preconditions_for_paxos(daemon* d);
+        bool accept_2a(comm_id id, unsigned idx, const paxos_synod::pvalue& p, daemon* d, int64_t* recno);
         void work_state_machine(daemon* d);
         void work_paxos_vote(unsigned idx, daemon* d);
 
+    private:
+        // the vote led by one member, and what we last sent on its behalf
+        struct instance
+        {
+            instance();
+            ~instance() throw ();
+
+            paxos_synod vote;
+            transmit_limiter<paxos_synod::ballot, daemon> xmit_p1a;
+            transmit_limiter<paxos_synod::pvalue, daemon> xmit_p2a;
+            transmit_limiter<uint64_t, daemon> xmit_learn;
+
+            private:
+                instance(const instance&);
+                instance& operator = (const instance&);
+        };
+
     private:
         const transaction_group m_tg;
         po6::threads::mutex m_mtx;
         bool m_initialized;
         paxos_group m_group;
-        paxos_synod m_votes[CONSUS_MAX_REPLICATION_FACTOR];
-        transmit_limiter<paxos_synod::ballot, daemon> m_xmit_p1a[CONSUS_MAX_REPLICATION_FACTOR];
-        transmit_limiter<paxos_synod::pvalue, daemon> m_xmit_p2a[CONSUS_MAX_REPLICATION_FACTOR];
-        transmit_limiter<uint64_t, daemon> m_xmit_learn[CONSUS_MAX_REPLICATION_FACTOR];
+        instance* m_instances;
         bool m_has_preferred_vote;
         uint64_t m_preferred_vote;
+        uint64_t m_preferred_vote_time;
         bool m_has_outcome;
         uint64_t m_outcome;
         bool m_outcome_in_dispositions;
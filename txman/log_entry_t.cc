@@ -39,12 +39,14 @@ consus :: is_paxos_2a_log_entry(log_entry_t t)
         case LOG_ENTRY_TX_BEGIN:
         case LOG_ENTRY_TX_READ:
         case LOG_ENTRY_TX_WRITE:
+        case LOG_ENTRY_TX_WRITE_DIGEST:
         case LOG_ENTRY_TX_PREPARE:
         case LOG_ENTRY_TX_ABORT:
             return true;
         case LOG_ENTRY_LOCAL_VOTE_1A:
         case LOG_ENTRY_LOCAL_VOTE_2A:
         case LOG_ENTRY_LOCAL_LEARN:
+        case LOG_ENTRY_WITNESS:
         case LOG_ENTRY_GLOBAL_PROPOSE:
         case LOG_ENTRY_GLOBAL_VOTE_1A:
         case LOG_ENTRY_GLOBAL_VOTE_2A:
@@ -65,11 +67,13 @@ consus :: operator << (std::ostream& lhs, const log_entry_t& rhs)
         STRINGIFY(LOG_ENTRY_TX_BEGIN);
         STRINGIFY(LOG_ENTRY_TX_READ);
         STRINGIFY(LOG_ENTRY_TX_WRITE);
+        STRINGIFY(LOG_ENTRY_TX_WRITE_DIGEST);
         STRINGIFY(LOG_ENTRY_TX_PREPARE);
         STRINGIFY(LOG_ENTRY_TX_ABORT);
         STRINGIFY(LOG_ENTRY_LOCAL_VOTE_1A);
         STRINGIFY(LOG_ENTRY_LOCAL_VOTE_2A);
         STRINGIFY(LOG_ENTRY_LOCAL_LEARN);
+        STRINGIFY(LOG_ENTRY_WITNESS);
         STRINGIFY(LOG_ENTRY_GLOBAL_PROPOSE);
         STRINGIFY(LOG_ENTRY_GLOBAL_VOTE_1A);
         STRINGIFY(LOG_ENTRY_GLOBAL_VOTE_2A);
@@ -0,0 +1,486 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// consus
+#include "txman/log_shipper.h"
+
+using consus::log_shipper;
+
+log_shipper :: log_shipper(durable_log* log)
+    : m_log(log)
+    , m_mtx()
+    , m_standby()
+    , m_attached(false)
+    , m_synced(false)
+    , m_epoch(0)
+    , m_start(0)
+    , m_acked(0)
+    , m_collected(0)
+    , m_last_sent(0)
+    , m_unacked()
+    , m_primary()
+    , m_primary_epoch(0)
+    , m_primary_start(0)
+    , m_next(0)
+    , m_early()
+    , m_held()
+    , m_to_ack()
+    , m_acked_upto(0)
+    , m_promoted(&m_mtx)
+    , m_promoting(0)
+{
+}
+
+log_shipper :: ~log_shipper() throw ()
+{
+}
+
+void
+log_shipper :: set_standby(comm_id standby)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    // the coordinator forgets a standby's sync when it leaves, so there is
+    // nothing to report unsynced first
+    if (m_standby != standby)
+    {
+        detach_locked();
+        m_standby = standby;
+    }
+}
+
+void
+log_shipper :: ship(int64_t recno, const std::string& entry, uint64_t now,
+                    std::vector<shipment>* out)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_attached || recno < m_start)
+    {
+        return;
+    }
+
+    m_unacked.insert(std::make_pair(recno, pending(entry, now)));
+    m_last_sent = now;
+    shipment_for(recno, entry, out);
+}
+
+bool
+log_shipper :: acked(comm_id from, uint64_t epoch, int64_t upto)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_attached || from != m_standby || epoch != m_epoch || upto <= m_acked)
+    {
+        return false;
+    }
+
+    m_acked = upto;
+
+    while (!m_unacked.empty() && m_unacked.begin()->first < upto)
+    {
+        m_unacked.erase(m_unacked.begin());
+    }
+
+    return true;
+}
+
+void
+log_shipper :: collected(int64_t lower_bound)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_collected = std::max(m_collected, lower_bound);
+}
+
+int64_t
+log_shipper :: gate(int64_t durable)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    // m_acked starts at the next record to be logged when attaching, so
+    // the bound never moves backwards
+    if (!m_attached)
+    {
+        return durable;
+    }
+
+    return std::min(durable, m_acked);
+}
+
+log_shipper::action_t
+log_shipper :: tick(uint64_t now, std::vector<shipment>* out,
+                    comm_id* standby, uint64_t* epoch)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_standby == comm_id())
+    {
+        return SHIP_NOTHING;
+    }
+
+    if (!m_attached)
+    {
+        m_attached = true;
+        m_synced = false;
+        m_epoch = std::max(m_epoch + 1, po6::wallclock_time());
+        m_start = m_log->next_recno();
+        m_acked = m_start;
+        m_unacked.clear();
+        m_last_sent = 0;
+    }
+
+    *standby = m_standby;
+    *epoch = m_epoch;
+
+    if (!m_unacked.empty() &&
+        m_unacked.begin()->second.first + LOG_SHIP_TIMEOUT <= now)
+    {
+        if (m_synced)
+        {
+            return SHIP_REPORT_UNSYNCED;
+        }
+
+        detach_locked();
+        return SHIP_NOTHING;
+    }
+
+    for (pending_map_t::iterator it = m_unacked.begin();
+            it != m_unacked.end(); ++it)
+    {
+        if (it->second.sent + LOG_SHIP_RESEND <= now)
+        {
+            it->second.sent = now;
+            shipment_for(it->first, it->second.entry, out);
+        }
+    }
+
+    if (m_last_sent + LOG_SHIP_HEARTBEAT <= now)
+    {
+        m_last_sent = now;
+        shipment_for(-1, std::string(), out);
+    }
+
+    if (!m_synced && m_collected >= m_start)
+    {
+        return SHIP_REPORT_SYNCED;
+    }
+
+    return SHIP_NOTHING;
+}
+
+void
+log_shipper :: synced(uint64_t epoch)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_attached && epoch == m_epoch)
+    {
+        m_synced = true;
+    }
+}
+
+void
+log_shipper :: detach(uint64_t epoch)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_attached && epoch == m_epoch)
+    {
+        detach_locked();
+    }
+}
+
+void
+log_shipper :: set_primary(comm_id primary)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_primary == primary)
+    {
+        return;
+    }
+
+    m_primary = primary;
+    m_primary_epoch = 0;
+    m_early.clear();
+    m_to_ack.clear();
+
+    if (primary == comm_id())
+    {
+        m_held.clear();
+    }
+}
+
+consus::comm_id
+log_shipper :: primary()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_primary;
+}
+
+void
+log_shipper :: hold(const unsigned char* entry, size_t entry_sz)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_held.push_back(held(0, -1, -1, std::string(reinterpret_cast<const char*>(entry), entry_sz)));
+}
+
+bool
+log_shipper :: receive(comm_id from, uint64_t epoch, int64_t start,
+                       int64_t collected, int64_t recno, const e::slice& entry)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_primary == comm_id() || from != m_primary || epoch < m_primary_epoch)
+    {
+        return false;
+    }
+
+    // the primary attached afresh; what it sent before is superseded
+    if (epoch != m_primary_epoch)
+    {
+        m_primary_epoch = epoch;
+        m_primary_start = start;
+        m_next = start;
+        m_early.clear();
+        m_to_ack.clear();
+        m_acked_upto = start;
+    }
+
+    bool resent = false;
+
+    if (recno >= 0 && recno < m_next)
+    {
+        resent = true;
+    }
+    else if (recno > m_next)
+    {
+        m_early[recno] = entry.str();
+    }
+    else if (recno == m_next)
+    {
+        append_locked(recno, entry.str());
+        ++m_next;
+
+        while (!m_early.empty() && m_early.begin()->first == m_next)
+        {
+            append_locked(m_next, m_early.begin()->second);
+            m_early.erase(m_early.begin());
+            ++m_next;
+        }
+    }
+
+    drop_held(collected);
+    return resent;
+}
+
+bool
+log_shipper :: ack(int64_t durable, bool force,
+                   comm_id* to, uint64_t* epoch, int64_t* upto)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_primary == comm_id() || m_primary_epoch == 0)
+    {
+        return false;
+    }
+
+    bool news = false;
+
+    while (!m_to_ack.empty() && m_to_ack.front().first < durable)
+    {
+        m_acked_upto = m_to_ack.front().second + 1;
+        m_to_ack.pop_front();
+        news = true;
+    }
+
+    if (!news && !force)
+    {
+        return false;
+    }
+
+    *to = m_primary;
+    *epoch = m_primary_epoch;
+    *upto = m_acked_upto;
+    return true;
+}
+
+int64_t
+log_shipper :: retain(int64_t lower_bound)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_held.empty())
+    {
+        return lower_bound;
+    }
+
+    // records read back at startup predate everything appended since
+    return m_held.front().local < 0 ? 0 : std::min(lower_bound, m_held.front().local);
+}
+
+void
+log_shipper :: begin_promotion()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    e::atomic::store_64_release(&m_promoting, 1);
+}
+
+void
+log_shipper :: take(std::vector<std::string>* entries)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    entries->reserve(entries->size() + m_held.size());
+
+    for (size_t i = 0; i < m_held.size(); ++i)
+    {
+        entries->push_back(std::string());
+        entries->back().swap(m_held[i].entry);
+    }
+
+    m_held.clear();
+    m_early.clear();
+    m_to_ack.clear();
+    m_primary = comm_id();
+    m_primary_epoch = 0;
+}
+
+void
+log_shipper :: end_promotion()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    e::atomic::store_64_release(&m_promoting, 0);
+    m_promoted.broadcast();
+}
+
+void
+log_shipper :: wait_for_promotion()
+{
+    if (e::atomic::load_64_acquire(&m_promoting) == 0)
+    {
+        return;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    while (m_promoting != 0)
+    {
+        m_promoted.wait();
+    }
+}
+
+std::string
+log_shipper :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+
+    if (m_standby != comm_id())
+    {
+        ostr << "standby=" << m_standby
+             << " attached=" << (m_attached ? "yes" : "no")
+             << " synced=" << (m_synced ? "yes" : "no")
+             << " epoch=" << m_epoch
+             << " start=" << m_start
+             << " acked=" << m_acked
+             << " collected=" << m_collected
+             << " unacked=" << m_unacked.size() << "\n";
+    }
+
+    if (m_primary != comm_id())
+    {
+        ostr << "standing by for " << m_primary
+             << " epoch=" << m_primary_epoch
+             << " next=" << m_next
+             << " early=" << m_early.size()
+             << " held=" << m_held.size()
+             << " acked=" << m_acked_upto << "\n";
+    }
+
+    return ostr.str();
+}
+
+void
+log_shipper :: detach_locked()
+{
+    m_attached = false;
+    m_synced = false;
+    m_unacked.clear();
+}
+
+void
+log_shipper :: shipment_for(int64_t recno, const std::string& entry,
+                            std::vector<shipment>* out)
+{
+    out->push_back(shipment());
+    shipment* s = &out->back();
+    s->to = m_standby;
+    s->epoch = m_epoch;
+    s->start = m_start;
+    s->collected = m_collected;
+    s->recno = recno;
+    s->entry = entry;
+}
+
+void
+log_shipper :: append_locked(int64_t recno, const std::string& entry)
+{
+    int64_t local = m_log->append(entry.data(), entry.size());
+
+    // the log is failing, and the daemon with it; acking nothing more
+    // makes the primary cut this standby loose
+    if (local < 0)
+    {
+        return;
+    }
+
+    m_held.push_back(held(m_primary_epoch, recno, local, entry));
+    m_to_ack.push_back(std::make_pair(local, recno));
+}
+
+void
+log_shipper :: drop_held(int64_t collected)
+{
+    // everything held before this attachment is of no use once the
+    // primary needs nothing from before it
+    while (!m_held.empty() &&
+           ((m_held.front().epoch != m_primary_epoch && collected >= m_primary_start) ||
+            (m_held.front().epoch == m_primary_epoch && m_held.front().recno < collected)))
+    {
+        m_held.pop_front();
+    }
+}
@@ -0,0 +1,220 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_log_shipper_h_
+#define consus_txman_log_shipper_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/cond.h>
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "txman/durable_log.h"
+
+// the shipping thread wakes this often to resend and report
+#define LOG_SHIP_INTERVAL (PO6_MILLIS * 10)
+// a record the standby has not acknowledged is sent again this often
+#define LOG_SHIP_RESEND (PO6_MILLIS * 50)
+// an idle primary tells its standby how far it has collected this often
+#define LOG_SHIP_HEARTBEAT (PO6_MILLIS * 100)
+// a standby that acknowledges nothing for this long is cut loose
+#define LOG_SHIP_TIMEOUT (PO6_MILLIS * 500)
+
+BEGIN_CONSUS_NAMESPACE
+
+// Log shipping from a transaction manager to its warm standby.
+//
+// A primary whose standby is online attaches to it at the next record it
+// will log, and from then on sends it every record it appends.  While
+// attached, a record is durable only once the standby has it durably too,
+// so nothing the primary says ever depends on a record its standby lacks.
+// When the oldest record the primary still needs follows the attach point,
+// the standby holds everything the primary's groups depend upon; the
+// primary reports it synced and the coordinator may swap it in when the
+// primary fails.  A standby that falls LOG_SHIP_TIMEOUT behind is reported
+// unsynced, detached, and attached afresh.
+//
+// The standby appends what it receives to its own log, in the primary's
+// order, and holds the records in memory until the primary collects them.
+// Once swapped in, it replays them through its state machines just as a
+// restarted member replays its own log; dispatch waits until it is done.
+class log_shipper
+{
+    public:
+        struct shipment;
+        enum action_t
+        {
+            SHIP_NOTHING,
+            // tell the coordinator, then call synced
+            SHIP_REPORT_SYNCED,
+            // tell the coordinator, then call detach
+            SHIP_REPORT_UNSYNCED
+        };
+
+    public:
+        log_shipper(durable_log* log);
+        ~log_shipper() throw ();
+
+    // the primary
+    public:
+        // from each configuration; comm_id() for none
+        void set_standby(comm_id standby);
+        // call with every record appended
+        void ship(int64_t recno, const std::string& entry, uint64_t now,
+                  std::vector<shipment>* out);
+        // true if the standby acknowledged something new
+        bool acked(comm_id from, uint64_t epoch, int64_t upto);
+        // the oldest record the primary still needs
+        void collected(int64_t lower_bound);
+        // records before durable are durable locally; returns the bound
+        // before which they are durable on the attached standby as well
+        int64_t gate(int64_t durable);
+        // attaches, resends, and says what to tell the coordinator about
+        // standby as of epoch
+        action_t tick(uint64_t now, std::vector<shipment>* out,
+                      comm_id* standby, uint64_t* epoch);
+        void synced(uint64_t epoch);
+        void detach(uint64_t epoch);
+
+    // the standby
+    public:
+        // from each configuration; comm_id() for none
+        void set_primary(comm_id primary);
+        comm_id primary();
+        // a record of the standby's own log, read back at startup
+        void hold(const unsigned char* entry, size_t entry_sz);
+        // true if the primary resent something and should be acked now
+        bool receive(comm_id from, uint64_t epoch, int64_t start,
+                     int64_t collected, int64_t recno, const e::slice& entry);
+        // records before durable are durable in the standby's log; fills in
+        // the ack to send if it is news or if force is set
+        bool ack(int64_t durable, bool force,
+                 comm_id* to, uint64_t* epoch, int64_t* upto);
+        // lower the bound to the first record of the standby's log it holds
+        int64_t retain(int64_t lower_bound);
+        // take the held records, in order, and stop being a standby;
+        // dispatch waits from begin_promotion until end_promotion
+        void begin_promotion();
+        void take(std::vector<std::string>* entries);
+        void end_promotion();
+        void wait_for_promotion();
+
+    public:
+        std::string debug_dump();
+
+    private:
+        struct pending
+        {
+            pending() : entry(), first(0), sent(0) {}
+            pending(const std::string& e, uint64_t now) : entry(e), first(now), sent(now) {}
+            std::string entry;
+            uint64_t first;
+            uint64_t sent;
+        };
+        struct held
+        {
+            held() : epoch(0), recno(-1), local(-1), entry() {}
+            held(uint64_t e, int64_t r, int64_t l, const std::string& x)
+                : epoch(e), recno(r), local(l), entry(x) {}
+            uint64_t epoch;
+            // in the primary's log, or -1 if read back at startup
+            int64_t recno;
+            // in the standby's log, or -1 if read back at startup
+            int64_t local;
+            std::string entry;
+        };
+        typedef std::map<int64_t, pending> pending_map_t;
+        void detach_locked();
+        void shipment_for(int64_t recno, const std::string& entry,
+                          std::vector<shipment>* out);
+        void append_locked(int64_t recno, const std::string& entry);
+        void drop_held(int64_t collected);
+
+    private:
+        durable_log* const m_log;
+        po6::threads::mutex m_mtx;
+
+        // the primary
+        comm_id m_standby;
+        bool m_attached;
+        bool m_synced;
+        uint64_t m_epoch;
+        int64_t m_start;
+        int64_t m_acked;
+        int64_t m_collected;
+        uint64_t m_last_sent;
+        pending_map_t m_unacked;
+
+        // the standby
+        comm_id m_primary;
+        uint64_t m_primary_epoch;
+        int64_t m_primary_start;
+        int64_t m_next;
+        std::map<int64_t, std::string> m_early;
+        std::deque<held> m_held;
+        // (local, recno) of each record of this epoch not yet acked
+        std::deque<std::pair<int64_t, int64_t> > m_to_ack;
+        int64_t m_acked_upto;
+
+        // promotion
+        po6::threads::cond m_promoted;
+        uint64_t m_promoting;
+
+    private:
+        log_shipper(const log_shipper&);
+        log_shipper& operator = (const log_shipper&);
+};
+
+struct log_shipper::shipment
+{
+    shipment() : to(), epoch(0), start(0), collected(0), recno(-1), entry() {}
+    comm_id to;
+    uint64_t epoch;
+    int64_t start;
+    int64_t collected;
+    // -1 for a heartbeat
+    int64_t recno;
+    std::string entry;
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_log_shipper_h_
@@ -25,11 +25,16 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <stdlib.h>
+#include <string.h>
+
 // POSIX
 #include <signal.h>
 
 // C++
 #include <string>
+#include <vector>
 
 // Google Log
 #include <glog/logging.h>
@@ -37,6 +42,7 @@
 // po6
 #include <po6/net/hostname.h>
 #include <po6/net/location.h>
+#include <po6/time.h>
 
 // e
 #include <e/popt.h>
@@ -55,6 +61,27 @@
 
 extern bool s_debug_mode;
 
+static std::vector<std::string>
+split_list(const char* list)
+{
+    std::vector<std::string> items;
+
+    for (const char* item = list; *item; )
+    {
+        const char* end = strchr(item, ',');
+        end = end ? end : item + strlen(item);
+
+        if (end > item)
+        {
+            items.push_back(std::string(item, end));
+        }
+
+        item = *end ? end + 1 : end;
+    }
+
+    return items;
+}
+
 int
 main(int argc, const char* argv[])
 {
@@ -65,10 +92,46 @@ main(int argc, const char* argv[])
     const char* listen_host = "auto";
     long listen_port = CONSUS_PORT_TXMAN;
     const char* data_center = "";
+    const char* zone = "";
+    const char* rack = "";
     const char* pidfile = "";
     bool has_pidfile = false;
     long threads = 0;
+    long stage_threads = 0;
+    long resend_ms = 1000;
     bool log_immediate = false;
+    bool sync_writes = false;
+    bool pmem_log = false;
+    bool pin_threads = false;
+    long busy_poll_us = 0;
+    long coalesce_us = 0;
+    bool compress_wan = false;
+    const char* wan_dictionary = "";
+    bool has_wan_dictionary = false;
+    bool compact_messages = false;
+    bool early_lock_release = false;
+    bool balance_groups = false;
+    const char* standby_for = "";
+    bool has_standby_for = false;
+    const char* intra_dc_transport = "";
+    bool has_intra_dc_transport = false;
+    long metrics_port = 0;
+    const char* trace_file = "";
+    bool has_trace_file = false;
+    long trace_sample = 1000;
+    long commit_digest_threshold = 0;
+    long wan_bulk_mbps = 0;
+    long admit_transactions = 0;
+    long admit_durable_queue = 0;
+    long admit_kvs_latency_ms = 0;
+    long vote_pipeline_us = 0;
+    long commit_pipeline_us = 0;
+    long slow_transaction_ms = 1000;
+    long transaction_timeout_ms = 0;
+    long read_lease_ms = 0;
+    long max_clock_drift_ppm = 1000;
+    const char* log_dirs = "";
+    const char* optimistic_tables = "";
     sigset_t ss;
 
     if (sigfillset(&ss) < 0 ||
@@ -102,12 +165,108 @@ main(int argc, const char* argv[])
     ap.arg().name('c', "data-center")
             .description("data center containing this transaction manager")
             .metavar("name").as_string(&data_center);
+    ap.arg().long_name("zone")
+            .description("availability zone within the data center, for read locality")
+            .metavar("name").as_string(&zone);
+    ap.arg().long_name("rack")
+            .description("rack within the zone, for read locality")
+            .metavar("name").as_string(&rack);
     ap.arg().long_name("pidfile")
             .description("write the PID to a file (default: don't)")
             .metavar("file").as_string(&pidfile).set_true(&has_pidfile);
     ap.arg().name('t', "threads")
             .description("the number of threads which will handle network traffic")
             .metavar("N").as_long(&threads);
+    ap.arg().long_name("state-machine-threads")
+            .description("hand messages from the network threads to this many threads, each owning a share of the transaction groups, or 0 to handle them on the network threads (default: 0)")
+            .metavar("N").as_long(&stage_threads);
+    ap.arg().long_name("resend-interval")
+            .description("retransmission timeout for peers whose round-trip time is not yet known (default: 1000)")
+            .metavar("ms").as_long(&resend_ms);
+    ap.arg().long_name("sync-writes")
+            .description("make every durable log write synchronous (O_DSYNC) instead of batching fsyncs")
+            .set_true(&sync_writes);
+    ap.arg().long_name("pmem-log")
+            .description("map the durable log from persistent memory and make each write durable with cache-line flushes; every log directory must be on a DAX file system")
+            .set_true(&pmem_log);
+    ap.arg().long_name("pin-threads")
+            .description("pin each network thread to its own CPU, filling one socket before the next")
+            .set_true(&pin_threads);
+    ap.arg().long_name("busy-poll")
+            .description("spin on the network for up to this many microseconds before blocking, spinning less while idle, or 0 to always block (default: 0)")
+            .metavar("us").as_long(&busy_poll_us);
+    ap.arg().long_name("coalesce")
+            .description("hold small messages to a peer for up to this many microseconds to send them together, or 0 to disable (default: 0)")
+            .metavar("us").as_long(&coalesce_us);
+    ap.arg().long_name("compress-wan")
+            .description("compress large messages to peers in other data centers with LZ4")
+            .set_true(&compress_wan);
+    ap.arg().long_name("wan-dictionary")
+            .description("prime WAN compression with this file, which every transaction manager must share")
+            .metavar("file").as_string(&wan_dictionary).set_true(&has_wan_dictionary);
+    ap.arg().long_name("compact-messages")
+            .description("send messages to other servers with their zero bytes suppressed; every server must run a version that understands them")
+            .set_true(&compact_messages);
+    ap.arg().long_name("intra-dc-transport")
+            .description("reach peers in this data center over this transport instead of BusyBee (default: busybee)")
+            .metavar("name").as_string(&intra_dc_transport).set_true(&has_intra_dc_transport);
+    ap.arg().long_name("metrics-port")
+            .description("serve Prometheus metrics over HTTP on this port, or 0 to disable (default: 0)")
+            .metavar("port").as_long(&metrics_port);
+    ap.arg().long_name("trace-file")
+            .description("append spans of sampled transactions to this file in Chrome trace format")
+            .metavar("file").as_string(&trace_file).set_true(&has_trace_file);
+    ap.arg().long_name("trace-sample")
+            .description("trace one in N transactions; use the same N on every transaction manager (default: 1000)")
+            .metavar("N").as_long(&trace_sample);
+    ap.arg().long_name("commit-digest-threshold")
+            .description("send other data centers only a digest of written values this large until the commit is decided, or 0 to disable; use the same value on every transaction manager (default: 0)")
+            .metavar("bytes").as_long(&commit_digest_threshold);
+    ap.arg().long_name("wan-bulk-bandwidth")
+            .description("send shipped values and repeated commit records to each other data center at no more than this many MB/s, leaving the rest of the link to votes, or 0 to send them unpaced (default: 0)")
+            .metavar("MB/s").as_long(&wan_bulk_mbps);
+    ap.arg().long_name("max-transactions")
+            .description("start turning new transactions away as busy as live transactions approach this many, or 0 for no limit (default: 0)")
+            .metavar("N").as_long(&admit_transactions);
+    ap.arg().long_name("max-durable-queue")
+            .description("start turning new transactions away as this many log records and responses await fsync, or 0 for no limit (default: 0)")
+            .metavar("N").as_long(&admit_durable_queue);
+    ap.arg().long_name("max-kvs-latency")
+            .description("start turning new transactions away as the mean key-value store response time approaches this, or 0 for no limit (default: 0)")
+            .metavar("ms").as_long(&admit_kvs_latency_ms);
+    ap.arg().long_name("vote-pipeline")
+            .description("hold votes on commit for up to this many microseconds to send those of many transactions to each peer together, or 0 to send each at once (default: 0)")
+            .metavar("us").as_long(&vote_pipeline_us);
+    ap.arg().long_name("commit-pipeline")
+            .description("hold commit records and global votes bound for other data centers for up to this many microseconds to send those of many transactions to each peer together, or 0 to send each at once (default: 0)")
+            .metavar("us").as_long(&commit_pipeline_us);
+    ap.arg().long_name("slow-transaction")
+            .description("log when each step of a transaction that takes this long happened, or 0 to disable (default: 1000)")
+            .metavar("ms").as_long(&slow_transaction_ms);
+    ap.arg().long_name("transaction-timeout")
+            .description("abort a transaction whose client has sent nothing for this long before committing, releasing its locks, or 0 to wait forever (default: 0)")
+            .metavar("ms").as_long(&transaction_timeout_ms);
+    ap.arg().long_name("early-lock-release")
+            .description("release the shared locks of a transaction's reads once its data center votes to commit, rather than after every data center decides")
+            .set_true(&early_lock_release);
+    ap.arg().long_name("balance-groups")
+            .description("start each transaction in whichever of this server's groups has the least work in flight and the fastest logs, rather than in a random one")
+            .set_true(&balance_groups);
+    ap.arg().long_name("standby-for")
+            .description("register as a warm standby that tails this transaction manager's log and takes its place if it fails")
+            .metavar("ID").as_string(&standby_for).set_true(&has_standby_for);
+    ap.arg().long_name("read-lease")
+            .description("have the first member of each group hold a lease this long and answer reads without waiting for the log, or 0 to disable (default: 0)")
+            .metavar("ms").as_long(&read_lease_ms);
+    ap.arg().long_name("max-clock-drift")
+            .description("the most any two clocks drift apart, which read leases allow for (default: 1000)")
+            .metavar("ppm").as_long(&max_clock_drift_ppm);
+    ap.arg().long_name("log-dirs")
+            .description("stripe the durable log across these comma-separated directories, ideally one per device (default: --data)")
+            .metavar("dir,dir,...").as_string(&log_dirs);
+    ap.arg().long_name("optimistic-tables")
+            .description("run transactions on these comma-separated tables without locks until prepare, then lock and validate what they read and wrote")
+            .metavar("table,table,...").as_string(&optimistic_tables);
     ap.arg().long_name("log-immediate")
             .description("immediately flush all log output")
             .set_true(&log_immediate).hidden();
@@ -204,6 +363,112 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (stage_threads < 0 || stage_threads > 512)
+    {
+        std::cerr << "state-machine-threads must be between 0 and 512" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (resend_ms <= 0)
+    {
+        std::cerr << "resend-interval must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (busy_poll_us < 0)
+    {
+        std::cerr << "busy-poll must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (coalesce_us < 0)
+    {
+        std::cerr << "coalesce must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (vote_pipeline_us < 0)
+    {
+        std::cerr << "vote-pipeline must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (commit_pipeline_us < 0)
+    {
+        std::cerr << "commit-pipeline must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (slow_transaction_ms < 0)
+    {
+        std::cerr << "slow-transaction must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (transaction_timeout_ms < 0)
+    {
+        std::cerr << "transaction-timeout must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (read_lease_ms < 0)
+    {
+        std::cerr << "read-lease must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (max_clock_drift_ppm < 0 || max_clock_drift_ppm >= 1000000)
+    {
+        std::cerr << "max-clock-drift must be between 0 and 999999" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (metrics_port < 0 || metrics_port >= (1 << 16))
+    {
+        std::cerr << "metrics-port is out of range" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (trace_sample <= 0)
+    {
+        std::cerr << "trace-sample must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> log_dir_list = split_list(log_dirs);
+
+    if (commit_digest_threshold < 0)
+    {
+        std::cerr << "commit-digest-threshold must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (wan_bulk_mbps < 0)
+    {
+        std::cerr << "wan-bulk-bandwidth must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (admit_transactions < 0 || admit_durable_queue < 0 || admit_kvs_latency_ms < 0)
+    {
+        std::cerr << "max-transactions, max-durable-queue and max-kvs-latency must be non-negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    uint64_t standby_id = 0;
+
+    if (has_standby_for)
+    {
+        char* end = NULL;
+        standby_id = strtoull(standby_for, &end, 0);
+
+        if (*standby_for == '\0' || *end != '\0' || standby_id == 0)
+        {
+            std::cerr << "standby-for must name a transaction manager by its numeric id" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
     try
     {
         consus::daemon d;
@@ -213,7 +478,32 @@ main(int argc, const char* argv[])
                      std::string(pidfile), has_pidfile,
                      listen, bind_to,
                      conn.isset(), conn.conn_str(),
-                     data_center, threads);
+                     data_center, zone, rack, threads, stage_threads,
+                     resend_ms * PO6_MILLIS, sync_writes, pmem_log, pin_threads,
+                     uint64_t(busy_poll_us) * 1000ULL,
+                     uint64_t(coalesce_us) * 1000ULL,
+                     compress_wan,
+                     has_wan_dictionary ? wan_dictionary : NULL,
+                     compact_messages,
+                     has_intra_dc_transport ? intra_dc_transport : NULL,
+                     metrics_port,
+                     has_trace_file ? trace_file : NULL,
+                     trace_sample,
+                     commit_digest_threshold,
+                     uint64_t(wan_bulk_mbps) * 1024ULL * 1024ULL,
+                     admit_transactions, admit_durable_queue,
+                     admit_kvs_latency_ms * PO6_MILLIS,
+                     uint64_t(vote_pipeline_us) * 1000ULL,
+                     uint64_t(commit_pipeline_us) * 1000ULL,
+                     slow_transaction_ms * PO6_MILLIS,
+                     transaction_timeout_ms * PO6_MILLIS,
+                     read_lease_ms * PO6_MILLIS,
+                     max_clock_drift_ppm,
+                     early_lock_release,
+                     balance_groups,
+                     consus::comm_id(standby_id),
+                     log_dir_list,
+                     split_list(optimistic_tables));
     }
     catch (std::exception& e)
     {
@@ -0,0 +1,254 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <sstream>
+
+// consus
+#include "txman/message_cost.h"
+
+using consus::message_cost;
+
+struct message_cost::tally
+{
+    struct entry
+    {
+        entry(network_msgtype t)
+            : mt(t), sent(0), sent_bytes(0), received(0), received_bytes(0) {}
+        network_msgtype mt;
+        uint64_t sent;
+        uint64_t sent_bytes;
+        uint64_t received;
+        uint64_t received_bytes;
+    };
+
+    tally() : entries() {}
+    // a transaction uses a handful of message types, so a scan beats a map
+    entry* get(network_msgtype mt);
+    std::vector<entry> entries;
+};
+
+message_cost::tally::entry*
+message_cost :: tally :: get(network_msgtype mt)
+{
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].mt == mt)
+        {
+            return &entries[i];
+        }
+    }
+
+    entries.push_back(entry(mt));
+    return &entries.back();
+}
+
+struct message_cost::per_type
+{
+    per_type() : sent(), sent_bytes(), received(), received_bytes() {}
+    histogram sent;
+    histogram sent_bytes;
+    histogram received;
+    histogram received_bytes;
+};
+
+message_cost :: message_cost()
+    : m_shards()
+    , m_types(new per_type[MESSAGE_COST_SLOTS])
+    , m_sent()
+    , m_sent_bytes()
+    , m_received()
+    , m_received_bytes()
+{
+}
+
+message_cost :: ~message_cost() throw ()
+{
+    for (size_t i = 0; i < MESSAGE_COST_SHARDS; ++i)
+    {
+        std::map<transaction_group, tally*>::iterator it;
+
+        for (it = m_shards[i].tallies.begin(); it != m_shards[i].tallies.end(); ++it)
+        {
+            delete it->second;
+        }
+    }
+
+    delete[] m_types;
+}
+
+void
+message_cost :: begin(const transaction_group& tg)
+{
+    shard* s = get_shard(tg);
+    po6::threads::mutex::hold hold(&s->mtx);
+    tally*& t(s->tallies[tg]);
+
+    if (!t)
+    {
+        t = new tally();
+    }
+}
+
+void
+message_cost :: sent(const transaction_group& tg, network_msgtype mt, uint64_t bytes)
+{
+    record(tg, mt, true, bytes);
+}
+
+void
+message_cost :: received(const transaction_group& tg, network_msgtype mt, uint64_t bytes)
+{
+    record(tg, mt, false, bytes);
+}
+
+void
+message_cost :: finish(const transaction_group& tg)
+{
+    tally* t = NULL;
+
+    {
+        shard* s = get_shard(tg);
+        po6::threads::mutex::hold hold(&s->mtx);
+        std::map<transaction_group, tally*>::iterator it = s->tallies.find(tg);
+
+        if (it == s->tallies.end())
+        {
+            return;
+        }
+
+        t = it->second;
+        s->tallies.erase(it);
+    }
+
+    uint64_t sent = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t received = 0;
+    uint64_t received_bytes = 0;
+
+    for (size_t i = 0; i < t->entries.size(); ++i)
+    {
+        const tally::entry& ent(t->entries[i]);
+        sent += ent.sent;
+        sent_bytes += ent.sent_bytes;
+        received += ent.received;
+        received_bytes += ent.received_bytes;
+        unsigned idx = static_cast<unsigned>(ent.mt) - MESSAGE_COST_BASE;
+
+        if (idx >= MESSAGE_COST_SLOTS)
+        {
+            continue;
+        }
+
+        if (ent.sent > 0)
+        {
+            m_types[idx].sent.record(ent.sent);
+            m_types[idx].sent_bytes.record(ent.sent_bytes);
+        }
+
+        if (ent.received > 0)
+        {
+            m_types[idx].received.record(ent.received);
+            m_types[idx].received_bytes.record(ent.received_bytes);
+        }
+    }
+
+    m_sent.record(sent);
+    m_sent_bytes.record(sent_bytes);
+    m_received.record(received);
+    m_received_bytes.record(received_bytes);
+    delete t;
+}
+
+void
+message_cost :: render(std::ostream& out)
+{
+    out << "# TYPE consus_transaction_messages histogram\n";
+    m_sent.render(out, "consus_transaction_messages", "direction=\"sent\"", 1);
+    m_received.render(out, "consus_transaction_messages", "direction=\"received\"", 1);
+    out << "# TYPE consus_transaction_message_bytes histogram\n";
+    m_sent_bytes.render(out, "consus_transaction_message_bytes", "direction=\"sent\"", 1);
+    m_received_bytes.render(out, "consus_transaction_message_bytes", "direction=\"received\"", 1);
+    std::ostringstream counts;
+    std::ostringstream bytes;
+
+    for (unsigned i = 0; i < MESSAGE_COST_SLOTS; ++i)
+    {
+        per_type* pt = &m_types[i];
+
+        if (pt->sent.count() == 0 && pt->received.count() == 0)
+        {
+            continue;
+        }
+
+        std::ostringstream type;
+        type << static_cast<network_msgtype>(MESSAGE_COST_BASE + i);
+        const std::string sent("direction=\"sent\",type=\"" + type.str() + "\"");
+        const std::string received("direction=\"received\",type=\"" + type.str() + "\"");
+        pt->sent.render(counts, "consus_transaction_messages_by_type", sent, 1);
+        pt->received.render(counts, "consus_transaction_messages_by_type", received, 1);
+        pt->sent_bytes.render(bytes, "consus_transaction_message_bytes_by_type", sent, 1);
+        pt->received_bytes.render(bytes, "consus_transaction_message_bytes_by_type", received, 1);
+    }
+
+    out << "# TYPE consus_transaction_messages_by_type histogram\n" << counts.str();
+    out << "# TYPE consus_transaction_message_bytes_by_type histogram\n" << bytes.str();
+}
+
+message_cost::shard*
+message_cost :: get_shard(const transaction_group& tg)
+{
+    return &m_shards[tg.hash() % MESSAGE_COST_SHARDS];
+}
+
+void
+message_cost :: record(const transaction_group& tg, network_msgtype mt,
+                       bool sent, uint64_t bytes)
+{
+    shard* s = get_shard(tg);
+    po6::threads::mutex::hold hold(&s->mtx);
+    std::map<transaction_group, tally*>::iterator it = s->tallies.find(tg);
+
+    if (it == s->tallies.end())
+    {
+        return;
+    }
+
+    tally::entry* ent = it->second->get(mt);
+
+    if (sent)
+    {
+        ++ent->sent;
+        ent->sent_bytes += bytes;
+    }
+    else
+    {
+        ++ent->received;
+        ent->received_bytes += bytes;
+    }
+}
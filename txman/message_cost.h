@@ -0,0 +1,105 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_txman_message_cost_h_
+#define consus_txman_message_cost_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+#include <map>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/metrics.h"
+#include "common/network_msgtype.h"
+#include "common/transaction_group.h"
+
+// independently locked maps the open tallies are spread over
+#define MESSAGE_COST_SHARDS 16
+// message types are tracked in [MESSAGE_COST_BASE, MESSAGE_COST_BASE + MESSAGE_COST_SLOTS)
+#define MESSAGE_COST_BASE 7400
+#define MESSAGE_COST_SLOTS 448
+
+BEGIN_CONSUS_NAMESPACE
+
+// The messages and bytes this daemon sends and receives on behalf of each
+// transaction, by message type.  A transaction opens its tally when it starts
+// working and closes it when it is collected; closing folds the tally into
+// per-type histograms, so the sum of a histogram over its count is the mean
+// cost of one transaction.  Messages for a transaction without an open tally
+// are not counted, nor are batches that carry many transactions at once.
+class message_cost
+{
+    public:
+        message_cost();
+        ~message_cost() throw ();
+
+    public:
+        void begin(const transaction_group& tg);
+        void sent(const transaction_group& tg, network_msgtype mt, uint64_t bytes);
+        void received(const transaction_group& tg, network_msgtype mt, uint64_t bytes);
+        void finish(const transaction_group& tg);
+        // append as Prometheus histograms
+        void render(std::ostream& out);
+
+    private:
+        struct tally;
+        struct per_type;
+        struct shard
+        {
+            shard() : mtx(), tallies() {}
+            po6::threads::mutex mtx;
+            std::map<transaction_group, tally*> tallies;
+        };
+        shard* get_shard(const transaction_group& tg);
+        void record(const transaction_group& tg, network_msgtype mt,
+                    bool sent, uint64_t bytes);
+
+    private:
+        shard m_shards[MESSAGE_COST_SHARDS];
+        per_type* m_types;
+        histogram m_sent;
+        histogram m_sent_bytes;
+        histogram m_received;
+        histogram m_received_bytes;
+
+    private:
+        message_cost(const message_cost&);
+        message_cost& operator = (const message_cost&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_message_cost_h_
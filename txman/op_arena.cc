@@ -0,0 +1,85 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <string.h>
+
+// STL
+#include <algorithm>
+
+// consus
+#include "txman/op_arena.h"
+
+using consus::op_arena;
+
+// the first chunk; each later one doubles, up to the cap, unless a single
+// copy needs more
+#define OP_ARENA_FIRST_CHUNK 256
+#define OP_ARENA_MAX_CHUNK (64 * 1024)
+
+op_arena :: op_arena()
+    : m_chunks()
+    , m_ptr(NULL)
+    , m_avail(0)
+    , m_next_chunk(OP_ARENA_FIRST_CHUNK)
+    , m_bytes(0)
+{
+}
+
+op_arena :: ~op_arena() throw ()
+{
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        delete[] m_chunks[i];
+    }
+}
+
+e::slice
+op_arena :: copy(const e::slice& s)
+{
+    if (s.empty())
+    {
+        return e::slice();
+    }
+
+    if (s.size() > m_avail)
+    {
+        const size_t sz = std::max(m_next_chunk, s.size());
+        m_chunks.push_back(new char[sz]);
+        m_ptr = m_chunks.back();
+        m_avail = sz;
+        m_bytes += sz;
+        m_next_chunk = std::min(m_next_chunk * 2, size_t(OP_ARENA_MAX_CHUNK));
+    }
+
+    memmove(m_ptr, s.data(), s.size());
+    e::slice ret(m_ptr, s.size());
+    m_ptr += s.size();
+    m_avail -= s.size();
+    return ret;
+}
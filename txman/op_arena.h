@@ -0,0 +1,72 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_txman_op_arena_h_
+#define consus_txman_op_arena_h_
+
+// STL
+#include <vector>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Append-only storage for the tables, keys, and values of one transaction's
+// operations.  Copies never move once made, so slices into the arena stay
+// valid until it is destroyed.  Chunks start small and double, so a tiny
+// transaction holds a few hundred bytes instead of a reference to every
+// message that carried one of its operations.
+class op_arena
+{
+    public:
+        op_arena();
+        ~op_arena() throw ();
+
+    public:
+        e::slice copy(const e::slice& s);
+        size_t bytes() const { return m_bytes; }
+
+    private:
+        std::vector<char*> m_chunks;
+        char* m_ptr;
+        size_t m_avail;
+        size_t m_next_chunk;
+        size_t m_bytes;
+
+    private:
+        op_arena(const op_arena&);
+        op_arena& operator = (const op_arena&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_op_arena_h_
@@ -134,7 +134,7 @@ paxos_synod :: advance(bool* send_p1a, ballot* p1a,
             }
         }
 
-        if (accepted >= m_group.quorum())
+        if (accepted >= m_group.phase1_quorum())
         {
             m_leader_phase = PHASE2;
             m_leader_pvalue = pvalue();
@@ -175,7 +175,7 @@ paxos_synod :: advance(bool* send_p1a, ballot* p1a,
             }
         }
 
-        if (accepted >= m_group.quorum())
+        if (accepted >= m_group.phase2_quorum())
         {
             m_leader_phase = LEARNED;
             m_value = m_leader_pvalue.v;
@@ -0,0 +1,187 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+// consus
+#include "txman/phase_latency.h"
+
+using consus::paxos_group_id;
+using consus::phase_latency;
+
+// the overflow key has group 0 and no data centers
+struct phase_latency::key
+{
+    key() : group(0), dcs_sz(0) { std::fill(dcs, dcs + CONSUS_MAX_REPLICATION_FACTOR, 0); }
+    bool operator < (const key& rhs) const;
+    uint64_t group;
+    uint64_t dcs[CONSUS_MAX_REPLICATION_FACTOR];
+    size_t dcs_sz;
+};
+
+struct phase_latency::histograms
+{
+    histograms() {}
+    histogram h[NUM_PHASES];
+
+    private:
+        histograms(const histograms&);
+        histograms& operator = (const histograms&);
+};
+
+bool
+phase_latency::key :: operator < (const key& rhs) const
+{
+    if (group != rhs.group)
+    {
+        return group < rhs.group;
+    }
+
+    return std::lexicographical_compare(dcs, dcs + dcs_sz,
+                                        rhs.dcs, rhs.dcs + rhs.dcs_sz);
+}
+
+namespace
+{
+
+const char* s_phases[] = {
+    "executing",
+    "local_vote",
+    "global_vote",
+    "committing",
+    "aborting",
+    "local_paxos",
+    "global_paxos"
+};
+
+} // namespace
+
+phase_latency :: phase_latency()
+    : m_mtx()
+    , m_histograms()
+{
+}
+
+phase_latency :: ~phase_latency() throw ()
+{
+    for (map_t::iterator it = m_histograms.begin(); it != m_histograms.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+void
+phase_latency :: record(paxos_group_id group,
+                        const paxos_group_id* dcs, size_t dcs_sz,
+                        phase p, uint64_t nanos)
+{
+    key k;
+    k.group = group.get();
+    k.dcs_sz = std::min(dcs_sz, size_t(CONSUS_MAX_REPLICATION_FACTOR));
+
+    for (size_t i = 0; i < k.dcs_sz; ++i)
+    {
+        k.dcs[i] = dcs[i].get();
+    }
+
+    // members of a transaction may list its data centers in any order
+    std::sort(k.dcs, k.dcs + k.dcs_sz);
+    // histograms are never freed before the daemon exits, so recording
+    // needs no lock
+    get(k)->h[p].record(nanos);
+}
+
+void
+phase_latency :: render(std::ostream& out)
+{
+    std::vector<std::pair<key, histograms*> > hs;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        hs.assign(m_histograms.begin(), m_histograms.end());
+    }
+
+    out << "# TYPE consus_transaction_phase_seconds histogram\n";
+
+    for (size_t i = 0; i < hs.size(); ++i)
+    {
+        std::ostringstream labels;
+        labels << "group=\"";
+
+        if (hs[i].first.group != 0)
+        {
+            labels << hs[i].first.group;
+        }
+
+        labels << "\",dcs=\"";
+
+        for (size_t j = 0; j < hs[i].first.dcs_sz; ++j)
+        {
+            labels << (j > 0 ? "," : "") << hs[i].first.dcs[j];
+        }
+
+        labels << "\",phase=\"";
+
+        for (size_t p = 0; p < NUM_PHASES; ++p)
+        {
+            if (hs[i].second->h[p].count() == 0)
+            {
+                continue;
+            }
+
+            hs[i].second->h[p].render(out, "consus_transaction_phase_seconds",
+                                      labels.str() + s_phases[p] + "\"");
+        }
+    }
+}
+
+phase_latency::histograms*
+phase_latency :: get(const key& k)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    key which(k);
+
+    if (m_histograms.size() >= PHASE_LATENCY_MAX_KEYS &&
+        m_histograms.find(which) == m_histograms.end())
+    {
+        which = key();
+    }
+
+    map_t::iterator it = m_histograms.find(which);
+
+    if (it != m_histograms.end())
+    {
+        return it->second;
+    }
+
+    histograms* h = new histograms();
+    m_histograms.insert(std::make_pair(which, h));
+    return h;
+}
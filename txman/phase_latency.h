@@ -0,0 +1,100 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_phase_latency_h_
+#define consus_txman_phase_latency_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+#include <map>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/constants.h"
+#include "common/ids.h"
+#include "common/metrics.h"
+
+// (group, data centers) pairs with their own histograms; the rest share one
+#define PHASE_LATENCY_MAX_KEYS 256
+
+BEGIN_CONSUS_NAMESPACE
+
+// How long transactions spend in each phase of commit, per paxos group and
+// per set of data centers they span, for capacity planning and for judging
+// the cost of a wide-area topology.
+class phase_latency
+{
+    public:
+        enum phase
+        {
+            // time in each state of transaction
+            EXECUTING,
+            LOCAL_VOTE,
+            GLOBAL_VOTE,
+            COMMITTING,
+            ABORTING,
+            // from proposing a vote to learning the outcome, per voter
+            LOCAL_PAXOS,
+            GLOBAL_PAXOS,
+            NUM_PHASES
+        };
+
+    public:
+        phase_latency();
+        ~phase_latency() throw ();
+
+    public:
+        void record(paxos_group_id group,
+                    const paxos_group_id* dcs, size_t dcs_sz,
+                    phase p, uint64_t nanos);
+        // append as Prometheus histograms
+        void render(std::ostream& out);
+
+    private:
+        struct key;
+        struct histograms;
+        typedef std::map<key, histograms*> map_t;
+        histograms* get(const key& k);
+
+    private:
+        po6::threads::mutex m_mtx;
+        map_t m_histograms;
+
+    private:
+        phase_latency(const phase_latency&);
+        phase_latency& operator = (const phase_latency&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_phase_latency_h_
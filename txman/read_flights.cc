@@ -0,0 +1,97 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// e
+#include <e/compat.h>
+#include <e/endian.h>
+
+// consus
+#include "txman/read_flights.h"
+
+using consus::read_flights;
+
+read_flights :: read_flights()
+    : m_shards()
+{
+}
+
+read_flights :: ~read_flights() throw ()
+{
+}
+
+std::string
+read_flights :: flight(const e::slice& table,
+                       const e::slice& key,
+                       uint64_t timestamp)
+{
+    // the fixed-width timestamp and table length make the name unambiguous
+    char buf[2 * sizeof(uint64_t)];
+    e::pack64be(timestamp, buf);
+    e::pack64be(table.size(), buf + sizeof(uint64_t));
+    std::string f(buf, sizeof(buf));
+    f.append(table.cdata(), table.size());
+    f.append(key.cdata(), key.size());
+    return f;
+}
+
+uint64_t
+read_flights :: find(const std::string& f)
+{
+    shard* s = get_shard(f);
+    po6::threads::mutex::hold hold(&s->mtx);
+    std::map<std::string, uint64_t>::iterator it = s->flights.find(f);
+    return it != s->flights.end() ? it->second : 0;
+}
+
+void
+read_flights :: start(const std::string& f, uint64_t nonce)
+{
+    shard* s = get_shard(f);
+    po6::threads::mutex::hold hold(&s->mtx);
+    s->flights[f] = nonce;
+}
+
+void
+read_flights :: finish(const std::string& f, uint64_t nonce)
+{
+    shard* s = get_shard(f);
+    po6::threads::mutex::hold hold(&s->mtx);
+    std::map<std::string, uint64_t>::iterator it = s->flights.find(f);
+
+    if (it != s->flights.end() && it->second == nonce)
+    {
+        s->flights.erase(it);
+    }
+}
+
+read_flights::shard*
+read_flights :: get_shard(const std::string& f)
+{
+    e::compat::hash<std::string> h;
+    return &m_shards[h(f) % READ_FLIGHTS_SHARDS];
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_txman_read_flights_h_
+#define consus_txman_read_flights_h_
+
+// STL
+#include <map>
+#include <string>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+
+// independently locked maps the flights are spread over
+#define READ_FLIGHTS_SHARDS 16
+
+BEGIN_CONSUS_NAMESPACE
+
+// The pinned reads this daemon has in flight to the key-value stores, by the
+// version they read.  Every transaction reading the newest version of a key
+// at or before the same timestamp gets the same answer, so a read that
+// finds one already in flight joins it instead of sending its own.
+class read_flights
+{
+    public:
+        read_flights();
+        ~read_flights() throw ();
+
+    public:
+        // names the version of table/key a read at timestamp returns
+        static std::string flight(const e::slice& table,
+                                  const e::slice& key,
+                                  uint64_t timestamp);
+        // the nonce of the read in flight for f, or 0 if there is none
+        uint64_t find(const std::string& f);
+        void start(const std::string& f, uint64_t nonce);
+        // forget f, unless a later read has taken it over
+        void finish(const std::string& f, uint64_t nonce);
+
+    private:
+        struct shard
+        {
+            shard() : mtx(), flights() {}
+            po6::threads::mutex mtx;
+            std::map<std::string, uint64_t> flights;
+        };
+        shard* get_shard(const std::string& f);
+
+    private:
+        shard m_shards[READ_FLIGHTS_SHARDS];
+
+    private:
+        read_flights(const read_flights&);
+        read_flights& operator = (const read_flights&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_read_flights_h_
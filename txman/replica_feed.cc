@@ -0,0 +1,396 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <set>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "txman/replica_feed.h"
+
+using consus::replica_feed;
+
+replica_feed :: replica_feed()
+    : m_mtx()
+    , m_replicas()
+    , m_nonces()
+    , m_standby()
+{
+}
+
+replica_feed :: ~replica_feed() throw ()
+{
+}
+
+void
+replica_feed :: set_replicas(const std::vector<data_center_id>& dcs)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::set<data_center_id> keep(dcs.begin(), dcs.end());
+
+    for (size_t i = 0; i < dcs.size(); ++i)
+    {
+        m_replicas[dcs[i]];
+    }
+
+    replica_map_t::iterator it = m_replicas.begin();
+
+    while (it != m_replicas.end())
+    {
+        if (keep.find(it->first) != keep.end())
+        {
+            ++it;
+            continue;
+        }
+
+        for (std::map<uint64_t, queued>::iterator q = it->second.writes.begin();
+                q != it->second.writes.end(); ++q)
+        {
+            m_nonces.erase(q->second.w.nonce);
+        }
+
+        m_replicas.erase(it++);
+    }
+
+    if (m_replicas.empty())
+    {
+        m_standby.clear();
+    }
+}
+
+void
+replica_feed :: enqueue(data_center_id dc, uint64_t nonce,
+                        const e::slice& table, const e::slice& key,
+                        uint64_t timestamp, const e::slice& value, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    replica_map_t::iterator it = m_replicas.find(dc);
+
+    if (it == m_replicas.end())
+    {
+        return;
+    }
+
+    enqueue_locked(&it->second, dc, nonce, table, key, timestamp, value, now);
+}
+
+void
+replica_feed :: enqueue_locked(replica* r, data_center_id dc, uint64_t nonce,
+                               const e::slice& table, const e::slice& key,
+                               uint64_t timestamp, const e::slice& value, uint64_t now)
+{
+    if (r->writes.size() >= REPLICA_FEED_BACKLOG)
+    {
+        // the oldest write leaves the queue; its key is resynced instead
+        const queued& oldest(r->writes.begin()->second);
+        resync_locked(r, key_t(oldest.w.table, oldest.w.key));
+        m_nonces.erase(oldest.w.nonce);
+        r->writes.erase(r->writes.begin());
+        r->acked_through = r->writes.empty() ? r->next : r->writes.begin()->first;
+    }
+
+    const uint64_t pos = r->next++;
+    queued* q = &r->writes[pos];
+    q->w.dc = dc;
+    q->w.nonce = nonce;
+    q->w.table.assign(table.cdata(), table.size());
+    q->w.key.assign(key.cdata(), key.size());
+    q->w.timestamp = timestamp;
+    q->w.value.assign(value.cdata(), value.size());
+    q->enqueued = now;
+    m_nonces[nonce] = std::make_pair(dc, pos);
+}
+
+void
+replica_feed :: due(uint64_t now, std::vector<write>* out)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        size_t n = 0;
+
+        for (std::map<uint64_t, queued>::iterator q = it->second.writes.begin();
+                q != it->second.writes.end() && n < REPLICA_FEED_WINDOW; ++q, ++n)
+        {
+            if (q->second.sent == 0 || q->second.sent + REPLICA_FEED_RESEND <= now)
+            {
+                q->second.sent = now;
+                out->push_back(q->second.w);
+            }
+        }
+    }
+}
+
+bool
+replica_feed :: acked(uint64_t nonce)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    nonce_map_t::iterator n = m_nonces.find(nonce);
+
+    if (n == m_nonces.end())
+    {
+        return false;
+    }
+
+    replica_map_t::iterator it = m_replicas.find(n->second.first);
+
+    if (it != m_replicas.end())
+    {
+        replica* r = &it->second;
+        r->writes.erase(n->second.second);
+        r->acked_through = r->writes.empty() ? r->next : r->writes.begin()->first;
+    }
+
+    m_nonces.erase(n);
+    return true;
+}
+
+void
+replica_feed :: standby(paxos_group_id group, const e::slice& table,
+                        const e::slice& key, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_replicas.empty())
+    {
+        return;
+    }
+
+    std::deque<standby_key>* keys = &m_standby[group];
+
+    while (!keys->empty() &&
+           (keys->front().when + REPLICA_FEED_STANDBY_AGE < now ||
+            keys->size() >= REPLICA_FEED_BACKLOG))
+    {
+        keys->pop_front();
+    }
+
+    keys->push_back(standby_key());
+    keys->back().key = key_t(table.str(), key.str());
+    keys->back().when = now;
+}
+
+void
+replica_feed :: take_over(paxos_group_id group, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    standby_map_t::iterator s = m_standby.find(group);
+
+    if (s == m_standby.end())
+    {
+        return;
+    }
+
+    // some of these writes may have reached the replicas already; sending
+    // a key's newest version again is harmless
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        for (size_t i = 0; i < s->second.size(); ++i)
+        {
+            if (s->second[i].when + REPLICA_FEED_STANDBY_AGE >= now)
+            {
+                resync_locked(&it->second, s->second[i].key);
+            }
+        }
+    }
+
+    m_standby.erase(s);
+}
+
+void
+replica_feed :: due_resyncs(uint64_t now, std::vector<resync>* out)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        size_t n = 0;
+
+        for (std::map<key_t, uint64_t>::iterator k = it->second.resyncs.begin();
+                k != it->second.resyncs.end() && n < REPLICA_FEED_WINDOW; ++k)
+        {
+            if (k->second != 0 && k->second + REPLICA_FEED_RESYNC_RETRY > now)
+            {
+                ++n;
+                continue;
+            }
+
+            k->second = now;
+            out->push_back(resync());
+            out->back().dc = it->first;
+            out->back().table = k->first.first;
+            out->back().key = k->first.second;
+            ++n;
+        }
+    }
+}
+
+void
+replica_feed :: resynced(data_center_id dc, const e::slice& table, const e::slice& key,
+                         consus_returncode rc, uint64_t timestamp, const e::slice& value,
+                         uint64_t nonce, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    replica_map_t::iterator it = m_replicas.find(dc);
+
+    if (it == m_replicas.end())
+    {
+        return;
+    }
+
+    replica* r = &it->second;
+
+    // anything else is read again after REPLICA_FEED_RESYNC_RETRY
+    if (rc != CONSUS_SUCCESS && rc != CONSUS_NOT_FOUND)
+    {
+        return;
+    }
+
+    if (r->resyncs.erase(key_t(table.str(), key.str())) == 0)
+    {
+        return;
+    }
+
+    ++r->resynced;
+
+    if (rc == CONSUS_SUCCESS)
+    {
+        enqueue_locked(r, dc, nonce, table, key, timestamp, value, now);
+    }
+}
+
+void
+replica_feed :: resync_locked(replica* r, const key_t& key)
+{
+    if (r->resyncs.find(key) != r->resyncs.end())
+    {
+        return;
+    }
+
+    if (r->resyncs.size() >= REPLICA_FEED_RESYNC_MAX)
+    {
+        ++r->dropped;
+        return;
+    }
+
+    r->resyncs.insert(std::make_pair(key, uint64_t(0)));
+}
+
+void
+replica_feed :: render(std::ostream& out, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_replicas.empty())
+    {
+        return;
+    }
+
+    out << "# TYPE consus_read_replica_lag_seconds gauge\n";
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        const uint64_t since = it->second.writes.empty() ? now : it->second.writes.begin()->second.enqueued;
+        const uint64_t lag = now > since ? now - since : 0;
+        out << "consus_read_replica_lag_seconds{data_center=\"" << it->first.get() << "\"} "
+            << lag * 1e-9 << "\n";
+    }
+
+    out << "# TYPE consus_read_replica_backlog gauge\n";
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        out << "consus_read_replica_backlog{data_center=\"" << it->first.get() << "\"} "
+            << it->second.writes.size() << "\n";
+    }
+
+    out << "# TYPE consus_read_replica_position gauge\n";
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        out << "consus_read_replica_position{data_center=\"" << it->first.get() << "\"} "
+            << it->second.acked_through << "\n";
+    }
+
+    out << "# TYPE consus_read_replica_resync_backlog gauge\n";
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        out << "consus_read_replica_resync_backlog{data_center=\"" << it->first.get() << "\"} "
+            << it->second.resyncs.size() << "\n";
+    }
+
+    out << "# TYPE consus_read_replica_resynced_total counter\n";
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        out << "consus_read_replica_resynced_total{data_center=\"" << it->first.get() << "\"} "
+            << it->second.resynced << "\n";
+    }
+
+    out << "# TYPE consus_read_replica_dropped_total counter\n";
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        out << "consus_read_replica_dropped_total{data_center=\"" << it->first.get() << "\"} "
+            << it->second.dropped << "\n";
+    }
+}
+
+std::string
+replica_feed :: debug_dump(uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+
+    for (replica_map_t::iterator it = m_replicas.begin();
+            it != m_replicas.end(); ++it)
+    {
+        const uint64_t since = it->second.writes.empty() ? now : it->second.writes.begin()->second.enqueued;
+        ostr << it->first
+             << " queued=" << it->second.writes.size()
+             << " acked_through=" << it->second.acked_through
+             << " resyncing=" << it->second.resyncs.size()
+             << " lag=" << (now > since ? now - since : 0) / PO6_MILLIS << "ms"
+             << " dropped=" << it->second.dropped << "\n";
+    }
+
+    return ostr.str();
+}
@@ -0,0 +1,193 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_replica_feed_h_
+#define consus_txman_replica_feed_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include <consus.h>
+#include "namespace.h"
+#include "common/ids.h"
+
+// the feeding thread wakes this often to send and resend
+#define REPLICA_FEED_INTERVAL (PO6_MILLIS * 10)
+// a write the replica has not acknowledged is sent again this often
+#define REPLICA_FEED_RESEND (PO6_MILLIS * 250)
+// at most this many writes are in flight to each read replica
+#define REPLICA_FEED_WINDOW 256
+// writes queued for a read replica past this many are resynced instead
+#define REPLICA_FEED_BACKLOG 65536
+// keys awaiting a resync for a read replica past this many are lost
+#define REPLICA_FEED_RESYNC_MAX 1048576
+// a resync read the key-value store has not answered is sent again this often
+#define REPLICA_FEED_RESYNC_RETRY (PO6_SECONDS * 5)
+// members that do not feed a group remember its writes' keys this long, in
+// case its feeder fails with them unacknowledged
+#define REPLICA_FEED_STANDBY_AGE (PO6_SECONDS * 60)
+
+BEGIN_CONSUS_NAMESPACE
+
+// Committed writes bound for read replicas.
+//
+// A read replica is a data center outside every quorum whose key-value
+// stores hold a full copy of every table, for stale reads only.  The first
+// live member of the group that performs a write queues it here, once per
+// replica, after the transaction commits; a thread sends each, windowed and
+// resent until the replica's key-value store acknowledges it.  The replica
+// is thus behind by however long the oldest unacknowledged write has been
+// queued, which is reported per data center so that operators know how
+// stale a read there may be.
+//
+// Each replica's queue is numbered, and every position below acked_through
+// has been acknowledged.  The queue is memory only, so a gap in it is filled
+// from the key-value store instead: its keys are resynced by reading their
+// newest version from this data center and sending that.  A replica that
+// falls REPLICA_FEED_BACKLOG behind resyncs the oldest writes' keys; and the
+// other members of a group remember the keys of its recent writes, which
+// they resync when the feeder fails and one of them takes over.  Only keys
+// past REPLICA_FEED_RESYNC_MAX, or older than REPLICA_FEED_STANDBY_AGE at a
+// failover, are lost; they are counted, and call for re-seeding the replica.
+// A key deleted since it was written keeps its old value at the replica.
+class replica_feed
+{
+    public:
+        struct write
+        {
+            write() : dc(), nonce(0), table(), key(), timestamp(0), value() {}
+            data_center_id dc;
+            uint64_t nonce;
+            std::string table;
+            std::string key;
+            uint64_t timestamp;
+            std::string value;
+        };
+        struct resync
+        {
+            resync() : dc(), table(), key() {}
+            data_center_id dc;
+            std::string table;
+            std::string key;
+        };
+
+    public:
+        replica_feed();
+        ~replica_feed() throw ();
+
+    public:
+        // from each configuration; forgets what is queued for any other
+        void set_replicas(const std::vector<data_center_id>& dcs);
+        void enqueue(data_center_id dc, uint64_t nonce,
+                     const e::slice& table, const e::slice& key,
+                     uint64_t timestamp, const e::slice& value, uint64_t now);
+        // the writes to send (or resend) now
+        void due(uint64_t now, std::vector<write>* out);
+        // true if nonce was a write of the feed
+        bool acked(uint64_t nonce);
+        // a write to group this member does not feed
+        void standby(paxos_group_id group, const e::slice& table,
+                     const e::slice& key, uint64_t now);
+        // this member now feeds group; resync what its feeder may have lost
+        void take_over(paxos_group_id group, uint64_t now);
+        // the keys to read (or read again) now for resyncs
+        void due_resyncs(uint64_t now, std::vector<resync>* out);
+        // the answer to a resync read of table/key for dc
+        void resynced(data_center_id dc, const e::slice& table, const e::slice& key,
+                      consus_returncode rc, uint64_t timestamp, const e::slice& value,
+                      uint64_t nonce, uint64_t now);
+
+    public:
+        void render(std::ostream& out, uint64_t now);
+        std::string debug_dump(uint64_t now);
+
+    private:
+        struct queued
+        {
+            queued() : w(), enqueued(0), sent(0) {}
+            write w;
+            uint64_t enqueued;
+            uint64_t sent;
+        };
+        typedef std::pair<std::string, std::string> key_t;
+        struct replica
+        {
+            replica() : next(0), acked_through(0), writes(), resyncs(), resynced(0), dropped(0) {}
+            uint64_t next;
+            uint64_t acked_through;
+            std::map<uint64_t, queued> writes;
+            // key -> when its read last went out, or 0
+            std::map<key_t, uint64_t> resyncs;
+            uint64_t resynced;
+            uint64_t dropped;
+        };
+        struct standby_key
+        {
+            standby_key() : key(), when(0) {}
+            key_t key;
+            uint64_t when;
+        };
+        typedef std::map<data_center_id, replica> replica_map_t;
+        typedef std::map<uint64_t, std::pair<data_center_id, uint64_t> > nonce_map_t;
+        typedef std::map<paxos_group_id, std::deque<standby_key> > standby_map_t;
+
+    private:
+        void enqueue_locked(replica* r, data_center_id dc, uint64_t nonce,
+                            const e::slice& table, const e::slice& key,
+                            uint64_t timestamp, const e::slice& value, uint64_t now);
+        void resync_locked(replica* r, const key_t& key);
+
+    private:
+        po6::threads::mutex m_mtx;
+        replica_map_t m_replicas;
+        // nonce -> (dc, position in its queue)
+        nonce_map_t m_nonces;
+        standby_map_t m_standby;
+
+    private:
+        replica_feed(const replica_feed&);
+        replica_feed& operator = (const replica_feed&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_replica_feed_h_
@@ -0,0 +1,98 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// consus
+#include "txman/timeline.h"
+
+using consus::timeline;
+
+timeline :: timeline()
+    : m_events()
+    , m_dropped(0)
+{
+}
+
+timeline :: ~timeline() throw ()
+{
+}
+
+void
+timeline :: mark(const char* what, uint64_t now)
+{
+    mark(what, UINT64_MAX, now);
+}
+
+void
+timeline :: mark(const char* what, uint64_t seqno, uint64_t now)
+{
+    if (m_events.size() >= TIMELINE_MAX_EVENTS)
+    {
+        ++m_dropped;
+        return;
+    }
+
+    m_events.push_back(event(what, seqno, now));
+}
+
+uint64_t
+timeline :: elapsed(uint64_t now) const
+{
+    if (m_events.empty() || now < m_events[0].at)
+    {
+        return 0;
+    }
+
+    return now - m_events[0].at;
+}
+
+void
+timeline :: write(std::ostream& out) const
+{
+    for (size_t i = 0; i < m_events.size(); ++i)
+    {
+        if (i > 0)
+        {
+            out << " ";
+        }
+
+        out << m_events[i].what;
+
+        if (m_events[i].seqno != UINT64_MAX)
+        {
+            out << "[" << m_events[i].seqno << "]";
+        }
+
+        out << "+" << (m_events[i].at - m_events[0].at) / 1000000.0;
+    }
+
+    if (m_dropped > 0)
+    {
+        out << " (" << m_dropped << " more)";
+    }
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_timeline_h_
+#define consus_txman_timeline_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+#include <vector>
+
+// consus
+#include "namespace.h"
+
+// events kept per transaction; later ones are only counted
+#define TIMELINE_MAX_EVENTS 64
+
+BEGIN_CONSUS_NAMESPACE
+
+// When each step of one transaction happened on this daemon, so that a slow
+// transaction can be logged with where its time went.  The caller
+// serializes access.
+class timeline
+{
+    public:
+        timeline();
+        ~timeline() throw ();
+
+    public:
+        // what must be a string literal; the first mark starts the clock
+        void mark(const char* what, uint64_t now);
+        // as above, for a step of the operation at seqno
+        void mark(const char* what, uint64_t seqno, uint64_t now);
+        uint64_t elapsed(uint64_t now) const;
+        // one line: each step with its offset from the first, in ms
+        void write(std::ostream& out) const;
+
+    private:
+        struct event
+        {
+            event(const char* w, uint64_t s, uint64_t a)
+                : what(w), seqno(s), at(a) {}
+            const char* what;
+            uint64_t seqno;
+            uint64_t at;
+        };
+
+    private:
+        std::vector<event> m_events;
+        uint64_t m_dropped;
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_timeline_h_
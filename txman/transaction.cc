@@ -27,13 +27,20 @@
 
 #define __STDC_LIMIT_MACROS
 
+// C
+#include <string.h>
+
 // STL
+#include <algorithm>
 #include <sstream>
 #include <string>
 
 // Google Log
 #include <glog/logging.h>
 
+// po6
+#include <po6/time.h>
+
 // e
 #include <e/serialization.h>
 #include <e/strescape.h>
@@ -42,12 +49,31 @@
 #include <busybee.h>
 
 // consus
+#include "common/constants.h"
 #include "common/consus.h"
+#include "common/hash.h"
 #include "common/ids.h"
+#include "common/probes.h"
+#include "common/update.h"
 #include "txman/daemon.h"
+#include "txman/kvs_lock_batch.h"
 #include "txman/log_entry_t.h"
 #include "txman/transaction.h"
 
+// operations to make room for before the first reallocation
+#define TRANSACTION_OPS_RESERVE 16
+// commit records larger than this go to other data centers in pieces
+#define COMMIT_RECORD_CHUNK_BYTES (256ULL * 1024ULL)
+// refuse to buffer commit records claiming more pieces than this
+#define COMMIT_RECORD_MAX_CHUNKS 65536
+// durable notifications to hold for a transaction that has not yet begun;
+// later ones are dropped and learned again when the 2A is resent
+#define DEFERRED_2B_MAX (CONSUS_MAX_REPLICATION_FACTOR * CONSUS_TRANSACTION_WINDOW)
+// trailing flags on a logged read or write; entries without them were
+// taken under lock, as before operations could be optimistic
+#define OP_FLAG_READ_UNDER_LOCK 1
+#define OP_FLAG_OPTIMISTIC 2
+
 #define UNPACK_ERROR(X) \
     LOG(ERROR) << logid() << " failed while unpacking " << (X);
 
@@ -70,10 +96,23 @@
     } \
     else \
     { \
+        m_client_active = po6::monotonic_time(); \
         INTERNAL_RETURN_IF_EXECUTED((I), "client", (A)); \
     } \
     } while (0)
 
+// ops below m_ops.size() have all arrived or left a gap for one that is in
+// flight, so a client respecting its window never lands beyond this
+#define CLIENT_RETURN_IF_OUTSIDE_WINDOW(I, A) \
+    do { \
+    if ((I) >= m_ops.size() + CONSUS_TRANSACTION_WINDOW) \
+    { \
+        LOG(ERROR) << logid() << ".ops[" << (I) << "]: client " << (A) << " is outside the window of " << CONSUS_TRANSACTION_WINDOW << " operations past " << m_ops.size(); \
+        avoid_commit_if_possible(d); \
+        return; \
+    } \
+    } while (0)
+
 #define INTERNAL_RETURN_IF_EXECUTED(I, S, A) \
     do { \
     if (m_state > EXECUTING) \
@@ -111,7 +150,8 @@ struct transaction :: operation
 
     // utils
     void set_client(comm_id client, uint64_t nonce);
-    bool merge(const operation& op, const comparison& cmp);
+    // the first merge copies op's table, key, and value into the arena
+    bool merge(const operation& op, const comparison& cmp, op_arena* arena);
 
     // log entry
     log_entry_t type;
@@ -120,25 +160,43 @@ struct transaction :: operation
     uint64_t timestamp;
     e::slice value;
     consus_returncode rc;
-    e::compat::shared_ptr<e::buffer> backing;
 
-    // locking
+    // locking; an optimistic op on a table without locks takes its lock
+    // only to validate at prepare
+    bool optimistic;
     bool require_lock;
     bool lock_acquired;
     bool lock_released;
+    bool lock_exclusive;
     uint64_t lock_nonce;
+    // when the outstanding unlock went out; unlocking is idempotent at the
+    // key-value store, so one that goes unanswered is simply sent again
+    uint64_t unlock_sent;
 
     // reading
     bool require_read;
     bool read_done;
     std::string read_backing;
     uint64_t read_nonce;
+    // the read completed while this transaction held the key's lock; the
+    // KVS only hands a granted lock to another transaction after we unlock
+    // it, so nothing can have written the key since
+    bool read_under_lock;
+    // a peer logged this read at timestamp; a client asking this member for
+    // the same slot, as a hedged or retried read does, gets that version
+    bool read_pinned;
 
     // writing
     bool require_write;
     bool write_done;
     uint64_t write_nonce;
 
+    // a write another data center's commit record sent only as a digest;
+    // value stays empty until the origin ships it after the decision
+    bool value_pending;
+    uint64_t value_size;
+    uint64_t value_hash;
+
     // verify read
     bool require_verify_read;
     bool verify_read_done;
@@ -149,18 +207,126 @@ struct transaction :: operation
     bool verify_write_done;
     uint64_t verify_write_nonce;
 
+    // conditional write; once this op's read completes, the next op becomes
+    // the write or a second read, and answers cond_client
+    bool cond_pending;
+    update_t cond_update;
+    e::slice cond_table;
+    e::slice cond_key;
+    e::slice cond_expected;
+    e::slice cond_value;
+    e::compat::shared_ptr<e::buffer> cond_backing;
+    // backs value when this op writes what an update computed
+    e::compat::shared_ptr<e::buffer> cond_written;
+    comm_id cond_client;
+    uint64_t cond_nonce;
+    // answers a conditional write rather than a plain read or write, with
+    // cond_rc if it did not write
+    bool conditional;
+    consus_returncode cond_rc;
+
     // durability
     bool log_write_issued;
     bool log_write_durable;
-    bool durable[CONSUS_MAX_REPLICATION_FACTOR];
-    uint64_t paxos_timestamps[CONSUS_MAX_REPLICATION_FACTOR];
-    uint64_t paxos_2b_timestamps[CONSUS_MAX_REPLICATION_FACTOR];
 
     // client response
     comm_id client;
     uint64_t nonce;
 };
 
+struct transaction :: declared
+{
+    declared();
+    ~declared() throw ();
+
+    std::string table;
+    std::string key;
+    uint8_t flags;
+
+    // locking, as for an operation; an op on the same key that needs no
+    // more than this lock takes it over rather than asking for its own
+    uint64_t lock_nonce;
+    bool lock_acquired;
+    bool lock_released;
+    uint64_t unlock_sent;
+    // the lock was granted after an op on the key had unlocked it, so the
+    // op's unlock did not release it
+    bool late;
+
+    // prefetching
+    uint64_t read_nonce;
+    bool read_done;
+    std::string read_backing;
+    uint64_t timestamp;
+    consus_returncode rc;
+};
+
+transaction :: declared :: declared()
+    : table()
+    , key()
+    , flags(0)
+    , lock_nonce(0)
+    , lock_acquired(false)
+    , lock_released(false)
+    , unlock_sent(0)
+    , late(false)
+    , read_nonce(0)
+    , read_done(false)
+    , read_backing()
+    , timestamp(0)
+    , rc(CONSUS_GARBAGE)
+{
+}
+
+transaction :: declared :: ~declared() throw ()
+{
+}
+
+// A chunk of a scan the client was answered with.  The key-value stores
+// cannot lock a range, so the chunk is read again before prepare, and any
+// key inserted, removed, or rewritten within it since aborts the transaction.
+struct transaction :: scanned
+{
+    scanned();
+    ~scanned() throw ();
+
+    std::string table;
+    std::string key;
+    uint64_t limit;
+    bool scan_done;
+    uint64_t digest;
+    bool verify_sent;
+    bool verify_done;
+};
+
+transaction :: scanned :: scanned()
+    : table()
+    , key()
+    , limit(0)
+    , scan_done(false)
+    , digest(0)
+    , verify_sent(false)
+    , verify_done(false)
+{
+}
+
+transaction :: scanned :: ~scanned() throw ()
+{
+}
+
+static bool
+declared_before(const transaction::key_hint& lhs, const transaction::key_hint& rhs)
+{
+    int cmp = lhs.table.compare(rhs.table);
+
+    if (cmp != 0)
+    {
+        return cmp < 0;
+    }
+
+    return lhs.key.compare(rhs.key) < 0;
+}
+
 transaction :: operation :: operation()
     : type(LOG_ENTRY_NOP)
     , table()
@@ -168,35 +334,48 @@ transaction :: operation :: operation()
     , timestamp(0)
     , value()
     , rc(CONSUS_GARBAGE)
-    , backing()
+    , optimistic(false)
     , require_lock(false)
     , lock_acquired(false)
     , lock_released(false)
+    , lock_exclusive(false)
     , lock_nonce(0)
+    , unlock_sent(0)
     , require_read(false)
     , read_done(false)
     , read_backing()
     , read_nonce()
+    , read_under_lock(false)
+    , read_pinned(false)
     , require_write(false)
     , write_done(false)
     , write_nonce(0)
+    , value_pending(false)
+    , value_size(0)
+    , value_hash(0)
     , require_verify_read(false)
     , verify_read_done(false)
     , verify_read_nonce()
     , require_verify_write(false)
     , verify_write_done(false)
     , verify_write_nonce()
+    , cond_pending(false)
+    , cond_update(UPDATE_IF_EQUAL)
+    , cond_table()
+    , cond_key()
+    , cond_expected()
+    , cond_value()
+    , cond_backing()
+    , cond_written()
+    , cond_client()
+    , cond_nonce(0)
+    , conditional(false)
+    , cond_rc(CONSUS_COMPARE_FAILED)
     , log_write_issued(false)
     , log_write_durable(false)
     , client()
     , nonce()
 {
-    for (unsigned i = 0; i < CONSUS_MAX_REPLICATION_FACTOR; ++i)
-    {
-        durable[i] = false;
-        paxos_timestamps[i] = 0;
-        paxos_2b_timestamps[i] = 0;
-    }
 }
 
 transaction :: operation :: ~operation() throw ()
@@ -214,15 +393,14 @@ transaction :: operation :: set_client(comm_id c, uint64_t n)
 }
 
 bool
-transaction :: operation :: merge(const operation& op, const comparison& cmp)
+transaction :: operation :: merge(const operation& op, const comparison& cmp, op_arena* arena)
 {
     if (type == LOG_ENTRY_NOP)
     {
         type = op.type;
-        table = op.table;
-        key = op.key;
-        value = op.value;
-        backing = op.backing;
+        table = arena->copy(op.table);
+        key = arena->copy(op.key);
+        value = arena->copy(op.value);
     }
     else
     {
@@ -247,10 +425,47 @@ transaction :: transaction(const transaction_group& tg)
     , m_dcs_sz()
     , m_state(INITIALIZED)
     , m_decision(INITIALIZED)
+    , m_traced_state(INITIALIZED)
+    , m_traced_since(0)
+    , m_inflight(NULL)
+    , m_inflight_since(0)
+    , m_costs(NULL)
+    , m_timed_state(INITIALIZED)
+    , m_timed_since(0)
+    , m_timeline()
     , m_timestamp(0)
     , m_prefer_to_commit(true)
+    , m_client_active(0)
+    , m_abandoned(false)
+    , m_validating(false)
+    , m_validate_client()
+    , m_validate_nonce(0)
+    , m_validate_seqno(0)
+    , m_scans()
     , m_ops()
+    , m_arena()
+    , m_durable()
+    , m_paxos_timestamps()
+    , m_paxos_2b_timestamps()
+    , m_paxos_resent()
+    , m_witnessed()
+    , m_ops_executed(0)
+    , m_ops_finished(0)
+    , m_ops_dirty()
+    , m_declared()
+    , m_declared_here(false)
+    , m_ops_end(UINT64_MAX)
+    , m_vote_resent(0)
     , m_deferred_2b()
+    , m_commit_record()
+    , m_commit_record_ops(0)
+    , m_commit_chunks()
+    , m_commit_chunks_ops(0)
+    , m_commit_chunks_received(0)
+    , m_values_acked()
+    , m_values_fetched(false)
+    , m_single(false)
+    , m_single_kind(SINGLE_GET)
 {
     po6::threads::mutex::hold hold(&m_mtx);
 
@@ -262,6 +477,15 @@ transaction :: transaction(const transaction_group& tg)
 
 transaction :: ~transaction() throw ()
 {
+    if (m_inflight)
+    {
+        m_inflight->remove(m_tg, m_inflight_since);
+    }
+
+    if (m_costs)
+    {
+        m_costs->finish(m_tg);
+    }
 }
 
 const consus::transaction_group&
@@ -281,12 +505,25 @@ void
 transaction :: begin(comm_id id, uint64_t nonce, uint64_t timestamp,
                      const paxos_group& group,
                      const std::vector<paxos_group_id>& dcs,
+                     const std::vector<key_hint>& hints,
                      daemon* d)
 {
+    // keys on tables without locks are validated at prepare instead
+    std::vector<key_hint> locking;
+
+    for (size_t i = 0; i < hints.size(); ++i)
+    {
+        if (!d->optimistic(hints[i].table))
+        {
+            locking.push_back(hints[i]);
+        }
+    }
+
     po6::threads::mutex::hold hold(&m_mtx);
     CLIENT_RETURN_IF_EXECUTED(0, id, nonce, "begin");
-    internal_begin("client", timestamp, group, dcs, d);
+    internal_begin("client", timestamp, group, dcs, locking, d);
     m_ops[0].set_client(id, nonce);
+    m_declared_here = !m_declared.empty();
     work_state_machine(d);
 }
 
@@ -298,10 +535,26 @@ transaction :: paxos_2a_begin(uint64_t seqno,
 {
     uint64_t timestamp;
     std::vector<paxos_group_id> dcs;
+    uint64_t hints_sz = 0;
+    std::vector<key_hint> hints;
     up = up >> timestamp >> dcs;
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> hints_sz;
+    }
+
+    for (uint64_t i = 0; !up.error() && i < hints_sz && i < CONSUS_MAX_DECLARED_KEYS; ++i)
+    {
+        key_hint h;
+        up = up >> h.table >> h.key >> h.flags;
+        hints.push_back(h);
+    }
+
     const paxos_group* group = d->get_config()->get_group(m_tg.group);
 
-    if (seqno != 0 || up.error() || up.remain() || !group)
+    if (seqno != 0 || up.error() || up.remain() || !group ||
+        hints_sz > CONSUS_MAX_DECLARED_KEYS)
     {
         UNPACK_ERROR("paxos 2a::begin");
         po6::threads::mutex::hold hold(&m_mtx);
@@ -310,7 +563,7 @@ transaction :: paxos_2a_begin(uint64_t seqno,
     }
 
     po6::threads::mutex::hold hold(&m_mtx);
-    internal_begin("paxos 2a", timestamp, *group, dcs, d);
+    internal_begin("paxos 2a", timestamp, *group, dcs, hints, d);
     work_state_machine(d);
 }
 
@@ -332,13 +585,14 @@ transaction :: commit_record_begin(uint64_t seqno,
         return;
     }
 
-    internal_begin("commit record", timestamp, *group, dcs, d);
+    internal_begin("commit record", timestamp, *group, dcs, std::vector<key_hint>(), d);
 }
 
 void
 transaction :: internal_begin(const char* source, uint64_t timestamp,
                               const paxos_group& group,
                               const std::vector<paxos_group_id>& dcs,
+                              const std::vector<key_hint>& hints,
                               daemon* d)
 {
     ensure_initialized();
@@ -363,6 +617,8 @@ transaction :: internal_begin(const char* source, uint64_t timestamp,
         return;
     }
 
+    mark_dirty(0);
+
     if (m_init_timestamp == 0)
     {
         LOG_IF(INFO, s_debug_mode) << logid() << ".transaction_group: " << m_tg;
@@ -384,6 +640,28 @@ transaction :: internal_begin(const char* source, uint64_t timestamp,
 
         m_dcs_sz = dcs.size();
 
+        // one lock per key, in the same order everywhere
+        std::vector<key_hint> sorted(hints);
+        std::sort(sorted.begin(), sorted.end(), declared_before);
+
+        for (size_t i = 0; i < sorted.size(); ++i)
+        {
+            if (!m_declared.empty() &&
+                e::slice(m_declared.back().table) == sorted[i].table &&
+                e::slice(m_declared.back().key) == sorted[i].key)
+            {
+                m_declared.back().flags |= sorted[i].flags;
+                continue;
+            }
+
+            m_declared.push_back(declared());
+            m_declared.back().table.assign(sorted[i].table.cdata(), sorted[i].table.size());
+            m_declared.back().key.assign(sorted[i].key.cdata(), sorted[i].key.size());
+            m_declared.back().flags = sorted[i].flags;
+        }
+
+        LOG_IF(INFO, s_debug_mode && !m_declared.empty()) << logid() << " declared " << m_declared.size() << " keys";
+
         for (size_t i = 0; i < m_deferred_2b.size(); ++i)
         {
             LOG_IF(INFO, s_debug_mode) << logid() << " processing delayed durable notifaction " << m_deferred_2b[i].first << "/" << m_deferred_2b[i].second;
@@ -401,11 +679,83 @@ transaction :: read(comm_id id, uint64_t nonce, uint64_t seqno,
 {
     e::compat::shared_ptr<e::buffer> backing(_backing.release());
     po6::threads::mutex::hold hold(&m_mtx);
-    CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "read");
-    internal_read("client", seqno, table, key, backing, d);
-    m_ops[seqno].require_lock = true;
-    m_ops[seqno].require_read = true;
-    m_ops[seqno].set_client(id, nonce);
+    client_read(id, nonce, seqno, table, key, backing, d);
+    work_state_machine(d);
+}
+
+void
+transaction :: cond_write(comm_id id, uint64_t nonce, uint64_t seqno,
+                          const e::slice& table,
+                          const e::slice& key,
+                          update_t update,
+                          const e::slice& expected,
+                          const e::slice& value,
+                          std::auto_ptr<e::buffer> _backing,
+                          daemon* d)
+{
+    e::compat::shared_ptr<e::buffer> backing(_backing.release());
+    po6::threads::mutex::hold hold(&m_mtx);
+    client_cond_write(id, nonce, seqno, table, key, update, expected, value, backing, d);
+    work_state_machine(d);
+}
+
+void
+transaction :: multi(comm_id id, uint64_t ops_sz, e::unpacker up,
+                     std::auto_ptr<e::buffer> _backing,
+                     daemon* d)
+{
+    std::vector<multi_op> ops;
+
+    for (uint64_t i = 0; i < ops_sz && !up.error(); ++i)
+    {
+        multi_op op;
+        up = up >> op.write
+                >> e::unpack_varint(op.nonce)
+                >> e::unpack_varint(op.seqno)
+                >> op.table >> op.key;
+
+        if (op.write)
+        {
+            up = up >> op.value;
+        }
+
+        ops.push_back(op);
+    }
+
+    if (up.error() || up.remain())
+    {
+        UNPACK_ERROR("multi");
+        return;
+    }
+
+    // apply every operation and then work the state machine once, so that
+    // all of the operations go out to the key-value stores together
+    //
+    // Each op keeps its own paxos slot rather than the batch sharing one:
+    // resends, replay, commit records and verification all work per seqno,
+    // and a slot holding several ops would need each of them to learn how
+    // to split it.  The slots of a batch travel together instead: one
+    // TXMAN_PAXOS_2A_BATCH to each member, one TXMAN_PAXOS_2B_BATCH back,
+    // and one flush of the durable log.  What a batch still pays per op is a
+    // log record, an entry in each 2B batch, and members_sz durability
+    // slots; it pays no extra round trip or fsync.
+    e::compat::shared_ptr<e::buffer> backing(_backing.release());
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        const multi_op& op(ops[i]);
+
+        if (op.write)
+        {
+            client_write(id, op.nonce, op.seqno, op.table, op.key, op.value, backing, d);
+        }
+        else
+        {
+            client_read(id, op.nonce, op.seqno, op.table, op.key, backing, d);
+        }
+    }
+
     work_state_machine(d);
 }
 
@@ -418,8 +768,14 @@ transaction :: paxos_2a_read(uint64_t seqno,
     e::slice table;
     e::slice key;
     uint64_t timestamp;
+    uint8_t flags = OP_FLAG_READ_UNDER_LOCK;
     up = up >> table >> key >> timestamp;
 
+    if (!up.error() && up.remain())
+    {
+        up = up >> flags;
+    }
+
     if (up.error() || up.remain())
     {
         UNPACK_ERROR("paxos 2a::read");
@@ -431,8 +787,10 @@ transaction :: paxos_2a_read(uint64_t seqno,
     e::compat::shared_ptr<e::buffer> backing(_backing.release());
     po6::threads::mutex::hold hold(&m_mtx);
     internal_read("paxos 2a", seqno, table, key, backing, d);
-    m_ops[seqno].require_lock = true;
-    m_ops[seqno].lock_acquired = true;
+    replicate_locking("paxos 2a", seqno, flags);
+    // trust the lock only as far as the member that logged the read did
+    m_ops[seqno].read_under_lock = (flags & OP_FLAG_READ_UNDER_LOCK) != 0;
+    m_ops[seqno].read_pinned = true;
     m_ops[seqno].timestamp = timestamp;
     work_state_machine(d);
 }
@@ -446,8 +804,15 @@ transaction :: commit_record_read(uint64_t seqno,
     e::slice table;
     e::slice key;
     uint64_t timestamp;
+    uint8_t flags = 0;
     up = up >> table >> key >> timestamp;
 
+    if (!up.error() && up.remain())
+    {
+        // every read is verified at home, so the flags do not matter here
+        up = up >> flags;
+    }
+
     if (up.error() || up.remain())
     {
         UNPACK_ERROR("commit record::read");
@@ -460,13 +825,174 @@ transaction :: commit_record_read(uint64_t seqno,
     m_ops[seqno].require_lock = true;
     m_ops[seqno].timestamp = timestamp;
     m_ops[seqno].require_verify_read = true;
+    defer_to_home(seqno, d);
+}
+
+void
+transaction :: client_read(comm_id id, uint64_t nonce, uint64_t seqno,
+                           const e::slice& table,
+                           const e::slice& key,
+                           e::compat::shared_ptr<e::buffer> backing,
+                           daemon* d)
+{
+    CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "read");
+    CLIENT_RETURN_IF_OUTSIDE_WINDOW(seqno, "read");
+    internal_read("client", seqno, table, key, backing, d);
+
+    if (seqno >= m_ops.size())
+    {
+        return;
+    }
+
+    set_locking(seqno, d);
+    m_ops[seqno].require_read = true;
+    m_ops[seqno].set_client(id, nonce);
+}
+
+void
+transaction :: client_write(comm_id id, uint64_t nonce, uint64_t seqno,
+                            const e::slice& table,
+                            const e::slice& key,
+                            const e::slice& value,
+                            e::compat::shared_ptr<e::buffer> backing,
+                            daemon* d)
+{
+    CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "write");
+    CLIENT_RETURN_IF_OUTSIDE_WINDOW(seqno, "write");
+    internal_write("client", seqno, table, key, value, backing, d);
+
+    if (seqno >= m_ops.size())
+    {
+        return;
+    }
+
+    set_locking(seqno, d);
+    m_ops[seqno].require_write = true;
+    m_ops[seqno].set_client(id, nonce);
+}
+
+// The read takes seqno and the outcome takes seqno + 1, both ordinary log
+// entries, so the other replicas and data centers need not know that they
+// came from one request.  A retransmission that finds the outcome already
+// chosen (perhaps by another member of the group) just waits for it.
+void
+transaction :: client_cond_write(comm_id id, uint64_t nonce, uint64_t seqno,
+                                 const e::slice& table,
+                                 const e::slice& key,
+                                 update_t update,
+                                 const e::slice& expected,
+                                 const e::slice& value,
+                                 e::compat::shared_ptr<e::buffer> backing,
+                                 daemon* d)
+{
+    CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "conditional write");
+    CLIENT_RETURN_IF_OUTSIDE_WINDOW(seqno, "conditional write");
+
+    if (seqno + 1 < m_ops.size() && m_ops[seqno + 1].type != LOG_ENTRY_NOP)
+    {
+        m_ops[seqno + 1].conditional = true;
+        m_ops[seqno + 1].set_client(id, nonce);
+        mark_dirty(seqno + 1);
+        return;
+    }
+
+    internal_read("client", seqno, table, key, backing, d);
+
+    if (seqno >= m_ops.size() || m_ops[seqno].type != LOG_ENTRY_TX_READ)
+    {
+        return;
+    }
+
+    operation& op(m_ops[seqno]);
+    op.require_lock = true;
+    // the key is all but certain to be written; locking it exclusively now
+    // spares the upgrade two concurrent updaters would deadlock on
+    op.lock_exclusive = true;
+    // a read learned through paxos carries no value; read it again
+    op.require_read = true;
+    op.cond_pending = true;
+    op.cond_update = update;
+    op.cond_table = table;
+    op.cond_key = key;
+    op.cond_expected = expected;
+    op.cond_value = value;
+    op.cond_backing = backing;
+    op.cond_client = id;
+    op.cond_nonce = nonce;
+
+    if (op.read_done)
+    {
+        decide_cond_write(seqno, d);
+    }
+}
+
+void
+transaction :: decide_cond_write(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+    op.cond_pending = false;
+    std::string result;
+    consus_returncode rc;
+    const bool holds = update_apply(op.cond_update, op.rc == CONSUS_SUCCESS, op.value,
+                                    op.cond_expected, op.cond_value, &result, &rc);
+    LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: update "
+                               << (holds ? "writes" : "declines") << " (" << rc << ")";
+    // the internal_* calls may reallocate m_ops
+    const e::slice table(op.cond_table);
+    const e::slice key(op.cond_key);
+    e::compat::shared_ptr<e::buffer> backing(op.cond_backing);
+    const comm_id client(op.cond_client);
+    const uint64_t nonce(op.cond_nonce);
+    op.cond_backing.reset();
+
+    if (holds)
+    {
+        // the written value outlives the request, so it gets a buffer of its
+        // own; table and key stay with the request's
+        e::compat::shared_ptr<e::buffer> written(e::buffer::create(result.size()));
+        memmove(written->data(), result.data(), result.size());
+        written->resize(result.size());
+        const e::slice value(written->data(), written->size());
+        internal_write("conditional", seqno + 1, table, key, value, backing, d);
+
+        if (seqno + 1 < m_ops.size())
+        {
+            m_ops[seqno + 1].cond_written = written;
+        }
+    }
+    else
+    {
+        internal_read("conditional", seqno + 1, table, key, backing, d);
+    }
+
+    if (seqno + 1 >= m_ops.size())
+    {
+        return;
+    }
+
+    operation& next(m_ops[seqno + 1]);
+    next.require_lock = true;
+
+    if (next.type == LOG_ENTRY_TX_WRITE)
+    {
+        next.require_write = true;
+    }
+    else
+    {
+        next.require_read = true;
+    }
+
+    next.conditional = true;
+    next.cond_rc = rc;
+    next.set_client(client, nonce);
 }
 
 void
 transaction :: internal_read(const char* source, uint64_t seqno,
                              const e::slice& table,
                              const e::slice& key,
-                             e::compat::shared_ptr<e::buffer> backing,
+                             e::compat::shared_ptr<e::buffer>,
                              daemon* d)
 {
     ensure_initialized();
@@ -487,15 +1013,16 @@ transaction :: internal_read(const char* source, uint64_t seqno,
     cmp.table = true;
     op.key = key;
     cmp.key = true;
-    op.backing = backing;
 
     if (!resize_to_hold(seqno) ||
-        !m_ops[seqno].merge(op, cmp))
+        !m_ops[seqno].merge(op, cmp, &m_arena))
     {
         LOG_IF(INFO, s_debug_mode) << logid() << " read failed; invariants violated";
         avoid_commit_if_possible(d);
         return;
     }
+
+    mark_dirty(seqno);
 }
 
 void
@@ -508,11 +1035,7 @@ transaction :: write(comm_id id, uint64_t nonce, uint64_t seqno,
 {
     e::compat::shared_ptr<e::buffer> backing(_backing.release());
     po6::threads::mutex::hold hold(&m_mtx);
-    CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "write");
-    internal_write("client", seqno, table, key, value, backing, d);
-    m_ops[seqno].require_lock = true;
-    m_ops[seqno].require_write = true;
-    m_ops[seqno].set_client(id, nonce);
+    client_write(id, nonce, seqno, table, key, value, backing, d);
     work_state_machine(d);
 }
 
@@ -525,8 +1048,14 @@ transaction :: paxos_2a_write(uint64_t seqno,
     e::slice table;
     e::slice key;
     e::slice value;
+    uint8_t flags = 0;
     up = up >> table >> key >> value;
 
+    if (!up.error() && up.remain())
+    {
+        up = up >> flags;
+    }
+
     if (up.error() || up.remain())
     {
         UNPACK_ERROR("paxos 2a::write");
@@ -538,8 +1067,41 @@ transaction :: paxos_2a_write(uint64_t seqno,
     e::compat::shared_ptr<e::buffer> backing(_backing.release());
     po6::threads::mutex::hold hold(&m_mtx);
     internal_write("paxos 2a", seqno, table, key, value, backing, d);
-    m_ops[seqno].require_lock = true;
-    m_ops[seqno].lock_acquired = true;
+    replicate_locking("paxos 2a", seqno, flags);
+    m_ops[seqno].require_write = true;
+    work_state_machine(d);
+}
+
+void
+transaction :: paxos_2a_write_digest(uint64_t seqno,
+                                     e::unpacker up,
+                                     std::auto_ptr<e::buffer> _backing,
+                                     daemon* d)
+{
+    e::slice table;
+    e::slice key;
+    uint64_t value_size;
+    uint64_t value_hash;
+    uint8_t flags = 0;
+    up = up >> table >> key >> value_size >> value_hash;
+
+    if (!up.error() && up.remain())
+    {
+        up = up >> flags;
+    }
+
+    if (up.error() || up.remain())
+    {
+        UNPACK_ERROR("paxos 2a::write digest");
+        po6::threads::mutex::hold hold(&m_mtx);
+        avoid_commit_if_possible(d);
+        return;
+    }
+
+    e::compat::shared_ptr<e::buffer> backing(_backing.release());
+    po6::threads::mutex::hold hold(&m_mtx);
+    internal_write_digest("paxos 2a", seqno, table, key, value_size, value_hash, backing, d);
+    replicate_locking("paxos 2a", seqno, flags);
     m_ops[seqno].require_write = true;
     work_state_machine(d);
 }
@@ -553,8 +1115,15 @@ transaction :: commit_record_write(uint64_t seqno,
     e::slice table;
     e::slice key;
     e::slice value;
+    uint8_t flags = 0;
     up = up >> table >> key >> value;
 
+    if (!up.error() && up.remain())
+    {
+        // every write is verified at home, so the flags do not matter here
+        up = up >> flags;
+    }
+
     if (up.error() || up.remain())
     {
         UNPACK_ERROR("commit record::write");
@@ -567,18 +1136,52 @@ transaction :: commit_record_write(uint64_t seqno,
     m_ops[seqno].require_lock = true;
     m_ops[seqno].require_verify_write = true;
     m_ops[seqno].require_write = true;
+    defer_to_home(seqno, d);
 }
 
 void
-transaction :: internal_write(const char* source, uint64_t seqno,
-                              const e::slice& table,
-                              const e::slice& key,
-                              const e::slice& value,
-                              e::compat::shared_ptr<e::buffer> backing,
-                              daemon* d)
+transaction :: commit_record_write_digest(uint64_t seqno,
+                                          e::unpacker up,
+                                          e::compat::shared_ptr<e::buffer> backing,
+                                          daemon* d)
 {
-    ensure_initialized();
-    INTERNAL_RETURN_IF_EXECUTED(seqno, source, "write");
+    e::slice table;
+    e::slice key;
+    uint64_t value_size;
+    uint64_t value_hash;
+    uint8_t flags = 0;
+    up = up >> table >> key >> value_size >> value_hash;
+
+    if (!up.error() && up.remain())
+    {
+        // every write is verified at home, so the flags do not matter here
+        up = up >> flags;
+    }
+
+    if (up.error() || up.remain())
+    {
+        UNPACK_ERROR("commit record::write digest");
+        avoid_commit_if_possible(d);
+        return;
+    }
+
+    internal_write_digest("commit record", seqno, table, key, value_size, value_hash, backing, d);
+    m_ops[seqno].require_lock = true;
+    m_ops[seqno].require_verify_write = true;
+    m_ops[seqno].require_write = true;
+    defer_to_home(seqno, d);
+}
+
+void
+transaction :: internal_write(const char* source, uint64_t seqno,
+                              const e::slice& table,
+                              const e::slice& key,
+                              const e::slice& value,
+                              e::compat::shared_ptr<e::buffer>,
+                              daemon* d)
+{
+    ensure_initialized();
+    INTERNAL_RETURN_IF_EXECUTED(seqno, source, "write");
 
     if (s_debug_mode)
     {
@@ -598,15 +1201,111 @@ transaction :: internal_write(const char* source, uint64_t seqno,
     cmp.key = true;
     op.value = value;
     cmp.value = true;
-    op.backing = backing;
 
     if (!resize_to_hold(seqno) ||
-        !m_ops[seqno].merge(op, cmp))
+        !m_ops[seqno].merge(op, cmp, &m_arena))
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " write failed; invariants violated";
+        avoid_commit_if_possible(d);
+        return;
+    }
+
+    mark_dirty(seqno);
+}
+
+void
+transaction :: internal_write_digest(const char* source, uint64_t seqno,
+                                     const e::slice& table,
+                                     const e::slice& key,
+                                     uint64_t value_size,
+                                     uint64_t value_hash,
+                                     e::compat::shared_ptr<e::buffer>,
+                                     daemon* d)
+{
+    ensure_initialized();
+    INTERNAL_RETURN_IF_EXECUTED(seqno, source, "write");
+
+    if (s_debug_mode)
+    {
+        LOG(INFO) << logid() << "[" << seqno << "] = " << source << " initiated write(\""
+                  << e::strescape(table.str()) << "\", \""
+                  << e::strescape(key.str()) << "\", <"
+                  << value_size << " bytes>)";
+    }
+
+    operation op;
+    comparison cmp;
+    op.type = LOG_ENTRY_TX_WRITE;
+    cmp.type = true;
+    op.table = table;
+    cmp.table = true;
+    op.key = key;
+    cmp.key = true;
+
+    if (!resize_to_hold(seqno))
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " write failed; invariants violated";
+        avoid_commit_if_possible(d);
+        return;
+    }
+
+    const bool fresh = m_ops[seqno].type == LOG_ENTRY_NOP;
+
+    if (!m_ops[seqno].merge(op, cmp, &m_arena) ||
+        (!fresh && (!m_ops[seqno].value_pending ||
+                    m_ops[seqno].value_size != value_size ||
+                    m_ops[seqno].value_hash != value_hash)))
     {
         LOG_IF(INFO, s_debug_mode) << logid() << " write failed; invariants violated";
         avoid_commit_if_possible(d);
         return;
     }
+
+    if (fresh)
+    {
+        m_ops[seqno].value_pending = true;
+        m_ops[seqno].value_size = value_size;
+        m_ops[seqno].value_hash = value_hash;
+        m_values_fetched = true;
+    }
+
+    mark_dirty(seqno);
+}
+
+void
+transaction :: scan(comm_id id, uint64_t nonce,
+                    const e::slice& table,
+                    const e::slice& key,
+                    uint64_t limit,
+                    daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_state == ABORTED || m_decision == ABORTED)
+    {
+        send_aborted_response(id, nonce, d);
+        return;
+    }
+    else if (m_state == COMMITTED || m_decision == COMMITTED)
+    {
+        send_committed_response(id, nonce, d);
+        return;
+    }
+
+    // Scans read the latest values like start_read, but they are neither
+    // logged nor locked; the key-value store only locks individual keys.
+    // Instead, start_validation has each chunk read again before prepare.
+    const uint64_t index = m_scans.size();
+    m_scans.push_back(scanned());
+    m_scans.back().table.assign(table.cdata(), table.size());
+    m_scans.back().key.assign(key.cdata(), key.size());
+    m_scans.back().limit = limit;
+    daemon::scan_map_t::state_reference sr;
+    kvs_scan* kv = d->create_scan(&sr);
+    kv->callback_client(id, nonce);
+    kv->callback_transaction(m_tg, index, &transaction::callback_scanned);
+    kv->scan(table, key, UINT64_MAX, limit, d);
+    LOG_IF(INFO, s_debug_mode) << logid() << " scan nonce=" << nonce << " limit=" << limit;
 }
 
 void
@@ -614,8 +1313,68 @@ transaction :: prepare(comm_id id, uint64_t nonce, uint64_t seqno, daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "prepare");
-    internal_end_of_transaction("client", "prepare", LOG_ENTRY_TX_PREPARE, seqno, d);
-    m_ops[seqno].set_client(id, nonce);
+    CLIENT_RETURN_IF_OUTSIDE_WINDOW(seqno, "prepare");
+
+    if (!start_validation(id, nonce, seqno))
+    {
+        internal_end_of_transaction("client", "prepare", LOG_ENTRY_TX_PREPARE, seqno, d);
+        m_ops[seqno].set_client(id, nonce);
+    }
+
+    work_state_machine(d);
+}
+
+void
+transaction :: prepare(comm_id id, uint64_t nonce, uint64_t seqno,
+                       uint64_t writes_sz, e::unpacker up,
+                       std::auto_ptr<e::buffer> _backing,
+                       daemon* d)
+{
+    std::vector<multi_op> writes;
+
+    for (uint64_t i = 0; i < writes_sz && !up.error(); ++i)
+    {
+        multi_op op;
+        op.write = 1;
+        up = up >> e::unpack_varint(op.seqno)
+                >> op.table >> op.key >> op.value;
+        writes.push_back(op);
+    }
+
+    if (up.error() || up.remain())
+    {
+        UNPACK_ERROR("prepare");
+        return;
+    }
+
+    e::compat::shared_ptr<e::buffer> backing(_backing.release());
+    po6::threads::mutex::hold hold(&m_mtx);
+    CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "prepare");
+
+    // the writes answer to no client; the outcome of the prepare covers them
+    for (size_t i = 0; i < writes.size(); ++i)
+    {
+        const multi_op& op(writes[i]);
+        CLIENT_RETURN_IF_OUTSIDE_WINDOW(op.seqno, "prepare");
+        internal_write("client", op.seqno, op.table, op.key, op.value, backing, d);
+
+        if (op.seqno >= m_ops.size())
+        {
+            return;
+        }
+
+        set_locking(op.seqno, d);
+        m_ops[op.seqno].require_write = true;
+    }
+
+    CLIENT_RETURN_IF_OUTSIDE_WINDOW(seqno, "prepare");
+
+    if (!start_validation(id, nonce, seqno))
+    {
+        internal_end_of_transaction("client", "prepare", LOG_ENTRY_TX_PREPARE, seqno, d);
+        m_ops[seqno].set_client(id, nonce);
+    }
+
     work_state_machine(d);
 }
 
@@ -635,6 +1394,7 @@ transaction :: paxos_2a_prepare(uint64_t seqno,
 
     po6::threads::mutex::hold hold(&m_mtx);
     internal_end_of_transaction("paxos 2a", "prepare", LOG_ENTRY_TX_PREPARE, seqno, d);
+    adopt_validation_locks(seqno);
     work_state_machine(d);
 }
 
@@ -660,11 +1420,63 @@ transaction :: abort(comm_id id, uint64_t nonce, uint64_t seqno, daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     CLIENT_RETURN_IF_EXECUTED(seqno, id, nonce, "abort");
+    CLIENT_RETURN_IF_OUTSIDE_WINDOW(seqno, "abort");
     internal_end_of_transaction("client", "abort", LOG_ENTRY_TX_ABORT, seqno, d);
     m_ops[seqno].set_client(id, nonce);
     work_state_machine(d);
 }
 
+void
+transaction :: single(comm_id id, uint64_t nonce, single_t kind,
+                      const e::slice& table,
+                      const e::slice& key,
+                      update_t update,
+                      const e::slice& expected,
+                      const e::slice& value,
+                      std::auto_ptr<e::buffer> _backing,
+                      daemon* d)
+{
+    e::compat::shared_ptr<e::buffer> backing(_backing.release());
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_state != INITIALIZED)
+    {
+        return;
+    }
+
+    ensure_initialized();
+    operation op;
+    comparison cmp;
+    op.type = kind == SINGLE_GET ? LOG_ENTRY_TX_READ : LOG_ENTRY_TX_WRITE;
+    op.table = table;
+    op.key = key;
+
+    if (!resize_to_hold(0) || !m_ops[0].merge(op, cmp, &m_arena))
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " single failed; invariants violated";
+        set_state(GARBAGE_COLLECT);
+        return;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << " single(\"" << e::strescape(table.str())
+                               << "\", \"" << e::strescape(key.str()) << "\") kind="
+                               << unsigned(kind);
+    m_single = true;
+    m_single_kind = kind;
+    m_init_timestamp = m_timestamp = d->m_clock.now();
+    operation& o(m_ops[0]);
+    o.require_lock = true;
+    o.lock_exclusive = kind != SINGLE_GET;
+    // a put overwrites whatever is there, so it need not look
+    o.require_read = kind != SINGLE_PUT;
+    o.cond_update = update;
+    o.cond_expected = expected;
+    o.cond_value = value;
+    o.cond_backing = backing;
+    o.set_client(id, nonce);
+    work_state_machine(d);
+}
+
 void
 transaction :: paxos_2a_abort(uint64_t seqno,
                               e::unpacker up,
@@ -681,6 +1493,7 @@ transaction :: paxos_2a_abort(uint64_t seqno,
 
     po6::threads::mutex::hold hold(&m_mtx);
     internal_end_of_transaction("paxos 2a", "abort", LOG_ENTRY_TX_ABORT, seqno, d);
+    adopt_validation_locks(seqno);
     work_state_machine(d);
 }
 
@@ -701,12 +1514,15 @@ transaction :: internal_end_of_transaction(const char* source, const char* func,
     cmp.type = true;
 
     if (!resize_to_hold(seqno) ||
-        !m_ops[seqno].merge(op, cmp))
+        !m_ops[seqno].merge(op, cmp, &m_arena))
     {
         INVARIANT_VIOLATION(func);
         avoid_commit_if_possible(d);
         return;
     }
+
+    m_ops_end = std::min(m_ops_end, seqno);
+    mark_dirty(seqno);
 }
 
 void
@@ -727,6 +1543,8 @@ transaction :: paxos_2a(uint64_t seqno,
             return paxos_2a_read(seqno, up, backing, d);
         case LOG_ENTRY_TX_WRITE:
             return paxos_2a_write(seqno, up, backing, d);
+        case LOG_ENTRY_TX_WRITE_DIGEST:
+            return paxos_2a_write_digest(seqno, up, backing, d);
         case LOG_ENTRY_TX_PREPARE:
             return paxos_2a_prepare(seqno, up, backing, d);
         case LOG_ENTRY_TX_ABORT:
@@ -760,6 +1578,12 @@ transaction :: internal_paxos_2b(comm_id id, uint64_t seqno, daemon* d)
 
     if (m_init_timestamp == 0)
     {
+        if (m_deferred_2b.size() >= DEFERRED_2B_MAX)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: durable notification dropped; " << m_deferred_2b.size() << " already deferred";
+            return;
+        }
+
         m_deferred_2b.push_back(std::make_pair(id, seqno));
         LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: durable notification deferred until begin() action received";
         return;
@@ -780,8 +1604,16 @@ transaction :: internal_paxos_2b(comm_id id, uint64_t seqno, daemon* d)
         return;
     }
 
-    bool already_durable = m_ops[seqno].durable[idx];
-    m_ops[seqno].durable[idx] = true;
+    const size_t slot = replica_slot(seqno, idx);
+    bool already_durable = m_durable[slot];
+    m_durable[slot] = true;
+
+    // the 2B answers the only 2A we sent this member
+    if (!already_durable && d->m_us.id != id &&
+        m_paxos_timestamps[slot] > 0 && !m_paxos_resent[slot])
+    {
+        d->observe_rtt(id, po6::monotonic_time() - m_paxos_timestamps[slot]);
+    }
 
     if (!already_durable && s_debug_mode)
     {
@@ -798,7 +1630,7 @@ transaction :: internal_paxos_2b(comm_id id, uint64_t seqno, daemon* d)
 
         for (size_t i = 0; i < m_group.members_sz; ++i)
         {
-            ostr << (m_ops[seqno].durable[i] ? "1" : "0");
+            ostr << (m_durable[replica_slot(seqno, i)] ? "1" : "0");
         }
 
         LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: durability across group: " << ostr.str();
@@ -816,9 +1648,80 @@ transaction :: commit_record(e::slice commit_record, std::auto_ptr<e::buffer> _b
         return;
     }
 
-    e::unpacker up(commit_record);
     e::compat::shared_ptr<e::buffer> backing(_backing.release());
 
+    if (!replay_commit_record(commit_record, backing, d))
+    {
+        ::abort(); // XXX
+    }
+
+    commit_record_replayed(d);
+}
+
+void
+transaction :: commit_record_chunk(uint64_t ops, uint64_t index, uint64_t count,
+                                   e::slice chunk,
+                                   std::auto_ptr<e::buffer> _backing,
+                                   daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_ops.empty())
+    {
+        work_state_machine(d);
+        return;
+    }
+
+    if (count == 0 || index >= count || count > COMMIT_RECORD_MAX_CHUNKS)
+    {
+        LOG(ERROR) << logid() << " dropping commit record chunk " << index << "/" << count;
+        return;
+    }
+
+    // a rebuilt record splits differently, so start over on its pieces
+    if (m_commit_chunks_ops != ops || m_commit_chunks.size() != count)
+    {
+        m_commit_chunks.clear();
+        m_commit_chunks.resize(count);
+        m_commit_chunks_ops = ops;
+        m_commit_chunks_received = 0;
+    }
+
+    if (m_commit_chunks[index].second)
+    {
+        return;
+    }
+
+    m_commit_chunks[index].first = chunk;
+    m_commit_chunks[index].second.reset(_backing.release());
+    ++m_commit_chunks_received;
+    LOG_IF(INFO, s_debug_mode) << logid() << " received commit record chunk " << index << "/" << count;
+
+    if (m_commit_chunks_received < count)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_commit_chunks.size(); ++i)
+    {
+        if (!replay_commit_record(m_commit_chunks[i].first, m_commit_chunks[i].second, d))
+        {
+            ::abort(); // XXX
+        }
+    }
+
+    // the ops hold on to the backings they need
+    std::vector<std::pair<e::slice, e::compat::shared_ptr<e::buffer> > >().swap(m_commit_chunks);
+    commit_record_replayed(d);
+}
+
+bool
+transaction :: replay_commit_record(e::slice commit_record,
+                                    e::compat::shared_ptr<e::buffer> backing,
+                                    daemon* d)
+{
+    e::unpacker up(commit_record);
+
     while (!up.error() && up.remain())
     {
         e::slice entry;
@@ -852,6 +1755,9 @@ transaction :: commit_record(e::slice commit_record, std::auto_ptr<e::buffer> _b
             case LOG_ENTRY_TX_WRITE:
                 commit_record_write(seqno, eup, backing, d);
                 break;
+            case LOG_ENTRY_TX_WRITE_DIGEST:
+                commit_record_write_digest(seqno, eup, backing, d);
+                break;
             case LOG_ENTRY_TX_PREPARE:
                 commit_record_prepare(seqno, eup, backing, d);
                 break;
@@ -872,6 +1778,12 @@ transaction :: commit_record(e::slice commit_record, std::auto_ptr<e::buffer> _b
         }
     }
 
+    return !up.error();
+}
+
+void
+transaction :: commit_record_replayed(daemon* d)
+{
     const uint64_t now = po6::monotonic_time();
 
     for (size_t i = 0; i < m_dcs_sz; ++i)
@@ -879,14 +1791,56 @@ transaction :: commit_record(e::slice commit_record, std::auto_ptr<e::buffer> _b
         m_dcs_timestamps[i] = now;
     }
 
-    if (up.error())
+    if (m_ops.empty() || m_ops.back().type != LOG_ENTRY_TX_PREPARE)
     {
         ::abort(); // XXX
     }
 
-    if (m_ops.empty() || m_ops.back().type != LOG_ENTRY_TX_PREPARE)
+    work_state_machine(d);
+}
+
+void
+transaction :: commit_values(const std::vector<uint64_t>& seqnos,
+                             const std::vector<e::slice>& values,
+                             std::auto_ptr<e::buffer>,
+                             daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < seqnos.size() && i < values.size(); ++i)
     {
-        ::abort(); // XXX
+        const uint64_t seqno = seqnos[i];
+
+        if (seqno >= m_ops.size() || !m_ops[seqno].value_pending)
+        {
+            continue;
+        }
+
+        operation& op(m_ops[seqno]);
+
+        if (values[i].size() != op.value_size ||
+            hash64(0, values[i].data(), values[i].size()) != op.value_hash)
+        {
+            LOG(ERROR) << logid() << ".ops[" << seqno << "]: shipped value does not match its digest";
+            continue;
+        }
+
+        LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: received digested value";
+        op.value = m_arena.copy(values[i]);
+        op.value_pending = false;
+    }
+
+    work_state_machine(d);
+}
+
+void
+transaction :: commit_values_ack(comm_id id, daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (std::find(m_values_acked.begin(), m_values_acked.end(), id) == m_values_acked.end())
+    {
+        m_values_acked.push_back(id);
     }
 
     work_state_machine(d);
@@ -905,6 +1859,7 @@ transaction :: callback_durable(uint64_t seqno, daemon* d)
         }
 
         m_ops[seqno].log_write_durable = true;
+        time_step("durable", seqno, d);
     }
 
     paxos_2b(d->m_us.id, seqno, d);
@@ -928,6 +1883,7 @@ transaction :: callback_locked(consus_returncode rc, uint64_t seqno, daemon* d)
     {
         m_ops[seqno].lock_nonce = 0;
         m_ops[seqno].lock_acquired = true;
+        time_step("locked", seqno, d);
     }
 
     work_state_machine(d);
@@ -950,6 +1906,7 @@ transaction :: callback_unlocked(consus_returncode rc, uint64_t seqno, daemon* d
     if (m_ops[seqno].require_lock && !m_ops[seqno].lock_released)
     {
         m_ops[seqno].lock_nonce = 0;
+        m_ops[seqno].unlock_sent = 0;
         m_ops[seqno].lock_released = true;
     }
 
@@ -975,10 +1932,18 @@ transaction :: callback_read(consus_returncode rc, uint64_t timestamp, const e::
     {
         m_ops[seqno].read_nonce = 0;
         m_ops[seqno].read_done = true;
+        time_step("read", seqno, d);
         m_ops[seqno].read_backing.assign(value.cdata(), value.size());
         m_ops[seqno].timestamp = timestamp;
         m_ops[seqno].value = e::slice(m_ops[seqno].read_backing);
         m_ops[seqno].rc = rc;
+        m_ops[seqno].read_under_lock = m_ops[seqno].lock_acquired &&
+                                       !m_ops[seqno].lock_released;
+
+        if (m_ops[seqno].cond_pending)
+        {
+            decide_cond_write(seqno, d);
+        }
     }
 
     work_state_machine(d);
@@ -1002,6 +1967,7 @@ transaction :: callback_write(consus_returncode rc, uint64_t seqno, daemon* d)
     {
         m_ops[seqno].write_nonce = 0;
         m_ops[seqno].write_done = true;
+        time_step("written", seqno, d);
     }
 
     work_state_machine(d);
@@ -1064,20 +2030,145 @@ transaction :: callback_verify_write(consus_returncode rc, uint64_t timestamp, c
 }
 
 void
-transaction :: externally_work_state_machine(daemon* d)
+transaction :: callback_declared_locked(consus_returncode rc, uint64_t index, daemon* d)
 {
     po6::threads::mutex::hold hold(&m_mtx);
+
+    if (index >= m_declared.size())
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << ".declared[" << index << "]: lock callback dropped";
+        return;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << ".declared[" << index << "]: lock acquired";
+    assert(rc == CONSUS_SUCCESS || rc == CONSUS_LESS_DURABLE);// XXX unsafe
+    declared& dk(m_declared[index]);
+
+    if (!dk.lock_acquired && !dk.lock_released)
+    {
+        dk.lock_nonce = 0;
+        dk.lock_acquired = true;
+
+        for (size_t i = 0; i < m_ops.size(); ++i)
+        {
+            const operation& op(m_ops[i]);
+
+            if (op.type != LOG_ENTRY_NOP && op.require_lock &&
+                (op.lock_released || op.unlock_sent != 0) &&
+                op.table == e::slice(dk.table) && op.key == e::slice(dk.key))
+            {
+                dk.late = true;
+            }
+        }
+    }
+
     work_state_machine(d);
 }
 
-#define yn(x) "        " STR(x) " = " << (op.x ? "yes" : "no") << "\n"
-
-std::string
-transaction :: debug_dump()
+void
+transaction :: callback_declared_unlocked(consus_returncode rc, uint64_t index, daemon* d)
 {
-    std::ostringstream ostr;
     po6::threads::mutex::hold hold(&m_mtx);
-    ostr << m_state << "\n";
+
+    if (index >= m_declared.size())
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << ".declared[" << index << "]: lock callback dropped";
+        return;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << ".declared[" << index << "]: lock released";
+    assert(rc == CONSUS_SUCCESS || rc == CONSUS_LESS_DURABLE);// XXX unsafe
+    declared& dk(m_declared[index]);
+
+    if (!dk.lock_released)
+    {
+        dk.lock_nonce = 0;
+        dk.unlock_sent = 0;
+        dk.lock_released = true;
+    }
+
+    work_state_machine(d);
+}
+
+void
+transaction :: callback_prefetched(consus_returncode rc, uint64_t timestamp, const e::slice& value,
+                                   uint64_t index, daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (index >= m_declared.size())
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << ".declared[" << index << "]: read callback dropped";
+        return;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << logid() << ".declared[" << index << "]: prefetch completed";
+    assert(rc == CONSUS_SUCCESS || rc == CONSUS_NOT_FOUND);// XXX unsafe
+    declared& dk(m_declared[index]);
+
+    if (!dk.read_done)
+    {
+        dk.read_nonce = 0;
+        dk.read_done = true;
+        dk.read_backing.assign(value.cdata(), value.size());
+        dk.timestamp = timestamp;
+        dk.rc = rc;
+    }
+
+    work_state_machine(d);
+}
+
+void
+transaction :: callback_scanned(uint64_t index, uint64_t digest, daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (index >= m_scans.size() || m_scans[index].scan_done)
+    {
+        return;
+    }
+
+    m_scans[index].scan_done = true;
+    m_scans[index].digest = digest;
+    work_state_machine(d);
+}
+
+void
+transaction :: callback_verify_scan(uint64_t index, uint64_t digest, daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (index >= m_scans.size() || m_scans[index].verify_done)
+    {
+        return;
+    }
+
+    m_scans[index].verify_done = true;
+
+    if (digest != m_scans[index].digest)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " scan[" << index << "]: range changed since it was read";
+        avoid_commit_if_possible(d);
+    }
+
+    work_state_machine(d);
+}
+
+void
+transaction :: externally_work_state_machine(daemon* d)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    work_state_machine(d);
+}
+
+#define yn(x) "        " STR(x) " = " << (op.x ? "yes" : "no") << "\n"
+
+std::string
+transaction :: debug_dump()
+{
+    std::ostringstream ostr;
+    po6::threads::mutex::hold hold(&m_mtx);
+    ostr << m_state << "\n";
 
     for (size_t i = 0; i < m_ops.size(); ++i)
     {
@@ -1092,18 +2183,24 @@ transaction :: debug_dump()
              << yn(lock_acquired)
              << yn(lock_released)
              << "        lock_nonce = " << op.lock_nonce << "\n"
+             << "        unlock_sent = " << op.unlock_sent << "\n"
              << yn(require_read)
              << yn(read_done)
+             << yn(read_under_lock)
+             << yn(read_pinned)
              << "        read_nonce = " << op.read_nonce << "\n"
              << yn(require_write)
              << yn(write_done)
              << "        write_nonce = " << op.write_nonce << "\n"
+             << yn(value_pending)
              << yn(require_verify_read)
              << yn(verify_read_done)
              << "        verify_read_nonce = " << op.verify_read_nonce << "\n"
              << yn(require_verify_write)
              << yn(verify_write_done)
              << "        verify_write_nonce = " << op.verify_write_nonce << "\n"
+             << yn(cond_pending)
+             << yn(conditional)
              << yn(log_write_issued)
              << yn(log_write_durable)
              << "        client = " << op.client << "\n"
@@ -1124,18 +2221,37 @@ transaction :: ensure_initialized()
 {
     if (m_state == INITIALIZED)
     {
-        m_state = EXECUTING;
+        set_state(EXECUTING);
+        m_ops.reserve(TRANSACTION_OPS_RESERVE);
     }
 }
 
+void
+transaction :: set_state(state_t s)
+{
+    CONSUS_PROBE6(transaction_state, m_tg.txid.group.get(), m_tg.txid.start,
+                  m_tg.txid.number, m_tg.group.get(), uint64_t(m_state), uint64_t(s));
+    m_state = s;
+}
+
 void
 transaction :: work_state_machine(daemon* d)
 {
+    if (m_single)
+    {
+        return work_state_machine_single(d);
+    }
+
     if (m_init_timestamp == 0)
     {
         return;
     }
 
+    trace_state(d);
+    track_inflight(d);
+    track_costs(d);
+    time_state(d);
+
     switch (m_state)
     {
         case INITIALIZED:
@@ -1159,200 +2275,576 @@ transaction :: work_state_machine(daemon* d)
     }
 }
 
+// A single-key operation is one op that runs start to finish under its
+// key's lock.  Holding just the one lock, and never waiting on anything but
+// the key-value stores, it cannot be part of a deadlock, so a wound is left
+// for it to outlast rather than abort it.
 void
-transaction :: work_state_machine_executing(daemon* d)
+transaction :: work_state_machine_single(daemon* d)
 {
-    size_t done = 0;
-
-    for (size_t i = 0; i < m_ops.size(); ++i)
+    if (m_state == GARBAGE_COLLECT)
     {
-        if (m_ops[i].type == LOG_ENTRY_NOP)
-        {
-            continue;
-        }
-
-        if (m_ops[i].require_lock && !m_ops[i].lock_acquired)
-        {
-            acquire_lock(i, d);
-            continue;
-        }
+        return;
+    }
 
-        if (m_ops[i].require_read && !m_ops[i].read_done)
-        {
-            start_read(i, d);
-            continue;
-        }
+    assert(!m_ops.empty());
+    operation& op(m_ops[0]);
 
-        if (m_ops[i].require_verify_read && !m_ops[i].verify_read_done)
-        {
-            start_verify_read(i, d);
-            continue;
-        }
+    if (!op.lock_acquired)
+    {
+        return acquire_lock(0, NULL, d);
+    }
 
-        if (m_ops[i].require_verify_write && !m_ops[i].verify_write_done)
-        {
-            start_verify_write(i, d);
-            continue;
-        }
+    if (op.require_read && !op.read_done)
+    {
+        return start_read(0, d);
+    }
 
-        if (m_ops[i].log_write_durable)
+    if (m_single_kind == SINGLE_PUT && !op.require_write)
+    {
+        op.value = op.cond_value;
+        op.require_write = true;
+    }
+    else if (m_single_kind == SINGLE_UPDATE && !op.conditional)
+    {
+        std::string result;
+        const bool holds = update_apply(op.cond_update, op.rc == CONSUS_SUCCESS, op.value,
+                                        op.cond_expected, op.cond_value, &result, &op.cond_rc);
+        op.conditional = true;
+        LOG_IF(INFO, s_debug_mode) << logid() << " single update "
+                                   << (holds ? "writes" : "declines") << " (" << op.cond_rc << ")";
+
+        if (holds)
         {
-            send_paxos_2b(i, d);
+            op.cond_written.reset(e::buffer::create(result.size()));
+            memmove(op.cond_written->data(), result.data(), result.size());
+            op.cond_written->resize(result.size());
+            op.value = e::slice(op.cond_written->data(), op.cond_written->size());
+            // the lock keeps every other writer out, so one past what we read
+            // is enough to make this the newest version
+            m_timestamp = std::max(d->m_clock.now(), op.timestamp + 1);
+            op.require_write = true;
         }
+    }
 
-        if (!is_durable(i))
-        {
-            send_paxos_2a(i, d);
-
-            if (!m_ops[i].log_write_issued)
-            {
-                std::string le = generate_log_entry(i);
-                d->callback_when_durable(le, m_tg, i);
-                m_ops[i].log_write_issued = true;
-            }
-
-            continue;
-        }
+    if (op.require_write && !op.write_done)
+    {
+        return start_write(0, d);
+    }
 
-        if (m_ops[i].client != comm_id())
-        {
-            send_response(&m_ops[i], d);
-        }
+    if (op.client != comm_id())
+    {
+        send_single_response(&op, d);
+    }
 
-        ++done;
+    if (!op.lock_released)
+    {
+        return release_lock(0, NULL, d);
     }
 
-    if (done == m_ops.size() && !m_ops.empty() &&
-        (m_ops.back().type == LOG_ENTRY_TX_PREPARE ||
-         m_ops.back().type == LOG_ENTRY_TX_ABORT))
+    LOG_IF(INFO, s_debug_mode) << logid() << " single done";
+    set_state(GARBAGE_COLLECT);
+}
+
+// Every transition re-enters work_state_machine, so this sees each state
+// this transaction passes through and closes the span of the one it left.
+void
+transaction :: trace_state(daemon* d)
+{
+    if (m_state == m_traced_state || !d->m_tracer.sampled(m_tg))
     {
-        LOG_IF(INFO, s_debug_mode) << logid() << " finished execuing all operations; transitioning to DATA CENTER VOTE state";
-        m_state = LOCAL_COMMIT_VOTE;
-        return work_state_machine(d);
+        return;
     }
 
-    daemon::local_voter_map_t::state_reference lvsr;
-    local_voter* lv = d->m_local_voters.get_state(m_tg, &lvsr);
-    uint64_t outcome;
+    const uint64_t now = po6::wallclock_time();
 
-    if (lv && lv->outcome(&outcome))
+    if (m_traced_since != 0)
     {
-        LOG_IF(INFO, s_debug_mode) << logid() << " short-circuiting operations (possible deadlock prevention)";
-        m_state = LOCAL_COMMIT_VOTE;
-        return work_state_machine(d);
+        std::ostringstream name;
+        name << m_traced_state;
+        d->m_tracer.span(name.str().c_str(), m_tg, 0, m_traced_since, now);
     }
+
+    m_traced_state = m_state;
+    m_traced_since = now;
 }
 
 void
-transaction :: work_state_machine_local_commit_vote(daemon* d)
+transaction :: track_inflight(daemon* d)
 {
-    uint64_t outcome;
+    const bool live = m_state != INITIALIZED &&
+                      m_state != TERMINATED &&
+                      m_state != GARBAGE_COLLECT;
 
-    if (d->m_dispositions.get(m_tg, &outcome))
+    if (live && !m_inflight)
     {
-        // de-dupe this
+        m_inflight = &d->m_inflight;
+        m_inflight_since = po6::monotonic_time();
+        m_inflight->add(m_tg, m_inflight_since);
+    }
+    else if (!live && m_inflight)
+    {
+        m_inflight->remove(m_tg, m_inflight_since);
+        m_inflight = NULL;
+    }
+}
 
-        if (outcome == CONSUS_VOTE_COMMIT)
-        {
-            LOG_IF(INFO, s_debug_mode) << logid() << " local vote chose COMMIT; transitioning to COMMITTED state";
-            m_state = COMMITTED;
-        }
-        else if (outcome == CONSUS_VOTE_ABORT)
-        {
-            LOG_IF(INFO, s_debug_mode) << logid() << " local vote chose ABORT; transitioning to ABORTED state";
-            m_state = ABORTED;
-        }
-        else
-        {
-            LOG(ERROR) << logid() << " local commit failed; invariants violated";
-            return;
-        }
+void
+transaction :: track_costs(daemon* d)
+{
+    const bool live = m_state != INITIALIZED &&
+                      m_state != GARBAGE_COLLECT;
 
-        return work_state_machine(d);
+    if (live && !m_costs)
+    {
+        m_costs = &d->m_costs;
+        m_costs->begin(m_tg);
     }
-
-    for (size_t i = 0; i < m_ops.size(); ++i)
+    else if (!live && m_costs)
     {
-        if (m_ops[i].type == LOG_ENTRY_NOP)
-        {
-            continue;
-        }
-
-        send_paxos_2a(i, d);
-        send_paxos_2b(i, d);
+        m_costs->finish(m_tg);
+        m_costs = NULL;
     }
+}
 
-    daemon::local_voter_map_t::state_reference lvsr;
-    local_voter* lv = d->m_local_voters.get_or_create_state(m_tg, &lvsr);
-    assert(lv);
-    lv->set_preferred_vote(m_prefer_to_commit && m_ops.back().type == LOG_ENTRY_TX_PREPARE
-                           ? CONSUS_VOTE_COMMIT : CONSUS_VOTE_ABORT, d);
-
-    if (!lv->outcome(&outcome))
+void
+transaction :: time_state(daemon* d)
+{
+    if (m_state == m_timed_state)
     {
-        lv->externally_work_state_machine(d);
         return;
     }
 
-    lv = NULL;
-    lvsr.release();
-    assert(m_dcs_sz >= 1);
-    bool single_dc = m_dcs_sz == 1;
+    const uint64_t now = po6::monotonic_time();
+    phase_latency::phase p = phase_latency::NUM_PHASES;
 
-    if (outcome == CONSUS_VOTE_COMMIT)
+    switch (m_timed_state)
     {
-        if (single_dc)
-        {
-            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose COMMIT; transitioning to COMMITTED state";
-            m_state = COMMITTED;
-        }
-        else
-        {
-            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose COMMIT; transitioning to GLOBAL VOTE state";
-            m_state = GLOBAL_COMMIT_VOTE;
-        }
+        case EXECUTING:
+            p = phase_latency::EXECUTING;
+            break;
+        case LOCAL_COMMIT_VOTE:
+            p = phase_latency::LOCAL_VOTE;
+            break;
+        case GLOBAL_COMMIT_VOTE:
+            p = phase_latency::GLOBAL_VOTE;
+            break;
+        case COMMITTED:
+            p = phase_latency::COMMITTING;
+            break;
+        case ABORTED:
+            p = phase_latency::ABORTING;
+            break;
+        case INITIALIZED:
+        case TERMINATED:
+        case GARBAGE_COLLECT:
+        default:
+            break;
     }
-    else if (outcome == CONSUS_VOTE_ABORT)
+
+    if (p != phase_latency::NUM_PHASES)
     {
-        // if single dc or only aborting in originating data center
-        if (single_dc || m_tg.group == m_tg.txid.group)
-        {
-            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose ABORT; transitioning to ABORTED state";
-            m_state = ABORTED;
-        }
-        else
-        {
-            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose ABORT; transitioning to GLOBAL VOTE state";
-            m_state = GLOBAL_COMMIT_VOTE;
-        }
+        d->m_phases.record(m_group.id, m_dcs, m_dcs_sz, p, now - m_timed_since);
     }
-    else
+
+    m_timed_state = m_state;
+    m_timed_since = now;
+
+    if (d->slow_transaction_threshold() == 0)
     {
-        LOG(ERROR) << logid() << " data center commit failed; invariants violated";
         return;
     }
 
-    return work_state_machine(d);
+    m_timeline.mark(state_label(m_state), now);
+    const uint64_t elapsed = m_timeline.elapsed(now);
+
+    if (m_state == TERMINATED && elapsed >= d->slow_transaction_threshold())
+    {
+        std::ostringstream ostr;
+        m_timeline.write(ostr);
+        LOG(WARNING) << logid() << " slow transaction took "
+                     << elapsed / PO6_MILLIS << "ms: " << ostr.str();
+    }
 }
 
 void
-transaction :: work_state_machine_global_commit_vote(daemon* d)
+transaction :: time_step(const char* what, uint64_t seqno, daemon* d)
 {
-    uint64_t outcome;
+    if (d->slow_transaction_threshold() > 0)
+    {
+        m_timeline.mark(what, seqno, po6::monotonic_time());
+    }
+}
 
-    if (d->m_dispositions.get(m_tg, &outcome))
+const char*
+transaction :: state_label(state_t s)
+{
+    switch (s)
     {
-        // de-dupe this
+        case INITIALIZED:
+            return "initialized";
+        case EXECUTING:
+            return "executing";
+        case LOCAL_COMMIT_VOTE:
+            return "local_vote";
+        case GLOBAL_COMMIT_VOTE:
+            return "global_vote";
+        case COMMITTED:
+            return "committed";
+        case ABORTED:
+            return "aborted";
+        case TERMINATED:
+            return "terminated";
+        case GARBAGE_COLLECT:
+            return "garbage_collect";
+        default:
+            return "bad_state";
+    }
+}
 
-        if (outcome == CONSUS_VOTE_COMMIT)
+void
+transaction :: work_state_machine_executing(daemon* d)
+{
+    std::vector<uint64_t> send_2a;
+    std::vector<uint64_t> send_2b;
+    kvs_lock_batch locks;
+    std::vector<uint64_t> dirty;
+    dirty.swap(m_ops_dirty);
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    size_t regressed = m_ops_executed;
+    // ahead of the ops, so that they find the declared locks requested
+    acquire_declared(&locks, d);
+
+    for (size_t i = 0; i < dirty.size(); ++i)
+    {
+        if (dirty[i] < m_ops_executed &&
+            !work_op_executing(dirty[i], &locks, &send_2a, &send_2b, d))
         {
-            LOG_IF(INFO, s_debug_mode) << logid() << " global vote chose COMMIT; transitioning to COMMITTED state";
-            m_state = COMMITTED;
+            regressed = std::min(regressed, size_t(dirty[i]));
+        }
+    }
+
+    for (size_t i = m_ops_executed; i < m_ops.size(); ++i)
+    {
+        if (work_op_executing(i, &locks, &send_2a, &send_2b, d) &&
+            i == m_ops_executed)
+        {
+            ++m_ops_executed;
+        }
+    }
+
+    // an op that took on new work gets walked with the rest until it's done
+    m_ops_executed = std::min(m_ops_executed, regressed);
+    locks.flush(m_tg, d);
+    send_paxos_2a(send_2a, d);
+    send_paxos_2b(send_2b, d);
+    const bool done = m_ops_executed == m_ops.size();
+
+    // everything the client asked for is answered and it has not ended the
+    // transaction, so the next move is the client's
+    if (done && m_ops_end == UINT64_MAX)
+    {
+        abort_if_abandoned(d);
+    }
+
+    // every optimistic op now holds its lock and has been checked against the
+    // latest version; only now may the prepare be logged for the group to
+    // vote on, and if a check failed it is an abort instead
+    if (done && m_validating && validate_scans(d))
+    {
+        m_validating = false;
+        LOG_IF(INFO, s_debug_mode) << logid() << " optimistic operations validated " << (m_prefer_to_commit ? "successfully" : "unsuccessfully");
+        internal_end_of_transaction("client", "prepare",
+                                    m_prefer_to_commit ? LOG_ENTRY_TX_PREPARE : LOG_ENTRY_TX_ABORT,
+                                    m_validate_seqno, d);
+
+        if (m_validate_seqno < m_ops.size())
+        {
+            m_ops[m_validate_seqno].set_client(m_validate_client, m_validate_nonce);
+        }
+
+        return work_state_machine(d);
+    }
+
+    // a read-only transaction re-checks its reads before the group votes on
+    // it; the vote itself still runs so that a wound at any one member aborts
+    // it at every member
+    if (done && !m_ops.empty() &&
+        m_ops.back().type == LOG_ENTRY_TX_PREPARE &&
+        m_prefer_to_commit && is_read_only() &&
+        m_tg.group == m_tg.txid.group)
+    {
+        bool verified = true;
+
+        for (size_t i = 0; i < m_ops.size(); ++i)
+        {
+            if (m_ops[i].type == LOG_ENTRY_TX_READ &&
+                !m_ops[i].require_verify_read)
+            {
+                m_ops[i].require_verify_read = true;
+
+                // the lock has been held since the read, so reading
+                // again could only return the same version
+                if (m_ops[i].read_under_lock)
+                {
+                    m_ops[i].verify_read_done = true;
+                    continue;
+                }
+
+                mark_dirty(i);
+                verified = false;
+            }
+        }
+
+        if (!verified)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " read-only transaction; verifying reads before commit";
+            return work_state_machine(d);
+        }
+    }
+
+    if (done && !m_ops.empty() &&
+        (m_ops.back().type == LOG_ENTRY_TX_PREPARE ||
+         m_ops.back().type == LOG_ENTRY_TX_ABORT))
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " finished execuing all operations; transitioning to DATA CENTER VOTE state";
+        set_state(LOCAL_COMMIT_VOTE);
+        return work_state_machine(d);
+    }
+
+    daemon::local_voter_map_t::state_reference lvsr;
+    local_voter* lv = d->m_local_voters.get_state(m_tg, &lvsr);
+    uint64_t outcome;
+
+    if (lv && lv->outcome(&outcome))
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " short-circuiting operations (possible deadlock prevention)";
+        set_state(LOCAL_COMMIT_VOTE);
+        return work_state_machine(d);
+    }
+}
+
+bool
+transaction :: work_op_executing(uint64_t i,
+                                 kvs_lock_batch* locks,
+                                 std::vector<uint64_t>* send_2a,
+                                 std::vector<uint64_t>* send_2b,
+                                 daemon* d)
+{
+    if (m_ops[i].type == LOG_ENTRY_NOP)
+    {
+        return false;
+    }
+
+    // a declared key's lock, and its prefetched value, may already be here
+    if (m_ops[i].require_lock && !m_ops[i].lock_acquired)
+    {
+        acquire_lock(i, locks, d);
+
+        if (!m_ops[i].lock_acquired)
+        {
+            return false;
+        }
+    }
+
+    if (m_ops[i].require_read && !m_ops[i].read_done)
+    {
+        start_read(i, d);
+
+        if (!m_ops[i].read_done)
+        {
+            return false;
+        }
+    }
+
+    if (m_ops[i].require_verify_read && !m_ops[i].verify_read_done)
+    {
+        start_verify_read(i, d);
+        return false;
+    }
+
+    if (m_ops[i].require_verify_write && !m_ops[i].verify_write_done)
+    {
+        start_verify_write(i, d);
+        return false;
+    }
+
+    if (m_ops[i].log_write_durable)
+    {
+        send_2b->push_back(i);
+    }
+
+    if (!is_durable(i))
+    {
+        // under the group's read lease no other member can be answering for
+        // the group, so the leader need not wait for the log; the read is
+        // still logged, and prepare waits on it as before
+        if (m_ops[i].type == LOG_ENTRY_TX_READ &&
+            m_ops[i].client != comm_id() &&
+            !m_ops[i].conditional &&
+            !m_ops[i].cond_pending &&
+            d->m_leases.held(m_group.id, po6::monotonic_time()))
+        {
+            send_response(&m_ops[i], d);
+        }
+
+        send_2a->push_back(i);
+
+        if (!m_ops[i].log_write_issued)
+        {
+            std::string le = generate_log_entry(i);
+            d->callback_when_durable(le, m_tg, i);
+            m_ops[i].log_write_issued = true;
+            time_step("log", i, d);
+        }
+
+        return false;
+    }
+
+    if (m_ops[i].client != comm_id())
+    {
+        send_response(&m_ops[i], d);
+    }
+
+    return true;
+}
+
+void
+transaction :: work_state_machine_local_commit_vote(daemon* d)
+{
+    uint64_t outcome;
+
+    if (d->m_dispositions.get(m_tg, &outcome))
+    {
+        // de-dupe this
+
+        if (outcome == CONSUS_VOTE_COMMIT)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " local vote chose COMMIT; transitioning to COMMITTED state";
+            set_state(COMMITTED);
+        }
+        else if (outcome == CONSUS_VOTE_ABORT)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " local vote chose ABORT; transitioning to ABORTED state";
+            set_state(ABORTED);
+        }
+        else
+        {
+            LOG(ERROR) << logid() << " local commit failed; invariants violated";
+            return;
+        }
+
+        return work_state_machine(d);
+    }
+
+    // the ops are fixed once execution ends and each one resends on its own
+    // timer, so walk them only as often as any of them could come due
+    const uint64_t now = po6::monotonic_time();
+    uint64_t resend = d->resend_interval();
+
+    for (unsigned i = 0; i < m_group.members_sz; ++i)
+    {
+        resend = std::min(resend, d->resend_interval(m_group.members[i]));
+    }
+
+    if (m_vote_resent + resend <= now)
+    {
+        std::vector<uint64_t> seqnos;
+
+        for (size_t i = 0; i < m_ops.size(); ++i)
+        {
+            if (m_ops[i].type == LOG_ENTRY_NOP)
+            {
+                continue;
+            }
+
+            seqnos.push_back(i);
+        }
+
+        send_paxos_2a(seqnos, d);
+        send_paxos_2b(seqnos, d);
+        m_vote_resent = now;
+    }
+
+    daemon::local_voter_map_t::state_reference lvsr;
+    local_voter* lv = d->get_or_create_pumped(&d->m_local_voters, m_tg, &lvsr);
+    assert(lv);
+    lv->set_preferred_vote(m_prefer_to_commit && m_ops.back().type == LOG_ENTRY_TX_PREPARE
+                           ? CONSUS_VOTE_COMMIT : CONSUS_VOTE_ABORT, d);
+
+    if (!lv->outcome(&outcome))
+    {
+        lv->externally_work_state_machine(d);
+        return;
+    }
+
+    lv = NULL;
+    lvsr.release();
+    assert(m_dcs_sz >= 1);
+    // with one data center the local vote is final: no global voter, no
+    // commit record, and no waiting on other data centers; the same holds
+    // when no other data center holds anything this transaction touched, or
+    // when it wrote nothing and its reads were verified here
+    bool single_dc = m_dcs_sz == 1 || is_home_local(d) ||
+                     (is_read_only() && m_tg.group == m_tg.txid.group);
+
+    if (outcome == CONSUS_VOTE_COMMIT)
+    {
+        if (single_dc)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose COMMIT; transitioning to COMMITTED state";
+            set_state(COMMITTED);
+        }
+        else
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose COMMIT; transitioning to GLOBAL VOTE state";
+            release_read_locks(d);
+            set_state(GLOBAL_COMMIT_VOTE);
+        }
+    }
+    else if (outcome == CONSUS_VOTE_ABORT)
+    {
+        // if single dc or only aborting in originating data center
+        if (single_dc || m_tg.group == m_tg.txid.group)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose ABORT; transitioning to ABORTED state";
+            set_state(ABORTED);
+        }
+        else
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " data center vote chose ABORT; transitioning to GLOBAL VOTE state";
+            set_state(GLOBAL_COMMIT_VOTE);
+        }
+    }
+    else
+    {
+        LOG(ERROR) << logid() << " data center commit failed; invariants violated";
+        return;
+    }
+
+    return work_state_machine(d);
+}
+
+void
+transaction :: work_state_machine_global_commit_vote(daemon* d)
+{
+    assert(m_dcs_sz > 1);
+    uint64_t outcome;
+
+    if (d->m_dispositions.get(m_tg, &outcome))
+    {
+        // de-dupe this
+
+        if (outcome == CONSUS_VOTE_COMMIT)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << " global vote chose COMMIT; transitioning to COMMITTED state";
+            set_state(COMMITTED);
         }
         else if (outcome == CONSUS_VOTE_ABORT)
         {
             LOG_IF(INFO, s_debug_mode) << logid() << " global vote chose ABORT; transitioning to ABORTED state";
-            m_state = ABORTED;
+            set_state(ABORTED);
         }
         else
         {
@@ -1364,7 +2856,7 @@ transaction :: work_state_machine_global_commit_vote(daemon* d)
     }
 
     daemon::global_voter_map_t::state_reference gvsr;
-    global_voter* gv = d->m_global_voters.get_or_create_state(m_tg, &gvsr);
+    global_voter* gv = d->get_or_create_pumped(&d->m_global_voters, m_tg, &gvsr);
 
     if (!gv->initialized())
     {
@@ -1378,6 +2870,7 @@ transaction :: work_state_machine_global_commit_vote(daemon* d)
         }
 
         gv->init(v, m_dcs, m_dcs_sz, d);
+        time_step("global_propose", UINT64_MAX, d);
     }
 
     gv->externally_work_state_machine(d);
@@ -1387,18 +2880,9 @@ transaction :: work_state_machine_global_commit_vote(daemon* d)
 
     if (undecided_sz > 0)
     {
-        std::string commit_record;
-        e::packer pa(&commit_record);
-
-        for (size_t i = 0; i < m_ops.size(); ++i)
+        if (m_commit_record.empty() || m_commit_record_ops != m_ops.size())
         {
-            if (m_ops[i].type == LOG_ENTRY_NOP)
-            {
-                continue;
-            }
-
-            std::string log_entry = generate_log_entry(i);
-            pa = pa << e::slice(log_entry);
+            build_commit_record(d);
         }
 
         const configuration* c = d->get_config();
@@ -1420,24 +2904,10 @@ transaction :: work_state_machine_global_commit_vote(daemon* d)
                 ::abort();
             }
 
-            for (unsigned j = 0; j < g->members_sz; ++j)
+            if (m_dcs_timestamps[idx] + d->resend_interval() < now &&
+                send_commit_record(*g, m_dcs_timestamps[idx] == 0, d))
             {
-                // XXX coordinator failure sensitive
-                if (c->get_state(g->members[j]) == txman_state::ONLINE &&
-                    m_dcs_timestamps[idx] + d->resend_interval() < now)
-                {
-                    transaction_group tg(g->id, m_tg.txid);
-                    const size_t sz = BUSYBEE_HEADER_SIZE
-                                    + pack_size(COMMIT_RECORD)
-                                    + pack_size(tg)
-                                    + pack_size(e::slice(commit_record));
-                    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-                    msg->pack_at(BUSYBEE_HEADER_SIZE)
-                        << COMMIT_RECORD << tg << e::slice(commit_record);
-                    d->send(g->members[j], msg);
-                    m_dcs_timestamps[idx] = now;
-                    break;
-                }
+                m_dcs_timestamps[idx] = now;
             }
         }
     }
@@ -1450,12 +2920,12 @@ transaction :: work_state_machine_global_commit_vote(daemon* d)
     if (outcome == CONSUS_VOTE_COMMIT)
     {
         LOG_IF(INFO, s_debug_mode) << logid() << " global vote chose COMMIT; transitioning to COMMITTED state";
-        m_state = COMMITTED;
+        set_state(COMMITTED);
     }
     else if (outcome == CONSUS_VOTE_ABORT)
     {
         LOG_IF(INFO, s_debug_mode) << logid() << " global vote chose ABORT; transitioning to ABORTED state";
-        m_state = ABORTED;
+        set_state(ABORTED);
     }
     else
     {
@@ -1469,45 +2939,79 @@ transaction :: work_state_machine_global_commit_vote(daemon* d)
 void
 transaction :: work_state_machine_committed(daemon* d)
 {
-    size_t non_nop = 0;
-    size_t done = 0;
+    bool finished = true;
+    kvs_lock_batch locks;
     m_decision = COMMITTED;
 
-    for (size_t i = 0; i < m_ops.size(); ++i)
+    // the decision is durable in the group, and across data centers in the
+    // global vote, so the client need not wait on the key-value stores; each
+    // written key's lock is held until the write lands and serves as its
+    // intent: later transactions wait on it, and optimistic reads validate
+    // under it
+    // the loop below counts an operation when it answers it, so the prepare
+    // answered here is counted here
+    if (!m_ops.empty() && m_ops.back().type == LOG_ENTRY_TX_PREPARE &&
+        m_ops.back().client != comm_id())
+    {
+        record_table_stats(m_ops.back(), table_stats::COMMITS, d);
+        send_committed_response(&m_ops.back(), d);
+    }
+
+    for (size_t i = m_ops_finished; i < m_ops.size(); ++i)
     {
         if (m_ops[i].type == LOG_ENTRY_NOP)
         {
+            m_ops_finished += finished ? 1 : 0;
             continue;
         }
 
-        ++non_nop;
-
         if (m_ops[i].require_write && !m_ops[i].write_done)
         {
-            start_write(i, d);
+            // a digested write waits here for the origin to ship its value
+            if (!m_ops[i].value_pending)
+            {
+                start_write(i, d);
+            }
+
+            finished = false;
             continue;
         }
 
         if (m_ops[i].require_lock && !m_ops[i].lock_released)
         {
-            release_lock(i, d);
+            release_lock(i, &locks, d);
+            finished = false;
             continue;
         }
 
         if (m_ops[i].client != comm_id())
         {
+            record_table_stats(m_ops[i], table_stats::COMMITS, d);
             send_committed_response(&m_ops[i], d);
         }
 
-        ++done;
+        m_ops_finished += finished ? 1 : 0;
     }
 
-    if (done == non_nop)
+    const bool released = release_declared(&locks, d);
+    locks.flush(m_tg, d);
+
+    if (m_ops_finished == m_ops.size() && released)
     {
+        if (!ship_commit_values(d))
+        {
+            return;
+        }
+
+        if (m_values_fetched)
+        {
+            send_commit_values_ack(comm_id(), d);
+        }
+
         send_tx_commit(d);
         record_disposition_commit(d);
         LOG_IF(INFO, s_debug_mode) << logid() << " transitioning to TERMINATED state";
-        m_state = TERMINATED;
+        set_state(TERMINATED);
         return work_state_machine(d);
     }
 }
@@ -1515,39 +3019,45 @@ transaction :: work_state_machine_committed(daemon* d)
 void
 transaction :: work_state_machine_aborted(daemon* d)
 {
-    size_t non_nop = 0;
-    size_t done = 0;
+    bool finished = true;
+    kvs_lock_batch locks;
     m_decision = ABORTED;
 
-    for (size_t i = 0; i < m_ops.size(); ++i)
+    for (size_t i = m_ops_finished; i < m_ops.size(); ++i)
     {
         if (m_ops[i].type == LOG_ENTRY_NOP)
         {
+            m_ops_finished += finished ? 1 : 0;
             continue;
         }
 
-        ++non_nop;
-
-        if (m_ops[i].require_lock && !m_ops[i].lock_released)
+        // the abort is decided and the unlocks are safe to retry, so the
+        // client hears of it now instead of after the last unlock returns
+        if (m_ops[i].client != comm_id())
         {
-            release_lock(i, d);
-            continue;
+            record_table_stats(m_ops[i], table_stats::ABORTS, d);
+            send_aborted_response(&m_ops[i], d);
         }
 
-        if (m_ops[i].client != comm_id())
+        if (m_ops[i].require_lock && !m_ops[i].lock_released)
         {
-            send_aborted_response(&m_ops[i], d);
+            release_lock(i, &locks, d);
+            finished = false;
+            continue;
         }
 
-        ++done;
+        m_ops_finished += finished ? 1 : 0;
     }
 
-    if (done == non_nop)
+    const bool released = release_declared(&locks, d);
+    locks.flush(m_tg, d);
+
+    if (m_ops_finished == m_ops.size() && released)
     {
         send_tx_abort(d);
         record_disposition_abort(d);
         LOG_IF(INFO, s_debug_mode) << logid() << " transitioning to TERMINATED state";
-        m_state = TERMINATED;
+        set_state(TERMINATED);
         return work_state_machine(d);
     }
 }
@@ -1557,7 +3067,7 @@ transaction :: work_state_machine_terminated(daemon* d)
 {
     if (d->m_dispositions.has(m_tg))
     {
-        m_state = GARBAGE_COLLECT;
+        set_state(GARBAGE_COLLECT);
     }
 }
 
@@ -1566,47 +3076,114 @@ transaction :: avoid_commit_if_possible(daemon* d)
 {
     m_prefer_to_commit = false;
     daemon::local_voter_map_t::state_reference lvsr;
-    local_voter* lv = d->m_local_voters.get_or_create_state(m_tg, &lvsr);
+    local_voter* lv = d->get_or_create_pumped(&d->m_local_voters, m_tg, &lvsr);
     assert(lv);
     lv->set_preferred_vote(CONSUS_VOTE_ABORT, d);
 }
 
-bool
-transaction :: is_durable(uint64_t seqno)
+void
+transaction :: abort_if_abandoned(daemon* d)
 {
-    if (seqno >= m_ops.size())
+    const uint64_t timeout = d->transaction_timeout();
+
+    if (timeout == 0 || m_client_active == 0 || m_abandoned ||
+        m_client_active + timeout > po6::monotonic_time())
     {
-        return false;
+        return;
     }
 
-    unsigned c = 0;
+    // the wound aborts us through the group's vote, which releases our
+    // locks, just as a wound from a key-value store would
+    m_abandoned = true;
+    m_prefer_to_commit = false;
+    LOG(INFO) << logid() << " aborting because its client has been silent for "
+              << timeout / PO6_MILLIS << "ms";
+    daemon::local_voter_map_t::state_reference lvsr;
+    local_voter* lv = d->get_or_create_pumped(&d->m_local_voters, m_tg, &lvsr);
+    assert(lv);
+    lv->wound(d);
+}
 
-    for (unsigned i = 0; i < m_group.members_sz; ++i)
+bool
+transaction :: is_read_only()
+{
+    for (size_t i = 0; i < m_ops.size(); ++i)
     {
-        if (m_ops[seqno].durable[i])
+        if (m_ops[i].type != LOG_ENTRY_NOP &&
+            m_ops[i].type != LOG_ENTRY_TX_BEGIN &&
+            m_ops[i].type != LOG_ENTRY_TX_READ &&
+            m_ops[i].type != LOG_ENTRY_TX_PREPARE)
         {
-            ++c;
+            return false;
         }
     }
 
-    return c >= m_group.quorum();
+    return true;
 }
 
 bool
-transaction :: resize_to_hold(uint64_t seqno)
+transaction :: is_home_local(daemon* d)
 {
+    if (m_tg.group != m_tg.txid.group)
+    {
+        return false;
+    }
+
+    const configuration* c = d->get_config();
+
     for (size_t i = 0; i < m_ops.size(); ++i)
     {
-        if (m_ops[i].type != LOG_ENTRY_NOP &&
-            m_ops[i].type >= LOG_ENTRY_TX_PREPARE &&
-            i < seqno)
+        if ((m_ops[i].type == LOG_ENTRY_TX_READ ||
+             m_ops[i].type == LOG_ENTRY_TX_WRITE) &&
+            c->home(m_ops[i].table) != m_group.dc)
         {
             return false;
         }
     }
 
+    return true;
+}
+
+bool
+transaction :: is_durable(uint64_t seqno)
+{
+    if (seqno >= m_ops.size())
+    {
+        return false;
+    }
+
+    unsigned c = 0;
+
+    for (unsigned i = 0; i < m_group.members_sz; ++i)
+    {
+        const size_t slot = seqno * m_group.members_sz + i;
+
+        if (slot < m_durable.size() && m_durable[slot])
+        {
+            ++c;
+        }
+    }
+
+    return c >= m_group.phase2_quorum();
+}
+
+bool
+transaction :: resize_to_hold(uint64_t seqno)
+{
+    if (m_ops_end < seqno)
+    {
+        return false;
+    }
+
     if (m_ops.size() <= seqno && m_state == EXECUTING)
     {
+        // every reallocation copies each operation's strings and buffer
+        // references, so grow geometrically rather than op by op
+        if (m_ops.capacity() <= seqno)
+        {
+            m_ops.reserve(std::max(m_ops.capacity() * 2, size_t(seqno + 1)));
+        }
+
         m_ops.resize(seqno + 1);
     }
     else if (m_ops.size() <= seqno && m_state > EXECUTING)
@@ -1617,178 +3194,1255 @@ transaction :: resize_to_hold(uint64_t seqno)
     return true;
 }
 
+size_t
+transaction :: replica_slot(uint64_t seqno, unsigned idx)
+{
+    assert(idx < m_group.members_sz);
+    const size_t slot = seqno * m_group.members_sz + idx;
+
+    if (slot >= m_durable.size())
+    {
+        const size_t sz = (seqno + 1) * m_group.members_sz;
+
+        if (m_durable.capacity() < sz)
+        {
+            const size_t cap = std::max(m_durable.capacity() * 2, sz);
+            m_durable.reserve(cap);
+            m_paxos_timestamps.reserve(cap);
+            m_paxos_2b_timestamps.reserve(cap);
+            m_paxos_resent.reserve(cap);
+        }
+
+        m_durable.resize(sz, 0);
+        m_paxos_timestamps.resize(sz, 0);
+        m_paxos_2b_timestamps.resize(sz, 0);
+        m_paxos_resent.resize(sz, 0);
+    }
+
+    return slot;
+}
+
+// The internal_* calls mark each op they touch, so an op under the watermark
+// that gains a client or new work gets another look.
+void
+transaction :: mark_dirty(uint64_t seqno)
+{
+    if (m_state == EXECUTING && seqno < m_ops_executed)
+    {
+        m_ops_dirty.push_back(seqno);
+    }
+}
+
+void
+transaction :: set_locking(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+
+    if (op.require_lock)
+    {
+        return;
+    }
+
+    if (d->optimistic(op.table))
+    {
+        op.optimistic = true;
+    }
+    else
+    {
+        op.require_lock = true;
+    }
+}
+
+void
+transaction :: replicate_locking(const char* source, uint64_t seqno, uint8_t flags)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+
+    // an optimistic op holds no lock until the transaction is validated; if
+    // this member takes over, start_validation must still check it
+    if (flags & OP_FLAG_OPTIMISTIC)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: " << source << " learned an optimistic op";
+        op.optimistic = true;
+        return;
+    }
+
+    op.require_lock = true;
+    op.lock_acquired = true;
+}
+
+void
+transaction :: adopt_validation_locks(uint64_t seqno)
+{
+    // the member that logged the prepare or abort had validated, and so
+    // locked, any optimistic op before it; whoever finishes the transaction
+    // must release those locks.  Unlocking is idempotent, so an abort logged
+    // before validation costs no more than a few spare unlocks.
+    for (size_t i = 0; i < m_ops.size() && i < seqno; ++i)
+    {
+        operation& op(m_ops[i]);
+
+        if (!op.optimistic || op.require_lock)
+        {
+            continue;
+        }
+
+        op.require_lock = true;
+        op.lock_acquired = true;
+        mark_dirty(i);
+    }
+}
+
+bool
+transaction :: start_validation(comm_id id, uint64_t nonce, uint64_t seqno)
+{
+    bool validate = m_validating;
+
+    for (size_t i = 0; i < m_ops.size() && i < seqno; ++i)
+    {
+        operation& op(m_ops[i]);
+
+        if (!op.optimistic || op.require_lock)
+        {
+            continue;
+        }
+
+        // a read must still be the latest version, and nothing may have
+        // been written at or after our timestamp where we write
+        op.require_lock = true;
+
+        if (op.type == LOG_ENTRY_TX_READ)
+        {
+            op.require_verify_read = true;
+        }
+        else
+        {
+            op.require_verify_write = true;
+        }
+
+        mark_dirty(i);
+        validate = true;
+    }
+
+    // scans are validated by reading them again; see validate_scans
+    for (size_t i = 0; i < m_scans.size(); ++i)
+    {
+        if (!m_scans[i].verify_done)
+        {
+            validate = true;
+        }
+    }
+
+    if (validate)
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << " validating optimistic operations and scans before prepare";
+        m_validating = true;
+        m_validate_client = id;
+        m_validate_nonce = nonce;
+        m_validate_seqno = seqno;
+    }
+
+    return validate;
+}
+
+bool
+transaction :: validate_scans(daemon* d)
+{
+    bool validated = true;
+
+    for (size_t i = 0; i < m_scans.size(); ++i)
+    {
+        scanned& s(m_scans[i]);
+
+        if (s.verify_done)
+        {
+            continue;
+        }
+
+        validated = false;
+
+        // nothing to compare against until the client's chunk comes back
+        if (!s.scan_done || s.verify_sent)
+        {
+            continue;
+        }
+
+        LOG_IF(INFO, s_debug_mode) << logid() << " scan[" << i << "]: reading again to validate";
+        daemon::scan_map_t::state_reference sr;
+        kvs_scan* kv = d->create_scan(&sr);
+        kv->callback_transaction(m_tg, i, &transaction::callback_verify_scan);
+        kv->scan(e::slice(s.table), e::slice(s.key), UINT64_MAX, s.limit, d);
+        s.verify_sent = true;
+    }
+
+    return validated;
+}
+
 void
-transaction :: acquire_lock(uint64_t seqno, daemon* d)
+transaction :: acquire_lock(uint64_t seqno, kvs_lock_batch* batch, daemon* d)
 {
     assert(seqno < m_ops.size());
     operation& op(m_ops[seqno]);
+    const bool shared = op.type == LOG_ENTRY_TX_READ && !op.lock_exclusive;
+    const size_t di = m_declared_here ? find_declared(op.table, op.key) : m_declared.size();
+    const size_t ei = op.lock_nonce == 0 ? find_locked_earlier(seqno) : m_ops.size();
+
+    // so does an earlier op's lock on the same key; unlocking is idempotent
+    // at the key-value store, so either op's unlock may release it
+    if (ei < m_ops.size() &&
+        (shared || m_ops[ei].type == LOG_ENTRY_TX_WRITE || m_ops[ei].lock_exclusive))
+    {
+        LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: lock held by ops[" << ei << "]";
+        op.lock_acquired = true;
+        time_step("locked", seqno, d);
+        return;
+    }
+
+    // the declared lock serves the op if it is strong enough; the op's
+    // unlock then releases it
+    if (op.lock_nonce == 0 && di < m_declared.size() &&
+        !m_declared[di].lock_released &&
+        ((m_declared[di].flags & CONSUS_HINT_WRITE) || shared))
+    {
+        if (m_declared[di].lock_acquired)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: lock declared at begin";
+            op.lock_acquired = true;
+            time_step("locked", seqno, d);
+            return;
+        }
+
+        if (m_declared[di].lock_nonce != 0)
+        {
+            return;
+        }
+    }
 
     if (op.lock_nonce == 0)
     {
         daemon::lock_op_map_t::state_reference sr;
-        kvs_lock_op* kv = d->create_lock_op(&sr);
+        kvs_lock_op* kv = d->create_lock_op(&sr, m_tg, d->m_tracer.sampled(m_tg));
         kv->callback_transaction(m_tg, seqno, &transaction::callback_locked);
-        kv->doit(LOCK_LOCK, op.table, op.key, m_tg, d);
+        // reads share the lock unless a write is sure to follow; a later
+        // write of the same key upgrades it
+        kv->doit(shared ? LOCK_LOCK_SHARED : LOCK_LOCK,
+                 op.table, op.key, m_tg, d, batch);
         op.lock_nonce = kv->state_key();
+        time_step("lock", seqno, d);
+    }
+}
+
+void
+transaction :: release_lock(uint64_t seqno, kvs_lock_batch* batch, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+    const uint64_t now = po6::monotonic_time();
+
+    // an outstanding acquire also holds lock_nonce; we wait on it rather
+    // than let an unlock race past it to a different replica
+    if (op.lock_nonce != 0 &&
+        (op.unlock_sent == 0 || op.unlock_sent + d->resend_interval() > now))
+    {
+        return;
+    }
+
+    if (op.lock_nonce != 0)
+    {
+        // give up on the unanswered unlock, so it can be collected, and
+        // send a fresh one that may reach a replica that is still up
+        daemon::lock_op_map_t::state_reference osr;
+        kvs_lock_op* old = d->m_lock_ops.get_state(op.lock_nonce, &osr);
+
+        if (old)
+        {
+            old->cancel();
+        }
+
+        LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: resending unlock";
+    }
+
+    daemon::lock_op_map_t::state_reference sr;
+    kvs_lock_op* kv = d->create_lock_op(&sr, m_tg, d->m_tracer.sampled(m_tg));
+    kv->callback_transaction(m_tg, seqno, &transaction::callback_unlocked);
+    kv->doit(LOCK_UNLOCK, op.table, op.key, m_tg, d, batch);
+    op.lock_nonce = kv->state_key();
+    op.unlock_sent = now;
+}
+
+// Every lock was taken before the data center voted, and none will be taken
+// after, so giving up a read's shared lock now still leaves the transaction
+// two-phase.  Reads don't write, so nothing can come to depend on them if the
+// global vote aborts.  A key that is also written keeps its lock, which
+// stands for both.
+void
+transaction :: release_read_locks(daemon* d)
+{
+    if (!d->m_early_lock_release)
+    {
+        return;
+    }
+
+    std::vector<const operation*> written;
+
+    for (size_t i = 0; i < m_ops.size(); ++i)
+    {
+        if (m_ops[i].type == LOG_ENTRY_TX_WRITE)
+        {
+            written.push_back(&m_ops[i]);
+        }
+    }
+
+    kvs_lock_batch locks;
+
+    for (size_t i = 0; i < m_ops.size(); ++i)
+    {
+        operation& op(m_ops[i]);
+
+        if (op.type != LOG_ENTRY_TX_READ || !op.require_lock ||
+            !op.lock_acquired || op.lock_released || op.lock_exclusive)
+        {
+            continue;
+        }
+
+        bool also_written = false;
+
+        for (size_t w = 0; !also_written && w < written.size(); ++w)
+        {
+            also_written = written[w]->table == op.table &&
+                           written[w]->key == op.key;
+        }
+
+        if (!also_written)
+        {
+            release_lock(i, &locks, d);
+        }
+    }
+
+    locks.flush(m_tg, d);
+}
+
+void
+transaction :: start_read(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+    const size_t di = m_declared_here && !op.read_pinned && !op.cond_pending
+                    ? find_declared(op.table, op.key) : m_declared.size();
+    const size_t ei = op.read_nonce == 0 && op.lock_acquired && !op.read_pinned && !op.cond_pending
+                    ? find_locked_earlier(seqno) : m_ops.size();
+
+    // the transaction read the key before and has held its lock ever since,
+    // so that read's version is still the latest; this op is logged, and
+    // replicated, with the same timestamp as if it had read it afresh
+    if (ei < m_ops.size() &&
+        m_ops[ei].type == LOG_ENTRY_TX_READ &&
+        m_ops[ei].read_done &&
+        m_ops[ei].read_under_lock &&
+        !m_ops[ei].cond_pending)
+    {
+        const operation& prev(m_ops[ei]);
+        LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: read repeats ops[" << ei << "]";
+        op.read_done = true;
+        time_step("read", seqno, d);
+        op.read_backing = prev.read_backing;
+        op.timestamp = prev.timestamp;
+        op.value = e::slice(op.read_backing);
+        op.rc = prev.rc;
+        op.read_under_lock = true;
+        return;
+    }
+
+    // the key has been locked since before it was prefetched, so the
+    // prefetched version is still the latest
+    if (op.read_nonce == 0 && op.lock_acquired && di < m_declared.size() &&
+        (m_declared[di].flags & CONSUS_HINT_READ) &&
+        m_declared[di].lock_acquired && !m_declared[di].lock_released)
+    {
+        const declared& dk(m_declared[di]);
+
+        if (dk.read_done)
+        {
+            LOG_IF(INFO, s_debug_mode) << logid() << ".ops[" << seqno << "]: read prefetched";
+            op.read_done = true;
+            time_step("read", seqno, d);
+            op.read_backing = dk.read_backing;
+            op.timestamp = dk.timestamp;
+            op.value = e::slice(op.read_backing);
+            op.rc = dk.rc;
+            op.read_under_lock = true;
+            return;
+        }
+
+        if (dk.read_nonce != 0)
+        {
+            return;
+        }
+    }
+
+    if (op.read_nonce == 0 && op.read_pinned)
+    {
+        // a pinned read's answer is the same for every reader, so it may
+        // share a read already in flight; an unpinned one must see every
+        // write that precedes it and always goes out on its own
+        op.read_nonce = d->pinned_read(m_tg, seqno, &transaction::callback_read,
+                                       op.table, op.key, op.timestamp);
+        time_step("fetch", seqno, d);
+    }
+    else if (op.read_nonce == 0)
+    {
+        daemon::read_map_t::state_reference sr;
+        kvs_read* kv = d->create_read(&sr, m_tg, d->m_tracer.sampled(m_tg));
+        kv->callback_transaction(m_tg, seqno, &transaction::callback_read);
+        kv->read(op.table, op.key, UINT64_MAX, d);
+        op.read_nonce = kv->state_key();
+        time_step("fetch", seqno, d);
+    }
+}
+
+void
+transaction :: start_write(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+
+    if (op.write_nonce == 0)
+    {
+        daemon::write_map_t::state_reference sr;
+        kvs_write* kv = d->create_write(&sr, m_tg, d->m_tracer.sampled(m_tg));
+        kv->callback_transaction(m_tg, seqno, &transaction::callback_write);
+        kv->write(0/*XXX*/, op.table, op.key, m_timestamp, op.value, d);
+        op.write_nonce = kv->state_key();
+        feed_replicas(seqno, d);
+    }
+}
+
+// One group performs each write on behalf of the read replicas: the table's
+// home, if it has one, and otherwise the origin; within it, the first live
+// member queues it, and the others remember its key in case that member
+// fails before the replicas have it.
+void
+transaction :: feed_replicas(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+    configuration* c = d->get_config();
+    std::vector<data_center_id> replicas;
+    c->read_replicas(&replicas);
+
+    if (replicas.empty())
+    {
+        return;
+    }
+
+    const data_center_id home = c->home(op.table);
+
+    if (home != data_center_id() ? home != d->m_us.dc : m_tg.group != m_tg.txid.group)
+    {
+        return;
+    }
+
+    const uint64_t now = po6::monotonic_time();
+
+    if (c->first_alive(m_tg.group) != d->m_us.id)
+    {
+        d->m_replica_feed.standby(m_tg.group, op.table, op.key, now);
+        return;
+    }
+
+    for (size_t i = 0; i < replicas.size(); ++i)
+    {
+        d->m_replica_feed.enqueue(replicas[i], d->generate_nonce(), op.table,
+                                  op.key, m_timestamp, op.value, now);
+    }
+}
+
+void
+transaction :: start_verify_read(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+
+    if (op.verify_read_nonce == 0)
+    {
+        daemon::read_map_t::state_reference sr;
+        kvs_read* kv = d->create_read(&sr, m_tg, d->m_tracer.sampled(m_tg));
+        kv->callback_transaction(m_tg, seqno, &transaction::callback_verify_read);
+        kv->read(op.table, op.key, UINT64_MAX, d);
+        op.verify_read_nonce = kv->state_key();
+    }
+}
+
+void
+transaction :: start_verify_write(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+
+    if (op.verify_write_nonce == 0)
+    {
+        daemon::read_map_t::state_reference sr;
+        kvs_read* kv = d->create_read(&sr, m_tg, d->m_tracer.sampled(m_tg));
+        kv->callback_transaction(m_tg, seqno, &transaction::callback_verify_write);
+        kv->read(op.table, op.key, UINT64_MAX, d);
+        op.verify_write_nonce = kv->state_key();
+    }
+}
+
+// The origin locked, read, and will write a homed table's key at the only key
+// value stores that hold it, so re-executing the op here would only contend
+// with the origin for the same lock.
+void
+transaction :: defer_to_home(uint64_t seqno, daemon* d)
+{
+    assert(seqno < m_ops.size());
+    operation& op(m_ops[seqno]);
+
+    if (d->get_config()->home(op.table) == data_center_id())
+    {
+        return;
+    }
+
+    op.require_lock = false;
+    op.require_verify_read = false;
+    op.require_verify_write = false;
+    op.require_write = false;
+}
+
+size_t
+transaction :: find_locked_earlier(uint64_t seqno)
+{
+    assert(seqno < m_ops.size());
+    const operation& op(m_ops[seqno]);
+
+    for (size_t i = seqno; i > 0; --i)
+    {
+        const operation& prev(m_ops[i - 1]);
+
+        if ((prev.type != LOG_ENTRY_TX_READ && prev.type != LOG_ENTRY_TX_WRITE) ||
+            prev.table != op.table || prev.key != op.key)
+        {
+            continue;
+        }
+
+        if (prev.require_lock && prev.lock_acquired &&
+            !prev.lock_released && prev.unlock_sent == 0)
+        {
+            return i - 1;
+        }
+
+        return m_ops.size();
+    }
+
+    return m_ops.size();
+}
+
+size_t
+transaction :: find_declared(const e::slice& table, const e::slice& key)
+{
+    key_hint h;
+    h.table = table;
+    h.key = key;
+    size_t lo = 0;
+    size_t hi = m_declared.size();
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        key_hint m;
+        m.table = e::slice(m_declared[mid].table);
+        m.key = e::slice(m_declared[mid].key);
+
+        if (declared_before(m, h))
+        {
+            lo = mid + 1;
+        }
+        else if (declared_before(h, m))
+        {
+            hi = mid;
+        }
+        else
+        {
+            return mid;
+        }
+    }
+
+    return m_declared.size();
+}
+
+void
+transaction :: acquire_declared(kvs_lock_batch* batch, daemon* d)
+{
+    if (!m_declared_here)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_declared.size(); ++i)
+    {
+        declared& dk(m_declared[i]);
+
+        if (dk.lock_released)
+        {
+            continue;
+        }
+
+        if (!dk.lock_acquired && dk.lock_nonce == 0)
+        {
+            daemon::lock_op_map_t::state_reference sr;
+            kvs_lock_op* kv = d->create_lock_op(&sr, m_tg, d->m_tracer.sampled(m_tg));
+            kv->callback_transaction(m_tg, i, &transaction::callback_declared_locked);
+            kv->doit((dk.flags & CONSUS_HINT_WRITE) ? LOCK_LOCK : LOCK_LOCK_SHARED,
+                     e::slice(dk.table), e::slice(dk.key), m_tg, d, batch);
+            dk.lock_nonce = kv->state_key();
+        }
+        else if (dk.lock_acquired && (dk.flags & CONSUS_HINT_READ) &&
+                 !dk.read_done && dk.read_nonce == 0)
+        {
+            daemon::read_map_t::state_reference sr;
+            kvs_read* kv = d->create_read(&sr, m_tg, d->m_tracer.sampled(m_tg));
+            kv->callback_transaction(m_tg, i, &transaction::callback_prefetched);
+            kv->read(e::slice(dk.table), e::slice(dk.key), UINT64_MAX, d);
+            dk.read_nonce = kv->state_key();
+        }
+    }
+}
+
+// A declared key that an op also locked is the op's to unlock, and only once
+// the op has unlocked it, so a written key stays locked until the write
+// lands.  What is left are keys no op touched, which the member that took
+// them may no longer be around to release, and locks that came back after
+// the op's unlock had already gone out.
+bool
+transaction :: release_declared(kvs_lock_batch* batch, daemon* d)
+{
+    // 1 once every op on the key has unlocked it, 2 while one still holds it
+    std::vector<uint8_t> covered(m_declared.size(), 0);
+    bool done = true;
+
+    for (size_t i = 0; i < m_ops.size() && !m_declared.empty(); ++i)
+    {
+        const operation& op(m_ops[i]);
+
+        if (op.type == LOG_ENTRY_NOP || !op.require_lock)
+        {
+            continue;
+        }
+
+        const size_t di = find_declared(op.table, op.key);
+
+        if (di < m_declared.size() && !op.lock_released)
+        {
+            covered[di] = 2;
+        }
+        else if (di < m_declared.size() && covered[di] == 0)
+        {
+            covered[di] = 1;
+        }
+    }
+
+    const uint64_t now = po6::monotonic_time();
+
+    for (size_t i = 0; i < m_declared.size(); ++i)
+    {
+        declared& dk(m_declared[i]);
+
+        if (dk.lock_released)
+        {
+            continue;
+        }
+
+        if (covered[i] == 2)
+        {
+            done = false;
+            continue;
+        }
+
+        // an acquire still outstanding could land after the unlock
+        if (dk.lock_nonce != 0 &&
+            (dk.unlock_sent == 0 || dk.unlock_sent + d->resend_interval() > now))
+        {
+            done = false;
+            continue;
+        }
+
+        if (covered[i] == 1 && dk.lock_nonce == 0 && !dk.late)
+        {
+            dk.lock_released = true;
+            continue;
+        }
+
+        if (dk.lock_nonce != 0)
+        {
+            daemon::lock_op_map_t::state_reference osr;
+            kvs_lock_op* old = d->m_lock_ops.get_state(dk.lock_nonce, &osr);
+
+            if (old)
+            {
+                old->cancel();
+            }
+        }
+
+        daemon::lock_op_map_t::state_reference sr;
+        kvs_lock_op* kv = d->create_lock_op(&sr, m_tg, d->m_tracer.sampled(m_tg));
+        kv->callback_transaction(m_tg, i, &transaction::callback_declared_unlocked);
+        kv->doit(LOCK_UNLOCK, e::slice(dk.table), e::slice(dk.key), m_tg, d, batch);
+        dk.lock_nonce = kv->state_key();
+        dk.unlock_sent = now;
+        done = false;
+    }
+
+    return done;
+}
+
+std::string
+transaction :: generate_log_entry(uint64_t seqno)
+{
+    assert(seqno < m_ops.size());
+    std::string entry;
+    e::packer pa(&entry);
+    std::vector<paxos_group_id> dcs(m_dcs, m_dcs + m_dcs_sz);
+    operation* op = &m_ops[seqno];
+    const uint8_t op_flags = (op->optimistic ? OP_FLAG_OPTIMISTIC : 0)
+                           | (op->read_under_lock ? OP_FLAG_READ_UNDER_LOCK : 0);
+
+    switch (m_ops[seqno].type)
+    {
+        case LOG_ENTRY_TX_BEGIN:
+            pa = pa << LOG_ENTRY_TX_BEGIN << m_tg << seqno << m_init_timestamp << dcs;
+
+            // the rest of the group learns the declared keys so that any
+            // member may release them
+            if (!m_declared.empty())
+            {
+                pa = pa << uint64_t(m_declared.size());
+
+                for (size_t i = 0; i < m_declared.size(); ++i)
+                {
+                    pa = pa << e::slice(m_declared[i].table)
+                            << e::slice(m_declared[i].key)
+                            << m_declared[i].flags;
+                }
+            }
+            break;
+        case LOG_ENTRY_TX_READ:
+            pa << LOG_ENTRY_TX_READ << m_tg << seqno << op->table << op->key << op->timestamp
+               << op_flags;
+            break;
+        case LOG_ENTRY_TX_WRITE:
+            if (op->value_pending)
+            {
+                pa << LOG_ENTRY_TX_WRITE_DIGEST << m_tg << seqno << op->table << op->key
+                   << op->value_size << op->value_hash << op_flags;
+            }
+            else
+            {
+                pa << LOG_ENTRY_TX_WRITE << m_tg << seqno << op->table << op->key << op->value
+                   << op_flags;
+            }
+            break;
+        case LOG_ENTRY_TX_PREPARE:
+            pa << LOG_ENTRY_TX_PREPARE << m_tg << seqno;
+            break;
+        case LOG_ENTRY_TX_ABORT:
+            pa << LOG_ENTRY_TX_ABORT << m_tg << seqno;
+            break;
+        case LOG_ENTRY_LOCAL_VOTE_1A:
+        case LOG_ENTRY_LOCAL_VOTE_2A:
+        case LOG_ENTRY_LOCAL_LEARN:
+        case LOG_ENTRY_GLOBAL_PROPOSE:
+        case LOG_ENTRY_GLOBAL_VOTE_1A:
+        case LOG_ENTRY_GLOBAL_VOTE_2A:
+        case LOG_ENTRY_GLOBAL_VOTE_2B:
+        case LOG_ENTRY_CONFIG:
+        case LOG_ENTRY_NOP:
+        default:
+            ::abort();
+    }
+
+    return entry;
+}
+
+std::string
+transaction :: generate_commit_entry(uint64_t seqno, uint64_t threshold)
+{
+    assert(seqno < m_ops.size());
+    operation* op = &m_ops[seqno];
+
+    // other data centers lock one op at a time, so they get no declared keys
+    if (op->type == LOG_ENTRY_TX_BEGIN)
+    {
+        std::string entry;
+        std::vector<paxos_group_id> dcs(m_dcs, m_dcs + m_dcs_sz);
+        e::packer(&entry) << LOG_ENTRY_TX_BEGIN << m_tg << seqno << m_init_timestamp << dcs;
+        return entry;
+    }
+
+    if (op->type != LOG_ENTRY_TX_WRITE || op->value_pending ||
+        threshold == 0 || op->value.size() < threshold)
+    {
+        return generate_log_entry(seqno);
+    }
+
+    // other data centers vote on the key alone; the value follows the
+    // decision, and only if it is to commit
+    std::string entry;
+    e::packer pa(&entry);
+    const uint64_t value_size = op->value.size();
+    const uint64_t value_hash = hash64(0, op->value.data(), op->value.size());
+    pa << LOG_ENTRY_TX_WRITE_DIGEST << m_tg << seqno << op->table << op->key
+       << value_size << value_hash;
+    return entry;
+}
+
+void
+transaction :: build_commit_record(daemon* d)
+{
+    m_commit_record.clear();
+    m_commit_record.push_back(std::string());
+    e::packer pa(&m_commit_record.back());
+    const uint64_t threshold = d->commit_digest_threshold();
+
+    for (size_t i = 0; i < m_ops.size(); ++i)
+    {
+        if (m_ops[i].type == LOG_ENTRY_NOP)
+        {
+            continue;
+        }
+
+        std::string log_entry = generate_commit_entry(i, threshold);
+
+        if (!m_commit_record.back().empty() &&
+            m_commit_record.back().size() + log_entry.size() > COMMIT_RECORD_CHUNK_BYTES)
+        {
+            m_commit_record.push_back(std::string());
+            pa = e::packer(&m_commit_record.back());
+        }
+
+        pa = pa << e::slice(log_entry);
+    }
+
+    m_commit_record_ops = m_ops.size();
+}
+
+// A record that fits in one chunk goes as it always has.  Larger ones go as
+// a series of chunks, each naming its place in the whole, on the bulk class
+// so that they interleave with, rather than hold up, other traffic; the
+// remote group acts once it has every chunk.
+bool
+transaction :: send_commit_record(const paxos_group& g, bool first, daemon* d)
+{
+    const configuration* c = d->get_config();
+    comm_id target;
+
+    for (unsigned i = 0; i < g.members_sz; ++i)
+    {
+        // XXX coordinator failure sensitive
+        if (c->get_state(g.members[i]) == txman_state::ONLINE)
+        {
+            target = g.members[i];
+            break;
+        }
+    }
+
+    if (target == comm_id())
+    {
+        return false;
+    }
+
+    const transaction_group tg(g.id, m_tg.txid);
+    const uint64_t ops = m_commit_record_ops;
+    const uint64_t count = m_commit_record.size();
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        const e::slice chunk(m_commit_record[i]);
+        std::string inner;
+        e::packer pa(&inner);
+
+        if (count == 1)
+        {
+            pa = pa << COMMIT_RECORD << tg << chunk;
+        }
+        else
+        {
+            pa = pa << COMMIT_RECORD_CHUNK << tg << ops
+                    << e::pack_varint(i) << e::pack_varint(count) << chunk;
+        }
+
+        const size_t sz = BUSYBEE_HEADER_SIZE + inner.size();
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        memmove(msg->data() + BUSYBEE_HEADER_SIZE, inner.data(), inner.size());
+        msg->resize(sz);
+
+        // only the first copy holds up the vote
+        if (!first)
+        {
+            d->send_bulk(target, wan_scheduler::RETRANSMISSIONS, msg);
+            continue;
+        }
+
+        if (count == 1)
+        {
+            d->send(target, msg);
+        }
+        else
+        {
+            d->send_bulk(target, wan_scheduler::VALUES, msg);
+        }
+
+        if (g.witnesses_sz > 0)
+        {
+            send_witnesses(g, tg, inner, d);
+        }
+    }
+
+    return true;
+}
+
+bool
+transaction :: ship_commit_values(daemon* d)
+{
+    const uint64_t threshold = d->commit_digest_threshold();
+
+    if (m_dcs_sz <= 1 || threshold == 0 || m_tg.group != m_tg.txid.group ||
+        is_home_local(d))
+    {
+        return true;
+    }
+
+    const configuration* c = d->get_config();
+    std::vector<uint64_t> seqnos;
+    std::vector<e::slice> values;
+
+    for (size_t i = 0; i < m_ops.size(); ++i)
+    {
+        // other data centers leave homed tables to us, and never apply
+        // their values
+        if (m_ops[i].type == LOG_ENTRY_TX_WRITE &&
+            m_ops[i].value.size() >= threshold &&
+            c->home(m_ops[i].table) == data_center_id())
+        {
+            seqnos.push_back(i);
+            values.push_back(m_ops[i].value);
+        }
+    }
+
+    if (seqnos.empty())
+    {
+        return true;
+    }
+
+    // the first live member ships for the group; every member waits on the
+    // acknowledgements so that another takes over if it fails
+    comm_id shipper;
+
+    for (unsigned i = 0; i < m_group.members_sz; ++i)
+    {
+        if (c->get_state(m_group.members[i]) == txman_state::ONLINE)
+        {
+            shipper = m_group.members[i];
+            break;
+        }
+    }
+
+    const uint64_t now = po6::monotonic_time();
+    bool done = true;
+
+    for (size_t i = 0; i < m_dcs_sz; ++i)
+    {
+        const paxos_group* g = c->get_group(m_dcs[i]);
+
+        if (m_dcs[i] == m_group.id || !g)
+        {
+            continue;
+        }
+
+        const bool due = shipper == d->m_us.id &&
+                         m_dcs_timestamps[i] + d->resend_interval() < now;
+        transaction_group tg(g->id, m_tg.txid);
+
+        for (unsigned j = 0; j < g->members_sz; ++j)
+        {
+            // XXX coordinator failure sensitive
+            if (c->get_state(g->members[j]) != txman_state::ONLINE ||
+                std::find(m_values_acked.begin(), m_values_acked.end(),
+                          g->members[j]) != m_values_acked.end())
+            {
+                continue;
+            }
+
+            done = false;
+
+            if (!due)
+            {
+                continue;
+            }
+
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(COMMIT_VALUES)
+                            + pack_size(tg)
+                            + pack_size(seqnos)
+                            + pack_size(values);
+            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE)
+                << COMMIT_VALUES << tg << seqnos << values;
+            d->send_bulk(g->members[j], wan_scheduler::VALUES, msg);
+        }
+
+        if (due)
+        {
+            m_dcs_timestamps[i] = now;
+        }
     }
+
+    return done;
 }
 
 void
-transaction :: release_lock(uint64_t seqno, daemon* d)
+transaction :: send_commit_values_ack(comm_id id, daemon* d)
 {
-    assert(seqno < m_ops.size());
-    operation& op(m_ops[seqno]);
+    transaction_group tg(m_tg.txid);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(COMMIT_VALUES_ACK)
+                    + pack_size(tg);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << COMMIT_VALUES_ACK << tg;
 
-    if (op.lock_nonce == 0)
+    if (id == comm_id())
     {
-        daemon::lock_op_map_t::state_reference sr;
-        kvs_lock_op* kv = d->create_lock_op(&sr);
-        kv->callback_transaction(m_tg, seqno, &transaction::callback_unlocked);
-        kv->doit(LOCK_UNLOCK, op.table, op.key, m_tg, d);
-        op.lock_nonce = kv->state_key();
+        d->send(tg.group, msg);
+    }
+    else
+    {
+        d->send(id, msg);
     }
 }
 
 void
-transaction :: start_read(uint64_t seqno, daemon* d)
+transaction :: record_disposition_commit(daemon* d)
 {
-    assert(seqno < m_ops.size());
-    operation& op(m_ops[seqno]);
-
-    if (op.read_nonce == 0)
-    {
-        daemon::read_map_t::state_reference sr;
-        kvs_read* kv = d->create_read(&sr);
-        kv->callback_transaction(m_tg, seqno, &transaction::callback_read);
-        kv->read(op.table, op.key, UINT64_MAX, d);
-        op.read_nonce = kv->state_key();
-    }
+    d->m_dispositions.put(m_tg, CONSUS_VOTE_COMMIT);
+    d->disposition_recorded(m_tg);
 }
 
 void
-transaction :: start_write(uint64_t seqno, daemon* d)
+transaction :: record_disposition_abort(daemon* d)
 {
-    assert(seqno < m_ops.size());
-    operation& op(m_ops[seqno]);
-
-    if (op.write_nonce == 0)
-    {
-        daemon::write_map_t::state_reference sr;
-        kvs_write* kv = d->create_write(&sr);
-        kv->callback_transaction(m_tg, seqno, &transaction::callback_write);
-        kv->write(0/*XXX*/, op.table, op.key, m_timestamp, op.value, d);
-        op.write_nonce = kv->state_key();
-    }
+    d->m_dispositions.put(m_tg, CONSUS_VOTE_ABORT);
+    d->disposition_recorded(m_tg);
 }
 
 void
-transaction :: start_verify_read(uint64_t seqno, daemon* d)
+transaction :: record_table_stats(const operation& op, table_stats::stat outcome, daemon* d)
 {
-    assert(seqno < m_ops.size());
-    operation& op(m_ops[seqno]);
+    // only the member a client sent the operation to answers it, so each
+    // operation is counted once across the group
+    if (op.table.empty())
+    {
+        return;
+    }
 
-    if (op.verify_read_nonce == 0)
+    d->m_tables.record(op.table, outcome, 1);
+
+    if (op.type == LOG_ENTRY_TX_READ)
     {
-        daemon::read_map_t::state_reference sr;
-        kvs_read* kv = d->create_read(&sr);
-        kv->callback_transaction(m_tg, seqno, &transaction::callback_verify_read);
-        kv->read(op.table, op.key, UINT64_MAX, d);
-        op.verify_read_nonce = kv->state_key();
+        d->m_tables.record(op.table, table_stats::READS, 1);
+        d->m_tables.record(op.table, table_stats::READ_BYTES, op.key.size() + op.value.size());
+    }
+    else if (op.type == LOG_ENTRY_TX_WRITE)
+    {
+        d->m_tables.record(op.table, table_stats::WRITES, 1);
+        d->m_tables.record(op.table, table_stats::WRITE_BYTES, op.key.size() + op.value.size());
+    }
+
+    if (m_inflight_since > 0)
+    {
+        d->m_tables.record(op.table, table_stats::TRANSACTION_NANOS,
+                           po6::monotonic_time() - m_inflight_since);
     }
 }
 
 void
-transaction :: start_verify_write(uint64_t seqno, daemon* d)
+transaction :: send_paxos_2a(const std::vector<uint64_t>& seqnos, daemon* d)
 {
-    assert(seqno < m_ops.size());
-    operation& op(m_ops[seqno]);
+    // every operation that is due for a member goes out in one message; the
+    // log entries are generated at most once per call, and only when needed
+    const uint64_t now = po6::monotonic_time();
+    std::vector<std::string> entries(seqnos.size());
+    std::vector<e::slice> batch;
 
-    if (op.verify_write_nonce == 0)
+    for (unsigned i = 0; i < m_group.members_sz; ++i)
     {
-        daemon::read_map_t::state_reference sr;
-        kvs_read* kv = d->create_read(&sr);
-        kv->callback_transaction(m_tg, seqno, &transaction::callback_verify_write);
-        kv->read(op.table, op.key, UINT64_MAX, d);
-        op.verify_write_nonce = kv->state_key();
+        if (m_group.members[i] == d->m_us.id)
+        {
+            continue;
+        }
+
+        const uint64_t resend = d->resend_interval(m_group.members[i]);
+        batch.clear();
+
+        for (size_t j = 0; j < seqnos.size(); ++j)
+        {
+            const size_t slot = replica_slot(seqnos[j], i);
+
+            if (m_durable[slot] || m_paxos_timestamps[slot] + resend > now)
+            {
+                continue;
+            }
+
+            if (entries[j].empty())
+            {
+                entries[j] = generate_log_entry(seqnos[j]);
+            }
+
+            batch.push_back(e::slice(entries[j]));
+            m_paxos_resent[slot] = m_paxos_timestamps[slot] > 0;
+            m_paxos_timestamps[slot] = now;
+        }
+
+        if (batch.empty())
+        {
+            continue;
+        }
+
+        std::auto_ptr<e::buffer> msg;
+
+        if (batch.size() == 1)
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(TXMAN_PAXOS_2A)
+                            + pack_size(batch[0]);
+            msg.reset(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_PAXOS_2A << batch[0];
+        }
+        else
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(TXMAN_PAXOS_2A_BATCH)
+                            + pack_size(batch);
+            msg.reset(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_PAXOS_2A_BATCH << batch;
+        }
+
+        d->send(m_group.members[i], msg);
     }
-}
 
-std::string
-transaction :: generate_log_entry(uint64_t seqno)
-{
-    assert(seqno < m_ops.size());
-    std::string entry;
-    e::packer pa(&entry);
-    std::vector<paxos_group_id> dcs(m_dcs, m_dcs + m_dcs_sz);
-    operation* op = &m_ops[seqno];
+    if (m_group.witnesses_sz == 0)
+    {
+        return;
+    }
 
-    switch (m_ops[seqno].type)
+    // witnesses neither vote nor acknowledge, so each op goes to them once
+    // and they log it as it came, ready to replay if they are promoted
+    batch.clear();
+
+    for (size_t j = 0; j < seqnos.size(); ++j)
     {
-        case LOG_ENTRY_TX_BEGIN:
-            pa << LOG_ENTRY_TX_BEGIN << m_tg << seqno << m_init_timestamp << dcs;
-            break;
-        case LOG_ENTRY_TX_READ:
-            pa << LOG_ENTRY_TX_READ << m_tg << seqno << op->table << op->key << op->timestamp;
-            break;
-        case LOG_ENTRY_TX_WRITE:
-            pa << LOG_ENTRY_TX_WRITE << m_tg << seqno << op->table << op->key << op->value;
-            break;
-        case LOG_ENTRY_TX_PREPARE:
-            pa << LOG_ENTRY_TX_PREPARE << m_tg << seqno;
-            break;
-        case LOG_ENTRY_TX_ABORT:
-            pa << LOG_ENTRY_TX_ABORT << m_tg << seqno;
-            break;
-        case LOG_ENTRY_LOCAL_VOTE_1A:
-        case LOG_ENTRY_LOCAL_VOTE_2A:
-        case LOG_ENTRY_LOCAL_LEARN:
-        case LOG_ENTRY_GLOBAL_PROPOSE:
-        case LOG_ENTRY_GLOBAL_VOTE_1A:
-        case LOG_ENTRY_GLOBAL_VOTE_2A:
-        case LOG_ENTRY_GLOBAL_VOTE_2B:
-        case LOG_ENTRY_CONFIG:
-        case LOG_ENTRY_NOP:
-        default:
-            ::abort();
+        if (seqnos[j] >= m_witnessed.size())
+        {
+            m_witnessed.resize(seqnos[j] + 1, 0);
+        }
+
+        if (m_witnessed[seqnos[j]])
+        {
+            continue;
+        }
+
+        if (entries[j].empty())
+        {
+            entries[j] = generate_log_entry(seqnos[j]);
+        }
+
+        batch.push_back(e::slice(entries[j]));
+        m_witnessed[seqnos[j]] = 1;
     }
 
-    return entry;
-}
+    if (batch.empty())
+    {
+        return;
+    }
 
-void
-transaction :: record_disposition_commit(daemon* d)
-{
-    d->m_dispositions.put(m_tg, CONSUS_VOTE_COMMIT);
+    std::string inner;
+    e::packer(&inner) << TXMAN_PAXOS_2A_BATCH << batch;
+    send_witnesses(m_group, m_tg, inner, d);
 }
 
 void
-transaction :: record_disposition_abort(daemon* d)
+transaction :: send_witnesses(const paxos_group& g, const transaction_group& tg,
+                              const std::string& inner, daemon* d)
 {
-    d->m_dispositions.put(m_tg, CONSUS_VOTE_ABORT);
+    for (unsigned i = 0; i < g.witnesses_sz; ++i)
+    {
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(TXMAN_WITNESS)
+                        + pack_size(tg)
+                        + pack_size(e::slice(inner));
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_WITNESS << tg << e::slice(inner);
+        d->send(g.witnesses[i], msg);
+    }
 }
 
 void
-transaction :: send_paxos_2a(uint64_t i, daemon* d)
+transaction :: send_paxos_2b(const std::vector<uint64_t>& seqnos, daemon* d)
 {
-    std::string le = generate_log_entry(i);
-    const size_t sz = BUSYBEE_HEADER_SIZE
-                    + pack_size(TXMAN_PAXOS_2A)
-                    + pack_size(e::slice(le));
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_PAXOS_2A << e::slice(le);
-    send_to_nondurable(i, msg, m_ops[i].paxos_timestamps, d);
-}
+    const uint64_t now = po6::monotonic_time();
+    std::vector<uint64_t> batch;
 
-void
-transaction :: send_paxos_2b(uint64_t i, daemon* d)
-{
-    const size_t sz = BUSYBEE_HEADER_SIZE
-                    + pack_size(TXMAN_PAXOS_2B)
-                    + pack_size(m_tg)
-                    + sizeof(uint64_t);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_PAXOS_2B << m_tg << i;
-    send_to_group(msg, m_ops[i].paxos_2b_timestamps, d);
+    for (unsigned i = 0; i < m_group.members_sz; ++i)
+    {
+        if (m_group.members[i] == d->m_us.id)
+        {
+            continue;
+        }
+
+        const uint64_t resend = d->resend_interval(m_group.members[i]);
+        batch.clear();
+
+        for (size_t j = 0; j < seqnos.size(); ++j)
+        {
+            const size_t slot = replica_slot(seqnos[j], i);
+
+            if (m_paxos_2b_timestamps[slot] + resend > now)
+            {
+                continue;
+            }
+
+            batch.push_back(seqnos[j]);
+            m_paxos_2b_timestamps[slot] = now;
+        }
+
+        if (batch.empty())
+        {
+            continue;
+        }
+
+        std::auto_ptr<e::buffer> msg;
+
+        if (batch.size() == 1)
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(TXMAN_PAXOS_2B)
+                            + pack_size(m_tg)
+                            + sizeof(uint64_t);
+            msg.reset(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_PAXOS_2B << m_tg << batch[0];
+        }
+        else
+        {
+            const size_t sz = BUSYBEE_HEADER_SIZE
+                            + pack_size(TXMAN_PAXOS_2B_BATCH)
+                            + pack_size(m_tg)
+                            + pack_size(batch);
+            msg.reset(e::buffer::create(sz));
+            msg->pack_at(BUSYBEE_HEADER_SIZE) << TXMAN_PAXOS_2B_BATCH << m_tg << batch;
+        }
+
+        d->send(m_group.members[i], msg);
+    }
 }
 
 void
@@ -1796,6 +4450,11 @@ transaction :: send_response(operation* op, daemon* d)
 {
     assert(op->client != comm_id());
 
+    if (op->conditional)
+    {
+        return send_tx_cond_write(op, d);
+    }
+
     switch (op->type)
     {
         case LOG_ENTRY_TX_BEGIN:
@@ -1924,6 +4583,61 @@ transaction :: send_tx_write(operation* op, daemon* d)
     op->client = comm_id();
 }
 
+// gets answer as a transactional read does; puts and updates answer with
+// the version they wrote, or with why they did not and what they found
+void
+transaction :: send_single_response(operation* op, daemon* d)
+{
+    consus_returncode rc = op->rc;
+    uint64_t timestamp = op->timestamp;
+    e::slice value = op->value;
+
+    if (m_single_kind != SINGLE_GET && op->require_write)
+    {
+        rc = CONSUS_SUCCESS;
+        timestamp = m_timestamp;
+        value = e::slice();
+    }
+    else if (m_single_kind != SINGLE_GET)
+    {
+        rc = op->cond_rc;
+    }
+
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(CLIENT_RESPONSE)
+                    + sizeof(uint64_t)
+                    + pack_size(rc)
+                    + sizeof(uint64_t)
+                    + pack_size(value);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << CLIENT_RESPONSE
+        << op->nonce
+        << rc
+        << timestamp
+        << value;
+    d->send(op->client, msg);
+    op->client = comm_id();
+}
+
+void
+transaction :: send_tx_cond_write(operation* op, daemon* d)
+{
+    // the value written, or the value that caused the update to decline
+    const consus_returncode rc = op->type == LOG_ENTRY_TX_WRITE
+                               ? CONSUS_SUCCESS : op->cond_rc;
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(CLIENT_RESPONSE)
+                    + sizeof(uint64_t)
+                    + pack_size(rc)
+                    + pack_size(op->value);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << CLIENT_RESPONSE << op->nonce << rc << op->value;
+    d->send(op->client, msg);
+    op->client = comm_id();
+}
+
 void
 transaction :: send_tx_commit(daemon* d)
 {
@@ -1960,50 +4674,6 @@ transaction :: send_tx_abort(daemon* d)
     d->send(m_ops.back().client, msg);
 }
 
-void
-transaction :: send_to_group(std::auto_ptr<e::buffer> msg, uint64_t timestamps[CONSUS_MAX_REPLICATION_FACTOR], daemon* d)
-{
-    const uint64_t now = po6::monotonic_time();
-
-    for (unsigned i = 0; i < m_group.members_sz; ++i)
-    {
-        if (m_group.members[i] == d->m_us.id ||
-            timestamps[i] + d->resend_interval() > now)
-        {
-            continue;
-        }
-
-        std::auto_ptr<e::buffer> m(msg->copy());
-        d->send(m_group.members[i], m);
-        timestamps[i] = now;
-    }
-}
-
-void
-transaction :: send_to_nondurable(uint64_t seqno, std::auto_ptr<e::buffer> msg, uint64_t timestamps[CONSUS_MAX_REPLICATION_FACTOR], daemon* d)
-{
-    if (seqno >= m_ops.size())
-    {
-        return;
-    }
-
-    const uint64_t now = po6::monotonic_time();
-
-    for (unsigned i = 0; i < m_group.members_sz; ++i)
-    {
-        if (m_group.members[i] == d->m_us.id ||
-            m_ops[seqno].durable[i] ||
-            timestamps[i] + d->resend_interval() > now)
-        {
-            continue;
-        }
-
-        std::auto_ptr<e::buffer> m(msg->copy());
-        d->send(m_group.members[i], m);
-        timestamps[i] = now;
-    }
-}
-
 std::ostream&
 consus :: operator << (std::ostream& lhs, const transaction::state_t& rhs)
 {
@@ -31,17 +31,25 @@
 // consus
 #include <consus.h>
 #include "namespace.h"
+#include "common/alloc_stats.h"
 #include "common/consus.h"
 #include "common/ids.h"
+#include "common/table_stats.h"
 #include "common/transaction_id.h"
 #include "common/transaction_group.h"
+#include "common/update.h"
 #include "txman/log_entry_t.h"
+#include "txman/op_arena.h"
 #include "txman/paxos_synod.h"
+#include "txman/timeline.h"
 
 BEGIN_CONSUS_NAMESPACE
 class daemon;
+class inflight;
+class kvs_lock_batch;
+class message_cost;
 
-class transaction
+class transaction : public tagged<ALLOC_TRANSACTIONS>
 {
     public:
         enum state_t
@@ -56,6 +64,15 @@ class transaction
             GARBAGE_COLLECT
         };
 
+        // a key the client declared at begin, with CONSUS_HINT_* flags
+        struct key_hint
+        {
+            key_hint() : table(), key(), flags(0) {}
+            e::slice table;
+            e::slice key;
+            uint8_t flags;
+        };
+
     public:
         transaction(const transaction_group& tg);
         ~transaction() throw ();
@@ -69,6 +86,7 @@ class transaction
         void begin(comm_id id, uint64_t nonce, uint64_t timestamp,
                    const paxos_group& group,
                    const std::vector<paxos_group_id>& dcs,
+                   const std::vector<key_hint>& hints,
                    daemon* d);
         void read(comm_id id, uint64_t nonce, uint64_t seqno,
                   const e::slice& table,
@@ -81,8 +99,47 @@ class transaction
                    const e::slice& value,
                    std::auto_ptr<e::buffer> backing,
                    daemon* d);
+        // read key at seqno and, at seqno + 1, write what update makes of
+        // it, or read it again if the update declines to write
+        void cond_write(comm_id id, uint64_t nonce, uint64_t seqno,
+                        const e::slice& table,
+                        const e::slice& key,
+                        update_t update,
+                        const e::slice& expected,
+                        const e::slice& value,
+                        std::auto_ptr<e::buffer> backing,
+                        daemon* d);
+        // ops_sz reads and writes, each with its own nonce and seqno, and
+        // so its own paxos slot; see the definition for what is shared
+        void multi(comm_id id, uint64_t ops_sz, e::unpacker up,
+                   std::auto_ptr<e::buffer> backing,
+                   daemon* d);
+        // the first limit keys >= key; answered straight from the key-value
+        // stores without occupying a slot in the transaction, and read again
+        // before prepare to validate it
+        void scan(comm_id id, uint64_t nonce,
+                  const e::slice& table,
+                  const e::slice& key,
+                  uint64_t limit,
+                  daemon* d);
         void prepare(comm_id id, uint64_t nonce, uint64_t seqno, daemon* d);
+        // prepare, preceded by writes_sz buffered writes, each with its own
+        // seqno, that no client waits on individually
+        void prepare(comm_id id, uint64_t nonce, uint64_t seqno,
+                     uint64_t writes_sz, e::unpacker up,
+                     std::auto_ptr<e::buffer> backing,
+                     daemon* d);
         void abort(comm_id id, uint64_t nonce, uint64_t seqno, daemon* d);
+        // one key, outside any transaction:  locked, read, perhaps written,
+        // answered, and unlocked, without the group's log or a vote
+        void single(comm_id id, uint64_t nonce, single_t kind,
+                    const e::slice& table,
+                    const e::slice& key,
+                    update_t update,
+                    const e::slice& expected,
+                    const e::slice& value,
+                    std::auto_ptr<e::buffer> backing,
+                    daemon* d);
 
     public:
         void paxos_2a(uint64_t seqno, log_entry_t t, e::unpacker up,
@@ -91,6 +148,18 @@ class transaction
         void commit_record(e::slice commit_record,
                            std::auto_ptr<e::buffer> _backing,
                            daemon* d);
+        // one of count pieces of a commit record too large to send whole;
+        // ops identifies which build of the record the piece belongs to
+        void commit_record_chunk(uint64_t ops, uint64_t index, uint64_t count,
+                                 e::slice chunk,
+                                 std::auto_ptr<e::buffer> _backing,
+                                 daemon* d);
+        // values the origin ships for writes its commit record digested
+        void commit_values(const std::vector<uint64_t>& seqnos,
+                           const std::vector<e::slice>& values,
+                           std::auto_ptr<e::buffer> backing,
+                           daemon* d);
+        void commit_values_ack(comm_id id, daemon* d);
         void callback_durable(uint64_t seqno, daemon* d);
 
         // key value store callbacks
@@ -103,6 +172,15 @@ class transaction
                                   uint64_t seqno, daemon*d);
         void callback_verify_write(consus_returncode rc, uint64_t timestamp, const e::slice& value,
                                    uint64_t seqno, daemon*d);
+        // as above, for the declared key at index
+        void callback_declared_locked(consus_returncode rc, uint64_t index, daemon* d);
+        void callback_declared_unlocked(consus_returncode rc, uint64_t index, daemon* d);
+        void callback_prefetched(consus_returncode rc, uint64_t timestamp, const e::slice& value,
+                                 uint64_t index, daemon* d);
+        // a digest of scan chunk index as the client saw it, and as it
+        // reads when validated
+        void callback_scanned(uint64_t index, uint64_t digest, daemon* d);
+        void callback_verify_scan(uint64_t index, uint64_t digest, daemon* d);
 
         void externally_work_state_machine(daemon* d);
         std::string debug_dump();
@@ -111,6 +189,18 @@ class transaction
     private:
         struct operation;
         struct comparison;
+        struct declared;
+        struct scanned;
+        struct multi_op
+        {
+            multi_op() : write(0), nonce(0), seqno(0), table(), key(), value() {}
+            uint8_t write;
+            uint64_t nonce;
+            uint64_t seqno;
+            e::slice table;
+            e::slice key;
+            e::slice value;
+        };
 
     private:
         void ensure_initialized();
@@ -120,6 +210,8 @@ class transaction
                            std::auto_ptr<e::buffer> backing, daemon* d);
         void paxos_2a_write(uint64_t seqno, e::unpacker up,
                             std::auto_ptr<e::buffer> backing, daemon* d);
+        void paxos_2a_write_digest(uint64_t seqno, e::unpacker up,
+                                   std::auto_ptr<e::buffer> backing, daemon* d);
         void paxos_2a_prepare(uint64_t seqno, e::unpacker up,
                               std::auto_ptr<e::buffer> backing, daemon* d);
         void paxos_2a_abort(uint64_t seqno, e::unpacker up,
@@ -130,12 +222,40 @@ class transaction
                                 e::compat::shared_ptr<e::buffer> backing, daemon* d);
         void commit_record_write(uint64_t seqno, e::unpacker up,
                                  e::compat::shared_ptr<e::buffer> backing, daemon* d);
+        void commit_record_write_digest(uint64_t seqno, e::unpacker up,
+                                        e::compat::shared_ptr<e::buffer> backing, daemon* d);
         void commit_record_prepare(uint64_t seqno, e::unpacker up,
                                    e::compat::shared_ptr<e::buffer> backing, daemon* d);
+        bool replay_commit_record(e::slice commit_record,
+                                  e::compat::shared_ptr<e::buffer> backing, daemon* d);
+        void commit_record_replayed(daemon* d);
+        void build_commit_record(daemon* d);
+        bool send_commit_record(const paxos_group& g, bool first, daemon* d);
         void internal_begin(const char* source, uint64_t timestamp,
                             const paxos_group& group,
                             const std::vector<paxos_group_id>& dcs,
+                            const std::vector<key_hint>& hints,
                             daemon* d);
+        void client_read(comm_id id, uint64_t nonce, uint64_t seqno,
+                         const e::slice& table,
+                         const e::slice& key,
+                         e::compat::shared_ptr<e::buffer> backing,
+                         daemon* d);
+        void client_write(comm_id id, uint64_t nonce, uint64_t seqno,
+                          const e::slice& table,
+                          const e::slice& key,
+                          const e::slice& value,
+                          e::compat::shared_ptr<e::buffer> backing,
+                          daemon* d);
+        void client_cond_write(comm_id id, uint64_t nonce, uint64_t seqno,
+                               const e::slice& table,
+                               const e::slice& key,
+                               update_t update,
+                               const e::slice& expected,
+                               const e::slice& value,
+                               e::compat::shared_ptr<e::buffer> backing,
+                               daemon* d);
+        void decide_cond_write(uint64_t seqno, daemon* d);
         void internal_read(const char* source, uint64_t seqno,
                            const e::slice& table,
                            const e::slice& key,
@@ -147,6 +267,13 @@ class transaction
                             const e::slice& value,
                             e::compat::shared_ptr<e::buffer> backing,
                             daemon* d);
+        void internal_write_digest(const char* source, uint64_t seqno,
+                                   const e::slice& table,
+                                   const e::slice& key,
+                                   uint64_t value_size,
+                                   uint64_t value_hash,
+                                   e::compat::shared_ptr<e::buffer> backing,
+                                   daemon* d);
         void internal_end_of_transaction(const char* source,
                                          const char* op,
                                          log_entry_t let,
@@ -155,36 +282,101 @@ class transaction
         void internal_paxos_2b(comm_id id, uint64_t seqno, daemon* d);
 
         void work_state_machine(daemon* d);
+        // every transition goes through here, for the transaction_state probe
+        void set_state(state_t s);
+        void trace_state(daemon* d);
+        // in the daemon's inflight set from leaving INITIALIZED until
+        // TERMINATED
+        void track_inflight(daemon* d);
+        // holds an open tally in the daemon's message costs from leaving
+        // INITIALIZED until collected, so late acknowledgements still count
+        void track_costs(daemon* d);
+        // feeds the daemon's phase histograms; a transaction slower than
+        // the daemon's threshold is also logged with when it entered each
+        // state and finished each step
+        void time_state(daemon* d);
+        void time_step(const char* what, uint64_t seqno, daemon* d);
+        static const char* state_label(state_t s);
         void work_state_machine_executing(daemon* d);
+        // true once seqno needs nothing more before the vote
+        bool work_op_executing(uint64_t seqno,
+                               kvs_lock_batch* locks,
+                               std::vector<uint64_t>* send_2a,
+                               std::vector<uint64_t>* send_2b,
+                               daemon* d);
         void work_state_machine_local_commit_vote(daemon* d);
         void work_state_machine_global_commit_vote(daemon* d);
         void work_state_machine_committed(daemon* d);
         void work_state_machine_aborted(daemon* d);
         void work_state_machine_terminated(daemon* d);
+        void work_state_machine_single(daemon* d);
 
         // execution utils
         void avoid_commit_if_possible(daemon* d);
+        // wound ourselves once the client has left us idle for longer than
+        // the daemon's transaction timeout
+        void abort_if_abandoned(daemon* d);
+        bool is_read_only();
+        // started here and touches only tables homed in our data center
+        bool is_home_local(daemon* d);
         bool is_durable(uint64_t seqno);
         bool resize_to_hold(uint64_t seqno);
+        // the slot for member idx of the group in the per-member vectors
+        // below, growing them to hold seqno
+        size_t replica_slot(uint64_t seqno, unsigned idx);
+        void mark_dirty(uint64_t seqno);
 
         // key value store utils
-        void acquire_lock(uint64_t seqno, daemon* d);
-        void release_lock(uint64_t seqno, daemon* d);
+        void set_locking(uint64_t seqno, daemon* d);
+        // set an op learned from another member to lock as that member did
+        void replicate_locking(const char* source, uint64_t seqno, uint8_t flags);
+        void adopt_validation_locks(uint64_t seqno);
+        bool start_validation(comm_id id, uint64_t nonce, uint64_t seqno);
+        // read every scan chunk again; true once all have been checked
+        bool validate_scans(daemon* d);
+        void acquire_lock(uint64_t seqno, kvs_lock_batch* batch, daemon* d);
+        void release_lock(uint64_t seqno, kvs_lock_batch* batch, daemon* d);
+        // once the data center votes to commit, with --early-lock-release
+        void release_read_locks(daemon* d);
         void start_read(uint64_t seqno, daemon* d);
         void start_write(uint64_t seqno, daemon* d);
+        // queue a committed write for every read replica
+        void feed_replicas(uint64_t seqno, daemon* d);
         void start_verify_read(uint64_t seqno, daemon* d);
         void start_verify_write(uint64_t seqno, daemon* d);
+        // leave an op on a homed table to the origin
+        void defer_to_home(uint64_t seqno, daemon* d);
+        // the declared key's index in m_declared, or m_declared.size()
+        size_t find_declared(const e::slice& table, const e::slice& key);
+        // the latest read or write before seqno of the same key, if it still
+        // holds the key's lock; else m_ops.size()
+        size_t find_locked_earlier(uint64_t seqno);
+        // lock every declared key in one batch and prefetch those declared
+        // for reading, once locked
+        void acquire_declared(kvs_lock_batch* batch, daemon* d);
+        // true once every declared key no op locked for itself is unlocked
+        bool release_declared(kvs_lock_batch* batch, daemon* d);
 
         // inter-data center
         std::string generate_log_entry(uint64_t seqno);
+        // the log entry, but with only a digest for large written values
+        std::string generate_commit_entry(uint64_t seqno, uint64_t threshold);
+        // true once every member of every other data center has applied the
+        // values our commit record digested
+        bool ship_commit_values(daemon* d);
+        void send_commit_values_ack(comm_id id, daemon* d);
 
         // commit
         void record_disposition_commit(daemon* d);
         void record_disposition_abort(daemon* d);
+        void record_table_stats(const operation& op, table_stats::stat outcome, daemon* d);
 
         // message sending
-        void send_paxos_2a(uint64_t i, daemon* d);
-        void send_paxos_2b(uint64_t i, daemon* d);
+        void send_paxos_2a(const std::vector<uint64_t>& seqnos, daemon* d);
+        // inner is a whole message, from its type on, for g's witnesses to log
+        void send_witnesses(const paxos_group& g, const transaction_group& tg,
+                            const std::string& inner, daemon* d);
+        void send_paxos_2b(const std::vector<uint64_t>& seqnos, daemon* d);
         void send_response(operation* op, daemon* d);
         void send_committed_response(operation* op, daemon* d);
         void send_committed_response(comm_id id, uint64_t nonce, daemon* d);
@@ -193,10 +385,10 @@ class transaction
         void send_tx_begin(operation* op, daemon* d);
         void send_tx_read(operation* op, daemon* d);
         void send_tx_write(operation* op, daemon* d);
+        void send_tx_cond_write(operation* op, daemon* d);
         void send_tx_commit(daemon* d);
         void send_tx_abort(daemon* d);
-        void send_to_group(std::auto_ptr<e::buffer> msg, uint64_t timestamps[CONSUS_MAX_REPLICATION_FACTOR], daemon* d);
-        void send_to_nondurable(uint64_t seqno, std::auto_ptr<e::buffer> msg, uint64_t timestamps[CONSUS_MAX_REPLICATION_FACTOR], daemon* d);
+        void send_single_response(operation* op, daemon* d);
 
     private:
         const transaction_group m_tg;
@@ -208,10 +400,75 @@ class transaction
         size_t m_dcs_sz;
         state_t m_state;
         state_t m_decision;
+        // the state whose span is open, for sampled transactions
+        state_t m_traced_state;
+        uint64_t m_traced_since;
+        // the set this transaction is in, and since when; else NULL
+        inflight* m_inflight;
+        uint64_t m_inflight_since;
+        // where this transaction's tally is open; else NULL
+        message_cost* m_costs;
+        // the last state this transaction was seen to enter, and when
+        state_t m_timed_state;
+        uint64_t m_timed_since;
+        timeline m_timeline;
         uint64_t m_timestamp;
         bool m_prefer_to_commit;
+        // when the client last sent an operation, or 0 if it never has here
+        uint64_t m_client_active;
+        bool m_abandoned;
+        // a client's prepare, held back while optimistic ops are validated
+        bool m_validating;
+        comm_id m_validate_client;
+        uint64_t m_validate_nonce;
+        uint64_t m_validate_seqno;
+        // every chunk of every scan, in the order they were issued
+        std::vector<scanned> m_scans;
         std::vector<operation> m_ops;
+        // every op's table, key, and value
+        op_arena m_arena;
+        // each op's state at each member of m_group, op-major with one slot
+        // per member rather than CONSUS_MAX_REPLICATION_FACTOR per op
+        std::vector<uint8_t> m_durable;
+        std::vector<uint64_t> m_paxos_timestamps;
+        std::vector<uint64_t> m_paxos_2b_timestamps;
+        // slots whose 2A went out more than once; by Karn's rule their 2B
+        // cannot be matched to a send, so it yields no RTT sample
+        std::vector<uint8_t> m_paxos_resent;
+        // ops already sent to m_group's witnesses, which never answer
+        std::vector<uint8_t> m_witnessed;
+        // every op below m_ops_executed is durable and answered, and every op
+        // below m_ops_finished is written and unlocked, so each pass starts
+        // there; ops under the watermark that an event touched wait in
+        // m_ops_dirty for one more look
+        size_t m_ops_executed;
+        size_t m_ops_finished;
+        std::vector<uint64_t> m_ops_dirty;
+        // the keys declared at begin, sorted by table and key; only the
+        // member the client began with locks them ahead of the ops, but
+        // every member releases them
+        std::vector<declared> m_declared;
+        bool m_declared_here;
+        // the first prepare or abort; nothing may follow it
+        uint64_t m_ops_end;
+        // the last time the commit vote walked the ops to resend them
+        uint64_t m_vote_resent;
         std::vector<std::pair<comm_id, uint64_t> > m_deferred_2b;
+        // the commit record shipped to other data centers, built once and
+        // split into chunks of about COMMIT_RECORD_CHUNK_BYTES each
+        std::vector<std::string> m_commit_record;
+        size_t m_commit_record_ops;
+        // elsewhere, the chunks of a commit record received so far
+        std::vector<std::pair<e::slice, e::compat::shared_ptr<e::buffer> > > m_commit_chunks;
+        uint64_t m_commit_chunks_ops;
+        size_t m_commit_chunks_received;
+        // at the origin, members of other data centers that have applied the
+        // digested values; elsewhere, whether any values came by digest
+        std::vector<comm_id> m_values_acked;
+        bool m_values_fetched;
+        // a single-key operation rather than a transaction, and which
+        bool m_single;
+        single_t m_single_kind;
 
     private:
         transaction(const transaction&);
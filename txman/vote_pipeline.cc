@@ -0,0 +1,186 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <sstream>
+
+// consus
+#include "txman/vote_pipeline.h"
+
+using consus::vote_pipeline;
+
+// votes in one batch; a full batch goes out without waiting for the window
+#define VOTE_PIPELINE_DEPTH 128
+
+vote_pipeline :: vote :: vote()
+    : tg()
+    , idx(0)
+    , p()
+{
+}
+
+vote_pipeline :: vote :: vote(const transaction_group& _tg, unsigned _idx, const paxos_synod::pvalue& _p)
+    : tg(_tg)
+    , idx(_idx)
+    , p(_p)
+{
+}
+
+vote_pipeline :: vote :: vote(const vote& other)
+    : tg(other.tg)
+    , idx(other.idx)
+    , p(other.p)
+{
+}
+
+vote_pipeline :: vote :: ~vote() throw ()
+{
+}
+
+vote_pipeline::vote&
+vote_pipeline :: vote :: operator = (const vote& rhs)
+{
+    // no self-assign check needed
+    tg = rhs.tg;
+    idx = rhs.idx;
+    p = rhs.p;
+    return *this;
+}
+
+vote_pipeline :: vote_pipeline()
+    : m_window(0)
+    , m_mtx()
+    , m_pending()
+    , m_batches(0)
+    , m_votes(0)
+{
+}
+
+vote_pipeline :: ~vote_pipeline() throw ()
+{
+}
+
+void
+vote_pipeline :: set_window(uint64_t window)
+{
+    m_window = window;
+}
+
+bool
+vote_pipeline :: append(paxos_group_id g, const transaction_group& tg,
+                        unsigned idx, const paxos_synod::pvalue& p)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::vector<vote>* votes = &m_pending[g];
+    votes->push_back(vote(tg, idx, p));
+    return votes->size() >= VOTE_PIPELINE_DEPTH;
+}
+
+void
+vote_pipeline :: take(paxos_group_id g, batch_map_t* batches)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    batch_map_t::iterator it = m_pending.find(g);
+
+    if (it == m_pending.end() || it->second.empty())
+    {
+        return;
+    }
+
+    taken(it->second);
+    (*batches)[g].swap(it->second);
+    m_pending.erase(it);
+}
+
+void
+vote_pipeline :: take_all(batch_map_t* batches)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (batch_map_t::iterator it = m_pending.begin();
+            it != m_pending.end(); ++it)
+    {
+        taken(it->second);
+    }
+
+    batches->swap(m_pending);
+    m_pending.clear();
+}
+
+std::string
+vote_pipeline :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "window=" << m_window << "ns"
+         << " batches=" << m_batches
+         << " votes=" << m_votes;
+
+    if (m_batches > 0)
+    {
+        ostr << " votes/batch=" << double(m_votes) / m_batches;
+    }
+
+    ostr << "\n";
+
+    for (batch_map_t::iterator it = m_pending.begin();
+            it != m_pending.end(); ++it)
+    {
+        ostr << it->first << " pending=" << it->second.size() << "\n";
+    }
+
+    return ostr.str();
+}
+
+void
+vote_pipeline :: taken(const std::vector<vote>& votes)
+{
+    if (!votes.empty())
+    {
+        ++m_batches;
+        m_votes += votes.size();
+    }
+}
+
+e::packer
+consus :: operator << (e::packer pa, const vote_pipeline::vote& rhs)
+{
+    return pa << rhs.tg << rhs.idx << rhs.p;
+}
+
+e::unpacker
+consus :: operator >> (e::unpacker up, vote_pipeline::vote& rhs)
+{
+    return up >> rhs.tg >> rhs.idx >> rhs.p;
+}
+
+size_t
+consus :: pack_size(const vote_pipeline::vote& v)
+{
+    return pack_size(v.tg) + sizeof(uint8_t) + pack_size(v.p);
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef consus_txman_vote_pipeline_h_
+#define consus_txman_vote_pipeline_h_
+
+// STL
+#include <map>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "common/transaction_group.h"
+#include "txman/paxos_synod.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Holds the phase 2 requests each member sends for its own vote instance.
+// Every member leads its own instance from the implicit ballot, so in the
+// common case a group's members are stable leaders and their votes need no
+// phase 1.  Rather than send a message per transaction, the votes bound for
+// one paxos group are held for up to a window and sent as one batch; the
+// acceptors answer a batch with one batch once every vote in it is durable.
+class vote_pipeline
+{
+    public:
+        struct vote
+        {
+            vote();
+            vote(const transaction_group& tg, unsigned idx, const paxos_synod::pvalue& p);
+            vote(const vote& other);
+            ~vote() throw ();
+            vote& operator = (const vote& rhs);
+
+            transaction_group tg;
+            uint8_t idx;
+            paxos_synod::pvalue p;
+        };
+        typedef std::map<paxos_group_id, std::vector<vote> > batch_map_t;
+
+    public:
+        vote_pipeline();
+        ~vote_pipeline() throw ();
+
+    public:
+        void set_window(uint64_t window);
+        bool enabled() const { return m_window > 0; }
+        uint64_t window() const { return m_window; }
+        // true if the group's batch is full and should be sent right away
+        bool append(paxos_group_id g, const transaction_group& tg,
+                    unsigned idx, const paxos_synod::pvalue& p);
+        void take(paxos_group_id g, batch_map_t* batches);
+        void take_all(batch_map_t* batches);
+        std::string debug_dump();
+
+    private:
+        void taken(const std::vector<vote>& votes);
+
+    private:
+        uint64_t m_window;
+        po6::threads::mutex m_mtx;
+        batch_map_t m_pending;
+        uint64_t m_batches;
+        uint64_t m_votes;
+
+    private:
+        vote_pipeline(const vote_pipeline&);
+        vote_pipeline& operator = (const vote_pipeline&);
+};
+
+e::packer
+operator << (e::packer pa, const vote_pipeline::vote& rhs);
+e::unpacker
+operator >> (e::unpacker up, vote_pipeline::vote& rhs);
+size_t
+pack_size(const vote_pipeline::vote& v);
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_vote_pipeline_h_
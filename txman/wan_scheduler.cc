@@ -0,0 +1,211 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "txman/wan_scheduler.h"
+
+using consus::wan_scheduler;
+
+#define WAN_CLASSES 2
+// bytes a class may send per round for each unit of weight
+#define WAN_QUANTUM (16 * 1024)
+// how much unused rate a data center may bank, in nanoseconds' worth
+#define WAN_BURST (10 * PO6_MILLIS)
+// beyond this many queued bytes per data center new bulk messages are
+// dropped; whoever sent them retransmits
+#define WAN_MAX_QUEUED_BYTES (64ULL * 1024ULL * 1024ULL)
+
+// shipped values finish transactions; retransmissions mostly repeat what
+// is already on its way
+static const uint64_t s_weights[WAN_CLASSES] = {3, 1};
+
+struct wan_scheduler::link
+{
+    typedef std::deque<std::pair<comm_id, e::buffer*> > queue_t;
+
+    link();
+    ~link() throw ();
+
+    queue_t queues[WAN_CLASSES];
+    uint64_t deficits[WAN_CLASSES];
+    // the class being served, and whether it got its quantum this round
+    unsigned current;
+    bool credited;
+    uint64_t queued;
+    // may go negative when a message larger than the balance is sent
+    int64_t tokens;
+    uint64_t refilled;
+    uint64_t sent;
+    uint64_t dropped;
+
+    private:
+        link(const link&);
+        link& operator = (const link&);
+};
+
+wan_scheduler :: link :: link()
+    : current(0)
+    , credited(false)
+    , queued(0)
+    , tokens(0)
+    , refilled(0)
+    , sent(0)
+    , dropped(0)
+{
+    for (unsigned i = 0; i < WAN_CLASSES; ++i)
+    {
+        deficits[i] = 0;
+    }
+}
+
+wan_scheduler :: link :: ~link() throw ()
+{
+    for (unsigned i = 0; i < WAN_CLASSES; ++i)
+    {
+        for (size_t j = 0; j < queues[i].size(); ++j)
+        {
+            delete queues[i][j].second;
+        }
+    }
+}
+
+wan_scheduler :: wan_scheduler()
+    : m_rate(0)
+    , m_mtx()
+    , m_links()
+{
+}
+
+wan_scheduler :: ~wan_scheduler() throw ()
+{
+    for (link_map_t::iterator it = m_links.begin(); it != m_links.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+bool
+wan_scheduler :: enqueue(data_center_id dc, comm_id id, traffic_class tc,
+                         std::auto_ptr<e::buffer> msg)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    link*& l(m_links[dc]);
+
+    if (!l)
+    {
+        l = new link();
+        l->refilled = po6::monotonic_time();
+    }
+
+    if (l->queued + msg->size() > WAN_MAX_QUEUED_BYTES)
+    {
+        ++l->dropped;
+        return false;
+    }
+
+    l->queued += msg->size();
+    l->queues[tc].push_back(std::make_pair(id, msg.release()));
+    return true;
+}
+
+void
+wan_scheduler :: dequeue(uint64_t now, coalescer::outbox_t* ready)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    const int64_t burst = std::max(int64_t(1), int64_t(double(m_rate) * WAN_BURST / PO6_SECONDS));
+
+    for (link_map_t::iterator it = m_links.begin(); it != m_links.end(); ++it)
+    {
+        link* l = it->second;
+        const uint64_t elapsed = now > l->refilled ? now - l->refilled : 0;
+        l->tokens = std::min(burst, int64_t(l->tokens + double(m_rate) * elapsed / PO6_SECONDS));
+        l->refilled = now;
+
+        while (l->queued > 0 && l->tokens > 0)
+        {
+            link::queue_t& q(l->queues[l->current]);
+
+            if (q.empty())
+            {
+                l->deficits[l->current] = 0;
+                l->current = (l->current + 1) % WAN_CLASSES;
+                l->credited = false;
+                continue;
+            }
+
+            if (!l->credited)
+            {
+                l->deficits[l->current] += s_weights[l->current] * WAN_QUANTUM;
+                l->credited = true;
+            }
+
+            const size_t sz = q.front().second->size();
+
+            if (l->deficits[l->current] < sz)
+            {
+                l->current = (l->current + 1) % WAN_CLASSES;
+                l->credited = false;
+                continue;
+            }
+
+            ready->push_back(q.front());
+            q.pop_front();
+            l->deficits[l->current] -= sz;
+            l->queued -= sz;
+            l->tokens -= sz;
+            ++l->sent;
+        }
+    }
+}
+
+std::string
+wan_scheduler :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+    ostr << "WAN bulk rate=" << m_rate << "B/s\n";
+
+    for (link_map_t::iterator it = m_links.begin(); it != m_links.end(); ++it)
+    {
+        link* l = it->second;
+        ostr << "data center " << it->first.get()
+             << " queued=" << l->queued
+             << " values=" << l->queues[VALUES].size()
+             << " retransmissions=" << l->queues[RETRANSMISSIONS].size()
+             << " sent=" << l->sent
+             << " dropped=" << l->dropped << "\n";
+    }
+
+    return ostr.str();
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_wan_scheduler_h_
+#define consus_txman_wan_scheduler_h_
+
+// STL
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/buffer.h>
+
+// consus
+#include "namespace.h"
+#include "common/coalescer.h"
+#include "common/ids.h"
+
+BEGIN_CONSUS_NAMESPACE
+
+// Paces bulk traffic to each other data center so that it cannot crowd out
+// the votes and first commit records that a commit waits upon.  Those are
+// never queued here; they go straight to BusyBee.  Bulk messages wait in a
+// queue per data center and traffic class, and are released at a fixed rate
+// per data center, with the classes sharing that rate by deficit round
+// robin in proportion to their weights.
+class wan_scheduler
+{
+    public:
+        enum traffic_class
+        {
+            // values shipped after the commit decision
+            VALUES = 0,
+            // commit records resent to data centers that haven't answered
+            RETRANSMISSIONS = 1
+        };
+
+    public:
+        wan_scheduler();
+        ~wan_scheduler() throw ();
+
+    public:
+        void set_rate(uint64_t bytes_per_second) { m_rate = bytes_per_second; }
+        bool enabled() const { return m_rate > 0; }
+        // queue msg for id in data center dc; false if msg was dropped
+        // because that data center's queue is full
+        bool enqueue(data_center_id dc, comm_id id, traffic_class tc,
+                     std::auto_ptr<e::buffer> msg);
+        // everything the rate allows to leave by now, owned by the caller
+        void dequeue(uint64_t now, coalescer::outbox_t* ready);
+        std::string debug_dump();
+
+    private:
+        struct link;
+        typedef std::map<data_center_id, link*> link_map_t;
+
+    private:
+        uint64_t m_rate;
+        po6::threads::mutex m_mtx;
+        link_map_t m_links;
+
+    private:
+        wan_scheduler(const wan_scheduler&);
+        wan_scheduler& operator = (const wan_scheduler&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_wan_scheduler_h_
@@ -0,0 +1,188 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+
+// STL
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// consus
+#include "txman/witness_store.h"
+
+using consus::witness_store;
+
+witness_store :: witness_store()
+    : m_mtx()
+    , m_held()
+    , m_recnos()
+{
+}
+
+witness_store :: ~witness_store() throw ()
+{
+}
+
+void
+witness_store :: hold(const transaction_group& tg, comm_id sender,
+                      const e::slice& inner, int64_t recno, uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_held.insert(std::make_pair(recno, message(tg, sender, inner, now)));
+    m_recnos[tg].push_back(recno);
+}
+
+void
+witness_store :: forget(const transaction_group& tg)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    drop_locked(tg);
+}
+
+void
+witness_store :: take(paxos_group_id g, std::vector<message>* msgs)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::vector<int64_t> recnos;
+
+    for (recno_map_t::iterator it = m_recnos.begin(); it != m_recnos.end(); )
+    {
+        if (it->first.group != g)
+        {
+            ++it;
+            continue;
+        }
+
+        recnos.insert(recnos.end(), it->second.begin(), it->second.end());
+        m_recnos.erase(it++);
+    }
+
+    std::sort(recnos.begin(), recnos.end());
+
+    for (size_t i = 0; i < recnos.size(); ++i)
+    {
+        held_map_t::iterator it = m_held.find(recnos[i]);
+        assert(it != m_held.end());
+        msgs->push_back(it->second);
+        m_held.erase(it);
+    }
+}
+
+void
+witness_store :: groups(std::vector<paxos_group_id>* gs)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::set<paxos_group_id> seen;
+
+    for (recno_map_t::iterator it = m_recnos.begin(); it != m_recnos.end(); ++it)
+    {
+        if (seen.insert(it->first.group).second)
+        {
+            gs->push_back(it->first.group);
+        }
+    }
+}
+
+size_t
+witness_store :: sweep(uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::vector<transaction_group> expired;
+
+    // records are appended in the order messages arrive, so the oldest
+    // messages come first
+    for (held_map_t::iterator it = m_held.begin(); it != m_held.end(); ++it)
+    {
+        if (it->second.when + WITNESS_RETENTION > now)
+        {
+            break;
+        }
+
+        expired.push_back(it->second.tg);
+    }
+
+    const size_t before = m_held.size();
+
+    for (size_t i = 0; i < expired.size(); ++i)
+    {
+        drop_locked(expired[i]);
+    }
+
+    return before - m_held.size();
+}
+
+int64_t
+witness_store :: retain(int64_t lower_bound)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_held.empty())
+    {
+        lower_bound = std::min(lower_bound, m_held.begin()->first);
+    }
+
+    return lower_bound;
+}
+
+std::string
+witness_store :: debug_dump()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::ostringstream ostr;
+
+    if (!m_held.empty())
+    {
+        ostr << "holding " << m_held.size() << " messages for "
+             << m_recnos.size() << " transactions from record "
+             << m_held.begin()->first << "\n";
+    }
+
+    return ostr.str();
+}
+
+void
+witness_store :: drop_locked(const transaction_group& tg)
+{
+    recno_map_t::iterator it = m_recnos.find(tg);
+
+    if (it == m_recnos.end())
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < it->second.size(); ++i)
+    {
+        m_held.erase(it->second[i]);
+    }
+
+    m_recnos.erase(it);
+}
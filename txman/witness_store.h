@@ -0,0 +1,122 @@
+// Copyright (c) 2016, Robert Escriva, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Consus nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef consus_txman_witness_store_h_
+#define consus_txman_witness_store_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/slice.h>
+
+// consus
+#include "namespace.h"
+#include "common/ids.h"
+#include "common/transaction_group.h"
+
+// what a witness holds for a transaction is dropped this long after it
+// arrives, should the group never say the transaction is finished
+#define WITNESS_RETENTION (PO6_SECONDS * 300)
+
+BEGIN_CONSUS_NAMESPACE
+
+// What this transaction manager holds as a witness of other groups.
+//
+// A witness is sent each operation a group's leader proposes and each commit
+// record bound for the group, exactly as the members are, but it neither
+// votes nor acknowledges.  It logs every message, whole, and holds it here
+// until the group reports the transaction finished.  Should the coordinator
+// promote it into the group, it feeds what it holds through its own state
+// machines as if the messages had only just arrived, and catches up from
+// there as any member would.
+//
+// Held messages pin the log records that carry them, so that a restarted
+// witness can hold them again.
+class witness_store
+{
+    public:
+        struct message
+        {
+            message() : tg(), sender(), inner(), when(0) {}
+            message(const transaction_group& t, comm_id s, const e::slice& i, uint64_t w)
+                : tg(t), sender(s), inner(i.cdata(), i.size()), when(w) {}
+            transaction_group tg;
+            comm_id sender;
+            // the message as the members got it, from its type on
+            std::string inner;
+            uint64_t when;
+        };
+
+    public:
+        witness_store();
+        ~witness_store() throw ();
+
+    public:
+        // inner was logged as recno
+        void hold(const transaction_group& tg, comm_id sender,
+                  const e::slice& inner, int64_t recno, uint64_t now);
+        void forget(const transaction_group& tg);
+        // take what is held for g, in the order it arrived
+        void take(paxos_group_id g, std::vector<message>* msgs);
+        // every group something is held for
+        void groups(std::vector<paxos_group_id>* gs);
+        // drop what has been held for WITNESS_RETENTION; returns how much
+        size_t sweep(uint64_t now);
+        // lower the bound to the first record held
+        int64_t retain(int64_t lower_bound);
+
+    public:
+        std::string debug_dump();
+
+    private:
+        typedef std::map<int64_t, message> held_map_t;
+        typedef std::map<transaction_group, std::vector<int64_t> > recno_map_t;
+        void drop_locked(const transaction_group& tg);
+
+    private:
+        po6::threads::mutex m_mtx;
+        // by the record that logged each
+        held_map_t m_held;
+        recno_map_t m_recnos;
+
+    private:
+        witness_store(const witness_store&);
+        witness_store& operator = (const witness_store&);
+};
+
+END_CONSUS_NAMESPACE
+
+#endif // consus_txman_witness_store_h_